@@ -0,0 +1,104 @@
+#include "crpropa/Grid.h"
+#include "crpropa/GridTools.h"
+#include "crpropa/Random.h"
+
+#include "benchmark/benchmark.h"
+
+#include <vector>
+
+namespace crpropa {
+
+// 64^3 grid with random values and positions inside of it
+static ref_ptr<VectorGrid> randomGrid() {
+	ref_ptr<VectorGrid> grid = new VectorGrid(Vector3d(0.), 64, 1.);
+	Random random(42);
+	for (size_t ix = 0; ix < 64; ix++)
+		for (size_t iy = 0; iy < 64; iy++)
+			for (size_t iz = 0; iz < 64; iz++)
+				grid->get(ix, iy, iz) = Vector3f(random.rand(), random.rand(),
+						random.rand());
+	return grid;
+}
+
+static std::vector<Vector3d> randomPositions(size_t n) {
+	std::vector<Vector3d> positions(n);
+	Random random(43);
+	for (size_t i = 0; i < n; i++)
+		positions[i] = Vector3d(random.rand(64), random.rand(64), random.rand(64));
+	return positions;
+}
+
+static void Grid_interpolate(benchmark::State &state) {
+	ref_ptr<VectorGrid> grid = randomGrid();
+	grid->setBricked(state.range(0));
+	std::vector<Vector3d> positions = randomPositions(4096);
+	size_t i = 0;
+	while (state.KeepRunning()) {
+		benchmark::DoNotOptimize(grid->interpolate(positions[i]));
+		i = (i + 1) % positions.size();
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+// argument: bricked storage
+BENCHMARK(Grid_interpolate)->Arg(0)->Arg(1);
+
+static void QuantizedGrid_interpolate(benchmark::State &state) {
+	ref_ptr<QuantizedVectorGrid> grid = quantizeGrid(randomGrid());
+	std::vector<Vector3d> positions = randomPositions(4096);
+	size_t i = 0;
+	while (state.KeepRunning()) {
+		benchmark::DoNotOptimize(grid->interpolate(positions[i]));
+		i = (i + 1) % positions.size();
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(QuantizedGrid_interpolate);
+
+static void Random_rand(benchmark::State &state) {
+	Random random(42);
+	while (state.KeepRunning())
+		benchmark::DoNotOptimize(random.rand());
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(Random_rand);
+
+static void Random_randNorm(benchmark::State &state) {
+	Random random(42);
+	while (state.KeepRunning())
+		benchmark::DoNotOptimize(random.randNorm());
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(Random_randNorm);
+
+static void Random_randVector(benchmark::State &state) {
+	Random random(42);
+	while (state.KeepRunning())
+		benchmark::DoNotOptimize(random.randVector());
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(Random_randVector);
+
+// argument: numbers per call
+static void Random_fill(benchmark::State &state) {
+	Random random(42);
+	std::vector<double> values(state.range(0));
+	while (state.KeepRunning()) {
+		random.fill(&values[0], values.size());
+		benchmark::DoNotOptimize(values[0]);
+	}
+	state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(Random_fill)->Arg(64)->Arg(4096);
+
+static void Random_fillNorm(benchmark::State &state) {
+	Random random(42);
+	std::vector<double> values(state.range(0));
+	while (state.KeepRunning()) {
+		random.fillNorm(&values[0], values.size());
+		benchmark::DoNotOptimize(values[0]);
+	}
+	state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(Random_fillNorm)->Arg(64)->Arg(4096);
+
+} // namespace crpropa
@@ -0,0 +1,103 @@
+#include "crpropa/Candidate.h"
+#include "crpropa/ParticleID.h"
+#include "crpropa/Units.h"
+#include "crpropa/module/EMDoublePairProduction.h"
+#include "crpropa/module/EMInverseComptonScattering.h"
+#include "crpropa/module/EMPairProduction.h"
+#include "crpropa/module/EMTripletPairProduction.h"
+#include "crpropa/module/ElasticScattering.h"
+#include "crpropa/module/ElectronPairProduction.h"
+#include "crpropa/module/NuclearDecay.h"
+#include "crpropa/module/PhotoDisintegration.h"
+#include "crpropa/module/PhotoPionProduction.h"
+#include "crpropa/module/SynchrotronRadiation.h"
+
+#include "benchmark/benchmark.h"
+
+#include <stdexcept>
+
+namespace crpropa {
+
+typedef Module *(*ModuleFactory)();
+
+static Module *electronPairProduction() {
+	return new ElectronPairProduction(CMB, true);
+}
+static Module *photoPionProduction() {
+	return new PhotoPionProduction(CMB, true, true, true);
+}
+static Module *photoDisintegration() {
+	return new PhotoDisintegration(CMB, true);
+}
+static Module *nuclearDecay() {
+	return new NuclearDecay(true, true, true);
+}
+static Module *elasticScattering() {
+	return new ElasticScattering(CMB);
+}
+static Module *emPairProduction() {
+	return new EMPairProduction(CMB, true);
+}
+static Module *emDoublePairProduction() {
+	return new EMDoublePairProduction(URB_Protheroe96, true);
+}
+static Module *emInverseComptonScattering() {
+	return new EMInverseComptonScattering(CMB, true);
+}
+static Module *emTripletPairProduction() {
+	return new EMTripletPairProduction(CMB, true);
+}
+static Module *synchrotronRadiation() {
+	return new SynchrotronRadiation(1 * muG, true);
+}
+
+/**
+ One step of the interaction module for a particle of the given ID and energy.
+ The candidate is reset after each step and its secondaries are dropped, so
+ that every iteration starts from the same state. The benchmark is skipped
+ if the module cannot load its data files.
+ */
+static void interaction(benchmark::State &state, ModuleFactory factory, int id,
+		double energy) {
+	ref_ptr<Module> module;
+	try {
+		module = factory();
+	} catch (std::runtime_error &e) {
+		state.SkipWithError(e.what());
+		return;
+	}
+	Candidate c(id, energy);
+	while (state.KeepRunning()) {
+		c.current.setId(id);
+		c.current.setEnergy(energy);
+		c.setActive(true);
+		c.setCurrentStep(10 * Mpc);
+		c.setNextStep(10 * Mpc);
+		module->process(&c);
+		c.secondaries.clear();
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK_CAPTURE(interaction, ElectronPairProduction, electronPairProduction,
+		nucleusId(1, 1), 100 * EeV);
+BENCHMARK_CAPTURE(interaction, PhotoPionProduction, photoPionProduction,
+		nucleusId(1, 1), 100 * EeV);
+BENCHMARK_CAPTURE(interaction, PhotoDisintegration, photoDisintegration,
+		nucleusId(56, 26), 100 * EeV);
+BENCHMARK_CAPTURE(interaction, NuclearDecay, nuclearDecay,
+		nucleusId(1, 0), 1 * EeV);
+BENCHMARK_CAPTURE(interaction, ElasticScattering, elasticScattering,
+		nucleusId(12, 6), 100 * EeV);
+BENCHMARK_CAPTURE(interaction, EMPairProduction, emPairProduction,
+		22, 1 * EeV);
+BENCHMARK_CAPTURE(interaction, EMDoublePairProduction, emDoublePairProduction,
+		22, 1 * EeV);
+BENCHMARK_CAPTURE(interaction, EMInverseComptonScattering,
+		emInverseComptonScattering, 11, 1 * EeV);
+BENCHMARK_CAPTURE(interaction, EMTripletPairProduction,
+		emTripletPairProduction, 11, 1 * EeV);
+BENCHMARK_CAPTURE(interaction, SynchrotronRadiation, synchrotronRadiation,
+		nucleusId(1, 1), 100 * EeV);
+
+} // namespace crpropa
@@ -0,0 +1,36 @@
+#include "crpropa/Random.h"
+#include "crpropa/Units.h"
+#include "crpropa/magneticLens/MagneticLens.h"
+
+#include "benchmark/benchmark.h"
+
+#include <vector>
+
+namespace crpropa {
+
+// lens of healpix order 5 mapping each direction to a random one
+static void MagneticLens_transformCosmicRay(benchmark::State &state) {
+	MagneticLens lens(5);
+	Pixelization P(5);
+	ModelMatrixType M;
+	M.resize(P.nPix(), P.nPix());
+	M.reserve(P.nPix());
+	Random random(42);
+	for (int i = 0; i < P.nPix(); i++)
+		M.insert(i, random.randInt(P.nPix() - 1)) = 1;
+	lens.setLensPart(M, 10 * EeV, 100 * EeV);
+
+	std::vector<Vector3d> directions(4096);
+	for (size_t i = 0; i < directions.size(); i++)
+		directions[i] = random.randVector();
+	size_t i = 0;
+	while (state.KeepRunning()) {
+		Vector3d p = directions[i];
+		benchmark::DoNotOptimize(lens.transformCosmicRay(20 * EeV, p));
+		i = (i + 1) % directions.size();
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(MagneticLens_transformCosmicRay);
+
+} // namespace crpropa
@@ -0,0 +1,46 @@
+#include "crpropa/Candidate.h"
+#include "crpropa/ParticleID.h"
+#include "crpropa/Units.h"
+#include "crpropa/module/HDF5Output.h"
+#include "crpropa/module/TextOutput.h"
+
+#include "benchmark/benchmark.h"
+
+#include <cstdio>
+
+namespace crpropa {
+
+static Candidate candidate() {
+	Candidate c(nucleusId(1, 1), 10 * EeV, Vector3d(1 * Mpc, 2 * Mpc, 3 * Mpc),
+			Vector3d(1, 0, 0));
+	c.setTrajectoryLength(10 * Mpc);
+	return c;
+}
+
+// argument: Output::OutputType
+static void TextOutput_process(benchmark::State &state) {
+	TextOutput output("/dev/null", Output::OutputType(state.range(0)));
+	Candidate c = candidate();
+	while (state.KeepRunning())
+		output.process(&c);
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(TextOutput_process)->Arg(Output::Trajectory3D)->Arg(Output::Event3D);
+
+#ifdef CRPROPA_HAVE_HDF5
+static void HDF5Output_process(benchmark::State &state) {
+	const char *filename = "benchmark_HDF5Output.h5";
+	{
+		HDF5Output output(filename, Output::OutputType(state.range(0)));
+		Candidate c = candidate();
+		while (state.KeepRunning())
+			output.process(&c);
+		output.close();
+	}
+	std::remove(filename);
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(HDF5Output_process)->Arg(Output::Trajectory3D)->Arg(Output::Event3D);
+#endif
+
+} // namespace crpropa
@@ -0,0 +1,94 @@
+#include "crpropa/Candidate.h"
+#include "crpropa/ParticleID.h"
+#include "crpropa/Random.h"
+#include "crpropa/Units.h"
+#include "crpropa/magneticField/MagneticFieldGrid.h"
+#include "crpropa/module/DiffusionSDE.h"
+#include "crpropa/module/PropagationCK.h"
+
+#include "benchmark/benchmark.h"
+
+#include <vector>
+
+namespace crpropa {
+
+// random field of 1 nG on a periodic 64^3 grid with 100 kpc spacing
+static ref_ptr<MagneticField> gridField() {
+	ref_ptr<VectorGrid> grid = new VectorGrid(Vector3d(0.), 64, 100 * kpc);
+	Random random(42);
+	for (size_t ix = 0; ix < 64; ix++)
+		for (size_t iy = 0; iy < 64; iy++)
+			for (size_t iz = 0; iz < 64; iz++)
+				grid->get(ix, iy, iz) = Vector3f(random.randVector() * nG);
+	return new MagneticFieldGrid(grid);
+}
+
+static ref_ptr<MagneticField> uniformField() {
+	return new UniformMagneticField(Vector3d(0, 0, 1 * nG));
+}
+
+static Candidate proton() {
+	Candidate c(nucleusId(1, 1), 10 * EeV, Vector3d(3 * Mpc), Vector3d(1, 0, 0));
+	c.setNextStep(10 * kpc);
+	return c;
+}
+
+// argument: 0 uniform field, 1 grid field
+static void PropagationCK_process(benchmark::State &state) {
+	PropagationCK propa(state.range(0) ? gridField() : uniformField());
+	Candidate c = proton();
+	while (state.KeepRunning()) {
+		propa.process(&c);
+		c.setNextStep(10 * kpc);
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(PropagationCK_process)->Arg(0)->Arg(1);
+
+// argument: candidates per batch
+static void PropagationCK_processBatch(benchmark::State &state) {
+	PropagationCK propa(gridField());
+	std::vector<Candidate> candidates(state.range(0), proton());
+	std::vector<Candidate *> pointers(candidates.size());
+	for (size_t i = 0; i < candidates.size(); i++) {
+		candidates[i].current.setPosition(Vector3d(i * 100 * kpc, 0, 0));
+		pointers[i] = &candidates[i];
+	}
+	while (state.KeepRunning()) {
+		propa.processBatch(&pointers[0], pointers.size());
+		for (size_t i = 0; i < candidates.size(); i++)
+			candidates[i].setNextStep(10 * kpc);
+	}
+	state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(PropagationCK_processBatch)->Arg(64);
+
+static void DiffusionSDE_process(benchmark::State &state) {
+	DiffusionSDE diffusion(state.range(0) ? gridField() : uniformField());
+	Candidate c = proton();
+	while (state.KeepRunning()) {
+		diffusion.process(&c);
+		c.setNextStep(10 * pc);
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(DiffusionSDE_process)->Arg(0)->Arg(1);
+
+static void DiffusionSDE_processBatch(benchmark::State &state) {
+	DiffusionSDE diffusion(gridField());
+	std::vector<Candidate> candidates(state.range(0), proton());
+	std::vector<Candidate *> pointers(candidates.size());
+	for (size_t i = 0; i < candidates.size(); i++) {
+		candidates[i].current.setPosition(Vector3d(i * 100 * kpc, 0, 0));
+		pointers[i] = &candidates[i];
+	}
+	while (state.KeepRunning()) {
+		diffusion.processBatch(&pointers[0], pointers.size());
+		for (size_t i = 0; i < candidates.size(); i++)
+			candidates[i].setNextStep(10 * pc);
+	}
+	state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(DiffusionSDE_processBatch)->Arg(64);
+
+} // namespace crpropa
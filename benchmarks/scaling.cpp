@@ -0,0 +1,239 @@
+/*
+ End-to-end scaling of canonical simulation setups.
+
+ Each setup is run with 1, 2, 4, ... up to the given number of threads and
+ profiling enabled, see ModuleList::setProfiling. For each run the
+ throughput of primaries, steps (calls of the first module) and secondaries,
+ the strong-scaling efficiency T(1) / (n T(n)) and the time of each module,
+ summed over the threads, are reported. Modules with a time per call that
+ grows with the number of threads wait for shared resources, e.g. the
+ critical sections of outputs.
+
+ Usage: scaling [maximum threads] [primaries] [result file (scaling.json)]
+ */
+
+#include "crpropa/Clock.h"
+#include "crpropa/ModuleList.h"
+#include "crpropa/ParticleID.h"
+#include "crpropa/Source.h"
+#include "crpropa/Units.h"
+#include "crpropa/GridTools.h"
+#include "crpropa/magneticField/JF12Field.h"
+#include "crpropa/magneticField/MagneticFieldGrid.h"
+#include "crpropa/magneticField/PlaneWaveTurbulence.h"
+#include "crpropa/module/Boundary.h"
+#include "crpropa/module/BreakCondition.h"
+#include "crpropa/module/EMDoublePairProduction.h"
+#include "crpropa/module/EMInverseComptonScattering.h"
+#include "crpropa/module/EMPairProduction.h"
+#include "crpropa/module/EMTripletPairProduction.h"
+#include "crpropa/module/ElectronPairProduction.h"
+#include "crpropa/module/NuclearDecay.h"
+#include "crpropa/module/Observer.h"
+#include "crpropa/module/PhotoDisintegration.h"
+#include "crpropa/module/PhotoPionProduction.h"
+#include "crpropa/module/PropagationCK.h"
+#include "crpropa/module/Redshift.h"
+#include "crpropa/module/SimplePropagation.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace crpropa;
+
+struct Setup {
+	ref_ptr<ModuleList> sim;
+	ref_ptr<Source> source;
+};
+
+// 1D propagation of iron nuclei over 100 Mpc with all nuclear interactions
+static Setup uhecr1D() {
+	Setup s;
+	s.sim = new ModuleList();
+	s.sim->add(new SimplePropagation(1 * kpc, 10 * Mpc));
+	s.sim->add(new Redshift());
+	s.sim->add(new PhotoPionProduction(CMB));
+	s.sim->add(new PhotoPionProduction(IRB_Gilmore12));
+	s.sim->add(new PhotoDisintegration(CMB));
+	s.sim->add(new PhotoDisintegration(IRB_Gilmore12));
+	s.sim->add(new ElectronPairProduction(CMB));
+	s.sim->add(new ElectronPairProduction(IRB_Gilmore12));
+	s.sim->add(new NuclearDecay());
+	s.sim->add(new MinimumEnergy(1 * EeV));
+	ref_ptr<Observer> observer = new Observer();
+	observer->add(new ObserverPoint());
+	s.sim->add(observer);
+
+	s.source = new Source();
+	s.source->add(new SourcePosition(100 * Mpc));
+	s.source->add(new SourceDirection());
+	s.source->add(new SourceParticleType(nucleusId(56, 26)));
+	s.source->add(new SourcePowerLawSpectrum(1 * EeV, 1000 * EeV, -1));
+	return s;
+}
+
+// protons in a turbulent field of 1 nG sampled on a periodic 64^3 grid
+static Setup turbulentGrid3D() {
+	ref_ptr<VectorGrid> grid = new VectorGrid(Vector3d(0.), 64, 50 * kpc);
+	fromMagneticField(grid, new PlaneWaveTurbulence(1 * nG, 100 * kpc, 1 * Mpc));
+
+	Setup s;
+	s.sim = new ModuleList();
+	s.sim->add(new PropagationCK(new MagneticFieldGrid(grid)));
+	s.sim->add(new MaximumTrajectoryLength(100 * Mpc));
+	s.sim->add(new SphericalBoundary(Vector3d(0.), 20 * Mpc));
+
+	s.source = new Source();
+	s.source->add(new SourcePosition(Vector3d(0.)));
+	s.source->add(new SourceIsotropicEmission());
+	s.source->add(new SourceParticleType(nucleusId(1, 1)));
+	s.source->add(new SourcePowerLawSpectrum(1 * EeV, 100 * EeV, -1));
+	return s;
+}
+
+// antiprotons from Earth out of the Galaxy in the JF12 field
+static Setup galacticBacktracking() {
+	Setup s;
+	s.sim = new ModuleList();
+	s.sim->add(new PropagationCK(new JF12Field(), 1e-4, 0.1 * pc, 100 * pc));
+	s.sim->add(new SphericalBoundary(Vector3d(0.), 20 * kpc));
+
+	s.source = new Source();
+	s.source->add(new SourcePosition(Vector3d(-8.5 * kpc, 0, 0)));
+	s.source->add(new SourceIsotropicEmission());
+	s.source->add(new SourceParticleType(-nucleusId(1, 1)));
+	s.source->add(new SourcePowerLawSpectrum(1 * EeV, 100 * EeV, -1));
+	return s;
+}
+
+// electromagnetic cascades of photons over 10 Mpc
+static Setup emCascade() {
+	Setup s;
+	s.sim = new ModuleList();
+	s.sim->add(new SimplePropagation(1 * kpc, 1 * Mpc));
+	s.sim->add(new EMPairProduction(CMB, true));
+	s.sim->add(new EMPairProduction(IRB_Gilmore12, true));
+	s.sim->add(new EMDoublePairProduction(CMB, true));
+	s.sim->add(new EMTripletPairProduction(CMB, true));
+	s.sim->add(new EMInverseComptonScattering(CMB, true));
+	s.sim->add(new MinimumEnergy(1 * EeV));
+	ref_ptr<Observer> observer = new Observer();
+	observer->add(new ObserverPoint());
+	s.sim->add(observer);
+
+	s.source = new Source();
+	s.source->add(new SourcePosition(10 * Mpc));
+	s.source->add(new SourceDirection());
+	s.source->add(new SourceParticleType(22));
+	s.source->add(new SourcePowerLawSpectrum(10 * EeV, 1000 * EeV, -1));
+	return s;
+}
+
+static std::string jsonString(const std::string &s) {
+	std::stringstream ss;
+	ss << '"';
+	for (size_t i = 0; i < s.size(); i++) {
+		if (s[i] == '"' || s[i] == '\\')
+			ss << '\\' << s[i];
+		else if (s[i] == '\n')
+			ss << "\\n";
+		else
+			ss << s[i];
+	}
+	ss << '"';
+	return ss.str();
+}
+
+// run the setup at each thread count and write its JSON object
+static void scale(const std::string &name, Setup (*create)(),
+		const std::vector<int> &threads, size_t primaries, std::ostream &json) {
+	Setup s;
+	try {
+		s = create();
+	} catch (std::runtime_error &e) {
+		// e.g. data files not installed
+		std::cout << name << " skipped: " << e.what() << std::endl;
+		json << "{\"setup\": " << jsonString(name) << ", \"skipped\": "
+				<< jsonString(e.what()) << "}";
+		return;
+	}
+
+	std::cout << "\n" << name << "\n"
+			<< "threads  time [s]  primaries/s  steps/s  secondaries/s  efficiency\n";
+	json << "{\"setup\": " << jsonString(name) << ", \"primaries\": "
+			<< primaries << ", \"runs\": [";
+	s.sim->setProfiling(true);
+	double time1 = 0;
+	for (size_t r = 0; r < threads.size(); r++) {
+#ifdef _OPENMP
+		omp_set_num_threads(threads[r]);
+#endif
+		s.sim->resetProfile();
+		Clock clock;
+		clock.reset();
+		s.sim->run(s.source, primaries);
+		double time = clock.getSecond();
+		if (r == 0)
+			time1 = time * threads[0];
+		double efficiency = time1 / (threads[r] * time);
+
+		size_t steps = s.sim->getProfileCalls(0);
+		size_t secondaries = 0;
+		for (size_t i = 0; i < s.sim->size(); i++)
+			secondaries += s.sim->getProfileSecondaries(i);
+
+		std::cout << threads[r] << "  " << time << "  " << primaries / time
+				<< "  " << steps / time << "  " << secondaries / time << "  "
+				<< efficiency << std::endl;
+		json << (r ? ", " : "") << "{\"threads\": " << threads[r]
+				<< ", \"time\": " << time << ", \"primaries_per_second\": "
+				<< primaries / time << ", \"steps_per_second\": " << steps / time
+				<< ", \"secondaries_per_second\": " << secondaries / time
+				<< ", \"efficiency\": " << efficiency << ", \"modules\": [";
+		for (size_t i = 0; i < s.sim->size(); i++)
+			json << (i ? ", " : "") << "{\"module\": "
+					<< jsonString((*s.sim)[i]->getDescription()) << ", \"time\": "
+					<< s.sim->getProfileTime(i) << ", \"calls\": "
+					<< s.sim->getProfileCalls(i) << ", \"secondaries\": "
+					<< s.sim->getProfileSecondaries(i) << "}";
+		json << "]}";
+	}
+	json << "]}";
+}
+
+int main(int argc, char **argv) {
+#ifdef _OPENMP
+	int maxThreads = omp_get_num_procs();
+#else
+	int maxThreads = 1;
+#endif
+	if (argc > 1)
+		maxThreads = atoi(argv[1]);
+	size_t primaries = (argc > 2) ? atol(argv[2]) : 1000;
+	std::string filename = (argc > 3) ? argv[3] : "scaling.json";
+
+	std::vector<int> threads;
+	for (int n = 1; n < maxThreads; n *= 2)
+		threads.push_back(n);
+	threads.push_back(maxThreads);
+
+	std::ofstream json(filename.c_str());
+	json << "[";
+	scale("UHECR 1D", uhecr1D, threads, primaries, json);
+	json << ",\n";
+	scale("turbulent grid 3D", turbulentGrid3D, threads, primaries, json);
+	json << ",\n";
+	scale("JF12 backtracking", galacticBacktracking, threads, primaries, json);
+	json << ",\n";
+	scale("EM cascade", emCascade, threads, primaries, json);
+	json << "]\n";
+	return 0;
+}
@@ -2,29 +2,47 @@
 #ifndef CRPROPA_H
 #define CRPROPA_H
 
+#include "crpropa/Affinity.h"
+#include "crpropa/Autotuner.h"
 #include "crpropa/Candidate.h"
 #include "crpropa/Common.h"
+#include "crpropa/Configuration.h"
 #include "crpropa/Cosmology.h"
+#include "crpropa/DataTable.h"
 #include "crpropa/EmissionMap.h"
 #include "crpropa/Geometry.h"
 #include "crpropa/Grid.h"
 #include "crpropa/GridTools.h"
+#include "crpropa/Lock.h"
 #include "crpropa/Logging.h"
+#include "crpropa/MappedFile.h"
+#include "crpropa/MemoryAccounting.h"
 #include "crpropa/Module.h"
 #include "crpropa/ModuleList.h"
+#include "crpropa/ModulePipeline.h"
+#include "crpropa/MPIRunner.h"
 #include "crpropa/ParticleID.h"
 #include "crpropa/ParticleMass.h"
 #include "crpropa/ParticleState.h"
+#include "crpropa/PerfCounters.h"
 #include "crpropa/PhotonBackground.h"
+#include "crpropa/PhotonFieldRates.h"
 #include "crpropa/PhotonPropagation.h"
 #include "crpropa/Random.h"
 #include "crpropa/Referenced.h"
+#include "crpropa/SimulationBundle.h"
+#include "crpropa/SimulationPool.h"
+#include "crpropa/SmallVector.h"
 #include "crpropa/Source.h"
+#include "crpropa/SparseGrid.h"
+#include "crpropa/Statistics.h"
+#include "crpropa/Trace.h"
 #include "crpropa/Units.h"
 #include "crpropa/Variant.h"
 #include "crpropa/Vector3.h"
 #include "crpropa/Version.h"
 
+#include "crpropa/module/Backtracking.h"
 #include "crpropa/module/Boundary.h"
 #include "crpropa/module/BreakCondition.h"
 #include "crpropa/module/DiffusionSDE.h"
@@ -35,7 +53,15 @@
 #include "crpropa/module/EMTripletPairProduction.h"
 #include "crpropa/module/ElasticScattering.h"
 #include "crpropa/module/ElectronPairProduction.h"
+#include "crpropa/module/EventReweighting.h"
 #include "crpropa/module/HDF5Output.h"
+#include "crpropa/module/HDF5ColumnOutput.h"
+#include "crpropa/module/HistogramOutput.h"
+#include "crpropa/module/ConditionSet.h"
+#include "crpropa/module/ImportanceSampling.h"
+#include "crpropa/module/InteractionCollection.h"
+#include "crpropa/module/ContinuousLossCollection.h"
+#include "crpropa/module/NetworkOutput.h"
 #include "crpropa/module/NuclearDecay.h"
 #include "crpropa/module/Observer.h"
 #include "crpropa/module/OutputShell.h"
@@ -44,25 +70,37 @@
 #include "crpropa/module/PhotoPionProduction.h"
 #include "crpropa/module/PhotonEleCa.h"
 #include "crpropa/module/PhotonOutput1D.h"
+#include "crpropa/module/Propagation1D.h"
+#include "crpropa/module/PropagationBP.h"
 #include "crpropa/module/PropagationCK.h"
+#include "crpropa/module/PropagationCKOffload.h"
 #include "crpropa/module/Redshift.h"
+#include "crpropa/module/ResponseMatrix.h"
 #include "crpropa/module/RestrictToRegion.h"
 #include "crpropa/module/SimplePropagation.h"
 #include "crpropa/module/SynchrotronRadiation.h"
 #include "crpropa/module/TextOutput.h"
+#include "crpropa/module/BinaryOutput.h"
+#include "crpropa/module/TrajectoryOutput.h"
 #include "crpropa/module/Tools.h"
 #include "crpropa/module/AdiabaticCooling.h"
 
 #include "crpropa/magneticField/AMRMagneticField.h"
+#include "crpropa/magneticField/CachedMagneticField.h"
 #include "crpropa/magneticField/JF12Field.h"
 #include "crpropa/magneticField/JF12FieldSolenoidal.h"
 #include "crpropa/magneticField/MagneticField.h"
 #include "crpropa/magneticField/MagneticFieldGrid.h"
+#include "crpropa/magneticField/MagneticFieldSnapshots.h"
+#include "crpropa/magneticField/NestedTurbulenceField.h"
+#include "crpropa/magneticField/OctreeMagneticField.h"
+#include "crpropa/magneticField/PlaneWaveTurbulence.h"
 #include "crpropa/magneticField/PT11Field.h"
 #include "crpropa/magneticField/QuimbyMagneticField.h"
 #include "crpropa/magneticField/ArchimedeanSpiralField.h"
 
 #include "crpropa/advectionField/AdvectionField.h"
+#include "crpropa/advectionField/AdvectionFieldGrid.h"
 
 #include "crpropa/massDistribution/Density.h"
 #include "crpropa/massDistribution/Nakanishi.h"
@@ -70,6 +108,7 @@
 #include "crpropa/massDistribution/Massdistribution.h"
 #include "crpropa/massDistribution/Ferriere.h"
 #include "crpropa/massDistribution/ConstantDensity.h"
+#include "crpropa/massDistribution/CachedDensity.h"
 
 
 
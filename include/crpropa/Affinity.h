@@ -0,0 +1,39 @@
+#ifndef CRPROPA_AFFINITY_H
+#define CRPROPA_AFFINITY_H
+
+#include <cstddef>
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup Tools
+ * @{
+ */
+
+/**
+ @file
+ @brief Thread placement and NUMA memory policy for multi-socket machines
+
+ The functions are implemented for Linux only, on other systems they do
+ nothing and report failure.
+ */
+
+/** CPUs the calling thread is allowed to run on */
+std::vector<int> getThreadAffinity();
+
+/** Restrict the calling thread to the given CPUs, returns false on failure */
+bool setThreadAffinity(const std::vector<int> &cpus);
+
+/**
+ Interleave the pages of a memory block over all NUMA nodes.
+ Pages that are already in use are migrated. A large read-only block, e.g.
+ a turbulent field grid that was initialised by a single thread, is then
+ served by the memory controllers of all sockets instead of the first one.
+ Returns false if the memory policy could not be applied.
+ */
+bool interleaveMemory(void *address, size_t bytes);
+
+/** @} */
+} // namespace crpropa
+
+#endif // CRPROPA_AFFINITY_H
@@ -0,0 +1,119 @@
+#ifndef CRPROPA_AUTOTUNER_H
+#define CRPROPA_AUTOTUNER_H
+
+#include "crpropa/ModuleList.h"
+#include "crpropa/Source.h"
+
+#include <string>
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup Tools
+ * @{
+ */
+
+/**
+ @class AutotuneSetup
+ @brief The simulation of an Autotuner for a parameter setting.
+
+ Implement create, in C++ or Python, e.g. returning a module list with a
+ PropagationCK of the given tolerance and an Observer passing the detected
+ candidates on with Observer::onDetection(output).
+ */
+class AutotuneSetup: public Referenced {
+public:
+	/** Module list of the parameter setting, passing each detected candidate
+	 to output. */
+	virtual ref_ptr<ModuleList> create(const std::vector<double> &parameters,
+			Module *output) const = 0;
+};
+
+/**
+ @struct AutotuneResult
+ @brief A parameter setting of an Autotuner with its cost and accuracy.
+
+ The errors are compared against the reference setting: the Kolmogorov-Smirnov
+ distances of the weighted distributions of log10(E) and of the deflection
+ angle (between the directions at the source and at detection), and the
+ relative difference of the detected weight.
+ */
+struct AutotuneResult {
+	std::vector<double> parameters;
+	size_t steps; ///< processed steps, rejected propagation steps included
+	double time; ///< wall clock time in seconds
+	size_t detected; ///< detected candidates
+	double spectrumError, deflectionError, weightError;
+	bool accepted; ///< largest error within the tolerance
+
+	AutotuneResult();
+	double getError() const; ///< largest error
+};
+
+/**
+ @class Autotuner
+ @brief Cheapest simulation parameters within an accuracy tolerance.
+
+ Step tolerances and maximum steps of the propagators and the limits of the
+ interactions are usually chosen too small to be safe. The Autotuner runs short
+ pilot simulations of the same primaries for all settings of a parameter grid
+ and for a high-accuracy reference setting, each run using all threads, and
+ compares the detected spectra and deflections with those of the reference.
+ The cost of a setting is its number of steps counted by Statistics, which does
+ not depend on the load of the machine; the best setting is the one of fewest
+ steps with all errors within the tolerance.
+
+ The runs use counter-based random streams with the same key
+ (ModuleList::setCounterBasedRandom), so that the primaries and, as long as the
+ settings draw the same random numbers, the interactions are the same in all
+ runs and the errors show the differences of the settings instead of the
+ statistical noise. The source is drawn again for every run, i.e. it must not
+ be a streaming source of a file.
+ */
+class Autotuner: public Referenced {
+	ref_ptr<AutotuneSetup> setup;
+	ref_ptr<SourceInterface> source;
+	size_t primaries;
+	std::vector<std::string> names;
+	std::vector<std::vector<double> > axes;
+	std::vector<double> reference;
+	double tolerance;
+	uint64_t key;
+	AutotuneResult referenceResult;
+	std::vector<AutotuneResult> results;
+
+	AutotuneResult evaluate(const std::vector<double> &parameters,
+			std::vector<std::vector<double> > &observables) const;
+public:
+	/**
+	 @param setup		creates the simulation of each setting
+	 @param source		source of the primaries
+	 @param primaries	number of primaries of each pilot simulation
+	 @param tolerance	largest accepted error
+	 */
+	Autotuner(AutotuneSetup *setup, SourceInterface *source, size_t primaries,
+			double tolerance = 0.01);
+	/// Add a parameter with its values to the grid, the settings are all combinations
+	void addParameter(const std::string &name, const std::vector<double> &values);
+	/// The high-accuracy setting, one value per parameter
+	void setReference(const std::vector<double> &parameters);
+	void setTolerance(double tolerance);
+	double getTolerance() const;
+	/// Key of the random streams of all runs
+	void setRandomKey(uint64_t key);
+
+	/// Run the reference and all settings of the grid
+	void run();
+	size_t size() const; ///< number of settings run
+	const AutotuneResult &getResult(size_t i) const;
+	const AutotuneResult &getReferenceResult() const;
+	/// The accepted setting of fewest steps, throws if there is none
+	const AutotuneResult &getBest() const;
+	/// One line per setting: parameters, steps, time, errors and acceptance
+	std::string getReport() const;
+};
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_AUTOTUNER_H
@@ -4,6 +4,7 @@
 #include "crpropa/ParticleState.h"
 #include "crpropa/Referenced.h"
 #include "crpropa/AssocVector.h"
+#include "crpropa/SmallVector.h"
 #include "crpropa/Variant.h"
 
 #include <vector>
@@ -17,6 +18,47 @@ namespace crpropa {
  * @{
  */
 
+/**
+ @class PropertyKey
+ @brief Interned name of a candidate property
+
+ Each distinct name is stored once in a global registry, a key refers to that
+ copy. Keys compare by address, so lookups in the PropertyMap do not compare
+ strings. Constructing a key from a string takes a lock, modules should
+ therefore construct their keys once, e.g. in their constructor, and reuse
+ them during the propagation. Strings convert implicitly to keys.
+ The order of keys is not alphabetical and may differ between runs.
+ */
+class PropertyKey {
+	const std::string *name; ///< canonical copy in the registry
+public:
+	PropertyKey(); ///< the empty name
+	PropertyKey(const std::string &name);
+	PropertyKey(const char *name);
+
+	const std::string &getName() const {
+		return *name;
+	}
+	bool empty() const {
+		return name->empty();
+	}
+
+	bool operator<(const PropertyKey &other) const {
+		return name < other.name;
+	}
+	bool operator==(const PropertyKey &other) const {
+		return name == other.name;
+	}
+	bool operator!=(const PropertyKey &other) const {
+		return name != other.name;
+	}
+
+	// only found for keys, not for anything that converts to one
+	friend std::ostream &operator<<(std::ostream &out, const PropertyKey &key) {
+		return out << key.getName();
+	}
+};
+
 /**
  @class Candidate
  @brief All information about the cosmic ray.
@@ -26,14 +68,16 @@ namespace crpropa {
  */
 class Candidate: public Referenced {
 public:
-	ParticleState source; /**< Particle state at the source */
-	ParticleState created; /**< Particle state of parent particle at the time of creation */
+	SharedParticleState source; /**< Particle state at the source, shared with the secondaries */
+	SharedParticleState created; /**< Particle state of parent particle at the time of creation, shared between siblings */
 	ParticleState current; /**< Current particle state */
 	ParticleState previous; /**< Particle state at the end of the previous step */
 
-	std::vector<ref_ptr<Candidate> > secondaries; /**< Secondary particles from interactions */
+	/** Secondaries of an interaction stored inline, larger cascades on the heap */
+	typedef SmallVector<ref_ptr<Candidate>, 4> SecondaryVector;
+	SecondaryVector secondaries; /**< Secondary particles from interactions */
 
-	typedef Loki::AssocVector<std::string, Variant> PropertyMap;
+	typedef Loki::AssocVector<PropertyKey, Variant> PropertyMap;
 	PropertyMap properties; /**< Map of property names and their values. */
 
 	/** Parent candidate. 0 if no parent (initial particle). Must not be a ref_ptr to prevent circular referencing. */
@@ -44,11 +88,16 @@ private:
 	double weight; /**< Weight of the candidate */
 	double redshift; /**< Current simulation time-point in terms of redshift z */
 	double trajectoryLength; /**< Comoving distance [m] the candidate has traveled so far */
+	double columnDensity; /**< Column density [1/m^2] accumulated along the trajectory, see PropagationCK::setDensity */
 	double currentStep; /**< Size of the currently performed step in [m] comoving units */
 	double nextStep; /**< Proposed size of the next propagation step in [m] comoving units */
+	ref_ptr<Candidate> parentHolder; /**< Owning reference to the parent, see retainParent */
 
 	static uint64_t nextSerialNumber;
 	uint64_t serialNumber;
+	static uint64_t newSerialNumber();
+
+	void shareCreated(Candidate *secondary, const ParticleState &state) const;
 
 public:
 	Candidate(
@@ -72,6 +121,9 @@ public:
 	void setTrajectoryLength(double length);
 	double getTrajectoryLength() const;
 
+	void setColumnDensity(double columnDensity);
+	double getColumnDensity() const;
+
 	void setRedshift(double z);
 	double getRedshift() const;
 
@@ -101,26 +153,36 @@ public:
 	 */
 	void limitNextStep(double step);
 
-	void setProperty(const std::string &name, const Variant &value);
-	const Variant &getProperty(const std::string &name) const;
-	bool removeProperty(const std::string &name);
-	bool hasProperty(const std::string &name) const;
+	void setProperty(const PropertyKey &key, const Variant &value);
+	const Variant &getProperty(const PropertyKey &key) const;
+	bool removeProperty(const PropertyKey &key);
+	bool hasProperty(const PropertyKey &key) const;
 
 	/**
 	 Add a new candidate to the list of secondaries.
 	 @param id		particle ID of the secondary
 	 @param energy	energy of the secondary
+	 @param weight	weight of the secondary relative to this candidate
 
 	 Adds a new candidate to the list of secondaries of this candidate.
 	 The secondaries Candidate::source and Candidate::previous state are set to the _source_ and _previous_ state of its parent.
 	 The secondaries Candidate::created and Candidate::current state are set to the _current_ state of its parent, except for the secondaries current energy and particle id.
-	 Trajectory length and redshift are copied from the parent.
+	 Trajectory length and redshift are copied from the parent, the weight is the parent weight times the given weight.
+	 Secondaries of a thread confined candidate are thread confined as well.
 	 */
 	void addSecondary(Candidate *c);
 	inline void addSecondary(ref_ptr<Candidate> c) { addSecondary(c.get()); };
 	void addSecondary(int id, double energy, double weight = 1);
 	void addSecondary(int id, double energy, Vector3d position, double weight = 1);
+	/** Remove the secondaries, keeping the storage for the next ones */
 	void clearSecondaries();
+	/**
+	 Keep the parent alive as long as this candidate.
+	 For secondaries that are detached from the secondaries of their parent,
+	 so that Candidate::parent stays valid. Not to be used while the parent
+	 holds this candidate, as this creates a reference cycle.
+	 */
+	void retainParent();
 
 	std::string getDescription() const;
 
@@ -137,7 +199,11 @@ public:
 	/** Set the next serial number to use */
 	static void setNextSerialNumber(uint64_t snr);
 
-	/** Get the next serial number that will be assigned */
+	/**
+	 Get the next serial number that will be assigned.
+	 Inside parallel regions each thread reserves blocks of 65536 numbers,
+	 the numbers up to the returned one may then not all be used.
+	 */
 	static uint64_t getNextSerialNumber();
 
 	/**
@@ -146,11 +212,33 @@ public:
 	 */
 	ref_ptr<Candidate> clone(bool recursive = false) const;
 
+	/**
+	 Copy the state of this candidate into an existing one, as clone(false) but
+	 reusing its memory and keeping the serial number. The target has no parent
+	 and no secondaries afterwards.
+	 */
+	void copyState(Candidate &target) const;
+
 	/**
 	 Copy the source particle state to the current state
 	 and activate it if inactive, e.g. restart it
 	*/
 	void restart();
+
+#ifndef SWIG
+	/**
+	 Candidates are allocated from a per-thread free list.
+	 Memory of deleted candidates, e.g. of a secondary tree released with
+	 clearSecondaries, is kept by the releasing thread for reuse, which
+	 avoids a malloc/free pair for each short-lived secondary.
+	 */
+	static void *operator new(size_t size);
+	static void operator delete(void *p, size_t size);
+#endif
+	/** Number of free candidate blocks kept by the calling thread */
+	static size_t getPoolSize();
+	/** Return the free candidate blocks of the calling thread to the system */
+	static void clearPool();
 };
 
 /** @}*/
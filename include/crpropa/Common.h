@@ -21,6 +21,21 @@ std::string getDataPath(std::string filename);
 // Returns the install prefix
 std::string getInstallPrefix();
 
+/**
+ Attribute of the hot kernels, compiled for several x86-64 instruction sets
+ when built with ENABLE_MULTIVERSIONING; the version for the CPU is selected
+ when the library is loaded. Empty otherwise, e.g. on ARM where NEON is the
+ baseline.
+ */
+#ifdef CRPROPA_HAVE_MULTIVERSIONING
+#define CRPROPA_MULTIVERSION __attribute__((target_clones("default", "avx2", "avx512f")))
+#else
+#define CRPROPA_MULTIVERSION
+#endif
+
+// Returns the instruction set of the kernels selected for this CPU: avx512f, avx2, neon or default
+std::string getInstructionSet();
+
 // Returns a certain digit from a given integer
 inline int digit(const int& value, const int& d) {
 	return (value % (d * 10)) / d;
@@ -37,19 +52,67 @@ T clip(const T& x, const T& lower, const T& upper) {
 double interpolate(double x, const std::vector<double>& X,
 		const std::vector<double>& Y);
 
+// Same for n tabulated data points X[0 .. n-1] -> Y[0 .. n-1]
+double interpolate(double x, const double *X, const double *Y, size_t n);
+
 
 // Perform bilinear interpolation on a set of (n,m) tabulated data points X[0 .. n-1], Y[0 .. m-1] -> Z[0.. n-1*m-1]
 // Returns 0 if x < X[0] or x > X[n-1] or y < Y[0] or y > Y[m-1]
 double interpolate2d(double x, double y, const std::vector<double>& X,
 		const std::vector<double>& Y, const std::vector<double>& Z);
 
+// Same as interpolate and interpolate2d, with the cell indices of a previous call
+// as a hint: the search is skipped if x (and y) are still in the cell, the indices
+// are updated to the cell of x (and y)
+double interpolate(double x, const std::vector<double>& X,
+		const std::vector<double>& Y, size_t &i);
+double interpolate2d(double x, double y, const std::vector<double>& X,
+		const std::vector<double>& Y, const std::vector<double>& Z, size_t &i,
+		size_t &j);
+
 // Perform linear interpolation on equidistant tabulated data
 // Returns Y[0] if x < lo and Y[n-1] if x > hi
 double interpolateEquidistant(double x, double lo, double hi,
 		const std::vector<double>& Y);
 
+// Same for n tabulated data points Y[0 .. n-1]
+double interpolateEquidistant(double x, double lo, double hi, const double *Y,
+		size_t n);
+
 // Find index of value in a sorted vector X that is closest to x
 size_t closestIndex(double x, const std::vector<double> &X);
+
+/**
+ @class LogUniformTable
+ @brief Sorted positive tabulation points, with direct indexing if they are log-equidistant
+
+ Filled like a std::vector. While the points are log-equidistant (to within 1% of
+ the spacing) the cell of a value is computed from its logarithm and corrected to
+ the exact cell, otherwise it is searched. The results are those of the
+ functions above for std::vector<double>.
+ */
+class LogUniformTable {
+	std::vector<double> X;
+	bool uniform;
+	double lgFront; // log of the first point
+	double lgStep; // log spacing of the points
+public:
+	LogUniformTable();
+	void clear();
+	void push_back(double x);
+	size_t size() const {return X.size();}
+	double front() const {return X.front();}
+	double back() const {return X.back();}
+	double operator[](size_t i) const {return X[i];}
+	const std::vector<double> &values() const {return X;}
+	bool isUniform() const {return uniform;}
+	/// Index i with X[i] <= x < X[i+1], clipped to 0 .. n-2
+	size_t cell(double x) const;
+	/// Same as interpolate(x, X, Y)
+	double interpolate(double x, const std::vector<double> &Y) const;
+	/// Same as closestIndex(x, X)
+	size_t closestIndex(double x) const;
+};
 /** @}*/
 
 
@@ -0,0 +1,167 @@
+#ifndef CRPROPA_CONFIGURATION_H
+#define CRPROPA_CONFIGURATION_H
+
+#include "crpropa/Referenced.h"
+#include "crpropa/Vector3.h"
+
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace crpropa {
+
+class Module;
+class MagneticField;
+class SourceInterface;
+class SourceFeature;
+class ObserverFeature;
+class ConfigurationDocument;
+
+/**
+ @class Configuration
+ @brief Type and parameters of one object of a saved configuration.
+
+ Modules, magnetic fields, sources and their features describe themselves in
+ getConfiguration with a type name and named parameters, in the units of
+ the code (SI). Other objects are parameters by reference: they are saved
+ once per document, also if several objects use them (e.g. one field of
+ several propagation modules), and loaded once.
+ */
+class Configuration {
+	std::string type;
+	std::vector<std::pair<std::string, std::string> > values;
+	ConfigurationDocument *document;
+
+	const std::string &getValue(const std::string &key) const;
+	ref_ptr<Referenced> getObject(size_t id) const;
+	template<class T>
+	ref_ptr<T> cast(ref_ptr<Referenced> object, const std::string &key) const {
+		T *t = dynamic_cast<T *>(object.get());
+		if (!t)
+			throw std::runtime_error("Configuration: " + type + "." + key
+					+ " references an object of another type");
+		return t;
+	}
+	std::string reference(size_t id) const;
+	std::vector<size_t> getIds(const std::string &key) const;
+	friend class ConfigurationDocument;
+public:
+	Configuration(const std::string &type = "", ConfigurationDocument *document = 0);
+	void setType(const std::string &type);
+	const std::string &getType() const;
+	bool has(const std::string &key) const;
+	std::vector<std::string> getKeys() const;
+
+	void set(const std::string &key, double value);
+	void set(const std::string &key, const Vector3d &value);
+	void set(const std::string &key, const std::vector<double> &values);
+	void setString(const std::string &key, const std::string &value);
+	/** Parameters by reference, the object is saved into the same document */
+	void set(const std::string &key, const Module *module);
+	void set(const std::string &key, const MagneticField *field);
+	void set(const std::string &key, const SourceInterface *source);
+	void set(const std::string &key, const SourceFeature *feature);
+	void set(const std::string &key, const ObserverFeature *feature);
+	/** A list of references, e.g. the modules of a ModuleList */
+	template<class T>
+	void setList(const std::string &key, const std::vector<ref_ptr<T> > &objects) {
+		std::string s;
+		for (size_t i = 0; i < objects.size(); i++) {
+			Configuration c(*this);
+			c.set(key, objects[i].get());
+			s += (i > 0 ? " " : "") + c.getValue(key);
+		}
+		setString(key, s);
+	}
+
+	double getDouble(const std::string &key) const;
+	int getInt(const std::string &key) const;
+	bool getBool(const std::string &key) const;
+	Vector3d getVector(const std::string &key) const;
+	std::vector<double> getDoubles(const std::string &key) const;
+	const std::string &getString(const std::string &key) const;
+	/** Referenced object, throws if it has another type */
+	template<class T>
+	ref_ptr<T> get(const std::string &key) const {
+		std::vector<size_t> ids = getIds(key);
+		if (ids.size() != 1)
+			throw std::runtime_error("Configuration: " + type + "." + key + " is no reference");
+		return cast<T>(getObject(ids[0]), key);
+	}
+	template<class T>
+	std::vector<ref_ptr<T> > getList(const std::string &key) const {
+		std::vector<size_t> ids = getIds(key);
+		std::vector<ref_ptr<T> > objects;
+		for (size_t i = 0; i < ids.size(); i++)
+			objects.push_back(cast<T>(getObject(ids[i]), key));
+		return objects;
+	}
+};
+
+/**
+ @class ConfigurationDocument
+ @brief Machine-readable configuration of a simulation, e.g. a ModuleList with its fields and sources.
+
+ Ships a configured setup to other processes without running the setup
+ script there: save it on one node, send the text, load it on the others.
+ The text starts with the line "CRPCONF1" and lists the objects, the ones
+ referenced first:
+
+	object <id> <type>
+	<key> <value>
+	end
+
+ Numbers are written with 17 digits, vectors as three numbers and
+ references as @<id>. The last object is the root. Loading creates each
+ object once from its parameters, without parsing descriptions.
+
+ The built-in types cover the common modules, fields and features; a
+ magnetic field grid is referenced by its mapped file (see mapGrid), which
+ the workers map again. Further types are added with addType and saved by
+ overriding getConfiguration. Objects without configuration throw when
+ saved.
+ */
+class ConfigurationDocument: public Referenced {
+public:
+	/** Creates the object of a configuration */
+	typedef Referenced *(*Factory)(const Configuration &configuration);
+private:
+	std::vector<Configuration> objects;
+	std::map<const void *, size_t> ids; ///< saved objects
+	std::vector<ref_ptr<Referenced> > loaded;
+
+	template<class T>
+	size_t addObject(const T *object);
+	static std::map<std::string, Factory> &factories();
+	friend class Configuration;
+public:
+	/** Save an object and the objects it references, returns its id */
+	size_t add(const Module *module);
+	size_t add(const MagneticField *field);
+	size_t add(const SourceInterface *source);
+	size_t add(const SourceFeature *feature);
+	size_t add(const ObserverFeature *feature);
+	size_t size() const;
+	const Configuration &getConfiguration(size_t id) const;
+
+	std::string toString() const;
+	void save(const std::string &filename) const;
+	static ref_ptr<ConfigurationDocument> fromString(const std::string &text);
+	static ref_ptr<ConfigurationDocument> load(const std::string &filename);
+
+	/** The object of an id (once created), the objects are created in order */
+	ref_ptr<Referenced> getObject(size_t id);
+	ref_ptr<Module> getModule(); ///< the root, throws if it is of another type
+	ref_ptr<MagneticField> getMagneticField();
+	ref_ptr<SourceInterface> getSource();
+
+	/** Register the factory of a type, replacing a built-in one */
+	static void addType(const std::string &type, Factory factory);
+	static bool hasType(const std::string &type);
+};
+
+} // namespace crpropa
+
+#endif // CRPROPA_CONFIGURATION_H
@@ -1,6 +1,8 @@
 #ifndef CRPROPA_COSMOLOGY_H
 #define CRPROPA_COSMOLOGY_H
 
+#include <cstddef>
+
 namespace crpropa {
 /**
  * \addtogroup PhysicsDefinitions
@@ -10,10 +12,14 @@ namespace crpropa {
 /**
  @file
  @brief Cosmology functions
+
+ The conversions interpolate cubic tables on nodes equidistant in the
+ logarithm of the argument, at the cost of one logarithm per call.
  */
 
 /**
- Set the cosmological parameters for a flat universe. To ensure flatness omegaL is set to 1 - omegaMatter
+ Set the cosmological parameters for a flat universe. To ensure flatness omegaL is set to 1 - omegaMatter.
+ The tables are rebuilt and replaced at once, threads converting distances meanwhile use the old or the new ones.
  @param hubbleParameter	dimensionless Hubble parameter, default = 0.673
  @param omegaMatter		matter parameter, default = 0.315
  */
@@ -76,6 +82,13 @@ double comoving2LightTravelDistance(double distance);
 // Conversion from light travel distance to comoving distance.
 double lightTravel2ComovingDistance(double distance);
 
+// Batched conversions of n values
+void comovingDistance2Redshift(const double *distance, double *redshift, size_t n);
+void redshift2ComovingDistance(const double *redshift, double *distance, size_t n);
+void lightTravelDistance2Redshift(const double *distance, double *redshift, size_t n);
+void redshift2LightTravelDistance(const double *redshift, double *distance, size_t n);
+void comoving2LightTravelDistance(const double *comoving, double *lightTravel, size_t n);
+
 /** @}*/
 } // namespace crpropa
 
@@ -0,0 +1,69 @@
+#ifndef CRPROPA_DATATABLE_H
+#define CRPROPA_DATATABLE_H
+
+#include "crpropa/MappedFile.h"
+#include "crpropa/MemoryAccounting.h"
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup Tools
+ * @{
+ */
+
+/**
+ @class DataTable
+ @brief Rows of numbers of an interaction data file, shared read-only
+
+ The text files of the interaction modules hold rows of whitespace separated
+ numbers, lines starting with '#' and empty lines are skipped.
+ A text file is compiled once into a binary file (the filename with ".bin"
+ appended) that is used instead, as long as it is not older than the text
+ file, and memory mapped (MappedFile), so that it is not parsed again and all
+ processes share its pages.
+ DataTable::open keeps the tables of a process as long as they are used,
+ module instances using the same file share one table.
+ If the binary file cannot be written or mapped, the text file is parsed into
+ memory instead. Tables of an open SimulationBundle are used before all files.
+ */
+class DataTable: public Referenced {
+	ref_ptr<MappedFile> mapped;
+	std::vector<unsigned long long> ownedOffsets;
+	std::vector<double> ownedValues;
+	MemoryAccount memory; ///< of the owned offsets and values
+	const unsigned long long *offsets; ///< first value of each row, size = rows + 1
+	const double *values;
+	size_t rows;
+
+	DataTable();
+	void parse(const std::string &filename);
+	void map(ref_ptr<MappedFile> file);
+public:
+	/**
+	 Table of a text data file, from the process wide cache, its binary file or
+	 the text file. Returns an invalid reference if neither file exists.
+	 */
+	static ref_ptr<DataTable> open(const std::string &filename);
+	/** Compile the text file into the binary file, throws on errors */
+	static void compile(const std::string &filename,
+			const std::string &binaryFilename);
+	/** Names of the files of all tables opened in this process so far */
+	static std::vector<std::string> getFilenames();
+
+	/** Write the table in the binary format */
+	void write(std::ostream &out) const;
+	size_t getBinarySize() const; ///< bytes written by write
+
+	size_t size() const; ///< number of rows
+	size_t rowSize(size_t i) const; ///< number of values of row i
+	const double *row(size_t i) const; ///< values of row i
+	double get(size_t i, size_t j) const; ///< value j of row i
+};
+
+/** @} */
+} // namespace crpropa
+
+#endif // CRPROPA_DATATABLE_H
@@ -3,6 +3,11 @@
 
 #include "Referenced.h"
 #include "Candidate.h"
+#include "Random.h"
+
+#include <iosfwd>
+#include <string>
+#include <vector>
 
 /**
  @file
@@ -17,15 +22,20 @@ namespace crpropa {
 /**
  @class CylindricalProjectionMap
  @brief 2D histogram of spherical coordinates in equal-area projection
+
+ Directions are drawn in constant time from an alias table of the pdf, built
+ by freeze() or on the first draw after a change, also when several threads
+ draw concurrently. The pdf must not be changed while other threads draw.
  */
 class CylindricalProjectionMap : public Referenced {
 	size_t nPhi, nTheta;
 	double sPhi, sTheta;
-	mutable bool dirty;
 	std::vector<double> pdf;
 	mutable std::vector<double> cdf;
+	mutable AliasTable table;
+	mutable int frozen; ///< cdf and table are up to date, only set under a lock
 
-	/** Calculate the cdf from the pdf */
+	/** Calculate the cdf and the alias table from the pdf */
 	void updateCdf() const;
 public:
 
@@ -42,13 +52,25 @@ public:
 	/** Increment the bin value by weight. */
 	void fillBin(size_t bin, double weight = 1.);
 
+	/** Build the cdf and the alias table of the current pdf */
+	void freeze() const;
+
+	/** Draw a random bin from the distribution. */
+	size_t drawBin() const;
+
 	/** Draw a random vector from the distribution. */
 	Vector3d drawDirection() const;
 
 	/** Check if the direction has a non zero propabiliy. */
 	bool checkDirection(const Vector3d &direction) const;
 
+	/** Weight of a direction drawn in the bin, with the isotropic probability of
+	 the bin over its probability in the map. The weights of many draws sum up to
+	 the number of isotropic directions accepted by checkDirection. */
+	double getSamplingWeight(size_t bin) const;
+
 	const std::vector<double>& getPdf() const;
+	/** The pdf to be modified, the cdf is rebuilt on the next draw */
 	std::vector<double>& getPdf();
 
 	const std::vector<double>& getCdf() const;
@@ -68,6 +90,9 @@ public:
  @brief Particle Type and energy binned emission maps.
 
  Use SourceEmissionMap to suppress directions at the source. Use EmissionMapFiller to create EmissionMap from Observer.
+
+ The maps filled by fillMapOfThread are merged when the maps are used, e.g.
+ by freeze() before drawing from several threads.
  */
 class EmissionMap : public Referenced {
 public:
@@ -104,11 +129,19 @@ public:
 	void fillMap(int pid, double energy, const Vector3d& direction, double weight = 1.);
 	/** Increment the value for the particle state by weight. */
 	void fillMap(const ParticleState& state, double weight = 1.);
+	/** Increment the value for the particle state by weight in maps of the
+	 calling thread, without locking. Not concurrently with other methods. */
+	void fillMapOfThread(const ParticleState& state, double weight = 1.);
+	/** Merge the maps of the threads and build the alias tables of all maps */
+	void freeze() const;
 
 	/** Draw a random vector from the distribution. */
 	bool drawDirection(int pid, double energy, Vector3d& direction) const;
 	/** Draw a random vector from the distribution. */
 	bool drawDirection(const ParticleState& state, Vector3d& direction) const;
+	/** Draw a random vector from the distribution, with the weight relative to
+	 isotropic emission, see CylindricalProjectionMap::getSamplingWeight. */
+	bool drawDirection(const ParticleState& state, Vector3d& direction, double &weight) const;
 
 	/** Check if the direction has a non zero propabiliy. */
 	bool checkDirection(int pid, double energy, const Vector3d& direction) const;
@@ -123,7 +156,11 @@ public:
 
 	/** Save the content of the maps into a text file */
 	void save(const std::string &filename);
-	/** Load the content of the maps from a text file */
+	/** Save the maps into a binary file, gzip compressed if the filename ends with
+	 .gz. Maps with mostly empty bins store only the filled bins. */
+	void saveBinary(const std::string &filename);
+	/** Load the content of the maps from a text or binary file. A binary file
+	 sets the binning of an empty EmissionMap, else it has to match. */
 	void load(const std::string &filename);
 
 	/** Merge other maps, add pdfs */
@@ -132,10 +169,27 @@ public:
 	/** Merge maps from file */
 	void merge(const std::string &filename);
 
+	/** Merge the maps of many files, e.g. of cluster jobs, read in parallel */
+	void merge(const std::vector<std::string> &filenames);
+
 protected:
 	double minEnergy, maxEnergy, logStep;
 	size_t nPhi, nTheta, nEnergy;
-	map_t maps;
+	mutable map_t maps;
+
+	// maps of one thread, padded against false sharing
+	struct ThreadMaps {
+		map_t maps;
+		char padding[64];
+	};
+	mutable std::vector<ThreadMaps> threadMaps;
+	mutable int threadsFilled; ///< maps of the threads are to be merged
+	/** Add the maps of the threads to maps */
+	void mergeThreads() const;
+
+	void writeBinary(std::ostream &out) const;
+	void readBinary(std::istream &in);
+	void readText(std::istream &in);
 };
 
 /** }@ */
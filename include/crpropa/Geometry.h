@@ -37,6 +37,18 @@ class Surface : public Referenced
 	 */
     virtual Vector3d normal(const Vector3d& point) const = 0;
 		virtual std::string getDescription() const {return "Surface without description.";};
+	/**
+		Axis-aligned box around a bounded surface, false for unbounded
+		surfaces (default).
+	 */
+		virtual bool getBounds(Vector3d &lower, Vector3d &upper) const {return false;};
+	/**
+		Returns the distance along the ray point + t * direction, t >= 0 and
+		direction a unit vector, to the first crossing of the surface, or
+		infinity if the ray does not cross it. The default is the conservative
+		fabs(distance(point)).
+	 */
+		virtual double intersection(const Vector3d &point, const Vector3d &direction) const {return fabs(distance(point));};
 };
 
 
@@ -54,6 +66,7 @@ class Plane: public Surface
     virtual double distance(const Vector3d &x) const;
     virtual Vector3d normal(const Vector3d& point) const;
 		virtual std::string getDescription() const;
+		virtual double intersection(const Vector3d &point, const Vector3d &direction) const;
 };
 
 
@@ -71,6 +84,8 @@ class Sphere: public Surface
     virtual double distance(const Vector3d &point) const;
     virtual Vector3d normal(const Vector3d& point) const;
 		virtual std::string getDescription() const;
+		virtual double intersection(const Vector3d &point, const Vector3d &direction) const;
+		virtual bool getBounds(Vector3d &lower, Vector3d &upper) const;
 };
 
 
@@ -87,6 +102,50 @@ class ParaxialBox: public Surface
     virtual double distance(const Vector3d &point) const;
     virtual Vector3d normal(const Vector3d& point) const;
 		virtual std::string getDescription() const;
+		virtual double intersection(const Vector3d &point, const Vector3d &direction) const;
+		virtual bool getBounds(Vector3d &lower, Vector3d &upper) const;
+};
+
+
+/**
+ @class TriangleMesh
+ @brief A surface of triangles, loaded from a Wavefront OBJ file or given as vertices and triangles.
+
+ The triangles are held in a bounding volume hierarchy (BVH), so that distance,
+ normal and intersection cost O(log n) for n triangles instead of O(n). For a
+ closed mesh with the vertices of its triangles counter-clockwise seen from
+ outside, the distance is negative on the inside and the normal points
+ outwards; the side is taken from the angle-weighted pseudo normal of the
+ closest face, edge or vertex (Baerentzen & Aanaes 2005).
+ */
+class TriangleMesh: public Surface
+{
+	private:
+		struct Node {
+			Vector3d lower, upper;
+			unsigned int first, count; // triangles of a leaf, count 0 for inner nodes
+			unsigned int right; // second child, the first child follows its parent
+		};
+		std::vector<Vector3d> vertices;
+		std::vector<unsigned int> triangles; // three vertex indices per triangle
+		std::vector<Vector3d> faceNormals, edgeNormals, vertexNormals; // three edge normals per triangle
+		std::vector<Node> nodes;
+		void init();
+		unsigned int build(std::vector<unsigned int> &order, unsigned int first,
+				unsigned int count, const std::vector<Vector3d> &centroids);
+		double closest(const Vector3d &point, Vector3d &pseudoNormal) const;
+	public:
+		/** Load the vertices (v) and faces (f) of an OBJ file, polygons are split
+		    into triangles. The vertices are multiplied by scale. */
+		TriangleMesh(const std::string &filename, double scale = 1);
+		/** Vertices and three indices to the vertices per triangle */
+		TriangleMesh(const std::vector<Vector3d> &vertices, const std::vector<unsigned int> &triangles);
+		size_t getNumberOfTriangles() const;
+    virtual double distance(const Vector3d &point) const;
+    virtual Vector3d normal(const Vector3d& point) const;
+		virtual std::string getDescription() const;
+		virtual double intersection(const Vector3d &point, const Vector3d &direction) const;
+		virtual bool getBounds(Vector3d &lower, Vector3d &upper) const;
 };
 
 
@@ -1,24 +1,42 @@
 #ifndef CRPROPA_GRID_H
 #define CRPROPA_GRID_H
 
+#include "crpropa/MappedFile.h"
+#include "crpropa/MemoryAccounting.h"
 #include "crpropa/Referenced.h"
 #include "crpropa/Vector3.h"
+#include <algorithm>
+#include <stdexcept>
 #include <vector>
+#include <stdint.h>
 
 namespace crpropa {
 
 /** Lower and upper neighbor in a periodically continued unit grid */
 inline void periodicClamp(double x, int n, int &lo, int &hi) {
-	lo = ((int(floor(x)) % n) + n) % n;
-	hi = (lo + 1) % n;
+	// one modulo, the wrap-arounds are cheap branches
+	lo = int(floor(x)) % n;
+	if (lo < 0)
+		lo += n;
+	hi = lo + 1;
+	if (hi == n)
+		hi = 0;
 }
 
 /** Lower and upper neighbor in a reflectively repeated unit grid */
 inline void reflectiveClamp(double x, int n, int &lo, int &hi) {
-	while ((x < 0) or (x > n))
-		x = 2 * n * (x > n) - x;
-	lo = floor(x);
-	hi = lo + (lo < n-1);
+	// fold into one period [0, 2n) of the mirrored grid, then mirror [n, 2n)
+	double y = x - 2 * n * floor(x / (2 * n));
+	y = std::min(y, 2 * n - y);
+	lo = std::min(int(floor(y)), n - 1);
+	hi = std::min(lo + 1, n - 1);
+}
+
+/** Closest point in a reflectively repeated grid of n points */
+inline int reflectiveIndex(int i, int n) {
+	int m = i % (2 * n);
+	m += (m < 0) * 2 * n;
+	return std::min(std::min(m, 2 * n - m), n - 1);
 }
 
 /** Symmetrical round */
@@ -30,14 +48,82 @@ inline double round(double r) {
  * \addtogroup Core
  * @{
  */
+
+/**
+ @class Vector3s
+ @brief Vector of 16 bit integers, the stored value of a QuantizedVectorGrid
+ */
+struct Vector3s {
+	int16_t x, y, z;
+	Vector3s() : x(0), y(0), z(0) {
+	}
+};
+
+/**
+ @class GridValue
+ @brief Conversion between the stored value of a grid and its actual value
+
+ The stored values are the actual values for all types except Vector3s,
+ which hold multiples of the quantum of the grid.
+ */
+template<typename T>
+struct GridValue {
+	typedef T Type;
+	static Type decode(const T &v, double quantum) {
+		return v;
+	}
+	static T encode(const Type &v, double quantum) {
+		return v;
+	}
+};
+
+template<>
+struct GridValue<Vector3s> {
+	typedef Vector3f Type;
+	static Type decode(const Vector3s &v, double quantum) {
+		return Vector3f(v.x, v.y, v.z) * quantum;
+	}
+	static int16_t encode(double x, double quantum) {
+		double n = round(x / quantum);
+		return int16_t(std::max(-32767., std::min(32767., n)));
+	}
+	static Vector3s encode(const Type &v, double quantum) {
+		Vector3s s;
+		s.x = encode(v.x, quantum);
+		s.y = encode(v.y, quantum);
+		s.z = encode(v.z, quantum);
+		return s;
+	}
+};
+
 /**
  @class Grid
  @brief Template class for fields on a periodic grid with trilinear interpolation
 
  The grid spacing is constant with diffrent resulution along all three axes.
- Values are calculated by trilinear interpolation of the surrounding 8 grid points.
+ Values are calculated by trilinear interpolation of the surrounding 8 grid points,
+ or with interpolateTricubic from the surrounding 64 points.
  The grid is periodically (default) or reflectively extended.
  The grid sample positions are at 1/2 * size/N, 3/2 * size/N ... (2N-1)/2 * size/N.
+
+ The values are stored row-major with z changing the fastest (default), or
+ in bricks of 4x4x4 grid points (setBricked). In the bricked layout the 8
+ neighbors of an interpolation lie mostly in one brick, i.e. in a few
+ consecutive cache lines and the same memory page, which reduces cache and
+ TLB misses for large grids. The storage is then padded to multiples of 4
+ points per axis. get, interpolate and the functions in GridTools work with
+ both layouts, code that accesses getGrid() directly has to use
+ positionFromIndex to map the storage index to a grid point.
+
+ Instead of the owned vector a grid can use a MappedFile with the values in
+ the binary format of dumpGrid as storage (setMappedFile, mapGrid). The file
+ is not read at startup and processes on the same node share its pages.
+ getGrid() is then empty.
+
+ Grid<Vector3s> (QuantizedVectorGrid) stores the components as 16 bit
+ integers in units of a grid-wide quantum, i.e. 6 instead of 12 bytes per
+ point. The values are decoded in interpolate and closestValue, which return
+ a Vector3f. get and setValue access the stored integers, GridValue converts.
  */
 template<typename T>
 class Grid: public Referenced {
@@ -47,6 +133,38 @@ class Grid: public Referenced {
 	Vector3d gridOrigin; /**< Grid origin */
 	Vector3d spacing; /**< Distance between grid points, determines the extension of the grid */
 	bool reflective; /**< If set to true, the grid is repeated reflectively instead of periodically */
+	bool bricked; /**< If set to true, the values are stored in bricks of 4x4x4 points */
+	double quantum; /**< Value of one integer step for quantized types */
+	size_t NBy, NBz; /**< Number of bricks in y- and z-direction */
+	ref_ptr<MappedFile> mapped; /**< If set, the values are stored in this file instead of grid */
+	MemoryAccount memory; /**< Bytes of the owned values */
+
+	/** First value in storage order */
+	T *storage() {
+		return mapped.valid() ? static_cast<T*>(mapped->getData()) : &grid[0];
+	}
+
+	const T *storage() const {
+		return mapped.valid() ? static_cast<const T*>(mapped->getData()) : &grid[0];
+	}
+
+	/** Storage index of a grid point in the given layout */
+	size_t index(size_t ix, size_t iy, size_t iz, bool inBricks) const {
+		if (!inBricks)
+			return ix * Ny * Nz + iy * Nz + iz;
+		size_t brick = ((ix >> 2) * NBy + (iy >> 2)) * NBz + (iz >> 2);
+		return (brick << 6) + ((ix & 3) << 4) + ((iy & 3) << 2) + (iz & 3);
+	}
+
+	size_t index(size_t ix, size_t iy, size_t iz) const {
+		return index(ix, iy, iz, bricked);
+	}
+
+	size_t storageSize(bool inBricks) const {
+		if (!inBricks)
+			return Nx * Ny * Nz;
+		return ((Nx + 3) / 4) * NBy * NBz * 64;
+	}
 
 public:
 	/** Constructor for cubic grid
@@ -54,7 +172,7 @@ public:
 	 @param	N		Number of grid points in one direction
 	 @param spacing	Spacing between grid points
 	 */
-	Grid(Vector3d origin, size_t N, double spacing) {
+	Grid(Vector3d origin, size_t N, double spacing) : bricked(false), quantum(1), memory("Grid") {
 		setOrigin(origin);
 		setGridSize(N, N, N);
 		setSpacing(Vector3d(spacing));
@@ -68,7 +186,7 @@ public:
 	 @param	Nz		Number of grid points in z-direction
 	 @param spacing	Spacing between grid points
 	 */
-	Grid(Vector3d origin, size_t Nx, size_t Ny, size_t Nz, double spacing) {
+	Grid(Vector3d origin, size_t Nx, size_t Ny, size_t Nz, double spacing) : bricked(false), quantum(1), memory("Grid") {
 		setOrigin(origin);
 		setGridSize(Nx, Ny, Nz);
 		setSpacing(Vector3d(spacing));
@@ -82,7 +200,7 @@ public:
 	 @param	Nz		Number of grid points in z-direction
 	 @param spacing	Spacing vector between grid points
 	*/
-	 Grid(Vector3d origin, size_t Nx, size_t Ny, size_t Nz, Vector3d spacing) {
+	 Grid(Vector3d origin, size_t Nx, size_t Ny, size_t Nz, Vector3d spacing) : bricked(false), quantum(1), memory("Grid") {
 	 	setOrigin(origin);
 	 	setGridSize(Nx, Ny, Nz);
 	 	setSpacing(spacing);
@@ -99,7 +217,11 @@ public:
 		this->Nx = Nx;
 		this->Ny = Ny;
 		this->Nz = Nz;
-		grid.resize(Nx * Ny * Nz);
+		NBy = (Ny + 3) / 4;
+		NBz = (Nz + 3) / 4;
+		mapped = 0;
+		grid.resize(storageSize(bricked));
+		memory.set(grid.capacity() * sizeof(T));
 		setOrigin(origin);
 	}
 
@@ -112,6 +234,57 @@ public:
 		reflective = b;
 	}
 
+	/** Select the bricked (true) or row-major (false) layout, the values are kept */
+	void setBricked(bool b) {
+		if (b == bricked)
+			return;
+		std::vector<T> values(storageSize(b), T());
+		const T *v = storage();
+		for (size_t ix = 0; ix < Nx; ix++)
+			for (size_t iy = 0; iy < Ny; iy++)
+				for (size_t iz = 0; iz < Nz; iz++)
+					values[index(ix, iy, iz, b)] = v[index(ix, iy, iz)];
+		grid.swap(values);
+		memory.set(grid.capacity() * sizeof(T));
+		mapped = 0;
+		bricked = b;
+	}
+
+	/** Use a mapped file as storage, the values have to be in row-major order
+	 as written by dumpGrid. The grid switches to the row-major layout and
+	 the owned values are released. Modified values are not written to the file.
+	 */
+	void setMappedFile(ref_ptr<MappedFile> file) {
+		if (file->getSize() != Nx * Ny * Nz * sizeof(T))
+			throw std::runtime_error("Grid: file and grid size do not match");
+		std::vector<T>().swap(grid);
+		memory.set(0);
+		bricked = false;
+		mapped = file;
+	}
+
+	/** The mapped file of the values, null if the grid owns them */
+	ref_ptr<MappedFile> getMappedFile() const {
+		return mapped;
+	}
+
+	/** Use a mapped file as storage of Nx * Ny * Nz values as setMappedFile,
+	 resizing the grid without allocating the owned values first. */
+	void setMappedFile(ref_ptr<MappedFile> file, size_t Nx, size_t Ny, size_t Nz) {
+		if (file->getSize() != Nx * Ny * Nz * sizeof(T))
+			throw std::runtime_error("Grid: file and grid size do not match");
+		this->Nx = Nx;
+		this->Ny = Ny;
+		this->Nz = Nz;
+		NBy = (Ny + 3) / 4;
+		NBz = (Nz + 3) / 4;
+		setMappedFile(file);
+	}
+
+	bool isMapped() const {
+		return mapped.valid();
+	}
+
 	Vector3d getOrigin() const {
 		return origin;
 	}
@@ -135,66 +308,188 @@ public:
 		return reflective;
 	}
 
+	bool isBricked() const {
+		return bricked;
+	}
+
+	/** Value of one integer step of quantized values, ignored for other types */
+	void setQuantum(double q) {
+		quantum = q;
+	}
+
+	double getQuantum() const {
+		return quantum;
+	}
+
 	/** Inspector & Mutator */
 	T &get(size_t ix, size_t iy, size_t iz) {
-		return grid[ix * Ny * Nz + iy * Nz + iz];
+		return storage()[index(ix, iy, iz)];
 	}
 
 	/** Inspector */
 	const T &get(size_t ix, size_t iy, size_t iz) const {
-		return grid[ix * Ny * Nz + iy * Nz + iz];
+		return storage()[index(ix, iy, iz)];
 	}
 
 	T getValue(size_t ix, size_t iy, size_t iz) {
-		return grid[ix * Ny * Nz + iy * Nz + iz];
+		return storage()[index(ix, iy, iz)];
 	}
 
 	void setValue(size_t ix, size_t iy, size_t iz, T value) {
-		grid[ix * Ny * Nz + iy * Nz + iz] = value;
+		storage()[index(ix, iy, iz)] = value;
 	}
 
-	/** Return a reference to the grid values */
+	/** Return a reference to the grid values in storage order, empty for mapped grids */
 	std::vector<T> &getGrid() {
 		return grid;
 	}
 
-	/** Position of the grid point of a given index */
+	/** The values in storage order, also for mapped grids */
+	T *getData() {
+		return storage();
+	}
+
+	const T *getData() const {
+		return storage();
+	}
+
+	/** Number of stored values, including the padding of bricked grids */
+	size_t getStorageSize() const {
+		return storageSize(bricked);
+	}
+
+	/** Position of the grid point of a given storage index */
 	Vector3d positionFromIndex(int index) const {
-		int ix = index / (Ny * Nz);
-		int iy = (index / Nz) % Ny;
-		int iz = index % Nz;
+		int ix, iy, iz;
+		if (bricked) {
+			int brick = index >> 6;
+			ix = ((brick / (NBy * NBz)) << 2) + ((index >> 4) & 3);
+			iy = (((brick / NBz) % NBy) << 2) + ((index >> 2) & 3);
+			iz = ((brick % NBz) << 2) + (index & 3);
+		} else {
+			ix = index / (Ny * Nz);
+			iy = (index / Nz) % Ny;
+			iz = index % Nz;
+		}
 		return Vector3d(ix, iy, iz) * spacing + gridOrigin;
 	}
 
 	/** Value of a grid point that is closest to a given position */
-	T closestValue(const Vector3d &position) const {
+	typename GridValue<T>::Type closestValue(const Vector3d &position) const {
 		Vector3d r = (position - gridOrigin) / spacing;
 		int ix = round(r.x);
 		int iy = round(r.y);
 		int iz = round(r.z);
 		if (reflective) {
-			while ((ix < 0) or (ix > Nx))
-				ix = 2 * Nx * (ix > Nx) - ix;
-			while ((iy < 0) or (iy > Ny))
-				iy = 2 * Ny * (iy > Ny) - iy;
-			while ((iz < 0) or (iz > Nz))
-				iz = 2 * Nz * (iz > Nz) - iz;
+			ix = reflectiveIndex(ix, Nx);
+			iy = reflectiveIndex(iy, Ny);
+			iz = reflectiveIndex(iz, Nz);
 		} else {
-			ix = ((ix % Nx) + Nx) % Nx;
-			iy = ((iy % Ny) + Ny) % Ny;
-			iz = ((iz % Nz) + Nz) % Nz;
+			// signed modulo, negative indices wrap around
+			ix = ((ix % int(Nx)) + int(Nx)) % int(Nx);
+			iy = ((iy % int(Ny)) + int(Ny)) % int(Ny);
+			iz = ((iz % int(Nz)) + int(Nz)) % int(Nz);
 		}
-		return get(ix, iy, iz);
+		return GridValue<T>::decode(get(ix, iy, iz), quantum);
 	}
 
 	/** Interpolate the grid at a given position */
-	T interpolate(const Vector3d &position) const {
+	typename GridValue<T>::Type interpolate(const Vector3d &position) const {
+		return reflective ? interpolateAt<true>(position) : interpolateAt<false>(position);
+	}
+
+	/** Interpolate the grid at n positions
+	 @param positions	array of n positions
+	 @param values		array of n values to fill
+	 */
+	void interpolate(const Vector3d *positions, typename GridValue<T>::Type *values,
+			size_t n) const {
+		// the mode is selected once for all positions
+		if (reflective) {
+			for (size_t i = 0; i < n; i++)
+				values[i] = interpolateAt<true>(positions[i]);
+		} else {
+			for (size_t i = 0; i < n; i++)
+				values[i] = interpolateAt<false>(positions[i]);
+		}
+	}
+
+	/** Tricubic interpolation of the 4x4x4 surrounding grid points with
+	 Catmull-Rom splines along each axis. The interpolated field and its first
+	 derivatives are continuous across the cells and the error decreases with
+	 the third power of the spacing instead of the second, so a coarser grid
+	 gives the same accuracy as trilinear interpolation. About 8 times the
+	 work of interpolate. */
+	typename GridValue<T>::Type interpolateTricubic(const Vector3d &position) const {
+		return reflective ? interpolateTricubicAt<true>(position)
+				: interpolateTricubicAt<false>(position);
+	}
+
+private:
+	/** Catmull-Rom weights of the points -1, 0, 1, 2 at the fraction f */
+	static void cubicWeights(double f, float w[4]) {
+		double f2 = f * f, f3 = f2 * f;
+		w[0] = 0.5 * (-f3 + 2 * f2 - f);
+		w[1] = 0.5 * (3 * f3 - 5 * f2 + 2);
+		w[2] = 0.5 * (-3 * f3 + 4 * f2 + f);
+		w[3] = 0.5 * (f3 - f2);
+	}
+
+	/** Indices of the points -1, 0, 1, 2 around the unit grid position x */
+	template<bool Reflective>
+	static void cubicIndices(double x, int n, int i[4]) {
+		int i0 = int(floor(x));
+		for (int k = 0; k < 4; k++) {
+			int j = i0 + k - 1;
+			if (Reflective) {
+				i[k] = reflectiveIndex(j, n);
+			} else {
+				j %= n;
+				i[k] = j + (j < 0) * n;
+			}
+		}
+	}
+
+	template<bool Reflective>
+	typename GridValue<T>::Type interpolateTricubicAt(const Vector3d &position) const {
+		Vector3d r = (position - gridOrigin) / spacing;
+		int ix[4], iy[4], iz[4];
+		cubicIndices<Reflective>(r.x, Nx, ix);
+		cubicIndices<Reflective>(r.y, Ny, iy);
+		cubicIndices<Reflective>(r.z, Nz, iz);
+		float wx[4], wy[4], wz[4];
+		cubicWeights(r.x - floor(r.x), wx);
+		cubicWeights(r.y - floor(r.y), wy);
+		cubicWeights(r.z - floor(r.z), wz);
+
+		// successive interpolations along z, y and x on padded lanes
+		typedef typename GridValue<T>::Type V;
+		typedef typename Padded<V>::Type L;
+		const T *values = storage();
+		L bx = L();
+		for (int a = 0; a < 4; a++) {
+			L by = L();
+			for (int b = 0; b < 4; b++) {
+				L bz = L();
+				for (int c = 0; c < 4; c++)
+					bz += L(GridValue<T>::decode(values[index(ix[a], iy[b], iz[c])],
+							quantum)) * wz[c];
+				by += bz * wy[b];
+			}
+			bx += by * wx[a];
+		}
+		return V(bx);
+	}
+
+	/** Interpolation of a periodically (false) or reflectively (true) extended grid */
+	template<bool Reflective>
+	typename GridValue<T>::Type interpolateAt(const Vector3d &position) const {
 		// position on a unit grid
 		Vector3d r = (position - gridOrigin) / spacing;
 
 		// indices of lower and upper neighbors
 		int ix, iX, iy, iY, iz, iZ;
-		if (reflective) {
+		if (Reflective) {
 			reflectiveClamp(r.x, Nx, ix, iX);
 			reflectiveClamp(r.y, Ny, iy, iY);
 			reflectiveClamp(r.z, Nz, iz, iZ);
@@ -206,37 +501,57 @@ public:
 
 		// linear fraction to lower and upper neighbors
 		double fx = r.x - floor(r.x);
-		double fX = 1 - fx;
 		double fy = r.y - floor(r.y);
-		double fY = 1 - fy;
 		double fz = r.z - floor(r.z);
-		double fZ = 1 - fz;
-
-		// trilinear interpolation (see http://paulbourke.net/miscellaneous/interpolation)
-		T b(0.);
-		//V000 (1 - x) (1 - y) (1 - z) +
-		b += get(ix, iy, iz) * fX * fY * fZ;
-		//V100 x (1 - y) (1 - z) +
-		b += get(iX, iy, iz) * fx * fY * fZ;
-		//V010 (1 - x) y (1 - z) +
-		b += get(ix, iY, iz) * fX * fy * fZ;
-		//V001 (1 - x) (1 - y) z +
-		b += get(ix, iy, iZ) * fX * fY * fz;
-		//V101 x (1 - y) z +
-		b += get(iX, iy, iZ) * fx * fY * fz;
-		//V011 (1 - x) y z +
-		b += get(ix, iY, iZ) * fX * fy * fz;
-		//V110 x y (1 - z) +
-		b += get(iX, iY, iz) * fx * fy * fZ;
-		//V111 x y z
-		b += get(iX, iY, iZ) * fx * fy * fz;
-
-		return b;
+
+		// values of the 8 neighbors, v[x][y][z] with 0: lower, 1: upper
+		const T *values = storage();
+		const T *v[2][2][2];
+		if (bricked) {
+			v[0][0][0] = &values[index(ix, iy, iz, true)];
+			v[0][0][1] = &values[index(ix, iy, iZ, true)];
+			v[0][1][0] = &values[index(ix, iY, iz, true)];
+			v[0][1][1] = &values[index(ix, iY, iZ, true)];
+			v[1][0][0] = &values[index(iX, iy, iz, true)];
+			v[1][0][1] = &values[index(iX, iy, iZ, true)];
+			v[1][1][0] = &values[index(iX, iY, iz, true)];
+			v[1][1][1] = &values[index(iX, iY, iZ, true)];
+		} else {
+			// offsets of the x-y columns, z is contiguous
+			size_t x0 = ix * Ny * Nz, x1 = iX * Ny * Nz;
+			size_t y0 = iy * Nz, y1 = iY * Nz;
+			v[0][0][0] = &values[x0 + y0 + iz];
+			v[0][0][1] = &values[x0 + y0 + iZ];
+			v[0][1][0] = &values[x0 + y1 + iz];
+			v[0][1][1] = &values[x0 + y1 + iZ];
+			v[1][0][0] = &values[x1 + y0 + iz];
+			v[1][0][1] = &values[x1 + y0 + iZ];
+			v[1][1][0] = &values[x1 + y1 + iz];
+			v[1][1][1] = &values[x1 + y1 + iZ];
+		}
+
+		// trilinear interpolation as successive linear interpolations along
+		// z, y and x (see http://paulbourke.net/miscellaneous/interpolation),
+		// vectors on 4 padded lanes
+		typedef typename GridValue<T>::Type V;
+		typedef typename Padded<V>::Type L;
+		L c[2][2][2];
+		for (int i = 0; i < 8; i++)
+			c[i >> 2][(i >> 1) & 1][i & 1] = GridValue<T>::decode(
+					*v[i >> 2][(i >> 1) & 1][i & 1], quantum);
+		L b00 = c[0][0][0] + (c[0][0][1] - c[0][0][0]) * fz;
+		L b10 = c[1][0][0] + (c[1][0][1] - c[1][0][0]) * fz;
+		L b01 = c[0][1][0] + (c[0][1][1] - c[0][1][0]) * fz;
+		L b11 = c[1][1][0] + (c[1][1][1] - c[1][1][0]) * fz;
+		L b0 = b00 + (b01 - b00) * fy;
+		L b1 = b10 + (b11 - b10) * fy;
+		return V(b0 + (b1 - b0) * fx);
 	}
 };
 
 typedef Grid<Vector3f> VectorGrid;
 typedef Grid<float> ScalarGrid;
+typedef Grid<Vector3s> QuantizedVectorGrid;
 /** @}*/
 
 } // namespace crpropa
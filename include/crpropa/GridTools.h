@@ -3,6 +3,7 @@
 
 #include "crpropa/Grid.h"
 #include "crpropa/magneticField/MagneticField.h"
+#include <stdint.h>
 #include <string>
 
 /**
@@ -42,6 +43,18 @@ void scaleGrid(ref_ptr<ScalarGrid> grid, double a);
 /** Multiply all grid values by a given factor */
 void scaleGrid(ref_ptr<VectorGrid> grid, double a);
 
+/** Quantized copy of a VectorGrid with half the memory. The quantum is the
+ largest absolute component divided by 32767, i.e. the relative error of the
+ strongest components is about 1e-5. */
+ref_ptr<QuantizedVectorGrid> quantizeGrid(ref_ptr<VectorGrid> grid);
+
+/** Interleave the grid memory over all NUMA nodes, see interleaveMemory.
+ Call after initialising the grid, e.g. with initTurbulence or loadGrid. */
+bool interleaveGrid(ref_ptr<ScalarGrid> grid);
+/** Interleave the grid memory over all NUMA nodes, see interleaveMemory.
+ Call after initialising the grid, e.g. with initTurbulence or loadGrid. */
+bool interleaveGrid(ref_ptr<VectorGrid> grid);
+
 #ifdef CRPROPA_HAVE_FFTW3F
 /**
  Create a random initialization of a turbulent field.
@@ -50,28 +63,67 @@ void scaleGrid(ref_ptr<VectorGrid> grid, double a);
  @param alpha	Power law index of <B^2(k)> ~ k^alpha (alpha = -11/3 corresponds to a Kolmogorov spectrum)
  @param Brms	RMS field strength
  @param seed	Random seed
+
+ The modes in k-space are filled in parallel with OpenMP, each x-plane with
+ its own random stream, and the transformation uses all threads if FFTW was
+ built with OpenMP support. The components are transformed one after another,
+ so the temporary memory is about the size of the grid.
  */
 void initTurbulence(ref_ptr<VectorGrid> grid, double Brms, double lMin, double lMax, 
 	   double alpha = -11./3., int seed = 0, bool helicity = false, double H = 0);
+
+#if defined(CRPROPA_HAVE_MPI) && defined(CRPROPA_HAVE_FFTW3F_MPI)
+/**
+ Create a turbulent field on a cubic grid of n^3 points distributed over all
+ MPI ranks and write it to a binary file as dumpGrid would (see mapGrid,
+ loadGrid). Every rank only holds a slab of x-planes, so the grid can be
+ larger than the memory of a single node. To be called by all ranks, the
+ parameters are as for initTurbulence. With the same seed the field is
+ identical to the one of initTurbulence.
+ */
+void dumpTurbulence(std::string filename, size_t n, double spacing, double Brms,
+		double lMin, double lMax, double alpha = -11./3., int seed = 0,
+		bool helicity = false, double H = 0);
+#endif
 #endif // CRPROPA_HAVE_FFTW3F
 
 /** Analytically calculate the correlation length of a turbulent field */
 double turbulentCorrelationLength(double lMin, double lMax,
 		double alpha = (-11./3.));
 
-/** Fill vector grid from provided magnetic field */
+/** Fill vector grid from provided magnetic field, in parallel with OpenMP */
 void fromMagneticField(ref_ptr<VectorGrid> grid, ref_ptr<MagneticField> field);
 
-/** Fill scalar grid from provided magnetic field */
+/** Fill scalar grid from provided magnetic field, in parallel with OpenMP */
 void fromMagneticFieldStrength(ref_ptr<ScalarGrid> grid, ref_ptr<MagneticField> field);
 
-/** Load a VectorGrid from a binary file with single precision */
+/** Load a VectorGrid from a binary file with single precision.
+ The file is mapped and copied in chunks by all threads. If a checksum is
+ given, see gridChecksum, it is verified while copying, 0: not checked. */
 void loadGrid(ref_ptr<VectorGrid> grid, std::string filename,
-		double conversion = 1);
+		double conversion = 1, uint64_t checksum = 0);
 
 /** Load a ScalarGrid from a binary file with single precision */
 void loadGrid(ref_ptr<ScalarGrid> grid, std::string filename,
-		double conversion = 1);
+		double conversion = 1, uint64_t checksum = 0);
+
+/** Checksum of a binary grid file for loadGrid, a 64 bit FNV-1a over the
+ FNV-1a of chunks of 1 MB, computed by all threads */
+uint64_t gridChecksum(std::string filename);
+
+/** Map a binary file with single precision as storage of a VectorGrid, see
+ Grid::setMappedFile. Values are read on first access and the pages are shared
+ between processes. There is no conversion factor, the file is used as is.
+ A file of an open SimulationBundle is mapped from the bundle. */
+void mapGrid(ref_ptr<VectorGrid> grid, std::string filename);
+
+/** Map a binary file with single precision as storage of a ScalarGrid, see
+ Grid::setMappedFile. */
+void mapGrid(ref_ptr<ScalarGrid> grid, std::string filename);
+
+/** The file of an open SimulationBundle, or the file itself, mapped for
+ Grid::setMappedFile */
+ref_ptr<MappedFile> mapGridFile(const std::string &filename);
 
 /** Dump a VectorGrid to a binary file */
 void dumpGrid(ref_ptr<VectorGrid> grid, std::string filename,
@@ -81,7 +133,9 @@ void dumpGrid(ref_ptr<VectorGrid> grid, std::string filename,
 void dumpGrid(ref_ptr<ScalarGrid> grid, std::string filename,
 		double conversion = 1);
 
-/** Load a VectorGrid grid from a plain text file */
+/** Load a VectorGrid grid from a plain text file.
+ The text is split into a part per thread, which counts and then parses its
+ values; decimal values are parsed without the C library, others with strtod. */
 void loadGridFromTxt(ref_ptr<VectorGrid> grid, std::string filename,
 		double conversion = 1);
 
@@ -0,0 +1,85 @@
+#ifndef CRPROPA_GZIPSTREAM_H
+#define CRPROPA_GZIPSTREAM_H
+
+#ifdef CRPROPA_HAVE_ZLIB
+
+#include <deque>
+#include <map>
+#include <ostream>
+#include <pthread.h>
+#include <streambuf>
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup Tools
+ * @{
+ */
+
+/**
+ @class GzipStreamBuffer
+ @brief Stream buffer of GzipStream, compresses blocks in worker threads
+ */
+class GzipStreamBuffer: public std::streambuf {
+	struct Job {
+		size_t sequence;
+		std::vector<char> input;
+		std::vector<char> output;
+		unsigned long crc;
+		bool last;
+	};
+
+	std::ostream *out;
+	int level;
+	std::vector<char> buffer;
+	size_t sequence; ///< of the next block
+	size_t nextWrite; ///< sequence of the next block to write
+	unsigned long crc; ///< of the written data
+	unsigned long length; ///< of the written data, modulo 2^32
+	bool closed;
+
+	std::deque<Job *> jobs; ///< blocks to compress
+	std::map<size_t, Job *> done; ///< compressed blocks, not yet written
+	std::vector<pthread_t> workers;
+	pthread_mutex_t mutex; ///< guards jobs, done and stop
+	pthread_cond_t changed;
+	bool stop;
+
+	void push(bool last);
+	void compress(Job *job) const;
+	void writeDone();
+	static void *workerMain(void *buffer);
+protected:
+	int overflow(int c);
+	int sync();
+	std::streamsize xsputn(const char *s, std::streamsize n);
+public:
+	GzipStreamBuffer(std::ostream &out, int level, size_t threads);
+	~GzipStreamBuffer();
+	/// Compress and write the remaining data and the gzip trailer
+	void close();
+};
+
+/**
+ @class GzipStream
+ @brief Output stream writing a gzip file, compressed in parallel.
+
+ The data is split into blocks of 256 kB that are compressed independently by
+ worker threads (as pigz) and written in order as one gzip member, readable
+ by gzip, zcat and zstream::igzstream. Without a dictionary between the blocks
+ the compression is slightly weaker than that of a single deflate stream.
+ */
+class GzipStream: public std::ostream {
+	GzipStreamBuffer buf;
+public:
+	/// threads = 0: one worker per processor
+	GzipStream(std::ostream &out, int level = 6, size_t threads = 0);
+	void close();
+};
+
+/** @} */
+} // namespace crpropa
+
+#endif // CRPROPA_HAVE_ZLIB
+
+#endif // CRPROPA_GZIPSTREAM_H
@@ -0,0 +1,77 @@
+#ifndef CRPROPA_LOCK_H
+#define CRPROPA_LOCK_H
+
+#include <cstddef>
+#include <string>
+
+namespace crpropa {
+/**
+ * \addtogroup Tools
+ * @{
+ */
+
+/**
+ @class Lock
+ @brief Named mutual exclusion of the critical sections of one resource.
+
+ Unlike an unnamed omp critical, which shares one global lock with all other
+ unnamed critical sections, a Lock only serializes its own sections, e.g. the
+ writes of one output. In builds with CRPROPA_LOCK_PROFILING (CMake option
+ ENABLE_LOCK_PROFILING) the time each thread waits for and holds the lock is
+ recorded, see LockProfile, and waits are added to a started Trace. Without
+ OpenMP locking does nothing.
+ */
+class Lock {
+	void *impl; ///< omp_lock_t
+	size_t site;
+	size_t traceName;
+	double acquired; ///< time of the acquisition, written by the holder
+	double waited; ///< wait time of the acquisition, written by the holder
+	Lock(const Lock &);
+	Lock &operator=(const Lock &);
+public:
+	/// Locks of the same name are reported together
+	Lock(const std::string &name);
+	~Lock();
+	void lock();
+	void unlock();
+};
+
+/// Holds a Lock from its construction to the end of the scope
+class ScopedLock {
+	Lock &l;
+	ScopedLock(const ScopedLock &);
+	ScopedLock &operator=(const ScopedLock &);
+public:
+	ScopedLock(Lock &l) :
+			l(l) {
+		l.lock();
+	}
+	~ScopedLock() {
+		l.unlock();
+	}
+};
+
+/**
+ @class LockProfile
+ @brief Wait and hold times of the Locks, per name and thread.
+
+ Only recorded in builds with CRPROPA_LOCK_PROFILING. The times are
+ accumulated per thread without locking, the report of ModuleList::run
+ of a candidate vector or a source is printed at its end.
+ */
+class LockProfile {
+public:
+	static bool isEnabled(); ///< built with CRPROPA_LOCK_PROFILING
+	static size_t addSite(const std::string &name); ///< index of the name
+	/// add one acquisition of the current thread
+	static void record(size_t site, double wait, double hold);
+	static std::string getReport();
+	static void show();
+	static void reset();
+};
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_LOCK_H
@@ -0,0 +1,75 @@
+#ifndef CRPROPA_MPIRUNNER_H
+#define CRPROPA_MPIRUNNER_H
+
+#ifdef CRPROPA_HAVE_MPI
+
+#include "crpropa/ModuleList.h"
+#include "crpropa/Source.h"
+#include "crpropa/Referenced.h"
+
+#include <string>
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup Core
+ * @{
+ */
+
+/**
+ @class MPIRunner
+ @brief Distribute the candidates of a ModuleList::run over MPI processes
+
+ The requested number of candidates is handed out in chunks via a shared
+ counter on rank 0 (MPI-3 one-sided communication). Every rank fetches a new
+ chunk when it has finished the last one, so fast and slow ranks are balanced
+ automatically. Within a rank, ModuleList::run parallelises with OpenMP.
+
+ Every rank has to write to its own output files, use getShardFilename to
+ construct the filenames. After the run the shards can be listed in an index
+ file (writeIndex) or, for TextOutput, merged into a single file (mergeText).
+ Outputs have to be closed before merging.
+
+ Candidate serial numbers are unique over all ranks, each rank starts at
+ rank * 2^48.
+
+ MPI_Init has to be called before creating the runner, and MPI_Finalize
+ after destroying it, e.g. by mpi4py when used from Python.
+ */
+class MPIRunner: public Referenced {
+	ref_ptr<ModuleList> mlist;
+	size_t chunkSize;
+	int rank, size;
+	size_t processed; ///< candidates run by this rank
+public:
+	MPIRunner(ModuleList *mlist, size_t chunkSize = 1000);
+
+	int getRank() const;
+	int getSize() const;
+	size_t getNumberOfProcessed() const; ///< number of candidates run by this rank
+
+	void setChunkSize(size_t chunkSize);
+	size_t getChunkSize() const;
+
+	/// Seed all threads of all ranks with disjoint streams, see Random::seedThreadsDisjoint
+	void seed(uint32_t seed);
+
+	/// Run count candidates from the source, distributed over all ranks
+	void run(SourceInterface *source, size_t count, bool recursive = true);
+
+	/// Filename of the shard of this rank, e.g. events.txt -> events.3.txt
+	std::string getShardFilename(const std::string &filename) const;
+	std::string getShardFilename(const std::string &filename, int rank) const;
+
+	/// Rank 0 writes the list of all shard filenames into the given file
+	void writeIndex(const std::string &filename, const std::string &indexFilename) const;
+
+	/// Rank 0 concatenates the TextOutput shards into filename, keeping only the first header
+	void mergeText(const std::string &filename, bool removeShards = false) const;
+};
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_HAVE_MPI
+#endif // CRPROPA_MPIRUNNER_H
@@ -0,0 +1,54 @@
+#ifndef CRPROPA_MAPPEDFILE_H
+#define CRPROPA_MAPPEDFILE_H
+
+#include "crpropa/Referenced.h"
+#include "crpropa/MemoryAccounting.h"
+
+#include <cstddef>
+#include <string>
+
+namespace crpropa {
+/**
+ * \addtogroup Tools
+ * @{
+ */
+
+/**
+ @class MappedFile
+ @brief A file mapped into memory, unmapped when the last reference is gone
+
+ The file is mapped privately: all processes that map the same file share
+ its pages in the page cache, pages that are modified are copied for the
+ modifying process only and the file itself is never changed.
+ Only available on POSIX systems.
+
+ A MappedFile can also be a region of another one, e.g. a file in a
+ SimulationBundle, which stays mapped as long as the region is used.
+ */
+class MappedFile: public Referenced {
+	void *data;
+	size_t size;
+	std::string filename;
+	MemoryAccount memory; ///< the mapped size, pages may be shared
+	ref_ptr<MappedFile> parent; ///< set for a region
+
+	// not copyable
+	MappedFile(const MappedFile&);
+	MappedFile &operator=(const MappedFile&);
+public:
+	/** Map the whole file, throws if it cannot be opened or mapped */
+	MappedFile(const std::string &filename);
+	/** Region of size bytes at the offset of a mapped file, named filename */
+	MappedFile(ref_ptr<MappedFile> file, size_t offset, size_t size,
+			const std::string &filename);
+	~MappedFile();
+
+	void *getData() const;
+	size_t getSize() const; ///< size in bytes
+	std::string getFilename() const;
+};
+
+/** @} */
+} // namespace crpropa
+
+#endif // CRPROPA_MAPPEDFILE_H
@@ -0,0 +1,68 @@
+#ifndef CRPROPA_MEMORYACCOUNTING_H
+#define CRPROPA_MEMORYACCOUNTING_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup Tools
+ * @{
+ */
+
+/**
+ @class MemoryAccounting
+ @brief Bytes held by the large owners of memory and the live candidates.
+
+ Grids, mapped files, data tables, the tables of PhotoDisintegration and
+ EMPairProduction, lens parts and ParticleCollectors report their bytes per
+ category (see MemoryAccount), with the peak since the last resetPeaks().
+ Candidates are counted per thread: the candidates allocated minus deleted by
+ the thread, with its peak. Threads that delete the candidates of other
+ threads, e.g. secondary tasks, may have negative counts.
+ */
+class MemoryAccounting {
+public:
+	/// index of the category with the given name, added if new
+	static size_t addCategory(const std::string &name);
+	/// change the bytes of a category, negative when released
+	static void add(size_t category, long long bytes);
+	static long long getBytes(const std::string &category); ///< 0 for unknown categories
+	static long long getPeakBytes(const std::string &category);
+	static std::vector<std::string> getCategoryNames();
+
+	/// count allocated (1) or deleted (-1) candidates of the current thread
+	static void countCandidates(long n);
+	static long getLiveCandidates(); ///< summed over the threads
+	static size_t getCandidateThreads(); ///< threads that counted candidates
+	static long getPeakLiveCandidates(size_t thread);
+	static void resetPeaks(); ///< set the peaks to the current values
+
+	static std::string getReport();
+	static void show();
+};
+
+/**
+ @class MemoryAccount
+ @brief The bytes of one owner in a category of MemoryAccounting.
+
+ A member of the owner, a copy holds the same bytes, they are released when
+ it is destroyed.
+ */
+class MemoryAccount {
+	size_t category;
+	long long bytes;
+public:
+	MemoryAccount(const std::string &category);
+	MemoryAccount(const MemoryAccount &account);
+	MemoryAccount &operator=(const MemoryAccount &account);
+	~MemoryAccount();
+	void set(size_t bytes); ///< current bytes of the owner
+	size_t get() const;
+};
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_MEMORYACCOUNTING_H
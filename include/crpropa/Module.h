@@ -2,10 +2,12 @@
 #define CRPROPA_MODULE_H
 
 #include "crpropa/Candidate.h"
+#include "crpropa/Configuration.h"
 #include "crpropa/Referenced.h"
 #include "crpropa/Common.h"
 
 #include <string>
+#include <vector>
 
 namespace crpropa {
 
@@ -27,6 +29,51 @@ public:
 	inline void process(ref_ptr<Candidate> candidate) const {
 		process(candidate.get());
 	}
+	/** Process n candidates, used by batched runs (ModuleList::setBreadthFirst).
+	 The default calls process for one candidate after the other, modules
+	 can override it with a kernel that handles all candidates at once.
+	 */
+	virtual void processBatch(Candidate *const *candidates, size_t n) const;
+
+	/** Particle classes, combined to bit masks by getParticleClasses */
+	enum ParticleClass {
+		NucleusClass = 1, ///< charged nuclei and protons
+		NeutronClass = 2,
+		PhotonClass = 4,
+		ElectronClass = 8, ///< electrons and positrons
+		NeutrinoClass = 16,
+		OtherClass = 32,
+		NucleiClasses = NucleusClass | NeutronClass,
+		ChargedClasses = NucleusClass | ElectronClass | OtherClass,
+		AllClasses = 63
+	};
+	/** The ParticleClass of a particle ID */
+	static int particleClass(int id);
+	/** Particle classes the module acts on. process leaves candidates of
+	 other classes unchanged (no step limit, no random numbers drawn), so
+	 ModulePipeline can skip it for them. The default is AllClasses.
+	 */
+	virtual int getParticleClasses() const;
+	/** Type and parameters of the module for ConfigurationDocument, the
+	 default throws as the module cannot be saved. */
+	virtual void getConfiguration(Configuration &configuration) const;
+};
+
+/**
+ @class BatchModule
+ @brief Abstract Module that processes candidates in chunks, e.g. written in Python.
+
+ process and processBatch call processCandidateVector, in batched runs
+ (ModuleList::setBreadthFirst) with all candidates of a step. A module
+ written in Python then takes the GIL once per step of the batch instead of
+ once per candidate.
+ */
+class BatchModule: public Module {
+public:
+	virtual void processCandidateVector(
+			const std::vector<Candidate *> &candidates) const = 0;
+	void process(Candidate *candidate) const;
+	void processBatch(Candidate *const *candidates, size_t n) const;
 };
 
 
@@ -38,8 +85,8 @@ class AbstractCondition: public Module {
 protected:
 	ref_ptr<Module> rejectAction, acceptAction;
 	bool makeRejectedInactive, makeAcceptedInactive;
-	std::string rejectFlagKey, rejectFlagValue;
-	std::string acceptFlagKey, acceptFlagValue;
+	PropertyKey rejectFlagKey, acceptFlagKey;
+	std::string rejectFlagValue, acceptFlagValue;
 
 	void reject(Candidate *candidate) const;
 	inline void reject(ref_ptr<Candidate> candidate) const {
@@ -51,14 +98,100 @@ protected:
 		accept(candidate.get());
 	}
 
+	/** process by check: apply the decision and limit the next step */
+	void processCheck(Candidate *candidate) const;
+
 public:
+	/** Outcome of check */
+	enum Decision {
+		Continue, ///< the condition does not apply
+		Reject, ///< the candidate is to be rejected
+		Accept, ///< the candidate is to be accepted
+		Unsupported ///< no check, the condition has to be processed
+	};
+
 	AbstractCondition();
+	/** Evaluate the condition for the current state without acting on the
+	 candidate, used by ConditionSet. stepLimit is lowered to the step the
+	 condition allows. The default returns Unsupported.
+	 */
+	virtual Decision check(const Candidate *candidate, double &stepLimit) const;
+	/** Reject or accept the candidate according to a decision of check */
+	void apply(Candidate *candidate, Decision decision) const;
 	void onReject(Module *rejectAction);
 	void onAccept(Module *acceptAction);
 	void setMakeRejectedInactive(bool makeInactive);
 	void setMakeAcceptedInactive(bool makeInactive);
 	void setRejectFlag(std::string key, std::string value);
 	void setAcceptFlag(std::string key, std::string value);
+	/** Saves the actions and flags, for getConfiguration of the conditions */
+	void getConditionConfiguration(Configuration &configuration) const;
+};
+
+/**
+ @class Interaction
+ @brief Abstract Module for discrete interactions.
+
+ The module provides the total interaction rate for the current state of a
+ candidate and performs single interactions, choosing the channel according
+ to the partial rates. InteractionCollection combines several interactions
+ with a single random draw per step.
+ */
+class Interaction: public Module {
+	double bias;
+public:
+	Interaction();
+	/** Total interaction rate in [1/m] per comoving distance, including the
+	 cosmological scaling, 0 if the candidate does not interact */
+	virtual double interactionRate(const Candidate *candidate) const = 0;
+	/** Perform one interaction with a channel chosen according to the partial rates */
+	virtual void interact(Candidate *candidate) const = 0;
+
+	/**
+	 Interaction biasing, for rare secondaries: the interactions are drawn
+	 with b times the interaction rate, b >= 1 (default 1: unbiased).
+	 At each drawn interaction a copy of the candidate with weight w / b
+	 interacts, the candidate itself continues unchanged with weight
+	 w (1 - 1 / b), see interactBiased. The expected weights of both
+	 branches are those of the unbiased simulation, written by the outputs
+	 with the WeightColumn.
+	 */
+	void setInteractionBias(double b);
+	double getInteractionBias() const;
+	/**
+	 One interaction drawn with the biased rate. Without bias the candidate
+	 interacts, otherwise the interacting copy and its products are added
+	 as secondaries of the candidate, the copy only while it is active.
+	 */
+	void interactBiased(Candidate *candidate) const;
+
+protected:
+	/**
+	 Leading particle thinning (Hillas): the one of the n products of an
+	 interaction with the given energies that is kept, drawn with a probability
+	 proportional to its energy. Its weight is to be multiplied by the total
+	 energy over its energy.
+	 */
+	static size_t leadingParticle(const double *energies, size_t n);
+};
+
+/**
+ @class ContinuousLoss
+ @brief Abstract Module for continuous energy losses.
+
+ The module provides the energy loss rate of a candidate and emits the
+ secondaries of an energy loss. ContinuousLossCollection integrates the
+ losses of several modules jointly over long steps.
+ */
+class ContinuousLoss: public Module {
+public:
+	/** Energy loss rate -dE/dx in [J/m] per comoving distance of the candidate
+	 at its current position, but with the energy E and the redshift z,
+	 0 if the candidate has no losses */
+	virtual double energyLossRate(const Candidate *candidate, double E, double z) const = 0;
+	/** Emit the secondaries of the energy loss dE over the last step at the
+	 mean energy E, the default emits none */
+	virtual void emitSecondaries(Candidate *candidate, double E, double dE) const;
 };
 } // namespace crpropa
 
@@ -3,6 +3,7 @@
 
 #include "crpropa/Candidate.h"
 #include "crpropa/Module.h"
+#include "crpropa/PerfCounters.h"
 #include "crpropa/Source.h"
 
 #include <list>
@@ -10,6 +11,10 @@
 
 namespace crpropa {
 
+class ProgressBar;
+class Clock;
+class Output;
+
 /**
  @class ModuleList
  @brief The simulation itself: A list of simulation modules
@@ -19,9 +24,158 @@ public:
 	typedef std::list<ref_ptr<Module> > module_list_t;
 	typedef std::vector<ref_ptr<Candidate> > candidate_vector_t;
 
+	/** Distribution of the candidates of a run over the OpenMP threads.
+	 DefaultSchedule uses the OMP_SCHEDULE given at configure time, the others
+	 correspond to the OpenMP schedules of the same name. AdaptiveSchedule
+	 hands out chunks whose size follows the measured time per candidate.
+	 */
+	enum ScheduleType {
+		DefaultSchedule, StaticSchedule, DynamicSchedule, GuidedSchedule, AdaptiveSchedule
+	};
+
 	ModuleList();
 	virtual ~ModuleList();
 	void setShowProgress(bool show = true); ///< activate a progress bar
+	/** Write the progress of the runs (primaries and secondaries per second,
+	 ETA) every interval seconds to a JSON file, see
+	 ProgressBar::setHeartbeatFile. An empty name (default) disables. */
+	void setHeartbeatFile(const std::string &filename, double interval = 10);
+
+	/** Select the scheduling of candidates over threads.
+	 @param type		the scheduling policy
+	 @param chunkSize	chunk size (0: OpenMP default), initial chunk size for AdaptiveSchedule
+	 */
+	void setSchedule(ScheduleType type, size_t chunkSize = 0);
+	ScheduleType getScheduleType() const;
+	size_t getScheduleChunkSize() const; ///< for AdaptiveSchedule the last chunk size used
+	/** Number of primaries each thread draws at once from the source of
+	 run(SourceInterface*, ...), see SourceInterface::getCandidates.
+	 Primaries left over at the end of the run (or of a checkpoint interval)
+	 are discarded. 1 draws each primary with getCandidate.
+	 */
+	void setSourceBatchSize(size_t size);
+	size_t getSourceBatchSize() const;
+	/** Give each primary its own counter-based random stream (Philox).
+	 Before the i-th primary of a run is drawn from the source (or taken from
+	 the candidate vector) the generator of the thread is seeded with
+	 Random::seedCounter(key, i), primaries are then drawn one by one. The
+	 results of each primary do not depend on the number of threads or the
+	 scheduling, as long as its secondaries are propagated by the same
+	 thread (no parallel secondaries). Use a different key for each run.
+
+	 Each candidate then records the stream and position of the generator at
+	 the start of its propagation in the properties Replay.stream and
+	 Replay.position, its redshift and trajectory length in Replay.redshift
+	 and Replay.trajectoryLength if not 0, so that replay can run it again
+	 exactly. Not recorded with parallel secondaries, breadth first or
+	 streamed secondaries, or secondaries first, where the streams of the
+	 candidates of a tree interleave.
+	 */
+	void setCounterBasedRandom(bool enable = true, uint64_t key = 0);
+	bool getCounterBasedRandom() const;
+	uint64_t getRandomKey() const;
+	/**
+	 Run a candidate recorded with counter-based random streams again from
+	 the start of its propagation, with the same random numbers: from its
+	 created state with the recorded redshift and trajectory length. The
+	 results are the same if the modules are, added modules must not draw
+	 random numbers (e.g. a trajectory output). The generator of the thread
+	 is restored afterwards. Throws if the candidate has no recorded stream.
+	 */
+	void replay(Candidate *candidate, bool recursive = true);
+	/// True if the candidate has a recorded stream for replay
+	static bool canReplay(const Candidate *candidate);
+	/** Propagate secondaries as OpenMP tasks that can be picked up by idle threads.
+	 Only used when secondaries are propagated after their parent (secondariesFirst = false).
+	 */
+	void setParallelSecondaries(bool parallel = true);
+	bool getParallelSecondaries() const;
+	/** Propagate the candidate tree breadth-first in batches.
+	 All active candidates of a tree form a batch, sorted by particle type,
+	 that is passed through one module after the other, and new secondaries
+	 join the batch in the next step. Used by recursive runs of a single
+	 candidate, the order of secondaries and primaries is not preserved.
+	 */
+	void setBreadthFirst(bool breadthFirst = true);
+	bool getBreadthFirst() const;
+	/** Release secondaries as soon as they are propagated.
+	 The secondaries of a finished candidate are moved to a work queue of the
+	 thread and freed after their own propagation, so the memory of a cascade
+	 is bounded by its depth instead of its size. Detached secondaries keep
+	 their ancestors alive, Candidate::parent stays valid. Used when
+	 secondaries are propagated after their parent (secondariesFirst = false),
+	 the secondaries vectors are empty after the run.
+	 */
+	void setStreamSecondaries(bool stream = true);
+	bool getStreamSecondaries() const;
+	/** Count the references of candidates without atomic operations.
+	 Each candidate of a parallel run and its secondaries are only used by the
+	 thread that runs it, see Referenced::setThreadConfined. The candidates
+	 of a vector run are released after their run, secondaries and candidates
+	 from a source stay confined and must not be shared between threads
+	 afterwards. Not used with parallel secondaries.
+	 */
+	void setThreadConfined(bool confined = true);
+	bool getThreadConfined() const;
+	/** Pin each OpenMP thread of a parallel run to one CPU.
+	 Threads are assigned to the allowed CPUs in order (Linux only), which
+	 keeps the thread local data on the memory of its socket.
+	 */
+	void setThreadPinning(bool pin = true);
+	bool getThreadPinning() const;
+	/** Periodically save the progress of run(SourceInterface*, ...) to a file.
+	 The run is split into chunks of the given number of candidates. After each
+	 chunk the number of completed candidates and the state of all random number
+	 generators are written to the checkpoint file. If the file exists when run()
+	 is called, the run resumes after the last completed chunk.
+	 Outputs must be opened in append mode by the user, candidates of an
+	 interrupted chunk may appear twice.
+	 */
+	void setCheckpoint(const std::string &filename, size_t interval = 10000);
+
+	/** Stop starting new candidates after the given wall time in [s] of a
+	 parallel run (0: no limit). Candidates in flight are completed.
+	 */
+	void setTimeLimit(double seconds);
+	/** Stop starting new candidates once the output has received the given
+	 number of candidates, e.g. an output attached to an Observer (0: no limit).
+	 */
+	void setEventLimit(Output *output, size_t events);
+	/// Number of candidates completed in the last parallel run
+	size_t getNumberOfCompleted() const;
+
+	/** Measure the time, number of calls and created secondaries of each module.
+	 The numbers are accumulated per thread without locking and merged in
+	 getProfile(). A report is printed at the end of each run.
+	 Builds with ENABLE_LOCK_PROFILING print the LockProfile after each run.
+	 */
+	void setProfiling(bool profile = true);
+	bool getProfiling() const;
+	std::string getProfile() const; ///< merged report of all threads
+	void showProfile() const;
+	void resetProfile();
+	double getProfileTime(size_t i) const; ///< wall time [s] in module i, summed over the threads
+	size_t getProfileCalls(size_t i) const; ///< calls of module i
+	size_t getProfileSecondaries(size_t i) const; ///< secondaries created by module i
+	/** Also read the PerfCounters around every n-th call of each module in
+	 process() per thread, with IPC and misses per call in getProfile().
+	 */
+	void setHardwareCounters(bool enable = true, size_t sampling = 100);
+	bool getHardwareCounters() const;
+	/// counts of the sampled calls of module i
+	unsigned long long getProfileCounter(size_t i, PerfCounters::Event event) const;
+	size_t getProfileCounterCalls(size_t i) const; ///< sampled calls of module i
+
+	/** Call only the modules that act on the particle class of a candidate,
+	 see Module::getParticleClasses. The classes are read when a module is
+	 added or removed, at the start of a run of a candidate vector or a
+	 source, and with updateDispatch. A candidate that changes its class
+	 during a step continues with the following modules of its new class.
+	 Enabled by default.
+	 */
+	void setParticleDispatch(bool dispatch = true);
+	bool getParticleDispatch() const;
+	void updateDispatch(); ///< read the particle classes of the modules again
 
 	void add(Module* module);
 	void remove(std::size_t i);
@@ -37,6 +191,8 @@ public:
 	void run(SourceInterface* source, size_t count, bool recursive = true, bool secondariesFirst = false); ///< run simulation for a number of candidates from the given source
 
 	std::string getDescription() const;
+	/** The modules and the run settings, saved as ModuleList type */
+	void getConfiguration(Configuration &configuration) const;
 	void showModules() const;
 	
 	/** iterator goodies */
@@ -50,6 +206,98 @@ public:
 private:
 	module_list_t modules;
 	bool showProgress;
+	std::string heartbeatFile;
+	double heartbeatInterval;
+	ProgressBar *progress; ///< of the current run, 0 without progress
+	bool parallelSecondaries;
+	bool breadthFirst;
+	bool streamSecondaries;
+	bool threadConfined;
+	bool threadPinning;
+
+	std::string checkpointFile;
+	size_t checkpointInterval;
+	size_t sourceBatchSize;
+	bool counterBasedRandom;
+	uint64_t randomKey;
+
+	bool particleDispatch;
+	/// the modules acting on one particle class and their positions in the list
+	struct Dispatch {
+		std::vector<const Module *> modules;
+		std::vector<size_t> positions;
+	};
+	std::vector<Dispatch> dispatch; ///< by bit of Module::ParticleClass
+	std::vector<int> moduleClasses; ///< particle classes of each module
+	std::vector<size_t> limitCounters; ///< Statistics counters of each module
+	std::vector<size_t> traceNames; ///< Trace names of each module
+	const Dispatch &dispatchOf(int id) const;
+
+	struct ProfileEntry {
+		double time; ///< accumulated wall time [s]
+		size_t calls;
+		size_t secondaries;
+		size_t counterCalls; ///< calls with hardware counters
+		unsigned long long counters[PerfCounters::NumEvents];
+		char padding[128 - sizeof(double) - 3 * sizeof(size_t)
+				- PerfCounters::NumEvents * sizeof(unsigned long long)]; ///< avoid false sharing
+		ProfileEntry() : time(0), calls(0), secondaries(0), counterCalls(0) {
+			for (size_t i = 0; i < PerfCounters::NumEvents; i++)
+				counters[i] = 0;
+		}
+	};
+	bool profiling;
+	bool hardwareCounters;
+	size_t counterSampling;
+	mutable std::vector<std::vector<ProfileEntry> > profileData; ///< [thread][module]
+
+	void prepareProfile();
+	ProfileEntry profileTotal(size_t i) const; ///< merged over all threads
+
+	ScheduleType scheduleType;
+	size_t scheduleChunkSize;
+	size_t adaptiveChunkSize;
+
+	double timeLimit;
+	ref_ptr<Output> eventLimitOutput;
+	size_t eventLimit;
+	size_t completed;
+
+	// primaries drawn in advance by one thread, padded against false sharing
+	struct SourceBatch {
+		candidate_vector_t candidates; ///< in reverse order
+		char padding[64];
+	};
+	/// what a parallel run is working on: either a source or a candidate vector
+	struct RunContext {
+		SourceInterface *source;
+		candidate_vector_t *candidates;
+		bool recursive;
+		Clock *clock; ///< started with the run, for the time limit
+		std::vector<SourceBatch> batches; ///< one per thread, for a source
+		RunContext(SourceInterface *source, candidate_vector_t *candidates,
+				bool recursive, Clock *clock) :
+				source(source), candidates(candidates), recursive(recursive),
+				clock(clock) {
+		}
+	};
+	ref_ptr<Candidate> nextPrimary(RunContext &context); ///< from the batch of the thread
+
+	void startProgress(ProgressBar &progressbar);
+	void finishProgress();
+	bool budgetReached(RunContext &context) const;
+	void reportBudget(size_t count) const;
+	void runOne(size_t i, RunContext &context);
+	void runRange(size_t begin, size_t end, RunContext &context);
+	void runAdaptive(size_t begin, size_t end, RunContext &context);
+
+	void runTask(Candidate* candidate, bool recursive); ///< body of a secondary task
+	void pinThreads() const;
+	void runBreadthFirst(Candidate* candidate);
+	void runStreaming(Candidate* candidate);
+	void processBatch(candidate_vector_t &batch) const; ///< call process of all modules for all candidates
+	void saveCheckpoint(size_t nCompleted, size_t count) const;
+	size_t loadCheckpoint(size_t count) const; ///< returns the number of completed candidates
 };
 
 /**
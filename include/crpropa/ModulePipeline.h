@@ -0,0 +1,110 @@
+#ifndef CRPROPA_MODULE_PIPELINE_H
+#define CRPROPA_MODULE_PIPELINE_H
+
+#include "crpropa/Module.h"
+
+#include <vector>
+
+namespace crpropa {
+
+class ModuleList;
+
+/**
+ @class ModulePipeline
+ @brief A frozen sequence of modules for fixed simulation setups.
+
+ The modules of a ModuleList (or added one by one) are kept in a contiguous
+ array together with their Module::getParticleClasses, so that a step
+ skips the modules that do not act on the particle class of the candidate,
+ e.g. the photon interactions for nuclei. The class is determined again
+ when a module changes the particle ID. The pipeline does not follow later
+ changes of the modules added, their particle classes are read once.
+ Add the pipeline to a ModuleList to run it.
+ */
+class ModulePipeline: public Module {
+	struct Stage {
+		const Module *module;
+		int particleClasses;
+	};
+	std::vector<ref_ptr<Module> > modules;
+	std::vector<Stage> stages;
+public:
+	ModulePipeline();
+	/** Freeze the current modules of a list */
+	ModulePipeline(const ModuleList &list);
+	void add(Module *module);
+	size_t size() const;
+	void process(Candidate *candidate) const;
+	/** Pass the candidates of the classes of each module to its processBatch */
+	void processBatch(Candidate *const *candidates, size_t n) const;
+	std::string getDescription() const;
+};
+
+#ifndef SWIG
+/// Placeholder for the unused places of a ModuleChain
+class NoModule: public Module {
+public:
+	void process(Candidate *candidate) const {
+	}
+};
+
+/**
+ @class ModuleChain
+ @brief Compile-time sequence of up to six modules of known types.
+
+ For setups built from C++, e.g.
+ ModuleChain<PropagationCK, PhotoPionProduction, Observer>, the modules
+ are called with qualified, non-virtual calls that the compiler can inline
+ (e.g. with link time optimization). As in ModulePipeline, a module is
+ skipped for candidates outside of its particle classes.
+ */
+template<class A, class B = NoModule, class C = NoModule, class D = NoModule,
+		class E = NoModule, class F = NoModule>
+class ModuleChain: public Module {
+	ref_ptr<A> a;
+	ref_ptr<B> b;
+	ref_ptr<C> c;
+	ref_ptr<D> d;
+	ref_ptr<E> e;
+	ref_ptr<F> f;
+	int classes[6];
+
+	template<class M>
+	static int classesOf(const ref_ptr<M> &m) {
+		return m.valid() ? m->getParticleClasses() : 0;
+	}
+
+	template<class M>
+	static inline void call(const M *m, int particleClasses, Candidate *candidate) {
+		if (particleClasses & particleClass(candidate->current.getId()))
+			m->M::process(candidate);
+	}
+
+	static inline void call(const NoModule *m, int particleClasses, Candidate *candidate) {
+	}
+public:
+	ModuleChain(A *a, B *b = NULL, C *c = NULL, D *d = NULL, E *e = NULL,
+			F *f = NULL) :
+			a(a), b(b), c(c), d(d), e(e), f(f) {
+		classes[0] = classesOf(this->a);
+		classes[1] = classesOf(this->b);
+		classes[2] = classesOf(this->c);
+		classes[3] = classesOf(this->d);
+		classes[4] = classesOf(this->e);
+		classes[5] = classesOf(this->f);
+	}
+
+	void process(Candidate *candidate) const {
+		call(a.get(), classes[0], candidate);
+		call(b.get(), classes[1], candidate);
+		call(c.get(), classes[2], candidate);
+		call(d.get(), classes[3], candidate);
+		call(e.get(), classes[4], candidate);
+		call(f.get(), classes[5], candidate);
+	}
+};
+#endif // SWIG
+
+} // namespace crpropa
+
+#endif // CRPROPA_MODULE_PIPELINE_H
@@ -24,10 +24,40 @@ namespace crpropa {
  * I is the isomer number, with I=0 corresponding to the ground state.
  */
 int nucleusId(int a, int z);
-int chargeNumber(int id);
-int massNumber(int id);
 
-bool isNucleus(int id);
+/** Nucleus of the 10LZZZAAAI scheme (with A >= Z) or proton, as HepPID::isNucleus */
+inline bool isNucleusCode(int id) {
+	unsigned int a = (id < 0) ? 0u - (unsigned int) id : (unsigned int) id;
+	if (a == 2212)
+		return true;
+	return (a >= 1000000000u) and (a < 1100000000u)
+			and ((a / 10) % 1000 >= (a / 10000) % 1000);
+}
+
+/** Charge number Z of a nucleus, 0 for other particles, as HepPID::Z */
+inline int chargeNumber(int id) {
+	unsigned int a = (id < 0) ? 0u - (unsigned int) id : (unsigned int) id;
+	if (a == 2212)
+		return 1;
+	return isNucleusCode(id) ? (a / 10000) % 1000 : 0;
+}
+
+/** Mass number A of a nucleus or neutron, 0 for other particles, as HepPID::A */
+inline int massNumber(int id) {
+	if (id == 2112)
+		return 1;
+	unsigned int a = (id < 0) ? 0u - (unsigned int) id : (unsigned int) id;
+	if (a == 2212)
+		return 1;
+	return isNucleusCode(id) ? (a / 10) % 1000 : 0;
+}
+
+/** Nucleus (including the neutron) */
+inline bool isNucleus(int id) {
+	if (id == 2112)
+		return true; // consider neutron as nucleus
+	return isNucleusCode(id);
+}
 
 /* Additional modules */
 std::string convertIdToName(int id); 
@@ -2,6 +2,7 @@
 #define CRPROPA_PARTICLE_STATE_H
 
 #include "crpropa/Vector3.h"
+#include "crpropa/Referenced.h"
 
 namespace crpropa {
 /**
@@ -17,7 +18,9 @@ namespace crpropa {
  is assumed to be traveling at the exact speed of light.
  The cosmic ray state is defined by particle ID, energy and position and
  direction vector.
- For faster lookup mass and charge of the particle are stored as members.
+ For faster lookup mass and charge of the particle are stored as members,
+ as well as mass number, charge number and particle class, decoded from the
+ ID once in setId.
  */
 class ParticleState {
 private:
@@ -27,6 +30,10 @@ private:
 	Vector3d direction; ///< unit vector of velocity or momentum
 	double pmass; ///< particle rest mass
 	double charge; ///< particle charge
+	int massNo; ///< mass number A, 0 for non-nuclei
+	int chargeNo; ///< charge number Z, 0 for non-nuclei
+	int pclass; ///< Module::ParticleClass
+	bool nucleus;
 
 public:
 	ParticleState(int id = 0, double energy = 0,
@@ -54,6 +61,22 @@ public:
 	void setId(int newId);
 	/// Get particle ID
 	int getId() const;
+	/// Mass number A of nuclei (as massNumber(id)), 0 otherwise
+	int getMassNumber() const {
+		return massNo;
+	}
+	/// Charge number Z of nuclei (as chargeNumber(id)), 0 otherwise
+	int getChargeNumber() const {
+		return chargeNo;
+	}
+	/// Nucleus or proton (as isNucleus(id))
+	bool isNucleus() const {
+		return nucleus;
+	}
+	/// Module::ParticleClass of the particle (as Module::particleClass(id))
+	int getParticleClass() const {
+		return pclass;
+	}
 
 	std::string getDescription() const;
 
@@ -74,6 +97,108 @@ public:
 	/// Momentum: direction times energy divided by the speed of light [kg m/s]
 	Vector3d getMomentum() const;
 };
+
+/**
+ @class SharedParticleState
+ @brief Copy-on-write handle to an immutable ParticleState
+
+ Copies of a SharedParticleState refer to the same record, the record is only
+ copied when a shared state is modified. Candidate uses it for the source and
+ created states, which are identical for many candidates of a cascade, e.g.
+ the source state of all secondaries of a primary.
+ The interface mirrors ParticleState; use get() where a ParticleState is
+ expected and modify() for a writable reference.
+ */
+class SharedParticleState {
+	struct Record: public Referenced {
+		ParticleState state;
+		Record(const ParticleState &state) : state(state) {
+		}
+	};
+	ref_ptr<Record> record; ///< 0 for the default state
+
+	static const ParticleState &defaultState();
+public:
+	SharedParticleState() {
+	}
+	SharedParticleState(const ParticleState &state) : record(new Record(state)) {
+	}
+	SharedParticleState &operator=(const ParticleState &state);
+
+	const ParticleState &get() const {
+		return record.valid() ? record->state : defaultState();
+	}
+	operator const ParticleState &() const {
+		return get();
+	}
+	/// Writable state, copies the record if it is shared
+	ParticleState &modify();
+	/// True if both handles refer to the same record
+	bool isSharedWith(const SharedParticleState &other) const {
+		return record.valid() && (record == other.record);
+	}
+
+	void setPosition(const Vector3d &pos) {
+		modify().setPosition(pos);
+	}
+	const Vector3d &getPosition() const {
+		return get().getPosition();
+	}
+	void setDirection(const Vector3d &dir) {
+		modify().setDirection(dir);
+	}
+	const Vector3d &getDirection() const {
+		return get().getDirection();
+	}
+	void setEnergy(double newEnergy) {
+		modify().setEnergy(newEnergy);
+	}
+	double getEnergy() const {
+		return get().getEnergy();
+	}
+	double getRigidity() const {
+		return get().getRigidity();
+	}
+	void setId(int newId) {
+		modify().setId(newId);
+	}
+	int getId() const {
+		return get().getId();
+	}
+	int getMassNumber() const {
+		return get().getMassNumber();
+	}
+	int getChargeNumber() const {
+		return get().getChargeNumber();
+	}
+	bool isNucleus() const {
+		return get().isNucleus();
+	}
+	int getParticleClass() const {
+		return get().getParticleClass();
+	}
+	std::string getDescription() const {
+		return get().getDescription();
+	}
+	double getCharge() const {
+		return get().getCharge();
+	}
+	double getMass() const {
+		return get().getMass();
+	}
+	void setLorentzFactor(double gamma) {
+		modify().setLorentzFactor(gamma);
+	}
+	double getLorentzFactor() const {
+		return get().getLorentzFactor();
+	}
+	Vector3d getVelocity() const {
+		return get().getVelocity();
+	}
+	Vector3d getMomentum() const {
+		return get().getMomentum();
+	}
+};
 /** @}*/
 
 } // namespace crpropa
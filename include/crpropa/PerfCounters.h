@@ -0,0 +1,36 @@
+#ifndef CRPROPA_PERFCOUNTERS_H
+#define CRPROPA_PERFCOUNTERS_H
+
+#include <string>
+
+namespace crpropa {
+/**
+ * \addtogroup Tools
+ * @{
+ */
+
+/**
+ @class PerfCounters
+ @brief Hardware performance counters of the current thread.
+
+ Opened with perf_event_open on the first read of each thread, counting in
+ user space only. Not available outside of Linux, in most containers and
+ with /proc/sys/kernel/perf_event_paranoid > 2, then read() returns false.
+ See ModuleList::setHardwareCounters for counters per module.
+ */
+class PerfCounters {
+public:
+	enum Event {
+		Instructions, Cycles, CacheMisses, BranchMisses, NumEvents
+	};
+	/// the counters can be opened for the current thread
+	static bool isAvailable();
+	/// counts of the current thread since the counters were opened
+	static bool read(unsigned long long values[NumEvents]);
+	static std::string getName(Event event);
+};
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_PERFCOUNTERS_H
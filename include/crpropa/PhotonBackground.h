@@ -1,7 +1,10 @@
 #ifndef CRPROPA_PHOTONBACKGROUND_H
 #define CRPROPA_PHOTONBACKGROUND_H
 
+#include "crpropa/Referenced.h"
+
 #include <string>
+#include <vector>
 
 namespace crpropa {
 
@@ -25,7 +28,102 @@ enum PhotonField {
 	URB_Protheroe96
 };
 
+/**
+ @class CustomPhotonField
+ @brief Photon field of a spectral density table, with interaction tables computed on the fly
+
+ The comoving spectral number density at z = 0 is interpolated log-log
+ between the tabulated energies and is zero outside, its cosmological
+ evolution is the optional redshift scaling table (default: constant).
+ registerPhotonField assigns the field a PhotonField value for the modules.
+ Instead of the data files, EMPairProduction, EMInverseComptonScattering and
+ PhotoPionProduction then use tables that are integrated at their setup in
+ parallel from the cross sections, see PhotonFieldRates.h, and cached as
+ text files named after the hash of the field in the cache directory.
+ PhotoPionProduction samples the interaction products with SOPHIA, i.e. from
+ its own IRB model, and PhotoDisintegration, which needs the cross sections
+ of each channel, has no tables of custom fields.
+ */
+class CustomPhotonField: public Referenced {
+	std::string name;
+	std::vector<double> tabEnergy; ///< photon energy [J]
+	std::vector<double> tabDensity; ///< comoving spectral number density [1/m^3/J]
+	std::vector<double> tabZ, tabS; ///< redshift scaling
+	std::string cacheDirectory;
+
+public:
+	/**
+	 @param name		name of the field, used in the descriptions and the cache files
+	 @param energies	photon energies [J], ascending
+	 @param densities	comoving spectral number density at z = 0 [1/m^3/J]
+	 */
+	CustomPhotonField(const std::string &name, const std::vector<double> &energies,
+			const std::vector<double> &densities);
+	/// Field of a text file with rows of the photon energy [eV] and the density [1/cm^3/eV]
+	static ref_ptr<CustomPhotonField> load(const std::string &name,
+			const std::string &filename);
+
+	std::string getName() const;
+	/// Comoving spectral number density [1/m^3/J] at z = 0
+	double getDensity(double energy) const;
+	const std::vector<double> &getEnergies() const;
+	const std::vector<double> &getDensities() const;
+
+	/// Comoving density relative to z = 0, zero beyond the last redshift
+	void setRedshiftScaling(const std::vector<double> &redshifts,
+			const std::vector<double> &scalings);
+	const std::vector<double> &getScalingRedshifts() const;
+	const std::vector<double> &getScalings() const;
+
+	/// Directory of the generated tables, default: $CRPROPA_CACHE_PATH or the working directory
+	void setCacheDirectory(const std::string &directory);
+	std::string getCacheDirectory() const;
+	/// Hash of the name and the tables, part of the names of the cached tables
+	std::string getHash() const;
+
+	/// File of the table kind ("rate", "cdf") of a module, generated if not cached
+	std::string getTable(const std::string &module, const std::string &kind) const;
+};
+
+/// Make a custom field available to the modules under the returned value
+PhotonField registerPhotonField(ref_ptr<CustomPhotonField> field);
+
+/// The custom field of a registered value, null for the built-in fields
+ref_ptr<CustomPhotonField> getCustomPhotonField(PhotonField photonField);
+
+/**
+ File of an interaction table of a module (e.g. "EMPairProduction") and
+ kind (e.g. "rate"): the data file <module>/<kind>_<field name>.txt for the
+ built-in fields, the generated table for custom fields.
+ */
+std::string photonFieldTable(PhotonField photonField, const std::string &module,
+		const std::string &kind);
+
+/**
+ @class PhotonFieldScaling
+ @brief Cosmological evolution of the comoving density of a photon field
+
+ The scaling table of a field (cf. CRPropa3-data/calc_scaling.py) is loaded at
+ construction and not modified afterwards, so that modules can hold their own
+ instance and query it from any thread. Tables in equidistant redshift steps
+ are looked up directly, others by a binary search.
+ */
+class PhotonFieldScaling: public Referenced {
+	PhotonField photonField;
+	std::vector<double> tabZ;
+	std::vector<double> tabS;
+	bool uniform; ///< tabZ in equidistant steps
+	double dz; ///< step of an equidistant tabZ
+
+public:
+	PhotonFieldScaling(PhotonField photonField);
+	PhotonField getPhotonField() const;
+	/// Overall comoving scaling factor at redshift z
+	double scalingFactor(double z) const;
+};
+
 // Returns overall comoving scaling factor
+// The modules use their own PhotonFieldScaling, this loads the table on first use.
 double photonFieldScaling(PhotonField photonField, double z);
 
 // Returns a string representation of the field
@@ -0,0 +1,41 @@
+#ifndef CRPROPA_PHOTONFIELDRATES_H
+#define CRPROPA_PHOTONFIELDRATES_H
+
+#include "crpropa/PhotonBackground.h"
+
+#include <string>
+
+namespace crpropa {
+
+/**
+ * \addtogroup EnergyLosses
+ * @{
+ */
+
+/**
+ Interaction tables of a custom photon field in the format of the data files
+ (cf. CRPropa3-data/calc_electromagnetic.py and calc_photopion.py).
+ The rate of a particle of energy E in an isotropic field of density n(eps)
+ is 1 / (8 E^2) int ds s_kin sigma(s_kin) int_{s_kin / 4E} deps n(eps) / eps^2,
+ with s_kin = s - m^2, integrated numerically in log(s_kin) for each energy
+ in parallel. The cumulative rates are those up to the tabulated s_kin.
+ The files are written to a temporary file and renamed, so that processes
+ that generate the same table concurrently do not read incomplete files.
+ */
+
+/// Breit-Wheeler pair production of photons of 10^9 - 10^23 eV
+void writeEMPairProductionTables(const CustomPhotonField &field,
+		const std::string &rateFile, const std::string &cdfFile);
+
+/// Inverse Compton scattering (Klein-Nishina) of electrons of 10^9 - 10^23 eV
+void writeEMInverseComptonScatteringTables(const CustomPhotonField &field,
+		const std::string &rateFile, const std::string &cdfFile);
+
+/// Photo-pion production of protons and neutrons of Lorentz factors 10^6 - 10^16 with the SOPHIA cross sections
+void writePhotoPionProductionTable(const CustomPhotonField &field,
+		const std::string &rateFile);
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_PHOTONFIELDRATES_H
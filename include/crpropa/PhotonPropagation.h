@@ -1,6 +1,9 @@
 #ifndef CRPROPA_PHOTON_PROPAGATION_H
 #define CRPROPA_PHOTON_PROPAGATION_H
 
+#include "crpropa/module/PhotonOutput1D.h"
+
+#include <fstream>
 #include <string>
 #include <vector>
 
@@ -11,43 +14,161 @@
 
 namespace crpropa {
 
+/**
+ @class PhotonInputReader
+ @brief Reads the input of the photon propagation in chunks.
+
+ Reads text files of PhotonOutput1D or of Event1D with additional columns, and
+ binary files of PhotonOutput1D, which are copied without parsing. At most one
+ chunk of photons is held in memory.
+ */
+class PhotonInputReader {
+	std::ifstream infile;
+	std::string filename;
+	size_t chunkSize;
+	int format; // 0: PhotonOutput1D, 1: Event1D, 2: binary PhotonOutput1D
+	size_t size;
+
+	PhotonInputReader(const PhotonInputReader &);
+	PhotonInputReader &operator=(const PhotonInputReader &);
+public:
+	PhotonInputReader(const std::string &filename, size_t chunkSize = 65536);
+	/// Read the next chunk of at most chunkSize photons, false at the end of the file
+	bool read(std::vector<PhotonRecord1D> &photons);
+	bool isBinary() const;
+	size_t getChunkSize() const;
+	/// Bytes read so far
+	size_t getPosition();
+	/// Size of the file [bytes]
+	size_t getSize() const;
+};
+
 /**
  Propagate photons, electrons and positrons using the EleCa code.
  The propagation is stopped when the particles reach the observer or their energy drops below the threshold energy.
+ The primaries are read in chunks and propagated in parallel while the next chunk is read, the output keeps the order of the input.
  */
 void ElecaPropagation(
-	const std::string &inputfile,               //!< input in PhotonOutput1D format
+	const std::string &inputfile,               //!< input in PhotonOutput1D format, text or binary
 	const std::string &outputfile,              //!< output in PhotonOutput1D format
 	bool showProgress = true,                   //!< show a progress bar
 	double lowerEnergyThreshold = 0.8010882435, //!< threshold energy [J], default = 5 EeV
 	double magneticFieldStrength = 1E-13,       //!< magnetic field strength [T], default = 1 nG
-	const std::string &background = "ALL"       //!< photon background string
+	const std::string &background = "ALL",      //!< photon background string
+	int nThreads = 0                            //!< threads, 0: all
 	);
 
 /**
  Calculate the electromagnetic cascade with DINT
  */
 void DintPropagation(
-	const std::string &inputfile,         //!< input in PhotonOutput1D format
+	const std::string &inputfile,         //!< input in PhotonOutput1D format, text or binary
 	const std::string &outputfile,        //!< output spectrum (photons, electrons, positrons)
 	int IRFlag = 4,                       //!< EBL background 0: high, 1: low, 2: Primack, 4: Stecker'06
 	int RadioFlag = 4,                    //!< radio background 0: high, 1: medium, 2: obs, 3: none, 4: Protheroe'96
 	double magneticFieldStrength = 1E-13, //!< magnetic field strength [T], default = 1 nG
-	double aCutcascade_Magfield = 0       //!< a-parameter, see CRPropa 2 paper
+	double aCutcascade_Magfield = 0,      //!< a-parameter, see CRPropa 2 paper
+	double bufferSize = 1E9,              //!< memory [bytes] of the binned input before an intermediate cascade
+	int nThreads = 0                      //!< threads for the input and the cascade, 0: all
 	);
 
 /**
  Propagate photons using EleCa for energies above the crossover energy and DINT below
  */
 void DintElecaPropagation(
-	const std::string &inputfile,           //!< input in PhotonOutput1D format
+	const std::string &inputfile,           //!< input in PhotonOutput1D format, text or binary
 	const std::string &outputfile,          //!< output spectrum (photons, electrons, positrons)
 	bool showProgress = true,               //!< show a progress bar
 	double crossOverEnergy = 0.08010882435, //!< crossover energy [J] between EleCa and DINT, default = 0.5 EeV
 	double magneticFieldStrength = 1E-13,   //!< magnetic field strength [T], default = 1 nG
-	double aCutcascade_Magfield = 0         //!< a-parameter, see CRPropa 2 paper
+	double aCutcascade_Magfield = 0,        //!< a-parameter, see CRPropa 2 paper
+	double bufferSize = 1E9,                //!< memory [bytes] of the binned EleCa output before an intermediate cascade
+	int nThreads = 0                        //!< threads for EleCa and the cascade, 0: all
+	);
+
+/**
+ Calculate the electromagnetic cascade of particles injected at several
+ distances with DINT.
+ The injection at a distance joins the cascade when it passes that distance.
+ The distances are split into contiguous segments whose cascades are
+ calculated in parallel, each with its own DINT instance. The result of each
+ segment is then carried to the observer in one step per segment, which is
+ exact up to the step size of DINT as the cascade is linear in the injection.
+ */
+void DintCascade(
+	const std::vector<double> &distances,  //!< light travel distances [Mpc], descending
+	const std::vector<double> &injections, //!< per distance the injected photons, electrons and positrons in the NUM_MAIN_BINS energy bins of DINT
+	std::vector<double> &spectrum,         //!< photons, electrons and positrons at the observer, in the same bins
+	int IRFlag = 4,                        //!< EBL background 0: high, 1: low, 2: Primack, 4: Stecker'06
+	int RadioFlag = 4,                     //!< radio background 0: high, 1: medium, 2: obs, 3: none, 4: Protheroe'96
+	double magneticFieldStrength = 1E-13,  //!< magnetic field strength [T], default = 1 nG
+	double aCutcascade_Magfield = 0,       //!< a-parameter, see CRPropa 2 paper
+	int nThreads = 0                       //!< threads, 0: all
 	);
 
+/**
+ @class DintResponse
+ @brief Tabulated response of the DINT cascade for repeated runs with one background.
+
+ Holds for nodes at the light travel distances k * Dmax / nD, k = 1 ... nD,
+ the spectrum at the observer for a unit injection of each particle species
+ and energy bin of DINT. The matrix of each distance step is calculated with
+ DINT, independently and in parallel, and the responses are the products of
+ the steps towards the observer. A cascade of any injection is then a sum of
+ matrix vector products, interpolated linearly in distance between the nodes.
+ The table takes nD * (3 * NUM_MAIN_BINS)^2 doubles, about 2 MB per node.
+ */
+class DintResponse {
+	double Dmax; // [Mpc]
+	int nD;
+	int IRFlag, RadioFlag;
+	double magneticFieldStrength, aCutcascade_Magfield;
+	std::vector<double> responses; // per node, column major: observed x injected
+
+	void check() const;
+public:
+	DintResponse(
+		double Dmax,                          //!< maximum light travel distance [m]
+		int nD,                               //!< number of distance steps
+		int IRFlag = 4,                       //!< EBL background 0: high, 1: low, 2: Primack, 4: Stecker'06
+		int RadioFlag = 4,                    //!< radio background 0: high, 1: medium, 2: obs, 3: none, 4: Protheroe'96
+		double magneticFieldStrength = 1E-13, //!< magnetic field strength [T], default = 1 nG
+		double aCutcascade_Magfield = 0       //!< a-parameter, see CRPropa 2 paper
+		);
+
+	/** Calculate the table with DINT */
+	void compute(int nThreads = 0 /**< threads, 0: all */);
+	/** Load the table from getCacheFilename() in the directory, or compute and save it there */
+	void init(const std::string &cacheDirectory, int nThreads = 0);
+	/** File name that identifies the background and binning of the table */
+	std::string getCacheFilename() const;
+	void save(const std::string &filename) const;
+	/** Load a table, throws if its background or binning differ */
+	void load(const std::string &filename);
+	bool isComputed() const;
+
+	/** Cascade of injections at light travel distances [Mpc] up to Dmax, as DintCascade */
+	void cascade(const std::vector<double> &distances,
+			const std::vector<double> &injections,
+			std::vector<double> &spectrum) const;
+	/** Cascade of injections at the nodes, (nD + 1) x 3 x NUM_MAIN_BINS with node 0 at the observer */
+	void cascadeNodes(const std::vector<double> &weights,
+			std::vector<double> &spectrum) const;
+
+	/** Calculate the cascade of the input file as DintPropagation, with the table */
+	void propagate(
+		const std::string &inputfile,  //!< input in PhotonOutput1D format, text or binary
+		const std::string &outputfile, //!< output spectrum (photons, electrons, positrons)
+		double bufferSize = 1E9        //!< memory [bytes] of the binned input before an intermediate cascade
+		) const;
+
+	int getNumberOfDistances() const;
+	static int getNumberOfEnergyBins(); ///< NUM_MAIN_BINS of DINT, from 10^7 eV in 10 bins per decade
+	double getMaximumDistance() const;
+	/** Response of node k = 1 ... nD, column major (3 * NUM_MAIN_BINS)^2 */
+	const double *getResponse(int k) const;
+};
+
 } // namespace crpropa
 
 #endif // CRPROPA_PHOTON_PROPAGATION_H
@@ -3,6 +3,7 @@
 
 #include <string>
 #include <ctime>
+#include <pthread.h>
 
 namespace crpropa {
 
@@ -10,28 +11,70 @@ namespace crpropa {
  * \addtogroup Core
  * @{
  */
+
+/**
+ @class ProgressBar
+ @brief Progress of a run: a bar with throughput and ETA, and a heartbeat file
+
+ update and addSecondaries only count atomically, so that all threads of a
+ run can call them without a lock. After start, one reporter thread prints
+ the bar with the primaries and secondaries per second and the estimated
+ time to go, and, with setHeartbeatFile, periodically writes the same
+ numbers as a JSON object for monitoring batch jobs. finish (or the
+ destructor) stops the reporter and shows the final state.
+ */
 class ProgressBar {
 private:
 	unsigned long _steps;
 	unsigned long _currentCount;
+	unsigned long _secondaries;
 	unsigned long _maxbarLength;
-	unsigned long _nextStep;
 	unsigned long _updateSteps;
 	time_t _startTime;
 	std::string stringTmpl;
-	std::string arrow;
+	std::string title;
+	bool showBar;
+	bool error;
+
+	std::string heartbeatFile;
+	double heartbeatInterval; ///< seconds between heartbeats
+
+	pthread_t reporter;
+	pthread_mutex_t mutex; ///< guards running
+	pthread_cond_t stopped;
+	bool running;
+
+	static void *reporterMain(void *progressBar);
+	void print(unsigned long position, double elapsed) const;
+	void writeHeartbeat(unsigned long position, double elapsed, bool finished) const;
 
 public:
-	/// Initialize a ProgressBar with [steps] number of steps, updated at [updateSteps] intervalls
+	/// Initialize a ProgressBar with [steps] number of steps, reported [updateSteps] times on the terminal at most
 	ProgressBar(unsigned long steps = 0, unsigned long updateSteps = 100);
-	void start(const std::string &title);
+	~ProgressBar();
+	/// Start the reporter, show = false: only the heartbeat file is written
+	void start(const std::string &title, bool show = true);
+	/// Stop the reporter and show the final state, called by the destructor
+	void finish();
 
-	/// update the progressbar
-	/// should be called steps times in a loop 
-	void update(); 
+	/// count one step, should be called steps times in total, from any thread
+	void update();
+	/// count n secondaries, from any thread
+	void addSecondaries(unsigned long n);
 
 	// sets the position of the bar to a given value
 	void setPosition(unsigned long position);
+	unsigned long getPosition() const;
+	unsigned long getSecondaries() const;
+
+	/**
+	 Write the progress to a file every interval seconds, replaced atomically:
+	 {"title", "steps", "completed", "secondaries", "elapsed",
+	 "primariesPerSecond", "secondariesPerSecond", "eta", "finished", "error",
+	 "time"}, with the times in seconds and "time" in seconds since the epoch.
+	 To be set before start, an empty name disables.
+	 */
+	void setHeartbeatFile(const std::string &filename, double interval = 10);
 
 	/// Mark the progressbar with an error
 	void setError();
@@ -1,235 +1,397 @@
-// Random.h
-// Mersenne Twister random number generator -- a C++ class Random
-// Based on code by Makoto Matsumoto, Takuji Nishimura, and Shawn Cokus
-// Richard J. Wagner  v1.0  15 May 2003  rjwagner@writeme.com
-
-// The Mersenne Twister is an algorithm for generating random numbers.  It
-// was designed with consideration of the flaws in various other generators.
-// The period, 2^19937-1, and the order of equidistribution, 623 dimensions,
-// are far greater.  The generator is also fast; it avoids multiplication and
-// division, and it benefits from caches and pipelines.  For more information
-// see the inventors' web page at http://www.math.keio.ac.jp/~matumoto/emt.html
-
-// Reference
-// M. Matsumoto and T. Nishimura, "Mersenne Twister: A 623-Dimensionally
-// Equidistributed Uniform Pseudo-Random Number Generator", ACM Transactions on
-// Modeling and Computer Simulation, Vol. 8, No. 1, January 1998, pp 3-30.
-
-// Copyright (C) 1997 - 2002, Makoto Matsumoto and Takuji Nishimura,
-// Copyright (C) 2000 - 2003, Richard J. Wagner
-// All rights reserved.
-//
-// Redistribution and use in source and binary forms, with or without
-// modification, are permitted provided that the following conditions
-// are met:
-//
-//   1. Redistributions of source code must retain the above copyright
-//      notice, this list of conditions and the following disclaimer.
-//
-//   2. Redistributions in binary form must reproduce the above copyright
-//      notice, this list of conditions and the following disclaimer in the
-//      documentation and/or other materials provided with the distribution.
-//
-//   3. The names of its contributors may not be used to endorse or promote
-//      products derived from this software without specific prior written
-//      permission.
-//
-// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
-// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
-// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
-// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
-// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
-// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
-// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
-// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
-// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
-// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
-// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
-
-// The original code included the following notice:
-//
-//     When you use this, send an email to: matumoto@math.keio.ac.jp
-//     with an appropriate reference to your work.
-//
-// It would be nice to CC: rjwagner@writeme.com and Cokus@math.washington.edu
-// when you write.
-
-// Parts of this file are modified beginning in 29.10.09 for adaption in PXL.
-// Parts of this file are modified beginning in 10.02.12 for adaption in CRPropa.
-
-#ifndef RANDOM_H
-#define RANDOM_H
-
-// Not thread safe (unless auto-initialization is avoided and each thread has
-// its own Random object)
-#include "crpropa/Vector3.h"
-
-#include <iostream>
-#include <limits>
-#include <time.h>
-#include <cmath>
-#include <vector>
-#include <stdexcept>
-#include <algorithm>
-
-#include <stdint.h>
-#include <string>
-
-//necessary for win32
-#ifndef M_PI
-#define M_PI 3.14159265358979323846
-#endif
-
-namespace crpropa {
-
-/**
- * \addtogroup Core
- * @{
- */
-/**
- @class Random
- @brief Random number generator.
-
- Mersenne Twister random number generator -- a C++ class Random
- Based on code by Makoto Matsumoto, Takuji Nishimura, and Shawn Cokus
- Richard J. Wagner  v1.0  15 May 2003  rjwagner@writeme.com
- */
-class Random {
-public:
-	enum {N = 624}; // length of state vector
-	enum {SAVE = N + 1}; // length of array for save()
-
-protected:
-	enum {M = 397}; // period parameter
-	uint32_t state[N];// internal state
-	std::vector<uint32_t> initial_seed;//
-	uint32_t *pNext;// next value to get from state
-	int left;// number of values left before reload needed
-
-//Methods
-public:
-	/// initialize with a simple uint32_t
-	Random( const uint32_t& oneSeed );
-	// initialize with an array
-	Random( uint32_t *const bigSeed, uint32_t const seedLength = N );
-	/// auto-initialize with /dev/urandom or time() and clock()
-	/// Do NOT use for CRYPTOGRAPHY without securely hashing several returned
-	/// values together, otherwise the generator state can be learned after
-	/// reading 624 consecutive values.
-	Random();
-	// Access to 32-bit random numbers
-	double rand();///< real number in [0,1]
-	double rand( const double& n );///< real number in [0,n]
-	double randExc();///< real number in [0,1)
-	double randExc( const double& n );///< real number in [0,n)
-	double randDblExc();///< real number in (0,1)
-	double randDblExc( const double& n );///< real number in (0,n)
-	/// Pull a 32-bit integer from the generator state
-	/// Every other access function simply transforms the numbers extracted here
-	uint32_t randInt();///< integer in [0,2^32-1]
-	uint32_t randInt( const uint32_t& n );///< integer in [0,n] for n < 2^32
-
-	uint64_t randInt64(); ///< integer in [0, 2**64 -1]. PROBABLY NOT SECURE TO USE
-	uint64_t randInt64(const uint64_t &n); ///< integer in [0, n] for n < 2**64 -1. PROBABLY NOT SECURE TO USE
-
-	double operator()() {return rand();} ///< same as rand()
-
-	/// Access to 53-bit random numbers (capacity of IEEE double precision)
-	double rand53();// real number in [0,1)
-	///Exponential distribution in (0,inf)
-	double randExponential();
-	/// Normal distributed random number
-	double randNorm( const double& mean = 0.0, const double& variance = 1.0 );
-	/// Uniform distribution in [min, max]
-	double randUniform(double min, double max);
-	/// Rayleigh distributed random number
-	double randRayleigh(double sigma);
-	/// Fisher distributed random number
-	double randFisher(double k);
-
-	/// Draw a random bin from a (unnormalized) cumulative distribution function, without leading zero.
-	size_t randBin(const std::vector<float> &cdf);
-	size_t randBin(const std::vector<double> &cdf);
-
-	/// Random point on a unit-sphere
-	Vector3d randVector();
-	/// Random vector with given angular separation around mean direction
-	Vector3d randVectorAroundMean(const Vector3d &meanDirection, double angle);
-	/// Fisher distributed random vector
-	Vector3d randFisherVector(const Vector3d &meanDirection, double kappa);
-	/// Uniform distributed random vector inside a cone
-	Vector3d randConeVector(const Vector3d &meanDirection, double angularRadius);
-	///_Position vector uniformly distributed within propagation step size bin
-	Vector3d randomInterpolatedPosition(const Vector3d &a, const Vector3d &b);
-
-	/// Power-law distribution of a given differential spectral index
-	double randPowerLaw(double index, double min, double max);
-	/// Broken power-law distribution
-	double randBrokenPowerLaw(double index1, double index2, double breakpoint, double min, double max );
-
-	/// Seed the generator with a simple uint32_t
-	void seed( const uint32_t oneSeed );
-	/// Seed the generator with an array of uint32_t's
-	/// There are 2^19937-1 possible initial states.  This function allows
-	/// all of those to be accessed by providing at least 19937 bits (with a
-	/// default seed length of N = 624 uint32_t's).  Any bits above the lower 32
-	/// in each element are discarded.
-	/// Just call seed() if you want to get array from /dev/urandom
-	void seed( uint32_t *const bigSeed, const uint32_t seedLength = N );
-	// seed via an b64 encoded string
-	void seed( const std::string &b64Seed);
-	/// Seed the generator with an array from /dev/urandom if available
-	/// Otherwise use a hash of time() and clock() values
-	void seed();
-
-	// Saving and loading generator state
-	void save( uint32_t* saveArray ) const;// to array of size SAVE
-	void load( uint32_t *const loadArray );// from such array
-	const std::vector<uint32_t> &getSeed() const; // copy the seed to the array
-	const std::string getSeed_base64() const; // get the base 64 encoded seed
-
-	friend std::ostream& operator<<( std::ostream& os, const Random& mtrand );
-	friend std::istream& operator>>( std::istream& is, Random& mtrand );
-
-	static Random &instance();
-	static void seedThreads(const uint32_t oneSeed);
-	static std::vector< std::vector<uint32_t> > getSeedThreads();
-
-protected:
-	/// Initialize generator state with seed
-	/// See Knuth TAOCP Vol 2, 3rd Ed, p.106 for multiplier.
-	/// In previous versions, most significant bits (MSBs) of the seed affect
-	/// only MSBs of the state array.  Modified 9 Jan 2002 by Makoto Matsumoto.
-	void initialize( const uint32_t oneSeed );
-
-	/// Generate N new values in state
-	/// Made clearer and faster by Matthew Bellew (matthew.bellew@home.com)
-	void reload();
-	uint32_t hiBit( const uint32_t& u ) const {return u & 0x80000000UL;}
-	uint32_t loBit( const uint32_t& u ) const {return u & 0x00000001UL;}
-	uint32_t loBits( const uint32_t& u ) const {return u & 0x7fffffffUL;}
-	uint32_t mixBits( const uint32_t& u, const uint32_t& v ) const
-	{	return hiBit(u) | loBits(v);}
-
-#ifdef _MSC_VER
-#pragma warning( push )
-#pragma warning( disable : 4146 )
-#endif
-	uint32_t twist( const uint32_t& m, const uint32_t& s0, const uint32_t& s1 ) const
-	{	return m ^ (mixBits(s0,s1)>>1) ^ (-loBit(s1) & 0x9908b0dfUL);}
-
-#ifdef _MSC_VER
-#pragma warning( pop )
-#endif
-
-	/// Get a uint32_t from t and c
-	/// Better than uint32_t(x) in case x is floating point in [0,1]
-	/// Based on code by Lawrence Kirby (fred@genesis.demon.co.uk)
-	static uint32_t hash( time_t t, clock_t c );
-
-};
-/** @}*/
-
-} //namespace crpropa
-
-#endif  // RANDOM_H
+// Random.h
+// Mersenne Twister random number generator -- a C++ class Random
+// Based on code by Makoto Matsumoto, Takuji Nishimura, and Shawn Cokus
+// Richard J. Wagner  v1.0  15 May 2003  rjwagner@writeme.com
+
+// The Mersenne Twister is an algorithm for generating random numbers.  It
+// was designed with consideration of the flaws in various other generators.
+// The period, 2^19937-1, and the order of equidistribution, 623 dimensions,
+// are far greater.  The generator is also fast; it avoids multiplication and
+// division, and it benefits from caches and pipelines.  For more information
+// see the inventors' web page at http://www.math.keio.ac.jp/~matumoto/emt.html
+
+// Reference
+// M. Matsumoto and T. Nishimura, "Mersenne Twister: A 623-Dimensionally
+// Equidistributed Uniform Pseudo-Random Number Generator", ACM Transactions on
+// Modeling and Computer Simulation, Vol. 8, No. 1, January 1998, pp 3-30.
+
+// Copyright (C) 1997 - 2002, Makoto Matsumoto and Takuji Nishimura,
+// Copyright (C) 2000 - 2003, Richard J. Wagner
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+//   1. Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimer.
+//
+//   2. Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//   3. The names of its contributors may not be used to endorse or promote
+//      products derived from this software without specific prior written
+//      permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// The original code included the following notice:
+//
+//     When you use this, send an email to: matumoto@math.keio.ac.jp
+//     with an appropriate reference to your work.
+//
+// It would be nice to CC: rjwagner@writeme.com and Cokus@math.washington.edu
+// when you write.
+
+// Parts of this file are modified beginning in 29.10.09 for adaption in PXL.
+// Parts of this file are modified beginning in 10.02.12 for adaption in CRPropa.
+
+#ifndef RANDOM_H
+#define RANDOM_H
+
+// Not thread safe (unless auto-initialization is avoided and each thread has
+// its own Random object, see Random::instance)
+#include "crpropa/Vector3.h"
+
+#include <iostream>
+#include <limits>
+#include <time.h>
+#include <cmath>
+#include <vector>
+#include <stdexcept>
+#include <algorithm>
+
+#include <stdint.h>
+#include <string>
+
+//necessary for win32
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+namespace crpropa {
+
+/**
+ * \addtogroup Core
+ * @{
+ */
+/**
+ @class AliasTable
+ @brief Discrete distribution sampled in constant time.
+
+ Walker's alias method with the construction of Vose: each bin holds its own
+ acceptance probability and an alias bin, so that a sample needs one random
+ number and no search. The table is built from the same (unnormalized)
+ cumulative distribution as Random::randBin and gives the same distribution
+ of bin indices, bins of zero width are never drawn. A distribution without
+ weight always gives the first bin, as randBin.
+ A table can also hold several distributions of the same number of bins, e.g.
+ a conditional distribution on a grid, as rows in one contiguous block.
+ The acceptance probability and alias of a bin are stored together, a sample
+ reads a single cache line.
+ */
+class AliasTable {
+public:
+	struct Bin {
+		double probability; // acceptance probability of the bin
+		uint32_t alias; // bin drawn otherwise, within the row
+	};
+private:
+	std::vector<Bin> table; // rows of bins, one after another
+	size_t bins; // number of bins per row
+public:
+	AliasTable();
+	AliasTable(const std::vector<double> &cdf);
+	AliasTable(const std::vector<float> &cdf);
+	void setCDF(const std::vector<double> &cdf);
+	void setCDF(const std::vector<float> &cdf);
+	/// Rows of equal size, the cdf of each row (unnormalized) one after another
+	void setCDF(const std::vector<double> &cdf, size_t rows);
+	size_t size() const; ///< number of bins (per row)
+	size_t rows() const; ///< number of rows
+	size_t getMemory() const; ///< bytes of the bins
+	/// Bin for a uniform random number u in [0, 1)
+	size_t sample(double u) const {
+		return sample(0, u);
+	}
+	/// Bin of the given row for a uniform random number u in [0, 1)
+	size_t sample(size_t row, double u) const {
+		double x = u * bins;
+		size_t i = std::min(size_t(x), bins - 1);
+		const Bin &b = table[row * bins + i];
+		return ((x - i) < b.probability) ? i : b.alias;
+	}
+};
+
+/**
+ @class LazyAliasTable
+ @brief AliasTable of a distribution that is built up bin by bin.
+
+ Bins (or rows of bins) are appended to the cumulative distribution without
+ rebuilding the table, which is built once on the first sample after the
+ last change, also when several threads sample concurrently. The
+ distribution must not be changed while other threads sample it.
+ */
+class LazyAliasTable {
+	std::vector<double> cdf; // rows of cumulative distributions
+	size_t rowCount;
+	mutable AliasTable table;
+	mutable int built; // table is up to date, only set under a lock
+
+	void build() const;
+public:
+	LazyAliasTable();
+	/// Append a bin of the given (not cumulative) weight to a single row
+	void add(double weight);
+	/// Append a row given by its unnormalized cdf, all rows of equal size
+	void addRow(const std::vector<double> &rowCDF);
+	void clear();
+	bool empty() const;
+	const std::vector<double> &getCDF() const; ///< all rows
+	/// Bin for a uniform random number u in [0, 1)
+	size_t sample(double u) const {
+		return sample(0, u);
+	}
+	/// Bin of the given row for a uniform random number u in [0, 1)
+	size_t sample(size_t row, double u) const {
+		if (!__atomic_load_n(&built, __ATOMIC_ACQUIRE))
+			build();
+		return table.sample(row, u);
+	}
+};
+
+/**
+ @class Random
+ @brief Random number generator.
+
+ Mersenne Twister random number generator -- a C++ class Random
+ Based on code by Makoto Matsumoto, Takuji Nishimura, and Shawn Cokus
+ Richard J. Wagner  v1.0  15 May 2003  rjwagner@writeme.com
+
+ Alternatively, seedCounter switches a generator to the counter-based
+ Philox4x32-10 (Salmon et al. 2011): every block of four numbers is a
+ function of (key, stream, position) only, so that e.g. each candidate can
+ get its own stream that does not depend on the thread processing it, see
+ ModuleList::setCounterBasedRandom.
+ */
+class Random {
+public:
+	enum {N = 624}; // length of state vector
+	enum {SAVE = N + 1}; // length of array for save()
+
+protected:
+	enum {M = 397}; // period parameter
+	uint32_t state[N];// internal state
+	std::vector<uint32_t> initial_seed;//
+	uint32_t *pNext;// next value to get from state
+	int left;// number of values left before reload needed
+	bool counterBased; // Philox instead of the Mersenne Twister
+	uint32_t philoxKey[2];
+	uint32_t philoxCounter[4]; // position in the stream, stream
+	uint32_t philoxBlock[4];
+	int philoxLeft; // number of values left in philoxBlock
+
+//Methods
+public:
+	/// initialize with a simple uint32_t
+	Random( const uint32_t& oneSeed );
+	// initialize with an array
+	Random( uint32_t *const bigSeed, uint32_t const seedLength = N );
+	/// auto-initialize with /dev/urandom or time() and clock()
+	/// Do NOT use for CRYPTOGRAPHY without securely hashing several returned
+	/// values together, otherwise the generator state can be learned after
+	/// reading 624 consecutive values.
+	Random();
+	/// copies continue at the same position of the state
+	Random(const Random &other);
+	Random &operator=(const Random &other);
+	// Access to 32-bit random numbers
+	double rand();///< real number in [0,1]
+	double rand( const double& n );///< real number in [0,n]
+	double randExc();///< real number in [0,1)
+	double randExc( const double& n );///< real number in [0,n)
+	double randDblExc();///< real number in (0,1)
+	double randDblExc( const double& n );///< real number in (0,n)
+	/// Pull a 32-bit integer from the generator state
+	/// Every other access function simply transforms the numbers extracted here
+	uint32_t randInt();///< integer in [0,2^32-1]
+	uint32_t randInt( const uint32_t& n );///< integer in [0,n] for n < 2^32
+
+	uint64_t randInt64(); ///< integer in [0, 2**64 -1]. PROBABLY NOT SECURE TO USE
+	uint64_t randInt64(const uint64_t &n); ///< integer in [0, n] for n < 2**64 -1. PROBABLY NOT SECURE TO USE
+
+	double operator()() {return rand();} ///< same as rand()
+
+	/// Bulk generation, faster than single calls in a loop
+	void fillInt(uint32_t *out, size_t n); ///< n integers as randInt()
+	void fill(double *out, size_t n); ///< n real numbers in [0,1] as rand()
+	/// n normal distributed numbers as randNorm, with both numbers of each Box-Muller pair
+	void fillNorm(double *out, size_t n, double mean = 0.0, double variance = 1.0);
+	void fillExponential(double *out, size_t n); ///< n numbers as randExponential()
+
+	/// Access to 53-bit random numbers (capacity of IEEE double precision)
+	double rand53();// real number in [0,1)
+	///Exponential distribution in (0,inf)
+	double randExponential();
+	/// Normal distributed random number
+	double randNorm( const double& mean = 0.0, const double& variance = 1.0 );
+	/// Uniform distribution in [min, max]
+	double randUniform(double min, double max);
+	/// Rayleigh distributed random number
+	double randRayleigh(double sigma);
+	/// Fisher distributed random number
+	double randFisher(double k);
+
+	/// Draw a random bin from a (unnormalized) cumulative distribution function, without leading zero.
+	size_t randBin(const std::vector<float> &cdf);
+	size_t randBin(const std::vector<double> &cdf);
+	/// Draw a random bin from an alias table in constant time, same as randBin of its cdf.
+	size_t randBin(const AliasTable &table);
+	/// Draw a random bin from a row of an alias table in constant time.
+	size_t randBin(const AliasTable &table, size_t row);
+	/// Draw a random bin from a lazily built alias table in constant time.
+	size_t randBin(const LazyAliasTable &table);
+	/// Draw a random bin from a row of a lazily built alias table in constant time.
+	size_t randBin(const LazyAliasTable &table, size_t row);
+
+	/// Random point on a unit-sphere
+	Vector3d randVector();
+	/// Random vector with given angular separation around mean direction
+	Vector3d randVectorAroundMean(const Vector3d &meanDirection, double angle);
+	/// Fisher distributed random vector
+	Vector3d randFisherVector(const Vector3d &meanDirection, double kappa);
+	/// Uniform distributed random vector inside a cone
+	Vector3d randConeVector(const Vector3d &meanDirection, double angularRadius);
+	///_Position vector uniformly distributed within propagation step size bin
+	Vector3d randomInterpolatedPosition(const Vector3d &a, const Vector3d &b);
+
+	/// Power-law distribution of a given differential spectral index
+	double randPowerLaw(double index, double min, double max);
+	/// Broken power-law distribution
+	double randBrokenPowerLaw(double index1, double index2, double breakpoint, double min, double max );
+
+	/// Seed the generator with a simple uint32_t
+	void seed( const uint32_t oneSeed );
+	/// Seed the generator with an array of uint32_t's
+	/// There are 2^19937-1 possible initial states.  This function allows
+	/// all of those to be accessed by providing at least 19937 bits (with a
+	/// default seed length of N = 624 uint32_t's).  Any bits above the lower 32
+	/// in each element are discarded.
+	/// Just call seed() if you want to get array from /dev/urandom
+	void seed( uint32_t *const bigSeed, const uint32_t seedLength = N );
+	// seed via an b64 encoded string
+	void seed( const std::string &b64Seed);
+	/// Seed the generator with an array from /dev/urandom if available
+	/// Otherwise use a hash of time() and clock() values
+	void seed();
+	/// Use the counter-based Philox4x32-10 with the given key (seed) and
+	/// stream from its first number on, until the generator is seeded
+	/// again. The Philox state is not handled by save, load and the stream
+	/// operators.
+	void seedCounter(uint64_t key, uint64_t stream);
+	/// True if seeded with seedCounter
+	bool isCounterBased() const;
+	/// Stream of seedCounter
+	uint64_t getCounterStream() const;
+	/// Numbers drawn from the stream since seedCounter: seedCounter(key,
+	/// stream) and jump(position) continue from here
+	uint64_t getCounterPosition() const;
+	/// Advance the generator by the given number of numbers (randInt calls).
+	/// Long jumps of the Mersenne Twister take a few milliseconds up to
+	/// about a second for 2^64 steps.
+	void jump(uint64_t steps);
+	/// Advance the Mersenne Twister by n streams of 2^64 numbers each
+	void jumpStreams(uint64_t n);
+
+	// Saving and loading generator state
+	void save( uint32_t* saveArray ) const;// to array of size SAVE
+	void load( uint32_t *const loadArray );// from such array
+	const std::vector<uint32_t> &getSeed() const; // copy the seed to the array
+	const std::string getSeed_base64() const; // get the base 64 encoded seed
+
+	friend std::ostream& operator<<( std::ostream& os, const Random& mtrand );
+	friend std::istream& operator>>( std::istream& is, Random& mtrand );
+
+	/// Generator of the calling thread, created on its first call. Each
+	/// thread gets its own stream number: its thread number in the outermost
+	/// OpenMP parallel region (0 outside of it), or a unique number from
+	/// 65536 on if that is taken already, e.g. for threads not created by
+	/// OpenMP or of nested regions. There is no limit on the number of
+	/// threads.
+	static Random &instance();
+	/// Seed the generators of all threads, also of those created later, with oneSeed + stream number
+	static void seedThreads(const uint32_t oneSeed);
+	/// Seed all threads with the array (oneSeed, stream, thread stream number), e.g. to give each process of a distributed run its own streams
+	static void seedThreads(const uint32_t oneSeed, const uint32_t stream);
+	/// Split oneSeed into non-overlapping streams of 2^64 numbers by jump-ahead:
+	/// thread stream number i of the given stream (e.g. MPI rank) starts
+	/// (stream * 2^32 + i) streams after Random(oneSeed). Each new thread
+	/// stream takes a jump of a few milliseconds.
+	static void seedThreadsDisjoint(const uint32_t oneSeed, const uint32_t stream = 0);
+	static std::vector< std::vector<uint32_t> > getSeedThreads();
+	/// Write the generator states of all threads with their stream numbers, e.g. for checkpoints
+	static void saveThreads(std::ostream &os);
+	/// Restore the generator states of all threads written by saveThreads
+	static void loadThreads(std::istream &is);
+
+protected:
+	/// Initialize generator state with seed
+	/// See Knuth TAOCP Vol 2, 3rd Ed, p.106 for multiplier.
+	/// In previous versions, most significant bits (MSBs) of the seed affect
+	/// only MSBs of the state array.  Modified 9 Jan 2002 by Makoto Matsumoto.
+	void initialize( const uint32_t oneSeed );
+
+	/// Generate N new values in state
+	/// Made clearer and faster by Matthew Bellew (matthew.bellew@home.com)
+	void reload();
+	uint32_t hiBit( const uint32_t& u ) const {return u & 0x80000000UL;}
+	uint32_t loBit( const uint32_t& u ) const {return u & 0x00000001UL;}
+	uint32_t loBits( const uint32_t& u ) const {return u & 0x7fffffffUL;}
+	uint32_t mixBits( const uint32_t& u, const uint32_t& v ) const
+	{	return hiBit(u) | loBits(v);}
+
+#ifdef _MSC_VER
+#pragma warning( push )
+#pragma warning( disable : 4146 )
+#endif
+	uint32_t twist( const uint32_t& m, const uint32_t& s0, const uint32_t& s1 ) const
+	{	return m ^ (mixBits(s0,s1)>>1) ^ (-loBit(s1) & 0x9908b0dfUL);}
+	static uint32_t temper( uint32_t s1 )
+	{
+		s1 ^= (s1 >> 11);
+		s1 ^= (s1 << 7) & 0x9d2c5680UL;
+		s1 ^= (s1 << 15) & 0xefc60000UL;
+		return (s1 ^ (s1 >> 18));
+	}
+
+#ifdef _MSC_VER
+#pragma warning( pop )
+#endif
+
+	/// Get a uint32_t from t and c
+	/// Better than uint32_t(x) in case x is floating point in [0,1]
+	/// Based on code by Lawrence Kirby (fred@genesis.demon.co.uk)
+	static uint32_t hash( time_t t, clock_t c );
+
+	/// Compute the next Philox block and advance the counter
+	void philoxReload();
+	/// Apply q(F) to the state, F the step of the Mersenne Twister
+	void jumpPolynomial(const std::vector<uint32_t> &q);
+
+};
+/** @}*/
+
+} //namespace crpropa
+
+#endif  // RANDOM_H
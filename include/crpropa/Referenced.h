@@ -40,6 +40,8 @@ public:
 	}
 
 	inline size_t addReference() const {
+		if (_referenceCount & threadConfinedFlag)
+			return ++_referenceCount & ~threadConfinedFlag;
 		int newRef;
 #if defined(OPENMP_3_1)
 		#pragma omp atomic capture
@@ -47,7 +49,7 @@ public:
 #elif defined(__GNUC__)
 		newRef = __sync_add_and_fetch(&_referenceCount, 1);
 #else
-		#pragma omp critical
+		#pragma omp critical(Referenced)
 		{newRef = _referenceCount++;}
 #endif
 		return newRef;
@@ -55,11 +57,17 @@ public:
 
 	inline size_t removeReference() const {
 #ifdef DEBUG
-		if (_referenceCount == 0)
+		if (getReferenceCount() == 0)
 			std::cerr
 					<< "WARNING: Remove reference from Object with NO references: "
 					<< typeid(*this).name() << std::endl;
 #endif
+		if (_referenceCount & threadConfinedFlag) {
+			size_t newRef = --_referenceCount & ~threadConfinedFlag;
+			if (newRef == 0)
+				delete this;
+			return newRef;
+		}
 		int newRef;
 #if defined(OPENMP_3_1)
 		#pragma omp atomic capture
@@ -67,7 +75,7 @@ public:
 #elif defined(__GNUC__)
 		newRef = __sync_sub_and_fetch(&_referenceCount, 1);
 #else
-		#pragma omp critical
+		#pragma omp critical(Referenced)
 		{newRef = _referenceCount--;}
 #endif
 
@@ -78,23 +86,43 @@ public:
 	}
 
 	int removeReferenceNoDelete() const {
-		return --_referenceCount;
+		return --_referenceCount & ~threadConfinedFlag;
 	}
 
 	inline size_t getReferenceCount() const {
-		return _referenceCount;
+		return _referenceCount & ~threadConfinedFlag;
+	}
+
+	/**
+	 Count references without atomic operations.
+	 Only for objects that are used by one thread at a time, e.g. candidates
+	 during a ModuleList run. Must not be changed while other threads hold
+	 references.
+	 */
+	inline void setThreadConfined(bool confined) const {
+		if (confined)
+			_referenceCount |= threadConfinedFlag;
+		else
+			_referenceCount &= ~threadConfinedFlag;
+	}
+
+	inline bool isThreadConfined() const {
+		return (_referenceCount & threadConfinedFlag) != 0;
 	}
 
 protected:
 
 	virtual inline ~Referenced() {
 #ifdef DEBUG
-		if (_referenceCount)
+		if (getReferenceCount())
 			std::cerr << "WARNING: Deleting Object with references: "
 					<< typeid(*this).name() << std::endl;
 #endif
 	}
 
+	/// highest bit of the reference counter, marks thread confined objects
+	static const size_t threadConfinedFlag = ~(~size_t(0) >> 1);
+
 	mutable size_t _referenceCount;
 };
 
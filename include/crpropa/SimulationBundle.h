@@ -0,0 +1,47 @@
+#ifndef CRPROPA_SIMULATIONBUNDLE_H
+#define CRPROPA_SIMULATIONBUNDLE_H
+
+#include "crpropa/MappedFile.h"
+
+#include <string>
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup Tools
+ * @{
+ */
+
+/**
+ @class SimulationBundle
+ @brief One mapped file with the data tables and grids of a simulation setup
+
+ The workers of a job array load the same interaction tables (DataTable) and
+ often the same grids. A bundle holds all of them in one file, page aligned:
+ configure the simulation in one process, then call create(), which adds the
+ tables opened so far (DataTable::getFilenames) and further files, e.g. grids
+ written with dumpGrid. The workers call open() before configuring their
+ modules: DataTable::open and mapGrid then map the names found in the bundle
+ instead of their files, all processes of a node share the pages.
+ The entries are found by the file names as given to DataTable::open and
+ mapGrid, i.e. the modules have to use the same data path.
+ */
+class SimulationBundle {
+public:
+	/** Write the tables opened so far and the given files into a bundle */
+	static void create(const std::string &filename,
+			const std::vector<std::string> &files = std::vector<std::string>());
+	/** Map a bundle and use its entries, throws if it is no bundle */
+	static void open(const std::string &filename);
+	/** Stop using all bundles, mapped entries stay valid while used */
+	static void close();
+
+	static ref_ptr<MappedFile> getTable(const std::string &filename); ///< null if not bundled
+	static ref_ptr<MappedFile> getFile(const std::string &filename); ///< null if not bundled
+	static std::vector<std::string> getNames(); ///< entries of the open bundles
+};
+
+/** @} */
+} // namespace crpropa
+
+#endif // CRPROPA_SIMULATIONBUNDLE_H
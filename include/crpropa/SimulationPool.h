@@ -0,0 +1,144 @@
+#ifndef CRPROPA_SIMULATIONPOOL_H
+#define CRPROPA_SIMULATIONPOOL_H
+
+#include "crpropa/ModuleList.h"
+
+#include <deque>
+#include <string>
+#include <pthread.h>
+
+namespace crpropa {
+/**
+ * \addtogroup Core
+ * @{
+ */
+
+class SimulationPool;
+
+/**
+ @class SimulationJob
+ @brief Handle of the primaries submitted to a SimulationPool
+
+ Returned by SimulationPool::submit and feed, completed by the threads of
+ the pool. wait() blocks until all primaries of the job are done and throws
+ the first exception of the job, if any.
+ */
+class SimulationJob: public Referenced {
+	friend class SimulationPool;
+	ref_ptr<SourceInterface> source;
+	ModuleList::candidate_vector_t candidates;
+	size_t count;
+	size_t first; ///< index of the first primary, for counter-based random streams
+	bool recursive;
+
+	// guarded by the mutex of the pool
+	size_t next; ///< first primary not handed out
+
+	// guarded by the mutex of the job
+	mutable pthread_mutex_t mutex;
+	mutable pthread_cond_t changed;
+	size_t assigned; ///< primaries handed out, final when closed
+	size_t completed;
+	bool closed; ///< no further primaries handed out
+	bool finished;
+	std::string error;
+
+	SimulationJob(SourceInterface *source, size_t count, size_t first, bool recursive);
+	SimulationJob(const ModuleList::candidate_vector_t &candidates, size_t first, bool recursive);
+	void init();
+	/// returns true when the job is finished
+	bool close(size_t assigned);
+	/// returns true when the job is finished
+	bool complete(size_t n, const std::string &error);
+	SimulationJob(const SimulationJob &);
+	SimulationJob &operator=(const SimulationJob &);
+public:
+	~SimulationJob();
+	bool isDone() const;
+	/** Wait until the job is done, throws std::runtime_error if a primary
+	 of the job failed. */
+	void wait() const;
+	size_t getCount() const; ///< number of primaries submitted
+	size_t getNumberOfCompleted() const; ///< less than getCount() if cancelled
+	/** The candidates of feed, propagated after wait() */
+	const ModuleList::candidate_vector_t &getCandidates() const;
+};
+
+/**
+ @class SimulationPool
+ @brief Persistent threads that run a ModuleList for a stream of submissions
+
+ For workflows that call ModuleList::run many times with a few primaries,
+ e.g. fits or active learning loops in Python. Each run prints the number
+ of threads, installs and restores the SIGINT and SIGTERM handlers, starts
+ a progress bar and forks and joins the OpenMP threads, which dominates
+ runs of a few candidates. The pool starts its OpenMP threads once, in a
+ parallel region held open by a thread of its own that sleeps while there
+ is no work, and the threads take chunks of primaries from the queue of
+ jobs, in the order of submission. submit and feed return at once with a
+ SimulationJob, so that the next batch can be prepared while the current
+ one runs.
+
+ Without progress bar, signal handlers, checkpoints and limits; cancel()
+ drops the primaries not yet handed out. With counter-based random streams
+ (ModuleList::setCounterBasedRandom) the primaries are numbered in the order
+ of submission over all jobs, a sequence of submits reproduces one run of
+ the same total count. Per-thread state of the modules (e.g. the staging
+ buffers of HDF5Output) uses the OpenMP thread numbers of the pool, do not
+ run the same modules with ModuleList::run or in another pool meanwhile.
+ */
+class SimulationPool: public Referenced {
+	ref_ptr<ModuleList> modules;
+	size_t threads;
+	size_t chunkSize;
+	size_t submitted; ///< primaries submitted so far
+	size_t unfinished; ///< jobs not finished
+
+	mutable pthread_mutex_t mutex; ///< guards queue, stop, submitted and unfinished
+	pthread_cond_t changed; ///< new work or stop
+	mutable pthread_cond_t idle; ///< a job finished
+	std::deque<ref_ptr<SimulationJob> > queue;
+	bool stop;
+	pthread_t team;
+
+	static void *teamMain(void *pool);
+	void work();
+	bool nextChunk(ref_ptr<SimulationJob> &job, size_t &begin, size_t &end);
+	void runChunk(SimulationJob *job, size_t begin, size_t end);
+	void finished();
+	ref_ptr<SimulationJob> enqueue(SimulationJob *job);
+	SimulationPool(const SimulationPool &);
+	SimulationPool &operator=(const SimulationPool &);
+public:
+	/**
+	 @param modules	the simulation, not to be modified while jobs run
+	 @param threads	number of OpenMP threads, 0: omp_get_max_threads()
+	 */
+	SimulationPool(ModuleList *modules, size_t threads = 0);
+	/// Cancels the queued primaries and waits for those in flight
+	~SimulationPool();
+
+	/** Run count primaries of the source, see ModuleList::run */
+	ref_ptr<SimulationJob> submit(SourceInterface *source, size_t count,
+			bool recursive = true);
+	/** Run the given candidates, kept by the job */
+	ref_ptr<SimulationJob> feed(const ModuleList::candidate_vector_t &candidates,
+			bool recursive = true);
+	/** Wait until all jobs submitted so far are done */
+	void wait() const;
+	/** Hand out no further primaries of the queued jobs */
+	void cancel();
+
+	size_t getNumberOfThreads() const;
+	/** Number of primaries a thread takes at once (default 16). From a source
+	 they are drawn together with SourceInterface::getCandidates. */
+	void setChunkSize(size_t n);
+	size_t getChunkSize() const;
+	size_t getNumberOfJobs() const; ///< jobs not finished
+	ModuleList *getModuleList() const;
+};
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_SIMULATIONPOOL_H
@@ -0,0 +1,215 @@
+#ifndef CRPROPA_SMALLVECTOR_H
+#define CRPROPA_SMALLVECTOR_H
+
+#include <cstddef>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+namespace crpropa {
+/**
+ * \addtogroup Tools
+ * @{
+ */
+
+/**
+ @class SmallVector
+ @brief Vector with inline storage for its first N elements.
+
+ Up to N elements are stored in the object itself, further elements move the
+ elements to the heap, doubling the capacity as std::vector. clear() keeps the
+ capacity, so that a reused vector does not allocate again. The iterators are
+ pointers and, as for std::vector, invalidated when the vector grows.
+ */
+template<typename T, size_t N>
+class SmallVector {
+#ifndef SWIG
+	static_assert(N > 0, "SmallVector needs inline storage");
+	typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type Storage;
+	T *first;
+	size_t count;
+	size_t reserved;
+	Storage local[N];
+
+	T *inlineData() {
+		return reinterpret_cast<T *>(local);
+	}
+	const T *inlineData() const {
+		return reinterpret_cast<const T *>(local);
+	}
+	void destroyAll() {
+		for (size_t i = 0; i < count; i++)
+			first[i].~T();
+		count = 0;
+	}
+	void release() {
+		destroyAll();
+		if (first != inlineData())
+			::operator delete(first);
+		first = inlineData();
+		reserved = N;
+	}
+	// move the elements of an other vector, which is left empty
+	void take(SmallVector &other) {
+		if (other.first != other.inlineData()) {
+			first = other.first;
+			reserved = other.reserved;
+			count = other.count;
+			other.first = other.inlineData();
+			other.reserved = N;
+			other.count = 0;
+			return;
+		}
+		for (size_t i = 0; i < other.count; i++)
+			new (first + i) T(std::move(other.first[i]));
+		count = other.count;
+		other.destroyAll();
+	}
+#endif // SWIG
+public:
+	typedef T value_type;
+	typedef T *iterator;
+	typedef const T *const_iterator;
+
+	SmallVector() :
+			first(inlineData()), count(0), reserved(N) {
+	}
+	SmallVector(const SmallVector &other) :
+			first(inlineData()), count(0), reserved(N) {
+		reserve(other.count);
+		for (size_t i = 0; i < other.count; i++)
+			new (first + i) T(other.first[i]);
+		count = other.count;
+	}
+#ifndef SWIG
+	SmallVector(SmallVector &&other) :
+			first(inlineData()), count(0), reserved(N) {
+		take(other);
+	}
+#endif
+	~SmallVector() {
+		release();
+	}
+	SmallVector &operator=(const SmallVector &other) {
+		if (this != &other) {
+			clear();
+			reserve(other.count);
+			for (size_t i = 0; i < other.count; i++)
+				new (first + i) T(other.first[i]);
+			count = other.count;
+		}
+		return *this;
+	}
+#ifndef SWIG
+	SmallVector &operator=(SmallVector &&other) {
+		if (this != &other) {
+			release();
+			take(other);
+		}
+		return *this;
+	}
+#endif
+
+	size_t size() const {
+		return count;
+	}
+	size_t capacity() const {
+		return reserved;
+	}
+	bool empty() const {
+		return count == 0;
+	}
+	/// True while the elements are stored inline
+	bool isInline() const {
+		return first == inlineData();
+	}
+
+	T &operator[](size_t i) {
+		return first[i];
+	}
+	const T &operator[](size_t i) const {
+		return first[i];
+	}
+	T &at(size_t i) {
+		if (i >= count)
+			throw std::out_of_range("SmallVector::at");
+		return first[i];
+	}
+	const T &at(size_t i) const {
+		if (i >= count)
+			throw std::out_of_range("SmallVector::at");
+		return first[i];
+	}
+	T &front() {
+		return first[0];
+	}
+	const T &front() const {
+		return first[0];
+	}
+	T &back() {
+		return first[count - 1];
+	}
+	const T &back() const {
+		return first[count - 1];
+	}
+	T *data() {
+		return first;
+	}
+	const T *data() const {
+		return first;
+	}
+
+	iterator begin() {
+		return first;
+	}
+	iterator end() {
+		return first + count;
+	}
+	const_iterator begin() const {
+		return first;
+	}
+	const_iterator end() const {
+		return first + count;
+	}
+
+	void reserve(size_t n) {
+		if (n <= reserved)
+			return;
+		T *p = static_cast<T *>(::operator new(n * sizeof(T)));
+		for (size_t i = 0; i < count; i++) {
+			new (p + i) T(std::move(first[i]));
+			first[i].~T();
+		}
+		if (first != inlineData())
+			::operator delete(first);
+		first = p;
+		reserved = n;
+	}
+	void push_back(const T &value) {
+		if (count == reserved) {
+			T copy(value); // value may be an element
+			reserve(2 * reserved);
+			new (first + count) T(std::move(copy));
+		} else {
+			new (first + count) T(value);
+		}
+		count++;
+	}
+	void pop_back() {
+		first[--count].~T();
+	}
+	/// Remove all elements, keeping the capacity
+	void clear() {
+		destroyAll();
+	}
+	/// Remove all elements and free the heap storage
+	void reset() {
+		release();
+	}
+};
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_SMALLVECTOR_H
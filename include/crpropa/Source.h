@@ -2,12 +2,21 @@
 #define CRPROPA_SOURCE_H
 
 #include "crpropa/Candidate.h"
+#include "crpropa/Configuration.h"
 #include "crpropa/Grid.h"
 #include "crpropa/EmissionMap.h"
+#include "crpropa/Lock.h"
+#include "crpropa/Random.h"
 
 
 #include <vector>
 
+#ifdef CRPROPA_HAVE_MUPARSER
+namespace mu {
+class Parser;
+}
+#endif
+
 namespace crpropa {
 /** @addtogroup SourceFeatures
  *  @{
@@ -20,10 +29,39 @@ namespace crpropa {
 class SourceFeature: public Referenced {
 protected:
 	std::string description;
+	/// Prepare the source states of the candidates with prepareParticles, as prepareCandidate
+	void prepareSourceStates(Candidate *const *candidates, size_t n) const;
 public:
 	virtual void prepareParticle(ParticleState& particle) const {};
 	virtual void prepareCandidate(Candidate& candidate) const;
+	/** Prepare n particles at once, calls prepareParticle for each by default.
+	 Features with a cheap batch version override this and prepareCandidates.
+	 */
+	virtual void prepareParticles(ParticleState *const *particles, size_t n) const;
+	/// Prepare n candidates at once, calls prepareCandidate for each by default
+	virtual void prepareCandidates(Candidate *const *candidates, size_t n) const;
 	std::string getDescription() const;
+	/** Type and parameters for ConfigurationDocument, the default throws */
+	virtual void getConfiguration(Configuration &configuration) const;
+};
+
+/**
+ @class BatchSourceFeature
+ @brief Abstract source feature that prepares candidates in chunks, e.g. written in Python.
+
+ prepareCandidate and prepareCandidates call prepareCandidateVector, with
+ the batch of primaries that ModuleList draws per thread
+ (ModuleList::setSourceBatchSize). A feature written in Python then takes
+ the GIL once per batch. The feature prepares the source, created, current
+ and previous states itself, e.g. by setting the source state and assigning
+ it to the other states.
+ */
+class BatchSourceFeature: public SourceFeature {
+public:
+	virtual void prepareCandidateVector(
+			const std::vector<Candidate *> &candidates) const = 0;
+	void prepareCandidate(Candidate &candidate) const;
+	void prepareCandidates(Candidate *const *candidates, size_t n) const;
 };
 
 
@@ -34,7 +72,14 @@ public:
 class SourceInterface : public Referenced {
 public:
 	virtual ref_ptr<Candidate> getCandidate() const = 0;
+	/** Append n new candidates, calls getCandidate for each by default.
+	 Used by ModuleList::run to draw the primaries in batches.
+	 */
+	virtual void getCandidates(size_t n,
+			std::vector<ref_ptr<Candidate> > &candidates) const;
 	virtual std::string getDescription() const = 0;
+	/** Type and parameters for ConfigurationDocument, the default throws */
+	virtual void getConfiguration(Configuration &configuration) const;
 };
 
 /**
@@ -50,7 +95,64 @@ class Source: public SourceInterface {
 public:
 	void add(SourceFeature* feature);
 	ref_ptr<Candidate> getCandidate() const;
+	/// Passes all n candidates to each source feature in turn
+	void getCandidates(size_t n, std::vector<ref_ptr<Candidate> > &candidates) const;
 	std::string getDescription() const;
+	void getConfiguration(Configuration &configuration) const;
+};
+
+/**
+ @class AdaptiveSourceSampling
+ @brief Sampling of the sources of a catalogue by their detection efficiency.
+
+ In the pilot phase the sources are drawn by their luminosities p_i, and
+ the pilot candidates carry their source index in the property
+ AdaptiveSourceSampling<N>.index, N the number of the instance. An
+ ObserverSourceEfficiency adds the weights of their detections, also of
+ their secondaries, to the efficiency e_i of the source. After the pilot
+ candidates the sources are drawn with
+   q_i = (1 - mixing) p_i e_i / sum_j(p_j e_j) + mixing p_i
+ and the weights of their candidates are multiplied by p_i / q_i, so that
+ the weighted results are unchanged while the detected candidates come from
+ the efficient sources. The mixing keeps sources without pilot detections.
+ The distribution is adapted on the first draw after the pilot, with the
+ detections so far, or by adapt(), e.g. after a separate pilot run.
+ Used by SourceList and SourceMultiplePositions, see their setAdaptive.
+ */
+class AdaptiveSourceSampling: public Referenced {
+	size_t pilot;
+	double mixing;
+	PropertyKey indexKey; ///< of this instance
+	mutable std::vector<size_t> drawn; ///< pilot candidates per source
+	mutable std::vector<double> detected; ///< detected weight per source
+	mutable size_t drawnTotal;
+	LazyAliasTable luminosities; ///< of the pilot phase
+	mutable LazyAliasTable adapted; ///< of q
+	mutable std::vector<double> weights; ///< p / q
+	mutable int adaptedFlag; ///< only set under the lock
+	mutable Lock lock;
+
+	void build() const;
+public:
+	AdaptiveSourceSampling(size_t pilotCandidates, double mixing = 0.1);
+	/// Append a source, not while candidates are drawn
+	void add(double luminosity);
+	size_t size() const;
+	/// Draw a source, the weight factor of its candidates and if it is drawn in the pilot phase
+	size_t draw(double &weight, bool &isPilot) const;
+	/// Weight a candidate of source i, and count and mark a pilot candidate
+	void mark(Candidate &candidate, size_t i, double weight, bool isPilot) const;
+	/// Add a detected candidate of a pilot candidate, from any thread
+	void recordDetection(const Candidate *candidate) const;
+	/// Adapt the distribution to the detections so far, not while candidates are drawn
+	void adapt();
+	bool isAdapted() const;
+	size_t getPilotCandidates() const;
+	double getMixing() const;
+	/// Detected weight per pilot candidate of source i
+	double getEfficiency(size_t i) const;
+	/// Probability of source i, after the adaptation
+	double getProbability(size_t i) const;
 };
 
 /**
@@ -58,14 +160,69 @@ public:
  @brief List of cosmic ray sources of individual lumosities.
 
  The SourceList is a source itself. It can be used if several sources are
- needed in one simulation.
+ needed in one simulation. With setAdaptive, the sources are drawn by their
+ detection efficiency after a pilot phase, see AdaptiveSourceSampling.
  */
 class SourceList: public SourceInterface {
 	std::vector<ref_ptr<Source> > sources;
-	std::vector<double> cdf;
+	LazyAliasTable sampler; // of the source weights
+	ref_ptr<AdaptiveSourceSampling> adaptive;
 public:
 	void add(Source* source, double weight = 1);
 	ref_ptr<Candidate> getCandidate() const;
+	/// Draws the number of candidates of each source, grouped by source
+	void getCandidates(size_t n, std::vector<ref_ptr<Candidate> > &candidates) const;
+	/** Adaptive sampling after the given number of pilot candidates, for
+	 the sources added so far and later. Pass the result of
+	 getAdaptiveSampling to an ObserverSourceEfficiency. */
+	void setAdaptive(size_t pilotCandidates, double mixing = 0.1);
+	ref_ptr<AdaptiveSourceSampling> getAdaptiveSampling() const; ///< null if not adaptive
+	std::string getDescription() const;
+};
+
+/**
+ @class ArraySource
+ @brief Source of primaries given as columns of external arrays, e.g. NumPy arrays.
+
+ The columns are read in place, without a copy, and must outlive the source
+ (see addOwner).
+ Each column is given by a pointer to its first value and the stride in bytes
+ between consecutive primaries; positions and directions are three values per
+ primary, with the stride between their components. Columns that are not set
+ take the defaults of Candidate. The candidates are created when they are
+ drawn, in order and each once, so that ModuleList::run creates them inside the
+ parallel loop; getCandidate returns null after the last primary, run with
+ size() candidates.
+ */
+class ArraySource: public SourceInterface {
+	size_t count;
+	mutable size_t next; ///< next primary, advanced atomically
+	const int *ids;
+	const double *energies, *positions, *directions, *redshifts, *weights;
+	size_t idStride, energyStride, positionStride, positionComponentStride,
+		directionStride, directionComponentStride, redshiftStride, weightStride;
+	std::vector<ref_ptr<Referenced> > owners;
+public:
+	ArraySource(size_t size);
+	size_t size() const; ///< number of primaries
+	void setIds(const int *ids, size_t stride = sizeof(int));
+	void setEnergies(const double *energies, size_t stride = sizeof(double));
+	void setPositions(const double *positions, size_t stride = 3 * sizeof(double),
+			size_t componentStride = sizeof(double));
+	/// Directions, normalized when the candidates are created
+	void setDirections(const double *directions, size_t stride = 3 * sizeof(double),
+			size_t componentStride = sizeof(double));
+	void setRedshifts(const double *redshifts, size_t stride = sizeof(double));
+	void setWeights(const double *weights, size_t stride = sizeof(double));
+	/// Candidate of primary i
+	ref_ptr<Candidate> getCandidate(size_t i) const;
+	ref_ptr<Candidate> getCandidate() const;
+	/// Append the next n candidates, fewer after the last primary
+	void getCandidates(size_t n, std::vector<ref_ptr<Candidate> > &candidates) const;
+	/// Start again with the first primary
+	void rewind();
+	/// Keep an object alive as long as the source, e.g. the owner of a column
+	void addOwner(Referenced *owner);
 	std::string getDescription() const;
 };
 
@@ -81,7 +238,10 @@ class SourceParticleType: public SourceFeature {
 public:
 	SourceParticleType(int id);
 	void prepareParticle(ParticleState &particle) const;
+	void prepareParticles(ParticleState *const *particles, size_t n) const;
+	void prepareCandidates(Candidate *const *candidates, size_t n) const;
 	void setDescription();
+	void getConfiguration(Configuration &configuration) const;
 };
 
 /**
@@ -90,7 +250,7 @@ public:
  */
 class SourceMultipleParticleTypes: public SourceFeature {
 	std::vector<int> particleTypes;
-	std::vector<double> cdf;
+	LazyAliasTable sampler; // of the abundances
 public:
 	SourceMultipleParticleTypes();
 	void add(int id, double weight = 1);
@@ -107,7 +267,10 @@ class SourceEnergy: public SourceFeature {
 public:
 	SourceEnergy(double energy);
 	void prepareParticle(ParticleState &particle) const;
+	void prepareParticles(ParticleState *const *particles, size_t n) const;
+	void prepareCandidates(Candidate *const *candidates, size_t n) const;
 	void setDescription();
+	void getConfiguration(Configuration &configuration) const;
 };
 
 /**
@@ -121,7 +284,10 @@ class SourcePowerLawSpectrum: public SourceFeature {
 public:
 	SourcePowerLawSpectrum(double Emin, double Emax, double index);
 	void prepareParticle(ParticleState &particle) const;
+	void prepareParticles(ParticleState *const *particles, size_t n) const;
+	void prepareCandidates(Candidate *const *candidates, size_t n) const;
 	void setDescription();
+	void getConfiguration(Configuration &configuration) const;
 };
 
 /**
@@ -135,7 +301,7 @@ class SourceComposition: public SourceFeature {
 	double Rmax;
 	double index;
 	std::vector<int> nuclei;
-	std::vector<double> cdf;
+	LazyAliasTable sampler; // of the weights of the nuclei
 public:
 	SourceComposition(double Emin, double Rmax, double index);
 	void add(int id, double abundance);
@@ -154,20 +320,35 @@ public:
 	SourcePosition(Vector3d position);
 	SourcePosition(double d);
 	void prepareParticle(ParticleState &state) const;
+	void prepareParticles(ParticleState *const *particles, size_t n) const;
+	void prepareCandidates(Candidate *const *candidates, size_t n) const;
 	void setDescription();
+	void getConfiguration(Configuration &configuration) const;
 };
 
 /**
  @class SourceMultiplePositions
  @brief Multiple point source positions with individual luminosities
+
+ The positions are drawn in constant time from an alias table that is built
+ on the first draw after the last add, catalogues of many sources are added
+ in linear time. With setAdaptive, the positions are drawn by their
+ detection efficiency after a pilot phase, see AdaptiveSourceSampling.
  */
 class SourceMultiplePositions: public SourceFeature {
 	std::vector<Vector3d> positions;
-	std::vector<double> cdf;
+	LazyAliasTable sampler; // of the luminosities
+	ref_ptr<AdaptiveSourceSampling> adaptive;
 public:
 	SourceMultiplePositions();
 	void add(Vector3d position, double weight = 1);
 	void prepareParticle(ParticleState &particle) const;
+	void prepareCandidate(Candidate &candidate) const;
+	/** Adaptive sampling after the given number of pilot candidates, see
+	 SourceList::setAdaptive. Only candidates are weighted, not particles
+	 of prepareParticle. */
+	void setAdaptive(size_t pilotCandidates, double mixing = 0.1);
+	ref_ptr<AdaptiveSourceSampling> getAdaptiveSampling() const; ///< null if not adaptive
 	void setDescription();
 };
 
@@ -181,7 +362,10 @@ class SourceUniformSphere: public SourceFeature {
 public:
 	SourceUniformSphere(Vector3d center, double radius);
 	void prepareParticle(ParticleState &particle) const;
+	void prepareParticles(ParticleState *const *particles, size_t n) const;
+	void prepareCandidates(Candidate *const *candidates, size_t n) const;
 	void setDescription();
+	void getConfiguration(Configuration &configuration) const;
 };
 
 /**
@@ -256,6 +440,9 @@ public:
 The origin of the distribution is the Galactic center. The default maximum radius is set 
 to R_max=20 kpc and the default maximum height is Z_max = 5 kpc.
 See G. Case and D. Bhattacharya (1996) for the details of the distribution.
+The radius is drawn from a table of the inverse cdf of f_r (set_tableResolution
+quantiles, linearly interpolated), built at construction and by set_RMax, the
+height from the analytic inverse cdf of f_z, instead of rejection sampling.
 */
 
 class SourceSNRDistribution: public SourceFeature {
@@ -267,11 +454,16 @@ class SourceSNRDistribution: public SourceFeature {
 	double R_max; // maximum radial distance - default 20 kpc 
 		      // (due to the extension of the JF12 field)
 	double Z_max; // maximum distance from galactic plane - default 5 kpc
+	double zNorm; // fraction of the exponential within Z_max
+	size_t tableResolution; // number of quantiles of the radial table
+	std::vector<double> radialQuantiles; // inverse cdf of f_r
 
 public:
 	SourceSNRDistribution();	
 	SourceSNRDistribution(double R_earth, double beta, double Zg);
 	void prepareParticle(ParticleState &particle) const;
+	void prepareParticles(ParticleState *const *particles, size_t n) const;
+	void prepareCandidates(Candidate *const *candidates, size_t n) const;
 	double f_r(double r) const;
 	double f_z(double z) const;
 	void set_frMax(double R, double b);
@@ -282,6 +474,9 @@ public:
 	double get_fzMax();
 	double get_RMax();
 	double get_ZMax();
+	/// Number of quantiles of the radial inverse cdf table, rebuilds the table
+	void set_tableResolution(size_t n);
+	size_t get_tableResolution() const;
 	void setDescription();
 };
 /**
@@ -293,6 +488,7 @@ The z-distribution is a simple exponentially decaying distribution.
 The pulsar distribution is explained in detail in C.-A. Faucher-Giguere
 and V. M. Kaspi, ApJ 643 (May, 2006) 332. The radial distribution is 
 parametrized as in Blasi and Amato, JCAP 1 (Jan., 2012) 10.
+The radius and height are drawn from tables as for SourceSNRDistribution.
 */
 
 class SourcePulsarDistribution: public SourceFeature {
@@ -305,14 +501,16 @@ class SourcePulsarDistribution: public SourceFeature {
 	double Z_max; // maximum distance from galactic plane - default 5 kpc 
 	double r_blur; // relative smearing factor for the radius
 	double theta_blur; // smearing factor for the angle. Unit = [1/length]
-
-
-	
+	double zNorm; // fraction of the exponential within Z_max
+	size_t tableResolution; // number of quantiles of the radial table
+	std::vector<double> radialQuantiles; // inverse cdf of f_r
 
 public:
 	SourcePulsarDistribution();	
 	SourcePulsarDistribution(double R_earth, double beta, double Zg, double r_blur, double theta_blur);
 	void prepareParticle(ParticleState &particle) const;
+	void prepareParticles(ParticleState *const *particles, size_t n) const;
+	void prepareCandidates(Candidate *const *candidates, size_t n) const;
 	double f_r(double r) const;
 	double f_z(double z) const;
 	double f_theta(int i, double r) const;
@@ -330,6 +528,9 @@ public:
 	double get_ZMax();
 	double get_rBlur();
 	double get_thetaBlur();
+	/// Number of quantiles of the radial inverse cdf table, rebuilds the table
+	void set_tableResolution(size_t n);
+	size_t get_tableResolution() const;
 	void setDescription();
 };
 
@@ -360,9 +561,14 @@ public:
 /**
  @class SourceDensityGrid
  @brief Random source positions from a density grid
+
+ The cells are drawn from an alias table of the grid values in constant time,
+ the grid itself is not modified or kept.
  */
 class SourceDensityGrid: public SourceFeature {
-	ref_ptr<ScalarGrid> grid;
+	AliasTable sampler; // cells in row-major order
+	Vector3d origin, spacing;
+	size_t Ny, Nz;
 public:
 	SourceDensityGrid(ref_ptr<ScalarGrid> densityGrid);
 	void prepareParticle(ParticleState &particle) const;
@@ -372,9 +578,12 @@ public:
 /**
  @class SourceDensityGrid1D
  @brief Random source positions from a 1D density grid
+
+ As SourceDensityGrid, with positions along the x-axis.
  */
 class SourceDensityGrid1D: public SourceFeature {
-	ref_ptr<ScalarGrid> grid;
+	AliasTable sampler;
+	Vector3d origin, spacing;
 public:
 	SourceDensityGrid1D(ref_ptr<ScalarGrid> densityGrid);
 	void prepareParticle(ParticleState &particle) const;
@@ -389,7 +598,10 @@ class SourceIsotropicEmission: public SourceFeature {
 public:
 	SourceIsotropicEmission();
 	void prepareParticle(ParticleState &particle) const;
+	void prepareParticles(ParticleState *const *particles, size_t n) const;
+	void prepareCandidates(Candidate *const *candidates, size_t n) const;
 	void setDescription();
+	void getConfiguration(Configuration &configuration) const;
 };
 
 /**
@@ -402,18 +614,28 @@ public:
 	SourceDirection(Vector3d direction = Vector3d(-1, 0, 0));
 	void prepareParticle(ParticleState &particle) const;
 	void setDescription();
+	void getConfiguration(Configuration &configuration) const;
 };
 
 /**
  @class SourceEmissionMap
  @brief Deactivate Candidate if it has zero probability in provided EmissionMap
+
+ With sampling, the direction of an isotropic source is instead drawn from the
+ map of the candidate's type and energy and its weight multiplied with the
+ correction, see CylindricalProjectionMap::getSamplingWeight. All candidates
+ then reach the observers of the map, the weighted counts are those of the
+ rejection. Candidates without a map are deactivated.
  */
 class SourceEmissionMap: public SourceFeature {
 	ref_ptr<EmissionMap> emissionMap;
+	bool sampling;
 public:
-	SourceEmissionMap(EmissionMap *emissionMap);
+	SourceEmissionMap(EmissionMap *emissionMap, bool sampling = false);
 	void prepareCandidate(Candidate &candidate) const;
 	void setEmissionMap(EmissionMap *emissionMap);
+	/// draw the directions from the map instead of rejecting them
+	void setSampling(bool sampling);
 	void setDescription();
 };
 
@@ -430,6 +652,26 @@ public:
 	void setDescription();
 };
 
+/**
+ @class SourceBacktracking
+ @brief Antiparticles leaving a spherical observer, for backtracking
+
+ Random positions on the sphere with directions outwards, of the cosine
+ (Lambert) distribution to the normal: the reversed arrival directions of an
+ isotropic flux through the sphere. For radius 0 the directions are isotropic.
+ Charged particles are replaced by their antiparticles (negated ID), add the
+ feature after those of the particle type. The arrival direction of a
+ backtracked candidate is -source.getDirection(), see BacktrackingWeight.
+ */
+class SourceBacktracking: public SourceFeature {
+	Vector3d center;
+	double radius;
+public:
+	SourceBacktracking(Vector3d center, double radius);
+	void prepareParticle(ParticleState &particle) const;
+	void setDescription();
+};
+
 /**
  @class SourceRedshift
  @brief Discrete redshift (time of emission)
@@ -440,6 +682,7 @@ public:
 	SourceRedshift(double z);
 	void prepareCandidate(Candidate &candidate) const;
 	void setDescription();
+	void getConfiguration(Configuration &configuration) const;
 };
 
 /**
@@ -483,26 +726,25 @@ public:
 /**
  @class SourceGenericComposition
  @brief Multiple nuclei with energies described by an expression string
+
+ The expression is a function of E, A, Z, Emin, Emax, bins and the energy
+ units MeV - EeV, evaluated at bins + 1 logarithmically spaced energies.
+ It is compiled once and evaluated for all energies of an isotope in one
+ bulk pass on add. The spectra of all isotopes form the rows of one alias
+ table, so that the isotope and the energy bin are drawn in constant time,
+ the energy is uniform within the bin.
  */
 class SourceGenericComposition: public SourceFeature {
 public:
-	struct Nucleus {
-		int id;
-		std::vector<double> cdf;
-	};
-
 	SourceGenericComposition(double Emin, double Emax, std::string expression, size_t bins = 1024);
+	~SourceGenericComposition();
 	void add(int id, double abundance);
 	void add(int A, int Z, double abundance);
 	void prepareParticle(ParticleState &particle) const;
 	void setDescription();
 
-    const std::vector<double> *getNucleusCDF(int id) const {
-        for (size_t i = 0; i<nuclei.size(); i++)
-            if (nuclei[i].id == id)
-            	return &nuclei[i].cdf;
-    	return 0;
-    }
+	/// Cumulative spectrum of an isotope at the bins + 1 energies, empty if not added
+	std::vector<double> getNucleusCDF(int id) const;
 
 protected:
 
@@ -511,9 +753,17 @@ protected:
 	std::string expression;
 	std::vector<double> energy;
 
-	std::vector<Nucleus> nuclei;
-	std::vector<double> cdf;
+	std::vector<int> nuclei;
+	LazyAliasTable sampler; ///< abundances of the isotopes
+	LazyAliasTable energySampler; ///< cumulative spectrum of each isotope, one row each
+
+private:
+	// compiled expression, the variables are arrays of bins + 1 values
+	mu::Parser *parser;
+	std::vector<double> parserE, parserA, parserZ;
 
+	SourceGenericComposition(const SourceGenericComposition &);
+	SourceGenericComposition &operator=(const SourceGenericComposition &);
 };
 
 /**  @} */ // end of group SourceFeature
@@ -0,0 +1,291 @@
+#ifndef CRPROPA_SPARSEGRID_H
+#define CRPROPA_SPARSEGRID_H
+
+#include "crpropa/Grid.h"
+
+#include <cmath>
+
+namespace crpropa {
+
+/**
+ * \addtogroup Core
+ * @{
+ */
+
+/** Deviation of a grid value from the background of a SparseGrid */
+inline double sparseDeviation(float a, float b) {
+	return std::fabs(a - b);
+}
+
+inline double sparseDeviation(const Vector3f &a, const Vector3f &b) {
+	return (a - b).getR();
+}
+
+/**
+ @class SparseGrid
+ @brief Block-sparse grid: only the bricks of 8x8x8 points that differ from a constant background are stored.
+
+ Fields of cosmological MHD simulations, e.g. of clusters and filaments, are
+ close to zero in most of the volume. A SparseGrid holds an index of
+ NBx * NBy * NBz bricks with the position of the stored brick, or -1 for a
+ brick of only the background value, so the memory scales with the structure
+ instead of the volume: 4 bytes per empty and 512 values per stored brick.
+
+ Origin, spacing, size, the periodic or reflective extension and the
+ trilinear interpolate are those of Grid, a SparseGrid converted from a Grid
+ interpolates to the same values where the dense grid deviates from the
+ background by at most the tolerance. Interpolations inside an empty brick
+ return the background without reading any values.
+ Tricubic interpolation and mapped files are not supported.
+ */
+template<typename T>
+class SparseGrid: public Referenced {
+	std::vector<int32_t> index; /**< Position of each brick in values, -1: background */
+	std::vector<T> values; /**< Stored bricks of 512 values, z changing the fastest */
+	T background; /**< Value of the points in empty bricks */
+	size_t Nx, Ny, Nz; /**< Number of grid points */
+	size_t NBx, NBy, NBz; /**< Number of bricks */
+	Vector3d origin; /**< Origin of the volume that is represented by the grid. */
+	Vector3d gridOrigin; /**< Grid origin */
+	Vector3d spacing; /**< Distance between grid points */
+	bool reflective; /**< If set to true, the grid is repeated reflectively instead of periodically */
+	MemoryAccount memory; /**< Bytes of the index and the stored bricks */
+
+	size_t brickIndex(size_t ix, size_t iy, size_t iz) const {
+		return ((ix >> 3) * NBy + (iy >> 3)) * NBz + (iz >> 3);
+	}
+
+	static size_t offset(size_t ix, size_t iy, size_t iz) {
+		return ((ix & 7) << 6) + ((iy & 7) << 3) + (iz & 7);
+	}
+
+	void updateMemory() {
+		memory.set(index.capacity() * sizeof(int32_t) + values.capacity() * sizeof(T));
+	}
+
+	void init(Vector3d o, size_t nx, size_t ny, size_t nz, Vector3d s) {
+		Nx = nx;
+		Ny = ny;
+		Nz = nz;
+		NBx = (Nx + 7) / 8;
+		NBy = (Ny + 7) / 8;
+		NBz = (Nz + 7) / 8;
+		spacing = s;
+		setOrigin(o);
+		reflective = false;
+		index.assign(NBx * NBy * NBz, -1);
+		values.clear();
+		updateMemory();
+	}
+
+public:
+	/** Empty sparse grid, all points have the background value
+	 @param	origin	Position of the lower left front corner of the volume
+	 @param	Nx		Number of grid points in x-direction
+	 @param	Ny		Number of grid points in y-direction
+	 @param	Nz		Number of grid points in z-direction
+	 @param spacing	Spacing vector between grid points
+	 @param background	Value of the points that are not set
+	 */
+	SparseGrid(Vector3d origin, size_t Nx, size_t Ny, size_t Nz, Vector3d spacing,
+			T background = T()) : background(background), memory("SparseGrid") {
+		init(origin, Nx, Ny, Nz, spacing);
+	}
+
+	/** Conversion of a dense grid, keeping the bricks with a point that
+	 deviates from the background by more than the tolerance
+	 @param grid		the dense grid, in either layout
+	 @param tolerance	largest deviation of a point from the background in an omitted brick
+	 @param background	Value of the omitted points
+	 */
+	SparseGrid(const Grid<T> &grid, double tolerance = 0, T background = T()) :
+			background(background), memory("SparseGrid") {
+		init(grid.getOrigin(), grid.getNx(), grid.getNy(), grid.getNz(), grid.getSpacing());
+		reflective = grid.isReflective();
+		for (size_t bx = 0; bx < NBx; bx++)
+			for (size_t by = 0; by < NBy; by++)
+				for (size_t bz = 0; bz < NBz; bz++) {
+					size_t xEnd = std::min(Nx, 8 * bx + 8);
+					size_t yEnd = std::min(Ny, 8 * by + 8);
+					size_t zEnd = std::min(Nz, 8 * bz + 8);
+					bool empty = true;
+					for (size_t ix = 8 * bx; empty && (ix < xEnd); ix++)
+						for (size_t iy = 8 * by; empty && (iy < yEnd); iy++)
+							for (size_t iz = 8 * bz; empty && (iz < zEnd); iz++)
+								empty = !(sparseDeviation(grid.get(ix, iy, iz), background) > tolerance);
+					if (empty)
+						continue;
+					for (size_t ix = 8 * bx; ix < xEnd; ix++)
+						for (size_t iy = 8 * by; iy < yEnd; iy++)
+							for (size_t iz = 8 * bz; iz < zEnd; iz++)
+								setValue(ix, iy, iz, grid.get(ix, iy, iz));
+				}
+		std::vector<T>(values).swap(values);
+		updateMemory();
+	}
+
+	/** Dense copy of the grid */
+	ref_ptr<Grid<T> > toGrid() const {
+		ref_ptr<Grid<T> > grid = new Grid<T>(origin, Nx, Ny, Nz, spacing);
+		grid->setReflective(reflective);
+		for (size_t ix = 0; ix < Nx; ix++)
+			for (size_t iy = 0; iy < Ny; iy++)
+				for (size_t iz = 0; iz < Nz; iz++)
+					grid->get(ix, iy, iz) = get(ix, iy, iz);
+		return grid;
+	}
+
+	void setOrigin(Vector3d origin) {
+		this->origin = origin;
+		this->gridOrigin = origin + spacing / 2;
+	}
+
+	void setReflective(bool b) {
+		reflective = b;
+	}
+
+	Vector3d getOrigin() const {
+		return origin;
+	}
+
+	size_t getNx() const {
+		return Nx;
+	}
+
+	size_t getNy() const {
+		return Ny;
+	}
+
+	size_t getNz() const {
+		return Nz;
+	}
+
+	Vector3d getSpacing() const {
+		return spacing;
+	}
+
+	bool isReflective() const {
+		return reflective;
+	}
+
+	T getBackground() const {
+		return background;
+	}
+
+	/** Number of stored bricks of 8x8x8 points */
+	size_t getNumberOfBricks() const {
+		return values.size() / 512;
+	}
+
+	/** Fraction of the bricks that are stored */
+	double getFillFactor() const {
+		return double(getNumberOfBricks()) / index.size();
+	}
+
+	/** Value of a grid point, the background in empty bricks */
+	T get(size_t ix, size_t iy, size_t iz) const {
+		int32_t b = index[brickIndex(ix, iy, iz)];
+		return (b < 0) ? background : values[(size_t(b) << 9) + offset(ix, iy, iz)];
+	}
+
+	/** Set the value of a grid point, storing its brick if it was empty */
+	void setValue(size_t ix, size_t iy, size_t iz, T value) {
+		int32_t &b = index[brickIndex(ix, iy, iz)];
+		if (b < 0) {
+			if (sparseDeviation(value, background) == 0)
+				return;
+			b = int32_t(values.size() / 512);
+			values.resize(values.size() + 512, background);
+			updateMemory();
+		}
+		values[(size_t(b) << 9) + offset(ix, iy, iz)] = value;
+	}
+
+	/** Value of a grid point that is closest to a given position */
+	T closestValue(const Vector3d &position) const {
+		Vector3d r = (position - gridOrigin) / spacing;
+		int ix = round(r.x);
+		int iy = round(r.y);
+		int iz = round(r.z);
+		if (reflective) {
+			ix = reflectiveIndex(ix, Nx);
+			iy = reflectiveIndex(iy, Ny);
+			iz = reflectiveIndex(iz, Nz);
+		} else {
+			ix = ((ix % int(Nx)) + int(Nx)) % int(Nx);
+			iy = ((iy % int(Ny)) + int(Ny)) % int(Ny);
+			iz = ((iz % int(Nz)) + int(Nz)) % int(Nz);
+		}
+		return get(ix, iy, iz);
+	}
+
+	/** Interpolate the grid at a given position, as Grid::interpolate */
+	T interpolate(const Vector3d &position) const {
+		return reflective ? interpolateAt<true>(position) : interpolateAt<false>(position);
+	}
+
+	/** Interpolate the grid at n positions
+	 @param positions	array of n positions
+	 @param values		array of n values to fill
+	 */
+	void interpolate(const Vector3d *positions, T *values, size_t n) const {
+		if (reflective) {
+			for (size_t i = 0; i < n; i++)
+				values[i] = interpolateAt<true>(positions[i]);
+		} else {
+			for (size_t i = 0; i < n; i++)
+				values[i] = interpolateAt<false>(positions[i]);
+		}
+	}
+
+private:
+	template<bool Reflective>
+	T interpolateAt(const Vector3d &position) const {
+		// position on a unit grid
+		Vector3d r = (position - gridOrigin) / spacing;
+
+		// indices of lower and upper neighbors
+		int ix, iX, iy, iY, iz, iZ;
+		if (Reflective) {
+			reflectiveClamp(r.x, Nx, ix, iX);
+			reflectiveClamp(r.y, Ny, iy, iY);
+			reflectiveClamp(r.z, Nz, iz, iZ);
+		} else {
+			periodicClamp(r.x, Nx, ix, iX);
+			periodicClamp(r.y, Ny, iy, iY);
+			periodicClamp(r.z, Nz, iz, iZ);
+		}
+
+		// all neighbors in one empty brick: no values to read
+		size_t b = brickIndex(ix, iy, iz);
+		if ((index[b] < 0) && (b == brickIndex(iX, iY, iZ)))
+			return background;
+
+		// linear fraction to lower and upper neighbors
+		double fx = r.x - floor(r.x);
+		double fy = r.y - floor(r.y);
+		double fz = r.z - floor(r.z);
+
+		// trilinear interpolation as Grid::interpolateAt
+		typedef typename Padded<T>::Type L;
+		L c000 = get(ix, iy, iz), c001 = get(ix, iy, iZ);
+		L c010 = get(ix, iY, iz), c011 = get(ix, iY, iZ);
+		L c100 = get(iX, iy, iz), c101 = get(iX, iy, iZ);
+		L c110 = get(iX, iY, iz), c111 = get(iX, iY, iZ);
+		L b00 = c000 + (c001 - c000) * fz;
+		L b10 = c100 + (c101 - c100) * fz;
+		L b01 = c010 + (c011 - c010) * fz;
+		L b11 = c110 + (c111 - c110) * fz;
+		L b0 = b00 + (b01 - b00) * fy;
+		L b1 = b10 + (b11 - b10) * fy;
+		return T(b0 + (b1 - b0) * fx);
+	}
+};
+
+typedef SparseGrid<Vector3f> SparseVectorGrid;
+typedef SparseGrid<float> SparseScalarGrid;
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_SPARSEGRID_H
@@ -0,0 +1,66 @@
+#ifndef CRPROPA_STATISTICS_H
+#define CRPROPA_STATISTICS_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup Tools
+ * @{
+ */
+
+/**
+ @class Statistics
+ @brief Counters and histograms of a simulation, e.g. for tuning step sizes.
+
+ When enabled, the propagators count their accepted and rejected steps and
+ fill a histogram of the step sizes, the interaction modules count their
+ interactions per channel and ModuleList::process counts which module
+ limited the next step (the last one changing Candidate::getNextStep or
+ the first one if none changes it, not counted in breadth-first runs).
+ The numbers are accumulated per thread without locking and merged when
+ read, read them after a run. Disabled by default, then the modules only
+ check isEnabled().
+ */
+class Statistics {
+	static bool enabled;
+public:
+	static void setEnabled(bool enable = true);
+	static bool isEnabled() {
+		return enabled;
+	}
+
+	/// index of the counter with the given name, added if new
+	static size_t addCounter(const std::string &name);
+	/// add to a counter of the current thread
+	static void count(size_t counter, size_t n = 1);
+	static void count(const std::string &name, size_t n = 1);
+	/// sum over all threads, 0 for unknown names
+	static size_t getCount(const std::string &name);
+	static std::vector<std::string> getCounterNames();
+
+	/** Index of the histogram of log10(value) with the given name and bins
+	 between 10^min and 10^max, added if new. Values outside of the range
+	 are added to the first and last bin.
+	 */
+	static size_t addHistogram(const std::string &name, double min, double max,
+			size_t bins);
+	/// add a value to a histogram of the current thread
+	static void fill(size_t histogram, double value);
+	/// counts of the bins summed over all threads, empty for unknown names
+	static std::vector<double> getHistogram(const std::string &name);
+	/// the bins + 1 edges of a histogram
+	static std::vector<double> getHistogramEdges(const std::string &name);
+	static std::vector<std::string> getHistogramNames();
+
+	static std::string getReport(); ///< all nonzero counters and histograms
+	static void show();
+	static void reset(); ///< set all counts of all threads to 0
+};
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_STATISTICS_H
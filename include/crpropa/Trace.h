@@ -0,0 +1,58 @@
+#ifndef CRPROPA_TRACE_H
+#define CRPROPA_TRACE_H
+
+#include <cstddef>
+#include <string>
+
+namespace crpropa {
+/**
+ * \addtogroup Tools
+ * @{
+ */
+
+/**
+ @class Trace
+ @brief Timeline of the events of a simulation in the Chrome trace format.
+
+ When started, ModuleList::run records the span of each primary, every n-th
+ call of ModuleList::process the spans of the modules, the outputs their
+ writes and the Locks the waits longer than a microsecond. The events are
+ kept in a ring buffer per thread, only the latest ones are written if it
+ overflows. Write the trace after the run, e.g. to view the load imbalance of
+ long primaries in chrome://tracing or https://ui.perfetto.dev.
+
+ Example:
+ Trace::start();
+ sim.run(source, 10000);
+ Trace::stop();
+ Trace::write("trace.json");
+ */
+class Trace {
+	static bool enabled;
+public:
+	/// clear all events and start recording, with the events kept per thread
+	/// and 1 of moduleSampling calls of ModuleList::process recorded
+	static void start(size_t capacity = 100000, size_t moduleSampling = 100);
+	static void stop(); ///< keeps the events for write()
+	static bool isEnabled() {
+		return enabled;
+	}
+
+	/// index of the event name with the given category, added if new
+	static size_t addName(const std::string &name, const std::string &category);
+	/// seconds since start()
+	static double now();
+	/// add a span of the current thread, with an optional index argument (< 0: none)
+	static void record(size_t name, double begin, double end, long index = -1);
+	/// true for every moduleSampling-th call of the current thread
+	static bool sample();
+
+	static size_t size(); ///< number of kept events of all threads
+	/// write the kept events as a JSON array of Chrome trace events
+	static void write(const std::string &filename);
+};
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_TRACE_H
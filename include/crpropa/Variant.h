@@ -15,6 +15,7 @@
 #include <cstdlib>
 #include <stdexcept>
 #include <limits>
+#include <new>
 #include <stdint.h>
 
 // Helper to set POD type methods to variant
@@ -30,21 +31,6 @@
 	bool operator == (const VALUE &a) const { check(TYPE); return data._##NAME == a; } \
 	Variant(const VALUE &a) { data._ ## NAME = a; type = TYPE; }
 
-// Helper to set pointer type methods to variant
-#define VARIANT_ADD_TYPE_DECL_PTR_BASE(NAME, TYPE, VALUE) \
-	bool is ## NAME() const { return (type == TYPE); } \
-	VALUE &as ## NAME() { check(TYPE); return *data._##NAME; } \
-	const VALUE &as ## NAME() const	{ check(TYPE); return *data._##NAME; } \
-	static Variant from ## NAME(const VALUE &a) { return Variant(a); } \
-
-// Helper to set pointer type methods to variant
-#define VARIANT_ADD_TYPE_DECL_PTR(NAME, TYPE, VALUE) \
-	bool operator != (const VALUE &a) const { check(TYPE); return *data._##NAME != a; } \
-	bool operator == (const VALUE &a) const { check(TYPE); return *data._##NAME == a; } \
-	VARIANT_ADD_TYPE_DECL_PTR_BASE(NAME, TYPE, VALUE) \
-	Variant &operator =(const VALUE &a) { if (type != TYPE) { clear(); data._##NAME = new VALUE; } type = TYPE; (*data._##NAME) = a; return *this; } \
-	Variant(const VALUE &a) { data._ ## NAME = new VALUE(a); type = TYPE; }
-
 namespace crpropa
 {
 
@@ -114,7 +100,7 @@ public:
 	static const char *getTypeName(Type type);
 
 	// copy the data to buffer via memcpy. Returns the size of the data
-	size_t copyToBuffer(void* buffer);
+	size_t copyToBuffer(void* buffer) const;
 	/// returns size of used data type in bytes
 	size_t getSize() const;
 
@@ -166,9 +152,22 @@ public:
 
 	VARIANT_ADD_TYPE_DECL_POD(Double, TYPE_DOUBLE, double)
 
-	VARIANT_ADD_TYPE_DECL_PTR(String, TYPE_STRING, std::string)
+	bool isString() const { return (type == TYPE_STRING); }
+	std::string &asString() { check(TYPE_STRING); return stringData(); }
+	const std::string &asString() const { check(TYPE_STRING); return stringData(); }
+	static Variant fromString(const std::string &a) { return Variant(a); }
+	bool operator != (const std::string &a) const { check(TYPE_STRING); return stringData() != a; }
+	bool operator == (const std::string &a) const { check(TYPE_STRING); return stringData() == a; }
+	Variant &operator =(const std::string &a);
+	Variant(const std::string &a);
+#if __cplusplus >= 201103L
+	Variant(Variant &&a) noexcept;
+	Variant &operator =(Variant &&a) noexcept;
+#endif
 	Variant(const char *s);
 	std::string toString() const;
+	/// append the value as by toString, without temporary strings
+	void appendTo(std::string &out) const;
 	static Variant fromString(const std::string &str, Type type);
 	operator std::string() const
 	{
@@ -177,7 +176,7 @@ public:
 	bool operator !=(const char *a) const
 	{
 		check(TYPE_STRING);
-		return data._String->compare(a) != 0;
+		return stringData().compare(a) != 0;
 	}
 
 	// clear pointer based data types
@@ -199,8 +198,14 @@ protected:
 		uint64_t _UInt64;
 		double _Double;
 		float _Float;
-		std::string *_String;
+		char _String[sizeof(std::string)]; ///< the string itself, short ones need no allocation
 	} data;
+	std::string &stringData() {
+		return *reinterpret_cast<std::string *>(data._String);
+	}
+	const std::string &stringData() const {
+		return *reinterpret_cast<const std::string *>(data._String);
+	}
 
 private:
 	void copy(const Variant &a);
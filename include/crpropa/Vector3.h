@@ -406,6 +406,119 @@ inline Vector3<T> operator *(T f, const Vector3<T> &v) {
 typedef Vector3<double> Vector3d;
 typedef Vector3<float> Vector3f;
 
+#ifndef SWIG
+/**
+ @class PaddedVector3
+ @brief 3-vector padded to 4 lanes for the inner loops of the propagation and the grid interpolation.
+
+ The components are stored in an array of 4 elements aligned to its size,
+ the fourth lane is kept at 0. All operations are fixed loops over the 4
+ lanes, which compilers translate into single 4-wide SSE/AVX/NEON
+ instructions (or two 2-wide ones) without intrinsics. Used internally,
+ converts from and to Vector3, whose API and layout are unchanged.
+ */
+template<typename T>
+struct
+#if __cplusplus >= 201103L
+alignas(4 * sizeof(T))
+#endif
+PaddedVector3 {
+	T v[4];
+
+	PaddedVector3() {
+		for (int i = 0; i < 4; i++)
+			v[i] = 0;
+	}
+	PaddedVector3(const Vector3<T> &u) {
+		v[0] = u.x;
+		v[1] = u.y;
+		v[2] = u.z;
+		v[3] = 0;
+	}
+	template<typename U>
+	explicit PaddedVector3(const Vector3<U> &u) {
+		v[0] = u.x;
+		v[1] = u.y;
+		v[2] = u.z;
+		v[3] = 0;
+	}
+	operator Vector3<T>() const {
+		return Vector3<T>(v[0], v[1], v[2]);
+	}
+
+	PaddedVector3 &operator +=(const PaddedVector3 &u) {
+		for (int i = 0; i < 4; i++)
+			v[i] += u.v[i];
+		return *this;
+	}
+	PaddedVector3 &operator -=(const PaddedVector3 &u) {
+		for (int i = 0; i < 4; i++)
+			v[i] -= u.v[i];
+		return *this;
+	}
+	PaddedVector3 &operator *=(T f) {
+		for (int i = 0; i < 4; i++)
+			v[i] *= f;
+		return *this;
+	}
+	/** this += u * f, without a temporary */
+	PaddedVector3 &addScaled(const PaddedVector3 &u, T f) {
+		for (int i = 0; i < 4; i++)
+			v[i] += u.v[i] * f;
+		return *this;
+	}
+	PaddedVector3 operator +(const PaddedVector3 &u) const {
+		PaddedVector3 w(*this);
+		return w += u;
+	}
+	PaddedVector3 operator -(const PaddedVector3 &u) const {
+		PaddedVector3 w(*this);
+		return w -= u;
+	}
+	PaddedVector3 operator *(T f) const {
+		PaddedVector3 w(*this);
+		return w *= f;
+	}
+	T dot(const PaddedVector3 &u) const {
+		T s = 0;
+		for (int i = 0; i < 4; i++)
+			s += v[i] * u.v[i];
+		return s;
+	}
+	T getR2() const {
+		return dot(*this);
+	}
+	T getR() const {
+		return std::sqrt(getR2());
+	}
+	/** Cross product as the difference of two lane permutations (y, z, x) */
+	PaddedVector3 cross(const PaddedVector3 &u) const {
+		PaddedVector3 a, b, w;
+		for (int i = 0; i < 3; i++) {
+			a.v[i] = v[(i + 1) % 3] * u.v[(i + 2) % 3];
+			b.v[i] = v[(i + 2) % 3] * u.v[(i + 1) % 3];
+		}
+		for (int i = 0; i < 4; i++)
+			w.v[i] = a.v[i] - b.v[i];
+		return w;
+	}
+};
+
+/** Type used in the inner loops for a value type, PaddedVector3 for a Vector3 */
+template<typename T>
+struct Padded {
+	typedef T Type;
+};
+
+template<typename T>
+struct Padded<Vector3<T> > {
+	typedef PaddedVector3<T> Type;
+};
+
+typedef PaddedVector3<double> PaddedVector3d;
+typedef PaddedVector3<float> PaddedVector3f;
+#endif // SWIG
+
 /** @}*/
 }  // namespace crpropa
 
@@ -26,6 +26,26 @@ public:
 	}
 	virtual Vector3d getField(const Vector3d &position) const {};
 	virtual double getDivergence(const Vector3d &position) const {};
+	/** Field and divergence at the same position, fields with shared
+	 intermediate results compute both at once */
+	virtual void getFieldAndDivergence(const Vector3d &position, Vector3d &field,
+			double &divergence) const {
+		field = getField(position);
+		divergence = getDivergence(position);
+	};
+	/** Field and divergence at n positions. Either of fields and divergences
+	 may be NULL if not needed. */
+	virtual void getFieldsAndDivergences(const Vector3d *positions,
+			Vector3d *fields, double *divergences, size_t n) const {
+		for (size_t i = 0; i < n; i++) {
+			if (fields && divergences)
+				getFieldAndDivergence(positions[i], fields[i], divergences[i]);
+			else if (fields)
+				fields[i] = getField(positions[i]);
+			else if (divergences)
+				divergences[i] = getDivergence(positions[i]);
+		}
+	};
 };
 
 
@@ -39,6 +59,11 @@ public:
 	void addField(ref_ptr<AdvectionField> field);
 	Vector3d getField(const Vector3d &position) const;
 	double getDivergence(const Vector3d &position) const;
+	void getFieldAndDivergence(const Vector3d &position, Vector3d &field,
+			double &divergence) const;
+	/** Evaluates one field after the other for all positions */
+	void getFieldsAndDivergences(const Vector3d *positions, Vector3d *fields,
+			double *divergences, size_t n) const;
 };
 
 
@@ -75,6 +100,8 @@ public:
 	ConstantSphericalAdvectionField(const Vector3d origin, double vWind);
 	Vector3d getField(const Vector3d &position) const;
 	double getDivergence(const Vector3d &position) const;
+	void getFieldAndDivergence(const Vector3d &position, Vector3d &field,
+			double &divergence) const;
 
 	void setOrigin(const Vector3d origin);
 	void setVWind(double vMax);
@@ -110,6 +137,8 @@ public:
 	SphericalAdvectionField(const Vector3d origin, double radius, double vMax, double tau, double alpha);
 	Vector3d getField(const Vector3d &position) const;
 	double getDivergence(const Vector3d &position) const;
+	void getFieldAndDivergence(const Vector3d &position, Vector3d &field,
+			double &divergence) const;
 
 	double getV(const double &r) const;
 
@@ -157,6 +186,8 @@ public:
 
 	Vector3d getField(const Vector3d &position) const;
 	double getDivergence(const Vector3d &position) const;
+	void getFieldAndDivergence(const Vector3d &position, Vector3d &field,
+			double &divergence) const;
 
 	double g(double R) const;
 	double g_prime(double R) const;
@@ -0,0 +1,40 @@
+#ifndef CRPROPA_ADVECTIONFIELDGRID_H
+#define CRPROPA_ADVECTIONFIELDGRID_H
+
+#include "crpropa/advectionField/AdvectionField.h"
+#include "crpropa/Grid.h"
+
+namespace crpropa {
+
+/**
+ @class AdvectionFieldGrid
+ @brief Advection field on a periodic (or reflective), cartesian grid with trilinear interpolation.
+
+ This class wraps a VectorGrid, e.g. the wind of an MHD simulation read
+ with loadGrid, to serve as an AdvectionField. The divergence is derived
+ once from central differences of the grid values, with the periodic or
+ reflective continuation of the grid, and stored in a ScalarGrid of the
+ same geometry, which is interpolated like the field.
+ */
+class AdvectionFieldGrid: public AdvectionField {
+	ref_ptr<VectorGrid> grid;
+	ref_ptr<ScalarGrid> divergenceGrid;
+
+	void updateDivergence();
+public:
+	AdvectionFieldGrid(ref_ptr<VectorGrid> grid);
+	/** Set the field grid and derive the divergence grid */
+	void setGrid(ref_ptr<VectorGrid> grid);
+	ref_ptr<VectorGrid> getGrid();
+	ref_ptr<ScalarGrid> getDivergenceGrid();
+	Vector3d getField(const Vector3d &position) const;
+	double getDivergence(const Vector3d &position) const;
+	void getFieldAndDivergence(const Vector3d &position, Vector3d &field,
+			double &divergence) const;
+	void getFieldsAndDivergences(const Vector3d *positions, Vector3d *fields,
+			double *divergences, size_t n) const;
+};
+
+} // namespace crpropa
+
+#endif // CRPROPA_ADVECTIONFIELDGRID_H
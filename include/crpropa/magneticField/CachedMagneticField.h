@@ -0,0 +1,74 @@
+#ifndef CRPROPA_CACHEDMAGNETICFIELD_H
+#define CRPROPA_CACHEDMAGNETICFIELD_H
+
+#include "crpropa/magneticField/MagneticField.h"
+#include "crpropa/Grid.h"
+
+#include <string>
+
+namespace crpropa {
+/**
+ * \addtogroup MagneticFields
+ * @{
+ */
+
+/**
+ @class CachedMagneticField
+ @brief Magnetic field decorator that samples a field onto a grid and interpolates
+
+ Expensive analytic fields, e.g. JF12Field or PT11Field, are sampled once on a
+ uniform grid inside a box and then served by trilinear interpolation.
+ Outside of the box the underlying field is evaluated directly.
+ The grid points lie on the box boundaries, so the whole box is covered
+ without extrapolation. Sampling runs in parallel with OpenMP.
+
+ The cached grid can be saved with save() and reused in later jobs by
+ loading it into a grid of the same geometry (loadGrid, mapGrid) and passing
+ it to the second constructor.
+ */
+class CachedMagneticField: public MagneticField {
+	ref_ptr<MagneticField> field;
+	ref_ptr<VectorGrid> grid;
+	Vector3d boxOrigin, boxSize;
+	double spacing;
+
+	void sample();
+	bool isInside(const Vector3d &position) const;
+public:
+	/** Sample a field in a box
+	 @param field	underlying field
+	 @param origin	lower corner of the box
+	 @param size	size of the box
+	 @param spacing	spacing of the grid points
+	 */
+	CachedMagneticField(ref_ptr<MagneticField> field, const Vector3d &origin,
+			const Vector3d &size, double spacing);
+	/** Use a previously sampled grid, e.g. from getGrid or loaded from a file */
+	CachedMagneticField(ref_ptr<MagneticField> field, ref_ptr<VectorGrid> grid);
+
+	Vector3d getField(const Vector3d &position) const;
+	void getFields(const Vector3d *positions, Vector3d *fields, size_t n) const;
+	void getFields(const Vector3d *positions, Vector3d *fields, size_t n, double z) const {
+		getFields(positions, fields, n); // independent of z
+	}
+
+	/** Relative RMS deviation sqrt(<|B_cached - B|^2> / <|B|^2>) at random positions in the box */
+	double getRelativeError(size_t samples = 1000, int seed = 0) const;
+
+	/** Halve the spacing until the relative error is below the given accuracy
+	 or the spacing would be smaller than minSpacing. Returns the relative error. */
+	double refine(double accuracy, double minSpacing, size_t samples = 1000);
+
+	/** Save the grid in the binary format of dumpGrid */
+	void save(const std::string &filename) const;
+
+	ref_ptr<VectorGrid> getGrid() const;
+	Vector3d getBoxOrigin() const;
+	Vector3d getBoxSize() const;
+	double getSpacing() const;
+};
+
+/** @} */
+} // namespace crpropa
+
+#endif // CRPROPA_CACHEDMAGNETICFIELD_H
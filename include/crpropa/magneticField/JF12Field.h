@@ -3,8 +3,11 @@
 
 #include "crpropa/magneticField/MagneticField.h"
 #include "crpropa/Grid.h"
+#include "crpropa/Units.h"
 #include "kiss/logger.h"
 
+#include <string>
+
 namespace crpropa {
 
 /**
@@ -27,6 +30,12 @@ namespace crpropa {
 
  The regular field components (disk, toroidal halo and polodial halo field) 
  may be turned on and off individually.
+
+ The random realisations of a seed other than 0 are created once per process
+ and shared by all instances, e.g. of a parameter scan. With
+ setRealizationDirectory they are also saved as grid files, which later
+ processes map instead of creating them again. cacheRegularField samples the
+ regular field onto a grid, see CachedMagneticField.
  */
 class JF12Field: public MagneticField {
 protected:
@@ -64,6 +73,10 @@ protected:
 
 	// Turbulent field --------------------------------------------------------
 	ref_ptr<VectorGrid> turbulentGrid;
+	// sampled regular field, or null
+	ref_ptr<MagneticField> regularCache;
+	// the regular field from the cache, if set
+	Vector3d regularField(const Vector3d& pos) const;
 	// disk
 	double bDiskTurb[8]; // field strengths in arms at r=5 kpc
 	double bDiskTurb5;   // field strength at r<5kpc
@@ -84,6 +97,26 @@ public:
 	void randomTurbulent(int seed = 0);
 #endif
 
+	/**
+	 * Directory of the shared realizations of the seeds other than 0, files
+	 * JF12Striated-<seed>.raw and JF12Turbulent-<seed>.raw. Empty: only
+	 * shared within the process (default).
+	 */
+	static void setRealizationDirectory(const std::string &directory);
+	static std::string getRealizationDirectory();
+	// Release the realizations shared within the process
+	static void clearRealizations();
+
+	/**
+	 * Sample the regular field onto a grid of the given spacing in a cube
+	 * of the given size around the Galactic center, e.g. 200^3 points and
+	 * 96 MB for 0.2 kpc. Outside of the cube the field is calculated.
+	 * A spacing of 0 removes the cache. Changing the regular components
+	 * removes it as well.
+	 */
+	void cacheRegularField(double spacing, double size = 40 * kpc);
+	bool isCachingRegularField() const;
+
 	/**
 	 * Set a striated grid and activate the striated field component
 	 * @param grid	scalar grid containing random +1/-1 values, 100 parsec grid spacing
@@ -132,6 +165,9 @@ public:
 
 	// All set field components
 	Vector3d getField(const Vector3d& pos) const;
+	// All set field components at n positions, one component after the other
+	void getFields(const Vector3d *positions, Vector3d *fields, size_t n) const;
+	void getFields(const Vector3d *positions, Vector3d *fields, size_t n, double z) const;
 };
 
 } // namespace crpropa
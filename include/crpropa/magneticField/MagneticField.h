@@ -1,9 +1,13 @@
 #ifndef CRPROPA_MAGNETICFIELD_H
 #define CRPROPA_MAGNETICFIELD_H
 
+#include "crpropa/Configuration.h"
 #include "crpropa/Units.h"
 #include "crpropa/Vector3.h"
 #include "crpropa/Referenced.h"
+#include "crpropa/Grid.h"
+
+#include <vector>
 
 #ifdef CRPROPA_HAVE_MUPARSER
 #include "muParser.h"
@@ -29,6 +33,60 @@ public:
 	virtual Vector3d getField(const Vector3d &position, double z) const {
 		return getField(position);
 	};
+	/** Field at n positions, for fields that can evaluate many points at once */
+	virtual void getFields(const Vector3d *positions, Vector3d *fields, size_t n) const {
+		for (size_t i = 0; i < n; i++)
+			fields[i] = getField(positions[i]);
+	};
+	/** Field at n positions at redshift z */
+	virtual void getFields(const Vector3d *positions, Vector3d *fields, size_t n, double z) const {
+		for (size_t i = 0; i < n; i++)
+			fields[i] = getField(positions[i], z);
+	};
+	/** True if the field is the same everywhere, allows analytic propagation */
+	virtual bool isUniform() const {
+		return false;
+	};
+	/** Type and parameters for ConfigurationDocument, the default throws */
+	virtual void getConfiguration(Configuration &configuration) const;
+};
+
+/**
+ @class Vector3dArray
+ @brief n vectors in contiguous memory, the arguments of BatchMagneticField::getFieldArray
+ */
+struct Vector3dArray {
+	Vector3d *data;
+	size_t size;
+	Vector3dArray(Vector3d *data, size_t size) :
+			data(data), size(size) {
+	}
+	Vector3d get(size_t i) const {
+		return data[i];
+	}
+	void set(size_t i, const Vector3d &v) {
+		data[i] = v;
+	}
+};
+
+/**
+ @class BatchMagneticField
+ @brief Abstract base class for fields evaluated at many positions at once, e.g. written in Python.
+
+ getField and getFields call getFieldArray with all their positions. In
+ Python the arrays are NumPy arrays of shape (n, 3) (without NumPy use get
+ and set), so the positions of a batch of PropagationCK::processBatch or
+ DiffusionSDE cost one call into Python and can be evaluated vectorised.
+ */
+class BatchMagneticField: public MagneticField {
+public:
+	/** Fill the fields at the given positions at redshift z */
+	virtual void getFieldArray(const Vector3dArray &positions,
+			Vector3dArray &fields, double z) const = 0;
+	Vector3d getField(const Vector3d &position) const;
+	Vector3d getField(const Vector3d &position, double z) const;
+	void getFields(const Vector3d *positions, Vector3d *fields, size_t n) const;
+	void getFields(const Vector3d *positions, Vector3d *fields, size_t n, double z) const;
 };
 
 /**
@@ -51,17 +109,52 @@ public:
 	bool isReflective();
 	void setReflective(bool reflective);
 	Vector3d getField(const Vector3d &position) const;
+	bool isUniform() const;
 };
 
 /**
  @class MagneticFieldList
  @brief Magnetic field decorator implementing a superposition of fields.
+
+ A field can be given a bounding box outside of which it is zero and not
+ evaluated. freeze() flattens the list for faster evaluation: all
+ MagneticFieldGrids with the same grid geometry and bounding box are summed
+ into one grid, which is interpolated directly instead of through the field,
+ and OctreeMagneticFields get their root cell as bounding box.
+ Changes to the underlying grids after freeze() require another freeze().
  */
 class MagneticFieldList: public MagneticField {
 	std::vector<ref_ptr<MagneticField> > fields;
+	std::vector<Vector3d> boxLower, boxUpper; // bounding boxes
+	std::vector<bool> bounded;
+
+	bool frozen;
+	std::vector<ref_ptr<VectorGrid> > frozenGrids; // fused grids
+	std::vector<Vector3d> gridLower, gridUpper;
+	std::vector<bool> gridBounded;
+	std::vector<size_t> frozenFields; // indices of the other fields
+
+	void addFields(const MagneticField *field, const VectorGrid *grid,
+			bool bounded, const Vector3d &lower, const Vector3d &upper,
+			const Vector3d *positions, Vector3d *fields, size_t n, double z) const;
 public:
+	MagneticFieldList();
 	void addField(ref_ptr<MagneticField> field);
+	/** Add a field that is zero outside the box [origin, origin + size] */
+	void addField(ref_ptr<MagneticField> field, const Vector3d &boxOrigin,
+			const Vector3d &boxSize);
+	/** Fuse compatible grids and derive bounding boxes, undone by addField */
+	void freeze();
+	bool isFrozen() const;
+	size_t getNumberOfFields() const; ///< number of evaluated fields, after freeze() fused grids count once
 	Vector3d getField(const Vector3d &position) const;
+	Vector3d getField(const Vector3d &position, double z) const;
+	/** Evaluates one field after the other for all positions */
+	void getFields(const Vector3d *positions, Vector3d *fields, size_t n) const;
+	void getFields(const Vector3d *positions, Vector3d *fields, size_t n, double z) const;
+	/** Uniform if all fields are uniform and unbounded */
+	bool isUniform() const;
+	void getConfiguration(Configuration &configuration) const;
 };
 
 /**
@@ -74,6 +167,10 @@ class MagneticFieldEvolution: public MagneticField {
 public:
 	MagneticFieldEvolution(ref_ptr<MagneticField> field, double m);
 	Vector3d getField(const Vector3d &position, double z = 0) const;
+	void getFields(const Vector3d *positions, Vector3d *fields, size_t n) const;
+	void getFields(const Vector3d *positions, Vector3d *fields, size_t n, double z) const;
+	bool isUniform() const;
+	void getConfiguration(Configuration &configuration) const;
 };
 
 /**
@@ -89,6 +186,20 @@ public:
 	Vector3d getField(const Vector3d &position) const {
 		return value;
 	}
+	void getFields(const Vector3d *positions, Vector3d *fields, size_t n) const {
+		for (size_t i = 0; i < n; i++)
+			fields[i] = value;
+	}
+	void getFields(const Vector3d *positions, Vector3d *fields, size_t n, double z) const {
+		getFields(positions, fields, n);
+	}
+	bool isUniform() const {
+		return true;
+	}
+	void getConfiguration(Configuration &configuration) const {
+		configuration.setType("UniformMagneticField");
+		configuration.set("value", value);
+	}
 };
 
 /**
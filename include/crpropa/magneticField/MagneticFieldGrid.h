@@ -3,6 +3,7 @@
 
 #include "crpropa/magneticField/MagneticField.h"
 #include "crpropa/Grid.h"
+#include "crpropa/SparseGrid.h"
 
 namespace crpropa {
 /**
@@ -14,15 +15,37 @@ namespace crpropa {
  @class MagneticFieldGrid
  @brief Magnetic field on a periodic (or reflective), cartesian grid with trilinear interpolation.
 
- This class wraps a VectorGrid to serve as a MagneticField.
+ This class wraps a VectorGrid, a QuantizedVectorGrid or a SparseVectorGrid
+ to serve as a MagneticField. The SparseVectorGrid stores only the bricks with
+ structure, for fields that vanish in most of the volume.
+ With setTricubic the field is interpolated tricubically, see
+ Grid::interpolateTricubic, which allows a coarser grid for the same accuracy.
  */
 class MagneticFieldGrid: public MagneticField {
 	ref_ptr<VectorGrid> grid;
+	ref_ptr<QuantizedVectorGrid> quantizedGrid;
+	ref_ptr<SparseVectorGrid> sparseGrid;
+	bool tricubic;
 public:
 	MagneticFieldGrid(ref_ptr<VectorGrid> grid);
+	MagneticFieldGrid(ref_ptr<QuantizedVectorGrid> grid);
+	MagneticFieldGrid(ref_ptr<SparseVectorGrid> grid);
 	void setGrid(ref_ptr<VectorGrid> grid);
-	ref_ptr<VectorGrid> getGrid();
+	void setGrid(ref_ptr<QuantizedVectorGrid> grid);
+	/** Sparse grids are interpolated trilinearly, throws if tricubic */
+	void setGrid(ref_ptr<SparseVectorGrid> grid);
+	ref_ptr<VectorGrid> getGrid(); ///< null for a quantized or sparse grid
+	ref_ptr<QuantizedVectorGrid> getQuantizedGrid(); ///< null for an unquantized grid
+	ref_ptr<SparseVectorGrid> getSparseGrid(); ///< null for a dense grid
+	void setTricubic(bool tricubic); ///< default false: trilinear, throws for sparse grids
+	bool isTricubic() const;
+	/** Saved with the mapped file of the grid (mapGrid), throws for other grids */
+	void getConfiguration(Configuration &configuration) const;
 	Vector3d getField(const Vector3d &position) const;
+	void getFields(const Vector3d *positions, Vector3d *fields, size_t n) const;
+	void getFields(const Vector3d *positions, Vector3d *fields, size_t n, double z) const {
+		getFields(positions, fields, n); // independent of z
+	}
 };
 
 /**
@@ -46,6 +69,10 @@ public:
 	ref_ptr<ScalarGrid> getModulationGrid();
 	void setReflective(bool gridReflective, bool modGridReflective);
 	Vector3d getField(const Vector3d &position) const;
+	void getFields(const Vector3d *positions, Vector3d *fields, size_t n) const;
+	void getFields(const Vector3d *positions, Vector3d *fields, size_t n, double z) const {
+		getFields(positions, fields, n); // independent of z
+	}
 };
 /** @} */
 } // namespace crpropa
@@ -0,0 +1,94 @@
+#ifndef CRPROPA_MAGNETICFIELDSNAPSHOTS_H
+#define CRPROPA_MAGNETICFIELDSNAPSHOTS_H
+
+#include "crpropa/magneticField/MagneticField.h"
+#include "crpropa/Grid.h"
+
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup MagneticFields
+ * @{
+ */
+
+/**
+ @class MagneticFieldSnapshots
+ @brief Magnetic field interpolated between grid snapshots at different redshifts.
+
+ The snapshots are binary grid files as of dumpGrid, all of the same
+ geometry, e.g. from an MHD simulation. They are mapped when needed (see
+ mapGrid) and the field at redshift z is linearly interpolated between the
+ two snapshots around z, below the first and above the last snapshot the
+ nearest one is used. Since the candidates propagate to smaller redshifts,
+ a background thread maps and reads the snapshot below the current ones in
+ advance. At most setMaxMapped snapshots stay mapped, the least recently used
+ are unmapped. Each thread keeps its current pair, so only a change of the
+ pair takes the lock.
+ */
+class MagneticFieldSnapshots: public MagneticField {
+	struct Snapshot {
+		double z;
+		std::string filename;
+		ref_ptr<VectorGrid> grid; ///< null if not mapped
+		size_t lastUse;
+	};
+	// current pair of a thread, padded against false sharing
+	struct Pair {
+		size_t lower; ///< index of the lower snapshot, npos if none
+		ref_ptr<VectorGrid> grids[2];
+		char padding[64];
+	};
+
+	Vector3d origin;
+	size_t Nx, Ny, Nz;
+	double spacing;
+	std::vector<Snapshot> snapshots; ///< sorted by redshift
+	size_t maxMapped;
+	bool prefetch;
+
+	mutable std::vector<Pair> pairs; ///< one per thread
+	mutable size_t useClock;
+	mutable size_t prefetchIndex, loadingIndex; ///< npos if none
+	mutable bool prefetching; ///< the thread is running
+	mutable bool stop;
+	mutable pthread_mutex_t mutex; ///< guards the snapshots and the prefetch state
+	mutable pthread_cond_t changed;
+	mutable pthread_t prefetcher;
+
+	ref_ptr<VectorGrid> map(size_t i) const;
+	ref_ptr<VectorGrid> acquire(size_t i) const; ///< with the lock held
+	void evict() const; ///< with the lock held
+	void requestPrefetch(size_t i) const; ///< with the lock held
+	static void *prefetchMain(void *field);
+	/// the pair around z, kept alive by the thread or held, and the weight of the upper snapshot
+	void getPair(double z, const VectorGrid *grids[2], ref_ptr<VectorGrid> held[2],
+			double &weight) const;
+public:
+	/** Snapshots of N^3 points */
+	MagneticFieldSnapshots(const Vector3d &origin, size_t N, double spacing);
+	MagneticFieldSnapshots(const Vector3d &origin, size_t Nx, size_t Ny,
+			size_t Nz, double spacing);
+	~MagneticFieldSnapshots();
+
+	/** Add the snapshot at redshift z, the file is mapped when needed */
+	void addSnapshot(double z, const std::string &filename);
+	size_t getNumberOfSnapshots() const;
+	double getRedshift(size_t i) const;
+	void setMaxMapped(size_t n); ///< at least 2, default 4
+	size_t getMaxMapped() const;
+	size_t getNumberOfMapped() const;
+	void setPrefetch(bool prefetch); ///< default true
+	bool getPrefetch() const;
+
+	Vector3d getField(const Vector3d &position) const;
+	Vector3d getField(const Vector3d &position, double z) const;
+	void getFields(const Vector3d *positions, Vector3d *fields, size_t n) const;
+	void getFields(const Vector3d *positions, Vector3d *fields, size_t n, double z) const;
+};
+/** @} */
+} // namespace crpropa
+
+#endif // CRPROPA_MAGNETICFIELDSNAPSHOTS_H
@@ -0,0 +1,57 @@
+#ifndef CRPROPA_NESTEDTURBULENCEFIELD_H
+#define CRPROPA_NESTEDTURBULENCEFIELD_H
+
+#include "crpropa/magneticField/MagneticField.h"
+#include "crpropa/Grid.h"
+
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup MagneticFields
+ * @{
+ */
+
+/**
+ @class NestedTurbulenceField
+ @brief Turbulent field summed from periodic grids of decreasing spacing.
+
+ A single grid for turbulence from lMin to lMax needs (lMax / lMin)^3 points
+ or more. Here every level covers a band of wavelengths: the first level the
+ largest scales on a coarse grid, each further level smaller scales on a finer
+ but smaller grid, which is repeated periodically. The memory of n levels of
+ N^3 points replaces one grid of N^(3n) / 2^(3(n-1)) points or more.
+ The fields of all levels are interpolated and summed.
+ */
+class NestedTurbulenceField: public MagneticField {
+	std::vector<ref_ptr<VectorGrid> > levels;
+public:
+	NestedTurbulenceField();
+	/** Add a grid, periodic, with a smaller spacing than the previous levels */
+	void addLevel(ref_ptr<VectorGrid> grid);
+	size_t getNumberOfLevels() const;
+	ref_ptr<VectorGrid> getLevel(size_t i) const;
+
+#ifdef CRPROPA_HAVE_FFTW3F
+	/**
+	 Fill the levels with turbulence as initTurbulence. The range from lMin to
+	 lMax is split into bands: a level covers down to twice its spacing, or
+	 lMin, the next level from there on, and needs a size of at least twice
+	 the largest wavelength of its band. Each band gets the part of Brms^2
+	 of its wavelengths in the spectrum. With a seed each level uses seed + i.
+	 Throws if the levels do not cover the range.
+	 */
+	void initTurbulence(double Brms, double lMin, double lMax,
+			double alpha = -11./3., int seed = 0);
+#endif
+
+	Vector3d getField(const Vector3d &position) const;
+	void getFields(const Vector3d *positions, Vector3d *fields, size_t n) const;
+	void getFields(const Vector3d *positions, Vector3d *fields, size_t n, double z) const {
+		getFields(positions, fields, n); // independent of z
+	}
+};
+/** @} */
+} // namespace crpropa
+
+#endif // CRPROPA_NESTEDTURBULENCEFIELD_H
@@ -0,0 +1,78 @@
+#ifndef CRPROPA_OCTREEMAGNETICFIELD_H
+#define CRPROPA_OCTREEMAGNETICFIELD_H
+
+#include "crpropa/magneticField/MagneticField.h"
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace crpropa {
+/**
+ * \addtogroup MagneticFields
+ * @{
+ */
+
+/**
+ @class OctreeNode
+ @brief Node of an OctreeMagneticField, 16 bytes
+
+ child is the index of the first of 8 consecutive child nodes, or -1 for a
+ leaf, which holds the field value of its cell. The children are ordered by
+ octant, index = 4 * (x upper half) + 2 * (y upper half) + (z upper half).
+ */
+struct OctreeNode {
+	int32_t child;
+	float x, y, z;
+	OctreeNode() : child(-1), x(0), y(0), z(0) {
+	}
+};
+
+/**
+ @class OctreeMagneticField
+ @brief Magnetic field on an adaptively refined octree (AMR) without external libraries
+
+ The nodes are stored in breadth-first order in one array, without pointers,
+ the root is node 0 and covers the cube [origin, origin + size]. A position is
+ located in O(depth) steps, each touching a single node. The field is constant
+ within a leaf cell, as in cell-centered AMR data. Outside of the cube the
+ field is zero.
+
+ The binary file format (load, save) is the sequence of nodes in breadth-first
+ order, each as an int32 child index followed by the three float components,
+ in the byte order of the machine. The number of nodes follows from the file
+ size, origin and size of the root cell are given by the user as for loadGrid.
+ */
+class OctreeMagneticField: public MagneticField {
+	std::vector<OctreeNode> nodes;
+	Vector3d origin;
+	double size;
+public:
+	/** Field that is zero in the whole cube, see setNodes and load */
+	OctreeMagneticField(const Vector3d &origin, double size);
+	/** Load the nodes from a binary file */
+	OctreeMagneticField(const Vector3d &origin, double size,
+			const std::string &filename);
+
+	/** Replace the nodes, throws if they are no valid breadth-first octree */
+	void setNodes(const std::vector<OctreeNode> &nodes);
+	const std::vector<OctreeNode> &getNodes() const;
+	void load(const std::string &filename);
+	void save(const std::string &filename) const;
+
+	Vector3d getOrigin() const;
+	double getSize() const;
+	/** Index of the leaf containing the position, -1 if outside */
+	int getLeaf(const Vector3d &position) const;
+
+	Vector3d getField(const Vector3d &position) const;
+	void getFields(const Vector3d *positions, Vector3d *fields, size_t n) const;
+	void getFields(const Vector3d *positions, Vector3d *fields, size_t n, double z) const {
+		getFields(positions, fields, n); // independent of z
+	}
+};
+
+/** @} */
+} // namespace crpropa
+
+#endif // CRPROPA_OCTREEMAGNETICFIELD_H
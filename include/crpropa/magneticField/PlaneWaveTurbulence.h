@@ -0,0 +1,62 @@
+#ifndef CRPROPA_PLANEWAVETURBULENCE_H
+#define CRPROPA_PLANEWAVETURBULENCE_H
+
+#include "crpropa/magneticField/MagneticField.h"
+
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup MagneticFields
+ * @{
+ */
+
+/**
+ @class PlaneWaveTurbulence
+ @brief Turbulent magnetic field from a superposition of plane waves, without a grid
+
+ The field is evaluated at every position as a sum of Nm randomly oriented
+ transverse modes (Giacalone & Jokipii 1999), so resolution and dynamic range
+ are not limited by memory, only by the number of modes.
+ The wavelengths are distributed logarithmically between lMin and lMax and the
+ amplitudes follow the same spectrum <B^2(k)> ~ k^alpha as initTurbulence.
+ Each mode is perpendicular to its wave vector, so the field is divergence free.
+
+ The modes are stored as separate arrays per component, so that the compiler
+ can vectorise the mode sum. Use getFields to evaluate many positions at once.
+ */
+class PlaneWaveTurbulence: public MagneticField {
+	double Brms, lMin, lMax, alpha;
+	// wave vector, phase and amplitude vector of each mode
+	std::vector<double> kx, ky, kz, phase, ax, ay, az;
+
+	Vector3d sumModes(const Vector3d &position) const;
+public:
+	/** Constructor
+	 @param Brms	RMS field strength
+	 @param lMin	Minimum wavelength of the turbulence
+	 @param lMax	Maximum wavelength of the turbulence
+	 @param alpha	Power law index of <B^2(k)> ~ k^alpha (alpha = -11/3 corresponds to a Kolmogorov spectrum)
+	 @param Nm		Number of modes
+	 @param seed	Random seed, 0: random seed
+	 */
+	PlaneWaveTurbulence(double Brms, double lMin, double lMax,
+			double alpha = -11. / 3., int Nm = 64, int seed = 0);
+
+	Vector3d getField(const Vector3d &position) const;
+	void getFields(const Vector3d *positions, Vector3d *fields, size_t n) const;
+	void getFields(const Vector3d *positions, Vector3d *fields, size_t n, double z) const {
+		getFields(positions, fields, n); // independent of z
+	}
+
+	double getBrms() const;
+	double getMinimumWavelength() const;
+	double getMaximumWavelength() const;
+	double getPowerSpectralIndex() const;
+	size_t getNumberOfModes() const;
+};
+
+/** @} */
+} // namespace crpropa
+
+#endif // CRPROPA_PLANEWAVETURBULENCE_H
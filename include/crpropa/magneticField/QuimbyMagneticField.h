@@ -8,24 +8,42 @@
 
 #include "quimby/MagneticField.h"
 
+#include <cmath>
 #include <stdexcept>
 #include <sstream>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 namespace crpropa {
 
 /**
  @class QuimbyMagneticField
  @brief Wrapper for quimby::MagneticField
+
+ Every lookup of an SPH field in quimby searches the neighbouring particles.
+ With setCellSize each thread keeps the field at the 8 corners of the cube
+ of that size around its last position and interpolates trilinearly inside,
+ so the stages of a step in the same cell need no further lookups. The cell
+ size should be below the resolution of the SPH field. Default 0: every
+ position is looked up.
  */
 class QuimbyMagneticField: public MagneticField {
+	// corners of the current cell of a thread, padded against false sharing
+	struct Cell {
+		bool valid;
+		long ix, iy, iz;
+		Vector3d corners[8]; ///< corner i at (i >> 2, (i >> 1) & 1, i & 1)
+		char padding[64];
+	};
+
 	quimby::ref_ptr<quimby::MagneticField> field;
-public:
-	QuimbyMagneticField(quimby::ref_ptr<quimby::MagneticField> field) : field(field) {
+	double cellSize;
+	mutable std::vector<Cell> cells; ///< one per thread, further threads look up
 
-	}
-	QuimbyMagneticField(quimby::MagneticField *field) : field(field) {
-	}
-	Vector3d getField(const Vector3d &position) const {
+	Vector3d lookup(const Vector3d &position) const {
 		quimby::Vector3f b, r = quimby::Vector3f(position.x, position.y, position.z);
 		bool isGood = field->getField(r / kpc, b);
 		if (!isGood) {
@@ -35,6 +53,78 @@ public:
 		}
 		return Vector3d(b.x, b.y, b.z) * gauss;
 	}
+
+	Vector3d interpolate(const Vector3d &position) const {
+#ifdef _OPENMP
+		size_t thread = omp_get_thread_num();
+#else
+		size_t thread = 0;
+#endif
+		if (thread >= cells.size())
+			return lookup(position);
+
+		Vector3d r = position / cellSize;
+		long ix = long(std::floor(r.x)), iy = long(std::floor(r.y)), iz = long(std::floor(r.z));
+		Cell &c = cells[thread];
+		if (!c.valid || (c.ix != ix) || (c.iy != iy) || (c.iz != iz)) {
+			c.valid = false; // until all corners are known
+			for (int i = 0; i < 8; i++)
+				c.corners[i] = lookup(Vector3d(ix + (i >> 2), iy + ((i >> 1) & 1),
+						iz + (i & 1)) * cellSize);
+			c.ix = ix;
+			c.iy = iy;
+			c.iz = iz;
+			c.valid = true;
+		}
+
+		double fx = r.x - ix, fy = r.y - iy, fz = r.z - iz;
+		const Vector3d *v = c.corners;
+		Vector3d b00 = v[0] + (v[1] - v[0]) * fz;
+		Vector3d b01 = v[2] + (v[3] - v[2]) * fz;
+		Vector3d b10 = v[4] + (v[5] - v[4]) * fz;
+		Vector3d b11 = v[6] + (v[7] - v[6]) * fz;
+		Vector3d b0 = b00 + (b01 - b00) * fy;
+		Vector3d b1 = b10 + (b11 - b10) * fy;
+		return b0 + (b1 - b0) * fx;
+	}
+
+public:
+	QuimbyMagneticField(quimby::ref_ptr<quimby::MagneticField> field) :
+			field(field), cellSize(0) {
+	}
+	QuimbyMagneticField(quimby::MagneticField *field) :
+			field(field), cellSize(0) {
+	}
+
+	/** Size of the cells of the per thread cache, 0: off */
+	void setCellSize(double size) {
+		cellSize = size;
+		cells.clear();
+		if (size > 0) {
+			cells.resize(256);
+			for (size_t i = 0; i < cells.size(); i++)
+				cells[i].valid = false;
+		}
+	}
+	double getCellSize() const {
+		return cellSize;
+	}
+
+	Vector3d getField(const Vector3d &position) const {
+		return (cellSize > 0) ? interpolate(position) : lookup(position);
+	}
+	void getFields(const Vector3d *positions, Vector3d *fields, size_t n) const {
+		if (cellSize > 0) {
+			for (size_t i = 0; i < n; i++)
+				fields[i] = interpolate(positions[i]);
+		} else {
+			for (size_t i = 0; i < n; i++)
+				fields[i] = lookup(positions[i]);
+		}
+	}
+	void getFields(const Vector3d *positions, Vector3d *fields, size_t n, double z) const {
+		getFields(positions, fields, n); // independent of z
+	}
 };
 #if 1
 /**
@@ -0,0 +1,102 @@
+#ifndef CRPROPA_LENSBUILDER_H
+#define CRPROPA_LENSBUILDER_H
+
+#include "crpropa/Module.h"
+#include "crpropa/magneticLens/ModelMatrix.h"
+#include "crpropa/magneticLens/Pixelization.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup MagneticLenses
+ * @{
+ */
+
+/**
+ @class LensBuilder
+ @brief Accumulates the matrices of a MagneticLens from backtracked candidates.
+
+ Used as observer output of a simulation that backtracks (anti-)particles
+ from the observer out of the galactic field: for each candidate the pixel of
+ the launch direction (source) is the observed pixel, the pixel of the final
+ direction the extragalactic one, and the weight is added to the matrix of
+ the rigidity bin of the candidate.
+ The transitions are buffered per thread without locking and merged into one
+ sparse matrix per bin by getMatrix, write and addLens, which must not be
+ called while other threads process candidates.
+ The rigidity bins are equal in log10(E / Z / eV), as in the lens files.
+ */
+class LensBuilder: public Module {
+public:
+	/// Transition of a particle from the extragalactic to the observed pixel
+	struct Transition {
+		uint32_t observed, extragalactic;
+		uint32_t bin;
+		double weight;
+	};
+private:
+	// transitions of one thread, padded against false sharing
+	struct ThreadTransitions {
+		std::vector<Transition> transitions;
+		size_t limit; // size of the next compaction
+		char padding[64];
+	};
+	Pixelization pixelization;
+	size_t nBins;
+	double logRigidityMin, logRigidityMax;
+	mutable std::vector<ThreadTransitions> threadTransitions; ///< one per thread
+	mutable std::vector<ModelMatrixType> matrices; ///< merged transitions
+	size_t maxTransitions;
+
+	void merge() const;
+	static void compact(std::vector<Transition> &transitions);
+public:
+	/**
+	 @param healpixOrder	order of the HEALPix pixelization of the lens
+	 @param nBins			number of rigidity bins
+	 @param logRigidityMin	lower edge of the rigidities, log10(E / Z / eV)
+	 @param logRigidityMax	upper edge of the rigidities, log10(E / Z / eV)
+	 */
+	LensBuilder(uint8_t healpixOrder, size_t nBins, double logRigidityMin,
+			double logRigidityMax);
+
+	void process(Candidate *candidate) const;
+	/// Add the transition from the extragalactic to the observed pixel with
+	/// rigidity [Joule], i.e. E / |Z|
+	void add(uint32_t observed, uint32_t extragalactic, double rigidity,
+			double weight = 1) const;
+
+	/// Number of buffered transitions per thread before equal transitions
+	/// are combined
+	void setMaximumTransitions(size_t n);
+
+	size_t getNumberOfBins() const;
+	const Pixelization &getPixelization() const;
+	/// Matrix of bin i, the source pixels in the columns
+	const ModelMatrixType &getMatrix(size_t i) const;
+	/// Reset all bins
+	void clear();
+
+	/**
+	 Write one matrix file per bin and the configuration file of
+	 MagneticLens::loadLens. The matrix files are named after the
+	 configuration file with the index of the bin, in the format of
+	 serializeCSC, or of serialize if csc is false.
+	 */
+	void write(const std::string &cfgFilename, bool csc = true,
+			bool singlePrecision = false) const;
+	/**
+	 Add the matrices of a lens written by another builder with the same
+	 bins, e.g. of a simulation on another node.
+	 */
+	void addLens(const std::string &cfgFilename);
+	std::string getDescription() const;
+};
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_LENSBUILDER_H
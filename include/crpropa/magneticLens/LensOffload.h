@@ -0,0 +1,83 @@
+#ifndef CRPROPA_LENSOFFLOAD_H
+#define CRPROPA_LENSOFFLOAD_H
+
+#include "crpropa/magneticLens/MagneticLens.h"
+
+#include <stdint.h>
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup MagneticLenses
+ * @{
+ */
+
+/**
+ @class LensOffload
+ @brief The lens parts of a MagneticLens resident on an OpenMP offload device.
+
+ For scans that apply a lens many times, e.g. in likelihood fits of
+ compositions and anisotropies. The lens parts are copied to the device
+ once, at construction or with update(), as compressed sparse rows, and
+ batches of model vectors are transferred, multiplied and copied back.
+ With sampling, the cumulative sums of the columns are kept on the device as
+ well and the arrival pixels of cosmic rays are drawn there, as by
+ MagneticLens::transformCosmicRay with the random numbers of the host.
+ The device then holds about twice the lens.\n
+ The device code uses OpenMP target regions, as PropagationCKOffload. Without
+ an offload device, or when compiled without OpenMP offloading
+ (cmake -DOPENMP_OFFLOAD_FLAGS=...), it runs on the host threads.
+ The lens must outlive the offload and not change in between, otherwise
+ call update().
+ */
+class LensOffload {
+	// device copy of one lens part
+	struct Part {
+		const LensPart *lensPart;
+		size_t rows, cols;
+		std::vector<int32_t> rowStarts, columns;
+		std::vector<double> values;
+		std::vector<int32_t> columnStarts, rowsOfColumns;
+		std::vector<double> cdf;
+	};
+	const MagneticLens &lens;
+	bool sampling;
+	size_t batchSize;
+	std::vector<Part *> parts;
+
+	void release();
+	const Part *findPart(const LensPart *lensPart) const;
+	LensOffload(const LensOffload &);
+	LensOffload &operator=(const LensOffload &);
+public:
+	/**
+	 @param lens		lens of which all parts are copied to the device
+	 @param sampling	keep the column sums for transformPixels
+	 */
+	LensOffload(const MagneticLens &lens, bool sampling = false);
+	~LensOffload();
+	/// Copy the lens parts to the device again, after the lens has been modified
+	void update();
+	const MagneticLens &getLens() const;
+	bool isSampling() const;
+	/// Number of model vectors transferred at once, default 256
+	void setBatchSize(size_t n);
+	size_t getBatchSize() const;
+
+	/// models[i] = M * models[i] for n vectors with the matrix of the lens
+	/// part, as LensPart::transform
+	void transform(const LensPart *lensPart, double *const *models, size_t n) const;
+	/// As MagneticLens::transformModelVector, rigidity in Joule
+	void transformModelVector(double *model, double rigidity) const;
+	/// n model vectors of the same rigidity at once
+	void transformModelVectors(double *const *models, size_t n, double rigidity) const;
+	/// Arrival pixels of cosmic rays of the given extragalactic pixels and
+	/// rigidity [Joule], -1 for those lost by the lens, see
+	/// MagneticLens::transformCosmicRay. Needs sampling.
+	std::vector<int> transformPixels(double rigidity, const std::vector<int> &pixels) const;
+};
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_LENSOFFLOAD_H
@@ -25,9 +25,11 @@
 
 #include "crpropa/magneticLens/ModelMatrix.h"
 #include "crpropa/magneticLens/Pixelization.h"
+#include "crpropa/MemoryAccounting.h"
 #include "crpropa/Units.h"
 #include "crpropa/Vector3.h"
 
+#include <algorithm>
 #include <vector>
 #include <string>
 #include <stdexcept>
@@ -49,27 +51,79 @@ class LensPart
 	ModelMatrixType M;
 	double _maximumSumOfColumns;
 	bool _maximumSumOfColumns_calculated;
+	std::vector<double> _columnCDF; // cumulative sums of the nonzeros of each column
+	MappedModelMatrix *_mapped; // matrix of a file in CSC format, or NULL
+	double _scale; // factor of the values of the mapped matrix
+	MemoryAccount _memory; // of M and the column CDFs
+
+	LensPart(const LensPart &);
+	LensPart &operator=(const LensPart &);
+
+	// copies a mapped matrix into M, e.g. to change its columns
+	void materialize()
+	{
+		if (!_mapped)
+			return;
+		_mapped->toSparseMatrix(M, _scale);
+		delete _mapped;
+		_mapped = NULL;
+		_scale = 1;
+		updateColumnCDF();
+	}
 
 public:
-	LensPart()
+	LensPart() : _rigidityMin(0), _rigidityMax(0), _maximumSumOfColumns(0),
+			_maximumSumOfColumns_calculated(false), _mapped(NULL), _scale(1), _memory("LensPart")
 	{
 	}
 	/// File containing the matrix to be used in the range rigidityMin,
 	/// rigidityMax in Joule
 	LensPart(const std::string &filename, double rigidityMin, double rigidityMax) :
 			_filename(filename), _rigidityMin(rigidityMin), _rigidityMax(rigidityMax), _maximumSumOfColumns_calculated(
-					false), _maximumSumOfColumns(0)
+					false), _maximumSumOfColumns(0), _mapped(NULL), _scale(1), _memory("LensPart")
 	{
 	}
 
 	~LensPart()
 	{
+		delete _mapped;
 	}
 
-	/// Loads the matrix from file
+	/// Loads the matrix from file. Files written by serializeCSC are mapped
+	/// into memory instead of being read, see MappedModelMatrix.
 	void loadMatrixFromFile()
 	{
+		delete _mapped;
+		_mapped = NULL;
+		_scale = 1;
+		_maximumSumOfColumns_calculated = false;
+		if (isCSCFile(_filename))
+		{
+			_mapped = new MappedModelMatrix(_filename);
+			M.resize(0, 0);
+			M.data().squeeze();
+			_columnCDF.clear();
+			_memory.set(0);
+			return;
+		}
 		deserialize(_filename, M);
+		updateColumnCDF();
+	}
+
+	/// True if the matrix is mapped from a file instead of held in memory
+	bool isMapped() const
+	{
+		return _mapped != NULL;
+	}
+
+	size_t rows() const
+	{
+		return _mapped ? _mapped->rows() : M.rows();
+	}
+
+	size_t cols() const
+	{
+		return _mapped ? _mapped->cols() : M.cols();
 	}
 
 	/// Returns the filename of the matrix
@@ -83,7 +137,10 @@ public:
 	{
 		if (!_maximumSumOfColumns_calculated)
 		{ // lazy calculation of maximum
-			_maximumSumOfColumns = maximumOfSumsOfColumns(M);
+			if (_mapped)
+				_maximumSumOfColumns = _scale * _mapped->maximumOfSumsOfColumns();
+			else
+				_maximumSumOfColumns = maximumOfSumsOfColumns(M);
 			_maximumSumOfColumns_calculated = true;
 		}
 		return _maximumSumOfColumns;
@@ -101,18 +158,156 @@ public:
 		return _rigidityMax / eV;
 	}
 
-	/// Returns the modelmatrix
+	/// Returns the modelmatrix, a mapped matrix is copied into memory first
 	ModelMatrixType& getMatrix()
 	{
+		materialize();
 		return M;
 	}
 
 	/// Sets the modelmatrix
 	void setMatrix(const ModelMatrixType& m)
 	{
+		delete _mapped;
+		_mapped = NULL;
+		_scale = 1;
+		_maximumSumOfColumns_calculated = false;
 		M = m;
+		updateColumnCDF();
+	}
+
+	/// Divides the matrix by norm, without copying a mapped matrix
+	void normalize(double norm)
+	{
+		_maximumSumOfColumns_calculated = false;
+		if (_mapped)
+		{
+			_scale /= norm;
+			return;
+		}
+		normalizeMatrix(M, norm);
+		updateColumnCDF();
+	}
+
+	/// Prunes and quantizes the matrix with compactMatrix, a mapped matrix
+	/// is copied into memory first
+	MatrixCompaction compact(double threshold, bool cdfSteps = false)
+	{
+		materialize();
+		MatrixCompaction result = compactMatrix(M, threshold, cdfSteps);
+		_maximumSumOfColumns_calculated = false;
+		updateColumnCDF();
+		return result;
+	}
+
+	/// Multiplies the model vector of size cols() with the matrix, as prod_up
+	void transform(double *model, std::vector<double> &scratch) const
+	{
+		if (!_mapped)
+		{
+			prod_up(M, model, scratch);
+			return;
+		}
+		const size_t n = _mapped->cols();
+		scratch.resize(2 * n);
+		std::copy(model, model + n, scratch.begin());
+		_mapped->multiply(&scratch[0], &scratch[n], 1, _scale);
+		std::copy(scratch.begin() + n, scratch.end(), model);
+	}
+
+	/// Multiplies n model vectors with the matrix at once, as prod_up
+	void transform(double *const *models, size_t n,
+			std::vector<double> &scratch) const
+	{
+		if (!_mapped)
+		{
+			prod_up(M, models, n, scratch);
+			return;
+		}
+		const size_t mSize = _mapped->cols();
+		scratch.resize(2 * mSize * n);
+		for (size_t i = 0; i < n; i++)
+			std::copy(models[i], models[i] + mSize, scratch.begin() + i * mSize);
+		_mapped->multiply(&scratch[0], &scratch[mSize * n], n, _scale);
+		for (size_t i = 0; i < n; i++)
+			std::copy(scratch.begin() + (n + i) * mSize,
+					scratch.begin() + (n + i + 1) * mSize, models[i]);
 	}
 
+	/// Precomputes the cumulative sums of the columns for sampleColumn,
+	/// needed again after the values of the matrix are changed
+	void updateColumnCDF()
+	{
+		M.makeCompressed();
+		_columnCDF.resize(M.nonZeros());
+		for (int c = 0; c < M.outerSize(); c++)
+		{
+			double sum = 0;
+			for (int k = M.outerIndexPtr()[c]; k < M.outerIndexPtr()[c + 1]; k++)
+			{
+				sum += M.valuePtr()[k];
+				_columnCDF[k] = sum;
+			}
+		}
+		_memory.set(M.data().allocatedSize() * (sizeof(double) + sizeof(int))
+				+ (M.outerSize() + 1) * sizeof(int) + _columnCDF.capacity() * sizeof(double));
+	}
+
+	/// Draws the row of column c for a uniform random number rn in [0, 1),
+	/// with the matrix elements as probabilities. Returns false if rn is
+	/// larger than the sum of the column.
+	bool sampleColumn(uint32_t c, double rn, uint32_t &row) const
+	{
+		if (_mapped)
+		{	// walk the column of the file
+			const int32_t *outer = _mapped->outerIndex();
+			double cpv = 0;
+			for (int32_t k = outer[c]; k < outer[c + 1]; k++)
+			{
+				cpv += _scale * _mapped->value(c, k);
+				if (rn < cpv)
+				{
+					row = _mapped->innerIndex()[k];
+					return true;
+				}
+			}
+			return false;
+		}
+		if (!M.isCompressed() || (_columnCDF.size() != (size_t) M.nonZeros()))
+		{	// without cumulative sums
+			double cpv = 0;
+			for (ModelMatrixType::InnerIterator i(M, c); i; ++i)
+			{
+				cpv += i.value();
+				if (rn < cpv)
+				{
+					row = i.index();
+					return true;
+				}
+			}
+			return false;
+		}
+		const double *begin = &_columnCDF[0] + M.outerIndexPtr()[c];
+		const double *end = &_columnCDF[0] + M.outerIndexPtr()[c + 1];
+		const double *k = std::upper_bound(begin, end, rn);
+		if (k == end)
+			return false;
+		row = M.innerIndexPtr()[k - &_columnCDF[0]];
+		return true;
+	}
+	/// The matrix in compressed sparse column format: the elements of
+	/// column c are k in [columnStarts[c], columnStarts[c + 1])
+	void getColumns(std::vector<int32_t> &columnStarts,
+			std::vector<int32_t> &rows, std::vector<double> &values) const;
+	/// The matrix in compressed sparse row format: the elements of row r
+	/// are k in [rowStarts[r], rowStarts[r + 1]), in the order of the columns
+	void getRows(std::vector<int32_t> &rowStarts, std::vector<int32_t> &columns,
+			std::vector<double> &values) const;
+	/// The cumulative sums of the columns that sampleColumn draws from, in
+	/// compressed sparse column format with the running sums as values
+	void getColumnCDFs(std::vector<int32_t> &columnStarts,
+			std::vector<int32_t> &rows, std::vector<double> &cdf) const;
+
 
 };
 
@@ -158,30 +353,36 @@ class MagneticLens
 	Pixelization* _pixelization;
 	// Checks Matrix, raises Errors if not ok - also generate
 	// _pixelization if called first time
-	void _checkMatrix(const ModelMatrixType &M);
+	void _checkMatrix(size_t rows, size_t cols);
 	// minimum / maximum rigidity that is covered by the lens [Joule]
 	double _minimumRigidity;
 	double _maximumRigidity;
 	static bool _randomSeeded;
 	double _norm;
+	// lens parts sorted by rigidity if they are contiguous bins of equal
+	// width in log10(rigidity), for a lookup without search
+	std::vector<LensPart*> _lensPartBins;
+	double _logRigidityMin;
+	double _logRigidityStep;
+	void updateLensPartBins();
 
 public:
 	/// Default constructor
 	MagneticLens() :
-			_pixelization(NULL), _minimumRigidity(DBL_MAX), _maximumRigidity(DBL_MIN), _norm(1)
+			_pixelization(NULL), _minimumRigidity(DBL_MAX), _maximumRigidity(DBL_MIN), _norm(1), _logRigidityMin(0), _logRigidityStep(0)
 	{
 	}
 
 	/// Constructs lens with predefined healpix order
 	MagneticLens(uint8_t healpixorder) :
-			_pixelization(NULL), _minimumRigidity(DBL_MAX), _maximumRigidity(DBL_MIN)
+			_pixelization(NULL), _minimumRigidity(DBL_MAX), _maximumRigidity(DBL_MIN), _norm(1), _logRigidityMin(0), _logRigidityStep(0)
 	{
 		_pixelization = new Pixelization(healpixorder);
 	}
 
 	/// Construct lens and load lens from file
 	MagneticLens(const string &filename) :
-			_pixelization(NULL), _minimumRigidity(DBL_MAX), _maximumRigidity(DBL_MIN)
+			_pixelization(NULL), _minimumRigidity(DBL_MAX), _maximumRigidity(DBL_MIN), _norm(1), _logRigidityMin(0), _logRigidityStep(0)
 	{
 		loadLens(filename);
 	}
@@ -243,6 +444,11 @@ public:
 	/// anisotropies, but won't drop particles
 	void normalizeMatrixColumns();
 
+	/// Removes the tails of the matrix columns below threshold of the column
+	/// sums and optionally rounds the columns to uint16 steps, see
+	/// compactMatrix. Returns the non zero elements and errors of all lens parts.
+	MatrixCompaction compactLens(double threshold, bool cdfSteps = false);
+
 	/// Returns minimum rigidity covered by lens, in eV
 	double getMinimumRigidity() const
 	{
@@ -255,12 +461,13 @@ public:
 	}
 
 	//	returns the norm used for the lenses
-	double getNorm()
+	double getNorm() const
 	{
 		return _norm;
 	}
 
-	/// Returns iterator to the lens part with rigidity Joule
+	/// Returns the lens part with rigidity Joule, without search for
+	/// lens parts in equal logarithmic rigidity bins
 	LensPart* getLensPart(double rigidity) const;
 
 	/// Returns all lens parts
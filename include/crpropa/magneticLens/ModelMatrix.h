@@ -34,6 +34,8 @@
 #include <vector>
 #include <stdint.h>
 
+#include "crpropa/MemoryAccounting.h"
+
 using namespace std;
 
 #include <Eigen/SparseCore>
@@ -52,9 +54,97 @@ namespace crpropa
 	/// Reads a matrix from file
 	void deserialize(const string &filename, ModelMatrixType &matrix);
 
+	/// Writes the ModelMatrix in compressed sparse column format for
+	/// MappedModelMatrix: a header ("CRPLENS1", uint32 rows, cols, value
+	/// bytes 4 or 8, uint64 number of non zero elements) followed by the
+	/// int32 column starts, int32 rows and the values, as float if
+	/// singlePrecision
+	void serializeCSC(const string &filename, const ModelMatrixType &matrix,
+			bool singlePrecision = false);
+
+	/// As serializeCSC, with the values as uint16 steps of the column sums:
+	/// value bytes 2, the values of column c are multiples of the unit
+	/// sum_c / 65535, stored as doubles after the steps. Exact for matrices
+	/// of compactMatrix with cdfSteps, the values of others are rounded.
+	void serializeCSCSteps(const string &filename, const ModelMatrixType &matrix);
+
+	/// Number of steps of a column sum in compactMatrix and serializeCSCSteps
+	static const uint32_t CDF_STEPS = 65535;
+
+	/// True if the file starts with the header of serializeCSC
+	bool isCSCFile(const string &filename);
+
+	/**
+	 @class MappedModelMatrix
+	 @brief Read-only matrix of a file of serializeCSC, mapped into memory.
+
+	 The pages of the file are read on first access and shared by all
+	 processes that map the same file.
+	 */
+	class MappedModelMatrix
+	{
+		void *_data;
+		size_t _size;
+		MemoryAccount _memory;
+		uint32_t _rows, _cols;
+		uint64_t _nnz;
+		uint32_t _valueBytes;
+		const int32_t *_outer, *_inner;
+		const void *_values;
+		const double *_units; // of the columns for uint16 steps
+		MappedModelMatrix(const MappedModelMatrix &);
+		MappedModelMatrix &operator=(const MappedModelMatrix &);
+	public:
+		MappedModelMatrix(const string &filename);
+		~MappedModelMatrix();
+		uint32_t rows() const {return _rows;}
+		uint32_t cols() const {return _cols;}
+		uint64_t nonZeros() const {return _nnz;}
+		bool isSinglePrecision() const {return _valueBytes == sizeof(float);}
+		/// True for a file of serializeCSCSteps
+		bool isSteps() const {return _valueBytes == sizeof(uint16_t);}
+		/// non zero elements of column c: k in [outerIndex()[c], outerIndex()[c + 1])
+		const int32_t *outerIndex() const {return _outer;}
+		const int32_t *innerIndex() const {return _inner;}
+		/// value of the non zero element k of column c
+		double value(uint32_t c, uint64_t k) const
+		{
+			if (_valueBytes == sizeof(double))
+				return ((const double*) _values)[k];
+			if (_valueBytes == sizeof(float))
+				return ((const float*) _values)[k];
+			return ((const uint16_t*) _values)[k] * _units[c];
+		}
+		/// Copy into a sparse matrix, multiplied by scale
+		void toSparseMatrix(ModelMatrixType &matrix, double scale = 1) const;
+		double maximumOfSumsOfColumns() const;
+		/// y = scale * matrix * x for n column-major vectors of size cols() and rows()
+		void multiply(const double *x, double *y, size_t n, double scale) const;
+	};
+
 	/// Normalizes each column j of the matrix so that, \f$ \Vert m_j \Vert_1 = 1 \f$ 
 	void normalizeColumns(ModelMatrixType &matrix);
 
+	/// Size and error of a matrix after compactMatrix
+	struct MatrixCompaction
+	{
+		uint64_t nonZerosBefore, nonZerosAfter;
+		uint64_t columns; ///< with non zero elements before
+		/// largest and mean L1 distance of a column to the original, relative to its sum
+		double maximumError, meanError;
+		MatrixCompaction() : nonZerosBefore(0), nonZerosAfter(0), columns(0),
+				maximumError(0), meanError(0) {}
+	};
+
+	/// Removes the tail of each column: the smallest elements whose sum is
+	/// at most threshold times the column sum. The remaining elements are
+	/// scaled to the original column sum, so the lens keeps its flux and a
+	/// normalized column stays normalized. With cdfSteps the cumulative sums
+	/// of each column are rounded to multiples of sum / CDF_STEPS, elements
+	/// of no step are removed, as stored by serializeCSCSteps.
+	MatrixCompaction compactMatrix(ModelMatrixType &matrix, double threshold,
+			bool cdfSteps = false);
+
 	/// Calculate the maximum of the unity norm of the column vectors of the matrix \f$\max_j(\Vert m_j \Vert_1) \f$
 	double maximumOfSumsOfColumns(const ModelMatrixType &matrix);
 	
@@ -64,6 +154,14 @@ namespace crpropa
 
 	// matrix vector product with update: model = matrix * model
 	void prod_up(const ModelMatrixType& matrix, double* model);
+
+	// as prod_up, with a buffer that is reused for the copy of model
+	void prod_up(const ModelMatrixType& matrix, double* model,
+			std::vector<double> &scratch);
+
+	// product with update of n model vectors at once: models[i] = matrix * models[i]
+	void prod_up(const ModelMatrixType& matrix, double* const* models,
+			size_t n, std::vector<double> &scratch);
 } // namespace parsec
 
 #endif // MODELMATRIX_HH
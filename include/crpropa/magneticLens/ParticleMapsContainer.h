@@ -5,6 +5,7 @@
 #include <vector>
 #include "crpropa/magneticLens/Pixelization.h"
 #include "crpropa/magneticLens/MagneticLens.h"
+#include "crpropa/magneticLens/LensOffload.h"
 
 #include "crpropa/Vector3.h"
 
@@ -21,27 +22,50 @@ namespace crpropa{
 class ParticleMapsContainer
 {
 	private:
-    std::map< int , std::map <int , double*> > _data;
+		// maps of one particle id: the energy bins firstBin ... firstBin +
+		// filled.size() - 1, each one row of pixels in one allocation
+		struct ParticleMaps
+		{
+			int firstBin;
+			std::vector<double> maps; // energy bin x pixel
+			std::vector<char> filled; // bins that received particles
+			std::vector<double> pixelCDF; // cumulative sums of each row
+			std::vector<double> energyCDF; // cumulative weights of the bins
+		};
+    std::map<int, ParticleMaps> _data;
 		Pixelization _pixelization;
     double _deltaLogE;
     double _bin0lowerEdge;
+		// the maps of the last particle id looked up
+		int _lastPid;
+		ParticleMaps *_lastMaps;
 
 		// get the bin number of the energy
 		int energy2Idx(double energy) const;
 		double idx2Energy(int idx) const;
 
+		ParticleMaps *findMaps(int pid);
+		// the filled rows of the maps of each lens part, NULL for neutral particles
+		void groupByLensPart(const MagneticLens &lens,
+				std::map<LensPart*, std::vector<double*> > &maps);
+		// returns the row of bin, enlarging the maps if needed
+		size_t addBin(ParticleMaps &maps, int bin);
+		// row of bin or -1 if the bin has no particles
+		int findRow(const ParticleMaps &maps, int bin) const;
+		bool placeInRow(const ParticleMaps &maps, size_t row,
+				double &galacticLongitude, double &galacticLatitude);
 
 		// weights of the particles
 		double _sumOfWeights;
-		std::map< int , double > _weightsPID;
-		std::map< int , map<int, double> > _weights_pidEnergy;
+		std::vector<int> _pids;
+		std::vector<double> _pidCDF; // cumulative weights of the ids
 
 		// lazy update of weights
 		bool _weightsUpToDate;
 		void _updateWeights();
   public:
 
-		ParticleMapsContainer(double deltaLogE = 0.02, double bin0lowerEdge = 17.99) : _deltaLogE(deltaLogE), _bin0lowerEdge(bin0lowerEdge), _pixelization(6), _weightsUpToDate(false), _sumOfWeights(0)
+		ParticleMapsContainer(double deltaLogE = 0.02, double bin0lowerEdge = 17.99) : _deltaLogE(deltaLogE), _bin0lowerEdge(bin0lowerEdge), _pixelization(6), _lastPid(0), _lastMaps(NULL), _weightsUpToDate(false), _sumOfWeights(0)
 		{
 		}
 
@@ -53,7 +77,8 @@ class ParticleMapsContainer
     }
 
 		/// returns the map for the particleId with the given energy,. energy in
-		/// Joule
+		/// Joule. The maps of a particle id are moved when particles are
+		/// added with a new energy.
 		double *getMap(const int particleId, double energy);
 
 		/// adds a particle to the map container
@@ -69,7 +94,9 @@ class ParticleMapsContainer
 		// the energies are in eV
 		std::vector<double> getEnergies(int pid);
 
-		void applyLens(MagneticLens &lens);;
+		void applyLens(MagneticLens &lens);
+		/// as applyLens, with the lens parts on the offload device
+		void applyLens(const LensOffload &lens);
 
 		// energy in eV , galacticLongitude in rad [-pi ... pi], galacticLatitudes in rad [-pi/2 ... pi/2]
 		void getRandomParticles(size_t N, vector<int> &particleId,
@@ -91,12 +118,7 @@ class ParticleMapsContainer
 			return _sumOfWeights;
 		}
 
-		double getWeight(int pid, double energy)
-		{
-			if (!_weightsUpToDate)
-				_updateWeights();
-			return _weights_pidEnergy[pid][energy2Idx(energy)];
-		}
+		double getWeight(int pid, double energy);
 };
 
 /** @}*/
@@ -27,6 +27,7 @@
 #include "healpix_base/healpix_base.h"
 #include <cmath>
 #include <stdint.h>
+#include <vector>
 
 namespace crpropa
 {
@@ -59,14 +60,14 @@ const uint32_t _nPix[] =
 class Pixelization
 {
 public:
-	Pixelization()
+	Pixelization() : _centersBuilt(false)
 	{
 		_healpix = new healpix::T_Healpix_Base<int>(6, healpix::RING);
 	}
 
 	/// Constructor creating Pixelization with healpix order 6 (about
 	/// 50000 pixels)
-	Pixelization(uint8_t order)
+	Pixelization(uint8_t order) : _centersBuilt(false)
 	{
 		_healpix = new healpix::T_Healpix_Base<int>(order, healpix::RING);
 	}
@@ -80,6 +81,10 @@ public:
 	/// phi in [-pi, pi], theta in [-pi/2, pi/2]
 	uint32_t direction2Pix(double longitude, double latitude) const;
 
+	/// Pixel numbers of n directions, as direction2Pix
+	void direction2Pix(const double *longitude, const double *latitude,
+			uint32_t *pixel, size_t n) const;
+
 	/// Returns the number of pixels of the pixelization
 	uint32_t nPix() const
 	{
@@ -129,9 +134,17 @@ public:
 	}
 
 private:
+	// centers of the pixels for orders up to _centersOrder_max: longitude,
+	// latitude and the unit vector, built on first use
+	static const uint8_t _centersOrder_max = 8;
+	mutable std::vector<double> _centers;
+	mutable bool _centersBuilt;
+	const double *pixelCenter(uint32_t i) const;
+	void buildCenters() const;
 	void spherCo2Vec(double phi, double theta, healpix::vec3 &V) const;
 	void vec2SphereCo(double &phi , double &theta, const healpix::vec3 &V) const;
 	healpix::T_Healpix_Base<int> *_healpix;
+	uint32_t loc2pix(double longitude, double latitude, double z) const;
 	static healpix::T_Healpix_Base<healpix::int64> _healpix_nest;
 };
 
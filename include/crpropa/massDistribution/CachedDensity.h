@@ -0,0 +1,75 @@
+#ifndef CRPROPA_CACHEDDENSITY_H
+#define CRPROPA_CACHEDDENSITY_H
+
+#include "crpropa/massDistribution/Density.h"
+#include "crpropa/Grid.h"
+
+#include <string>
+#include <vector>
+
+namespace crpropa {
+
+/**
+ @class CachedDensity
+ @brief Density sampled onto nested grids, for models that are expensive to evaluate.
+
+ The HI, HII and H2 densities, the total density (getDensity) and the nucleon
+ density of a density model, e.g. Ferriere, Nakanishi, Cordes or a
+ DensityList, are sampled once onto a set of grids and then trilinearly
+ interpolated. The base level covers the whole volume, finer levels can be
+ added for regions with steep gradients such as the galactic disc; the
+ finest level that contains a position is used. Outside of all levels the
+ model is evaluated directly, or 0 is returned for a cache loaded without
+ model.
+ The grids are sampled in parallel and can be saved to and loaded from a
+ binary file.
+ */
+class CachedDensity: public Density {
+	struct Level {
+		Vector3d origin, size;
+		ref_ptr<ScalarGrid> grids[5]; // HI, HII, H2, total, nucleon
+	};
+	ref_ptr<Density> density;
+	std::vector<Level> levels; // coarse to fine
+	bool isForHI, isForHII, isForH2;
+
+	void sample(Level &level);
+	double interpolate(const Vector3d &position, int channel) const;
+public:
+	/** Sample the model on a base level
+	 @param density		density model to cache
+	 @param origin		lower corner of the cached volume
+	 @param size		extension of the cached volume
+	 @param Nx, Ny, Nz	number of grid points along the axes
+	 */
+	CachedDensity(ref_ptr<Density> density, const Vector3d &origin,
+			const Vector3d &size, size_t Nx, size_t Ny, size_t Nz);
+	/** Load the levels from a file written by save
+	 @param filename	file of save
+	 @param density		model evaluated outside of the levels, optional
+	 */
+	CachedDensity(const std::string &filename, ref_ptr<Density> density = NULL);
+
+	/** Sample the model on a finer level, which is used inside its volume */
+	void addLevel(const Vector3d &origin, const Vector3d &size, size_t Nx,
+			size_t Ny, size_t Nz);
+	size_t getNumberOfLevels() const;
+
+	/** Write all levels, the activation status and grid values as floats */
+	void save(const std::string &filename) const;
+
+	double getDensity(const Vector3d &position) const;
+	double getHIDensity(const Vector3d &position) const;
+	double getHIIDensity(const Vector3d &position) const;
+	double getH2Density(const Vector3d &position) const;
+	double getNucleonDensity(const Vector3d &position) const;
+	void getDensities(const Vector3d *positions, double *densities, size_t n) const;
+
+	bool getIsForHI();
+	bool getIsForHII();
+	bool getIsForH2();
+};
+
+}  // namespace crpropa
+
+#endif  // CRPROPA_CACHEDDENSITY_H
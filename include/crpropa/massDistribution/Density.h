@@ -35,6 +35,14 @@ class Density: public Referenced {
   	return 0;
   }
 
+  /** getDensity at n positions, e.g. the stages of a propagation step.
+   Models with a cheaper evaluation of many positions override this. */
+  virtual void getDensities(const Vector3d *positions, double *densities,
+      size_t n) const {
+    for (size_t i = 0; i < n; i++)
+      densities[i] = getDensity(positions[i]);
+  }
+
   virtual bool getIsForHI() {
   	return false;
   }
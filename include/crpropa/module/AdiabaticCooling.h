@@ -30,6 +30,9 @@ class AdiabaticCooling: public Module {
 		ref_ptr<AdvectionField> advectionField;
 		double limit;
 
+		// energy change of the current step for the divergence Div
+		void cool(Candidate *c, double Div) const;
+
 	public:
 	/** Constructor
 	@param advectionField 	The advection field used for the adiabatic energy change
@@ -38,6 +41,9 @@ class AdiabaticCooling: public Module {
 		AdiabaticCooling(ref_ptr<AdvectionField> advectionField);
 		AdiabaticCooling(ref_ptr<AdvectionField> advectionField, double limit);
 		void process(Candidate *c) const;
+		/** The divergences of all candidates with one
+		 AdvectionField::getFieldsAndDivergences call */
+		void processBatch(Candidate *const *candidates, size_t n) const;
 
 		void setLimit(double l);
 
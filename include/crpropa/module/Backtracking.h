@@ -0,0 +1,68 @@
+#ifndef CRPROPA_BACKTRACKING_H
+#define CRPROPA_BACKTRACKING_H
+
+#include "crpropa/Module.h"
+#include "crpropa/Grid.h"
+#include "crpropa/massDistribution/Density.h"
+
+namespace crpropa {
+/**
+ * \addtogroup Tools
+ * @{
+ */
+
+/**
+ @class BacktrackingWeight
+ @brief Weights of backtracked candidates by the density of the sources.
+
+ In a backtracking simulation antiparticles leave the observer
+ (SourceBacktracking) and are propagated without energy losses and
+ interactions, e.g. with PropagationCK or with DiffusionSDE in a reversed
+ advection field. By reciprocity (Liouville's theorem) the flux of the
+ sources of density n arriving at the observer from the reversed start
+ direction of a candidate is proportional to
+ - Integral: the integral of n along the backtracked trajectory, for sources
+   steadily emitting inside the propagation volume. The steps count with
+   their trajectory length (c dt for DiffusionSDE) and the density at the
+   middle of the step, the factor is in units of 1 / m^2 for n in 1 / m^3.
+ - EndPoint: n at the end of the trajectory, for sources on the boundary
+   that ends it.
+ The weight of the candidate is the weight at the start, stored in the
+ property BacktrackingWeight.weight, times this factor, updated in every
+ step. Place the module directly after the propagation, so that observers
+ and boundaries see the factor of the current step. Modules changing the
+ weight on the way (ImportanceSampling) cannot be combined with it.
+
+ The density is a Density (getDensity, in batches with getDensities) or a
+ grid of the cells of SourceDensityGrid, zero outside the grid.
+ */
+class BacktrackingWeight: public Module {
+public:
+	enum Mode {
+		Integral, EndPoint
+	};
+private:
+	ref_ptr<Density> density;
+	ref_ptr<ScalarGrid> grid;
+	Mode mode;
+
+	Vector3d getPosition(const Candidate *candidate) const;
+	void setFactor(Candidate *candidate, double density) const;
+public:
+	BacktrackingWeight(ref_ptr<Density> density, Mode mode = Integral);
+	BacktrackingWeight(ref_ptr<ScalarGrid> grid, Mode mode = Integral);
+	void setMode(Mode mode);
+	Mode getMode() const;
+
+	/** Density of the sources at a position */
+	double getDensity(const Vector3d &position) const;
+	void process(Candidate *candidate) const;
+	/** The densities of all candidates with one Density::getDensities call */
+	void processBatch(Candidate *const *candidates, size_t n) const;
+	std::string getDescription() const;
+};
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_BACKTRACKING_H
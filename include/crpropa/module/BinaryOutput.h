@@ -0,0 +1,134 @@
+#ifndef CRPROPA_BINARYOUTPUT_H
+#define CRPROPA_BINARYOUTPUT_H
+
+#include "crpropa/Module.h"
+#include "crpropa/Lock.h"
+#include "crpropa/MappedFile.h"
+#include "crpropa/Source.h"
+#include "crpropa/module/ParticleCollector.h"
+
+#include <fstream>
+#include <stdint.h>
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup Output
+ * @{
+ */
+
+/// Particle state in a binary candidate file
+struct BinaryState {
+	int32_t id;
+	int32_t reserved;
+	double energy;
+	double position[3];
+	double direction[3];
+};
+
+/**
+ Candidate in a binary candidate file, followed by its properties.
+ Each property is stored as: uint8 Variant::Type, uint8 0, uint16 length of
+ the name, uint32 size of the value, the name and the value. Records are
+ padded to multiples of 8 bytes, size includes the properties and padding.
+ */
+struct BinaryRecord {
+	uint32_t size;
+	uint32_t properties; ///< number of properties
+	uint64_t serialNumber;
+	double trajectoryLength;
+	double redshift;
+	double weight;
+	double currentStep;
+	double nextStep;
+	BinaryState current;
+	BinaryState source;
+	BinaryState created;
+};
+
+/**
+ @class BinaryOutput
+ @brief Binary candidate stream, for handing candidates from one simulation to the next.
+
+ Writes the current, source and created particle states, the trajectory
+ length, redshift, weight, step sizes, serial number and all properties of each
+ candidate in native byte order. The file is read with BinaryInput or
+ BinaryOutput::load, which is much faster than TextOutput::load.
+ Records are collected per thread and written in blocks, close() writes the
+ records of all threads and must not be called while other threads process
+ candidates.
+ */
+class BinaryOutput: public Module {
+	// records of one thread, padded against false sharing
+	struct RecordBuffer {
+		std::string records;
+		char padding[64];
+	};
+	mutable std::ofstream outfile;
+	mutable std::vector<RecordBuffer> recordBuffers; ///< one per thread
+	std::string filename;
+	mutable Lock lock; ///< of the file
+
+	void writeRecords(std::string &records) const;
+public:
+	BinaryOutput(const std::string &filename);
+	~BinaryOutput();
+
+	void process(Candidate *candidate) const;
+	/// Write the records of all threads
+	void flush() const;
+	/// Write the records of all threads and close the file
+	void close();
+	/// Append the candidates of a binary candidate file to the collector
+	static void load(const std::string &filename, ParticleCollector *collector);
+	std::string getDescription() const;
+};
+
+/**
+ @class BinaryInput
+ @brief Memory mapped binary candidate file of BinaryOutput.
+
+ The records are views into the mapped file, iterating them does not copy or
+ parse anything. getCandidate creates a candidate of a record.
+ */
+class BinaryInput: public Referenced {
+	ref_ptr<MappedFile> file;
+	std::vector<size_t> offsets; ///< of each record in the file
+public:
+	/// Map the file, throws if it is no complete binary candidate file
+	BinaryInput(const std::string &filename);
+	/// True if the file starts as a binary candidate file
+	static bool isBinaryFile(const std::string &filename);
+
+	size_t size() const; ///< number of records
+	const BinaryRecord &getRecord(size_t i) const;
+	ref_ptr<Candidate> getCandidate(size_t i) const;
+	/// Append all candidates to the collector
+	void load(ParticleCollector *collector) const;
+};
+
+/**
+ @class BinarySource
+ @brief Source of the candidates of a binary candidate file, for multi-stage simulations.
+
+ The candidates are created from the mapped records when they are drawn, in
+ file order and each once, so that the next stage streams the file instead of
+ loading it. getCandidate returns null after the last record, run the next
+ stage with size() candidates.
+ */
+class BinarySource: public SourceInterface {
+	ref_ptr<BinaryInput> input;
+	mutable size_t next; ///< next record, advanced atomically
+public:
+	BinarySource(const std::string &filename);
+	size_t size() const; ///< number of records
+	ref_ptr<Candidate> getCandidate() const;
+	/// Append the next n candidates, fewer after the last record
+	void getCandidates(size_t n, std::vector<ref_ptr<Candidate> > &candidates) const;
+	std::string getDescription() const;
+};
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_BINARYOUTPUT_H
@@ -60,6 +60,7 @@ public:
  The particle is made inactive and flagged as "Rejected".
  By default the module prevents overshooting the boundary by more than a margin of 0.1 kpc.
  This corresponds to the default minimum step size of the propagation modules (PropagationCK and SimplePropagation).
+ With setRayStep neutral particles may step up to the intersection of their straight line with the boundary, plus the margin.
  */
 class CubicBoundary: public AbstractCondition {
 private:
@@ -67,15 +68,18 @@ private:
 	double size;
 	double margin;
 	bool limitStep;
+	bool rayStep;
 
 public:
 	CubicBoundary();
 	CubicBoundary(Vector3d origin, double size);
 	void process(Candidate *candidate) const;
+	Decision check(const Candidate *candidate, double &stepLimit) const;
 	void setOrigin(Vector3d origin);
 	void setSize(double size);
 	void setMargin(double margin);
 	void setLimitStep(bool limitStep);
+	void setRayStep(bool rayStep);
 	std::string getDescription() const;
 };
 
@@ -86,6 +90,7 @@ public:
  The particle is made inactive and flagged as "Rejected".
  By default the module prevents overshooting the boundary by more than a margin of 0.1 kpc.
  This corresponds to the default minimum step size of the propagation modules (PropagationCK and SimplePropagation).
+ With setRayStep neutral particles may step up to the intersection of their straight line with the boundary, plus the margin.
  */
 class SphericalBoundary: public AbstractCondition {
 private:
@@ -93,15 +98,18 @@ private:
 	double radius;
 	double margin;
 	bool limitStep;
+	bool rayStep;
 
 public:
 	SphericalBoundary();
 	SphericalBoundary(Vector3d center, double radius);
 	void process(Candidate *candidate) const;
+	Decision check(const Candidate *candidate, double &stepLimit) const;
 	void setCenter(Vector3d center);
 	void setRadius(double size);
 	void setMargin(double margin);
 	void setLimitStep(bool limitStep);
+	void setRayStep(bool rayStep);
 	std::string getDescription() const;
 };
 
@@ -127,6 +135,7 @@ public:
 	EllipsoidalBoundary(Vector3d focalPoint1, Vector3d focalPoint2,
 			double majorAxis);
 	void process(Candidate *candidate) const;
+	Decision check(const Candidate *candidate, double &stepLimit) const;
 	void setFocalPoints(Vector3d focalPoint1, Vector3d focalPoint2);
 	void setMajorAxis(double size);
 	void setMargin(double margin);
@@ -155,6 +164,7 @@ public:
 	CylindricalBoundary(Vector3d origin, double height,
 			double radius);
 	void process(Candidate *candidate) const;
+	Decision check(const Candidate *candidate, double &stepLimit) const;
 	void setOrigin(Vector3d origin);
 	void setHeight(double height);
 	void setRadius(double radius);
@@ -28,6 +28,8 @@ public:
 	const std::vector<Vector3d>& getObserverPositions() const;
 	std::string getDescription() const;
 	void process(Candidate *candidate) const;
+	Decision check(const Candidate *candidate, double &stepLimit) const;
+	void getConfiguration(Configuration &configuration) const;
 };
 
 /**
@@ -45,6 +47,8 @@ public:
 	double getMinimumEnergy() const;
 	std::string getDescription() const;
 	void process(Candidate *candidate) const;
+	Decision check(const Candidate *candidate, double &stepLimit) const;
+	void getConfiguration(Configuration &configuration) const;
 };
 
 
@@ -63,6 +67,8 @@ public:
 	double getMinimumRigidity() const;
 	std::string getDescription() const;
 	void process(Candidate *candidate) const;
+	Decision check(const Candidate *candidate, double &stepLimit) const;
+	void getConfiguration(Configuration &configuration) const;
 };
 
 /**
@@ -80,6 +86,8 @@ public:
 	double getMinimumRedshift();
 	std::string getDescription() const;
 	void process(Candidate *candidate) const;
+	Decision check(const Candidate *candidate, double &stepLimit) const;
+	void getConfiguration(Configuration &configuration) const;
 };
 
 /**
@@ -96,6 +104,8 @@ public:
 	double getDetectionLength() const;
 	std::string getDescription() const;
 	void process(Candidate *candidate) const;
+	Decision check(const Candidate *candidate, double &stepLimit) const;
+	void getConfiguration(Configuration &configuration) const;
 };
 /** @}*/
 
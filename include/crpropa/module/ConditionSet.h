@@ -0,0 +1,42 @@
+#ifndef CRPROPA_CONDITIONSET_H
+#define CRPROPA_CONDITIONSET_H
+
+#include "crpropa/Module.h"
+
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup Condition
+ * @{
+ */
+
+/**
+ @class ConditionSet
+ @brief Several conditions evaluated in one module.
+
+ Instead of a module per break condition and boundary, e.g.
+ MaximumTrajectoryLength, MinimumEnergy and SphericalBoundary, the set
+ evaluates AbstractCondition::check of all its conditions in one pass and
+ limits the next step once, to the smallest step the conditions allow.
+ Rejection and acceptance keep the flags, actions and deactivation of the
+ individual conditions.
+ The conditions have priority in the order they were added: a condition
+ that makes the candidate inactive ends the evaluation, so if several
+ conditions apply in the same step, only the first one flags the candidate.
+ Conditions without check are processed at their position.
+ The conditions are not added to the ModuleList themselves.
+ */
+class ConditionSet: public Module {
+	std::vector<ref_ptr<AbstractCondition> > conditions;
+public:
+	void add(AbstractCondition *condition);
+	size_t size() const;
+	void process(Candidate *candidate) const;
+	std::string getDescription() const;
+};
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_CONDITIONSET_H
@@ -0,0 +1,60 @@
+#ifndef CRPROPA_CONTINUOUSLOSSCOLLECTION_H
+#define CRPROPA_CONTINUOUSLOSSCOLLECTION_H
+
+#include "crpropa/Module.h"
+
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup EnergyLosses
+ * @{
+ */
+
+/**
+ @class ContinuousLossCollection
+ @brief Several continuous energy losses integrated jointly over each step.
+
+ Instead of each loss module applying its loss to first order in the step,
+ the collection integrates dE/dx = -sum beta_i(E, z) over the step with an
+ adaptive embedded Runge-Kutta method (Cash-Karp), so that the step can be
+ longer than the loss length at a given relative accuracy of the energy.
+ With setRedshiftEvolution(true) (default) the collection also advances the
+ redshift and applies the adiabatic loss, replacing the Redshift module.
+ The loss rates are evaluated at the position at the end of the step.
+ The losses are not added to the ModuleList themselves. After the step
+ each loss emits its secondaries for its part of the energy loss, at the
+ mean energy of the step.
+
+ The collection limits the next step to a fraction (default 1) of the
+ energy loss length of the summed losses, without the adiabatic loss.
+ */
+class ContinuousLossCollection: public Module {
+	std::vector<ref_ptr<ContinuousLoss> > losses;
+	double limit;
+	double tolerance;
+	bool redshiftEvolution;
+
+	void derivatives(const Candidate *candidate, const double *y,
+			double *dydx) const;
+public:
+	ContinuousLossCollection(double limit = 1, double tolerance = 1e-4);
+	void add(ContinuousLoss *loss);
+	size_t size() const;
+	/** Limit the step to a fraction of the total energy loss length */
+	void setLimit(double limit);
+	double getLimit() const;
+	/** Relative error of the energy (and of 1 + z) per step */
+	void setTolerance(double tolerance);
+	double getTolerance() const;
+	/** Advance the redshift and apply the adiabatic loss */
+	void setRedshiftEvolution(bool redshiftEvolution);
+	bool getRedshiftEvolution() const;
+	void process(Candidate *candidate) const;
+	std::string getDescription() const;
+};
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_CONTINUOUSLOSSCOLLECTION_H
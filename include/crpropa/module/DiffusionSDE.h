@@ -43,7 +43,21 @@ private:
 	    double epsilon; // ratio of parallel and perpendicular diffusion coefficient D_par = epsilon*D_perp
 	    double alpha; // power law index of the energy dependent diffusion coefficient: D\propto E^alpha
 	    double scale; // scaling factor for the diffusion coefficient D = scale*D_0
-
+	    bool adaptiveSubsteps; // integrate the field line with adaptive substeps
+	    bool adiabaticCooling; // apply the adiabatic energy change of the advection field
+	    double coolingLimit; // maximum relative energy change of the adiabatic cooling per step
+
+	    size_t integrateFieldLine(const Vector3d &PosIn, Vector3d &PosOut, double z, double propTime, Candidate *candidate) const;
+	    // diffusion step from the end point of the field line integration,
+	    // with the advection field at PosIn if already evaluated
+	    void finishStep(Candidate *candidate, const Vector3d &PosIn, const Vector3d &PosOut, size_t stepNumber, double h, double TStep, double NStep, double BStep, const Vector3d *advection = NULL) const;
+	    // batch integration of the field lines of n charged candidates at redshift z
+	    void diffuseBatch(Candidate *const *candidates, size_t n, double z) const;
+	    void tryStepBatch(const std::vector<size_t> &lanes, size_t n, const double *PosIn, double *POut, double *PosErr, const double *propStep, double z) const;
+	    // advection field and divergence at Pos, zero on errors
+	    void evaluateAdvection(const Vector3d &Pos, Vector3d &advection, double &divergence) const;
+	    // adiabatic energy change of the current step, as AdiabaticCooling
+	    void cool(Candidate *candidate, double divergence) const;
 
 public:
 /** Constructor
@@ -59,6 +73,12 @@ public:
 	    DiffusionSDE(ref_ptr<crpropa::MagneticField> magneticField, ref_ptr<crpropa::AdvectionField> advectionField, double tolerance = 1e-4, double minStep=(10*pc), double maxStep=(1*kpc), double epsilon=0.1);
 
 	    void process(crpropa::Candidate *candidate) const;
+	    /** Batch mode: the random numbers of all candidates are drawn at once and
+	     the field lines integrated together in structure of arrays form, with
+	     one MagneticField::getFields call per Cash-Karp stage. The adaptive
+	     substeps use the scalar path.
+	     */
+	    void processBatch(crpropa::Candidate *const *candidates, size_t n) const;
 
 	    void tryStep(const Vector3d &Pos, Vector3d &POut, Vector3d &PosErr, double z, double propStep ) const;
 	    void driftStep(const Vector3d &Pos, Vector3d &LinProp, double h) const;
@@ -70,6 +90,22 @@ public:
 	    void setEpsilon(double kappa);
 	    void setAlpha(double alpha);
 	    void setScale(double Scale);
+	    /** Integrate the field line with adaptive substeps.
+	     Instead of halving the step until the first substep meets the tolerance
+	     and repeating it, every substep is checked with the embedded error
+	     estimate and the next one adapted. The last substep size is stored in
+	     the candidate property "DiffusionSDE.substep" and used as the start of
+	     the next step.
+	     */
+	    void setAdaptiveSubsteps(bool adaptive = true);
+	    /** Apply the adiabatic energy change dE/dt = -E/3 div(u) of the advection
+	     field in each step, instead of a separate AdiabaticCooling module. The
+	     field and its divergence are evaluated together once per step, at the
+	     start of the step (AdiabaticCooling evaluates the divergence at its
+	     end), and the next step is limited to a relative energy change of limit.
+	     Needs an advection field.
+	     */
+	    void setAdiabaticCooling(bool enable = true, double limit = 0.1);
 	    void setMagneticField(ref_ptr<crpropa::MagneticField> magneticField);
 	    void setAdvectionField(ref_ptr<crpropa::AdvectionField> advectionField);
 
@@ -79,6 +115,9 @@ public:
 	    double getEpsilon() const;
 	    double getAlpha() const;
 	    double getScale() const;
+	    bool getAdaptiveSubsteps() const;
+	    bool getAdiabaticCooling() const;
+	    double getAdiabaticCoolingLimit() const;
 	    std::string getDescription() const;
 
 };
@@ -2,6 +2,7 @@
 #define CRPROPA_EMCASCADE_H
 
 #include "crpropa/Module.h"
+#include "crpropa/PhotonPropagation.h"
 
 namespace crpropa {
 
@@ -39,18 +40,67 @@ public:
 	/** Load the unpropagated histogram of EM particles */
 	void load(const std::string &filename);
 
-	/** Calculates the EM cascade with DINT */
+	/** Calculates the EM cascade with DINT, in parallel segments of distance bins */
 	void runCascade(
 		const std::string &filename,  //!< output filename
 		int IRBFlag = 4,        //!< EBL background 0: high, 1: low, 2: Primack, 4: Stecker'06
 		int RadioFlag = 4,      //!< radio background 0: high, 1: medium, 2: obs, 3: none, 4: Protheroe'96
 		double Bfield = 1E-13,  //!< magnetic field strength [T], default = 1 nG
-		double cutCascade = 0   //!< a-parameter, see CRPropa 2 paper
+		double cutCascade = 0,  //!< a-parameter, see CRPropa 2 paper
+		int nThreads = 0        //!< threads for the cascade, see DintCascade, 0: all
 		);
 
 	std::string getDescription() const;
 };
 
+/**
+ @class EMCascadeResponse
+ @brief Tabulated EM cascade of low energy photons, electrons and positrons inside the module list.
+
+ Photons, electrons and positrons below the maximum energy are taken out of
+ the simulation and their cascade to the observer at the origin is added to
+ an observed spectrum with a DintResponse table, so that the low energy tail
+ of the cascade is not tracked and needs no separate DINT pass.
+ Particles farther than the table reaches are left to the other modules,
+ particles below the energy range of DINT are only deactivated.
+ The weights are collected per thread at the distance nodes of the table,
+ linearly interpolated in light travel distance, and only cascaded by
+ getSpectrum and save, which must not be called while other threads process
+ candidates.
+ */
+class EMCascadeResponse: public Module {
+	// weights at the nodes of one thread, padded against false sharing
+	struct NodeWeights {
+		std::vector<double> weights;
+		char padding[64];
+	};
+	DintResponse response;
+	double maxEnergy;
+	mutable std::vector<NodeWeights> threadWeights; ///< one per thread
+	mutable std::vector<double> mergedWeights;
+
+	void merge() const;
+public:
+	/**
+	 @param response	computed or loaded table, copied
+	 @param maxEnergy	maximum energy of the particles handed to the table
+	 */
+	EMCascadeResponse(const DintResponse &response, double maxEnergy);
+	void setMaximumEnergy(double energy);
+	double getMaximumEnergy() const;
+
+	void process(Candidate *candidate) const;
+
+	/** Observed photons, electrons and positrons in the energy bins of DINT, one species after the other */
+	std::vector<double> getSpectrum() const;
+	/** Summed weight of the particles handed to the table */
+	double getInjectedWeight() const;
+	void clear();
+	/** Write the observed spectrum in the format of EMCascade::runCascade */
+	void save(const std::string &filename) const;
+	std::string getDescription() const;
+};
+
 } // namespace crpropa
 
 #endif // CRPROPA_EMCASCADE_H
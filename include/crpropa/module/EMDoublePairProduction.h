@@ -2,6 +2,7 @@
 #define CRPROPA_EMDOUBLEPAIRPRODUCTION_H
 
 #include "crpropa/Module.h"
+#include "crpropa/Common.h"
 #include "crpropa/PhotonBackground.h"
 #include <fstream>
 
@@ -15,14 +16,16 @@ namespace crpropa {
  The secondary electrons from this interaction are optionally created (default = false).
  The module limits the propagation step size to a fraction of the mean free path (default = 0.1).
  */
-class EMDoublePairProduction: public Module {
+class EMDoublePairProduction: public Interaction {
 private:
 	PhotonField photonField;
+	ref_ptr<PhotonFieldScaling> scaling; ///< cosmological evolution of the photon field
 	bool haveElectrons;
 	double limit;
+	double thinning;  //!< leading particle thinning below this fraction of the source energy
 
 	// tabulated interaction rate 1/lambda(E)
-	std::vector<double> tabEnergy;  //!< electron energy in [J]
+	LogUniformTable tabEnergy;  //!< electron energy in [J]
 	std::vector<double> tabRate;  //!< interaction rate in [1/m]
 
 public:
@@ -35,9 +38,19 @@ public:
 	void setPhotonField(PhotonField photonField);
 	void setHaveElectrons(bool haveElectrons);
 	void setLimit(double limit);
+	/**
+	 Leading particle thinning: if the energy of an interacting particle is
+	 below the given fraction of its source energy, only one of the products
+	 is kept, with a probability proportional to its energy and its weight
+	 increased accordingly (default = 0, no thinning).
+	 */
+	void setThinning(double thinning);
 
 	void initRate(std::string filename);
 	void process(Candidate *candidate) const;
+	int getParticleClasses() const;
+	double interactionRate(const Candidate *candidate) const;
+	void interact(Candidate *candidate) const;
 	void performInteraction(Candidate *candidate) const;
 
 };
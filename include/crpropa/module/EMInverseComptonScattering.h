@@ -2,11 +2,38 @@
 #define CRPROPA_EMINVERSECOMPTONSCATTERING_H
 
 #include "crpropa/Module.h"
+#include "crpropa/Common.h"
 #include "crpropa/PhotonBackground.h"
+#include "crpropa/Random.h"
 #include <fstream>
 
 namespace crpropa {
 
+/**
+ @class ICSSecondariesEnergyDistribution
+ @brief Energy distribution of the electron after inverse Compton scattering.
+
+ Cumulative differential cross section in the energy fraction x = Ee'/Ee,
+ in 1000 bins of s and 1000 bins of x, see Lee 96 (arXiv:9604098), eq. 23.
+ The distributions are computed in parallel on construction and sampled with
+ alias tables. All EMInverseComptonScattering modules share one instance.
+ */
+class ICSSecondariesEnergyDistribution: public Referenced {
+	AliasTable data; //!< cdf(x), one row for each s bin
+	std::vector<double> s_values; //!< s bin borders in [J**2]
+	size_t Ns; //!< number of s bins
+	size_t Nrer; //!< number of x bins
+	double s_min;
+	double s_max;
+	double dls;
+public:
+	ICSSecondariesEnergyDistribution();
+	/// Instance shared by all modules, built at the first call
+	static ref_ptr<ICSSecondariesEnergyDistribution> shared();
+	/// Random electron energy after scattering for the energy Ee and s in [J]
+	double sample(double Ee, double s) const;
+};
+
 /**
  @class EMInverseComptonScattering
  @brief Inverse Compton scattering of electrons with background photons.
@@ -14,21 +41,29 @@ namespace crpropa {
  This module simulates inverse Compton scattering of electrons with background photons for several photon fields.
  The upscattered photons are optionally created as secondary particles (default = false).
  The module limits the propagation step size to a fraction of the mean free path (default = 0.1).
+ Below an optional energy (setContinuousEnergy) the scattering is instead
+ treated as a continuous loss in the Thomson regime, see setContinuousEnergy.
 */
-class EMInverseComptonScattering: public Module {
+class EMInverseComptonScattering: public Interaction {
 private:
 	PhotonField photonField;
+	ref_ptr<PhotonFieldScaling> scaling; ///< cosmological evolution of the photon field
 	bool havePhotons;
 	double limit;
+	double thinning;  //!< leading particle thinning below this fraction of the source energy
+	double continuousEnergy;  //!< continuous loss below this energy in [J]
 
 	// tabulated interaction rate 1/lambda(E)
-	std::vector<double> tabEnergy;  //!< electron energy in [J]
+	LogUniformTable tabEnergy;  //!< electron energy in [J]
 	std::vector<double> tabRate;  //!< interaction rate in [1/m]
 	
 	// tabulated CDF(s_kin, E) = cumulative differential interaction rate
-	std::vector<double> tabE;  //!< electron energy in [J]
+	LogUniformTable tabE;  //!< electron energy in [J]
 	std::vector<double> tabs;  //!< s_kin = s - m^2 in [J**2]
-	std::vector< std::vector<double> > tabCDF;  //!< cumulative interaction rate
+	AliasTable tabCDF;  //!< cumulative interaction rate, one alias table row per energy
+	std::vector<double> tabMeanLoss;  //!< mean fractional energy loss per scattering, Thomson regime
+
+	ref_ptr<ICSSecondariesEnergyDistribution> secondaryDistribution;
 
 public:
 	EMInverseComptonScattering(
@@ -40,12 +75,39 @@ public:
 	void setPhotonField(PhotonField photonField);
 	void setHavePhotons(bool havePhotons);
 	void setLimit(double limit);
+	/**
+	 Leading particle thinning: if the energy of an interacting particle is
+	 below the given fraction of its source energy, only one of the products
+	 is kept, with a probability proportional to its energy and its weight
+	 increased accordingly (default = 0, no thinning).
+	 */
+	void setThinning(double thinning);
+	/**
+	 Continuous loss below the given electron energy (default = 0, off).
+	 In the Thomson regime the mean energy loss per scattering is
+	 E <s_kin> / (2 (m c^2)^2) with the mean s_kin of the tabulated
+	 distribution, the loss length decreases with 1/E. Below the energy the
+	 electron loses energy continuously, E' = E / (1 + l / L(E)) after a step
+	 l for the loss length L(E), and the step is limited to a fraction of L.
+	 With photons, one macro-photon per step carries the lost energy: the
+	 mean up-scattered energy with the weight of the number of photons.
+	 Only valid well below the Klein-Nishina regime, gamma * e_photon << m c^2.
+	 */
+	void setContinuousEnergy(double energy);
+	double getContinuousEnergy() const;
 
 	void initRate(std::string filename);
 	void initCumulativeRate(std::string filename);
 
 	void process(Candidate *candidate) const;
+	int getParticleClasses() const;
+	double interactionRate(const Candidate *candidate) const;
+	void interact(Candidate *candidate) const;
 	void performInteraction(Candidate *candidate) const;
+	/// Mean fractional energy loss per scattering in the Thomson regime
+	double meanEnergyLoss(const Candidate *candidate) const;
+private:
+	void processContinuous(Candidate *candidate, double rate) const;
 };
 
 } // namespace crpropa
@@ -2,11 +2,36 @@
 #define CRPROPA_EMPAIRPRODUCTION_H
 
 #include "crpropa/Module.h"
+#include "crpropa/Common.h"
+#include "crpropa/MemoryAccounting.h"
 #include "crpropa/PhotonBackground.h"
+#include "crpropa/Random.h"
 #include <fstream>
 
 namespace crpropa {
 
+/**
+ @class PPSecondariesEnergyDistribution
+ @brief Energy distribution of the electron and positron from pair production.
+
+ Cumulative differential cross section in the energy fraction x = E_e / E_gamma,
+ in 1000 bins of s_kin and 1000 bins of x, see Lee 96 (arXiv:9604098).
+ The distributions are computed in parallel on construction and sampled with
+ alias tables. All EMPairProduction modules share one instance.
+ */
+class PPSecondariesEnergyDistribution: public Referenced {
+	std::vector<double> tab_s; //!< s_kin bin borders in [J**2]
+	AliasTable data; //!< cdf(x), one row for each s_kin bin
+	size_t N; //!< number of x bins
+	MemoryAccount memory; //!< of the alias tables
+public:
+	PPSecondariesEnergyDistribution();
+	/// Instance shared by all modules, built at the first call
+	static ref_ptr<PPSecondariesEnergyDistribution> shared();
+	/// Random electron or positron energy for the photon energy E0 and s_kin in [J]
+	double sample(double E0, double s) const;
+};
+
 /**
  @class EMPairProduction
  @brief Electron-pair production of photons with background photons.
@@ -16,20 +41,26 @@ namespace crpropa {
  The resulting electron positron pair is optionally created (default = false).
  The module limits the propagation step size to a fraction of the mean free path (default = 0.1).
  */
-class EMPairProduction: public Module {
+class EMPairProduction: public Interaction {
 private:
 	PhotonField photonField;
+	ref_ptr<PhotonFieldScaling> scaling; ///< cosmological evolution of the photon field
 	bool haveElectrons;
 	double limit;
+	double thinning;  //!< leading particle thinning below this fraction of the source energy
 
 	// tabulated interaction rate 1/lambda(E)
-	std::vector<double> tabEnergy;  //!< electron energy in [J]
+	LogUniformTable tabEnergy;  //!< electron energy in [J]
 	std::vector<double> tabRate;  //!< interaction rate in [1/m]
 	
 	// tabulated CDF(s_kin, E) = cumulative differential interaction rate
-	std::vector<double> tabE;  //!< electron energy in [J]
+	LogUniformTable tabE;  //!< electron energy in [J]
 	std::vector<double> tabs;  //!< s_kin = s - m^2 in [J**2]
-	std::vector< std::vector<double> > tabCDF;  //!< cumulative interaction rate
+	AliasTable tabCDF;  //!< cumulative interaction rate, one alias table row per energy
+
+	ref_ptr<PPSecondariesEnergyDistribution> secondaryDistribution;  //!< built when electrons are created
+	MemoryAccount memory;  //!< of the tables
+	void updateMemory();
 
 public:
 	EMPairProduction(
@@ -41,12 +72,22 @@ public:
 	void setPhotonField(PhotonField photonField);
 	void setHaveElectrons(bool haveElectrons);
 	void setLimit(double limit);
+	/**
+	 Leading particle thinning: if the energy of an interacting particle is
+	 below the given fraction of its source energy, only one of the products
+	 is kept, with a probability proportional to its energy and its weight
+	 increased accordingly (default = 0, no thinning).
+	 */
+	void setThinning(double thinning);
 
 	void initRate(std::string filename);
 	void initCumulativeRate(std::string filename);
 
 	void performInteraction(Candidate *candidate) const;
 	void process(Candidate *candidate) const;
+	int getParticleClasses() const;
+	double interactionRate(const Candidate *candidate) const;
+	void interact(Candidate *candidate) const;
 };
 
 } // namespace crpropa
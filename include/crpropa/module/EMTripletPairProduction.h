@@ -2,7 +2,9 @@
 #define CRPROPA_EMTRIPLETPAIRPRODUCTION_H
 
 #include "crpropa/Module.h"
+#include "crpropa/Common.h"
 #include "crpropa/PhotonBackground.h"
+#include "crpropa/Random.h"
 #include <fstream>
 
 namespace crpropa {
@@ -19,20 +21,22 @@ namespace crpropa {
  The secondary electrons from this interaction are optionally created (default = false).
  The module limits the propagation step size to a fraction of the mean free path (default = 0.1).
 */
-class EMTripletPairProduction: public Module {
+class EMTripletPairProduction: public Interaction {
 private:
 	PhotonField photonField;
+	ref_ptr<PhotonFieldScaling> scaling; ///< cosmological evolution of the photon field
 	bool haveElectrons;
 	double limit;
+	double thinning;  //!< leading particle thinning below this fraction of the source energy
 
 	// tabulated interaction rate 1/lambda(E)
-	std::vector<double> tabEnergy;  //!< electron energy in [J]
+	LogUniformTable tabEnergy;  //!< electron energy in [J]
 	std::vector<double> tabRate;  //!< interaction rate in [1/m]
 	
 	// tabulated CDF(s_kin, E) = cumulative differential interaction rate
-	std::vector<double> tabE;  //!< electron energy in [J]
+	LogUniformTable tabE;  //!< electron energy in [J]
 	std::vector<double> tabs;  //!< s_kin = s - m^2 in [J**2]
-	std::vector< std::vector<double> > tabCDF;  //!< cumulative interaction rate
+	AliasTable tabCDF;  //!< cumulative interaction rate, one alias table row per energy
 
 public:
 	EMTripletPairProduction(
@@ -44,11 +48,21 @@ public:
 	void setPhotonField(PhotonField photonField);
 	void setHaveElectrons(bool haveElectrons);
 	void setLimit(double limit);
+	/**
+	 Leading particle thinning: if the energy of an interacting particle is
+	 below the given fraction of its source energy, only one of the products
+	 is kept, with a probability proportional to its energy and its weight
+	 increased accordingly (default = 0, no thinning).
+	 */
+	void setThinning(double thinning);
 
 	void initRate(std::string filename);
 	void initCumulativeRate(std::string filename);
 
 	void process(Candidate *candidate) const;
+	int getParticleClasses() const;
+	double interactionRate(const Candidate *candidate) const;
+	void interact(Candidate *candidate) const;
 	void performInteraction(Candidate *candidate) const;
 
 };
@@ -3,6 +3,7 @@
 
 #include "crpropa/Module.h"
 #include "crpropa/PhotonBackground.h"
+#include "crpropa/Random.h"
 
 #include <vector>
 
@@ -15,9 +16,10 @@ namespace crpropa {
 class ElasticScattering: public Module {
 private:
     PhotonField photonField;
+    ref_ptr<PhotonFieldScaling> scaling; ///< cosmological evolution of the photon field
 
     std::vector<double> tabRate; // elastic scattering rate
-    std::vector<std::vector<double> > tabCDF; // CDF as function of background photon energy
+    AliasTable tabCDF; // CDF as function of background photon energy, one alias table row per Lorentz factor
 
     static const double lgmin; // minimum log10(Lorentz-factor)
     static const double lgmax; // maximum log10(Lorentz-factor)
@@ -32,6 +34,7 @@ public:
     void initCDF(std::string filename);
     void setPhotonField(PhotonField photonField);
     void process(Candidate *candidate) const;
+    int getParticleClasses() const;
 };
 
 } // namespace crpropa
@@ -3,6 +3,7 @@
 
 #include "crpropa/Module.h"
 #include "crpropa/PhotonBackground.h"
+#include "crpropa/Random.h"
 
 namespace crpropa {
 
@@ -18,16 +19,25 @@ namespace crpropa {
  This module simulates electron-pair production as a continuous energy loss.\n
  Several photon fields can be selected.\n
  The production of secondary e+/e- pairs and photons can by activated.\n
+ With setSecondaryInterval(n), n > 1, the energy lost to pairs is accumulated
+ over n steps of a candidate and then emitted as one e+/e- pair with the
+ corresponding weight, instead of drawing unit weight pairs in every step.
+ Energy accumulated since the last emission is lost when the candidate stops.\n
  By default, the module limits the step size to 10% of the energy loss length of the particle.
  */
-class ElectronPairProduction: public Module {
+class ElectronPairProduction: public ContinuousLoss {
 private:
 	PhotonField photonField;
+	ref_ptr<PhotonFieldScaling> scaling; ///< cosmological evolution of the photon field
 	std::vector<double> tabLossRate; /*< tabulated energy loss rate in [J/m] for protons at z = 0 */
 	std::vector<double> tabLorentzFactor; /*< tabulated Lorentz factor */
-	std::vector<std::vector<double> > tabSpectrum; /*< electron/positron cdf(Ee|log10(gamma)) for log10(Ee/eV)=7-24 in 170 steps and log10(gamma)=6-13 in 70 steps and*/
+	AliasTable tabSpectrum; /*< electron/positron cdf(Ee|log10(gamma)), one row per log10(gamma)=6-13 in 70 steps, for log10(Ee/eV)=7-24 in 170 steps */
 	double limit; ///< fraction of energy loss length to limit the next step
 	bool haveElectrons;
+	int secondaryInterval; ///< number of steps over which the pair energy is accumulated
+
+	double drawPairEnergy(size_t i) const;
+	void emitPairs(Candidate *candidate, double lf, double dE) const;
 
 public:
 	ElectronPairProduction(PhotonField photonField = CMB, bool haveElectrons =
@@ -36,10 +46,16 @@ public:
 	void setPhotonField(PhotonField photonField);
 	void setHaveElectrons(bool haveElectrons);
 	void setLimit(double limit);
+	/** Emit the pairs of n steps as one weighted pair, 1: unweighted pairs every step */
+	void setSecondaryInterval(int n);
+	int getSecondaryInterval() const;
 
 	void initRate(std::string filename);
 	void initSpectrum(std::string filename);
 	void process(Candidate *candidate) const;
+	int getParticleClasses() const;
+	double energyLossRate(const Candidate *candidate, double E, double z) const;
+	void emitSecondaries(Candidate *candidate, double E, double dE) const;
 
 	/**
 	 Calculates the energy loss length 1/beta = -E dx/dE in [m]
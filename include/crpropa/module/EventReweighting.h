@@ -0,0 +1,78 @@
+#ifndef CRPROPA_EVENTREWEIGHTING_H
+#define CRPROPA_EVENTREWEIGHTING_H
+
+#include "crpropa/module/BinaryOutput.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup Output
+ * @{
+ */
+
+/**
+ @class EventReweighting
+ @brief Observed energy spectra of many source models from one simulation.
+
+ The events of a simulation with a SourcePowerLawSpectrum of the simulated
+ index are reweighted to each parameter point and histogrammed in the
+ observed energy, in one pass over a binary candidate file (BinaryOutput).
+ The weight of an event with the source ID0, energy E0 and redshift z0 at
+ a point of index, cut off rigidity Rcut and source evolution m is
+
+   w * a(ID0) * (E0 / EeV)^(simulatedIndex - index) * exp(-E0 / (Z0 * Rcut)) * (1 + z0)^m
+
+ with w the weight of the candidate, a the abundance of ID0, Z0 its charge
+ number and Rcut an energy per charge as the Rmax of SourceComposition.
+ z0 is the redshift of the comoving distance of the source position to the
+ origin, as in 1D simulations. The records are processed
+ in chunks over all threads, each thread fills its own histograms.
+ */
+class EventReweighting: public Referenced {
+	struct Point {
+		double index, inverseRcut, m;
+	};
+	double simulatedIndex;
+	double lgEmin, lgEmax;
+	size_t nEnergy;
+	std::vector<Point> points;
+	std::map<int, double> abundances; ///< empty: all 1
+	std::vector<double> histograms; ///< [point][energy]
+public:
+	/**
+	 @param simulatedIndex	spectral index of the simulated sources
+	 @param Emin, Emax		range of the observed energy
+	 @param nEnergy			number of logarithmic energy bins
+	 */
+	EventReweighting(double simulatedIndex, double Emin, double Emax,
+			size_t nEnergy);
+
+	/** Add a parameter point, Rcut = 0: no cut off. Returns its number. */
+	size_t addParameterPoint(double index, double Rcut = 0, double m = 0);
+	size_t getNumberOfParameterPoints() const;
+	/** Abundance of a source ID, once set the other IDs have abundance 0 */
+	void setAbundance(int id, double abundance);
+	/** Weight of an event at a point, without the weight of the candidate */
+	double getWeight(size_t point, int id0, double E0, double z0) const;
+
+	/** Add the events of the file, see fill(const BinaryInput&) */
+	void fill(const std::string &filename, size_t chunkSize = 65536);
+	/** Add the events of the binary candidate file, in chunks of records */
+	void fill(const BinaryInput &input, size_t chunkSize = 65536);
+	void clear();
+
+	size_t getNumberOfEnergyBins() const;
+	double getEnergyBinEdge(size_t i) const; ///< i = 0 .. nEnergy
+	/** Summed weights of a point per energy bin */
+	std::vector<double> getHistogram(size_t point) const;
+	/** One line per energy bin: the bin edges in EeV and the summed weight of each point */
+	void save(const std::string &filename) const;
+};
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_EVENTREWEIGHTING_H
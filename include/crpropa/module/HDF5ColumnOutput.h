@@ -0,0 +1,47 @@
+#ifdef CRPROPA_HAVE_HDF5
+
+#ifndef CRPROPA_HDF5COLUMNOUTPUT_H
+#define CRPROPA_HDF5COLUMNOUTPUT_H
+
+#include "crpropa/module/HDF5Output.h"
+
+#include <vector>
+
+namespace crpropa {
+
+/**
+ * \addtogroup Output
+ * @{
+ */
+
+/**
+ @class HDF5ColumnOutput
+ @brief Output to HDF5 Format, one dataset per column.
+
+ Same columns, properties and attributes as HDF5Output, but the group
+ "CRPROPA3" holds one chunked and compressed dataset per column, e.g.
+ "CRPROPA3/E", so that analyses read and decompress only the columns they use.
+ The attributes are attached to the group.
+ */
+class HDF5ColumnOutput: public HDF5Output {
+	std::vector<hid_t> datasets; ///< one per column and property
+	std::vector<hid_t> types; ///< element type of each dataset
+	std::vector<size_t> offsets; ///< offset of each dataset in a packed row
+protected:
+	void createDataset();
+	void writeRows(const std::vector<unsigned char> &rows);
+	void closeDataset();
+public:
+	HDF5ColumnOutput();
+	HDF5ColumnOutput(const std::string &filename);
+	HDF5ColumnOutput(const std::string &filename, OutputType outputtype);
+	~HDF5ColumnOutput();
+	std::string getDescription() const;
+};
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_HDF5COLUMNOUTPUT_H
+
+#endif // CRPROPA_HAVE_HDF5
@@ -4,16 +4,20 @@
 #define CRPROPA_HDF5OUTPUT_H
 
 
+#include "crpropa/Lock.h"
+#include "crpropa/Source.h"
 #include "crpropa/module/Output.h"
+#include "crpropa/module/ParticleCollector.h"
 #include "stdint.h"
 #include <ctime>
+#include <deque>
+#include <vector>
+#include <pthread.h>
 
 #include <H5Ipublic.h>
 
 namespace crpropa {
 
-const size_t propertyBufferSize = 1024;
-
 /**
  * \addtogroup Output
  * @{
@@ -48,53 +52,102 @@ DATASET "OUTPUTTYPE" {
  }
 } } }
 ```
+ HDF5Input reads the file as the source of a next simulation stage.
+
+ The rows hold only the enabled fields and properties, packed without padding.
+ The rows are collected in a staging buffer of each thread, without locking,
+ and handed over in blocks to a writer thread, which collects them into
+ chunks and extends, compresses and writes the dataset while the simulation
+ continues. The queue of blocks
+ is bounded: threads wait when the writer falls behind.
+ flush() and close() write the rows of all threads and must not be called
+ while other threads process candidates.
 
+ With setCollective, all ranks of MPI_COMM_WORLD write into one file with the
+ MPI-IO driver of a parallel HDF5. The writer thread of each rank collects
+ the rows in memory, flush() and close() then write the rows of all ranks
+ with one collective H5Dwrite, each rank at the offset given by the prefix
+ sum of the rows of the lower ranks. open(), flush() and close() are
+ collective, call open() on all ranks before the run and close() before
+ MPI_Finalize. The collective dataset is not compressed, its chunks default
+ to a stripe of about 4 MB of the parallel file system, see setChunkSize, and
+ the random seeds of the threads are not stored, as they differ between the
+ ranks.
  */
 class HDF5Output: public Output {
+	friend class HDF5Input;
+protected:
+	// values of the columns, named as the columns
+	enum ColumnValue {
+		ColD, Colz, ColSN, ColID, ColE, ColX, ColY, ColZ, ColPx, ColPy,
+		ColPz, ColSN0, ColID0, ColE0, ColX0, ColY0, ColZ0, ColP0x, ColP0y, ColP0z,
+		ColSN1, ColID1, ColE1, ColX1, ColY1, ColZ1, ColP1x, ColP1y, ColP1z, Colweight
+	};
+
+	// a column of the enabled fields, at its offset in the packed row
+	struct Column {
+		const char *name;
+		ColumnValue value;
+		hid_t type;
+		size_t offset;
+	};
+
+	hid_t file;
+	hid_t dset; ///< dataset of the rows, location of the attributes
+
+	std::vector<Column> columns; ///< columns of the enabled fields
+	std::vector<hid_t> propertyTypes; ///< types of the properties
+	size_t propertyOffset; ///< offset of the properties in a row
+	size_t rowSize; ///< bytes of a row, without padding
+
+	/// Create the datasets of the columns, called by open
+	virtual void createDataset();
+	/// Append packed rows to the datasets, called by the writer thread
+	virtual void writeRows(const std::vector<unsigned char> &rows);
+	/// Close the datasets, called by close
+	virtual void closeDataset();
+
+private:
+	// rows for the writer thread, flush: flush the file after writing them
+	struct Block {
+		std::vector<unsigned char> rows; // packed rows of rowSize bytes
+		bool flush;
+	};
 
-	typedef struct OutputRow {
-		double D;
-		double z;
-		uint64_t SN;
-		int32_t ID;
-		double E;
-		double X;
-		double Y;
-		double Z;
-		double Px;
-		double Py;
-		double Pz;
-		uint64_t SN0;
-		int32_t ID0;
-		double E0;
-		double X0;
-		double Y0;
-		double Z0;
-		double P0x;
-		double P0y;
-		double P0z;
-		uint64_t SN1;
-		int32_t ID1;
-		double E1;
-		double X1;
-		double Y1;
-		double Z1;
-		double P1x;
-		double P1y;
-		double P1z;
-		double weight;
-		unsigned char propertyBuffer[propertyBufferSize];
-	} OutputRow;
+	// rows of one simulation thread, padded against false sharing
+	struct Staging {
+		Block *block;
+		time_t lastPush;
+		char padding[64];
+	};
 
 	std::string filename;
+	bool collective; ///< MPI-IO, see setCollective
+	size_t chunkRows; ///< rows per chunk, 0: default
+	mutable std::vector<unsigned char> pending; ///< rows of the collective write
 
-	hid_t file, sid;
-	hid_t dset, dataspace;
-	mutable std::vector<OutputRow> buffer;
+	hid_t sid, dataspace;
+	int isOpen; ///< file and writer thread ready, read atomically
+
+	mutable std::vector<Staging> staging; ///< one per thread
+	mutable std::deque<Block *> queue; ///< blocks for the writer thread
+	mutable size_t writing; ///< blocks taken by the writer thread and not yet written
+	mutable pthread_mutex_t mutex; ///< guards queue, writing and stopWriter
+	mutable pthread_cond_t queueChanged;
+	pthread_t writer;
+	bool stopWriter;
 
-	time_t lastFlush;
 	unsigned int flushLimit;
-	unsigned int candidatesSinceFlush;
+	mutable unsigned int candidatesSinceFlush;
+	mutable Lock openLock; ///< of the lazy open in process
+
+	void init();
+	void push(Block *block) const;
+	void pushStaging(Staging &s, bool flush) const;
+	void addColumn(const char *name, ColumnValue value, hid_t type);
+	void packRow(Candidate *candidate, unsigned char *row) const;
+	void writeCollective() const;
+	static void *writerMain(void *output);
 public:
 	HDF5Output();
 	HDF5Output(const std::string &filename);
@@ -111,11 +164,94 @@ public:
 	/// with frequent output this should be set to a high number (default)
 	void setFlushLimit(unsigned int N);
 
+	/// Write one file from all MPI ranks, see above. Throws if CRPropa is
+	/// built without MPI or HDF5 without parallel support. Before open()
+	void setCollective(bool collective);
+	bool isCollective() const;
+	/// Rows per chunk of the dataset, 0: 16384 rows, or about 4 MB for the
+	/// collective dataset. Before open()
+	void setChunkSize(size_t rows);
+	size_t getChunkSize() const; ///< rows per chunk for the enabled fields
+
 	void open(const std::string &filename);
 	void close();
+	/// Write the rows of all threads and flush the file
 	void flush() const;
 
 };
+
+/**
+ Lock of the calls into the HDF5 library from the writer threads of the
+ outputs and the reader threads of the inputs, as HDF5 is not thread safe
+ in its default build.
+ */
+Lock &hdf5Lock();
+
+/**
+ @class HDF5Input
+ @brief Source of the candidates of a HDF5Output file, for multi-stage simulations.
+
+ The rows of the compound dataset are read in hyperslabs of chunkRows rows
+ by a reader thread, which prefetches and converts the next chunks while the
+ candidates of the current one are drawn, so that the next stage starts
+ immediately and streams the file instead of loading it.
+ Each row becomes a candidate with the current, source and created states,
+ trajectory length, redshift, weight and serial number of the columns in the
+ file, in the units of its LengthScale and EnergyScale attributes (default
+ Mpc and EeV). Missing columns keep the defaults of a new candidate, further
+ columns become properties: integers as int64 or uint64, floating point
+ numbers as double and strings.
+ The candidates are drawn in file order, each once. getCandidate returns
+ null after the last row, run the next stage with size() candidates.
+ */
+class HDF5Input: public SourceInterface {
+	struct Column {
+		int value; ///< standard column, -1: property
+		std::string name;
+		size_t offset; ///< in the memory row
+		int kind; ///< 0: double, 1: int64, 2: uint64, 3: string
+		size_t size;
+	};
+	typedef std::vector<ref_ptr<Candidate> > Chunk;
+
+	std::string filename;
+	hid_t file, dset, memoryType;
+	std::vector<Column> columns;
+	size_t rowSize; ///< of the memory row
+	size_t rows;
+	size_t chunkRows;
+	double lengthScale, energyScale;
+
+	mutable pthread_mutex_t mutex; ///< guards the chunks and the position
+	mutable pthread_cond_t changed;
+	mutable std::deque<Chunk *> chunks; ///< prefetched by the reader
+	mutable Chunk current; ///< chunk being drawn, reversed
+	pthread_t reader;
+	bool readerRunning;
+	bool stopReader;
+	bool finished; ///< all rows read
+
+	void readChunk(size_t begin, size_t n, Chunk &chunk) const;
+	static void *readerMain(void *input);
+
+	// not copyable
+	HDF5Input(const HDF5Input &);
+	HDF5Input &operator=(const HDF5Input &);
+public:
+	/// Open the file and start the reader thread, throws if it has no CRPropa dataset
+	HDF5Input(const std::string &filename, size_t chunkRows = 16384);
+	~HDF5Input();
+	/// True if the file is a HDF5 file
+	static bool isHDF5File(const std::string &filename);
+
+	size_t size() const; ///< number of rows
+	ref_ptr<Candidate> getCandidate() const;
+	/// Append the next n candidates, fewer after the last row
+	void getCandidates(size_t n, std::vector<ref_ptr<Candidate> > &candidates) const;
+	/// Append the remaining candidates to the collector
+	void load(ParticleCollector *collector) const;
+	std::string getDescription() const;
+};
 /** @}*/
 
 } // namespace crpropa
@@ -0,0 +1,114 @@
+#ifndef CRPROPA_HISTOGRAMOUTPUT_H
+#define CRPROPA_HISTOGRAMOUTPUT_H
+
+#include "crpropa/Module.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace crpropa {
+class Pixelization;
+/**
+ * \addtogroup Output
+ * @{
+ */
+
+/**
+ @class HistogramOutput
+ @brief Weighted N-dimensional histogram of the detected candidates.
+
+ Replaces the output of events that are only histogrammed afterwards, e.g.
+ spectra per particle type or arrival direction maps.
+ The axes are added before the simulation: binned quantities (energy,
+ distance, ...), linear or logarithmic, a list of particle ids, or HEALPix
+ pixels of the arrival direction (Pixelization, needs the galactic lenses).
+ Each candidate adds its weight to the bin of its current state, candidates
+ outside of any axis are counted as overflow.
+ The bins are accumulated per thread without locking and merged by
+ getHistogram, save and clear, which must not be called while other threads
+ process candidates.
+ */
+class HistogramOutput: public Module {
+public:
+	enum Quantity {
+		Energy, ///< current energy
+		Distance, ///< current distance to the origin
+		TrajectoryLength, ///< comoving trajectory length
+		Redshift, ///< current redshift
+		SourceEnergy, ///< energy at the source
+		SourceDistance, ///< distance of the source to the origin
+		Id, ///< current particle id, see addIdAxis
+		Direction ///< current direction in HEALPix pixels, see addDirectionAxis
+	};
+
+private:
+	struct Axis {
+		Quantity quantity;
+		size_t bins;
+		double min, max;
+		bool logarithmic;
+		std::vector<int> ids;
+		Pixelization *pixelization;
+	};
+	// bins of one thread, padded against false sharing
+	struct ThreadBins {
+		std::vector<double> bins;
+		double overflow;
+		char padding[64];
+	};
+	std::vector<Axis> axes;
+	size_t nBins;
+	mutable std::vector<ThreadBins> threadBins; ///< one per thread
+	mutable std::vector<double> mergedBins;
+	mutable double mergedOverflow;
+
+	void add(const Axis &axis);
+	bool binIndex(const Axis &axis, const Candidate *candidate, size_t &i) const;
+	void merge() const;
+public:
+	HistogramOutput();
+	~HistogramOutput();
+
+	/**
+	 Add an axis of n bins of the quantity from min to max, logarithmically
+	 spaced if log is true.
+	 */
+	void addAxis(Quantity quantity, size_t n, double min, double max,
+			bool log = false);
+	/// Add an axis with one bin per particle id
+	void addIdAxis(const std::vector<int> &ids);
+	/**
+	 Add an axis of the HEALPix pixels (RING scheme) of the given order of the
+	 arrival direction, i.e. the direction the particle comes from.
+	 Throws if CRPropa is built without the galactic lenses.
+	 */
+	void addDirectionAxis(uint8_t order);
+
+	void process(Candidate *candidate) const;
+
+	size_t getNumberOfAxes() const;
+	size_t getNumberOfBins(size_t axis) const;
+	/// Lower edge of bin i of a binned axis
+	double getBinEdge(size_t axis, size_t i) const;
+	/// All bins, the index of the last axis runs fastest
+	const std::vector<double> &getHistogram() const;
+	/// Sum of the bins at the given index of each axis
+	double getBin(const std::vector<size_t> &index) const;
+	/// Summed weight of the candidates outside of the axes
+	double getOverflow() const;
+	/// Reset all bins
+	void clear();
+
+	/**
+	 Write the axes and all nonzero bins as text: one line per bin with the
+	 index of each axis and the summed weight.
+	 */
+	void save(const std::string &filename) const;
+	std::string getDescription() const;
+};
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_HISTOGRAMOUTPUT_H
@@ -0,0 +1,75 @@
+#ifndef CRPROPA_IMPORTANCESAMPLING_H
+#define CRPROPA_IMPORTANCESAMPLING_H
+
+#include "crpropa/Module.h"
+#include "crpropa/Grid.h"
+
+namespace crpropa {
+/**
+ * \addtogroup Tools
+ * @{
+ */
+
+/**
+ @class ImportanceSampling
+ @brief Splitting and Russian roulette towards an observer, for variance reduction.
+
+ The importance of a candidate is the product of
+ - (radius / max(d, radius))^distancePower, d the distance to the center,
+ - ((1 + cos a) / 2)^anglePower, a the angle between the direction and the
+   direction to the center,
+ - the value of an importance grid at the position, if set.
+ Only the level floor(log2(importance)) counts, so that small changes do
+ nothing. When the level of a candidate rises by k, it is split into 2^k
+ candidates (at most setMaxSplitting) of equal weight: the candidate and
+ clones added as its secondaries. When it falls by k, the candidate survives
+ with probability 2^-k and its weight times 2^k, otherwise it is
+ deactivated. The expected weight is unchanged.
+
+ The level is stored in the property ImportanceSampling<N>.level, N the
+ number of the instance, the first step only sets it. Place the module at
+ the end of the module list: the clones start after the step.
+ */
+class ImportanceSampling: public Module {
+	Vector3d center;
+	double radius;
+	double distancePower, anglePower;
+	ref_ptr<ScalarGrid> grid;
+	int maxSplitting;
+	PropertyKey levelKey; ///< of this instance
+public:
+	/**
+	 @param center		center of the observer
+	 @param radius		radius of the observer, inside the importance is highest
+	 @param distancePower	power of the distance importance, 0: off
+	 @param anglePower	power of the angle importance, 0: off
+	 */
+	ImportanceSampling(const Vector3d &center, double radius,
+			double distancePower = 2, double anglePower = 0);
+	void setCenter(const Vector3d &center);
+	const Vector3d &getCenter() const;
+	void setRadius(double radius);
+	double getRadius() const;
+	void setDistancePower(double power);
+	double getDistancePower() const;
+	void setAnglePower(double power);
+	double getAnglePower() const;
+	/** Importance grid, multiplied with the importance of distance and
+	 angle, null to disable. The values must be positive. */
+	void setImportanceGrid(ref_ptr<ScalarGrid> grid);
+	ref_ptr<ScalarGrid> getImportanceGrid() const;
+	/** Maximum number of candidates of one split, a power of 2, default 16 */
+	void setMaxSplitting(int n);
+	int getMaxSplitting() const;
+
+	double getImportance(const Candidate *candidate) const;
+	/** floor(log2(importance)), very low for a vanishing importance */
+	int getLevel(const Candidate *candidate) const;
+	void process(Candidate *candidate) const;
+	std::string getDescription() const;
+};
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_IMPORTANCESAMPLING_H
@@ -0,0 +1,60 @@
+#ifndef CRPROPA_INTERACTIONCOLLECTION_H
+#define CRPROPA_INTERACTIONCOLLECTION_H
+
+#include "crpropa/Module.h"
+
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup EnergyLosses
+ * @{
+ */
+
+/**
+ @class InteractionCollection
+ @brief Several discrete interactions with a single random draw per step.
+
+ Instead of each interaction module drawing its own random interaction
+ distance, the collection sums the interaction rates of all its interactions,
+ draws one distance from the total rate and, if the interaction happens
+ within the step, selects the interaction according to the partial rates.
+ This is statistically equivalent to the separate modules, but needs one
+ random number per step and limits the next step once, to a fraction of the
+ total mean free path.
+ The interactions are not added to the ModuleList themselves. Their
+ interaction bias (Interaction::setInteractionBias) scales their partial rates.
+
+ With setRateTolerance(tol), tol > 0, the total rate is kept in properties
+ of the candidate and only evaluated again when the particle type changes,
+ after an interaction of the collection, or when the energy or (1 + z)
+ changed by more than the relative tolerance since the last evaluation.
+ Particles with negligible interaction rates then cost a property lookup
+ per step instead of the rates of all interactions.
+ */
+class InteractionCollection: public Module {
+	std::vector<ref_ptr<Interaction> > interactions;
+	double limit;
+	double rateTolerance;
+	PropertyKey rateKey, idKey, energyKey, redshiftKey; ///< per instance
+
+	double totalRate(Candidate *candidate, std::vector<double> &rates) const;
+	double cachedTotalRate(Candidate *candidate, std::vector<double> &rates) const;
+public:
+	InteractionCollection(double limit = 0.1);
+	void add(Interaction *interaction);
+	size_t size() const;
+	/** Limit the step to a fraction of the total mean free path */
+	void setLimit(double limit);
+	double getLimit() const;
+	/** Relative change of energy or (1 + z) before the rates are evaluated again, 0: every step */
+	void setRateTolerance(double tolerance);
+	double getRateTolerance() const;
+	void process(Candidate *candidate) const;
+	std::string getDescription() const;
+};
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_INTERACTIONCOLLECTION_H
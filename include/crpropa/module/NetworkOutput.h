@@ -0,0 +1,106 @@
+#ifndef CRPROPA_NETWORKOUTPUT_H
+#define CRPROPA_NETWORKOUTPUT_H
+
+#include "crpropa/module/Output.h"
+
+#include <deque>
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup Output
+ * @{
+ */
+
+/**
+ @class NetworkOutput
+ @brief Stream the rows of an Output over a TCP connection.
+
+ Sends the enabled columns and properties, configured as for TextOutput, as
+ packed binary rows in native byte order, for a live monitor or an analysis
+ service instead of a local file. The stream starts with the magic
+ "CRPSTRM1", a uint32 length and a text header of one line
+ "name type bytes" per field, the types are float64, int32, uint64 or the
+ Variant type of a property. Then batches follow, each a uint32 number of
+ rows, a uint32 number of bytes and the rows. A batch of zero rows ends the
+ stream.
+
+ The rows are collected per thread and handed over in batches to a sender
+ thread. At most setMaxQueuedBatches batches wait in memory: then the
+ threads wait for the sender, or with setDropWhenFull the batches are
+ dropped and counted. A lost connection is reported by the next process().
+ flush() and close() send the rows of all threads and must not be called
+ while other threads process candidates.
+ */
+class NetworkOutput: public Output {
+	enum ColumnValue {
+		ColD, Colz, ColSN, ColID, ColE, ColX, ColY, ColZ, ColPx, ColPy, ColPz,
+		ColSN0, ColID0, ColE0, ColX0, ColY0, ColZ0, ColP0x, ColP0y, ColP0z,
+		ColSN1, ColID1, ColE1, ColX1, ColY1, ColZ1, ColP1x, ColP1y, ColP1z, Colweight
+	};
+	struct Column {
+		const char *name;
+		ColumnValue value;
+		const char *type;
+		size_t size;
+	};
+	// rows of one thread, padded against false sharing
+	struct Staging {
+		std::string rows;
+		char padding[64];
+	};
+
+	std::string host;
+	int port;
+	int fd; ///< socket, -1 when closed
+	int isOpen; ///< header sent and sender running, read atomically
+	std::vector<Column> columns;
+	size_t rowSize;
+	size_t batchRows, maxQueued;
+	bool dropWhenFull;
+
+	mutable std::vector<Staging> staging; ///< one per thread
+	mutable std::deque<std::string *> queue; ///< batches for the sender thread
+	mutable size_t sending; ///< batches taken by the sender and not yet sent
+	mutable size_t droppedRows;
+	mutable bool failed; ///< the connection was lost
+	mutable pthread_mutex_t mutex; ///< guards queue, sending, droppedRows, failed and stop
+	mutable pthread_cond_t queueChanged;
+	pthread_t sender;
+	bool stop;
+
+	void open(); ///< columns, header and sender thread, at the first candidate
+	void addColumn(const char *name, ColumnValue value, const char *type, size_t size);
+	void packRow(Candidate *candidate, std::string &rows) const;
+	void push(std::string *batch) const;
+	bool sendAll(const char *data, size_t size) const;
+	static void *senderMain(void *output);
+public:
+	/// Connect to the host, a name or address, and port, throws if not possible
+	NetworkOutput(const std::string &host, int port, OutputType outputtype = Everything);
+	~NetworkOutput();
+
+	void setBatchSize(size_t rows); ///< rows per batch, default 1024
+	size_t getBatchSize() const;
+	void setMaxQueuedBatches(size_t n); ///< default 64
+	size_t getMaxQueuedBatches() const;
+	/// Drop batches if the queue is full, instead of waiting for the sender
+	void setDropWhenFull(bool drop);
+	size_t getDroppedRows() const;
+	size_t getRowSize() const; ///< bytes of a row, after the first candidate
+
+	void process(Candidate *candidate) const;
+	/// Send the rows of all threads
+	void flush() const;
+	/// Send the rows of all threads, end the stream and close the connection
+	void close();
+	std::string getDescription() const;
+};
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_NETWORKOUTPUT_H
@@ -21,7 +21,7 @@ namespace crpropa {
 
  For details on the preprocessing of the NuDat2 data refer to "CRPropa3-data/calc_decay.py".
  */
-class NuclearDecay: public Module {
+class NuclearDecay: public Interaction {
 private:
 	double limit;
 	bool haveElectrons;
@@ -30,10 +30,27 @@ private:
 	struct DecayMode {
 		int channel; // (#beta- #beta+ #alpha #proton #neutron)
 		double rate; // decay rate in [1/m]
-		std::vector<double> energy; // photon energies of ensuing gamma decays
-		std::vector<double> intensity; // probabilities of ensuing gamma decays
+		size_t gammaBegin, gammaEnd; // ensuing gamma decays in tabGamma
 	};
-	std::vector<std::vector<DecayMode> > decayTable; // decayTable[Z * 31 + N] = vector<DecayMode>
+	// decay modes sorted by nucleus, in the order of the file: the modes of
+	// nucleus Z * 31 + N are decayBegin[Z * 31 + N] to decayBegin[Z * 31 + N + 1]
+	std::vector<DecayMode> decayModes;
+	std::vector<size_t> decayBegin;
+	std::vector<double> tabGamma; // photon energy and probability of each gamma decay, pairwise
+	std::vector<double> tabTotalRate; // sum of the decay rates of each isotope in [1/m]
+	struct BetaSpectrum {
+		double Q; // Q-value of the decay
+		size_t begin; // n cdf values of the electron energy (unnormalized) in
+		size_t n; // tabBetaSpectra, followed by the n total electron energies
+	};
+	// electron / positron spectra of the nuclei reached by the decay channels, [Z * 31 + N]
+	std::vector<BetaSpectrum> tabBetaMinus;
+	std::vector<BetaSpectrum> tabBetaPlus;
+	std::vector<double> tabBetaSpectra;
+
+	void initBetaSpectra();
+	void performDecay(Candidate *candidate, const DecayMode &decay) const;
+	void gammaEmission(Candidate *candidate, const DecayMode &decay) const;
 
 public:
 	NuclearDecay(bool electrons = false, bool photons = false, bool neutrinos = false, double limit = 0.1);
@@ -42,6 +59,9 @@ public:
 	void setHavePhotons(bool b);
 	void setHaveNeutrinos(bool b);
 	void process(Candidate *candidate) const;
+	int getParticleClasses() const;
+	double interactionRate(const Candidate *candidate) const;
+	void interact(Candidate *candidate) const;
 	void performInteraction(Candidate *candidate, int channel) const;
 	void gammaEmission(Candidate *candidate, int channel) const;
 	void betaDecay(Candidate *candidate, bool isBetaPlus) const;
@@ -11,6 +11,7 @@
 #include "../Referenced.h"
 #include "../Vector3.h"
 #include "../Geometry.h"
+#include "../Source.h"
 
 namespace crpropa {
 
@@ -32,6 +33,27 @@ public:
 	virtual DetectionState checkDetection(Candidate *candidate) const;
 	virtual void onDetection(Candidate *candidate) const;
 	virtual std::string getDescription() const;
+	/**
+	 Axis-aligned box around all positions the feature can detect a
+	 candidate at or limit its step in, for the spatial index of Observer.
+	 Returns false for features without bounds (default), which are
+	 checked in each step.
+	 */
+	virtual bool getBounds(Vector3d &lower, Vector3d &upper) const;
+	/**
+	 True for features that only veto, e.g. by the particle type, and
+	 neither detect nor limit the step. Observer checks them first and skips
+	 the other features of a vetoed candidate. Default false.
+	 */
+	virtual bool isVeto() const;
+	/**
+	 Trajectory length the candidate has to travel at least before the
+	 feature can detect it, e.g. its distance to a surface, for
+	 Observer::setDetectionHints. 0 (default) if unknown.
+	 */
+	virtual double getDetectionHint(Candidate *candidate) const;
+	/** Type and parameters for ConfigurationDocument, the default throws */
+	virtual void getConfiguration(Configuration &configuration) const;
 };
 
 /**
@@ -39,21 +61,71 @@ public:
  @brief General cosmic ray observer
  */
 class Observer: public Module {
-	std::string flagKey;
+	PropertyKey flagKey;
 	std::string flagValue;
 private:
 	std::vector<ref_ptr<ObserverFeature> > features;
+	std::vector<size_t> vetoes, detectors; ///< indices of the features
 	ref_ptr<Module> detectionAction;
 	bool clone;
 	bool makeInactive;
+	bool hints;
+	PropertyKey hintKey; ///< trajectory length of the next check, of this instance
+
+	// uniform grid of the features with bounds, see setSpatialIndex
+	struct SpatialIndex {
+		Vector3d lower, upper; ///< bounds of all indexed features
+		double cellSize;
+		int n[3]; ///< number of cells per axis
+		std::vector<size_t> cellStart; ///< features of cell i: cellFeatures[cellStart[i]:cellStart[i+1]]
+		std::vector<size_t> cellFeatures;
+		std::vector<int> featureCells; ///< first and last cell of each feature (6 indices)
+		std::vector<size_t> unbounded; ///< features checked in each step
+	};
+	double indexCellSize;
+	mutable SpatialIndex index;
+	mutable int indexBuilt; // only set under a lock
+	void buildIndex() const;
+	DetectionState checkIndexed(Candidate *candidate) const;
 public:
 	Observer();
 	void add(ObserverFeature *feature);
+	/**
+	 Check only the features near the last step of a candidate, for
+	 observers with many features (e.g. ObserverSmallSphere or spheres and
+	 boxes of ObserverSurface). Features with bounds (getBounds) are sorted
+	 into a uniform grid of the given cell size, the others are checked in
+	 each step as before. Far features do not limit the step of the
+	 candidate, instead the observer limits it to the larger of the cell
+	 size and the distance to the bounds of all features.
+	 A cell size of 0 (default) checks all features in each step.
+	 */
+	void setSpatialIndex(double cellSize);
+	double getSpatialIndex() const;
+	/**
+	 Skip the features while no feature can detect the candidate. After a
+	 step without detection the smallest ObserverFeature::getDetectionHint
+	 of the features that are no veto is stored in the candidate property
+	 Observer<N>.hint, N the number of the instance. The features are not
+	 checked until the candidate has travelled so far, the step is limited
+	 to reach that length. Only used without spatial index, and only if all
+	 features give a hint. Off by default.
+	 */
+	void setDetectionHints(bool hints);
+	bool getDetectionHints() const;
+	/**
+	 Action for the detected candidates. With clone, the action gets a snapshot
+	 of the candidate before the flag is set and it is deactivated. The snapshot
+	 is reused for the next detections of the thread unless the action keeps a
+	 reference to it, e.g. a ParticleCollector, so that outputs need no copy of
+	 their own.
+	 */
 	void onDetection(Module *action, bool clone = false);
 	void process(Candidate *candidate) const;
 	std::string getDescription() const;
 	void setFlag(std::string key, std::string value);
 	void setDeactivateOnDetection(bool deactivate);
+	void getConfiguration(Configuration &configuration) const;
 };
 
 
@@ -66,20 +138,29 @@ class ObserverDetectAll: public ObserverFeature {
 public:
 	DetectionState checkDetection(Candidate *candidate) const;
 	std::string getDescription() const;
+	void getConfiguration(Configuration &configuration) const;
 };
 
 
 /**
  @class ObserverSurface
  @brief Detects particles crossing the durface
+
+ The next step is limited to the distance to the surface. With setRayStep
+ neutral particles, which move on straight lines, may instead step up to the
+ crossing of their ray with the surface (Surface::intersection).
  */
 class ObserverSurface: public ObserverFeature {
 	private:
 		ref_ptr<Surface> surface;
+		bool rayStep;
 
 	public:
 		ObserverSurface(Surface* _surface);
+		void setRayStep(bool rayStep);
 		DetectionState checkDetection(Candidate *candidate) const;
+		double getDetectionHint(Candidate *candidate) const;
+		bool getBounds(Vector3d &lower, Vector3d &upper) const;
 		std::string getDescription() const;
 };
 
@@ -94,9 +175,12 @@ private:
 public:
 	ObserverSmallSphere(Vector3d center = Vector3d(0.), double radius = 0);
 	DetectionState checkDetection(Candidate *candidate) const;
+	double getDetectionHint(Candidate *candidate) const;
+	bool getBounds(Vector3d &lower, Vector3d &upper) const;
 	void setCenter(const Vector3d &center);
 	void setRadius(float radius);
 	std::string getDescription() const;
+	void getConfiguration(Configuration &configuration) const;
 };
 
 /**
@@ -111,6 +195,8 @@ private:
 public:
 	ObserverTracking(Vector3d center, double radius, double stepSize = 0);
 	DetectionState checkDetection(Candidate *candidate) const;
+	double getDetectionHint(Candidate *candidate) const;
+	bool getBounds(Vector3d &lower, Vector3d &upper) const;
 	std::string getDescription() const;
 };
 
@@ -125,7 +211,9 @@ private:
 public:
 	ObserverLargeSphere(Vector3d center = Vector3d(0.), double radius = 0);
 	DetectionState checkDetection(Candidate *candidate) const;
+	double getDetectionHint(Candidate *candidate) const;
 	std::string getDescription() const;
+	void getConfiguration(Configuration &configuration) const;
 };
 
 /**
@@ -138,7 +226,9 @@ public:
 class ObserverPoint: public ObserverFeature {
 public:
 	DetectionState checkDetection(Candidate *candidate) const;
+	double getDetectionHint(Candidate *candidate) const;
 	std::string getDescription() const;
+	void getConfiguration(Configuration &configuration) const;
 };
 
 /**
@@ -151,7 +241,9 @@ private:
 public:
 	ObserverRedshiftWindow(double zmin = 0, double zmax = 0.1);
 	DetectionState checkDetection(Candidate *candidate) const;
+	bool isVeto() const;
 	std::string getDescription() const;
+	void getConfiguration(Configuration &configuration) const;
 };
 
 /**
@@ -161,7 +253,9 @@ public:
 class ObserverInactiveVeto: public ObserverFeature {
 public:
 	DetectionState checkDetection(Candidate *candidate) const;
+	bool isVeto() const;
 	std::string getDescription() const;
+	void getConfiguration(Configuration &configuration) const;
 };
 
 /**
@@ -171,7 +265,9 @@ public:
 class ObserverNucleusVeto: public ObserverFeature {
 public:
 	DetectionState checkDetection(Candidate *candidate) const;
+	bool isVeto() const;
 	std::string getDescription() const;
+	void getConfiguration(Configuration &configuration) const;
 };
 
 /**
@@ -181,7 +277,9 @@ public:
 class ObserverNeutrinoVeto: public ObserverFeature {
 public:
 	DetectionState checkDetection(Candidate *candidate) const;
+	bool isVeto() const;
 	std::string getDescription() const;
+	void getConfiguration(Configuration &configuration) const;
 };
 
 /**
@@ -191,7 +289,9 @@ public:
 class ObserverPhotonVeto: public ObserverFeature {
 public:
 	DetectionState checkDetection(Candidate *candidate) const;
+	bool isVeto() const;
 	std::string getDescription() const;
+	void getConfiguration(Configuration &configuration) const;
 };
 
 /**
@@ -201,6 +301,27 @@ public:
 class ObserverElectronVeto: public ObserverFeature {
 public:
 	DetectionState checkDetection(Candidate *candidate) const;
+	bool isVeto() const;
+	std::string getDescription() const;
+	void getConfiguration(Configuration &configuration) const;
+};
+
+/**
+ @class ObserverSourceEfficiency
+ @brief Learns the detection efficiency of the sources of an AdaptiveSourceSampling
+
+ Adds the weights of the detected pilot candidates, and of their secondaries,
+ to the efficiency of their source, see SourceList::setAdaptive. It never
+ detects or vetoes, add it to the observers whose detections count.
+ */
+class ObserverSourceEfficiency: public ObserverFeature {
+	ref_ptr<AdaptiveSourceSampling> sampling;
+public:
+	ObserverSourceEfficiency(AdaptiveSourceSampling *sampling);
+	DetectionState checkDetection(Candidate *candidate) const;
+	void onDetection(Candidate *candidate) const;
+	/// Checked with the vetoes, so that it does not disable detection hints
+	bool isVeto() const;
 	std::string getDescription() const;
 };
 
@@ -208,6 +329,9 @@ public:
  @class ObserverTimeEvolution
  @brief Observes the time evolution of the candidates (phase-space elements)
  This observer is very useful if the time evolution of the particle density is needed. It detects all candidates in regular timeintervals and limits the nextStep of candidates to prevent overshooting of detection intervals.
+ The detection lengths are kept sorted, the number of lengths a candidate
+ has passed is stored in its property DetectionIndex and the next one is
+ found by binary search. A step that passes several lengths detects once.
  */
 class ObserverTimeEvolution: public ObserverFeature {
 private:
@@ -218,7 +342,9 @@ public:
   void addTime(const double &position);
   const std::vector<double>& getTimes() const;
   DetectionState checkDetection(Candidate *candidate) const;
+  double getDetectionHint(Candidate *candidate) const;
   std::string getDescription() const;
+  void getConfiguration(Configuration &configuration) const;
 };
 /** @} */
 
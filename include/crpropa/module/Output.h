@@ -3,6 +3,7 @@
 
 #include "crpropa/Module.h"
 #include "crpropa/Variant.h"
+#include "crpropa/module/OutputFilter.h"
 
 #include <bitset>
 #include <vector>
@@ -22,6 +23,7 @@ protected:
 	struct Property
 	{
 		std::string name;
+		PropertyKey key; ///< interned name, for the lookup in the candidate
 		std::string comment;
 		Variant defaultValue;
 	};
@@ -29,6 +31,7 @@ protected:
 
 	bool oneDimensional;
 	mutable size_t count;
+	ref_ptr<OutputFilter> filter; ///< of the candidates, 0: all
 
 	void modify();
 
@@ -81,6 +84,16 @@ public:
 	void set1D(bool value);
 	size_t size() const;
 
+	/// Write only the candidates for which the expression is true, see
+	/// OutputFilter. Evaluated before the row is formatted, an empty
+	/// expression writes all candidates.
+	void setFilter(const std::string &expression);
+	std::string getFilter() const;
+	/// True if the candidate passes the filter
+	bool accepts(const Candidate *candidate) const {
+		return !filter || filter->accepts(candidate);
+	}
+
 	void process(Candidate *) const;
 };
 
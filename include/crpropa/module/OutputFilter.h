@@ -0,0 +1,66 @@
+#ifndef CRPROPA_OUTPUTFILTER_H
+#define CRPROPA_OUTPUTFILTER_H
+
+#include "crpropa/Candidate.h"
+#include "crpropa/Referenced.h"
+
+#include <string>
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup Output
+ * @{
+ */
+
+/**
+ @class OutputFilter
+ @brief Predicate on the candidates of an Output, compiled from an expression.
+
+ The expression compares values of the candidate, e.g.
+ "E > 10 EeV and (ID == 22 or abs(ID) == 11)". It supports the comparisons
+ < <= > >= == !=, and, or and not (also && || !), + - * /,
+ abs() and parentheses. Numbers can have an energy or length unit: eV, keV,
+ MeV, GeV, TeV, PeV, EeV, cm, m, km, pc, kpc, Mpc or Gpc, values are in
+ SI units. The values are named as the columns of the outputs:
+ D (trajectory length), z (redshift), weight, and ID, E, X, Y, Z, Px, Py, Pz,
+ R (distance from the origin), A (mass number) and charge of the current
+ particle, with the suffix 0 of the source and 1 of the created particle,
+ e.g. E0 or R1. Other names, or names in double quotes, are numeric
+ candidate properties. A missing property is NaN, so every comparison but
+ != with it is false. The expression is parsed once, an error in it throws.
+ */
+class OutputFilter: public Referenced {
+public:
+	enum Value {
+		ValueD, Valuez, Valueweight,
+		ValueID, ValueE, ValueX, ValueY, ValueZ, ValuePx, ValuePy, ValuePz, ValueR, ValueA, ValueCharge,
+		ValueID0, ValueE0, ValueX0, ValueY0, ValueZ0, ValueP0x, ValueP0y, ValueP0z, ValueR0, ValueA0, ValueCharge0,
+		ValueID1, ValueE1, ValueX1, ValueY1, ValueZ1, ValueP1x, ValueP1y, ValueP1z, ValueR1, ValueA1, ValueCharge1
+	};
+private:
+	enum Code {
+		PushNumber, PushValue, PushProperty, Abs, Negate, Add, Subtract, Multiply,
+		Divide, Less, LessEqual, Greater, GreaterEqual, Equal, NotEqual, And, Or, Not
+	};
+	struct Instruction {
+		Code code;
+		double number;
+		Value value;
+		PropertyKey key;
+	};
+	std::string expression;
+	std::vector<Instruction> program; ///< postfix
+
+	class Parser;
+	static double getValue(const Candidate *candidate, Value value);
+public:
+	OutputFilter(const std::string &expression);
+	bool accepts(const Candidate *candidate) const;
+	const std::string &getExpression() const;
+};
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_OUTPUTFILTER_H
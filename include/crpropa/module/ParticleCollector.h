@@ -4,9 +4,15 @@
 #include <string>
 
 #include "crpropa/Module.h"
+#include "crpropa/Lock.h"
+#include "crpropa/MemoryAccounting.h"
 #include "crpropa/ModuleList.h"
 
 namespace crpropa {
+
+class BinaryOutput;
+class BinaryInput;
+
 /**
  * \addtogroup Tools
  * \addtogroup Output
@@ -16,6 +22,15 @@ namespace crpropa {
 /**
  @class ParticleCollector
  @brief A helper ouput mechanism to keep candidates in-memory and directly transfer them to Python
+
+ With setSpillLimit, candidates beyond the limit are written to a temporary
+ binary file (BinaryOutput) instead of memory. size(), operator[], getAll()
+ and reprocess() include them, the iterators cover the candidates in memory
+ only. Spilled candidates are new copies each time they are accessed.
+
+ Each thread collects into its own container without locking, they are merged
+ in no particular order when the candidates are accessed, which must not happen
+ while other threads process candidates.
  */
 class ParticleCollector: public Module {
 protected:
@@ -25,6 +40,28 @@ protected:
 	bool clone;
 	bool recursive;
 
+	std::size_t spillLimit; ///< candidates kept in memory
+	mutable ref_ptr<BinaryOutput> spill; ///< further candidates
+	mutable std::string spillFilename;
+	mutable std::size_t spilled; ///< number of candidates in the spill file
+	mutable ref_ptr<BinaryInput> spillInput; ///< mapped spill file, 0 if outdated
+
+	const BinaryInput &getSpilled() const;
+	void removeSpill();
+
+	// candidates of one thread, padded against false sharing
+	struct ThreadContainer {
+		tContainer candidates;
+		char padding[64];
+	};
+	mutable std::vector<ThreadContainer> threadContainers;
+	mutable std::size_t collected; ///< candidates given to process, for the spill limit
+	mutable Lock lock; ///< of the shared container and the spill file
+	mutable MemoryAccount memory; ///< of the container and the kept candidates
+
+	void merge() const;
+	void updateMemory(std::size_t kept) const;
+
 public:
         ParticleCollector();
         ParticleCollector(const std::size_t nBuffer);
@@ -34,8 +71,12 @@ public:
 
         void process(Candidate *candidate) const;
 	void process(ref_ptr<Candidate> c) const;
+	/** Process all candidates with the action, over all threads and in no
+	 particular order: the action must be thread-safe, like the outputs. */
 	void reprocess(Module *action) const;
-	void dump(const std::string &filename) const;
+	/// Write the candidates to a text file, or a binary file (BinaryOutput)
+	void dump(const std::string &filename, bool binary = false) const;
+	/// Append the candidates of a text or binary file
 	void load(const std::string &filename);
 
         std::size_t size() const;
@@ -44,8 +85,21 @@ public:
 
 	std::string getDescription() const;
 	std::vector<ref_ptr<Candidate> > getAll() const;
+	/** Values of the given columns of all candidates, filled in one pass.
+	 The columns are named as in the header of TextOutput: D, z, SN, ID, E,
+	 X, Y, Z, Px, Py, Pz and W, with 0 (at the source) or 1 (at the point of
+	 creation) for the initial states, e.g. E0 or P1x. The values are in SI
+	 units. Other names are properties of the candidates, NaN if missing.
+	 @param columns	names of the columns
+	 @param data	size() * columns.size() values to fill, one row per candidate
+	 */
+	void getColumns(const std::vector<std::string> &columns, double *data) const;
+	std::vector<double> getColumns(const std::vector<std::string> &columns) const;
 	void setClone(bool b);
 	bool getClone() const;
+	/// Keep at most n candidates in memory, write further ones to a temporary file
+	void setSpillLimit(std::size_t n);
+	std::size_t getSpillLimit() const;
 
 	/** iterator goodies */
         typedef tContainer::iterator iterator;
@@ -57,10 +111,18 @@ public:
 
 	/**
 	 Retrieves the trajectory of a detected particle
-	 Procedure: takes the initial state of the particle, re-runs the ModuleList for that particle and captures trajectory
+	 Procedure: takes the initial state of the particle, re-runs the ModuleList for that particle and captures trajectory.
+	 With counter-based random streams (ModuleList::setCounterBasedRandom)
+	 the candidate is replayed with the random numbers of the simulation, so
+	 that the trajectory is exactly that of the detected particle.
 	*/
 	void getTrajectory(ModuleList *mlist, std::size_t i, Module *output) const;
 	void getTrajectory(ref_ptr<ModuleList> mlist, std::size_t i, ref_ptr<Module> output) const;
+	/** Trajectories of several particles as getTrajectory, re-run over all
+	 threads. The output must be thread-safe and receives the steps of the
+	 particles interleaved. */
+	void getTrajectories(ModuleList *mlist, const std::vector<std::size_t> &indices, Module *output) const;
+	void getTrajectories(ref_ptr<ModuleList> mlist, const std::vector<std::size_t> &indices, ref_ptr<Module> output) const;
 };
 /** @}*/
 
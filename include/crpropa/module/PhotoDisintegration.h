@@ -3,6 +3,8 @@
 
 #include "crpropa/Module.h"
 #include "crpropa/PhotonBackground.h"
+#include "crpropa/DataTable.h"
+#include "crpropa/MemoryAccounting.h"
 
 #include <vector>
 #include <map>
@@ -16,26 +18,71 @@ namespace crpropa {
 /**
  @class PhotoDisintegration
  @brief Photodisintegration of nuclei by background photons.
+
+ The interaction tables are shared by all instances in a process that use
+ the same data files, and values are only read for the nuclei that occur.
+
+ With setOpticalDepth(true), each candidate draws an exponential optical depth
+ once, kept in a property of the candidate, which each step reduces by
+ rate * step. The interaction happens where it reaches zero, after which a new
+ optical depth is drawn. The next step is limited to the remaining distance
+ to the interaction at the current rate, but not below the limit fraction of
+ the mean free path, so that steps far from an interaction can be long.
  */
-class PhotoDisintegration: public Module {
+class PhotoDisintegration: public Interaction {
 private:
 	PhotonField photonField;
+	ref_ptr<PhotonFieldScaling> scaling; ///< cosmological evolution of the photon field
 	double limit; // fraction of mean free path for limiting the next step
 	bool havePhotons;
+	bool useOpticalDepth; // accumulate the optical depth instead of drawing a distance each step
+	PropertyKey opticalDepthKey; // remaining optical depth of a candidate, per instance
 
-	struct Branch {
-		int channel; // number of emitted (n, p, H2, H3, He3, He4)
-		std::vector<double> branchingRatio; // branching ratio as function of nucleus Lorentz factor
-	};
+	void processOpticalDepth(Candidate *candidate) const;
 
-	struct PhotonEmission {
-		double energy; // energy of emitted photon [J]
-		std::vector<double> emissionProbability; // emission probability as function of nucleus Lorentz factor
+	/**
+	 Rows of an interaction data file for each nucleus or, for the photon
+	 emission, for each pair of mother and daughter nucleus.
+	 The index is immutable once built, lookups need no locking.
+	 The values are read from the DataTable when used, all instances that
+	 read the same file share one index (see openTable).
+	 */
+	struct TableIndex: public Referenced {
+		ref_ptr<DataTable> table;
+		// rows of nucleus Z * 31 + N, in the order of the file:
+		// rowBegin[Z * 31 + N] to rowBegin[Z * 31 + N + 1] in row
+		std::vector<size_t> rowBegin;
+		std::vector<size_t> row;
+		size_t rowCount(size_t nucleus) const {
+			return rowBegin[nucleus + 1] - rowBegin[nucleus];
+		}
+		const size_t *rowsOf(size_t nucleus) const {
+			return row.empty() ? 0 : &row[0] + rowBegin[nucleus];
+		}
+		// photon emissions of nucleus Z * 31 + N: emissionBegin[Z * 31 + N] to
+		// emissionBegin[Z * 31 + N + 1] in emissionDaughter (Zd * 31 + Nd, sorted) and emissionRow
+		std::vector<size_t> emissionBegin;
+		std::vector<int> emissionDaughter;
+		std::vector<size_t> emissionRow;
+		// branchings: the channels of nucleus Z * 31 + N are branchChannel[branchBegin[Z * 31 + N] + c],
+		// their normalised cumulative ratios at tabulation point l are
+		// branchCumulative[branchBegin[Z * 31 + N] * nlg + l * channels + c]
+		std::vector<size_t> branchBegin;
+		std::vector<int> branchChannel;
+		std::vector<double> branchCumulative;
+		MemoryAccount memory; // of the index, the table accounts for itself
+		TableIndex() : memory("PhotoDisintegration") {}
 	};
 
-	std::vector<std::vector<double> > pdRate; // pdRate[Z * 31 + N] = total interaction rate
-	std::vector<std::vector<Branch> > pdBranch; // pdTable[Z * 31 + N] = branching ratios
-	mutable std::map<int, std::vector<PhotonEmission> > pdPhoton; // map of emitted photon energies and photon emission probabilities
+	ref_ptr<TableIndex> pdRate; // rows: Z, N, total interaction rate [1/Mpc]
+	ref_ptr<TableIndex> pdBranch; // rows: Z, N, channel (number of emitted n, p, H2, H3, He3, He4), branching ratios
+	ref_ptr<TableIndex> pdPhoton; // rows: Z, N, Zd, Nd, photon energy [eV], emission probabilities
+
+	enum TableKind {
+		RateTable, BranchingTable, EmissionTable
+	};
+	static ref_ptr<TableIndex> openTable(const std::string &filename,
+			size_t columns, TableKind kind);
 
 	static const double lgmin; // minimum log10(Lorentz-factor)
 	static const double lgmax; // maximum log10(Lorentz-factor)
@@ -47,12 +94,17 @@ public:
 	void setPhotonField(PhotonField photonField);
 	void setHavePhotons(bool havePhotons);
 	void setLimit(double limit);
+	/** Keep one optical depth per candidate instead of drawing an interaction distance each step */
+	void setOpticalDepth(bool b);
 
 	void initRate(std::string filename);
 	void initBranching(std::string filename);
 	void initPhotonEmission(std::string filename);
 
 	void process(Candidate *candidate) const;
+	int getParticleClasses() const;
+	double interactionRate(const Candidate *candidate) const;
+	void interact(Candidate *candidate) const;
 	void performInteraction(Candidate *candidate, int channel) const;
 
 	/**
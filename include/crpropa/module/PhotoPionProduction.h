@@ -2,6 +2,7 @@
 #define CRPROPA_PHOTOPIONPRODUCTION_H
 
 #include "crpropa/Module.h"
+#include "crpropa/Common.h"
 #include "crpropa/PhotonBackground.h"
 
 #include <vector>
@@ -16,10 +17,11 @@ namespace crpropa {
  @class PhotoPionProduction
  @brief Photo-pion interactions of nuclei with background photons.
  */
-class PhotoPionProduction: public Module {
+class PhotoPionProduction: public Interaction {
 protected:
 	PhotonField photonField;
-	std::vector<double> tabLorentz; ///< Lorentz factor of nucleus
+	ref_ptr<PhotonFieldScaling> scaling; ///< cosmological evolution of the photon field
+	LogUniformTable tabLorentz; ///< Lorentz factor of nucleus
 	std::vector<double> tabRedshifts;  ///< redshifts (optional for haveRedshiftDependence)
 	std::vector<double> tabProtonRate; ///< interaction rate in [1/m] for protons
 	std::vector<double> tabNeutronRate; ///< interaction rate in [1/m] for neutrons
@@ -30,6 +32,27 @@ protected:
 	bool haveAntiNucleons;
 	bool haveRedshiftDependence;
 
+	// optional table of SOPHIA events for sampling the secondaries
+	size_t tabEventsPerEnergy; ///< number of tabulated events per nucleon type and energy
+	std::vector<size_t> tabEventOffset; ///< first secondary of each event, size = events + 1
+	std::vector<int> tabSecondaryType; ///< SOPHIA particle type of the secondaries
+	std::vector<float> tabSecondaryFraction; ///< energy of the secondaries / nucleon energy
+
+	// last mean free path per thread and nucleon type, for repeated evaluations
+	// and as a starting point for the search of the interpolation cell
+	struct RateCache {
+		double gamma, z, mfp; ///< last evaluation
+		size_t i, j; ///< interpolation cell in tabLorentz and tabRedshifts
+		bool valid;
+		char padding[64 - 3 * sizeof(double) - 2 * sizeof(size_t) - sizeof(bool)]; ///< one cache line per entry
+	};
+	mutable std::vector<RateCache> rateCache;
+	void clearRateCache();
+
+	void buildSecondaryTable(size_t eventsPerEnergy);
+	bool loadSecondaryTable(std::string filename, size_t eventsPerEnergy);
+	void saveSecondaryTable(std::string filename) const;
+
 public:
 	PhotoPionProduction(
 		PhotonField photonField = CMB,
@@ -47,9 +70,33 @@ public:
 	void setHaveRedshiftDependence(bool b);
 	void setLimit(double limit);
 	void initRate(std::string filename);
+
+	/**
+	 Sample the interaction products from a table of SOPHIA events instead of
+	 generating a new event for each interaction.
+	 The table holds eventsPerEnergy events for protons and neutrons at 10
+	 nucleon energies per decade, from the energy threshold to 1e23 eV, and
+	 an interaction picks one of the events of the neighboring energies.
+	 The energies of the secondaries scale with the nucleon energy, the
+	 redshift enters as for the interaction rates through E (1 + z).
+	 Building the table is parallelized with OpenMP.
+	 @param eventsPerEnergy	number of tabulated events per nucleon type and energy
+	 @param filename	cache file: the table is read from it if present and
+						matching, otherwise built and written to it
+	 */
+	void initSecondaryTable(size_t eventsPerEnergy = 1000, std::string filename = "");
+	/// Generate a SOPHIA event for each interaction again (default)
+	void clearSecondaryTable();
+	bool haveSecondaryTable() const;
+
 	double nucleonMFP(double gamma, double z, bool onProton) const;
+	/** Rate of interactions of the candidate on its protons or neutrons in [1/m] */
+	double nucleonRate(const Candidate *candidate, bool onProton) const;
 	double nucleiModification(int A, int X) const;
 	void process(Candidate *candidate) const;
+	int getParticleClasses() const;
+	double interactionRate(const Candidate *candidate) const;
+	void interact(Candidate *candidate) const;
 	void performInteraction(Candidate *candidate, bool onProton) const;
 
 	/**
@@ -60,6 +107,12 @@ public:
 	 @param z		redshift
 	 */
 	double lossLength(int id, double gamma, double z = 0);
+
+	/**
+	 Total cross section of SOPHIA in [m^2] of a proton (onProton) or neutron
+	 with a photon of energy eps [J] in the rest frame of the nucleon.
+	 */
+	static double nucleonCrossSection(double eps, bool onProton);
 };
 /** @}*/
 
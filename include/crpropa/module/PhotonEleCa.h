@@ -2,6 +2,7 @@
 #define CRPROPA_PHOTONELECA_H
 
 #include "crpropa/Module.h"
+#include "crpropa/Lock.h"
 #include "crpropa/magneticField/MagneticField.h"
 #include "crpropa/Referenced.h"
 
@@ -21,6 +22,7 @@ private:
 	mutable std::ofstream output;
 	Vector3d observer;
 	bool saveOnlyPhotonEnergies;
+	mutable Lock lock; ///< of the output file
 public:
 	PhotonEleCa(const std::string background, const std::string &outputFilename);
 	~PhotonEleCa();
@@ -2,8 +2,10 @@
 #define CRPROPA_PHOTON_OUTPUT_H
 
 #include "crpropa/Module.h"
+#include "crpropa/Lock.h"
 
 #include <fstream>
+#include <stdint.h>
 
 namespace crpropa {
 /**
@@ -11,16 +13,40 @@ namespace crpropa {
  * @{
  */
 
+/**
+ Photon, electron or positron in a binary PhotonOutput1D file, with the
+ energies in [EeV] and the comoving distances in [Mpc] as in the text files.
+ The records follow the 8 byte magic "CRPPHOT1" in native byte order.
+ */
+struct PhotonRecord1D {
+	int32_t id;
+	int32_t parentId;
+	int32_t sourceId;
+	int32_t reserved;
+	double energy;
+	double distance;       ///< distance to the observer
+	double parentEnergy;
+	double sourceEnergy;
+	double sourceDistance;
+};
+
+/// Magic at the beginning of binary PhotonOutput1D files
+extern const char PhotonOutput1DMagic[8];
+
 class PhotonOutput1D: public Module {
 private:
 	std::ostream *out;
 	std::string filename;
 	mutable std::ofstream outfile;
+	bool binary;
+	mutable Lock lock; ///< of the stream
 
 public:
 	PhotonOutput1D();
 	PhotonOutput1D(std::ostream &out);
-	PhotonOutput1D(const std::string &filename);
+	/// With binary, the photons are written as PhotonRecord1D, which
+	/// the photon propagation reads much faster than the text files
+	PhotonOutput1D(const std::string &filename, bool binary = false);
 	~PhotonOutput1D();
 	void process(Candidate *candidate) const;
 	std::string getDescription() const;
@@ -0,0 +1,79 @@
+#ifndef CRPROPA_PROPAGATION1D_H
+#define CRPROPA_PROPAGATION1D_H
+
+#include "crpropa/Module.h"
+#include "crpropa/Units.h"
+#include "crpropa/module/ElectronPairProduction.h"
+#include "crpropa/module/InteractionCollection.h"
+
+namespace crpropa {
+/**
+ * \addtogroup Propagation
+ * @{
+ */
+
+/**
+ @class Propagation1D
+ @brief One module for a whole step of 1D propagation to an observer at x = 0.
+
+ Replaces the module list SimplePropagation, Redshift,
+ ElectronPairProduction, the discrete interactions (PhotoPionProduction,
+ PhotoDisintegration, NuclearDecay, ...), MinimumEnergy and an Observer
+ with ObserverPoint. The physics and the data tables are those of the
+ given modules, but a step is one call instead of one per module, the
+ Lorentz factor and the redshift are computed once and set once.
+
+ The energy loss of the electron pair production is integrated over the
+ step with the midpoint rule in log(gamma), exp(-s / L(gamma_mid)) exact for
+ a constant loss length L, so steps of a sizeable fraction of the loss length
+ (setLossLimit, default 0.3) stay accurate. No e+/e- pairs are produced, for
+ them use ElectronPairProduction itself. The discrete interactions are drawn
+ with one random number per step as in InteractionCollection.
+ Candidates at x <= 0 are detected: the detection action processes them and
+ they are deactivated, as the ones at or below the minimum energy.
+ Secondaries are propagated by the same module.
+ */
+class Propagation1D: public Module {
+	double minStep, maxStep;
+	double lossLimit;
+	double minEnergy;
+	bool redshift;
+	ref_ptr<ElectronPairProduction> pairProduction;
+	ref_ptr<InteractionCollection> interactions;
+	ref_ptr<Module> detectionAction;
+
+	void step(Candidate *candidate) const;
+public:
+	Propagation1D(double minStep = (0.1 * kpc), double maxStep = (1 * Gpc));
+	void setMinimumStep(double minStep);
+	void setMaximumStep(double maxStep);
+	double getMinimumStep() const;
+	double getMaximumStep() const;
+
+	/** Continuous loss by electron pair production, 0: none */
+	void setElectronPairProduction(ElectronPairProduction *pairProduction);
+	/** Limit the step to a fraction of the energy loss length */
+	void setLossLimit(double limit);
+	double getLossLimit() const;
+	/** Add a discrete interaction, with the step limit of setInteractionLimit */
+	void add(Interaction *interaction);
+	/** Limit the step to a fraction of the total mean free path */
+	void setInteractionLimit(double limit);
+	/** Adiabatic loss and redshift changes (default), as Redshift */
+	void setRedshift(bool redshift);
+	/** Candidates at or below the energy are deactivated, as MinimumEnergy */
+	void setMinimumEnergy(double energy);
+	double getMinimumEnergy() const;
+	/** Module called for the detected candidates, e.g. an output */
+	void onDetection(Module *action);
+
+	void process(Candidate *candidate) const;
+	/** Steps all candidates without a virtual call per module */
+	void processBatch(Candidate *const *candidates, size_t n) const;
+	std::string getDescription() const;
+};
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_PROPAGATION1D_H
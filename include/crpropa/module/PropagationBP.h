@@ -0,0 +1,63 @@
+#ifndef CRPROPA_PROPAGATIONBP_H
+#define CRPROPA_PROPAGATIONBP_H
+
+#include "crpropa/Module.h"
+#include "crpropa/Units.h"
+#include "crpropa/magneticField/MagneticField.h"
+
+namespace crpropa {
+/**
+ * \addtogroup Propagation
+ * @{
+ */
+
+/**
+ @class PropagationBP
+ @brief Propagation through magnetic fields using the Boris push.
+
+ This module solves the equations of motion of a relativistic charged particle when propagating through a magnetic field.\n
+ It uses the Boris push (leapfrog drift - rotate - drift), which needs a single field evaluation per step and conserves the particle energy exactly.
+ The method is only of second order, hence smaller steps than with PropagationCK are needed for the same accuracy.\n
+ The step size control limits the deflection per step: the next step is chosen such that the phase error of the Boris rotation, (step / r_g)^3 / 12, stays below the designated tolerance, using the field and gyro-radius r_g of the current step.
+ Rejected steps are not repeated. A tolerance of 0 disables the step control, then steps of the maximum step size are proposed, setting minStep = maxStep gives a fixed step size.
+ For neutral particles a rectilinear propagation is applied and a next step of the maximum step size proposed.
+ */
+class PropagationBP: public Module {
+private:
+	ref_ptr<MagneticField> field;
+	double tolerance; /*< target phase error per step */
+	double minStep; /*< minimum step size of the propagation */
+	double maxStep; /*< maximum step size of the propagation */
+
+public:
+	PropagationBP(ref_ptr<MagneticField> field = NULL, double tolerance = 1e-4,
+			double minStep = (0.1 * kpc), double maxStep = (1 * Gpc));
+	void process(Candidate *candidate) const;
+
+	/**
+	 Perform a single Boris step of length h.
+	 @param x	position, updated in place
+	 @param u	unit direction, updated in place
+	 @param h	step length
+	 @param p	particle state providing charge and energy
+	 @param z	redshift
+	 @returns	the magnetic field strength at the half step
+	 */
+	double push(Vector3d &x, Vector3d &u, double h, const ParticleState &p,
+			double z) const;
+
+	void setField(ref_ptr<MagneticField> field);
+	void setTolerance(double tolerance);
+	void setMinimumStep(double minStep);
+	void setMaximumStep(double maxStep);
+
+	double getTolerance() const;
+	double getMinimumStep() const;
+	double getMaximumStep() const;
+	std::string getDescription() const;
+};
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_PROPAGATIONBP_H
@@ -4,6 +4,7 @@
 #include "crpropa/Module.h"
 #include "crpropa/Units.h"
 #include "crpropa/magneticField/MagneticField.h"
+#include "crpropa/massDistribution/Density.h"
 
 namespace crpropa {
 /**
@@ -19,7 +20,10 @@ namespace crpropa {
  It uses the Runge-Kutta integration method with Cash-Karp coefficients.\n
  The step size control tries to keep the relative error close to, but smaller than the designated tolerance.
  Additionally a minimum and maximum size for the steps can be set.
- For neutral particles a rectilinear propagation is applied and a next step of the maximum step size proposed.
+ For neutral particles a rectilinear propagation is applied and a next step of the maximum step size proposed, or of the free streaming step for the particle classes of setFreeStreaming, as in SimplePropagation.
+ In uniform fields (MagneticField::isUniform) charged particles are moved analytically along the exact helix, the step is then limited only by the maximum step size and other modules.
+ With a density (setDensity) the column density along the trajectory is integrated with the weights of the Cash-Karp method from the stages of each accepted step and stored in Candidate::getColumnDensity.
+ The densities of the stages are evaluated with one Density::getDensities call per step, or per batch in processBatch.
  */
 class PropagationCK: public Module {
 public:
@@ -50,16 +54,31 @@ public:
 	};
 
 private:
-	std::vector<double> a, b, bs; /*< Cash-Karp coefficients */
 	ref_ptr<MagneticField> field;
+	ref_ptr<Density> density; /*< optional, for the column density */
 	double tolerance; /*< target relative error of the numerical integration */
 	double minStep; /*< minimum step size of the propagation */
 	double maxStep; /*< maximum step size of the propagation */
+	int freeStreaming; /*< neutral particle classes with the free streaming step */
+	double freeStep;
+
+	// advance n charged candidates at redshift z in lockstep
+	void propagateBatch(Candidate *const *candidates, size_t n, double z) const;
+	// add the column density of the steps from the positions of the stages
+	// with nonzero weight, 4 per candidate
+	void addColumnDensity(Candidate *const *candidates, const Vector3d *positions,
+			size_t n) const;
 
 public:
 	PropagationCK(ref_ptr<MagneticField> field = NULL, double tolerance = 1e-4,
 			double minStep = (0.1 * kpc), double maxStep = (1 * Gpc));
 	void process(Candidate *candidate) const;
+	/** Integrate all charged candidates of the batch together.
+	 The stages of all candidates are evaluated with one MagneticField::getFields
+	 call each, rejected steps are repeated only for the affected candidates.
+	 The results are identical to process().
+	 */
+	void processBatch(Candidate *const *candidates, size_t n) const;
 
 	// derivative of phase point, dY/dt = d/dt(x, u) = (v, du/dt)
 	// du/dt = q*c^2/E * (u x B)
@@ -68,7 +87,20 @@ public:
 	void tryStep(const Y &y, Y &out, Y &error, double t,
 			ParticleState &p, double z) const;
 
+	/// Same as above with the first stage k1 = dYdt(y) already evaluated.
+	/// A rejected step starts from the same y, so retries can reuse k1.
+	/// The positions of the 6 stages are stored in stages, if given.
+	void tryStep(const Y &y, const Y &k1, Y &out, Y &error, double t,
+			ParticleState &p, double z, Vector3d *stages = NULL) const;
+
+	/// Exact helix of length s in the uniform field B
+	Y helix(const Y &y, const Vector3d &B, double s, const ParticleState &p) const;
+
 	void setField(ref_ptr<MagneticField> field);
+	ref_ptr<MagneticField> getField() const;
+	/// Density for the column density of the candidates, NULL to disable
+	void setDensity(ref_ptr<Density> density);
+	ref_ptr<Density> getDensity() const;
 	void setTolerance(double tolerance);
 	void setMinimumStep(double minStep);
 	void setMaximumStep(double maxStep);
@@ -76,7 +108,12 @@ public:
 	double getTolerance() const;
 	double getMinimumStep() const;
 	double getMaximumStep() const;
+	/** Neutral particle classes proposed the given next step instead of maxStep, see SimplePropagation::setFreeStreaming */
+	void setFreeStreaming(int particleClasses, double step = 100 * Gpc);
+	int getFreeStreaming() const;
+	double getFreeStreamingStep() const;
 	std::string getDescription() const;
+	void getConfiguration(Configuration &configuration) const;
 };
 /** @}*/
 
@@ -0,0 +1,56 @@
+#ifndef CRPROPA_PROPAGATIONCKOFFLOAD_H
+#define CRPROPA_PROPAGATIONCKOFFLOAD_H
+
+#include "crpropa/Module.h"
+#include "crpropa/Units.h"
+#include "crpropa/Grid.h"
+
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup Propagation
+ * @{
+ */
+
+/**
+ @class PropagationCKOffload
+ @brief Cash-Karp propagation through a VectorGrid on an OpenMP offload device.
+
+ Same integration and step size control as PropagationCK with a MagneticFieldGrid, for batches of candidates (Module::processBatch, e.g. ModuleList::setBreadthFirst).
+ The grid is copied to the device once, at construction or with update(), and each batch is transferred to the device, advanced by one step per candidate and copied back, so that interactions, observers and boundaries are applied by the CPU module chain in between.\n
+ The device code uses OpenMP target regions. Without an offload device, or when compiled without OpenMP offloading (cmake -DOPENMP_OFFLOAD_FLAGS=...), it runs on the host threads.
+ The field is interpolated in double precision and the redshift is ignored, as for MagneticFieldGrid.
+ */
+class PropagationCKOffload: public Module {
+	ref_ptr<VectorGrid> grid;
+	std::vector<float> data; /*< device copy of the grid, 3 components per point */
+	double tolerance; /*< target relative error of the numerical integration */
+	double minStep; /*< minimum step size of the propagation */
+	double maxStep; /*< maximum step size of the propagation */
+
+	void release();
+public:
+	PropagationCKOffload(ref_ptr<VectorGrid> grid, double tolerance = 1e-4,
+			double minStep = (0.1 * kpc), double maxStep = (1 * Gpc));
+	~PropagationCKOffload();
+	void process(Candidate *candidate) const;
+	void processBatch(Candidate *const *candidates, size_t n) const;
+
+	/// Copy the grid to the device again, after it has been modified
+	void update();
+
+	void setTolerance(double tolerance);
+	void setMinimumStep(double minStep);
+	void setMaximumStep(double maxStep);
+
+	double getTolerance() const;
+	double getMinimumStep() const;
+	double getMaximumStep() const;
+	std::string getDescription() const;
+};
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_PROPAGATIONCKOFFLOAD_H
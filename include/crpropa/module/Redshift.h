@@ -12,6 +12,9 @@ namespace crpropa {
 /**
  @class Redshift
  @brief Updates redshift and applies adiabatic energy loss according to the traveled distance.
+
+ Uses dz = H(z) / c * step for short steps and the comoving distance of
+ the redshift for long steps (dz > 0.001), e.g. of free streaming particles.
  */
 class Redshift: public Module {
 public:
@@ -0,0 +1,101 @@
+#ifndef CRPROPA_RESPONSEMATRIX_H
+#define CRPROPA_RESPONSEMATRIX_H
+
+#include "crpropa/Module.h"
+#include "crpropa/ModuleList.h"
+
+#include <string>
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup Output
+ * @{
+ */
+
+/**
+ @class ResponseMatrix
+ @brief Precomputed 1D propagation of nuclei, folded with source models.
+
+ simulate injects a number of candidates in each bin of (species, log
+ energy, comoving distance) at (D, 0, 0) towards the observer at x = 0 and
+ with the redshift of D, uniform in log energy and distance inside the bin.
+ The detected particles are binned by injected bin, observed mass number
+ and observed energy, in the same energy bins. The modules must detect the
+ particles with the matrix as action, e.g. an Observer with ObserverPoint
+ and onDetection(matrix). Particles other than nuclei are not counted.
+
+ fold and foldSpectrum then compute observed spectra of source models from
+ the yields, without propagating again: a fold is a sum over the bins of
+ the matrix. save and load keep a matrix for later fits.
+ */
+class ResponseMatrix: public Module {
+	std::vector<int> species;
+	double lgEmin, lgEmax;
+	size_t nEnergy;
+	double Dmin, Dmax;
+	size_t nDistance;
+	int maxA; ///< of the observed nuclei
+	std::vector<double> yields; ///< summed weights, [injected bin][A - 1][observed energy]
+	std::vector<double> injected; ///< number of candidates per injected bin
+
+	size_t observedSize() const;
+	long injectedBin(const Candidate *candidate) const;
+	ResponseMatrix();
+public:
+	/**
+	 @param species		IDs of the injected nuclei
+	 @param Emin, Emax	energy range of the injected and observed particles
+	 @param nEnergy		number of logarithmic energy bins
+	 @param Dmin, Dmax	range of the comoving source distance
+	 @param nDistance	number of linear distance bins
+	 */
+	ResponseMatrix(const std::vector<int> &species, double Emin, double Emax,
+			size_t nEnergy, double Dmin, double Dmax, size_t nDistance);
+
+	/** Inject count candidates per bin and propagate them with the modules,
+	 over all threads. Can be called again to add candidates. */
+	void simulate(ModuleList *modules, size_t count);
+	/** Record a detected particle, the action of the observer */
+	void process(Candidate *candidate) const;
+	void clear();
+
+	size_t getNumberOfInjectedBins() const; ///< species x energies x distances
+	size_t getNumberOfObservedBins() const; ///< mass numbers x energies
+	size_t getInjectedBin(size_t species, size_t energy, size_t distance) const;
+	size_t getObservedBin(int A, size_t energy) const;
+	const std::vector<int> &getSpecies() const;
+	int getMaximumMassNumber() const;
+	double getEnergyBinEdge(size_t i) const; ///< i = 0 .. nEnergy
+	double getDistanceBinEdge(size_t i) const; ///< i = 0 .. nDistance
+	size_t getNumberOfEnergyBins() const;
+	size_t getNumberOfDistanceBins() const;
+	/** Mean observed number per injected candidate of a bin */
+	double getYield(size_t injectedBin, size_t observedBin) const;
+
+	/**
+	 Observed numbers of the injected numbers of each injected bin
+	 (getInjectedBin), by getObservedBin. Empty injected bins are skipped.
+	 */
+	std::vector<double> fold(const std::vector<double> &sources) const;
+	/**
+	 Injected numbers of a source model: per species the abundance times
+	 E^-index with an exponential cut off at Z * Rcut (0: none), integrated
+	 over the energy bins, and sources evolving with (1 + z)^m in redshift
+	 as SourceRedshiftEvolution, integrated over the distance bins.
+	 */
+	std::vector<double> getSourceNumbers(const std::vector<double> &abundances,
+			double index, double Rcut = 0, double m = 0) const;
+	/** fold(getSourceNumbers(...)) */
+	std::vector<double> foldSpectrum(const std::vector<double> &abundances,
+			double index, double Rcut = 0, double m = 0) const;
+
+	void save(const std::string &filename) const;
+	static ref_ptr<ResponseMatrix> load(const std::string &filename);
+	std::string getDescription() const;
+};
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_RESPONSEMATRIX_H
@@ -17,10 +17,15 @@ namespace crpropa {
  This module implements rectilinear propagation.
  The step size is guaranteed to be larger than minStep and smaller than maxStep.
  It always proposes a next step size of maxStep.
+ Particles of the free streaming classes (setFreeStreaming) are proposed a
+ much longer next step instead, so that they go to the next step limit of
+ the other modules (observer, boundary, maximum trajectory length) at once.
  */
 class SimplePropagation: public Module {
 private:
 	double minStep, maxStep;
+	int freeStreaming; ///< particle classes
+	double freeStep;
 
 public:
 	SimplePropagation(double minStep = (0.1 * kpc), double maxStep = (1 * Gpc));
@@ -29,7 +34,18 @@ public:
 	void setMaximumStep(double maxStep);
 	double getMinimumStep() const;
 	double getMaximumStep() const;
+	/**
+	 Particle classes (Module::ParticleClass) that nothing interacts with,
+	 e.g. NeutrinoClass. Their next step is step instead of maxStep, bounded
+	 only by the step limits of the other modules. The modules acting on
+	 other classes are skipped for them by the particle dispatch, and Redshift
+	 converts long steps exactly. 0 (default) disables.
+	 */
+	void setFreeStreaming(int particleClasses, double step = 100 * Gpc);
+	int getFreeStreaming() const;
+	double getFreeStreamingStep() const;
 	std::string getDescription() const;
+	void getConfiguration(Configuration &configuration) const;
 };
 /** @}*/
 
@@ -3,6 +3,7 @@
 
 #include "crpropa/Module.h"
 #include "crpropa/magneticField/MagneticField.h"
+#include "crpropa/Random.h"
 
 namespace crpropa {
 /**
@@ -19,8 +20,10 @@ namespace crpropa {
  The module limits the next step size to ensure a fractional energy loss dE/E < limit (default = 0.1).
  Optionally, synchrotron photons above a threshold (default E > 10^7 eV) are created as secondary particles.
  Note that the large number of secondary photons per propagation can cause memory problems.
+ With setMaximumPhotons(n), steps that radiate more photons than n on average emit n weighted
+ photons drawn from the spectrum instead, with weights that conserve the radiated energy.
  */
-class SynchrotronRadiation: public Module {
+class SynchrotronRadiation: public ContinuousLoss {
 private:
 	ref_ptr<MagneticField> field; ///< MagneticField instance
 	double Brms; ///< Brms value in case no MagneticField is specified
@@ -29,7 +32,14 @@ private:
 	bool havePhotons; ///< flag for production of secondary photons
 	double secondaryThreshold; ///< threshold energy for secondary photons
 	std::vector<double> tabx; ///< tabulated fraction E_photon/E_critical from 10^-6 to 10^2 in 801 log-spaced steps
-	std::vector<double> tabCDF; ///< tabulated CDF of synchrotron spectrum
+	AliasTable tabCDF; ///< tabulated CDF of synchrotron spectrum, as alias table
+	double meanX; ///< mean photon energy of the spectrum in units of E_critical
+	int maxPhotons; ///< maximum number of photons per step, 0: unlimited
+
+	double drawPhotonEnergy(double Ecrit) const;
+	/** Perpendicular magnetic field at the current position, with the cosmological scaling */
+	double perpendicularField(const Candidate *candidate, double z) const;
+	void emitPhotons(Candidate *candidate, double Ecrit, double dE) const;
 
 
 public:
@@ -51,8 +61,15 @@ public:
 	void setSecondaryThreshold(double threshold);
 	double getSecondaryThreshold() const;
 
+	/** Emit at most n weighted photons per step, 0: unweighted photons up to the energy loss */
+	void setMaximumPhotons(int n);
+	int getMaximumPhotons() const;
+
 	void initSpectrum();
 	void process(Candidate *candidate) const;
+	int getParticleClasses() const;
+	double energyLossRate(const Candidate *candidate, double E, double z) const;
+	void emitSecondaries(Candidate *candidate, double E, double dE) const;
 	std::string getDescription() const;
 };
 /** @}*/
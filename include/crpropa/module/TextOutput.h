@@ -3,8 +3,10 @@
 
 #include "crpropa/module/Output.h"
 #include "crpropa/module/ParticleCollector.h"
+#include "crpropa/Lock.h"
 
 #include <fstream>
+#include <vector>
 
 namespace crpropa {
 /**
@@ -15,6 +17,17 @@ namespace crpropa {
 /**
  @class TextOutput
  @brief Configurable plain text output for cosmic ray information.
+
+ The numbers are formatted independently of the locale. Output to a file is
+ collected in a line buffer per thread and written in blocks, flush() and
+ close() write the lines of all threads and must not be called while other
+ threads process candidates.
+
+ In the sharded mode (setSharded), each thread writes the lines of its
+ candidates to its own file, name.<thread>.ext, without any locking, and the
+ file of the output becomes a manifest of the shards, written by close().
+ load and ParticleCollector::load read a manifest as one dataset of the
+ lines of all its shards.
  */
 class TextOutput: public Output {
 protected:
@@ -22,8 +35,32 @@ protected:
 	std::ofstream outfile;
 	std::string filename;
 	bool storeRandomSeeds;
+	mutable bool headerPrinted;
+
+	// lines of one thread, padded against false sharing
+	struct LineBuffer {
+		std::string lines;
+		char padding[64];
+	};
+	mutable std::vector<LineBuffer> lineBuffers; ///< one per thread, for files
+	mutable Lock lock; ///< of the stream and the line buffers
+
+	// file of one thread in the sharded mode, padded against false sharing
+	struct Shard {
+		std::ofstream file;
+		std::ostream *out;
+		std::string lines;
+		size_t count;
+		char padding[64];
+	};
+	bool sharded;
+	mutable std::vector<Shard *> shards; ///< one per thread, opened by the thread
 
 	void printHeader() const;
+	void printHeader(std::ostream &out) const;
+	Shard *openShard(size_t thread) const;
+	void closeShards();
+	void writeLines(std::string &lines) const;
 
 public:
 	TextOutput();
@@ -35,7 +72,17 @@ public:
 	~TextOutput();
 
 	void enableRandomSeeds() {storeRandomSeeds = true;};
+	/**
+	 Write a file per thread and a manifest of the files instead of one file,
+	 before the first candidate. Only for file output.
+	 */
+	void setSharded(bool sharded);
+	bool isSharded() const;
+	/// Name of the file of a thread in the sharded mode: name.<thread>.ext
+	std::string getShardFilename(size_t thread) const;
 	void close();
+	/// Write the lines of all threads
+	void flush() const;
 	void gzip();
 
 	void process(Candidate *candidate) const;
@@ -3,6 +3,7 @@
 
 #include "crpropa/Module.h"
 #include "crpropa/EmissionMap.h"
+#include "crpropa/Lock.h"
 
 #include <vector>
 #include <set>
@@ -28,8 +29,10 @@ private:
 
 	mutable std::vector<_module_info> modules;
 	mutable size_t calls;
+	mutable Lock lock; ///< of the times
 
 public:
+	PerformanceModule();
 	~PerformanceModule();
 	void add(Module* module);
 	void process(Candidate* candidate) const;
@@ -58,6 +61,9 @@ public:
 /**
   @class EmissionMapFiller
   @brief Fill EmissionMap with source particle state
+
+  Each thread fills its own maps, which are merged when the EmissionMap is
+  used after the run, see EmissionMap::fillMapOfThread.
 */
 class EmissionMapFiller: public Module {
 	ref_ptr<EmissionMap> emissionMap;
@@ -0,0 +1,116 @@
+#ifndef CRPROPA_TRAJECTORYOUTPUT_H
+#define CRPROPA_TRAJECTORYOUTPUT_H
+
+#include "crpropa/Module.h"
+#include "crpropa/Lock.h"
+#include "crpropa/Units.h"
+#include "crpropa/module/ParticleCollector.h"
+
+#include <fstream>
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup Output
+ * @{
+ */
+
+/**
+ @class TrajectorySampling
+ @brief Pass only some steps of each trajectory to an output.
+
+ Decimates the steps given to a trajectory output, e.g. a TextOutput of type
+ Trajectory3D or a TrajectoryOutput: every n-th step, steps after the position
+ or direction changed by more than a threshold since the last kept step, or
+ snapshots each time the trajectory length passes a multiple of an interval.
+ A step is kept if any of the set criteria is met, without criteria all steps
+ are kept. The first step of each candidate and its last, when it is
+ deactivated, are always kept, place the module after the break conditions.
+ The last kept step is stored in candidate properties, named TrajectorySampling
+ followed by a number of the instance, e.g. TrajectorySampling1.steps.
+ */
+class TrajectorySampling: public Module {
+	ref_ptr<Module> output;
+	size_t everyNth;
+	double minDistance, minAngle, interval;
+	PropertyKey stepsKey, positionKeys[3], directionKeys[3]; ///< of this instance
+public:
+	TrajectorySampling(Module *output);
+	void setEveryNthStep(size_t n); ///< 0: off
+	void setMinDistance(double distance); ///< 0: off
+	void setMinAngle(double angle); ///< [rad], 0: off
+	/// trajectory length between snapshots, i.e. c times the time, 0: off
+	void setSnapshotInterval(double length);
+	size_t getEveryNthStep() const;
+	double getMinDistance() const;
+	double getMinAngle() const;
+	double getSnapshotInterval() const;
+
+	/// true if the step is to be kept, updates the state of the candidate
+	bool keep(Candidate *candidate) const;
+	void process(Candidate *candidate) const;
+	std::string getDescription() const;
+};
+
+/**
+ @class TrajectoryOutput
+ @brief Compact binary trajectories, delta encoded and quantised per candidate.
+
+ Collects the steps of each candidate by its serial number and writes them
+ as one segment when the candidate is deactivated, or at close(). A segment
+ stores the serial number, the number of steps and for each step the
+ differences to the previous step of the trajectory length, the position and
+ the particle id as variable length integers, the lengths rounded to the
+ resolution, and the energy as float. The rounding errors do not accumulate,
+ the differences are taken between the rounded values. Steps that are small
+ against the resolution need a few bytes per coordinate, decimate them with
+ TrajectorySampling in front. A candidate propagated in several runs may
+ have several segments. close() must not be called while other threads
+ process candidates.
+ */
+class TrajectoryOutput: public Module {
+	struct Trajectory {
+		std::string steps; ///< encoded steps
+		uint32_t count; ///< number of steps
+		int64_t last[4]; ///< rounded trajectory length and position of the last step
+		int32_t lastId;
+	};
+	typedef std::map<uint64_t, Trajectory> TrajectoryMap;
+	// open trajectories and finished segments of one thread, padded against false sharing
+	struct ThreadTrajectories {
+		TrajectoryMap open;
+		std::string segments;
+		char padding[64];
+	};
+	mutable std::ofstream outfile;
+	mutable std::vector<ThreadTrajectories> threads; ///< one per thread and one shared
+	std::string filename;
+	double resolution;
+	mutable Lock lock; ///< of the file and the shared trajectories
+
+	void addStep(ThreadTrajectories &t, Candidate *candidate) const;
+	static void appendSegment(std::string &segments, uint64_t serial, const Trajectory &trajectory);
+	void writeSegments(std::string &segments) const;
+public:
+	/// resolution of the trajectory lengths and positions
+	TrajectoryOutput(const std::string &filename, double resolution = 1 * kpc);
+	~TrajectoryOutput();
+
+	void process(Candidate *candidate) const;
+	/// Write all trajectories, also the open ones, and close the file
+	void close();
+	double getResolution() const;
+	/// Append a candidate for each step of the file to the collector, with the
+	/// serial number, trajectory length, id, energy, position and the direction
+	/// from the previous step
+	static void load(const std::string &filename, ParticleCollector *collector);
+	std::string getDescription() const;
+};
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_TRAJECTORYOUTPUT_H
@@ -5,9 +5,14 @@
 #include <vector>
 #include <cstdlib>
 #include <ctime>
+#include <algorithm>
 
 #include <iostream>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 namespace eleca {
 
 double z2Mpc(double z) {
@@ -33,6 +38,29 @@ double Mpc2z(double D) {
 }
 
 
+// states of erand48 per thread, further threads share the last one
+static const int ELECA_THREADS = 256;
+struct RandomState {
+	unsigned short xsubi[3];
+	char padding[64];
+};
+static RandomState gRandomStates[ELECA_THREADS];
+static bool gSeeded = false;
+
+static void seedStates(unsigned long long seedval) {
+	for (int i = 0; i < ELECA_THREADS; i++) {
+		// splitmix64 to decorrelate the streams of the threads
+		unsigned long long x = seedval + (i + 1) * 0x9E3779B97F4A7C15ULL;
+		x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+		x = x ^ (x >> 31);
+		gRandomStates[i].xsubi[0] = x & 0xFFFF;
+		gRandomStates[i].xsubi[1] = (x >> 16) & 0xFFFF;
+		gRandomStates[i].xsubi[2] = (x >> 32) & 0xFFFF;
+	}
+	__atomic_store_n(&gSeeded, true, __ATOMIC_RELEASE);
+}
+
 void setSeed(long int seedval)
 {
 	if (seedval == 0)
@@ -40,11 +68,30 @@ void setSeed(long int seedval)
 		time(&seedval);
 	}
 	::srand48(seedval);
+#pragma omp critical(ElecaSeed)
+	seedStates(seedval);
 }
 
 
 double Uniform(double min, double max) {
-		return min + (max - min) * ::drand48();
+	if (!__atomic_load_n(&gSeeded, __ATOMIC_ACQUIRE)) {
+#pragma omp critical(ElecaSeed)
+		if (!gSeeded)
+			seedStates(0x1234ABCD330EULL); // default seed of drand48
+	}
+
+	int i = 0;
+#ifdef _OPENMP
+	i = std::min(omp_get_thread_num(), ELECA_THREADS - 1);
+#endif
+	double r;
+	if (i == ELECA_THREADS - 1) {
+#pragma omp critical(ElecaUniform)
+		r = ::erand48(gRandomStates[i].xsubi);
+	} else {
+		r = ::erand48(gRandomStates[i].xsubi);
+	}
+	return min + (max - min) * r;
 }
 
 } // namespace eleca
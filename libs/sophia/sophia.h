@@ -5,6 +5,17 @@ extern "C" {
 void sophiaevent_(int& channel, double& inputenergy, double momentum[][2000],
 		int id[], int& n, double& redshift, int& photonbackground, double& maxz,
 		int&, double[], double[]);
+
+// resonance parameters of a nucleon: 13 -> p, 14 -> n
+void initial_(int& nucleon);
+
+// cross section in microbarn of the nucleon of the last initial_ with a photon
+// of energy x in GeV in its rest frame, mode 3: total
+double crossection_(double& x, int& mode, int& nucleon);
+
+// random number in (0, 1) used by SOPHIA when compiled with OpenMP,
+// provided by PhotoPionProduction
+double sophia_rand_();
 }
 
 /*
@@ -125,6 +125,11 @@ C      IDB(23) = -ABS(IDB(23))
 
 
 C  incoming nucleon
+!$OMP THREADPRIVATE(/RES_PROP/,/RES_PROPN/,/RES_PROPP/,/S_CHP/,
+!$OMP&/S_CSYDEC/,/S_MASS1/,/S_PLIST/,/S_RUN/,ANORF,BETAP,COD,COF,
+!$OMP&EPS_PRIME,ESUM,GAMBET,GAMMAP,I,ICOUNT,IFBAD,IPROC,IQBAR,IQCHR,
+!$OMP&IRANGE,IRES,IRESMAX,ISTABLE,NBAD,P_GAM,P_NUC,P_SUM,PC,PI,PM,PTOT,
+!$OMP&PXSUM,PYSUM,PZSUM,SID,SIF,SQSM,STH,XX)
        pm = AM(L0)
        P_nuc(1) = 0.D0
        P_nuc(2) = 0.D0
@@ -334,6 +339,10 @@ c** author: A.Muecke **
 c**********************
 c
 c x = eps_prime in GeV
+!$OMP THREADPRIVATE(/RES_PROP/,/S_MASS1/,CROSS_DIFFR,CROSS_DIFFR1,
+!$OMP&CROSS_DIFFR2,CROSS_DIR,CROSS_DIR1,CROSS_DIR2,CROSS_FRAG2,
+!$OMP&CROSS_RES,CS_DELTA,CS_MULTI,CS_MULTIDIFF,CS_TMP,N,PM,S,SIG_RES,
+!$OMP&SS1,SS2,STH)
        pm = AM(NL0)       
        s = pm*pm+2.D0*pm*x
        
@@ -524,6 +533,7 @@ c calculates Breit-Wigner cross section of a resonance with width Gamma [GeV],
 c mass DMM [GeV], max. cross section sigma_0 [mubarn] and total mass of the 
 c interaction s [GeV] 
 c***************************************************************************
+!$OMP THREADPRIVATE(GAM2S,PM,S)
        pm = 0.93827D0
        s = pm*pm+2.D0*pm*eps_prime
        gam2s = Gamma*Gamma*s
@@ -542,6 +552,7 @@ c***************************************************************************
 
        SAVE
 
+!$OMP THREADPRIVATE(A,PROD1,PROD2)
        if (xth.gt.x) then
         Pl = 0.
         RETURN
@@ -562,6 +573,7 @@ c***************************************************************************
 
        SAVE
 
+!$OMP THREADPRIVATE(WTH)
        wth = w+th
        if (x.le.th) then
         Ef = 0.
@@ -602,6 +614,7 @@ c***********************************************************
 c** Date: 15/04/98   **
 c** author: A.Muecke **
 c**********************
+!$OMP THREADPRIVATE(PROB1,PROB2,PROB3,PROB4,PROB5,PROB6,PROB7,RN,TOT)
        tot = crossection(eps_prime,3,L0)
        if (tot.eq.0.) tot = 1.D0
        prob1 = crossection(eps_prime,1,L0)/tot
@@ -678,6 +691,8 @@ c** correct.:19/02/98**
 c** author: A.Muecke **
 c**********************
 
+!$OMP THREADPRIVATE(/RES_FLAG/,/S_MASS1/,E1,E2,P1X,P1Y,P1Z,P2X,P2Y,P2Z,
+!$OMP&PC,R,SM1,SM2)
         nbad = 0
         SM1 = AM(LA)
         if (LB.eq.0) then
@@ -775,6 +790,7 @@ c**********************
 
 
 c*** sum of all resonances:
+!$OMP THREADPRIVATE(I,J,J10,PROB,PROB_SUM,PROBOLD,R,SUMRES)
        sumres = 0.D0
        do 12 j=1,IRESMAX
         j10 = j+10
@@ -834,6 +850,8 @@ c**********************
 c      x = eps_prime
 c ... choose arrays /S_RESp/ for charged resonances,
 c ...        arrays /S_RESn/ for neutral resonances
+!$OMP THREADPRIVATE(/S_RESN/,/S_RESP/,I,IE,ISTART,J,NLIM,PROB_SUM,R,
+!$OMP&RESLIMP1,RESLIMP2)
        if (L0.eq.13) then
 c ... charged resonances:
 
@@ -1044,6 +1062,7 @@ c** author: A.Muecke **
 c**********************
 
 c... determine decay products LA, LB:
+!$OMP THREADPRIVATE(/S_PLIST/,/S_RESN/,/S_RESP/,ANGLESCAT,LA,LB)
         NP = 2
         if (L0.eq.13) then
 c ... proton is incident nucleon:
@@ -1154,6 +1173,7 @@ c**********************
        COMMON /S_PLIST/ P(2000,5), LLIST(2000), NP, Ideb
 
 c ... use rejection method for sampling:
+!$OMP THREADPRIVATE(/S_PLIST/,LA,LB,PROB,R)
        LA = LLIST(1)
        LB = LLIST(2)
   10   continue
@@ -1189,6 +1209,7 @@ c IRES and incident nucleon L0 ;                                   **
 c z is cosine of scattering angle in CMF frame                     **
 c********************************************************************
 
+!$OMP THREADPRIVATE(Q)
        if (IRES.eq.4.or.IRES.eq.5.or.IRES.eq.2) then  
 c ... N1535 andf N1650 decay isotropically. 
         probangle = 0.5D0 
@@ -1279,6 +1300,7 @@ C...........................................................
 	DATA W /.1894506104D0,.1826034150D0,.1691565193D0,.1495959888D0
      +        ,.1246289712D0,.0951585116D0,.0622535239D0, .0271524594D0/
 
+!$OMP THREADPRIVATE(W,X)
 	XM = 0.5D0*(B+A)
 	XR = 0.5D0*(B-A)
 	SS = 0.D0
@@ -1520,6 +1542,8 @@ C************************** settings of versions 1.4 - 2.0 *********
      + 0.,0.,0.,0.,0.,0.,0.,0.,0.,0.,0.,0.,0.,0.,0.,0.,0.,
      + 0.,0.,0.,0.,0.,0.,0.,0.,0.,0.,0.,0.,0.,0.,0.,0.,0.,0.,0.,
      + 0.,0.,0./
+!$OMP THREADPRIVATE(/RES_FLAG/,/RES_PROPN/,/RES_PROPP/,/S_CHP/,/S_CNAM/,
+!$OMP&/S_CSYDEC/,/S_MASS1/,/S_PLIST/,/S_RESN/,/S_RESP/)
       END
 C->
       BLOCK DATA PARAM_INI
@@ -1550,6 +1574,8 @@ C...Splitting parameters
       DATA CCHIK /21*2.,6*3./
 C...Parameters of flavor formation
       DATA PAR /0.04,0.25,0.25,0.14,0.3,0.3,0.15,0./
+!$OMP THREADPRIVATE(/S_CDIF0/,/S_CFLAFR/,/S_CPSPL/,/S_CQDIS/,/S_CZDIS/,
+!$OMP&/S_CZDISS/,/S_CZLEAD/)
       END
 
 
@@ -1602,6 +1628,14 @@ C**********************************************************************
       DATA Ic / 0 /
 
 C  second particle is always photon
+!$OMP THREADPRIVATE(/S_CFLAFR/,/S_CHP/,/S_MASS1/,/S_PLIST/,/S_RUN/,
+!$OMP&ALPHAP,AM_A,AM_B,AS1,AS2,B,E1,E3,E_REF_1,E_REF_2,EE,ELOG,ELOG_1,
+!$OMP&ELOG_2,I,IBA_0,IBA_1,IBA_2,IBA_3,IBB_0,IBB_1,IBB_2,IBB_3,IC,IFL1A,
+!$OMP&IFL1B,IFL2A,IFL2B,IFLIP,IJOIN,IMA_0,IMA_1,IMA_2,IMA_3,IMB_0,IMB_1,
+!$OMP&IMB_2,IMB_3,IMUL,IP2,IPA,IPB,IQBAR,IQCHR,IREJ,ISTRING,ITRY,J,K,L1,
+!$OMP&LL,ND,P1,P2,P_DEC,P_IN,PA1,PA2,PCM1,PCM3,PHI,PL,PL1,PL2,PROB,
+!$OMP&PROB_1,PROB_REG,PS1,PS2,PT,PTU,PX,PY,PZ,S1,S2,SIG_POM,SIG_REG,T,
+!$OMP&T0,T1,XM1,XM2,XMA,XMI,XS1,XS2)
       IP2 = 1
 C  parameters of pi0 suppression
       a1 = 0.5D0
@@ -2371,6 +2405,8 @@ C**********************************************************************
       CHARACTER CODE*18
       SAVE
 
+!$OMP THREADPRIVATE(/S_CHP/,/S_CNAM/,/S_CSYDEC/,/S_MASS1/,/S_PLIST/,
+!$OMP&/S_RUN/,CODE,EE,I0,IBARY,ICHAR,J,K,L,L1,PX,PY,PZ)
       if(iout.gt.0) then
        
         print *,' --------------------------------------------------'
@@ -2450,6 +2486,8 @@ C***********************************************************************
       CHARACTER*6 NAMP
       SAVE
 
+!$OMP THREADPRIVATE(/S_CHP/,/S_CNAM/,/S_CSYDEC/,/S_MASS1/,/S_PLIST/,
+!$OMP&/S_RUN/,EE,IBARY,ICHAR,IPRINT,J,L,L1,PLSCALE,PTSCALE,PX,PY,PZ)
       px = 0.D0
       py = 0.D0
       pz = 0.D0
@@ -2519,6 +2557,7 @@ C**********************************************************************
 
       SAVE
 
+!$OMP THREADPRIVATE(K,XI)
       if(ip.eq.1) then
         if(rndm(0).gt.0.2D0) then
           ival1 = 1
@@ -2596,6 +2635,8 @@ C***********************************************************************
 
       DIMENSION P0(5), LL(10), PD(10,5)
 
+!$OMP THREADPRIVATE(/S_CSYDEC/,/S_PLIST/,/S_PLIST1/,J,K,L,LL,ND,NN,P0,
+!$OMP&PD)
       NN = 1
       DO J=1,NP
          LLIST1(J) = 0
@@ -2655,6 +2696,9 @@ C***********************************************************************
       DATA PI /3.1415926D0/
 
 C...c.m.s. Momentum in two particle decays
+!$OMP THREADPRIVATE(/S_CSYDEC/,/S_MASS1/,A,B,BE,BEP,BETA,C,F1,FACN,GA,I,
+!$OMP&IDC,IL,IL1,IL2,J,KD,L,MAT,MBST,PA,PHI,PI,PMAX,PMIN,PS,PV,RBR,RORD,
+!$OMP&RSAV,UE,UT,WT,WTMAX,WWTMAX)
       PAWT(A,B,C) = SQRT((A**2-(B+C)**2)*(A**2-(B-C)**2))/(2.D0*A)
 
 C...Phase space decay into the particles in the list
@@ -2811,6 +2855,7 @@ C*********************************************************************
       IMPLICIT DOUBLE PRECISION (A-H,O-Z)
       SAVE
 
+!$OMP THREADPRIVATE(EP,PE)
       EP=PCX*BGX+PCY*BGY+PCZ*BGZ
       PE=EP/(GA+1.D0)+EC
       PX=PCX+BGX*PE
@@ -2856,6 +2901,7 @@ C***********************************************************************
       DIMENSION XS1(2),XS2(2)
       DIMENSION XMIN(2),XMAX(2)
 
+!$OMP THREADPRIVATE(BET1,BET2,GAM1,GAM2,I,ITRY0,ITRY1,ITRY2,X1,X2,X3,X4)
       IREJ = 0
 
       GAM1 = +1.5D0 + 1.D0
@@ -2924,6 +2970,7 @@ C********************************************************************
       IMPLICIT INTEGER (I-N)
       SAVE
 
+!$OMP THREADPRIVATE(Y,Z)
       Y = PO_RNDGAM(1.D0,GAM)
       Z = PO_RNDGAM(1.D0,ETA)
       PO_RNDBET = Y/(Y+Z)
@@ -2944,6 +2991,7 @@ C********************************************************************
       IMPLICIT INTEGER (I-N)
       SAVE
 
+!$OMP THREADPRIVATE(F,I,N,NCOU,R,Y,YYY,Z)
       NCOU=0
       N = ETA
       F = ETA - N
@@ -2991,6 +3039,7 @@ C***********************************************************************
       DATA init / 0 /
 
 
+!$OMP THREADPRIVATE(/LUDAT1/,/LUDAT3/,/LUJETS/,II,INIT,KC)
       if(init.eq.0) then
 
 C  no title page
@@ -3068,6 +3117,7 @@ C***********************************************************************
       COMMON/LUDAT3/MDCY(500,3),MDME(2000,2),BRAT(2000),KFDP(2000,5)
       SAVE
 
+!$OMP THREADPRIVATE(/LUDAT1/,/LUDAT3/,/LUJETS/,IL)
       if(IFL.eq.1) then
         Il = 2
       else if(IFL.eq.-1) then
@@ -3122,6 +3172,7 @@ C***********************************************************************
       COMMON/LUDAT3/MDCY(500,3),MDME(2000,2),BRAT(2000),KFDP(2000,5)
       SAVE
 
+!$OMP THREADPRIVATE(/LUDAT1/,/LUDAT3/,/LUJETS/,IL)
       PX = PLU(I,1)
       PY = PLU(I,2)
       PZ = PLU(I,3)
@@ -3156,6 +3207,7 @@ C************************************************************************
      &  3112, 3322, 3312, 3122, 2224, 2214, 2114, 1114, 3224, 3214, 
      &  3114, 3324, 3314, 3334 / 
 
+!$OMP THREADPRIVATE(I,IC,IDA,IDPDG,IS,ITABLE)
       IDPDG = ID
 
  100  CONTINUE
@@ -3209,6 +3261,8 @@ C********************************************************************
       DIMENSION PA1(4),PA2(4),P1(4),P2(4)
 
 C  Lorentz transformation into system CMS
+!$OMP THREADPRIVATE(ANORF,BGX,BGY,BGZ,COD,COF,EE,EE1,EE2,GAM,PCMP,PTOT1,
+!$OMP&PTOT2,PX,PY,PZ,SID,SIF,SS,XM12,XM22,XMS,XX,YY,ZZ)
       PX = PA1(1)+PA2(1)
       PY = PA1(2)+PA2(2)
       PZ = PA1(3)+PA2(3)
@@ -3264,6 +3318,7 @@ C**********************************************************************
       IMPLICIT DOUBLE PRECISION (A-H,O-Z)
       SAVE
 
+!$OMP THREADPRIVATE(XLAM,YZ)
       YZ=Y-Z
       XLAM=X*X-2.D0*X*(Y+Z)+YZ*YZ
       IF(XLAM.LT.0.D0) XLAM=-XLAM
@@ -3290,6 +3345,7 @@ c*******************************************************************
       CHARACTER NAMPRESp*6, NAMPRESn*6
       CHARACTER NAMPRES*6
 
+!$OMP THREADPRIVATE(/RES_PROP/,/RES_PROPN/,/RES_PROPP/,/S_MASS1/,I)
        if (L0.eq.13) then
        do i=1,9
         SIG0(i) = 4.893089117D0/AM2(13)*RATIOJp(i)*BGAMMAp(i)
@@ -3356,6 +3412,7 @@ c**********************
        DIMENSION Dg(201),Dnum(201),Dnue(201),Dp(201),Dn(201)
        DIMENSION Dem(201),Dep(201),Dnuea(201),Dnuma(201)
 
+!$OMP THREADPRIVATE(/S_PLIST/,EI,EP,I,J,LA,R,X,X1,X2,XINI)
         do i=1,201
           Dg(i) = 0.
           Dnum(i) = 0.
@@ -3541,6 +3598,9 @@ c**********************
  572  format(E10.5,3x,2(I3,3x))
  573  format(2x,E10.5)
 
+!$OMP THREADPRIVATE(/INPUT/,FILENAME,FPART,I,J,JFIN,JFIN0,JINI,JL,MAT,
+!$OMP&MAT1,MAT2,NM,NM1,NMC,NMC2,NMCF,NMCF2,PARTICLE,SPART,STRNM1,
+!$OMP&STRNM11,STRNM12,TARGET1,TARGET2)
       print*
       print*,'OUTPUT files:'
 c**********************************************
@@ -4075,6 +4135,7 @@ C...Purpose: to store one parton/particle in commonblock LUJETS.
       SAVE /LUJETS/,/LUDAT1/,/LUDAT2/ 
  
 C...Standard checks. 
+!$OMP THREADPRIVATE(/LUDAT1/,/LUDAT2/,/LUJETS/)
       MSTU(28)=0 
       IF(MSTU(12).GE.1) CALL LULIST(0) 
       IPA=MAX(1,IABS(IP)) 
@@ -4125,6 +4186,7 @@ C...with the first along the +z axis.
       SAVE /LUJETS/,/LUDAT1/,/LUDAT2/ 
  
 C...Standard checks. 
+!$OMP THREADPRIVATE(/LUDAT1/,/LUDAT2/,/LUJETS/)
       MSTU(28)=0 
       IF(MSTU(12).GE.1) CALL LULIST(0) 
       IPA=MAX(1,IABS(IP)) 
@@ -4212,6 +4274,7 @@ C...plane with x > 0.
       SAVE /LUJETS/,/LUDAT1/,/LUDAT2/ 
  
 C...Standard checks. 
+!$OMP THREADPRIVATE(/LUDAT1/,/LUDAT2/,/LUJETS/)
       MSTU(28)=0 
       IF(MSTU(12).GE.1) CALL LULIST(0) 
       IPA=MAX(1,IABS(IP)) 
@@ -4329,6 +4392,7 @@ C...and the second having y < 0 and y > 0 with equal probability.
       SAVE /LUJETS/,/LUDAT1/,/LUDAT2/ 
  
 C...Standard checks. 
+!$OMP THREADPRIVATE(/LUDAT1/,/LUDAT2/,/LUJETS/)
       MSTU(28)=0 
       IF(MSTU(12).GE.1) CALL LULIST(0) 
       IPA=MAX(1,IABS(IP)) 
@@ -4491,6 +4555,7 @@ C...as required for subsequent shower evolution (or other operations).
       DIMENSION IJOIN(*) 
  
 C...Check that partons are of right types to be connected. 
+!$OMP THREADPRIVATE(/LUDAT1/,/LUDAT2/,/LUJETS/)
       IF(NJOIN.LT.2) GOTO 120 
       KQSUM=0 
       DO 100 IJN=1,NJOIN 
@@ -4589,6 +4654,9 @@ C...integer/real/character, no. of indices, lower&upper index bounds.
      &'ABCDEFGHIJKLMNOPQRSTUVWXYZ'/ 
  
 C...Length of character variable. Subdivide it into instructions. 
+!$OMP THREADPRIVATE(/LUDAT1/,/LUDAT2/,/LUDAT3/,/LUDAT4/,/LUJETS/,
+!$OMP&/PYINT1/,/PYINT2/,/PYINT3/,/PYINT4/,/PYINT5/,/PYINT6/,/PYINT7/,
+!$OMP&/PYPARS/,/PYSUBS/,CHALP,CHVAR,MSVAR)
       IF(MSTU(12).GE.1) CALL LULIST(0) 
       CHBIT=CHIN//' ' 
       LBIT=101 
@@ -4956,6 +5024,7 @@ C...Purpose: to administrate the fragmentation and decay chain.
       DIMENSION PS(2,6) 
  
 C...Initialize and reset. 
+!$OMP THREADPRIVATE(/LUDAT1/,/LUDAT2/,/LUDAT3/,/LUJETS/)
       MSTU(24)=0 
       IF(MSTU(12).GE.1) CALL LULIST(0) 
       MSTU(31)=MSTU(31)+1 
@@ -5080,6 +5149,7 @@ C     IMPLICIT DOUBLE PRECISION(D)
       DIMENSION DPS(5),DPC(5),UE(3) 
  
 C...Rearrange parton shower product listing along strings: begin loop. 
+!$OMP THREADPRIVATE(/LUDAT1/,/LUDAT2/,/LUDAT3/,/LUJETS/)
       I1=N 
       DO 130 MQGST=1,2 
       DO 120 I=MAX(1,IP),N 
@@ -5429,6 +5499,7 @@ C     IMPLICIT DOUBLE PRECISION(D)
      &TJU(5),KFJH(2),NJS(2),KFJS(2),PJS(4,5),MSTU9T(8),PARU9T(8) 
  
 C...Function: four-product of two vectors. 
+!$OMP THREADPRIVATE(/LUDAT1/,/LUDAT2/,/LUJETS/)
       FOUR(I,J)=P(I,4)*P(J,4)-P(I,1)*P(J,1)-P(I,2)*P(J,2)-P(I,3)*P(J,3) 
       DFOUR(I,J)=DP(I,4)*DP(J,4)-DP(I,1)*DP(J,1)-DP(I,2)*DP(J,2)- 
      &DP(I,3)*DP(J,3) 
@@ -6546,6 +6617,7 @@ C     IMPLICIT DOUBLE PRECISION(D)
      &KFLO(2),PXO(2),PYO(2),WO(2) 
  
 C...Reset counters. Identify parton system and take copy. Check flavour. 
+!$OMP THREADPRIVATE(/LUDAT1/,/LUDAT2/,/LUJETS/)
       NSAV=N 
       MSTU90=MSTU(90) 
       NJET=0 
@@ -7014,6 +7086,7 @@ C     DOUBLE PRECISION DBETAU(3)
  
 C...Functions: momentum in two-particle decays, four-product and 
 C...matrix element times phase space in weak decays. 
+!$OMP THREADPRIVATE(/LUDAT1/,/LUDAT2/,/LUDAT3/,/LUJETS/,WTCOR)
       PAWT(A,B,C)=SQRT((A**2-(B+C)**2)*(A**2-(B-C)**2))/(2.*A) 
       FOUR(I,J)=P(I,4)*P(J,4)-P(I,1)*P(J,1)-P(I,2)*P(J,2)-P(I,3)*P(J,3) 
       HMEPS(HA)=((1.-HRQ-HA)**2+3.*HA*(1.+HRQ-HA))* 
@@ -7889,6 +7962,7 @@ C...Purpose: to generate a new flavour pair and combine off a hadron.
       SAVE /LUDAT1/,/LUDAT2/ 
  
 C...Default flavour values. Input consistency checks. 
+!$OMP THREADPRIVATE(/LUDAT1/,/LUDAT2/)
       KF1A=IABS(KFL1) 
       KF2A=IABS(KFL2) 
       KFL3=0 
@@ -8223,6 +8297,7 @@ C...Purpose: to generate transverse momentum according to a Gaussian.
       SAVE /LUDAT1/ 
  
 C...Generate p_T and azimuthal angle, gives p_x and p_y. 
+!$OMP THREADPRIVATE(/LUDAT1/)
       KFLA=IABS(KFL) 
       PT=PARJ(21)*SQRT(-LOG(MAX(1D-10,RLU(0)))) 
       IF(PARJ(23).GT.RLU(0)) PT=PARJ(24)*PT 
@@ -8247,6 +8322,7 @@ C...Purpose: to generate the longitudinal splitting variable z.
       SAVE /LUDAT1/,/LUDAT2/ 
  
 C...Check if heavy flavour fragmentation. 
+!$OMP THREADPRIVATE(/LUDAT1/,/LUDAT2/)
       KFLA=IABS(KFL1) 
       KFLB=IABS(KFL2) 
       KFLH=KFLA 
@@ -8375,6 +8451,7 @@ C     IMPLICIT DOUBLE PRECISION(D)
      &ISII(2) 
  
 C...Initialization of cutoff masses etc. 
+!$OMP THREADPRIVATE(/LUDAT1/,/LUDAT2/,/LUJETS/)
       IF(MSTJ(41).LE.0.OR.(MSTJ(41).EQ.1.AND.QMAX.LE.PARJ(82)).OR. 
      &QMAX.LE.MIN(PARJ(82),PARJ(83))) RETURN 
       DO 100 IFL=0,40 
@@ -9465,6 +9542,7 @@ C     IMPLICIT DOUBLE PRECISION(D)
       DATA KFBE/211,-211,111,321,-321,130,310,221,331/ 
  
 C...Boost event to overall CM frame. Calculate CM energy. 
+!$OMP THREADPRIVATE(/LUDAT1/,/LUJETS/,KFBE)
       IF((MSTJ(51).NE.1.AND.MSTJ(51).NE.2).OR.N-NSAV.LE.1) RETURN 
       DO 100 J=1,4 
       DPS(J)=0. 
@@ -9626,6 +9704,7 @@ C...Purpose: to give the mass of a particle/parton.
       SAVE /LUDAT1/,/LUDAT2/ 
  
 C...Reset variables. Compressed code. 
+!$OMP THREADPRIVATE(/LUDAT1/,/LUDAT2/)
       ULMASS=0. 
       KFA=IABS(KF) 
       KC=LUCOMP(KF) 
@@ -9721,6 +9800,7 @@ C...Purpose: to give the particle/parton name as a character string.
       CHARACTER CHAU*16 
  
 C...Initial values. Charge. Subdivide code. 
+!$OMP THREADPRIVATE(/LUDAT1/,/LUDAT2/,/LUDAT4/)
       CHAU=' ' 
       KFA=IABS(KF) 
       KC=LUCOMP(KF) 
@@ -9861,6 +9941,7 @@ C...Purpose: to give three times the charge for a particle/parton.
       SAVE /LUDAT2/ 
  
 C...Initial values. Simple case of direct readout. 
+!$OMP THREADPRIVATE(/LUDAT2/)
       LUCHGE=0 
       KFA=IABS(KF) 
       KC=LUCOMP(KFA) 
@@ -9902,6 +9983,7 @@ C...arrays; also to check whether a given code actually is defined.
      &122,123,332,333,281,282,283,284,285,286,287,231,235,0,0/ 
  
 C...Starting values. 
+!$OMP THREADPRIVATE(/LUDAT2/,KCTAB,KFTAB)
       LUCOMP=0 
       KFA=IABS(KF) 
  
@@ -10016,6 +10098,7 @@ C...Purpose: to inform user of errors in program execution.
       CHARACTER CHMESS*(*) 
  
 C...Write first few warnings, then be silent. 
+!$OMP THREADPRIVATE(/LUDAT1/,/LUJETS/)
       IF(MERR.LE.10) THEN 
         MSTU(27)=MSTU(27)+1 
         MSTU(28)=MERR 
@@ -10068,6 +10151,7 @@ C...Calculate real part of photon vacuum polarization.
 C...For leptons simplify by using asymptotic (Q^2 >> m^2) expressions. 
 C...For hadrons use parametrization of H. Burkhardt et al. 
 C...See R. Kleiss et al, CERN 89-08, vol. 3, pp. 129-131. 
+!$OMP THREADPRIVATE(/LUDAT1/)
       AEMPI=PARU(101)/(3.*PARU(1)) 
       IF(MSTU(101).LE.0.OR.Q2.LT.2D-6) THEN 
         RPIGG=0. 
@@ -10104,6 +10188,7 @@ C...Purpose: to give the value of alpha_strong.
       SAVE /LUDAT1/,/LUDAT2/ 
  
 C...Constant alpha_strong trivial. 
+!$OMP THREADPRIVATE(/LUDAT1/,/LUDAT2/)
       IF(MSTU(111).LE.0) THEN 
         ULALPS=PARU(111) 
         MSTU(118)=MSTU(112) 
@@ -10162,6 +10247,7 @@ C...Purpose: to reconstruct an angle from given x and y coordinates.
       COMMON/LUDAT1/MSTU(200),PARU(200),MSTJ(200),PARJ(200) 
       SAVE /LUDAT1/ 
  
+!$OMP THREADPRIVATE(/LUDAT1/)
       ULANGL=0. 
       R=SQRT(X**2+Y**2) 
       IF(R.LT.1D-20) RETURN 
@@ -10194,6 +10280,11 @@ C...0 and 1, excluding the endpoints.
      &(RRLU98,RRLU(98)),(RRLU99,RRLU(99)),(RRLU00,RRLU(100)) 
  
 C...Initialize generation from given seed. 
+C...With OpenMP each thread draws from its own CRPropa generator,
+C...see sophia_rand_ in PhotoPionProduction.cpp.
+!$    RLU=SOPHIA_RAND()
+!$    RETURN
+ 
       IF(MRLU2.EQ.0) THEN 
         IJ=MOD(MRLU1/30082,31329) 
         KL=MOD(MRLU1,30082) 
@@ -10340,6 +10431,7 @@ C     IMPLICIT DOUBLE PRECISION(D)
       DIMENSION ROT(3,3),PR(3),VR(3),DP(4),DV(4) 
  
 C...Find range of rotation/boost. Convert boost to double precision. 
+!$OMP THREADPRIVATE(/LUDAT1/,/LUJETS/)
       IMIN=1 
       IF(MSTU(1).GT.0) IMIN=MSTU(1) 
       IMAX=N 
@@ -10450,6 +10542,7 @@ C...in particular to exclude unstable or undetectable partons/particles.
       DIMENSION NS(2),PTS(2),PLS(2) 
  
 C...Remove unwanted partons/particles. 
+!$OMP THREADPRIVATE(/LUDAT1/,/LUDAT2/,/LUJETS/)
       IF((MEDIT.GE.0.AND.MEDIT.LE.3).OR.MEDIT.EQ.5) THEN 
         IMAX=N 
         IF(MSTU(2).GT.0) IMAX=MSTU(2) 
@@ -10730,6 +10823,7 @@ C...data, or current parameter values.
       DATA CHDL/'(())',' ','()','!!','<>','==','(==)'/ 
  
 C...Initialization printout: version number and date of last change. 
+!$OMP THREADPRIVATE(/LUDAT1/,/LUDAT2/,/LUDAT3/,/LUJETS/,CHDL)
       IF(MLIST.EQ.0.OR.MSTU(12).EQ.1) THEN 
         CALL LULOGO 
         MSTU(12)=0 
@@ -11081,6 +11175,7 @@ C...Data on months, logo, titles, and references.
      &'te mention.                         '/ 
  
 C...Check if PYTHIA linked. 
+!$OMP THREADPRIVATE(/LUDAT1/,/PYPARS/,LOGO,MONTH,REFER)
       IF(MSTP(183)/10.NE.199) THEN 
         LOGO(32)=' Warning: PYTHIA is not loaded! ' 
         LOGO(33)='Did you remember to link PYDATA?' 
@@ -11177,6 +11272,7 @@ C...Purpose: to facilitate the updating of particle and decay data.
      &'KFDP(I,2)','KFDP(I,3)','KFDP(I,4)','KFDP(I,5)','CHAF(I)  '/ 
  
 C...Write information on file for editing. 
+!$OMP THREADPRIVATE(/LUDAT1/,/LUDAT2/,/LUDAT3/,/LUDAT4/,CHVAR)
       IF(MSTU(12).GE.1) CALL LULIST(0) 
       IF(MUPDA.EQ.1) THEN 
         DO 110 KC=1,MSTU(6) 
@@ -11421,6 +11517,7 @@ C...Purpose: to provide various integer-valued event related data.
  
 C...Default value. For I=0 number of entries, number of stable entries 
 C...or 3 times total charge. 
+!$OMP THREADPRIVATE(/LUDAT1/,/LUDAT2/,/LUJETS/)
       KLU=0 
       IF(I.LT.0.OR.I.GT.MSTU(4).OR.J.LE.0) THEN 
       ELSEIF(I.EQ.0.AND.J.EQ.1) THEN 
@@ -11554,6 +11651,7 @@ C...Purpose: to provide various real-valued event related data.
  
 C...Set default value. For I = 0 sum of momenta or charges, 
 C...or invariant mass of system. 
+!$OMP THREADPRIVATE(/LUDAT1/,/LUDAT2/,/LUJETS/)
       PLU=0. 
       IF(I.LT.0.OR.I.GT.MSTU(4).OR.J.LE.0) THEN 
       ELSEIF(I.EQ.0.AND.J.LE.4) THEN 
@@ -11629,6 +11727,7 @@ C...aplanarity and the related event axes.
       DIMENSION SM(3,3),SV(3,3) 
  
 C...Calculate matrix to be diagonalized. 
+!$OMP THREADPRIVATE(/LUDAT1/,/LUDAT2/,/LUJETS/)
       NP=0 
       DO 110 J1=1,3 
       DO 100 J2=J1,3 
@@ -11771,6 +11870,7 @@ C...and the related event axes.
       DIMENSION TDI(3),TPR(3) 
  
 C...Take copy of particles that are to be considered in thrust analysis. 
+!$OMP THREADPRIVATE(/LUDAT1/,/LUDAT2/,/LUJETS/)
       NP=0 
       PS=0. 
       DO 100 I=1,N 
@@ -11954,6 +12054,8 @@ C...jets/clusters.
       SAVE NSAV,NP,PS,PSS,RINIT,NPRE,NREM 
  
 C...Functions: distance measure in pT or (pseudo)mass. 
+!$OMP THREADPRIVATE(/LUDAT1/,/LUDAT2/,/LUJETS/,NP,NPRE,NREM,NSAV,PS,PSS,
+!$OMP&RINIT)
       R2T(I1,I2)=(P(I1,5)*P(I2,5)-P(I1,1)*P(I2,1)-P(I1,2)*P(I2,2)- 
      &P(I1,3)*P(I2,3))*2.*P(I1,5)*P(I2,5)/(0.0001+P(I1,5)+P(I2,5))**2 
       R2M(I1,I2)=2.*P(I1,4)*P(I2,4)*(1.-(P(I1,1)*P(I2,1)+P(I1,2)* 
@@ -12300,6 +12402,7 @@ C...coordinate frame, as used for calorimeters at hadron colliders.
       SAVE /LUJETS/,/LUDAT1/,/LUDAT2/ 
  
 C...Loop over all particles. Find cell that was hit by given particle. 
+!$OMP THREADPRIVATE(/LUDAT1/,/LUDAT2/,/LUJETS/)
       PTLRAT=1./SINH(PARU(51))**2 
       NP=0 
       NC=N 
@@ -12508,6 +12611,7 @@ C...minimize the sum m_H^2 + m_L^2, a la Clavelli and Wyler.
       DIMENSION SM(3,3),SAX(3),PS(3,5) 
  
 C...Reset. 
+!$OMP THREADPRIVATE(/LUDAT1/,/LUDAT2/,/LUJETS/)
       NP=0 
       DO 120 J1=1,3 
       DO 100 J2=J1,3 
@@ -12678,6 +12782,7 @@ C...Purpose: to calculate the first few Fox-Wolfram moments.
       SAVE /LUJETS/,/LUDAT1/,/LUDAT2/ 
  
 C...Copy momenta for particles and calculate H0. 
+!$OMP THREADPRIVATE(/LUDAT1/,/LUDAT2/,/LUJETS/)
       NP=0 
       H0=0. 
       HD=0. 
@@ -12773,6 +12878,10 @@ C...printed at the end.
      &NEVDC/0/,NKFDC/0/,NREDC/0/ 
  
 C...Reset statistics on initial parton state. 
+!$OMP THREADPRIVATE(/LUDAT1/,/LUDAT2/,/LUDAT3/,/LUJETS/,FE1EA,FE1EC,
+!$OMP&FE2EA,FE2EC,FM1FM,FM2FM,KFDC,KFFS,KFIS,NCHFS,NEVDC,NEVEE,NEVFM,
+!$OMP&NEVFS,NEVIS,NFIFS,NKFDC,NKFFS,NKFIS,NMUFM,NPDC,NPFS,NPIS,NPRFS,
+!$OMP&NREDC)
       IF(MTABU.EQ.10) THEN 
         NEVIS=0 
         NKFIS=0 
@@ -13501,6 +13610,7 @@ C     IMPLICIT DOUBLE PRECISION(D)
       SAVE /LUJETS/,/LUDAT1/,/LUDAT2/ 
  
 C...Check input parameters. 
+!$OMP THREADPRIVATE(/LUDAT1/,/LUDAT2/,/LUJETS/)
       IF(MSTU(12).GE.1) CALL LULIST(0) 
       IF(KFL.LT.0.OR.KFL.GT.8) THEN 
         CALL LUERRM(16,'(LUEEVT:) called with unknown flavour code') 
@@ -13652,6 +13762,7 @@ C...state radiation effects.
       SAVE /LUDAT1/,/LUDAT2/ 
  
 C...Status, (optimized) Q^2 scale, alpha_strong. 
+!$OMP THREADPRIVATE(/LUDAT1/,/LUDAT2/)
       PARJ(151)=ECM 
       MSTJ(119)=10*MSTJ(102)+KFL 
       IF(MSTJ(111).EQ.0) THEN 
@@ -13808,6 +13919,7 @@ C...Purpose: to generate initial state photon radiation.
       SAVE /LUDAT1/ 
  
 C...Function: cumulative hard photon spectrum in QFD case. 
+!$OMP THREADPRIVATE(/LUDAT1/)
       FXK(XX)=2.*LOG(XX)+PARJ(161)*LOG(1.-XX)+PARJ(162)*XX+ 
      &PARJ(163)*LOG((XX-SZM)**2+SZW**2)+PARJ(164)*ATAN((XX-SZM)/SZW) 
  
@@ -13881,6 +13993,7 @@ C...Purpose: to select flavour for produced qqbar pair.
       SAVE /LUDAT1/,/LUDAT2/ 
  
 C...Calculate maximum weight in QED or QFD case. 
+!$OMP THREADPRIVATE(/LUDAT1/,/LUDAT2/)
       IF(MSTJ(102).LE.1) THEN 
         RFMAX=4./9. 
       ELSE 
@@ -13952,6 +14065,7 @@ C...Relative three-jet rate in Zhu second order parametrization.
       DATA ZHUT/3.0922, 6.2291, 7.4782, 7.8440, 8.2560/ 
  
 C...Trivial result for two-jets only, including parton shower. 
+!$OMP THREADPRIVATE(/LUDAT1/,ZHUT)
       IF(MSTJ(101).EQ.0.OR.MSTJ(101).EQ.5) THEN 
         CUT=0. 
  
@@ -14137,6 +14251,7 @@ C...Coefficients of Zhu second order parametrization.
      &    476.9,    29.65,   -239.3,   0.4745,   -1.174,    6.081/ 
  
 C...Dilogarithm of x for x<0.5 (x>0.5 obtained by analytic trick). 
+!$OMP THREADPRIVATE(/LUDAT1/,ZHUP)
       DILOG(X)=X+X**2/4.+X**3/9.+X**4/16.+X**5/25.+X**6/36.+X**7/49. 
  
 C...Event type. Mass effect factors and other common constants. 
@@ -14284,6 +14399,7 @@ C...Purpose: to select the kinematical variables of four-jet events.
       DIMENSION WTA(4),WTB(4),WTC(4),WTD(4),WTE(4) 
  
 C...Common constants. Colour factors for QCD and Abelian gluon theory. 
+!$OMP THREADPRIVATE(/LUDAT1/)
       PMQ=ULMASS(KFL) 
       QME=(2.*PMQ/ECM)**2 
       CT=LOG(1./CUT-5.) 
@@ -14495,6 +14611,7 @@ C...Purpose: to give the angular orientation of events.
       SAVE /LUJETS/,/LUDAT1/,/LUDAT2/ 
  
 C...Charge. Factors depending on polarization for QED case. 
+!$OMP THREADPRIVATE(/LUDAT1/,/LUDAT2/,/LUJETS/)
       QF=KCHG(KFL,1)/3. 
       POLL=1.-PARJ(131)*PARJ(132) 
       POLD=PARJ(132)-PARJ(131) 
@@ -14629,6 +14746,7 @@ C...gluons or two gluons and a photon.
       SAVE /LUJETS/,/LUDAT1/,/LUDAT2/ 
  
 C...Printout. Check input parameters. 
+!$OMP THREADPRIVATE(/LUDAT1/,/LUDAT2/,/LUJETS/)
       IF(MSTU(12).GE.1) CALL LULIST(0) 
       IF(KFL.LT.0.OR.KFL.GT.8) THEN 
         CALL LUERRM(16,'(LUONIA:) called with unknown flavour code') 
@@ -14789,6 +14907,7 @@ C     DOUBLE PRECISION PHEP,VHEP
       SAVE /LUJETS/,/LUDAT1/,/LUDAT2/ 
  
 C...Conversion from JETSET to standard, the easy part. 
+!$OMP THREADPRIVATE(/HEPEVT/,/LUDAT1/,/LUDAT2/,/LUJETS/)
       IF(MCONV.EQ.1) THEN 
         NEVHEP=0 
         IF(N.GT.NMXHEP) CALL LUERRM(8, 
@@ -14935,6 +15054,7 @@ C...run at installation as a check that the program works as intended.
       DIMENSION PSUM(5),PINI(6),PFIN(6) 
  
 C...Loop over events to be generated. 
+!$OMP THREADPRIVATE(/LUDAT1/,/LUJETS/)
       IF(MTEST.GE.1) CALL LUTABU(20) 
       NERR=0 
       DO 180 IEV=1,600 
@@ -15592,6 +15712,7 @@ C...LUDAT4, with character strings.
 C...LUDATR, with initial values for the random number generator. 
       DATA MRLU/19780503,0,0,97,33,0/ 
  
+!$OMP THREADPRIVATE(/LUDAT1/,/LUDAT2/,/LUDAT3/,/LUDAT4/)
       END 
  
 C********************************************************************* 
@@ -15624,6 +15745,7 @@ C...P(I,3), P(I,4) and P(I,5). The rest will be stored automatically.
  
 C...Stop program if this routine is ever called. 
 C...You should not copy these lines to your own routine. 
+!$OMP THREADPRIVATE(/LUDAT1/,/LUJETS/)
       NDECAY=ITAU+IORIG+KFORIG      
       WRITE(MSTU(11),5000) 
       IF(RLU(0).LT.10.) STOP 
@@ -15650,6 +15772,12 @@ C...0 and 1, excluding the endpoints.
       SAVE
  
 C...Initialize generation from given seed.
+!$OMP THREADPRIVATE(I,I24,II,IJ,J,JJ,K,KL,L,M,RUNI,S,T,TWOM24)
+C...With OpenMP each thread draws from its own CRPropa generator,
+C...see sophia_rand_ in PhotoPionProduction.cpp.
+!$    RNDM=SOPHIA_RAND()
+!$    RETURN
+ 
       IF(MRLU2.EQ.0) THEN
         IF (MRLU1 .EQ. 0)  MRLU1 = 19780503    ! initial seed
         IJ=MOD(MRLU1/30082,31329)
@@ -15757,6 +15885,9 @@ c**********************
       double precision functs,gauss,rndm
 
 c*** calculate smin,smax : ************************
+!$OMP THREADPRIVATE(/INPUT/,/S_MASS1/,BETA,BETAI,I_REPT,NMETHOD,PMAX,PP,
+!$OMP&PS,QUO,R1,R2,R3,R4,S0,SINTEGR1,SINTEGR2,SMAX,SMIN,TERM1,TERM2,XMP,
+!$OMP&XMPI)
       xmpi = AM(7)
       xmp = AM(L0)
       Pp = sqrt(E0*E0-xmp*xmp)
@@ -15847,6 +15978,9 @@ c**********************
       double precision prob_epskt,prob_epspl,rndm,gauss
       double precision functs,probint_pl
       
+!$OMP THREADPRIVATE(/INPUT/,/PLINDEX/,/S_MASS1/,BETA,DE,DUM,E1,E2,
+!$OMP&EPS_DUM,FUNCTS,GAUSS,I,I_MAX,I_REP,I_TRY,PP,PROB_EPSKT,PROB_EPSPL,
+!$OMP&PROBINT_PL,R1,RESULT,RMAX,XMP,XMPI)
       xmpi = AM(7)
       xmp = AM(L0)
       Pp = sqrt(E0*E0-xmp*xmp)
@@ -15907,6 +16041,10 @@ c**********************
       double precision prob_epskt,prob_epspl,rndm,gauss
       double precision functs,probint_pl
 
+!$OMP THREADPRIVATE(/INPUT/,/PLINDEX/,/S_MASS1/,A1,A2,A3,ALPHA12,AMPL,
+!$OMP&BETA,BETAI,BETAP,CNORM,EPSBX,EPSDELTA,EPSKT,EPSMX1,EPSMX2,EPSPMAX,
+!$OMP&EPSTH,EPSXX,EPXX,FACPMAX,GAMMAP,PEPS,PINTEGR1,PINTEGR2,PINTEGR3,
+!$OMP&PMAX,PMAXC,PP,R1,R2,RN,TERM1,TERM2,XMP,XMPI)
       xmpi = AM(7)
       xmp = AM(L0)
       gammap = E0/xmp
@@ -16153,6 +16291,8 @@ c**********************
        external functs,photd,gauss
        double precision functs,photd,gauss
 
+!$OMP THREADPRIVATE(/INPUT/,BETAP,DEPS,GAMMAP,PP,SINTEGR,SMAX,SMIN,XMP,
+!$OMP&XMPI)
        xmpi = 0.135D0
        xmp = 0.93827D0
        Pp = sqrt(E0*E0-xmp*xmp)
@@ -16195,6 +16335,8 @@ c**********************
        external functs,gauss
        double precision functs,gauss
 
+!$OMP THREADPRIVATE(/INPUT/,ALPHA12,AMPL,BETAP,DEPS,GAMMAP,PP,SINTEGR,
+!$OMP&SMAX,SMIN,XMP,XMPI)
        xmpi = 0.135D0
        xmp = 0.93827D0
        Pp = sqrt(E0*E0-xmp*xmp)
@@ -16234,6 +16376,7 @@ c**********************
 
         SAVE
 
+!$OMP THREADPRIVATE(P1)
         if (p.eq.1.D0) then
           probint_pl = log(epsf/epsi)
         else
@@ -16265,6 +16408,7 @@ c**********************
         double precision crossection
 
 
+!$OMP THREADPRIVATE(/INPUT/,EPSPRIME,FACTOR,PM,SIGMA_PG)
         pm = 0.93827D0
         factor = (s-pm*pm)
         epsprime = factor/2.D0/pm
@@ -16284,6 +16428,7 @@ C **************************************************************
 	IMPLICIT DOUBLE PRECISION (A-H,O-Z)
         SAVE
 C CONVERT TEMPERATURE TO eV
+!$OMP THREADPRIVATE(BB,EKT,EPH,EPHKT,FEE)
 	EPH = EPS
         EKT = 8.619D-5*TBB
         EPHKT = EPS/EKT
@@ -16332,6 +16477,7 @@ c       PARAMETER  (FLUX_CONVERSION = 3.82182d3)
 c        print*,Z
 
 c conversion from eV to micrometers
+!$OMP THREADPRIVATE(/REDSHIFT/,I,INDEX,RESULT,X,XDATA,YDATA)
         X = 1.2398d0*(1.+Z)/EPS
         if (X.gt.500.) then
            RESULT=0.
@@ -16377,6 +16523,7 @@ c**********************
        DATA A / 0.D0,1.D0,2.D0,3.D0/
        DATA AINDEX / 8.D8,5.D8,5.D8,1.D9/
 
+!$OMP THREADPRIVATE(A,AINDEX,NI,P1,P2,TANG)
        plinterpol = 0.D0
 
        do 1 ni=1,3
@@ -16414,6 +16561,7 @@ c**********************
      &           epsm1,epsm2,epsb,L0
 
 
+!$OMP THREADPRIVATE(/INPUT/,ALPHA12,AMPL)
        alpha12 = alpha2-alpha1
        ampl = epsb**alpha12
        if (eps.lt.epsb) then
@@ -16444,6 +16592,8 @@ C **************************************************************
        COMMON /REDSHIFT/ Z,ZMAX_IR
        external functs,gauss
 
+!$OMP THREADPRIVATE(/INPUT/,/REDSHIFT/,/S_MASS1/,EPS,PP,RESULT,S0,SMAX,
+!$OMP&SMIN,XMP,XMPI)
        eps=dexp(eps_ln)
        xmpi = AM(7)
        xmp = AM(L0)
@@ -16476,6 +16626,7 @@ C **************************************************************
        COMMON /REDSHIFT/ Z,ZMAX_IR
        external functs_int_ir,gauss
 
+!$OMP THREADPRIVATE(/INPUT/,/REDSHIFT/,/S_MASS1/,PM,PP,RESULT,XMP,XMPI)
        pm = 0.93827D0
        xmpi = AM(7)
        xmp = AM(L0)
@@ -16506,6 +16657,8 @@ C **************************************************************
        COMMON /REDSHIFT/ Z,ZMAX_IR
        external functs,gauss
 
+!$OMP THREADPRIVATE(/INPUT/,/REDSHIFT/,/S_MASS1/,EPS,PP,RESULT,S0,SMAX,
+!$OMP&SMIN,XMP,XMPI)
        eps=dexp(eps_ln)
        xmpi = AM(7)
        xmp = AM(L0)
@@ -16538,6 +16691,7 @@ C **************************************************************
        COMMON /REDSHIFT/ Z,ZMAX_IR
        external functs_int_cmb,gauss
 
+!$OMP THREADPRIVATE(/INPUT/,/REDSHIFT/,/S_MASS1/,PM,PP,RESULT,XMP,XMPI)
        pm = 0.93827D0
        xmpi = AM(7)
        xmp = AM(L0)
@@ -16763,6 +16917,9 @@ cc 15.09.2009
       integer idatamax
       double precision en_data(idatamax),flux_data(idatamax) ! eV, eV/cm3
 cc
+!$OMP THREADPRIVATE(/INPUT/,/REDSHIFT/,/RES_PROP/,/RES_PROPN/,
+!$OMP&/RES_PROPP/,/S_CHP/,/S_CSYDEC/,/S_MASS1/,/S_PLIST/,EPS,EPSEV,
+!$OMP&EPSMAX,EPSMIN,I,IMODE,J,PI,PM,PP,S,THETA)
       if (nature.eq.0) then 
          L0=13
       else if (nature.eq.1) then
@@ -16864,6 +17021,8 @@ cc 15.09.2009
 ccc
 
 
+!$OMP THREADPRIVATE(/INPUT/,/PLINDEX/,/S_MASS1/,ALPHA,E2PROB_MAX,
+!$OMP&EPS_MAX,EPSTH,F_COMP,FACTOR,I,PP,PROB,R1,R2,SMIN,XMP,XMPI)
       xmpi = AM(7)              ! Mpion (GeV)
       xmp = AM(L0)              ! Mp (GeV) 
       smin = 1.1646D0 ! (xmpi+xmp)**2      
@@ -16951,6 +17110,7 @@ c
       double precision en_data(idatamax),flux_data(idatamax) ! eV, eV/cm3
 c
 
+!$OMP THREADPRIVATE(/INPUT/,/S_MASS1/)
       xmpi = 0.135D0
       xmp = am(l0)              
       Pp = sqrt(E0*E0-xmp*xmp)
@@ -17029,6 +17189,7 @@ C
 C  TABULAR INTERPOLATION USING SYMMETRICALLY PLACED ARGUMENT POINTS.
 C
 C  START.  FIND SUBSCRIPT IX OF X IN ARRAY A.
+!$OMP THREADPRIVATE(MMAX)
       IF( (NN.LT.2) .OR. (MM.LT.1) ) GO TO 20
       N=NN
       M=MM
@@ -17151,6 +17312,8 @@ c**********************************
 
       DATA pi /3.141593D0/
 
+!$OMP THREADPRIVATE(/INPUT/,/REDSHIFT/,/RES_PROP/,/RES_PROPN/,
+!$OMP&/RES_PROPP/,/S_CHP/,/S_CSYDEC/,/S_MASS1/,/S_PLIST/,PI,PM)
       L0=Npartid
 
       call initial(L0)
@@ -1,5 +1,11 @@
 /* 1. SWIG settings and workarounds */
 
+/* threads="1": each wrapped call releases the GIL, so long running calls
+   like ModuleList::run or initTurbulence let other Python threads run.
+   Directors (modules, sources and surfaces written in Python) take the GIL
+   for each call; a Python source that implements getCandidates delivers the
+   batch of primaries of a thread (ModuleList::setSourceBatchSize) at once.
+   Extensions that use the Python API are wrapped in %nothread. */
 %module(directors="1", threads="1", allprotected="1") crpropa
 
 %feature("director:except") {
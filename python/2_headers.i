@@ -48,20 +48,34 @@
 %ignore operator crpropa::AdvectionField*;
 %ignore operator crpropa::ParticleCollector*;
 %ignore crpropa::TextOutput::load;
+%ignore crpropa::BinaryOutput::load;
+%ignore crpropa::hdf5Lock;
+%ignore crpropa::TrajectoryOutput::load;
+%ignore *::prepareParticles;
+%ignore *::prepareCandidates;
+%ignore *::prepareSourceStates;
 
 %feature("ref")   crpropa::Referenced "$this->addReference();"
 %feature("unref") crpropa::Referenced "$this->removeReference();"
 
 
+%ignore crpropa::ScopedLock;
+%include "crpropa/Lock.h"
 %include "crpropa/Logging.h"
 %include "crpropa/Vector3.h"
 %include "crpropa/Referenced.h"
 %include "crpropa/Units.h"
 %include "crpropa/Common.h"
+%include "crpropa/Affinity.h"
 %include "crpropa/Cosmology.h"
+%template(PhotonFieldScalingRefPtr) crpropa::ref_ptr<crpropa::PhotonFieldScaling>;
+%template(CustomPhotonFieldRefPtr) crpropa::ref_ptr<crpropa::CustomPhotonField>;
 %include "crpropa/PhotonBackground.h"
+%include "crpropa/PhotonFieldRates.h"
+%ignore crpropa::PhotonOutput1DMagic;
 %include "crpropa/PhotonPropagation.h"
 %include "crpropa/Random.h"
+%implicitconv crpropa::SharedParticleState;
 %include "crpropa/ParticleState.h"
 %include "crpropa/ParticleID.h"
 %include "crpropa/ParticleMass.h"
@@ -70,7 +84,7 @@
 %import "crpropa/Variant.h"
 
 /* override Candidate::getProperty() */
-%ignore crpropa::Candidate::getProperty(const std::string &) const;
+%ignore crpropa::Candidate::getProperty(const crpropa::PropertyKey &) const;
 
 %nothread; /* disable threading for extend*/
 %extend crpropa::Candidate {
@@ -265,20 +279,61 @@
 
 %template(CandidateVector) std::vector< crpropa::ref_ptr<crpropa::Candidate> >;
 %template(CandidateRefPtr) crpropa::ref_ptr<crpropa::Candidate>;
+%ignore crpropa::SmallVector::operator[];
+%ignore crpropa::SmallVector::begin;
+%ignore crpropa::SmallVector::end;
+%ignore crpropa::SmallVector::data;
+%include "crpropa/SmallVector.h"
+%extend crpropa::SmallVector {
+  T __getitem__(size_t i) {
+        if (i >= $self->size()) {
+                throw RangeError();
+        }
+        return (*($self))[i];
+  }
+  size_t __len__() {
+        return $self->size();
+  }
+};
+%template(CandidateSmallVector) crpropa::SmallVector<crpropa::ref_ptr<crpropa::Candidate>, 4>;
+%template(CandidatePointerVector) std::vector<crpropa::Candidate *>;
+%implicitconv crpropa::PropertyKey;
 %include "crpropa/Candidate.h"
 
 %feature("director") crpropa::Surface;
 %feature("director") crpropa::ClosedSurface;
 %include "crpropa/Geometry.h"
 
+%template(ConfigurationDocumentRefPtr) crpropa::ref_ptr<crpropa::ConfigurationDocument>;
+%include "crpropa/Configuration.h"
+
 %template(ModuleRefPtr) crpropa::ref_ptr<crpropa::Module>;
 %template(stdModuleList) std::list< crpropa::ref_ptr<crpropa::Module> >;
 %feature("director") crpropa::Module;
 %feature("director") crpropa::AbstractCondition;
+%feature("director") crpropa::Interaction;
+%feature("director") crpropa::ContinuousLoss;
+%feature("director") crpropa::BatchModule;
 %include "crpropa/Module.h"
+%template(InteractionRefPtr) crpropa::ref_ptr<crpropa::Interaction>;
+%template(ContinuousLossRefPtr) crpropa::ref_ptr<crpropa::ContinuousLoss>;
 
 %implicitconv crpropa::ref_ptr<crpropa::MagneticField>;
 %template(MagneticFieldRefPtr) crpropa::ref_ptr<crpropa::MagneticField>;
+%feature("director") crpropa::BatchMagneticField;
+#ifdef WITHNUMPY
+/* the arrays of BatchMagneticField::getFieldArray as NumPy views (n, 3) */
+%typemap(directorin) const crpropa::Vector3dArray & {
+  npy_intp dims[2] = {(npy_intp) $1.size, 3};
+  $input = PyArray_New(&PyArray_Type, 2, dims, NPY_DOUBLE, NULL,
+      (void *) $1.data, 0, NPY_ARRAY_CARRAY_RO, NULL);
+}
+%typemap(directorin) crpropa::Vector3dArray & {
+  npy_intp dims[2] = {(npy_intp) $1.size, 3};
+  $input = PyArray_New(&PyArray_Type, 2, dims, NPY_DOUBLE, NULL,
+      (void *) $1.data, 0, NPY_ARRAY_CARRAY, NULL);
+}
+#endif
 %include "crpropa/magneticField/MagneticField.h"
 
 %implicitconv crpropa::ref_ptr<crpropa::AdvectionField>;
@@ -289,6 +344,12 @@
 %template(DensityRefPtr) crpropa::ref_ptr<crpropa::Density>;
 %include "crpropa/massDistribution/Density.h"
 
+%template(MappedFileRefPtr) crpropa::ref_ptr<crpropa::MappedFile>;
+%include "crpropa/MappedFile.h"
+%template(DataTableRefPtr) crpropa::ref_ptr<crpropa::DataTable>;
+%ignore crpropa::DataTable::write;
+%include "crpropa/DataTable.h"
+%include "crpropa/SimulationBundle.h"
 %include "crpropa/Grid.h"
 %include "crpropa/GridTools.h"
 
@@ -300,6 +361,21 @@
 %template(ScalarGridRefPtr) crpropa::ref_ptr<crpropa::Grid<float> >;
 %template(ScalarGrid) crpropa::Grid<float>;
 
+%template(GridValueVector3s) crpropa::GridValue<crpropa::Vector3s>;
+%implicitconv crpropa::ref_ptr<crpropa::Grid<crpropa::Vector3s> >;
+%template(QuantizedVectorGridRefPtr) crpropa::ref_ptr<crpropa::Grid<crpropa::Vector3s> >;
+%template(QuantizedVectorGrid) crpropa::Grid<crpropa::Vector3s>;
+
+%include "crpropa/SparseGrid.h"
+%implicitconv crpropa::ref_ptr<crpropa::SparseGrid<crpropa::Vector3<float> > >;
+%template(SparseVectorGridRefPtr) crpropa::ref_ptr<crpropa::SparseGrid<crpropa::Vector3<float> > >;
+%template(SparseVectorGrid) crpropa::SparseGrid<crpropa::Vector3<float> >;
+
+%implicitconv crpropa::ref_ptr<crpropa::SparseGrid<float> >;
+%template(SparseScalarGridRefPtr) crpropa::ref_ptr<crpropa::SparseGrid<float> >;
+%template(SparseScalarGrid) crpropa::SparseGrid<float>;
+
+%template(StringVector) std::vector<std::string>;
 %include "crpropa/EmissionMap.h"
 %implicitconv crpropa::ref_ptr<crpropa::EmissionMap>;
 %template(EmissionMapRefPtr) crpropa::ref_ptr<crpropa::EmissionMap>;
@@ -307,12 +383,19 @@
 %template(CylindricalProjectionMapRefPtr) crpropa::ref_ptr<crpropa::CylindricalProjectionMap>;
 
 %include "crpropa/magneticField/MagneticFieldGrid.h"
+%include "crpropa/advectionField/AdvectionFieldGrid.h"
 %feature("notabstract") QuimbyMagneticFieldAdapter;
 %include "crpropa/magneticField/QuimbyMagneticField.h"
 %include "crpropa/magneticField/AMRMagneticField.h"
 %include "crpropa/magneticField/JF12Field.h"
 %include "crpropa/magneticField/JF12FieldSolenoidal.h"
 %include "crpropa/magneticField/PT11Field.h"
+%include "crpropa/magneticField/PlaneWaveTurbulence.h"
+%include "crpropa/magneticField/CachedMagneticField.h"
+%include "crpropa/magneticField/MagneticFieldSnapshots.h"
+%include "crpropa/magneticField/NestedTurbulenceField.h"
+%include "crpropa/magneticField/OctreeMagneticField.h"
+%template(OctreeNodeVector) std::vector<crpropa::OctreeNode>;
 %include "crpropa/magneticField/ArchimedeanSpiralField.h"
 %include "crpropa/module/BreakCondition.h"
 %include "crpropa/module/Boundary.h"
@@ -321,9 +404,12 @@
 %feature("director") crpropa::ObserverFeature;
 %include "crpropa/module/Observer.h"
 %include "crpropa/module/SimplePropagation.h"
+%include "crpropa/module/PropagationBP.h"
 %include "crpropa/module/PropagationCK.h"
+%include "crpropa/module/PropagationCKOffload.h"
 
 %ignore crpropa::Output::enableProperty(const std::string &property, const Variant& defaultValue, const std::string &comment = "");
+%nothread; /* the extension uses the Python API */
 %extend crpropa::Output{
   PyObject * enableProperty(const std::string &name, PyObject* defaultValue, const std::string &comment="")
   {
@@ -393,17 +479,39 @@
 
   }
 }
+%thread;
 
 
+// before the outputs, their inputs are sources of the next stage
+%template(SourceInterfaceRefPtr) crpropa::ref_ptr<crpropa::SourceInterface>;
+%feature("director") crpropa::SourceInterface;
+%template(SourceFeatureRefPtr) crpropa::ref_ptr<crpropa::SourceFeature>;
+%feature("director") crpropa::SourceFeature;
+%feature("director") crpropa::BatchSourceFeature;
+%template(AdaptiveSourceSamplingRefPtr) crpropa::ref_ptr<crpropa::AdaptiveSourceSampling>;
+%include "crpropa/Source.h"
+
+%template(OutputFilterRefPtr) crpropa::ref_ptr<crpropa::OutputFilter>;
+%include "crpropa/module/OutputFilter.h"
 %include "crpropa/module/Output.h"
 %include "crpropa/module/DiffusionSDE.h"
 %include "crpropa/module/TextOutput.h"
+%template(BinaryInputRefPtr) crpropa::ref_ptr<crpropa::BinaryInput>;
+%include "crpropa/module/BinaryOutput.h"
+%include "crpropa/module/TrajectoryOutput.h"
+%include "crpropa/module/NetworkOutput.h"
 
 %include "crpropa/module/HDF5Output.h"
+%include "crpropa/module/HDF5ColumnOutput.h"
+%include "crpropa/module/HistogramOutput.h"
 %include "crpropa/module/OutputShell.h"
 %include "crpropa/module/EMCascade.h"
 %include "crpropa/module/PhotonEleCa.h"
 %include "crpropa/module/PhotonOutput1D.h"
+%template(ResponseMatrixRefPtr) crpropa::ref_ptr<crpropa::ResponseMatrix>;
+%include "crpropa/module/ResponseMatrix.h"
+%template(EventReweightingRefPtr) crpropa::ref_ptr<crpropa::EventReweighting>;
+%include "crpropa/module/EventReweighting.h"
 %include "crpropa/module/NuclearDecay.h"
 %include "crpropa/module/ElectronPairProduction.h"
 %include "crpropa/module/PhotoPionProduction.h"
@@ -411,22 +519,24 @@
 %include "crpropa/module/ElasticScattering.h"
 %include "crpropa/module/Redshift.h"
 %include "crpropa/module/RestrictToRegion.h"
+%template(PPSecondariesEnergyDistributionRefPtr) crpropa::ref_ptr<crpropa::PPSecondariesEnergyDistribution>;
 %include "crpropa/module/EMPairProduction.h"
 %include "crpropa/module/EMDoublePairProduction.h"
 %include "crpropa/module/EMTripletPairProduction.h"
+%template(ICSSecondariesEnergyDistributionRefPtr) crpropa::ref_ptr<crpropa::ICSSecondariesEnergyDistribution>;
 %include "crpropa/module/EMInverseComptonScattering.h"
 %include "crpropa/module/SynchrotronRadiation.h"
 %include "crpropa/module/AdiabaticCooling.h"
+%include "crpropa/module/ConditionSet.h"
+%include "crpropa/module/InteractionCollection.h"
+%include "crpropa/module/ContinuousLossCollection.h"
+%include "crpropa/module/Propagation1D.h"
+%include "crpropa/module/ImportanceSampling.h"
+%include "crpropa/module/Backtracking.h"
 
 %template(IntSet) std::set<int>;
 %include "crpropa/module/Tools.h"
 
-%template(SourceInterfaceRefPtr) crpropa::ref_ptr<crpropa::SourceInterface>;
-%feature("director") crpropa::SourceInterface;
-%template(SourceFeatureRefPtr) crpropa::ref_ptr<crpropa::SourceFeature>;
-%feature("director") crpropa::SourceFeature;
-%include "crpropa/Source.h"
-
 %inline %{
 class ModuleListIterator {
   public:
@@ -468,40 +578,48 @@ class ModuleListIterator {
   }
 };
 
+%ignore crpropa::PerfCounters::read;
+%include "crpropa/PerfCounters.h"
 %template(ModuleListRefPtr) crpropa::ref_ptr<crpropa::ModuleList>;
 %include "crpropa/ModuleList.h"
+%include "crpropa/ModulePipeline.h"
+%include "crpropa/MPIRunner.h"
+%template(SimulationJobRefPtr) crpropa::ref_ptr<crpropa::SimulationJob>;
+%template(SimulationPoolRefPtr) crpropa::ref_ptr<crpropa::SimulationPool>;
+%include "crpropa/SimulationPool.h"
 
 %template(ParticleCollectorRefPtr) crpropa::ref_ptr<crpropa::ParticleCollector>;
 
 %inline %{
 class ParticleCollectorIterator {
   public:
+        // by index, to include the candidates spilled to disk
         ParticleCollectorIterator(
-                crpropa::ParticleCollector::iterator _cur,
-                crpropa::ParticleCollector::iterator _end) :
-                        cur(_cur), end(_end) {}
+                const crpropa::ParticleCollector *_collector) :
+                        collector(_collector), cur(0) {}
         ParticleCollectorIterator* __iter__() { return this; }
-        crpropa::ParticleCollector::iterator cur;
-        crpropa::ParticleCollector::iterator end;
+        const crpropa::ParticleCollector *collector;
+        size_t cur;
   };
 %}
 
 %extend ParticleCollectorIterator {
 #ifdef SWIG_PYTHON3
-  crpropa::ref_ptr<crpropa::Candidate>& __next__() {
+  crpropa::ref_ptr<crpropa::Candidate> __next__() {
 #else
-  crpropa::ref_ptr<crpropa::Candidate>& next() {
+  crpropa::ref_ptr<crpropa::Candidate> next() {
 #endif
-    if ($self->cur != $self->end) {
-        return *$self->cur++;
+    if ($self->cur < $self->collector->size()) {
+        return (*$self->collector)[$self->cur++];
     }
     throw StopIterator();
   }
 }
 
+%nothread; /* __getitem__ uses the Python API */
 %extend crpropa::ParticleCollector {
   ParticleCollectorIterator __iter__() {
-        return ParticleCollectorIterator($self->begin(), $self->end());
+        return ParticleCollectorIterator($self);
   }
   crpropa::ref_ptr<crpropa::Candidate> __getitem__(size_t i) {
         if (i >= $self->size()) {
@@ -522,12 +640,8 @@ class ParticleCollectorIterator {
                     PySlice_GetIndicesEx((PySliceObject*)param, len, &start, &stop, &step, &slicelength);
                 #endif
 
-                for(crpropa::ParticleCollector::iterator itr = $self->begin(); itr != $self->end(); ++itr){
-                        if( i >= start && i < stop){
-                                result.push_back(itr->get());
-                        }
-                        ++i;
-                }
+                for (i = start; (step > 0) ? (i < stop) : (i > stop); i += step)
+                        result.push_back((*($self))[i]);
                 return result;
         } else {
                 throw RangeError();
@@ -537,13 +651,27 @@ class ParticleCollectorIterator {
         return $self->size();
   }
 };
-
+%thread;
+
+%template(DoubleVector) std::vector<double>;
+%include "crpropa/Statistics.h"
+%include "crpropa/Trace.h"
+%ignore crpropa::MemoryAccount;
+%ignore crpropa::MemoryAccounting::countCandidates;
+%include "crpropa/MemoryAccounting.h"
+%ignore crpropa::ParticleCollector::getColumns(const std::vector<std::string> &, double *) const;
+%template(SizeVector) std::vector<size_t>;
 %include "crpropa/module/ParticleCollector.h"
 
+%template(AutotuneSetupRefPtr) crpropa::ref_ptr<crpropa::AutotuneSetup>;
+%feature("director") crpropa::AutotuneSetup;
+%include "crpropa/Autotuner.h"
+
 %include "crpropa/massDistribution/Density.h"
 %include "crpropa/massDistribution/Nakanishi.h"
 %include "crpropa/massDistribution/Cordes.h"
 %include "crpropa/massDistribution/Ferriere.h"
 %include "crpropa/massDistribution/Massdistribution.h"
 %include "crpropa/massDistribution/ConstantDensity.h"
+%include "crpropa/massDistribution/CachedDensity.h"
 
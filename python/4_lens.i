@@ -33,13 +33,14 @@ __WITHNUMPY = False
 %include typemaps.i
 
 %template(IntVector) std::vector<int>;
-%template(DoubleVector) std::vector<double>;
 
 %{
 #include "crpropa/magneticLens/ModelMatrix.h"
 #include "crpropa/magneticLens/Pixelization.h"
 #include "crpropa/magneticLens/MagneticLens.h"
+#include "crpropa/magneticLens/LensOffload.h"
 #include "crpropa/magneticLens/ParticleMapsContainer.h"
+#include "crpropa/magneticLens/LensBuilder.h"
 %}
 
 %include "crpropa/magneticLens/ModelMatrix.h"
@@ -64,6 +65,9 @@ __WITHNUMPY = False
 %include "crpropa/magneticLens/MagneticLens.h"
 %template(LenspartVector) std::vector< crpropa::LensPart *>;
 
+/* the extensions use the Python API and hold the GIL, it is released
+   around the lens application */
+%nothread;
 #ifdef WITHNUMPY
 %extend crpropa::MagneticLens{
     PyObject * transformModelVector_numpyArray(PyObject *input, double rigidity)
@@ -83,7 +87,9 @@ __WITHNUMPY = False
       }
 
       double *dataPointer = (double*) PyArray_DATA(arr);
+      Py_BEGIN_ALLOW_THREADS
       $self->transformModelVector(dataPointer, rigidity);
+      Py_END_ALLOW_THREADS
       return input;
     }
 };
@@ -96,6 +102,56 @@ __WITHNUMPY = False
     }
 };
 #endif
+%thread;
+
+%ignore crpropa::LensOffload::transform;
+%ignore crpropa::LensOffload::transformModelVector;
+%ignore crpropa::LensOffload::transformModelVectors;
+%include "crpropa/magneticLens/LensOffload.h"
+
+%nothread;
+#ifdef WITHNUMPY
+%extend crpropa::LensOffload{
+    /* transforms the model vectors, the rows of a writeable C-contiguous
+       float64 array of shape ([n,] pixels), in place */
+    PyObject * transformModelVectors_numpyArray(PyObject *input, double rigidity)
+    {
+      PyArrayObject *arr = (PyArrayObject *) input;
+      size_t nPix = $self->getLens().getPixelization().nPix();
+      if (!PyArray_Check(input) || (PyArray_TYPE(arr) != NPY_DOUBLE)
+          || !PyArray_IS_C_CONTIGUOUS(arr) || !PyArray_ISWRITEABLE(arr)
+          || (PyArray_NDIM(arr) < 1) || (PyArray_NDIM(arr) > 2)
+          || ((size_t) PyArray_DIM(arr, PyArray_NDIM(arr) - 1) != nPix))
+      {
+        PyErr_SetString(PyExc_ValueError,
+            "LensOffload: no writeable C-contiguous float64 array of shape ([n,] pixels)");
+        return NULL;
+      }
+      size_t n = (PyArray_NDIM(arr) == 2) ? PyArray_DIM(arr, 0) : 1;
+      double *data = (double*) PyArray_DATA(arr);
+      std::vector<double*> models(n);
+      for (size_t i = 0; i < n; i++)
+        models[i] = data + i * nPix;
+      if (n > 0)
+      {
+        Py_BEGIN_ALLOW_THREADS
+        $self->transformModelVectors(&models[0], n, rigidity);
+        Py_END_ALLOW_THREADS
+      }
+      Py_INCREF(input);
+      return input;
+    }
+};
+#else
+%extend crpropa::LensOffload{
+    PyObject * transformModelVectors_numpyArray(PyObject *input, double rigidity)
+    {
+      std::cerr << "ERROR: PARSEC was compiled without numpy support!" << std::endl;
+      Py_RETURN_NONE;
+    }
+};
+#endif
+%thread;
 
 
 
@@ -107,6 +163,7 @@ __WITHNUMPY = False
 %ignore ParticleMapsContainer::getRandomParticles;
 %include "crpropa/magneticLens/ParticleMapsContainer.h"
 
+%nothread; /* the extensions use the Python API */
 #ifdef WITHNUMPY
 %extend crpropa::ParticleMapsContainer{
         PyObject *addParticles(PyObject *particleIds,
@@ -274,8 +331,10 @@ __WITHNUMPY = False
 			vector<double> energy;
       vector<double> galacticLongitudes;
 			vector<double> galacticLatitudes;
+      Py_BEGIN_ALLOW_THREADS
       $self->getRandomParticles(N, particleId, energy, galacticLongitudes,
           galacticLatitudes);
+      Py_END_ALLOW_THREADS
 
       npy_intp size = N;
       PyObject *oId = PyArray_SimpleNew(1, &size, NPY_INT);
@@ -331,6 +390,13 @@ __WITHNUMPY = False
   }
 };
 #endif // with numpy
+%thread;
+
+
+/* 6. Lens builder */
+
+%ignore crpropa::LensBuilder::Transition;
+%include "crpropa/magneticLens/LensBuilder.h"
 
 #endif // WITH_GALACTIC_LENSES_
 
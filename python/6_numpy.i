@@ -0,0 +1,178 @@
+/* 6. NumPy arrays of collected candidates and views of grids */
+
+#ifdef WITHNUMPY
+
+/* the functions use the Python API and hold the GIL, it is released while
+   the columns are filled */
+%nothread;
+
+%{
+/* drops the reference of a NumPy view to its grid */
+static void crpropa_releaseGrid(PyObject *capsule) {
+  crpropa::Referenced *grid = static_cast<crpropa::Referenced *>(
+      PyCapsule_GetPointer(capsule, NULL));
+  grid->removeReference();
+}
+
+/* array of shape (Nx, Ny, Nz[, components]) over the values of a grid,
+   without a copy; the grid is kept alive by the array */
+template<typename T>
+static PyObject *crpropa_gridArray(crpropa::ref_ptr<crpropa::Grid<T> > grid,
+    int typenum, int components) {
+  if (grid->isBricked()) {
+    PyErr_SetString(PyExc_RuntimeError,
+        "Grid: no array view of bricked grids, use setBricked(False)");
+    return NULL;
+  }
+  npy_intp dims[4] = {(npy_intp) grid->getNx(), (npy_intp) grid->getNy(),
+      (npy_intp) grid->getNz(), components};
+  int ndim = (components > 1) ? 4 : 3;
+  // mapped files are not written back, their views are read-only
+  int flags = grid->isMapped() ? NPY_ARRAY_CARRAY_RO : NPY_ARRAY_CARRAY;
+  PyObject *array = PyArray_New(&PyArray_Type, ndim, dims, typenum, NULL,
+      (void *) grid->getData(), 0, flags, NULL);
+  if (!array)
+    return NULL;
+  crpropa::Grid<T> *g = grid.get();
+  g->addReference();
+  PyObject *capsule = PyCapsule_New(static_cast<crpropa::Referenced *>(g), NULL,
+      crpropa_releaseGrid);
+  PyArray_SetBaseObject((PyArrayObject *) array, capsule);
+  return array;
+}
+
+/* holds a reference of a Python object for C++ */
+class crpropa_PythonOwner: public crpropa::Referenced {
+  PyObject *object;
+public:
+  crpropa_PythonOwner(PyObject *object) : object(object) {
+    Py_INCREF(object);
+  }
+  ~crpropa_PythonOwner() {
+    PyGILState_STATE state = PyGILState_Ensure();
+    Py_DECREF(object);
+    PyGILState_Release(state);
+  }
+};
+%}
+
+%inline %{
+PyObject *VectorGrid_numpyArray(crpropa::ref_ptr<crpropa::Grid<crpropa::Vector3<float> > > grid) {
+  return crpropa_gridArray(grid, NPY_FLOAT32, 3);
+}
+PyObject *ScalarGrid_numpyArray(crpropa::ref_ptr<crpropa::Grid<float> > grid) {
+  return crpropa_gridArray(grid, NPY_FLOAT32, 1);
+}
+PyObject *QuantizedVectorGrid_numpyArray(crpropa::ref_ptr<crpropa::Grid<crpropa::Vector3s> > grid) {
+  return crpropa_gridArray(grid, NPY_INT16, 3);
+}
+%}
+
+%extend crpropa::ParticleCollector {
+  /* array of shape (size(), len(columns)) filled in one pass, see getColumns */
+  PyObject *getColumns_numpyArray(const std::vector<std::string> &columns) {
+    npy_intp dims[2] = {(npy_intp) $self->size(), (npy_intp) columns.size()};
+    PyObject *array = PyArray_SimpleNew(2, dims, NPY_DOUBLE);
+    if (array && (dims[0] * dims[1] > 0)) {
+      double *data = (double *) PyArray_DATA((PyArrayObject *) array);
+      Py_BEGIN_ALLOW_THREADS
+      $self->getColumns(columns, data);
+      Py_END_ALLOW_THREADS
+    }
+    return array;
+  }
+}
+
+%extend crpropa::ArraySource {
+  /* reads an aligned array of int (id) or float64 in place, other arrays are
+     converted first; the array is kept alive by the source */
+  PyObject *setColumn_numpyArray(const std::string &name, PyObject *input) {
+    bool vector = (name == "position") || (name == "direction");
+    int typenum = (name == "id") ? NPY_INT : NPY_DOUBLE;
+    PyArrayObject *array = (PyArrayObject *) PyArray_FROM_OTF(input, typenum,
+        NPY_ARRAY_ALIGNED);
+    if (!array)
+      return NULL;
+    npy_intp *strides = PyArray_STRIDES(array);
+    bool negative = false;
+    for (int i = 0; i < PyArray_NDIM(array); i++)
+      negative = negative || (strides[i] < 0);
+    if (negative) {
+      PyArrayObject *copy = (PyArrayObject *) PyArray_NewCopy(array, NPY_CORDER);
+      Py_DECREF(array);
+      if (!copy)
+        return NULL;
+      array = copy;
+      strides = PyArray_STRIDES(array);
+    }
+    if ((PyArray_NDIM(array) != (vector ? 2 : 1))
+        || ((size_t) PyArray_DIM(array, 0) != $self->size())
+        || (vector && (PyArray_DIM(array, 1) != 3))) {
+      Py_DECREF(array);
+      PyErr_SetString(PyExc_ValueError, vector ?
+          "ArraySource: column is not of shape (size(), 3)" :
+          "ArraySource: column is not of shape (size(),)");
+      return NULL;
+    }
+    const char *data = PyArray_BYTES(array);
+    if (name == "id")
+      $self->setIds((const int *) data, strides[0]);
+    else if (name == "energy")
+      $self->setEnergies((const double *) data, strides[0]);
+    else if (name == "position")
+      $self->setPositions((const double *) data, strides[0], strides[1]);
+    else if (name == "direction")
+      $self->setDirections((const double *) data, strides[0], strides[1]);
+    else if (name == "redshift")
+      $self->setRedshifts((const double *) data, strides[0]);
+    else if (name == "weight")
+      $self->setWeights((const double *) data, strides[0]);
+    else {
+      Py_DECREF(array);
+      PyErr_SetString(PyExc_ValueError, ("ArraySource: unknown column " + name).c_str());
+      return NULL;
+    }
+    $self->addOwner(new crpropa_PythonOwner((PyObject *) array));
+    Py_DECREF(array);
+    Py_RETURN_NONE;
+  }
+}
+
+%thread;
+
+%pythoncode %{
+
+def _grid_getArray(self):
+    """NumPy view (Nx, Ny, Nz[, 3]) of the grid values, without a copy"""
+    return globals()[type(self).__name__ + '_numpyArray'](self)
+
+VectorGrid.getArray = _grid_getArray
+ScalarGrid.getArray = _grid_getArray
+QuantizedVectorGrid.getArray = _grid_getArray
+
+def ParticleCollector_getArray(self, columns=('ID', 'E', 'X', 'Y', 'Z', 'W')):
+    """Structured array of the given columns of all candidates, see getColumns"""
+    columns = list(columns)
+    data = self.getColumns_numpyArray(columns)
+    return numpy.rec.fromarrays(data.T, names=columns)
+
+ParticleCollector.getArray = ParticleCollector_getArray
+
+def ArraySource_fromArrays(**columns):
+    """Source of primaries given as NumPy arrays of equal length, read in place
+
+    Columns: id, energy, position and direction (shape (n, 3)), redshift and
+    weight. Arrays of int (id) or float64 are not copied.
+    """
+    if not columns:
+        raise ValueError('ArraySource: no columns')
+    size = len(next(iter(columns.values())))
+    source = ArraySource(size)
+    for name, array in columns.items():
+        source.setColumn_numpyArray(name, array)
+    return source
+
+ArraySource.fromArrays = staticmethod(ArraySource_fromArrays)
+%}
+
+#endif // WITHNUMPY
@@ -6,6 +6,7 @@
  * 2. SWIG and CRPropa headers
  * 3. Pretty print for Python
  * 4. Magnetic Lens and Particle Maps Container
+ * 6. NumPy arrays of collected candidates and views of grids
  *
  */
 
@@ -47,6 +48,9 @@ Vector3f.__repr__ = Vector3__repr__
 /* 4. Magnetic Lens */
 %include "4_lens.i"
 
+/* 6. NumPy arrays of collected candidates and views of grids */
+%include "6_numpy.i"
+
 #ifdef WITH_GALACTIC_LENSES
 
 %ignore Pixelization::nPix();
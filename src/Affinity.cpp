@@ -0,0 +1,74 @@
+#include "crpropa/Affinity.h"
+
+#if defined(__linux__)
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#endif
+
+namespace crpropa {
+
+#if defined(__linux__)
+
+std::vector<int> getThreadAffinity() {
+	std::vector<int> cpus;
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if (sched_getaffinity(0, sizeof(set), &set) != 0)
+		return cpus;
+	for (int i = 0; i < CPU_SETSIZE; i++)
+		if (CPU_ISSET(i, &set))
+			cpus.push_back(i);
+	return cpus;
+}
+
+bool setThreadAffinity(const std::vector<int> &cpus) {
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (size_t i = 0; i < cpus.size(); i++)
+		if ((cpus[i] >= 0) && (cpus[i] < CPU_SETSIZE))
+			CPU_SET(cpus[i], &set);
+	if (CPU_COUNT(&set) == 0)
+		return false;
+	return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+bool interleaveMemory(void *address, size_t bytes) {
+	// the memory policy applies to whole pages inside the block
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t begin = ((size_t) address + page - 1) / page * page;
+	size_t end = ((size_t) address + bytes) / page * page;
+	if (end <= begin)
+		return false;
+
+	// all nodes, the kernel restricts this to the nodes with memory
+	const size_t nWords = 16;
+	unsigned long nodes[nWords];
+	for (size_t i = 0; i < nWords; i++)
+		nodes[i] = ~0UL;
+	long result = syscall(SYS_mbind, begin, end - begin, MPOL_INTERLEAVE,
+			nodes, nWords * 8 * sizeof(unsigned long), MPOL_MF_MOVE);
+	return result == 0;
+}
+
+#else
+
+std::vector<int> getThreadAffinity() {
+	return std::vector<int>();
+}
+
+bool setThreadAffinity(const std::vector<int> &cpus) {
+	return false;
+}
+
+bool interleaveMemory(void *address, size_t bytes) {
+	return false;
+}
+
+#endif
+
+} // namespace crpropa
@@ -0,0 +1,243 @@
+#include "crpropa/Autotuner.h"
+#include "crpropa/Clock.h"
+#include "crpropa/Statistics.h"
+#include "crpropa/module/ParticleCollector.h"
+
+#include "kiss/logger.h"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+
+namespace crpropa {
+
+// the counters of the steps, see Statistics and ModuleList::process
+static bool isStepCounter(const std::string &name) {
+	return (name.compare(0, 32, "ModuleList: next step limited by") == 0)
+			|| (name.find("rejected steps") != std::string::npos);
+}
+
+// Kolmogorov-Smirnov distance of two weighted samples of (value, weight)
+static double sortedKSDistance(std::vector<std::pair<double, double> > &a,
+		std::vector<std::pair<double, double> > &b) {
+	if (a.empty() && b.empty())
+		return 0;
+	if (a.empty() || b.empty())
+		return 1;
+	std::sort(a.begin(), a.end());
+	std::sort(b.begin(), b.end());
+	double totalA = 0, totalB = 0;
+	for (size_t i = 0; i < a.size(); i++)
+		totalA += a[i].second;
+	for (size_t i = 0; i < b.size(); i++)
+		totalB += b[i].second;
+	if (!(totalA > 0) || !(totalB > 0))
+		return (totalA > 0) == (totalB > 0) ? 0 : 1;
+	double cdfA = 0, cdfB = 0, d = 0;
+	size_t i = 0, j = 0;
+	while ((i < a.size()) || (j < b.size())) {
+		// step both distributions over equal values
+		double x = (j == b.size()) || ((i < a.size()) && (a[i].first <= b[j].first)) ?
+				a[i].first : b[j].first;
+		while ((i < a.size()) && (a[i].first == x))
+			cdfA += a[i++].second / totalA;
+		while ((j < b.size()) && (b[j].first == x))
+			cdfB += b[j++].second / totalB;
+		d = std::max(d, fabs(cdfA - cdfB));
+	}
+	return d;
+}
+
+// observables of the detected candidates: log10(E), deflection and weight
+static void observablesOf(const ParticleCollector &collector,
+		std::vector<std::vector<double> > &observables) {
+	observables.assign(3, std::vector<double>());
+	for (size_t i = 0; i < collector.size(); i++) {
+		ref_ptr<Candidate> c = collector[i];
+		observables[0].push_back(log10(c->current.getEnergy()));
+		observables[1].push_back(c->source.getDirection().getAngleTo(c->current.getDirection()));
+		observables[2].push_back(c->getWeight());
+	}
+}
+
+static double ksDistance(const std::vector<double> &a, const std::vector<double> &wa,
+		const std::vector<double> &b, const std::vector<double> &wb) {
+	std::vector<std::pair<double, double> > x(a.size()), y(b.size());
+	for (size_t i = 0; i < a.size(); i++)
+		x[i] = std::make_pair(a[i], wa[i]);
+	for (size_t i = 0; i < b.size(); i++)
+		y[i] = std::make_pair(b[i], wb[i]);
+	return sortedKSDistance(x, y);
+}
+
+AutotuneResult::AutotuneResult() :
+		steps(0), time(0), detected(0), spectrumError(0), deflectionError(0),
+		weightError(0), accepted(false) {
+}
+
+double AutotuneResult::getError() const {
+	return std::max(spectrumError, std::max(deflectionError, weightError));
+}
+
+Autotuner::Autotuner(AutotuneSetup *setup, SourceInterface *source,
+		size_t primaries, double tolerance) :
+		setup(setup), source(source), primaries(primaries), key(0) {
+	if (!setup)
+		throw std::runtime_error("Autotuner: no setup");
+	if (!source)
+		throw std::runtime_error("Autotuner: no source");
+	setTolerance(tolerance);
+}
+
+void Autotuner::addParameter(const std::string &name, const std::vector<double> &values) {
+	if (values.empty())
+		throw std::runtime_error("Autotuner: no values of parameter " + name);
+	names.push_back(name);
+	axes.push_back(values);
+}
+
+void Autotuner::setReference(const std::vector<double> &parameters) {
+	reference = parameters;
+}
+
+void Autotuner::setTolerance(double t) {
+	if (!(t > 0))
+		throw std::runtime_error("Autotuner: tolerance <= 0");
+	tolerance = t;
+}
+
+double Autotuner::getTolerance() const {
+	return tolerance;
+}
+
+void Autotuner::setRandomKey(uint64_t k) {
+	key = k;
+}
+
+AutotuneResult Autotuner::evaluate(const std::vector<double> &parameters,
+		std::vector<std::vector<double> > &observables) const {
+	ref_ptr<ParticleCollector> collector = new ParticleCollector();
+	ref_ptr<ModuleList> simulation = setup->create(parameters, collector);
+	if (!simulation)
+		throw std::runtime_error("Autotuner: setup created no module list");
+	simulation->setCounterBasedRandom(true, key);
+
+	Statistics::reset();
+	Clock clock;
+	simulation->run(source.get(), primaries);
+
+	AutotuneResult result;
+	result.parameters = parameters;
+	result.time = clock.getSecond();
+	std::vector<std::string> counters = Statistics::getCounterNames();
+	for (size_t i = 0; i < counters.size(); i++)
+		if (isStepCounter(counters[i]))
+			result.steps += Statistics::getCount(counters[i]);
+	result.detected = collector->size();
+	observablesOf(*collector, observables);
+	return result;
+}
+
+void Autotuner::run() {
+	if (reference.size() != names.size())
+		throw std::runtime_error("Autotuner: reference setting is not of one value per parameter");
+	bool statistics = Statistics::isEnabled();
+	Statistics::setEnabled(true);
+	results.clear();
+	try {
+		std::vector<std::vector<double> > expected, observed;
+		referenceResult = evaluate(reference, expected);
+		referenceResult.accepted = true;
+		double referenceWeight = 0;
+		for (size_t i = 0; i < expected[2].size(); i++)
+			referenceWeight += expected[2][i];
+		if (expected[2].empty())
+			KISS_LOG_WARNING << "Autotuner: nothing detected with the reference setting";
+
+		// all combinations, the first parameter changing fastest
+		std::vector<size_t> index(names.size(), 0);
+		bool done = false;
+		while (!done) {
+			std::vector<double> parameters(names.size());
+			for (size_t i = 0; i < names.size(); i++)
+				parameters[i] = axes[i][index[i]];
+			AutotuneResult result = evaluate(parameters, observed);
+			result.spectrumError = ksDistance(observed[0], observed[2], expected[0], expected[2]);
+			result.deflectionError = ksDistance(observed[1], observed[2], expected[1], expected[2]);
+			double weight = 0;
+			for (size_t i = 0; i < observed[2].size(); i++)
+				weight += observed[2][i];
+			if (referenceWeight > 0)
+				result.weightError = fabs(weight - referenceWeight) / referenceWeight;
+			else
+				result.weightError = (weight > 0) ? 1 : 0;
+			result.accepted = result.getError() <= tolerance;
+			results.push_back(result);
+
+			done = true;
+			for (size_t i = 0; i < index.size(); i++) {
+				if (++index[i] < axes[i].size()) {
+					done = false;
+					break;
+				}
+				index[i] = 0;
+			}
+		}
+	} catch (...) {
+		Statistics::setEnabled(statistics);
+		throw;
+	}
+	Statistics::setEnabled(statistics);
+}
+
+size_t Autotuner::size() const {
+	return results.size();
+}
+
+const AutotuneResult &Autotuner::getResult(size_t i) const {
+	if (i >= results.size())
+		throw std::out_of_range("Autotuner: no result " + std::to_string(i));
+	return results[i];
+}
+
+const AutotuneResult &Autotuner::getReferenceResult() const {
+	return referenceResult;
+}
+
+const AutotuneResult &Autotuner::getBest() const {
+	const AutotuneResult *best = NULL;
+	for (size_t i = 0; i < results.size(); i++) {
+		const AutotuneResult &r = results[i];
+		if (!r.accepted)
+			continue;
+		if (!best || (r.steps < best->steps)
+				|| ((r.steps == best->steps) && (r.getError() < best->getError())))
+			best = &r;
+	}
+	if (!best)
+		throw std::runtime_error("Autotuner: no setting within the tolerance");
+	return *best;
+}
+
+std::string Autotuner::getReport() const {
+	std::stringstream ss;
+	for (size_t i = 0; i < names.size(); i++)
+		ss << names[i] << "\t";
+	ss << "steps\ttime [s]\tdetected\tspectrum\tdeflection\tweight\taccepted\n";
+	for (size_t k = 0; !results.empty() && (k <= results.size()); k++) {
+		const AutotuneResult &r = (k == 0) ? referenceResult : results[k - 1];
+		for (size_t i = 0; i < r.parameters.size(); i++)
+			ss << r.parameters[i] << "\t";
+		ss << r.steps << "\t" << r.time << "\t" << r.detected << "\t";
+		if (k == 0) {
+			ss << "reference\n";
+			continue;
+		}
+		ss << r.spectrumError << "\t" << r.deflectionError << "\t"
+				<< r.weightError << "\t" << (r.accepted ? "yes" : "no") << "\n";
+	}
+	return ss.str();
+}
+
+} // namespace crpropa
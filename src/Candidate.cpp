@@ -1,44 +1,79 @@
 #include "crpropa/Candidate.h"
+#include "crpropa/MemoryAccounting.h"
 #include "crpropa/ParticleID.h"
 #include "crpropa/Units.h"
 
+#include <new>
+#include <set>
 #include <stdexcept>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 namespace crpropa {
 
+// per-thread free list of memory blocks of sizeof(Candidate)
+#if defined(__GNUC__)
+#define CRPROPA_CANDIDATE_POOL
+struct CandidateBlock {
+	CandidateBlock *next;
+};
+static __thread CandidateBlock *candidatePool = 0;
+static __thread size_t candidatePoolSize = 0;
+static const size_t candidatePoolLimit = 16384;
+
+// per-thread block of reserved serial numbers [serialBlockNext, serialBlockEnd)
+#define CRPROPA_SERIAL_BLOCKS
+static __thread uint64_t serialBlockNext = 0;
+static __thread uint64_t serialBlockEnd = 0;
+static __thread uint64_t serialBlockEpoch = 0;
+static const uint64_t serialBlockSize = 65536;
+#endif
+static uint64_t serialNumberEpoch = 0; ///< incremented by setNextSerialNumber
+
+static const std::string *internPropertyName(const std::string &name) {
+	// function static, as keys may be constructed during static initialization
+	static std::set<std::string> names;
+	const std::string *interned;
+#pragma omp critical(PropertyKey)
+	interned = &*names.insert(name).first;
+	return interned;
+}
+
+PropertyKey::PropertyKey() : name(internPropertyName("")) {
+}
+
+PropertyKey::PropertyKey(const std::string &n) : name(internPropertyName(n)) {
+}
+
+PropertyKey::PropertyKey(const char *n) : name(internPropertyName(n)) {
+}
+
+static bool sameState(const ParticleState &a, const ParticleState &b) {
+	return (a.getId() == b.getId()) && (a.getEnergy() == b.getEnergy())
+			&& (a.getPosition() == b.getPosition())
+			&& (a.getDirection() == b.getDirection());
+}
+
 Candidate::Candidate(int id, double E, Vector3d pos, Vector3d dir, double z, double weight) :
-		redshift(z), trajectoryLength(0), weight(1), currentStep(0), nextStep(0), active(true), parent(0) {
+		redshift(z), trajectoryLength(0), columnDensity(0), weight(weight), currentStep(0), nextStep(0), active(true), parent(0) {
 	ParticleState state(id, E, pos, dir);
-	source = state;
-	created = state;
+	// the default state needs no record, e.g. for new secondaries
+	if (!sameState(state, ParticleState())) {
+		source = state;
+		created = source;
+	}
 	previous = state;
 	current = state;
 
-#if defined(OPENMP_3_1)
-		#pragma omp atomic capture
-		{serialNumber = nextSerialNumber++;}
-#elif defined(__GNUC__)
-		{serialNumber = __sync_add_and_fetch(&nextSerialNumber, 1);}
-#else
-		#pragma omp critical
-		{serialNumber = nextSerialNumber++;}
-#endif
-
+	serialNumber = newSerialNumber();
 }
 
 Candidate::Candidate(const ParticleState &state) :
-		source(state), created(state), current(state), previous(state), redshift(0), trajectoryLength(0), currentStep(0), nextStep(0), active(true), parent(0) {
-
-#if defined(OPENMP_3_1)
-		#pragma omp atomic capture
-		{serialNumber = nextSerialNumber++;}
-#elif defined(__GNUC__)
-		{serialNumber = __sync_add_and_fetch(&nextSerialNumber, 1);}
-#else
-		#pragma omp critical
-		{serialNumber = nextSerialNumber++;}
-#endif
+		source(state), created(source), current(state), previous(state), redshift(0), trajectoryLength(0), columnDensity(0), currentStep(0), nextStep(0), active(true), parent(0) {
 
+	serialNumber = newSerialNumber();
 }
 
 bool Candidate::isActive() const {
@@ -57,6 +92,10 @@ double Candidate::getTrajectoryLength() const {
 	return trajectoryLength;
 }
 
+double Candidate::getColumnDensity() const {
+	return columnDensity;
+}
+
 double Candidate::getWeight() const {
 	return weight;
 }
@@ -77,6 +116,10 @@ void Candidate::setTrajectoryLength(double a) {
 	trajectoryLength = a;
 }
 
+void Candidate::setColumnDensity(double n) {
+	columnDensity = n;
+}
+
 void Candidate::setWeight(double w) {
 	weight = w;
 }
@@ -94,27 +137,27 @@ void Candidate::limitNextStep(double step) {
 	nextStep = std::min(nextStep, step);
 }
 
-void Candidate::setProperty(const std::string &name, const Variant &value) {
-	properties[name] = value;
+void Candidate::setProperty(const PropertyKey &key, const Variant &value) {
+	properties[key] = value;
 }
 
-const Variant &Candidate::getProperty(const std::string &name) const {
-	PropertyMap::const_iterator i = properties.find(name);
+const Variant &Candidate::getProperty(const PropertyKey &key) const {
+	PropertyMap::const_iterator i = properties.find(key);
 	if (i == properties.end())
-		throw std::runtime_error("Unknown candidate property: " + name);
+		throw std::runtime_error("Unknown candidate property: " + key.getName());
 	return i->second;
 }
 
-bool Candidate::removeProperty(const std::string& name) {
-	PropertyMap::iterator i = properties.find(name);
+bool Candidate::removeProperty(const PropertyKey &key) {
+	PropertyMap::iterator i = properties.find(key);
 	if (i == properties.end())
 		return false;
 	properties.erase(i);
 	return true;
 }
 
-bool Candidate::hasProperty(const std::string &name) const {
-	PropertyMap::const_iterator i = properties.find(name);
+bool Candidate::hasProperty(const PropertyKey &key) const {
+	PropertyMap::const_iterator i = properties.find(key);
 	if (i == properties.end())
 		return false;
 	return true;
@@ -124,14 +167,24 @@ void Candidate::addSecondary(Candidate *c) {
 	secondaries.push_back(c);
 }
 
+void Candidate::shareCreated(Candidate *secondary, const ParticleState &state) const {
+	// secondaries of the same interaction share their created state
+	if (!secondaries.empty() && sameState(secondaries.back()->created, state))
+		secondary->created = secondaries.back()->created;
+	else
+		secondary->created = state;
+}
+
 void Candidate::addSecondary(int id, double energy, double weight) {
 	ref_ptr<Candidate> secondary = new Candidate;
+	secondary->setThreadConfined(isThreadConfined());
 	secondary->setRedshift(redshift);
 	secondary->setTrajectoryLength(trajectoryLength);
-	secondary->setWeight(weight);
+	secondary->setColumnDensity(columnDensity);
+	secondary->setWeight(this->weight * weight);
 	secondary->source = source;
 	secondary->previous = previous;
-	secondary->created = previous;
+	shareCreated(secondary, previous);
 	secondary->current = current;
 	secondary->current.setId(id);
 	secondary->current.setEnergy(energy);
@@ -141,17 +194,20 @@ void Candidate::addSecondary(int id, double energy, double weight) {
 
 void Candidate::addSecondary(int id, double energy, Vector3d position, double weight) {
 	ref_ptr<Candidate> secondary = new Candidate;
+	secondary->setThreadConfined(isThreadConfined());
 	secondary->setRedshift(redshift);
 	secondary->setTrajectoryLength(trajectoryLength - (current.getPosition() - position).getR() );
-	secondary->setWeight(weight);
+	secondary->setColumnDensity(columnDensity);
+	secondary->setWeight(this->weight * weight);
 	secondary->source = source;
 	secondary->previous = previous;
-	secondary->created = previous;
+	ParticleState created = previous;
+	created.setPosition(position);
+	shareCreated(secondary, created);
 	secondary->current = current;
 	secondary->current.setId(id);
 	secondary->current.setEnergy(energy);
 	secondary->current.setPosition(position);
-	secondary->created.setPosition(position);
 	secondary->parent = this;
 	secondaries.push_back(secondary);
 }
@@ -160,6 +216,10 @@ void Candidate::clearSecondaries() {
 	secondaries.clear();
 }
 
+void Candidate::retainParent() {
+	parentHolder = parent;
+}
+
 std::string Candidate::getDescription() const {
 	std::stringstream ss;
 	ss << "CosmicRay at z = " << getRedshift() << "\n";
@@ -180,6 +240,7 @@ ref_ptr<Candidate> Candidate::clone(bool recursive) const {
 	cloned->redshift = redshift;
 	cloned->weight = weight;
 	cloned->trajectoryLength = trajectoryLength;
+	cloned->columnDensity = columnDensity;
 	cloned->currentStep = currentStep;
 	cloned->nextStep = nextStep;
 	if (recursive) {
@@ -193,6 +254,26 @@ ref_ptr<Candidate> Candidate::clone(bool recursive) const {
 	return cloned;
 }
 
+void Candidate::copyState(Candidate &target) const {
+	target.source = source;
+	target.created = created;
+	target.current = current;
+	target.previous = previous;
+
+	target.properties = properties;
+	target.active = active;
+	target.redshift = redshift;
+	target.weight = weight;
+	target.trajectoryLength = trajectoryLength;
+	target.columnDensity = columnDensity;
+	target.currentStep = currentStep;
+	target.nextStep = nextStep;
+	target.serialNumber = serialNumber;
+	target.secondaries.clear();
+	target.parent = 0;
+	target.parentHolder = 0;
+}
+
 uint64_t Candidate::getSerialNumber() const {
 	return serialNumber;
 }
@@ -217,6 +298,38 @@ uint64_t Candidate::getCreatedSerialNumber() const {
 
 void Candidate::setNextSerialNumber(uint64_t snr) {
 	nextSerialNumber = snr;
+	// invalidate the reserved blocks of all threads
+#if defined(__GNUC__)
+	__sync_add_and_fetch(&serialNumberEpoch, 1);
+#else
+	serialNumberEpoch++;
+#endif
+}
+
+uint64_t Candidate::newSerialNumber() {
+#if defined(CRPROPA_SERIAL_BLOCKS) && defined(_OPENMP)
+	// within parallel regions each thread takes numbers from its own block,
+	// outside the numbers are assigned one by one, as before
+	if (omp_in_parallel()) {
+		if ((serialBlockNext == serialBlockEnd) || (serialBlockEpoch != serialNumberEpoch)) {
+			serialBlockEpoch = serialNumberEpoch;
+			serialBlockNext = __sync_fetch_and_add(&nextSerialNumber, serialBlockSize) + 1;
+			serialBlockEnd = serialBlockNext + serialBlockSize;
+		}
+		return serialBlockNext++;
+	}
+#endif
+	uint64_t snr;
+#if defined(OPENMP_3_1)
+	#pragma omp atomic capture
+	{snr = nextSerialNumber++;}
+#elif defined(__GNUC__)
+	snr = __sync_add_and_fetch(&nextSerialNumber, 1);
+#else
+	#pragma omp critical(SerialNumber)
+	{snr = nextSerialNumber++;}
+#endif
+	return snr;
 }
 
 uint64_t Candidate::getNextSerialNumber() {
@@ -225,9 +338,59 @@ uint64_t Candidate::getNextSerialNumber() {
 
 uint64_t Candidate::nextSerialNumber = 0;
 
+void *Candidate::operator new(size_t size) {
+	MemoryAccounting::countCandidates(1);
+#ifdef CRPROPA_CANDIDATE_POOL
+	// derived classes use the global allocator
+	if ((size == sizeof(Candidate)) && candidatePool) {
+		CandidateBlock *block = candidatePool;
+		candidatePool = block->next;
+		candidatePoolSize--;
+		return block;
+	}
+#endif
+	return ::operator new(size);
+}
+
+void Candidate::operator delete(void *p, size_t size) {
+	if (p == 0)
+		return;
+	MemoryAccounting::countCandidates(-1);
+#ifdef CRPROPA_CANDIDATE_POOL
+	if ((size == sizeof(Candidate)) && (candidatePoolSize < candidatePoolLimit)) {
+		CandidateBlock *block = static_cast<CandidateBlock*>(p);
+		block->next = candidatePool;
+		candidatePool = block;
+		candidatePoolSize++;
+		return;
+	}
+#endif
+	::operator delete(p);
+}
+
+size_t Candidate::getPoolSize() {
+#ifdef CRPROPA_CANDIDATE_POOL
+	return candidatePoolSize;
+#else
+	return 0;
+#endif
+}
+
+void Candidate::clearPool() {
+#ifdef CRPROPA_CANDIDATE_POOL
+	while (candidatePool) {
+		CandidateBlock *block = candidatePool;
+		candidatePool = block->next;
+		::operator delete(block);
+	}
+	candidatePoolSize = 0;
+#endif
+}
+
 void Candidate::restart() {
 	setActive(true);
 	setTrajectoryLength(0);
+	setColumnDensity(0);
 	previous = source;
 	current = source;
 }
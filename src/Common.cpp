@@ -56,6 +56,20 @@ std::string getDataPath(std::string filename) {
 }
 
 
+std::string getInstructionSet() {
+#ifdef CRPROPA_HAVE_MULTIVERSIONING
+	// the order of the dispatch of target_clones
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f"))
+		return "avx512f";
+	if (__builtin_cpu_supports("avx2"))
+		return "avx2";
+#elif defined(__ARM_NEON)
+	return "neon";
+#endif
+	return "default";
+}
+
 std::string getInstallPrefix()
 {
   std::string _path = "";
@@ -78,6 +92,17 @@ double interpolate(double x, const std::vector<double> &X,
 	return Y[i] + (x - X[i]) * (Y[i + 1] - Y[i]) / (X[i + 1] - X[i]);
 }
 
+double interpolate(double x, const double *X, const double *Y, size_t n) {
+	const double *it = std::upper_bound(X, X + n, x);
+	if (it == X)
+		return Y[0];
+	if (it == X + n)
+		return Y[n - 1];
+
+	size_t i = it - X - 1;
+	return Y[i] + (x - X[i]) * (Y[i + 1] - Y[i]) / (X[i + 1] - X[i]);
+}
+
 double interpolate2d(double x, double y, const std::vector<double> &X,
 		const std::vector<double> &Y, const std::vector<double> &Z) {
 
@@ -108,6 +133,40 @@ double interpolate2d(double x, double y, const std::vector<double> &X,
 	return ((Y[j+1]-y)/(Y[j+1]-Y[j]))*R1+((y-Y[j])/(Y[j+1]-Y[j]))*R2;
 }
 
+// index i with X[i] <= x < X[i+1], checking the hint first, false outside of the table
+static bool cellIndex(double x, const std::vector<double> &X, size_t &i) {
+	if (!(x >= X.front()) || !(x < X.back()))
+		return false;
+	if ((i + 1 < X.size()) && (X[i] <= x) && (x < X[i + 1]))
+		return true;
+	i = std::upper_bound(X.begin(), X.end(), x) - X.begin() - 1;
+	return true;
+}
+
+double interpolate(double x, const std::vector<double> &X,
+		const std::vector<double> &Y, size_t &i) {
+	if (!cellIndex(x, X, i))
+		return interpolate(x, X, Y);
+	return Y[i] + (x - X[i]) * (Y[i + 1] - Y[i]) / (X[i + 1] - X[i]);
+}
+
+double interpolate2d(double x, double y, const std::vector<double> &X,
+		const std::vector<double> &Y, const std::vector<double> &Z, size_t &i,
+		size_t &j) {
+	if (!cellIndex(x, X, i) || !cellIndex(y, Y, j))
+		return interpolate2d(x, y, X, Y, Z);
+
+	double Q11 = Z[index(i,j)];
+	double Q12 = Z[index(i,j+1)];
+	double Q21 = Z[index(i+1,j)];
+	double Q22 = Z[index(i+1,j+1)];
+
+	double R1 = ((X[i+1]-x)/(X[i+1]-X[i]))*Q11+((x-X[i])/(X[i+1]-X[i]))*Q21;
+	double R2 = ((X[i+1]-x)/(X[i+1]-X[i]))*Q12+((x-X[i])/(X[i+1]-X[i]))*Q22;
+
+	return ((Y[j+1]-y)/(Y[j+1]-Y[j]))*R1+((y-Y[j])/(Y[j+1]-Y[j]))*R2;
+}
+
 double interpolateEquidistant(double x, double lo, double hi,
 		const std::vector<double> &Y) {
 	if (x <= lo)
@@ -121,6 +180,19 @@ double interpolateEquidistant(double x, double lo, double hi,
 	return Y[i] + (p - i) * (Y[i + 1] - Y[i]);
 }
 
+double interpolateEquidistant(double x, double lo, double hi, const double *Y,
+		size_t n) {
+	if (x <= lo)
+		return Y[0];
+	if (x >= hi)
+		return Y[n - 1];
+
+	double dx = (hi - lo) / (n - 1);
+	double p = (x - lo) / dx;
+	size_t i = floor(p);
+	return Y[i] + (p - i) * (Y[i + 1] - Y[i]);
+}
+
 size_t closestIndex(double x, const std::vector<double> &X) {
 	size_t i1 = std::lower_bound(X.begin(), X.end(), x) - X.begin();
 	if (i1 == 0)
@@ -132,5 +204,67 @@ size_t closestIndex(double x, const std::vector<double> &X) {
 		return i1;
 }
 
+LogUniformTable::LogUniformTable() :
+		uniform(false), lgFront(0), lgStep(0) {
+}
+
+void LogUniformTable::clear() {
+	X.clear();
+	uniform = false;
+}
+
+void LogUniformTable::push_back(double x) {
+	X.push_back(x);
+	size_t n = X.size();
+	if (n == 1) {
+		uniform = (x > 0);
+		lgFront = log(x);
+	} else if (n == 2) {
+		lgStep = log(x / X[0]);
+		uniform = uniform && (lgStep > 0);
+	} else if (uniform) {
+		double lgPoint = lgFront + (n - 1) * lgStep;
+		uniform = (std::fabs(log(x) - lgPoint) < 0.01 * lgStep);
+	}
+}
+
+size_t LogUniformTable::cell(double x) const {
+	size_t n = X.size();
+	if (n < 2)
+		return 0;
+	if (!uniform || !(x > 0)) {
+		size_t i = std::upper_bound(X.begin(), X.end(), x) - X.begin();
+		return std::min(std::max(i, size_t(1)), n - 1) - 1;
+	}
+	double r = std::floor((log(x) - lgFront) / lgStep);
+	size_t i = (r < 0) ? 0 : std::min(size_t(r), n - 2);
+	while ((i > 0) && (X[i] > x))
+		i--;
+	while ((i + 2 < n) && (X[i + 1] <= x))
+		i++;
+	return i;
+}
+
+double LogUniformTable::interpolate(double x, const std::vector<double> &Y) const {
+	if (!(x >= X.front()) || !(x < X.back()))
+		return crpropa::interpolate(x, X, Y);
+	size_t i = cell(x);
+	return Y[i] + (x - X[i]) * (Y[i + 1] - Y[i]) / (X[i + 1] - X[i]);
+}
+
+size_t LogUniformTable::closestIndex(double x) const {
+	if (!(x > X.front()) || !(x <= X.back()))
+		return crpropa::closestIndex(x, X);
+	// first point not below x, as lower_bound
+	size_t i1 = cell(x);
+	if (X[i1] < x)
+		i1++;
+	size_t i0 = i1 - 1;
+	if (std::fabs(X[i0] - x) < std::fabs(X[i1] - x))
+		return i0;
+	else
+		return i1;
+}
+
 } // namespace crpropa
 
@@ -0,0 +1,613 @@
+#include "crpropa/Configuration.h"
+#include "crpropa/GridTools.h"
+#include "crpropa/ModuleList.h"
+#include "crpropa/Source.h"
+#include "crpropa/magneticField/MagneticField.h"
+#include "crpropa/magneticField/MagneticFieldGrid.h"
+#include "crpropa/module/BreakCondition.h"
+#include "crpropa/module/Observer.h"
+#include "crpropa/module/PropagationCK.h"
+#include "crpropa/module/SimplePropagation.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+namespace crpropa {
+
+static const char configurationMagic[] = "CRPCONF1";
+
+static std::string checkedKey(const std::string &key) {
+	if (key.empty() || (key.find_first_of(" \t\r\n@") != std::string::npos))
+		throw std::runtime_error("Configuration: invalid key \"" + key + "\"");
+	return key;
+}
+
+Configuration::Configuration(const std::string &type, ConfigurationDocument *document) :
+		type(type), document(document) {
+}
+
+void Configuration::setType(const std::string &t) {
+	type = t;
+}
+
+const std::string &Configuration::getType() const {
+	return type;
+}
+
+bool Configuration::has(const std::string &key) const {
+	for (size_t i = 0; i < values.size(); i++)
+		if (values[i].first == key)
+			return true;
+	return false;
+}
+
+std::vector<std::string> Configuration::getKeys() const {
+	std::vector<std::string> keys;
+	for (size_t i = 0; i < values.size(); i++)
+		keys.push_back(values[i].first);
+	return keys;
+}
+
+const std::string &Configuration::getValue(const std::string &key) const {
+	for (size_t i = 0; i < values.size(); i++)
+		if (values[i].first == key)
+			return values[i].second;
+	throw std::runtime_error("Configuration: " + type + " has no parameter " + key);
+}
+
+void Configuration::setString(const std::string &key, const std::string &value) {
+	if (value.find_first_of("\r\n") != std::string::npos)
+		throw std::runtime_error("Configuration: " + type + "." + key + " contains a line break");
+	for (size_t i = 0; i < values.size(); i++)
+		if (values[i].first == key) {
+			values[i].second = value;
+			return;
+		}
+	values.push_back(std::make_pair(checkedKey(key), value));
+}
+
+void Configuration::set(const std::string &key, double value) {
+	std::ostringstream s;
+	s.precision(17);
+	s << value;
+	setString(key, s.str());
+}
+
+void Configuration::set(const std::string &key, const Vector3d &value) {
+	std::ostringstream s;
+	s.precision(17);
+	s << value.x << " " << value.y << " " << value.z;
+	setString(key, s.str());
+}
+
+void Configuration::set(const std::string &key, const std::vector<double> &v) {
+	std::ostringstream s;
+	s.precision(17);
+	for (size_t i = 0; i < v.size(); i++)
+		s << (i > 0 ? " " : "") << v[i];
+	setString(key, s.str());
+}
+
+std::string Configuration::reference(size_t id) const {
+	std::ostringstream s;
+	s << "@" << id;
+	return s.str();
+}
+
+// the referenced objects are saved into the same document
+#define CONFIGURATION_SET_REFERENCE(T) \
+void Configuration::set(const std::string &key, const T *object) { \
+	if (!document) \
+		throw std::runtime_error("Configuration: references need a document"); \
+	setString(key, reference(document->add(object))); \
+}
+CONFIGURATION_SET_REFERENCE(Module)
+CONFIGURATION_SET_REFERENCE(MagneticField)
+CONFIGURATION_SET_REFERENCE(SourceInterface)
+CONFIGURATION_SET_REFERENCE(SourceFeature)
+CONFIGURATION_SET_REFERENCE(ObserverFeature)
+#undef CONFIGURATION_SET_REFERENCE
+
+const std::string &Configuration::getString(const std::string &key) const {
+	return getValue(key);
+}
+
+double Configuration::getDouble(const std::string &key) const {
+	const std::string &s = getValue(key);
+	char *end;
+	double value = strtod(s.c_str(), &end);
+	if (s.empty() || (*end != 0))
+		throw std::runtime_error("Configuration: " + type + "." + key + " is no number");
+	return value;
+}
+
+int Configuration::getInt(const std::string &key) const {
+	return (int) getDouble(key);
+}
+
+bool Configuration::getBool(const std::string &key) const {
+	return getDouble(key) != 0;
+}
+
+std::vector<double> Configuration::getDoubles(const std::string &key) const {
+	std::istringstream s(getValue(key));
+	std::vector<double> v;
+	std::string word;
+	while (s >> word) {
+		char *end;
+		v.push_back(strtod(word.c_str(), &end));
+		if (*end != 0)
+			throw std::runtime_error("Configuration: " + type + "." + key + " is no list of numbers");
+	}
+	return v;
+}
+
+Vector3d Configuration::getVector(const std::string &key) const {
+	std::vector<double> v = getDoubles(key);
+	if (v.size() != 3)
+		throw std::runtime_error("Configuration: " + type + "." + key + " is no vector");
+	return Vector3d(v[0], v[1], v[2]);
+}
+
+std::vector<size_t> Configuration::getIds(const std::string &key) const {
+	std::istringstream s(getValue(key));
+	std::vector<size_t> ids;
+	std::string word;
+	while (s >> word) {
+		char *end;
+		unsigned long id = strtoul(word.c_str() + 1, &end, 10);
+		if ((word[0] != '@') || (word.size() < 2) || (*end != 0))
+			throw std::runtime_error("Configuration: " + type + "." + key + " is no reference");
+		ids.push_back(id);
+	}
+	return ids;
+}
+
+ref_ptr<Referenced> Configuration::getObject(size_t id) const {
+	if (!document)
+		throw std::runtime_error("Configuration: references need a document");
+	return document->getObject(id);
+}
+
+// ----------------------------------------------------------------------------
+template<class T>
+size_t ConfigurationDocument::addObject(const T *object) {
+	if (!object)
+		throw std::runtime_error("ConfigurationDocument: null reference");
+	std::map<const void *, size_t>::iterator i = ids.find(object);
+	if (i != ids.end()) {
+		if (i->second == size_t(-1))
+			throw std::runtime_error("ConfigurationDocument: the object references itself");
+		return i->second;
+	}
+	// the references are saved first, the object gets the next id after them
+	ids[object] = size_t(-1);
+	Configuration c("", this);
+	object->getConfiguration(c);
+	if (c.getType().empty())
+		throw std::runtime_error("ConfigurationDocument: the configuration has no type");
+	c.document = 0;
+	objects.push_back(c);
+	ids[object] = objects.size() - 1;
+	return objects.size() - 1;
+}
+
+size_t ConfigurationDocument::add(const Module *module) {
+	return addObject(module);
+}
+
+size_t ConfigurationDocument::add(const MagneticField *field) {
+	return addObject(field);
+}
+
+size_t ConfigurationDocument::add(const SourceInterface *source) {
+	return addObject(source);
+}
+
+size_t ConfigurationDocument::add(const SourceFeature *feature) {
+	return addObject(feature);
+}
+
+size_t ConfigurationDocument::add(const ObserverFeature *feature) {
+	return addObject(feature);
+}
+
+size_t ConfigurationDocument::size() const {
+	return objects.size();
+}
+
+const Configuration &ConfigurationDocument::getConfiguration(size_t id) const {
+	if (id >= objects.size())
+		throw std::runtime_error("ConfigurationDocument: no object of this id");
+	return objects[id];
+}
+
+std::string ConfigurationDocument::toString() const {
+	std::ostringstream s;
+	s << configurationMagic << "\n";
+	for (size_t i = 0; i < objects.size(); i++) {
+		const Configuration &c = objects[i];
+		s << "object " << i << " " << c.type << "\n";
+		for (size_t j = 0; j < c.values.size(); j++)
+			s << c.values[j].first << " " << c.values[j].second << "\n";
+		s << "end\n";
+	}
+	return s.str();
+}
+
+void ConfigurationDocument::save(const std::string &filename) const {
+	std::string tmp = filename + ".tmp";
+	std::ofstream out(tmp.c_str());
+	if (!out)
+		throw std::runtime_error("ConfigurationDocument: cannot create " + tmp);
+	out << toString();
+	out.close();
+	if (!out || (rename(tmp.c_str(), filename.c_str()) != 0))
+		throw std::runtime_error("ConfigurationDocument: cannot write " + filename);
+}
+
+ref_ptr<ConfigurationDocument> ConfigurationDocument::fromString(const std::string &text) {
+	ref_ptr<ConfigurationDocument> document = new ConfigurationDocument();
+	std::istringstream in(text);
+	std::string line;
+	if (!std::getline(in, line) || (line != configurationMagic))
+		throw std::runtime_error("ConfigurationDocument: no configuration");
+	size_t lineNumber = 1;
+	Configuration *c = 0;
+	while (std::getline(in, line)) {
+		lineNumber++;
+		std::ostringstream where;
+		where << "ConfigurationDocument: line " << lineNumber << ": ";
+		if (!c) {
+			std::istringstream words(line);
+			std::string object, type;
+			size_t id;
+			if (!(words >> object >> id >> type) || (object != "object"))
+				throw std::runtime_error(where.str() + "object expected");
+			if (id != document->objects.size())
+				throw std::runtime_error(where.str() + "objects out of order");
+			document->objects.push_back(Configuration(type, document));
+			c = &document->objects.back();
+		} else if (line == "end") {
+			c = 0;
+		} else {
+			size_t space = line.find(' ');
+			if (space == std::string::npos)
+				throw std::runtime_error(where.str() + "parameter expected");
+			c->values.push_back(std::make_pair(line.substr(0, space), line.substr(space + 1)));
+		}
+	}
+	if (c)
+		throw std::runtime_error("ConfigurationDocument: end of the last object missing");
+	document->loaded.resize(document->objects.size());
+	return document;
+}
+
+ref_ptr<ConfigurationDocument> ConfigurationDocument::load(const std::string &filename) {
+	std::ifstream in(filename.c_str());
+	if (!in)
+		throw std::runtime_error("ConfigurationDocument: cannot open " + filename);
+	std::stringstream text;
+	text << in.rdbuf();
+	return fromString(text.str());
+}
+
+ref_ptr<Referenced> ConfigurationDocument::getObject(size_t id) {
+	if (id >= objects.size())
+		throw std::runtime_error("ConfigurationDocument: no object of this id");
+	if (loaded.size() < objects.size())
+		loaded.resize(objects.size());
+	if (loaded[id].valid())
+		return loaded[id];
+
+	const Configuration &c = objects[id];
+	std::map<std::string, Factory> &f = factories();
+	std::map<std::string, Factory>::const_iterator i = f.find(c.type);
+	if (i == f.end())
+		throw std::runtime_error("ConfigurationDocument: unknown type " + c.type);
+	// objects only reference objects saved before them
+	for (size_t j = 0; j < c.values.size(); j++) {
+		const std::string &v = c.values[j].second;
+		if (!v.empty() && (v[0] == '@')) {
+			std::vector<size_t> references = c.getIds(c.values[j].first);
+			for (size_t k = 0; k < references.size(); k++)
+				if (references[k] >= id)
+					throw std::runtime_error("ConfigurationDocument: " + c.type
+							+ " references a later object");
+		}
+	}
+	Configuration withDocument(c);
+	withDocument.document = this;
+	loaded[id] = i->second(withDocument);
+	return loaded[id];
+}
+
+template<class T>
+static ref_ptr<T> rootAs(ConfigurationDocument &document, const char *name) {
+	if (document.size() == 0)
+		throw std::runtime_error("ConfigurationDocument: empty configuration");
+	ref_ptr<Referenced> root = document.getObject(document.size() - 1);
+	T *t = dynamic_cast<T *>(root.get());
+	if (!t)
+		throw std::runtime_error(std::string("ConfigurationDocument: the root is no ") + name);
+	return t;
+}
+
+ref_ptr<Module> ConfigurationDocument::getModule() {
+	return rootAs<Module>(*this, "Module");
+}
+
+ref_ptr<MagneticField> ConfigurationDocument::getMagneticField() {
+	return rootAs<MagneticField>(*this, "MagneticField");
+}
+
+ref_ptr<SourceInterface> ConfigurationDocument::getSource() {
+	return rootAs<SourceInterface>(*this, "SourceInterface");
+}
+
+// ----------------------------------------------------------------------------
+// built-in types, the parameters as written by the getConfiguration methods
+namespace {
+
+void configureCondition(AbstractCondition *condition, const Configuration &c) {
+	if (c.has("rejectAction"))
+		condition->onReject(c.get<Module>("rejectAction"));
+	if (c.has("acceptAction"))
+		condition->onAccept(c.get<Module>("acceptAction"));
+	condition->setMakeRejectedInactive(c.getBool("makeRejectedInactive"));
+	condition->setMakeAcceptedInactive(c.getBool("makeAcceptedInactive"));
+	condition->setRejectFlag(c.getString("rejectFlagKey"), c.getString("rejectFlagValue"));
+	condition->setAcceptFlag(c.getString("acceptFlagKey"), c.getString("acceptFlagValue"));
+}
+
+Referenced *createModuleList(const Configuration &c) {
+	ref_ptr<ModuleList> list = new ModuleList();
+	std::vector<ref_ptr<Module> > modules = c.getList<Module>("modules");
+	for (size_t i = 0; i < modules.size(); i++)
+		list->add(modules[i]);
+	list->setSchedule((ModuleList::ScheduleType) c.getInt("schedule"), c.getInt("scheduleChunkSize"));
+	list->setSourceBatchSize(c.getInt("sourceBatchSize"));
+	list->setBreadthFirst(c.getBool("breadthFirst"));
+	list->setParallelSecondaries(c.getBool("parallelSecondaries"));
+	list->setStreamSecondaries(c.getBool("streamSecondaries"));
+	list->setThreadConfined(c.getBool("threadConfined"));
+	list->setParticleDispatch(c.getBool("particleDispatch"));
+	list->setCounterBasedRandom(c.getBool("counterBasedRandom"),
+			strtoull(c.getString("randomKey").c_str(), 0, 10));
+	return list.release();
+}
+
+Referenced *createSimplePropagation(const Configuration &c) {
+	SimplePropagation *p = new SimplePropagation(c.getDouble("minStep"), c.getDouble("maxStep"));
+	if (c.has("freeStreaming"))
+		p->setFreeStreaming(c.getInt("freeStreaming"), c.getDouble("freeStreamingStep"));
+	return p;
+}
+
+Referenced *createPropagationCK(const Configuration &c) {
+	PropagationCK *p = new PropagationCK(c.get<MagneticField>("field"), c.getDouble("tolerance"),
+			c.getDouble("minStep"), c.getDouble("maxStep"));
+	if (c.has("freeStreaming"))
+		p->setFreeStreaming(c.getInt("freeStreaming"), c.getDouble("freeStreamingStep"));
+	return p;
+}
+
+Referenced *createMaximumTrajectoryLength(const Configuration &c) {
+	MaximumTrajectoryLength *m = new MaximumTrajectoryLength(c.getDouble("maxLength"));
+	std::vector<double> p = c.getDoubles("observerPositions");
+	for (size_t i = 0; i + 2 < p.size(); i += 3)
+		m->addObserverPosition(Vector3d(p[i], p[i + 1], p[i + 2]));
+	configureCondition(m, c);
+	return m;
+}
+
+Referenced *createMinimumEnergy(const Configuration &c) {
+	MinimumEnergy *m = new MinimumEnergy(c.getDouble("minEnergy"));
+	configureCondition(m, c);
+	return m;
+}
+
+Referenced *createMinimumRigidity(const Configuration &c) {
+	MinimumRigidity *m = new MinimumRigidity(c.getDouble("minRigidity"));
+	configureCondition(m, c);
+	return m;
+}
+
+Referenced *createMinimumRedshift(const Configuration &c) {
+	MinimumRedshift *m = new MinimumRedshift(c.getDouble("zmin"));
+	configureCondition(m, c);
+	return m;
+}
+
+Referenced *createDetectionLength(const Configuration &c) {
+	DetectionLength *m = new DetectionLength(c.getDouble("detLength"));
+	configureCondition(m, c);
+	return m;
+}
+
+Referenced *createObserver(const Configuration &c) {
+	Observer *o = new Observer();
+	std::vector<ref_ptr<ObserverFeature> > features = c.getList<ObserverFeature>("features");
+	for (size_t i = 0; i < features.size(); i++)
+		o->add(features[i]);
+	if (c.has("detectionAction"))
+		o->onDetection(c.get<Module>("detectionAction"), c.getBool("clone"));
+	o->setDeactivateOnDetection(c.getBool("makeInactive"));
+	o->setFlag(c.getString("flagKey"), c.getString("flagValue"));
+	o->setSpatialIndex(c.getDouble("spatialIndex"));
+	o->setDetectionHints(c.getBool("detectionHints"));
+	return o;
+}
+
+Referenced *createUniformMagneticField(const Configuration &c) {
+	return new UniformMagneticField(c.getVector("value"));
+}
+
+Referenced *createMagneticFieldList(const Configuration &c) {
+	MagneticFieldList *list = new MagneticFieldList();
+	std::vector<ref_ptr<MagneticField> > fields = c.getList<MagneticField>("fields");
+	std::vector<double> bounded = c.getDoubles("bounded");
+	std::vector<double> lower = c.getDoubles("boxLower");
+	std::vector<double> upper = c.getDoubles("boxUpper");
+	if ((bounded.size() != fields.size()) || (lower.size() != 3 * fields.size())
+			|| (upper.size() != 3 * fields.size()))
+		throw std::runtime_error("Configuration: MagneticFieldList boxes do not match the fields");
+	for (size_t i = 0; i < fields.size(); i++) {
+		if (bounded[i] == 0) {
+			list->addField(fields[i]);
+			continue;
+		}
+		Vector3d l(lower[3 * i], lower[3 * i + 1], lower[3 * i + 2]);
+		Vector3d u(upper[3 * i], upper[3 * i + 1], upper[3 * i + 2]);
+		list->addField(fields[i], l, u - l);
+	}
+	if (c.getBool("frozen"))
+		list->freeze();
+	return list;
+}
+
+Referenced *createMagneticFieldEvolution(const Configuration &c) {
+	return new MagneticFieldEvolution(c.get<MagneticField>("field"), c.getDouble("m"));
+}
+
+Referenced *createMagneticFieldGrid(const Configuration &c) {
+	Vector3d size = c.getVector("size");
+	ref_ptr<VectorGrid> grid = new VectorGrid(c.getVector("origin"), 1, 1, 1,
+			c.getVector("spacing"));
+	grid->setReflective(c.getBool("reflective"));
+	// the workers map the file again, without reading it
+	grid->setMappedFile(mapGridFile(c.getString("file")), size.x, size.y, size.z);
+	MagneticFieldGrid *field = new MagneticFieldGrid(grid);
+	field->setTricubic(c.getBool("tricubic"));
+	return field;
+}
+
+Referenced *createSource(const Configuration &c) {
+	Source *source = new Source();
+	std::vector<ref_ptr<SourceFeature> > features = c.getList<SourceFeature>("features");
+	for (size_t i = 0; i < features.size(); i++)
+		source->add(features[i]);
+	return source;
+}
+
+Referenced *createSourceParticleType(const Configuration &c) {
+	return new SourceParticleType(c.getInt("id"));
+}
+
+Referenced *createSourceEnergy(const Configuration &c) {
+	return new SourceEnergy(c.getDouble("energy"));
+}
+
+Referenced *createSourcePowerLawSpectrum(const Configuration &c) {
+	return new SourcePowerLawSpectrum(c.getDouble("Emin"), c.getDouble("Emax"),
+			c.getDouble("index"));
+}
+
+Referenced *createSourcePosition(const Configuration &c) {
+	return new SourcePosition(c.getVector("position"));
+}
+
+Referenced *createSourceUniformSphere(const Configuration &c) {
+	return new SourceUniformSphere(c.getVector("center"), c.getDouble("radius"));
+}
+
+Referenced *createSourceIsotropicEmission(const Configuration &c) {
+	return new SourceIsotropicEmission();
+}
+
+Referenced *createSourceDirection(const Configuration &c) {
+	return new SourceDirection(c.getVector("direction"));
+}
+
+Referenced *createSourceRedshift(const Configuration &c) {
+	return new SourceRedshift(c.getDouble("z"));
+}
+
+template<class T>
+Referenced *createFeature(const Configuration &c) {
+	return new T();
+}
+
+Referenced *createObserverSmallSphere(const Configuration &c) {
+	return new ObserverSmallSphere(c.getVector("center"), c.getDouble("radius"));
+}
+
+Referenced *createObserverLargeSphere(const Configuration &c) {
+	return new ObserverLargeSphere(c.getVector("center"), c.getDouble("radius"));
+}
+
+Referenced *createObserverRedshiftWindow(const Configuration &c) {
+	return new ObserverRedshiftWindow(c.getDouble("zmin"), c.getDouble("zmax"));
+}
+
+Referenced *createObserverTimeEvolution(const Configuration &c) {
+	ObserverTimeEvolution *o = new ObserverTimeEvolution();
+	std::vector<double> times = c.getDoubles("times");
+	for (size_t i = 0; i < times.size(); i++)
+		o->addTime(times[i]);
+	return o;
+}
+
+struct BuiltinType {
+	const char *type;
+	ConfigurationDocument::Factory factory;
+};
+
+const BuiltinType builtinTypes[] = {
+	{"ModuleList", createModuleList},
+	{"SimplePropagation", createSimplePropagation},
+	{"PropagationCK", createPropagationCK},
+	{"MaximumTrajectoryLength", createMaximumTrajectoryLength},
+	{"MinimumEnergy", createMinimumEnergy},
+	{"MinimumRigidity", createMinimumRigidity},
+	{"MinimumRedshift", createMinimumRedshift},
+	{"DetectionLength", createDetectionLength},
+	{"Observer", createObserver},
+	{"UniformMagneticField", createUniformMagneticField},
+	{"MagneticFieldList", createMagneticFieldList},
+	{"MagneticFieldEvolution", createMagneticFieldEvolution},
+	{"MagneticFieldGrid", createMagneticFieldGrid},
+	{"Source", createSource},
+	{"SourceParticleType", createSourceParticleType},
+	{"SourceEnergy", createSourceEnergy},
+	{"SourcePowerLawSpectrum", createSourcePowerLawSpectrum},
+	{"SourcePosition", createSourcePosition},
+	{"SourceUniformSphere", createSourceUniformSphere},
+	{"SourceIsotropicEmission", createSourceIsotropicEmission},
+	{"SourceDirection", createSourceDirection},
+	{"SourceRedshift", createSourceRedshift},
+	{"ObserverDetectAll", createFeature<ObserverDetectAll>},
+	{"ObserverSmallSphere", createObserverSmallSphere},
+	{"ObserverLargeSphere", createObserverLargeSphere},
+	{"ObserverPoint", createFeature<ObserverPoint>},
+	{"ObserverRedshiftWindow", createObserverRedshiftWindow},
+	{"ObserverInactiveVeto", createFeature<ObserverInactiveVeto>},
+	{"ObserverNucleusVeto", createFeature<ObserverNucleusVeto>},
+	{"ObserverNeutrinoVeto", createFeature<ObserverNeutrinoVeto>},
+	{"ObserverPhotonVeto", createFeature<ObserverPhotonVeto>},
+	{"ObserverElectronVeto", createFeature<ObserverElectronVeto>},
+	{"ObserverTimeEvolution", createObserverTimeEvolution}
+};
+
+} // namespace
+
+std::map<std::string, ConfigurationDocument::Factory> &ConfigurationDocument::factories() {
+	static std::map<std::string, Factory> f;
+	#pragma omp critical(ConfigurationTypes)
+	if (f.empty())
+		for (size_t i = 0; i < sizeof(builtinTypes) / sizeof(builtinTypes[0]); i++)
+			f[builtinTypes[i].type] = builtinTypes[i].factory;
+	return f;
+}
+
+void ConfigurationDocument::addType(const std::string &type, Factory factory) {
+	factories()[type] = factory;
+}
+
+bool ConfigurationDocument::hasType(const std::string &type) {
+	return factories().count(type) > 0;
+}
+
+} // namespace crpropa
@@ -8,6 +8,50 @@
 
 namespace crpropa {
 
+/**
+ @class CosmologyTable
+ @brief Cubic Hermite table of y(x)
+
+ Node 0 is at x = 0. The nodes are found in buckets equidistant in log(x),
+ so a lookup needs one logarithm and at most a few comparisons.
+ */
+struct CosmologyTable {
+	double xmin, xmax;
+	double scale; // buckets per unit of ln(x)
+	std::vector<double> x, y, dy; // nodes, values and derivatives
+	std::vector<size_t> buckets; // last node below each bucket
+
+	// index the nodes x, buckets of the width of the smallest log step
+	void index() {
+		xmin = x[1];
+		xmax = x.back();
+		size_t n = 4 * (x.size() - 2);
+		scale = n / log(xmax / xmin);
+		buckets.resize(n);
+		size_t i = 1;
+		for (size_t b = 0; b < n; b++) {
+			double xb = xmin * exp(b / scale);
+			while ((i + 2 < x.size()) && (x[i + 1] <= xb))
+				i++;
+			buckets[b] = i;
+		}
+	}
+
+	double operator()(double xi) const {
+		size_t i = 0;
+		if (xi >= xmin) {
+			i = buckets[std::min(size_t(log(xi / xmin) * scale), buckets.size() - 1)];
+			while ((i + 2 < x.size()) && (x[i + 1] <= xi))
+				i++;
+		}
+		double h = x[i + 1] - x[i];
+		double s = (xi - x[i]) / h;
+		double s2 = s * s, s3 = s2 * s;
+		return (2 * s3 - 3 * s2 + 1) * y[i] + (s3 - 2 * s2 + s) * h * dy[i]
+				+ (3 * s2 - 2 * s3) * y[i + 1] + (s3 - s2) * h * dy[i + 1];
+	}
+};
+
 /**
  @class Cosmology
  @brief Cosmology calculations
@@ -21,31 +65,86 @@ struct Cosmology {
 	static const double zmin;
 	static const double zmax;
 
-	std::vector<double> Z;  // redshift
-	std::vector<double> Dc; // comoving distance [m]
-	std::vector<double> Dl; // luminosity distance [m]
-	std::vector<double> Dt; // light travel distance [m]
+	// of the redshift
+	CosmologyTable Dc; // comoving distance [m]
+	CosmologyTable Dl; // luminosity distance [m]
+	CosmologyTable Dt; // light travel distance [m]
+	// of the comoving distance
+	CosmologyTable ZofDc;
+	CosmologyTable DtofDc;
+	// of the luminosity distance
+	CosmologyTable ZofDl;
+	// of the light travel distance
+	CosmologyTable ZofDt;
+	CosmologyTable DcofDt;
+
+	double E(double z) const {
+		return sqrt(omegaL + omegaM * pow_integer<3>(1 + z));
+	}
 
 	void update() {
 		double dH = c_light / H0; // Hubble distance
 
-		std::vector<double> E(n);
-		E[0] = 1;
-
 		// Relation between comoving distance r and redshift z (cf. J.A. Peacock, Cosmological physics, p. 89 eq. 3.76)
-		// dr = c / H(z) dz, integration using midpoint rule
+		// dr = c / H(z) dz, Simpson's rule between the nodes
+		std::vector<double> Z(n), dc(n), dt(n);
 		double dlz = log10(zmax) - log10(zmin);
 		for (int i = 1; i < n; i++) {
-			Z[i] = zmin * pow(10, i * dlz / (n - 1)); // logarithmic even spacing
-			double dz = (Z[i] - Z[i - 1]); // redshift step
-			E[i] = sqrt(omegaL + omegaM * pow_integer<3>(1 + Z[i]));
-			Dc[i] = Dc[i - 1] + dH * dz * (1 / E[i] + 1 / E[i - 1]) / 2;
-			Dl[i] = (1 + Z[i]) * Dc[i];
-			Dt[i] = Dt[i - 1]
-					+ dH * dz
-							* (1 / ((1 + Z[i]) * E[i])
-									+ 1 / ((1 + Z[i - 1]) * E[i - 1])) / 2;
+			Z[i] = zmin * pow(10, (i - 1) * dlz / (n - 2)); // logarithmic even spacing
+			const int m = 16;
+			double h = (Z[i] - Z[i - 1]) / m;
+			double sc = 0, st = 0;
+			for (int j = 0; j <= m; j++) {
+				double zj = Z[i - 1] + j * h;
+				double w = ((j == 0) || (j == m)) ? 1 : ((j % 2) ? 4 : 2);
+				sc += w / E(zj);
+				st += w / ((1 + zj) * E(zj));
+			}
+			dc[i] = dc[i - 1] + dH * h / 3 * sc;
+			dt[i] = dt[i - 1] + dH * h / 3 * st;
 		}
+		Z[n - 1] = zmax;
+
+		// the tables share the nodes, the derivatives are analytic
+		Dc.x = Dl.x = Dt.x = Z;
+		ZofDc.x = DtofDc.x = dc;
+		ZofDt.x = DcofDt.x = dt;
+		Dc.y = DcofDt.y = dc;
+		Dt.y = DtofDc.y = dt;
+		ZofDc.y = ZofDl.y = ZofDt.y = Z;
+		Dl.y.resize(n);
+		Dc.dy.resize(n);
+		Dl.dy.resize(n);
+		Dt.dy.resize(n);
+		for (int i = 0; i < n; i++) {
+			double z = Z[i];
+			Dl.y[i] = (1 + z) * dc[i];
+			Dc.dy[i] = dH / E(z);
+			Dt.dy[i] = dH / ((1 + z) * E(z));
+			Dl.dy[i] = dc[i] + (1 + z) * Dc.dy[i];
+		}
+		ZofDl.x = Dl.y;
+		ZofDc.dy.resize(n);
+		ZofDl.dy.resize(n);
+		ZofDt.dy.resize(n);
+		DtofDc.dy.resize(n);
+		DcofDt.dy.resize(n);
+		for (int i = 0; i < n; i++) {
+			ZofDc.dy[i] = 1 / Dc.dy[i];
+			ZofDl.dy[i] = 1 / Dl.dy[i];
+			ZofDt.dy[i] = 1 / Dt.dy[i];
+			DtofDc.dy[i] = 1 / (1 + Z[i]);
+			DcofDt.dy[i] = 1 + Z[i];
+		}
+
+		Dc.index();
+		Dl.index();
+		Dt.index();
+		ZofDc.index();
+		DtofDc.index();
+		ZofDl.index();
+		ZofDt.index();
+		DcofDt.index();
 	}
 
 	Cosmology() {
@@ -53,21 +152,10 @@ struct Cosmology {
 		H0 = 67.3 * 1000 * meter / second / Mpc; // default values
 		omegaM = 0.315;
 		omegaL = 1 - omegaM;
-
-		Z.resize(n);
-		Dc.resize(n);
-		Dl.resize(n);
-		Dt.resize(n);
-
-		Z[0] = 0;
-		Dc[0] = 0;
-		Dl[0] = 0;
-		Dt[0] = 0;
-
 		update();
 	}
 
-	void setParameters(double h, double oM) {
+	Cosmology(double h, double oM) {
 		H0 = h * 1e5 / Mpc;
 		omegaM = oM;
 		omegaL = 1 - oM;
@@ -75,95 +163,144 @@ struct Cosmology {
 	}
 };
 
-const int Cosmology::n = 1000;
+// 64 nodes per decade, the cubic interpolation is accurate to ~1e-8
+const int Cosmology::n = 386;
 const double Cosmology::zmin = 0.0001;
 const double Cosmology::zmax = 100;
 
-static Cosmology cosmology; // instance is created at runtime
+static Cosmology defaultCosmology; // instance is created at runtime
+static const Cosmology *cosmology = &defaultCosmology;
+
+/*
+ New parameters are set by publishing the complete new tables, concurrent
+ readers use either the old or the new ones. The old tables are kept, as
+ readers may still use them.
+ */
+static std::vector<Cosmology *> &retiredCosmologies() {
+	static std::vector<Cosmology *> retired;
+	return retired;
+}
+
+static inline const Cosmology &currentCosmology() {
+	return *__atomic_load_n(&cosmology, __ATOMIC_ACQUIRE);
+}
 
 void setCosmologyParameters(double h, double oM) {
-	cosmology.setParameters(h, oM);
+	Cosmology *c = new Cosmology(h, oM);
+#pragma omp critical(Cosmology)
+	{
+		retiredCosmologies().push_back(c);
+		__atomic_store_n(&cosmology, c, __ATOMIC_RELEASE);
+	}
 }
 
 double hubbleRate(double z) {
+	const Cosmology &cosmology = currentCosmology();
 	return cosmology.H0
 			* sqrt(cosmology.omegaL + cosmology.omegaM * pow(1 + z, 3));
 }
 
 double omegaL() {
-	return cosmology.omegaL;
+	return currentCosmology().omegaL;
 }
 
 double omegaM() {
-	return cosmology.omegaM;
+	return currentCosmology().omegaM;
 }
 
 double H0() {
-	return cosmology.H0;
+	return currentCosmology().H0;
 }
 
-double comovingDistance2Redshift(double d) {
+static inline void checkRedshift(double z) {
+	if (z < 0)
+		throw std::runtime_error("Cosmology: z < 0");
+	if (z > Cosmology::zmax)
+		throw std::runtime_error("Cosmology: z > zmax");
+}
+
+static inline void checkDistance(double d, const CosmologyTable &table) {
 	if (d < 0)
 		throw std::runtime_error("Cosmology: d < 0");
-	if (d > cosmology.Dc.back())
+	if (d > table.xmax)
 		throw std::runtime_error("Cosmology: d > dmax");
-	return interpolate(d, cosmology.Dc, cosmology.Z);
+}
+
+// evaluate the table for n arguments
+static void interpolateBatch(const CosmologyTable &table, const double *x,
+		double *y, size_t n, bool redshift) {
+	for (size_t i = 0; i < n; i++) {
+		if (redshift)
+			checkRedshift(x[i]);
+		else
+			checkDistance(x[i], table);
+		y[i] = table(x[i]);
+	}
+}
+
+double comovingDistance2Redshift(double d) {
+	const Cosmology &cosmology = currentCosmology();
+	checkDistance(d, cosmology.ZofDc);
+	return cosmology.ZofDc(d);
 }
 
 double redshift2ComovingDistance(double z) {
-	if (z < 0)
-		throw std::runtime_error("Cosmology: z < 0");
-	if (z > cosmology.zmax)
-		throw std::runtime_error("Cosmology: z > zmax");
-	return interpolate(z, cosmology.Z, cosmology.Dc);
+	checkRedshift(z);
+	return currentCosmology().Dc(z);
 }
 
 double luminosityDistance2Redshift(double d) {
-	if (d < 0)
-		throw std::runtime_error("Cosmology: d < 0");
-	if (d > cosmology.Dl.back())
-		throw std::runtime_error("Cosmology: d > dmax");
-	return interpolate(d, cosmology.Dl, cosmology.Z);
+	const Cosmology &cosmology = currentCosmology();
+	checkDistance(d, cosmology.ZofDl);
+	return cosmology.ZofDl(d);
 }
 
 double redshift2LuminosityDistance(double z) {
-	if (z < 0)
-		throw std::runtime_error("Cosmology: z < 0");
-	if (z > cosmology.zmax)
-		throw std::runtime_error("Cosmology: z > zmax");
-	return interpolate(z, cosmology.Z, cosmology.Dl);
+	checkRedshift(z);
+	return currentCosmology().Dl(z);
 }
 
 double lightTravelDistance2Redshift(double d) {
-	if (d < 0)
-		throw std::runtime_error("Cosmology: d < 0");
-	if (d > cosmology.Dt.back())
-		throw std::runtime_error("Cosmology: d > dmax");
-	return interpolate(d, cosmology.Dt, cosmology.Z);
+	const Cosmology &cosmology = currentCosmology();
+	checkDistance(d, cosmology.ZofDt);
+	return cosmology.ZofDt(d);
 }
 
 double redshift2LightTravelDistance(double z) {
-	if (z < 0)
-		throw std::runtime_error("Cosmology: z < 0");
-	if (z > cosmology.zmax)
-		throw std::runtime_error("Cosmology: z > zmax");
-	return interpolate(z, cosmology.Z, cosmology.Dt);
+	checkRedshift(z);
+	return currentCosmology().Dt(z);
 }
 
 double comoving2LightTravelDistance(double d) {
-	if (d < 0)
-		throw std::runtime_error("Cosmology: d < 0");
-	if (d > cosmology.Dc.back())
-		throw std::runtime_error("Cosmology: d > dmax");
-	return interpolate(d, cosmology.Dc, cosmology.Dt);
+	const Cosmology &cosmology = currentCosmology();
+	checkDistance(d, cosmology.DtofDc);
+	return cosmology.DtofDc(d);
 }
 
 double lightTravel2ComovingDistance(double d) {
-	if (d < 0)
-		throw std::runtime_error("Cosmology: d < 0");
-	if (d > cosmology.Dt.back())
-		throw std::runtime_error("Cosmology: d > dmax");
-	return interpolate(d, cosmology.Dt, cosmology.Dc);
+	const Cosmology &cosmology = currentCosmology();
+	checkDistance(d, cosmology.DcofDt);
+	return cosmology.DcofDt(d);
+}
+
+void comovingDistance2Redshift(const double *d, double *z, size_t n) {
+	interpolateBatch(currentCosmology().ZofDc, d, z, n, false);
+}
+
+void redshift2ComovingDistance(const double *z, double *d, size_t n) {
+	interpolateBatch(currentCosmology().Dc, z, d, n, true);
+}
+
+void redshift2LightTravelDistance(const double *z, double *d, size_t n) {
+	interpolateBatch(currentCosmology().Dt, z, d, n, true);
+}
+
+void lightTravelDistance2Redshift(const double *d, double *z, size_t n) {
+	interpolateBatch(currentCosmology().ZofDt, d, z, n, false);
+}
+
+void comoving2LightTravelDistance(const double *dc, double *dt, size_t n) {
+	interpolateBatch(currentCosmology().DtofDc, dc, dt, n, false);
 }
 
 } // namespace crpropa
@@ -0,0 +1,230 @@
+#include "crpropa/DataTable.h"
+#include "crpropa/SimulationBundle.h"
+
+#include <kiss/logger.h>
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <sys/stat.h>
+
+namespace crpropa {
+
+// binary layout: magic, number of rows, number of values, row offsets, values
+static const char dataTableMagic[8] = {'C', 'R', 'P', 'T', 'A', 'B', '1', '\0'};
+static const size_t dataTableHeader = 8 + 2 * sizeof(unsigned long long);
+
+// modification time of a file, false if it does not exist
+static bool fileTime(const std::string &filename, time_t &t) {
+	struct stat st;
+	if (stat(filename.c_str(), &st) != 0)
+		return false;
+	t = st.st_mtime;
+	return true;
+}
+
+DataTable::DataTable() :
+		memory("DataTable"), offsets(0), values(0), rows(0) {
+}
+
+void DataTable::parse(const std::string &filename) {
+	std::ifstream infile(filename.c_str());
+	if (!infile.good())
+		throw std::runtime_error("DataTable: could not open file " + filename);
+
+	std::vector<unsigned long long> o(1, 0);
+	std::vector<double> v;
+	std::string line;
+	while (std::getline(infile, line)) {
+		const char *p = line.c_str();
+		while (isspace(*p))
+			p++;
+		if ((*p == '#') || (*p == '\0'))
+			continue;
+		while (*p != '\0') {
+			char *end;
+			double x = strtod(p, &end);
+			if (end == p)
+				throw std::runtime_error("DataTable: no number in " + filename + ": " + line);
+			v.push_back(x);
+			p = end;
+			while (isspace(*p))
+				p++;
+		}
+		o.push_back(v.size());
+	}
+
+	ownedOffsets.swap(o);
+	ownedValues.swap(v);
+	mapped = 0;
+	rows = ownedOffsets.size() - 1;
+	offsets = &ownedOffsets[0];
+	values = ownedValues.empty() ? 0 : &ownedValues[0];
+	memory.set(ownedOffsets.capacity() * sizeof(unsigned long long)
+			+ ownedValues.capacity() * sizeof(double));
+}
+
+void DataTable::map(ref_ptr<MappedFile> file) {
+	const std::string &binaryFilename = file->getFilename();
+	const char *p = (const char *) file->getData();
+	size_t size = file->getSize();
+
+	unsigned long long header[2];
+	if ((size < dataTableHeader) || (memcmp(p, dataTableMagic, 8) != 0))
+		throw std::runtime_error("DataTable: " + binaryFilename + " is no data table");
+	memcpy(header, p + 8, sizeof(header));
+	if (size != dataTableHeader + (header[0] + 1 + header[1]) * 8)
+		throw std::runtime_error("DataTable: " + binaryFilename + " has the wrong size");
+
+	mapped = file;
+	std::vector<unsigned long long>().swap(ownedOffsets);
+	std::vector<double>().swap(ownedValues);
+	memory.set(0);
+	rows = header[0];
+	offsets = (const unsigned long long *) (p + dataTableHeader);
+	values = (const double *) (p + dataTableHeader + (rows + 1) * 8);
+}
+
+void DataTable::compile(const std::string &filename,
+		const std::string &binaryFilename) {
+	DataTable table;
+	table.parse(filename);
+
+	// write to a temporary file first, other processes may map the file
+	std::string tmp = binaryFilename + ".tmp";
+	std::ofstream out(tmp.c_str(), std::ios::binary);
+	if (!out.good())
+		throw std::runtime_error("DataTable: could not write file " + tmp);
+	table.write(out);
+	out.close();
+	if (!out || (std::rename(tmp.c_str(), binaryFilename.c_str()) != 0)) {
+		std::remove(tmp.c_str());
+		throw std::runtime_error("DataTable: could not write file " + binaryFilename);
+	}
+}
+
+void DataTable::write(std::ostream &out) const {
+	unsigned long long header[2] = {rows, offsets[rows]};
+	out.write(dataTableMagic, 8);
+	out.write((const char *) header, sizeof(header));
+	out.write((const char *) offsets, (rows + 1) * 8);
+	if (header[1] > 0)
+		out.write((const char *) values, header[1] * 8);
+}
+
+size_t DataTable::getBinarySize() const {
+	return dataTableHeader + (rows + 1 + offsets[rows]) * 8;
+}
+
+// files of the tables opened so far, for SimulationBundle::create
+static std::set<std::string> openedFiles;
+
+std::vector<std::string> DataTable::getFilenames() {
+	std::vector<std::string> names;
+#pragma omp critical(DataTable)
+	names.assign(openedFiles.begin(), openedFiles.end());
+	return names;
+}
+
+ref_ptr<DataTable> DataTable::open(const std::string &filename) {
+	static std::map<std::string, ref_ptr<DataTable> > tables;
+
+	ref_ptr<DataTable> table;
+	std::string error;
+#pragma omp critical(DataTable)
+	{
+		// forget tables that are no longer used
+		std::map<std::string, ref_ptr<DataTable> >::iterator i = tables.begin();
+		while (i != tables.end()) {
+			if (i->second->getReferenceCount() == 1)
+				tables.erase(i++);
+			else
+				++i;
+		}
+
+		i = tables.find(filename);
+		ref_ptr<MappedFile> bundled;
+		if (i == tables.end())
+			bundled = SimulationBundle::getTable(filename);
+		if (i != tables.end()) {
+			table = i->second;
+		} else if (bundled.valid()) {
+			try {
+				table = new DataTable();
+				table->map(bundled);
+				tables[filename] = table;
+				openedFiles.insert(filename);
+			} catch (std::exception &e) {
+				table = 0;
+				error = e.what();
+			}
+		} else {
+			try {
+				table = new DataTable();
+				std::string bin = filename + ".bin";
+				time_t tText, tBin;
+				bool haveText = fileTime(filename, tText);
+				bool haveBin = fileTime(bin, tBin) && (!haveText || (tBin >= tText));
+
+				if (!haveText && !haveBin) {
+					table = 0;
+				} else {
+					if (!haveBin) {
+						try {
+							compile(filename, bin);
+							haveBin = true;
+						} catch (std::exception &e) {
+							std::string what = e.what();
+							KISS_LOG_INFO << what << ", reading " << filename << " as text";
+						}
+					}
+					bool isMapped = false;
+					if (haveBin) {
+						try {
+							table->map(new MappedFile(bin));
+							isMapped = true;
+						} catch (std::exception &e) {
+							if (!haveText)
+								throw;
+							std::string what = e.what();
+							KISS_LOG_WARNING << what << ", reading " << filename << " as text";
+						}
+					}
+					if (!isMapped)
+						table->parse(filename);
+					tables[filename] = table;
+					openedFiles.insert(filename);
+				}
+			} catch (std::exception &e) {
+				table = 0;
+				error = e.what();
+			}
+		}
+	}
+	if (!error.empty())
+		throw std::runtime_error(error);
+	return table;
+}
+
+size_t DataTable::size() const {
+	return rows;
+}
+
+size_t DataTable::rowSize(size_t i) const {
+	return offsets[i + 1] - offsets[i];
+}
+
+const double *DataTable::row(size_t i) const {
+	return values + offsets[i];
+}
+
+double DataTable::get(size_t i, size_t j) const {
+	return values[offsets[i] + j];
+}
+
+} // namespace crpropa
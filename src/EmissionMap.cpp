@@ -2,16 +2,49 @@
 #include "crpropa/Random.h"
 #include "crpropa/Units.h"
 
+#include <cstring>
 #include <fstream>
+#include <stdexcept>
+#include <stdint.h>
+#include <kiss/string.h>
+
+#ifdef CRPROPA_HAVE_ZLIB
+#include "crpropa/GzipStream.h"
+#include <izstream.hpp>
+#endif
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 namespace crpropa {
 
-CylindricalProjectionMap::CylindricalProjectionMap() : nPhi(360), nTheta(180), dirty(false), pdf(nPhi* nTheta, 0), cdf(nPhi* nTheta, 0) {
+// further threads fill the shared maps under a lock
+static const size_t EMISSION_MAP_THREADS = 256;
+
+// first bytes of the binary files
+static const char EMISSION_MAP_MAGIC[8] = {'C', 'R', 'E', 'M', 'A', 'P', '0', '1'};
+
+template<typename T>
+static void writeValue(std::ostream &out, const T &value) {
+	out.write((const char *) &value, sizeof(T));
+}
+
+template<typename T>
+static T readValue(std::istream &in) {
+	T value;
+	in.read((char *) &value, sizeof(T));
+	if (!in.good())
+		throw std::runtime_error("EmissionMap: truncated binary file");
+	return value;
+}
+
+CylindricalProjectionMap::CylindricalProjectionMap() : nPhi(360), nTheta(180), pdf(nPhi* nTheta, 0), frozen(0) {
 	sPhi = 2. * M_PI / nPhi;
 	sTheta = 2. / nTheta;
 }
 
-CylindricalProjectionMap::CylindricalProjectionMap(size_t nPhi, size_t nTheta) : nPhi(nPhi), nTheta(nTheta), dirty(false), pdf(nPhi* nTheta, 0), cdf(nPhi* nTheta, 0) {
+CylindricalProjectionMap::CylindricalProjectionMap(size_t nPhi, size_t nTheta) : nPhi(nPhi), nTheta(nTheta), pdf(nPhi* nTheta, 0), frozen(0) {
 	sPhi = 2 * M_PI / nPhi;
 	sTheta = 2. / nTheta;
 }
@@ -23,16 +56,26 @@ void CylindricalProjectionMap::fillBin(const Vector3d& direction, double weight)
 
 void CylindricalProjectionMap::fillBin(size_t bin, double weight) {
 	pdf[bin] += weight;
-	dirty = true;
+	frozen = 0;
 }
 
-Vector3d CylindricalProjectionMap::drawDirection() const {
-	if (dirty)
+void CylindricalProjectionMap::freeze() const {
+#pragma omp critical(CylindricalProjectionMap)
+	if (!__atomic_load_n(&frozen, __ATOMIC_RELAXED)) {
 		updateCdf();
+		__atomic_store_n(&frozen, 1, __ATOMIC_RELEASE);
+	}
+}
 
-	size_t bin = Random::instance().randBin(cdf);
+size_t CylindricalProjectionMap::drawBin() const {
+	if (!__atomic_load_n(&frozen, __ATOMIC_ACQUIRE))
+		freeze();
+
+	return Random::instance().randBin(table);
+}
 
-	return directionFromBin(bin);
+Vector3d CylindricalProjectionMap::drawDirection() const {
+	return directionFromBin(drawBin());
 }
 
 bool CylindricalProjectionMap::checkDirection(const Vector3d &direction) const {
@@ -40,16 +83,24 @@ bool CylindricalProjectionMap::checkDirection(const Vector3d &direction) const {
 	return pdf[bin];
 }
 
+double CylindricalProjectionMap::getSamplingWeight(size_t bin) const {
+	const std::vector<double> &c = getCdf();
+	return c.back() / (pdf[bin] * pdf.size());
+}
+
 
 const std::vector<double>& CylindricalProjectionMap::getPdf() const {
 	return pdf;
 }
 
 std::vector<double>& CylindricalProjectionMap::getPdf() {
+	frozen = 0;
 	return pdf;
 }
 
 const std::vector<double>& CylindricalProjectionMap::getCdf() const {
+	if (!__atomic_load_n(&frozen, __ATOMIC_ACQUIRE))
+		freeze();
 	return cdf;
 }
 
@@ -107,26 +158,26 @@ Vector3d CylindricalProjectionMap::directionFromBin(size_t bin) const {
 }
 
 void CylindricalProjectionMap::updateCdf() const {
-	if (dirty) {
-		cdf[0] = pdf[0];
-		for (size_t i = 1; i < pdf.size(); i++) {
-			cdf[i] = cdf[i-1] + pdf[i];
-		}
-		dirty = false;
+	cdf.resize(pdf.size());
+	double sum = 0;
+	for (size_t i = 0; i < pdf.size(); i++) {
+		sum += pdf[i];
+		cdf[i] = sum;
 	}
+	table.setCDF(cdf);
 }
 
 EmissionMap::EmissionMap() : minEnergy(0.0001 * EeV), maxEnergy(10000 * EeV),
-	nEnergy(8*2), nPhi(360), nTheta(180) {
+	nEnergy(8*2), nPhi(360), nTheta(180), threadMaps(EMISSION_MAP_THREADS), threadsFilled(0) {
 	logStep = log10(maxEnergy / minEnergy) / nEnergy;
 }
 
 EmissionMap::EmissionMap(size_t nPhi, size_t nTheta, size_t nEnergy) : minEnergy(0.0001 * EeV), maxEnergy(10000 * EeV),
-	nEnergy(nEnergy), nPhi(nPhi), nTheta(nTheta) {
+	nEnergy(nEnergy), nPhi(nPhi), nTheta(nTheta), threadMaps(EMISSION_MAP_THREADS), threadsFilled(0) {
 	logStep = log10(maxEnergy / minEnergy) / nEnergy;
 }
 
-EmissionMap::EmissionMap(size_t nPhi, size_t nTheta, size_t nEnergy, double minEnergy, double maxEnergy) : minEnergy(minEnergy), maxEnergy(maxEnergy), nEnergy(nEnergy), nPhi(nPhi), nTheta(nTheta) {
+EmissionMap::EmissionMap(size_t nPhi, size_t nTheta, size_t nEnergy, double minEnergy, double maxEnergy) : minEnergy(minEnergy), maxEnergy(maxEnergy), nEnergy(nEnergy), nPhi(nPhi), nTheta(nTheta), threadMaps(EMISSION_MAP_THREADS), threadsFilled(0) {
 	logStep = log10(maxEnergy / minEnergy) / nEnergy;
 }
 
@@ -146,15 +197,74 @@ void EmissionMap::fillMap(const ParticleState& state, double weight) {
 	fillMap(state.getId(), state.getEnergy(), state.getDirection(), weight);
 }
 
+void EmissionMap::fillMapOfThread(const ParticleState& state, double weight) {
+#ifdef _OPENMP
+	size_t thread = omp_get_thread_num();
+#else
+	size_t thread = 0;
+#endif
+	key_t key(state.getId(), binFromEnergy(state.getEnergy()));
+	if (thread >= threadMaps.size()) {
+#pragma omp critical(EmissionMapShared)
+		{
+			ref_ptr<CylindricalProjectionMap> &cpm = maps[key];
+			if (!cpm.valid())
+				cpm = new CylindricalProjectionMap(nPhi, nTheta);
+			cpm->fillBin(state.getDirection(), weight);
+		}
+		return;
+	}
+	ref_ptr<CylindricalProjectionMap> &cpm = threadMaps[thread].maps[key];
+	if (!cpm.valid())
+		cpm = new CylindricalProjectionMap(nPhi, nTheta);
+	cpm->fillBin(state.getDirection(), weight);
+	if (!__atomic_load_n(&threadsFilled, __ATOMIC_RELAXED))
+		__atomic_store_n(&threadsFilled, 1, __ATOMIC_RELAXED);
+}
+
+void EmissionMap::mergeThreads() const {
+	if (!__atomic_load_n(&threadsFilled, __ATOMIC_ACQUIRE))
+		return;
+#pragma omp critical(EmissionMap)
+	if (__atomic_load_n(&threadsFilled, __ATOMIC_RELAXED)) {
+		for (size_t t = 0; t < threadMaps.size(); t++) {
+			map_t &m = threadMaps[t].maps;
+			for (map_t::iterator i = m.begin(); i != m.end(); i++) {
+				ref_ptr<CylindricalProjectionMap> &cpm = maps[i->first];
+				if (!cpm.valid()) {
+					cpm = i->second;
+					continue;
+				}
+				const std::vector<double> &pdf = i->second->getPdf();
+				for (size_t k = 0; k < pdf.size(); k++)
+					if (pdf[k] != 0)
+						cpm->fillBin(k, pdf[k]);
+			}
+			m.clear();
+		}
+		__atomic_store_n(&threadsFilled, 0, __ATOMIC_RELEASE);
+	}
+}
+
+void EmissionMap::freeze() const {
+	mergeThreads();
+	for (map_t::const_iterator i = maps.begin(); i != maps.end(); i++)
+		if (i->second.valid())
+			i->second->freeze();
+}
+
 EmissionMap::map_t &EmissionMap::getMaps() {
+	mergeThreads();
 	return maps;
 }
 
 const EmissionMap::map_t &EmissionMap::getMaps() const {
+	mergeThreads();
 	return maps;
 }
 
 bool EmissionMap::drawDirection(int pid, double energy, Vector3d& direction) const {
+	mergeThreads();
 	key_t key(pid, binFromEnergy(energy));
 	map_t::const_iterator i = maps.find(key);
 
@@ -170,7 +280,23 @@ bool EmissionMap::drawDirection(const ParticleState& state, Vector3d& direction)
 	return drawDirection(state.getId(), state.getEnergy(), direction);
 }
 
+bool EmissionMap::drawDirection(const ParticleState& state, Vector3d& direction, double &weight) const {
+	mergeThreads();
+	key_t key(state.getId(), binFromEnergy(state.getEnergy()));
+	map_t::const_iterator i = maps.find(key);
+
+	if (i == maps.end() || !i->second.valid()) {
+		return false;
+	} else {
+		size_t bin = i->second->drawBin();
+		direction = i->second->directionFromBin(bin);
+		weight = i->second->getSamplingWeight(bin);
+		return true;
+	}
+}
+
 bool EmissionMap::checkDirection(int pid, double energy, const Vector3d& direction) const {
+	mergeThreads();
 	key_t key(pid, binFromEnergy(energy));
 	map_t::const_iterator i = maps.find(key);
 
@@ -186,6 +312,7 @@ bool EmissionMap::checkDirection(const ParticleState& state) const {
 }
 
 bool EmissionMap::hasMap(int pid, double energy) {
+	mergeThreads();
     key_t key(pid, binFromEnergy(energy));
     map_t::iterator i = maps.find(key);
     if (i == maps.end() || !i->second.valid())
@@ -195,6 +322,7 @@ bool EmissionMap::hasMap(int pid, double energy) {
 }
 
 ref_ptr<CylindricalProjectionMap> EmissionMap::getMap(int pid, double energy) {
+	mergeThreads();
 	key_t key(pid, binFromEnergy(energy));
 	map_t::iterator i = maps.find(key);
 	if (i == maps.end() || !i->second.valid()) {
@@ -207,6 +335,7 @@ ref_ptr<CylindricalProjectionMap> EmissionMap::getMap(int pid, double energy) {
 }
 
 void EmissionMap::save(const std::string &filename) {
+	mergeThreads();
 	std::ofstream out(filename.c_str());
 	out.imbue(std::locale("C"));
 
@@ -222,17 +351,138 @@ void EmissionMap::save(const std::string &filename) {
 	}
 }
 
+void EmissionMap::saveBinary(const std::string &filename) {
+	std::ofstream outfile(filename.c_str(), std::ios::binary);
+	if (!outfile.is_open())
+		throw std::runtime_error("EmissionMap: could not create file " + filename);
+	if (kiss::ends_with(filename, ".gz")) {
+#ifdef CRPROPA_HAVE_ZLIB
+		GzipStream out(outfile);
+		writeBinary(out);
+		out.close();
+#else
+		throw std::runtime_error("CRPropa was build without Zlib compression!");
+#endif
+	} else {
+		writeBinary(outfile);
+	}
+	if (!outfile.good())
+		throw std::runtime_error("EmissionMap: could not write file " + filename);
+}
+
+void EmissionMap::writeBinary(std::ostream &out) const {
+	mergeThreads();
+	uint64_t nMaps = 0;
+	for (map_t::const_iterator i = maps.begin(); i != maps.end(); i++)
+		if (i->second.valid())
+			nMaps++;
+
+	out.write(EMISSION_MAP_MAGIC, sizeof(EMISSION_MAP_MAGIC));
+	writeValue(out, minEnergy);
+	writeValue(out, maxEnergy);
+	writeValue(out, (uint64_t) nEnergy);
+	writeValue(out, (uint64_t) nPhi);
+	writeValue(out, (uint64_t) nTheta);
+	writeValue(out, nMaps);
+
+	for (map_t::const_iterator i = maps.begin(); i != maps.end(); i++) {
+		if (!i->second.valid())
+			continue;
+		const std::vector<double> &pdf = i->second->getPdf();
+		uint64_t filled = 0;
+		for (size_t k = 0; k < pdf.size(); k++)
+			if (pdf[k] != 0)
+				filled++;
+		// index and value of the filled bins if smaller than all values
+		char sparse = (filled * (sizeof(uint32_t) + sizeof(double))
+				< pdf.size() * sizeof(double)) ? 1 : 0;
+
+		writeValue(out, (int32_t) i->first.first);
+		writeValue(out, (uint64_t) i->first.second);
+		writeValue(out, (uint64_t) i->second->getNPhi());
+		writeValue(out, (uint64_t) i->second->getNTheta());
+		writeValue(out, filled);
+		writeValue(out, sparse);
+		if (sparse) {
+			for (size_t k = 0; k < pdf.size(); k++) {
+				if (pdf[k] == 0)
+					continue;
+				writeValue(out, (uint32_t) k);
+				writeValue(out, pdf[k]);
+			}
+		} else if (!pdf.empty()) {
+			out.write((const char *) &pdf[0], pdf.size() * sizeof(double));
+		}
+	}
+}
+
+void EmissionMap::readBinary(std::istream &in) {
+	char magic[sizeof(EMISSION_MAP_MAGIC)];
+	in.read(magic, sizeof(magic));
+	if (!in.good() || memcmp(magic, EMISSION_MAP_MAGIC, sizeof(magic)) != 0)
+		throw std::runtime_error("EmissionMap: not a binary emission map");
+
+	double minEnergy_ = readValue<double>(in);
+	double maxEnergy_ = readValue<double>(in);
+	size_t nEnergy_ = readValue<uint64_t>(in);
+	size_t nPhi_ = readValue<uint64_t>(in);
+	size_t nTheta_ = readValue<uint64_t>(in);
+	uint64_t nMaps = readValue<uint64_t>(in);
+
+	mergeThreads();
+	if (maps.empty()) {
+		minEnergy = minEnergy_;
+		maxEnergy = maxEnergy_;
+		nEnergy = nEnergy_;
+		nPhi = nPhi_;
+		nTheta = nTheta_;
+		logStep = log10(maxEnergy / minEnergy) / nEnergy;
+	} else if ((minEnergy != minEnergy_) || (maxEnergy != maxEnergy_)
+			|| (nEnergy != nEnergy_) || (nPhi != nPhi_) || (nTheta != nTheta_)) {
+		throw std::runtime_error("EmissionMap: binning of the file does not match");
+	}
+
+	for (uint64_t m = 0; m < nMaps; m++) {
+		key_t key;
+		key.first = readValue<int32_t>(in);
+		key.second = readValue<uint64_t>(in);
+		size_t mapPhi = readValue<uint64_t>(in);
+		size_t mapTheta = readValue<uint64_t>(in);
+		uint64_t filled = readValue<uint64_t>(in);
+		char sparse = readValue<char>(in);
+
+		ref_ptr<CylindricalProjectionMap> cpm = new CylindricalProjectionMap(mapPhi, mapTheta);
+		std::vector<double> &pdf = cpm->getPdf();
+		if (sparse) {
+			for (uint64_t k = 0; k < filled; k++) {
+				uint32_t bin = readValue<uint32_t>(in);
+				if (bin >= pdf.size())
+					throw std::runtime_error("EmissionMap: invalid bin in binary file");
+				pdf[bin] = readValue<double>(in);
+			}
+		} else if (!pdf.empty()) {
+			in.read((char *) &pdf[0], pdf.size() * sizeof(double));
+			if (!in.good())
+				throw std::runtime_error("EmissionMap: truncated binary file");
+		}
+		maps[key] = cpm;
+	}
+}
+
 void EmissionMap::merge(const EmissionMap *other) {
 	if (other == 0)
 		return;
+	mergeThreads();
 	map_t::const_iterator i = other->getMaps().begin();
 	map_t::const_iterator end = other->getMaps().end();
 	for(;i != end; i++) {
 		if (!i->second.valid())
 			continue;
 
-		std::vector<double> &otherpdf = i->second->getPdf();
-		ref_ptr<CylindricalProjectionMap> cpm = getMap(i->first.first, i->first.second);
+		const std::vector<double> &otherpdf = i->second->getPdf();
+		ref_ptr<CylindricalProjectionMap> &cpm = maps[i->first];
+		if (!cpm.valid())
+			cpm = new CylindricalProjectionMap(nPhi, nTheta);
 
 		if (otherpdf.size() != cpm->getPdf().size()) {
 			std::cout << "pdf size mismatch!" << std::endl;
@@ -240,19 +490,70 @@ void EmissionMap::merge(const EmissionMap *other) {
 		}
 
 		for (size_t k = 0; k < otherpdf.size(); k++) {
-			cpm->fillBin(k, otherpdf[k]);
+			if (otherpdf[k] != 0)
+				cpm->fillBin(k, otherpdf[k]);
 		}
 	}
 }
 
 void EmissionMap::merge(const std::string &filename) {
-	EmissionMap em;
+	EmissionMap em(nPhi, nTheta, nEnergy, minEnergy, maxEnergy);
 	em.load(filename);
+	if ((em.minEnergy != minEnergy) || (em.maxEnergy != maxEnergy)
+			|| (em.nEnergy != nEnergy))
+		throw std::runtime_error("EmissionMap: binning of " + filename + " does not match");
 	merge(&em);
 }
 
+void EmissionMap::merge(const std::vector<std::string> &filenames) {
+	std::string error;
+#pragma omp parallel
+	{
+		// sum of the files read by this thread
+		EmissionMap sum(nPhi, nTheta, nEnergy, minEnergy, maxEnergy);
+#pragma omp for schedule(dynamic)
+		for (long i = 0; i < (long) filenames.size(); i++) {
+			try {
+				sum.merge(filenames[i]);
+			} catch (std::exception &e) {
+#pragma omp critical(EmissionMapMerge)
+				error = e.what();
+			}
+		}
+#pragma omp critical(EmissionMapMerge)
+		merge(&sum);
+	}
+	if (!error.empty())
+		throw std::runtime_error(error);
+}
+
 void EmissionMap::load(const std::string &filename) {
-	std::ifstream in(filename.c_str());
+	std::ifstream in(filename.c_str(), std::ios::binary);
+	if (!in.good())
+		throw std::runtime_error("EmissionMap: could not open file " + filename);
+
+	if (kiss::ends_with(filename, ".gz")) {
+#ifdef CRPROPA_HAVE_ZLIB
+		zstream::igzstream zin(in);
+		readBinary(zin);
+#else
+		throw std::runtime_error("CRPropa was build without Zlib compression!");
+#endif
+		return;
+	}
+
+	char magic[sizeof(EMISSION_MAP_MAGIC)];
+	in.read(magic, sizeof(magic));
+	bool binary = in.good() && (memcmp(magic, EMISSION_MAP_MAGIC, sizeof(magic)) == 0);
+	in.clear();
+	in.seekg(0);
+	if (binary)
+		readBinary(in);
+	else
+		readText(in);
+}
+
+void EmissionMap::readText(std::istream &in) {
 	in.imbue(std::locale("C"));
 
 	while(in.good()) {
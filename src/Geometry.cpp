@@ -4,6 +4,11 @@
 #include "crpropa/Geometry.h"
 
 #include <iostream>
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
 namespace crpropa
 {
 // Plane ------------------------------------------------------------------
@@ -35,6 +40,18 @@ Vector3d Plane::normal(const Vector3d& point) const
   return n;
 }
 
+double Plane::intersection(const Vector3d &point, const Vector3d &direction) const
+{
+	double d = distance(point);
+	double v = n.dot(direction);
+	if (d == 0)
+		return 0;
+	// moving away from or parallel to the plane
+	if (d * v >= 0)
+		return std::numeric_limits<double>::infinity();
+	return -d / v;
+}
+
 
 // Sphere ------------------------------------------------------------------
 Sphere::Sphere(const Vector3d& _center, double _radius) : center(_center), radius(_radius) {};
@@ -45,12 +62,36 @@ double Sphere::distance(const Vector3d &point) const
 	return dR.getR() - radius;
 }
 
+bool Sphere::getBounds(Vector3d &lower, Vector3d &upper) const
+{
+	lower = center - Vector3d(radius);
+	upper = center + Vector3d(radius);
+	return true;
+}
+
 Vector3d Sphere::normal(const Vector3d& point) const
 {
   Vector3d d = point-center;
   return d.getUnitVector();
 }
 
+double Sphere::intersection(const Vector3d &point, const Vector3d &direction) const
+{
+	// |dR + t * direction| = radius
+	Vector3d dR = point - center;
+	double b = dR.dot(direction);
+	double c = dR.getR2() - radius * radius;
+	double discriminant = b * b - c;
+	if (discriminant < 0)
+		return std::numeric_limits<double>::infinity();
+	double s = sqrt(discriminant);
+	if (-b - s >= 0)
+		return -b - s; // entering from outside
+	if (-b + s >= 0)
+		return -b + s; // leaving from inside
+	return std::numeric_limits<double>::infinity();
+}
+
 std::string Sphere::getDescription() const
 {
 	std::stringstream ss;
@@ -82,6 +123,13 @@ double ParaxialBox::distance(const Vector3d &point) const
 	return sqrt(a*a + b*b +c*c);
 }
 
+bool ParaxialBox::getBounds(Vector3d &lower, Vector3d &upper) const
+{
+	lower = corner;
+	upper = corner + size;
+	return true;
+}
+
 Vector3d ParaxialBox::normal(const Vector3d& point) const
 {
   Vector3d d = (point-corner).abs();
@@ -122,6 +170,29 @@ Vector3d ParaxialBox::normal(const Vector3d& point) const
   return n;
 }
 
+double ParaxialBox::intersection(const Vector3d &point, const Vector3d &direction) const
+{
+	// entry and exit of the ray through the three slabs
+	double tEntry = -std::numeric_limits<double>::infinity();
+	double tExit = std::numeric_limits<double>::infinity();
+	Vector3d lo = corner - point, hi = corner + size - point;
+	double l[3] = {lo.x, lo.y, lo.z}, h[3] = {hi.x, hi.y, hi.z};
+	double u[3] = {direction.x, direction.y, direction.z};
+	for (int i = 0; i < 3; i++) {
+		if (u[i] == 0) {
+			if ((l[i] > 0) or (h[i] < 0))
+				return std::numeric_limits<double>::infinity();
+			continue;
+		}
+		double t1 = l[i] / u[i], t2 = h[i] / u[i];
+		tEntry = std::max(tEntry, std::min(t1, t2));
+		tExit = std::min(tExit, std::max(t1, t2));
+	}
+	if ((tEntry > tExit) or (tExit < 0))
+		return std::numeric_limits<double>::infinity();
+	return (tEntry >= 0) ? tEntry : tExit;
+}
+
 std::string ParaxialBox::getDescription() const
 {
 	std::stringstream ss;
@@ -132,4 +203,380 @@ std::string ParaxialBox::getDescription() const
 };
 
 
+// TriangleMesh ------------------------------------------------------------
+// triangles per leaf of the BVH
+static const unsigned int meshLeafSize = 4;
+
+static double component(const Vector3d &v, int axis)
+{
+	return (axis == 0) ? v.x : ((axis == 1) ? v.y : v.z);
+}
+
+static Vector3d elementMin(const Vector3d &a, const Vector3d &b)
+{
+	return Vector3d(std::min(a.x, b.x), std::min(a.y, b.y), std::min(a.z, b.z));
+}
+
+static Vector3d elementMax(const Vector3d &a, const Vector3d &b)
+{
+	return Vector3d(std::max(a.x, b.x), std::max(a.y, b.y), std::max(a.z, b.z));
+}
+
+// orders triangles by a component of their centroids
+struct CentroidOrder {
+	const std::vector<Vector3d> &centroids;
+	int axis;
+	CentroidOrder(const std::vector<Vector3d> &centroids, int axis) : centroids(centroids), axis(axis) {}
+	bool operator()(unsigned int a, unsigned int b) const {
+		return component(centroids[a], axis) < component(centroids[b], axis);
+	}
+};
+
+// closest point of the triangle abc, with the feature it lies on:
+// 0-2 the vertices a, b, c, 3-5 the edges ab, bc, ca, 6 the face (Ericson 2005)
+static Vector3d closestOnTriangle(const Vector3d &p, const Vector3d &a,
+		const Vector3d &b, const Vector3d &c, int &feature)
+{
+	Vector3d ab = b - a, ac = c - a, ap = p - a;
+	double d1 = ab.dot(ap), d2 = ac.dot(ap);
+	if ((d1 <= 0) and (d2 <= 0)) {
+		feature = 0;
+		return a;
+	}
+	Vector3d bp = p - b;
+	double d3 = ab.dot(bp), d4 = ac.dot(bp);
+	if ((d3 >= 0) and (d4 <= d3)) {
+		feature = 1;
+		return b;
+	}
+	double vc = d1 * d4 - d3 * d2;
+	if ((vc <= 0) and (d1 >= 0) and (d3 <= 0)) {
+		feature = 3;
+		return a + ab * (d1 / (d1 - d3));
+	}
+	Vector3d cp = p - c;
+	double d5 = ab.dot(cp), d6 = ac.dot(cp);
+	if ((d6 >= 0) and (d5 <= d6)) {
+		feature = 2;
+		return c;
+	}
+	double vb = d5 * d2 - d1 * d6;
+	if ((vb <= 0) and (d2 >= 0) and (d6 <= 0)) {
+		feature = 5;
+		return a + ac * (d2 / (d2 - d6));
+	}
+	double va = d3 * d6 - d5 * d4;
+	if ((va <= 0) and (d4 - d3 >= 0) and (d5 - d6 >= 0)) {
+		feature = 4;
+		return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+	}
+	feature = 6;
+	double denom = 1. / (va + vb + vc);
+	return a + ab * (vb * denom) + ac * (vc * denom);
+}
+
+TriangleMesh::TriangleMesh(const std::string &filename, double scale)
+{
+	std::ifstream in(filename.c_str());
+	if (!in.good())
+		throw std::runtime_error("TriangleMesh: could not open file " + filename);
+	std::string line;
+	while (std::getline(in, line)) {
+		std::stringstream ss(line);
+		std::string tag;
+		ss >> tag;
+		if (tag == "v") {
+			double x, y, z;
+			if (!(ss >> x >> y >> z))
+				throw std::runtime_error("TriangleMesh: bad vertex in " + filename + ": " + line);
+			vertices.push_back(Vector3d(x, y, z) * scale);
+		} else if (tag == "f") {
+			// v, v/vt, v//vn or v/vt/vn, negative indices count from the last vertex
+			std::vector<unsigned int> face;
+			std::string token;
+			while (ss >> token) {
+				long i = atol(token.substr(0, token.find('/')).c_str());
+				if (i < 0)
+					i += vertices.size() + 1;
+				if ((i < 1) or (i > (long)vertices.size()))
+					throw std::runtime_error("TriangleMesh: bad face in " + filename + ": " + line);
+				face.push_back(i - 1);
+			}
+			for (size_t k = 2; k < face.size(); k++) {
+				triangles.push_back(face[0]);
+				triangles.push_back(face[k - 1]);
+				triangles.push_back(face[k]);
+			}
+		}
+	}
+	init();
+}
+
+TriangleMesh::TriangleMesh(const std::vector<Vector3d> &_vertices,
+		const std::vector<unsigned int> &_triangles) : vertices(_vertices), triangles(_triangles)
+{
+	if (triangles.size() % 3 != 0)
+		throw std::runtime_error("TriangleMesh: number of vertex indices not a multiple of 3");
+	for (size_t i = 0; i < triangles.size(); i++)
+		if (triangles[i] >= vertices.size())
+			throw std::runtime_error("TriangleMesh: vertex index out of range");
+	init();
+}
+
+void TriangleMesh::init()
+{
+	// drop degenerate triangles, which have no normal
+	std::vector<unsigned int> kept;
+	for (size_t t = 0; t < triangles.size() / 3; t++) {
+		const Vector3d &a = vertices[triangles[3 * t]];
+		const Vector3d &b = vertices[triangles[3 * t + 1]];
+		const Vector3d &c = vertices[triangles[3 * t + 2]];
+		if ((b - a).cross(c - a).getR2() > 0)
+			kept.insert(kept.end(), &triangles[3 * t], &triangles[3 * t] + 3);
+	}
+	if (kept.size() < triangles.size())
+		KISS_LOG_WARNING << "TriangleMesh: " << (triangles.size() - kept.size()) / 3 << " degenerate triangles ignored";
+	triangles.swap(kept);
+	size_t n = triangles.size() / 3;
+	if (n == 0)
+		throw std::runtime_error("TriangleMesh: no triangles");
+
+	// BVH over the triangle centroids, the triangles are then ordered by leaf
+	std::vector<Vector3d> centroids(n);
+	std::vector<unsigned int> order(n);
+	for (size_t t = 0; t < n; t++) {
+		centroids[t] = (vertices[triangles[3 * t]] + vertices[triangles[3 * t + 1]]
+				+ vertices[triangles[3 * t + 2]]) / 3.;
+		order[t] = t;
+	}
+	nodes.clear();
+	nodes.reserve(2 * n / meshLeafSize + 1);
+	build(order, 0, n, centroids);
+	std::vector<unsigned int> sorted(3 * n);
+	for (size_t t = 0; t < n; t++)
+		for (int k = 0; k < 3; k++)
+			sorted[3 * t + k] = triangles[3 * order[t] + k];
+	triangles.swap(sorted);
+
+	// face normals and the angle-weighted pseudo normals of the vertices and edges
+	faceNormals.resize(n);
+	vertexNormals.assign(vertices.size(), Vector3d(0.));
+	std::map<std::pair<unsigned int, unsigned int>, Vector3d> edges;
+	for (size_t t = 0; t < n; t++) {
+		const unsigned int *v = &triangles[3 * t];
+		Vector3d nf = (vertices[v[1]] - vertices[v[0]]).cross(vertices[v[2]] - vertices[v[0]]);
+		nf /= nf.getR();
+		faceNormals[t] = nf;
+		for (int k = 0; k < 3; k++) {
+			Vector3d e1 = vertices[v[(k + 1) % 3]] - vertices[v[k]];
+			Vector3d e2 = vertices[v[(k + 2) % 3]] - vertices[v[k]];
+			vertexNormals[v[k]] += nf * e1.getAngleTo(e2);
+			unsigned int i = v[k], j = v[(k + 1) % 3];
+			std::pair<unsigned int, unsigned int> key(std::min(i, j), std::max(i, j));
+			std::map<std::pair<unsigned int, unsigned int>, Vector3d>::iterator it = edges.find(key);
+			if (it == edges.end())
+				edges[key] = nf;
+			else
+				it->second += nf;
+		}
+	}
+	edgeNormals.resize(3 * n);
+	for (size_t t = 0; t < n; t++)
+		for (int k = 0; k < 3; k++) {
+			unsigned int i = triangles[3 * t + k], j = triangles[3 * t + (k + 1) % 3];
+			edgeNormals[3 * t + k] = edges[std::make_pair(std::min(i, j), std::max(i, j))];
+		}
+}
+
+unsigned int TriangleMesh::build(std::vector<unsigned int> &order, unsigned int first,
+		unsigned int count, const std::vector<Vector3d> &centroids)
+{
+	unsigned int index = nodes.size();
+	nodes.push_back(Node());
+	double inf = std::numeric_limits<double>::infinity();
+	Vector3d lower(inf), upper(-inf), cLower(inf), cUpper(-inf);
+	for (unsigned int i = first; i < first + count; i++) {
+		const unsigned int *v = &triangles[3 * order[i]];
+		for (int k = 0; k < 3; k++) {
+			lower = elementMin(lower, vertices[v[k]]);
+			upper = elementMax(upper, vertices[v[k]]);
+		}
+		cLower = elementMin(cLower, centroids[order[i]]);
+		cUpper = elementMax(cUpper, centroids[order[i]]);
+	}
+	nodes[index].lower = lower;
+	nodes[index].upper = upper;
+	nodes[index].first = first;
+	nodes[index].count = count;
+	nodes[index].right = 0;
+
+	// median split along the longest extent of the centroids
+	Vector3d extent = cUpper - cLower;
+	int axis = (extent.x >= extent.y) ? ((extent.x >= extent.z) ? 0 : 2) : ((extent.y >= extent.z) ? 1 : 2);
+	if ((count <= meshLeafSize) or (component(extent, axis) <= 0))
+		return index;
+	unsigned int middle = first + count / 2;
+	std::nth_element(order.begin() + first, order.begin() + middle, order.begin() + first + count,
+		CentroidOrder(centroids, axis));
+	build(order, first, middle - first, centroids);
+	unsigned int right = build(order, middle, first + count - middle, centroids);
+	nodes[index].count = 0;
+	nodes[index].right = right;
+	return index;
+}
+
+// squared distance of a point to a box
+static double boxDistance2(const Vector3d &point, const Vector3d &lower, const Vector3d &upper)
+{
+	return elementMax(elementMax(lower - point, point - upper), Vector3d(0.)).getR2();
+}
+
+// unsigned distance to the closest triangle and the pseudo normal of its closest feature
+double TriangleMesh::closest(const Vector3d &point, Vector3d &pseudoNormal) const
+{
+	double best = std::numeric_limits<double>::infinity(); // squared distance
+	Vector3d bestPoint;
+	// nodes to visit with the squared distance of their boxes
+	unsigned int stack[64];
+	double stackDistance[64];
+	int top = 0;
+	stack[top] = 0;
+	stackDistance[top++] = 0;
+	while (top > 0) {
+		top--;
+		if (stackDistance[top] >= best)
+			continue;
+		unsigned int index = stack[top];
+		const Node &node = nodes[index];
+		if (node.count == 0) {
+			// visit the nearer child first
+			unsigned int left = index + 1, right = node.right;
+			double dl = boxDistance2(point, nodes[left].lower, nodes[left].upper);
+			double dr = boxDistance2(point, nodes[right].lower, nodes[right].upper);
+			if (dl < dr) {
+				std::swap(left, right);
+				std::swap(dl, dr);
+			}
+			stack[top] = left;
+			stackDistance[top++] = dl;
+			stack[top] = right;
+			stackDistance[top++] = dr;
+			continue;
+		}
+		for (unsigned int t = node.first; t < node.first + node.count; t++) {
+			const unsigned int *v = &triangles[3 * t];
+			int feature;
+			Vector3d x = closestOnTriangle(point, vertices[v[0]], vertices[v[1]], vertices[v[2]], feature);
+			double r2 = (point - x).getR2();
+			if (r2 < best) {
+				best = r2;
+				bestPoint = x;
+				if (feature < 3)
+					pseudoNormal = vertexNormals[v[feature]];
+				else if (feature < 6)
+					pseudoNormal = edgeNormals[3 * t + feature - 3];
+				else
+					pseudoNormal = faceNormals[t];
+			}
+		}
+	}
+	double r = sqrt(best);
+	if ((point - bestPoint).dot(pseudoNormal) < 0)
+		r = -r;
+	return r;
+}
+
+double TriangleMesh::distance(const Vector3d &point) const
+{
+	Vector3d pseudoNormal;
+	return closest(point, pseudoNormal);
+}
+
+Vector3d TriangleMesh::normal(const Vector3d &point) const
+{
+	Vector3d pseudoNormal;
+	closest(point, pseudoNormal);
+	return pseudoNormal.getUnitVector();
+}
+
+double TriangleMesh::intersection(const Vector3d &point, const Vector3d &direction) const
+{
+	double best = std::numeric_limits<double>::infinity();
+	double u[3] = {direction.x, direction.y, direction.z};
+	double p[3] = {point.x, point.y, point.z};
+	unsigned int stack[64];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		const Node &node = nodes[stack[--top]];
+		// slab test of the box, as ParaxialBox::intersection
+		double l[3] = {node.lower.x, node.lower.y, node.lower.z};
+		double h[3] = {node.upper.x, node.upper.y, node.upper.z};
+		double tEntry = 0, tExit = best;
+		bool miss = false;
+		for (int i = 0; (i < 3) and not miss; i++) {
+			if (u[i] == 0) {
+				miss = (p[i] < l[i]) or (p[i] > h[i]);
+				continue;
+			}
+			double t1 = (l[i] - p[i]) / u[i], t2 = (h[i] - p[i]) / u[i];
+			tEntry = std::max(tEntry, std::min(t1, t2));
+			tExit = std::min(tExit, std::max(t1, t2));
+			miss = tEntry > tExit;
+		}
+		if (miss)
+			continue;
+		if (node.count == 0) {
+			stack[top++] = node.right;
+			stack[top++] = &node - &nodes[0] + 1;
+			continue;
+		}
+		// Moeller-Trumbore
+		for (unsigned int t = node.first; t < node.first + node.count; t++) {
+			const Vector3d &a = vertices[triangles[3 * t]];
+			Vector3d e1 = vertices[triangles[3 * t + 1]] - a;
+			Vector3d e2 = vertices[triangles[3 * t + 2]] - a;
+			Vector3d q = direction.cross(e2);
+			double det = e1.dot(q);
+			if (det == 0)
+				continue; // parallel
+			Vector3d s = point - a;
+			double b1 = s.dot(q) / det;
+			if ((b1 < 0) or (b1 > 1))
+				continue;
+			Vector3d r = s.cross(e1);
+			double b2 = direction.dot(r) / det;
+			if ((b2 < 0) or (b1 + b2 > 1))
+				continue;
+			double tHit = e2.dot(r) / det;
+			if ((tHit >= 0) and (tHit < best))
+				best = tHit;
+		}
+	}
+	return best;
+}
+
+bool TriangleMesh::getBounds(Vector3d &lower, Vector3d &upper) const
+{
+	lower = nodes[0].lower;
+	upper = nodes[0].upper;
+	return true;
+}
+
+size_t TriangleMesh::getNumberOfTriangles() const
+{
+	return triangles.size() / 3;
+}
+
+std::string TriangleMesh::getDescription() const
+{
+	std::stringstream ss;
+	ss << "TriangleMesh: " << std::endl
+		 << "   triangles: " << triangles.size() / 3 << std::endl
+		 << "   BVH nodes: " << nodes.size() << std::endl
+		 << "      bounds: " << nodes[0].lower << " - " << nodes[0].upper << std::endl;
+	return ss.str();
+};
+
+
 } // namespace
@@ -1,36 +1,102 @@
 #include "crpropa/GridTools.h"
+#include "crpropa/Affinity.h"
 #include "crpropa/Random.h"
+#include "crpropa/MappedFile.h"
+#include "crpropa/SimulationBundle.h"
 #include "crpropa/magneticField/MagneticField.h"
 
+#include <algorithm>
+#include <cstdlib>
 #include <fstream>
 #include <sstream>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#ifdef CRPROPA_HAVE_MPI
+#include <mpi.h>
+#endif
+
 namespace crpropa {
 
 void scaleGrid(ref_ptr<ScalarGrid> grid, double a) {
-	for (int ix = 0; ix < grid->getNx(); ix++)
-		for (int iy = 0; iy < grid->getNy(); iy++)
-			for (int iz = 0; iz < grid->getNz(); iz++)
+	size_t Nx = grid->getNx();
+	size_t Ny = grid->getNy();
+	size_t Nz = grid->getNz();
+	#pragma omp parallel for
+	for (int ix = 0; ix < Nx; ix++)
+		for (size_t iy = 0; iy < Ny; iy++)
+			for (size_t iz = 0; iz < Nz; iz++)
 				grid->get(ix, iy, iz) *= a;
 }
 
 void scaleGrid(ref_ptr<VectorGrid> grid, double a) {
-	for (int ix = 0; ix < grid->getNx(); ix++)
-		for (int iy = 0; iy < grid->getNy(); iy++)
-			for (int iz = 0; iz < grid->getNz(); iz++)
+	size_t Nx = grid->getNx();
+	size_t Ny = grid->getNy();
+	size_t Nz = grid->getNz();
+	#pragma omp parallel for
+	for (int ix = 0; ix < Nx; ix++)
+		for (size_t iy = 0; iy < Ny; iy++)
+			for (size_t iz = 0; iz < Nz; iz++)
 				grid->get(ix, iy, iz) *= a;
 }
 
-Vector3f meanFieldVector(ref_ptr<VectorGrid> grid) {
+ref_ptr<QuantizedVectorGrid> quantizeGrid(ref_ptr<VectorGrid> grid) {
 	size_t Nx = grid->getNx();
 	size_t Ny = grid->getNy();
 	size_t Nz = grid->getNz();
-	Vector3f mean(0.);
+	ref_ptr<QuantizedVectorGrid> q = new QuantizedVectorGrid(grid->getOrigin(),
+			Nx, Ny, Nz, grid->getSpacing());
+	q->setReflective(grid->isReflective());
+	q->setBricked(grid->isBricked());
+
+	double vMax = 0;
+	for (int ix = 0; ix < Nx; ix++)
+		for (int iy = 0; iy < Ny; iy++)
+			for (int iz = 0; iz < Nz; iz++) {
+				Vector3f v = grid->get(ix, iy, iz).abs();
+				vMax = std::max(vMax, double(std::max(v.x, std::max(v.y, v.z))));
+			}
+	double quantum = (vMax > 0) ? vMax / 32767 : 1;
+	q->setQuantum(quantum);
+
 	for (int ix = 0; ix < Nx; ix++)
 		for (int iy = 0; iy < Ny; iy++)
 			for (int iz = 0; iz < Nz; iz++)
-				mean += grid->get(ix, iy, iz);
-	return mean / Nx / Ny / Nz;
+				q->get(ix, iy, iz) = GridValue<Vector3s>::encode(
+						grid->get(ix, iy, iz), quantum);
+	return q;
+}
+
+bool interleaveGrid(ref_ptr<ScalarGrid> grid) {
+	std::vector<float> &values = grid->getGrid();
+	if (values.empty())
+		return false;
+	return interleaveMemory(&values[0], values.size() * sizeof(float));
+}
+
+bool interleaveGrid(ref_ptr<VectorGrid> grid) {
+	std::vector<Vector3f> &values = grid->getGrid();
+	if (values.empty())
+		return false;
+	return interleaveMemory(&values[0], values.size() * sizeof(Vector3f));
+}
+
+Vector3f meanFieldVector(ref_ptr<VectorGrid> grid) {
+	size_t Nx = grid->getNx();
+	size_t Ny = grid->getNy();
+	size_t Nz = grid->getNz();
+	double mx = 0, my = 0, mz = 0;
+	#pragma omp parallel for reduction(+:mx,my,mz)
+	for (int ix = 0; ix < Nx; ix++)
+		for (size_t iy = 0; iy < Ny; iy++)
+			for (size_t iz = 0; iz < Nz; iz++) {
+				const Vector3f &v = grid->get(ix, iy, iz);
+				mx += v.x;
+				my += v.y;
+				mz += v.z;
+			}
+	return Vector3f(mx, my, mz) / Nx / Ny / Nz;
 }
 
 double meanFieldStrength(ref_ptr<VectorGrid> grid) {
@@ -38,9 +104,10 @@ double meanFieldStrength(ref_ptr<VectorGrid> grid) {
 	size_t Ny = grid->getNy();
 	size_t Nz = grid->getNz();
 	double mean = 0;
+	#pragma omp parallel for reduction(+:mean)
 	for (int ix = 0; ix < Nx; ix++)
-		for (int iy = 0; iy < Ny; iy++)
-			for (int iz = 0; iz < Nz; iz++)
+		for (size_t iy = 0; iy < Ny; iy++)
+			for (size_t iz = 0; iz < Nz; iz++)
 				mean += grid->get(ix, iy, iz).getR();
 	return mean / Nx / Ny / Nz;
 }
@@ -50,9 +117,10 @@ double meanFieldStrength(ref_ptr<ScalarGrid> grid) {
 	size_t Ny = grid->getNy();
 	size_t Nz = grid->getNz();
 	double mean = 0;
+	#pragma omp parallel for reduction(+:mean)
 	for (int ix = 0; ix < Nx; ix++)
-		for (int iy = 0; iy < Ny; iy++)
-			for (int iz = 0; iz < Nz; iz++)
+		for (size_t iy = 0; iy < Ny; iy++)
+			for (size_t iz = 0; iz < Nz; iz++)
 				mean += grid->get(ix, iy, iz);
 	return mean / Nx / Ny / Nz;
 }
@@ -62,9 +130,10 @@ double rmsFieldStrength(ref_ptr<VectorGrid> grid) {
 	size_t Ny = grid->getNy();
 	size_t Nz = grid->getNz();
 	double sumV2 = 0;
+	#pragma omp parallel for reduction(+:sumV2)
 	for (int ix = 0; ix < Nx; ix++)
-		for (int iy = 0; iy < Ny; iy++)
-			for (int iz = 0; iz < Nz; iz++)
+		for (size_t iy = 0; iy < Ny; iy++)
+			for (size_t iz = 0; iz < Nz; iz++)
 				sumV2 += grid->get(ix, iy, iz).getR2();
 	return std::sqrt(sumV2 / Nx / Ny / Nz);
 }
@@ -74,84 +143,78 @@ double rmsFieldStrength(ref_ptr<ScalarGrid> grid) {
 	size_t Ny = grid->getNy();
 	size_t Nz = grid->getNz();
 	double sumV2 = 0;
+	#pragma omp parallel for reduction(+:sumV2)
 	for (int ix = 0; ix < Nx; ix++)
-		for (int iy = 0; iy < Ny; iy++)
-			for (int iz = 0; iz < Nz; iz++)
-				sumV2 += pow(grid->get(ix, iy, iz), 2);
+		for (size_t iy = 0; iy < Ny; iy++)
+			for (size_t iz = 0; iz < Nz; iz++)
+				sumV2 += grid->get(ix, iy, iz) * grid->get(ix, iy, iz);
 	return std::sqrt(sumV2 / Nx / Ny / Nz);
 }
 
 #ifdef CRPROPA_HAVE_FFTW3F
 #include "fftw3.h"
-void initTurbulence(ref_ptr<VectorGrid> grid, double Brms, double lMin, double lMax, double alpha, int seed, bool helicity, double H) {
-	size_t Nx = grid->getNx();
-	size_t Ny = grid->getNy();
-	size_t Nz = grid->getNz();
-	if ((Nx != Ny) or (Ny != Nz))
-		throw std::runtime_error("turbulentField: only cubic grid supported");
-	
-	Vector3d spacing = grid->getSpacing();
-	if ((spacing.x != spacing.y) or (spacing.y != spacing.z))
-		throw std::runtime_error("turbulentField: only equal spacing suported");
-	
-	if (lMin < 2 * spacing.x)
+#ifdef CRPROPA_HAVE_FFTW3F_MPI
+#include "fftw3-mpi.h"
+#endif
+
+static void checkTurbulence(size_t n, double spacing, double lMin, double lMax) {
+	if (lMin < 2 * spacing)
 		throw std::runtime_error("turbulentField: lMin < 2 * spacing");
 	if (lMin >= lMax)
 		throw std::runtime_error("turbulentField: lMin >= lMax");
-	if (lMax > Nx * spacing.x / 2)
+	if (lMax > n * spacing / 2)
 		throw std::runtime_error("turbulentField: lMax > size / 2");
+}
 
-	size_t n = Nx; // size of array
-	size_t n2 = (size_t) floor(n / 2) + 1; // size array in z-direction in configuration space
-
-	// arrays to hold the complex vector components of the B(k)-field
-	fftwf_complex *Bkx, *Bky, *Bkz;
-	Bkx = (fftwf_complex*) fftwf_malloc(sizeof(fftwf_complex) * n * n * n2);
-	Bky = (fftwf_complex*) fftwf_malloc(sizeof(fftwf_complex) * n * n * n2);
-	Bkz = (fftwf_complex*) fftwf_malloc(sizeof(fftwf_complex) * n * n * n2);
-
+/** Use all OpenMP threads in the FFTW plans created after this call */
+static void initFFTWThreads() {
+#ifdef CRPROPA_HAVE_FFTW3F_OMP
+	static bool initialized = false;
+	if (!initialized) {
+		fftwf_init_threads();
+		initialized = true;
+	}
+	fftwf_plan_with_nthreads(omp_get_max_threads());
+#endif
+}
 
-	Random random;
-	if (seed != 0)
-		random.seed(seed); // use given seed
+/**
+ Fill one vector component of the B(k)-field for the x-planes [ix0, ix0 + nx)
+ of an n^3 grid into Bk (nx * n * (n/2+1) values). Each plane draws its modes
+ from its own random stream, seeded with (seed, ix). The field therefore
+ neither depends on the number of threads or MPI ranks nor on the component,
+ so the three components can be transformed one after another.
+ */
+static void fillTurbulentModes(fftwf_complex *Bk, int component, size_t ix0,
+		size_t nx, size_t n, double kMin, double kMax, double alpha,
+		uint32_t seed, bool helicity, double H) {
+	size_t n2 = n / 2 + 1;
 
 	// calculate the n possible discrete wave numbers
-	double K[n];
-	for (int i = 0; i < n; i++)
+	std::vector<double> K(n);
+	for (size_t i = 0; i < n; i++)
 		K[i] = (double) i / n - i / (n / 2);
 
-	// construct the field in configuration space
-	int i;
-	double k;
-
-	// only used if there is a helicity
-	double Bktot, Bkplus, Bkminus, thetaplus, thetaminus;
+	#pragma omp parallel for schedule(dynamic)
+	for (int jx = 0; jx < nx; jx++) {
+		size_t ix = ix0 + jx;
+		uint32_t planeSeed[2] = {seed, uint32_t(ix)};
+		Random random(planeSeed, 2);
 
-	// parameters goes for non helical calculations
-	double theta, phase, cosPhase, sinPhase;
+		Vector3f ek, e1, e2; // orthogonal base
+		Vector3f n0(1, 1, 1); // arbitrary vector to construct orthogonal base
+		float re[3], im[3]; // real and imaginary part of B(k)
 
-	double kMin = spacing.x / lMax;
-	double kMax = spacing.x / lMin;
-	Vector3f b; // real b-field vector
-	Vector3f ek, e1, e2; // orthogonal base
-	Vector3f n0(1, 1, 1); // arbitrary vector to construct orthogonal base
-
-	for (size_t ix = 0; ix < n; ix++) {
 		for (size_t iy = 0; iy < n; iy++) {
 			for (size_t iz = 0; iz < n2; iz++) {
-
-				i = ix * n * n2 + iy * n2 + iz;
+				size_t i = jx * n * n2 + iy * n2 + iz;
 				ek.setXYZ(K[ix], K[iy], K[iz]);
-				k = ek.getR();
+				double k = ek.getR();
 
 				// wave outside of turbulent range -> B(k) = 0
 				if ((k < kMin) || (k > kMax)) {
-					Bkx[i][0] = 0;
-					Bkx[i][1] = 0;
-					Bky[i][0] = 0;
-					Bky[i][1] = 0;
-					Bkz[i][0] = 0;
-					Bkz[i][1] = 0;
+					Bk[i][0] = 0;
+					Bk[i][1] = 0;
 					continue;
 				}
 
@@ -169,28 +232,27 @@ void initTurbulence(ref_ptr<VectorGrid> grid, double Brms, double lMin, double l
 					e1 /= e1.getR();
 					e2 /= e2.getR();
 
-
 					double Bkprefactor = mu0 / (4 * M_PI * pow(k, 3));
-					Bktot = fabs(random.randNorm() * pow(k, alpha / 2));
-					Bkplus  = Bkprefactor * sqrt((1 + H) / 2) * Bktot;
-					Bkminus = Bkprefactor * sqrt((1 - H) / 2) * Bktot;
-					thetaplus = 2 * M_PI * random.rand();
-					thetaminus = 2 * M_PI * random.rand();
+					double Bktot = fabs(random.randNorm() * pow(k, alpha / 2));
+					double Bkplus  = Bkprefactor * sqrt((1 + H) / 2) * Bktot;
+					double Bkminus = Bkprefactor * sqrt((1 - H) / 2) * Bktot;
+					double thetaplus = 2 * M_PI * random.rand();
+					double thetaminus = 2 * M_PI * random.rand();
 					double ctp = cos(thetaplus);
 					double stp = sin(thetaplus);
 					double ctm = cos(thetaminus);
 					double stm = sin(thetaminus);
 
-					Bkx[i][0] = ((Bkplus * ctp + Bkminus * ctm) * e1.x + (-Bkplus * stp + Bkminus * stm) * e2.x) / sqrt(2);
-					Bkx[i][1] = ((Bkplus * stp + Bkminus * stm) * e1.x + ( Bkplus * ctp - Bkminus * ctm) * e2.x) / sqrt(2);
-					Bky[i][0] = ((Bkplus * ctp + Bkminus * ctm) * e1.y + (-Bkplus * stp + Bkminus * stm) * e2.y) / sqrt(2);
-					Bky[i][1] = ((Bkplus * stp + Bkminus * stm) * e1.y + ( Bkplus * ctp - Bkminus * ctm) * e2.y) / sqrt(2);
-					Bkz[i][0] = ((Bkplus * ctp + Bkminus * ctm) * e1.z + (-Bkplus * stp + Bkminus * stm) * e2.z) / sqrt(2);
-					Bkz[i][1] = ((Bkplus * stp + Bkminus * stm) * e1.z + ( Bkplus * ctp - Bkminus * ctm) * e2.z) / sqrt(2);
-
-					Vector3f BkRe(Bkx[i][0], Bky[i][0], Bkz[i][0]);
-					Vector3f BkIm(Bkx[i][1], Bky[i][1], Bkz[i][1]);
-
+					double a1 = (Bkplus * ctp + Bkminus * ctm) / sqrt(2);
+					double a2 = (-Bkplus * stp + Bkminus * stm) / sqrt(2);
+					double a3 = (Bkplus * stp + Bkminus * stm) / sqrt(2);
+					double a4 = (Bkplus * ctp - Bkminus * ctm) / sqrt(2);
+					re[0] = a1 * e1.x + a2 * e2.x;
+					im[0] = a3 * e1.x + a4 * e2.x;
+					re[1] = a1 * e1.y + a2 * e2.y;
+					im[1] = a3 * e1.y + a4 * e2.y;
+					re[2] = a1 * e1.z + a2 * e2.z;
+					im[2] = a3 * e1.z + a4 * e2.z;
 				} else { // no helicity
 					if (ek.isParallelTo(n0, float(1e-3))) {
 						// ek parallel to (1,1,1)
@@ -205,66 +267,157 @@ void initTurbulence(ref_ptr<VectorGrid> grid, double Brms, double lMin, double l
 					e2 /= e2.getR();
 
 					// random orientation perpendicular to k
-					theta = 2 * M_PI * random.rand();
-					b = e1 * cos(theta) + e2 * sin(theta);
+					double theta = 2 * M_PI * random.rand();
+					Vector3f b = e1 * cos(theta) + e2 * sin(theta);
 
 					// normal distributed amplitude with mean = 0 and sigma = k^alpha/2
 					b *= random.randNorm() * pow(k, alpha / 2);
 
 					// uniform random phase
-					phase = 2 * M_PI * random.rand();
-					cosPhase = cos(phase); // real part
-					sinPhase = sin(phase); // imaginary part
-
-					Bkx[i][0] = b.x * cosPhase;
-					Bkx[i][1] = b.x * sinPhase;
-					Bky[i][0] = b.y * cosPhase;
-					Bky[i][1] = b.y * sinPhase;
-					Bkz[i][0] = b.z * cosPhase;
-					Bkz[i][1] = b.z * sinPhase;
-
+					double phase = 2 * M_PI * random.rand();
+					double cosPhase = cos(phase); // real part
+					double sinPhase = sin(phase); // imaginary part
+
+					re[0] = b.x * cosPhase;
+					im[0] = b.x * sinPhase;
+					re[1] = b.y * cosPhase;
+					im[1] = b.y * sinPhase;
+					re[2] = b.z * cosPhase;
+					im[2] = b.z * sinPhase;
 				} // non helical case
+
+				Bk[i][0] = re[component];
+				Bk[i][1] = im[component];
 			} // for iz
 		} // for iy
 	} // for ix
+}
 
+/** Random seed that is used for all random streams of a turbulent field */
+static uint32_t turbulenceSeed(int seed) {
+	if (seed != 0)
+		return seed;
+	Random random;
+	return random.randInt();
+}
 
-	// in-place, complex to real, inverse Fourier transformation on each component
-	// note that the last elements of B(x) are unused now
-	float *Bx = (float*) Bkx;
-	fftwf_plan plan_x = fftwf_plan_dft_c2r_3d(n, n, n, Bkx, Bx, FFTW_ESTIMATE);
-	fftwf_execute(plan_x);
-	fftwf_destroy_plan(plan_x);
-
-	float *By = (float*) Bky;
-	fftwf_plan plan_y = fftwf_plan_dft_c2r_3d(n, n, n, Bky, By, FFTW_ESTIMATE);
-	fftwf_execute(plan_y);
-	fftwf_destroy_plan(plan_y);
+static float &component(Vector3f &v, int c) {
+	return (c == 0) ? v.x : ((c == 1) ? v.y : v.z);
+}
 
-	float *Bz = (float*) Bkz;
-	fftwf_plan plan_z = fftwf_plan_dft_c2r_3d(n, n, n, Bkz, Bz, FFTW_ESTIMATE);
-	fftwf_execute(plan_z);
-	fftwf_destroy_plan(plan_z);
+void initTurbulence(ref_ptr<VectorGrid> grid, double Brms, double lMin, double lMax, double alpha, int seed, bool helicity, double H) {
+	size_t Nx = grid->getNx();
+	size_t Ny = grid->getNy();
+	size_t Nz = grid->getNz();
+	if ((Nx != Ny) or (Ny != Nz))
+		throw std::runtime_error("turbulentField: only cubic grid supported");
+	
+	Vector3d spacing = grid->getSpacing();
+	if ((spacing.x != spacing.y) or (spacing.y != spacing.z))
+		throw std::runtime_error("turbulentField: only equal spacing suported");
+	checkTurbulence(Nx, spacing.x, lMin, lMax);
 
-	// save to grid
-	for (size_t ix = 0; ix < n; ix++) {
-		for (size_t iy = 0; iy < n; iy++) {
-			for (size_t iz = 0; iz < n; iz++) {
-				i = ix * n * 2 * n2 + iy * 2 * n2 + iz;
-				Vector3f &b = grid->get(ix, iy, iz);
-				b.x = Bx[i];
-				b.y = By[i];
-				b.z = Bz[i];
-			}
-		}
+	size_t n = Nx; // size of array
+	size_t n2 = n / 2 + 1; // size array in z-direction in configuration space
+	double kMin = spacing.x / lMax;
+	double kMax = spacing.x / lMin;
+	uint32_t streamSeed = turbulenceSeed(seed);
+
+	// one array for the complex B(k) of one component at a time
+	fftwf_complex *Bk = (fftwf_complex*) fftwf_malloc(sizeof(fftwf_complex) * n * n * n2);
+	float *B = (float*) Bk;
+
+	// in-place, complex to real, inverse Fourier transformation
+	// note that the last elements of B(x) are unused
+	initFFTWThreads();
+	fftwf_plan plan = fftwf_plan_dft_c2r_3d(n, n, n, Bk, B, FFTW_ESTIMATE);
+
+	for (int c = 0; c < 3; c++) {
+		fillTurbulentModes(Bk, c, 0, n, n, kMin, kMax, alpha, streamSeed,
+				helicity, H);
+		fftwf_execute(plan);
+
+		// save to grid
+		#pragma omp parallel for
+		for (int ix = 0; ix < n; ix++)
+			for (size_t iy = 0; iy < n; iy++)
+				for (size_t iz = 0; iz < n; iz++)
+					component(grid->get(ix, iy, iz), c) = B[ix * n * 2 * n2
+							+ iy * 2 * n2 + iz];
 	}
 
-	fftwf_free(Bkx);
-	fftwf_free(Bky);
-	fftwf_free(Bkz);
+	fftwf_destroy_plan(plan);
+	fftwf_free(Bk);
 
 	scaleGrid(grid, Brms / rmsFieldStrength(grid)); // normalize to Brms
 }
+
+#if defined(CRPROPA_HAVE_MPI) && defined(CRPROPA_HAVE_FFTW3F_MPI)
+void dumpTurbulence(std::string filename, size_t n, double spacing, double Brms,
+		double lMin, double lMax, double alpha, int seed, bool helicity,
+		double H) {
+	checkTurbulence(n, spacing, lMin, lMax);
+
+	int rank;
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+	uint32_t streamSeed = turbulenceSeed(seed);
+	MPI_Bcast(&streamSeed, 1, MPI_UINT32_T, 0, MPI_COMM_WORLD);
+
+	// threads have to be initialized before fftwf_mpi_init
+	initFFTWThreads();
+	static bool initialized = false;
+	if (!initialized) {
+		fftwf_mpi_init();
+		initialized = true;
+	}
+
+	// slab of x-planes [ix0, ix0 + nx) of this rank
+	size_t n2 = n / 2 + 1;
+	ptrdiff_t nx, ix0;
+	ptrdiff_t nLocal = fftwf_mpi_local_size_3d(n, n, n2, MPI_COMM_WORLD, &nx, &ix0);
+	fftwf_complex *Bk = fftwf_alloc_complex(std::max<ptrdiff_t>(nLocal, 1));
+	float *B = (float*) Bk;
+	fftwf_plan plan = fftwf_mpi_plan_dft_c2r_3d(n, n, n, Bk, B, MPI_COMM_WORLD,
+			FFTW_ESTIMATE);
+
+	std::vector<Vector3f> slab(nx * n * n);
+	for (int c = 0; c < 3; c++) {
+		fillTurbulentModes(Bk, c, ix0, nx, n, spacing / lMax, spacing / lMin,
+				alpha, streamSeed, helicity, H);
+		fftwf_execute(plan);
+		#pragma omp parallel for
+		for (int jx = 0; jx < nx; jx++)
+			for (size_t iy = 0; iy < n; iy++)
+				for (size_t iz = 0; iz < n; iz++)
+					component(slab[(jx * n + iy) * n + iz], c) = B[jx * n * 2 * n2
+							+ iy * 2 * n2 + iz];
+	}
+	fftwf_destroy_plan(plan);
+	fftwf_free(Bk);
+
+	// normalize to Brms
+	double sumB2 = 0, totalB2 = 0;
+	for (size_t i = 0; i < slab.size(); i++)
+		sumB2 += slab[i].getR2();
+	MPI_Allreduce(&sumB2, &totalB2, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+	float a = Brms / std::sqrt(totalB2 / n / n / n);
+	for (size_t i = 0; i < slab.size(); i++)
+		slab[i] *= a;
+
+	// every rank writes its slab, plane by plane to keep the counts in int range
+	MPI_File file;
+	if (MPI_File_open(MPI_COMM_WORLD, (char*) filename.c_str(),
+			MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &file) != MPI_SUCCESS)
+		throw std::runtime_error("dumpTurbulence: could not open " + filename);
+	MPI_File_set_size(file, MPI_Offset(n) * n * n * 3 * sizeof(float));
+	for (ptrdiff_t jx = 0; jx < nx; jx++) {
+		MPI_Offset offset = MPI_Offset(ix0 + jx) * n * n * 3 * sizeof(float);
+		MPI_File_write_at(file, offset, &slab[jx * n * n], 3 * n * n, MPI_FLOAT,
+				MPI_STATUS_IGNORE);
+	}
+	MPI_File_close(&file);
+}
+#endif // CRPROPA_HAVE_MPI && CRPROPA_HAVE_FFTW3F_MPI
 #endif // CRPROPA_HAVE_FFTW3F
 
 void fromMagneticField(ref_ptr<VectorGrid> grid, ref_ptr<MagneticField> field) {
@@ -273,12 +426,17 @@ void fromMagneticField(ref_ptr<VectorGrid> grid, ref_ptr<MagneticField> field) {
 	size_t Nx = grid->getNx();
 	size_t Ny = grid->getNy();
 	size_t Nz = grid->getNz();
-	for (size_t ix = 0; ix < Nx; ix++)
+	// one batch per x-plane
+	#pragma omp parallel for schedule(dynamic)
+	for (int ix = 0; ix < Nx; ix++) {
+		std::vector<Vector3d> pos(Ny * Nz), B(Ny * Nz);
 		for (size_t iy = 0; iy < Ny; iy++)
-			for (size_t iz = 0; iz < Nz; iz++) {
-				Vector3d pos = Vector3d(double(ix) + 0.5, double(iy) + 0.5, double(iz) + 0.5) * spacing + origin;
-				Vector3d B = field->getField(pos);
-				grid->get(ix, iy, iz) = B;
+			for (size_t iz = 0; iz < Nz; iz++)
+				pos[iy * Nz + iz] = Vector3d(double(ix) + 0.5, double(iy) + 0.5, double(iz) + 0.5) * spacing + origin;
+		field->getFields(&pos[0], &B[0], Ny * Nz);
+		for (size_t iy = 0; iy < Ny; iy++)
+			for (size_t iz = 0; iz < Nz; iz++)
+				grid->get(ix, iy, iz) = B[iy * Nz + iz];
 	}
 }
 
@@ -288,12 +446,17 @@ void fromMagneticFieldStrength(ref_ptr<ScalarGrid> grid, ref_ptr<MagneticField>
 	size_t Nx = grid->getNx();
 	size_t Ny = grid->getNy();
 	size_t Nz = grid->getNz();
-	for (size_t ix = 0; ix < Nx; ix++)
+	// one batch per x-plane
+	#pragma omp parallel for schedule(dynamic)
+	for (int ix = 0; ix < Nx; ix++) {
+		std::vector<Vector3d> pos(Ny * Nz), B(Ny * Nz);
 		for (size_t iy = 0; iy < Ny; iy++)
-			for (size_t iz = 0; iz < Nz; iz++) {
-				Vector3d pos = Vector3d(double(ix) + 0.5, double(iy) + 0.5, double(iz) + 0.5) * spacing + origin;
-				double s = field->getField(pos).getR();
-				grid->get(ix, iy, iz) = s;
+			for (size_t iz = 0; iz < Nz; iz++)
+				pos[iy * Nz + iz] = Vector3d(double(ix) + 0.5, double(iy) + 0.5, double(iz) + 0.5) * spacing + origin;
+		field->getFields(&pos[0], &B[0], Ny * Nz);
+		for (size_t iy = 0; iy < Ny; iy++)
+			for (size_t iz = 0; iz < Nz; iz++)
+				grid->get(ix, iy, iz) = B[iy * Nz + iz].getR();
 	}
 }
 
@@ -303,70 +466,128 @@ double turbulentCorrelationLength(double lMin, double lMax, double alpha) {
 	return lMax / 2 * (a - 1) / a * (1 - pow(r, a)) / (1 - pow(r, a - 1));
 }
 
-void loadGrid(ref_ptr<VectorGrid> grid, std::string filename, double c) {
-	std::ifstream fin(filename.c_str(), std::ios::binary);
-	if (!fin) {
-		std::stringstream ss;
-		ss << "load VectorGrid: " << filename << " not found";
-		throw std::runtime_error(ss.str());
-	}
+// the floats of a grid file are hashed and loaded in chunks of this size,
+// the checksum does not depend on the number of threads
+static const size_t GRID_CHUNK_FLOATS = 256 * 1024;
 
-	// get length of file and compare to size of grid
-	fin.seekg(0, fin.end);
-	size_t length = fin.tellg() / sizeof(float);
-	fin.seekg (0, fin.beg);
+static inline size_t gridComponents(const float *) {
+	return 1;
+}
 
-	size_t nx = grid->getNx();
-	size_t ny = grid->getNy();
-	size_t nz = grid->getNz();
+static inline size_t gridComponents(const Vector3f *) {
+	return 3;
+}
 
-	if (length != (3 * nx * ny * nz))
-		throw std::runtime_error("loadGrid: file and grid size do not match");
+static inline float &gridComponent(float &value, size_t k) {
+	return value;
+}
 
-	for (int ix = 0; ix < grid->getNx(); ix++) {
-		for (int iy = 0; iy < grid->getNy(); iy++) {
-			for (int iz = 0; iz < grid->getNz(); iz++) {
-				Vector3f &b = grid->get(ix, iy, iz);
-				fin.read((char*) &(b.x), sizeof(float));
-				fin.read((char*) &(b.y), sizeof(float));
-				fin.read((char*) &(b.z), sizeof(float));
-				b *= c;
-			}
-		}
+static inline float &gridComponent(Vector3f &value, size_t k) {
+	return (k == 0) ? value.x : ((k == 1) ? value.y : value.z);
+}
+
+// FNV-1a of the 32 bit words of a chunk
+static uint64_t chunkChecksum(const float *values, size_t n) {
+	const uint32_t *words = (const uint32_t *) values;
+	uint64_t h = 14695981039346656037ULL;
+	for (size_t i = 0; i < n; i++)
+		h = (h ^ words[i]) * 1099511628211ULL;
+	return h;
+}
+
+// FNV-1a of the checksums of the chunks
+static uint64_t combineChecksums(const std::vector<uint64_t> &chunks) {
+	uint64_t h = 14695981039346656037ULL;
+	for (size_t i = 0; i < chunks.size(); i++)
+		h = (h ^ chunks[i]) * 1099511628211ULL;
+	return h;
+}
+
+uint64_t gridChecksum(std::string filename) {
+	ref_ptr<MappedFile> file = new MappedFile(filename);
+	const float *values = (const float *) file->getData();
+	size_t n = file->getSize() / sizeof(float);
+	std::vector<uint64_t> chunks((n + GRID_CHUNK_FLOATS - 1) / GRID_CHUNK_FLOATS);
+	#pragma omp parallel for schedule(static)
+	for (long i = 0; i < (long) chunks.size(); i++) {
+		size_t begin = i * GRID_CHUNK_FLOATS;
+		chunks[i] = chunkChecksum(values + begin, std::min(GRID_CHUNK_FLOATS, n - begin));
 	}
-	fin.close();
+	return combineChecksums(chunks);
 }
 
-void loadGrid(ref_ptr<ScalarGrid> grid, std::string filename, double c) {
-	std::ifstream fin(filename.c_str(), std::ios::binary);
-	if (!fin) {
+// the file is mapped and its chunks are copied by all threads
+template<typename T>
+static void loadGridChunks(Grid<T> &grid, const std::string &filename, double c,
+		uint64_t checksum, const char *name) {
+	ref_ptr<MappedFile> file;
+	try {
+		file = new MappedFile(filename);
+	} catch (std::exception &e) {
 		std::stringstream ss;
-		ss << "load ScalarGrid: " << filename << " not found";
+		ss << "load " << name << ": " << filename << " not found";
 		throw std::runtime_error(ss.str());
 	}
 
-	// get length of file and compare to size of grid
-	fin.seekg(0, fin.end);
-	size_t length = fin.tellg() / sizeof(float);
-	fin.seekg (0, fin.beg);
-
-	size_t nx = grid->getNx();
-	size_t ny = grid->getNy();
-	size_t nz = grid->getNz();
-
-	if (length != (nx * ny * nz))
+	const size_t components = gridComponents((const T *) 0);
+	size_t nx = grid.getNx(), ny = grid.getNy(), nz = grid.getNz();
+	size_t n = components * nx * ny * nz;
+	if (file->getSize() != n * sizeof(float))
 		throw std::runtime_error("loadGrid: file and grid size do not match");
 
-	for (int ix = 0; ix < nx; ix++) {
-		for (int iy = 0; iy < ny; iy++) {
-			for (int iz = 0; iz < nz; iz++) {
-				float &b = grid->get(ix, iy, iz);
-				fin.read((char*) &b, sizeof(float));
-				b *= c;
-			}
+	const float *values = (const float *) file->getData();
+	std::vector<uint64_t> chunks((n + GRID_CHUNK_FLOATS - 1) / GRID_CHUNK_FLOATS);
+	#pragma omp parallel for schedule(static)
+	for (long i = 0; i < (long) chunks.size(); i++) {
+		size_t begin = i * GRID_CHUNK_FLOATS;
+		size_t end = std::min(begin + GRID_CHUNK_FLOATS, n);
+		if (checksum != 0)
+			chunks[i] = chunkChecksum(values + begin, end - begin);
+		// grid point and component of the first value, in the order of dumpGrid
+		size_t cell = begin / components, k = begin % components;
+		size_t iz = cell % nz, iy = (cell / nz) % ny, ix = cell / (ny * nz);
+		for (size_t j = begin; j < end; j++) {
+			gridComponent(grid.get(ix, iy, iz), k) = values[j] * c;
+			if (++k < components)
+				continue;
+			k = 0;
+			if (++iz < nz)
+				continue;
+			iz = 0;
+			if (++iy < ny)
+				continue;
+			iy = 0;
+			ix++;
 		}
 	}
-	fin.close();
+
+	if ((checksum != 0) && (combineChecksums(chunks) != checksum))
+		throw std::runtime_error("loadGrid: checksum of " + filename + " does not match");
+}
+
+void loadGrid(ref_ptr<VectorGrid> grid, std::string filename, double c,
+		uint64_t checksum) {
+	loadGridChunks(*grid, filename, c, checksum, "VectorGrid");
+}
+
+void loadGrid(ref_ptr<ScalarGrid> grid, std::string filename, double c,
+		uint64_t checksum) {
+	loadGridChunks(*grid, filename, c, checksum, "ScalarGrid");
+}
+
+ref_ptr<MappedFile> mapGridFile(const std::string &filename) {
+	ref_ptr<MappedFile> file = SimulationBundle::getFile(filename);
+	if (!file.valid())
+		file = new MappedFile(filename);
+	return file;
+}
+
+void mapGrid(ref_ptr<VectorGrid> grid, std::string filename) {
+	grid->setMappedFile(mapGridFile(filename));
+}
+
+void mapGrid(ref_ptr<ScalarGrid> grid, std::string filename) {
+	grid->setMappedFile(mapGridFile(filename));
 }
 
 void dumpGrid(ref_ptr<VectorGrid> grid, std::string filename, double c) {
@@ -407,54 +628,179 @@ void dumpGrid(ref_ptr<ScalarGrid> grid, std::string filename, double c) {
 	fout.close();
 }
 
-void loadGridFromTxt(ref_ptr<VectorGrid> grid, std::string filename, double c) {
-	std::ifstream fin(filename.c_str());
-	if (!fin) {
+static inline bool isGridSpace(char c) {
+	return (c == ' ') || (c == '\t') || (c == '\n') || (c == '\r') || (c == '\f') || (c == '\v');
+}
+
+// decimal number up to the next white space, as written by dumpGridToTxt
+static bool parseGridValue(const char *&p, const char *end, float &value) {
+	const char *begin = p;
+	bool negative = false;
+	if ((p < end) && ((*p == '-') || (*p == '+')))
+		negative = (*p++ == '-');
+	uint64_t mantissa = 0;
+	int digits = 0, exponent = 0;
+	bool any = false;
+	for (; (p < end) && (*p >= '0') && (*p <= '9'); p++, any = true)
+		if (digits < 19) {
+			mantissa = mantissa * 10 + (*p - '0');
+			if (mantissa > 0)
+				digits++;
+		} else {
+			exponent++;
+		}
+	if ((p < end) && (*p == '.'))
+		for (p++; (p < end) && (*p >= '0') && (*p <= '9'); p++, any = true)
+			if (digits < 19) {
+				mantissa = mantissa * 10 + (*p - '0');
+				if (mantissa > 0)
+					digits++;
+				exponent--;
+			}
+	if (any && (p < end) && ((*p == 'e') || (*p == 'E'))) {
+		const char *e = p + 1;
+		bool negativeExponent = false;
+		if ((e < end) && ((*e == '-') || (*e == '+')))
+			negativeExponent = (*e++ == '-');
+		int x = 0;
+		bool anyExponent = false;
+		for (; (e < end) && (*e >= '0') && (*e <= '9'); e++, anyExponent = true)
+			if (x < 10000)
+				x = x * 10 + (*e - '0');
+		if (anyExponent) {
+			exponent += negativeExponent ? -x : x;
+			p = e;
+		}
+	}
+
+	// exact powers of ten, else with strtod, e.g. inf, nan or large exponents
+	static const double powers[23] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7,
+			1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19,
+			1e20, 1e21, 1e22};
+	if (any && ((p == end) || isGridSpace(*p)) && (exponent >= -22) && (exponent <= 22)) {
+		double v = (double) mantissa;
+		v = (exponent < 0) ? v / powers[-exponent] : v * powers[exponent];
+		value = negative ? -v : v;
+		return true;
+	}
+	const char *tokenEnd = begin;
+	while ((tokenEnd < end) && !isGridSpace(*tokenEnd))
+		tokenEnd++;
+	std::string token(begin, tokenEnd);
+	char *parsed;
+	value = strtod(token.c_str(), &parsed);
+	p = tokenEnd;
+	return !token.empty() && (*parsed == 0);
+}
+
+// the text after the header lines is split at white space into a part per
+// thread, the values are counted and then parsed by all threads
+template<typename T>
+static void loadGridText(Grid<T> &grid, const std::string &filename, double c,
+		const char *name) {
+	ref_ptr<MappedFile> file;
+	try {
+		file = new MappedFile(filename);
+	} catch (std::exception &e) {
 		std::stringstream ss;
-		ss << "load VectorGrid: " << filename << " not found";
+		ss << "load " << name << ": " << filename << " not found";
 		throw std::runtime_error(ss.str());
 	}
+	const char *text = (const char *) file->getData();
+	const char *end = text + file->getSize();
 	// skip header lines
-	while (fin.peek() == '#')
-		fin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+	while ((text < end) && (*text == '#')) {
+		while ((text < end) && (*text != '\n'))
+			text++;
+		if (text < end)
+			text++;
+	}
 
-	for (int ix = 0; ix < grid->getNx(); ix++) {
-		for (int iy = 0; iy < grid->getNy(); iy++) {
-			for (int iz = 0; iz < grid->getNz(); iz++) {
-				Vector3f &b = grid->get(ix, iy, iz);
-				fin >> b.x >> b.y >> b.z;
-				b *= c;
-				if (fin.eof())
-					throw std::runtime_error("load VectorGrid: file too short");
-			}
+#ifdef _OPENMP
+	size_t parts = omp_get_max_threads();
+#else
+	size_t parts = 1;
+#endif
+	std::vector<const char *> bounds(parts + 1, end);
+	bounds[0] = text;
+	for (size_t i = 1; i < parts; i++) {
+		const char *p = std::max(bounds[i - 1], text + (end - text) * i / parts);
+		while ((p < end) && !isGridSpace(*p))
+			p++;
+		bounds[i] = p;
+	}
+
+	std::vector<size_t> first(parts + 1, 0); // index of the first value of each part
+	#pragma omp parallel for schedule(static, 1)
+	for (long i = 0; i < (long) parts; i++) {
+		size_t n = 0;
+		for (const char *p = bounds[i]; p < bounds[i + 1]; ) {
+			while ((p < bounds[i + 1]) && isGridSpace(*p))
+				p++;
+			if (p == bounds[i + 1])
+				break;
+			n++;
+			while ((p < bounds[i + 1]) && !isGridSpace(*p))
+				p++;
 		}
+		first[i + 1] = n;
 	}
-	fin.close();
-}
+	for (size_t i = 0; i < parts; i++)
+		first[i + 1] += first[i];
 
-void loadGridFromTxt(ref_ptr<ScalarGrid> grid, std::string filename, double c) {
-	std::ifstream fin(filename.c_str());
-	if (!fin) {
+	const size_t components = gridComponents((const T *) 0);
+	size_t nx = grid.getNx(), ny = grid.getNy(), nz = grid.getNz();
+	size_t n = components * nx * ny * nz;
+	if (first[parts] < n) {
 		std::stringstream ss;
-		ss << "load ScalarGrid: " << filename << " not found";
+		ss << "load " << name << ": file too short";
 		throw std::runtime_error(ss.str());
 	}
-	// skip header lines
-	while (fin.peek() == '#')
-		fin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
 
-	for (int ix = 0; ix < grid->getNx(); ix++) {
-		for (int iy = 0; iy < grid->getNy(); iy++) {
-			for (int iz = 0; iz < grid->getNz(); iz++) {
-				float &b = grid->get(ix, iy, iz);
-				fin >> b;
-				b *= c;
-				if (fin.eof())
-					throw std::runtime_error("load ScalarGrid: file too short");
+	bool invalid = false;
+	#pragma omp parallel for schedule(static, 1) reduction(||:invalid)
+	for (long i = 0; i < (long) parts; i++) {
+		size_t j = first[i];
+		size_t cell = j / components, k = j % components;
+		size_t iz = cell % nz, iy = (cell / nz) % ny, ix = cell / (ny * nz);
+		const char *p = bounds[i];
+		while ((j < n) && (p < bounds[i + 1])) {
+			while ((p < bounds[i + 1]) && isGridSpace(*p))
+				p++;
+			if (p == bounds[i + 1])
+				break;
+			float value;
+			if (!parseGridValue(p, bounds[i + 1], value)) {
+				invalid = true;
+				break;
 			}
+			gridComponent(grid.get(ix, iy, iz), k) = value * c;
+			j++;
+			if (++k < components)
+				continue;
+			k = 0;
+			if (++iz < nz)
+				continue;
+			iz = 0;
+			if (++iy < ny)
+				continue;
+			iy = 0;
+			ix++;
 		}
 	}
-	fin.close();
+	if (invalid) {
+		std::stringstream ss;
+		ss << "load " << name << ": " << filename << " has an invalid value";
+		throw std::runtime_error(ss.str());
+	}
+}
+
+void loadGridFromTxt(ref_ptr<VectorGrid> grid, std::string filename, double c) {
+	loadGridText(*grid, filename, c, "VectorGrid");
+}
+
+void loadGridFromTxt(ref_ptr<ScalarGrid> grid, std::string filename, double c) {
+	loadGridText(*grid, filename, c, "ScalarGrid");
 }
 
 void dumpGridToTxt(ref_ptr<VectorGrid> grid, std::string filename, double c) {
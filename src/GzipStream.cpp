@@ -0,0 +1,186 @@
+#ifdef CRPROPA_HAVE_ZLIB
+
+#include "crpropa/GzipStream.h"
+
+#include <stdexcept>
+#include <unistd.h>
+#include <zlib.h>
+
+namespace crpropa {
+
+static const size_t GZIP_BLOCK_SIZE = 256 * 1024;
+
+GzipStreamBuffer::GzipStreamBuffer(std::ostream &out, int level,
+		size_t threads) :
+		out(&out), level(level), sequence(0), nextWrite(0), crc(crc32(0, 0, 0)),
+		length(0), closed(false), stop(false) {
+	buffer.resize(GZIP_BLOCK_SIZE);
+	setp(&buffer[0], &buffer[0] + buffer.size());
+
+	// gzip header: magic, deflate, no flags, no time, no extra flags, unix
+	const char header[10] = {'\x1f', '\x8b', 8, 0, 0, 0, 0, 0, 0, 3};
+	out.write(header, 10);
+
+	if (threads == 0) {
+		long n = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = (n > 0) ? n : 1;
+	}
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&changed, NULL);
+	for (size_t i = 0; i < threads; i++) {
+		pthread_t t;
+		if (pthread_create(&t, NULL, workerMain, this) != 0)
+			break;
+		workers.push_back(t);
+	}
+	if (workers.empty())
+		throw std::runtime_error("GzipStream: could not start a worker thread");
+}
+
+GzipStreamBuffer::~GzipStreamBuffer() {
+	close();
+	pthread_cond_destroy(&changed);
+	pthread_mutex_destroy(&mutex);
+}
+
+void GzipStreamBuffer::compress(Job *job) const {
+	job->crc = crc32(0, (const Bytef *) &job->input[0], job->input.size());
+
+	// raw deflate, ends on a byte boundary (sync flush) or with the final block
+	z_stream z;
+	z.zalloc = Z_NULL;
+	z.zfree = Z_NULL;
+	z.opaque = Z_NULL;
+	deflateInit2(&z, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+	job->output.resize(deflateBound(&z, job->input.size()) + 16);
+	z.next_in = job->input.empty() ? Z_NULL : (Bytef *) &job->input[0];
+	z.avail_in = job->input.size();
+	z.next_out = (Bytef *) &job->output[0];
+	z.avail_out = job->output.size();
+	deflate(&z, job->last ? Z_FINISH : Z_SYNC_FLUSH);
+	job->output.resize(job->output.size() - z.avail_out);
+	deflateEnd(&z);
+}
+
+void *GzipStreamBuffer::workerMain(void *buffer) {
+	GzipStreamBuffer *self = (GzipStreamBuffer *) buffer;
+	pthread_mutex_lock(&self->mutex);
+	while (true) {
+		while (self->jobs.empty() && !self->stop)
+			pthread_cond_wait(&self->changed, &self->mutex);
+		if (self->jobs.empty())
+			break;
+		Job *job = self->jobs.front();
+		self->jobs.pop_front();
+		pthread_cond_broadcast(&self->changed);
+		pthread_mutex_unlock(&self->mutex);
+
+		self->compress(job);
+
+		pthread_mutex_lock(&self->mutex);
+		self->done[job->sequence] = job;
+		self->writeDone();
+		pthread_cond_broadcast(&self->changed);
+	}
+	pthread_mutex_unlock(&self->mutex);
+	return 0;
+}
+
+void GzipStreamBuffer::writeDone() {
+	// called with the mutex locked, writes the blocks in order
+	std::map<size_t, Job *>::iterator i = done.find(nextWrite);
+	while (i != done.end()) {
+		Job *job = i->second;
+		if (!job->output.empty())
+			out->write(&job->output[0], job->output.size());
+		crc = crc32_combine(crc, job->crc, job->input.size());
+		length += job->input.size();
+		done.erase(i);
+		delete job;
+		i = done.find(++nextWrite);
+	}
+}
+
+void GzipStreamBuffer::push(bool last) {
+	Job *job = new Job;
+	job->sequence = sequence++;
+	job->input.assign(pbase(), pptr());
+	job->last = last;
+	setp(&buffer[0], &buffer[0] + buffer.size());
+
+	pthread_mutex_lock(&mutex);
+	// bound the memory: wait while twice as many blocks as workers are queued
+	while (jobs.size() >= 2 * workers.size())
+		pthread_cond_wait(&changed, &mutex);
+	jobs.push_back(job);
+	pthread_cond_broadcast(&changed);
+	pthread_mutex_unlock(&mutex);
+}
+
+int GzipStreamBuffer::overflow(int c) {
+	if (closed)
+		return traits_type::eof();
+	push(false);
+	if (c != traits_type::eof()) {
+		*pptr() = c;
+		pbump(1);
+	}
+	return traits_type::not_eof(c);
+}
+
+std::streamsize GzipStreamBuffer::xsputn(const char *s, std::streamsize n) {
+	std::streamsize written = 0;
+	while (written < n) {
+		if (pptr() == epptr() && (overflow(traits_type::eof()) == traits_type::eof()))
+			break;
+		std::streamsize m = std::min<std::streamsize>(n - written, epptr() - pptr());
+		traits_type::copy(pptr(), s + written, m);
+		pbump(m);
+		written += m;
+	}
+	return written;
+}
+
+int GzipStreamBuffer::sync() {
+	// the blocks are independent, data is only written in whole blocks
+	return 0;
+}
+
+void GzipStreamBuffer::close() {
+	if (closed)
+		return;
+	closed = true;
+	push(true);
+
+	pthread_mutex_lock(&mutex);
+	while (nextWrite < sequence)
+		pthread_cond_wait(&changed, &mutex);
+	stop = true;
+	pthread_cond_broadcast(&changed);
+	pthread_mutex_unlock(&mutex);
+	for (size_t i = 0; i < workers.size(); i++)
+		pthread_join(workers[i], NULL);
+	workers.clear();
+
+	// gzip trailer: crc and length, little endian
+	char trailer[8];
+	for (int i = 0; i < 4; i++) {
+		trailer[i] = (crc >> (8 * i)) & 0xff;
+		trailer[4 + i] = (length >> (8 * i)) & 0xff;
+	}
+	out->write(trailer, 8);
+	out->flush();
+}
+
+GzipStream::GzipStream(std::ostream &out, int level, size_t threads) :
+		std::ostream(0), buf(out, level, threads) {
+	rdbuf(&buf);
+}
+
+void GzipStream::close() {
+	buf.close();
+}
+
+} // namespace crpropa
+
+#endif // CRPROPA_HAVE_ZLIB
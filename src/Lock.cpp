@@ -0,0 +1,199 @@
+#include "crpropa/Lock.h"
+#include "crpropa/Trace.h"
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace crpropa {
+
+namespace {
+
+struct LockEntry {
+	double wait;
+	double hold;
+	size_t count;
+	LockEntry() : wait(0), hold(0), count(0) {}
+};
+
+// entries of one thread, only written by the thread itself
+struct ThreadEntries {
+	int thread;
+	std::vector<LockEntry> entries;
+};
+
+// function statics, Locks are also constructed during static initialization
+std::vector<std::string> &sites() {
+	static std::vector<std::string> s;
+	return s;
+}
+
+std::vector<ThreadEntries *> &threads() {
+	static std::vector<ThreadEntries *> t;
+	return t;
+}
+
+#ifdef CRPROPA_LOCK_PROFILING
+__thread ThreadEntries *threadEntries = 0;
+
+double now() {
+#ifdef _OPENMP
+	return omp_get_wtime();
+#else
+	return 0;
+#endif
+}
+#endif
+
+} // namespace
+
+Lock::Lock(const std::string &name) :
+		impl(0), acquired(0), waited(0) {
+	site = LockProfile::addSite(name);
+	traceName = Trace::addName("wait: " + name, "lock");
+#ifdef _OPENMP
+	omp_lock_t *l = new omp_lock_t;
+	omp_init_lock(l);
+	impl = l;
+#endif
+}
+
+Lock::~Lock() {
+#ifdef _OPENMP
+	omp_lock_t *l = (omp_lock_t *) impl;
+	omp_destroy_lock(l);
+	delete l;
+#endif
+}
+
+void Lock::lock() {
+#ifdef _OPENMP
+	double traceStart = Trace::isEnabled() ? Trace::now() : 0;
+#ifdef CRPROPA_LOCK_PROFILING
+	double start = now();
+	omp_set_lock((omp_lock_t *) impl);
+	acquired = now();
+	waited = acquired - start;
+#else
+	omp_set_lock((omp_lock_t *) impl);
+#endif
+	if (Trace::isEnabled()) {
+		// uncontended acquisitions are not traced
+		double end = Trace::now();
+		if (end - traceStart > 1e-6)
+			Trace::record(traceName, traceStart, end);
+	}
+#endif
+}
+
+void Lock::unlock() {
+#ifdef _OPENMP
+#ifdef CRPROPA_LOCK_PROFILING
+	double hold = now() - acquired;
+	double wait = waited;
+	omp_unset_lock((omp_lock_t *) impl);
+	LockProfile::record(site, wait, hold);
+#else
+	omp_unset_lock((omp_lock_t *) impl);
+#endif
+#endif
+}
+
+bool LockProfile::isEnabled() {
+#ifdef CRPROPA_LOCK_PROFILING
+	return true;
+#else
+	return false;
+#endif
+}
+
+size_t LockProfile::addSite(const std::string &name) {
+	size_t site;
+#pragma omp critical(LockProfile)
+	{
+		std::vector<std::string> &s = sites();
+		site = s.size();
+		for (size_t i = 0; i < s.size(); i++)
+			if (s[i] == name)
+				site = i;
+		if (site == s.size())
+			s.push_back(name);
+	}
+	return site;
+}
+
+void LockProfile::record(size_t site, double wait, double hold) {
+#ifdef CRPROPA_LOCK_PROFILING
+	if (!threadEntries) {
+		threadEntries = new ThreadEntries;
+#ifdef _OPENMP
+		threadEntries->thread = omp_get_thread_num();
+#else
+		threadEntries->thread = 0;
+#endif
+#pragma omp critical(LockProfile)
+		threads().push_back(threadEntries);
+	}
+	std::vector<LockEntry> &entries = threadEntries->entries;
+	if (entries.size() <= site)
+		entries.resize(site + 1);
+	entries[site].wait += wait;
+	entries[site].hold += hold;
+	entries[site].count++;
+#endif
+}
+
+std::string LockProfile::getReport() {
+	std::stringstream ss;
+	if (!isEnabled()) {
+		ss << "Lock profile: not recorded, configure with ENABLE_LOCK_PROFILING\n";
+		return ss.str();
+	}
+	ss << "Lock profile (wait / hold time):\n";
+#pragma omp critical(LockProfile)
+	{
+		const std::vector<std::string> &s = sites();
+		const std::vector<ThreadEntries *> &t = threads();
+		for (size_t i = 0; i < s.size(); i++) {
+			LockEntry total;
+			for (size_t k = 0; k < t.size(); k++) {
+				if (i >= t[k]->entries.size())
+					continue;
+				total.wait += t[k]->entries[i].wait;
+				total.hold += t[k]->entries[i].hold;
+				total.count += t[k]->entries[i].count;
+			}
+			if (total.count == 0)
+				continue;
+			ss << " - " << s[i] << ": " << total.wait << " s / " << total.hold
+					<< " s, " << total.count << " locks\n";
+			for (size_t k = 0; k < t.size(); k++) {
+				if ((i >= t[k]->entries.size()) || (t[k]->entries[i].count == 0))
+					continue;
+				const LockEntry &e = t[k]->entries[i];
+				ss << "     thread " << t[k]->thread << ": " << e.wait << " s / "
+						<< e.hold << " s, " << e.count << " locks\n";
+			}
+		}
+	}
+	return ss.str();
+}
+
+void LockProfile::show() {
+	std::cout << getReport();
+}
+
+void LockProfile::reset() {
+#pragma omp critical(LockProfile)
+	{
+		std::vector<ThreadEntries *> &t = threads();
+		for (size_t k = 0; k < t.size(); k++)
+			t[k]->entries.assign(t[k]->entries.size(), LockEntry());
+	}
+}
+
+} // namespace crpropa
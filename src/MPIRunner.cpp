@@ -0,0 +1,142 @@
+#ifdef CRPROPA_HAVE_MPI
+
+#include "crpropa/MPIRunner.h"
+#include "crpropa/Random.h"
+
+#include <mpi.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace crpropa {
+
+MPIRunner::MPIRunner(ModuleList *mlist, size_t chunkSize) :
+		mlist(mlist), chunkSize(chunkSize), rank(0), size(1), processed(0) {
+	int initialized = 0;
+	MPI_Initialized(&initialized);
+	if (!initialized)
+		throw std::runtime_error("MPIRunner: MPI_Init has to be called first");
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+	MPI_Comm_size(MPI_COMM_WORLD, &size);
+	setChunkSize(chunkSize);
+
+	// disjoint ranges of serial numbers: 2^48 per rank
+	uint64_t firstSerialNumber = uint64_t(rank) << 48;
+	if (Candidate::getNextSerialNumber() < firstSerialNumber)
+		Candidate::setNextSerialNumber(firstSerialNumber);
+}
+
+int MPIRunner::getRank() const {
+	return rank;
+}
+
+int MPIRunner::getSize() const {
+	return size;
+}
+
+size_t MPIRunner::getNumberOfProcessed() const {
+	return processed;
+}
+
+void MPIRunner::setChunkSize(size_t n) {
+	if (n == 0)
+		throw std::runtime_error("MPIRunner: chunk size must be larger than 0");
+	chunkSize = n;
+}
+
+size_t MPIRunner::getChunkSize() const {
+	return chunkSize;
+}
+
+void MPIRunner::seed(uint32_t seed) {
+	Random::seedThreadsDisjoint(seed, rank);
+}
+
+void MPIRunner::run(SourceInterface *source, size_t count, bool recursive) {
+	// shared counter of handed out candidates, located on rank 0
+	unsigned long long *counter = 0;
+	MPI_Win window;
+	MPI_Aint windowSize = (rank == 0) ? sizeof(unsigned long long) : 0;
+	MPI_Win_allocate(windowSize, sizeof(unsigned long long), MPI_INFO_NULL,
+			MPI_COMM_WORLD, &counter, &window);
+	if (rank == 0)
+		*counter = 0;
+	MPI_Barrier(MPI_COMM_WORLD);
+
+	unsigned long long increment = chunkSize;
+	processed = 0;
+	while (true) {
+		unsigned long long begin = 0;
+		MPI_Win_lock(MPI_LOCK_SHARED, 0, 0, window);
+		MPI_Fetch_and_op(&increment, &begin, MPI_UNSIGNED_LONG_LONG, 0, 0,
+				MPI_SUM, window);
+		MPI_Win_unlock(0, window);
+		if (begin >= count)
+			break;
+
+		size_t n = std::min<size_t>(chunkSize, count - begin);
+		mlist->run(source, n, recursive);
+		processed += n;
+	}
+
+	MPI_Barrier(MPI_COMM_WORLD);
+	MPI_Win_free(&window);
+}
+
+std::string MPIRunner::getShardFilename(const std::string &filename) const {
+	return getShardFilename(filename, rank);
+}
+
+std::string MPIRunner::getShardFilename(const std::string &filename, int r) const {
+	std::stringstream ss;
+	size_t dot = filename.find_last_of('.');
+	size_t slash = filename.find_last_of('/');
+	if ((dot == std::string::npos) || ((slash != std::string::npos) && (dot < slash)))
+		ss << filename << "." << r;
+	else
+		ss << filename.substr(0, dot) << "." << r << filename.substr(dot);
+	return ss.str();
+}
+
+void MPIRunner::writeIndex(const std::string &filename, const std::string &indexFilename) const {
+	MPI_Barrier(MPI_COMM_WORLD);
+	if (rank != 0)
+		return;
+	std::ofstream out(indexFilename.c_str());
+	for (int r = 0; r < size; r++)
+		out << getShardFilename(filename, r) << "\n";
+	if (!out)
+		throw std::runtime_error("MPIRunner: could not write " + indexFilename);
+}
+
+void MPIRunner::mergeText(const std::string &filename, bool removeShards) const {
+	MPI_Barrier(MPI_COMM_WORLD);
+	if (rank != 0)
+		return;
+	std::ofstream out(filename.c_str());
+	for (int r = 0; r < size; r++) {
+		std::string shard = getShardFilename(filename, r);
+		std::ifstream in(shard.c_str());
+		if (!in.good())
+			throw std::runtime_error("MPIRunner: could not open " + shard);
+		std::string line;
+		while (std::getline(in, line)) {
+			// keep the header of the first shard only
+			if ((r > 0) && (line.size() > 0) && (line[0] == '#'))
+				continue;
+			out << line << "\n";
+		}
+		in.close();
+		if (removeShards)
+			std::remove(shard.c_str());
+	}
+	if (!out)
+		throw std::runtime_error("MPIRunner: could not write " + filename);
+}
+
+} // namespace crpropa
+
+#endif // CRPROPA_HAVE_MPI
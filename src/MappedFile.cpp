@@ -0,0 +1,77 @@
+#include "crpropa/MappedFile.h"
+
+#include <stdexcept>
+
+#if defined(WIN32) || defined(_WIN32)
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace crpropa {
+
+#if defined(WIN32) || defined(_WIN32)
+
+MappedFile::MappedFile(const std::string &filename) :
+		data(0), size(0), filename(filename), memory("MappedFile") {
+	throw std::runtime_error("MappedFile: not supported on this system");
+}
+
+MappedFile::~MappedFile() {
+}
+
+#else
+
+MappedFile::MappedFile(const std::string &filename) :
+		data(0), size(0), filename(filename), memory("MappedFile") {
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+		throw std::runtime_error("MappedFile: " + filename + " not found");
+
+	struct stat st;
+	if ((fstat(fd, &st) != 0) || (st.st_size <= 0)) {
+		close(fd);
+		throw std::runtime_error("MappedFile: " + filename + " is empty");
+	}
+	size = st.st_size;
+
+	// private and writable: pages are shared until modified
+	void *p = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+		throw std::runtime_error("MappedFile: could not map " + filename);
+	data = p;
+	memory.set(size);
+}
+
+MappedFile::~MappedFile() {
+	if (data && !parent.valid())
+		munmap(data, size);
+}
+
+#endif
+
+MappedFile::MappedFile(ref_ptr<MappedFile> file, size_t offset, size_t size,
+		const std::string &filename) :
+		data(0), size(size), filename(filename), memory("MappedFile"),
+		parent(file) {
+	if (offset + size > file->getSize())
+		throw std::runtime_error("MappedFile: region outside of " + file->getFilename());
+	data = static_cast<char *>(file->getData()) + offset;
+}
+
+void *MappedFile::getData() const {
+	return data;
+}
+
+size_t MappedFile::getSize() const {
+	return size;
+}
+
+std::string MappedFile::getFilename() const {
+	return filename;
+}
+
+} // namespace crpropa
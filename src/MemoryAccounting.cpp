@@ -0,0 +1,221 @@
+#include "crpropa/MemoryAccounting.h"
+#include "crpropa/Candidate.h"
+
+#include <iostream>
+#include <sstream>
+
+namespace crpropa {
+
+namespace {
+
+struct Category {
+	std::string name;
+	long long bytes;
+	long long peak;
+};
+
+// live candidates of one thread, only written by the thread itself
+struct ThreadCandidates {
+	long live;
+	long peak;
+};
+
+// function statics, categories are also added during static initialization
+std::vector<Category> &categories() {
+	static std::vector<Category> c;
+	return c;
+}
+
+std::vector<ThreadCandidates *> &threads() {
+	static std::vector<ThreadCandidates *> t;
+	return t;
+}
+
+__thread ThreadCandidates *threadCandidates = 0;
+
+} // namespace
+
+size_t MemoryAccounting::addCategory(const std::string &name) {
+	size_t index;
+#pragma omp critical(MemoryAccounting)
+	{
+		std::vector<Category> &c = categories();
+		index = c.size();
+		for (size_t i = 0; i < c.size(); i++)
+			if (c[i].name == name)
+				index = i;
+		if (index == c.size()) {
+			Category category;
+			category.name = name;
+			category.bytes = 0;
+			category.peak = 0;
+			c.push_back(category);
+		}
+	}
+	return index;
+}
+
+void MemoryAccounting::add(size_t category, long long bytes) {
+#pragma omp critical(MemoryAccounting)
+	{
+		Category &c = categories()[category];
+		c.bytes += bytes;
+		if (c.bytes > c.peak)
+			c.peak = c.bytes;
+	}
+}
+
+long long MemoryAccounting::getBytes(const std::string &category) {
+	long long bytes = 0;
+#pragma omp critical(MemoryAccounting)
+	{
+		const std::vector<Category> &c = categories();
+		for (size_t i = 0; i < c.size(); i++)
+			if (c[i].name == category)
+				bytes = c[i].bytes;
+	}
+	return bytes;
+}
+
+long long MemoryAccounting::getPeakBytes(const std::string &category) {
+	long long peak = 0;
+#pragma omp critical(MemoryAccounting)
+	{
+		const std::vector<Category> &c = categories();
+		for (size_t i = 0; i < c.size(); i++)
+			if (c[i].name == category)
+				peak = c[i].peak;
+	}
+	return peak;
+}
+
+std::vector<std::string> MemoryAccounting::getCategoryNames() {
+	std::vector<std::string> names;
+#pragma omp critical(MemoryAccounting)
+	{
+		const std::vector<Category> &c = categories();
+		for (size_t i = 0; i < c.size(); i++)
+			names.push_back(c[i].name);
+	}
+	return names;
+}
+
+void MemoryAccounting::countCandidates(long n) {
+	if (!threadCandidates) {
+		threadCandidates = new ThreadCandidates;
+		threadCandidates->live = 0;
+		threadCandidates->peak = 0;
+#pragma omp critical(MemoryAccounting)
+		threads().push_back(threadCandidates);
+	}
+	threadCandidates->live += n;
+	if (threadCandidates->live > threadCandidates->peak)
+		threadCandidates->peak = threadCandidates->live;
+}
+
+long MemoryAccounting::getLiveCandidates() {
+	long live = 0;
+#pragma omp critical(MemoryAccounting)
+	{
+		const std::vector<ThreadCandidates *> &t = threads();
+		for (size_t k = 0; k < t.size(); k++)
+			live += t[k]->live;
+	}
+	return live;
+}
+
+size_t MemoryAccounting::getCandidateThreads() {
+	size_t n;
+#pragma omp critical(MemoryAccounting)
+	n = threads().size();
+	return n;
+}
+
+long MemoryAccounting::getPeakLiveCandidates(size_t thread) {
+	long peak = 0;
+#pragma omp critical(MemoryAccounting)
+	{
+		const std::vector<ThreadCandidates *> &t = threads();
+		if (thread < t.size())
+			peak = t[thread]->peak;
+	}
+	return peak;
+}
+
+void MemoryAccounting::resetPeaks() {
+#pragma omp critical(MemoryAccounting)
+	{
+		std::vector<Category> &c = categories();
+		for (size_t i = 0; i < c.size(); i++)
+			c[i].peak = c[i].bytes;
+		std::vector<ThreadCandidates *> &t = threads();
+		for (size_t k = 0; k < t.size(); k++)
+			t[k]->peak = t[k]->live;
+	}
+}
+
+std::string MemoryAccounting::getReport() {
+	std::stringstream ss;
+	ss << "Memory (current / peak MB):\n";
+	std::vector<std::string> names = getCategoryNames();
+	for (size_t i = 0; i < names.size(); i++) {
+		long long peak = getPeakBytes(names[i]);
+		if (peak == 0)
+			continue;
+		ss << " - " << names[i] << ": " << getBytes(names[i]) / 1e6 << " / "
+				<< peak / 1e6 << "\n";
+	}
+	long live = getLiveCandidates();
+	ss << " - Candidates: " << live << " live, " << live * sizeof(Candidate) / 1e6
+			<< " MB without properties and secondaries\n";
+	for (size_t k = 0; k < getCandidateThreads(); k++)
+		ss << "     thread " << k << ": peak " << getPeakLiveCandidates(k)
+				<< " live candidates\n";
+	return ss.str();
+}
+
+void MemoryAccounting::show() {
+	std::cout << getReport();
+}
+
+MemoryAccount::MemoryAccount(const std::string &category) :
+		category(MemoryAccounting::addCategory(category)), bytes(0) {
+}
+
+MemoryAccount::MemoryAccount(const MemoryAccount &account) :
+		category(account.category), bytes(0) {
+	set(account.get());
+}
+
+MemoryAccount &MemoryAccount::operator=(const MemoryAccount &account) {
+	if (&account != this) {
+		set(0);
+		category = account.category;
+		set(account.get());
+	}
+	return *this;
+}
+
+MemoryAccount::~MemoryAccount() {
+	set(0);
+}
+
+void MemoryAccount::set(size_t newBytes) {
+	long long change;
+#pragma omp critical(MemoryAccount)
+	{
+		change = (long long) newBytes - bytes;
+		bytes = newBytes;
+	}
+	if (change != 0)
+		MemoryAccounting::add(category, change);
+}
+
+size_t MemoryAccount::get() const {
+	size_t b;
+#pragma omp critical(MemoryAccount)
+	b = bytes;
+	return b;
+}
+
+} // namespace crpropa
@@ -1,5 +1,10 @@
 #include "crpropa/Module.h"
+#include "crpropa/ParticleID.h"
+#include "crpropa/Random.h"
 
+#include <cstdlib>
+#include <limits>
+#include <stdexcept>
 #include <typeinfo>
 
 namespace crpropa {
@@ -17,6 +22,45 @@ void Module::setDescription(const std::string &d) {
 	description = d;
 }
 
+void Module::processBatch(Candidate *const *candidates, size_t n) const {
+	for (size_t i = 0; i < n; i++)
+		process(candidates[i]);
+}
+
+void Module::getConfiguration(Configuration &configuration) const {
+	throw std::runtime_error("Module: no configuration of " + getDescription());
+}
+
+int Module::particleClass(int id) {
+	if (isNucleus(id))
+		return (chargeNumber(id) > 0) ? NucleusClass : NeutronClass;
+	switch (abs(id)) {
+	case 22:
+		return PhotonClass;
+	case 11:
+		return ElectronClass;
+	case 12:
+	case 14:
+	case 16:
+		return NeutrinoClass;
+	default:
+		return OtherClass;
+	}
+}
+
+int Module::getParticleClasses() const {
+	return AllClasses;
+}
+
+void BatchModule::process(Candidate *candidate) const {
+	processBatch(&candidate, 1);
+}
+
+void BatchModule::processBatch(Candidate *const *candidates, size_t n) const {
+	std::vector<Candidate *> batch(candidates, candidates + n);
+	processCandidateVector(batch);
+}
+
 AbstractCondition::AbstractCondition() :
 		makeRejectedInactive(true), makeAcceptedInactive(false), rejectFlagKey(
 				"Rejected") {
@@ -51,6 +95,24 @@ void AbstractCondition::accept(Candidate *candidate) const {
 		candidate->setActive(false);
 }
 
+AbstractCondition::Decision AbstractCondition::check(const Candidate *candidate,
+		double &stepLimit) const {
+	return Unsupported;
+}
+
+void AbstractCondition::apply(Candidate *candidate, Decision decision) const {
+	if (decision == Reject)
+		reject(candidate);
+	else if (decision == Accept)
+		accept(candidate);
+}
+
+void AbstractCondition::processCheck(Candidate *candidate) const {
+	double stepLimit = std::numeric_limits<double>::max();
+	apply(candidate, check(candidate, stepLimit));
+	candidate->limitNextStep(stepLimit);
+}
+
 void AbstractCondition::setMakeRejectedInactive(bool deactivate) {
 	makeRejectedInactive = deactivate;
 }
@@ -77,4 +139,71 @@ void AbstractCondition::setAcceptFlag(std::string key, std::string value) {
 	acceptFlagValue = value;
 }
 
+void AbstractCondition::getConditionConfiguration(Configuration &c) const {
+	if (rejectAction.valid())
+		c.set("rejectAction", rejectAction.get());
+	if (acceptAction.valid())
+		c.set("acceptAction", acceptAction.get());
+	c.set("makeRejectedInactive", makeRejectedInactive);
+	c.set("makeAcceptedInactive", makeAcceptedInactive);
+	c.setString("rejectFlagKey", rejectFlagKey.getName());
+	c.setString("rejectFlagValue", rejectFlagValue);
+	c.setString("acceptFlagKey", acceptFlagKey.getName());
+	c.setString("acceptFlagValue", acceptFlagValue);
+}
+
+Interaction::Interaction() :
+		bias(1) {
+}
+
+void Interaction::setInteractionBias(double b) {
+	if (!(b >= 1))
+		throw std::runtime_error("Interaction: the interaction bias must be >= 1");
+	bias = b;
+}
+
+double Interaction::getInteractionBias() const {
+	return bias;
+}
+
+void Interaction::interactBiased(Candidate *candidate) const {
+	if (bias == 1) {
+		interact(candidate);
+		return;
+	}
+	double w = candidate->getWeight();
+	ref_ptr<Candidate> branch = candidate->clone(false);
+	branch->setThreadConfined(candidate->isThreadConfined());
+	branch->setWeight(w / bias);
+	branch->parent = candidate;
+	interact(branch);
+	candidate->setWeight(w * (1 - 1 / bias));
+
+	// the products become siblings of the branch, so that breadth first
+	// runs, which only look at the new secondaries, propagate them
+	for (size_t i = 0; i < branch->secondaries.size(); i++) {
+		branch->secondaries[i]->parent = candidate;
+		candidate->secondaries.push_back(branch->secondaries[i]);
+	}
+	branch->secondaries.clear();
+	if (branch->isActive())
+		candidate->addSecondary(branch);
+}
+
+size_t Interaction::leadingParticle(const double *energies, size_t n) {
+	double total = 0;
+	for (size_t i = 0; i < n; i++)
+		total += energies[i];
+	double r = Random::instance().rand() * total;
+	size_t i = 0;
+	while ((i + 1 < n) and (r >= energies[i])) {
+		r -= energies[i];
+		i++;
+	}
+	return i;
+}
+
+void ContinuousLoss::emitSecondaries(Candidate *candidate, double E, double dE) const {
+}
+
 } // namespace crpropa
@@ -0,0 +1,66 @@
+#include "crpropa/ModulePipeline.h"
+#include "crpropa/ModuleList.h"
+
+#include <sstream>
+
+namespace crpropa {
+
+ModulePipeline::ModulePipeline() {
+}
+
+ModulePipeline::ModulePipeline(const ModuleList &list) {
+	ModuleList::const_iterator m;
+	for (m = list.begin(); m != list.end(); m++)
+		add(*m);
+}
+
+void ModulePipeline::add(Module *module) {
+	modules.push_back(module);
+	Stage stage;
+	stage.module = module;
+	stage.particleClasses = module->getParticleClasses();
+	stages.push_back(stage);
+}
+
+size_t ModulePipeline::size() const {
+	return stages.size();
+}
+
+void ModulePipeline::process(Candidate *candidate) const {
+	// the class is cached in the state and follows changes of the ID
+	const ParticleState &current = candidate->current;
+	for (size_t i = 0; i < stages.size(); i++) {
+		const Stage &stage = stages[i];
+		if (!(stage.particleClasses & current.getParticleClass()))
+			continue;
+		stage.module->process(candidate);
+	}
+}
+
+void ModulePipeline::processBatch(Candidate *const *candidates, size_t n) const {
+	std::vector<Candidate *> selected;
+	selected.reserve(n);
+	for (size_t i = 0; i < stages.size(); i++) {
+		const Stage &stage = stages[i];
+		if (stage.particleClasses == AllClasses) {
+			stage.module->processBatch(candidates, n);
+			continue;
+		}
+		selected.clear();
+		for (size_t j = 0; j < n; j++)
+			if (stage.particleClasses & candidates[j]->current.getParticleClass())
+				selected.push_back(candidates[j]);
+		if (!selected.empty())
+			stage.module->processBatch(&selected[0], selected.size());
+	}
+}
+
+std::string ModulePipeline::getDescription() const {
+	std::stringstream s;
+	s << "ModulePipeline: " << stages.size() << " modules";
+	for (size_t i = 0; i < stages.size(); i++)
+		s << "\n  " << stages[i].module->getDescription();
+	return s.str();
+}
+
+} // namespace crpropa
@@ -24,22 +24,6 @@ int nucleusId(int a, int z) {
 	return 1000000000 + z * 10000 + a * 10;
 }
 
-int chargeNumber(int id) {
-	return HepPID::Z(id);
-}
-
-int massNumber(int id) {
-	if (id == 2112)
-		return 1;
-	return HepPID::A(id);
-}
-
-bool isNucleus(int id) {
-	if (id == 2112)
-		return true; // consider neutron as nucleus
-	return HepPID::isNucleus(id);
-}
-
 std::string convertIdToName(int id) {
 	// handle a few extra cases that HepPID doesn't like
 	if (id == 1000000010) // neutron
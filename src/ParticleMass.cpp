@@ -2,56 +2,66 @@
 #include "crpropa/ParticleID.h"
 #include "crpropa/Common.h"
 #include "crpropa/Units.h"
+#include "crpropa/DataTable.h"
 
 #include "kiss/convert.h"
 #include "kiss/logger.h"
 
 #include <vector>
-#include <fstream>
 #include <stdexcept>
-#include <limits>
 
 namespace crpropa {
 
-struct NuclearMassTable {
-	bool initialized;
-	std::vector<double> table;
+// masses of the nuclei [Z * 31 + N], loaded once on first use and published
+// to the other threads with the pointer, after that a lookup is a plain load
+static std::vector<double> nuclearMassValues;
+static const double *nuclearMassTable = 0;
 
-	NuclearMassTable() {
-		initialized = false;
-	}
+static void loadNuclearMassTable() {
+	std::string filename = getDataPath("nuclear_mass.txt");
+	ref_ptr<DataTable> table = DataTable::open(filename);
+	if (!table.valid())
+		throw std::runtime_error("crpropa: could not open file " + filename);
 
-	void init() {
-		std::string filename = getDataPath("nuclear_mass.txt");
-		std::ifstream infile(filename.c_str());
+	// rows: Z, N, mass, nuclei not in the file as unmeasured nuclei
+	std::vector<double> masses(27 * 31);
+	for (int Z = 0; Z <= 26; Z++)
+		for (int N = 0; N <= 30; N++)
+			masses[Z * 31 + N] = (Z + N) * amu - Z * mass_electron;
+	for (size_t i = 0; i < table->size(); i++) {
+		if (table->rowSize(i) < 3)
+			throw std::runtime_error("crpropa: incomplete row in " + filename);
+		const double *row = table->row(i);
+		int Z = int(row[0]);
+		int N = int(row[1]);
+		if ((Z < 0) or (Z > 26) or (N < 0) or (N > 30))
+			continue;
+		masses[Z * 31 + N] = row[2];
+	}
+	nuclearMassValues.swap(masses);
+}
 
-		if (!infile.good())
-			throw std::runtime_error("crpropa: could not open file " + filename);
+static const double *getNuclearMassTable() {
+	const double *table = __atomic_load_n(&nuclearMassTable, __ATOMIC_ACQUIRE);
+	if (table)
+		return table;
 
-		int Z, N;
-		double mass;
-		while (infile.good()) {
-			if (infile.peek() != '#') {
-				infile >> Z >> N >> mass;
-				table.push_back(mass);
+	std::string error;
+#pragma omp critical(NuclearMassTable)
+	{
+		if (!nuclearMassTable) {
+			try {
+				loadNuclearMassTable();
+				__atomic_store_n(&nuclearMassTable, &nuclearMassValues[0], __ATOMIC_RELEASE);
+			} catch (std::exception &e) {
+				error = e.what();
 			}
-			infile.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
 		}
-
-		infile.close();
-		initialized = true;
 	}
-
-	double getMass(std::size_t idx) {
-		if (!initialized) {
-#pragma omp critical(init)
-			init();
-		}
-		return table[idx];
-	}
-};
-
-static NuclearMassTable nuclearMassTable;
+	if (!error.empty())
+		throw std::runtime_error(error);
+	return nuclearMassTable;
+}
 
 double nuclearMass(int id) {
 	int A = massNumber(id);
@@ -68,7 +78,7 @@ double nuclearMass(int A, int Z) {
 		return A * amu - Z * mass_electron;
 	}
 	int N = A - Z;
-	return nuclearMassTable.getMass(Z * 31 + N);
+	return getNuclearMassTable()[Z * 31 + N];
 }
 
 } // namespace crpropa
@@ -1,6 +1,7 @@
 #include "crpropa/ParticleState.h"
 #include "crpropa/Units.h"
 #include "crpropa/Common.h"
+#include "crpropa/Module.h"
 #include "crpropa/ParticleID.h"
 #include "crpropa/ParticleMass.h"
 
@@ -11,7 +12,7 @@
 
 namespace crpropa {
 
-ParticleState::ParticleState(int id, double E, Vector3d pos, Vector3d dir): id(0), energy(0.), position(0.), direction(0.), pmass(0.), charge(0.)
+ParticleState::ParticleState(int id, double E, Vector3d pos, Vector3d dir): id(0), energy(0.), position(0.), direction(0.), pmass(0.), charge(0.), massNo(0), chargeNo(0), pclass(0), nucleus(false)
 {
 	setId(id);
 	setEnergy(E);
@@ -49,9 +50,13 @@ double ParticleState::getRigidity() const {
 
 void ParticleState::setId(int newId) {
 	id = newId;
-	if (isNucleus(id)) {
+	nucleus = crpropa::isNucleus(id);
+	massNo = massNumber(id);
+	chargeNo = chargeNumber(id);
+	pclass = Module::particleClass(id);
+	if (nucleus) {
 		pmass = nuclearMass(id);
-		charge = chargeNumber(id) * eplus;
+		charge = chargeNo * eplus;
 		if (id < 0)
 			charge *= -1; // anti-nucleus
 	} else {
@@ -99,4 +104,26 @@ std::string ParticleState::getDescription() const {
 	return ss.str();
 }
 
+const ParticleState &SharedParticleState::defaultState() {
+	static const ParticleState state;
+	return state;
+}
+
+SharedParticleState &SharedParticleState::operator=(const ParticleState &state) {
+	// reuse the record if this is the only reference to it
+	if (record.valid() && (record->getReferenceCount() == 1))
+		record->state = state;
+	else
+		record = new Record(state);
+	return *this;
+}
+
+ParticleState &SharedParticleState::modify() {
+	if (!record.valid())
+		record = new Record(defaultState());
+	else if (record->getReferenceCount() > 1)
+		record = new Record(record->state);
+	return record->state;
+}
+
 } // namespace crpropa
@@ -0,0 +1,92 @@
+#include "crpropa/PerfCounters.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cstring>
+#endif
+
+namespace crpropa {
+
+namespace {
+
+#ifdef __linux__
+// group of the counters of one thread, the first one leads
+__thread int counterFds[PerfCounters::NumEvents];
+__thread int counterState = 0; ///< 0: not opened, 1: open, -1: not available
+
+bool openCounters() {
+	const unsigned long long configs[PerfCounters::NumEvents] = {
+			PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CPU_CYCLES,
+			PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES };
+	int leader = -1;
+	for (int i = 0; i < PerfCounters::NumEvents; i++) {
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = configs[i];
+		attr.disabled = (leader < 0) ? 1 : 0;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_GROUP;
+		// this thread on any cpu
+		int fd = syscall(__NR_perf_event_open, &attr, 0, -1, leader, 0);
+		if (fd < 0) {
+			for (int k = 0; k < i; k++)
+				close(counterFds[k]);
+			return false;
+		}
+		counterFds[i] = fd;
+		if (leader < 0)
+			leader = fd;
+	}
+	ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	return true;
+}
+#endif
+
+} // namespace
+
+bool PerfCounters::isAvailable() {
+	unsigned long long values[NumEvents];
+	return read(values);
+}
+
+bool PerfCounters::read(unsigned long long values[NumEvents]) {
+#ifdef __linux__
+	if (counterState == 0)
+		counterState = openCounters() ? 1 : -1;
+	if (counterState < 0)
+		return false;
+	// number of counters followed by their values
+	unsigned long long group[NumEvents + 1];
+	if (::read(counterFds[0], group, sizeof(group)) != sizeof(group))
+		return false;
+	for (int i = 0; i < NumEvents; i++)
+		values[i] = group[i + 1];
+	return true;
+#else
+	return false;
+#endif
+}
+
+std::string PerfCounters::getName(Event event) {
+	switch (event) {
+	case Instructions:
+		return "instructions";
+	case Cycles:
+		return "cycles";
+	case CacheMisses:
+		return "cache misses";
+	case BranchMisses:
+		return "branch misses";
+	default:
+		return "unknown";
+	}
+}
+
+} // namespace crpropa
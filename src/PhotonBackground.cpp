@@ -1,27 +1,233 @@
 #include "crpropa/PhotonBackground.h"
+#include "crpropa/PhotonFieldRates.h"
 #include "crpropa/Common.h"
+#include "crpropa/Units.h"
+
+#include "kiss/path.h"
 
 #include <vector>
 #include <fstream>
 #include <stdexcept>
 #include <limits>
 #include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <map>
+#include <stdint.h>
 
 namespace crpropa {
 
-// Class to handle global evolution of IRB models (cf. CRPropa3-data/calc_scaling.py)
-struct PhotonFieldScaling {
-	bool initialized;
-	std::string name;
-	std::vector<double> tab_z;
-	std::vector<double> tab_s;
+// version of the generated tables, part of the hash
+static const char *customTableVersion = "CustomPhotonField 1";
+
+CustomPhotonField::CustomPhotonField(const std::string &name,
+		const std::vector<double> &energies, const std::vector<double> &densities) :
+		name(name), tabEnergy(energies), tabDensity(densities) {
+	if ((energies.size() < 2) || (energies.size() != densities.size()))
+		throw std::runtime_error("CustomPhotonField: at least two energies and densities needed");
+	for (size_t i = 0; i < energies.size(); i++) {
+		if (!(energies[i] > 0) || ((i > 0) && !(energies[i] > energies[i - 1])))
+			throw std::runtime_error("CustomPhotonField: the energies must be positive and ascending");
+		if (!(densities[i] >= 0))
+			throw std::runtime_error("CustomPhotonField: negative density");
+	}
+	const char *path = getenv("CRPROPA_CACHE_PATH");
+	cacheDirectory = path ? path : ".";
+}
+
+ref_ptr<CustomPhotonField> CustomPhotonField::load(const std::string &name,
+		const std::string &filename) {
+	std::ifstream infile(filename.c_str());
+	if (!infile.good())
+		throw std::runtime_error("CustomPhotonField: could not open file " + filename);
+	std::vector<double> energies, densities;
+	double e, n;
+	while (infile.good()) {
+		if (infile.peek() != '#') {
+			infile >> e >> n;
+			if (infile) {
+				energies.push_back(e * eV);
+				densities.push_back(n / (cm * cm * cm * eV));
+			}
+		}
+		infile.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+	}
+	return new CustomPhotonField(name, energies, densities);
+}
+
+std::string CustomPhotonField::getName() const {
+	return name;
+}
+
+double CustomPhotonField::getDensity(double energy) const {
+	if ((energy < tabEnergy.front()) || (energy > tabEnergy.back()))
+		return 0;
+	size_t i = std::upper_bound(tabEnergy.begin(), tabEnergy.end(), energy) - tabEnergy.begin();
+	if (i == tabEnergy.size())
+		return tabDensity.back();
+	double n0 = tabDensity[i - 1], n1 = tabDensity[i];
+	double f = log(energy / tabEnergy[i - 1]) / log(tabEnergy[i] / tabEnergy[i - 1]);
+	if ((n0 > 0) && (n1 > 0))
+		return n0 * pow(n1 / n0, f);
+	return n0 + f * (n1 - n0);
+}
+
+const std::vector<double> &CustomPhotonField::getEnergies() const {
+	return tabEnergy;
+}
+
+const std::vector<double> &CustomPhotonField::getDensities() const {
+	return tabDensity;
+}
+
+void CustomPhotonField::setRedshiftScaling(const std::vector<double> &redshifts,
+		const std::vector<double> &scalings) {
+	if (redshifts.size() != scalings.size())
+		throw std::runtime_error("CustomPhotonField: redshifts and scalings of unequal size");
+	for (size_t i = 1; i < redshifts.size(); i++)
+		if (!(redshifts[i] > redshifts[i - 1]))
+			throw std::runtime_error("CustomPhotonField: the redshifts must be ascending");
+	tabZ = redshifts;
+	tabS = scalings;
+}
+
+const std::vector<double> &CustomPhotonField::getScalingRedshifts() const {
+	return tabZ;
+}
+
+const std::vector<double> &CustomPhotonField::getScalings() const {
+	return tabS;
+}
+
+void CustomPhotonField::setCacheDirectory(const std::string &directory) {
+	cacheDirectory = directory;
+}
+
+std::string CustomPhotonField::getCacheDirectory() const {
+	return cacheDirectory;
+}
+
+// 64 bit FNV-1a
+static void fnv1a(uint64_t &hash, const void *data, size_t size) {
+	const unsigned char *p = (const unsigned char *) data;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= p[i];
+		hash *= 1099511628211ULL;
+	}
+}
+
+std::string CustomPhotonField::getHash() const {
+	uint64_t hash = 14695981039346656037ULL;
+	fnv1a(hash, customTableVersion, strlen(customTableVersion));
+	fnv1a(hash, name.data(), name.size());
+	const std::vector<double> *tables[4] = {&tabEnergy, &tabDensity, &tabZ, &tabS};
+	for (int i = 0; i < 4; i++) {
+		uint64_t n = tables[i]->size();
+		fnv1a(hash, &n, sizeof(n));
+		if (n > 0)
+			fnv1a(hash, &(*tables[i])[0], n * sizeof(double));
+	}
+	char s[17];
+	std::sprintf(s, "%016llx", (unsigned long long) hash);
+	return s;
+}
+
+static bool fileExists(const std::string &filename) {
+	std::ifstream f(filename.c_str());
+	return f.good();
+}
+
+std::string CustomPhotonField::getTable(const std::string &module,
+		const std::string &kind) const {
+	// the name in the file name without path separators and spaces
+	std::string fileName = name;
+	for (size_t i = 0; i < fileName.size(); i++)
+		if (!isalnum((unsigned char) fileName[i]) && (fileName[i] != '-'))
+			fileName[i] = '_';
+	std::string prefix = concat_path(cacheDirectory, module + "_");
+	std::string suffix = "_" + fileName + "_" + getHash() + ".txt";
+	std::string rate = prefix + "rate" + suffix;
+	std::string cdf = prefix + "cdf" + suffix;
+
+	std::string error;
+#pragma omp critical(CustomPhotonField)
+	{
+	try {
+		if (module == "EMPairProduction") {
+			if (!fileExists(rate) || !fileExists(cdf))
+				writeEMPairProductionTables(*this, rate, cdf);
+		} else if (module == "EMInverseComptonScattering") {
+			if (!fileExists(rate) || !fileExists(cdf))
+				writeEMInverseComptonScatteringTables(*this, rate, cdf);
+		} else if ((module == "PhotoPionProduction") && (kind == "rate")) {
+			if (!fileExists(rate))
+				writePhotoPionProductionTable(*this, rate);
+		} else {
+			error = "CustomPhotonField: no " + kind + " tables of " + module
+					+ " for custom photon fields";
+		}
+	} catch (std::exception &e) {
+		error = e.what();
+	}
+	}
+	if (!error.empty())
+		throw std::runtime_error(error);
+	if ((kind != "rate") && (kind != "cdf"))
+		throw std::runtime_error("CustomPhotonField: unknown table kind " + kind);
+	return (kind == "rate") ? rate : cdf;
+}
+
+// the registered custom fields, of the values after URB_Protheroe96
+static std::vector<ref_ptr<CustomPhotonField> > customPhotonFields;
 
-	PhotonFieldScaling(std::string filename) {
-		name = filename;
-		initialized = false;
+PhotonField registerPhotonField(ref_ptr<CustomPhotonField> field) {
+	if (!field.valid())
+		throw std::runtime_error("PhotonField: no custom field to register");
+	size_t i;
+#pragma omp critical(customPhotonFields)
+	{
+		for (i = 0; i < customPhotonFields.size(); i++)
+			if (customPhotonFields[i] == field)
+				break;
+		if (i == customPhotonFields.size())
+			customPhotonFields.push_back(field);
 	}
+	return PhotonField(URB_Protheroe96 + 1 + i);
+}
+
+ref_ptr<CustomPhotonField> getCustomPhotonField(PhotonField photonField) {
+	ref_ptr<CustomPhotonField> field;
+	long i = long(photonField) - URB_Protheroe96 - 1;
+#pragma omp critical(customPhotonFields)
+	if ((i >= 0) && (i < long(customPhotonFields.size())))
+		field = customPhotonFields[i];
+	return field;
+}
+
+std::string photonFieldTable(PhotonField photonField, const std::string &module,
+		const std::string &kind) {
+	ref_ptr<CustomPhotonField> custom = getCustomPhotonField(photonField);
+	if (custom.valid())
+		return custom->getTable(module, kind);
+	return getDataPath(module + "/" + kind + "_" + photonFieldName(photonField) + ".txt");
+}
+
+PhotonFieldScaling::PhotonFieldScaling(PhotonField field) :
+		photonField(field), uniform(false), dz(0) {
+	if ((field == CMB) or (field == URB_Protheroe96))
+		return; // analytic scaling
 
-	void init() {
+	ref_ptr<CustomPhotonField> custom = getCustomPhotonField(field);
+	if (custom.valid()) {
+		// constant without a scaling table
+		if (custom->getScalingRedshifts().size() < 2)
+			return;
+		tabZ = custom->getScalingRedshifts();
+		tabS = custom->getScalings();
+	} else {
+		std::string name = photonFieldName(field);
 		std::string path = getDataPath("Scaling/scaling_" + name + ".txt");
 		std::ifstream infile(path.c_str());
 
@@ -33,66 +239,80 @@ struct PhotonFieldScaling {
 		while (infile.good()) {
 			if (infile.peek() != '#') {
 				infile >> z >> s;
-				tab_z.push_back(z);
-				tab_s.push_back(s);
+				tabZ.push_back(z);
+				tabS.push_back(s);
 			}
 			infile.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
 		}
-
 		infile.close();
-		initialized = true;
+		if (tabZ.size() < 2)
+			throw std::runtime_error("crpropa: incomplete file scaling_" + name);
 	}
 
-	double scalingFactor(double z) {
-		if (!initialized) 
-#pragma omp critical(init)
-			init();
-		if (z > tab_z.back())
-			return 0;  // zero photon background beyond maximum tabulated value
-		return interpolate(z, tab_z, tab_s);
-	}
-};
+	// equidistant redshifts within rounding of the text file
+	dz = (tabZ.back() - tabZ.front()) / (tabZ.size() - 1);
+	uniform = (dz > 0);
+	for (size_t i = 1; i < tabZ.size(); i++)
+		if (std::fabs(tabZ[i] - tabZ[i - 1] - dz) > 1e-6 * dz)
+			uniform = false;
+}
 
-static PhotonFieldScaling scalingKneiske04("IRB_Kneiske04");
-static PhotonFieldScaling scalingStecker05("IRB_Stecker05");
-static PhotonFieldScaling scalingFranceschini08("IRB_Franceschini08");
-static PhotonFieldScaling scalingFinke10("IRB_Finke10");
-static PhotonFieldScaling scalingDominguez11("IRB_Dominguez11");
-static PhotonFieldScaling scalingGilmore12("IRB_Gilmore12");
-static PhotonFieldScaling scalingStecker16_upper("IRB_Stecker16_upper");
-static PhotonFieldScaling scalingStecker16_lower("IRB_Stecker16_lower");
+PhotonField PhotonFieldScaling::getPhotonField() const {
+	return photonField;
+}
 
-double photonFieldScaling(PhotonField photonField, double z) {
-	switch (photonField) {
-	case CMB:
-		return 1;  // constant comoving photon number density
-	case IRB:
-	case IRB_Kneiske04:
-		return scalingKneiske04.scalingFactor(z);
-	case IRB_Stecker05:
-		return scalingStecker05.scalingFactor(z);
-	case IRB_Franceschini08:
-		return scalingFranceschini08.scalingFactor(z);
-	case IRB_Finke10:
-		return scalingFinke10.scalingFactor(z);
-	case IRB_Dominguez11:
-		return scalingDominguez11.scalingFactor(z);
-	case IRB_Gilmore12:
-		return scalingGilmore12.scalingFactor(z);
-	case IRB_Stecker16_upper:
-		return scalingStecker16_upper.scalingFactor(z);
-	case IRB_Stecker16_lower:
-		return scalingStecker16_lower.scalingFactor(z);
-	case URB_Protheroe96:
+double PhotonFieldScaling::scalingFactor(double z) const {
+	if (tabZ.empty()) {
+		if (photonField != URB_Protheroe96)
+			return 1;  // constant comoving photon number density: CMB, custom fields
 		if (z < 0.8)
 			return 1;
 		if (z < 6)
 			return pow((1 + 0.8) / (1 + z), 4);
 		else
 			return 0;
-	default:
+	}
+
+	if (z > tabZ.back())
+		return 0;  // zero photon background beyond maximum tabulated value
+	if (!uniform)
+		return interpolate(z, tabZ, tabS);
+
+	// cell of z as from the binary search of interpolate
+	if (z < tabZ.front())
+		return tabS.front();
+	size_t i = std::min(size_t((z - tabZ.front()) / dz), tabZ.size() - 1);
+	while ((i > 0) and (tabZ[i] > z))
+		i--;
+	while ((i + 1 < tabZ.size()) and (tabZ[i + 1] <= z))
+		i++;
+	if (i + 1 == tabZ.size())
+		return tabS.back();
+	return tabS[i] + (z - tabZ[i]) * (tabS[i + 1] - tabS[i]) / (tabZ[i + 1] - tabZ[i]);
+}
+
+double photonFieldScaling(PhotonField photonField, double z) {
+	static std::map<int, ref_ptr<PhotonFieldScaling> > scalings;
+	if ((photonField < CMB) or ((photonField > URB_Protheroe96)
+			and !getCustomPhotonField(photonField).valid()))
 		throw std::runtime_error("PhotonField: unknown photon background");
+
+	ref_ptr<PhotonFieldScaling> scaling;
+	std::string error;
+#pragma omp critical(photonFieldScaling)
+	{
+		if (!scalings[photonField].valid()) {
+			try {
+				scalings[photonField] = new PhotonFieldScaling(photonField);
+			} catch (std::exception &e) {
+				error = e.what();
+			}
+		}
+		scaling = scalings[photonField];
 	}
+	if (!error.empty())
+		throw std::runtime_error(error);
+	return scaling->scalingFactor(z);
 }
 
 std::string photonFieldName(PhotonField photonField) {
@@ -118,8 +338,12 @@ std::string photonFieldName(PhotonField photonField) {
 		return "IRB_Stecker16_lower";
 	case URB_Protheroe96:
 		return "URB_Protheroe96";
-	default:
-		throw std::runtime_error("PhotonField: unknown photon background");
+	default: {
+		ref_ptr<CustomPhotonField> custom = getCustomPhotonField(photonField);
+		if (!custom.valid())
+			throw std::runtime_error("PhotonField: unknown photon background");
+		return custom->getName();
+	}
 	}
 }
 
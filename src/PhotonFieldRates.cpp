@@ -0,0 +1,296 @@
+#include "crpropa/PhotonFieldRates.h"
+#include "crpropa/Units.h"
+#include "crpropa/module/PhotoPionProduction.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+namespace crpropa {
+
+static const double mec2 = mass_electron * c_squared;
+static const double sigmaThomson = 6.6524587158e-29 * meter * meter;
+
+// table steps in log10, as the data files
+static const double energyStep = 0.05;
+static const double sStep = 0.1;
+static const double lorentzStep = 0.02;
+
+/** Cross section of an interaction as a function of s_kin = s - m^2 */
+class CrossSection {
+public:
+	virtual ~CrossSection() {
+	}
+	virtual double sigma(double sKin) const = 0;
+	/** Smallest s_kin of a non zero cross section */
+	virtual double threshold() const = 0;
+};
+
+/** Breit-Wheeler pair production, s_kin = s */
+class PairProductionCrossSection: public CrossSection {
+public:
+	double sigma(double s) const {
+		if (s <= 4 * mec2 * mec2)
+			return 0;
+		double b = sqrt(1 - 4 * mec2 * mec2 / s);
+		return sigmaThomson * 3 / 16 * (1 - b * b)
+				* ((3 - b * b * b * b) * log((1 + b) / (1 - b)) - 2 * b * (2 - b * b));
+	}
+	double threshold() const {
+		return 4 * mec2 * mec2;
+	}
+};
+
+/** Klein-Nishina cross section */
+class InverseComptonCrossSection: public CrossSection {
+public:
+	double sigma(double sKin) const {
+		double s = sKin + mec2 * mec2;
+		double b = sKin / (s + mec2 * mec2);
+		if (b < 1e-3)
+			return sigmaThomson * (1 - 2 * b); // Thomson limit, cancellations below
+		double A = 2 / b / (1 + b) * (2 + 2 * b - b * b - 2 * b * b * b);
+		double B = (2 - 3 * b * b - b * b * b) / (b * b) * log((1 + b) / (1 - b));
+		return sigmaThomson * 3 / 8 * mec2 * mec2 / s / b * (A - B);
+	}
+	double threshold() const {
+		return 0;
+	}
+};
+
+/** SOPHIA cross section of a nucleon, tabulated in the photon energy in its rest frame */
+class PhotoPionCrossSection: public CrossSection {
+	double mc2;
+	double lnEpsMin, dlnEps;
+	std::vector<double> tabSigma;
+public:
+	PhotoPionCrossSection(bool onProton) {
+		mc2 = (onProton ? mass_proton : mass_neutron) * c_squared;
+		// from the threshold of SOPHIA, s = 1.1646 GeV^2, to 10^9 GeV, constant above
+		double epsMin = (1.1646 * GeV * GeV - mc2 * mc2) / (2 * mc2);
+		lnEpsMin = log(epsMin);
+		dlnEps = 0.002 * log(10.);
+		size_t n = size_t(log(1e9 * GeV / epsMin) / dlnEps) + 1;
+		tabSigma.resize(n);
+		// serially, SOPHIA may not be thread safe
+		for (size_t i = 0; i < n; i++)
+			tabSigma[i] = PhotoPionProduction::nucleonCrossSection(exp(lnEpsMin + i * dlnEps), onProton);
+	}
+	double sigma(double sKin) const {
+		double u = (log(sKin / (2 * mc2)) - lnEpsMin) / dlnEps;
+		if (u < 0)
+			return 0;
+		if (u >= tabSigma.size() - 1)
+			return tabSigma.back();
+		size_t i = size_t(u);
+		return tabSigma[i] + (u - i) * (tabSigma[i + 1] - tabSigma[i]);
+	}
+	double threshold() const {
+		return 2 * mc2 * exp(lnEpsMin);
+	}
+};
+
+/** F(x) = int_x^inf deps n(eps) / eps^2 of a photon field, tabulated in log(x) */
+class FieldIntegral {
+	double lnMin, dlnx;
+	std::vector<double> tabF;
+public:
+	FieldIntegral(const CustomPhotonField &field, size_t n = 2000) {
+		const std::vector<double> &e = field.getEnergies();
+		lnMin = log(e.front());
+		dlnx = log(e.back() / e.front()) / (n - 1);
+		tabF.assign(n, 0);
+		// trapezoidal rule in log(eps) of n(eps) / eps, from the top
+		double g1 = field.getDensity(e.back()) / e.back();
+		for (size_t i = n - 1; i-- > 0;) {
+			double x = std::max(e.front(), std::min(e.back(), exp(lnMin + i * dlnx)));
+			double g0 = field.getDensity(x) / x;
+			tabF[i] = tabF[i + 1] + 0.5 * (g0 + g1) * dlnx;
+			g1 = g0;
+		}
+	}
+	double operator()(double x) const {
+		double u = (log(x) - lnMin) / dlnx;
+		if (u <= 0)
+			return tabF.front();
+		if (u >= tabF.size() - 1)
+			return 0;
+		size_t i = size_t(u);
+		return tabF[i] + (u - i) * (tabF[i + 1] - tabF[i]);
+	}
+	double minimumEnergy() const {
+		return exp(lnMin);
+	}
+	double maximumEnergy() const {
+		return exp(lnMin + (tabF.size() - 1) * dlnx);
+	}
+};
+
+/**
+ Cumulative rates [1/m] of a particle of energy E up to the ascending s_kin
+ values, integrated from sLow with the midpoint rule in log(s_kin).
+ */
+static void cumulativeRates(const CrossSection &xs, const FieldIntegral &F,
+		double E, double sLow, const std::vector<double> &sKin,
+		std::vector<double> &rates) {
+	const size_t steps = 16; // per interval
+	rates.assign(sKin.size(), 0);
+	double sMax = 4 * E * F.maximumEnergy();
+	double lo = std::max(sLow, xs.threshold());
+	double sum = 0;
+	for (size_t j = 0; j < sKin.size(); j++) {
+		double hi = std::min(sKin[j], sMax);
+		if (hi > lo) {
+			double dl = log(hi / lo) / steps;
+			for (size_t k = 0; k < steps; k++) {
+				double s = lo * exp((k + 0.5) * dl);
+				sum += s * s * xs.sigma(s) * F(s / (4 * E)) * dl;
+			}
+			lo = hi;
+		}
+		rates[j] = sum / (8 * E * E);
+	}
+}
+
+/** Total rate [1/m], from sLow to the largest s_kin of the field */
+static double totalRate(const CrossSection &xs, const FieldIntegral &F,
+		double E, double sLow) {
+	double lo = std::max(sLow, xs.threshold());
+	double sMax = 4 * E * F.maximumEnergy();
+	if (!(sMax > lo))
+		return 0;
+	// nodes every 0.05 in log10
+	std::vector<double> nodes;
+	for (double s = lo * pow(10, 0.05); s < sMax; s *= pow(10, 0.05))
+		nodes.push_back(s);
+	nodes.push_back(sMax);
+	std::vector<double> rates;
+	cumulativeRates(xs, F, E, lo, nodes, rates);
+	return rates.back();
+}
+
+/** Write the text of a table atomically */
+static void writeTable(const std::string &filename, const std::string &text) {
+	std::string tmp = filename + ".tmp";
+	std::ofstream out(tmp.c_str());
+	out << text;
+	out.close();
+	if (!out || (std::rename(tmp.c_str(), filename.c_str()) != 0)) {
+		std::remove(tmp.c_str());
+		throw std::runtime_error("PhotonFieldRates: could not write file " + filename);
+	}
+}
+
+/** Equidistant values in log10 from a to b including both, in units of step */
+static std::vector<double> logSteps(double lgMin, double lgMax, double step) {
+	std::vector<double> v;
+	size_t n = size_t(floor((lgMax - lgMin) / step + 1e-9)) + 1;
+	for (size_t i = 0; i < n; i++)
+		v.push_back(lgMin + i * step);
+	return v;
+}
+
+/**
+ Rate and cumulative rate tables of an electromagnetic interaction.
+ binCenters: the s_kin values are the centers of the bins of the cumulative
+ rates (EMInverseComptonScattering) instead of their upper edges.
+ */
+static void writeEMTables(const CrossSection &xs, const CustomPhotonField &field,
+		const std::string &module, double lgSMin, bool binCenters,
+		const std::string &rateFile, const std::string &cdfFile) {
+	FieldIntegral F(field);
+	std::vector<double> lgE = logSteps(9, 23, energyStep);
+	double lgSMax = log10(4 * pow(10, lgE.back()) * eV * F.maximumEnergy() / (eV * eV)) + sStep;
+	std::vector<double> lgS = logSteps(floor(lgSMin / sStep) * sStep, lgSMax, sStep);
+	std::vector<double> sEdges(lgS.size());
+	for (size_t j = 0; j < lgS.size(); j++)
+		sEdges[j] = pow(10, lgS[j] + (binCenters ? 0.5 * sStep : 0)) * eV * eV;
+	double sLow = binCenters ? sEdges.front() / pow(10, sStep) : sEdges.front();
+
+	// each energy independently
+	std::vector<double> rate(lgE.size());
+	std::vector<std::vector<double> > cdf(lgE.size());
+#pragma omp parallel for schedule(dynamic)
+	for (int i = 0; i < int(lgE.size()); i++) {
+		cumulativeRates(xs, F, pow(10, lgE[i]) * eV, sLow, sEdges, cdf[i]);
+		rate[i] = cdf[i].back(); // the s_kin cover the field
+	}
+
+	char line[64];
+	std::string text = "# " + module + " rate of the custom photon field " + field.getName()
+			+ "\n# log10(E/eV), 1/lambda [1/Mpc]\n";
+	for (size_t i = 0; i < lgE.size(); i++) {
+		std::sprintf(line, "%.4f %.10g\n", lgE[i], rate[i] * Mpc);
+		text += line;
+	}
+	writeTable(rateFile, text);
+
+	// rows above the threshold: the first row of a sampled energy has to have a rate
+	text = "# " + module + " cumulative rate of the custom photon field " + field.getName()
+			+ "\n# first row: log10(s_kin/eV^2), others: log10(E/eV), cumulative rates [1/Mpc]\n0";
+	for (size_t j = 0; j < lgS.size(); j++) {
+		std::sprintf(line, " %.4f", lgS[j]);
+		text += line;
+	}
+	text += "\n";
+	size_t first = 0;
+	while ((first < lgE.size()) && !(cdf[first].back() > 0))
+		first++;
+	if (first == lgE.size())
+		throw std::runtime_error("PhotonFieldRates: no " + module + " in the field " + field.getName());
+	for (size_t i = first; i < lgE.size(); i++) {
+		std::sprintf(line, "%.4f", lgE[i]);
+		text += line;
+		for (size_t j = 0; j < lgS.size(); j++) {
+			std::sprintf(line, " %.10g", cdf[i][j] * Mpc);
+			text += line;
+		}
+		text += "\n";
+	}
+	writeTable(cdfFile, text);
+}
+
+void writeEMPairProductionTables(const CustomPhotonField &field,
+		const std::string &rateFile, const std::string &cdfFile) {
+	PairProductionCrossSection xs;
+	// the first s_kin below the threshold, as EMPairProduction expects
+	double lgSMin = log10(xs.threshold() / (eV * eV)) - sStep;
+	writeEMTables(xs, field, "EMPairProduction", lgSMin, false, rateFile, cdfFile);
+}
+
+void writeEMInverseComptonScatteringTables(const CustomPhotonField &field,
+		const std::string &rateFile, const std::string &cdfFile) {
+	InverseComptonCrossSection xs;
+	// three decades below the smallest s_kin of the lowest energy and photon energy
+	FieldIntegral F(field);
+	double lgSMin = log10(4 * 1e9 * eV * F.minimumEnergy() / (eV * eV)) - 3;
+	writeEMTables(xs, field, "EMInverseComptonScattering", lgSMin, true, rateFile, cdfFile);
+}
+
+void writePhotoPionProductionTable(const CustomPhotonField &field,
+		const std::string &rateFile) {
+	PhotoPionCrossSection proton(true), neutron(false);
+	FieldIntegral F(field);
+	std::vector<double> lgGamma = logSteps(6, 16, lorentzStep);
+	std::vector<double> p(lgGamma.size()), n(lgGamma.size());
+#pragma omp parallel for schedule(dynamic)
+	for (int i = 0; i < int(lgGamma.size()); i++) {
+		double gamma = pow(10, lgGamma[i]);
+		p[i] = totalRate(proton, F, gamma * mass_proton * c_squared, 0);
+		n[i] = totalRate(neutron, F, gamma * mass_neutron * c_squared, 0);
+	}
+
+	char line[64];
+	std::string text = "# PhotoPionProduction rate of the custom photon field " + field.getName()
+			+ "\n# log10(gamma), 1/lambda proton, 1/lambda neutron [1/Mpc]\n";
+	for (size_t i = 0; i < lgGamma.size(); i++) {
+		std::sprintf(line, "%.4f %.10g %.10g\n", lgGamma[i], p[i] * Mpc, n[i] * Mpc);
+		text += line;
+	}
+	writeTable(rateFile, text);
+}
+
+} // namespace crpropa
@@ -13,51 +13,255 @@
 
 #include <fstream>
 #include <cstdio>
+#include <cstdlib>
+#include <map>
 #include <stdexcept>
 #include <iostream>
 #include <iomanip>
 #include <algorithm>
 #include <limits>
 #include <cmath>
+#include <cstring>
+#include <sstream>
+#include <stdint.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 namespace crpropa {
 
+PhotonInputReader::PhotonInputReader(const std::string &filename,
+		size_t chunkSize) :
+		filename(filename), chunkSize(std::max(chunkSize, size_t(1))),
+		format(0), size(0) {
+	infile.open(filename.c_str(), std::ios::binary);
+	if (!infile.good())
+		throw std::runtime_error(
+				"PhotonInputReader: could not open file " + filename);
+	infile.seekg(0, std::ios::end);
+	size = infile.tellg();
+	infile.seekg(0, std::ios::beg);
+
+	char magic[sizeof(PhotonOutput1DMagic)];
+	infile.read(magic, sizeof(magic));
+	if (infile && (memcmp(magic, PhotonOutput1DMagic, sizeof(magic)) == 0)) {
+		format = 2;
+		return;
+	}
+	infile.clear();
+	infile.seekg(0, std::ios::beg);
+
+	std::string line;
+	std::getline(infile, line);
+	if (line == "#ID	E	D	pID	pE	iID	iE	iD") {
+		format = 0;
+	} else if (line == "#	D	ID	E	ID0	E0	ID1	E1	X1") {
+		format = 1;
+	} else {
+		throw std::runtime_error("PhotonInputReader: Wrong header of input file " + filename + ". Use PhotonOutput1D or Event1D with additional columns enabled.");
+	}
+}
+
+// parse the next number of a line, false if there is none
+static bool parseField(char *&c, double &x) {
+	char *end;
+	x = strtod(c, &end);
+	if (end == c)
+		return false;
+	c = end;
+	return true;
+}
+
+static bool parseField(char *&c, int32_t &x) {
+	char *end;
+	x = strtol(c, &end, 10);
+	if (end == c)
+		return false;
+	c = end;
+	return true;
+}
+
+bool PhotonInputReader::read(std::vector<PhotonRecord1D> &photons) {
+	photons.clear();
+	if (format == 2) {
+		photons.resize(chunkSize);
+		infile.read((char*) &photons[0], chunkSize * sizeof(PhotonRecord1D));
+		photons.resize(infile.gcount() / sizeof(PhotonRecord1D));
+		return !photons.empty();
+	}
+
+	std::string line;
+	while ((photons.size() < chunkSize) && std::getline(infile, line)) {
+		if (line.empty() || (line[0] == '#'))
+			continue;
+		PhotonRecord1D p;
+		p.reserved = 0;
+		char *c = &line[0];
+		bool ok;
+		if (format == 0) {
+			ok = parseField(c, p.id) && parseField(c, p.energy)
+					&& parseField(c, p.distance) && parseField(c, p.parentId)
+					&& parseField(c, p.parentEnergy) && parseField(c, p.sourceId)
+					&& parseField(c, p.sourceEnergy)
+					&& parseField(c, p.sourceDistance);
+		} else {
+			ok = parseField(c, p.sourceDistance) && parseField(c, p.id)
+					&& parseField(c, p.energy) && parseField(c, p.sourceId)
+					&& parseField(c, p.sourceEnergy) && parseField(c, p.parentId)
+					&& parseField(c, p.parentEnergy) && parseField(c, p.distance);
+		}
+		if (ok)
+			photons.push_back(p);
+	}
+	return !photons.empty();
+}
+
+bool PhotonInputReader::isBinary() const {
+	return format == 2;
+}
+
+size_t PhotonInputReader::getChunkSize() const {
+	return chunkSize;
+}
+
+size_t PhotonInputReader::getPosition() {
+	if (!infile.good())
+		return size;
+	return infile.tellg();
+}
+
+size_t PhotonInputReader::getSize() const {
+	return size;
+}
+
+/*
+ Processes the photons of the reader chunk by chunk: begin(chunk), then
+ process(chunk, i) for each photon in parallel and finish(chunk). One thread reads the next chunk
+ while the others start on the current one.
+ */
+template<class Processor>
+static void processPhotonChunks(PhotonInputReader &reader,
+		Processor &processor, int nThreads, ProgressBar *progressbar) {
+	std::vector<PhotonRecord1D> chunk, next;
+	bool more = reader.read(chunk);
+	while (more) {
+		bool nextMore = false;
+		const long n = chunk.size();
+		processor.begin(chunk);
+#pragma omp parallel num_threads(nThreads)
+		{
+#pragma omp single nowait
+			nextMore = reader.read(next);
+
+#pragma omp for schedule(dynamic, 16)
+			for (long i = 0; i < n; i++)
+				processor.process(chunk, i);
+		}
+		processor.finish(chunk);
+		if (progressbar)
+			progressbar->setPosition(reader.getPosition());
+		chunk.swap(next);
+		more = nextMore;
+	}
+}
+
+static int photonThreads(int nThreads) {
+#ifdef _OPENMP
+	if (nThreads <= 0)
+		nThreads = omp_get_max_threads();
+#else
+	nThreads = 1;
+#endif
+	return nThreads;
+}
+
+// EleCa propagation of the photons of a chunk, the tables are shared
+class _ElecaChunk {
+protected:
+	const eleca::Propagation &propagation;
+	bool dropParticlesBelowEnergyThreshold;
+	std::vector<std::vector<eleca::Particle> > particlesAtGround;
+public:
+	_ElecaChunk(const eleca::Propagation &propagation,
+			bool dropParticlesBelowEnergyThreshold) :
+			propagation(propagation),
+			dropParticlesBelowEnergyThreshold(dropParticlesBelowEnergyThreshold) {
+	}
+
+	void begin(const std::vector<PhotonRecord1D> &chunk) {
+		particlesAtGround.resize(chunk.size());
+	}
+
+	void process(const std::vector<PhotonRecord1D> &chunk, long i) {
+		const PhotonRecord1D &p = chunk[i];
+		std::vector<eleca::Particle> &ParticleAtGround = particlesAtGround[i];
+		ParticleAtGround.clear();
+
+		double z = eleca::Mpc2z(p.distance);
+		eleca::Particle p0(p.id, p.energy * 1e18, z);
+		std::vector<eleca::Particle> ParticleAtMatrix;
+		ParticleAtMatrix.push_back(p0);
+
+		while (ParticleAtMatrix.size() > 0) {
+			eleca::Particle p1 = ParticleAtMatrix.back();
+			ParticleAtMatrix.pop_back();
+
+			if (p1.IsGood()) {
+				propagation.Propagate(p1, ParticleAtMatrix, ParticleAtGround,
+						dropParticlesBelowEnergyThreshold);
+			}
+		}
+	}
+};
+
+// writes the photons at the observer in input order
+class _ElecaOutputChunk: public _ElecaChunk {
+	std::ofstream &output;
+public:
+	_ElecaOutputChunk(const eleca::Propagation &propagation,
+			std::ofstream &output) :
+			_ElecaChunk(propagation, true), output(output) {
+	}
+
+	void finish(const std::vector<PhotonRecord1D> &chunk) {
+		for (size_t j = 0; j < chunk.size(); j++) {
+			std::vector<eleca::Particle> &ParticleAtGround = particlesAtGround[j];
+			for (size_t i = 0; i < ParticleAtGround.size(); ++i) {
+				eleca::Particle &p = ParticleAtGround[i];
+				if (p.GetType() != 22)
+					continue;
+				char buffer[256];
+				size_t bufferPos = 0;
+				bufferPos += std::sprintf(buffer + bufferPos, "%i\t", p.GetType());
+				bufferPos += std::sprintf(buffer + bufferPos, "%.4E\t", p.GetEnergy() / 1E18 );
+				bufferPos += std::sprintf(buffer + bufferPos, "%i\t", chunk[j].sourceId);
+				bufferPos += std::sprintf(buffer + bufferPos, "%.4E\t", chunk[j].sourceEnergy );
+				bufferPos += std::sprintf(buffer + bufferPos, "%i", p.Generation());
+				bufferPos += std::sprintf(buffer + bufferPos, "\n");
+
+				output.write(buffer, bufferPos);
+			}
+		}
+	}
+};
+
 void ElecaPropagation(
 		const std::string &inputfile,
 		const std::string &outputfile,
 		bool showProgress,
 		double lowerEnergyThreshold,
 		double magneticFieldStrength,
-		const std::string &background) {
+		const std::string &background,
+		int nThreads) {
 
-	std::ifstream infile(inputfile.c_str());
-	std::streampos startPosition = infile.tellg();
+	PhotonInputReader reader(inputfile);
 
-	infile.seekg(0, std::ios::end);
-	std::streampos endPosition = infile.tellg();
-	infile.seekg(startPosition);
-
-
-	ProgressBar progressbar(endPosition);
+	ProgressBar progressbar(reader.getSize());
 	if (showProgress) {
 		progressbar.start("Run ElecaPropagation");
 	}
 
-	if (!infile.good())
-		throw std::runtime_error(
-				"ElecaPropagation: could not open file " + inputfile);
-
-	bool PhotonOutput1D;
-	std::string line;
-	std::getline(infile, line);
-	if (line == "#ID	E	D	pID	pE	iID	iE	iD") {
-		PhotonOutput1D = true;
-	} else if (line == "#	D	ID	E	ID0	E0	ID1	E1	X1") { 
-		PhotonOutput1D = false;
-	} else {
-		throw std::runtime_error("ElecaPropagation: Wrong header of input file. Use PhotonOutput1D or Event1D with additional columns enabled.");
-	}
-
 	eleca::setSeed();
 	eleca::Propagation propagation;
 	propagation.SetEthr(lowerEnergyThreshold / eV );
@@ -74,206 +278,179 @@ void ElecaPropagation(
 	output << "# iE          Energy [EeV] of source particle\n";
 	output << "# Generation  number of interactions during propagation before particle is created\n";
 
-	while (infile.good()) {
-		if (infile.peek() != '#') {
-			double D, E, E0, E1, X1;
-			int ID, ID0, ID1;
-			if (PhotonOutput1D) {
-				infile >> ID >> E >> X1 >> ID1 >> E1 >> ID0 >> E0 >> D;
-			} else {
-				infile >> D >> ID >> E >> ID0 >> E0 >> ID1 >> E1 >> X1;
-			}
-			if (showProgress) {
-				progressbar.setPosition(infile.tellg());
-			}
-
-			if (infile) {
-
-				double z = eleca::Mpc2z(X1);
-				eleca::Particle p0(ID, E * 1e18, z);
-
-				std::vector<eleca::Particle> ParticleAtMatrix;
-				std::vector<eleca::Particle> ParticleAtGround;
-				ParticleAtMatrix.push_back(p0);
-
-				while (ParticleAtMatrix.size() > 0) {
-
-					eleca::Particle p1 = ParticleAtMatrix.back();
-					ParticleAtMatrix.pop_back();
-
-					if (p1.IsGood()) {
-						propagation.Propagate(p1, ParticleAtMatrix,
-								ParticleAtGround);
-					}
-				}
-
-				for (int i = 0; i < ParticleAtGround.size(); ++i) {
-					eleca::Particle &p = ParticleAtGround[i];
-					if (p.GetType() != 22)
-						continue;
-					char buffer[256];
-					size_t bufferPos = 0;
-					bufferPos += std::sprintf(buffer + bufferPos, "%i\t", p.GetType());
-					bufferPos += std::sprintf(buffer + bufferPos, "%.4E\t", p.GetEnergy() / 1E18 );
-					bufferPos += std::sprintf(buffer + bufferPos, "%i\t", ID0);
-					bufferPos += std::sprintf(buffer + bufferPos, "%.4E\t", E0 );
-					bufferPos += std::sprintf(buffer + bufferPos, "%i", p.Generation());
-					bufferPos += std::sprintf(buffer + bufferPos, "\n");
-
-					output.write(buffer, bufferPos);
-				}
-			}
-		}
-
-		infile.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-	}
-	infile.close();
+	_ElecaOutputChunk processor(propagation, output);
+	processPhotonChunks(reader, processor, photonThreads(nThreads),
+			showProgress ? &progressbar : NULL);
 	output.close();
 }
 
-typedef struct _Secondary {
-	double D, E, E0, E1, X1;
-	int ID, ID0, ID1;
-} _Secondary;
-
-bool _SecondarySortPredicate(const _Secondary& s1, const _Secondary& s2) {
-	return s1.X1 < s2.X1;
+static void addToSpectrum(Spectrum *a, const double *values) {
+	for (int i = 0; i < 3; i++)
+		for (int j = 0; j < NUM_MAIN_BINS; j++)
+			a->spectrum[i][j] += values[i * NUM_MAIN_BINS + j];
 }
 
-void FillInSpectrum(Spectrum *a, const _Secondary &s) {
-	double logE = log10(s.E) + 18;  // log10(E/eV)
-	int iBin = floor((logE - MIN_ENERGY_EXP) / 0.1);  // bin number from 0 - NUM_MAIN_BINS-1
-	if (iBin >= NUM_MAIN_BINS) {
-		std::cout << "DintPropagation: Energy too high " << logE << std::endl;
-		return;
-	}
-	if (iBin < 0) {
-		std::cout << "DintPropagation: Energy too low " << logE << std::endl;
-		return;
-	}
-	if (s.ID == 22)
-		a->spectrum[PHOTON][iBin] += 1.;
-	else if (s.ID == 11)
-		a->spectrum[ELECTRON][iBin] += 1.;
-	else if (s.ID == -11)
-		a->spectrum[POSITRON][iBin] += 1.;
-	else
-		std::cout << "DintPropagation: Unhandled particle ID " << s.ID << std::endl;
+static void copyFromSpectrum(const Spectrum *a, double *values) {
+	for (int i = 0; i < 3; i++)
+		for (int j = 0; j < NUM_MAIN_BINS; j++)
+			values[i * NUM_MAIN_BINS + j] = a->spectrum[i][j];
 }
 
-void DintPropagation(
-		const std::string &inputfile,
-		const std::string &outputfile,
+void DintCascade(
+		const std::vector<double> &distances,
+		const std::vector<double> &injections,
+		std::vector<double> &spectrum,
 		int IRBFlag,
 		int RadioFlag,
 		double magneticFieldStrength,
-		double aCutcascade_Magfield) {
-
-	// initialize the energy grids for DINT
-	dCVector energyGrid, energyWidth;
-	New_dCVector(&energyGrid, NUM_MAIN_BINS);
-	New_dCVector(&energyWidth, NUM_MAIN_BINS);
-	SetEnergyBins(MIN_ENERGY_EXP, &energyGrid, &energyWidth);
-
-	std::ofstream outfile(outputfile.c_str());
-	if (!outfile.good())
-		throw std::runtime_error(
-				"DintPropagation: could not open file " + outputfile);
-
-	std::ifstream infile(inputfile.c_str());
-	if (!infile.good())
-		throw std::runtime_error(
-				"DintPropagation: could not open file " + inputfile);
-
-	bool PhotonOutput1D;
-	std::string line;
-	std::getline(infile, line);
-	if (line == "#ID	E	D	pID	pE	iID	iE	iD") {
-		PhotonOutput1D = true;
-	} else if (line == "#	D	ID	E	ID0	E0	ID1	E1	X1") { 
-		PhotonOutput1D = false;
-	} else {
-		throw std::runtime_error("DintPropagation: Wrong header of input file. Use PhotonOutput1D or Event1D with additional columns enabled.");
-	}
+		double aCutcascade_Magfield,
+		int nThreads) {
+	const size_t nValues = 3 * NUM_MAIN_BINS;
+	const size_t n = distances.size();
+	if (injections.size() != n * nValues)
+		throw std::runtime_error("DintCascade: need 3 x NUM_MAIN_BINS injected particles per distance");
+	for (size_t i = 1; i < n; i++)
+		if (distances[i] > distances[i - 1])
+			throw std::runtime_error("DintCascade: distances not in descending order");
+	spectrum.assign(nValues, 0);
+	if (n == 0)
+		return;
 
-	// initialize the spectrum
-	Spectrum finalSpectrum;
-	NewSpectrum(&finalSpectrum, NUM_MAIN_BINS);
-	InitializeSpectrum(&finalSpectrum);
+#ifdef _OPENMP
+	if (nThreads <= 0)
+		nThreads = omp_get_max_threads();
+#else
+	nThreads = 1;
+#endif
+	// contiguous segments of distances, cascaded concurrently
+	const size_t nSegments = std::max(size_t(1), std::min(size_t(nThreads), n));
+	std::vector<size_t> first(nSegments + 1);
+	for (size_t k = 0; k <= nSegments; k++)
+		first[k] = k * n / nSegments;
+	std::vector<double> results(nSegments * nValues, 0);
 
 	std::string dataPath = getDataPath("dint");
 	double B = magneticFieldStrength / gauss;
 	double h = H0() * Mpc / 1000;
-	DintEMCascade dint(IRBFlag, RadioFlag, dataPath, B, h, omegaM(), omegaL());
-
-	const size_t nBuffer = 7.5E7;  // maximum number of simultaneously processed particles, keep memory requirement < 1GB
-	const double dMargin = 0.1;  // distance bin width in [Mpc]
-
-	while (infile.good()) {
-		// read up to nBuffer secondaries from input file
-		std::vector<_Secondary> secondaries;
-		secondaries.reserve(nBuffer);
-		while (infile.good() && (secondaries.size() < nBuffer)) {
-			if (infile.peek() != '#') {
-				_Secondary s;
-				if (PhotonOutput1D) {
-					infile >> s.ID >> s.E >> s.X1 >> s.ID1 >> s.E1 >> s.ID0 >> s.E0 >> s.D;
-				} else {
-					infile >> s.D >> s.ID >> s.E >> s.ID0 >> s.E0 >> s.ID1 >> s.E1 >> s.X1;
-				}
-				s.X1 = comoving2LightTravelDistance(s.X1 * Mpc) / Mpc;  // DintEMCascade expects light travel distance
-				if (infile)
-					secondaries.push_back(s);
-			}
-			infile.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-		}
-
-		if (secondaries.empty())
-			break;  // all secondaries processed, nothing left to do
-
-		// sort by distance
-		std::sort(secondaries.begin(), secondaries.end(),
-				_SecondarySortPredicate);
 
+#pragma omp parallel num_threads(nSegments)
+	{
+		DintEMCascade dint(IRBFlag, RadioFlag, dataPath, B, h, omegaM(), omegaL());
 		Spectrum inputSpectrum, outputSpectrum;
 		NewSpectrum(&inputSpectrum, NUM_MAIN_BINS);
 		NewSpectrum(&outputSpectrum, NUM_MAIN_BINS);
-		InitializeSpectrum(&inputSpectrum);
 
-		// process secondaries
-		while ((secondaries.back().X1 > 0) and (secondaries.size() > 0)) {
-			double Dmax = secondaries.back().X1;  // upper bound of distance bin
-			double Dmin = max(Dmax - dMargin, 0.);  // lower bound of distance bin
-
-			// add all secondaries within the current distance bin
-			while ((secondaries.back().X1 > Dmin) and (secondaries.size() > 0)) {
-				FillInSpectrum(&inputSpectrum, secondaries.back());
-				secondaries.pop_back();
+#pragma omp for schedule(static, 1)
+		for (int k = 0; k < int(nSegments); k++) {
+			// cascade of the segment down to the start of the next one
+			InitializeSpectrum(&inputSpectrum);
+			for (size_t i = first[k]; i < first[k + 1]; i++) {
+				addToSpectrum(&inputSpectrum, &injections[i * nValues]);
+				double D = (i + 1 < n) ? distances[i + 1] : 0;
+				if (distances[i] > D) {
+					InitializeSpectrum(&outputSpectrum);
+					dint.propagate(distances[i], D, &inputSpectrum, &outputSpectrum, aCutcascade_Magfield);
+					SetSpectrum(&inputSpectrum, &outputSpectrum);
+				}
 			}
+			copyFromSpectrum(&inputSpectrum, &results[k * nValues]);
+		}
 
-			// propagate to next closest particle or to D=0
-			double D = 0;
-			if (secondaries.size() > 0)
-				D = secondaries.back().X1;
+		DeleteSpectrum(&outputSpectrum);
+		DeleteSpectrum(&inputSpectrum);
+	}
 
-			// propagate distance step and make the output the new input spectrum
+	if (nSegments == 1) {
+		spectrum = results;
+		return;
+	}
+
+	// carry the result of each segment through all closer segments
+	DintEMCascade dint(IRBFlag, RadioFlag, dataPath, B, h, omegaM(), omegaL());
+	Spectrum inputSpectrum, outputSpectrum;
+	NewSpectrum(&inputSpectrum, NUM_MAIN_BINS);
+	NewSpectrum(&outputSpectrum, NUM_MAIN_BINS);
+	InitializeSpectrum(&inputSpectrum);
+	addToSpectrum(&inputSpectrum, &results[0]);
+	for (size_t k = 1; k < nSegments; k++) {
+		double D1 = distances[first[k]];
+		double D0 = (first[k + 1] < n) ? distances[first[k + 1]] : 0;
+		if (D1 > D0) {
 			InitializeSpectrum(&outputSpectrum);
-			dint.propagate(Dmax, D, &inputSpectrum, &outputSpectrum, aCutcascade_Magfield);
+			dint.propagate(D1, D0, &inputSpectrum, &outputSpectrum, aCutcascade_Magfield);
 			SetSpectrum(&inputSpectrum, &outputSpectrum);
 		}
+		addToSpectrum(&inputSpectrum, &results[k * nValues]);
+	}
+	copyFromSpectrum(&inputSpectrum, &spectrum[0]);
+	DeleteSpectrum(&outputSpectrum);
+	DeleteSpectrum(&inputSpectrum);
+}
 
-		// add remaining secondaries at D=0 to output spectrum
-		while (secondaries.size() > 0) {
-			FillInSpectrum(&inputSpectrum, secondaries.back());
-			secondaries.pop_back();
+/**
+ Injected particles binned in light travel distance for DintCascade. The
+ cascade of a bin starts at the largest distance of its particles, particles
+ at distance 0 are not propagated.
+ */
+class _DistanceBinnedInjection {
+	struct Bin {
+		double distance;
+		std::vector<double> values;
+	};
+	double binWidth; // [Mpc]
+	std::map<long, Bin> bins;
+	std::vector<double> atObserver;
+public:
+	_DistanceBinnedInjection(double binWidth) :
+			binWidth(binWidth), atObserver(3 * NUM_MAIN_BINS, 0) {
+	}
+
+	/** Add a particle of species 0, 1, 2 (photon, electron, positron) in energy bin iE at distance D [Mpc] */
+	void add(double D, int species, int iE) {
+		if (!(D > 0)) {
+			atObserver[species * NUM_MAIN_BINS + iE] += 1.;
+			return;
 		}
+		Bin &b = bins[long(floor(D / binWidth))];
+		if (b.values.empty()) {
+			b.values.assign(3 * NUM_MAIN_BINS, 0);
+			b.distance = D;
+		}
+		b.distance = std::max(b.distance, D);
+		b.values[species * NUM_MAIN_BINS + iE] += 1.;
+	}
 
-		AddSpectrum(&finalSpectrum, &inputSpectrum);
-		DeleteSpectrum(&outputSpectrum);
-		DeleteSpectrum(&inputSpectrum);
+	/** Memory of the bins [bytes] */
+	double memory() const {
+		return bins.size() * (3. * NUM_MAIN_BINS * sizeof(double) + sizeof(Bin) + 64);
 	}
 
-	// output
+	/** Calculate the cascade of all bins, add it to the spectrum and clear the bins */
+	void cascade(Spectrum *finalSpectrum, int IRBFlag, int RadioFlag,
+			double magneticFieldStrength, double aCutcascade_Magfield,
+			int nThreads, const DintResponse *response = NULL) {
+		std::vector<double> distances, injections;
+		distances.reserve(bins.size());
+		injections.reserve(bins.size() * 3 * NUM_MAIN_BINS);
+		for (std::map<long, Bin>::reverse_iterator i = bins.rbegin(); i != bins.rend(); ++i) {
+			distances.push_back(i->second.distance);
+			injections.insert(injections.end(), i->second.values.begin(), i->second.values.end());
+		}
+		bins.clear();
+
+		std::vector<double> spectrum;
+		if (response)
+			response->cascade(distances, injections, spectrum);
+		else
+			DintCascade(distances, injections, spectrum, IRBFlag, RadioFlag,
+					magneticFieldStrength, aCutcascade_Magfield, nThreads);
+		addToSpectrum(finalSpectrum, &spectrum[0]);
+		addToSpectrum(finalSpectrum, &atObserver[0]);
+		atObserver.assign(3 * NUM_MAIN_BINS, 0);
+	}
+};
+
+static void writeDintSpectrum(std::ofstream &outfile, const Spectrum &finalSpectrum) {
 	outfile << "# logE photons electrons positrons\n";
 	outfile << "#   - logE: energy bin center <log10(E/eV)>\n";
 	outfile << "#   - photons, electrons, positrons: total flux weights\n";
@@ -285,18 +462,192 @@ void DintPropagation(
 		}
 		outfile << "\n";
 	}
+}
+
+// species of DINT for the particle id, -1 if not handled
+static int dintSpecies(int id) {
+	if (id == 22)
+		return PHOTON;
+	if (id == 11)
+		return ELECTRON;
+	if (id == -11)
+		return POSITRON;
+	return -1;
+}
+
+// injection of a photon into the distance bins of DINT
+struct _DintInjection {
+	double distance;  // light travel distance [Mpc]
+	int species, bin; // bin < 0 if not injected
+};
+
+// bins the photons of a chunk by distance and calls DINT when the bins
+// use more than the buffer
+class _DintChunk {
+	_DistanceBinnedInjection &injection;
+	Spectrum *finalSpectrum;
+	int IRBFlag, RadioFlag;
+	double magneticFieldStrength, aCutcascade_Magfield, bufferSize;
+	int nThreads;
+	const DintResponse *response;
+	std::vector<_DintInjection> injections;
+public:
+	_DintChunk(_DistanceBinnedInjection &injection, Spectrum *finalSpectrum,
+			int IRBFlag, int RadioFlag, double magneticFieldStrength,
+			double aCutcascade_Magfield, double bufferSize, int nThreads,
+			const DintResponse *response) :
+			injection(injection), finalSpectrum(finalSpectrum),
+			IRBFlag(IRBFlag), RadioFlag(RadioFlag),
+			magneticFieldStrength(magneticFieldStrength),
+			aCutcascade_Magfield(aCutcascade_Magfield), bufferSize(bufferSize),
+			nThreads(nThreads), response(response) {
+	}
+
+	void add(double distance, int species, int bin) {
+		injection.add(distance, species, bin);
+	}
+
+	void cascade() {
+		injection.cascade(finalSpectrum, IRBFlag, RadioFlag,
+				magneticFieldStrength, aCutcascade_Magfield, nThreads, response);
+	}
+
+	void cascadeIfFull() {
+		if (injection.memory() > bufferSize)
+			cascade();
+	}
+
+	void begin(const std::vector<PhotonRecord1D> &chunk) {
+		injections.resize(chunk.size());
+	}
+
+	void process(const std::vector<PhotonRecord1D> &chunk, long i) {
+		const PhotonRecord1D &p = chunk[i];
+		_DintInjection &j = injections[i];
+		double logE = log10(p.energy) + 18;  // log10(E/eV)
+		j.bin = floor((logE - MIN_ENERGY_EXP) / 0.1);  // bin number from 0 - NUM_MAIN_BINS-1
+		j.species = dintSpecies(p.id);
+		if ((j.bin >= 0) && (j.bin < NUM_MAIN_BINS) && (j.species >= 0))
+			// DintEMCascade expects light travel distance
+			j.distance = comoving2LightTravelDistance(p.distance * Mpc) / Mpc;
+	}
+
+	void finish(const std::vector<PhotonRecord1D> &chunk) {
+		for (size_t i = 0; i < chunk.size(); i++) {
+			const _DintInjection &j = injections[i];
+			double logE = log10(chunk[i].energy) + 18;
+			if (j.bin >= NUM_MAIN_BINS) {
+				std::cout << "DintPropagation: Energy too high " << logE << std::endl;
+			} else if (j.bin < 0) {
+				std::cout << "DintPropagation: Energy too low " << logE << std::endl;
+			} else if (j.species < 0) {
+				std::cout << "DintPropagation: Unhandled particle ID " << chunk[i].id << std::endl;
+			} else {
+				add(j.distance, j.species, j.bin);
+			}
+		}
+		cascadeIfFull();
+	}
+};
+
+// DintPropagation, with the tabulated response if given
+static void dintPropagation(
+		const std::string &inputfile,
+		const std::string &outputfile,
+		int IRBFlag,
+		int RadioFlag,
+		double magneticFieldStrength,
+		double aCutcascade_Magfield,
+		double bufferSize,
+		int nThreads,
+		const DintResponse *response) {
+
+	std::ofstream outfile(outputfile.c_str());
+	if (!outfile.good())
+		throw std::runtime_error(
+				"DintPropagation: could not open file " + outputfile);
+
+	PhotonInputReader reader(inputfile);
+
+	// initialize the spectrum
+	Spectrum finalSpectrum;
+	NewSpectrum(&finalSpectrum, NUM_MAIN_BINS);
+	InitializeSpectrum(&finalSpectrum);
+
+	const double dMargin = 0.1;  // distance bin width in [Mpc]
+	_DistanceBinnedInjection injection(dMargin);
+
+	// the input is streamed into the distance bins
+	nThreads = photonThreads(nThreads);
+	_DintChunk processor(injection, &finalSpectrum, IRBFlag, RadioFlag,
+			magneticFieldStrength, aCutcascade_Magfield, bufferSize, nThreads,
+			response);
+	processPhotonChunks(reader, processor, nThreads, NULL);
+	processor.cascade();
+
+	// output
+	writeDintSpectrum(outfile, finalSpectrum);
 	outfile.close();
 
 	DeleteSpectrum(&finalSpectrum);
-	Delete_dCVector(&energyGrid);
-	Delete_dCVector(&energyWidth);
 }
 
+void DintPropagation(
+		const std::string &inputfile,
+		const std::string &outputfile,
+		int IRBFlag,
+		int RadioFlag,
+		double magneticFieldStrength,
+		double aCutcascade_Magfield,
+		double bufferSize,
+		int nThreads) {
+	dintPropagation(inputfile, outputfile, IRBFlag, RadioFlag,
+			magneticFieldStrength, aCutcascade_Magfield, bufferSize, nThreads,
+			NULL);
+}
 
+// EleCa down to the crossover energy, the particles at the matrix boundary
+// are binned by distance for DINT
+class _DintElecaChunk: public _ElecaChunk {
+	_DintChunk dint;
+public:
+	_DintElecaChunk(const eleca::Propagation &propagation,
+			const _DintChunk &dint) :
+			_ElecaChunk(propagation, false), dint(dint) {
+	}
 
-bool _ParticlesAtGroundSortPredicate(const eleca::Particle& p1, const eleca::Particle& p2) {
-	return p1.Getz() < p2.Getz();
-}
+	void cascade() {
+		dint.cascade();
+	}
+
+	void finish(const std::vector<PhotonRecord1D> &chunk) {
+		for (size_t j = 0; j < chunk.size(); j++) {
+			const std::vector<eleca::Particle> &ParticleAtGround = particlesAtGround[j];
+			// bin the particles at the matrix boundary by distance
+			for (size_t i = 0; i < ParticleAtGround.size(); i++) {
+				const eleca::Particle &p = ParticleAtGround[i];
+				double criticalEnergy = p.GetEnergy() / (ELECTRON_MASS); // units of dint
+				int maxBin = (int) ((log10(criticalEnergy * ELECTRON_MASS) - MIN_ENERGY_EXP) * BINS_PER_DECADE + 0.5 + 1); // +1 line before to avoid conversion error to int for negative values (int(-0.7) = 0)
+				maxBin -= 1; // remove the additional 1 from line before
+				int species = dintSpecies(p.GetType());
+				if (maxBin >= NUM_MAIN_BINS) {
+					std::cout << "DintPropagation: Energy too high " <<
+						p.GetEnergy() << " eV"  << std::endl;
+				} else if (maxBin < 0) {
+					std::cout << "DintPropagation: Energy too low " <<
+						p.GetEnergy() << " eV"  << std::endl;
+				} else if (species < 0) {
+					std::cout << "DintPropagation: Unhandled particle ID " << p.GetType()
+						<< std::endl;
+				} else {
+					// dint expects light travel distance
+					dint.add(redshift2LightTravelDistance(p.Getz()) / Mpc, species, maxBin);
+				}
+			}
+		}
+		dint.cascadeIfFull();
+	}
+};
 
 void DintElecaPropagation(
 		const std::string &inputfile,
@@ -304,53 +655,28 @@ void DintElecaPropagation(
 		bool showProgress,
 		double crossOverEnergy,
 		double magneticFieldStrength,
-		double aCutcascade_Magfield) {
+		double aCutcascade_Magfield,
+		double bufferSize,
+		int nThreads) {
 
 	////////////////////////////////////////////////////////////////////////
 	//Initialize EleCa
-	std::ifstream infile(inputfile.c_str());
-	std::streampos startPosition = infile.tellg();
-
-	infile.seekg(0, std::ios::end);
-	std::streampos endPosition = infile.tellg();
-	infile.seekg(startPosition);
+	PhotonInputReader reader(inputfile);
 
-	ProgressBar progressbar(endPosition);
+	ProgressBar progressbar(reader.getSize());
 	if (showProgress) {
 		progressbar.start("Run EleCa propagation");
 	}
 
-	if (!infile.good())
-		throw std::runtime_error(
-				"EleCaPropagation: could not open file " + inputfile);
-
-	bool PhotonOutput1D;
-	std::string line;
-	std::getline(infile, line);
-	if (line == "#ID	E	D	pID	pE	iID	iE	iD") {
-		PhotonOutput1D = true;
-	} else if (line == "#	D	ID	E	ID0	E0	ID1	E1	X1") { 
-		PhotonOutput1D = false;
-	} else {
-		throw std::runtime_error("DintElecaPropagation: Wrong header of input file. Use PhotonOutput1D or Event1D with additional columns enabled.");
-	}
-
 	eleca::setSeed();
 	eleca::Propagation propagation;
 	propagation.SetEthr(crossOverEnergy / eV );
 	propagation.ReadTables(getDataPath("EleCa/eleca.dat"));
 	propagation.InitBkgArray("ALL");
 	propagation.SetB(magneticFieldStrength / gauss);
-	std::vector<eleca::Particle> ParticleAtGround;
 
 	////////////////////////////////////////////////////////////////////////
 	//Initialize DINT
-	dCVector energyGrid, energyWidth;
-	// Initialize the energy grids for dint
-	New_dCVector(&energyGrid, NUM_MAIN_BINS);
-	New_dCVector(&energyWidth, NUM_MAIN_BINS);
-	SetEnergyBins(MIN_ENERGY_EXP, &energyGrid, &energyWidth);
-
 	std::ofstream outfile(outputfile.c_str());
 	if (!outfile.good())
 		throw std::runtime_error(
@@ -360,137 +686,246 @@ void DintElecaPropagation(
 	NewSpectrum(&finalSpectrum, NUM_MAIN_BINS);
 	InitializeSpectrum(&finalSpectrum);
 
-	std::string dataPath = getDataPath("dint");
-	double h = H0() * Mpc / 1000;
-	double ol = omegaL();
-	double om = omegaM();
-	DintEMCascade dint(4, 4, dataPath, magneticFieldStrength/gauss, h, om, ol);
+	const double dMargin = 0.1;  // distance bin width in [Mpc]
+	_DistanceBinnedInjection injection(dMargin);
 
 	////////////////////////////////////////////////////////////////////////
 	// Loop over infile
+	nThreads = photonThreads(nThreads);
+	_DintElecaChunk processor(propagation, _DintChunk(injection,
+			&finalSpectrum, 4, 4, magneticFieldStrength, aCutcascade_Magfield,
+			bufferSize, nThreads, NULL));
+	processPhotonChunks(reader, processor, nThreads,
+			showProgress ? &progressbar : NULL);
+	processor.cascade();
 
-	while (infile.good()) {
-		/// Eleca Propagation
-		if (infile.peek() == '#') {
-			infile.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-			continue;
-		}
-
-		double D, E, E0, E1, X1;
-		int ID, ID0, ID1;
-		if (PhotonOutput1D) {
-			infile >> ID >> E >> X1 >> ID1 >> E1 >> ID0 >> E0 >> D;
-		} else {
-			infile >> D >> ID >> E >> ID0 >> E0 >> ID1 >> E1 >> X1;
-		}
-		if (showProgress) {
-			progressbar.setPosition(infile.tellg());
-		}
-		if (infile) { // stop at last line
-			double z = eleca::Mpc2z(X1);
-			eleca::Particle p0(ID, E * 1e18, z);
-
-			std::vector<eleca::Particle> ParticleAtMatrix;
-			ParticleAtMatrix.push_back(p0);
+	// output
+	writeDintSpectrum(outfile, finalSpectrum);
+	outfile.close();
 
-			while (ParticleAtMatrix.size() > 0) {
-				eleca::Particle p1 = ParticleAtMatrix.back();
-				ParticleAtMatrix.pop_back();
+	DeleteSpectrum(&finalSpectrum);
+}
 
-				if (p1.IsGood()) {
-					propagation.Propagate(p1, ParticleAtMatrix,
-							ParticleAtGround, false);
-				}
-			}
-		}
+DintResponse::DintResponse(double Dmax, int nD, int IRFlag, int RadioFlag,
+		double magneticFieldStrength, double aCutcascade_Magfield) :
+		Dmax(Dmax / Mpc), nD(nD), IRFlag(IRFlag), RadioFlag(RadioFlag),
+		magneticFieldStrength(magneticFieldStrength),
+		aCutcascade_Magfield(aCutcascade_Magfield) {
+	if (nD < 1)
+		throw std::runtime_error("DintResponse: need at least one distance step");
+	if (!(Dmax > 0))
+		throw std::runtime_error("DintResponse: Dmax <= 0");
+}
 
-		// The vector is larger than ~1GB, or the infile is completely read - better call DINT.
-		if (ParticleAtGround.size() > 1000000 || !infile) {
-			const double dMargin = 0.1 * Mpc;
+void DintResponse::check() const {
+	if (!isComputed())
+		throw std::runtime_error("DintResponse: table not computed or loaded");
+}
 
-			std::sort(ParticleAtGround.begin(), ParticleAtGround.end(), _ParticlesAtGroundSortPredicate);
+bool DintResponse::isComputed() const {
+	const size_t m = 3 * NUM_MAIN_BINS;
+	return responses.size() == nD * m * m;
+}
 
-			Spectrum inputSpectrum, outputSpectrum;
-			NewSpectrum(&inputSpectrum, NUM_MAIN_BINS);
-			NewSpectrum(&outputSpectrum, NUM_MAIN_BINS);
+void DintResponse::compute(int nThreads) {
+	const size_t m = 3 * NUM_MAIN_BINS;
+#ifdef _OPENMP
+	if (nThreads <= 0)
+		nThreads = omp_get_max_threads();
+#else
+	nThreads = 1;
+#endif
+	std::string dataPath = getDataPath("dint");
+	double B = magneticFieldStrength / gauss;
+	double h = H0() * Mpc / 1000;
+	double dD = Dmax / nD;
+
+	// steps from node k to k - 1 for each unit injection, all independent
+	std::vector<double> steps(nD * m * m, 0);
+	const long nTasks = long(nD) * m;
+#pragma omp parallel num_threads(nThreads)
+	{
+		DintEMCascade dint(IRFlag, RadioFlag, dataPath, B, h, omegaM(), omegaL());
+		Spectrum inputSpectrum, outputSpectrum;
+		NewSpectrum(&inputSpectrum, NUM_MAIN_BINS);
+		NewSpectrum(&outputSpectrum, NUM_MAIN_BINS);
 
+#pragma omp for schedule(dynamic, 1)
+		for (long t = 0; t < nTasks; t++) {
+			int k = t / m + 1;
+			size_t j = t % m;
 			InitializeSpectrum(&inputSpectrum);
-			// process secondaries
-			while (ParticleAtGround.size() > 0) {
-				double currentDistance =  redshift2LightTravelDistance(ParticleAtGround.back().Getz());  // dint expects light travel distance
-				bool lastStep = (currentDistance == 0.);
-				// add secondaries at the current distance to spectrum
-				while ((ParticleAtGround.size() > 0) && (redshift2LightTravelDistance(ParticleAtGround.back().Getz()) >= (currentDistance - dMargin)))	{
-					if (redshift2LightTravelDistance(ParticleAtGround.back().Getz()) > 0. || lastStep) {
-						double criticalEnergy = ParticleAtGround.back().GetEnergy() / (ELECTRON_MASS); // units of dint
-						int maxBin = (int) ((log10(criticalEnergy * ELECTRON_MASS) - MIN_ENERGY_EXP) * BINS_PER_DECADE + 0.5 + 1); // +1 line before to avoid conversion error to int for negative values (int(-0.7) = 0)
-						maxBin -= 1; // remove the additional 1 from line before
-						if (maxBin >= NUM_MAIN_BINS) {
-							std::cout << "DintPropagation: Energy too high " <<
-								ParticleAtGround.back().GetEnergy() << " eV"  <<
-								std::endl;
-							ParticleAtGround.pop_back();
-							continue;
-						}
-						if (maxBin < 0) {
-							std::cout << "DintPropagation: Energy too low " <<
-								ParticleAtGround.back().GetEnergy() << " eV"  << std::endl;
-							ParticleAtGround.pop_back();
-							continue;
-						}
-						int Id = ParticleAtGround.back().GetType();
-						if (Id == 22)
-							inputSpectrum.spectrum[PHOTON][maxBin] += 1.;
-						else if (Id == 11)
-							inputSpectrum.spectrum[ELECTRON][maxBin] += 1.;
-						else if (Id == -11)
-							inputSpectrum.spectrum[POSITRON][maxBin] += 1.;
-						else {
-							std::cout << "DintPropagation: Unhandled particle ID " << Id
-								<< std::endl;
-						}
-						ParticleAtGround.pop_back();
-					} else
-						break;
-				}
+			inputSpectrum.spectrum[j / NUM_MAIN_BINS][j % NUM_MAIN_BINS] = 1;
+			InitializeSpectrum(&outputSpectrum);
+			dint.propagate(k * dD, (k - 1) * dD, &inputSpectrum,
+					&outputSpectrum, aCutcascade_Magfield);
+			copyFromSpectrum(&outputSpectrum, &steps[((k - 1) * m + j) * m]);
+		}
 
-				double D = 0;
-				// only propagate to next particle
-				if (ParticleAtGround.size() > 0)
-					D = redshift2LightTravelDistance(ParticleAtGround.back().Getz());
+		DeleteSpectrum(&outputSpectrum);
+		DeleteSpectrum(&inputSpectrum);
+	}
 
-				InitializeSpectrum(&outputSpectrum);
-				dint.propagate(currentDistance / Mpc, D / Mpc, &inputSpectrum,
-						&outputSpectrum, aCutcascade_Magfield);
-				SetSpectrum(&inputSpectrum, &outputSpectrum);
-			} // while (secondaries.size() > 0)
+	// responses of the nodes: R_1 = S_1 and R_k = R_{k-1} S_k
+	responses.assign(nD * m * m, 0);
+	std::copy(steps.begin(), steps.begin() + m * m, responses.begin());
+	for (int k = 2; k <= nD; k++) {
+		const double *A = &responses[(k - 2) * m * m];
+		const double *S = &steps[(k - 1) * m * m];
+		double *R = &responses[(k - 1) * m * m];
+#pragma omp parallel for num_threads(nThreads)
+		for (int j = 0; j < int(m); j++)
+			for (size_t l = 0; l < m; l++) {
+				double x = S[j * m + l];
+				if (x == 0)
+					continue;
+				for (size_t i = 0; i < m; i++)
+					R[j * m + i] += A[l * m + i] * x;
+			}
+	}
+}
 
-			AddSpectrum(&finalSpectrum, &inputSpectrum);
+std::string DintResponse::getCacheFilename() const {
+	std::stringstream s;
+	s << "dint_response_IR" << IRFlag << "_radio" << RadioFlag << "_B"
+			<< magneticFieldStrength << "T_a" << aCutcascade_Magfield << "_D"
+			<< Dmax << "Mpc_n" << nD << ".bin";
+	return s.str();
+}
 
-			DeleteSpectrum(&outputSpectrum);
-			DeleteSpectrum(&inputSpectrum);
-		} // dint call
+void DintResponse::init(const std::string &cacheDirectory, int nThreads) {
+	std::string filename = getCacheFilename();
+	if (!cacheDirectory.empty())
+		filename = cacheDirectory + "/" + filename;
+	std::ifstream cached(filename.c_str());
+	if (cached.good()) {
+		cached.close();
+		try {
+			load(filename);
+			return;
+		} catch (std::runtime_error &e) {
+			std::cerr << "DintResponse: recompute, " << e.what() << std::endl;
+		}
 	}
+	compute(nThreads);
+	save(filename);
+}
 
-	infile.close();
+// header of the saved tables
+static const char dintResponseMagic[8] = {'C', 'R', 'P', 'D', 'I', 'N', 'T', '1'};
+
+void DintResponse::save(const std::string &filename) const {
+	check();
+	std::ofstream out(filename.c_str(), std::ios::binary);
+	if (!out.good())
+		throw std::runtime_error("DintResponse: could not open file " + filename);
+	int32_t ints[5] = {nD, IRFlag, RadioFlag, NUM_MAIN_BINS, 0};
+	double doubles[3] = {Dmax, magneticFieldStrength, aCutcascade_Magfield};
+	out.write(dintResponseMagic, sizeof(dintResponseMagic));
+	out.write((const char*) ints, sizeof(ints));
+	out.write((const char*) doubles, sizeof(doubles));
+	out.write((const char*) &responses[0], responses.size() * sizeof(double));
+	out.close();
+	if (!out)
+		throw std::runtime_error("DintResponse: could not write file " + filename);
+}
 
-	// output
-	outfile << "# logE photons electrons positrons\n";
-	outfile << "#   - logE: energy bin center <log10(E/eV)>\n";
-	outfile << "#   - photons, electrons, positrons: total flux weights\n";
-	for (int j = 0; j < finalSpectrum.numberOfMainBins; j++) {
-		double logEc = MIN_ENERGY_EXP + 0.05 + j * 1. / BINS_PER_DECADE;
-		outfile << std::setw(5) << logEc;
-		for (int i = 0; i < 3; i++) {
-			outfile << std::setw(13) << finalSpectrum.spectrum[i][j];
+void DintResponse::load(const std::string &filename) {
+	std::ifstream in(filename.c_str(), std::ios::binary);
+	if (!in.good())
+		throw std::runtime_error("DintResponse: could not open file " + filename);
+	char magic[8];
+	int32_t ints[5];
+	double doubles[3];
+	in.read(magic, sizeof(magic));
+	in.read((char*) ints, sizeof(ints));
+	in.read((char*) doubles, sizeof(doubles));
+	if (!in || (memcmp(magic, dintResponseMagic, sizeof(magic)) != 0))
+		throw std::runtime_error("DintResponse: not a response table " + filename);
+	if ((ints[0] != nD) || (ints[1] != IRFlag) || (ints[2] != RadioFlag)
+			|| (ints[3] != NUM_MAIN_BINS) || (doubles[0] != Dmax)
+			|| (doubles[1] != magneticFieldStrength)
+			|| (doubles[2] != aCutcascade_Magfield))
+		throw std::runtime_error("DintResponse: other background or binning in " + filename);
+	const size_t m = 3 * NUM_MAIN_BINS;
+	std::vector<double> r(nD * m * m);
+	in.read((char*) &r[0], r.size() * sizeof(double));
+	if (!in)
+		throw std::runtime_error("DintResponse: could not read file " + filename);
+	responses.swap(r);
+}
+
+void DintResponse::cascade(const std::vector<double> &distances,
+		const std::vector<double> &injections,
+		std::vector<double> &spectrum) const {
+	check();
+	const size_t m = 3 * NUM_MAIN_BINS;
+	const size_t n = distances.size();
+	if (injections.size() != n * m)
+		throw std::runtime_error("DintResponse: need 3 x NUM_MAIN_BINS injected particles per distance");
+
+	// injections at the nodes, node 0 is the observer
+	double dD = Dmax / nD;
+	std::vector<double> weights((nD + 1) * m, 0);
+	for (size_t i = 0; i < n; i++) {
+		double x = distances[i] / dD;
+		if (!(x >= 0) || (x > nD * (1 + 1e-12)))
+			throw std::runtime_error("DintResponse: distance outside of the table");
+		int k = std::min(int(x), nD - 1);
+		double t = std::min(x - k, 1.);
+		for (size_t j = 0; j < m; j++) {
+			weights[k * m + j] += (1 - t) * injections[i * m + j];
+			weights[(k + 1) * m + j] += t * injections[i * m + j];
 		}
-		outfile << "\n";
 	}
-	outfile.close();
+	cascadeNodes(weights, spectrum);
+}
 
-	DeleteSpectrum(&finalSpectrum);
-	Delete_dCVector(&energyGrid);
-	Delete_dCVector(&energyWidth);
+void DintResponse::cascadeNodes(const std::vector<double> &weights,
+		std::vector<double> &spectrum) const {
+	check();
+	const size_t m = 3 * NUM_MAIN_BINS;
+	if (weights.size() != (nD + 1) * m)
+		throw std::runtime_error("DintResponse: need 3 x NUM_MAIN_BINS injected particles per node");
+
+	spectrum.assign(weights.begin(), weights.begin() + m);
+	for (int k = 1; k <= nD; k++) {
+		const double *R = &responses[(k - 1) * m * m];
+		const double *w = &weights[k * m];
+		for (size_t j = 0; j < m; j++) {
+			if (w[j] == 0)
+				continue;
+			for (size_t i = 0; i < m; i++)
+				spectrum[i] += R[j * m + i] * w[j];
+		}
+	}
+}
+
+void DintResponse::propagate(const std::string &inputfile,
+		const std::string &outputfile, double bufferSize) const {
+	check();
+	dintPropagation(inputfile, outputfile, IRFlag, RadioFlag,
+			magneticFieldStrength, aCutcascade_Magfield, bufferSize, 0, this);
+}
+
+int DintResponse::getNumberOfDistances() const {
+	return nD;
+}
+
+int DintResponse::getNumberOfEnergyBins() {
+	return NUM_MAIN_BINS;
+}
+
+double DintResponse::getMaximumDistance() const {
+	return Dmax * Mpc;
+}
+
+const double *DintResponse::getResponse(int k) const {
+	check();
+	if ((k < 1) || (k > nD))
+		throw std::out_of_range("DintResponse: node out of range");
+	const size_t m = 3 * NUM_MAIN_BINS;
+	return &responses[(k - 1) * m * m];
 }
 
 } // namespace crpropa
@@ -1,77 +1,230 @@
 #include "crpropa/ProgressBar.h"
 
+#include <algorithm>
+#include <cerrno>
 #include <cstdio>
+#include <fstream>
 #include <iostream>
+#include <locale>
+#include <stdexcept>
+#include <time.h>
 
 namespace crpropa {
 
-/// Initialize a ProgressBar with [steps] number of steps, updated at [updateSteps] intervalls
+// longest wait of the reporter, and the longest time without a new line on the terminal
+static const double REPORT_TICK = 1;
+static const double REPORT_MAX_INTERVAL = 10;
+
+static double monotonicSeconds() {
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + 1e-9 * t.tv_nsec;
+}
+
+/// Initialize a ProgressBar with [steps] number of steps, reported [updateSteps] times on the terminal at most
 ProgressBar::ProgressBar(unsigned long steps, unsigned long updateSteps) :
-		_steps(steps), _currentCount(0), _maxbarLength(10), _updateSteps(
-				updateSteps), _nextStep(1), _startTime(0) {
+		_steps(steps), _currentCount(0), _secondaries(0), _maxbarLength(10),
+		_updateSteps(updateSteps), _startTime(0), showBar(true), error(false),
+		heartbeatInterval(10), running(false) {
 	if (_updateSteps > _steps)
 		_updateSteps = _steps;
-	arrow.append(">");
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&stopped, NULL);
+}
+
+ProgressBar::~ProgressBar() {
+	finish();
+	pthread_cond_destroy(&stopped);
+	pthread_mutex_destroy(&mutex);
 }
 
-void ProgressBar::start(const std::string &title) {
+void ProgressBar::setHeartbeatFile(const std::string &filename, double interval) {
+	if (running)
+		throw std::runtime_error("ProgressBar: the heartbeat file is to be set before start");
+	if (!(interval > 0))
+		throw std::runtime_error("ProgressBar: the heartbeat interval must be positive");
+	heartbeatFile = filename;
+	heartbeatInterval = interval;
+}
+
+void ProgressBar::start(const std::string &t, bool show) {
+	if (running)
+		return;
+	title = t;
+	showBar = show;
 	_startTime = time(NULL);
 	std::string s = ctime(&_startTime);
 	s.erase(s.end() - 1, s.end());
 	stringTmpl = "  Started ";
 	stringTmpl.append(s);
-	stringTmpl.append(" : [%-10s] %3i%%    %s: %02i:%02i:%02i %s\r");
-	std::cout << title << std::endl;
+	stringTmpl.append(" : [%-10s] %3i%%  %s  %s: %02i:%02i:%02i %s\r");
+	if (showBar)
+		std::cout << title << std::endl;
+
+	running = true;
+	if (pthread_create(&reporter, NULL, reporterMain, this) != 0) {
+		running = false;
+		throw std::runtime_error("ProgressBar: could not start the reporter thread");
+	}
+}
+
+void *ProgressBar::reporterMain(void *progressBar) {
+	ProgressBar *self = (ProgressBar *) progressBar;
+	double start = monotonicSeconds();
+	double nextHeartbeat = 0;
+	double lastPrint = 0;
+	unsigned long printed = 0;
+	unsigned long printSteps = (self->_updateSteps > 0) ? self->_steps / self->_updateSteps : 1;
+
+	pthread_mutex_lock(&self->mutex);
+	while (self->running) {
+		double elapsed = monotonicSeconds() - start;
+		unsigned long position = self->getPosition();
+		if (self->showBar && (position > printed)
+				&& ((position - printed >= printSteps)
+						|| (elapsed - lastPrint >= REPORT_MAX_INTERVAL))) {
+			self->print(position, elapsed);
+			printed = position;
+			lastPrint = elapsed;
+		}
+		if (!self->heartbeatFile.empty() && (elapsed >= nextHeartbeat)) {
+			self->writeHeartbeat(position, elapsed, false);
+			nextHeartbeat = elapsed + self->heartbeatInterval;
+		}
+
+		// wake up for the next report or heartbeat, or when stopped
+		double wait = REPORT_TICK;
+		if (!self->heartbeatFile.empty())
+			wait = std::min(wait, std::max(0., nextHeartbeat - elapsed));
+		timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		long ns = deadline.tv_nsec + long(wait * 1e9);
+		deadline.tv_sec += ns / 1000000000L;
+		deadline.tv_nsec = ns % 1000000000L;
+		while (self->running && (pthread_cond_timedwait(&self->stopped,
+				&self->mutex, &deadline) != ETIMEDOUT))
+			;
+	}
+	pthread_mutex_unlock(&self->mutex);
 
+	// the final state
+	double elapsed = monotonicSeconds() - start;
+	if (self->showBar)
+		self->print(self->getPosition(), elapsed);
+	if (!self->heartbeatFile.empty())
+		self->writeHeartbeat(self->getPosition(), elapsed, true);
+	return 0;
 }
+
+void ProgressBar::finish() {
+	pthread_mutex_lock(&mutex);
+	bool wasRunning = running;
+	running = false;
+	pthread_cond_broadcast(&stopped);
+	pthread_mutex_unlock(&mutex);
+	if (wasRunning)
+		pthread_join(reporter, NULL);
+}
+
 /// update the progressbar
 /// should be called steps times in a loop
 void ProgressBar::update() {
-	_currentCount++;
-	if (_currentCount == _nextStep || _currentCount == _steps
-			|| _currentCount == 1000) {
-				_nextStep += long(_steps / float(_updateSteps));
-			setPosition(_currentCount);
-			}
+	__sync_add_and_fetch(&_currentCount, 1);
+}
+
+void ProgressBar::addSecondaries(unsigned long n) {
+	__sync_add_and_fetch(&_secondaries, n);
 }
 
 void ProgressBar::setPosition(unsigned long position) {
-	int percentage = int(100 * (position / float(_steps)));
+	__sync_lock_test_and_set(&_currentCount, position);
+}
+
+unsigned long ProgressBar::getPosition() const {
+	return __sync_add_and_fetch(const_cast<unsigned long *>(&_currentCount), 0);
+}
+
+unsigned long ProgressBar::getSecondaries() const {
+	return __sync_add_and_fetch(const_cast<unsigned long *>(&_secondaries), 0);
+}
+
+void ProgressBar::print(unsigned long position, double elapsed) const {
+	char rates[255];
+	double t = std::max(elapsed, 1e-9);
+	std::sprintf(rates, "%.3g primaries/s %.3g secondaries/s", position / t,
+			getSecondaries() / t);
 	time_t currentTime = time(NULL);
-	if (position < _steps) {
-		if (arrow.size() <= (_maxbarLength) * (position) / (_steps))
-			arrow.insert(0, "=");
-		float tElapsed = currentTime - _startTime;
-		float tToGo = (_steps - position) * tElapsed / position;
-		std::printf(stringTmpl.c_str(), arrow.c_str(), percentage, "Finish in",
-				int(tToGo / 3600), (int(tToGo) % 3600) / 60,
+
+	if (error) {
+		std::string s = " - Finished at ";
+		s.append(ctime(&currentTime));
+		char fs[255];
+		std::sprintf(fs, "%c[%d;%dm  ERROR   %c[%dm", 27, 1, 31, 27, 0);
+		std::printf(stringTmpl.c_str(), fs, int(position), rates, "Needed",
+				int(elapsed / 3600), (int(elapsed) % 3600) / 60,
+				int(elapsed) % 60, s.c_str());
+	} else if (position < _steps) {
+		int percentage = int(100 * (position / float(_steps)));
+		std::string arrow(std::min(_maxbarLength, _maxbarLength * position / _steps), '=');
+		arrow.append(">");
+		double tToGo = (position > 0) ? (_steps - position) * elapsed / position : 0;
+		std::printf(stringTmpl.c_str(), arrow.c_str(), percentage, rates,
+				"Finish in", int(tToGo / 3600), (int(tToGo) % 3600) / 60,
 				int(tToGo) % 60, "");
-		fflush(stdout);
 	} else {
-		float tElapsed = currentTime - _startTime;
 		std::string s = " - Finished at ";
 		s.append(ctime(&currentTime));
 		char fs[255];
 		std::sprintf(fs, "%c[%d;%dm Finished %c[%dm", 27, 1, 32, 27, 0);
-		std::printf(stringTmpl.c_str(), fs, 100, "Needed",
-				int(tElapsed / 3600), (int(tElapsed) % 3600) / 60,
-				int(tElapsed) % 60, s.c_str());
+		std::printf(stringTmpl.c_str(), fs, 100, rates, "Needed",
+				int(elapsed / 3600), (int(elapsed) % 3600) / 60,
+				int(elapsed) % 60, s.c_str());
+	}
+	fflush(stdout);
+}
+
+static std::string jsonString(const std::string &s) {
+	std::string out = "\"";
+	for (size_t i = 0; i < s.size(); i++) {
+		if ((s[i] == '"') || (s[i] == '\\'))
+			out += '\\';
+		if ((unsigned char) s[i] >= 0x20)
+			out += s[i];
 	}
+	return out + "\"";
 }
 
+void ProgressBar::writeHeartbeat(unsigned long position, double elapsed,
+		bool finished) const {
+	unsigned long secondaries = getSecondaries();
+	double t = std::max(elapsed, 1e-9);
+	double eta = (position > 0) && (position < _steps)
+			? (_steps - position) * elapsed / position : 0;
+
+	std::string tmp = heartbeatFile + ".tmp";
+	std::ofstream out(tmp.c_str());
+	out.imbue(std::locale::classic());
+	out.precision(10);
+	out << "{\"title\": " << jsonString(title) << ", \"steps\": " << _steps
+			<< ", \"completed\": " << position << ", \"secondaries\": "
+			<< secondaries << ", \"elapsed\": " << elapsed
+			<< ", \"primariesPerSecond\": " << position / t
+			<< ", \"secondariesPerSecond\": " << secondaries / t
+			<< ", \"eta\": " << eta << ", \"finished\": "
+			<< (finished ? "true" : "false") << ", \"error\": "
+			<< (error ? "true" : "false") << ", \"time\": " << time(NULL)
+			<< "}\n";
+	out.close();
+	// a failed heartbeat must not stop the run
+	if (!out || (std::rename(tmp.c_str(), heartbeatFile.c_str()) != 0))
+		std::remove(tmp.c_str());
+}
 
 /// Mark the progressbar with an error
 void ProgressBar::setError() {
-	time_t currentTime = time(NULL);
-	_currentCount++;
-	float tElapsed = currentTime - _startTime;
-	std::string s = " - Finished at ";
-	s.append(ctime(&currentTime));
-	char fs[255];
-	std::sprintf(fs, "%c[%d;%dm  ERROR   %c[%dm", 27, 1, 31, 27, 0);
-	std::printf(stringTmpl.c_str(), fs, _currentCount, "Needed",
-			int(tElapsed / 3600), (int(tElapsed) % 3600) / 60,
-			int(tElapsed) % 60, s.c_str());
+	error = true;
+	update();
+	finish();
 }
 
 } // namespace crpropa
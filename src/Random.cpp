@@ -59,9 +59,17 @@
 
 #include "crpropa/Random.h"
 
+#include "crpropa/Common.h"
 #include "crpropa/base64.h"
 
+#include <algorithm>
 #include <cstdio>
+#include <map>
+#include <stdexcept>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 namespace crpropa {
 
@@ -77,6 +85,26 @@ Random::Random() {
 	seed();
 }
 
+Random::Random(const Random &other) {
+	*this = other;
+}
+
+Random &Random::operator=(const Random &other) {
+	if (this == &other)
+		return *this;
+	std::copy(other.state, other.state + N, state);
+	initial_seed = other.initial_seed;
+	// the position in the own state, not in that of the other generator
+	pNext = state + (other.pNext - other.state);
+	left = other.left;
+	counterBased = other.counterBased;
+	std::copy(other.philoxKey, other.philoxKey + 2, philoxKey);
+	std::copy(other.philoxCounter, other.philoxCounter + 4, philoxCounter);
+	std::copy(other.philoxBlock, other.philoxBlock + 4, philoxBlock);
+	philoxLeft = other.philoxLeft;
+	return *this;
+}
+
 double Random::rand() {
 	return double(randInt()) * (1.0 / 4294967295.0);
 }
@@ -138,6 +166,22 @@ size_t Random::randBin(const std::vector<double> &cdf) {
 	return it - cdf.begin();
 }
 
+size_t Random::randBin(const AliasTable &table) {
+	return table.sample(rand());
+}
+
+size_t Random::randBin(const AliasTable &table, size_t row) {
+	return table.sample(row, rand());
+}
+
+size_t Random::randBin(const LazyAliasTable &table) {
+	return table.sample(rand());
+}
+
+size_t Random::randBin(const LazyAliasTable &table, size_t row) {
+	return table.sample(row, rand());
+}
+
 Vector3d Random::randVector() {
 	double z = randUniform(-1.0, 1.0);
 	double t = randUniform(-1.0 * M_PI, M_PI);
@@ -229,16 +273,78 @@ double Random::randExponential() {
 }
 
 uint32_t Random::randInt() {
+	if (counterBased) {
+		if (philoxLeft == 0)
+			philoxReload();
+		return philoxBlock[4 - philoxLeft--];
+	}
 	if (left == 0)
 		reload();
 	--left;
+	return temper(*pNext++);
+}
 
-	uint32_t s1;
-	s1 = *pNext++;
-	s1 ^= (s1 >> 11);
-	s1 ^= (s1 << 7) & 0x9d2c5680UL;
-	s1 ^= (s1 << 15) & 0xefc60000UL;
-	return (s1 ^ (s1 >> 18));
+CRPROPA_MULTIVERSION
+void Random::fillInt(uint32_t *out, size_t n) {
+	if (counterBased) {
+		for (size_t i = 0; i < n; i++)
+			out[i] = randInt();
+		return;
+	}
+	while (n > 0) {
+		if (left == 0)
+			reload();
+		// tempering of the state without dependencies, vectorizable
+		size_t m = std::min(n, size_t(left));
+		for (size_t i = 0; i < m; i++)
+			out[i] = temper(pNext[i]);
+		pNext += m;
+		left -= m;
+		out += m;
+		n -= m;
+	}
+}
+
+CRPROPA_MULTIVERSION
+void Random::fill(double *out, size_t n) {
+	uint32_t buffer[256];
+	while (n > 0) {
+		size_t m = std::min(n, size_t(256));
+		fillInt(buffer, m);
+		for (size_t i = 0; i < m; i++)
+			out[i] = double(buffer[i]) * (1.0 / 4294967295.0);
+		out += m;
+		n -= m;
+	}
+}
+
+void Random::fillNorm(double *out, size_t n, double mean, double variance) {
+	// uint32 pairs as randDblExc and randExc of randNorm
+	uint32_t buffer[256];
+	while (n > 0) {
+		size_t m = std::min(n, size_t(256));
+		size_t pairs = (m + 1) / 2;
+		fillInt(buffer, 2 * pairs);
+		for (size_t i = 0; i < pairs; i++) {
+			double u = (double(buffer[2 * i]) + 0.5) * (1.0 / 4294967296.0);
+			double r = sqrt(-2.0 * log(1.0 - u)) * variance;
+			double phi = 2.0 * M_PI * double(buffer[2 * i + 1]) * (1.0 / 4294967296.0);
+			out[2 * i] = mean + r * cos(phi);
+			if (2 * i + 1 < m)
+				out[2 * i + 1] = mean + r * sin(phi);
+		}
+		out += m;
+		n -= m;
+	}
+}
+
+void Random::fillExponential(double *out, size_t n) {
+	fill(out, n);
+	for (size_t i = 0; i < n; i++) {
+		while (out[i] < std::numeric_limits<double>::epsilon())
+			out[i] = rand();
+		out[i] = -1.0 * log(out[i]);
+	}
 }
 
 uint32_t Random::randInt(const uint32_t& n) {
@@ -262,9 +368,9 @@ uint32_t Random::randInt(const uint32_t& n) {
 
 uint64_t Random::randInt64()
 {
-	int64_t a = randInt();
-	int64_t b = randInt();
-	return (b + a << 32);
+	uint64_t a = randInt();
+	uint64_t b = randInt();
+	return (a << 32) + b;
 }
 
 
@@ -289,6 +395,7 @@ uint64_t Random::randInt64(const uint64_t &n)
 
 
 void Random::seed(const uint32_t oneSeed) {
+	counterBased = false;
 	initial_seed.resize(1);
 	initial_seed[0] = oneSeed;
 	initialize(oneSeed);
@@ -296,7 +403,7 @@ void Random::seed(const uint32_t oneSeed) {
 }
 
 void Random::seed(uint32_t * const bigSeed, const uint32_t seedLength) {
-
+	counterBased = false;
 	initial_seed.resize(seedLength);
 	for (size_t i =0; i< seedLength; i++)
 	{
@@ -381,6 +488,54 @@ void Random::reload() {
 	left = N, pNext = state;
 }
 
+void Random::seedCounter(uint64_t key, uint64_t stream) {
+	counterBased = true;
+	philoxKey[0] = uint32_t(key);
+	philoxKey[1] = uint32_t(key >> 32);
+	philoxCounter[0] = philoxCounter[1] = 0;
+	philoxCounter[2] = uint32_t(stream);
+	philoxCounter[3] = uint32_t(stream >> 32);
+	philoxLeft = 0;
+}
+
+bool Random::isCounterBased() const {
+	return counterBased;
+}
+
+uint64_t Random::getCounterStream() const {
+	return (uint64_t(philoxCounter[3]) << 32) + philoxCounter[2];
+}
+
+uint64_t Random::getCounterPosition() const {
+	// the counter is the next block, philoxLeft numbers of the last are left
+	uint64_t block = (uint64_t(philoxCounter[1]) << 32) + philoxCounter[0];
+	return 4 * block - philoxLeft;
+}
+
+void Random::philoxReload() {
+	uint32_t c0 = philoxCounter[0], c1 = philoxCounter[1];
+	uint32_t c2 = philoxCounter[2], c3 = philoxCounter[3];
+	uint32_t k0 = philoxKey[0], k1 = philoxKey[1];
+	for (int round = 0; round < 10; round++) {
+		uint64_t p0 = uint64_t(0xD2511F53UL) * c0;
+		uint64_t p1 = uint64_t(0xCD9E8D57UL) * c2;
+		c0 = uint32_t(p1 >> 32) ^ c1 ^ k0;
+		c1 = uint32_t(p1);
+		c2 = uint32_t(p0 >> 32) ^ c3 ^ k1;
+		c3 = uint32_t(p0);
+		k0 += 0x9E3779B9UL;
+		k1 += 0xBB67AE85UL;
+	}
+	philoxBlock[0] = c0;
+	philoxBlock[1] = c1;
+	philoxBlock[2] = c2;
+	philoxBlock[3] = c3;
+	philoxLeft = 4;
+	// 64 bit position within the stream
+	if (++philoxCounter[0] == 0)
+		++philoxCounter[1];
+}
+
 uint32_t Random::hash(time_t t, clock_t c) {
 	static uint32_t differ = 0; // guarantee time-based seeds will change
 
@@ -421,6 +576,7 @@ void Random::load(uint32_t * const loadArray) {
 	}
 	left = *la;
 	pNext = &state[N - left];
+	counterBased = false;
 }
 
 std::ostream& operator<<(std::ostream& os, const Random& mtrand) {
@@ -438,62 +594,333 @@ std::istream& operator>>(std::istream& is, Random& mtrand) {
 	}
 	is >> mtrand.left;
 	mtrand.pNext = &mtrand.state[mtrand.N - mtrand.left];
+	mtrand.counterBased = false;
 	return is;
 }
 
-#ifdef _OPENMP
-#include <omp.h>
-#include <stdexcept>
+// Jump-ahead of the Mersenne Twister (Haramoto et al. 2008): advancing the
+// state by J numbers is the linear map q(F) with q(x) = x^J mod p(x), where F
+// generates one number and p is its characteristic polynomial. Polynomials
+// over GF(2) of degree < MT_DEGREE are stored as words of bits, bit k the
+// coefficient of x^k.
+typedef std::vector<uint32_t> Polynomial;
+static const int MT_DEGREE = 19937;
+static const size_t POLYNOMIAL_WORDS = MT_DEGREE / 32 + 1;
+
+// exponents of the terms of p below x^19937, from the Berlekamp-Massey
+// algorithm on the low bit of the output
+static const int mtCharacteristic[] = {
+	0, 1189, 1416, 1585, 1643, 1870, 2493, 2773, 3000, 3227,
+	3454, 3681, 3908, 4135, 4362, 4753, 5661, 6337, 6569, 7129,
+	7477, 7525, 7583, 7752, 7979, 8206, 9505, 9901, 9969, 10128,
+	10693, 10761, 10920, 11089, 11147, 11157, 11215, 11321, 11374, 11384,
+	11485, 11611, 11712, 11717, 11838, 11881, 11944, 11997, 12277, 12335,
+	12393, 12504, 12509, 12620, 12673, 12731, 12736, 12789, 12905, 12958,
+	12963, 13137, 13185, 13190, 13243, 13301, 13412, 13528, 13533, 13639,
+	13697, 13760, 13813, 13866, 14093, 14151, 14209, 14320, 14325, 14436,
+	14547, 14552, 14605, 14721, 14774, 14779, 14953, 15001, 15006, 15059,
+	15117, 15228, 15344, 15349, 15455, 15513, 15576, 15629, 15682, 15909,
+	15967, 16025, 16136, 16141, 16252, 16363, 16368, 16421, 16537, 16590,
+	16595, 16817, 16822, 16875, 16933, 17044, 17160, 17271, 17329, 17445,
+	17498, 17725, 17783, 17841, 17952, 18068, 18179, 18237, 18406, 18633,
+	18691, 18860, 19087, 19314
+};
+
+// reduce a product of two polynomials modulo p
+static void polynomialReduce(Polynomial &a) {
+	const size_t terms = sizeof(mtCharacteristic) / sizeof(mtCharacteristic[0]);
+	for (int k = 32 * int(a.size()) - 1; k >= MT_DEGREE; k--) {
+		if (!((a[k / 32] >> (k % 32)) & 1))
+			continue;
+		a[k / 32] ^= uint32_t(1) << (k % 32);
+		int shift = k - MT_DEGREE;
+		for (size_t i = 0; i < terms; i++) {
+			int j = shift + mtCharacteristic[i];
+			a[j / 32] ^= uint32_t(1) << (j % 32);
+		}
+	}
+	a.resize(POLYNOMIAL_WORDS);
+}
+
+static Polynomial polynomialMultiply(const Polynomial &a, const Polynomial &b) {
+	// b shifted by 0..31 bits, to add it word by word
+	std::vector<Polynomial> shifted(32, Polynomial(POLYNOMIAL_WORDS + 1, 0));
+	for (size_t s = 0; s < 32; s++)
+		for (size_t w = 0; w < POLYNOMIAL_WORDS; w++) {
+			shifted[s][w] |= b[w] << s;
+			if (s > 0)
+				shifted[s][w + 1] |= b[w] >> (32 - s);
+		}
+	Polynomial product(2 * POLYNOMIAL_WORDS + 1, 0);
+	for (size_t k = 0; k < 32 * POLYNOMIAL_WORDS; k++) {
+		if (!((a[k / 32] >> (k % 32)) & 1))
+			continue;
+		const Polynomial &c = shifted[k % 32];
+		uint32_t *p = &product[k / 32];
+		for (size_t w = 0; w < c.size(); w++)
+			p[w] ^= c[w];
+	}
+	polynomialReduce(product);
+	return product;
+}
+
+static Polynomial polynomialSquare(const Polynomial &a) {
+	// the square of a polynomial over GF(2) spreads its coefficients
+	Polynomial square(2 * POLYNOMIAL_WORDS, 0);
+	for (size_t k = 0; k < 32 * POLYNOMIAL_WORDS; k++)
+		if ((a[k / 32] >> (k % 32)) & 1)
+			square[k / 16] |= uint32_t(1) << ((2 * k) % 32);
+	polynomialReduce(square);
+	return square;
+}
+
+// base^e mod p
+static Polynomial polynomialPower(Polynomial base, uint64_t e) {
+	Polynomial result(POLYNOMIAL_WORDS, 0);
+	result[0] = 1;
+	while (e > 0) {
+		if (e & 1)
+			result = polynomialMultiply(result, base);
+		e >>= 1;
+		if (e > 0)
+			base = polynomialSquare(base);
+	}
+	return result;
+}
+
+// x^(2^64) mod p, the jump of one stream
+static const Polynomial &streamPolynomial() {
+	static Polynomial q;
+#pragma omp critical(RandomJump)
+	{
+		if (q.empty()) {
+			Polynomial x(POLYNOMIAL_WORDS, 0);
+			x[0] = 2;
+			for (int i = 0; i < 64; i++)
+				x = polynomialSquare(x);
+			q = x;
+		}
+	}
+	return q;
+}
+
+void Random::jumpPolynomial(const std::vector<uint32_t> &q) {
+	// Horner's scheme on the circular window acc of N words starting at start
+	uint32_t acc[N];
+	std::fill(acc, acc + N, 0);
+	int start = 0;
+	for (int k = 32 * int(q.size()) - 1; k >= 0; k--) {
+		uint32_t *p = acc + start;
+		uint32_t *pm = acc + (start + M) % N;
+		uint32_t *p1 = acc + (start + 1) % N;
+		*p = twist(*pm, *p, *p1);
+		start = (start + 1) % N;
+		if ((q[k / 32] >> (k % 32)) & 1) {
+			for (int t = 0; t < N - start; t++)
+				acc[start + t] ^= state[t];
+			for (int t = N - start; t < N; t++)
+				acc[start + t - N] ^= state[t];
+		}
+	}
+	for (int t = 0; t < N; t++)
+		state[t] = acc[(start + t) % N];
+	pNext = &state[N - left];
+}
+
+void Random::jump(uint64_t steps) {
+	if (counterBased) {
+		for (; (steps > 0) && (philoxLeft > 0); steps--)
+			randInt();
+		uint64_t position = (uint64_t(philoxCounter[1]) << 32) + philoxCounter[0] + steps / 4;
+		philoxCounter[0] = uint32_t(position);
+		philoxCounter[1] = uint32_t(position >> 32);
+		for (steps %= 4; steps > 0; steps--)
+			randInt();
+		return;
+	}
+	// short jumps are cheaper by drawing
+	if (steps < 16 * uint64_t(N)) {
+		for (; steps > 0; steps--)
+			randInt();
+		return;
+	}
+	Polynomial x(POLYNOMIAL_WORDS, 0);
+	x[0] = 2;
+	jumpPolynomial(polynomialPower(x, steps));
+}
 
-// see http://stackoverflow.com/questions/8051108/using-the-openmp-threadprivate-directive-on-static-instances-of-c-stl-types
-const static int MAX_THREAD = 256;
+void Random::jumpStreams(uint64_t n) {
+	if (counterBased)
+		throw std::runtime_error("crpropa::Random: jumpStreams needs the Mersenne Twister, use the stream of seedCounter");
+	if (n > 0)
+		jumpPolynomial(polynomialPower(streamPolynomial(), n));
+}
 
-struct RANDOM_TLS_ITEM {
-	Random r;
-	char padding[(sizeof(Random) / 64 + 1) * 64 - sizeof(Random)];
+// Generators of the threads by stream number. Each thread claims a stream
+// on its first call of instance() and keeps a pointer to its generator; the
+// generators are never removed, so that streams of finished threads are not
+// reused and their states can still be saved.
+struct ThreadRandom {
+	Random random;
+	bool claimed; ///< used by a thread, otherwise only loaded or seeded
+	ThreadRandom() : claimed(false) {}
 };
+typedef std::map<uint64_t, ThreadRandom> ThreadRandomMap;
+
+// how new generators are seeded, see seedThreads
+static int threadSeedMode = 0; // 0: /dev/urandom, 1: oneSeed, 2: oneSeed and stream, 3: disjoint
+static uint32_t threadSeed = 0;
+static uint32_t threadSeedStream = 0;
+// saved states of the disjoint streams 0, 1, ... of seedThreadsDisjoint
+static std::vector< std::vector<uint32_t> > disjointStates;
+// streams of threads without an OpenMP thread number of their own
+static uint64_t nextExtraStream = 65536;
+
+static __thread Random *threadRandom = 0;
+
+static ThreadRandomMap &threadRandoms() {
+	// never destroyed, threads may still use their generators at exit
+	static ThreadRandomMap *m = new ThreadRandomMap;
+	return *m;
+}
 
-#ifdef _MSC_VER
-__declspec(align(64)) static RANDOM_TLS_ITEM _tls[MAX_THREAD];
-#else
-__attribute__ ((aligned(64))) static RANDOM_TLS_ITEM _tls[MAX_THREAD];
+static void seedThreadRandom(Random &random, uint64_t stream) {
+	if (threadSeedMode == 1) {
+		random.seed(uint32_t(threadSeed + stream));
+	} else if (threadSeedMode == 2) {
+		uint32_t bigSeed[3] = {threadSeed, threadSeedStream, uint32_t(stream)};
+		random.seed(bigSeed, 3);
+	} else if (threadSeedMode == 3) {
+		random.seed(threadSeed);
+		if (stream >= 65536) {
+			random.load(&disjointStates[0][0]);
+			random.jumpStreams(stream);
+			return;
+		}
+		// each stream continues where the previous one ends
+		while (disjointStates.size() <= stream) {
+			random.load(&disjointStates.back()[0]);
+			random.jumpStreams(1);
+			disjointStates.push_back(std::vector<uint32_t>(Random::SAVE));
+			random.save(&disjointStates.back()[0]);
+		}
+		random.load(&disjointStates[stream][0]);
+	}
+}
+
+// Stream of the calling thread: the thread number in the outermost parallel
+// region (0 outside), as long as it is not taken by another thread, e.g.
+// by a thread that is not created by OpenMP or in a nested region.
+static Random *claimThreadRandom() {
+	ThreadRandomMap &m = threadRandoms();
+	uint64_t stream = 0;
+	bool extra = false;
+#ifdef _OPENMP
+	if (omp_get_level() > 1)
+		extra = true;
+	else
+		stream = omp_get_thread_num();
 #endif
+	ThreadRandomMap::iterator it = m.find(stream);
+	if (extra || ((it != m.end()) && it->second.claimed)) {
+		while (m.count(nextExtraStream))
+			nextExtraStream++;
+		stream = nextExtraStream++;
+		it = m.end();
+	}
+	if (it == m.end()) {
+		it = m.insert(std::make_pair(stream, ThreadRandom())).first;
+		seedThreadRandom(it->second.random, stream);
+	}
+	it->second.claimed = true;
+	return &it->second.random;
+}
 
 Random &Random::instance() {
-	int i = omp_get_thread_num();
-	if (i >= MAX_THREAD)
-	throw std::runtime_error("crpropa::Random: more than MAX_THREAD threads!");
-	return _tls[i].r;
+	if (threadRandom == 0) {
+#pragma omp critical(RandomThreads)
+		threadRandom = claimThreadRandom();
+	}
+	return *threadRandom;
 }
 
 void Random::seedThreads(const uint32_t oneSeed) {
-	for(size_t i = 0; i < MAX_THREAD; ++i)
-	_tls[i].r.seed(oneSeed + i);
+#pragma omp critical(RandomThreads)
+	{
+		threadSeedMode = 1;
+		threadSeed = oneSeed;
+		ThreadRandomMap &m = threadRandoms();
+		for (ThreadRandomMap::iterator it = m.begin(); it != m.end(); ++it)
+			seedThreadRandom(it->second.random, it->first);
+	}
 }
 
-std::vector< std::vector<uint32_t> > Random::getSeedThreads()
-{
-	std::vector< std::vector<uint32_t> > seeds;
-	for(size_t i = 0; i < omp_get_num_threads(); ++i)
-		seeds.push_back(_tls[i].r.getSeed() ); 
-	return seeds;
+void Random::seedThreads(const uint32_t oneSeed, const uint32_t stream) {
+#pragma omp critical(RandomThreads)
+	{
+		threadSeedMode = 2;
+		threadSeed = oneSeed;
+		threadSeedStream = stream;
+		ThreadRandomMap &m = threadRandoms();
+		for (ThreadRandomMap::iterator it = m.begin(); it != m.end(); ++it)
+			seedThreadRandom(it->second.random, it->first);
+	}
 }
 
-#else
-static Random _random;
-Random &Random::instance() {
-	return _random;
-}
-void Random::seedThreads(const uint32_t oneSeed) {
-	_random.seed(oneSeed);
+void Random::seedThreadsDisjoint(const uint32_t oneSeed, const uint32_t stream) {
+#pragma omp critical(RandomThreads)
+	{
+		threadSeedMode = 3;
+		threadSeed = oneSeed;
+		threadSeedStream = stream;
+		Random first(oneSeed);
+		first.jumpStreams(uint64_t(stream) << 32);
+		disjointStates.assign(1, std::vector<uint32_t>(Random::SAVE));
+		first.save(&disjointStates[0][0]);
+		ThreadRandomMap &m = threadRandoms();
+		for (ThreadRandomMap::iterator it = m.begin(); it != m.end(); ++it)
+			seedThreadRandom(it->second.random, it->first);
+	}
 }
+
 std::vector< std::vector<uint32_t> > Random::getSeedThreads()
 {
 	std::vector< std::vector<uint32_t> > seeds;
-		seeds.push_back(_random.getSeed() ); 
+#pragma omp critical(RandomThreads)
+	{
+		ThreadRandomMap &m = threadRandoms();
+		for (ThreadRandomMap::iterator it = m.begin(); it != m.end(); ++it)
+			seeds.push_back(it->second.random.getSeed());
+	}
 	return seeds;
 }
-#endif
+
+void Random::saveThreads(std::ostream &os) {
+#pragma omp critical(RandomThreads)
+	{
+		ThreadRandomMap &m = threadRandoms();
+		os << m.size() << "\n";
+		for (ThreadRandomMap::iterator it = m.begin(); it != m.end(); ++it)
+			os << it->first << "\t" << it->second.random << "\n";
+	}
+}
+
+void Random::loadThreads(std::istream &is) {
+	size_t n = 0;
+	is >> n;
+#pragma omp critical(RandomThreads)
+	{
+		ThreadRandomMap &m = threadRandoms();
+		for (size_t i = 0; (i < n) && is; ++i) {
+			uint64_t stream = 0;
+			is >> stream;
+			if (is)
+				is >> m[stream].random;
+		}
+	}
+	if (!is)
+		throw std::runtime_error("crpropa::Random: could not load thread states");
+}
 
 const std::string Random::getSeed_base64() const
 {
@@ -507,5 +934,148 @@ void Random::seed(const std::string &b64Seed)
 	seed((uint32_t*)decoded_data.c_str(), seedSize );
 }
 
-} // namespace crpropa
 
+// Vose's construction of the alias table of one row from a cumulative distribution
+template<typename T>
+static void buildAliasTable(const T *cdf, size_t n, AliasTable::Bin *bin) {
+	for (size_t i = 0; i < n; i++) {
+		bin[i].probability = 1.;
+		bin[i].alias = i;
+	}
+	if (!(cdf[n - 1] > 0)) {
+		// nothing to distribute, the first bin as from randBin
+		for (size_t i = 0; i < n; i++) {
+			bin[i].probability = 0.;
+			bin[i].alias = 0;
+		}
+		return;
+	}
+
+	// bin weights scaled to a mean of 1, split in bins below and above
+	std::vector<double> weight(n);
+	std::vector<size_t> small, large;
+	for (size_t i = 0; i < n; i++) {
+		double w = cdf[i] - ((i > 0) ? cdf[i - 1] : 0);
+		weight[i] = w * n / cdf[n - 1];
+		if (weight[i] < 1)
+			small.push_back(i);
+		else
+			large.push_back(i);
+	}
+
+	// fill each small bin up with a large one
+	while (!small.empty() && !large.empty()) {
+		size_t s = small.back();
+		size_t l = large.back();
+		small.pop_back();
+		bin[s].probability = weight[s];
+		bin[s].alias = l;
+		weight[l] -= 1 - weight[s];
+		if (weight[l] < 1) {
+			large.pop_back();
+			small.push_back(l);
+		}
+	}
+	// the remaining bins are full up to rounding, keep zero width bins empty
+	for (size_t i = 0; i < small.size(); i++)
+		if (cdf[small[i]] == ((small[i] > 0) ? cdf[small[i] - 1] : 0))
+			bin[small[i]].probability = 0;
+}
+
+template<typename T>
+static void buildAliasTable(const std::vector<T> &cdf, size_t rows,
+		std::vector<AliasTable::Bin> &table, size_t &bins) {
+	if ((rows == 0) || cdf.empty() || (cdf.size() % rows != 0))
+		throw std::runtime_error("AliasTable: no bins or rows of unequal size");
+	if (cdf.size() / rows > std::numeric_limits<uint32_t>::max())
+		throw std::runtime_error("AliasTable: too many bins per row");
+	bins = cdf.size() / rows;
+	table.resize(cdf.size());
+	// the rows are independent
+#pragma omp parallel for schedule(static) if (rows > 1)
+	for (long r = 0; r < long(rows); r++)
+		buildAliasTable(&cdf[r * bins], bins, &table[r * bins]);
+}
+
+AliasTable::AliasTable() :
+		bins(0) {
+}
+
+AliasTable::AliasTable(const std::vector<double> &cdf) {
+	setCDF(cdf);
+}
+
+AliasTable::AliasTable(const std::vector<float> &cdf) {
+	setCDF(cdf);
+}
+
+void AliasTable::setCDF(const std::vector<double> &cdf) {
+	buildAliasTable(cdf, 1, table, bins);
+}
+
+void AliasTable::setCDF(const std::vector<float> &cdf) {
+	buildAliasTable(cdf, 1, table, bins);
+}
+
+void AliasTable::setCDF(const std::vector<double> &cdf, size_t rows) {
+	buildAliasTable(cdf, rows, table, bins);
+}
+
+size_t AliasTable::size() const {
+	return bins;
+}
+
+size_t AliasTable::rows() const {
+	return (bins > 0) ? table.size() / bins : 0;
+}
+
+size_t AliasTable::getMemory() const {
+	return table.capacity() * sizeof(Bin);
+}
+
+LazyAliasTable::LazyAliasTable() :
+		rowCount(0), built(0) {
+}
+
+void LazyAliasTable::add(double weight) {
+	if (rowCount > 1)
+		throw std::runtime_error("LazyAliasTable: add to a table of several rows");
+	cdf.push_back(cdf.empty() ? weight : (cdf.back() + weight));
+	rowCount = 1;
+	built = 0;
+}
+
+void LazyAliasTable::addRow(const std::vector<double> &rowCDF) {
+	if (rowCDF.empty() || ((rowCount > 0) && (rowCDF.size() != cdf.size() / rowCount)))
+		throw std::runtime_error("LazyAliasTable: rows of unequal size");
+	cdf.insert(cdf.end(), rowCDF.begin(), rowCDF.end());
+	rowCount++;
+	built = 0;
+}
+
+void LazyAliasTable::clear() {
+	cdf.clear();
+	rowCount = 0;
+	table = AliasTable();
+	built = 0;
+}
+
+bool LazyAliasTable::empty() const {
+	return cdf.empty();
+}
+
+const std::vector<double> &LazyAliasTable::getCDF() const {
+	return cdf;
+}
+
+void LazyAliasTable::build() const {
+	if (cdf.empty())
+		throw std::runtime_error("LazyAliasTable: no bins");
+#pragma omp critical(LazyAliasTable)
+	if (!__atomic_load_n(&built, __ATOMIC_RELAXED)) {
+		table.setCDF(cdf, rowCount);
+		__atomic_store_n(&built, 1, __ATOMIC_RELEASE);
+	}
+}
+
+} // namespace crpropa
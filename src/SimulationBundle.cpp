@@ -0,0 +1,181 @@
+#include "crpropa/SimulationBundle.h"
+#include "crpropa/DataTable.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <stdint.h>
+#include <sys/stat.h>
+
+namespace crpropa {
+
+// layout: magic, entries, per entry type, name length, name, offset and size,
+// then the data of the entries, each at a multiple of the page size
+static const char bundleMagic[8] = {'C', 'R', 'P', 'B', 'N', 'D', 'L', '1'};
+static const uint64_t BUNDLE_ALIGNMENT = 4096;
+
+enum EntryType {
+	TableEntry = 1, FileEntry = 2
+};
+
+namespace {
+
+struct Entry {
+	uint64_t type;
+	ref_ptr<MappedFile> bundle;
+	uint64_t offset, size;
+};
+
+std::map<std::string, Entry> entries;
+
+} // namespace
+
+static uint64_t aligned(uint64_t n) {
+	return (n + BUNDLE_ALIGNMENT - 1) / BUNDLE_ALIGNMENT * BUNDLE_ALIGNMENT;
+}
+
+void SimulationBundle::create(const std::string &filename,
+		const std::vector<std::string> &files) {
+	std::vector<std::string> tableNames = DataTable::getFilenames();
+	std::vector<ref_ptr<DataTable> > tables;
+	std::vector<std::string> names;
+	std::vector<uint64_t> types, sizes;
+	for (size_t i = 0; i < tableNames.size(); i++) {
+		ref_ptr<DataTable> table = DataTable::open(tableNames[i]);
+		if (!table.valid())
+			continue;
+		tables.push_back(table);
+		names.push_back(tableNames[i]);
+		types.push_back(TableEntry);
+		sizes.push_back(table->getBinarySize());
+	}
+	for (size_t i = 0; i < files.size(); i++) {
+		struct stat st;
+		if (stat(files[i].c_str(), &st) != 0)
+			throw std::runtime_error("SimulationBundle: " + files[i] + " not found");
+		names.push_back(files[i]);
+		types.push_back(FileEntry);
+		sizes.push_back(st.st_size);
+	}
+
+	// the directory, then the entries
+	uint64_t count = names.size();
+	uint64_t directory = 8 + 8;
+	for (size_t i = 0; i < names.size(); i++)
+		directory += 4 * 8 + names[i].size();
+	std::vector<uint64_t> offsets(count);
+	uint64_t offset = aligned(directory);
+	for (size_t i = 0; i < count; i++) {
+		offsets[i] = offset;
+		offset = aligned(offset + sizes[i]);
+	}
+
+	// written completely before other processes can see it
+	std::string tmp = filename + ".tmp";
+	std::ofstream out(tmp.c_str(), std::ios::binary);
+	if (!out.good())
+		throw std::runtime_error("SimulationBundle: could not write file " + tmp);
+	out.write(bundleMagic, 8);
+	out.write((const char *) &count, 8);
+	for (size_t i = 0; i < count; i++) {
+		uint64_t length = names[i].size();
+		out.write((const char *) &types[i], 8);
+		out.write((const char *) &length, 8);
+		out.write(names[i].data(), length);
+		out.write((const char *) &offsets[i], 8);
+		out.write((const char *) &sizes[i], 8);
+	}
+	std::vector<char> buffer(1 << 20);
+	for (size_t i = 0; i < count; i++) {
+		std::vector<char> padding(offsets[i] - out.tellp(), 0);
+		if (!padding.empty())
+			out.write(&padding[0], padding.size());
+		if (i < tables.size()) {
+			tables[i]->write(out);
+			continue;
+		}
+		std::ifstream in(names[i].c_str(), std::ios::binary);
+		while (in) {
+			in.read(&buffer[0], buffer.size());
+			out.write(&buffer[0], in.gcount());
+		}
+	}
+	out.close();
+	if (!out || (std::rename(tmp.c_str(), filename.c_str()) != 0)) {
+		std::remove(tmp.c_str());
+		throw std::runtime_error("SimulationBundle: could not write file " + filename);
+	}
+}
+
+void SimulationBundle::open(const std::string &filename) {
+	ref_ptr<MappedFile> file = new MappedFile(filename);
+	const char *p = (const char *) file->getData();
+	const char *end = p + file->getSize();
+	uint64_t count;
+	if ((end - p < 16) || (memcmp(p, bundleMagic, 8) != 0))
+		throw std::runtime_error("SimulationBundle: " + filename + " is no bundle");
+	memcpy(&count, p + 8, 8);
+	p += 16;
+
+	std::map<std::string, Entry> found;
+	for (uint64_t i = 0; i < count; i++) {
+		Entry e;
+		uint64_t length;
+		if (end - p < 16)
+			throw std::runtime_error("SimulationBundle: " + filename + " is truncated");
+		memcpy(&e.type, p, 8);
+		memcpy(&length, p + 8, 8);
+		p += 16;
+		if ((uint64_t) (end - p) < length + 16)
+			throw std::runtime_error("SimulationBundle: " + filename + " is truncated");
+		std::string name(p, length);
+		memcpy(&e.offset, p + length, 8);
+		memcpy(&e.size, p + length + 8, 8);
+		p += length + 16;
+		if (e.offset + e.size > file->getSize())
+			throw std::runtime_error("SimulationBundle: " + filename + " is truncated");
+		e.bundle = file;
+		found[name] = e;
+	}
+
+	#pragma omp critical(SimulationBundle)
+	for (std::map<std::string, Entry>::iterator i = found.begin(); i != found.end(); ++i)
+		entries[i->first] = i->second;
+}
+
+void SimulationBundle::close() {
+	#pragma omp critical(SimulationBundle)
+	entries.clear();
+}
+
+static ref_ptr<MappedFile> getEntry(const std::string &filename, uint64_t type) {
+	ref_ptr<MappedFile> region;
+	#pragma omp critical(SimulationBundle)
+	{
+		std::map<std::string, Entry>::iterator i = entries.find(filename);
+		if ((i != entries.end()) && (i->second.type == type))
+			region = new MappedFile(i->second.bundle, i->second.offset,
+					i->second.size, filename);
+	}
+	return region;
+}
+
+ref_ptr<MappedFile> SimulationBundle::getTable(const std::string &filename) {
+	return getEntry(filename, TableEntry);
+}
+
+ref_ptr<MappedFile> SimulationBundle::getFile(const std::string &filename) {
+	return getEntry(filename, FileEntry);
+}
+
+std::vector<std::string> SimulationBundle::getNames() {
+	std::vector<std::string> names;
+	#pragma omp critical(SimulationBundle)
+	for (std::map<std::string, Entry>::iterator i = entries.begin(); i != entries.end(); ++i)
+		names.push_back(i->first);
+	return names;
+}
+
+} // namespace crpropa
@@ -0,0 +1,315 @@
+#include "crpropa/SimulationPool.h"
+#include "crpropa/Random.h"
+
+#if _OPENMP
+#include <omp.h>
+#endif
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace crpropa {
+
+SimulationJob::SimulationJob(SourceInterface *source, size_t count,
+		size_t first, bool recursive) :
+		source(source), count(count), first(first), recursive(recursive) {
+	init();
+}
+
+SimulationJob::SimulationJob(const ModuleList::candidate_vector_t &candidates,
+		size_t first, bool recursive) :
+		candidates(candidates), count(candidates.size()), first(first),
+		recursive(recursive) {
+	init();
+}
+
+void SimulationJob::init() {
+	next = 0;
+	assigned = 0;
+	completed = 0;
+	closed = false;
+	finished = false;
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&changed, NULL);
+}
+
+SimulationJob::~SimulationJob() {
+	pthread_cond_destroy(&changed);
+	pthread_mutex_destroy(&mutex);
+}
+
+bool SimulationJob::close(size_t n) {
+	pthread_mutex_lock(&mutex);
+	closed = true;
+	assigned = n;
+	bool done = (completed == assigned);
+	if (done) {
+		finished = true;
+		pthread_cond_broadcast(&changed);
+	}
+	pthread_mutex_unlock(&mutex);
+	return done;
+}
+
+bool SimulationJob::complete(size_t n, const std::string &e) {
+	pthread_mutex_lock(&mutex);
+	completed += n;
+	if (error.empty())
+		error = e;
+	bool done = closed && (completed == assigned);
+	if (done) {
+		finished = true;
+		pthread_cond_broadcast(&changed);
+	}
+	pthread_mutex_unlock(&mutex);
+	return done;
+}
+
+bool SimulationJob::isDone() const {
+	pthread_mutex_lock(&mutex);
+	bool done = finished;
+	pthread_mutex_unlock(&mutex);
+	return done;
+}
+
+void SimulationJob::wait() const {
+	pthread_mutex_lock(&mutex);
+	while (!finished)
+		pthread_cond_wait(&changed, &mutex);
+	std::string e = error;
+	pthread_mutex_unlock(&mutex);
+	if (!e.empty())
+		throw std::runtime_error("SimulationJob: " + e);
+}
+
+size_t SimulationJob::getCount() const {
+	return count;
+}
+
+size_t SimulationJob::getNumberOfCompleted() const {
+	pthread_mutex_lock(&mutex);
+	size_t n = completed;
+	pthread_mutex_unlock(&mutex);
+	return n;
+}
+
+const ModuleList::candidate_vector_t &SimulationJob::getCandidates() const {
+	return candidates;
+}
+
+SimulationPool::SimulationPool(ModuleList *modules, size_t threads) :
+		modules(modules), threads(threads), chunkSize(16), submitted(0),
+		unfinished(0), stop(false) {
+	if (!modules)
+		throw std::runtime_error("SimulationPool: no module list");
+#if _OPENMP
+	if (threads == 0)
+		this->threads = omp_get_max_threads();
+#else
+	this->threads = 1;
+#endif
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&changed, NULL);
+	pthread_cond_init(&idle, NULL);
+	if (pthread_create(&team, NULL, teamMain, this) != 0) {
+		pthread_cond_destroy(&idle);
+		pthread_cond_destroy(&changed);
+		pthread_mutex_destroy(&mutex);
+		throw std::runtime_error("SimulationPool: could not start the threads");
+	}
+}
+
+SimulationPool::~SimulationPool() {
+	cancel();
+	pthread_mutex_lock(&mutex);
+	stop = true;
+	pthread_cond_broadcast(&changed);
+	pthread_mutex_unlock(&mutex);
+	pthread_join(team, NULL);
+	pthread_cond_destroy(&idle);
+	pthread_cond_destroy(&changed);
+	pthread_mutex_destroy(&mutex);
+}
+
+void *SimulationPool::teamMain(void *pool) {
+	SimulationPool *self = (SimulationPool *) pool;
+	// the team stays in this region until the pool is destroyed
+#pragma omp parallel num_threads(self->threads)
+	self->work();
+	return NULL;
+}
+
+void SimulationPool::work() {
+	ref_ptr<SimulationJob> job;
+	size_t begin, end;
+	while (nextChunk(job, begin, end))
+		runChunk(job, begin, end);
+}
+
+bool SimulationPool::nextChunk(ref_ptr<SimulationJob> &job, size_t &begin,
+		size_t &end) {
+	pthread_mutex_lock(&mutex);
+	while (queue.empty() && !stop)
+		pthread_cond_wait(&changed, &mutex);
+	if (queue.empty()) {
+		pthread_mutex_unlock(&mutex);
+		return false;
+	}
+	job = queue.front();
+	begin = job->next;
+	end = std::min(job->count, begin + chunkSize);
+	job->next = end;
+	if (end == job->count) {
+		queue.pop_front();
+		// the chunk is in flight, the job does not finish here
+		job->close(end);
+	}
+	pthread_mutex_unlock(&mutex);
+	return true;
+}
+
+void SimulationPool::runChunk(SimulationJob *job, size_t begin, size_t end) {
+	bool counterBased = modules->getCounterBasedRandom();
+	uint64_t key = modules->getRandomKey();
+	std::string error;
+	try {
+		// secondary tasks of the primaries are done with the chunk
+#if _OPENMP >= 201307
+#pragma omp taskgroup
+#endif
+		{
+			if (!job->source) {
+				for (size_t i = begin; i < end; i++) {
+					if (counterBased)
+						Random::instance().seedCounter(key, job->first + i);
+					modules->run(job->candidates[i], job->recursive);
+				}
+			} else if (counterBased) {
+				// the stream of a primary depends only on its index
+				for (size_t i = begin; i < end; i++) {
+					Random::instance().seedCounter(key, job->first + i);
+					ref_ptr<Candidate> candidate = job->source->getCandidate();
+					if (candidate.valid())
+						modules->run(candidate, job->recursive);
+				}
+			} else {
+				ModuleList::candidate_vector_t batch;
+				job->source->getCandidates(end - begin, batch);
+				for (size_t i = 0; i < batch.size(); i++)
+					modules->run(batch[i], job->recursive);
+			}
+		}
+	} catch (std::exception &e) {
+		error = e.what();
+	}
+
+	// a failed job hands out no further primaries
+	if (!error.empty()) {
+		pthread_mutex_lock(&mutex);
+		if (job->next < job->count) {
+			job->close(job->next);
+			job->next = job->count;
+			for (size_t i = 0; i < queue.size(); i++)
+				if (queue[i] == job) {
+					queue.erase(queue.begin() + i);
+					break;
+				}
+		}
+		pthread_mutex_unlock(&mutex);
+	}
+	if (job->complete(end - begin, error))
+		finished();
+}
+
+void SimulationPool::finished() {
+	pthread_mutex_lock(&mutex);
+	unfinished--;
+	pthread_cond_broadcast(&idle);
+	pthread_mutex_unlock(&mutex);
+}
+
+ref_ptr<SimulationJob> SimulationPool::enqueue(SimulationJob *j) {
+	ref_ptr<SimulationJob> job = j;
+	if (job->count == 0) {
+		job->close(0);
+		return job;
+	}
+	pthread_mutex_lock(&mutex);
+	queue.push_back(job);
+	unfinished++;
+	pthread_cond_broadcast(&changed);
+	pthread_mutex_unlock(&mutex);
+	return job;
+}
+
+ref_ptr<SimulationJob> SimulationPool::submit(SourceInterface *source,
+		size_t count, bool recursive) {
+	if (!source)
+		throw std::runtime_error("SimulationPool: no source");
+	pthread_mutex_lock(&mutex);
+	size_t first = submitted;
+	submitted += count;
+	pthread_mutex_unlock(&mutex);
+	return enqueue(new SimulationJob(source, count, first, recursive));
+}
+
+ref_ptr<SimulationJob> SimulationPool::feed(
+		const ModuleList::candidate_vector_t &candidates, bool recursive) {
+	pthread_mutex_lock(&mutex);
+	size_t first = submitted;
+	submitted += candidates.size();
+	pthread_mutex_unlock(&mutex);
+	return enqueue(new SimulationJob(candidates, first, recursive));
+}
+
+void SimulationPool::wait() const {
+	pthread_mutex_lock(&mutex);
+	while (unfinished > 0)
+		pthread_cond_wait(&idle, &mutex);
+	pthread_mutex_unlock(&mutex);
+}
+
+void SimulationPool::cancel() {
+	size_t done = 0;
+	pthread_mutex_lock(&mutex);
+	for (size_t i = 0; i < queue.size(); i++) {
+		SimulationJob *job = queue[i];
+		if (job->close(job->next))
+			done++;
+		job->next = job->count;
+	}
+	queue.clear();
+	unfinished -= done;
+	if (done > 0)
+		pthread_cond_broadcast(&idle);
+	pthread_mutex_unlock(&mutex);
+}
+
+size_t SimulationPool::getNumberOfThreads() const {
+	return threads;
+}
+
+void SimulationPool::setChunkSize(size_t n) {
+	if (n == 0)
+		throw std::runtime_error("SimulationPool: chunk size 0");
+	pthread_mutex_lock(&mutex);
+	chunkSize = n;
+	pthread_mutex_unlock(&mutex);
+}
+
+size_t SimulationPool::getChunkSize() const {
+	return chunkSize;
+}
+
+size_t SimulationPool::getNumberOfJobs() const {
+	pthread_mutex_lock(&mutex);
+	size_t n = unfinished;
+	pthread_mutex_unlock(&mutex);
+	return n;
+}
+
+ModuleList *SimulationPool::getModuleList() const {
+	return modules;
+}
+
+} // namespace crpropa
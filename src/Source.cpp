@@ -5,6 +5,8 @@
 #include "crpropa/Units.h"
 #include "crpropa/ParticleID.h"
 
+#include "kiss/logger.h"
+
 #ifdef CRPROPA_HAVE_MUPARSER
 #include "muParser.h"
 #endif
@@ -14,6 +16,17 @@
 
 namespace crpropa {
 
+// SourceInterface ------------------------------------------------------------
+void SourceInterface::getCandidates(size_t n,
+		std::vector<ref_ptr<Candidate> > &candidates) const {
+	for (size_t i = 0; i < n; i++)
+		candidates.push_back(getCandidate());
+}
+
+void SourceInterface::getConfiguration(Configuration &configuration) const {
+	throw std::runtime_error("SourceInterface: no configuration of " + getDescription());
+}
+
 // Source ---------------------------------------------------------------------
 void Source::add(SourceFeature* property) {
 	features.push_back(property);
@@ -26,6 +39,20 @@ ref_ptr<Candidate> Source::getCandidate() const {
 	return candidate;
 }
 
+void Source::getCandidates(size_t n,
+		std::vector<ref_ptr<Candidate> > &candidates) const {
+	size_t first = candidates.size();
+	std::vector<Candidate *> batch(n);
+	for (size_t i = 0; i < n; i++) {
+		candidates.push_back(new Candidate());
+		batch[i] = candidates.back();
+	}
+	if (n == 0)
+		return;
+	for (int i = 0; i < features.size(); i++)
+		(*features[i]).prepareCandidates(&batch[0], n);
+}
+
 std::string Source::getDescription() const {
 	std::stringstream ss;
 	ss << "Cosmic ray source\n";
@@ -34,21 +61,220 @@ std::string Source::getDescription() const {
 	return ss.str();
 }
 
+void Source::getConfiguration(Configuration &c) const {
+	c.setType("Source");
+	c.setList("features", features);
+}
+
+// AdaptiveSourceSampling -----------------------------------------------------
+static int adaptiveSamplingInstances = 0;
+
+AdaptiveSourceSampling::AdaptiveSourceSampling(size_t pilot, double mixing) :
+		pilot(pilot), mixing(mixing), drawnTotal(0), adaptedFlag(0),
+		lock("AdaptiveSourceSampling") {
+	if (!((mixing > 0) && (mixing <= 1)))
+		throw std::runtime_error("AdaptiveSourceSampling: mixing not in (0, 1]");
+	std::stringstream key;
+	key << "AdaptiveSourceSampling" << __sync_add_and_fetch(&adaptiveSamplingInstances, 1) << ".index";
+	indexKey = PropertyKey(key.str());
+}
+
+void AdaptiveSourceSampling::add(double luminosity) {
+	luminosities.add(luminosity);
+	drawn.push_back(0);
+	detected.push_back(0);
+	if (adaptedFlag)
+		build();
+}
+
+size_t AdaptiveSourceSampling::size() const {
+	return drawn.size();
+}
+
+void AdaptiveSourceSampling::build() const {
+	const std::vector<double> &cdf = luminosities.getCDF();
+	size_t n = cdf.size();
+	std::vector<double> p(n), e(n, 0);
+	double norm = 0;
+	for (size_t i = 0; i < n; i++) {
+		p[i] = (i == 0) ? cdf[0] : (cdf[i] - cdf[i - 1]);
+		if (drawn[i] > 0)
+			e[i] = detected[i] / drawn[i];
+		norm += p[i] * e[i];
+	}
+	double total = (n > 0) ? cdf.back() : 0;
+	if (!(norm > 0))
+		KISS_LOG_WARNING << "AdaptiveSourceSampling: no detections in the pilot phase, sources drawn by their luminosities";
+
+	adapted.clear();
+	weights.assign(n, 0);
+	for (size_t i = 0; i < n; i++) {
+		double q = (norm > 0) ? ((1 - mixing) * p[i] * e[i] / norm + mixing * p[i] / total) : p[i] / total;
+		adapted.add(q);
+		if (q > 0)
+			weights[i] = p[i] / total / q;
+	}
+}
+
+size_t AdaptiveSourceSampling::draw(double &weight, bool &isPilot) const {
+	if (drawn.empty())
+		throw std::runtime_error("AdaptiveSourceSampling: no sources");
+	Random &random = Random::instance();
+	if (!__atomic_load_n(&adaptedFlag, __ATOMIC_ACQUIRE)
+			&& (__atomic_load_n(&drawnTotal, __ATOMIC_RELAXED) >= pilot)) {
+		ScopedLock l(lock);
+		if (!adaptedFlag) {
+			build();
+			__atomic_store_n(&adaptedFlag, 1, __ATOMIC_RELEASE);
+		}
+	}
+	if (__atomic_load_n(&adaptedFlag, __ATOMIC_ACQUIRE)) {
+		size_t i = random.randBin(adapted);
+		weight = weights[i];
+		isPilot = false;
+		return i;
+	}
+	weight = 1;
+	isPilot = true;
+	return random.randBin(luminosities);
+}
+
+void AdaptiveSourceSampling::mark(Candidate &candidate, size_t i, double weight, bool isPilot) const {
+	if (!isPilot) {
+		candidate.setWeight(candidate.getWeight() * weight);
+		return;
+	}
+	// counted for the efficiency
+	candidate.setProperty(indexKey, Variant::fromUInt64(i));
+	__sync_fetch_and_add(&drawn[i], 1);
+	__sync_fetch_and_add(&drawnTotal, 1);
+}
+
+void AdaptiveSourceSampling::recordDetection(const Candidate *candidate) const {
+	// the primary, whose secondaries have no properties of it
+	const Candidate *primary = candidate;
+	while (primary->parent)
+		primary = primary->parent;
+	if (!primary->hasProperty(indexKey))
+		return;
+	size_t i = primary->getProperty(indexKey).toUInt64();
+	if (i >= detected.size())
+		return;
+	double w = candidate->getWeight();
+	#pragma omp atomic
+	detected[i] += w;
+}
+
+void AdaptiveSourceSampling::adapt() {
+	ScopedLock l(lock);
+	build();
+	__atomic_store_n(&adaptedFlag, 1, __ATOMIC_RELEASE);
+}
+
+bool AdaptiveSourceSampling::isAdapted() const {
+	return __atomic_load_n(&adaptedFlag, __ATOMIC_ACQUIRE);
+}
+
+size_t AdaptiveSourceSampling::getPilotCandidates() const {
+	return pilot;
+}
+
+double AdaptiveSourceSampling::getMixing() const {
+	return mixing;
+}
+
+double AdaptiveSourceSampling::getEfficiency(size_t i) const {
+	if (i >= drawn.size())
+		throw std::out_of_range("AdaptiveSourceSampling: no source " + std::to_string(i));
+	if (drawn[i] == 0)
+		return 0;
+	return detected[i] / drawn[i];
+}
+
+double AdaptiveSourceSampling::getProbability(size_t i) const {
+	if (i >= drawn.size())
+		throw std::out_of_range("AdaptiveSourceSampling: no source " + std::to_string(i));
+	const std::vector<double> &cdf = isAdapted() ? adapted.getCDF() : luminosities.getCDF();
+	double p = (i == 0) ? cdf[0] : (cdf[i] - cdf[i - 1]);
+	return p / cdf.back();
+}
+
 // SourceList------------------------------------------------------------------
 void SourceList::add(Source* source, double weight) {
 	sources.push_back(source);
-	if (cdf.size() > 0)
-		weight += cdf.back();
-	cdf.push_back(weight);
+	sampler.add(weight);
+	if (adaptive.valid())
+		adaptive->add(weight);
 }
 
 ref_ptr<Candidate> SourceList::getCandidate() const {
 	if (sources.size() == 0)
 		throw std::runtime_error("SourceList: no sources set");
-	size_t i = Random::instance().randBin(cdf);
+	if (adaptive.valid()) {
+		double weight;
+		bool pilot;
+		size_t i = adaptive->draw(weight, pilot);
+		ref_ptr<Candidate> candidate = sources[i]->getCandidate();
+		adaptive->mark(*candidate, i, weight, pilot);
+		return candidate;
+	}
+	size_t i = Random::instance().randBin(sampler);
 	return (sources[i])->getCandidate();
 }
 
+void SourceList::getCandidates(size_t n,
+		std::vector<ref_ptr<Candidate> > &candidates) const {
+	if (sources.size() == 0)
+		throw std::runtime_error("SourceList: no sources set");
+	std::vector<size_t> counts(sources.size(), 0);
+	Random &random = Random::instance();
+	if (!adaptive.valid()) {
+		for (size_t i = 0; i < n; i++)
+			counts[random.randBin(sampler)]++;
+		for (size_t i = 0; i < sources.size(); i++)
+			if (counts[i] > 0)
+				sources[i]->getCandidates(counts[i], candidates);
+		return;
+	}
+
+	// pilot and adapted candidates, the adaptation may happen in the batch
+	std::vector<size_t> pilotCounts(sources.size(), 0);
+	std::vector<double> weights(sources.size(), 1);
+	for (size_t i = 0; i < n; i++) {
+		double weight;
+		bool pilot;
+		size_t j = adaptive->draw(weight, pilot);
+		if (pilot) {
+			pilotCounts[j]++;
+		} else {
+			counts[j]++;
+			weights[j] = weight;
+		}
+	}
+	for (size_t i = 0; i < sources.size(); i++) {
+		for (int pilot = 1; pilot >= 0; pilot--) {
+			size_t m = pilot ? pilotCounts[i] : counts[i];
+			if (m == 0)
+				continue;
+			size_t first = candidates.size();
+			sources[i]->getCandidates(m, candidates);
+			for (size_t j = first; j < candidates.size(); j++)
+				adaptive->mark(*candidates[j], i, weights[i], pilot);
+		}
+	}
+}
+
+void SourceList::setAdaptive(size_t pilotCandidates, double mixing) {
+	adaptive = new AdaptiveSourceSampling(pilotCandidates, mixing);
+	const std::vector<double> &cdf = sampler.getCDF();
+	for (size_t i = 0; i < cdf.size(); i++)
+		adaptive->add((i == 0) ? cdf[0] : (cdf[i] - cdf[i - 1]));
+}
+
+ref_ptr<AdaptiveSourceSampling> SourceList::getAdaptiveSampling() const {
+	return adaptive;
+}
+
 std::string SourceList::getDescription() const {
 	std::stringstream ss;
 	ss << "List of cosmic ray sources\n";
@@ -57,19 +283,168 @@ std::string SourceList::getDescription() const {
 	return ss.str();
 }
 
+// ArraySource ----------------------------------------------------------------
+template<typename T>
+static const T &column(const T *first, size_t stride, size_t i) {
+	return *reinterpret_cast<const T *>(reinterpret_cast<const char *>(first) + i * stride);
+}
+
+ArraySource::ArraySource(size_t size) :
+		count(size), next(0), ids(0), energies(0), positions(0), directions(0),
+		redshifts(0), weights(0), idStride(0), energyStride(0), positionStride(0),
+		positionComponentStride(0), directionStride(0), directionComponentStride(0),
+		redshiftStride(0), weightStride(0) {
+}
+
+size_t ArraySource::size() const {
+	return count;
+}
+
+void ArraySource::setIds(const int *i, size_t stride) {
+	ids = i;
+	idStride = stride;
+}
+
+void ArraySource::setEnergies(const double *E, size_t stride) {
+	energies = E;
+	energyStride = stride;
+}
+
+void ArraySource::setPositions(const double *x, size_t stride, size_t componentStride) {
+	positions = x;
+	positionStride = stride;
+	positionComponentStride = componentStride;
+}
+
+void ArraySource::setDirections(const double *u, size_t stride, size_t componentStride) {
+	directions = u;
+	directionStride = stride;
+	directionComponentStride = componentStride;
+}
+
+void ArraySource::setRedshifts(const double *z, size_t stride) {
+	redshifts = z;
+	redshiftStride = stride;
+}
+
+void ArraySource::setWeights(const double *w, size_t stride) {
+	weights = w;
+	weightStride = stride;
+}
+
+ref_ptr<Candidate> ArraySource::getCandidate(size_t i) const {
+	if (i >= count)
+		throw std::out_of_range("ArraySource: no primary " + std::to_string(i));
+	ParticleState state;
+	if (ids)
+		state.setId(column(ids, idStride, i));
+	if (energies)
+		state.setEnergy(column(energies, energyStride, i));
+	if (positions) {
+		const double *x = &column(positions, positionStride, i);
+		state.setPosition(Vector3d(*x, column(x, positionComponentStride, 1),
+			column(x, positionComponentStride, 2)));
+	}
+	if (directions) {
+		const double *u = &column(directions, directionStride, i);
+		state.setDirection(Vector3d(*u, column(u, directionComponentStride, 1),
+			column(u, directionComponentStride, 2)));
+	}
+	ref_ptr<Candidate> candidate = new Candidate(state);
+	if (redshifts)
+		candidate->setRedshift(column(redshifts, redshiftStride, i));
+	if (weights)
+		candidate->setWeight(column(weights, weightStride, i));
+	return candidate;
+}
+
+ref_ptr<Candidate> ArraySource::getCandidate() const {
+	size_t i = __sync_fetch_and_add(&next, 1);
+	if (i >= count)
+		return 0;
+	return getCandidate(i);
+}
+
+void ArraySource::getCandidates(size_t n, std::vector<ref_ptr<Candidate> > &candidates) const {
+	size_t begin = __sync_fetch_and_add(&next, n);
+	size_t end = std::min(begin + n, count);
+	for (size_t i = begin; i < end; i++)
+		candidates.push_back(getCandidate(i));
+}
+
+void ArraySource::rewind() {
+	__atomic_store_n(&next, 0, __ATOMIC_RELAXED);
+}
+
+void ArraySource::addOwner(Referenced *owner) {
+	owners.push_back(owner);
+}
+
+std::string ArraySource::getDescription() const {
+	std::stringstream ss;
+	ss << "ArraySource: " << count << " primaries\n";
+	return ss.str();
+}
+
 // SourceFeature---------------------------------------------------------------
 void SourceFeature::prepareCandidate(Candidate& candidate) const {
-	ParticleState &source = candidate.source;
+	// release the shared created state first, so that the source is not copied
+	candidate.created = SharedParticleState();
+	ParticleState &source = candidate.source.modify();
 	prepareParticle(source);
-	candidate.created = source;
+	candidate.created = candidate.source;
 	candidate.current = source;
 	candidate.previous = source;
 }
 
+void SourceFeature::prepareParticles(ParticleState *const *particles,
+		size_t n) const {
+	for (size_t i = 0; i < n; i++)
+		prepareParticle(*particles[i]);
+}
+
+void SourceFeature::prepareCandidates(Candidate *const *candidates,
+		size_t n) const {
+	for (size_t i = 0; i < n; i++)
+		prepareCandidate(*candidates[i]);
+}
+
+void SourceFeature::prepareSourceStates(Candidate *const *candidates,
+		size_t n) const {
+	std::vector<ParticleState *> particles(n);
+	for (size_t i = 0; i < n; i++) {
+		candidates[i]->created = SharedParticleState();
+		particles[i] = &candidates[i]->source.modify();
+	}
+	prepareParticles(&particles[0], n);
+	for (size_t i = 0; i < n; i++) {
+		Candidate &candidate = *candidates[i];
+		candidate.created = candidate.source;
+		candidate.current = *particles[i];
+		candidate.previous = *particles[i];
+	}
+}
+
+// BatchSourceFeature ----------------------------------------------------------
+void BatchSourceFeature::prepareCandidate(Candidate &candidate) const {
+	Candidate *c = &candidate;
+	prepareCandidates(&c, 1);
+}
+
+void BatchSourceFeature::prepareCandidates(Candidate *const *candidates,
+		size_t n) const {
+	std::vector<Candidate *> batch(candidates, candidates + n);
+	prepareCandidateVector(batch);
+}
+
 std::string SourceFeature::getDescription() const {
 	return description;
 }
 
+void SourceFeature::getConfiguration(Configuration &configuration) const {
+	throw std::runtime_error("SourceFeature: no configuration of " + getDescription());
+}
+
 // ----------------------------------------------------------------------------
 SourceParticleType::SourceParticleType(int id) :
 		id(id) {
@@ -80,12 +455,28 @@ void SourceParticleType::prepareParticle(ParticleState& particle) const {
 	particle.setId(id);
 }
 
+void SourceParticleType::prepareParticles(ParticleState *const *particles,
+		size_t n) const {
+	for (size_t i = 0; i < n; i++)
+		particles[i]->setId(id);
+}
+
+void SourceParticleType::prepareCandidates(Candidate *const *candidates,
+		size_t n) const {
+	prepareSourceStates(candidates, n);
+}
+
 void SourceParticleType::setDescription() {
 	std::stringstream ss;
 	ss << "SourceParticleType: " << id << "\n";
 	description = ss.str();
 }
 
+void SourceParticleType::getConfiguration(Configuration &c) const {
+	c.setType("SourceParticleType");
+	c.set("id", id);
+}
+
 // ----------------------------------------------------------------------------
 SourceMultipleParticleTypes::SourceMultipleParticleTypes() {
 	setDescription();
@@ -93,16 +484,14 @@ SourceMultipleParticleTypes::SourceMultipleParticleTypes() {
 
 void SourceMultipleParticleTypes::add(int id, double a) {
 	particleTypes.push_back(id);
-	if (cdf.size() > 0)
-		a += cdf.back();
-	cdf.push_back(a);
+	sampler.add(a);
 	setDescription();
 }
 
 void SourceMultipleParticleTypes::prepareParticle(ParticleState& particle) const {
 	if (particleTypes.size() == 0)
 		throw std::runtime_error("SourceMultipleParticleTypes: no nuclei set");
-	size_t i = Random::instance().randBin(cdf);
+	size_t i = Random::instance().randBin(sampler);
 	particle.setId(particleTypes[i]);
 }
 
@@ -124,12 +513,28 @@ void SourceEnergy::prepareParticle(ParticleState& p) const {
 	p.setEnergy(E);
 }
 
+void SourceEnergy::prepareParticles(ParticleState *const *particles,
+		size_t n) const {
+	for (size_t i = 0; i < n; i++)
+		particles[i]->setEnergy(E);
+}
+
+void SourceEnergy::prepareCandidates(Candidate *const *candidates,
+		size_t n) const {
+	prepareSourceStates(candidates, n);
+}
+
 void SourceEnergy::setDescription() {
 	std::stringstream ss;
 	ss << "SourceEnergy: " << E / EeV << " EeV\n";
 	description = ss.str();
 }
 
+void SourceEnergy::getConfiguration(Configuration &c) const {
+	c.setType("SourceEnergy");
+	c.set("energy", E);
+}
+
 // ----------------------------------------------------------------------------
 SourcePowerLawSpectrum::SourcePowerLawSpectrum(double Emin, double Emax,
 		double index) :
@@ -143,6 +548,32 @@ void SourcePowerLawSpectrum::prepareParticle(ParticleState& particle) const {
 	particle.setEnergy(E);
 }
 
+void SourcePowerLawSpectrum::prepareParticles(ParticleState *const *particles,
+		size_t n) const {
+	// Random::randPowerLaw with the constants computed once
+	if ((Emin < 0) || (Emax < Emin))
+		throw std::runtime_error(
+				"Power law distribution only possible for 0 <= min <= max");
+	Random &random = Random::instance();
+	if ((std::abs(index + 1.0)) < std::numeric_limits<double>::epsilon()) {
+		double part1 = log(Emax);
+		double part2 = log(Emin);
+		for (size_t i = 0; i < n; i++)
+			particles[i]->setEnergy(exp((part1 - part2) * random.rand() + part2));
+	} else {
+		double part1 = pow(Emax, index + 1);
+		double part2 = pow(Emin, index + 1);
+		double ex = 1 / (index + 1);
+		for (size_t i = 0; i < n; i++)
+			particles[i]->setEnergy(pow((part1 - part2) * random.rand() + part2, ex));
+	}
+}
+
+void SourcePowerLawSpectrum::prepareCandidates(Candidate *const *candidates,
+		size_t n) const {
+	prepareSourceStates(candidates, n);
+}
+
 void SourcePowerLawSpectrum::setDescription() {
 	std::stringstream ss;
 	ss << "SourcePowerLawSpectrum: Random energy ";
@@ -151,6 +582,13 @@ void SourcePowerLawSpectrum::setDescription() {
 	description = ss.str();
 }
 
+void SourcePowerLawSpectrum::getConfiguration(Configuration &c) const {
+	c.setType("SourcePowerLawSpectrum");
+	c.set("Emin", Emin);
+	c.set("Emax", Emax);
+	c.set("index", index);
+}
+
 // ----------------------------------------------------------------------------
 SourceComposition::SourceComposition(double Emin, double Rmax, double index) :
 		Emin(Emin), Rmax(Rmax), index(index) {
@@ -170,9 +608,7 @@ void SourceComposition::add(int id, double weight) {
 
 	weight *= pow(A, -a);
 
-	if (cdf.size() > 0)
-		weight += cdf.back();
-	cdf.push_back(weight);
+	sampler.add(weight);
 	setDescription();
 }
 
@@ -187,7 +623,7 @@ void SourceComposition::prepareParticle(ParticleState& particle) const {
 	Random &random = Random::instance();
 
 	// draw random particle type
-	size_t i = random.randBin(cdf);
+	size_t i = random.randBin(sampler);
 	int id = nuclei[i];
 	particle.setId(id);
 
@@ -221,12 +657,28 @@ void SourcePosition::prepareParticle(ParticleState& particle) const {
 	particle.setPosition(position);
 }
 
+void SourcePosition::prepareParticles(ParticleState *const *particles,
+		size_t n) const {
+	for (size_t i = 0; i < n; i++)
+		particles[i]->setPosition(position);
+}
+
+void SourcePosition::prepareCandidates(Candidate *const *candidates,
+		size_t n) const {
+	prepareSourceStates(candidates, n);
+}
+
 void SourcePosition::setDescription() {
 	std::stringstream ss;
 	ss << "SourcePosition: " << position / Mpc << " Mpc\n";
 	description = ss.str();
 }
 
+void SourcePosition::getConfiguration(Configuration &c) const {
+	c.setType("SourcePosition");
+	c.set("position", position);
+}
+
 // ----------------------------------------------------------------------------
 SourceMultiplePositions::SourceMultiplePositions() {
 	setDescription();
@@ -234,18 +686,49 @@ SourceMultiplePositions::SourceMultiplePositions() {
 
 void SourceMultiplePositions::add(Vector3d pos, double weight) {
 	positions.push_back(pos);
-	if (cdf.size() > 0)
-		weight += cdf.back();
-	cdf.push_back(weight);
+	sampler.add(weight);
+	if (adaptive.valid())
+		adaptive->add(weight);
 }
 
 void SourceMultiplePositions::prepareParticle(ParticleState& particle) const {
 	if (positions.size() == 0)
 		throw std::runtime_error("SourceMultiplePositions: no position set");
-	size_t i = Random::instance().randBin(cdf);
+	size_t i = Random::instance().randBin(sampler);
 	particle.setPosition(positions[i]);
 }
 
+void SourceMultiplePositions::prepareCandidate(Candidate &candidate) const {
+	if (!adaptive.valid()) {
+		SourceFeature::prepareCandidate(candidate);
+		return;
+	}
+	if (positions.size() == 0)
+		throw std::runtime_error("SourceMultiplePositions: no position set");
+	double weight;
+	bool pilot;
+	size_t i = adaptive->draw(weight, pilot);
+	// as SourceFeature::prepareCandidate
+	candidate.created = SharedParticleState();
+	ParticleState &source = candidate.source.modify();
+	source.setPosition(positions[i]);
+	candidate.created = candidate.source;
+	candidate.current = source;
+	candidate.previous = source;
+	adaptive->mark(candidate, i, weight, pilot);
+}
+
+void SourceMultiplePositions::setAdaptive(size_t pilotCandidates, double mixing) {
+	adaptive = new AdaptiveSourceSampling(pilotCandidates, mixing);
+	const std::vector<double> &cdf = sampler.getCDF();
+	for (size_t i = 0; i < cdf.size(); i++)
+		adaptive->add((i == 0) ? cdf[0] : (cdf[i] - cdf[i - 1]));
+}
+
+ref_ptr<AdaptiveSourceSampling> SourceMultiplePositions::getAdaptiveSampling() const {
+	return adaptive;
+}
+
 void SourceMultiplePositions::setDescription() {
 	std::stringstream ss;
 	ss << "SourceMultiplePositions: Random position from list\n";
@@ -266,6 +749,20 @@ void SourceUniformSphere::prepareParticle(ParticleState& particle) const {
 	particle.setPosition(center + random.randVector() * r);
 }
 
+void SourceUniformSphere::prepareParticles(ParticleState *const *particles,
+		size_t n) const {
+	Random &random = Random::instance();
+	for (size_t i = 0; i < n; i++) {
+		double r = pow(random.rand(), 1. / 3.) * radius;
+		particles[i]->setPosition(center + random.randVector() * r);
+	}
+}
+
+void SourceUniformSphere::prepareCandidates(Candidate *const *candidates,
+		size_t n) const {
+	prepareSourceStates(candidates, n);
+}
+
 void SourceUniformSphere::setDescription() {
 	std::stringstream ss;
 	ss << "SourceUniformSphere: Random position within a sphere at ";
@@ -274,6 +771,12 @@ void SourceUniformSphere::setDescription() {
 	description = ss.str();
 }
 
+void SourceUniformSphere::getConfiguration(Configuration &c) const {
+	c.setType("SourceUniformSphere");
+	c.set("center", center);
+	c.set("radius", radius);
+}
+
 // ----------------------------------------------------------------------------
 SourceUniformHollowSphere::SourceUniformHollowSphere(
 		Vector3d center,
@@ -361,8 +864,54 @@ void SourceUniformCylinder::setDescription() {
 }
 
 // ---------------------------------------------------------------------------
+// quantiles r_k = F^-1(k / n) of the radial profile f_r ~ (r/R_earth)^2 *
+// exp(-beta * (r - R_earth) / R_earth) in 0 - R_max, from a finer trapezoidal cdf
+static void galacticRadialQuantiles(double R_earth, double beta, double R_max,
+		size_t n, std::vector<double> &quantiles) {
+	if (n == 0)
+		throw std::runtime_error("Source: table resolution must be larger than 0");
+	size_t m = 16 * n;
+	double dr = R_max / m;
+	std::vector<double> cdf(m + 1, 0.);
+	double f0 = 0;
+	for (size_t j = 1; j <= m; j++) {
+		double r = j * dr;
+		double f = pow(r / R_earth, 2.) * exp(-beta * (r - R_earth) / R_earth);
+		cdf[j] = cdf[j - 1] + (f0 + f) * dr / 2;
+		f0 = f;
+	}
+
+	quantiles.resize(n + 1);
+	quantiles[0] = 0;
+	quantiles[n] = R_max;
+	size_t j = 1;
+	for (size_t k = 1; k < n; k++) {
+		double c = cdf[m] * k / n;
+		while ((j < m) && (cdf[j] < c))
+			j++;
+		double w = cdf[j] - cdf[j - 1];
+		double t = (w > 0) ? (c - cdf[j - 1]) / w : 0;
+		quantiles[k] = (j - 1 + t) * dr;
+	}
+}
+
+// linear interpolation of the quantiles for a uniform random number u
+static double sampleQuantiles(const std::vector<double> &quantiles, double u) {
+	size_t n = quantiles.size() - 1;
+	double x = u * n;
+	size_t k = std::min(size_t(x), n - 1);
+	return quantiles[k] + (x - k) * (quantiles[k + 1] - quantiles[k]);
+}
+
+// z of the two-sided exponential exp(-|z| / Zg) in -Z_max - Z_max by its
+// inverse cdf, zNorm = 1 - exp(-Z_max / Zg)
+static double sampleGalacticHeight(Random &random, double Zg, double zNorm) {
+	double z = -Zg * log1p(-random.rand() * zNorm);
+	return (random.rand() < 0.5) ? -z : z;
+}
+
 SourceSNRDistribution::SourceSNRDistribution() :
-    R_earth(8.5*kpc), beta(3.53), Zg(0.3*kpc) {
+    R_earth(8.5*kpc), beta(3.53), Zg(0.3*kpc), tableResolution(1024) {
 	set_frMax(8.5*kpc, 3.53);
 	set_fzMax(0.3*kpc);
 	set_RMax(20*kpc);
@@ -370,7 +919,7 @@ SourceSNRDistribution::SourceSNRDistribution() :
 }
 
 SourceSNRDistribution::SourceSNRDistribution(double R_earth, double beta, double Zg) :
-    R_earth(R_earth), beta(beta), Zg(Zg) {
+    R_earth(R_earth), beta(beta), Zg(Zg), tableResolution(1024) {
 	set_frMax(R_earth, beta);
 	set_fzMax(Zg);
 	set_RMax(20*kpc);
@@ -379,29 +928,24 @@ SourceSNRDistribution::SourceSNRDistribution(double R_earth, double beta, double
 
 void SourceSNRDistribution::prepareParticle(ParticleState& particle) const {
   	Random &random = Random::instance();
-	double RPos;
-	while (true){
-		RPos = random.rand()*R_max;
-		double fTest = random.rand()*frMax;
-		double fR=f_r(RPos);
-		if (fTest<=fR) {
-			break;
-		}
-	}
-	double ZPos;
-	while (true){
-		ZPos = (random.rand()-0.5)*2*Z_max;
-		double fTest = random.rand()*fzMax;
-		double fz=f_z(ZPos);
-		if (fTest<=fz) {
-			break;
-		}
-	}
+	double RPos = sampleQuantiles(radialQuantiles, random.rand());
+	double ZPos = sampleGalacticHeight(random, Zg, zNorm);
 	double phi = random.rand()*2*M_PI;
 	Vector3d pos(cos(phi)*RPos, sin(phi)*RPos, ZPos);
 	particle.setPosition(pos);
   }
 
+void SourceSNRDistribution::prepareParticles(ParticleState *const *particles,
+		size_t n) const {
+	for (size_t i = 0; i < n; i++)
+		SourceSNRDistribution::prepareParticle(*particles[i]);
+}
+
+void SourceSNRDistribution::prepareCandidates(Candidate *const *candidates,
+		size_t n) const {
+	prepareSourceStates(candidates, n);
+}
+
 double SourceSNRDistribution::f_r(double r) const{
 	double Atilde = (pow(beta, 4.) * exp(-beta)) / (12 * M_PI * pow(R_earth, 2.));
  	double f = pow(r/R_earth, 2.) * exp(-beta * (r-R_earth)/R_earth);
@@ -428,14 +972,25 @@ void SourceSNRDistribution::set_fzMax(double Zg) {
 
 void SourceSNRDistribution::set_RMax(double R_m) {
 	R_max = R_m;
+	galacticRadialQuantiles(R_earth, beta, R_max, tableResolution, radialQuantiles);
 	return;
 }
 
 void SourceSNRDistribution::set_ZMax(double Z_m) {
 	Z_max = Z_m;
+	zNorm = -expm1(-Z_max / Zg);
 	return;
 }
 
+void SourceSNRDistribution::set_tableResolution(size_t n) {
+	galacticRadialQuantiles(R_earth, beta, R_max, n, radialQuantiles);
+	tableResolution = n;
+}
+
+size_t SourceSNRDistribution::get_tableResolution() const {
+	return tableResolution;
+}
+
 double SourceSNRDistribution::get_frMax() {
 	return frMax;
 }
@@ -465,7 +1020,7 @@ void SourceSNRDistribution::setDescription() {
 
 // ---------------------------------------------------------------------------
 SourcePulsarDistribution::SourcePulsarDistribution() :
-    R_earth(8.5*kpc), beta(3.53), Zg(0.3*kpc) {
+    R_earth(8.5*kpc), beta(3.53), Zg(0.3*kpc), tableResolution(1024) {
 	set_frMax(8.5*kpc, 3.53);
 	set_fzMax(0.3*kpc);
 	set_RMax(22*kpc);
@@ -475,7 +1030,7 @@ SourcePulsarDistribution::SourcePulsarDistribution() :
 }
 
 SourcePulsarDistribution::SourcePulsarDistribution(double R_earth, double beta, double Zg, double rB, double tB) :
-    R_earth(R_earth), beta(beta), Zg(Zg) {
+    R_earth(R_earth), beta(beta), Zg(Zg), tableResolution(1024) {
 	set_frMax(R_earth, beta);
 	set_fzMax(Zg);
 	set_rBlur(rB);
@@ -486,24 +1041,8 @@ SourcePulsarDistribution::SourcePulsarDistribution(double R_earth, double beta,
 
 void SourcePulsarDistribution::prepareParticle(ParticleState& particle) const {
   	Random &random = Random::instance();
-	double Rtilde;
-	while (true){
-		Rtilde = random.rand()*R_max;
-		double fTest = random.rand()*frMax;
-		double fR=f_r(Rtilde);
-		if (fTest<=fR) {
-			break;
-		}
-	}
-	double ZPos;
-	while (true){
-		ZPos = (random.rand()-0.5)*2*Z_max;
-		double fTest = random.rand()*fzMax;
-		double fz=f_z(ZPos);
-		if (fTest<=fz) {
-			break;
-		}
-	}
+	double Rtilde = sampleQuantiles(radialQuantiles, random.rand());
+	double ZPos = sampleGalacticHeight(random, Zg, zNorm);
 
 	int i = random.randInt(3);
 	double theta_tilde = f_theta(i, Rtilde);
@@ -514,6 +1053,17 @@ void SourcePulsarDistribution::prepareParticle(ParticleState& particle) const {
 	particle.setPosition(pos);
   }
 
+void SourcePulsarDistribution::prepareParticles(ParticleState *const *particles,
+		size_t n) const {
+	for (size_t i = 0; i < n; i++)
+		SourcePulsarDistribution::prepareParticle(*particles[i]);
+}
+
+void SourcePulsarDistribution::prepareCandidates(Candidate *const *candidates,
+		size_t n) const {
+	prepareSourceStates(candidates, n);
+}
+
 double SourcePulsarDistribution::f_r(double r) const{
 	double Atilde = (pow(beta, 4.) * exp(-beta)) / (12 * M_PI * pow(R_earth, 2.));
  	double f = pow(r/R_earth, 2.) * exp(-beta * (r-R_earth)/R_earth);
@@ -566,14 +1116,25 @@ void SourcePulsarDistribution::set_fzMax(double Zg) {
 
 void SourcePulsarDistribution::set_RMax(double R_m) {
 	R_max = R_m;
+	galacticRadialQuantiles(R_earth, beta, R_max, tableResolution, radialQuantiles);
 	return;
 }
 
 void SourcePulsarDistribution::set_ZMax(double Z_m) {
 	Z_max = Z_m;
+	zNorm = -expm1(-Z_max / Zg);
 	return;
 }
 
+void SourcePulsarDistribution::set_tableResolution(size_t n) {
+	galacticRadialQuantiles(R_earth, beta, R_max, n, radialQuantiles);
+	tableResolution = n;
+}
+
+size_t SourcePulsarDistribution::get_tableResolution() const {
+	return tableResolution;
+}
+
 void SourcePulsarDistribution::set_rBlur(double r_B) {
 	r_blur = r_B;
 	return;
@@ -653,33 +1214,36 @@ void SourceUniform1D::setDescription() {
 
 // ----------------------------------------------------------------------------
 SourceDensityGrid::SourceDensityGrid(ref_ptr<ScalarGrid> grid) :
-		grid(grid) {
-	float sum = 0;
-	for (int ix = 0; ix < grid->getNx(); ix++) {
-		for (int iy = 0; iy < grid->getNy(); iy++) {
-			for (int iz = 0; iz < grid->getNz(); iz++) {
+		origin(grid->getOrigin()), spacing(grid->getSpacing()),
+		Ny(grid->getNy()), Nz(grid->getNz()) {
+	// cumulative sum independent of the storage layout of the grid
+	std::vector<double> cdf;
+	cdf.reserve(grid->getNx() * Ny * Nz);
+	double sum = 0;
+	for (size_t ix = 0; ix < grid->getNx(); ix++) {
+		for (size_t iy = 0; iy < Ny; iy++) {
+			for (size_t iz = 0; iz < Nz; iz++) {
 				sum += grid->get(ix, iy, iz);
-				grid->get(ix, iy, iz) = sum;
+				cdf.push_back(sum);
 			}
 		}
 	}
+	sampler.setCDF(cdf);
 	setDescription();
 }
 
 void SourceDensityGrid::prepareParticle(ParticleState& particle) const {
 	Random &random = Random::instance();
 
-	// draw random bin
-	size_t i = random.randBin(grid->getGrid());
-	Vector3d pos = grid->positionFromIndex(i);
+	// draw random cell
+	size_t i = random.randBin(sampler);
+	Vector3d cell(i / (Ny * Nz), (i / Nz) % Ny, i % Nz);
 
-	// draw uniform position within bin
-	double dx = random.rand() - 0.5;
-	double dy = random.rand() - 0.5;
-	double dz = random.rand() - 0.5;
-	pos += Vector3d(dx, dy, dz) * grid->getSpacing();
-
-	particle.setPosition(pos);
+	// draw uniform position within the cell
+	double dx = random.rand();
+	double dy = random.rand();
+	double dz = random.rand();
+	particle.setPosition(origin + (cell + Vector3d(dx, dy, dz)) * spacing);
 }
 
 void SourceDensityGrid::setDescription() {
@@ -688,31 +1252,33 @@ void SourceDensityGrid::setDescription() {
 
 // ----------------------------------------------------------------------------
 SourceDensityGrid1D::SourceDensityGrid1D(ref_ptr<ScalarGrid> grid) :
-		grid(grid) {
+		origin(grid->getOrigin()), spacing(grid->getSpacing()) {
 	if (grid->getNy() != 1)
 		throw std::runtime_error("SourceDensityGrid1D: Ny != 1");
 	if (grid->getNz() != 1)
 		throw std::runtime_error("SourceDensityGrid1D: Nz != 1");
 
-	float sum = 0;
-	for (int ix = 0; ix < grid->getNx(); ix++) {
+	std::vector<double> cdf;
+	cdf.reserve(grid->getNx());
+	double sum = 0;
+	for (size_t ix = 0; ix < grid->getNx(); ix++) {
 		sum += grid->get(ix, 0, 0);
-		grid->get(ix, 0, 0) = sum;
+		cdf.push_back(sum);
 	}
+	sampler.setCDF(cdf);
 	setDescription();
 }
 
 void SourceDensityGrid1D::prepareParticle(ParticleState& particle) const {
 	Random &random = Random::instance();
 
-	// draw random bin
-	size_t i = random.randBin(grid->getGrid());
-	Vector3d pos = grid->positionFromIndex(i);
-
-	// draw uniform position within bin
-	double dx = random.rand() - 0.5;
-	pos.x += dx * grid->getSpacing().x;
+	// draw random cell
+	size_t i = random.randBin(sampler);
 
+	// draw uniform position within the cell, at the center in y and z
+	double dx = random.rand();
+	Vector3d pos = origin + spacing / 2;
+	pos.x = origin.x + (i + dx) * spacing.x;
 	particle.setPosition(pos);
 }
 
@@ -730,10 +1296,26 @@ void SourceIsotropicEmission::prepareParticle(ParticleState& particle) const {
 	particle.setDirection(random.randVector());
 }
 
+void SourceIsotropicEmission::prepareParticles(ParticleState *const *particles,
+		size_t n) const {
+	Random &random = Random::instance();
+	for (size_t i = 0; i < n; i++)
+		particles[i]->setDirection(random.randVector());
+}
+
+void SourceIsotropicEmission::prepareCandidates(Candidate *const *candidates,
+		size_t n) const {
+	prepareSourceStates(candidates, n);
+}
+
 void SourceIsotropicEmission::setDescription() {
 	description = "SourceIsotropicEmission: Random isotropic direction\n";
 }
 
+void SourceIsotropicEmission::getConfiguration(Configuration &c) const {
+	c.setType("SourceIsotropicEmission");
+}
+
 // ----------------------------------------------------------------------------
 SourceDirection::SourceDirection(Vector3d direction) :
 		direction(direction) {
@@ -750,24 +1332,59 @@ void SourceDirection::setDescription() {
 	description = ss.str();
 }
 
+void SourceDirection::getConfiguration(Configuration &c) const {
+	c.setType("SourceDirection");
+	c.set("direction", direction);
+}
+
 // ----------------------------------------------------------------------------
-SourceEmissionMap::SourceEmissionMap(EmissionMap *emissionMap) : emissionMap(emissionMap) {
+SourceEmissionMap::SourceEmissionMap(EmissionMap *emissionMap, bool sampling) :
+		emissionMap(emissionMap), sampling(sampling) {
+	if (emissionMap)
+		emissionMap->freeze();
 	setDescription();
 }
 
 void SourceEmissionMap::prepareCandidate(Candidate &candidate) const {
-	if (emissionMap) {
+	if (!emissionMap)
+		return;
+	if (!sampling) {
 		bool accept = emissionMap->checkDirection(candidate.source);
 		candidate.setActive(accept);
+		return;
 	}
+
+	Vector3d direction;
+	double weight;
+	if (!emissionMap->drawDirection(candidate.source, direction, weight)) {
+		candidate.setActive(false);
+		return;
+	}
+	candidate.created = SharedParticleState();
+	ParticleState &source = candidate.source.modify();
+	source.setDirection(direction);
+	candidate.created = candidate.source;
+	candidate.current = source;
+	candidate.previous = source;
+	candidate.setWeight(candidate.getWeight() * weight);
 }
 
 void SourceEmissionMap::setDescription() {
-	description = "SourceEmissionMap: accept only directions from emission map\n";
+	if (sampling)
+		description = "SourceEmissionMap: draw directions from emission map\n";
+	else
+		description = "SourceEmissionMap: accept only directions from emission map\n";
 }
 
 void SourceEmissionMap::setEmissionMap(EmissionMap *emissionMap) {
 	this->emissionMap = emissionMap;
+	if (emissionMap)
+		emissionMap->freeze();
+}
+
+void SourceEmissionMap::setSampling(bool sampling) {
+	this->sampling = sampling;
+	setDescription();
 }
 
 // ----------------------------------------------------------------------------
@@ -789,6 +1406,36 @@ void SourceEmissionCone::setDescription() {
 	description = ss.str();
 }
 
+// ----------------------------------------------------------------------------
+SourceBacktracking::SourceBacktracking(Vector3d center, double radius) :
+		center(center), radius(radius) {
+	if (radius < 0)
+		throw std::runtime_error("SourceBacktracking: radius < 0");
+	setDescription();
+}
+
+void SourceBacktracking::prepareParticle(ParticleState& particle) const {
+	Random &random = Random::instance();
+	Vector3d normal = random.randVector();
+	particle.setPosition(center + normal * radius);
+	if (radius > 0) {
+		// cosine distribution of the angle to the normal, uniform azimuth
+		Vector3d axis = normal.cross(random.randVector()).getUnitVector();
+		particle.setDirection(normal.getRotated(axis, acos(sqrt(random.rand()))));
+	} else
+		particle.setDirection(normal);
+	if (particle.getCharge() != 0)
+		particle.setId(-particle.getId());
+}
+
+void SourceBacktracking::setDescription() {
+	std::stringstream ss;
+	ss << "SourceBacktracking: Antiparticles leaving a sphere at ";
+	ss << center / kpc << " kpc with ";
+	ss << radius / kpc << " kpc radius\n";
+	description = ss.str();
+}
+
 // ----------------------------------------------------------------------------
 SourceRedshift::SourceRedshift(double z) :
 		z(z) {
@@ -805,6 +1452,11 @@ void SourceRedshift::setDescription() {
 	description = ss.str();
 }
 
+void SourceRedshift::getConfiguration(Configuration &c) const {
+	c.setType("SourceRedshift");
+	c.set("z", z);
+}
+
 // ----------------------------------------------------------------------------
 SourceUniformRedshift::SourceUniformRedshift(double zmin, double zmax) :
 		zmin(zmin), zmax(zmax) {
@@ -864,7 +1516,9 @@ void SourceRedshift1D::setDescription() {
 // ----------------------------------------------------------------------------
 #ifdef CRPROPA_HAVE_MUPARSER
 SourceGenericComposition::SourceGenericComposition(double Emin, double Emax, std::string expression, size_t bins) :
-	Emin(Emin), Emax(Emax), expression(expression), bins(bins) {
+	Emin(Emin), Emax(Emax), expression(expression), bins(bins), parser(0) {
+	if (bins == 0)
+		throw std::runtime_error("SourceGenericComposition: bins must be larger than 0");
 
 	// precalculate energy bins
 	double logEmin = ::log10(Emin);
@@ -874,80 +1528,94 @@ SourceGenericComposition::SourceGenericComposition(double Emin, double Emax, std
 	for (size_t i = 0; i <= bins; i++) {
 		energy[i] = ::pow(10, logEmin + i * logStep);
 	}
+
+	// compile the expression once, A and Z are set per isotope
+	parserE = energy;
+	parserA.resize(bins + 1);
+	parserZ.resize(bins + 1);
+	parser = new mu::Parser();
+	try {
+		parser->DefineVar("E", &parserE[0]);
+		parser->DefineVar("A", &parserA[0]);
+		parser->DefineVar("Z", &parserZ[0]);
+		parser->DefineConst("Emin", Emin);
+		parser->DefineConst("Emax", Emax);
+		parser->DefineConst("bins", bins);
+
+		parser->DefineConst("MeV", MeV);
+		parser->DefineConst("GeV", GeV);
+		parser->DefineConst("TeV", TeV);
+		parser->DefineConst("PeV", PeV);
+		parser->DefineConst("EeV", EeV);
+
+		parser->SetExpr(expression);
+	} catch (mu::Parser::exception_type &e) {
+		delete parser;
+		throw std::runtime_error("SourceGenericComposition: " + e.GetMsg());
+	}
 	setDescription();
 }
 
-void SourceGenericComposition::add(int id, double weight) {
-	int A = massNumber(id);
-	int Z = chargeNumber(id);
-
-	Nucleus n;
-	n.id = id;
-
-	// calculate nuclei cdf
-	mu::Parser p;
-	double E;
-	p.DefineVar("E", &E);
-	p.DefineConst("Emin", Emin);
-	p.DefineConst("Emax", Emax);
-	p.DefineConst("bins", bins);
-	p.DefineConst("A", (double)A);
-	p.DefineConst("Z", (double)Z);
-
-	p.DefineConst("MeV", MeV);
-	p.DefineConst("GeV", GeV);
-	p.DefineConst("TeV", TeV);
-	p.DefineConst("PeV", PeV);
-	p.DefineConst("EeV", EeV);
-
-	p.SetExpr(expression);
-
-	// calculate pdf
-	n.cdf.resize(bins + 1);
-
-	for (std::size_t i=0; i<=bins; ++i) {
-		E = energy[i];
-		n.cdf[i] = p.Eval();
-	}
+SourceGenericComposition::~SourceGenericComposition() {
+	delete parser;
+}
 
-	// integrate
-	for (std::size_t i=bins; i>0; --i) {
-		n.cdf[i] = (n.cdf[i-1] + n.cdf[i]) * (energy[i] - energy[i-1]) / 2;
+void SourceGenericComposition::add(int id, double weight) {
+	// calculate the pdf at all energies in one bulk evaluation
+	std::fill(parserA.begin(), parserA.end(), (double) massNumber(id));
+	std::fill(parserZ.begin(), parserZ.end(), (double) chargeNumber(id));
+	std::vector<double> pdf(bins + 1);
+	try {
+		parser->Eval(&pdf[0], int(bins + 1));
+	} catch (mu::Parser::exception_type &e) {
+		throw std::runtime_error("SourceGenericComposition: " + e.GetMsg());
 	}
-	n.cdf[0] = 0;
 
-	// cumulate
-	for (std::size_t i=1; i<=bins; ++i) {
-		n.cdf[i] += n.cdf[i-1];
+	// integrate and cumulate the bins
+	std::vector<double> energyCDF(bins);
+	double sum = 0;
+	for (std::size_t i = 0; i < bins; ++i) {
+		sum += (pdf[i] + pdf[i + 1]) * (energy[i + 1] - energy[i]) / 2;
+		energyCDF[i] = sum;
 	}
-
-	nuclei.push_back(n);
+	nuclei.push_back(id);
+	energySampler.addRow(energyCDF);
 
 	// update composition cdf
-	if (cdf.size() == 0)
-		cdf.push_back(weight * n.cdf.back());
-	else
-		cdf.push_back(cdf.back() + weight * n.cdf.back());
+	sampler.add(weight * sum);
 }
 
 void SourceGenericComposition::add(int A, int Z, double a) {
 	add(nucleusId(A, Z), a);
 }
 
+std::vector<double> SourceGenericComposition::getNucleusCDF(int id) const {
+	const std::vector<double> &energyCDF = energySampler.getCDF();
+	std::vector<double> c;
+	for (size_t i = 0; i < nuclei.size(); i++) {
+		if (nuclei[i] == id) {
+			c.push_back(0);
+			c.insert(c.end(), energyCDF.begin() + i * bins,
+					energyCDF.begin() + (i + 1) * bins);
+			break;
+		}
+	}
+	return c;
+}
+
 void SourceGenericComposition::prepareParticle(ParticleState& particle) const {
 	if (nuclei.size() == 0)
 		throw std::runtime_error("SourceComposition: No source isotope set");
 
 	Random &random = Random::instance();
 
-
 	// draw random particle type
-	size_t iN = random.randBin(cdf);
-	const Nucleus &n = nuclei.at(iN);
-	particle.setId(n.id);
+	size_t iN = random.randBin(sampler);
+	particle.setId(nuclei[iN]);
 
-	// random energy
-	double E = interpolate(random.rand() * n.cdf.back(), n.cdf, energy);
+	// random energy bin, uniform within the bin as interpolating the cdf
+	size_t i = random.randBin(energySampler, iN);
+	double E = energy[i] + random.rand() * (energy[i + 1] - energy[i]);
 	particle.setEnergy(E);
 }
 
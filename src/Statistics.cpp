@@ -0,0 +1,253 @@
+#include "crpropa/Statistics.h"
+
+#include <cmath>
+#include <iostream>
+#include <sstream>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace crpropa {
+
+namespace {
+
+struct HistogramInfo {
+	std::string name;
+	double min, max;
+	size_t bins;
+};
+
+// histogram of one thread with a copy of its range
+struct ThreadHistogram {
+	double min, max;
+	std::vector<size_t> bins;
+};
+
+// counts of one thread, only written by the thread itself
+struct ThreadCounts {
+	std::vector<size_t> counters;
+	std::vector<ThreadHistogram> histograms;
+};
+
+// function statics, counters are also added during static initialization
+std::vector<std::string> &counterNames() {
+	static std::vector<std::string> n;
+	return n;
+}
+
+std::vector<HistogramInfo> &histogramInfos() {
+	static std::vector<HistogramInfo> h;
+	return h;
+}
+
+std::vector<ThreadCounts *> &threads() {
+	static std::vector<ThreadCounts *> t;
+	return t;
+}
+
+__thread ThreadCounts *threadCounts = 0;
+
+ThreadCounts &currentThread() {
+	if (!threadCounts) {
+		threadCounts = new ThreadCounts;
+#pragma omp critical(Statistics)
+		threads().push_back(threadCounts);
+	}
+	return *threadCounts;
+}
+
+} // namespace
+
+bool Statistics::enabled = false;
+
+void Statistics::setEnabled(bool enable) {
+	enabled = enable;
+}
+
+size_t Statistics::addCounter(const std::string &name) {
+	size_t counter;
+#pragma omp critical(Statistics)
+	{
+		std::vector<std::string> &n = counterNames();
+		counter = n.size();
+		for (size_t i = 0; i < n.size(); i++)
+			if (n[i] == name)
+				counter = i;
+		if (counter == n.size())
+			n.push_back(name);
+	}
+	return counter;
+}
+
+void Statistics::count(size_t counter, size_t n) {
+	std::vector<size_t> &counters = currentThread().counters;
+	if (counters.size() <= counter)
+		counters.resize(counter + 1, 0);
+	counters[counter] += n;
+}
+
+void Statistics::count(const std::string &name, size_t n) {
+	count(addCounter(name), n);
+}
+
+size_t Statistics::getCount(const std::string &name) {
+	size_t total = 0;
+#pragma omp critical(Statistics)
+	{
+		const std::vector<std::string> &n = counterNames();
+		const std::vector<ThreadCounts *> &t = threads();
+		for (size_t i = 0; i < n.size(); i++) {
+			if (n[i] != name)
+				continue;
+			for (size_t k = 0; k < t.size(); k++)
+				if (i < t[k]->counters.size())
+					total += t[k]->counters[i];
+		}
+	}
+	return total;
+}
+
+std::vector<std::string> Statistics::getCounterNames() {
+	std::vector<std::string> names;
+#pragma omp critical(Statistics)
+	names = counterNames();
+	return names;
+}
+
+size_t Statistics::addHistogram(const std::string &name, double min,
+		double max, size_t bins) {
+	size_t histogram;
+#pragma omp critical(Statistics)
+	{
+		std::vector<HistogramInfo> &h = histogramInfos();
+		histogram = h.size();
+		for (size_t i = 0; i < h.size(); i++)
+			if (h[i].name == name)
+				histogram = i;
+		if (histogram == h.size()) {
+			HistogramInfo info;
+			info.name = name;
+			info.min = min;
+			info.max = max;
+			info.bins = (bins > 0) ? bins : 1;
+			h.push_back(info);
+		}
+	}
+	return histogram;
+}
+
+void Statistics::fill(size_t histogram, double value) {
+	std::vector<ThreadHistogram> &histograms = currentThread().histograms;
+	if (histograms.size() <= histogram)
+		histograms.resize(histogram + 1);
+	ThreadHistogram &h = histograms[histogram];
+	if (h.bins.empty()) {
+#pragma omp critical(Statistics)
+		{
+			const HistogramInfo &info = histogramInfos()[histogram];
+			h.min = info.min;
+			h.max = info.max;
+			h.bins.resize(info.bins, 0);
+		}
+	}
+	long n = h.bins.size();
+	double x = (value > 0) ? std::log10(value) : h.min;
+	long bin = long(std::floor((x - h.min) / (h.max - h.min) * n));
+	bin = (bin < 0) ? 0 : ((bin >= n) ? n - 1 : bin);
+	h.bins[bin]++;
+}
+
+std::vector<double> Statistics::getHistogram(const std::string &name) {
+	std::vector<double> counts;
+#pragma omp critical(Statistics)
+	{
+		const std::vector<HistogramInfo> &h = histogramInfos();
+		const std::vector<ThreadCounts *> &t = threads();
+		for (size_t i = 0; i < h.size(); i++) {
+			if (h[i].name != name)
+				continue;
+			counts.assign(h[i].bins, 0);
+			for (size_t k = 0; k < t.size(); k++) {
+				if ((i >= t[k]->histograms.size()) || t[k]->histograms[i].bins.empty())
+					continue;
+				for (size_t b = 0; b < h[i].bins; b++)
+					counts[b] += t[k]->histograms[i].bins[b];
+			}
+		}
+	}
+	return counts;
+}
+
+std::vector<double> Statistics::getHistogramEdges(const std::string &name) {
+	std::vector<double> edges;
+#pragma omp critical(Statistics)
+	{
+		const std::vector<HistogramInfo> &h = histogramInfos();
+		for (size_t i = 0; i < h.size(); i++) {
+			if (h[i].name != name)
+				continue;
+			edges.resize(h[i].bins + 1);
+			for (size_t b = 0; b <= h[i].bins; b++)
+				edges[b] = std::pow(10, h[i].min
+						+ (h[i].max - h[i].min) * b / h[i].bins);
+		}
+	}
+	return edges;
+}
+
+std::vector<std::string> Statistics::getHistogramNames() {
+	std::vector<std::string> names;
+#pragma omp critical(Statistics)
+	{
+		const std::vector<HistogramInfo> &h = histogramInfos();
+		for (size_t i = 0; i < h.size(); i++)
+			names.push_back(h[i].name);
+	}
+	return names;
+}
+
+std::string Statistics::getReport() {
+	std::stringstream ss;
+	ss << "Statistics:\n";
+	std::vector<std::string> names = getCounterNames();
+	for (size_t i = 0; i < names.size(); i++) {
+		size_t n = getCount(names[i]);
+		if (n > 0)
+			ss << " - " << names[i] << ": " << n << "\n";
+	}
+	names = getHistogramNames();
+	for (size_t i = 0; i < names.size(); i++) {
+		std::vector<double> counts = getHistogram(names[i]);
+		std::vector<double> edges = getHistogramEdges(names[i]);
+		double total = 0;
+		for (size_t b = 0; b < counts.size(); b++)
+			total += counts[b];
+		if (total == 0)
+			continue;
+		ss << " - " << names[i] << ":\n";
+		for (size_t b = 0; b < counts.size(); b++)
+			if (counts[b] > 0)
+				ss << "     " << edges[b] << " - " << edges[b + 1] << ": "
+						<< counts[b] << "\n";
+	}
+	return ss.str();
+}
+
+void Statistics::show() {
+	std::cout << getReport();
+}
+
+void Statistics::reset() {
+#pragma omp critical(Statistics)
+	{
+		std::vector<ThreadCounts *> &t = threads();
+		for (size_t k = 0; k < t.size(); k++) {
+			t[k]->counters.assign(t[k]->counters.size(), 0);
+			for (size_t i = 0; i < t[k]->histograms.size(); i++)
+				t[k]->histograms[i].bins.assign(t[k]->histograms[i].bins.size(), 0);
+		}
+	}
+}
+
+} // namespace crpropa
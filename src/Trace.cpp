@@ -0,0 +1,198 @@
+#include "crpropa/Trace.h"
+#include "crpropa/Clock.h"
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+namespace crpropa {
+
+namespace {
+
+struct TraceName {
+	std::string name;
+	std::string category;
+};
+
+struct TraceEvent {
+	size_t name;
+	double begin, duration;
+	long index;
+};
+
+// ring buffer of one thread, only written by the thread itself
+struct ThreadTrace {
+	size_t thread; ///< order of the first event
+	std::vector<TraceEvent> events;
+	size_t next; ///< total number of recorded events
+	size_t calls; ///< of sample()
+};
+
+// function statics, names are also added during static initialization
+std::vector<TraceName> &names() {
+	static std::vector<TraceName> n;
+	return n;
+}
+
+std::vector<ThreadTrace *> &threads() {
+	static std::vector<ThreadTrace *> t;
+	return t;
+}
+
+Clock &clock() {
+	static Clock c;
+	return c;
+}
+
+size_t traceCapacity = 100000;
+size_t traceSampling = 100;
+
+__thread ThreadTrace *threadTrace = 0;
+
+ThreadTrace &currentThread() {
+	if (!threadTrace) {
+		threadTrace = new ThreadTrace;
+		threadTrace->next = 0;
+		threadTrace->calls = 0;
+#pragma omp critical(Trace)
+		{
+			threadTrace->thread = threads().size();
+			threads().push_back(threadTrace);
+		}
+	}
+	return *threadTrace;
+}
+
+std::string jsonString(const std::string &s) {
+	std::stringstream ss;
+	ss << '"';
+	for (size_t i = 0; i < s.size(); i++) {
+		if (s[i] == '"' || s[i] == '\\')
+			ss << '\\' << s[i];
+		else if (s[i] == '\n')
+			ss << "\\n";
+		else
+			ss << s[i];
+	}
+	ss << '"';
+	return ss.str();
+}
+
+} // namespace
+
+bool Trace::enabled = false;
+
+void Trace::start(size_t capacity, size_t moduleSampling) {
+	traceCapacity = (capacity > 0) ? capacity : 1;
+	traceSampling = (moduleSampling > 0) ? moduleSampling : 1;
+#pragma omp critical(Trace)
+	{
+		std::vector<ThreadTrace *> &t = threads();
+		for (size_t k = 0; k < t.size(); k++) {
+			t[k]->events.clear();
+			t[k]->next = 0;
+			t[k]->calls = 0;
+		}
+	}
+	clock().reset();
+	enabled = true;
+}
+
+void Trace::stop() {
+	enabled = false;
+}
+
+size_t Trace::addName(const std::string &name, const std::string &category) {
+	size_t index;
+#pragma omp critical(Trace)
+	{
+		std::vector<TraceName> &n = names();
+		index = n.size();
+		for (size_t i = 0; i < n.size(); i++)
+			if ((n[i].name == name) && (n[i].category == category))
+				index = i;
+		if (index == n.size()) {
+			TraceName t;
+			t.name = name;
+			t.category = category;
+			n.push_back(t);
+		}
+	}
+	return index;
+}
+
+double Trace::now() {
+	return clock().getSecond();
+}
+
+void Trace::record(size_t name, double begin, double end, long index) {
+	ThreadTrace &t = currentThread();
+	TraceEvent e;
+	e.name = name;
+	e.begin = begin;
+	e.duration = end - begin;
+	e.index = index;
+	if (t.events.size() < traceCapacity)
+		t.events.push_back(e);
+	else
+		t.events[t.next % t.events.size()] = e;
+	t.next++;
+}
+
+bool Trace::sample() {
+	ThreadTrace &t = currentThread();
+	return (t.calls++ % traceSampling) == 0;
+}
+
+size_t Trace::size() {
+	size_t n = 0;
+#pragma omp critical(Trace)
+	{
+		const std::vector<ThreadTrace *> &t = threads();
+		for (size_t k = 0; k < t.size(); k++)
+			n += t[k]->events.size();
+	}
+	return n;
+}
+
+void Trace::write(const std::string &filename) {
+	std::ofstream out(filename.c_str());
+	if (!out.good())
+		throw std::runtime_error("crpropa::Trace: could not open " + filename);
+
+	// times in microseconds, one process with a track per thread
+	out << std::fixed;
+	out.precision(3);
+	out << "[";
+	bool first = true;
+#pragma omp critical(Trace)
+	{
+		const std::vector<TraceName> &n = names();
+		const std::vector<ThreadTrace *> &t = threads();
+		for (size_t k = 0; k < t.size(); k++) {
+			const std::vector<TraceEvent> &events = t[k]->events;
+			if (events.empty())
+				continue;
+			out << (first ? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", "
+					<< "\"pid\": 0, \"tid\": " << t[k]->thread
+					<< ", \"args\": {\"name\": \"thread " << t[k]->thread << "\"}}";
+			first = false;
+			// oldest first
+			size_t begin = (t[k]->next > events.size()) ? t[k]->next % events.size() : 0;
+			for (size_t i = 0; i < events.size(); i++) {
+				const TraceEvent &e = events[(begin + i) % events.size()];
+				out << ",\n{\"name\": " << jsonString(n[e.name].name) << ", \"cat\": "
+						<< jsonString(n[e.name].category) << ", \"ph\": \"X\", \"pid\": 0, "
+						<< "\"tid\": " << t[k]->thread << ", \"ts\": " << 1e6 * e.begin
+						<< ", \"dur\": " << 1e6 * e.duration;
+				if (e.index >= 0)
+					out << ", \"args\": {\"index\": " << e.index << "}";
+				out << "}";
+			}
+		}
+	}
+	out << "]\n";
+}
+
+} // namespace crpropa
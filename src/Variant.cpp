@@ -6,6 +6,7 @@
 #include "crpropa/Variant.h"
 
 #include <algorithm>
+#include <cstdio>
 
 namespace crpropa
 {
@@ -28,22 +29,69 @@ Variant::Variant(const Variant& a) :
 
 Variant::Variant(const char *s)
 {
-	data._String = new std::string(s);
+	new (data._String) std::string(s);
 	type = TYPE_STRING;
 }
 
+Variant::Variant(const std::string &a)
+{
+	new (data._String) std::string(a);
+	type = TYPE_STRING;
+}
 
-void Variant::clear()
+#if __cplusplus >= 201103L
+Variant::Variant(Variant &&a) noexcept :
+		type(a.type)
 {
 	if (type == TYPE_STRING)
+		new (data._String) std::string(std::move(a.stringData()));
+	else
+		data = a.data;
+	a.clear();
+}
+
+Variant &Variant::operator =(Variant &&a) noexcept
+{
+	if (&a == this)
+		return *this;
+	if ((type == TYPE_STRING) && (a.type == TYPE_STRING))
 	{
-		if(data._String)
-		{
-			delete data._String;
-			data._String = NULL;
-		}
+		stringData().swap(a.stringData());
+	}
+	else
+	{
+		clear();
+		if (a.type == TYPE_STRING)
+			new (data._String) std::string(std::move(a.stringData()));
+		else
+			data = a.data;
+		type = a.type;
+	}
+	a.clear();
+	return *this;
+}
+#endif
 
+Variant &Variant::operator =(const std::string &a)
+{
+	if (type != TYPE_STRING)
+	{
+		clear();
+		new (data._String) std::string(a);
+		type = TYPE_STRING;
+	}
+	else
+	{
+		stringData() = a;
 	}
+	return *this;
+}
+
+
+void Variant::clear()
+{
+	if (type == TYPE_STRING)
+		stringData().~basic_string();
 
 	type = TYPE_NONE;
 }
@@ -62,7 +110,7 @@ void Variant::check(const Type t)
 		switch (t)
 		{
 		case TYPE_STRING:
-			data._String = new std::string;
+			new (data._String) std::string;
 			break;
 		default:
 			break;
@@ -134,7 +182,7 @@ const std::type_info& Variant::getTypeInfo() const
 	}
 	else if (type == TYPE_STRING)
 	{
-		const std::type_info &ti = typeid(*data._String);
+		const std::type_info &ti = typeid(std::string);
 		return ti;
 	}
 	else
@@ -315,7 +363,7 @@ bool Variant::operator ==(const Variant &a) const
 	}
 	else if (type == TYPE_STRING)
 	{
-		return (*data._String == *a.data._String);
+		return (stringData() == a.stringData());
 	}
 	else
 	{
@@ -326,55 +374,59 @@ bool Variant::operator ==(const Variant &a) const
 std::string Variant::toString() const
 {
 	if (type == TYPE_STRING)
-		return *data._String;
+		return stringData();
+	std::string s;
+	appendTo(s);
+	return s;
+}
 
-	std::stringstream sstr;
-	if (type == TYPE_BOOL)
-	{
-		sstr << data._Bool;
-	}
-	else if (type == TYPE_CHAR)
-	{
-		sstr << data._Char;
-	}
-	else if (type == TYPE_UCHAR)
-	{
-		sstr << data._UChar;
-	}
-	else if (type == TYPE_INT16)
-	{
-		sstr << data._Int16;
-	}
-	else if (type == TYPE_UINT16)
-	{
-		sstr << data._UInt16;
-	}
-	else if (type == TYPE_INT32)
-	{
-		sstr << data._Int32;
-	}
-	else if (type == TYPE_UINT32)
-	{
-		sstr << data._UInt32;
-	}
-	else if (type == TYPE_INT64)
-	{
-		sstr << data._Int64;
-	}
-	else if (type == TYPE_UINT64)
-	{
-		sstr << data._UInt64;
-	}
-	else if (type == TYPE_FLOAT)
-	{
-		sstr << std::scientific << data._Float;
-	}
-	else if (type == TYPE_DOUBLE)
+void Variant::appendTo(std::string &out) const
+{
+	// formatted as by a stream in the classic locale
+	char buffer[32];
+	int n = 0;
+	switch (type)
 	{
-		sstr << std::scientific << data._Double;
+	case TYPE_BOOL:
+		out += data._Bool ? '1' : '0';
+		return;
+	case TYPE_CHAR:
+		out += data._Char;
+		return;
+	case TYPE_UCHAR:
+		out += (char) data._UChar;
+		return;
+	case TYPE_INT16:
+		n = snprintf(buffer, sizeof(buffer), "%d", (int) data._Int16);
+		break;
+	case TYPE_UINT16:
+		n = snprintf(buffer, sizeof(buffer), "%u", (unsigned int) data._UInt16);
+		break;
+	case TYPE_INT32:
+		n = snprintf(buffer, sizeof(buffer), "%d", (int) data._Int32);
+		break;
+	case TYPE_UINT32:
+		n = snprintf(buffer, sizeof(buffer), "%u", (unsigned int) data._UInt32);
+		break;
+	case TYPE_INT64:
+		n = snprintf(buffer, sizeof(buffer), "%lld", (long long) data._Int64);
+		break;
+	case TYPE_UINT64:
+		n = snprintf(buffer, sizeof(buffer), "%llu", (unsigned long long) data._UInt64);
+		break;
+	case TYPE_FLOAT:
+		n = snprintf(buffer, sizeof(buffer), "%e", (double) data._Float);
+		break;
+	case TYPE_DOUBLE:
+		n = snprintf(buffer, sizeof(buffer), "%e", data._Double);
+		break;
+	case TYPE_STRING:
+		out += stringData();
+		return;
+	default:
+		return;
 	}
-
-	return sstr.str();
+	out.append(buffer, n);
 }
 
 Variant Variant::fromString(const std::string &str, Type type)
@@ -501,7 +553,7 @@ bool Variant::operator !=(const Variant &a) const
 	case TYPE_DOUBLE:
 		return (data._Double == a.data._Double);
 	case TYPE_STRING:
-		return (*data._String == *a.data._String);
+		return (stringData() == a.stringData());
 	default:
 		throw std::runtime_error("compare operator not implemented");
 	}
@@ -557,7 +609,7 @@ void Variant::copy(const Variant &a)
 	}
 	else if (t == TYPE_STRING)
 	{
-		operator =(*a.data._String);
+		operator =(a.stringData());
 	}
 	else
 	{
@@ -598,7 +650,7 @@ bool Variant::toBool() const
 		break;
 	case TYPE_STRING:
 	{
-		std::string upperstr(*data._String);
+		std::string upperstr(stringData());
 		std::transform(upperstr.begin(), upperstr.end(), upperstr.begin(),
 				(int(*)(int))toupper);if
 (		upperstr == "YES")
@@ -652,7 +704,7 @@ to Variant::fun() const { \
 	INT_CASE(Double, TYPE_DOUBLE, to_type, to) \
 	case Variant::TYPE_STRING: \
 		{ \
-		long l = atol(data._String->c_str()); \
+		long l = atol(stringData().c_str()); \
 		if (l < std::numeric_limits<to>::min() || l > std::numeric_limits<to>::max()) \
 			throw bad_conversion(type, to_type); \
 		else \
@@ -767,7 +819,7 @@ float Variant::toFloat() const
 	}
 	else if (type == TYPE_STRING)
 	{
-		return static_cast<float>(std::atof(data._String->c_str()));
+		return static_cast<float>(std::atof(stringData().c_str()));
 	}
 	else if (type == TYPE_BOOL)
 	{
@@ -823,7 +875,7 @@ double Variant::toDouble() const
 	}
 	else if (type == TYPE_STRING)
 	{
-		return std::atof(data._String->c_str());
+		return std::atof(stringData().c_str());
 	}
 	else if (type == TYPE_BOOL)
 	{
@@ -840,7 +892,7 @@ double Variant::toDouble() const
 	memcpy(buffer, &VAR, sizeof( VAR) );\
   return sizeof( VAR );
 
-size_t Variant::copyToBuffer(void* buffer)
+size_t Variant::copyToBuffer(void* buffer) const
 {
   if (type == TYPE_CHAR)
 	{
@@ -884,8 +936,8 @@ size_t Variant::copyToBuffer(void* buffer)
 	}
 	else if (type == TYPE_STRING)
 	{
-		size_t len = data._String->size();
-		memcpy(buffer, data._String->c_str(), len);
+		size_t len = stringData().size();
+		memcpy(buffer, stringData().c_str(), len);
 		return len;
 	}
 	else if (type == TYPE_BOOL)
@@ -943,7 +995,7 @@ size_t Variant::getSize() const
 	}
 	else if (type == TYPE_STRING)
 	{
-		size_t len = strlen(data._String->c_str()+1);
+		size_t len = stringData().size();
 		return len;
 	}
 	else if (type == TYPE_BOOL)
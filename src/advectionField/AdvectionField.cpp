@@ -1,5 +1,7 @@
 #include "crpropa/advectionField/AdvectionField.h"
 
+#include <vector>
+
 
 namespace crpropa {
 
@@ -24,6 +26,41 @@ double AdvectionFieldList::getDivergence(const Vector3d &position) const {
 	return D;
 }
 
+void AdvectionFieldList::getFieldAndDivergence(const Vector3d &position,
+		Vector3d &field, double &divergence) const {
+	field = Vector3d(0.);
+	divergence = 0.;
+	for (int i = 0; i < fields.size(); i++) {
+		Vector3d v;
+		double D;
+		fields[i]->getFieldAndDivergence(position, v, D);
+		field += v;
+		divergence += D;
+	}
+}
+
+void AdvectionFieldList::getFieldsAndDivergences(const Vector3d *positions,
+		Vector3d *f, double *divergences, size_t n) const {
+	std::vector<Vector3d> v(f ? n : 0);
+	std::vector<double> D(divergences ? n : 0);
+	for (size_t j = 0; j < n; j++) {
+		if (f)
+			f[j] = Vector3d(0.);
+		if (divergences)
+			divergences[j] = 0.;
+	}
+	for (int i = 0; i < fields.size(); i++) {
+		fields[i]->getFieldsAndDivergences(positions, f ? &v[0] : NULL,
+				divergences ? &D[0] : NULL, n);
+		for (size_t j = 0; j < n; j++) {
+			if (f)
+				f[j] += v[j];
+			if (divergences)
+				divergences[j] += D[j];
+		}
+	}
+}
+
 
 //----------------------------------------------------------------
 UniformAdvectionField::UniformAdvectionField(const Vector3d &value) :
@@ -61,6 +98,14 @@ double ConstantSphericalAdvectionField::getDivergence(const Vector3d &position)
 	return 2*vWind/R;
 }
 
+void ConstantSphericalAdvectionField::getFieldAndDivergence(
+		const Vector3d &position, Vector3d &field, double &divergence) const {
+	Vector3d Pos = position-origin;
+	double R = Pos.getR();
+	field = vWind * (Pos / R);
+	divergence = 2*vWind/R;
+}
+
 void ConstantSphericalAdvectionField::setOrigin(const Vector3d o) {
 	origin=o;
 	return;
@@ -117,6 +162,22 @@ double SphericalAdvectionField::getDivergence(const Vector3d &position) const {
 	return D;
 }
 
+void SphericalAdvectionField::getFieldAndDivergence(const Vector3d &position,
+		Vector3d &field, double &divergence) const {
+	Vector3d Pos = position-origin;
+	double R = Pos.getR();
+	if (R>radius) {
+		field = Vector3d(0.);
+		divergence = 0.;
+		return;
+	}
+	// one exponential for the velocity and its derivative
+	double x = pow(R, alpha)/tau;
+	double e = exp(-x);
+	field = vMax * (1-e) * (Pos / R);
+	divergence = 2*vMax/R * ( 1-( 1-alpha*x/2 )*e );
+}
+
 double SphericalAdvectionField::getV(const double &r) const {
 	double f = vMax * (1-exp(-(pow(r, alpha)/tau)));
 	return f;
@@ -212,6 +273,25 @@ double SphericalAdvectionShock::getDivergence(const Vector3d &pos) const {
 	return v_0 * (d1+d2);
 }
 
+void SphericalAdvectionShock::getFieldAndDivergence(const Vector3d &pos,
+		Vector3d &field, double &divergence) const {
+	Vector3d R = pos-origin;
+	double r = R.getR();
+
+	// g and g_prime from one exponential, exp(-|a|) does not overflow
+	double a = (r-r_0)/lambda;
+	double e = exp(-fabs(a));
+	double g = (a >= 0) ? 1. / (1+e) : e / (1+e);
+	double g_prime = e / (lambda*(1+e)*(1+e));
+	double s = r_0/(2*r);
+	double q = s*s - 1;
+
+	double v_r = v_0 * ( 1 + q * g);
+	double v_p = v_phi * (r_rot/r);
+	field = v_r * (R / r) + v_p * R.getUnitVectorPhi();
+	divergence = v_0 * (2./r*(1-g) + q*g_prime);
+}
+
 
 double SphericalAdvectionShock::g(double r) const {
 	double a = (r-r_0)/lambda;
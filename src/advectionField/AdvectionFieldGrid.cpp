@@ -0,0 +1,83 @@
+#include "crpropa/advectionField/AdvectionFieldGrid.h"
+
+namespace crpropa {
+
+AdvectionFieldGrid::AdvectionFieldGrid(ref_ptr<VectorGrid> grid) {
+	setGrid(grid);
+}
+
+void AdvectionFieldGrid::setGrid(ref_ptr<VectorGrid> g) {
+	grid = g;
+	updateDivergence();
+}
+
+ref_ptr<VectorGrid> AdvectionFieldGrid::getGrid() {
+	return grid;
+}
+
+ref_ptr<ScalarGrid> AdvectionFieldGrid::getDivergenceGrid() {
+	return divergenceGrid;
+}
+
+// neighbor index i of n points, continued periodically or reflectively
+static inline size_t neighbor(long i, long n, bool reflective) {
+	if (reflective)
+		return (i < 0) ? 0 : ((i >= n) ? n - 1 : i);
+	return (i + n) % n;
+}
+
+void AdvectionFieldGrid::updateDivergence() {
+	const VectorGrid &g = *grid;
+	const long Nx = g.getNx(), Ny = g.getNy(), Nz = g.getNz();
+	const Vector3d spacing = g.getSpacing();
+	const bool reflective = g.isReflective();
+	divergenceGrid = new ScalarGrid(g.getOrigin(), Nx, Ny, Nz, spacing);
+	divergenceGrid->setReflective(reflective);
+	ScalarGrid &d = *divergenceGrid;
+
+	// central differences, the grid points at the boundary of a reflective
+	// grid are their own mirrored neighbors
+#pragma omp parallel for schedule(static)
+	for (long ix = 0; ix < Nx; ix++)
+		for (long iy = 0; iy < Ny; iy++)
+			for (long iz = 0; iz < Nz; iz++) {
+				double dx = g.get(neighbor(ix + 1, Nx, reflective), iy, iz).x
+						- g.get(neighbor(ix - 1, Nx, reflective), iy, iz).x;
+				double dy = g.get(ix, neighbor(iy + 1, Ny, reflective), iz).y
+						- g.get(ix, neighbor(iy - 1, Ny, reflective), iz).y;
+				double dz = g.get(ix, iy, neighbor(iz + 1, Nz, reflective)).z
+						- g.get(ix, iy, neighbor(iz - 1, Nz, reflective)).z;
+				d.get(ix, iy, iz) = dx / (2 * spacing.x) + dy / (2 * spacing.y)
+						+ dz / (2 * spacing.z);
+			}
+}
+
+Vector3d AdvectionFieldGrid::getField(const Vector3d &position) const {
+	return grid->interpolate(position);
+}
+
+double AdvectionFieldGrid::getDivergence(const Vector3d &position) const {
+	return divergenceGrid->interpolate(position);
+}
+
+void AdvectionFieldGrid::getFieldAndDivergence(const Vector3d &position,
+		Vector3d &field, double &divergence) const {
+	field = grid->interpolate(position);
+	divergence = divergenceGrid->interpolate(position);
+}
+
+void AdvectionFieldGrid::getFieldsAndDivergences(const Vector3d *positions,
+		Vector3d *fields, double *divergences, size_t n) const {
+	if (fields) {
+		const VectorGrid &g = *grid;
+		for (size_t i = 0; i < n; i++)
+			fields[i] = g.interpolate(positions[i]);
+	}
+	if (divergences) {
+		const ScalarGrid &d = *divergenceGrid;
+		for (size_t i = 0; i < n; i++)
+			divergences[i] = d.interpolate(positions[i]);
+	}
+}
+
+} // namespace crpropa
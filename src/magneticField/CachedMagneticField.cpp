@@ -0,0 +1,107 @@
+#include "crpropa/magneticField/CachedMagneticField.h"
+#include "crpropa/GridTools.h"
+#include "crpropa/Random.h"
+
+#include <cmath>
+#include <stdexcept>
+
+namespace crpropa {
+
+CachedMagneticField::CachedMagneticField(ref_ptr<MagneticField> field,
+		const Vector3d &origin, const Vector3d &size, double spacing) :
+		field(field), boxOrigin(origin), boxSize(size), spacing(spacing) {
+	if ((size.x <= 0) || (size.y <= 0) || (size.z <= 0))
+		throw std::runtime_error("CachedMagneticField: box size <= 0");
+	if (spacing <= 0)
+		throw std::runtime_error("CachedMagneticField: spacing <= 0");
+	sample();
+}
+
+CachedMagneticField::CachedMagneticField(ref_ptr<MagneticField> field,
+		ref_ptr<VectorGrid> grid) :
+		field(field), grid(grid) {
+	Vector3d s = grid->getSpacing();
+	if ((s.x != s.y) || (s.y != s.z))
+		throw std::runtime_error("CachedMagneticField: only equal spacing supported");
+	spacing = s.x;
+	// grid point 0 is on the lower box boundary
+	boxOrigin = grid->getOrigin() + s / 2;
+	boxSize = Vector3d(grid->getNx() - 1, grid->getNy() - 1, grid->getNz() - 1) * spacing;
+}
+
+void CachedMagneticField::sample() {
+	// one more point than cells, points on both boundaries
+	size_t Nx = (size_t) ceil(boxSize.x / spacing) + 1;
+	size_t Ny = (size_t) ceil(boxSize.y / spacing) + 1;
+	size_t Nz = (size_t) ceil(boxSize.z / spacing) + 1;
+	grid = new VectorGrid(boxOrigin - Vector3d(spacing / 2), Nx, Ny, Nz, spacing);
+	fromMagneticField(grid, field);
+}
+
+bool CachedMagneticField::isInside(const Vector3d &pos) const {
+	Vector3d r = pos - boxOrigin;
+	return (r.x >= 0) && (r.y >= 0) && (r.z >= 0) && (r.x <= boxSize.x)
+			&& (r.y <= boxSize.y) && (r.z <= boxSize.z);
+}
+
+Vector3d CachedMagneticField::getField(const Vector3d &pos) const {
+	if (isInside(pos))
+		return grid->interpolate(pos);
+	return field->getField(pos);
+}
+
+void CachedMagneticField::getFields(const Vector3d *pos, Vector3d *fields,
+		size_t n) const {
+	for (size_t i = 0; i < n; i++)
+		fields[i] = getField(pos[i]);
+}
+
+double CachedMagneticField::getRelativeError(size_t samples, int seed) const {
+	Random random;
+	if (seed != 0)
+		random.seed(seed);
+	double sumDiff2 = 0, sumB2 = 0;
+	for (size_t i = 0; i < samples; i++) {
+		Vector3d pos = boxOrigin + Vector3d(random.rand(boxSize.x),
+				random.rand(boxSize.y), random.rand(boxSize.z));
+		Vector3d b = field->getField(pos);
+		sumDiff2 += (grid->interpolate(pos) - b).getR2();
+		sumB2 += b.getR2();
+	}
+	if (sumB2 == 0)
+		return 0;
+	return sqrt(sumDiff2 / sumB2);
+}
+
+double CachedMagneticField::refine(double accuracy, double minSpacing,
+		size_t samples) {
+	double error = getRelativeError(samples);
+	while ((error > accuracy) && (spacing / 2 >= minSpacing)) {
+		spacing /= 2;
+		sample();
+		error = getRelativeError(samples);
+	}
+	return error;
+}
+
+void CachedMagneticField::save(const std::string &filename) const {
+	dumpGrid(grid, filename);
+}
+
+ref_ptr<VectorGrid> CachedMagneticField::getGrid() const {
+	return grid;
+}
+
+Vector3d CachedMagneticField::getBoxOrigin() const {
+	return boxOrigin;
+}
+
+Vector3d CachedMagneticField::getBoxSize() const {
+	return boxSize;
+}
+
+double CachedMagneticField::getSpacing() const {
+	return spacing;
+}
+
+} // namespace crpropa
@@ -1,10 +1,90 @@
 #include "crpropa/magneticField/JF12Field.h"
+#include "crpropa/magneticField/CachedMagneticField.h"
 #include "crpropa/Units.h"
 #include "crpropa/GridTools.h"
 #include "crpropa/Random.h"
 
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <unistd.h>
+
 namespace crpropa {
 
+// realizations of the seeds other than 0, shared by all instances
+static std::map<int, ref_ptr<ScalarGrid> > striatedRealizations;
+static std::map<int, ref_ptr<VectorGrid> > turbulentRealizations;
+static std::string realizationDirectory;
+
+static void createStriated(ref_ptr<ScalarGrid> grid, int seed) {
+	Random random;
+	if (seed != 0)
+		random.seed(seed);
+
+	size_t N = grid->getNx();
+	for (int ix = 0; ix < N; ix++)
+		for (int iy = 0; iy < N; iy++)
+			for (int iz = 0; iz < N; iz++) {
+				float &f = grid->get(ix, iy, iz);
+				f = round(random.rand()) * 2 - 1;
+			}
+}
+
+#ifdef CRPROPA_HAVE_FFTW3F
+static void createTurbulent(ref_ptr<VectorGrid> grid, int seed) {
+	// turbulent field with Kolmogorov spectrum, B_rms = 1 and Lc = 60 parsec
+	initTurbulence(grid, 1, 8 * parsec, 272 * parsec, -11./3., seed);
+}
+#endif
+
+/** The realization of the seed, from the process, the directory or created */
+template<typename T>
+static ref_ptr<Grid<T> > sharedRealization(std::map<int, ref_ptr<Grid<T> > > &realizations,
+		const char *name, int seed, size_t N, double spacing,
+		void (*create)(ref_ptr<Grid<T> >, int)) {
+	ref_ptr<Grid<T> > grid;
+	#pragma omp critical(JF12Realizations)
+	{
+		typename std::map<int, ref_ptr<Grid<T> > >::iterator i = realizations.find(seed);
+		if (i != realizations.end()) {
+			grid = i->second;
+		} else {
+			std::stringstream filename;
+			if (!realizationDirectory.empty())
+				filename << realizationDirectory << "/" << name << "-" << seed << ".raw";
+			if (!realizationDirectory.empty() && std::ifstream(filename.str().c_str()).good()) {
+				grid = new Grid<T>(Vector3d(0.), 1, spacing);
+				grid->setMappedFile(new MappedFile(filename.str()), N, N, N);
+			} else {
+				grid = new Grid<T>(Vector3d(0.), N, spacing);
+				create(grid, seed);
+				if (!realizationDirectory.empty()) {
+					// written completely before other processes can see it
+					std::stringstream temporary;
+					temporary << filename.str() << "." << getpid();
+					dumpGrid(grid, temporary.str());
+					std::rename(temporary.str().c_str(), filename.str().c_str());
+				}
+			}
+			realizations[seed] = grid;
+		}
+	}
+	return grid;
+}
+
+// the regular field of a JF12Field, for the cache of its owner
+class JF12RegularField: public MagneticField {
+	const JF12Field *field;
+public:
+	JF12RegularField(const JF12Field *field) :
+			field(field) {
+	}
+	Vector3d getField(const Vector3d &pos) const {
+		return field->getRegularField(pos);
+	}
+};
+
 JF12Field::JF12Field() {
 	useRegularField = true;
 	useStriatedField = false;
@@ -84,29 +164,63 @@ JF12Field::JF12Field() {
 void JF12Field::randomStriated(int seed) {
 	useStriatedField = true;
 	int N = 100;
+	if (seed != 0) {
+		striatedGrid = sharedRealization(striatedRealizations, "JF12Striated",
+				seed, N, 0.1 * kpc, createStriated);
+		return;
+	}
 	striatedGrid = new ScalarGrid(Vector3d(0.), N, 0.1 * kpc);
-
-	Random random;
-	if (seed != 0)
-		random.seed(seed);
-
-	for (int ix = 0; ix < N; ix++)
-		for (int iy = 0; iy < N; iy++)
-			for (int iz = 0; iz < N; iz++) {
-				float &f = striatedGrid->get(ix, iy, iz);
-				f = round(random.rand()) * 2 - 1;
-			}
+	createStriated(striatedGrid, seed);
 }
 
 #ifdef CRPROPA_HAVE_FFTW3F
 void JF12Field::randomTurbulent(int seed) {
 	useTurbulentField = true;
-	// turbulent field with Kolmogorov spectrum, B_rms = 1 and Lc = 60 parsec
+	if (seed != 0) {
+		turbulentGrid = sharedRealization(turbulentRealizations, "JF12Turbulent",
+				seed, 256, 4 * parsec, createTurbulent);
+		return;
+	}
 	turbulentGrid = new VectorGrid(Vector3d(0.), 256, 4 * parsec);
-	initTurbulence(turbulentGrid, 1, 8 * parsec, 272 * parsec, -11./3., seed);
+	createTurbulent(turbulentGrid, seed);
 }
 #endif
 
+void JF12Field::setRealizationDirectory(const std::string &directory) {
+	#pragma omp critical(JF12Realizations)
+	realizationDirectory = directory;
+}
+
+std::string JF12Field::getRealizationDirectory() {
+	return realizationDirectory;
+}
+
+void JF12Field::clearRealizations() {
+	#pragma omp critical(JF12Realizations)
+	{
+		striatedRealizations.clear();
+		turbulentRealizations.clear();
+	}
+}
+
+void JF12Field::cacheRegularField(double spacing, double size) {
+	regularCache = 0;
+	if (spacing <= 0)
+		return;
+	regularCache = new CachedMagneticField(new JF12RegularField(this),
+			Vector3d(-size / 2), Vector3d(size), spacing);
+}
+
+bool JF12Field::isCachingRegularField() const {
+	return regularCache.valid();
+}
+
+Vector3d JF12Field::regularField(const Vector3d& pos) const {
+	if (regularCache.valid())
+		return regularCache->getField(pos);
+	return getRegularField(pos);
+}
+
 void JF12Field::setStriatedGrid(ref_ptr<ScalarGrid> grid) {
 	useStriatedField = true;
 	striatedGrid = grid;
@@ -127,18 +241,22 @@ ref_ptr<VectorGrid> JF12Field::getTurbulentGrid() {
 
 void JF12Field::setUseRegularField(bool use) {
 	useRegularField = use;
+	regularCache = 0;
 }
 
 void JF12Field::setUseDiskField(bool use) {
 	useDiskField = use;
+	regularCache = 0;
 }
 
 void JF12Field::setUseToroidalHaloField(bool use) {
 	useToroidalHaloField = use;
+	regularCache = 0;
 }
 
 void JF12Field::setUseXField(bool use) {
 	useXField = use;
+	regularCache = 0;
 }
 
 void JF12Field::setUseStriatedField(bool use) {
@@ -287,7 +405,7 @@ Vector3d JF12Field::getXField(const double& r, const double& z, const double& si
 }
 
 Vector3d JF12Field::getStriatedField(const Vector3d& pos) const {
-	return (getRegularField(pos)
+	return (regularField(pos)
 			* (1. + sqrtbeta * striatedGrid->closestValue(pos)));
 }
 
@@ -337,8 +455,30 @@ Vector3d JF12Field::getField(const Vector3d& pos) const {
 	if (useStriatedField)
 		b += getStriatedField(pos);
 	else if (useRegularField)
-		b += getRegularField(pos);
+		b += regularField(pos);
 	return b;
 }
 
+void JF12Field::getFields(const Vector3d *pos, Vector3d *fields, size_t n) const {
+	for (size_t i = 0; i < n; i++)
+		fields[i] = Vector3d(0.);
+	if (useTurbulentField) {
+		const VectorGrid &g = *turbulentGrid;
+		for (size_t i = 0; i < n; i++)
+			fields[i] += g.interpolate(pos[i]) * getTurbulentStrength(pos[i]);
+	}
+	if (useStriatedField) {
+		for (size_t i = 0; i < n; i++)
+			fields[i] += getStriatedField(pos[i]);
+	} else if (useRegularField) {
+		for (size_t i = 0; i < n; i++)
+			fields[i] += regularField(pos[i]);
+	}
+}
+
+void JF12Field::getFields(const Vector3d *pos, Vector3d *fields, size_t n,
+		double z) const {
+	getFields(pos, fields, n);
+}
+
 } // namespace crpropa
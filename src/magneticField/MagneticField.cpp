@@ -1,7 +1,40 @@
 #include "crpropa/magneticField/MagneticField.h"
+#include "crpropa/magneticField/MagneticFieldGrid.h"
+#include "crpropa/magneticField/OctreeMagneticField.h"
+
+#include <stdexcept>
+#include <typeinfo>
 
 namespace crpropa {
 
+void MagneticField::getConfiguration(Configuration &configuration) const {
+	throw std::runtime_error(std::string("MagneticField: no configuration of ")
+			+ typeid(*this).name());
+}
+
+Vector3d BatchMagneticField::getField(const Vector3d &position) const {
+	return getField(position, 0);
+}
+
+Vector3d BatchMagneticField::getField(const Vector3d &position, double z) const {
+	Vector3d field(0.);
+	getFields(&position, &field, 1, z);
+	return field;
+}
+
+void BatchMagneticField::getFields(const Vector3d *positions, Vector3d *fields,
+		size_t n) const {
+	getFields(positions, fields, n, 0);
+}
+
+void BatchMagneticField::getFields(const Vector3d *positions, Vector3d *fields,
+		size_t n, double z) const {
+	// the positions are not modified
+	const Vector3dArray p(const_cast<Vector3d *>(positions), n);
+	Vector3dArray f(fields, n);
+	getFieldArray(p, f, z);
+}
+
 PeriodicMagneticField::PeriodicMagneticField(ref_ptr<MagneticField> field,
 		const Vector3d &extends) :
 		field(field), extends(extends), origin(0, 0, 0), reflective(false) {
@@ -57,17 +90,217 @@ Vector3d PeriodicMagneticField::getField(const Vector3d &position) const {
 	return field->getField(p);
 }
 
+bool PeriodicMagneticField::isUniform() const {
+	return field->isUniform();
+}
+
+static bool isInside(const Vector3d &p, const Vector3d &lower,
+		const Vector3d &upper) {
+	return (p.x >= lower.x) && (p.y >= lower.y) && (p.z >= lower.z)
+			&& (p.x <= upper.x) && (p.y <= upper.y) && (p.z <= upper.z);
+}
+
+static bool sameGeometry(const VectorGrid &a, const VectorGrid &b) {
+	return (a.getOrigin() == b.getOrigin()) && (a.getSpacing() == b.getSpacing())
+			&& (a.getNx() == b.getNx()) && (a.getNy() == b.getNy())
+			&& (a.getNz() == b.getNz()) && (a.isReflective() == b.isReflective())
+			&& (a.isBricked() == b.isBricked());
+}
+
+MagneticFieldList::MagneticFieldList() : frozen(false) {
+}
+
 void MagneticFieldList::addField(ref_ptr<MagneticField> field) {
 	fields.push_back(field);
+	boxLower.push_back(Vector3d(0.));
+	boxUpper.push_back(Vector3d(0.));
+	bounded.push_back(false);
+	frozen = false;
+}
+
+void MagneticFieldList::addField(ref_ptr<MagneticField> field,
+		const Vector3d &boxOrigin, const Vector3d &boxSize) {
+	fields.push_back(field);
+	boxLower.push_back(boxOrigin);
+	boxUpper.push_back(boxOrigin + boxSize);
+	bounded.push_back(true);
+	frozen = false;
+}
+
+void MagneticFieldList::freeze() {
+	frozenGrids.clear();
+	gridLower.clear();
+	gridUpper.clear();
+	gridBounded.clear();
+	frozenFields.clear();
+
+	for (size_t i = 0; i < fields.size(); i++) {
+		Vector3d lower = boxLower[i], upper = boxUpper[i];
+		bool b = bounded[i];
+
+		OctreeMagneticField *octree = dynamic_cast<OctreeMagneticField*>(fields[i].get());
+		if (octree && !b) {
+			lower = octree->getOrigin();
+			upper = lower + Vector3d(octree->getSize());
+			b = true;
+		}
+
+		MagneticFieldGrid *mfg = dynamic_cast<MagneticFieldGrid*>(fields[i].get());
+		ref_ptr<VectorGrid> grid = mfg ? mfg->getGrid() : ref_ptr<VectorGrid>();
+		if (!grid.valid()) {
+			boxLower[i] = lower;
+			boxUpper[i] = upper;
+			bounded[i] = b;
+			frozenFields.push_back(i);
+			continue;
+		}
+
+		// add to a fused grid of the same geometry and bounding box
+		size_t j = 0;
+		for (; j < frozenGrids.size(); j++)
+			if (!frozenGrids[j]->isMapped() && sameGeometry(*frozenGrids[j], *grid)
+					&& (gridBounded[j] == b)
+					&& (!b || ((gridLower[j] == lower) && (gridUpper[j] == upper))))
+				break;
+		if (j == frozenGrids.size()) {
+			frozenGrids.push_back(grid);
+			gridLower.push_back(lower);
+			gridUpper.push_back(upper);
+			gridBounded.push_back(b);
+			continue;
+		}
+
+		// copy on the first fusion, i.e. while the field still holds the grid too
+		if (frozenGrids[j]->getReferenceCount() > 1)
+			frozenGrids[j] = new VectorGrid(*frozenGrids[j]);
+		VectorGrid &sum = *frozenGrids[j];
+		for (size_t ix = 0; ix < sum.getNx(); ix++)
+			for (size_t iy = 0; iy < sum.getNy(); iy++)
+				for (size_t iz = 0; iz < sum.getNz(); iz++)
+					sum.get(ix, iy, iz) += grid->get(ix, iy, iz);
+	}
+	frozen = true;
+}
+
+bool MagneticFieldList::isFrozen() const {
+	return frozen;
+}
+
+size_t MagneticFieldList::getNumberOfFields() const {
+	if (frozen)
+		return frozenGrids.size() + frozenFields.size();
+	return fields.size();
+}
+
+bool MagneticFieldList::isUniform() const {
+	for (size_t i = 0; i < fields.size(); i++)
+		if (bounded[i] || !fields[i]->isUniform())
+			return false;
+	return true;
+}
+
+void MagneticFieldList::getConfiguration(Configuration &c) const {
+	c.setType("MagneticFieldList");
+	c.setList("fields", fields);
+	std::vector<double> b, lower, upper;
+	for (size_t i = 0; i < fields.size(); i++) {
+		b.push_back(bounded[i]);
+		lower.push_back(boxLower[i].x);
+		lower.push_back(boxLower[i].y);
+		lower.push_back(boxLower[i].z);
+		upper.push_back(boxUpper[i].x);
+		upper.push_back(boxUpper[i].y);
+		upper.push_back(boxUpper[i].z);
+	}
+	c.set("bounded", b);
+	c.set("boxLower", lower);
+	c.set("boxUpper", upper);
+	c.set("frozen", frozen);
 }
 
 Vector3d MagneticFieldList::getField(const Vector3d &position) const {
-	Vector3d b;
-	for (int i = 0; i < fields.size(); i++)
-		b += fields[i]->getField(position);
+	return getField(position, 0);
+}
+
+Vector3d MagneticFieldList::getField(const Vector3d &position, double z) const {
+	Vector3d b(0.);
+	if (!frozen) {
+		for (size_t i = 0; i < fields.size(); i++)
+			if (!bounded[i] || isInside(position, boxLower[i], boxUpper[i]))
+				b += fields[i]->getField(position, z);
+		return b;
+	}
+
+	for (size_t i = 0; i < frozenGrids.size(); i++)
+		if (!gridBounded[i] || isInside(position, gridLower[i], gridUpper[i]))
+			b += frozenGrids[i]->interpolate(position);
+	for (size_t k = 0; k < frozenFields.size(); k++) {
+		size_t i = frozenFields[k];
+		if (!bounded[i] || isInside(position, boxLower[i], boxUpper[i]))
+			b += fields[i]->getField(position, z);
+	}
 	return b;
 }
 
+void MagneticFieldList::addFields(const MagneticField *field,
+		const VectorGrid *grid, bool bounded, const Vector3d &lower,
+		const Vector3d &upper, const Vector3d *pos, Vector3d *fields, size_t n,
+		double z) const {
+	// positions inside the bounding box
+	std::vector<size_t> index;
+	std::vector<Vector3d> inside;
+	if (bounded) {
+		for (size_t i = 0; i < n; i++)
+			if (isInside(pos[i], lower, upper)) {
+				index.push_back(i);
+				inside.push_back(pos[i]);
+			}
+		if (inside.empty())
+			return;
+	}
+	size_t m = bounded ? inside.size() : n;
+	const Vector3d *p = bounded ? &inside[0] : pos;
+
+	std::vector<Vector3d> b(m);
+	if (grid)
+		for (size_t i = 0; i < m; i++)
+			b[i] = grid->interpolate(p[i]);
+	else
+		field->getFields(p, &b[0], m, z);
+
+	for (size_t i = 0; i < m; i++)
+		fields[bounded ? index[i] : i] += b[i];
+}
+
+void MagneticFieldList::getFields(const Vector3d *pos, Vector3d *fields,
+		size_t n) const {
+	getFields(pos, fields, n, 0);
+}
+
+void MagneticFieldList::getFields(const Vector3d *pos, Vector3d *fields,
+		size_t n, double z) const {
+	for (size_t i = 0; i < n; i++)
+		fields[i] = Vector3d(0.);
+	if (n == 0)
+		return;
+
+	if (!frozen) {
+		for (size_t i = 0; i < this->fields.size(); i++)
+			addFields(this->fields[i], 0, bounded[i], boxLower[i], boxUpper[i],
+					pos, fields, n, z);
+		return;
+	}
+
+	for (size_t i = 0; i < frozenGrids.size(); i++)
+		addFields(0, frozenGrids[i], gridBounded[i], gridLower[i], gridUpper[i],
+				pos, fields, n, z);
+	for (size_t k = 0; k < frozenFields.size(); k++) {
+		size_t i = frozenFields[k];
+		addFields(this->fields[i], 0, bounded[i], boxLower[i], boxUpper[i],
+				pos, fields, n, z);
+	}
+}
+
 MagneticFieldEvolution::MagneticFieldEvolution(ref_ptr<MagneticField> field,
 	double m) :
 	field(field), m(m) {
@@ -78,6 +311,29 @@ Vector3d MagneticFieldEvolution::getField(const Vector3d &position,
 	return field->getField(position) * pow(1+z, m);
 }
 
+void MagneticFieldEvolution::getFields(const Vector3d *pos, Vector3d *fields,
+		size_t n) const {
+	getFields(pos, fields, n, 0);
+}
+
+void MagneticFieldEvolution::getFields(const Vector3d *pos, Vector3d *fields,
+		size_t n, double z) const {
+	field->getFields(pos, fields, n);
+	double a = pow(1 + z, m);
+	for (size_t i = 0; i < n; i++)
+		fields[i] *= a;
+}
+
+bool MagneticFieldEvolution::isUniform() const {
+	return field->isUniform();
+}
+
+void MagneticFieldEvolution::getConfiguration(Configuration &c) const {
+	c.setType("MagneticFieldEvolution");
+	c.set("field", field.get());
+	c.set("m", m);
+}
+
 Vector3d MagneticDipoleField::getField(const Vector3d &position) const {
 		Vector3d r = (position - origin);
 		Vector3d unit_r = r.getUnitVector();
@@ -1,21 +1,134 @@
 #include "crpropa/magneticField/MagneticFieldGrid.h"
+#include "crpropa/Common.h"
+
+#include <stdexcept>
 
 namespace crpropa {
 
-MagneticFieldGrid::MagneticFieldGrid(ref_ptr<VectorGrid> grid) {
+MagneticFieldGrid::MagneticFieldGrid(ref_ptr<VectorGrid> grid) :
+		tricubic(false) {
+	setGrid(grid);
+}
+
+MagneticFieldGrid::MagneticFieldGrid(ref_ptr<QuantizedVectorGrid> grid) :
+		tricubic(false) {
+	setGrid(grid);
+}
+
+MagneticFieldGrid::MagneticFieldGrid(ref_ptr<SparseVectorGrid> grid) :
+		tricubic(false) {
 	setGrid(grid);
 }
 
 void MagneticFieldGrid::setGrid(ref_ptr<VectorGrid> grid) {
 	this->grid = grid;
+	quantizedGrid = 0;
+	sparseGrid = 0;
+}
+
+void MagneticFieldGrid::setGrid(ref_ptr<QuantizedVectorGrid> grid) {
+	this->grid = 0;
+	quantizedGrid = grid;
+	sparseGrid = 0;
+}
+
+void MagneticFieldGrid::setGrid(ref_ptr<SparseVectorGrid> grid) {
+	if (tricubic)
+		throw std::runtime_error("MagneticFieldGrid: sparse grids are interpolated trilinearly");
+	this->grid = 0;
+	quantizedGrid = 0;
+	sparseGrid = grid;
 }
 
 ref_ptr<VectorGrid> MagneticFieldGrid::getGrid() {
 	return grid;
 }
 
+ref_ptr<QuantizedVectorGrid> MagneticFieldGrid::getQuantizedGrid() {
+	return quantizedGrid;
+}
+
+ref_ptr<SparseVectorGrid> MagneticFieldGrid::getSparseGrid() {
+	return sparseGrid;
+}
+
+void MagneticFieldGrid::setTricubic(bool t) {
+	if (t && sparseGrid.valid())
+		throw std::runtime_error("MagneticFieldGrid: sparse grids are interpolated trilinearly");
+	tricubic = t;
+}
+
+bool MagneticFieldGrid::isTricubic() const {
+	return tricubic;
+}
+
+void MagneticFieldGrid::getConfiguration(Configuration &c) const {
+	ref_ptr<MappedFile> file;
+	if (grid.valid())
+		file = grid->getMappedFile();
+	if (!file.valid())
+		throw std::runtime_error("MagneticFieldGrid: only grids of mapped files "
+				"(mapGrid) can be saved");
+	c.setType("MagneticFieldGrid");
+	c.setString("file", file->getFilename());
+	c.set("origin", grid->getOrigin());
+	c.set("size", Vector3d(grid->getNx(), grid->getNy(), grid->getNz()));
+	c.set("spacing", grid->getSpacing());
+	c.set("reflective", grid->isReflective());
+	c.set("tricubic", tricubic);
+}
+
 Vector3d MagneticFieldGrid::getField(const Vector3d &pos) const {
-	return grid->interpolate(pos);
+	if (tricubic)
+		return grid.valid() ? grid->interpolateTricubic(pos)
+				: quantizedGrid->interpolateTricubic(pos);
+	if (grid.valid())
+		return grid->interpolate(pos);
+	if (sparseGrid.valid())
+		return sparseGrid->interpolate(pos);
+	return quantizedGrid->interpolate(pos);
+}
+
+// the interpolation loops, outside of the virtual functions for the multiversioning
+CRPROPA_MULTIVERSION
+static void interpolateFields(const VectorGrid &g, const Vector3d *pos,
+		Vector3d *fields, size_t n) {
+	for (size_t i = 0; i < n; i++)
+		fields[i] = g.interpolate(pos[i]);
+}
+
+CRPROPA_MULTIVERSION
+static void interpolateFields(const QuantizedVectorGrid &g, const Vector3d *pos,
+		Vector3d *fields, size_t n) {
+	for (size_t i = 0; i < n; i++)
+		fields[i] = g.interpolate(pos[i]);
+}
+
+CRPROPA_MULTIVERSION
+static void interpolateFields(const SparseVectorGrid &g, const Vector3d *pos,
+		Vector3d *fields, size_t n) {
+	for (size_t i = 0; i < n; i++)
+		fields[i] = g.interpolate(pos[i]);
+}
+
+CRPROPA_MULTIVERSION
+static void interpolateFields(const VectorGrid &g, const ScalarGrid &mg,
+		const Vector3d *pos, Vector3d *fields, size_t n) {
+	for (size_t i = 0; i < n; i++)
+		fields[i] = Vector3d(g.interpolate(pos[i])) * mg.interpolate(pos[i]);
+}
+
+void MagneticFieldGrid::getFields(const Vector3d *pos, Vector3d *fields, size_t n) const {
+	if (tricubic) {
+		for (size_t i = 0; i < n; i++)
+			fields[i] = getField(pos[i]);
+	} else if (grid.valid()) {
+		interpolateFields(*grid, pos, fields, n);
+	} else if (sparseGrid.valid()) {
+		interpolateFields(*sparseGrid, pos, fields, n);
+	} else {
+		interpolateFields(*quantizedGrid, pos, fields, n);
+	}
 }
 
 ModulatedMagneticFieldGrid::ModulatedMagneticFieldGrid(ref_ptr<VectorGrid> grid,
@@ -54,4 +167,8 @@ Vector3d ModulatedMagneticFieldGrid::getField(const Vector3d &pos) const {
 	return b * m;
 }
 
+void ModulatedMagneticFieldGrid::getFields(const Vector3d *pos, Vector3d *fields, size_t n) const {
+	interpolateFields(*grid, *modGrid, pos, fields, n);
+}
+
 } // namespace crpropa
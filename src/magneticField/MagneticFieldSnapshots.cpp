@@ -0,0 +1,282 @@
+#include "crpropa/magneticField/MagneticFieldSnapshots.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace crpropa {
+
+static const size_t npos = size_t(-1);
+// further threads take the lock for every field
+static const size_t SNAPSHOT_THREADS = 256;
+
+MagneticFieldSnapshots::MagneticFieldSnapshots(const Vector3d &origin,
+		size_t N, double spacing) :
+		origin(origin), Nx(N), Ny(N), Nz(N), spacing(spacing), maxMapped(4),
+		prefetch(true), useClock(0), prefetchIndex(npos), loadingIndex(npos),
+		prefetching(false), stop(false) {
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&changed, NULL);
+	pairs.resize(SNAPSHOT_THREADS);
+	for (size_t i = 0; i < pairs.size(); i++)
+		pairs[i].lower = npos;
+}
+
+MagneticFieldSnapshots::MagneticFieldSnapshots(const Vector3d &origin,
+		size_t Nx, size_t Ny, size_t Nz, double spacing) :
+		origin(origin), Nx(Nx), Ny(Ny), Nz(Nz), spacing(spacing), maxMapped(4),
+		prefetch(true), useClock(0), prefetchIndex(npos), loadingIndex(npos),
+		prefetching(false), stop(false) {
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&changed, NULL);
+	pairs.resize(SNAPSHOT_THREADS);
+	for (size_t i = 0; i < pairs.size(); i++)
+		pairs[i].lower = npos;
+}
+
+MagneticFieldSnapshots::~MagneticFieldSnapshots() {
+	if (prefetching) {
+		pthread_mutex_lock(&mutex);
+		stop = true;
+		pthread_cond_broadcast(&changed);
+		pthread_mutex_unlock(&mutex);
+		pthread_join(prefetcher, NULL);
+	}
+	pthread_cond_destroy(&changed);
+	pthread_mutex_destroy(&mutex);
+}
+
+void MagneticFieldSnapshots::addSnapshot(double z, const std::string &filename) {
+	Snapshot s;
+	s.z = z;
+	s.filename = filename;
+	s.lastUse = 0;
+	size_t i = 0;
+	while ((i < snapshots.size()) && (snapshots[i].z < z))
+		i++;
+	if ((i < snapshots.size()) && (snapshots[i].z == z))
+		throw std::runtime_error("MagneticFieldSnapshots: two snapshots at the same redshift");
+	pthread_mutex_lock(&mutex);
+	snapshots.insert(snapshots.begin() + i, s);
+	// the indices of the pairs changed
+	for (size_t j = 0; j < pairs.size(); j++) {
+		pairs[j].lower = npos;
+		pairs[j].grids[0] = 0;
+		pairs[j].grids[1] = 0;
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+size_t MagneticFieldSnapshots::getNumberOfSnapshots() const {
+	return snapshots.size();
+}
+
+double MagneticFieldSnapshots::getRedshift(size_t i) const {
+	return snapshots.at(i).z;
+}
+
+void MagneticFieldSnapshots::setMaxMapped(size_t n) {
+	if (n < 2)
+		throw std::runtime_error("MagneticFieldSnapshots: at least 2 snapshots have to be mapped");
+	maxMapped = n;
+}
+
+size_t MagneticFieldSnapshots::getMaxMapped() const {
+	return maxMapped;
+}
+
+size_t MagneticFieldSnapshots::getNumberOfMapped() const {
+	pthread_mutex_lock(&mutex);
+	size_t n = 0;
+	for (size_t i = 0; i < snapshots.size(); i++)
+		if (snapshots[i].grid.valid())
+			n++;
+	pthread_mutex_unlock(&mutex);
+	return n;
+}
+
+void MagneticFieldSnapshots::setPrefetch(bool p) {
+	prefetch = p;
+}
+
+bool MagneticFieldSnapshots::getPrefetch() const {
+	return prefetch;
+}
+
+ref_ptr<VectorGrid> MagneticFieldSnapshots::map(size_t i) const {
+	ref_ptr<VectorGrid> grid = new VectorGrid(origin, 1, spacing);
+	grid->setMappedFile(new MappedFile(snapshots[i].filename), Nx, Ny, Nz);
+	return grid;
+}
+
+ref_ptr<VectorGrid> MagneticFieldSnapshots::acquire(size_t i) const {
+	while (loadingIndex == i)
+		pthread_cond_wait(&changed, &mutex);
+	Snapshot &s = const_cast<Snapshot &>(snapshots[i]);
+	if (!s.grid.valid())
+		s.grid = map(i);
+	s.lastUse = ++useClock;
+	return s.grid;
+}
+
+void MagneticFieldSnapshots::evict() const {
+	while (true) {
+		size_t n = 0, oldest = npos;
+		for (size_t i = 0; i < snapshots.size(); i++) {
+			if (!snapshots[i].grid.valid())
+				continue;
+			n++;
+			if ((oldest == npos) || (snapshots[i].lastUse < snapshots[oldest].lastUse))
+				oldest = i;
+		}
+		if (n <= maxMapped)
+			return;
+		// unmapped when the threads do not use it any more
+		const_cast<Snapshot &>(snapshots[oldest]).grid = 0;
+	}
+}
+
+void MagneticFieldSnapshots::requestPrefetch(size_t i) const {
+	if (snapshots[i].grid.valid() || (loadingIndex == i))
+		return;
+	prefetchIndex = i;
+	if (!prefetching) {
+		if (pthread_create(&prefetcher, NULL, prefetchMain,
+				const_cast<MagneticFieldSnapshots *>(this)) != 0)
+			return; // no prefetching then
+		prefetching = true;
+	}
+	pthread_cond_broadcast(&changed);
+}
+
+void *MagneticFieldSnapshots::prefetchMain(void *field) {
+	MagneticFieldSnapshots *self = static_cast<MagneticFieldSnapshots *>(field);
+	pthread_mutex_lock(&self->mutex);
+	while (true) {
+		while (!self->stop && (self->prefetchIndex == npos))
+			pthread_cond_wait(&self->changed, &self->mutex);
+		if (self->stop)
+			break;
+		size_t i = self->prefetchIndex;
+		self->prefetchIndex = npos;
+		if (self->snapshots[i].grid.valid())
+			continue;
+		self->loadingIndex = i;
+		pthread_mutex_unlock(&self->mutex);
+
+		// map and read a value of every page into the page cache
+		ref_ptr<VectorGrid> grid;
+		try {
+			grid = self->map(i);
+			const Vector3f *values = &grid->get(0, 0, 0);
+			size_t n = self->Nx * self->Ny * self->Nz;
+			size_t step = std::max<size_t>(4096 / sizeof(Vector3f), 1);
+			volatile float sum = 0;
+			for (size_t j = 0; j < n; j += step)
+				sum += values[j].x;
+		} catch (std::exception &) {
+			grid = 0; // reported when the snapshot is needed
+		}
+
+		pthread_mutex_lock(&self->mutex);
+		if (grid.valid()) {
+			self->snapshots[i].grid = grid;
+			self->snapshots[i].lastUse = ++self->useClock;
+		}
+		self->loadingIndex = npos;
+		self->evict();
+		pthread_cond_broadcast(&self->changed);
+	}
+	pthread_mutex_unlock(&self->mutex);
+	return NULL;
+}
+
+void MagneticFieldSnapshots::getPair(double z, const VectorGrid *grids[2],
+		ref_ptr<VectorGrid> held[2], double &weight) const {
+	size_t n = snapshots.size();
+	if (n == 0)
+		throw std::runtime_error("MagneticFieldSnapshots: no snapshots");
+
+	// the lower snapshot of the pair, the nearest ones outside of the range
+	size_t lower = 0;
+	while ((lower + 2 < n) && (snapshots[lower + 1].z <= z))
+		lower++;
+	size_t upper = (n > 1) ? lower + 1 : lower;
+	weight = 0;
+	if (upper != lower) {
+		weight = (z - snapshots[lower].z) / (snapshots[upper].z - snapshots[lower].z);
+		weight = std::min(std::max(weight, 0.), 1.);
+	}
+
+#ifdef _OPENMP
+	size_t thread = omp_get_thread_num();
+#else
+	size_t thread = 0;
+#endif
+	// the grids of the pair of the thread are only changed by the thread
+	if ((thread < pairs.size()) && (pairs[thread].lower == lower)) {
+		grids[0] = pairs[thread].grids[0];
+		grids[1] = pairs[thread].grids[1];
+		return;
+	}
+
+	pthread_mutex_lock(&mutex);
+	try {
+		held[0] = acquire(lower);
+		held[1] = acquire(upper);
+	} catch (...) {
+		pthread_mutex_unlock(&mutex);
+		throw;
+	}
+	if (prefetch && (lower > 0))
+		requestPrefetch(lower - 1);
+	evict();
+	pthread_mutex_unlock(&mutex);
+
+	if (thread < pairs.size()) {
+		pairs[thread].lower = lower;
+		pairs[thread].grids[0] = held[0];
+		pairs[thread].grids[1] = held[1];
+	}
+	grids[0] = held[0];
+	grids[1] = held[1];
+}
+
+Vector3d MagneticFieldSnapshots::getField(const Vector3d &position) const {
+	return getField(position, 0);
+}
+
+Vector3d MagneticFieldSnapshots::getField(const Vector3d &position, double z) const {
+	const VectorGrid *grids[2];
+	ref_ptr<VectorGrid> held[2];
+	double w;
+	getPair(z, grids, held, w);
+	Vector3d b = grids[0]->interpolate(position);
+	if (w > 0)
+		b = b * (1 - w) + Vector3d(grids[1]->interpolate(position)) * w;
+	return b;
+}
+
+void MagneticFieldSnapshots::getFields(const Vector3d *positions,
+		Vector3d *fields, size_t n) const {
+	getFields(positions, fields, n, 0);
+}
+
+void MagneticFieldSnapshots::getFields(const Vector3d *positions,
+		Vector3d *fields, size_t n, double z) const {
+	const VectorGrid *grids[2];
+	ref_ptr<VectorGrid> held[2];
+	double w;
+	getPair(z, grids, held, w);
+	const VectorGrid &g0 = *grids[0], &g1 = *grids[1];
+	for (size_t i = 0; i < n; i++)
+		fields[i] = g0.interpolate(positions[i]);
+	if (w > 0)
+		for (size_t i = 0; i < n; i++)
+			fields[i] = fields[i] * (1 - w) + Vector3d(g1.interpolate(positions[i])) * w;
+}
+
+} // namespace crpropa
@@ -0,0 +1,86 @@
+#include "crpropa/magneticField/NestedTurbulenceField.h"
+#include "crpropa/GridTools.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace crpropa {
+
+NestedTurbulenceField::NestedTurbulenceField() {
+}
+
+void NestedTurbulenceField::addLevel(ref_ptr<VectorGrid> grid) {
+	if (!levels.empty() && !(grid->getSpacing().x < levels.back()->getSpacing().x))
+		throw std::runtime_error("NestedTurbulenceField: the spacing of a level must be smaller than of the previous one");
+	grid->setReflective(false);
+	levels.push_back(grid);
+}
+
+size_t NestedTurbulenceField::getNumberOfLevels() const {
+	return levels.size();
+}
+
+ref_ptr<VectorGrid> NestedTurbulenceField::getLevel(size_t i) const {
+	if (i >= levels.size())
+		throw std::runtime_error("NestedTurbulenceField: no such level");
+	return levels[i];
+}
+
+#ifdef CRPROPA_HAVE_FFTW3F
+// squared field of the wavelengths [l1, l2] of the spectrum, not normalized
+static double bandEnergy(double l1, double l2, double alpha) {
+	// <B^2(k)> ~ k^alpha per mode, k^2 dk modes per shell
+	double a = alpha + 3;
+	if (fabs(a) < 1e-10)
+		return log(l2 / l1);
+	return (pow(l1, -a) - pow(l2, -a)) / a;
+}
+
+void NestedTurbulenceField::initTurbulence(double Brms, double lMin,
+		double lMax, double alpha, int seed) {
+	// the bands, from the largest wavelengths down
+	std::vector<double> upper, lower;
+	double l = lMax;
+	for (size_t i = 0; (i < levels.size()) && (l > lMin); i++) {
+		double bandMin = std::max(lMin, 2 * levels[i]->getSpacing().x);
+		if (bandMin >= l)
+			throw std::runtime_error("NestedTurbulenceField: level spacing too large for its band");
+		upper.push_back(l);
+		lower.push_back(bandMin);
+		l = bandMin;
+	}
+	if (l > lMin)
+		throw std::runtime_error("NestedTurbulenceField: the levels do not reach lMin");
+	if (upper.size() < levels.size())
+		throw std::runtime_error("NestedTurbulenceField: more levels than needed for lMin");
+
+	double total = bandEnergy(lMin, lMax, alpha);
+	for (size_t i = 0; i < levels.size(); i++) {
+		double b = Brms * sqrt(bandEnergy(lower[i], upper[i], alpha) / total);
+		crpropa::initTurbulence(levels[i], b, lower[i], upper[i], alpha,
+				(seed == 0) ? 0 : seed + int(i));
+	}
+}
+#endif // CRPROPA_HAVE_FFTW3F
+
+Vector3d NestedTurbulenceField::getField(const Vector3d &position) const {
+	Vector3d b(0.);
+	for (size_t i = 0; i < levels.size(); i++)
+		b += levels[i]->interpolate(position);
+	return b;
+}
+
+void NestedTurbulenceField::getFields(const Vector3d *positions,
+		Vector3d *fields, size_t n) const {
+	for (size_t j = 0; j < n; j++)
+		fields[j] = Vector3d(0.);
+	// level by level, the grid of a level stays in the cache
+	for (size_t i = 0; i < levels.size(); i++) {
+		const VectorGrid &g = *levels[i];
+		for (size_t j = 0; j < n; j++)
+			fields[j] += g.interpolate(positions[j]);
+	}
+}
+
+} // namespace crpropa
@@ -0,0 +1,124 @@
+#include "crpropa/magneticField/OctreeMagneticField.h"
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace crpropa {
+
+OctreeMagneticField::OctreeMagneticField(const Vector3d &origin, double size) :
+		nodes(1), origin(origin), size(size) {
+	if (size <= 0)
+		throw std::runtime_error("OctreeMagneticField: size <= 0");
+}
+
+OctreeMagneticField::OctreeMagneticField(const Vector3d &origin, double size,
+		const std::string &filename) :
+		nodes(1), origin(origin), size(size) {
+	if (size <= 0)
+		throw std::runtime_error("OctreeMagneticField: size <= 0");
+	load(filename);
+}
+
+void OctreeMagneticField::setNodes(const std::vector<OctreeNode> &n) {
+	if (n.empty())
+		throw std::runtime_error("OctreeMagneticField: no nodes");
+	// breadth-first: children follow their parent, and every node but the root has exactly one parent
+	size_t next = 1;
+	for (size_t i = 0; i < n.size(); i++) {
+		if (n[i].child < 0)
+			continue;
+		if ((size_t(n[i].child) != next) || (next + 8 > n.size()))
+			throw std::runtime_error("OctreeMagneticField: nodes are not in breadth-first order");
+		next += 8;
+	}
+	if (next != n.size())
+		throw std::runtime_error("OctreeMagneticField: unreferenced nodes");
+	nodes = n;
+}
+
+const std::vector<OctreeNode> &OctreeMagneticField::getNodes() const {
+	return nodes;
+}
+
+void OctreeMagneticField::load(const std::string &filename) {
+	std::ifstream fin(filename.c_str(), std::ios::binary);
+	if (!fin) {
+		std::stringstream ss;
+		ss << "OctreeMagneticField: " << filename << " not found";
+		throw std::runtime_error(ss.str());
+	}
+	fin.seekg(0, fin.end);
+	size_t length = fin.tellg();
+	fin.seekg(0, fin.beg);
+	if ((length == 0) || (length % sizeof(OctreeNode) != 0))
+		throw std::runtime_error("OctreeMagneticField: invalid file size");
+
+	std::vector<OctreeNode> n(length / sizeof(OctreeNode));
+	for (size_t i = 0; i < n.size(); i++) {
+		fin.read((char*) &n[i].child, sizeof(int32_t));
+		fin.read((char*) &n[i].x, sizeof(float));
+		fin.read((char*) &n[i].y, sizeof(float));
+		fin.read((char*) &n[i].z, sizeof(float));
+	}
+	if (!fin)
+		throw std::runtime_error("OctreeMagneticField: could not read " + filename);
+	setNodes(n);
+}
+
+void OctreeMagneticField::save(const std::string &filename) const {
+	std::ofstream fout(filename.c_str(), std::ios::binary);
+	if (!fout) {
+		std::stringstream ss;
+		ss << "OctreeMagneticField: " << filename << " not found";
+		throw std::runtime_error(ss.str());
+	}
+	for (size_t i = 0; i < nodes.size(); i++) {
+		fout.write((char*) &nodes[i].child, sizeof(int32_t));
+		fout.write((char*) &nodes[i].x, sizeof(float));
+		fout.write((char*) &nodes[i].y, sizeof(float));
+		fout.write((char*) &nodes[i].z, sizeof(float));
+	}
+}
+
+Vector3d OctreeMagneticField::getOrigin() const {
+	return origin;
+}
+
+double OctreeMagneticField::getSize() const {
+	return size;
+}
+
+int OctreeMagneticField::getLeaf(const Vector3d &pos) const {
+	// position in units of the root cell
+	Vector3d r = (pos - origin) / size;
+	if ((r.x < 0) || (r.y < 0) || (r.z < 0) || (r.x >= 1) || (r.y >= 1) || (r.z >= 1))
+		return -1;
+
+	const OctreeNode *n = &nodes[0];
+	int i = 0;
+	while (n[i].child >= 0) {
+		// descend into the octant and rescale to the child cell
+		r *= 2;
+		int ox = (r.x >= 1), oy = (r.y >= 1), oz = (r.z >= 1);
+		r -= Vector3d(ox, oy, oz);
+		i = n[i].child + 4 * ox + 2 * oy + oz;
+	}
+	return i;
+}
+
+Vector3d OctreeMagneticField::getField(const Vector3d &pos) const {
+	int i = getLeaf(pos);
+	if (i < 0)
+		return Vector3d(0.);
+	const OctreeNode &n = nodes[i];
+	return Vector3d(n.x, n.y, n.z);
+}
+
+void OctreeMagneticField::getFields(const Vector3d *pos, Vector3d *fields,
+		size_t n) const {
+	for (size_t i = 0; i < n; i++)
+		fields[i] = getField(pos[i]);
+}
+
+} // namespace crpropa
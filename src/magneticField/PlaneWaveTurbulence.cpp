@@ -0,0 +1,108 @@
+#include "crpropa/magneticField/PlaneWaveTurbulence.h"
+#include "crpropa/Random.h"
+
+#include <cmath>
+#include <stdexcept>
+
+namespace crpropa {
+
+PlaneWaveTurbulence::PlaneWaveTurbulence(double Brms, double lMin, double lMax,
+		double alpha, int Nm, int seed) :
+		Brms(Brms), lMin(lMin), lMax(lMax), alpha(alpha) {
+	if (lMin <= 0)
+		throw std::runtime_error("PlaneWaveTurbulence: lMin <= 0");
+	if (lMin >= lMax)
+		throw std::runtime_error("PlaneWaveTurbulence: lMin >= lMax");
+	if (Nm < 1)
+		throw std::runtime_error("PlaneWaveTurbulence: Nm < 1");
+
+	Random random;
+	if (seed != 0)
+		random.seed(seed);
+
+	// logarithmic wave numbers, i.e. dk ~ k and the energy of a mode ~ k^(alpha+2) dk
+	double kMin = 2 * M_PI / lMax;
+	double kMax = 2 * M_PI / lMin;
+	std::vector<double> k(Nm), w(Nm);
+	double sumW = 0;
+	for (int i = 0; i < Nm; i++) {
+		k[i] = (Nm == 1) ? kMin : kMin * pow(kMax / kMin, double(i) / (Nm - 1));
+		w[i] = pow(k[i], alpha + 3);
+		sumW += w[i];
+	}
+
+	kx.resize(Nm);
+	ky.resize(Nm);
+	kz.resize(Nm);
+	phase.resize(Nm);
+	ax.resize(Nm);
+	ay.resize(Nm);
+	az.resize(Nm);
+	for (int i = 0; i < Nm; i++) {
+		// random direction and a random polarization perpendicular to it
+		Vector3d ek = random.randVector();
+		Vector3d e1 = ek.cross(Vector3d(1, 0, 0));
+		if (e1.getR() < 1e-3)
+			e1 = ek.cross(Vector3d(0, 1, 0));
+		e1 /= e1.getR();
+		Vector3d e2 = ek.cross(e1);
+		double psi = 2 * M_PI * random.rand();
+		Vector3d xi = e1 * cos(psi) + e2 * sin(psi);
+
+		// <cos^2> = 1/2, so the amplitudes add up to Brms^2
+		double a = Brms * sqrt(2 * w[i] / sumW);
+		kx[i] = k[i] * ek.x;
+		ky[i] = k[i] * ek.y;
+		kz[i] = k[i] * ek.z;
+		phase[i] = 2 * M_PI * random.rand();
+		ax[i] = a * xi.x;
+		ay[i] = a * xi.y;
+		az[i] = a * xi.z;
+	}
+}
+
+Vector3d PlaneWaveTurbulence::sumModes(const Vector3d &pos) const {
+	const size_t n = kx.size();
+	const double *px = &kx[0], *py = &ky[0], *pz = &kz[0], *pp = &phase[0];
+	const double *qx = &ax[0], *qy = &ay[0], *qz = &az[0];
+	double bx = 0, by = 0, bz = 0;
+	for (size_t i = 0; i < n; i++) {
+		double c = cos(px[i] * pos.x + py[i] * pos.y + pz[i] * pos.z + pp[i]);
+		bx += qx[i] * c;
+		by += qy[i] * c;
+		bz += qz[i] * c;
+	}
+	return Vector3d(bx, by, bz);
+}
+
+Vector3d PlaneWaveTurbulence::getField(const Vector3d &pos) const {
+	return sumModes(pos);
+}
+
+void PlaneWaveTurbulence::getFields(const Vector3d *pos, Vector3d *fields,
+		size_t n) const {
+	for (size_t i = 0; i < n; i++)
+		fields[i] = sumModes(pos[i]);
+}
+
+double PlaneWaveTurbulence::getBrms() const {
+	return Brms;
+}
+
+double PlaneWaveTurbulence::getMinimumWavelength() const {
+	return lMin;
+}
+
+double PlaneWaveTurbulence::getMaximumWavelength() const {
+	return lMax;
+}
+
+double PlaneWaveTurbulence::getPowerSpectralIndex() const {
+	return alpha;
+}
+
+size_t PlaneWaveTurbulence::getNumberOfModes() const {
+	return kx.size();
+}
+
+} // namespace crpropa
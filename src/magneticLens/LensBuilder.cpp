@@ -0,0 +1,254 @@
+#include "crpropa/magneticLens/LensBuilder.h"
+#include "crpropa/Units.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <locale>
+#include <sstream>
+#include <stdexcept>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace crpropa {
+
+// further threads share the last buffer under a lock
+static const size_t LENSBUILDER_THREADS = 256;
+
+LensBuilder::LensBuilder(uint8_t healpixOrder, size_t nBins,
+		double logRigidityMin, double logRigidityMax) :
+		pixelization(healpixOrder), nBins(nBins),
+		logRigidityMin(logRigidityMin), logRigidityMax(logRigidityMax),
+		threadTransitions(LENSBUILDER_THREADS), maxTransitions(1 << 20) {
+	if (nBins == 0)
+		throw std::runtime_error("LensBuilder: no rigidity bins");
+	if (!(logRigidityMax > logRigidityMin))
+		throw std::runtime_error("LensBuilder: logRigidityMax <= logRigidityMin");
+	for (size_t i = 0; i < threadTransitions.size(); i++)
+		threadTransitions[i].limit = maxTransitions;
+	clear();
+}
+
+void LensBuilder::setMaximumTransitions(size_t n) {
+	maxTransitions = std::max(n, size_t(1));
+	for (size_t i = 0; i < threadTransitions.size(); i++)
+		threadTransitions[i].limit = std::max(maxTransitions,
+				threadTransitions[i].transitions.size() + 1);
+}
+
+void LensBuilder::process(Candidate *candidate) const {
+	const ParticleState &current = candidate->current;
+	if (current.getCharge() == 0)
+		return;
+	// the particles come from the directions of the backtracked antiparticles
+	Vector3d u0 = candidate->source.getDirection();
+	Vector3d u1 = current.getDirection();
+	uint32_t observed = pixelization.direction2Pix(atan2(u0.y, u0.x),
+			M_PI / 2 - acos(u0.z / u0.getR()));
+	uint32_t extragalactic = pixelization.direction2Pix(atan2(u1.y, u1.x),
+			M_PI / 2 - acos(u1.z / u1.getR()));
+	add(observed, extragalactic, current.getRigidity() * eplus,
+			candidate->getWeight());
+}
+
+void LensBuilder::add(uint32_t observed, uint32_t extragalactic,
+		double rigidity, double weight) const {
+	double t = (log10(rigidity / eV) - logRigidityMin)
+			/ (logRigidityMax - logRigidityMin);
+	// also rejects NaN
+	if (!((t >= 0) && (t < 1)))
+		return;
+	if ((observed >= pixelization.nPix()) || (extragalactic >= pixelization.nPix()))
+		throw std::out_of_range("LensBuilder: pixel out of range");
+	Transition transition;
+	transition.observed = observed;
+	transition.extragalactic = extragalactic;
+	transition.bin = std::min(size_t(t * nBins), nBins - 1);
+	transition.weight = weight;
+
+	size_t thread = 0;
+#ifdef _OPENMP
+	thread = omp_get_thread_num();
+#endif
+	if (thread >= LENSBUILDER_THREADS - 1) {
+		ThreadTransitions &b = threadTransitions[LENSBUILDER_THREADS - 1];
+#pragma omp critical(LensBuilder)
+		{
+			b.transitions.push_back(transition);
+			if (b.transitions.size() >= b.limit) {
+				compact(b.transitions);
+				b.limit = std::max(maxTransitions, 2 * b.transitions.size());
+			}
+		}
+		return;
+	}
+
+	ThreadTransitions &b = threadTransitions[thread];
+	b.transitions.push_back(transition);
+	if (b.transitions.size() >= b.limit) {
+		compact(b.transitions);
+		b.limit = std::max(maxTransitions, 2 * b.transitions.size());
+	}
+}
+
+static bool lessTransition(const LensBuilder::Transition &a,
+		const LensBuilder::Transition &b) {
+	if (a.bin != b.bin)
+		return a.bin < b.bin;
+	if (a.extragalactic != b.extragalactic)
+		return a.extragalactic < b.extragalactic;
+	return a.observed < b.observed;
+}
+
+void LensBuilder::compact(std::vector<Transition> &transitions) {
+	// combine the equal transitions
+	std::sort(transitions.begin(), transitions.end(), lessTransition);
+	size_t n = 0;
+	for (size_t i = 0; i < transitions.size(); i++) {
+		if ((n > 0) && !lessTransition(transitions[n - 1], transitions[i]))
+			transitions[n - 1].weight += transitions[i].weight;
+		else
+			transitions[n++] = transitions[i];
+	}
+	transitions.resize(n);
+}
+
+void LensBuilder::merge() const {
+	std::vector<std::vector<Eigen::Triplet<double> > > triplets(nBins);
+	for (size_t i = 0; i < threadTransitions.size(); i++) {
+		ThreadTransitions &b = threadTransitions[i];
+		for (size_t j = 0; j < b.transitions.size(); j++) {
+			const Transition &t = b.transitions[j];
+			triplets[t.bin].push_back(Eigen::Triplet<double>(t.observed,
+					t.extragalactic, t.weight));
+		}
+		std::vector<Transition>().swap(b.transitions);
+		b.limit = maxTransitions;
+	}
+	for (size_t i = 0; i < nBins; i++) {
+		if (triplets[i].empty())
+			continue;
+		ModelMatrixType m(pixelization.nPix(), pixelization.nPix());
+		m.setFromTriplets(triplets[i].begin(), triplets[i].end());
+		std::vector<Eigen::Triplet<double> >().swap(triplets[i]);
+		matrices[i] += m;
+		matrices[i].makeCompressed();
+	}
+}
+
+size_t LensBuilder::getNumberOfBins() const {
+	return nBins;
+}
+
+const Pixelization &LensBuilder::getPixelization() const {
+	return pixelization;
+}
+
+const ModelMatrixType &LensBuilder::getMatrix(size_t i) const {
+	merge();
+	return matrices.at(i);
+}
+
+void LensBuilder::clear() {
+	for (size_t i = 0; i < threadTransitions.size(); i++) {
+		std::vector<Transition>().swap(threadTransitions[i].transitions);
+		threadTransitions[i].limit = maxTransitions;
+	}
+	matrices.assign(nBins, ModelMatrixType(pixelization.nPix(), pixelization.nPix()));
+}
+
+static std::string partFilename(const std::string &cfgFilename, size_t i,
+		bool csc) {
+	std::string base = cfgFilename;
+	size_t slash = base.find_last_of("/");
+	if (slash != std::string::npos)
+		base = base.substr(slash + 1);
+	size_t dot = base.find_last_of(".");
+	if ((dot != std::string::npos) && (dot > 0))
+		base = base.substr(0, dot);
+	std::stringstream s;
+	s << base << "_" << i << (csc ? ".csc" : ".mldat");
+	return s.str();
+}
+
+void LensBuilder::write(const std::string &cfgFilename, bool csc,
+		bool singlePrecision) const {
+	merge();
+	std::string prefix;
+	size_t slash = cfgFilename.find_last_of("/");
+	if (slash != std::string::npos)
+		prefix = cfgFilename.substr(0, slash + 1);
+
+	std::ofstream cfg(cfgFilename.c_str());
+	if (!cfg.good())
+		throw std::runtime_error("LensBuilder: could not open file " + cfgFilename);
+	cfg.imbue(std::locale::classic());
+	cfg.precision(17);
+	cfg << "# LensBuilder, file log10(Rmin / V) log10(Rmax / V)\n";
+	double step = (logRigidityMax - logRigidityMin) / nBins;
+	for (size_t i = 0; i < nBins; i++) {
+		std::string filename = partFilename(cfgFilename, i, csc);
+		if (csc)
+			serializeCSC(prefix + filename, matrices[i], singlePrecision);
+		else
+			serialize(prefix + filename, matrices[i]);
+		cfg << filename << " " << logRigidityMin + i * step << " "
+				<< logRigidityMin + (i + 1) * step << "\n";
+	}
+	cfg.close();
+	if (!cfg)
+		throw std::runtime_error("LensBuilder: could not write file " + cfgFilename);
+}
+
+void LensBuilder::addLens(const std::string &cfgFilename) {
+	merge();
+	std::ifstream cfg(cfgFilename.c_str());
+	if (!cfg.good())
+		throw std::runtime_error("LensBuilder: could not open file " + cfgFilename);
+	cfg.imbue(std::locale::classic());
+	std::string prefix;
+	size_t slash = cfgFilename.find_last_of("/");
+	if (slash != std::string::npos)
+		prefix = cfgFilename.substr(0, slash + 1);
+
+	double step = (logRigidityMax - logRigidityMin) / nBins;
+	std::string line;
+	while (std::getline(cfg, line)) {
+		if (line.find('#') != std::string::npos)
+			continue;
+		std::stringstream ss(line);
+		std::string filename;
+		double lmin, lmax;
+		if (!(ss >> filename >> lmin >> lmax))
+			continue;
+		double x = (lmin - logRigidityMin) / step;
+		size_t i = size_t(floor(x + 0.5));
+		if ((x < -0.5) || (i >= nBins) || (fabs(x - i) > 1e-6)
+				|| (fabs(lmax - lmin - step) > 1e-6 * step))
+			throw std::runtime_error("LensBuilder: " + cfgFilename
+					+ " has other rigidity bins");
+
+		ModelMatrixType m;
+		if (isCSCFile(prefix + filename))
+			MappedModelMatrix(prefix + filename).toSparseMatrix(m);
+		else
+			deserialize(prefix + filename, m);
+		if ((m.rows() != pixelization.nPix()) || (m.cols() != pixelization.nPix()))
+			throw std::runtime_error("LensBuilder: " + filename
+					+ " has another pixelization");
+		matrices[i] += m;
+		matrices[i].makeCompressed();
+	}
+}
+
+std::string LensBuilder::getDescription() const {
+	std::stringstream s;
+	s << "LensBuilder: HEALPix order " << int(pixelization.getOrder()) << ", "
+			<< nBins << " bins in log10(R / V) = " << logRigidityMin << " - "
+			<< logRigidityMax;
+	return s.str();
+}
+
+} // namespace crpropa
@@ -0,0 +1,233 @@
+#include "crpropa/magneticLens/LensOffload.h"
+#include "crpropa/Random.h"
+#include "crpropa/Units.h"
+
+#include "kiss/logger.h"
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+// device offloading needs OpenMP 4.5 (target enter/exit data)
+#if defined(_OPENMP) && (_OPENMP >= 201511)
+#define CRPROPA_OMP_OFFLOAD
+#endif
+
+namespace crpropa {
+
+LensOffload::LensOffload(const MagneticLens &lens, bool sampling) :
+		lens(lens), sampling(sampling), batchSize(256) {
+	update();
+}
+
+LensOffload::~LensOffload() {
+	release();
+}
+
+void LensOffload::release() {
+	for (size_t i = 0; i < parts.size(); i++) {
+		Part *p = parts[i];
+#ifdef CRPROPA_OMP_OFFLOAD
+		int32_t *rowStarts = &p->rowStarts[0];
+		size_t nRows = p->rowStarts.size();
+#pragma omp target exit data map(delete: rowStarts[0:nRows])
+		size_t nnz = p->values.size();
+		if (nnz > 0) {
+			int32_t *columns = &p->columns[0];
+			double *values = &p->values[0];
+#pragma omp target exit data map(delete: columns[0:nnz], values[0:nnz])
+		}
+		if (sampling) {
+			int32_t *columnStarts = &p->columnStarts[0];
+			size_t nCols = p->columnStarts.size();
+#pragma omp target exit data map(delete: columnStarts[0:nCols])
+			if (nnz > 0) {
+				int32_t *rows = &p->rowsOfColumns[0];
+				double *cdf = &p->cdf[0];
+#pragma omp target exit data map(delete: rows[0:nnz], cdf[0:nnz])
+			}
+		}
+#endif
+		delete p;
+	}
+	parts.clear();
+}
+
+void LensOffload::update() {
+	release();
+
+	const std::vector<LensPart *> &lensParts = lens.getLensParts();
+	for (size_t i = 0; i < lensParts.size(); i++) {
+		Part *p = new Part();
+		p->lensPart = lensParts[i];
+		p->rows = lensParts[i]->rows();
+		p->cols = lensParts[i]->cols();
+		lensParts[i]->getRows(p->rowStarts, p->columns, p->values);
+		if (sampling)
+			lensParts[i]->getColumnCDFs(p->columnStarts, p->rowsOfColumns, p->cdf);
+		parts.push_back(p);
+
+#ifdef CRPROPA_OMP_OFFLOAD
+		int32_t *rowStarts = &p->rowStarts[0];
+		size_t nRows = p->rowStarts.size();
+#pragma omp target enter data map(to: rowStarts[0:nRows])
+		size_t nnz = p->values.size();
+		if (nnz > 0) {
+			int32_t *columns = &p->columns[0];
+			double *values = &p->values[0];
+#pragma omp target enter data map(to: columns[0:nnz], values[0:nnz])
+		}
+		if (sampling) {
+			int32_t *columnStarts = &p->columnStarts[0];
+			size_t nCols = p->columnStarts.size();
+#pragma omp target enter data map(to: columnStarts[0:nCols])
+			if (nnz > 0) {
+				int32_t *rows = &p->rowsOfColumns[0];
+				double *cdf = &p->cdf[0];
+#pragma omp target enter data map(to: rows[0:nnz], cdf[0:nnz])
+			}
+		}
+#endif
+	}
+}
+
+const MagneticLens &LensOffload::getLens() const {
+	return lens;
+}
+
+bool LensOffload::isSampling() const {
+	return sampling;
+}
+
+void LensOffload::setBatchSize(size_t n) {
+	if (n == 0)
+		throw std::runtime_error("LensOffload: batch size 0");
+	batchSize = n;
+}
+
+size_t LensOffload::getBatchSize() const {
+	return batchSize;
+}
+
+const LensOffload::Part *LensOffload::findPart(const LensPart *lensPart) const {
+	for (size_t i = 0; i < parts.size(); i++)
+		if (parts[i]->lensPart == lensPart)
+			return parts[i];
+	throw std::runtime_error("LensOffload: lens part not on the device, call update()");
+}
+
+void LensOffload::transform(const LensPart *lensPart, double *const *models,
+		size_t n) const {
+	const Part *p = findPart(lensPart);
+	const size_t rows = p->rows, cols = p->cols, nnz = p->values.size();
+	if (nnz == 0) {
+		for (size_t i = 0; i < n; i++)
+			std::fill(models[i], models[i] + rows, 0.);
+		return;
+	}
+
+	// the vectors of a batch as one block, row-major per vector
+	std::vector<double> x(std::min(n, batchSize) * cols);
+	std::vector<double> y(std::min(n, batchSize) * rows);
+	const int32_t *pStarts = &p->rowStarts[0];
+	const int32_t *pColumns = &p->columns[0];
+	const double *pValues = &p->values[0];
+	for (size_t first = 0; first < n; first += batchSize) {
+		size_t m = std::min(batchSize, n - first);
+		for (size_t i = 0; i < m; i++)
+			std::copy(models[first + i], models[first + i] + cols, x.begin() + i * cols);
+
+		double *px = &x[0], *py = &y[0];
+		size_t sx = m * cols, sy = m * rows, nRows = rows + 1;
+		int total = m * rows, nr = rows, nc = cols;
+#ifdef CRPROPA_OMP_OFFLOAD
+#pragma omp target teams distribute parallel for map(to: pStarts[0:nRows], pColumns[0:nnz], pValues[0:nnz], px[0:sx]) map(from: py[0:sy])
+#else
+#pragma omp parallel for
+#endif
+		for (int j = 0; j < total; j++) {
+			int i = j / nr, r = j % nr;
+			const double *xi = px + (size_t) i * nc;
+			double sum = 0;
+			for (int32_t k = pStarts[r]; k < pStarts[r + 1]; k++)
+				sum += pValues[k] * xi[pColumns[k]];
+			py[j] = sum;
+		}
+
+		for (size_t i = 0; i < m; i++)
+			std::copy(y.begin() + i * rows, y.begin() + (i + 1) * rows, models[first + i]);
+	}
+}
+
+void LensOffload::transformModelVector(double *model, double rigidity) const {
+	transformModelVectors(&model, 1, rigidity);
+}
+
+void LensOffload::transformModelVectors(double *const *models, size_t n,
+		double rigidity) const {
+	LensPart *lensPart = lens.getLensPart(rigidity);
+	if (!lensPart) {
+		double R = rigidity / eV;
+		KISS_LOG_WARNING << "LensOffload: rigidity " << R
+				<< " eV is not covered by the lens";
+		return;
+	}
+	transform(lensPart, models, n);
+}
+
+std::vector<int> LensOffload::transformPixels(double rigidity,
+		const std::vector<int> &pixels) const {
+	if (!sampling)
+		throw std::runtime_error("LensOffload: no sampling, construct with sampling = true");
+	std::vector<int> arrival(pixels.size(), -1);
+	LensPart *lensPart = lens.getLensPart(rigidity);
+	if (!lensPart) {
+		double R = rigidity / eV;
+		KISS_LOG_WARNING << "LensOffload: rigidity " << R
+				<< " eV is not covered by the lens";
+		return arrival;
+	}
+	const Part *p = findPart(lensPart);
+	const size_t n = pixels.size(), nnz = p->cdf.size();
+	if ((n == 0) || (nnz == 0))
+		return arrival;
+	for (size_t i = 0; i < n; i++)
+		if ((pixels[i] < 0) || ((size_t) pixels[i] >= p->cols))
+			throw std::out_of_range("LensOffload: pixel out of range");
+
+	// the random numbers of the host, as MagneticLens::transformCosmicRay
+	std::vector<double> random(n);
+	Random &r = Random::instance();
+	for (size_t i = 0; i < n; i++)
+		random[i] = r.rand();
+
+	const int32_t *pStarts = &p->columnStarts[0];
+	const int32_t *pRows = &p->rowsOfColumns[0];
+	const double *pCDF = &p->cdf[0];
+	const int *pPixels = &pixels[0];
+	const double *pRandom = &random[0];
+	int *pArrival = &arrival[0];
+	size_t nCols = p->cols + 1;
+	int m = n;
+#ifdef CRPROPA_OMP_OFFLOAD
+#pragma omp target teams distribute parallel for map(to: pStarts[0:nCols], pRows[0:nnz], pCDF[0:nnz], pPixels[0:n], pRandom[0:n]) map(from: pArrival[0:n])
+#else
+#pragma omp parallel for
+#endif
+	for (int i = 0; i < m; i++) {
+		// first element of the column with a cumulative sum above the random number
+		int c = pPixels[i];
+		int32_t lo = pStarts[c], hi = pStarts[c + 1];
+		while (lo < hi) {
+			int32_t mid = lo + (hi - lo) / 2;
+			if (pCDF[mid] > pRandom[i])
+				hi = mid;
+			else
+				lo = mid + 1;
+		}
+		pArrival[i] = (lo < pStarts[c + 1]) ? pRows[lo] : -1;
+	}
+	return arrival;
+}
+
+} // namespace crpropa
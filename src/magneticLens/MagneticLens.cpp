@@ -27,10 +27,78 @@
 
 // needed for memcpy in gcc 4.3.2
 #include <cstring>
+#include <algorithm>
+#include <cmath>
 
 namespace crpropa 
 {
 
+void LensPart::getColumns(std::vector<int32_t> &columnStarts,
+		std::vector<int32_t> &rows, std::vector<double> &values) const
+{
+	const size_t nCols = cols();
+	columnStarts.assign(nCols + 1, 0);
+	rows.clear();
+	values.clear();
+	for (size_t c = 0; c < nCols; c++)
+	{
+		if (_mapped)
+		{
+			const int32_t *outer = _mapped->outerIndex();
+			for (int32_t k = outer[c]; k < outer[c + 1]; k++)
+			{
+				rows.push_back(_mapped->innerIndex()[k]);
+				values.push_back(_scale * _mapped->value(c, k));
+			}
+		}
+		else
+		{
+			for (ModelMatrixType::InnerIterator i(M, c); i; ++i)
+			{
+				rows.push_back(i.index());
+				values.push_back(i.value());
+			}
+		}
+		columnStarts[c + 1] = rows.size();
+	}
+}
+
+void LensPart::getColumnCDFs(std::vector<int32_t> &columnStarts,
+		std::vector<int32_t> &rows, std::vector<double> &cdf) const
+{
+	getColumns(columnStarts, rows, cdf);
+	// summed in the order of sampleColumn
+	for (size_t c = 0; c + 1 < columnStarts.size(); c++)
+		for (int32_t k = columnStarts[c] + 1; k < columnStarts[c + 1]; k++)
+			cdf[k] += cdf[k - 1];
+}
+
+void LensPart::getRows(std::vector<int32_t> &rowStarts,
+		std::vector<int32_t> &columns, std::vector<double> &values) const
+{
+	std::vector<int32_t> columnStarts, rowsOfColumns;
+	std::vector<double> columnValues;
+	getColumns(columnStarts, rowsOfColumns, columnValues);
+
+	// transpose, the columns of each row stay in ascending order
+	const size_t nRows = rows(), nCols = cols();
+	rowStarts.assign(nRows + 1, 0);
+	for (size_t k = 0; k < rowsOfColumns.size(); k++)
+		rowStarts[rowsOfColumns[k] + 1]++;
+	for (size_t r = 0; r < nRows; r++)
+		rowStarts[r + 1] += rowStarts[r];
+	std::vector<int32_t> next(rowStarts.begin(), rowStarts.end() - 1);
+	columns.resize(rowsOfColumns.size());
+	values.resize(rowsOfColumns.size());
+	for (size_t c = 0; c < nCols; c++)
+		for (int32_t k = columnStarts[c]; k < columnStarts[c + 1]; k++)
+		{
+			int32_t j = next[rowsOfColumns[k]]++;
+			columns[j] = c;
+			values[j] = columnValues[k];
+		}
+}
+
 void MagneticLens::loadLens(const string &filename)
 {
 	ifstream infile(filename.c_str());
@@ -85,29 +153,14 @@ bool MagneticLens::transformCosmicRay(double rigidity, double& phi,
 		return false;
 	}
 
-	ModelVectorType v = lenspart->getMatrix().col(c);
-
-	uint32_t r;
-
 	// the random number to compare with
 	double rn = Random::instance().rand();
 
-	ModelVectorType::InnerIterator i(v);
-  double cpv = 0;
-  while (i)
-  {
-		cpv += i.value();
-		if (rn < cpv)
-		{
-			_pixelization->pix2Direction(i.index(), phi, theta);
-			return true;
-    }
-    else
-    {
-			++i;
-    }
-   }
-  return false;
+	uint32_t r;
+	if (!lenspart->sampleColumn(c, rn, r))
+		return false;
+	_pixelization->pix2Direction(r, phi, theta);
+	return true;
 }
 
 bool MagneticLens::transformCosmicRay(double rigidity, Vector3d &p){
@@ -130,31 +183,32 @@ void MagneticLens::loadLensPart(const string &filename, double rigidityMin,
 
 	LensPart *p = new LensPart(filename, rigidityMin, rigidityMax);
 	p->loadMatrixFromFile();
-	_checkMatrix(p->getMatrix());
+	_checkMatrix(p->rows(), p->cols());
 
 	_lensParts.push_back(p);
+	updateLensPartBins();
 }
 
-void MagneticLens::_checkMatrix(const ModelMatrixType &M)
+void MagneticLens::_checkMatrix(size_t rows, size_t cols)
 {
-	if (M.rows() != M.cols())
+	if (rows != cols)
 	{
 		throw std::runtime_error("Not a square Matrix!");
 	}
 
 	if (_pixelization)
 	{
-		if (_pixelization->nPix() != M.cols())
+		if (_pixelization->nPix() != cols)
 		{
 			std::cerr << "*** ERROR ***" << endl;
 			std::cerr << "  Pixelization: " << _pixelization->nPix() << endl;
-			std::cerr << "  Matrix Size : " << M.cols() << endl;
+			std::cerr << "  Matrix Size : " << cols << endl;
 			throw std::runtime_error("Matrix doesn't fit into Lense");
 		}
 	}
 	else
 	{
-		uint32_t morder = Pixelization::pix2Order(M.cols());
+		uint32_t morder = Pixelization::pix2Order(cols);
 		if (morder == 0)
 		{
 			throw std::runtime_error(
@@ -189,12 +243,55 @@ void MagneticLens::setLensPart(const ModelMatrixType &M, double rigidityMin,
 
 	p->setMatrix(M);
 
-	_checkMatrix(p->getMatrix());
+	_checkMatrix(p->rows(), p->cols());
 	_lensParts.push_back(p);
+	updateLensPartBins();
+}
+
+static bool lessRigidity(LensPart *a, LensPart *b)
+{
+	return a->getMinimumRigidity() < b->getMinimumRigidity();
+}
+
+void MagneticLens::updateLensPartBins()
+{
+	_lensPartBins = _lensParts;
+	std::sort(_lensPartBins.begin(), _lensPartBins.end(), lessRigidity);
+	_logRigidityMin = log10(_lensPartBins[0]->getMinimumRigidity());
+	_logRigidityStep = log10(_lensPartBins[0]->getMaximumRigidity()) - _logRigidityMin;
+	double tolerance = 1e-6 * _logRigidityStep;
+	for (size_t i = 0; i < _lensPartBins.size(); i++)
+	{
+		double lower = log10(_lensPartBins[i]->getMinimumRigidity());
+		double upper = log10(_lensPartBins[i]->getMaximumRigidity());
+		if ((fabs(lower - _logRigidityMin - i * _logRigidityStep) > tolerance)
+				|| (fabs(upper - lower - _logRigidityStep) > tolerance))
+		{	// other bins are searched
+			_lensPartBins.clear();
+			return;
+		}
+	}
 }
 
 LensPart* MagneticLens::getLensPart(double rigidity) const
 {
+	if (!_lensPartBins.empty())
+	{
+		// the bin and its neighbours, against rounding at the edges
+		double x = (log10(rigidity / eV) - _logRigidityMin) / _logRigidityStep;
+		if (!(x > -1) || !(x < _lensPartBins.size() + 1))
+			return NULL;
+		int k = int(floor(x));
+		for (int j = std::max(0, k - 1); j <= std::min(int(_lensPartBins.size()) - 1, k + 1); j++)
+		{
+			LensPart *p = _lensPartBins[j];
+			if ((p->getMinimumRigidity() < rigidity / eV)
+					&& (p->getMaximumRigidity() >= rigidity / eV))
+				return p;
+		}
+		return NULL;
+	}
+
 	const_LensPartIter i = _lensParts.begin();
 	while (i != _lensParts.end())
 	{
@@ -223,10 +320,30 @@ void MagneticLens::normalizeMatrixColumns()
 			++iter)
 	{
 		normalizeColumns((*iter)->getMatrix());
+		(*iter)->updateColumnCDF();
 	}
 }
 
 
+MatrixCompaction MagneticLens::compactLens(double threshold, bool cdfSteps)
+{
+	MatrixCompaction total;
+	double errorSum = 0;
+	for (LensPartIter iter = _lensParts.begin(); iter != _lensParts.end();
+			++iter)
+	{
+		MatrixCompaction part = (*iter)->compact(threshold, cdfSteps);
+		total.nonZerosBefore += part.nonZerosBefore;
+		total.nonZerosAfter += part.nonZerosAfter;
+		total.columns += part.columns;
+		total.maximumError = std::max(total.maximumError, part.maximumError);
+		errorSum += part.meanError * part.columns;
+	}
+	if (total.columns > 0)
+		total.meanError = errorSum / total.columns;
+	return total;
+}
+
 void MagneticLens::normalizeLens()
 {
 	// get maximum of sums of columns, and normalize each matrix to that
@@ -242,7 +359,7 @@ void MagneticLens::normalizeLens()
 	for (LensPartIter iter = _lensParts.begin(); iter != _lensParts.end();
 			++iter)
 	{
-		normalizeMatrix((*iter)->getMatrix(), norm);
+		(*iter)->normalize(norm);
 	}
   _norm = norm;
 }
@@ -253,7 +370,7 @@ void MagneticLens::normalizeLensparts()
 			++iter)
 	{
 		double norm = (*iter)->getMaximumOfSumsOfColumns();
-		normalizeMatrix((*iter)->getMatrix(), norm);
+		(*iter)->normalize(norm);
 	}
 }
 
@@ -267,7 +384,8 @@ void MagneticLens::transformModelVector(double* model, double rigidity) const
 		return;
 	}
 
-	prod_up(lenspart->getMatrix(), model);
+	std::vector<double> scratch;
+	lenspart->transform(model, scratch);
 
 }
 
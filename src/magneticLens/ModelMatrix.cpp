@@ -21,7 +21,14 @@
 //----------------------------------------------------------------------
 
 #include "crpropa/magneticLens/ModelMatrix.h"
+#include <algorithm>
 #include <ctime>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <Eigen/Core>
 namespace crpropa 
@@ -102,6 +109,219 @@ void deserialize(const string &filename, ModelMatrixType& matrix)
 }
 
 
+static const char cscMagic[8] = {'C', 'R', 'P', 'L', 'E', 'N', 'S', '1'};
+
+// header of serializeCSC, the arrays follow at multiples of 8 bytes
+struct CSCHeader
+{
+	char magic[8];
+	uint32_t rows, cols;
+	uint32_t valueBytes, reserved;
+	uint64_t nnz;
+};
+
+static size_t cscPadded(size_t n)
+{
+	return (n + 7) / 8 * 8;
+}
+
+// cumulative sum of a column in steps of sum / CDF_STEPS
+static uint32_t cdfStep(double cumulative, double sum)
+{
+	double q = floor(cumulative / sum * CDF_STEPS + 0.5);
+	return uint32_t(std::max(0., std::min(double(CDF_STEPS), q)));
+}
+
+// writes the matrix with values of valueBytes 8 (double), 4 (float) or 2 (uint16 steps)
+static void writeCSC(const string &filename, const ModelMatrixType &m,
+		uint32_t valueBytes)
+{
+	ModelMatrixType matrix(m);
+	matrix.makeCompressed();
+	ofstream outfile(filename.c_str(), ios::binary);
+	if (!outfile)
+	{
+		throw runtime_error("Can't write file: " + filename);
+	}
+
+	CSCHeader header;
+	memcpy(header.magic, cscMagic, sizeof(cscMagic));
+	header.rows = matrix.rows();
+	header.cols = matrix.cols();
+	header.valueBytes = valueBytes;
+	header.reserved = 0;
+	header.nnz = matrix.nonZeros();
+	outfile.write((char*) &header, sizeof(header));
+
+	const char zeros[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+	std::vector<int32_t> outer(matrix.outerIndexPtr(), matrix.outerIndexPtr() + matrix.cols() + 1);
+	outfile.write((char*) &outer[0], outer.size() * sizeof(int32_t));
+	outfile.write(zeros, cscPadded(outer.size() * sizeof(int32_t)) - outer.size() * sizeof(int32_t));
+	std::vector<int32_t> inner(matrix.innerIndexPtr(), matrix.innerIndexPtr() + header.nnz);
+	if (header.nnz > 0)
+		outfile.write((char*) &inner[0], inner.size() * sizeof(int32_t));
+	outfile.write(zeros, cscPadded(inner.size() * sizeof(int32_t)) - inner.size() * sizeof(int32_t));
+	if (valueBytes == sizeof(uint16_t))
+	{
+		// per column: the steps of the cumulative sums, then the units
+		std::vector<uint16_t> steps(header.nnz);
+		std::vector<double> units(header.cols, 0.);
+		for (uint32_t col = 0; col < header.cols; col++)
+		{
+			double sum = 0;
+			for (int32_t k = outer[col]; k < outer[col + 1]; k++)
+				sum += matrix.valuePtr()[k];
+			if (!(sum > 0))
+				continue;
+			units[col] = sum / CDF_STEPS;
+			double cumulative = 0;
+			uint32_t previous = 0;
+			for (int32_t k = outer[col]; k < outer[col + 1]; k++)
+			{
+				cumulative += matrix.valuePtr()[k];
+				uint32_t q = (k + 1 == outer[col + 1]) ? CDF_STEPS : cdfStep(cumulative, sum);
+				q = std::max(q, previous);
+				steps[k] = q - previous;
+				previous = q;
+			}
+		}
+		if (header.nnz > 0)
+			outfile.write((char*) &steps[0], steps.size() * sizeof(uint16_t));
+		outfile.write(zeros, cscPadded(steps.size() * sizeof(uint16_t)) - steps.size() * sizeof(uint16_t));
+		if (header.cols > 0)
+			outfile.write((char*) &units[0], units.size() * sizeof(double));
+	}
+	else if (valueBytes == sizeof(float))
+	{
+		std::vector<float> values(matrix.valuePtr(), matrix.valuePtr() + header.nnz);
+		if (header.nnz > 0)
+			outfile.write((char*) &values[0], values.size() * sizeof(float));
+	}
+	else if (header.nnz > 0)
+	{
+		outfile.write((char*) matrix.valuePtr(), header.nnz * sizeof(double));
+	}
+	outfile.close();
+	if (outfile.fail())
+	{
+		throw runtime_error("Error writing file: " + filename);
+	}
+}
+
+void serializeCSC(const string &filename, const ModelMatrixType &matrix,
+		bool singlePrecision)
+{
+	writeCSC(filename, matrix, singlePrecision ? sizeof(float) : sizeof(double));
+}
+
+void serializeCSCSteps(const string &filename, const ModelMatrixType &matrix)
+{
+	writeCSC(filename, matrix, sizeof(uint16_t));
+}
+
+bool isCSCFile(const string &filename)
+{
+	ifstream infile(filename.c_str(), ios::binary);
+	char magic[8];
+	infile.read(magic, sizeof(magic));
+	return infile && (memcmp(magic, cscMagic, sizeof(cscMagic)) == 0);
+}
+
+MappedModelMatrix::MappedModelMatrix(const string &filename) :
+		_data(NULL), _size(0), _memory("MappedFile"), _units(NULL)
+{
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		throw runtime_error("Can't read file: " + filename);
+	}
+	struct stat st;
+	if (fstat(fd, &st) == 0)
+		_size = st.st_size;
+	if (_size >= sizeof(CSCHeader))
+		_data = mmap(NULL, _size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (!_data || (_data == MAP_FAILED))
+	{
+		_data = NULL;
+		throw runtime_error("Can't map file: " + filename);
+	}
+
+	const CSCHeader *header = (const CSCHeader*) _data;
+	_rows = header->rows;
+	_cols = header->cols;
+	_nnz = header->nnz;
+	_valueBytes = header->valueBytes;
+	size_t offset = sizeof(CSCHeader);
+	size_t outerBytes = cscPadded((size_t(_cols) + 1) * sizeof(int32_t));
+	size_t innerBytes = cscPadded(_nnz * sizeof(int32_t));
+	size_t valueBytes = _nnz * _valueBytes;
+	if (_valueBytes == sizeof(uint16_t))
+		valueBytes = cscPadded(valueBytes) + size_t(_cols) * sizeof(double);
+	if ((memcmp(header->magic, cscMagic, sizeof(cscMagic)) != 0)
+			|| ((_valueBytes != sizeof(uint16_t)) && (_valueBytes != sizeof(float))
+					&& (_valueBytes != sizeof(double)))
+			|| (_size < offset + outerBytes + innerBytes + valueBytes))
+	{
+		munmap(_data, _size);
+		_data = NULL;
+		throw runtime_error("Not a lens matrix in CSC format: " + filename);
+	}
+	const char *p = (const char*) _data + offset;
+	_outer = (const int32_t*) p;
+	_inner = (const int32_t*) (p + outerBytes);
+	_values = p + outerBytes + innerBytes;
+	if (_valueBytes == sizeof(uint16_t))
+		_units = (const double*) (p + outerBytes + innerBytes + cscPadded(_nnz * sizeof(uint16_t)));
+	_memory.set(_size);
+}
+
+MappedModelMatrix::~MappedModelMatrix()
+{
+	if (_data)
+		munmap(_data, _size);
+}
+
+void MappedModelMatrix::toSparseMatrix(ModelMatrixType &matrix, double scale) const
+{
+	matrix.resize(_rows, _cols);
+	matrix.resizeNonZeros(_nnz);
+	memcpy(matrix.outerIndexPtr(), _outer, (size_t(_cols) + 1) * sizeof(int32_t));
+	if (_nnz > 0)
+		memcpy(matrix.innerIndexPtr(), _inner, _nnz * sizeof(int32_t));
+	for (uint32_t c = 0; c < _cols; c++)
+		for (int32_t k = _outer[c]; k < _outer[c + 1]; k++)
+			matrix.valuePtr()[k] = scale * value(c, k);
+}
+
+double MappedModelMatrix::maximumOfSumsOfColumns() const
+{
+	double summax = 0;
+	for (uint32_t c = 0; c < _cols; c++)
+	{
+		double sum = 0;
+		for (int32_t k = _outer[c]; k < _outer[c + 1]; k++)
+			sum += value(c, k);
+		if (sum > summax)
+			summax = sum;
+	}
+	return summax;
+}
+
+void MappedModelMatrix::multiply(const double *x, double *y, size_t n, double scale) const
+{
+	std::fill(y, y + n * _rows, 0.);
+	for (uint32_t c = 0; c < _cols; c++)
+		for (int32_t k = _outer[c]; k < _outer[c + 1]; k++)
+		{
+			double v = scale * value(c, k);
+			int32_t r = _inner[k];
+			for (size_t i = 0; i < n; i++)
+				y[i * _rows + r] += v * x[i * _cols + c];
+		}
+}
+
+
 double norm_1(const ModelVectorType &v)
 {
 	return v.cwiseAbs().sum();
@@ -118,6 +338,90 @@ void normalizeColumns(ModelMatrixType &matrix){
 }
 
 
+// element of a column: value and row
+typedef std::pair<double, int> ColumnElement;
+
+static bool largerValue(const ColumnElement &a, const ColumnElement &b)
+{
+	return a.first > b.first;
+}
+
+static bool lowerRow(const ColumnElement &a, const ColumnElement &b)
+{
+	return a.second < b.second;
+}
+
+MatrixCompaction compactMatrix(ModelMatrixType &matrix, double threshold,
+		bool cdfSteps)
+{
+	if (!(threshold >= 0) || !(threshold < 1))
+		throw runtime_error("compactMatrix: the threshold must be in [0, 1)");
+	matrix.makeCompressed();
+	MatrixCompaction result;
+	result.nonZerosBefore = matrix.nonZeros();
+
+	std::vector<Eigen::Triplet<double> > triplets;
+	triplets.reserve(matrix.nonZeros());
+	std::vector<ColumnElement> column;
+	double errorSum = 0;
+	for (int c = 0; c < matrix.outerSize(); c++)
+	{
+		column.clear();
+		double sum = 0;
+		for (ModelMatrixType::InnerIterator i(matrix, c); i; ++i)
+		{
+			column.push_back(ColumnElement(i.value(), i.index()));
+			sum += i.value();
+		}
+		if (column.empty())
+			continue;
+		result.columns++;
+		if (!(sum > 0))
+		{	// not a column of probabilities, kept
+			for (size_t i = 0; i < column.size(); i++)
+				triplets.push_back(Eigen::Triplet<double>(column[i].second, c, column[i].first));
+			continue;
+		}
+
+		// the largest elements up to (1 - threshold) of the sum
+		std::sort(column.begin(), column.end(), largerValue);
+		double kept = 0;
+		size_t n = 0;
+		while ((n < column.size()) && (kept < (1 - threshold) * sum))
+			kept += column[n++].first;
+		double error = sum - kept;
+		column.resize(n);
+		std::sort(column.begin(), column.end(), lowerRow);
+
+		double cumulative = 0;
+		uint32_t previous = 0;
+		for (size_t i = 0; i < n; i++)
+		{
+			double v = column[i].first * sum / kept;
+			if (cdfSteps)
+			{
+				cumulative += v;
+				uint32_t q = (i + 1 == n) ? CDF_STEPS : std::max(previous, cdfStep(cumulative, sum));
+				v = (q - previous) * sum / CDF_STEPS;
+				previous = q;
+			}
+			error += fabs(v - column[i].first);
+			if (v != 0)
+				triplets.push_back(Eigen::Triplet<double>(column[i].second, c, v));
+		}
+		error /= sum;
+		errorSum += error;
+		result.maximumError = std::max(result.maximumError, error);
+	}
+
+	matrix.setFromTriplets(triplets.begin(), triplets.end());
+	matrix.makeCompressed();
+	result.nonZerosAfter = matrix.nonZeros();
+	if (result.columns > 0)
+		result.meanError = errorSum / result.columns;
+	return result;
+}
+
 double maximumOfSumsOfColumns(const ModelMatrixType &matrix) 
 {
 	double summax = 0;
@@ -137,24 +441,40 @@ double maximumOfSumsOfColumns(const ModelMatrixType &matrix)
 
 	void prod_up(const ModelMatrixType& matrix, double* model)
 {
+	std::vector<double> scratch;
+	prod_up(matrix, model, scratch);
+}
 
+void prod_up(const ModelMatrixType& matrix, double* model,
+		std::vector<double> &scratch)
+{
 	// copy storage of model, as matrix vector product cannot be done
 	// in place
-	
 	const size_t mSize = matrix.cols();
-	double *origVectorStorage = new double[mSize];
-	memcpy(origVectorStorage, model, mSize * sizeof(double));
-
+	scratch.assign(model, model + mSize);
 
-
-	Eigen::Map<Eigen::Matrix<double, Eigen::Dynamic, 1> > origVectorAdaptor(origVectorStorage, mSize);
+	Eigen::Map<Eigen::Matrix<double, Eigen::Dynamic, 1> > origVectorAdaptor(&scratch[0], mSize);
 	Eigen::Map<Eigen::Matrix<double, Eigen::Dynamic, 1> > modelVectorAdaptor(model, mSize);
 
 	// perform the optimized product
 	modelVectorAdaptor = matrix * origVectorAdaptor;
+}
+
+void prod_up(const ModelMatrixType& matrix, double* const* models, size_t n,
+		std::vector<double> &scratch)
+{
+	// the models as columns of one dense matrix, for a single product
+	const size_t mSize = matrix.cols();
+	scratch.resize(2 * mSize * n);
+	for (size_t i = 0; i < n; i++)
+		memcpy(&scratch[i * mSize], models[i], mSize * sizeof(double));
+
+	Eigen::Map<Eigen::MatrixXd> origAdaptor(&scratch[0], mSize, n);
+	Eigen::Map<Eigen::MatrixXd> resultAdaptor(&scratch[mSize * n], mSize, n);
+	resultAdaptor.noalias() = matrix * origAdaptor;
 
-	// clean up
-	delete[] origVectorStorage;
+	for (size_t i = 0; i < n; i++)
+		memcpy(models[i], &scratch[(n + i) * mSize], mSize * sizeof(double));
 }
 
 
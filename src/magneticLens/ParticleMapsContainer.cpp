@@ -3,20 +3,16 @@
 #include "crpropa/magneticLens/ParticleMapsContainer.h"
 #include "crpropa/Units.h"
 
+#include <algorithm>
 #include <iostream>
 #include <fstream>
+#include <stdexcept>
+
 namespace crpropa 
 {
 
 ParticleMapsContainer::~ParticleMapsContainer()
 {
-	for(std::map<int, std::map<int, double*> >::iterator pid_iter = _data.begin(); 
-			pid_iter != _data.end(); ++pid_iter) {
-		for(std::map<int, double*>::iterator energy_iter = pid_iter->second.begin();
-			energy_iter != pid_iter->second.end(); ++energy_iter) {
-				delete[] (energy_iter->second);
-		}
-	}
 }
 
 int ParticleMapsContainer::energy2Idx(double energy) const
@@ -31,42 +27,96 @@ double ParticleMapsContainer::idx2Energy(int idx) const
 }
 
 		
+ParticleMapsContainer::ParticleMaps *ParticleMapsContainer::findMaps(int pid)
+{
+	if (_lastMaps && (_lastPid == pid))
+		return _lastMaps;
+	std::map<int, ParticleMaps>::iterator i = _data.find(pid);
+	if (i == _data.end())
+		return NULL;
+	_lastPid = pid;
+	_lastMaps = &i->second;
+	return _lastMaps;
+}
+
+
+size_t ParticleMapsContainer::addBin(ParticleMaps &m, int bin)
+{
+	const size_t nPix = _pixelization.getNumberOfPixels();
+	const int nBins = m.filled.size();
+	if (nBins == 0)
+	{
+		m.firstBin = bin;
+		m.maps.assign(nPix, 0);
+		m.filled.assign(1, 0);
+	}
+	else if ((bin < m.firstBin) || (bin >= m.firstBin + nBins))
+	{
+		// grow by at least half, against a copy for every new bin
+		int grow = std::max(1, nBins / 2);
+		int first = m.firstBin;
+		int last = m.firstBin + nBins - 1;
+		if (bin < first)
+			first = std::min(bin, first - grow);
+		else
+			last = std::max(bin, last + grow);
+
+		std::vector<double> maps((last - first + 1) * nPix, 0);
+		std::copy(m.maps.begin(), m.maps.end(), maps.begin() + (m.firstBin - first) * nPix);
+		m.maps.swap(maps);
+		std::vector<char> filled(last - first + 1, 0);
+		std::copy(m.filled.begin(), m.filled.end(), filled.begin() + (m.firstBin - first));
+		m.filled.swap(filled);
+		m.firstBin = first;
+	}
+	size_t row = bin - m.firstBin;
+	m.filled[row] = 1;
+	return row;
+}
+
+
+int ParticleMapsContainer::findRow(const ParticleMaps &m, int bin) const
+{
+	int row = bin - m.firstBin;
+	if ((row < 0) || (row >= int(m.filled.size())) || !m.filled[row])
+		return -1;
+	return row;
+}
+
+
 double* ParticleMapsContainer::getMap(const int particleId, double energy)
 {
 	_weightsUpToDate = false;
-	if (_data.find(particleId) == _data.end())
+	ParticleMaps *m = findMaps(particleId);
+	if (!m)
 	{
 		std::cerr << "No map for ParticleID " << particleId << std::endl;
 		return NULL;
 	}
-	int energyIdx	= energy2Idx(energy);
-	if (_data[particleId].find(energyIdx) == _data[particleId].end())
+	int row = findRow(*m, energy2Idx(energy));
+	if (row < 0)
 	{
 		std::cerr << "No map for ParticleID and energy" << energy / eV << " eV" << std::endl;
 		return NULL;
 	}
-	return _data[particleId][energy2Idx(energy)];
+	return &m->maps[row * _pixelization.getNumberOfPixels()];
 }
 			
 			
 void ParticleMapsContainer::addParticle(const int particleId, double energy, double galacticLongitude, double galacticLatitude, double weight)
 {
 	_weightsUpToDate = false;
-	if (_data.find(particleId) == _data.end())
+	ParticleMaps *m = findMaps(particleId);
+	if (!m)
 	{
-		map<int, double*> M;
-		_data[particleId] = M;
-	}
-
-	int energyIdx	= energy2Idx(energy);
-	if (_data[particleId].find(energyIdx) == _data[particleId].end())
-	{
-		_data[particleId][energyIdx] = new double[_pixelization.getNumberOfPixels()];
-		std::fill(_data[particleId][energyIdx], _data[particleId][energyIdx] + _pixelization.getNumberOfPixels(), 0);
+		m = &_data[particleId];
+		_lastPid = particleId;
+		_lastMaps = m;
 	}
 
+	size_t row = addBin(*m, energy2Idx(energy));
 	uint32_t pixel = _pixelization.direction2Pix(galacticLongitude, galacticLatitude);
-	_data[particleId][energyIdx][pixel] += weight;
+	m->maps[row * _pixelization.getNumberOfPixels() + pixel] += weight;
 }
 
 
@@ -82,7 +132,7 @@ void ParticleMapsContainer::addParticle(const int particleId, double energy, con
 std::vector<int> ParticleMapsContainer::getParticleIds()
 {
 	std::vector<int> ids;
-	for(std::map<int, std::map<int, double*> >::iterator pid_iter = _data.begin(); 
+	for(std::map<int, ParticleMaps>::iterator pid_iter = _data.begin();
 			pid_iter != _data.end(); ++pid_iter) 
 	{
 		ids.push_back(pid_iter->first);
@@ -94,79 +144,154 @@ std::vector<int> ParticleMapsContainer::getParticleIds()
 std::vector<double> ParticleMapsContainer::getEnergies(int pid)
 {
 	std::vector<double> energies;
-	if (_data.find(pid) != _data.end())
+	ParticleMaps *m = findMaps(pid);
+	if (m)
 	{
-		for(std::map<int, double*>::iterator iter = _data[pid].begin(); 
-			iter != _data[pid].end(); ++iter) 
+		for (size_t row = 0; row < m->filled.size(); row++)
 		{
-			energies.push_back( idx2Energy(iter->first) / eV );
+			if (m->filled[row])
+				energies.push_back( idx2Energy(m->firstBin + row) / eV );
 		}
 	}
 	return energies;
 }
 
 
+// number of maps transformed in one sparse-dense matrix product
+static const size_t lensBatchSize = 16;
+
+void ParticleMapsContainer::groupByLensPart(const MagneticLens &lens,
+		std::map<LensPart*, std::vector<double*> > &maps)
+{
+	const size_t nPix = _pixelization.getNumberOfPixels();
+	for(std::map<int, ParticleMaps>::iterator pid_iter = _data.begin();
+			pid_iter != _data.end(); ++pid_iter) {
+		ParticleMaps &m = pid_iter->second;
+		for (size_t row = 0; row < m.filled.size(); row++) {
+			if (!m.filled[row])
+				continue;
+		//	// transform only nuclei
+			double energy = idx2Energy(m.firstBin + row);
+			int chargeNumber = HepPID::Z(pid_iter->first);
+			LensPart *part = NULL;
+			if (chargeNumber != 0)
+				part = lens.getLensPart(energy / chargeNumber);
+			maps[part].push_back(&m.maps[row * nPix]);
+		}
+	}
+}
+
 void ParticleMapsContainer::applyLens(MagneticLens &lens)
 {
 	// if lens is normalized, this should not be necessary.
 	_weightsUpToDate = false;
 
-	for(std::map<int, std::map<int, double*> >::iterator pid_iter = _data.begin(); 
-			pid_iter != _data.end(); ++pid_iter) {
-		for(std::map<int, double*>::iterator energy_iter = pid_iter->second.begin();
-			energy_iter != pid_iter->second.end(); ++energy_iter) {
-		//	// transform only nuclei
-			double energy = idx2Energy(energy_iter->first);
-			int chargeNumber = HepPID::Z(pid_iter->first);
-			if (chargeNumber != 0 && lens.rigidityCovered(energy / chargeNumber))
-			{
-				lens.transformModelVector(energy_iter->second, energy / chargeNumber);
-			}
-			else
-			{ // still normalize the vectors 
-				for(size_t j=0; j< _pixelization.getNumberOfPixels() ; j++)
-				{
-					energy_iter->second[j]/=lens.getNorm();
-				}
+	// group the maps by lens part, batches are transformed in parallel
+	std::map<LensPart*, std::vector<double*> > maps;
+	groupByLensPart(lens, maps);
+	const size_t nPix = _pixelization.getNumberOfPixels();
+
+	std::vector<std::pair<std::map<LensPart*, std::vector<double*> >::iterator, size_t> > batches;
+	for (std::map<LensPart*, std::vector<double*> >::iterator i = maps.begin(); i != maps.end(); ++i)
+		for (size_t j = 0; j < i->second.size(); j += lensBatchSize)
+			batches.push_back(std::make_pair(i, j));
+
+	const double norm = lens.getNorm();
+	#pragma omp parallel
+	{
+		std::vector<double> scratch;
+		#pragma omp for schedule(dynamic, 1)
+		for (int b = 0; b < batches.size(); b++) {
+			LensPart *part = batches[b].first->first;
+			std::vector<double*> &models = batches[b].first->second;
+			size_t first = batches[b].second;
+			size_t n = std::min(lensBatchSize, models.size() - first);
+			if (part) {
+				part->transform(&models[first], n, scratch);
+			} else { // still normalize the vectors
+				for (size_t i = first; i < first + n; i++)
+					for (size_t j = 0; j < nPix; j++)
+						models[i][j] /= norm;
 			}
 		}
 	}
 }
 
+void ParticleMapsContainer::applyLens(const LensOffload &lens)
+{
+	_weightsUpToDate = false;
+
+	// all maps of a lens part in the batches of the device
+	std::map<LensPart*, std::vector<double*> > maps;
+	groupByLensPart(lens.getLens(), maps);
+	const size_t nPix = _pixelization.getNumberOfPixels();
+	const double norm = lens.getLens().getNorm();
+	for (std::map<LensPart*, std::vector<double*> >::iterator i = maps.begin(); i != maps.end(); ++i) {
+		std::vector<double*> &models = i->second;
+		if (i->first) {
+			lens.transform(i->first, &models[0], models.size());
+		} else { // still normalize the vectors
+			for (size_t k = 0; k < models.size(); k++)
+				for (size_t j = 0; j < nPix; j++)
+					models[k][j] /= norm;
+		}
+	}
+}
+
 
 void ParticleMapsContainer::_updateWeights()
 {
 	if (_weightsUpToDate)
 		return;
 
-	for(std::map<int, std::map<int, double*> >::iterator pid_iter = _data.begin(); 
+	const size_t nPix = _pixelization.getNumberOfPixels();
+	_sumOfWeights = 0;
+	_pids.clear();
+	_pidCDF.clear();
+	for(std::map<int, ParticleMaps>::iterator pid_iter = _data.begin();
 			pid_iter != _data.end(); ++pid_iter) 
 	{
-		_weightsPID[pid_iter->first] = 0;
-
-		for(std::map<int, double*>::iterator energy_iter = pid_iter->second.begin();
-			energy_iter != pid_iter->second.end(); ++energy_iter) 
+		ParticleMaps &m = pid_iter->second;
+		m.pixelCDF.resize(m.maps.size());
+		m.energyCDF.resize(m.filled.size());
+		double pidWeight = 0;
+		for (size_t row = 0; row < m.filled.size(); row++)
 		{
-
-			_weights_pidEnergy[pid_iter->first][energy_iter->first] = 0;
-			for(size_t j=0; j< _pixelization.getNumberOfPixels() ; j++)
+			double sum = 0;
+			for (size_t j = row * nPix; j < (row + 1) * nPix; j++)
 			{
-				_weights_pidEnergy[pid_iter->first][energy_iter->first] +=energy_iter->second[j];
-					
-				_weightsPID[pid_iter->first]+=energy_iter->second[j];
+				sum += m.maps[j];
+				m.pixelCDF[j] = sum;
 			}
-		_sumOfWeights+=_weights_pidEnergy[pid_iter->first][energy_iter->first];
+			pidWeight += sum;
+			m.energyCDF[row] = pidWeight;
 		}
+		_sumOfWeights += pidWeight;
+		_pids.push_back(pid_iter->first);
+		_pidCDF.push_back(_sumOfWeights);
 	}
 	_weightsUpToDate = true;
 }
 
 
+// index of the first cumulative weight larger than r, the last entry with
+// weight if r reaches the sum by rounding
+static size_t sampleCDF(const double *begin, const double *end, double r)
+{
+	const double *k = std::upper_bound(begin, end, r);
+	if (k == end)
+		k = std::lower_bound(begin, end, *(end - 1));
+	return k - begin;
+}
+
+
 void ParticleMapsContainer::getRandomParticles(size_t N, vector<int> &particleId, 
 	vector<double> &energy, vector<double> &galacticLongitudes,
 	vector<double> &galacticLatitudes)
 {
 	_updateWeights();
+	if ((N > 0) && !(_sumOfWeights > 0))
+		throw std::runtime_error("ParticleMapsContainer: no particles to draw from");
 
 	particleId.resize(N);
 	energy.resize(N);
@@ -177,53 +302,62 @@ void ParticleMapsContainer::getRandomParticles(size_t N, vector<int> &particleId
 	{
 		//get particle
 		double r = Random::instance().rand() * _sumOfWeights;
-		std::map<int, double>::iterator iter = _weightsPID.begin();
-		while ((r-= iter->second) > 0)
-		{
-		 ++iter; 
-		}
-		particleId[i] = iter->first;
-	
+		size_t p = sampleCDF(&_pidCDF[0], &_pidCDF[0] + _pidCDF.size(), r);
+		particleId[i] = _pids[p];
+		const ParticleMaps &m = *findMaps(_pids[p]);
+
 		//get energy
-		r = Random::instance().rand() * iter->second;
-		iter = _weights_pidEnergy[particleId[i]].begin();
-		while ((r-= iter->second) > 0)
-		{
-		 ++iter; 
-		}
-		energy[i] = idx2Energy(iter->first) / eV;
+		r = Random::instance().rand() * m.energyCDF.back();
+		size_t row = sampleCDF(&m.energyCDF[0], &m.energyCDF[0] + m.energyCDF.size(), r);
+		energy[i] = idx2Energy(m.firstBin + row) / eV;
 
-		placeOnMap(particleId[i], energy[i] * eV, galacticLongitudes[i], galacticLatitudes[i]);
+		placeInRow(m, row, galacticLongitudes[i], galacticLatitudes[i]);
 	}
 }
 
 
+bool ParticleMapsContainer::placeInRow(const ParticleMaps &m, size_t row,
+		double &galacticLongitude, double &galacticLatitude)
+{
+	const size_t nPix = _pixelization.getNumberOfPixels();
+	const double *begin = &m.pixelCDF[row * nPix];
+	double weight = begin[nPix - 1];
+	if (!(weight > 0))
+		return false;
+	size_t j = sampleCDF(begin, begin + nPix, Random::instance().rand() * weight);
+	_pixelization.getRandomDirectionInPixel(j, galacticLongitude, galacticLatitude);
+	return true;
+}
+
+
 bool ParticleMapsContainer::placeOnMap(int pid, double energy, double &galacticLongitude, double &galacticLatitude)
 {
 	_updateWeights();
 
-	if (_data.find(pid) == _data.end())
+	ParticleMaps *m = findMaps(pid);
+	if (!m)
 	{
 		return false;
 	}
-	int energyIdx	= energy2Idx(energy);
-	if (_data[pid].find(energyIdx) == _data[pid].end())
+	int row = findRow(*m, energy2Idx(energy));
+	if (row < 0)
 	{
 		return false;
 	}
+	return placeInRow(*m, row, galacticLongitude, galacticLatitude);
+}
 
-	double r = Random::instance().rand() * _weights_pidEnergy[pid][energyIdx];
 
-	for(size_t j=0; j< _pixelization.getNumberOfPixels(); j++)
-	{
-		r-= _data[pid][energyIdx][j];
-		if (r <=0)
-		{
-			_pixelization.getRandomDirectionInPixel(j, galacticLongitude, galacticLatitude );
-			return true;
-		}
-	}
-	return false;
+double ParticleMapsContainer::getWeight(int pid, double energy)
+{
+	_updateWeights();
+	ParticleMaps *m = findMaps(pid);
+	if (!m)
+		return 0;
+	int row = findRow(*m, energy2Idx(energy));
+	if (row < 0)
+		return 0;
+	return m->pixelCDF[(row + 1) * _pixelization.getNumberOfPixels() - 1];
 }
 
 
@@ -23,6 +23,8 @@
 #include "crpropa/magneticLens/Pixelization.h"
 #include "crpropa/Random.h"
 
+#include <algorithm>
+
 namespace crpropa 
 {
 
@@ -51,28 +53,94 @@ uint32_t Pixelization::nPix(uint8_t order)
 	}
 }
 
-uint32_t Pixelization::direction2Pix(double longitude, double latitude) const
+void Pixelization::buildCenters() const
+{
+#pragma omp critical(PixelizationCenters)
+	if (!_centersBuilt)
+	{
+		const uint32_t n = nPix();
+		_centers.resize(5 * size_t(n));
+		for (uint32_t i = 0; i < n; i++)
+		{
+			healpix::vec3 v = _healpix->pix2vec(i);
+			double *c = &_centers[5 * size_t(i)];
+			vec2SphereCo(c[0], c[1], v);
+			c[2] = v.x;
+			c[3] = v.y;
+			c[4] = v.z;
+		}
+		__atomic_store_n(&_centersBuilt, true, __ATOMIC_RELEASE);
+	}
+}
+
+const double *Pixelization::pixelCenter(uint32_t i) const
+{
+	if ((getOrder() > _centersOrder_max) || (i >= nPix()))
+		return NULL;
+	if (!__atomic_load_n(&_centersBuilt, __ATOMIC_ACQUIRE))
+		buildCenters();
+	return &_centers[5 * size_t(i)];
+}
+
+uint32_t Pixelization::loc2pix(double longitude, double latitude,
+		double z) const
 {
-	healpix::vec3 v;
-	spherCo2Vec(longitude, latitude, v);
 	try
 	{
-		uint32_t i = (uint32_t) _healpix->vec2pix(v);
-		return i;
+		// as vec2pix, without the conversion to a vector and back
+		if ((std::abs(z) > 0.99) || !(std::abs(z) <= 1))
+		{
+			double theta = M_PI / 2 - latitude;
+			if (theta < 0)
+				theta = 0;
+			else if (theta > M_PI)
+				theta = M_PI;
+			healpix::pointing p(theta, longitude);
+			return (uint32_t) _healpix->ang2pix(p);
+		}
+		return (uint32_t) _healpix->zphi2pix(z, longitude);
 	}
 	catch (healpix::PlanckError &e)
 	{
 		std::cerr << "Healpix error triggered from direction2Pix(" << longitude << ", " << latitude  << ")\n";
-		std::cerr << " v = " << v.x <<", " << v.y << ", " <<  v.z << std::endl;
 		std::cerr << "\n The original exception reads:\n";
 		std::cerr << e.what() << std::endl;
 		throw;
 	}
 }
 
+uint32_t Pixelization::direction2Pix(double longitude, double latitude) const
+{
+	return loc2pix(longitude, latitude, sin(latitude));
+}
+
+void Pixelization::direction2Pix(const double *longitude,
+		const double *latitude, uint32_t *pixel, size_t n) const
+{
+	// the sines in a separate loop that the compiler can vectorize
+	const size_t blockSize = 256;
+	double z[blockSize];
+	for (size_t first = 0; first < n; first += blockSize)
+	{
+		size_t m = std::min(blockSize, n - first);
+		for (size_t i = 0; i < m; i++)
+			z[i] = sin(latitude[first + i]);
+		for (size_t i = 0; i < m; i++)
+			pixel[first + i] = loc2pix(longitude[first + i], latitude[first + i], z[i]);
+	}
+}
+
 void Pixelization::pix2Direction(uint32_t i, double &longitude,
 		double &latitude) const
 {
+	const double *c = pixelCenter(i);
+	if (c)
+	{
+		longitude = c[0];
+		latitude = c[1];
+		return;
+	}
+
 	healpix::vec3 v;
 	try{
 		v = _healpix->pix2vec(i);
@@ -106,10 +174,19 @@ void Pixelization::vec2SphereCo(double &phi, double &theta,
 
 double Pixelization::angularDistance(uint32_t i, uint32_t j) const
 {
-	healpix::vec3 v1, v2;
-	v1 = _healpix->pix2vec(i);
-	v2 = _healpix->pix2vec(j);
-	double s = v1.x * v2.x + v1.y * v2.y + v1.z * v2.z;
+	double s;
+	const double *c1 = pixelCenter(i), *c2 = pixelCenter(j);
+	if (c1 && c2)
+	{
+		s = c1[2] * c2[2] + c1[3] * c2[3] + c1[4] * c2[4];
+	}
+	else
+	{
+		healpix::vec3 v1, v2;
+		v1 = _healpix->pix2vec(i);
+		v2 = _healpix->pix2vec(j);
+		s = v1.x * v2.x + v1.y * v2.y + v1.z * v2.z;
+	}
 	// Failsafe for numerical inaccuracies
 	return ((s > 1) ? 0 : ((s < -1) ? M_PI : acos(s)));
 }
@@ -119,8 +196,9 @@ void Pixelization::getRandomDirectionInPixel(uint32_t i, double &longitude, doub
 	
 	uint64_t inest = _healpix->ring2nest(i);
 	uint64_t nUp = 29 - _healpix->Order();
-	uint64_t iUp = inest * pow(4, nUp);
-	iUp += Random::instance().randInt64(pow(4, nUp));
+	uint64_t nSub = uint64_t(1) << (2 * nUp); // subpixels of order 29
+	uint64_t iUp = inest * nSub;
+	iUp += Random::instance().randInt64(nSub - 1);
 
 	healpix::vec3 v = _healpix_nest.pix2vec(iUp);
 	
@@ -0,0 +1,193 @@
+#include "crpropa/massDistribution/CachedDensity.h"
+
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <stdint.h>
+
+namespace crpropa {
+
+CachedDensity::CachedDensity(ref_ptr<Density> density, const Vector3d &origin,
+		const Vector3d &size, size_t Nx, size_t Ny, size_t Nz) :
+		density(density) {
+	if (!density.valid())
+		throw std::runtime_error("CachedDensity: no density model");
+	isForHI = density->getIsForHI();
+	isForHII = density->getIsForHII();
+	isForH2 = density->getIsForH2();
+	addLevel(origin, size, Nx, Ny, Nz);
+}
+
+void CachedDensity::addLevel(const Vector3d &origin, const Vector3d &size,
+		size_t Nx, size_t Ny, size_t Nz) {
+	if (!density.valid())
+		throw std::runtime_error("CachedDensity: no density model to sample");
+	if ((Nx == 0) || (Ny == 0) || (Nz == 0) || !(size.x > 0) || !(size.y > 0)
+			|| !(size.z > 0))
+		throw std::runtime_error("CachedDensity: empty level");
+	Level level;
+	level.origin = origin;
+	level.size = size;
+	Vector3d spacing(size.x / Nx, size.y / Ny, size.z / Nz);
+	for (int c = 0; c < 5; c++) {
+		level.grids[c] = new ScalarGrid(origin, Nx, Ny, Nz, spacing);
+		// the grids are not periodic, continue at the boundaries
+		level.grids[c]->setReflective(true);
+	}
+	sample(level);
+	levels.push_back(level);
+}
+
+void CachedDensity::sample(Level &level) {
+	ScalarGrid &g = *level.grids[0];
+	const long Nx = g.getNx(), Ny = g.getNy(), Nz = g.getNz();
+	const Vector3d spacing = g.getSpacing();
+	const Vector3d gridOrigin = g.getOrigin() + spacing / 2;
+	const Density &d = *density;
+#pragma omp parallel for schedule(dynamic, 1)
+	for (long ix = 0; ix < Nx; ix++)
+		for (long iy = 0; iy < Ny; iy++)
+			for (long iz = 0; iz < Nz; iz++) {
+				Vector3d p = gridOrigin + Vector3d(ix, iy, iz) * spacing;
+				level.grids[0]->get(ix, iy, iz) = d.getHIDensity(p);
+				level.grids[1]->get(ix, iy, iz) = d.getHIIDensity(p);
+				level.grids[2]->get(ix, iy, iz) = d.getH2Density(p);
+				level.grids[3]->get(ix, iy, iz) = d.getDensity(p);
+				level.grids[4]->get(ix, iy, iz) = d.getNucleonDensity(p);
+			}
+}
+
+size_t CachedDensity::getNumberOfLevels() const {
+	return levels.size();
+}
+
+double CachedDensity::interpolate(const Vector3d &position, int channel) const {
+	for (size_t i = levels.size(); i-- > 0;) {
+		const Level &l = levels[i];
+		Vector3d r = position - l.origin;
+		if ((r.x >= 0) && (r.y >= 0) && (r.z >= 0) && (r.x <= l.size.x)
+				&& (r.y <= l.size.y) && (r.z <= l.size.z))
+			return l.grids[channel]->interpolate(position);
+	}
+	if (!density.valid())
+		return 0;
+	switch (channel) {
+	case 0:
+		return density->getHIDensity(position);
+	case 1:
+		return density->getHIIDensity(position);
+	case 2:
+		return density->getH2Density(position);
+	case 3:
+		return density->getDensity(position);
+	default:
+		return density->getNucleonDensity(position);
+	}
+}
+
+double CachedDensity::getHIDensity(const Vector3d &position) const {
+	return interpolate(position, 0);
+}
+
+double CachedDensity::getHIIDensity(const Vector3d &position) const {
+	return interpolate(position, 1);
+}
+
+double CachedDensity::getH2Density(const Vector3d &position) const {
+	return interpolate(position, 2);
+}
+
+double CachedDensity::getDensity(const Vector3d &position) const {
+	return interpolate(position, 3);
+}
+
+double CachedDensity::getNucleonDensity(const Vector3d &position) const {
+	return interpolate(position, 4);
+}
+
+void CachedDensity::getDensities(const Vector3d *positions, double *densities,
+		size_t n) const {
+	for (size_t i = 0; i < n; i++)
+		densities[i] = interpolate(positions[i], 3);
+}
+
+bool CachedDensity::getIsForHI() {
+	return isForHI;
+}
+
+bool CachedDensity::getIsForHII() {
+	return isForHII;
+}
+
+bool CachedDensity::getIsForH2() {
+	return isForH2;
+}
+
+// header of the cache files
+static const char cachedDensityMagic[8] = {'C', 'R', 'P', 'D', 'E', 'N', 'S', '1'};
+
+void CachedDensity::save(const std::string &filename) const {
+	std::ofstream out(filename.c_str(), std::ios::binary);
+	if (!out.good())
+		throw std::runtime_error("CachedDensity: could not open file " + filename);
+	out.write(cachedDensityMagic, sizeof(cachedDensityMagic));
+	uint32_t header[4] = {uint32_t(levels.size()), isForHI, isForHII, isForH2};
+	out.write((const char*) header, sizeof(header));
+	for (size_t i = 0; i < levels.size(); i++) {
+		const Level &l = levels[i];
+		const ScalarGrid &g = *l.grids[0];
+		double box[6] = {l.origin.x, l.origin.y, l.origin.z, l.size.x,
+				l.size.y, l.size.z};
+		uint64_t n[3] = {g.getNx(), g.getNy(), g.getNz()};
+		out.write((const char*) box, sizeof(box));
+		out.write((const char*) n, sizeof(n));
+		for (int c = 0; c < 5; c++)
+			for (size_t ix = 0; ix < n[0]; ix++)
+				for (size_t iy = 0; iy < n[1]; iy++)
+					for (size_t iz = 0; iz < n[2]; iz++)
+						out.write((const char*) &l.grids[c]->get(ix, iy, iz),
+								sizeof(float));
+	}
+	out.close();
+	if (!out)
+		throw std::runtime_error("CachedDensity: could not write file " + filename);
+}
+
+CachedDensity::CachedDensity(const std::string &filename,
+		ref_ptr<Density> density) : density(density) {
+	std::ifstream in(filename.c_str(), std::ios::binary);
+	if (!in.good())
+		throw std::runtime_error("CachedDensity: could not open file " + filename);
+	char magic[8];
+	uint32_t header[4];
+	in.read(magic, sizeof(magic));
+	in.read((char*) header, sizeof(header));
+	if (!in || (memcmp(magic, cachedDensityMagic, sizeof(magic)) != 0))
+		throw std::runtime_error("CachedDensity: not a density cache " + filename);
+	isForHI = header[1];
+	isForHII = header[2];
+	isForH2 = header[3];
+	levels.resize(header[0]);
+	for (size_t i = 0; i < levels.size(); i++) {
+		Level &l = levels[i];
+		double box[6];
+		uint64_t n[3];
+		in.read((char*) box, sizeof(box));
+		in.read((char*) n, sizeof(n));
+		if (!in)
+			throw std::runtime_error("CachedDensity: could not read file " + filename);
+		l.origin = Vector3d(box[0], box[1], box[2]);
+		l.size = Vector3d(box[3], box[4], box[5]);
+		Vector3d spacing(l.size.x / n[0], l.size.y / n[1], l.size.z / n[2]);
+		for (int c = 0; c < 5; c++) {
+			l.grids[c] = new ScalarGrid(l.origin, n[0], n[1], n[2], spacing);
+			l.grids[c]->setReflective(true);
+			std::vector<float> &values = l.grids[c]->getGrid();
+			in.read((char*) &values[0], values.size() * sizeof(float));
+		}
+		if (!in)
+			throw std::runtime_error("CachedDensity: could not read file " + filename);
+	}
+}
+
+}  // namespace crpropa
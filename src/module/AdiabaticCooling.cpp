@@ -1,5 +1,7 @@
 #include "crpropa/module/AdiabaticCooling.h"
 
+#include <vector>
+
 namespace crpropa {
 
 AdiabaticCooling::AdiabaticCooling(ref_ptr<AdvectionField> advectionField) :
@@ -15,7 +17,6 @@ AdiabaticCooling::AdiabaticCooling(ref_ptr<AdvectionField> advectionField, doubl
 void AdiabaticCooling::process(Candidate *c) const {
 
 	Vector3d pos = c->current.getPosition();
-	double E = c->current.getEnergy(); // Note we use E=p/c (relativistic limit)
 	
 	double Div = 0.;	
 	try {
@@ -25,7 +26,31 @@ void AdiabaticCooling::process(Candidate *c) const {
 		KISS_LOG_ERROR 	<< "AdiabaticCooling: Exception in getDivergence.\n" 
 				<< e.what();
 	}
-	
+
+	cool(c, Div);
+}
+
+void AdiabaticCooling::processBatch(Candidate *const *candidates, size_t n) const {
+	if (n == 0)
+		return;
+	std::vector<Vector3d> positions(n);
+	std::vector<double> Div(n, 0.);
+	for (size_t i = 0; i < n; i++)
+		positions[i] = candidates[i]->current.getPosition();
+	try {
+		advectionField->getFieldsAndDivergences(&positions[0], NULL, &Div[0], n);
+	}
+	catch (std::exception &e) {
+		KISS_LOG_ERROR 	<< "AdiabaticCooling: Exception in getDivergence.\n" 
+				<< e.what();
+		Div.assign(n, 0.);
+	}
+	for (size_t i = 0; i < n; i++)
+		cool(candidates[i], Div[i]);
+}
+
+void AdiabaticCooling::cool(Candidate *c, double Div) const {
+	double E = c->current.getEnergy(); // Note we use E=p/c (relativistic limit)
 	double dEdt = -E / 3. * Div; 	// cooling due to advection -p/3 * div(V_wind)
 					// (see e.g. Kopp et al. Computer Physics Communication 183
 					// (2012) 530-542)
@@ -0,0 +1,88 @@
+#include "crpropa/module/Backtracking.h"
+
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+namespace crpropa {
+
+// weight of the candidate at the start of the backtracking
+static const PropertyKey WEIGHT("BacktrackingWeight.weight");
+
+BacktrackingWeight::BacktrackingWeight(ref_ptr<Density> density, Mode mode) :
+		density(density), mode(mode) {
+	if (!density)
+		throw std::runtime_error("BacktrackingWeight: no density");
+}
+
+BacktrackingWeight::BacktrackingWeight(ref_ptr<ScalarGrid> grid, Mode mode) :
+		grid(grid), mode(mode) {
+	if (!grid)
+		throw std::runtime_error("BacktrackingWeight: no density grid");
+}
+
+void BacktrackingWeight::setMode(Mode m) {
+	mode = m;
+}
+
+BacktrackingWeight::Mode BacktrackingWeight::getMode() const {
+	return mode;
+}
+
+double BacktrackingWeight::getDensity(const Vector3d &position) const {
+	if (density)
+		return density->getDensity(position);
+	// cells as in SourceDensityGrid, the grid is not repeated
+	Vector3d r = (position - grid->getOrigin()) / grid->getSpacing();
+	if ((r.x < 0) || (r.y < 0) || (r.z < 0) || (r.x >= grid->getNx())
+			|| (r.y >= grid->getNy()) || (r.z >= grid->getNz()))
+		return 0;
+	return grid->closestValue(position);
+}
+
+Vector3d BacktrackingWeight::getPosition(const Candidate *c) const {
+	if (mode == EndPoint)
+		return c->current.getPosition();
+	return (c->previous.getPosition() + c->current.getPosition()) / 2;
+}
+
+void BacktrackingWeight::setFactor(Candidate *c, double n) const {
+	bool first = !c->hasProperty(WEIGHT);
+	if (first)
+		c->setProperty(WEIGHT, c->getWeight());
+	double weight = c->getProperty(WEIGHT).toDouble();
+	if (mode == EndPoint)
+		c->setWeight(weight * n);
+	else
+		c->setWeight((first ? 0 : c->getWeight()) + weight * n * c->getCurrentStep());
+}
+
+void BacktrackingWeight::process(Candidate *c) const {
+	setFactor(c, getDensity(getPosition(c)));
+}
+
+void BacktrackingWeight::processBatch(Candidate *const *candidates, size_t n) const {
+	if (!density) {
+		Module::processBatch(candidates, n);
+		return;
+	}
+	std::vector<Vector3d> positions(n);
+	std::vector<double> densities(n);
+	for (size_t i = 0; i < n; i++)
+		positions[i] = getPosition(candidates[i]);
+	if (n > 0)
+		density->getDensities(&positions[0], &densities[0], n);
+	for (size_t i = 0; i < n; i++)
+		setFactor(candidates[i], densities[i]);
+}
+
+std::string BacktrackingWeight::getDescription() const {
+	std::stringstream ss;
+	ss << "BacktrackingWeight: ";
+	ss << (mode == EndPoint ? "source density at the end" : "integral of the source density");
+	ss << " of the backtracked trajectories, from a ";
+	ss << (density ? "density" : "density grid");
+	return ss.str();
+}
+
+} // namespace crpropa
@@ -0,0 +1,263 @@
+#include "crpropa/module/BinaryOutput.h"
+#include "crpropa/Trace.h"
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace crpropa {
+
+static const char binaryMagic[8] = {'C', 'R', 'P', 'C', 'A', 'N', 'D', '1'};
+// records of a thread are written when this size is reached
+static const size_t RECORD_BUFFER_SIZE = 256 * 1024;
+// further threads write single records
+static const size_t RECORD_BUFFER_THREADS = 256;
+// the writes of the record buffers, see Trace
+static const size_t traceWrite = Trace::addName("BinaryOutput write", "output");
+
+static void toBinary(const ParticleState &p, BinaryState &b) {
+	b.id = p.getId();
+	b.reserved = 0;
+	b.energy = p.getEnergy();
+	const Vector3d &x = p.getPosition(), &u = p.getDirection();
+	b.position[0] = x.x;
+	b.position[1] = x.y;
+	b.position[2] = x.z;
+	b.direction[0] = u.x;
+	b.direction[1] = u.y;
+	b.direction[2] = u.z;
+}
+
+static ParticleState fromBinary(const BinaryState &b) {
+	return ParticleState(b.id, b.energy,
+			Vector3d(b.position[0], b.position[1], b.position[2]),
+			Vector3d(b.direction[0], b.direction[1], b.direction[2]));
+}
+
+// value of a property as written by Variant::copyToBuffer
+static Variant variantFromBuffer(Variant::Type type, const char *p, size_t size) {
+#define VARIANT_FROM_BUFFER(TYPE, VALUE) \
+	case Variant::TYPE: { VALUE v; memcpy(&v, p, sizeof(v)); return Variant(v); }
+	switch (type) {
+	VARIANT_FROM_BUFFER(TYPE_BOOL, bool)
+	VARIANT_FROM_BUFFER(TYPE_CHAR, char)
+	VARIANT_FROM_BUFFER(TYPE_UCHAR, unsigned char)
+	VARIANT_FROM_BUFFER(TYPE_INT16, int16_t)
+	VARIANT_FROM_BUFFER(TYPE_UINT16, uint16_t)
+	VARIANT_FROM_BUFFER(TYPE_INT32, int32_t)
+	VARIANT_FROM_BUFFER(TYPE_UINT32, uint32_t)
+	VARIANT_FROM_BUFFER(TYPE_INT64, int64_t)
+	VARIANT_FROM_BUFFER(TYPE_UINT64, uint64_t)
+	VARIANT_FROM_BUFFER(TYPE_FLOAT, float)
+	VARIANT_FROM_BUFFER(TYPE_DOUBLE, double)
+	case Variant::TYPE_STRING:
+		return Variant(std::string(p, size));
+	default:
+		return Variant();
+	}
+#undef VARIANT_FROM_BUFFER
+}
+
+BinaryOutput::BinaryOutput(const std::string &filename) :
+		outfile(filename.c_str(), std::ios::binary), filename(filename),
+		lock("BinaryOutput") {
+	if (!outfile.is_open())
+		throw std::runtime_error(std::string("Cannot create file: ") + filename);
+	outfile.write(binaryMagic, 8);
+	recordBuffers.resize(RECORD_BUFFER_THREADS);
+}
+
+BinaryOutput::~BinaryOutput() {
+	close();
+}
+
+void BinaryOutput::process(Candidate *c) const {
+#ifdef _OPENMP
+	size_t thread = omp_get_thread_num();
+#else
+	size_t thread = 0;
+#endif
+	std::string single;
+	std::string &records = (thread < RECORD_BUFFER_THREADS) ?
+			recordBuffers[thread].records : single;
+
+	BinaryRecord r;
+	r.properties = c->properties.size();
+	r.serialNumber = c->getSerialNumber();
+	r.trajectoryLength = c->getTrajectoryLength();
+	r.redshift = c->getRedshift();
+	r.weight = c->getWeight();
+	r.currentStep = c->getCurrentStep();
+	r.nextStep = c->getNextStep();
+	toBinary(c->current, r.current);
+	toBinary(c->source.get(), r.source);
+	toBinary(c->created.get(), r.created);
+
+	size_t start = records.size();
+	records.append((const char *) &r, sizeof(r));
+	char value[8];
+	for (Candidate::PropertyMap::const_iterator i = c->properties.begin();
+			i != c->properties.end(); ++i) {
+		const std::string &name = i->first.getName();
+		const Variant &v = i->second;
+		uint32_t size = 0;
+		if (v.getType() == Variant::TYPE_STRING)
+			size = v.asString().size();
+		else if (v.getType() != Variant::TYPE_NONE)
+			size = v.copyToBuffer(value);
+		char header[8] = {char(v.getType()), 0};
+		uint16_t length = name.size();
+		memcpy(header + 2, &length, 2);
+		memcpy(header + 4, &size, 4);
+		records.append(header, 8);
+		records.append(name);
+		if (v.getType() == Variant::TYPE_STRING)
+			records.append(v.asString());
+		else
+			records.append(value, size);
+	}
+	records.append((8 - (records.size() - start) % 8) % 8, '\0');
+	uint32_t size = records.size() - start;
+	memcpy(&records[start], &size, 4);
+
+	if ((thread >= RECORD_BUFFER_THREADS) || (records.size() >= RECORD_BUFFER_SIZE))
+		writeRecords(records);
+}
+
+void BinaryOutput::writeRecords(std::string &records) const {
+	{
+		ScopedLock l(lock);
+		double traceStart = Trace::isEnabled() ? Trace::now() : 0;
+		outfile.write(records.data(), records.size());
+		if (Trace::isEnabled())
+			Trace::record(traceWrite, traceStart, Trace::now());
+	}
+	records.clear();
+}
+
+void BinaryOutput::flush() const {
+	for (size_t i = 0; i < recordBuffers.size(); i++)
+		if (!recordBuffers[i].records.empty())
+			writeRecords(recordBuffers[i].records);
+	outfile.flush();
+}
+
+void BinaryOutput::close() {
+	if (!outfile.is_open())
+		return;
+	flush();
+	outfile.close();
+}
+
+void BinaryOutput::load(const std::string &filename, ParticleCollector *collector) {
+	BinaryInput input(filename);
+	input.load(collector);
+}
+
+std::string BinaryOutput::getDescription() const {
+	return "BinaryOutput: " + filename;
+}
+
+BinaryInput::BinaryInput(const std::string &filename) :
+		file(new MappedFile(filename)) {
+	const char *p = (const char *) file->getData();
+	size_t size = file->getSize();
+	if ((size < 8) || (memcmp(p, binaryMagic, 8) != 0))
+		throw std::runtime_error("BinaryInput: " + filename + " is no binary candidate file");
+
+	size_t pos = 8;
+	while (pos < size) {
+		uint32_t n;
+		if (size - pos < sizeof(BinaryRecord))
+			throw std::runtime_error("BinaryInput: " + filename + " is truncated");
+		memcpy(&n, p + pos, 4);
+		if ((n < sizeof(BinaryRecord)) || (n % 8 != 0) || (n > size - pos))
+			throw std::runtime_error("BinaryInput: " + filename + " is truncated");
+		offsets.push_back(pos);
+		pos += n;
+	}
+}
+
+bool BinaryInput::isBinaryFile(const std::string &filename) {
+	std::ifstream in(filename.c_str(), std::ios::binary);
+	char magic[8];
+	return in.read(magic, 8) && (memcmp(magic, binaryMagic, 8) == 0);
+}
+
+size_t BinaryInput::size() const {
+	return offsets.size();
+}
+
+const BinaryRecord &BinaryInput::getRecord(size_t i) const {
+	return *(const BinaryRecord *) ((const char *) file->getData() + offsets[i]);
+}
+
+ref_ptr<Candidate> BinaryInput::getCandidate(size_t i) const {
+	const BinaryRecord &r = getRecord(i);
+	ref_ptr<Candidate> c = new Candidate(fromBinary(r.current));
+	c->source = fromBinary(r.source);
+	c->created = fromBinary(r.created);
+	c->previous = c->current;
+	c->setSerialNumber(r.serialNumber);
+	c->setTrajectoryLength(r.trajectoryLength);
+	c->setRedshift(r.redshift);
+	c->setWeight(r.weight);
+	c->setCurrentStep(r.currentStep);
+	c->setNextStep(r.nextStep);
+
+	const char *p = (const char *) &r + sizeof(BinaryRecord);
+	const char *end = (const char *) &r + r.size;
+	for (uint32_t j = 0; (j < r.properties) && (p + 8 <= end); j++) {
+		uint16_t length;
+		uint32_t size;
+		memcpy(&length, p + 2, 2);
+		memcpy(&size, p + 4, 4);
+		if (p + 8 + length + size > end)
+			break;
+		Variant::Type type = Variant::Type((unsigned char) p[0]);
+		c->setProperty(std::string(p + 8, length),
+				variantFromBuffer(type, p + 8 + length, size));
+		p += 8 + length + size;
+	}
+	return c;
+}
+
+void BinaryInput::load(ParticleCollector *collector) const {
+	for (size_t i = 0; i < size(); i++)
+		collector->process(getCandidate(i));
+}
+
+BinarySource::BinarySource(const std::string &filename) :
+		input(new BinaryInput(filename)), next(0) {
+}
+
+size_t BinarySource::size() const {
+	return input->size();
+}
+
+ref_ptr<Candidate> BinarySource::getCandidate() const {
+	size_t i = __sync_fetch_and_add(&next, 1);
+	if (i >= input->size())
+		return 0;
+	return input->getCandidate(i);
+}
+
+void BinarySource::getCandidates(size_t n, std::vector<ref_ptr<Candidate> > &candidates) const {
+	size_t begin = __sync_fetch_and_add(&next, n);
+	size_t end = std::min(begin + n, input->size());
+	for (size_t i = begin; i < end; i++)
+		candidates.push_back(input->getCandidate(i));
+}
+
+std::string BinarySource::getDescription() const {
+	std::stringstream s;
+	s << "BinarySource: " << input->size() << " candidates";
+	return s.str();
+}
+
+} // namespace crpropa
@@ -1,6 +1,8 @@
 #include "crpropa/module/Boundary.h"
 #include "crpropa/Units.h"
+#include "crpropa/Geometry.h"
 
+#include <algorithm>
 #include <sstream>
 
 namespace crpropa {
@@ -110,24 +112,30 @@ std::string ReflectiveBox::getDescription() const {
 }
 
 CubicBoundary::CubicBoundary() :
-		origin(Vector3d(0, 0, 0)), size(0), limitStep(true), margin(0.1 * kpc) {
+		origin(Vector3d(0, 0, 0)), size(0), limitStep(true), rayStep(false), margin(0.1 * kpc) {
 }
 
 CubicBoundary::CubicBoundary(Vector3d o, double s) :
-		origin(o), size(s), limitStep(true), margin(0.1 * kpc) {
+		origin(o), size(s), limitStep(true), rayStep(false), margin(0.1 * kpc) {
 }
 
-void CubicBoundary::process(Candidate *c) const {
+AbstractCondition::Decision CubicBoundary::check(const Candidate *c,
+		double &stepLimit) const {
 	Vector3d r = c->current.getPosition() - origin;
 	double lo = r.min();
 	double hi = r.max();
-	if ((lo <= 0) or (hi >= size)) {
-		reject(c);
-	}
 	if (limitStep) {
-		c->limitNextStep(lo + margin);
-		c->limitNextStep(size - hi + margin);
+		double step = std::min(lo, size - hi);
+		if (rayStep and (step > 0) and (c->current.getCharge() == 0))
+			step = std::max(step, ParaxialBox(origin, Vector3d(size)).intersection(
+					c->current.getPosition(), c->current.getDirection()));
+		stepLimit = std::min(stepLimit, step + margin);
 	}
+	return ((lo <= 0) or (hi >= size)) ? Reject : Continue;
+}
+
+void CubicBoundary::process(Candidate *c) const {
+	processCheck(c);
 }
 
 void CubicBoundary::setOrigin(Vector3d o) {
@@ -142,6 +150,9 @@ void CubicBoundary::setMargin(double m) {
 void CubicBoundary::setLimitStep(bool b) {
 	limitStep = b;
 }
+void CubicBoundary::setRayStep(bool b) {
+	rayStep = b;
+}
 
 std::string CubicBoundary::getDescription() const {
 	std::stringstream s;
@@ -155,20 +166,28 @@ std::string CubicBoundary::getDescription() const {
 }
 
 SphericalBoundary::SphericalBoundary() :
-		center(Vector3d(0, 0, 0)), radius(0), limitStep(true), margin(0.1 * kpc) {
+		center(Vector3d(0, 0, 0)), radius(0), limitStep(true), rayStep(false), margin(0.1 * kpc) {
 }
 
 SphericalBoundary::SphericalBoundary(Vector3d c, double r) :
-		center(c), radius(r), limitStep(true), margin(0.1 * kpc) {
+		center(c), radius(r), limitStep(true), rayStep(false), margin(0.1 * kpc) {
 }
 
-void SphericalBoundary::process(Candidate *c) const {
+AbstractCondition::Decision SphericalBoundary::check(const Candidate *c,
+		double &stepLimit) const {
 	double d = (c->current.getPosition() - center).getR();
-	if (d >= radius) {
-		reject(c);
+	if (limitStep) {
+		double step = radius - d;
+		if (rayStep and (step > 0) and (c->current.getCharge() == 0))
+			step = std::max(step, Sphere(center, radius).intersection(
+					c->current.getPosition(), c->current.getDirection()));
+		stepLimit = std::min(stepLimit, step + margin);
 	}
-	if (limitStep)
-		c->limitNextStep(radius - d + margin);
+	return (d >= radius) ? Reject : Continue;
+}
+
+void SphericalBoundary::process(Candidate *c) const {
+	processCheck(c);
 }
 
 void SphericalBoundary::setCenter(Vector3d c) {
@@ -183,6 +202,9 @@ void SphericalBoundary::setMargin(double m) {
 void SphericalBoundary::setLimitStep(bool b) {
 	limitStep = b;
 }
+void SphericalBoundary::setRayStep(bool b) {
+	rayStep = b;
+}
 
 std::string SphericalBoundary::getDescription() const {
 	std::stringstream s;
@@ -205,14 +227,17 @@ EllipsoidalBoundary::EllipsoidalBoundary(Vector3d f1, Vector3d f2, double a) :
 		margin(0.1 * kpc) {
 }
 
-void EllipsoidalBoundary::process(Candidate *c) const {
+AbstractCondition::Decision EllipsoidalBoundary::check(const Candidate *c,
+		double &stepLimit) const {
 	Vector3d pos = c->current.getPosition();
 	double d = pos.getDistanceTo(focalPoint1) + pos.getDistanceTo(focalPoint2);
-	if (d >= majorAxis) {
-		reject(c);
-	}
 	if (limitStep)
-		c->limitNextStep(majorAxis - d + margin);
+		stepLimit = std::min(stepLimit, majorAxis - d + margin);
+	return (d >= majorAxis) ? Reject : Continue;
+}
+
+void EllipsoidalBoundary::process(Candidate *c) const {
+	processCheck(c);
 }
 
 void EllipsoidalBoundary::setFocalPoints(Vector3d f1, Vector3d f2) {
@@ -249,17 +274,22 @@ CylindricalBoundary::CylindricalBoundary(Vector3d o, double h, double r) :
   origin(o), height(h), radius(r), limitStep(false) , margin(0){
 }
 
-void CylindricalBoundary::process(Candidate *c) const {
+AbstractCondition::Decision CylindricalBoundary::check(const Candidate *c,
+		double &stepLimit) const {
 	Vector3d d = c->current.getPosition() - origin;
 	double R2 = pow(d.x, 2.)+pow(d.y, 2.);
 	double Z = fabs(d.z);
 	if ( R2 < pow(radius, 2.) and Z < height/2.) {
 	  if(limitStep) {
-	    c->limitNextStep(std::min(radius - pow(R2, 0.5), height/2. - Z) + margin);
+	    stepLimit = std::min(stepLimit, std::min(radius - pow(R2, 0.5), height/2. - Z) + margin);
 	  }
-	  return;
+	  return Continue;
 	}
-	reject(c);
+	return Reject;
+}
+
+void CylindricalBoundary::process(Candidate *c) const {
+	processCheck(c);
 }
 
 void CylindricalBoundary::setOrigin(Vector3d o) {
@@ -2,6 +2,7 @@
 #include "crpropa/ParticleID.h"
 #include "crpropa/Units.h"
 
+#include <algorithm>
 #include <sstream>
 
 namespace crpropa {
@@ -39,7 +40,21 @@ std::string MaximumTrajectoryLength::getDescription() const {
 	return s.str();
 }
 
-void MaximumTrajectoryLength::process(Candidate *c) const {
+void MaximumTrajectoryLength::getConfiguration(Configuration &c) const {
+	c.setType("MaximumTrajectoryLength");
+	c.set("maxLength", maxLength);
+	std::vector<double> positions;
+	for (size_t i = 0; i < observerPositions.size(); i++) {
+		positions.push_back(observerPositions[i].x);
+		positions.push_back(observerPositions[i].y);
+		positions.push_back(observerPositions[i].z);
+	}
+	c.set("observerPositions", positions);
+	getConditionConfiguration(c);
+}
+
+AbstractCondition::Decision MaximumTrajectoryLength::check(const Candidate *c,
+		double &stepLimit) const {
 	double length = c->getTrajectoryLength();
 	Vector3d position = c->current.getPosition();
 
@@ -50,17 +65,18 @@ void MaximumTrajectoryLength::process(Candidate *c) const {
 			if (distance + length < maxLength)
 				inRange = true;
 		}
-		if (!inRange) {
-			reject(c);
-			return;
-		}
+		if (!inRange)
+			return Reject;
 	}
 
-	if (length >= maxLength) {
-		reject(c);
-	} else {
-		c->limitNextStep(maxLength - length);
-	}
+	if (length >= maxLength)
+		return Reject;
+	stepLimit = std::min(stepLimit, maxLength - length);
+	return Continue;
+}
+
+void MaximumTrajectoryLength::process(Candidate *c) const {
+	processCheck(c);
 }
 
 //*****************************************************************************
@@ -76,11 +92,13 @@ double MinimumEnergy::getMinimumEnergy() const {
 	return minEnergy;
 }
 
+AbstractCondition::Decision MinimumEnergy::check(const Candidate *c,
+		double &stepLimit) const {
+	return (c->current.getEnergy() > minEnergy) ? Continue : Reject;
+}
+
 void MinimumEnergy::process(Candidate *c) const {
-	if (c->current.getEnergy() > minEnergy)
-		return;
-	else
-		reject(c);
+	processCheck(c);
 }
 
 std::string MinimumEnergy::getDescription() const {
@@ -93,6 +111,12 @@ std::string MinimumEnergy::getDescription() const {
 	return s.str();
 }
 
+void MinimumEnergy::getConfiguration(Configuration &c) const {
+	c.setType("MinimumEnergy");
+	c.set("minEnergy", minEnergy);
+	getConditionConfiguration(c);
+}
+
 //*****************************************************************************
 MinimumRigidity::MinimumRigidity(double minRigidity) :
 		minRigidity(minRigidity) {
@@ -106,9 +130,13 @@ double MinimumRigidity::getMinimumRigidity() const {
 	return minRigidity;
 }
 
+AbstractCondition::Decision MinimumRigidity::check(const Candidate *c,
+		double &stepLimit) const {
+	return (c->current.getRigidity() < minRigidity) ? Reject : Continue;
+}
+
 void MinimumRigidity::process(Candidate *c) const {
-	if (c->current.getRigidity() < minRigidity)
-		reject(c);
+	processCheck(c);
 }
 
 std::string MinimumRigidity::getDescription() const {
@@ -121,6 +149,12 @@ std::string MinimumRigidity::getDescription() const {
 	return s.str();
 }
 
+void MinimumRigidity::getConfiguration(Configuration &c) const {
+	c.setType("MinimumRigidity");
+	c.set("minRigidity", minRigidity);
+	getConditionConfiguration(c);
+}
+
 //*****************************************************************************
 MinimumRedshift::MinimumRedshift(double zmin) :
 		zmin(zmin) {
@@ -134,11 +168,13 @@ double MinimumRedshift::getMinimumRedshift() {
 	return zmin;
 }
 
+AbstractCondition::Decision MinimumRedshift::check(const Candidate *c,
+		double &stepLimit) const {
+	return (c->getRedshift() > zmin) ? Continue : Reject;
+}
+
 void MinimumRedshift::process(Candidate* c) const {
-	if (c->getRedshift() > zmin)
-		return;
-	else
-		reject(c);
+	processCheck(c);
 }
 
 std::string MinimumRedshift::getDescription() const {
@@ -151,6 +187,12 @@ std::string MinimumRedshift::getDescription() const {
 	return s.str();
 }
 
+void MinimumRedshift::getConfiguration(Configuration &c) const {
+	c.setType("MinimumRedshift");
+	c.set("zmin", zmin);
+	getConditionConfiguration(c);
+}
+
 //*****************************************************************************
 DetectionLength::DetectionLength(double detLength) :
 		detLength(detLength) {
@@ -175,15 +217,25 @@ std::string DetectionLength::getDescription() const {
 	return s.str();
 }
 
-void DetectionLength::process(Candidate *c) const {
+void DetectionLength::getConfiguration(Configuration &c) const {
+	c.setType("DetectionLength");
+	c.set("detLength", detLength);
+	getConditionConfiguration(c);
+}
+
+AbstractCondition::Decision DetectionLength::check(const Candidate *c,
+		double &stepLimit) const {
 	double length = c->getTrajectoryLength();
 	double step = c->getCurrentStep();
 
-	if (length >= detLength && length - step < detLength) {
-		reject(c);
-	} else {
-		c->limitNextStep(detLength - length);
-	}
+	if (length >= detLength && length - step < detLength)
+		return Reject;
+	stepLimit = std::min(stepLimit, detLength - length);
+	return Continue;
+}
+
+void DetectionLength::process(Candidate *c) const {
+	processCheck(c);
 }
 
 
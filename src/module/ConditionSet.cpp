@@ -0,0 +1,39 @@
+#include "crpropa/module/ConditionSet.h"
+
+#include <limits>
+#include <sstream>
+
+namespace crpropa {
+
+void ConditionSet::add(AbstractCondition *condition) {
+	conditions.push_back(condition);
+}
+
+size_t ConditionSet::size() const {
+	return conditions.size();
+}
+
+void ConditionSet::process(Candidate *candidate) const {
+	double stepLimit = std::numeric_limits<double>::max();
+	for (size_t i = 0; i < conditions.size(); i++) {
+		const AbstractCondition &condition = *conditions[i];
+		AbstractCondition::Decision decision = condition.check(candidate, stepLimit);
+		if (decision == AbstractCondition::Unsupported)
+			condition.process(candidate);
+		else
+			condition.apply(candidate, decision);
+		if (!candidate->isActive())
+			break;
+	}
+	candidate->limitNextStep(stepLimit);
+}
+
+std::string ConditionSet::getDescription() const {
+	std::stringstream s;
+	s << "ConditionSet: " << conditions.size() << " conditions";
+	for (size_t i = 0; i < conditions.size(); i++)
+		s << "\n  " << conditions[i]->getDescription();
+	return s.str();
+}
+
+} // namespace crpropa
@@ -0,0 +1,191 @@
+#include "crpropa/module/ContinuousLossCollection.h"
+#include "crpropa/Cosmology.h"
+#include "crpropa/Statistics.h"
+#include "crpropa/Units.h"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+
+namespace crpropa {
+
+// substep statistics, see Statistics
+static const size_t acceptedSubsteps = Statistics::addCounter("ContinuousLossCollection: accepted substeps");
+static const size_t rejectedSubsteps = Statistics::addCounter("ContinuousLossCollection: rejected substeps");
+
+// Cash-Karp coefficients, as PropagationCK
+static const double ck_a[6][5] = {
+	{0., 0., 0., 0., 0.},
+	{1. / 5., 0., 0., 0., 0.},
+	{3. / 40., 9. / 40., 0., 0., 0.},
+	{3. / 10., -9. / 10., 6. / 5., 0., 0.},
+	{-11. / 54., 5. / 2., -70. / 27., 35. / 27., 0.},
+	{1631. / 55296., 175. / 512., 575. / 13824., 44275. / 110592., 253. / 4096.}
+};
+static const double ck_b[6] = {
+	37. / 378., 0, 250. / 621., 125. / 594., 0., 512. / 1771.
+};
+static const double ck_bs[6] = {
+	2825. / 27648., 0., 18575. / 48384., 13525. / 55296., 277. / 14336., 1. / 4.
+};
+
+// the substeps of a step before the remaining step is taken without error control
+static const size_t maxSubsteps = 1000;
+
+ContinuousLossCollection::ContinuousLossCollection(double limit, double tolerance) :
+		limit(limit), redshiftEvolution(true) {
+	setTolerance(tolerance);
+}
+
+void ContinuousLossCollection::add(ContinuousLoss *loss) {
+	losses.push_back(loss);
+}
+
+size_t ContinuousLossCollection::size() const {
+	return losses.size();
+}
+
+void ContinuousLossCollection::setLimit(double l) {
+	limit = l;
+}
+
+double ContinuousLossCollection::getLimit() const {
+	return limit;
+}
+
+void ContinuousLossCollection::setTolerance(double t) {
+	if (!(t > 0))
+		throw std::runtime_error("ContinuousLossCollection: tolerance <= 0");
+	tolerance = t;
+}
+
+double ContinuousLossCollection::getTolerance() const {
+	return tolerance;
+}
+
+void ContinuousLossCollection::setRedshiftEvolution(bool b) {
+	redshiftEvolution = b;
+}
+
+bool ContinuousLossCollection::getRedshiftEvolution() const {
+	return redshiftEvolution;
+}
+
+// y = (ln E, z, energy lost to each loss), per comoving distance
+void ContinuousLossCollection::derivatives(const Candidate *candidate,
+		const double *y, double *dydx) const {
+	double E = exp(y[0]);
+	double z = std::max(y[1], 0.);
+	double total = 0;
+	for (size_t i = 0; i < losses.size(); i++) {
+		dydx[2 + i] = losses[i]->energyLossRate(candidate, E, z);
+		total += dydx[2 + i];
+	}
+	dydx[0] = -total / E;
+	dydx[1] = 0;
+	if (redshiftEvolution and (y[1] > 0)) {
+		// dz = H(z) / c * ds, adiabatic loss dE / dz = E / (1 + z)
+		dydx[1] = -hubbleRate(z) / c_light;
+		dydx[0] += dydx[1] / (1 + z);
+	}
+}
+
+void ContinuousLossCollection::process(Candidate *candidate) const {
+	double step = candidate->getCurrentStep();
+	double E0 = candidate->current.getEnergy();
+	double z0 = candidate->getRedshift();
+	if (!(E0 > 0))
+		return;
+
+	size_t n = 2 + losses.size();
+	std::vector<double> y(n, 0), k(6 * n), yt(n), y5(n);
+	y[0] = log(E0);
+	y[1] = z0;
+
+	// initial substep: one loss length of the summed losses
+	derivatives(candidate, &y[0], &k[0]);
+	double lossRate = -k[0] + k[1] / (1 + z0); // without the adiabatic loss
+	if ((lossRate <= 0) and (k[1] == 0))
+		return; // no losses
+	double h = step;
+	if (lossRate > 0)
+		h = std::min(step, 1 / lossRate);
+
+	double x = 0;
+	size_t substeps = 0, rejected = 0;
+	while (x < step) {
+		h = std::min(h, step - x);
+		bool force = (substeps + rejected >= maxSubsteps) or (h <= 1e-9 * step);
+		if (force)
+			h = step - x;
+
+		// stages, the first is the derivative at the current state
+		if (substeps + rejected > 0)
+			derivatives(candidate, &y[0], &k[0]);
+		for (size_t s = 1; s < 6; s++) {
+			for (size_t j = 0; j < n; j++) {
+				double sum = 0;
+				for (size_t r = 0; r < s; r++)
+					sum += ck_a[s][r] * k[r * n + j];
+				yt[j] = y[j] + h * sum;
+			}
+			derivatives(candidate, &yt[0], &k[s * n]);
+		}
+
+		// fifth order solution and relative error against the fourth order one
+		double r = 0;
+		for (size_t j = 0; j < n; j++) {
+			double s5 = 0, s4 = 0;
+			for (size_t s = 0; s < 6; s++) {
+				s5 += ck_b[s] * k[s * n + j];
+				s4 += ck_bs[s] * k[s * n + j];
+			}
+			y5[j] = y[j] + h * s5;
+			double scale = (j == 0) ? 1 : (j == 1) ? 1 + z0 : E0;
+			r = std::max(r, fabs(h * (s5 - s4)) / scale / tolerance);
+		}
+
+		if ((r > 1) and not force) {
+			h *= std::max(0.1, 0.95 * pow(r, -0.25));
+			rejected++;
+			continue;
+		}
+		y = y5;
+		x += h;
+		substeps++;
+		h *= (r > 0) ? std::min(5., 0.95 * pow(r, -0.2)) : 5.;
+	}
+	Statistics::count(acceptedSubsteps, substeps);
+	if (rejected > 0)
+		Statistics::count(rejectedSubsteps, rejected);
+
+	double E = exp(y[0]);
+	if (redshiftEvolution)
+		candidate->setRedshift(std::max(y[1], 0.));
+	candidate->current.setEnergy(E);
+
+	// secondaries of each loss at the mean energy of the step
+	for (size_t i = 0; i < losses.size(); i++)
+		if (y[2 + i] > 0)
+			losses[i]->emitSecondaries(candidate, (E0 + E) / 2, y[2 + i]);
+
+	// limit the next step with the losses at the new state
+	derivatives(candidate, &y[0], &k[0]);
+	lossRate = -k[0] + k[1] / (1 + std::max(y[1], 0.));
+	if (lossRate > 0)
+		candidate->limitNextStep(limit / lossRate);
+}
+
+std::string ContinuousLossCollection::getDescription() const {
+	std::stringstream s;
+	s << "ContinuousLossCollection: " << losses.size() << " losses";
+	if (redshiftEvolution)
+		s << " and redshift";
+	s << ", tolerance " << tolerance;
+	for (size_t i = 0; i < losses.size(); i++)
+		s << "\n  " << losses[i]->getDescription();
+	return s.str();
+}
+
+} // namespace crpropa
@@ -1,5 +1,7 @@
 #include "crpropa/module/DiffusionSDE.h"
 
+#include <algorithm>
+
 
 using namespace crpropa;
 
@@ -16,6 +18,8 @@ const double b[] = { 37. / 378., 0, 250. / 621., 125. / 594., 0., 512.
 const double bs[] = { 2825. / 27648., 0., 18575. / 48384., 13525.
 		/ 55296., 277. / 14336., 1. / 4. };
 
+static const PropertyKey SUBSTEP("DiffusionSDE.substep");
+
 
 
 DiffusionSDE::DiffusionSDE(ref_ptr<MagneticField> magneticField, double tolerance,
@@ -29,6 +33,9 @@ DiffusionSDE::DiffusionSDE(ref_ptr<MagneticField> magneticField, double toleranc
   	setEpsilon(epsilon);
   	setScale(1.);
   	setAlpha(1./3.);
+  	setAdaptiveSubsteps(false);
+  	adiabaticCooling = false;
+  	coolingLimit = 0.1;
 	}
 
 DiffusionSDE::DiffusionSDE(ref_ptr<MagneticField> magneticField, ref_ptr<AdvectionField> advectionField, double tolerance, double minStep, double maxStep, double epsilon) :
@@ -42,6 +49,9 @@ DiffusionSDE::DiffusionSDE(ref_ptr<MagneticField> magneticField, ref_ptr<Advecti
 	setEpsilon(epsilon);
 	setScale(1.);
 	setAlpha(1./3.);
+	setAdaptiveSubsteps(false);
+	adiabaticCooling = false;
+	coolingLimit = 0.1;
   	}
 
 void DiffusionSDE::process(Candidate *candidate) const {
@@ -62,13 +72,20 @@ void DiffusionSDE::process(Candidate *candidate) const {
 		Vector3d Pos = current.getPosition();
 
 		Vector3d LinProp(0.);
-		if (advectionField){
+		double divergence = 0;
+		if (advectionField && adiabaticCooling){
+			Vector3d advection;
+			evaluateAdvection(Pos, advection, divergence);
+			LinProp += advection * h;
+		} else if (advectionField){
 			driftStep(Pos, LinProp, h);
 		}
 
 		current.setPosition(Pos + LinProp + dir*h*c_light);
 		candidate->setCurrentStep(h * c_light);
 		candidate->setNextStep(maxStep);
+		if (adiabaticCooling)
+			cool(candidate, divergence);
 		return;
 	}
 
@@ -83,47 +100,67 @@ void DiffusionSDE::process(Candidate *candidate) const {
 
     // Generate random numbers
 	double eta[] = {0., 0., 0.};
-	for(size_t i=0; i < 3; i++) {
-	  	eta[i] =  Random::instance().randNorm();
-	}
+	Random::instance().fillNorm(eta, 3);
 
 	double TStep = BTensor[0] * eta[0];
 	double NStep = BTensor[4] * eta[1];
 	double BStep = BTensor[8] * eta[2];
 
-	Vector3d TVec(0.);
-	Vector3d NVec(0.);
-	Vector3d BVec(0.);
-
-	Vector3d DirOut = Vector3d(0.);
+	double propTime = TStep * sqrt(h) / c_light;
+	Vector3d PosOut = Vector3d(0.);
+	size_t stepNumber;
+	if (adaptiveSubsteps) {
+		stepNumber = integrateFieldLine(PosIn, PosOut, z, propTime, candidate);
+	} else {
+		size_t counter = 0;
+		double r=42.; //arbitrary number larger than one
+		Vector3d FirstOut = Vector3d(0.);
+
+		do {
+			Vector3d PosErr = Vector3d(0.);
+		  	tryStep(PosIn, FirstOut, PosErr, z, propTime);
+		    // calculate the relative position error r and the next time step h
+		  	r = PosErr.getR() / tolerance;
+		  	propTime *= 0.5;
+			counter += 1;
+
+	    // Check for better break condition
+		} while (r > 1 && fabs(propTime) >= minStep/c_light);
+
+		// the last trial is the first substep, continue from there
+		stepNumber = pow(2, counter-1);
+		double allowedTime = TStep * sqrt(h) / c_light / stepNumber;
+		Vector3d Start = FirstOut;
+		PosOut = FirstOut;
+		Vector3d PosErr = Vector3d(0.);
+		for (size_t j=1; j<stepNumber; j++) {
+			tryStep(Start, PosOut, PosErr, z, allowedTime);
+			Start = PosOut;
+		}
+	}
 
+	if (advectionField && adiabaticCooling) {
+		// one evaluation of the field and divergence for drift and cooling
+		Vector3d advection;
+		double divergence;
+		evaluateAdvection(PosIn, advection, divergence);
+		finishStep(candidate, PosIn, PosOut, stepNumber, h, TStep, NStep, BStep, &advection);
+		cool(candidate, divergence);
+		return;
+	}
+	finishStep(candidate, PosIn, PosOut, stepNumber, h, TStep, NStep, BStep);
 
-	double propTime = TStep * sqrt(h) / c_light;
-	size_t counter = 0;
-	double r=42.; //arbitrary number larger than one
+}
 
-	do {
-		Vector3d PosOut = Vector3d(0.);
-		Vector3d PosErr = Vector3d(0.);
-	  	tryStep(PosIn, PosOut, PosErr, z, propTime);
-	    // calculate the relative position error r and the next time step h
-	  	r = PosErr.getR() / tolerance;
-	  	propTime *= 0.5;
-		counter += 1;
 
-    // Check for better break condition
-	} while (r > 1 && fabs(propTime) >= minStep/c_light);
+void DiffusionSDE::finishStep(Candidate *candidate, const Vector3d &PosIn, const Vector3d &PosOut, size_t stepNumber, double h, double TStep, double NStep, double BStep, const Vector3d *advection) const {
+	ParticleState &current = candidate->current;
 
+	Vector3d TVec(0.);
+	Vector3d NVec(0.);
+	Vector3d BVec(0.);
 
-	size_t stepNumber = pow(2, counter-1);
-	double allowedTime = TStep * sqrt(h) / c_light / stepNumber;
-	Vector3d Start = PosIn;
-	Vector3d PosOut = Vector3d(0.);
-	Vector3d PosErr = Vector3d(0.);
-	for (size_t j=0; j<stepNumber; j++) {
-		tryStep(Start, PosOut, PosErr, z, allowedTime);
-		Start = PosOut;
-	}
+	Vector3d DirOut = Vector3d(0.);
 
     // Normalize the tangent vector
 	TVec = (PosOut-PosIn).getUnitVector();
@@ -135,7 +172,10 @@ void DiffusionSDE::process(Candidate *candidate) const {
 		Vector3d Pos = current.getPosition();
 		Vector3d LinProp(0.);
 		if (advectionField){
-			driftStep(Pos, LinProp, h);
+			if (advection)
+				LinProp += *advection * h;
+			else
+				driftStep(Pos, LinProp, h);
 			current.setPosition(Pos + LinProp);
 	 		candidate->setCurrentStep(h*c_light);
 	  		double newStep = 5*h*c_light;
@@ -164,7 +204,9 @@ void DiffusionSDE::process(Candidate *candidate) const {
 
     // Calculate the advection step
 	Vector3d LinProp(0.);
-	if (advectionField){
+	if (advection)
+		LinProp += *advection * h;
+	else if (advectionField){
 		driftStep(PosIn, LinProp, h);
 	}
 
@@ -229,16 +271,254 @@ void DiffusionSDE::process(Candidate *candidate) const {
 }
 
 
+static bool compareRedshift(const Candidate *a, const Candidate *b) {
+	return a->getRedshift() < b->getRedshift();
+}
+
+void DiffusionSDE::processBatch(Candidate *const *candidates, size_t n) const {
+	if (adaptiveSubsteps) {
+		Module::processBatch(candidates, n);
+		return;
+	}
+
+	// neutral particles are propagated one by one, the others grouped by redshift
+	std::vector<Candidate *> charged;
+	charged.reserve(n);
+	for (size_t i = 0; i < n; i++) {
+		if (candidates[i]->current.getCharge() == 0)
+			process(candidates[i]);
+		else
+			charged.push_back(candidates[i]);
+	}
+	std::stable_sort(charged.begin(), charged.end(), compareRedshift);
+
+	size_t begin = 0;
+	while (begin < charged.size()) {
+		double z = charged[begin]->getRedshift();
+		size_t end = begin + 1;
+		while ((end < charged.size()) && (charged[end]->getRedshift() == z))
+			end++;
+		diffuseBatch(&charged[begin], end - begin, z);
+		begin = end;
+	}
+}
+
+void DiffusionSDE::diffuseBatch(Candidate *const *candidates, size_t n, double z) const {
+	// structure of arrays, component d of lane i at [d * n + i]
+	std::vector<double> PosIn(3 * n), FirstOut(3 * n), Start(3 * n), PosOut(3 * n);
+	std::vector<double> h(n), TStep(n), NStep(n), BStep(n), propTime(n), PosErr(n);
+	std::vector<size_t> counter(n, 0), stepNumber(n), lanes, next;
+
+	// draw the random numbers of all candidates at once, in the order of process
+	std::vector<double> eta(3 * n);
+	Random &random = Random::instance();
+	for (size_t i = 0; i < n; i++)
+		random.fillNorm(&eta[3 * i], 3);
+
+	for (size_t i = 0; i < n; i++) {
+		ParticleState &current = candidates[i]->current;
+		candidates[i]->previous = current;
+		h[i] = clip(candidates[i]->getNextStep(), minStep, maxStep) / c_light;
+		Vector3d pos = current.getPosition();
+		PosIn[i] = pos.x;
+		PosIn[n + i] = pos.y;
+		PosIn[2 * n + i] = pos.z;
+
+		double rig = current.getEnergy() / current.getCharge();
+		double BTensor[] = {0., 0., 0., 0., 0., 0., 0., 0., 0.};
+		calculateBTensor(rig, BTensor, pos, current.getDirection(), z);
+		TStep[i] = BTensor[0] * eta[3 * i];
+		NStep[i] = BTensor[4] * eta[3 * i + 1];
+		BStep[i] = BTensor[8] * eta[3 * i + 2];
+		propTime[i] = TStep[i] * sqrt(h[i]) / c_light;
+		lanes.push_back(i);
+	}
+
+	// halve the first substep until it meets the tolerance
+	while (!lanes.empty()) {
+		tryStepBatch(lanes, n, &PosIn[0], &FirstOut[0], &PosErr[0], &propTime[0], z);
+		next.clear();
+		for (size_t j = 0; j < lanes.size(); j++) {
+			size_t i = lanes[j];
+			double r = PosErr[i] / tolerance;
+			propTime[i] *= 0.5;
+			counter[i] += 1;
+			if (r > 1 && fabs(propTime[i]) >= minStep/c_light)
+				next.push_back(i);
+		}
+		lanes.swap(next);
+	}
+
+	// the last trial is the first substep, replay the others
+	Start = FirstOut;
+	for (size_t i = 0; i < n; i++) {
+		stepNumber[i] = pow(2, counter[i]-1);
+		propTime[i] = TStep[i] * sqrt(h[i]) / c_light / stepNumber[i];
+		if (stepNumber[i] > 1)
+			lanes.push_back(i);
+	}
+	for (size_t j = 1; !lanes.empty(); j++) {
+		tryStepBatch(lanes, n, &Start[0], &PosOut[0], &PosErr[0], &propTime[0], z);
+		next.clear();
+		for (size_t l = 0; l < lanes.size(); l++) {
+			size_t i = lanes[l];
+			for (size_t d = 0; d < 3; d++)
+				Start[d * n + i] = PosOut[d * n + i];
+			if (j + 1 < stepNumber[i])
+				next.push_back(i);
+		}
+		lanes.swap(next);
+	}
+
+	// the advection of all candidates at once, on errors one by one in driftStep
+	// with the divergences for the adiabatic cooling
+	std::vector<Vector3d> advection;
+	std::vector<double> divergence;
+	if (advectionField) {
+		std::vector<Vector3d> positions(n);
+		for (size_t i = 0; i < n; i++)
+			positions[i] = Vector3d(PosIn[i], PosIn[n + i], PosIn[2 * n + i]);
+		advection.resize(n);
+		if (adiabaticCooling)
+			divergence.resize(n);
+		try {
+			advectionField->getFieldsAndDivergences(&positions[0], &advection[0],
+					adiabaticCooling ? &divergence[0] : NULL, n);
+		}
+		catch (std::exception &e) {
+			advection.clear();
+			if (adiabaticCooling) {
+				KISS_LOG_ERROR << "DiffusionSDE: Exception in advectionField::getFieldsAndDivergences.\n"
+						<< e.what();
+				divergence.assign(n, 0.);
+			}
+		}
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		finishStep(candidates[i], Vector3d(PosIn[i], PosIn[n + i], PosIn[2 * n + i]),
+				Vector3d(Start[i], Start[n + i], Start[2 * n + i]), stepNumber[i],
+				h[i], TStep[i], NStep[i], BStep[i], advection.empty() ? NULL : &advection[i]);
+		if (!divergence.empty())
+			cool(candidates[i], divergence[i]);
+	}
+}
+
+void DiffusionSDE::tryStepBatch(const std::vector<size_t> &lanes, size_t n, const double *PosIn, double *POut, double *PosErr, const double *propStep, double z) const {
+	// stage s, component d of the j-th lane at [(s * 3 + d) * m + j]
+	size_t m = lanes.size();
+	std::vector<double> k(6 * 3 * m);
+	std::vector<Vector3d> positions(m), fields(m);
+
+	for (size_t s = 0; s < 6; s++) {
+		for (size_t j = 0; j < m; j++) {
+			size_t i = lanes[j];
+			double y[3];
+			for (size_t d = 0; d < 3; d++) {
+				y[d] = PosIn[d * n + i];
+				for (size_t t = 0; t < s; t++)
+					y[d] += k[(t * 3 + d) * m + j] * (a[s * 6 + t] * propStep[i]);
+			}
+			positions[j] = Vector3d(y[0], y[1], y[2]);
+		}
+
+		try {
+			magneticField->getFields(&positions[0], &fields[0], m, z);
+		}
+		catch (std::exception &e) {
+			KISS_LOG_ERROR 	<< "DiffusionSDE: Exception in magneticField::getField.\n"
+					<< e.what();
+			for (size_t j = 0; j < m; j++) {
+				try {
+					fields[j] = magneticField->getField(positions[j], z);
+				}
+				catch (std::exception &e) {
+					fields[j] = Vector3d(0.);
+				}
+			}
+		}
+
+		// k_s = direction of the regular magnetic mean field
+		for (size_t j = 0; j < m; j++) {
+			Vector3d kv = fields[j].getUnitVector() * c_light;
+			k[(s * 3 + 0) * m + j] = kv.x;
+			k[(s * 3 + 1) * m + j] = kv.y;
+			k[(s * 3 + 2) * m + j] = kv.z;
+		}
+	}
+
+	for (size_t j = 0; j < m; j++) {
+		size_t i = lanes[j];
+		double err[3];
+		for (size_t d = 0; d < 3; d++) {
+			double out = PosIn[d * n + i];
+			err[d] = 0;
+			for (size_t s = 0; s < 6; s++) {
+				double ks = k[(s * 3 + d) * m + j];
+				out += ks * (b[s] * propStep[i]);
+				err[d] += ks * ((b[s] - bs[s]) * propStep[i] / kpc);
+			}
+			POut[d * n + i] = out;
+		}
+		PosErr[i] = Vector3d(err[0], err[1], err[2]).getR();
+	}
+}
+
+size_t DiffusionSDE::integrateFieldLine(const Vector3d &PosIn, Vector3d &PosOut, double z, double propTime, Candidate *candidate) const {
+	double total = fabs(propTime);
+	double sign = (propTime < 0) ? -1. : 1.;
+	double minTime = minStep / c_light;
+
+	// start with the last substep of this candidate
+	double dt = total;
+	if (candidate->hasProperty(SUBSTEP))
+		dt = std::min(total, candidate->getProperty(SUBSTEP).toDouble() / c_light);
+	dt = std::max(dt, std::min(minTime, total));
+
+	PosOut = PosIn;
+	double done = 0;
+	size_t stepNumber = 0;
+	double next = dt;
+	while (done < total) {
+		bool last = (dt >= total - done);
+		double t = last ? total - done : dt;
+
+		Vector3d Out = Vector3d(0.);
+		Vector3d PosErr = Vector3d(0.);
+		tryStep(PosOut, Out, PosErr, z, sign * t);
+		double r = PosErr.getR() / tolerance;
+		double f = 0.95 * pow(r, -0.2);
+
+		if ((r > 1) && (t > minTime)) {
+			// reject and retry with a smaller substep
+			dt = std::max(t * std::max(f, 0.1), minTime);
+			continue;
+		}
+
+		PosOut = Out;
+		done = last ? total : done + t;
+		stepNumber++;
+		// a shortened last substep does not reduce the proposal
+		next = std::max(t * clip(f, 0.1, 5.), last ? next : 0.);
+		dt = next;
+	}
+
+	candidate->setProperty(SUBSTEP, next * c_light);
+	return std::max(stepNumber, size_t(1));
+}
+
 void DiffusionSDE::tryStep(const Vector3d &PosIn, Vector3d &POut, Vector3d &PosErr,double z, double propStep) const {
 
-	Vector3d k[] = {Vector3d(0.),Vector3d(0.),Vector3d(0.),Vector3d(0.),Vector3d(0.),Vector3d(0.)};
-	POut = PosIn;
+	// the stages and sums on 4 padded lanes
+	PaddedVector3d k[6];
+	const PaddedVector3d x(PosIn);
+	PaddedVector3d out(x), err(PosErr);
 	//calculate the sum k_i * b_i
 	for (size_t i = 0; i < 6; i++) {
 
-		Vector3d y_n = PosIn;
+		PaddedVector3d y_n(x);
 		for (size_t j = 0; j < i; j++)
-		  y_n += k[j] * a[i * 6 + j] * propStep;
+		  y_n.addScaled(k[j], a[i * 6 + j] * propStep);
 
 		// update k_i = direction of the regular magnetic mean field
 		Vector3d BField(0.);
@@ -252,10 +532,12 @@ void DiffusionSDE::tryStep(const Vector3d &PosIn, Vector3d &POut, Vector3d &PosE
 
 		k[i] = BField.getUnitVector() * c_light;
 
-		POut += k[i] * b[i] * propStep;
-		PosErr +=  (k[i] * (b[i] - bs[i])) * propStep / kpc;
+		out.addScaled(k[i], b[i] * propStep);
+		err.addScaled(k[i], (b[i] - bs[i]) * propStep / kpc);
 
 	}
+	POut = out;
+	PosErr = err;
 }
 
 void DiffusionSDE::driftStep(const Vector3d &Pos, Vector3d &LinProp, double h) const {
@@ -271,6 +553,32 @@ void DiffusionSDE::driftStep(const Vector3d &Pos, Vector3d &LinProp, double h) c
 	return;
 }
 
+void DiffusionSDE::evaluateAdvection(const Vector3d &Pos, Vector3d &advection, double &divergence) const {
+	advection = Vector3d(0.);
+	divergence = 0.;
+	try {
+		advectionField->getFieldAndDivergence(Pos, advection, divergence);
+	}
+	catch (std::exception &e) {
+		KISS_LOG_ERROR 	<< "DiffusionSDE: Exception in advectionField::getFieldAndDivergence.\n"
+				<< e.what();
+		advection = Vector3d(0.);
+		divergence = 0.;
+	}
+}
+
+void DiffusionSDE::cool(Candidate *candidate, double divergence) const {
+	if (!candidate->isActive())
+		return;
+	double E = candidate->current.getEnergy(); // E = p c in the relativistic limit
+	double dEdt = -E / 3. * divergence;
+	double dt = candidate->getCurrentStep() / c_light;
+	candidate->current.setEnergy(E + dEdt * dt);
+	if (dEdt == 0)
+		return;
+	candidate->limitNextStep(coolingLimit * E / fabs(dEdt) * c_light);
+}
+
 void DiffusionSDE::calculateBTensor(double r, double BTen[], Vector3d pos, Vector3d dir, double z) const {
 
     double DifCoeff = scale * 6.1e24 * pow((std::abs(r) / 4.0e9), alpha);
@@ -326,6 +634,17 @@ void DiffusionSDE::setScale(double s) {
 	scale = s;
 }
 
+void DiffusionSDE::setAdaptiveSubsteps(bool adaptive) {
+	adaptiveSubsteps = adaptive;
+}
+
+void DiffusionSDE::setAdiabaticCooling(bool enable, double limit) {
+	if (enable && !advectionField)
+		throw std::runtime_error("DiffusionSDE: adiabatic cooling without advection field");
+	adiabaticCooling = enable;
+	coolingLimit = limit;
+}
+
 void DiffusionSDE::setMagneticField(ref_ptr<MagneticField> f) {
 	magneticField = f;
 }
@@ -358,6 +677,18 @@ double DiffusionSDE::getScale() const {
 	return scale;
 }
 
+bool DiffusionSDE::getAdaptiveSubsteps() const {
+	return adaptiveSubsteps;
+}
+
+bool DiffusionSDE::getAdiabaticCooling() const {
+	return adiabaticCooling;
+}
+
+double DiffusionSDE::getAdiabaticCoolingLimit() const {
+	return coolingLimit;
+}
+
 
 
 std::string DiffusionSDE::getDescription() const {
@@ -378,5 +709,10 @@ std::string DiffusionSDE::getDescription() const {
 	  s << "D_0: " << scale*6.1e24 << " m^2/s" << "\n";
 	  }
 
+	if (adiabaticCooling) {
+	  s << "adiabatic cooling, limit: " << coolingLimit << "\n";
+	  }
+
 	return s.str();
 }
+
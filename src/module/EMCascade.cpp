@@ -1,16 +1,20 @@
 #include "crpropa/module/EMCascade.h"
 #include "crpropa/Cosmology.h"
+#include "crpropa/PhotonPropagation.h"
 #include "crpropa/Units.h"
 
-#include "dint/DintEMCascade.h"
-
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <iomanip>
 #include <stdexcept>
+#include <algorithm>
 #include <cmath>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 namespace crpropa {
 
 EMCascade::EMCascade() : nE(170), logEmin(7), logEmax(24), dlogE(0.1) {
@@ -49,24 +53,25 @@ void EMCascade::process(Candidate *candidate) const {
 	double logE = log10(candidate->current.getEnergy() / eV);
 	double D = candidate->current.getPosition().getR();  // distance to (0,0,0)
 
-	if ((logE < logEmin) or (logE > logEmax))
+	if ((logE < logEmin) or (logE >= logEmax))
 		return;
-	if (D > Dmax)
+	if (D >= Dmax)
 		return;
 
-	int iE = (logE - logEmin) / dlogE;
-	int iD = D / dD;
+	int iE = std::min(int((logE - logEmin) / dlogE), nE - 1);
+	int iD = std::min(int(D / dD), nD - 1);
 	int i = (iD * nE) + iE;
 
-#pragma omp critical
-	{
+	// the bins are only incremented, atomically instead of serializing threads
+	uint64_t *bin;
 	if (id == 22)
-		photonHist[i] += 1;
+		bin = &photonHist[i];
 	else if (id == 11)
-		electronHist[i] += 1;
+		bin = &electronHist[i];
 	else
-		positronHist[i] += 1;
-	}
+		bin = &positronHist[i];
+#pragma omp atomic
+	*bin += 1;
 }
 
 void EMCascade::save(const std::string &filename) {
@@ -112,48 +117,32 @@ void EMCascade::load(const std::string &filename) {
 }
 
 void EMCascade::runCascade(const std::string &filename, int IRBFlag,
-		int RadioFlag, double Bfield, double cutCascade) {
-
-	// set up DINT
-	std::string dataPath = getDataPath("dint");
-	double B = Bfield / gauss;
-	double h = H0() * Mpc / 1000;
-	DintEMCascade dint(IRBFlag, RadioFlag, dataPath, B, h, omegaM(), omegaL());
+		int RadioFlag, double Bfield, double cutCascade, int nThreads) {
 
-	Spectrum inputSpectrum, outputSpectrum;
-	NewSpectrum(&inputSpectrum, nE);
-	NewSpectrum(&outputSpectrum, nE);
-	InitializeSpectrum(&outputSpectrum);
-
-	// step-wise cascade calculation
+	// injection of every nonempty distance bin, from bin center to bin center
+	std::vector<double> distances, injections;
 	for (int iD = nD - 1; iD >= 0; iD--) {
-		// make output of previous step the new input and reset output
-		SetSpectrum(&inputSpectrum, &outputSpectrum);
-		InitializeSpectrum(&outputSpectrum);
-
-		// add new particles to input
 		double count = 0;
 		for (int iE = 0; iE < nE; iE++) {
 			int i = (iD * nE) + iE;
-			inputSpectrum.spectrum[PHOTON][iE] += photonHist[i];
-			inputSpectrum.spectrum[ELECTRON][iE] += electronHist[i];
-			inputSpectrum.spectrum[POSITRON][iE] += positronHist[i];
-			count += inputSpectrum.spectrum[PHOTON][iE];
-			count += inputSpectrum.spectrum[ELECTRON][iE];
-			count += inputSpectrum.spectrum[POSITRON][iE];
+			count += photonHist[i] + electronHist[i] + positronHist[i];
 		}
-		// skip step if input spectrum empty
 		if (count == 0)
 			continue;
-
-		// start and stop distance [Mpc,light travel] from bin center to bin center
-		double D1 = comoving2LightTravelDistance( (iD + 0.5) * dD );
-		double D0 = comoving2LightTravelDistance( std::max((iD - 0.5) * dD, 0.) );
-
-		// propagate distance step
-		dint.propagate(D1/Mpc, D0/Mpc, &inputSpectrum, &outputSpectrum, cutCascade);
+		// start distance [Mpc,light travel]
+		distances.push_back(comoving2LightTravelDistance((iD + 0.5) * dD) / Mpc);
+		for (int s = 0; s < 3; s++) {
+			const std::vector<uint64_t> &hist = (s == 0) ? photonHist : ((s == 1) ? electronHist : positronHist);
+			for (int iE = 0; iE < nE; iE++)
+				injections.push_back(hist[(iD * nE) + iE]);
+		}
 	}
 
+	// cascade of the distance bins, in parallel segments
+	std::vector<double> outputSpectrum;
+	DintCascade(distances, injections, outputSpectrum, IRBFlag, RadioFlag,
+			Bfield, cutCascade, nThreads);
+
 	// write output
 	std::ofstream outfile(filename.c_str());
 	if (!outfile) {
@@ -165,7 +154,7 @@ void EMCascade::runCascade(const std::string &filename, int IRBFlag,
 	for (int iE = 0; iE < nE; iE++) {
 		outfile << std::setw(5) << logEmin + (iE + 0.5) * dlogE;
 		for (int s = 0; s < 3; s++)
-			outfile << std::setw(13) << outputSpectrum.spectrum[s][iE];
+			outfile << std::setw(13) << outputSpectrum[s * nE + iE];
 		outfile << "\n";
 	}
 	outfile.close();
@@ -174,9 +163,137 @@ void EMCascade::runCascade(const std::string &filename, int IRBFlag,
 	photonHist.assign(nD * nE, 0);
 	electronHist.assign(nD * nE, 0);
 	positronHist.assign(nD * nE, 0);
+}
+
+// further threads share the last weights and add atomically
+static const size_t CASCADE_THREADS = 256;
 
-	DeleteSpectrum(&outputSpectrum);
-	DeleteSpectrum(&inputSpectrum);
+EMCascadeResponse::EMCascadeResponse(const DintResponse &response,
+		double maxEnergy) :
+		response(response), threadWeights(CASCADE_THREADS) {
+	if (!response.isComputed())
+		throw std::runtime_error("EMCascadeResponse: table not computed or loaded");
+	setMaximumEnergy(maxEnergy);
+	clear();
+}
+
+void EMCascadeResponse::setMaximumEnergy(double energy) {
+	maxEnergy = energy;
+}
+
+double EMCascadeResponse::getMaximumEnergy() const {
+	return maxEnergy;
+}
+
+void EMCascadeResponse::process(Candidate *candidate) const {
+	int id = candidate->current.getId();
+	if ((id != 22) and (id != 11) and (id != -11))
+		return;
+	double E = candidate->current.getEnergy();
+	if (E >= maxEnergy)
+		return;
+
+	// node coordinate of the light travel distance
+	int nD = response.getNumberOfDistances();
+	double D = comoving2LightTravelDistance(candidate->current.getPosition().getR());
+	double x = D / response.getMaximumDistance() * nD;
+	if (x > nD)
+		return;
+	candidate->setActive(false);
+
+	int nE = DintResponse::getNumberOfEnergyBins();
+	double logE = log10(E / eV);
+	if ((logE < 7) or (logE >= 7 + 0.1 * nE))
+		return;
+	int species = (id == 22) ? 0 : ((id == 11) ? 1 : 2);
+	size_t j = species * nE + std::min(int((logE - 7) * 10), nE - 1);
+	int k = std::min(int(x), nD - 1);
+	double t = std::min(x - k, 1.);
+	double w = candidate->getWeight();
+	size_t m = 3 * nE;
+
+	size_t thread = 0;
+#ifdef _OPENMP
+	thread = omp_get_thread_num();
+#endif
+	if (thread >= CASCADE_THREADS - 1) {
+		// the last weights are shared and only changed atomically
+		NodeWeights &n = threadWeights[CASCADE_THREADS - 1];
+#pragma omp critical(EMCascadeResponse)
+		{
+			if (n.weights.empty())
+				n.weights.resize((nD + 1) * m, 0);
+		}
+		double *a = &n.weights[k * m + j];
+		double *b = &n.weights[(k + 1) * m + j];
+#pragma omp atomic
+		*a += (1 - t) * w;
+#pragma omp atomic
+		*b += t * w;
+		return;
+	}
+
+	NodeWeights &n = threadWeights[thread];
+	if (n.weights.empty())
+		n.weights.resize((nD + 1) * m, 0);
+	n.weights[k * m + j] += (1 - t) * w;
+	n.weights[(k + 1) * m + j] += t * w;
+}
+
+void EMCascadeResponse::merge() const {
+	for (size_t i = 0; i < threadWeights.size(); i++) {
+		NodeWeights &n = threadWeights[i];
+		for (size_t j = 0; j < n.weights.size(); j++)
+			mergedWeights[j] += n.weights[j];
+		std::vector<double>().swap(n.weights);
+	}
+}
+
+std::vector<double> EMCascadeResponse::getSpectrum() const {
+	merge();
+	std::vector<double> spectrum;
+	response.cascadeNodes(mergedWeights, spectrum);
+	return spectrum;
+}
+
+double EMCascadeResponse::getInjectedWeight() const {
+	merge();
+	double sum = 0;
+	for (size_t j = 0; j < mergedWeights.size(); j++)
+		sum += mergedWeights[j];
+	return sum;
+}
+
+void EMCascadeResponse::clear() {
+	for (size_t i = 0; i < threadWeights.size(); i++)
+		std::vector<double>().swap(threadWeights[i].weights);
+	mergedWeights.assign((response.getNumberOfDistances() + 1) * 3
+			* DintResponse::getNumberOfEnergyBins(), 0);
+}
+
+void EMCascadeResponse::save(const std::string &filename) const {
+	std::vector<double> spectrum = getSpectrum();
+	std::ofstream outfile(filename.c_str());
+	if (!outfile) {
+		std::stringstream s;
+		s << "EMCascadeResponse: could not open " << filename;
+		throw std::runtime_error(s.str());
+	}
+	int nE = DintResponse::getNumberOfEnergyBins();
+	outfile << "# log10(E/eV) photons electrons positrons\n";
+	for (int iE = 0; iE < nE; iE++) {
+		outfile << std::setw(5) << 7 + (iE + 0.5) * 0.1;
+		for (int s = 0; s < 3; s++)
+			outfile << std::setw(13) << spectrum[s * nE + iE];
+		outfile << "\n";
+	}
+}
+
+std::string EMCascadeResponse::getDescription() const {
+	std::stringstream s;
+	s << "EMCascadeResponse: below " << maxEnergy / EeV << " EeV, up to "
+			<< response.getMaximumDistance() / Mpc << " Mpc";
+	return s.str();
 }
 
 } // namespace crpropa
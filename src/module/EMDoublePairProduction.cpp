@@ -1,6 +1,8 @@
 #include "crpropa/module/EMDoublePairProduction.h"
+#include "crpropa/DataTable.h"
 #include "crpropa/Units.h"
 #include "crpropa/Random.h"
+#include "crpropa/Statistics.h"
 
 #include <fstream>
 #include <limits>
@@ -8,14 +10,19 @@
 
 namespace crpropa {
 
+// interaction statistics, see Statistics
+static const size_t interactions = Statistics::addCounter("EMDoublePairProduction: interactions");
+
 EMDoublePairProduction::EMDoublePairProduction(PhotonField photonField, bool haveElectrons, double limit) {
 	setPhotonField(photonField);
 	this->haveElectrons = haveElectrons;
 	this->limit = limit;
+	this->thinning = 0;
 }
 
 void EMDoublePairProduction::setPhotonField(PhotonField photonField) {
 	this->photonField = photonField;
+	scaling = new PhotonFieldScaling(photonField);
 	std::string fname = photonFieldName(photonField);
 	setDescription("EMDoublePairProduction: " + fname);
 	initRate(getDataPath("EMDoublePairProduction/rate_" + fname + ".txt"));
@@ -29,31 +36,32 @@ void EMDoublePairProduction::setLimit(double limit) {
 	this->limit = limit;
 }
 
-void EMDoublePairProduction::initRate(std::string filename) {
-	std::ifstream infile(filename.c_str());
+void EMDoublePairProduction::setThinning(double thinning) {
+	this->thinning = thinning;
+}
 
-	if (!infile.good())
+void EMDoublePairProduction::initRate(std::string filename) {
+	ref_ptr<DataTable> table = DataTable::open(filename);
+	if (!table.valid())
 		throw std::runtime_error("EMDoublePairProduction: could not open file " + filename);
 
 	// clear previously loaded interaction rates
 	tabEnergy.clear();
 	tabRate.clear();
 
-	while (infile.good()) {
-		if (infile.peek() != '#') {
-			double a, b;
-			infile >> a >> b;
-			if (infile) {
-				tabEnergy.push_back(pow(10, a) * eV);
-				tabRate.push_back(b / Mpc);
-			}
-		}
-		infile.ignore(std::numeric_limits < std::streamsize > ::max(), '\n');
+	for (size_t i = 0; i < table->size(); i++) {
+		if (table->rowSize(i) < 2)
+			throw std::runtime_error("EMDoublePairProduction: incomplete row in " + filename);
+		const double *row = table->row(i);
+		tabEnergy.push_back(pow(10, row[0]) * eV);
+		tabRate.push_back(row[1] / Mpc);
 	}
-	infile.close();
 }
 
 void EMDoublePairProduction::performInteraction(Candidate *candidate) const {
+	if (Statistics::isEnabled())
+		Statistics::count(interactions);
+
 	// the photon is lost in interaction
 	candidate->setActive(false);
 
@@ -69,14 +77,20 @@ void EMDoublePairProduction::performInteraction(Candidate *candidate) const {
 	Random &random = Random::instance();
 	Vector3d pos = random.randomInterpolatedPosition(candidate->previous.getPosition(), candidate->current.getPosition());
 
+	// thinning: keep either the electron or the positron, of equal energy
+	if (E < thinning * candidate->source.getEnergy()) {
+		candidate->addSecondary((random.rand() < 0.5) ? 11 : -11, Ee, pos, 2);
+		return;
+	}
+
 	candidate->addSecondary( 11, Ee, pos);
 	candidate->addSecondary(-11, Ee, pos);
 }
 
-void EMDoublePairProduction::process(Candidate *candidate) const {
+double EMDoublePairProduction::interactionRate(const Candidate *candidate) const {
 	// check if photon
 	if (candidate->current.getId() != 22)
-		return;
+		return 0;
 
 	// scale the electron energy instead of background photons
 	double z = candidate->getRedshift();
@@ -84,19 +98,34 @@ void EMDoublePairProduction::process(Candidate *candidate) const {
 
 	// check if in tabulated energy range
 	if (E < tabEnergy.front() or (E > tabEnergy.back()))
-		return;
+		return 0;
 
 	// interaction rate
-	double rate = interpolate(E, tabEnergy, tabRate);
-	rate *= pow(1 + z, 2) * photonFieldScaling(photonField, z);
+	double rate = tabEnergy.interpolate(E, tabRate);
+	rate *= pow(1 + z, 2) * scaling->scalingFactor(z);
+	return rate;
+}
+
+void EMDoublePairProduction::interact(Candidate *candidate) const {
+	performInteraction(candidate);
+}
+
+void EMDoublePairProduction::process(Candidate *candidate) const {
+	double rate = interactionRate(candidate) * getInteractionBias();
+	if (rate == 0)
+		return;
 
 	// check for interaction
 	Random &random = Random::instance();
 	double randDistance = -log(random.rand()) / rate;
 	if (candidate->getCurrentStep() > randDistance)
-		performInteraction(candidate);
+		interactBiased(candidate);
 	else
 		candidate->limitNextStep(limit / rate);
 }
 
+int EMDoublePairProduction::getParticleClasses() const {
+	return PhotonClass;
+}
+
 } // namespace crpropa
@@ -1,6 +1,8 @@
 #include "crpropa/module/EMInverseComptonScattering.h"
+#include "crpropa/DataTable.h"
 #include "crpropa/Units.h"
 #include "crpropa/Random.h"
+#include "crpropa/Statistics.h"
 #include "crpropa/Common.h"
 
 #include <fstream>
@@ -9,20 +11,28 @@
 
 namespace crpropa {
 
+// interaction statistics, see Statistics
+static const size_t interactions = Statistics::addCounter("EMInverseComptonScattering: interactions");
+
 static const double mec2 = mass_electron * c_squared;
 
 EMInverseComptonScattering::EMInverseComptonScattering(PhotonField photonField, bool havePhotons, double limit) {
+	// built now instead of at the first interaction
+	secondaryDistribution = ICSSecondariesEnergyDistribution::shared();
 	setPhotonField(photonField);
 	this->havePhotons = havePhotons;
 	this->limit = limit;
+	this->thinning = 0;
+	this->continuousEnergy = 0;
 }
 
 void EMInverseComptonScattering::setPhotonField(PhotonField photonField) {
 	this->photonField = photonField;
+	scaling = new PhotonFieldScaling(photonField);
 	std::string fname = photonFieldName(photonField);
 	setDescription("EMInverseComptonScattering: " + fname);
-	initRate(getDataPath("EMInverseComptonScattering/rate_" + fname + ".txt"));
-	initCumulativeRate(getDataPath("EMInverseComptonScattering/cdf_" + fname + ".txt"));
+	initRate(photonFieldTable(photonField, "EMInverseComptonScattering", "rate"));
+	initCumulativeRate(photonFieldTable(photonField, "EMInverseComptonScattering", "cdf"));
 }
 
 void EMInverseComptonScattering::setHavePhotons(bool havePhotons) {
@@ -33,138 +43,145 @@ void EMInverseComptonScattering::setLimit(double limit) {
 	this->limit = limit;
 }
 
-void EMInverseComptonScattering::initRate(std::string filename) {
-	std::ifstream infile(filename.c_str());
+void EMInverseComptonScattering::setThinning(double thinning) {
+	this->thinning = thinning;
+}
+
+void EMInverseComptonScattering::setContinuousEnergy(double energy) {
+	continuousEnergy = energy;
+}
+
+double EMInverseComptonScattering::getContinuousEnergy() const {
+	return continuousEnergy;
+}
 
-	if (!infile.good())
+void EMInverseComptonScattering::initRate(std::string filename) {
+	ref_ptr<DataTable> table = DataTable::open(filename);
+	if (!table.valid())
 		throw std::runtime_error("EMInverseComptonScattering: could not open file " + filename);
 
 	// clear previously loaded tables
 	tabEnergy.clear();
 	tabRate.clear();
 
-	while (infile.good()) {
-		if (infile.peek() != '#') {
-			double a, b;
-			infile >> a >> b;
-			if (infile) {
-				tabEnergy.push_back(pow(10, a) * eV);
-				tabRate.push_back(b / Mpc);
-			}
-		}
-		infile.ignore(std::numeric_limits < std::streamsize > ::max(), '\n');
+	for (size_t i = 0; i < table->size(); i++) {
+		if (table->rowSize(i) < 2)
+			throw std::runtime_error("EMInverseComptonScattering: incomplete row in " + filename);
+		const double *row = table->row(i);
+		tabEnergy.push_back(pow(10, row[0]) * eV);
+		tabRate.push_back(row[1] / Mpc);
 	}
-	infile.close();
 }
 
 void EMInverseComptonScattering::initCumulativeRate(std::string filename) {
-	std::ifstream infile(filename.c_str());
-
-	if (!infile.good())
+	ref_ptr<DataTable> table = DataTable::open(filename);
+	if (!table.valid())
 		throw std::runtime_error("EMInverseComptonScattering: could not open file " + filename);
 
 	// clear previously loaded tables
 	tabE.clear();
 	tabs.clear();
-	tabCDF.clear();
-	
-	// skip header
-	while (infile.peek() == '#')
-		infile.ignore(std::numeric_limits < std::streamsize > ::max(), '\n');
-
-	// read s values in first line
-	double a;
-	infile >> a; // skip first value
-	while (infile.good() and (infile.peek() != '\n')) {
-		infile >> a;
-		tabs.push_back(pow(10, a) * eV * eV);
+	tabCDF = AliasTable();
+	tabMeanLoss.clear();
+
+	// first row: s values (after one value that is skipped)
+	// following rows: E, cdf values
+	if (table->size() == 0)
+		throw std::runtime_error("EMInverseComptonScattering: no data in " + filename);
+	for (size_t j = 1; j < table->rowSize(0); j++)
+		tabs.push_back(pow(10, table->get(0, j)) * eV * eV);
+	std::vector<double> cdf; // the distributions of all energies, one table
+	for (size_t i = 1; i < table->size(); i++) {
+		if (table->rowSize(i) < 1 + tabs.size())
+			throw std::runtime_error("EMInverseComptonScattering: incomplete row in " + filename);
+		const double *row = table->row(i);
+		tabE.push_back(pow(10, row[0]) * eV);
+		for (size_t j = 0; j < tabs.size(); j++)
+			cdf.push_back(row[1 + j] / Mpc);
+
+		// mean s_kin of the distribution, for the continuous loss
+		const double *rowCDF = &cdf[cdf.size() - tabs.size()];
+		double sum = 0, last = 0;
+		for (size_t j = 0; j < tabs.size(); j++) {
+			sum += (rowCDF[j] - last) * tabs[j];
+			last = rowCDF[j];
+		}
+		tabMeanLoss.push_back((last > 0) ? sum / last / (2 * mec2 * mec2) : 0);
 	}
+	if (tabE.size() > 0)
+		tabCDF.setCDF(cdf, tabE.size());
+}
 
-	// read all following lines: E, cdf values
-	while (infile.good()) {
-		infile >> a;
-		if (!infile)
-			break;  // end of file
-		tabE.push_back(pow(10, a) * eV);
-		std::vector<double> cdf;
-		for (int i = 0; i < tabs.size(); i++) {
-			infile >> a;
-			cdf.push_back(a / Mpc);
+// differential cross-section, see Lee '96 (arXiv:9604098), eq. 23 for x = Ee'/Ee
+static double dSigmadE(double x, double beta) {
+	double q = ((1 - beta) / beta) * (1 - 1./x);
+	return ((1 + beta) / beta) * (x + 1./x + 2 * q + q * q);
+}
+
+// create the cumulative energy distribution of the up-scattered photon
+ICSSecondariesEnergyDistribution::ICSSecondariesEnergyDistribution() {
+	Ns = 1000;
+	Nrer = 1000;
+	s_min = mec2 * mec2;
+	s_max = 1e23 * eV * eV;
+	dls = (log(s_max) - log(s_min)) / Ns;
+
+	// tabulate s bin borders
+	s_values = std::vector<double>(Ns + 1);
+	for (size_t i = 0; i < Ns + 1; ++i)
+		s_values[i] = s_min * exp(i*dls);
+
+	// for each s tabulate cumulative differential cross section, independently
+	std::vector<double> cdf(Ns * Nrer);
+#pragma omp parallel for schedule(static)
+	for (int i = 0; i < int(Ns); i++) {
+		double s = s_min * exp((i+0.5) * dls);
+		double beta = (s - s_min) / (s + s_min);
+		double x0 = (1 - beta) / (1 + beta);
+		double dlx = -log(x0) / Nrer;
+
+		// cumulative midpoint integration
+		double *data_i = &cdf[i * Nrer];
+		data_i[0] = dSigmadE(x0, beta) * expm1(dlx);
+		for (size_t j = 1; j < Nrer; j++) {
+			double x = x0 * exp((j+0.5)*dlx);
+			double dx = exp((j+1)*dlx) - exp(j*dlx);
+			data_i[j] = dSigmadE(x, beta) * dx;
+			data_i[j] += data_i[j-1];
 		}
-		tabCDF.push_back(cdf);
 	}
-	infile.close();
-}
-
-// Class to calculate the energy distribution of the ICS photon and to sample from it
-class ICSSecondariesEnergyDistribution {
-	private:
-		std::vector< std::vector<double> > data;
-		std::vector<double> s_values;
-		size_t Ns;
-		size_t Nrer;
-		double s_min;
-		double s_max;
-		double dls;
-
-	public:
-		// differential cross-section, see Lee '96 (arXiv:9604098), eq. 23 for x = Ee'/Ee
-		double dSigmadE(double x, double beta) {
-			double q = ((1 - beta) / beta) * (1 - 1./x);
-			return ((1 + beta) / beta) * (x + 1./x + 2 * q + q * q);
-		}
+	data.setCDF(cdf, Ns);
+}
 
-		// create the cumulative energy distribution of the up-scattered photon
-		ICSSecondariesEnergyDistribution() {
-			Ns = 1000;
-			Nrer = 1000;
-			s_min = mec2 * mec2;
-			s_max = 1e23 * eV * eV;
-			dls = (log(s_max) - log(s_min)) / Ns;
-			data = std::vector< std::vector<double> >(1000, std::vector<double>(1000));
-			std::vector<double> data_i(1000);
-
-			// tabulate s bin borders
-			s_values = std::vector<double>(1001);
-			for (size_t i = 0; i < Ns + 1; ++i)
-				s_values[i] = s_min * exp(i*dls);
-
-
-			// for each s tabulate cumulative differential cross section
-			for (size_t i = 0; i < Ns; i++) {
-				double s = s_min * exp((i+0.5) * dls);
-				double beta = (s - s_min) / (s + s_min);
-				double x0 = (1 - beta) / (1 + beta);
-				double dlx = -log(x0) / Nrer;
-
-				// cumulative midpoint integration
-				data_i[0] = dSigmadE(x0, beta) * expm1(dlx);
-				for (size_t j = 1; j < Nrer; j++) {
-					double x = x0 * exp((j+0.5)*dlx);
-					double dx = exp((j+1)*dlx) - exp(j*dlx);
-					data_i[j] = dSigmadE(x, beta) * dx;
-					data_i[j] += data_i[j-1];
-				}
-				data[i] = data_i;
-			}
-		}
+ref_ptr<ICSSecondariesEnergyDistribution> ICSSecondariesEnergyDistribution::shared() {
+	static ref_ptr<ICSSecondariesEnergyDistribution> distribution;
+	ref_ptr<ICSSecondariesEnergyDistribution> d;
+#pragma omp critical(ICSSecondariesEnergyDistribution)
+	{
+		if (!distribution.valid())
+			distribution = new ICSSecondariesEnergyDistribution();
+		d = distribution;
+	}
+	return d;
+}
 
-		// draw random energy for the up-scattered photon Ep(Ee, s)
-		double sample(double Ee, double s) {
-			size_t idx = std::lower_bound(s_values.begin(), s_values.end(), s) - s_values.begin();
-			std::vector<double> s0 = data[idx];
-			Random &random = Random::instance();
-			size_t j = random.randBin(s0) + 1; // draw random bin (upper bin boundary returned)
-			double beta = (s - s_min) / (s + s_min);
-			double x0 = (1 - beta) / (1 + beta);
-			double dlx = -log(x0) / Nrer;
-			double binWidth = x0 * (exp(j*dlx) - exp((j-1)*dlx));
-			double Ep = (x0 * exp((j-1)*dlx) + binWidth) * Ee;
-			return std::min(Ee, Ep); // prevent Ep > Ee from numerical inaccuracies
-		}
-};
+// draw random energy for the up-scattered photon Ep(Ee, s)
+double ICSSecondariesEnergyDistribution::sample(double Ee, double s) const {
+	size_t idx = std::lower_bound(s_values.begin(), s_values.end(), s) - s_values.begin();
+	Random &random = Random::instance();
+	size_t j = random.randBin(data, idx) + 1; // draw random bin (upper bin boundary returned)
+	double beta = (s - s_min) / (s + s_min);
+	double x0 = (1 - beta) / (1 + beta);
+	double dlx = -log(x0) / Nrer;
+	double binWidth = x0 * (exp(j*dlx) - exp((j-1)*dlx));
+	double Ep = (x0 * exp((j-1)*dlx) + binWidth) * Ee;
+	return std::min(Ee, Ep); // prevent Ep > Ee from numerical inaccuracies
+}
 
 void EMInverseComptonScattering::performInteraction(Candidate *candidate) const {
+	if (Statistics::isEnabled())
+		Statistics::count(interactions);
+
 	// scale the particle energy instead of background photons
 	double z = candidate->getRedshift();
 	double E = candidate->current.getEnergy() * (1 + z);
@@ -174,18 +191,27 @@ void EMInverseComptonScattering::performInteraction(Candidate *candidate) const
 
 	// sample the value of s
 	Random &random = Random::instance();
-	size_t i = closestIndex(E, tabE);
-	size_t j = random.randBin(tabCDF[i]);
+	size_t i = tabE.closestIndex(E);
+	size_t j = random.randBin(tabCDF, i);
 	double s_kin = pow(10, log10(tabs[j]) + (random.rand() - 0.5) * 0.1);
 	double s = s_kin + mec2 * mec2;
 
 	// sample electron energy after scattering
-	static ICSSecondariesEnergyDistribution distribution;
-	double Enew = distribution.sample(E, s);
+	double Enew = secondaryDistribution->sample(E, s);
 
 	// add up-scattered photon
 	double Esecondary = E - Enew;
-	if (havePhotons) {
+	if (havePhotons and (candidate->current.getEnergy() < thinning * candidate->source.getEnergy())) {
+		// thinning: keep either the electron or the photon
+		double energies[2] = {Enew, Esecondary};
+		if (leadingParticle(energies, 2) == 0) {
+			candidate->setWeight(candidate->getWeight() * E / Enew);
+		} else {
+			Vector3d pos = random.randomInterpolatedPosition(candidate->previous.getPosition(), candidate->current.getPosition());
+			candidate->addSecondary(22, Esecondary / (1 + z), pos, E / Esecondary);
+			candidate->setActive(false);
+		}
+	} else if (havePhotons) {
 		Vector3d pos = random.randomInterpolatedPosition(candidate->previous.getPosition(), candidate->current.getPosition());
 		candidate->addSecondary(22, Esecondary / (1 + z), pos);
 	}
@@ -194,30 +220,74 @@ void EMInverseComptonScattering::performInteraction(Candidate *candidate) const
 	candidate->current.setEnergy(Enew / (1 + z));
 }
 
-void EMInverseComptonScattering::process(Candidate *candidate) const {
+double EMInverseComptonScattering::interactionRate(const Candidate *candidate) const {
 	// check if electron / positron
 	int id = candidate->current.getId();
 	if (id != 11 && id != -11)
-		return;
+		return 0;
 
 	// scale the particle energy instead of background photons
 	double z = candidate->getRedshift();
 	double E = (1 + z) * candidate->current.getEnergy();
 
 	if (E < tabEnergy.front() or (E > tabEnergy.back()))
-		return;
+		return 0;
 
 	// interaction rate
-	double rate = interpolate(E, tabEnergy, tabRate);
-	rate *= pow(1 + z, 2) * photonFieldScaling(photonField, z);
+	double rate = tabEnergy.interpolate(E, tabRate);
+	rate *= pow(1 + z, 2) * scaling->scalingFactor(z);
+	return rate;
+}
+
+void EMInverseComptonScattering::interact(Candidate *candidate) const {
+	performInteraction(candidate);
+}
+
+double EMInverseComptonScattering::meanEnergyLoss(const Candidate *candidate) const {
+	double E = candidate->current.getEnergy() * (1 + candidate->getRedshift());
+	if (E < tabE.front() or E > tabE.back())
+		return 0;
+	return tabE.interpolate(E, tabMeanLoss);
+}
+
+void EMInverseComptonScattering::processContinuous(Candidate *candidate, double rate) const {
+	double loss = rate * meanEnergyLoss(candidate); // inverse loss length
+	if (loss == 0)
+		return;
+	double E = candidate->current.getEnergy();
+	double step = candidate->getCurrentStep();
+	double Enew = E / (1 + loss * step); // dE/dx = -loss E, loss proportional to E
+	if (havePhotons) {
+		// macro-photon of the mean up-scattered energy, in the middle of the step
+		double Ephoton = meanEnergyLoss(candidate) * E;
+		Vector3d pos = (candidate->previous.getPosition() + candidate->current.getPosition()) / 2;
+		candidate->addSecondary(22, Ephoton, pos, (E - Enew) / Ephoton);
+	}
+	candidate->current.setEnergy(Enew);
+	candidate->limitNextStep(limit / loss);
+}
+
+void EMInverseComptonScattering::process(Candidate *candidate) const {
+	if (candidate->current.getEnergy() < continuousEnergy) {
+		processContinuous(candidate, interactionRate(candidate));
+		return;
+	}
+
+	double rate = interactionRate(candidate) * getInteractionBias();
+	if (rate == 0)
+		return;
 
 	// check for interaction
 	Random &random = Random::instance();
 	double randDistance = -log(random.rand()) / rate;
 	if (candidate->getCurrentStep() > randDistance)
-		performInteraction(candidate);
+		interactBiased(candidate);
 	else
 		candidate->limitNextStep(limit / rate);
 }
 
+int EMInverseComptonScattering::getParticleClasses() const {
+	return ElectronClass;
+}
+
 } // namespace crpropa
@@ -1,6 +1,8 @@
 #include "crpropa/module/EMPairProduction.h"
+#include "crpropa/DataTable.h"
 #include "crpropa/Units.h"
 #include "crpropa/Random.h"
+#include "crpropa/Statistics.h"
 
 #include <fstream>
 #include <limits>
@@ -9,160 +11,170 @@
 
 namespace crpropa {
 
+// interaction statistics, see Statistics
+static const size_t interactions = Statistics::addCounter("EMPairProduction: interactions");
+
 static const double mec2 = mass_electron * c_squared;
 
-EMPairProduction::EMPairProduction(PhotonField photonField, bool haveElectrons, double limit) : haveElectrons(haveElectrons), limit(limit) {
+EMPairProduction::EMPairProduction(PhotonField photonField, bool haveElectrons, double limit) : limit(limit), thinning(0), memory("EMPairProduction") {
 	setPhotonField(photonField);
+	setHaveElectrons(haveElectrons);
 }
 
 void EMPairProduction::setPhotonField(PhotonField photonField) {
 	this->photonField = photonField;
+	scaling = new PhotonFieldScaling(photonField);
 	std::string fname = photonFieldName(photonField);
 	setDescription("EMPairProduction: " + fname);
-	initRate(getDataPath("EMPairProduction/rate_" + fname + ".txt"));
-	initCumulativeRate(getDataPath("EMPairProduction/cdf_" + fname + ".txt"));
+	initRate(photonFieldTable(photonField, "EMPairProduction", "rate"));
+	initCumulativeRate(photonFieldTable(photonField, "EMPairProduction", "cdf"));
 }
 
 void EMPairProduction::setHaveElectrons(bool haveElectrons) {
 	this->haveElectrons = haveElectrons;
+	// build the secondary energy distribution now instead of at the first interaction
+	if (haveElectrons and !secondaryDistribution.valid())
+		secondaryDistribution = PPSecondariesEnergyDistribution::shared();
 }
 
 void EMPairProduction::setLimit(double limit) {
 	this->limit = limit;
 }
 
-void EMPairProduction::initRate(std::string filename) {
-	std::ifstream infile(filename.c_str());
+void EMPairProduction::setThinning(double thinning) {
+	this->thinning = thinning;
+}
 
-	if (!infile.good())
+void EMPairProduction::initRate(std::string filename) {
+	ref_ptr<DataTable> table = DataTable::open(filename);
+	if (!table.valid())
 		throw std::runtime_error("EMPairProduction: could not open file " + filename);
 
 	// clear previously loaded interaction rates
 	tabEnergy.clear();
 	tabRate.clear();
 
-	while (infile.good()) {
-		if (infile.peek() != '#') {
-			double a, b;
-			infile >> a >> b;
-			if (infile) {
-				tabEnergy.push_back(pow(10, a) * eV);
-				tabRate.push_back(b / Mpc);
-			}
-		}
-		infile.ignore(std::numeric_limits < std::streamsize > ::max(), '\n');
+	for (size_t i = 0; i < table->size(); i++) {
+		if (table->rowSize(i) < 2)
+			throw std::runtime_error("EMPairProduction: incomplete row in " + filename);
+		const double *row = table->row(i);
+		tabEnergy.push_back(pow(10, row[0]) * eV);
+		tabRate.push_back(row[1] / Mpc);
 	}
-	infile.close();
+	updateMemory();
 }
 
 void EMPairProduction::initCumulativeRate(std::string filename) {
-	std::ifstream infile(filename.c_str());
-
-	if (!infile.good())
+	ref_ptr<DataTable> table = DataTable::open(filename);
+	if (!table.valid())
 		throw std::runtime_error("EMPairProduction: could not open file " + filename);
 
 	// clear previously loaded tables
 	tabE.clear();
 	tabs.clear();
-	tabCDF.clear();
-	
-	// skip header
-	while (infile.peek() == '#')
-		infile.ignore(std::numeric_limits < std::streamsize > ::max(), '\n');
-
-	// read s values in first line
-	double a;
-	infile >> a; // skip first value
-	while (infile.good() and (infile.peek() != '\n')) {
-		infile >> a;
-		tabs.push_back(pow(10, a) * eV * eV);
+	tabCDF = AliasTable();
+
+	// first row: s values (after one value that is skipped)
+	// following rows: E, cdf values
+	if (table->size() == 0)
+		throw std::runtime_error("EMPairProduction: no data in " + filename);
+	for (size_t j = 1; j < table->rowSize(0); j++)
+		tabs.push_back(pow(10, table->get(0, j)) * eV * eV);
+	std::vector<double> cdf; // the distributions of all energies, one table
+	for (size_t i = 1; i < table->size(); i++) {
+		if (table->rowSize(i) < 1 + tabs.size())
+			throw std::runtime_error("EMPairProduction: incomplete row in " + filename);
+		const double *row = table->row(i);
+		tabE.push_back(pow(10, row[0]) * eV);
+		for (size_t j = 0; j < tabs.size(); j++)
+			cdf.push_back(row[1 + j] / Mpc);
 	}
+	if (tabE.size() > 0)
+		tabCDF.setCDF(cdf, tabE.size());
+	updateMemory();
+}
+
+void EMPairProduction::updateMemory() {
+	memory.set((tabEnergy.size() + tabRate.size() + tabE.size() + tabs.size())
+			* sizeof(double) + tabCDF.getMemory());
+}
 
-	// read all following lines: E, cdf values
-	while (infile.good()) {
-		infile >> a;
-		if (!infile)
-			break;  // end of file
-		tabE.push_back(pow(10, a) * eV);
-		std::vector<double> cdf;
-		for (int i = 0; i < tabs.size(); i++) {
-			infile >> a;
-			cdf.push_back(a / Mpc);
+// differential cross section for pair production for x = Epositron/Egamma, compare Lee 96 arXiv:9604098
+static double dSigmadE_PPx(double x, double beta) {
+	double A = (x / (1. - x) + (1. - x) / x );
+	double B =  (1. / x + 1. / (1. - x) );
+	double y = (1 - beta * beta);
+	return A + y * B - y * y / 4 * B * B;
+}
+
+PPSecondariesEnergyDistribution::PPSecondariesEnergyDistribution() :
+		memory("EMPairProduction") {
+	N = 1000;
+	size_t Ns = 1000;
+	double s_min = 4 * mec2 * mec2;
+	double s_max = 1e23 * eV * eV;
+	double dls = log(s_max / s_min) / Ns;
+	tab_s = std::vector<double>(Ns + 1);
+
+	for (size_t i = 0; i < Ns + 1; ++i)
+		tab_s[i] = s_min * exp(i*dls); // tabulate s bin borders
+
+	// the distributions of different s are independent
+	std::vector<double> cdf(Ns * N);
+#pragma omp parallel for schedule(static)
+	for (int i = 0; i < int(Ns); i++) {
+		double s = s_min * exp(i*dls + 0.5*dls);
+		double beta = sqrt(1 - s_min/s);
+		double x0 = (1 - beta) / 2;
+		double dx = log((1 + beta) / (1 - beta)) / N;
+
+		// cumulative midpoint integration
+		double *data_i = &cdf[i * N];
+		data_i[0] = dSigmadE_PPx(x0, beta) * expm1(dx);
+		for (size_t j = 1; j < N; j++) {
+			double x = x0 * exp(j*dx + 0.5*dx);
+			double binWidth = exp((j+1)*dx)-exp(j*dx);
+			data_i[j] = dSigmadE_PPx(x, beta) * binWidth + data_i[j-1];
 		}
-		tabCDF.push_back(cdf);
 	}
-	infile.close();
-}
-
-// Hold an data array to interpolate the energy distribution on
-class PPSecondariesEnergyDistribution {
-	private:
-		std::vector<double> tab_s;
-		std::vector< std::vector<double> > data;
-		size_t N;
-
-	public:
-		// differential cross section for pair production for x = Epositron/Egamma, compare Lee 96 arXiv:9604098
-		double dSigmadE_PPx(double x, double beta) {
-			double A = (x / (1. - x) + (1. - x) / x );
-			double B =  (1. / x + 1. / (1. - x) );
-			double y = (1 - beta * beta);
-			return A + y * B - y * y / 4 * B * B;
-		}
+	data.setCDF(cdf, Ns);
+	memory.set(tab_s.size() * sizeof(double) + data.getMemory());
+}
 
-		PPSecondariesEnergyDistribution() {
-			N = 1000;
-			size_t Ns = 1000;
-			double s_min = 4 * mec2 * mec2;
-			double s_max = 1e23 * eV * eV;
-			double dls = log(s_max / s_min) / Ns;
-			data = std::vector< std::vector<double> >(Ns, std::vector<double>(N));
-			tab_s = std::vector<double>(Ns + 1);
-
-			for (size_t i = 0; i < Ns + 1; ++i)
-				tab_s[i] = s_min * exp(i*dls); // tabulate s bin borders
-
-			for (size_t i = 0; i < Ns; i++) {
-				double s = s_min * exp(i*dls + 0.5*dls);
-				double beta = sqrt(1 - s_min/s);
-				double x0 = (1 - beta) / 2;
-				double dx = log((1 + beta) / (1 - beta)) / N;
-
-				// cumulative midpoint integration
-				std::vector<double> data_i(1000);
-				data_i[0] = dSigmadE_PPx(x0, beta) * expm1(dx);
-				for (size_t j = 1; j < N; j++) {
-					double x = x0 * exp(j*dx + 0.5*dx);
-					double binWidth = exp((j+1)*dx)-exp(j*dx);
-					data_i[j] = dSigmadE_PPx(x, beta) * binWidth + data_i[j-1];
-				}
-				data[i] = data_i;
-			}
-		}
+ref_ptr<PPSecondariesEnergyDistribution> PPSecondariesEnergyDistribution::shared() {
+	static ref_ptr<PPSecondariesEnergyDistribution> distribution;
+	ref_ptr<PPSecondariesEnergyDistribution> d;
+#pragma omp critical(PPSecondariesEnergyDistribution)
+	{
+		if (!distribution.valid())
+			distribution = new PPSecondariesEnergyDistribution();
+		d = distribution;
+	}
+	return d;
+}
 
-		// sample positron energy from cdf(E, s_kin)
-		double sample(double E0, double s) {
-			// get distribution for given s
-			size_t idx = std::lower_bound(tab_s.begin(), tab_s.end(), s) - tab_s.begin();
-			std::vector<double> s0 = data[idx];
-
-			// draw random bin
-			Random &random = Random::instance();
-			size_t j = random.randBin(s0) + 1;
-
-			double s_min = 4 * mec2 * mec2;
-			double beta = sqrt(1 - s_min / s);
-			double x0 = (1 - beta) / 2.;
-			double dx = log((1 + beta) / (1 - beta)) / N;
-			double binWidth = x0 * (exp(j*dx) - exp((j-1)*dx));
-			if (random.rand() < 0.5)
-				return E0 * (x0 * exp((j-1) * dx) + binWidth);
-			else
-				return E0 * (1 - (x0 * exp((j-1) * dx) + binWidth));
-		}
-};
+double PPSecondariesEnergyDistribution::sample(double E0, double s) const {
+	// get distribution for given s
+	size_t idx = std::lower_bound(tab_s.begin(), tab_s.end(), s) - tab_s.begin();
+	// draw random bin
+	Random &random = Random::instance();
+	size_t j = random.randBin(data, idx) + 1;
+
+	double s_min = 4 * mec2 * mec2;
+	double beta = sqrt(1 - s_min / s);
+	double x0 = (1 - beta) / 2.;
+	double dx = log((1 + beta) / (1 - beta)) / N;
+	double binWidth = x0 * (exp(j*dx) - exp((j-1)*dx));
+	if (random.rand() < 0.5)
+		return E0 * (x0 * exp((j-1) * dx) + binWidth);
+	else
+		return E0 * (1 - (x0 * exp((j-1) * dx) + binWidth));
+}
 
 void EMPairProduction::performInteraction(Candidate *candidate) const {
+	if (Statistics::isEnabled())
+		Statistics::count(interactions);
+
 	// scale particle energy instead of background photon energy
 	double z = candidate->getRedshift();
 	double E = candidate->current.getEnergy() * (1 + z);
@@ -180,27 +192,35 @@ void EMPairProduction::performInteraction(Candidate *candidate) const {
 
 	// sample the value of s
 	Random &random = Random::instance();
-	size_t i = closestIndex(E, tabE);  // find closest tabulation point
-	size_t j = random.randBin(tabCDF[i]);
+	size_t i = tabE.closestIndex(E);  // find closest tabulation point
+	size_t j = random.randBin(tabCDF, i);
 	double lo = std::max(4 * mec2 * mec2, tabs[j-1]);  // first s-tabulation point below min(s_kin) = (2 me c^2)^2; ensure physical value
 	double hi = tabs[j];
 	double s = lo + random.rand() * (hi - lo);
 
 	// sample electron / positron energy
-	static PPSecondariesEnergyDistribution interpolation;
-	double Ee = interpolation.sample(E, s);
+	double Ee = secondaryDistribution->sample(E, s);
 	double Ep = E - Ee;
 
 	// sample random position along current step
 	Vector3d pos = random.randomInterpolatedPosition(candidate->previous.getPosition(), candidate->current.getPosition());
+
+	// thinning: keep either the electron or the positron
+	if (candidate->current.getEnergy() < thinning * candidate->source.getEnergy()) {
+		double energies[2] = {Ee, Ep};
+		size_t i = leadingParticle(energies, 2);
+		candidate->addSecondary((i == 0) ? -11 : 11, energies[i] / (1 + z), pos, E / energies[i]);
+		return;
+	}
+
 	candidate->addSecondary(-11, Ee / (1 + z), pos);
 	candidate->addSecondary(11, Ep / (1 + z), pos);
 }
 
-void EMPairProduction::process(Candidate *candidate) const {
+double EMPairProduction::interactionRate(const Candidate *candidate) const {
 	// check if photon
 	if (candidate->current.getId() != 22)
-		return;
+		return 0;
 
 	// scale particle energy instead of background photon energy
 	double z = candidate->getRedshift();
@@ -208,19 +228,34 @@ void EMPairProduction::process(Candidate *candidate) const {
 
 	// check if in tabulated energy range
 	if (E < tabEnergy.front() or (E > tabEnergy.back()))
-		return;
+		return 0;
 
 	// interaction rate
-	double rate = interpolate(E, tabEnergy, tabRate);
-	rate *= pow(1 + z, 2) * photonFieldScaling(photonField, z);
+	double rate = tabEnergy.interpolate(E, tabRate);
+	rate *= pow(1 + z, 2) * scaling->scalingFactor(z);
+	return rate;
+}
+
+void EMPairProduction::interact(Candidate *candidate) const {
+	performInteraction(candidate);
+}
+
+void EMPairProduction::process(Candidate *candidate) const {
+	double rate = interactionRate(candidate) * getInteractionBias();
+	if (rate == 0)
+		return;
 
 	// check for interaction
 	Random &random = Random::instance();
 	double randDistance = -log(random.rand()) / rate;
 	if (candidate->getCurrentStep() > randDistance)
-		performInteraction(candidate);
+		interactBiased(candidate);
 	else
 		candidate->limitNextStep(limit / rate);
 }
 
+int EMPairProduction::getParticleClasses() const {
+	return PhotonClass;
+}
+
 } // namespace crpropa
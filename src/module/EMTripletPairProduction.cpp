@@ -1,6 +1,8 @@
 #include "crpropa/module/EMTripletPairProduction.h"
+#include "crpropa/DataTable.h"
 #include "crpropa/Units.h"
 #include "crpropa/Random.h"
+#include "crpropa/Statistics.h"
 
 #include <fstream>
 #include <limits>
@@ -8,16 +10,21 @@
 
 namespace crpropa {
 
+// interaction statistics, see Statistics
+static const size_t interactions = Statistics::addCounter("EMTripletPairProduction: interactions");
+
 static const double mec2 = mass_electron * c_squared;
 
 EMTripletPairProduction::EMTripletPairProduction(PhotonField photonField, bool haveElectrons, double limit) {
 	setPhotonField(photonField);
 	this->haveElectrons = haveElectrons;
 	this->limit = limit;
+	this->thinning = 0;
 }
 
 void EMTripletPairProduction::setPhotonField(PhotonField photonField) {
 	this->photonField = photonField;
+	scaling = new PhotonFieldScaling(photonField);
 	std::string fname = photonFieldName(photonField);
 	setDescription("EMTripletPairProduction: " + fname);
 	initRate(getDataPath("EMTripletPairProduction/rate_" + fname + ".txt"));
@@ -32,71 +39,61 @@ void EMTripletPairProduction::setLimit(double limit) {
 	this->limit = limit;
 }
 
-void EMTripletPairProduction::initRate(std::string filename) {
-	std::ifstream infile(filename.c_str());
+void EMTripletPairProduction::setThinning(double thinning) {
+	this->thinning = thinning;
+}
 
-	if (!infile.good())
+void EMTripletPairProduction::initRate(std::string filename) {
+	ref_ptr<DataTable> table = DataTable::open(filename);
+	if (!table.valid())
 		throw std::runtime_error("EMTripletPairProduction: could not open file " + filename);
 
 	// clear previously loaded interaction rates
 	tabEnergy.clear();
 	tabRate.clear();
 
-	while (infile.good()) {
-		if (infile.peek() != '#') {
-			double a, b;
-			infile >> a >> b;
-			if (infile) {
-				tabEnergy.push_back(pow(10, a) * eV);
-				tabRate.push_back(b / Mpc);
-			}
-		}
-		infile.ignore(std::numeric_limits < std::streamsize > ::max(), '\n');
+	for (size_t i = 0; i < table->size(); i++) {
+		if (table->rowSize(i) < 2)
+			throw std::runtime_error("EMTripletPairProduction: incomplete row in " + filename);
+		const double *row = table->row(i);
+		tabEnergy.push_back(pow(10, row[0]) * eV);
+		tabRate.push_back(row[1] / Mpc);
 	}
-	infile.close();
 }
 
 void EMTripletPairProduction::initCumulativeRate(std::string filename) {
-	std::ifstream infile(filename.c_str());
-
-	if (!infile.good())
-		throw std::runtime_error(
-				"EMTripletPairProduction: could not open file " + filename);
+	ref_ptr<DataTable> table = DataTable::open(filename);
+	if (!table.valid())
+		throw std::runtime_error("EMTripletPairProduction: could not open file " + filename);
 
 	// clear previously loaded tables
 	tabE.clear();
 	tabs.clear();
-	tabCDF.clear();
-	
-	// skip header
-	while (infile.peek() == '#')
-		infile.ignore(std::numeric_limits < std::streamsize > ::max(), '\n');
-
-	// read s values in first line
-	double a;
-	infile >> a; // skip first value
-	while (infile.good() and (infile.peek() != '\n')) {
-		infile >> a;
-		tabs.push_back(pow(10, a) * eV * eV);
-	}
-
-	// read all following lines: E, cdf values
-	while (infile.good()) {
-		infile >> a;
-		if (!infile)
-			break;  // end of file
-		tabE.push_back(pow(10, a) * eV);
-		std::vector<double> cdf;
-		for (int i = 0; i < tabs.size(); i++) {
-			infile >> a;
-			cdf.push_back(a / Mpc);
-		}
-		tabCDF.push_back(cdf);
+	tabCDF = AliasTable();
+
+	// first row: s values (after one value that is skipped)
+	// following rows: E, cdf values
+	if (table->size() == 0)
+		throw std::runtime_error("EMTripletPairProduction: no data in " + filename);
+	for (size_t j = 1; j < table->rowSize(0); j++)
+		tabs.push_back(pow(10, table->get(0, j)) * eV * eV);
+	std::vector<double> cdf; // the distributions of all energies, one table
+	for (size_t i = 1; i < table->size(); i++) {
+		if (table->rowSize(i) < 1 + tabs.size())
+			throw std::runtime_error("EMTripletPairProduction: incomplete row in " + filename);
+		const double *row = table->row(i);
+		tabE.push_back(pow(10, row[0]) * eV);
+		for (size_t j = 0; j < tabs.size(); j++)
+			cdf.push_back(row[1 + j] / Mpc);
 	}
-	infile.close();
+	if (tabE.size() > 0)
+		tabCDF.setCDF(cdf, tabE.size());
 }
 
 void EMTripletPairProduction::performInteraction(Candidate *candidate) const {
+	if (Statistics::isEnabled())
+		Statistics::count(interactions);
+
 	// scale the particle energy instead of background photons
 	double z = candidate->getRedshift();
 	double E = candidate->current.getEnergy() * (1 + z);
@@ -106,8 +103,8 @@ void EMTripletPairProduction::performInteraction(Candidate *candidate) const {
 
 	// sample the value of eps
 	Random &random = Random::instance();
-	size_t i = closestIndex(E, tabE);
-	size_t j = random.randBin(tabCDF[i]);
+	size_t i = tabE.closestIndex(E);
+	size_t j = random.randBin(tabCDF, i);
 	double s_kin = pow(10, log10(tabs[j]) + (random.rand() - 0.5) * 0.1);
 	double eps = s_kin / 4 / E; // random background photon energy
 
@@ -116,7 +113,18 @@ void EMTripletPairProduction::performInteraction(Candidate *candidate) const {
 	// For our purposes, me << E0 --> p0~E0 --> alpha = E0*eps*(costheta - 1) >= 100
 	double Epp = 5.7e-1 * pow(eps/mec2, -0.56) * pow(E/mec2, 0.44) * mec2;
 
-	if (haveElectrons) {
+	if (haveElectrons and (candidate->current.getEnergy() < thinning * candidate->source.getEnergy())) {
+		// thinning: keep either the primary, the electron or the positron
+		double energies[3] = {E - 2 * Epp, Epp, Epp};
+		size_t k = leadingParticle(energies, 3);
+		if (k == 0) {
+			candidate->setWeight(candidate->getWeight() * E / energies[0]);
+		} else {
+			Vector3d pos = random.randomInterpolatedPosition(candidate->previous.getPosition(), candidate->current.getPosition());
+			candidate->addSecondary((k == 1) ? 11 : -11, Epp, pos, E / Epp);
+			candidate->setActive(false);
+		}
+	} else if (haveElectrons) {
 		Vector3d pos = random.randomInterpolatedPosition(candidate->previous.getPosition(), candidate->current.getPosition());
 		candidate->addSecondary( 11, Epp, pos);
 		candidate->addSecondary(-11, Epp, pos);
@@ -126,11 +134,11 @@ void EMTripletPairProduction::performInteraction(Candidate *candidate) const {
 	candidate->current.setEnergy((E - 2 * Epp));
 }
 
-void EMTripletPairProduction::process(Candidate *candidate) const {
+double EMTripletPairProduction::interactionRate(const Candidate *candidate) const {
 	// check if electron / positron
 	int id = candidate->current.getId();
 	if (abs(id) != 11)
-		return;
+		return 0;
 
 	// scale the particle energy instead of background photons
 	double z = candidate->getRedshift();
@@ -138,19 +146,34 @@ void EMTripletPairProduction::process(Candidate *candidate) const {
 
 	// check if in tabulated energy range
 	if (E < tabEnergy.front() or (E > tabEnergy.back()))
-		return;
+		return 0;
 
 	// cosmological scaling of interaction distance (comoving)
-	double scaling = pow(1 + z, 2) * photonFieldScaling(photonField, z);
-	double rate = scaling * interpolate(E, tabEnergy, tabRate);
+	double rate = tabEnergy.interpolate(E, tabRate);
+	rate *= pow(1 + z, 2) * scaling->scalingFactor(z);
+	return rate;
+}
+
+void EMTripletPairProduction::interact(Candidate *candidate) const {
+	performInteraction(candidate);
+}
+
+void EMTripletPairProduction::process(Candidate *candidate) const {
+	double rate = interactionRate(candidate) * getInteractionBias();
+	if (rate == 0)
+		return;
 
 	// check for interaction
 	Random &random = Random::instance();
 	double randDistance = -log(random.rand()) / rate;
 	if (candidate->getCurrentStep() > randDistance)
-		performInteraction(candidate);
+		interactBiased(candidate);
 	else
 		candidate->limitNextStep(limit / rate);
 }
 
+int EMTripletPairProduction::getParticleClasses() const {
+	return ElectronClass;
+}
+
 } // namespace crpropa
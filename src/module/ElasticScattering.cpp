@@ -1,8 +1,10 @@
 #include "crpropa/module/ElasticScattering.h"
+#include "crpropa/DataTable.h"
 #include "crpropa/Units.h"
 #include "crpropa/ParticleID.h"
 #include "crpropa/ParticleMass.h"
 #include "crpropa/Random.h"
+#include "crpropa/Statistics.h"
 
 #include <cmath>
 #include <limits>
@@ -12,6 +14,9 @@
 
 namespace crpropa {
 
+// interaction statistics, see Statistics
+static const size_t interactions = Statistics::addCounter("ElasticScattering: interactions");
+
 const double ElasticScattering::lgmin = 6.;  // minimum log10(Lorentz-factor)
 const double ElasticScattering::lgmax = 14.; // maximum log10(Lorentz-factor)
 const size_t ElasticScattering::nlg = 201;   // number of Lorentz-factor steps
@@ -25,6 +30,7 @@ ElasticScattering::ElasticScattering(PhotonField f) {
 
 void ElasticScattering::setPhotonField(PhotonField photonField) {
 	this->photonField = photonField;
+	scaling = new PhotonFieldScaling(photonField);
 	std::string fname = photonFieldName(photonField);
 	setDescription("ElasticScattering: " + fname);
 	initRate(getDataPath("ElasticScattering/rate_" + fname.substr(0,3) + ".txt"));
@@ -32,51 +38,35 @@ void ElasticScattering::setPhotonField(PhotonField photonField) {
 }
 
 void ElasticScattering::initRate(std::string filename) {
-	std::ifstream infile(filename.c_str());
-	if (not infile.good())
+	ref_ptr<DataTable> table = DataTable::open(filename);
+	if (!table.valid())
 		throw std::runtime_error("ElasticScattering: could not open file " + filename);
 
 	tabRate.clear();
 
-	while (infile.good()) {
-		if (infile.peek() == '#') {
-			infile.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-			continue;
-		}
-		double r;
-		infile >> r;
-		if (!infile)
-			break;
-		tabRate.push_back(r / Mpc);
-	}
-
-	infile.close();
+	// all values, independent of the line breaks
+	for (size_t i = 0; i < table->size(); i++)
+		for (size_t j = 0; j < table->rowSize(i); j++)
+			tabRate.push_back(table->get(i, j) / Mpc);
 }
 
 void ElasticScattering::initCDF(std::string filename) {
-	std::ifstream infile(filename.c_str());
-	if (not infile.good())
+	ref_ptr<DataTable> table = DataTable::open(filename);
+	if (!table.valid())
 		throw std::runtime_error("ElasticScattering: could not open file " + filename);
 
-	tabCDF.clear();
-	std::string line;
-	double a;
-	while (std::getline(infile, line)) {
-		if (line[0] == '#')
-			continue;
-
-		std::stringstream lineStream(line);
-		lineStream >> a;
-
-		std::vector<double> cdf(neps);
-		for (size_t i = 0; i < neps; i++) {
-			lineStream >> a;
-			cdf[i] = a;
-		}
-		tabCDF.push_back(cdf);
-	}
+	tabCDF = AliasTable();
 
-	infile.close();
+	// rows: one value that is skipped, cdf values; all rows in one table
+	std::vector<double> cdf;
+	for (size_t i = 0; i < table->size(); i++) {
+		if (table->rowSize(i) < 1 + neps)
+			throw std::runtime_error("ElasticScattering: incomplete row in " + filename);
+		const double *row = table->row(i);
+		cdf.insert(cdf.end(), row + 1, row + 1 + neps);
+	}
+	if (table->size() > 0)
+		tabCDF.setCDF(cdf, table->size());
 }
 
 void ElasticScattering::process(Candidate *candidate) const {
@@ -99,17 +89,19 @@ void ElasticScattering::process(Candidate *candidate) const {
 
 		double rate = interpolateEquidistant(lg, lgmin, lgmax, tabRate);
 		rate *= Z * N / double(A);  // TRK scaling
-		rate *= pow(1 + z, 2) * photonFieldScaling(photonField, z);  // cosmological scaling
+		rate *= pow(1 + z, 2) * scaling->scalingFactor(z);  // cosmological scaling
 
 		// check for interaction
 		Random &random = Random::instance();
 		double randDist = -log(random.rand()) / rate;
 		if (step < randDist)
 			return;
+		if (Statistics::isEnabled())
+			Statistics::count(interactions);
 
 		// draw random background photon energy from CDF
 		size_t i = floor((lg - lgmin) / (lgmax - lgmin) * (nlg - 1)); // index of closest gamma tabulation point
-		size_t j = random.randBin(tabCDF[i]) - 1; // index of next lower tabulated eps value
+		size_t j = random.randBin(tabCDF, i) - 1; // index of next lower tabulated eps value
 		double binWidth = (epsmax - epsmin) / (neps - 1); // logarithmic bin width
 		double eps = pow(10, epsmin + (j + random.rand()) * binWidth);
 
@@ -125,4 +117,8 @@ void ElasticScattering::process(Candidate *candidate) const {
 	}
 }
 
+int ElasticScattering::getParticleClasses() const {
+	return NucleiClasses;
+}
+
 } // namespace crpropa
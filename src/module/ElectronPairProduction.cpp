@@ -1,4 +1,5 @@
 #include "crpropa/module/ElectronPairProduction.h"
+#include "crpropa/DataTable.h"
 #include "crpropa/Units.h"
 #include "crpropa/ParticleID.h"
 #include "crpropa/ParticleMass.h"
@@ -10,15 +11,21 @@
 
 namespace crpropa {
 
+// pair energy and number of steps accumulated for the next weighted pair
+static const PropertyKey PAIRENERGY("ElectronPairProduction.pairEnergy");
+static const PropertyKey PAIRSTEPS("ElectronPairProduction.pairSteps");
+
 ElectronPairProduction::ElectronPairProduction(PhotonField photonField,
 		bool haveElectrons, double limit) {
 	setPhotonField(photonField);
 	this->haveElectrons = haveElectrons;
 	this->limit = limit;
+	secondaryInterval = 1;
 }
 
 void ElectronPairProduction::setPhotonField(PhotonField photonField) {
 	this->photonField = photonField;
+	scaling = new PhotonFieldScaling(photonField);
 	std::string fname = photonFieldName(photonField);
 	setDescription("ElectronPairProduction: " + fname);
 	initRate(getDataPath("ElectronPairProduction/lossrate_" + fname + ".txt"));
@@ -33,48 +40,64 @@ void ElectronPairProduction::setLimit(double limit) {
 	this->limit = limit;
 }
 
-void ElectronPairProduction::initRate(std::string filename) {
-	std::ifstream infile(filename.c_str());
+void ElectronPairProduction::setSecondaryInterval(int n) {
+	if (n < 1)
+		throw std::runtime_error("ElectronPairProduction: secondary interval < 1");
+	secondaryInterval = n;
+}
+
+int ElectronPairProduction::getSecondaryInterval() const {
+	return secondaryInterval;
+}
 
-	if (!infile.good())
+void ElectronPairProduction::initRate(std::string filename) {
+	ref_ptr<DataTable> table = DataTable::open(filename);
+	if (!table.valid())
 		throw std::runtime_error("ElectronPairProduction: could not open file " + filename);
 
 	// clear previously loaded interaction rates
 	tabLorentzFactor.clear();
 	tabLossRate.clear();
 
-	while (infile.good()) {
-		if (infile.peek() != '#') {
-			double a, b;
-			infile >> a >> b;
-			if (infile) {
-				tabLorentzFactor.push_back(pow(10, a));
-				tabLossRate.push_back(b / Mpc);
-			}
-		}
-		infile.ignore(std::numeric_limits < std::streamsize > ::max(), '\n');
+	for (size_t i = 0; i < table->size(); i++) {
+		if (table->rowSize(i) < 2)
+			throw std::runtime_error("ElectronPairProduction: incomplete row in " + filename);
+		const double *row = table->row(i);
+		tabLorentzFactor.push_back(pow(10, row[0]));
+		tabLossRate.push_back(row[1] / Mpc);
 	}
-	infile.close();
 }
 
 void ElectronPairProduction::initSpectrum(std::string filename) {
-	std::ifstream infile(filename.c_str());
-	if (!infile.good())
+	ref_ptr<DataTable> table = DataTable::open(filename);
+	if (!table.valid())
 		throw std::runtime_error("ElectronPairProduction: could not open file " + filename);
 
-	double dNdE;
-	tabSpectrum.resize(70);
+	// 70 x 170 values, independent of the line breaks
+	size_t nValues = 0;
+	for (size_t i = 0; i < table->size(); i++)
+		nValues += table->rowSize(i);
+	if (nValues < 70 * 170)
+		throw std::runtime_error("ElectronPairProduction: incomplete data in " + filename);
+	const double *dNdE = table->row(0);
+
+	std::vector<double> cdf(70 * 170);
 	for (size_t i = 0; i < 70; i++) {
-		tabSpectrum[i].resize(170);
+		double *row = &cdf[i * 170];
 		for (size_t j = 0; j < 170; j++) {
-			infile >> dNdE;
-			tabSpectrum[i][j] = dNdE * pow(10, (7 + 0.1 * j)); // read electron distribution pdf(Ee) ~ dN/dEe * Ee
+			row[j] = dNdE[i * 170 + j] * pow(10, (7 + 0.1 * j)); // read electron distribution pdf(Ee) ~ dN/dEe * Ee
 		}
 		for (size_t j = 1; j < 170; j++) {
-			tabSpectrum[i][j] += tabSpectrum[i][j - 1]; // cdf(Ee), unnormalized
+			row[j] += row[j - 1]; // cdf(Ee), unnormalized
 		}
 	}
-	infile.close();
+	tabSpectrum.setCDF(cdf, 70);
+}
+
+double ElectronPairProduction::drawPairEnergy(size_t i) const {
+	Random &random = Random::instance();
+	size_t j = random.randBin(tabSpectrum, i);
+	return pow(10, 6.95 + (j + random.rand()) * 0.1) * eV;
 }
 
 double ElectronPairProduction::lossLength(int id, double lf, double z) const {
@@ -93,14 +116,58 @@ double ElectronPairProduction::lossLength(int id, double lf, double z) const {
 		rate = tabLossRate.back() * pow(lf / tabLorentzFactor.back(), -0.6); // extrapolation
 
 	double A = nuclearMass(id) / mass_proton; // more accurate than massNumber(Id)
-	rate *= Z * Z / A * pow(1 + z, 3) * photonFieldScaling(photonField, z);
+	rate *= Z * Z / A * pow(1 + z, 3) * scaling->scalingFactor(z);
 	return 1. / rate;
 }
 
+void ElectronPairProduction::emitPairs(Candidate *c, double lf, double dE) const {
+	int i = round((log10(lf) - 6.05) * 10);  // find closest cdf(Ee|log10(gamma))
+	i = std::min(std::max(i, 0), 69);
+	Random &random = Random::instance();
+
+	if (secondaryInterval > 1) {
+		// accumulate the energy loss and emit it as one weighted pair
+		int steps = 1;
+		if (c->hasProperty(PAIRSTEPS)) {
+			dE += c->getProperty(PAIRENERGY).toDouble();
+			steps += c->getProperty(PAIRSTEPS).toInt32();
+		}
+		if (steps < secondaryInterval) {
+			c->setProperty(PAIRENERGY, dE);
+			c->setProperty(PAIRSTEPS, steps);
+		} else {
+			c->removeProperty(PAIRENERGY);
+			c->removeProperty(PAIRSTEPS);
+			double Ee = drawPairEnergy(i);
+			double w = dE / (2 * Ee);
+			Vector3d pos = random.randomInterpolatedPosition(c->previous.getPosition(), c->current.getPosition());
+			c->addSecondary( 11, Ee, pos, w);
+			c->addSecondary(-11, Ee, pos, w);
+		}
+		dE = 0;
+	}
+
+	// draw pairs as long as their energy is smaller than the pair production energy loss
+	while (dE > 0) {
+		double Ee = drawPairEnergy(i);
+		double Epair = 2 * Ee; // NOTE: electron and positron in general don't have same lab frame energy, but averaged over many draws the result is consistent
+		// if the remaining energy is not sufficient check for random accepting
+		if (Epair > dE)
+			if (random.rand() > (dE / Epair))
+				break; // not accepted
+
+		// create pair and repeat with remaining energy
+		dE -= Epair;
+		Vector3d pos = random.randomInterpolatedPosition(c->previous.getPosition(), c->current.getPosition());
+		c->addSecondary( 11, Ee, pos);
+		c->addSecondary(-11, Ee, pos);
+	}
+}
+
 void ElectronPairProduction::process(Candidate *c) const {
-	int id = c->current.getId();
-	if (not (isNucleus(id)))
+	if (not c->current.isNucleus())
 		return; // only nuclei
+	int id = c->current.getId();
 
 	double lf = c->current.getLorentzFactor();
 	double z = c->getRedshift();
@@ -111,32 +178,31 @@ void ElectronPairProduction::process(Candidate *c) const {
 	double step = c->getCurrentStep() / (1 + z); // step size in local frame
 	double loss = step / losslen;  // relative energy loss
 
-	if (haveElectrons) {
-		double dE = c->current.getEnergy() * loss;  // energy loss
-		int i = round((log10(lf) - 6.05) * 10);  // find closest cdf(Ee|log10(gamma))
-		i = std::min(std::max(i, 0), 69);
-		Random &random = Random::instance();
-
-		// draw pairs as long as their energy is smaller than the pair production energy loss
-		while (dE > 0) {
-			size_t j = random.randBin(tabSpectrum[i]);
-			double Ee = pow(10, 6.95 + (j + random.rand()) * 0.1) * eV;
-			double Epair = 2 * Ee; // NOTE: electron and positron in general don't have same lab frame energy, but averaged over many draws the result is consistent
-			// if the remaining energy is not sufficient check for random accepting
-			if (Epair > dE)
-				if (random.rand() > (dE / Epair))
-					break; // not accepted
-
-			// create pair and repeat with remaining energy
-			dE -= Epair;
-			Vector3d pos = random.randomInterpolatedPosition(c->previous.getPosition(), c->current.getPosition());
-			c->addSecondary( 11, Ee, pos);
-			c->addSecondary(-11, Ee, pos);
-		}
-	}
+	if (haveElectrons)
+		emitPairs(c, lf, c->current.getEnergy() * loss);
 
 	c->current.setLorentzFactor(lf * (1 - loss));
 	c->limitNextStep(limit * losslen);
 }
 
+double ElectronPairProduction::energyLossRate(const Candidate *c, double E, double z) const {
+	if (not c->current.isNucleus())
+		return 0;
+	int id = c->current.getId();
+	double lf = E / (c->current.getMass() * c_squared);
+	double losslen = lossLength(id, lf, z);
+	if (losslen >= std::numeric_limits<double>::max())
+		return 0;
+	return E / losslen / (1 + z); // per comoving distance
+}
+
+void ElectronPairProduction::emitSecondaries(Candidate *c, double E, double dE) const {
+	if (haveElectrons and c->current.isNucleus())
+		emitPairs(c, E / (c->current.getMass() * c_squared), dE);
+}
+
+int ElectronPairProduction::getParticleClasses() const {
+	return NucleiClasses;
+}
+
 } // namespace crpropa
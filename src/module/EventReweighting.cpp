@@ -0,0 +1,173 @@
+#include "crpropa/module/EventReweighting.h"
+#include "crpropa/Cosmology.h"
+#include "crpropa/ParticleID.h"
+#include "crpropa/Units.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <locale>
+#include <stdexcept>
+
+namespace crpropa {
+
+EventReweighting::EventReweighting(double simulatedIndex, double Emin,
+		double Emax, size_t nEnergy) :
+		simulatedIndex(simulatedIndex), lgEmin(log10(Emin)),
+		lgEmax(log10(Emax)), nEnergy(nEnergy) {
+	if ((nEnergy == 0) || !(Emin > 0) || !(Emax > Emin))
+		throw std::runtime_error("EventReweighting: invalid energy bins");
+}
+
+size_t EventReweighting::addParameterPoint(double index, double Rcut, double m) {
+	if (Rcut < 0)
+		throw std::runtime_error("EventReweighting: negative cut off rigidity");
+	Point p;
+	p.index = index;
+	p.inverseRcut = (Rcut > 0) ? 1 / Rcut : 0;
+	p.m = m;
+	points.push_back(p);
+	histograms.resize(points.size() * nEnergy, 0);
+	return points.size() - 1;
+}
+
+size_t EventReweighting::getNumberOfParameterPoints() const {
+	return points.size();
+}
+
+void EventReweighting::setAbundance(int id, double abundance) {
+	abundances[id] = abundance;
+}
+
+double EventReweighting::getWeight(size_t point, int id0, double E0,
+		double z0) const {
+	const Point &p = points.at(point);
+	double a = 1;
+	if (!abundances.empty()) {
+		std::map<int, double>::const_iterator i = abundances.find(id0);
+		a = (i == abundances.end()) ? 0 : i->second;
+	}
+	double Z = isNucleus(id0) ? chargeNumber(id0) : 1;
+	return a * exp((simulatedIndex - p.index) * log(E0 / EeV)
+			+ p.m * log1p(z0) - E0 * p.inverseRcut / Z);
+}
+
+void EventReweighting::fill(const std::string &filename, size_t chunkSize) {
+	BinaryInput input(filename);
+	fill(input, chunkSize);
+}
+
+void EventReweighting::fill(const BinaryInput &input, size_t chunkSize) {
+	if (chunkSize == 0)
+		throw std::runtime_error("EventReweighting: the chunk size must be positive");
+	size_t nPoints = points.size();
+	if (nPoints == 0)
+		return;
+
+	// structure of arrays of the points, for the loop over the points
+	std::vector<double> dIndex(nPoints), inverseRcut(nPoints), m(nPoints);
+	for (size_t p = 0; p < nPoints; p++) {
+		dIndex[p] = simulatedIndex - points[p].index;
+		inverseRcut[p] = points[p].inverseRcut;
+		m[p] = points[p].m;
+	}
+
+	long nChunks = (input.size() + chunkSize - 1) / chunkSize;
+	#pragma omp parallel
+	{
+		std::vector<double> local(histograms.size(), 0);
+		std::vector<double> exponent(nPoints);
+		bool cached = false;
+		int lastId = 0;
+		double abundance = 1, Z = 1;
+
+		#pragma omp for schedule(dynamic, 1)
+		for (long chunk = 0; chunk < nChunks; chunk++) {
+			size_t end = std::min(input.size(), (chunk + 1) * chunkSize);
+			for (size_t i = chunk * chunkSize; i < end; i++) {
+				const BinaryRecord &r = input.getRecord(i);
+				double e = (log10(r.current.energy) - lgEmin) / (lgEmax - lgEmin) * nEnergy;
+				if (!(e >= 0) || (e >= nEnergy))
+					continue;
+
+				int id0 = r.source.id;
+				if (!cached || (id0 != lastId)) {
+					cached = true;
+					lastId = id0;
+					abundance = 1;
+					if (!abundances.empty()) {
+						std::map<int, double>::const_iterator a = abundances.find(id0);
+						abundance = (a == abundances.end()) ? 0 : a->second;
+					}
+					Z = isNucleus(id0) ? chargeNumber(id0) : 1;
+				}
+				double w = r.weight * abundance;
+				if (w == 0)
+					continue;
+
+				const double *x = r.source.position;
+				double z0 = comovingDistance2Redshift(sqrt(x[0] * x[0] + x[1] * x[1] + x[2] * x[2]));
+				double lnE = log(r.source.energy / EeV);
+				double ln1z = log1p(z0);
+				double E0 = r.source.energy / Z;
+				for (size_t p = 0; p < nPoints; p++)
+					exponent[p] = dIndex[p] * lnE + m[p] * ln1z - E0 * inverseRcut[p];
+
+				double *h = &local[size_t(e)];
+				for (size_t p = 0; p < nPoints; p++)
+					h[p * nEnergy] += w * exp(exponent[p]);
+			}
+		}
+
+		#pragma omp critical(EventReweighting)
+		for (size_t j = 0; j < histograms.size(); j++)
+			histograms[j] += local[j];
+	}
+}
+
+void EventReweighting::clear() {
+	histograms.assign(histograms.size(), 0);
+}
+
+size_t EventReweighting::getNumberOfEnergyBins() const {
+	return nEnergy;
+}
+
+double EventReweighting::getEnergyBinEdge(size_t i) const {
+	return pow(10, lgEmin + i * (lgEmax - lgEmin) / nEnergy);
+}
+
+std::vector<double> EventReweighting::getHistogram(size_t point) const {
+	if (point >= points.size())
+		throw std::runtime_error("EventReweighting: no such parameter point");
+	return std::vector<double>(histograms.begin() + point * nEnergy,
+			histograms.begin() + (point + 1) * nEnergy);
+}
+
+void EventReweighting::save(const std::string &filename) const {
+	std::ofstream out(filename.c_str());
+	if (!out.good())
+		throw std::runtime_error("EventReweighting: could not open file " + filename);
+	out.imbue(std::locale::classic());
+	out.precision(17);
+
+	out << "# EventReweighting, simulated index " << simulatedIndex
+			<< ", energies in EeV\n";
+	for (size_t p = 0; p < points.size(); p++) {
+		double Rcut = (points[p].inverseRcut > 0) ? 1 / points[p].inverseRcut : 0;
+		out << "# point " << p << ": index " << points[p].index << " Rcut "
+				<< Rcut / EeV << " EeV m " << points[p].m << "\n";
+	}
+	out << "# Emin Emax";
+	for (size_t p = 0; p < points.size(); p++)
+		out << " w" << p;
+	out << "\n";
+	for (size_t e = 0; e < nEnergy; e++) {
+		out << getEnergyBinEdge(e) / EeV << " " << getEnergyBinEdge(e + 1) / EeV;
+		for (size_t p = 0; p < points.size(); p++)
+			out << " " << histograms[p * nEnergy + e];
+		out << "\n";
+	}
+}
+
+} // namespace crpropa
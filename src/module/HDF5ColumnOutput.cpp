@@ -0,0 +1,111 @@
+#ifdef CRPROPA_HAVE_HDF5
+
+#include "crpropa/module/HDF5ColumnOutput.h"
+
+#include <hdf5.h>
+#include <cstring>
+#include <stdexcept>
+
+const hsize_t COLUMN_CHUNK_SIZE = 1024 * 16;
+
+namespace crpropa {
+
+HDF5ColumnOutput::HDF5ColumnOutput() : HDF5Output() {
+}
+
+HDF5ColumnOutput::HDF5ColumnOutput(const std::string& filename) :
+		HDF5Output(filename) {
+}
+
+HDF5ColumnOutput::HDF5ColumnOutput(const std::string& filename,
+		OutputType outputtype) : HDF5Output(filename, outputtype) {
+}
+
+HDF5ColumnOutput::~HDF5ColumnOutput() {
+	// the datasets of this class are closed before the base is destroyed
+	close();
+}
+
+void HDF5ColumnOutput::createDataset() {
+	if (isCollective())
+		throw std::runtime_error("HDF5ColumnOutput: no collective output, use HDF5Output");
+	dset = H5Gcreate2(file, "CRPROPA3", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+
+	std::vector<std::string> names;
+	types.clear();
+	offsets.clear();
+	for (size_t i = 0; i < columns.size(); i++) {
+		names.push_back(columns[i].name);
+		types.push_back(columns[i].type);
+		offsets.push_back(columns[i].offset);
+	}
+	size_t pos = propertyOffset;
+	for (size_t i = 0; i < properties.size(); i++) {
+		names.push_back(properties[i].name);
+		types.push_back(propertyTypes[i]);
+		offsets.push_back(pos);
+		pos += properties[i].defaultValue.getSize();
+	}
+
+	hid_t plist = H5Pcreate(H5P_DATASET_CREATE);
+	H5Pset_layout(plist, H5D_CHUNKED);
+	hsize_t chunk_dims[1] = {COLUMN_CHUNK_SIZE};
+	H5Pset_chunk(plist, 1, chunk_dims);
+	H5Pset_shuffle(plist); // groups the bytes of the values for deflate
+	H5Pset_deflate(plist, 5);
+
+	hsize_t dims[1] = {0};
+	hsize_t max_dims[1] = {H5S_UNLIMITED};
+	hid_t space = H5Screate_simple(1, dims, max_dims);
+	datasets.clear();
+	for (size_t i = 0; i < names.size(); i++)
+		datasets.push_back(H5Dcreate2(dset, names[i].c_str(), types[i], space,
+				H5P_DEFAULT, plist, H5P_DEFAULT));
+	H5Sclose(space);
+	H5Pclose(plist);
+}
+
+void HDF5ColumnOutput::writeRows(const std::vector<unsigned char> &rows) {
+	hsize_t n = rows.size() / rowSize;
+	if (n == 0)
+		return;
+
+	std::vector<unsigned char> values;
+	for (size_t i = 0; i < datasets.size(); i++) {
+		// gather the values of the column from the packed rows
+		size_t size = H5Tget_size(types[i]);
+		values.resize(n * size);
+		for (size_t j = 0; j < n; j++)
+			memcpy(&values[j * size], &rows[j * rowSize + offsets[i]], size);
+
+		hid_t file_space = H5Dget_space(datasets[i]);
+		hsize_t count = H5Sget_simple_extent_npoints(file_space);
+		H5Sclose(file_space);
+		hsize_t new_size[1] = {count + n};
+		H5Dset_extent(datasets[i], new_size);
+
+		file_space = H5Dget_space(datasets[i]);
+		hsize_t offset[1] = {count};
+		hsize_t cnt[1] = {n};
+		H5Sselect_hyperslab(file_space, H5S_SELECT_SET, offset, NULL, cnt, NULL);
+		hid_t mspace_id = H5Screate_simple(1, cnt, NULL);
+		H5Dwrite(datasets[i], types[i], mspace_id, file_space, H5P_DEFAULT, &values[0]);
+		H5Sclose(mspace_id);
+		H5Sclose(file_space);
+	}
+}
+
+void HDF5ColumnOutput::closeDataset() {
+	for (size_t i = 0; i < datasets.size(); i++)
+		H5Dclose(datasets[i]);
+	datasets.clear();
+	H5Gclose(dset);
+}
+
+std::string HDF5ColumnOutput::getDescription() const  {
+	return "HDF5ColumnOutput";
+}
+
+} // namespace crpropa
+
+#endif // CRPROPA_HAVE_HDF5
@@ -3,16 +3,42 @@
 #include "crpropa/module/HDF5Output.h"
 #include "crpropa/Version.h"
 #include "crpropa/Random.h"
+#include "crpropa/Trace.h"
+#include "crpropa/Units.h"
 #include "kiss/logger.h"
 
 #include <hdf5.h>
+#include <algorithm>
 #include <cstring>
+#include <fstream>
+#include <sstream>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#if defined(CRPROPA_HAVE_MPI) && defined(H5_HAVE_PARALLEL)
+#define CRPROPA_HDF5_MPIO
+#include <mpi.h>
+#endif
 
 const hsize_t RANK = 1;
 const hsize_t BUFFER_SIZE = 1024 * 16;
+const size_t BLOCK_SIZE = 1024; // rows per block for the writer thread
+const size_t MAX_QUEUED_BLOCKS = BUFFER_SIZE / BLOCK_SIZE;
+const size_t STAGING_THREADS = 256; // further threads hand over single rows
+const size_t STRIPE_SIZE = 4 * 1024 * 1024; // bytes per chunk of the collective dataset
 
 namespace crpropa {
 
+// the writes of the writer thread, see Trace
+static const size_t traceWrite = Trace::addName("HDF5Output write", "output");
+
+Lock &hdf5Lock() {
+	static Lock lock("HDF5");
+	return lock;
+}
+
 // map variant types to H5T_NATIVE
 hid_t variantTypeToH5T_NATIVE(Variant::Type type) {
 	if (type == Variant::TYPE_INT64)
@@ -48,18 +74,36 @@ hid_t variantTypeToH5T_NATIVE(Variant::Type type) {
 	}
 }
 
-HDF5Output::HDF5Output() :  Output(), filename(), file(-1), sid(-1), dset(-1), dataspace(-1), candidatesSinceFlush(0), flushLimit(std::numeric_limits<unsigned int>::max()) {
+HDF5Output::HDF5Output() :  Output(), filename(), flushLimit(std::numeric_limits<unsigned int>::max()), candidatesSinceFlush(0), openLock("HDF5Output") {
+	init();
 }
 
-HDF5Output::HDF5Output(const std::string& filename) :  Output(), filename(filename), file(-1), sid(-1), dset(-1), dataspace(-1), candidatesSinceFlush(0), flushLimit(std::numeric_limits<unsigned int>::max()) {
+HDF5Output::HDF5Output(const std::string& filename) :  Output(), filename(filename), flushLimit(std::numeric_limits<unsigned int>::max()), candidatesSinceFlush(0), openLock("HDF5Output") {
+	init();
 }
 
-HDF5Output::HDF5Output(const std::string& filename, OutputType outputtype) :  Output(outputtype), filename(filename), file(-1), sid(-1), dset(-1), dataspace(-1), candidatesSinceFlush(0), flushLimit(std::numeric_limits<unsigned int>::max()) {
+HDF5Output::HDF5Output(const std::string& filename, OutputType outputtype) :  Output(outputtype), filename(filename), flushLimit(std::numeric_limits<unsigned int>::max()), candidatesSinceFlush(0), openLock("HDF5Output") {
 	outputtype = outputtype;
+	init();
 }
 
 HDF5Output::~HDF5Output() {
 	close();
+	pthread_cond_destroy(&queueChanged);
+	pthread_mutex_destroy(&mutex);
+}
+
+void HDF5Output::init() {
+	file = sid = dset = dataspace = -1;
+	isOpen = 0;
+	writing = 0;
+	propertyOffset = 0;
+	rowSize = 0;
+	stopWriter = false;
+	collective = false;
+	chunkRows = 0;
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&queueChanged, NULL);
 }
 
 herr_t HDF5Output::insertStringAttribute(const std::string &key, const std::string &value){
@@ -97,75 +141,138 @@ herr_t HDF5Output::insertDoubleAttribute(const std::string &key, const double &v
 
 
 
+// native value at an unaligned position of a packed row
+template<typename T>
+static void putValue(unsigned char *p, T value) {
+	memcpy(p, &value, sizeof(T));
+}
+
+void HDF5Output::addColumn(const char *name, ColumnValue value, hid_t type) {
+	Column c;
+	c.name = name;
+	c.value = value;
+	c.type = type;
+	c.offset = rowSize;
+	columns.push_back(c);
+	rowSize += H5Tget_size(type);
+}
+
+void HDF5Output::createDataset() {
+	// compound type of the packed row
+	sid = H5Tcreate(H5T_COMPOUND, rowSize);
+	for (size_t i = 0; i < columns.size(); i++)
+		H5Tinsert(sid, columns[i].name, columns[i].offset, columns[i].type);
+	size_t pos = propertyOffset;
+	for (size_t i = 0; i < properties.size(); i++) {
+		H5Tinsert(sid, properties[i].name.c_str(), pos, propertyTypes[i]);
+		pos += properties[i].defaultValue.getSize();
+	}
+
+	hid_t plist = H5Pcreate(H5P_DATASET_CREATE);
+	H5Pset_layout(plist, H5D_CHUNKED);
+	hsize_t chunk_dims[RANK] = {getChunkSize()};
+	H5Pset_chunk(plist, RANK, chunk_dims);
+	// filters of parallel writes need collective chunk allocation, not compressed
+	if (!collective)
+		H5Pset_deflate(plist, 5);
+
+	hsize_t dims[RANK] = {0};
+	hsize_t max_dims[RANK] = {H5S_UNLIMITED};
+	dataspace = H5Screate_simple(RANK, dims, max_dims);
+
+	dset = H5Dcreate2(file, "CRPROPA3", sid, dataspace, H5P_DEFAULT, plist, H5P_DEFAULT);
+	H5Pclose(plist);
+}
+
+void HDF5Output::closeDataset() {
+	H5Dclose(dset);
+	H5Tclose(sid);
+	H5Sclose(dataspace);
+}
+
 void HDF5Output::open(const std::string& filename) {
-	file = H5Fcreate(filename.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+	hid_t fapl = H5P_DEFAULT;
+#ifdef CRPROPA_HDF5_MPIO
+	if (collective) {
+		fapl = H5Pcreate(H5P_FILE_ACCESS);
+		H5Pset_fapl_mpio(fapl, MPI_COMM_WORLD, MPI_INFO_NULL);
+		// large objects start at stripe boundaries
+		H5Pset_alignment(fapl, STRIPE_SIZE / 4, STRIPE_SIZE);
+	}
+#endif
+	file = H5Fcreate(filename.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, fapl);
+	if (fapl != H5P_DEFAULT)
+		H5Pclose(fapl);
 	if (file < 0)
 		throw std::runtime_error(std::string("Cannot create file: ") + filename);
 
 
-	sid = H5Tcreate(H5T_COMPOUND, sizeof(OutputRow));
+	columns.clear();
+	rowSize = 0;
 	if (fields.test(TrajectoryLengthColumn))
-		H5Tinsert(sid, "D", HOFFSET(OutputRow, D), H5T_NATIVE_DOUBLE);
+		addColumn("D", ColD, H5T_NATIVE_DOUBLE);
 	if (fields.test(RedshiftColumn))
-		H5Tinsert(sid, "z", HOFFSET(OutputRow, z), H5T_NATIVE_DOUBLE);
+		addColumn("z", Colz, H5T_NATIVE_DOUBLE);
 	if (fields.test(SerialNumberColumn))
-		H5Tinsert(sid, "SN", HOFFSET(OutputRow, SN), H5T_NATIVE_UINT64);
+		addColumn("SN", ColSN, H5T_NATIVE_UINT64);
 	if (fields.test(CurrentIdColumn))
-		H5Tinsert(sid, "ID", HOFFSET(OutputRow, ID), H5T_NATIVE_INT32);
+		addColumn("ID", ColID, H5T_NATIVE_INT32);
 	if (fields.test(CurrentEnergyColumn))
-		H5Tinsert(sid, "E", HOFFSET(OutputRow, E), H5T_NATIVE_DOUBLE);
+		addColumn("E", ColE, H5T_NATIVE_DOUBLE);
 	if (fields.test(CurrentPositionColumn) && oneDimensional)
-		H5Tinsert(sid, "X", HOFFSET(OutputRow, X), H5T_NATIVE_DOUBLE);
+		addColumn("X", ColX, H5T_NATIVE_DOUBLE);
 	if (fields.test(CurrentPositionColumn) && not oneDimensional) {
-		H5Tinsert(sid, "X", HOFFSET(OutputRow, X), H5T_NATIVE_DOUBLE);
-		H5Tinsert(sid, "Y", HOFFSET(OutputRow, Y), H5T_NATIVE_DOUBLE);
-		H5Tinsert(sid, "Z", HOFFSET(OutputRow, Z), H5T_NATIVE_DOUBLE);
+		addColumn("X", ColX, H5T_NATIVE_DOUBLE);
+		addColumn("Y", ColY, H5T_NATIVE_DOUBLE);
+		addColumn("Z", ColZ, H5T_NATIVE_DOUBLE);
 	}
 	if (fields.test(CurrentDirectionColumn) && not oneDimensional) {
-		H5Tinsert(sid, "Px", HOFFSET(OutputRow, Px), H5T_NATIVE_DOUBLE);
-		H5Tinsert(sid, "Py", HOFFSET(OutputRow, Py), H5T_NATIVE_DOUBLE);
-		H5Tinsert(sid, "Pz", HOFFSET(OutputRow, Pz), H5T_NATIVE_DOUBLE);
+		addColumn("Px", ColPx, H5T_NATIVE_DOUBLE);
+		addColumn("Py", ColPy, H5T_NATIVE_DOUBLE);
+		addColumn("Pz", ColPz, H5T_NATIVE_DOUBLE);
 	}
 	if (fields.test(SerialNumberColumn))
-		H5Tinsert(sid, "SN0", HOFFSET(OutputRow, SN0), H5T_NATIVE_UINT64);
+		addColumn("SN0", ColSN0, H5T_NATIVE_UINT64);
 	if (fields.test(SourceIdColumn))
-		H5Tinsert(sid, "ID0", HOFFSET(OutputRow, ID0), H5T_NATIVE_INT32);
+		addColumn("ID0", ColID0, H5T_NATIVE_INT32);
 	if (fields.test(SourceEnergyColumn))
-		H5Tinsert(sid, "E0", HOFFSET(OutputRow, E0), H5T_NATIVE_DOUBLE);
+		addColumn("E0", ColE0, H5T_NATIVE_DOUBLE);
 	if (fields.test(SourcePositionColumn) && oneDimensional)
-		H5Tinsert(sid, "X0", HOFFSET(OutputRow, X0), H5T_NATIVE_DOUBLE);
+		addColumn("X0", ColX0, H5T_NATIVE_DOUBLE);
 	if (fields.test(SourcePositionColumn) && not oneDimensional){
-		H5Tinsert(sid, "X0", HOFFSET(OutputRow, X0), H5T_NATIVE_DOUBLE);
-		H5Tinsert(sid, "Y0", HOFFSET(OutputRow, Y0), H5T_NATIVE_DOUBLE);
-		H5Tinsert(sid, "Z0", HOFFSET(OutputRow, Z0), H5T_NATIVE_DOUBLE);
+		addColumn("X0", ColX0, H5T_NATIVE_DOUBLE);
+		addColumn("Y0", ColY0, H5T_NATIVE_DOUBLE);
+		addColumn("Z0", ColZ0, H5T_NATIVE_DOUBLE);
 	}
 	if (fields.test(SourceDirectionColumn) && not oneDimensional) {
-		H5Tinsert(sid, "P0x", HOFFSET(OutputRow, P0x), H5T_NATIVE_DOUBLE);
-		H5Tinsert(sid, "P0y", HOFFSET(OutputRow, P0y), H5T_NATIVE_DOUBLE);
-		H5Tinsert(sid, "P0z", HOFFSET(OutputRow, P0z), H5T_NATIVE_DOUBLE);
+		addColumn("P0x", ColP0x, H5T_NATIVE_DOUBLE);
+		addColumn("P0y", ColP0y, H5T_NATIVE_DOUBLE);
+		addColumn("P0z", ColP0z, H5T_NATIVE_DOUBLE);
 	}
 	if (fields.test(SerialNumberColumn))
-		H5Tinsert(sid, "SN1", HOFFSET(OutputRow, SN1), H5T_NATIVE_UINT64);
+		addColumn("SN1", ColSN1, H5T_NATIVE_UINT64);
 	if (fields.test(CreatedIdColumn))
-		H5Tinsert(sid, "ID1", HOFFSET(OutputRow, ID1), H5T_NATIVE_INT32);
+		addColumn("ID1", ColID1, H5T_NATIVE_INT32);
 	if (fields.test(CreatedEnergyColumn))
-		H5Tinsert(sid, "E1", HOFFSET(OutputRow, E1), H5T_NATIVE_DOUBLE);
+		addColumn("E1", ColE1, H5T_NATIVE_DOUBLE);
 	if (fields.test(CreatedPositionColumn) && oneDimensional)
-		H5Tinsert(sid, "X1", HOFFSET(OutputRow, X1), H5T_NATIVE_DOUBLE);
+		addColumn("X1", ColX1, H5T_NATIVE_DOUBLE);
 	if (fields.test(CreatedPositionColumn) && not oneDimensional) {
-		H5Tinsert(sid, "X1", HOFFSET(OutputRow, X1), H5T_NATIVE_DOUBLE);
-		H5Tinsert(sid, "Y1", HOFFSET(OutputRow, Y1), H5T_NATIVE_DOUBLE);
-		H5Tinsert(sid, "Z1", HOFFSET(OutputRow, Z1), H5T_NATIVE_DOUBLE);
+		addColumn("X1", ColX1, H5T_NATIVE_DOUBLE);
+		addColumn("Y1", ColY1, H5T_NATIVE_DOUBLE);
+		addColumn("Z1", ColZ1, H5T_NATIVE_DOUBLE);
 	}
 	if (fields.test(CreatedDirectionColumn) && not oneDimensional) {
-		H5Tinsert(sid, "P1x", HOFFSET(OutputRow, P1x), H5T_NATIVE_DOUBLE);
-		H5Tinsert(sid, "P1y", HOFFSET(OutputRow, P1y), H5T_NATIVE_DOUBLE);
-		H5Tinsert(sid, "P1z", HOFFSET(OutputRow, P1z), H5T_NATIVE_DOUBLE);
+		addColumn("P1x", ColP1x, H5T_NATIVE_DOUBLE);
+		addColumn("P1y", ColP1y, H5T_NATIVE_DOUBLE);
+		addColumn("P1z", ColP1z, H5T_NATIVE_DOUBLE);
 	}
 	if (fields.test(WeightColumn))
-		H5Tinsert(sid, "weight", HOFFSET(OutputRow, weight), H5T_NATIVE_DOUBLE);
+		addColumn("weight", Colweight, H5T_NATIVE_DOUBLE);
 
-	size_t pos = 0;
+	// properties after the columns
+	propertyOffset = rowSize;
+	propertyTypes.clear();
 	for(std::vector<Output::Property>::const_iterator iter = properties.begin();
 			iter != properties.end(); ++iter)
 	{
@@ -175,28 +282,11 @@ void HDF5Output::open(const std::string& filename) {
 				type = H5Tcopy(H5T_C_S1);
 				H5Tset_size(type, (*iter).defaultValue.toString().size());
 			}
-
-			H5Tinsert(sid, (*iter).name.c_str(), HOFFSET(OutputRow, propertyBuffer) + pos, type);
-		  pos += (*iter).defaultValue.getSize();
+			propertyTypes.push_back(type);
+			rowSize += (*iter).defaultValue.getSize();
 	}
-	if (pos >= propertyBufferSize)
-	{
-		KISS_LOG_ERROR << "Using " << pos << " bytes for properties output. Maximum is " << propertyBufferSize << " bytes.";
-		throw std::runtime_error("Size of property buffer exceeded");
-	}
-
-	// chunked prop
-	hid_t plist = H5Pcreate(H5P_DATASET_CREATE);
-	H5Pset_layout(plist, H5D_CHUNKED);
-	hsize_t chunk_dims[RANK] = {BUFFER_SIZE};
-	H5Pset_chunk(plist, RANK, chunk_dims);
-	H5Pset_deflate(plist, 5);
-
-	hsize_t dims[RANK] = {0};
-	hsize_t max_dims[RANK] = {H5S_UNLIMITED};
-	dataspace = H5Screate_simple(RANK, dims, max_dims);
 
-	dset = H5Dcreate2(file, "CRPROPA3", sid, dataspace, H5P_DEFAULT, plist, H5P_DEFAULT);
+	createDataset();
 
 	insertStringAttribute("OutputType", outputName);
 	insertStringAttribute("Version", g_GIT_DESC);
@@ -204,7 +294,9 @@ void HDF5Output::open(const std::string& filename) {
 	insertDoubleAttribute("EnergyScale", this->energyScale);
 
 	// add ranom seeds
-	std::vector< std::vector<uint32_t> > seeds = Random::getSeedThreads();
+	std::vector< std::vector<uint32_t> > seeds;
+	if (!collective)
+		seeds = Random::getSeedThreads();
 	for (size_t i = 0; i < seeds.size(); i++)
 	{
 		hid_t   type, attr_space, version_attr;
@@ -226,122 +318,287 @@ void HDF5Output::open(const std::string& filename) {
 
 	}
 
-
-	H5Pclose(plist);
-
-	buffer.reserve(BUFFER_SIZE);
-	time(&lastFlush);
+	Staging empty;
+	empty.block = 0;
+	empty.lastPush = time(NULL);
+	staging.assign(STAGING_THREADS, empty);
+	stopWriter = false;
+	if (pthread_create(&writer, NULL, writerMain, this) != 0) {
+		closeDataset();
+		H5Fclose(file);
+		file = -1;
+		throw std::runtime_error("HDF5Output: could not start the writer thread");
+	}
+	__atomic_store_n(&isOpen, 1, __ATOMIC_RELEASE);
 }
 
 void HDF5Output::close() {
-	if (file >= 0) {
+	if (isOpen) {
 		flush();
-		H5Dclose(dset);
-		H5Tclose(sid);
-		H5Sclose(dataspace);
+		pthread_mutex_lock(&mutex);
+		stopWriter = true;
+		pthread_cond_broadcast(&queueChanged);
+		pthread_mutex_unlock(&mutex);
+		pthread_join(writer, NULL);
+		staging.clear();
+		pending.clear();
+
+		closeDataset();
 		H5Fclose(file);
 		file = -1;
+		isOpen = 0;
 	}
 }
 
-void HDF5Output::process(Candidate* candidate) const {
-	#pragma omp critical
-	{
-	if (file == -1)
-		// This is ugly, but necesary as otherwise the user has to manually open the
-		// file before processing the first candidate
-		const_cast<HDF5Output*>(this)->open(filename);
-	}
-
-	OutputRow r;
-	r.D = candidate->getTrajectoryLength() / lengthScale;
-	r.z = candidate->getRedshift();
-
-	r.SN = candidate->getSerialNumber();
-	r.ID = candidate->current.getId();
-	r.E = candidate->current.getEnergy() / energyScale;
-	Vector3d v = candidate->current.getPosition() / lengthScale;
-	r.X = v.x;
-	r.Y = v.y;
-	r.Z = v.z;
-	v = candidate->current.getDirection();
-	r.Px = v.x;
-	r.Py = v.y;
-	r.Pz = v.z;
-
-	r.SN0 = candidate->getSourceSerialNumber();
-	r.ID0 = candidate->source.getId();
-	r.E0 = candidate->source.getEnergy() / energyScale;
-	v = candidate->source.getPosition() / lengthScale;
-	r.X0 = v.x;
-	r.Y0 = v.y;
-	r.Z0 = v.z;
-	v = candidate->source.getDirection();
-	r.P0x = v.x;
-	r.P0y = v.y;
-	r.P0z = v.z;
-
-	r.SN1 = candidate->getCreatedSerialNumber();
-	r.ID1 = candidate->created.getId();
-	r.E1 = candidate->created.getEnergy() / energyScale;
-	v = candidate->created.getPosition() / lengthScale;
-	r.X1 = v.x;
-	r.Y1 = v.y;
-	r.Z1 = v.z;
-	v = candidate->created.getDirection();
-	r.P1x = v.x;
-	r.P1y = v.y;
-	r.P1z = v.z;
-
-	r.weight= candidate->getWeight();
-
-	size_t pos = 0;
-	for(std::vector<Output::Property>::const_iterator iter = properties.begin();
-			iter != properties.end(); ++iter)
-	{
-		  Variant v;
-			if (candidate->hasProperty((*iter).name))
-			{
-				v = candidate->getProperty((*iter).name);
-			}
-			else
+void *HDF5Output::writerMain(void *output) {
+	HDF5Output *self = (HDF5Output *) output;
+	// the dataset is written in chunks of BUFFER_SIZE rows, as before
+	std::vector<unsigned char> rows;
+	rows.reserve(BUFFER_SIZE * self->rowSize);
+	pthread_mutex_lock(&self->mutex);
+	while (true) {
+		while (self->queue.empty() && !self->stopWriter)
+			pthread_cond_wait(&self->queueChanged, &self->mutex);
+		if (self->queue.empty())
+			break; // stopped and nothing left to write
+
+		Block *block = self->queue.front();
+		self->queue.pop_front();
+		self->writing++;
+		pthread_cond_broadcast(&self->queueChanged);
+		pthread_mutex_unlock(&self->mutex);
+
+		// extend, compress and write while the simulation continues
+		if (self->collective) {
+			// kept for the collective write of flush
+			self->pending.insert(self->pending.end(), block->rows.begin(), block->rows.end());
+			delete block;
+			pthread_mutex_lock(&self->mutex);
+			self->writing--;
+			pthread_cond_broadcast(&self->queueChanged);
+			continue;
+		}
+		rows.insert(rows.end(), block->rows.begin(), block->rows.end());
+		if (block->flush || (rows.size() >= BUFFER_SIZE * self->rowSize)) {
+			double traceStart = Trace::isEnabled() ? Trace::now() : 0;
 			{
-				v = (*iter).defaultValue;
+				ScopedLock l(hdf5Lock());
+				self->writeRows(rows);
+				H5Fflush(self->file, H5F_SCOPE_GLOBAL);
 			}
-			pos += v.copyToBuffer(&r.propertyBuffer[pos]);
-	}
+			rows.clear();
+			if (Trace::isEnabled())
+				Trace::record(traceWrite, traceStart, Trace::now());
+		}
+		delete block;
 
-	#pragma omp critical
-	{
-		const_cast<HDF5Output*>(this)->candidatesSinceFlush++;
-		Output::process(candidate);
+		pthread_mutex_lock(&self->mutex);
+		self->writing--;
+		pthread_cond_broadcast(&self->queueChanged);
+	}
+	pthread_mutex_unlock(&self->mutex);
+	return 0;
+}
 
-		buffer.push_back(r);
+void HDF5Output::push(Block *block) const {
+	pthread_mutex_lock(&mutex);
+	while (queue.size() >= MAX_QUEUED_BLOCKS)
+		pthread_cond_wait(&queueChanged, &mutex);
+	queue.push_back(block);
+	pthread_cond_broadcast(&queueChanged);
+	pthread_mutex_unlock(&mutex);
+}
 
+void HDF5Output::pushStaging(Staging &s, bool flush) const {
+	s.block->flush = flush;
+	push(s.block);
+	s.block = 0;
+	s.lastPush = time(NULL);
+}
 
-		if (buffer.size() >= buffer.capacity())
-		{
-			KISS_LOG_DEBUG << "HDF5Output: Flush due to buffer capacity exceeded";
-			flush();
-		}
-		else if (candidatesSinceFlush >= flushLimit)
-		{
-			KISS_LOG_DEBUG << "HDF5Output: Flush due to number of candidates";
-			flush();
+void HDF5Output::packRow(Candidate *candidate, unsigned char *row) const {
+	for (size_t i = 0; i < columns.size(); i++) {
+		unsigned char *p = row + columns[i].offset;
+		switch (columns[i].value) {
+		case ColD: putValue(p, candidate->getTrajectoryLength() / lengthScale); break;
+		case Colz: putValue(p, candidate->getRedshift()); break;
+		case ColSN: putValue(p, (uint64_t) candidate->getSerialNumber()); break;
+		case ColID: putValue(p, (int32_t) candidate->current.getId()); break;
+		case ColE: putValue(p, candidate->current.getEnergy() / energyScale); break;
+		case ColX: putValue(p, candidate->current.getPosition().x / lengthScale); break;
+		case ColY: putValue(p, candidate->current.getPosition().y / lengthScale); break;
+		case ColZ: putValue(p, candidate->current.getPosition().z / lengthScale); break;
+		case ColPx: putValue(p, candidate->current.getDirection().x); break;
+		case ColPy: putValue(p, candidate->current.getDirection().y); break;
+		case ColPz: putValue(p, candidate->current.getDirection().z); break;
+		case ColSN0: putValue(p, (uint64_t) candidate->getSourceSerialNumber()); break;
+		case ColID0: putValue(p, (int32_t) candidate->source.getId()); break;
+		case ColE0: putValue(p, candidate->source.getEnergy() / energyScale); break;
+		case ColX0: putValue(p, candidate->source.getPosition().x / lengthScale); break;
+		case ColY0: putValue(p, candidate->source.getPosition().y / lengthScale); break;
+		case ColZ0: putValue(p, candidate->source.getPosition().z / lengthScale); break;
+		case ColP0x: putValue(p, candidate->source.getDirection().x); break;
+		case ColP0y: putValue(p, candidate->source.getDirection().y); break;
+		case ColP0z: putValue(p, candidate->source.getDirection().z); break;
+		case ColSN1: putValue(p, (uint64_t) candidate->getCreatedSerialNumber()); break;
+		case ColID1: putValue(p, (int32_t) candidate->created.getId()); break;
+		case ColE1: putValue(p, candidate->created.getEnergy() / energyScale); break;
+		case ColX1: putValue(p, candidate->created.getPosition().x / lengthScale); break;
+		case ColY1: putValue(p, candidate->created.getPosition().y / lengthScale); break;
+		case ColZ1: putValue(p, candidate->created.getPosition().z / lengthScale); break;
+		case ColP1x: putValue(p, candidate->created.getDirection().x); break;
+		case ColP1y: putValue(p, candidate->created.getDirection().y); break;
+		case ColP1z: putValue(p, candidate->created.getDirection().z); break;
+		case Colweight: putValue(p, candidate->getWeight()); break;
 		}
-		else if (difftime(time(NULL), lastFlush) > 60*10)
+	}
+
+	size_t pos = propertyOffset;
+	for(std::vector<Output::Property>::const_iterator iter = properties.begin();
+			iter != properties.end(); ++iter)
+	{
+			const Variant &v = candidate->hasProperty((*iter).key) ?
+					candidate->getProperty((*iter).key) : (*iter).defaultValue;
+			pos += v.copyToBuffer(row + pos);
+	}
+}
+
+void HDF5Output::process(Candidate* candidate) const {
+	if (!accepts(candidate))
+		return;
+
+	if (!__atomic_load_n(&isOpen, __ATOMIC_ACQUIRE)) {
+		// This is ugly, but necesary as otherwise the user has to manually open the
+		// file before processing the first candidate
+		std::string error;
 		{
-			KISS_LOG_DEBUG << "HDF5Output: Flush due to time exceeded";
-			flush();
+			ScopedLock l(openLock);
+			if (!isOpen && collective) {
+				error = "HDF5Output: a collective file has to be opened on all ranks before the run";
+			} else if (!isOpen) {
+				try {
+					const_cast<HDF5Output*>(this)->open(filename);
+				} catch (std::exception &e) {
+					error = e.what();
+				}
+			}
 		}
+		if (!error.empty())
+			throw std::runtime_error(error);
+	}
+
+	Output::process(candidate);
+	unsigned int n = __sync_add_and_fetch(&candidatesSinceFlush, 1);
+
+#ifdef _OPENMP
+	size_t thread = omp_get_thread_num();
+#else
+	size_t thread = 0;
+#endif
+	if (thread >= STAGING_THREADS) {
+		Block *block = new Block;
+		block->rows.resize(rowSize);
+		packRow(candidate, &block->rows[0]);
+		block->flush = (n >= flushLimit);
+		if (block->flush)
+			__sync_lock_test_and_set(&candidatesSinceFlush, 0);
+		push(block);
+		return;
+	}
+
+	Staging &s = staging[thread];
+	if (!s.block) {
+		s.block = new Block;
+		s.block->rows.reserve(BLOCK_SIZE * rowSize);
+	}
+	size_t end = s.block->rows.size();
+	s.block->rows.resize(end + rowSize);
+	packRow(candidate, &s.block->rows[end]);
+
+	if (s.block->rows.size() >= BLOCK_SIZE * rowSize)
+	{
+		pushStaging(s, false);
+	}
+	else if (n >= flushLimit)
+	{
+		KISS_LOG_DEBUG << "HDF5Output: Flush due to number of candidates";
+		__sync_lock_test_and_set(&candidatesSinceFlush, 0);
+		pushStaging(s, true);
+	}
+	else if (difftime(time(NULL), s.lastPush) > 60*10)
+	{
+		KISS_LOG_DEBUG << "HDF5Output: Flush due to time exceeded";
+		pushStaging(s, true);
 	}
 }
 
 void HDF5Output::flush() const {
-	const_cast<HDF5Output*>(this)->lastFlush = time(NULL);
-	const_cast<HDF5Output*>(this)->candidatesSinceFlush = 0;
+	if (!isOpen)
+		return;
+
+	// hand over the rows of all threads and wait for the writer
+	for (size_t i = 0; i < staging.size(); i++)
+		if (staging[i].block)
+			pushStaging(staging[i], false);
+	Block *last = new Block;
+	last->flush = true;
+	push(last);
+	pthread_mutex_lock(&mutex);
+	while (!queue.empty() || (writing > 0))
+		pthread_cond_wait(&queueChanged, &mutex);
+	pthread_mutex_unlock(&mutex);
+	candidatesSinceFlush = 0;
+	if (collective)
+		writeCollective();
+}
 
-	hsize_t n = buffer.size();
+void HDF5Output::writeCollective() const {
+#ifdef CRPROPA_HDF5_MPIO
+	double traceStart = Trace::isEnabled() ? Trace::now() : 0;
+	unsigned long long n = pending.size() / rowSize, offset = 0, total = 0;
+	MPI_Exscan(&n, &offset, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+	MPI_Allreduce(&n, &total, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+	int rank;
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+	if (rank == 0)
+		offset = 0; // undefined from MPI_Exscan
+	if (total == 0)
+		return;
+
+	// all ranks extend the dataset by the rows of all ranks
+	hid_t file_space = H5Dget_space(dset);
+	hsize_t count = H5Sget_simple_extent_npoints(file_space);
+	H5Sclose(file_space);
+	hsize_t new_size[RANK] = {count + total};
+	H5Dset_extent(dset, new_size);
+
+	// and write their rows behind the rows of the lower ranks
+	file_space = H5Dget_space(dset);
+	hsize_t start[RANK] = {count + offset};
+	hsize_t cnt[RANK] = {n};
+	hid_t mspace_id = H5Screate_simple(RANK, cnt, NULL);
+	if (n > 0) {
+		H5Sselect_hyperslab(file_space, H5S_SELECT_SET, start, NULL, cnt, NULL);
+	} else {
+		H5Sselect_none(file_space);
+		H5Sselect_none(mspace_id);
+	}
+	hid_t xfer = H5Pcreate(H5P_DATASET_XFER);
+	H5Pset_dxpl_mpio(xfer, H5FD_MPIO_COLLECTIVE);
+	herr_t status = H5Dwrite(dset, sid, mspace_id, file_space, xfer, pending.data());
+	H5Pclose(xfer);
+	H5Sclose(mspace_id);
+	H5Sclose(file_space);
+	pending.clear();
+	if (Trace::isEnabled())
+		Trace::record(traceWrite, traceStart, Trace::now());
+	if (status < 0)
+		throw std::runtime_error("HDF5Output: collective write failed");
+#endif
+}
+
+void HDF5Output::writeRows(const std::vector<unsigned char> &buffer) {
+	hsize_t n = buffer.size() / rowSize;
 
 	if (n == 0)
 		return;
@@ -367,10 +624,6 @@ void HDF5Output::flush() const {
 
 	H5Sclose(mspace_id);
 	H5Sclose(file_space);
-
-	buffer.clear();
-
-	H5Fflush(file, H5F_SCOPE_GLOBAL);
 }
 
 std::string HDF5Output::getDescription() const  {
@@ -382,6 +635,347 @@ void HDF5Output::setFlushLimit(unsigned int N)
 	flushLimit = N;
 }
 
+void HDF5Output::setCollective(bool c) {
+	if (isOpen)
+		throw std::runtime_error("HDF5Output: setCollective has to be called before open");
+#ifndef CRPROPA_HDF5_MPIO
+	if (c)
+		throw std::runtime_error("HDF5Output: collective output needs MPI and a parallel HDF5");
+#endif
+	collective = c;
+}
+
+bool HDF5Output::isCollective() const {
+	return collective;
+}
+
+void HDF5Output::setChunkSize(size_t rows) {
+	if (isOpen)
+		throw std::runtime_error("HDF5Output: setChunkSize has to be called before open");
+	chunkRows = rows;
+}
+
+size_t HDF5Output::getChunkSize() const {
+	if (chunkRows > 0)
+		return chunkRows;
+	if (collective)
+		return std::max<size_t>(1, STRIPE_SIZE / std::max<size_t>(rowSize, 1));
+	return BUFFER_SIZE;
+}
+
+// names of the standard columns, in the order of HDF5Output::ColumnValue
+static const char *columnNames[] = {
+	"D", "z", "SN", "ID", "E", "X", "Y", "Z", "Px", "Py",
+	"Pz", "SN0", "ID0", "E0", "X0", "Y0", "Z0", "P0x", "P0y", "P0z",
+	"SN1", "ID1", "E1", "X1", "Y1", "Z1", "P1x", "P1y", "P1z", "weight"
+};
+static const int nColumnNames = sizeof(columnNames) / sizeof(columnNames[0]);
+
+// chunks prefetched by the reader thread of HDF5Input
+static const size_t PREFETCH_CHUNKS = 2;
+
+static double readDoubleAttribute(hid_t dset, const char *name, double defaultValue) {
+	if (H5Aexists(dset, name) <= 0)
+		return defaultValue;
+	double value = defaultValue;
+	hid_t attr = H5Aopen(dset, name, H5P_DEFAULT);
+	H5Aread(attr, H5T_NATIVE_DOUBLE, &value);
+	H5Aclose(attr);
+	return value;
+}
+
+HDF5Input::HDF5Input(const std::string &filename, size_t chunkRows) :
+		filename(filename), file(-1), dset(-1), memoryType(-1), rowSize(0),
+		rows(0), chunkRows(std::max<size_t>(chunkRows, 1)),
+		readerRunning(false), stopReader(false), finished(false) {
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&changed, NULL);
+
+	ScopedLock l(hdf5Lock());
+	file = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+	if (file < 0)
+		throw std::runtime_error("HDF5Input: cannot open file " + filename);
+	if (H5Lexists(file, "CRPROPA3", H5P_DEFAULT) > 0)
+		dset = H5Dopen2(file, "CRPROPA3", H5P_DEFAULT);
+	if (dset < 0) {
+		H5Fclose(file);
+		throw std::runtime_error("HDF5Input: no CRPropa dataset of HDF5Output in " + filename);
+	}
+	lengthScale = readDoubleAttribute(dset, "LengthScale", Mpc);
+	energyScale = readDoubleAttribute(dset, "EnergyScale", EeV);
+
+	hid_t space = H5Dget_space(dset);
+	rows = H5Sget_simple_extent_npoints(space);
+	H5Sclose(space);
+
+	// memory row of the members as double, int64, uint64 or strings
+	hid_t fileType = H5Dget_type(dset);
+	int n = H5Tget_nmembers(fileType);
+	for (int i = 0; i < n; i++) {
+		Column c;
+		char *name = H5Tget_member_name(fileType, i);
+		c.name = name;
+		H5free_memory(name);
+		c.value = -1;
+		for (int j = 0; j < nColumnNames; j++)
+			if (c.name == columnNames[j])
+				c.value = j;
+		hid_t type = H5Tget_member_type(fileType, i);
+		H5T_class_t typeClass = H5Tget_class(type);
+		if (typeClass == H5T_FLOAT) {
+			c.kind = 0;
+			c.size = sizeof(double);
+		} else if (typeClass == H5T_INTEGER) {
+			c.kind = (H5Tget_sign(type) == H5T_SGN_NONE) ? 2 : 1;
+			c.size = sizeof(uint64_t);
+		} else if (typeClass == H5T_STRING && !H5Tis_variable_str(type)) {
+			c.kind = 3;
+			c.size = H5Tget_size(type);
+		} else {
+			KISS_LOG_WARNING << "HDF5Input: column " << c.name << " of unsupported type ignored";
+			H5Tclose(type);
+			continue;
+		}
+		H5Tclose(type);
+		c.offset = rowSize;
+		rowSize += c.size;
+		columns.push_back(c);
+	}
+	H5Tclose(fileType);
+
+	memoryType = H5Tcreate(H5T_COMPOUND, std::max<size_t>(rowSize, 1));
+	for (size_t i = 0; i < columns.size(); i++) {
+		const Column &c = columns[i];
+		if (c.kind == 3) {
+			hid_t type = H5Tcopy(H5T_C_S1);
+			H5Tset_size(type, c.size);
+			H5Tinsert(memoryType, c.name.c_str(), c.offset, type);
+			H5Tclose(type);
+		} else {
+			H5Tinsert(memoryType, c.name.c_str(), c.offset, (c.kind == 0) ?
+					H5T_NATIVE_DOUBLE : (c.kind == 1) ? H5T_NATIVE_INT64 : H5T_NATIVE_UINT64);
+		}
+	}
+
+	if (rows == 0) {
+		finished = true;
+		return;
+	}
+	if (pthread_create(&reader, NULL, readerMain, this) != 0) {
+		H5Tclose(memoryType);
+		H5Dclose(dset);
+		H5Fclose(file);
+		throw std::runtime_error("HDF5Input: could not start the reader thread");
+	}
+	readerRunning = true;
+}
+
+HDF5Input::~HDF5Input() {
+	if (readerRunning) {
+		pthread_mutex_lock(&mutex);
+		stopReader = true;
+		pthread_cond_broadcast(&changed);
+		pthread_mutex_unlock(&mutex);
+		pthread_join(reader, NULL);
+	}
+	for (size_t i = 0; i < chunks.size(); i++)
+		delete chunks[i];
+	{
+		ScopedLock l(hdf5Lock());
+		H5Tclose(memoryType);
+		H5Dclose(dset);
+		H5Fclose(file);
+	}
+	pthread_cond_destroy(&changed);
+	pthread_mutex_destroy(&mutex);
+}
+
+bool HDF5Input::isHDF5File(const std::string &filename) {
+	// H5Fis_hdf5 prints the error stack of missing files
+	std::ifstream in(filename.c_str());
+	if (!in.good())
+		return false;
+	in.close();
+	ScopedLock l(hdf5Lock());
+	return H5Fis_hdf5(filename.c_str()) > 0;
+}
+
+void HDF5Input::readChunk(size_t begin, size_t n, Chunk &chunk) const {
+	std::vector<unsigned char> buffer(n * rowSize);
+	{
+		ScopedLock l(hdf5Lock());
+		hid_t fileSpace = H5Dget_space(dset);
+		hsize_t offset[RANK] = {begin};
+		hsize_t cnt[RANK] = {n};
+		H5Sselect_hyperslab(fileSpace, H5S_SELECT_SET, offset, NULL, cnt, NULL);
+		hid_t memorySpace = H5Screate_simple(RANK, cnt, NULL);
+		herr_t status = H5Dread(dset, memoryType, memorySpace, fileSpace,
+				H5P_DEFAULT, buffer.data());
+		H5Sclose(memorySpace);
+		H5Sclose(fileSpace);
+		if (status < 0)
+			throw std::runtime_error("HDF5Input: cannot read " + filename);
+	}
+
+	chunk.resize(n);
+	for (size_t r = 0; r < n; r++) {
+		const unsigned char *row = &buffer[r * rowSize];
+		ref_ptr<Candidate> c = new Candidate;
+		ParticleState states[3] = {c->current, c->source, c->created};
+		double position[3][3], direction[3][3];
+		for (size_t s = 0; s < 3; s++) {
+			Vector3d x = states[s].getPosition(), p = states[s].getDirection();
+			position[s][0] = x.x, position[s][1] = x.y, position[s][2] = x.z;
+			direction[s][0] = p.x, direction[s][1] = p.y, direction[s][2] = p.z;
+		}
+		for (size_t i = 0; i < columns.size(); i++) {
+			const Column &col = columns[i];
+			const unsigned char *p = row + col.offset;
+			double d = 0;
+			int64_t i64 = 0;
+			uint64_t u64 = 0;
+			if (col.kind == 0)
+				memcpy(&d, p, sizeof(d));
+			else if (col.kind == 1)
+				memcpy(&i64, p, sizeof(i64));
+			else if (col.kind == 2)
+				memcpy(&u64, p, sizeof(u64));
+			if (col.value < 0) {
+				if (col.kind == 0)
+					c->setProperty(col.name, Variant(d));
+				else if (col.kind == 1)
+					c->setProperty(col.name, Variant(i64));
+				else if (col.kind == 2)
+					c->setProperty(col.name, Variant(u64));
+				else
+					c->setProperty(col.name, Variant(std::string((const char *) p,
+							strnlen((const char *) p, col.size))));
+				continue;
+			}
+			// a standard column of a numeric type, as double or integer
+			if (col.kind == 1)
+				d = i64, u64 = i64;
+			else if (col.kind == 2)
+				d = u64, i64 = u64;
+			else
+				i64 = d, u64 = d;
+			switch (col.value) {
+			case HDF5Output::ColD: c->setTrajectoryLength(d * lengthScale); break;
+			case HDF5Output::Colz: c->setRedshift(d); break;
+			case HDF5Output::ColSN: c->setSerialNumber(u64); break;
+			case HDF5Output::ColSN0: case HDF5Output::ColSN1: break; // of the parents
+			case HDF5Output::Colweight: c->setWeight(d); break;
+			default: {
+				// state columns, in the same order for current, source and created
+				int s = (col.value - HDF5Output::ColID) / (HDF5Output::ColID0 - HDF5Output::ColID);
+				int v = (col.value - HDF5Output::ColID) % (HDF5Output::ColID0 - HDF5Output::ColID);
+				if (v == 0)
+					states[s].setId(i64);
+				else if (v == 1)
+					states[s].setEnergy(d * energyScale);
+				else if (v <= 4)
+					position[s][v - 2] = d * lengthScale;
+				else
+					direction[s][v - 5] = d;
+			}
+			}
+		}
+		for (size_t s = 0; s < 3; s++) {
+			states[s].setPosition(Vector3d(position[s][0], position[s][1], position[s][2]));
+			states[s].setDirection(Vector3d(direction[s][0], direction[s][1], direction[s][2]));
+		}
+		c->current = states[0];
+		c->previous = states[0];
+		c->source = states[1];
+		c->created = states[2];
+		chunk[n - 1 - r] = c; // reversed, drawn from the back
+	}
+}
+
+void *HDF5Input::readerMain(void *input) {
+	HDF5Input *self = (HDF5Input *) input;
+	size_t begin = 0;
+	while (begin < self->rows) {
+		pthread_mutex_lock(&self->mutex);
+		while ((self->chunks.size() >= PREFETCH_CHUNKS) && !self->stopReader)
+			pthread_cond_wait(&self->changed, &self->mutex);
+		bool stop = self->stopReader;
+		pthread_mutex_unlock(&self->mutex);
+		if (stop)
+			break;
+
+		size_t n = std::min(self->chunkRows, self->rows - begin);
+		Chunk *chunk = new Chunk;
+		try {
+			self->readChunk(begin, n, *chunk);
+		} catch (std::exception &e) {
+			KISS_LOG_ERROR << e.what();
+			delete chunk;
+			break;
+		}
+		begin += n;
+
+		pthread_mutex_lock(&self->mutex);
+		self->chunks.push_back(chunk);
+		pthread_cond_broadcast(&self->changed);
+		pthread_mutex_unlock(&self->mutex);
+	}
+	pthread_mutex_lock(&self->mutex);
+	self->finished = true;
+	pthread_cond_broadcast(&self->changed);
+	pthread_mutex_unlock(&self->mutex);
+	return 0;
+}
+
+size_t HDF5Input::size() const {
+	return rows;
+}
+
+ref_ptr<Candidate> HDF5Input::getCandidate() const {
+	std::vector<ref_ptr<Candidate> > candidates;
+	getCandidates(1, candidates);
+	if (candidates.empty())
+		return 0;
+	return candidates[0];
+}
+
+void HDF5Input::getCandidates(size_t n, std::vector<ref_ptr<Candidate> > &candidates) const {
+	pthread_mutex_lock(&mutex);
+	while (n > 0) {
+		if (current.empty()) {
+			while (chunks.empty() && !finished)
+				pthread_cond_wait(&changed, &mutex);
+			if (chunks.empty())
+				break; // all rows drawn
+			current.swap(*chunks.front());
+			delete chunks.front();
+			chunks.pop_front();
+			pthread_cond_broadcast(&changed);
+		}
+		size_t m = std::min(n, current.size());
+		candidates.insert(candidates.end(), current.rbegin(), current.rbegin() + m);
+		current.resize(current.size() - m);
+		n -= m;
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+void HDF5Input::load(ParticleCollector *collector) const {
+	std::vector<ref_ptr<Candidate> > candidates;
+	do {
+		candidates.clear();
+		getCandidates(chunkRows, candidates);
+		for (size_t i = 0; i < candidates.size(); i++)
+			collector->process(candidates[i]);
+	} while (!candidates.empty());
+}
+
+std::string HDF5Input::getDescription() const {
+	std::stringstream s;
+	s << "HDF5Input: " << filename << ", " << rows << " candidates";
+	return s.str();
+}
+
 } // namespace crpropa
 
 #endif // CRPROPA_HAVE_HDF5
@@ -0,0 +1,342 @@
+#include "crpropa/module/HistogramOutput.h"
+#include "crpropa/Units.h"
+
+#ifdef WITH_GALACTIC_LENSES
+#include "crpropa/magneticLens/Pixelization.h"
+#endif
+
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <locale>
+#include <sstream>
+#include <stdexcept>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace crpropa {
+
+// further threads share the last bins and add atomically
+static const size_t HISTOGRAM_THREADS = 256;
+
+static const char *quantityName(HistogramOutput::Quantity q) {
+	switch (q) {
+	case HistogramOutput::Energy:
+		return "Energy";
+	case HistogramOutput::Distance:
+		return "Distance";
+	case HistogramOutput::TrajectoryLength:
+		return "TrajectoryLength";
+	case HistogramOutput::Redshift:
+		return "Redshift";
+	case HistogramOutput::SourceEnergy:
+		return "SourceEnergy";
+	case HistogramOutput::SourceDistance:
+		return "SourceDistance";
+	case HistogramOutput::Id:
+		return "Id";
+	case HistogramOutput::Direction:
+		return "Direction";
+	}
+	return "";
+}
+
+HistogramOutput::HistogramOutput() :
+		nBins(1), threadBins(HISTOGRAM_THREADS), mergedBins(1, 0),
+		mergedOverflow(0) {
+	for (size_t i = 0; i < threadBins.size(); i++)
+		threadBins[i].overflow = 0;
+}
+
+HistogramOutput::~HistogramOutput() {
+#ifdef WITH_GALACTIC_LENSES
+	for (size_t i = 0; i < axes.size(); i++)
+		delete axes[i].pixelization;
+#endif
+}
+
+void HistogramOutput::add(const Axis &axis) {
+	if (axis.bins == 0)
+		throw std::runtime_error("HistogramOutput: axis without bins");
+	if (nBins > std::numeric_limits<size_t>::max() / axis.bins)
+		throw std::runtime_error("HistogramOutput: too many bins");
+	axes.push_back(axis);
+	nBins *= axis.bins;
+	clear();
+}
+
+void HistogramOutput::addAxis(Quantity quantity, size_t n, double min,
+		double max, bool log) {
+	if ((quantity == Id) || (quantity == Direction))
+		throw std::runtime_error(
+				"HistogramOutput: use addIdAxis or addDirectionAxis");
+	if (!(max > min))
+		throw std::runtime_error("HistogramOutput: axis with max <= min");
+	if (log && !(min > 0))
+		throw std::runtime_error(
+				"HistogramOutput: logarithmic axis with min <= 0");
+	Axis axis;
+	axis.quantity = quantity;
+	axis.bins = n;
+	axis.min = min;
+	axis.max = max;
+	axis.logarithmic = log;
+	axis.pixelization = 0;
+	add(axis);
+}
+
+void HistogramOutput::addIdAxis(const std::vector<int> &ids) {
+	Axis axis;
+	axis.quantity = Id;
+	axis.bins = ids.size();
+	axis.min = axis.max = 0;
+	axis.logarithmic = false;
+	axis.ids = ids;
+	axis.pixelization = 0;
+	add(axis);
+}
+
+void HistogramOutput::addDirectionAxis(uint8_t order) {
+#ifdef WITH_GALACTIC_LENSES
+	if (order >= _nOrder_max)
+		throw std::runtime_error("HistogramOutput: HEALPix order too large");
+	Axis axis;
+	axis.quantity = Direction;
+	axis.bins = Pixelization::nPix(order);
+	axis.min = axis.max = order;
+	axis.logarithmic = false;
+	axis.pixelization = new Pixelization(order);
+	try {
+		add(axis);
+	} catch (...) {
+		delete axis.pixelization;
+		throw;
+	}
+#else
+	throw std::runtime_error(
+			"HistogramOutput: direction axes need the galactic lenses (HEALPix)");
+#endif
+}
+
+bool HistogramOutput::binIndex(const Axis &axis, const Candidate *candidate,
+		size_t &i) const {
+	const ParticleState &current = candidate->current;
+	double x = 0;
+	switch (axis.quantity) {
+	case Id:
+		for (i = 0; i < axis.ids.size(); i++)
+			if (axis.ids[i] == current.getId())
+				return true;
+		return false;
+	case Direction: {
+#ifdef WITH_GALACTIC_LENSES
+		// arrival direction, as ParticleMapsContainer::addParticle
+		Vector3d u = current.getDirection();
+		double longitude = atan2(-u.y, -u.x);
+		double latitude = M_PI / 2 - acos(-u.z / u.getR());
+		i = axis.pixelization->direction2Pix(longitude, latitude);
+		return i < axis.bins;
+#else
+		return false;
+#endif
+	}
+	case Energy:
+		x = current.getEnergy();
+		break;
+	case Distance:
+		x = current.getPosition().getR();
+		break;
+	case TrajectoryLength:
+		x = candidate->getTrajectoryLength();
+		break;
+	case Redshift:
+		x = candidate->getRedshift();
+		break;
+	case SourceEnergy:
+		x = candidate->source.getEnergy();
+		break;
+	case SourceDistance:
+		x = candidate->source.getPosition().getR();
+		break;
+	}
+
+	double t;
+	if (axis.logarithmic) {
+		if (!(x > 0))
+			return false;
+		t = log(x / axis.min) / log(axis.max / axis.min);
+	} else {
+		t = (x - axis.min) / (axis.max - axis.min);
+	}
+	// also rejects NaN
+	if (!((t >= 0) && (t < 1)))
+		return false;
+	i = std::min(size_t(t * axis.bins), axis.bins - 1);
+	return true;
+}
+
+void HistogramOutput::process(Candidate *candidate) const {
+	double w = candidate->getWeight();
+	size_t index = 0;
+	bool inside = true;
+	for (size_t a = 0; a < axes.size(); a++) {
+		size_t i;
+		if (!binIndex(axes[a], candidate, i)) {
+			inside = false;
+			break;
+		}
+		index = index * axes[a].bins + i;
+	}
+
+	size_t thread = 0;
+#ifdef _OPENMP
+	thread = omp_get_thread_num();
+#endif
+	if (thread >= HISTOGRAM_THREADS - 1) {
+		// the last bins are shared and only changed atomically
+		ThreadBins &t = threadBins[HISTOGRAM_THREADS - 1];
+#pragma omp critical(HistogramOutput)
+		{
+			if (t.bins.empty())
+				t.bins.resize(nBins, 0);
+		}
+		double *bin = inside ? &t.bins[index] : &t.overflow;
+#pragma omp atomic
+		*bin += w;
+		return;
+	}
+
+	ThreadBins &t = threadBins[thread];
+	if (t.bins.empty())
+		t.bins.resize(nBins, 0);
+	if (inside)
+		t.bins[index] += w;
+	else
+		t.overflow += w;
+}
+
+void HistogramOutput::merge() const {
+	for (size_t i = 0; i < threadBins.size(); i++) {
+		ThreadBins &t = threadBins[i];
+		for (size_t j = 0; j < t.bins.size(); j++)
+			mergedBins[j] += t.bins[j];
+		mergedOverflow += t.overflow;
+		std::vector<double>().swap(t.bins);
+		t.overflow = 0;
+	}
+}
+
+size_t HistogramOutput::getNumberOfAxes() const {
+	return axes.size();
+}
+
+size_t HistogramOutput::getNumberOfBins(size_t axis) const {
+	return axes.at(axis).bins;
+}
+
+double HistogramOutput::getBinEdge(size_t axis, size_t i) const {
+	const Axis &a = axes.at(axis);
+	if ((a.quantity == Id) || (a.quantity == Direction))
+		throw std::runtime_error("HistogramOutput: axis without bin edges");
+	double t = double(i) / a.bins;
+	if (a.logarithmic)
+		return a.min * pow(a.max / a.min, t);
+	return a.min + (a.max - a.min) * t;
+}
+
+const std::vector<double> &HistogramOutput::getHistogram() const {
+	merge();
+	return mergedBins;
+}
+
+double HistogramOutput::getBin(const std::vector<size_t> &index) const {
+	if (index.size() != axes.size())
+		throw std::runtime_error("HistogramOutput: wrong number of indices");
+	size_t j = 0;
+	for (size_t a = 0; a < axes.size(); a++) {
+		if (index[a] >= axes[a].bins)
+			throw std::out_of_range("HistogramOutput: index out of range");
+		j = j * axes[a].bins + index[a];
+	}
+	return getHistogram()[j];
+}
+
+double HistogramOutput::getOverflow() const {
+	merge();
+	return mergedOverflow;
+}
+
+void HistogramOutput::clear() {
+	for (size_t i = 0; i < threadBins.size(); i++) {
+		std::vector<double>().swap(threadBins[i].bins);
+		threadBins[i].overflow = 0;
+	}
+	mergedBins.assign(nBins, 0);
+	mergedOverflow = 0;
+}
+
+void HistogramOutput::save(const std::string &filename) const {
+	merge();
+	std::ofstream out(filename.c_str());
+	if (!out.good())
+		throw std::runtime_error("HistogramOutput: could not open file " + filename);
+	out.imbue(std::locale::classic());
+	out.precision(17);
+
+	out << "# HistogramOutput, energies in EeV and distances in Mpc\n";
+	for (size_t a = 0; a < axes.size(); a++) {
+		const Axis &axis = axes[a];
+		out << "# axis " << a << ": " << quantityName(axis.quantity) << " "
+				<< axis.bins;
+		if (axis.quantity == Id) {
+			out << " ids";
+			for (size_t i = 0; i < axis.ids.size(); i++)
+				out << " " << axis.ids[i];
+		} else if (axis.quantity == Direction) {
+			out << " HEALPix RING order " << axis.min;
+		} else {
+			double unit = 1;
+			if ((axis.quantity == Energy) || (axis.quantity == SourceEnergy))
+				unit = EeV;
+			else if (axis.quantity != Redshift)
+				unit = Mpc;
+			out << (axis.logarithmic ? " log " : " lin ") << axis.min / unit
+					<< " " << axis.max / unit;
+		}
+		out << "\n";
+	}
+	out << "# overflow " << mergedOverflow << "\n";
+	out << "#";
+	for (size_t a = 0; a < axes.size(); a++)
+		out << " i" << a;
+	out << " weight\n";
+
+	std::vector<size_t> index(axes.size(), 0);
+	for (size_t j = 0; j < mergedBins.size(); j++) {
+		if (mergedBins[j] != 0) {
+			size_t k = j;
+			for (size_t a = axes.size(); a-- > 0;) {
+				index[a] = k % axes[a].bins;
+				k /= axes[a].bins;
+			}
+			for (size_t a = 0; a < axes.size(); a++)
+				out << index[a] << " ";
+			out << mergedBins[j] << "\n";
+		}
+	}
+	out.close();
+	if (!out)
+		throw std::runtime_error("HistogramOutput: could not write file " + filename);
+}
+
+std::string HistogramOutput::getDescription() const {
+	std::stringstream s;
+	s << "HistogramOutput: " << nBins << " bins, axes:";
+	for (size_t a = 0; a < axes.size(); a++)
+		s << " " << quantityName(axes[a].quantity) << "(" << axes[a].bins << ")";
+	return s.str();
+}
+
+} // namespace crpropa
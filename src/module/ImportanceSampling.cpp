@@ -0,0 +1,154 @@
+#include "crpropa/module/ImportanceSampling.h"
+#include "crpropa/Random.h"
+#include "crpropa/Units.h"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+
+namespace crpropa {
+
+// level of a vanishing importance
+static const int LOWEST_LEVEL = -1024;
+
+// number of the instances, for the names of their properties
+static size_t samplingInstances = 0;
+
+ImportanceSampling::ImportanceSampling(const Vector3d &center, double radius,
+		double distancePower, double anglePower) :
+		center(center), distancePower(distancePower), anglePower(anglePower),
+		maxSplitting(16) {
+	setRadius(radius);
+	std::stringstream key;
+	key << "ImportanceSampling" << __sync_add_and_fetch(&samplingInstances, 1) << ".level";
+	levelKey = PropertyKey(key.str());
+}
+
+void ImportanceSampling::setCenter(const Vector3d &c) {
+	center = c;
+}
+
+const Vector3d &ImportanceSampling::getCenter() const {
+	return center;
+}
+
+void ImportanceSampling::setRadius(double r) {
+	if (!(r > 0))
+		throw std::runtime_error("ImportanceSampling: the radius must be positive");
+	radius = r;
+}
+
+double ImportanceSampling::getRadius() const {
+	return radius;
+}
+
+void ImportanceSampling::setDistancePower(double power) {
+	distancePower = power;
+}
+
+double ImportanceSampling::getDistancePower() const {
+	return distancePower;
+}
+
+void ImportanceSampling::setAnglePower(double power) {
+	anglePower = power;
+}
+
+double ImportanceSampling::getAnglePower() const {
+	return anglePower;
+}
+
+void ImportanceSampling::setImportanceGrid(ref_ptr<ScalarGrid> g) {
+	grid = g;
+}
+
+ref_ptr<ScalarGrid> ImportanceSampling::getImportanceGrid() const {
+	return grid;
+}
+
+void ImportanceSampling::setMaxSplitting(int n) {
+	if (n < 1)
+		throw std::runtime_error("ImportanceSampling: the maximum splitting must be >= 1");
+	maxSplitting = n;
+}
+
+int ImportanceSampling::getMaxSplitting() const {
+	return maxSplitting;
+}
+
+double ImportanceSampling::getImportance(const Candidate *candidate) const {
+	const Vector3d &x = candidate->current.getPosition();
+	Vector3d toCenter = center - x;
+	double d = toCenter.getR();
+	double importance = 1;
+	if (distancePower != 0)
+		importance *= pow(radius / std::max(d, radius), distancePower);
+	if ((anglePower != 0) && (d > 0)) {
+		double cosAngle = candidate->current.getDirection().dot(toCenter) / d;
+		importance *= pow(std::max(0., (1 + cosAngle) / 2), anglePower);
+	}
+	if (grid.valid())
+		importance *= grid->interpolate(x);
+	return importance;
+}
+
+int ImportanceSampling::getLevel(const Candidate *candidate) const {
+	double importance = getImportance(candidate);
+	if (!(importance > 0))
+		return LOWEST_LEVEL;
+	return std::max(LOWEST_LEVEL, int(std::floor(std::log(importance) / std::log(2.))));
+}
+
+void ImportanceSampling::process(Candidate *candidate) const {
+	if (!candidate->isActive())
+		return;
+	int level = getLevel(candidate);
+	if (!candidate->hasProperty(levelKey)) {
+		candidate->setProperty(levelKey, level);
+		return;
+	}
+	int last = candidate->getProperty(levelKey).toInt32();
+	if (level == last)
+		return;
+
+	if (level < last) {
+		// Russian roulette
+		int k = last - level;
+		candidate->setProperty(levelKey, level);
+		if (Random::instance().rand() < ldexp(1., -k))
+			candidate->setWeight(candidate->getWeight() * ldexp(1., k));
+		else
+			candidate->setActive(false);
+		return;
+	}
+
+	// split into 2^k candidates, k limited by the maximum splitting
+	int k = 0;
+	while ((last + k < level) && ((2 << k) <= maxSplitting))
+		k++;
+	candidate->setProperty(levelKey, last + k);
+	if (k == 0)
+		return;
+	int n = 1 << k;
+	candidate->setWeight(candidate->getWeight() / n);
+	for (int i = 1; i < n; i++) {
+		ref_ptr<Candidate> clone = candidate->clone(false);
+		clone->setThreadConfined(candidate->isThreadConfined());
+		clone->parent = candidate;
+		candidate->addSecondary(clone);
+	}
+}
+
+std::string ImportanceSampling::getDescription() const {
+	std::stringstream s;
+	s << "ImportanceSampling: center " << center / Mpc << " Mpc, radius "
+			<< radius / Mpc << " Mpc, distance power " << distancePower
+			<< ", angle power " << anglePower;
+	if (grid.valid())
+		s << ", importance grid";
+	s << ", splitting up to " << maxSplitting;
+	return s.str();
+}
+
+} // namespace crpropa
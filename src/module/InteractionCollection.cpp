@@ -0,0 +1,134 @@
+#include "crpropa/module/InteractionCollection.h"
+#include "crpropa/Random.h"
+
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+
+namespace crpropa {
+
+InteractionCollection::InteractionCollection(double limit) :
+		limit(limit), rateTolerance(0) {
+	// own property names, several collections can process the same candidate
+	static int instances = 0;
+	std::stringstream s;
+	s << "InteractionCollection" << __sync_fetch_and_add(&instances, 1) << ".";
+	rateKey = s.str() + "rate";
+	idKey = s.str() + "id";
+	energyKey = s.str() + "energy";
+	redshiftKey = s.str() + "redshift";
+}
+
+void InteractionCollection::add(Interaction *interaction) {
+	interactions.push_back(interaction);
+}
+
+size_t InteractionCollection::size() const {
+	return interactions.size();
+}
+
+void InteractionCollection::setLimit(double l) {
+	limit = l;
+}
+
+double InteractionCollection::getLimit() const {
+	return limit;
+}
+
+void InteractionCollection::setRateTolerance(double tolerance) {
+	if (tolerance < 0)
+		throw std::runtime_error("InteractionCollection: rate tolerance < 0");
+	rateTolerance = tolerance;
+}
+
+double InteractionCollection::getRateTolerance() const {
+	return rateTolerance;
+}
+
+double InteractionCollection::totalRate(Candidate *candidate,
+		std::vector<double> &rates) const {
+	double total = 0;
+	for (size_t i = 0; i < interactions.size(); i++) {
+		rates[i] = interactions[i]->interactionRate(candidate)
+				* interactions[i]->getInteractionBias();
+		total += rates[i];
+	}
+	return total;
+}
+
+// total rate from the last evaluation for this candidate, if still valid,
+// the partial rates are then left empty
+double InteractionCollection::cachedTotalRate(Candidate *candidate,
+		std::vector<double> &rates) const {
+	const ParticleState &current = candidate->current;
+	double E = current.getEnergy();
+	double z = candidate->getRedshift();
+	if (candidate->hasProperty(rateKey)
+			and (candidate->getProperty(idKey).toInt32() == current.getId())
+			and (fabs(E / candidate->getProperty(energyKey).toDouble() - 1) <= rateTolerance)
+			and (fabs((1 + z) / (1 + candidate->getProperty(redshiftKey).toDouble()) - 1) <= rateTolerance)) {
+		rates.clear();
+		return candidate->getProperty(rateKey).toDouble();
+	}
+
+	rates.resize(interactions.size());
+	double total = totalRate(candidate, rates);
+	candidate->setProperty(rateKey, total);
+	candidate->setProperty(idKey, current.getId());
+	candidate->setProperty(energyKey, E);
+	candidate->setProperty(redshiftKey, z);
+	return total;
+}
+
+void InteractionCollection::process(Candidate *candidate) const {
+	std::vector<double> rates(interactions.size());
+	double step = candidate->getCurrentStep();
+	// the loop is processed at least once for limiting the next step
+	do {
+		double total;
+		if (rateTolerance > 0)
+			total = cachedTotalRate(candidate, rates);
+		else
+			total = totalRate(candidate, rates);
+		if (total == 0)
+			return;
+
+		// check if an interaction happens in this step
+		Random &random = Random::instance();
+		double randDistance = -log(random.rand()) / total;
+		if (step < randDistance) {
+			candidate->limitNextStep(limit / total);
+			return;
+		}
+
+		// select the interaction according to the partial rates
+		if (rates.empty()) {
+			rates.resize(interactions.size());
+			total = totalRate(candidate, rates);
+			if (total == 0)
+				return;
+		}
+		double r = random.rand() * total;
+		size_t i = 0;
+		while ((i + 1 < rates.size()) and ((r >= rates[i]) or (rates[i] == 0))) {
+			r -= rates[i];
+			i++;
+		}
+		interactions[i]->interactBiased(candidate);
+		if (rateTolerance > 0)
+			candidate->removeProperty(rateKey); // the state changed
+
+		// repeat with remaining step
+		step -= randDistance;
+	} while ((step > 0) and candidate->isActive());
+}
+
+std::string InteractionCollection::getDescription() const {
+	std::stringstream s;
+	s << "InteractionCollection: " << interactions.size() << " interactions";
+	for (size_t i = 0; i < interactions.size(); i++)
+		s << "\n  " << interactions[i]->getDescription();
+	return s.str();
+}
+
+} // namespace crpropa
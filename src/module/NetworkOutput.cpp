@@ -0,0 +1,395 @@
+#include "crpropa/module/NetworkOutput.h"
+#include "crpropa/Trace.h"
+
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace crpropa {
+
+static const char streamMagic[8] = {'C', 'R', 'P', 'S', 'T', 'R', 'M', '1'};
+static const size_t STAGING_THREADS = 256; // further threads hand over single rows
+// the sends of the sender thread, see Trace
+static const size_t traceSend = Trace::addName("NetworkOutput send", "output");
+
+template<typename T>
+static void appendValue(std::string &rows, const T &value) {
+	rows.append((const char *) &value, sizeof(T));
+}
+
+NetworkOutput::NetworkOutput(const std::string &host, int port, OutputType outputtype) :
+		Output(outputtype), host(host), port(port), fd(-1), isOpen(0), rowSize(0),
+		batchRows(1024), maxQueued(64), dropWhenFull(false), sending(0),
+		droppedRows(0), failed(false), stop(false) {
+	std::stringstream service;
+	service << port;
+	struct addrinfo hints, *addresses;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(host.c_str(), service.str().c_str(), &hints, &addresses) != 0)
+		throw std::runtime_error("NetworkOutput: unknown host " + host);
+	for (struct addrinfo *a = addresses; a && (fd < 0); a = a->ai_next) {
+		fd = ::socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+		if ((fd >= 0) && (connect(fd, a->ai_addr, a->ai_addrlen) != 0)) {
+			::close(fd);
+			fd = -1;
+		}
+	}
+	freeaddrinfo(addresses);
+	if (fd < 0)
+		throw std::runtime_error("NetworkOutput: cannot connect to " + host + ":" + service.str());
+	// the batches are large, send them at once
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&queueChanged, NULL);
+}
+
+NetworkOutput::~NetworkOutput() {
+	close();
+	pthread_cond_destroy(&queueChanged);
+	pthread_mutex_destroy(&mutex);
+}
+
+void NetworkOutput::addColumn(const char *name, ColumnValue value, const char *type, size_t size) {
+	Column c = {name, value, type, size};
+	columns.push_back(c);
+	rowSize += size;
+}
+
+void NetworkOutput::open() {
+	columns.clear();
+	rowSize = 0;
+	if (fields.test(TrajectoryLengthColumn))
+		addColumn("D", ColD, "float64", 8);
+	if (fields.test(RedshiftColumn))
+		addColumn("z", Colz, "float64", 8);
+	if (fields.test(SerialNumberColumn))
+		addColumn("SN", ColSN, "uint64", 8);
+	if (fields.test(CurrentIdColumn))
+		addColumn("ID", ColID, "int32", 4);
+	if (fields.test(CurrentEnergyColumn))
+		addColumn("E", ColE, "float64", 8);
+	if (fields.test(CurrentPositionColumn))
+		addColumn("X", ColX, "float64", 8);
+	if (fields.test(CurrentPositionColumn) && !oneDimensional) {
+		addColumn("Y", ColY, "float64", 8);
+		addColumn("Z", ColZ, "float64", 8);
+	}
+	if (fields.test(CurrentDirectionColumn) && !oneDimensional) {
+		addColumn("Px", ColPx, "float64", 8);
+		addColumn("Py", ColPy, "float64", 8);
+		addColumn("Pz", ColPz, "float64", 8);
+	}
+	if (fields.test(SerialNumberColumn))
+		addColumn("SN0", ColSN0, "uint64", 8);
+	if (fields.test(SourceIdColumn))
+		addColumn("ID0", ColID0, "int32", 4);
+	if (fields.test(SourceEnergyColumn))
+		addColumn("E0", ColE0, "float64", 8);
+	if (fields.test(SourcePositionColumn))
+		addColumn("X0", ColX0, "float64", 8);
+	if (fields.test(SourcePositionColumn) && !oneDimensional) {
+		addColumn("Y0", ColY0, "float64", 8);
+		addColumn("Z0", ColZ0, "float64", 8);
+	}
+	if (fields.test(SourceDirectionColumn) && !oneDimensional) {
+		addColumn("P0x", ColP0x, "float64", 8);
+		addColumn("P0y", ColP0y, "float64", 8);
+		addColumn("P0z", ColP0z, "float64", 8);
+	}
+	if (fields.test(SerialNumberColumn))
+		addColumn("SN1", ColSN1, "uint64", 8);
+	if (fields.test(CreatedIdColumn))
+		addColumn("ID1", ColID1, "int32", 4);
+	if (fields.test(CreatedEnergyColumn))
+		addColumn("E1", ColE1, "float64", 8);
+	if (fields.test(CreatedPositionColumn))
+		addColumn("X1", ColX1, "float64", 8);
+	if (fields.test(CreatedPositionColumn) && !oneDimensional) {
+		addColumn("Y1", ColY1, "float64", 8);
+		addColumn("Z1", ColZ1, "float64", 8);
+	}
+	if (fields.test(CreatedDirectionColumn) && !oneDimensional) {
+		addColumn("P1x", ColP1x, "float64", 8);
+		addColumn("P1y", ColP1y, "float64", 8);
+		addColumn("P1z", ColP1z, "float64", 8);
+	}
+	if (fields.test(WeightColumn))
+		addColumn("weight", Colweight, "float64", 8);
+
+	std::stringstream header;
+	for (size_t i = 0; i < columns.size(); i++)
+		header << columns[i].name << " " << columns[i].type << " " << columns[i].size << "\n";
+	for (size_t i = 0; i < properties.size(); i++) {
+		const Variant &v = properties[i].defaultValue;
+		header << properties[i].name << " " << v.getTypeName() << " " << v.getSize() << "\n";
+		rowSize += v.getSize();
+	}
+	std::string start(streamMagic, 8);
+	uint32_t length = header.str().size();
+	appendValue(start, length);
+	start += header.str();
+	if (!sendAll(start.data(), start.size()))
+		throw std::runtime_error("NetworkOutput: cannot send to " + host);
+
+	staging.resize(STAGING_THREADS);
+	stop = false;
+	if (pthread_create(&sender, NULL, senderMain, this) != 0)
+		throw std::runtime_error("NetworkOutput: could not start the sender thread");
+	__atomic_store_n(&isOpen, 1, __ATOMIC_RELEASE);
+}
+
+bool NetworkOutput::sendAll(const char *data, size_t size) const {
+	while (size > 0) {
+		ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+		if (n <= 0)
+			return false;
+		data += n;
+		size -= n;
+	}
+	return true;
+}
+
+void *NetworkOutput::senderMain(void *output) {
+	NetworkOutput *self = (NetworkOutput *) output;
+	pthread_mutex_lock(&self->mutex);
+	while (true) {
+		while (self->queue.empty() && !self->stop)
+			pthread_cond_wait(&self->queueChanged, &self->mutex);
+		if (self->queue.empty())
+			break; // stopped and nothing left to send
+
+		std::string *batch = self->queue.front();
+		self->queue.pop_front();
+		self->sending++;
+		bool failed = self->failed;
+		pthread_cond_broadcast(&self->queueChanged);
+		pthread_mutex_unlock(&self->mutex);
+
+		// the rows are sent while the simulation continues
+		uint32_t counts[2] = {uint32_t(batch->size() / self->rowSize), uint32_t(batch->size())};
+		if (!failed) {
+			double traceStart = Trace::isEnabled() ? Trace::now() : 0;
+			failed = !self->sendAll((const char *) counts, sizeof(counts))
+					|| !self->sendAll(batch->data(), batch->size());
+			if (Trace::isEnabled())
+				Trace::record(traceSend, traceStart, Trace::now());
+		}
+		delete batch;
+
+		pthread_mutex_lock(&self->mutex);
+		self->failed = failed;
+		self->sending--;
+		pthread_cond_broadcast(&self->queueChanged);
+	}
+	pthread_mutex_unlock(&self->mutex);
+	return 0;
+}
+
+void NetworkOutput::push(std::string *batch) const {
+	pthread_mutex_lock(&mutex);
+	if (dropWhenFull && (queue.size() >= maxQueued)) {
+		droppedRows += batch->size() / rowSize;
+		delete batch;
+	} else {
+		while (queue.size() >= maxQueued)
+			pthread_cond_wait(&queueChanged, &mutex);
+		queue.push_back(batch);
+		pthread_cond_broadcast(&queueChanged);
+	}
+	bool lost = failed;
+	pthread_mutex_unlock(&mutex);
+	if (lost)
+		throw std::runtime_error("NetworkOutput: lost the connection to " + host);
+}
+
+void NetworkOutput::packRow(Candidate *candidate, std::string &rows) const {
+	for (size_t i = 0; i < columns.size(); i++) {
+		switch (columns[i].value) {
+		case ColD: appendValue(rows, candidate->getTrajectoryLength() / lengthScale); break;
+		case Colz: appendValue(rows, candidate->getRedshift()); break;
+		case ColSN: appendValue(rows, (uint64_t) candidate->getSerialNumber()); break;
+		case ColID: appendValue(rows, (int32_t) candidate->current.getId()); break;
+		case ColE: appendValue(rows, candidate->current.getEnergy() / energyScale); break;
+		case ColX: appendValue(rows, candidate->current.getPosition().x / lengthScale); break;
+		case ColY: appendValue(rows, candidate->current.getPosition().y / lengthScale); break;
+		case ColZ: appendValue(rows, candidate->current.getPosition().z / lengthScale); break;
+		case ColPx: appendValue(rows, candidate->current.getDirection().x); break;
+		case ColPy: appendValue(rows, candidate->current.getDirection().y); break;
+		case ColPz: appendValue(rows, candidate->current.getDirection().z); break;
+		case ColSN0: appendValue(rows, (uint64_t) candidate->getSourceSerialNumber()); break;
+		case ColID0: appendValue(rows, (int32_t) candidate->source.getId()); break;
+		case ColE0: appendValue(rows, candidate->source.getEnergy() / energyScale); break;
+		case ColX0: appendValue(rows, candidate->source.getPosition().x / lengthScale); break;
+		case ColY0: appendValue(rows, candidate->source.getPosition().y / lengthScale); break;
+		case ColZ0: appendValue(rows, candidate->source.getPosition().z / lengthScale); break;
+		case ColP0x: appendValue(rows, candidate->source.getDirection().x); break;
+		case ColP0y: appendValue(rows, candidate->source.getDirection().y); break;
+		case ColP0z: appendValue(rows, candidate->source.getDirection().z); break;
+		case ColSN1: appendValue(rows, (uint64_t) candidate->getCreatedSerialNumber()); break;
+		case ColID1: appendValue(rows, (int32_t) candidate->created.getId()); break;
+		case ColE1: appendValue(rows, candidate->created.getEnergy() / energyScale); break;
+		case ColX1: appendValue(rows, candidate->created.getPosition().x / lengthScale); break;
+		case ColY1: appendValue(rows, candidate->created.getPosition().y / lengthScale); break;
+		case ColZ1: appendValue(rows, candidate->created.getPosition().z / lengthScale); break;
+		case ColP1x: appendValue(rows, candidate->created.getDirection().x); break;
+		case ColP1y: appendValue(rows, candidate->created.getDirection().y); break;
+		case ColP1z: appendValue(rows, candidate->created.getDirection().z); break;
+		case Colweight: appendValue(rows, candidate->getWeight()); break;
+		}
+	}
+
+	for (size_t i = 0; i < properties.size(); i++) {
+		const Variant &v = candidate->hasProperty(properties[i].key) ?
+				candidate->getProperty(properties[i].key) : properties[i].defaultValue;
+		size_t end = rows.size();
+		rows.resize(end + properties[i].defaultValue.getSize());
+		v.copyToBuffer(&rows[end]);
+	}
+}
+
+void NetworkOutput::process(Candidate *candidate) const {
+	if (!accepts(candidate))
+		return;
+
+	if (!__atomic_load_n(&isOpen, __ATOMIC_ACQUIRE)) {
+		std::string error;
+#pragma omp critical(NetworkOutput)
+		if (!isOpen && (fd >= 0)) {
+			try {
+				const_cast<NetworkOutput *>(this)->open();
+			} catch (std::exception &e) {
+				error = e.what();
+			}
+		}
+		if (!error.empty())
+			throw std::runtime_error(error);
+		if (!isOpen)
+			throw std::runtime_error("NetworkOutput: the connection is closed");
+	}
+
+	Output::process(candidate);
+
+#ifdef _OPENMP
+	size_t thread = omp_get_thread_num();
+#else
+	size_t thread = 0;
+#endif
+	if (thread >= STAGING_THREADS) {
+		std::string *batch = new std::string;
+		packRow(candidate, *batch);
+		push(batch);
+		return;
+	}
+
+	std::string &rows = staging[thread].rows;
+	if (rows.empty())
+		rows.reserve(batchRows * rowSize);
+	packRow(candidate, rows);
+	if (rows.size() >= batchRows * rowSize) {
+		std::string *batch = new std::string;
+		batch->swap(rows);
+		push(batch);
+	}
+}
+
+void NetworkOutput::flush() const {
+	if (!isOpen)
+		return;
+	// hand over the rows of all threads and wait for the sender
+	for (size_t i = 0; i < staging.size(); i++) {
+		if (staging[i].rows.empty())
+			continue;
+		std::string *batch = new std::string;
+		batch->swap(staging[i].rows);
+		push(batch);
+	}
+	pthread_mutex_lock(&mutex);
+	while (!queue.empty() || (sending > 0))
+		pthread_cond_wait(&queueChanged, &mutex);
+	pthread_mutex_unlock(&mutex);
+}
+
+void NetworkOutput::close() {
+	if (fd < 0)
+		return;
+	if (isOpen) {
+		try {
+			flush();
+		} catch (std::exception &e) {
+			// the connection is lost, the rows are discarded below
+		}
+		pthread_mutex_lock(&mutex);
+		stop = true;
+		pthread_cond_broadcast(&queueChanged);
+		pthread_mutex_unlock(&mutex);
+		pthread_join(sender, NULL);
+		staging.clear();
+		uint32_t end[2] = {0, 0};
+		if (!failed)
+			sendAll((const char *) end, sizeof(end));
+		isOpen = 0;
+	}
+	::close(fd);
+	fd = -1;
+}
+
+void NetworkOutput::setBatchSize(size_t rows) {
+	if (rows == 0)
+		throw std::runtime_error("NetworkOutput: the batch size must be larger than 0");
+	batchRows = rows;
+}
+
+size_t NetworkOutput::getBatchSize() const {
+	return batchRows;
+}
+
+void NetworkOutput::setMaxQueuedBatches(size_t n) {
+	if (n == 0)
+		throw std::runtime_error("NetworkOutput: at least one batch has to be queued");
+	maxQueued = n;
+}
+
+size_t NetworkOutput::getMaxQueuedBatches() const {
+	return maxQueued;
+}
+
+void NetworkOutput::setDropWhenFull(bool drop) {
+	dropWhenFull = drop;
+}
+
+size_t NetworkOutput::getDroppedRows() const {
+	pthread_mutex_lock(&mutex);
+	size_t n = droppedRows;
+	pthread_mutex_unlock(&mutex);
+	return n;
+}
+
+size_t NetworkOutput::getRowSize() const {
+	return rowSize;
+}
+
+std::string NetworkOutput::getDescription() const {
+	std::stringstream s;
+	s << "NetworkOutput: " << host << ":" << port << ", batches of " << batchRows
+			<< " rows, at most " << maxQueued << " queued";
+	if (dropWhenFull)
+		s << ", dropped when full";
+	return s.str();
+}
+
+} // namespace crpropa
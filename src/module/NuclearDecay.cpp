@@ -1,14 +1,18 @@
 #include "crpropa/module/NuclearDecay.h"
+#include "crpropa/DataTable.h"
 #include "crpropa/Units.h"
 #include "crpropa/ParticleID.h"
 #include "crpropa/ParticleMass.h"
 #include "crpropa/Random.h"
+#include "crpropa/Statistics.h"
 
+#include <algorithm>
 #include <fstream>
 #include <limits>
 #include <cmath>
 #include <stdexcept>
 
+#include <kiss/convert.h>
 #include <kiss/logger.h>
 
 namespace crpropa {
@@ -22,34 +26,102 @@ NuclearDecay::NuclearDecay(bool electrons, bool photons, bool neutrinos, double
 
 	// load decay table
 	std::string filename = getDataPath("nuclear_decay.txt");
-	std::ifstream infile(filename.c_str());
-	if (!infile.good())
+	ref_ptr<DataTable> table = DataTable::open(filename);
+	if (!table.valid())
 		throw std::runtime_error(
 				"crpropa::NuclearDecay: could not open file " + filename);
 
-	decayTable.resize(27 * 31);
-	std::string line;
-	while (std::getline(infile,line)) {
-		std::stringstream stream(line);
-		if (stream.peek() == '#')
-			continue;
+	// rows: Z, N, channel, lifetime, pairs of gamma energy and intensity
+	std::vector<std::pair<int, size_t> > nuclei;
+	for (size_t i = 0; i < table->size(); i++) {
+		if (table->rowSize(i) < 4)
+			throw std::runtime_error(
+					"crpropa::NuclearDecay: incomplete row in " + filename);
+		const double *row = table->row(i);
+		nuclei.push_back(std::make_pair(int(row[0]) * 31 + int(row[1]), i));
+	}
+
+	// flat arrays sorted by nucleus, in file order
+	std::sort(nuclei.begin(), nuclei.end());
+	decayBegin.assign(27 * 31 + 1, 0);
+	tabTotalRate.assign(27 * 31, 0.);
+	for (size_t i = 0; i < nuclei.size(); i++) {
+		const double *row = table->row(nuclei[i].second);
+		size_t n = table->rowSize(nuclei[i].second);
 		DecayMode decay;
-		int Z, N;
-		double lifetime;
-		stream >> Z >> N >> decay.channel >> lifetime;
+		decay.channel = int(row[2]);
+		double lifetime = row[3];
 		decay.rate = 1. / lifetime / c_light; // decay rate in [1/m]
-		std::vector<double> gamma;
-		double val;
-		while (stream >> val)
-			gamma.push_back(val);
-		for (int i = 0; i < gamma.size(); i += 2) {
-			decay.energy.push_back(gamma[i] * keV);
-			decay.intensity.push_back(gamma[i+1]);
+		decay.gammaBegin = tabGamma.size() / 2;
+		for (size_t j = 4; j + 1 < n; j += 2) {
+			tabGamma.push_back(row[j] * keV);
+			tabGamma.push_back(row[j + 1]);
+		}
+		decay.gammaEnd = tabGamma.size() / 2;
+		decayModes.push_back(decay);
+		decayBegin[nuclei[i].first + 1]++;
+		tabTotalRate[nuclei[i].first] += decay.rate;
+	}
+	for (size_t i = 0; i < 27 * 31; i++)
+		decayBegin[i + 1] += decayBegin[i];
+	initBetaSpectra();
+}
+
+// spectrum of the electron (positron) from the beta- (beta+) decay of (A, Z),
+// neglecting Coulomb correction, see Basdevant, Fundamentals in Nuclear Physics, eq. (4.92)
+static void betaSpectrum(int A, int Z, int dZ, double &Q,
+		std::vector<double> &energies, std::vector<double> &densities) {
+	double m1 = nuclearMass(A, Z);
+	double m2 = nuclearMass(A, Z + dZ);
+	Q = (m1 - m2 - mass_electron) * c_squared;
+
+	energies.resize(51);
+	densities.resize(51);
+	double me = mass_electron * c_squared;
+	double cdf = 0;
+	for (int i = 0; i <= 50; i++) {
+		double E = me + i / 50. * Q;
+		cdf += E * sqrt(E * E - me * me) * pow(Q + me - E, 2);
+		energies[i] = E;
+		densities[i] = cdf;
+	}
+}
+
+void NuclearDecay::initBetaSpectra() {
+	BetaSpectrum none = {0., 0, 0};
+	tabBetaMinus.assign(27 * 31, none);
+	tabBetaPlus.assign(27 * 31, none);
+	tabBetaSpectra.clear();
+
+	// follow the beta decays of each channel, they are performed in sequence
+	for (int Z = 0; Z <= 26; Z++) {
+		for (int N = 0; N <= 30; N++) {
+			for (size_t i = decayBegin[Z * 31 + N]; i < decayBegin[Z * 31 + N + 1]; i++) {
+				int nBeta[2] = {digit(decayModes[i].channel, 10000), digit(decayModes[i].channel, 1000)};
+				int z = Z, n = N;
+				for (int k = 0; k < 2; k++) {
+					int dZ = (k == 0) ? 1 : -1;
+					std::vector<BetaSpectrum> &tab = (k == 0) ? tabBetaMinus : tabBetaPlus;
+					for (int j = 0; j < nBeta[k]; j++) {
+						// nuclei outside of the mass table are computed when they decay
+						if ((z + dZ < 0) or (z + dZ > 26) or (n - dZ < 0) or (n - dZ > 30))
+							break;
+						BetaSpectrum &b = tab[z * 31 + n];
+						if (b.n == 0) {
+							std::vector<double> energy, cdf;
+							betaSpectrum(z + n, z, dZ, b.Q, energy, cdf);
+							b.begin = tabBetaSpectra.size();
+							b.n = cdf.size();
+							tabBetaSpectra.insert(tabBetaSpectra.end(), cdf.begin(), cdf.end());
+							tabBetaSpectra.insert(tabBetaSpectra.end(), energy.begin(), energy.end());
+						}
+						z += dZ;
+						n -= dZ;
+					}
+				}
+			}
 		}
-		if (infile)
-			decayTable[Z * 31 + N].push_back(decay);
 	}
-	infile.close();
 }
 
 void NuclearDecay::setHaveElectrons(bool b) {
@@ -68,42 +140,58 @@ void NuclearDecay::setLimit(double l) {
 	limit = l;
 }
 
+double NuclearDecay::interactionRate(const Candidate *candidate) const {
+	// check if nucleus
+	if (not candidate->current.isNucleus())
+		return 0;
+
+	int Z = candidate->current.getChargeNumber();
+	int N = candidate->current.getMassNumber() - Z;
+	if ((Z > 26) or (N > 30))
+		return 0;
+
+	double totalRate = tabTotalRate[Z * 31 + N];
+	if (totalRate == 0)
+		return 0;
+
+	totalRate /= candidate->current.getLorentzFactor();  // relativistic time dilation
+	totalRate /= (1 + candidate->getRedshift());  // rate per light travel distance -> rate per comoving distance
+	return totalRate;
+}
+
+void NuclearDecay::interact(Candidate *candidate) const {
+	int Z = candidate->current.getChargeNumber();
+	int N = candidate->current.getMassNumber() - Z;
+	size_t begin = decayBegin[Z * 31 + N], end = decayBegin[Z * 31 + N + 1];
+
+	// select the decay mode according to the partial rates
+	double r = Random::instance().rand() * tabTotalRate[Z * 31 + N];
+	size_t i = begin;
+	while ((i + 1 < end) and (r >= decayModes[i].rate)) {
+		r -= decayModes[i].rate;
+		i++;
+	}
+	performDecay(candidate, decayModes[i]);
+}
+
 void NuclearDecay::process(Candidate *candidate) const {
 	// the loop should be processed at least once for limiting the next step
 	double step = candidate->getCurrentStep();
-	double z = candidate->getRedshift();
 	do {
-		// check if nucleus
-		int id = candidate->current.getId();
-		if (not (isNucleus(id)))
-			return;
-
-		int A = massNumber(id);
-		int Z = chargeNumber(id);
-		int N = A - Z;
-
 		// check if particle can decay
-		const std::vector<DecayMode> &decays = decayTable[Z * 31 + N];
-		if (decays.size() == 0)
+		double totalRate = interactionRate(candidate);
+		if (totalRate == 0)
 			return;
 
-		// find interaction mode with minimum random decay distance
-		Random &random = Random::instance();
-		double randDistance = std::numeric_limits<double>::max();
-		int channel;
-		double totalRate = 0;
-
-		for (size_t i = 0; i < decays.size(); i++) {
-			double rate = decays[i].rate;
-			rate /= candidate->current.getLorentzFactor();  // relativistic time dilation
-			rate /= (1 + z);  // rate per light travel distance -> rate per comoving distance
-			totalRate += rate;
-			double d = -log(random.rand()) / rate;
-			if (d > randDistance)
-				continue;
-			randDistance = d;
-			channel = decays[i].channel;
+		// decays that are certain within the remaining step (survival probability
+		// below 1e-20) happen right away, at the mean decay distance, without bias
+		if (totalRate * step > 46) {
+			interact(candidate);
+			step -= 1 / totalRate;
+			continue;
 		}
+		totalRate *= getInteractionBias();
+		double randDistance = -log(Random::instance().rand()) / totalRate;
 
 		// check if interaction doesn't happen
 		if (step < randDistance) {
@@ -113,13 +201,37 @@ void NuclearDecay::process(Candidate *candidate) const {
 		}
 
 		// interact and repeat with remaining step
-		performInteraction(candidate, channel);
+		interactBiased(candidate);
 		step -= randDistance;
 	} while (step > 0);
 }
 
 void NuclearDecay::performInteraction(Candidate *candidate, int channel) const {
+	if (Statistics::isEnabled())
+		Statistics::count("NuclearDecay: channel " + kiss::str(channel));
+
+	int Z = candidate->current.getChargeNumber();
+	int N = candidate->current.getMassNumber() - Z;
+
+	// find the decay mode of the channel
+	if ((Z <= 26) and (N <= 30)) {
+		for (size_t i = decayBegin[Z * 31 + N]; i < decayBegin[Z * 31 + N + 1]; i++)
+			if (decayModes[i].channel == channel)
+				return performDecay(candidate, decayModes[i]);
+	}
+
+	// channel without gamma lines
+	DecayMode decay;
+	decay.channel = channel;
+	decay.rate = 0;
+	decay.gammaBegin = 0;
+	decay.gammaEnd = 0;
+	performDecay(candidate, decay);
+}
+
+void NuclearDecay::performDecay(Candidate *candidate, const DecayMode &decay) const {
 	// interpret decay channel
+	int channel = decay.channel;
 	int nBetaMinus = digit(channel, 10000);
 	int nBetaPlus = digit(channel, 1000);
 	int nAlpha = digit(channel, 100);
@@ -128,7 +240,7 @@ void NuclearDecay::performInteraction(Candidate *candidate, int channel) const {
 
 	// perform decays
 	if (havePhotons)
-		gammaEmission(candidate,channel);
+		gammaEmission(candidate, decay);
 	for (size_t i = 0; i < nBetaMinus; i++)
 		betaDecay(candidate, false);
 	for (size_t i = 0; i < nBetaPlus; i++)
@@ -142,44 +254,43 @@ void NuclearDecay::performInteraction(Candidate *candidate, int channel) const {
 }
 
 void NuclearDecay::gammaEmission(Candidate *candidate, int channel) const {
-	int id = candidate->current.getId();
-	int Z = chargeNumber(id);
-	int N = massNumber(id) - Z;
+	int Z = candidate->current.getChargeNumber();
+	int N = candidate->current.getMassNumber() - Z;
 
 	// get photon energies and emission probabilities for decay channel
-	const std::vector<DecayMode> &decays = decayTable[Z * 31 + N];
-	size_t idecay = decays.size();
-	while (idecay-- != 0) {
-		if (decays[idecay].channel == channel)
-			break;
+	if ((Z > 26) or (N > 30))
+		return;
+	size_t begin = decayBegin[Z * 31 + N];
+	size_t idecay = decayBegin[Z * 31 + N + 1];
+	while (idecay-- > begin) {
+		if (decayModes[idecay].channel == channel)
+			return gammaEmission(candidate, decayModes[idecay]);
 	}
+}
 
-	const std::vector<double> &energy = decays[idecay].energy;
-	const std::vector<double> &intensity = decays[idecay].intensity;
-
+void NuclearDecay::gammaEmission(Candidate *candidate, const DecayMode &decay) const {
 	// check if photon emission available
-	if (energy.size() == 0)
+	if (decay.gammaBegin == decay.gammaEnd)
 		return;
 
 	Random &random = Random::instance();
 	Vector3d pos = random.randomInterpolatedPosition(candidate->previous.getPosition(), candidate->current.getPosition());
 
-	for (int i = 0; i < energy.size(); ++i) {
+	for (size_t i = decay.gammaBegin; i < decay.gammaEnd; ++i) {
 		// check if photon of specific energy is emitted
-		if (random.rand() > intensity[i])
+		if (random.rand() > tabGamma[2 * i + 1])
 			continue;
 		// create secondary photon; boost to lab frame
 		double cosTheta = 2 * random.rand() - 1;
-		double E = energy[i] * candidate->current.getLorentzFactor() * (1. - cosTheta);
+		double E = tabGamma[2 * i] * candidate->current.getLorentzFactor() * (1. - cosTheta);
 		candidate->addSecondary(22, E, pos);
 	}
 }
 
 void NuclearDecay::betaDecay(Candidate *candidate, bool isBetaPlus) const {
 	double gamma = candidate->current.getLorentzFactor();
-	int id = candidate->current.getId();
-	int A = massNumber(id);
-	int Z = chargeNumber(id);
+	int A = candidate->current.getMassNumber();
+	int Z = candidate->current.getChargeNumber();
 
 	// beta- decay
 	int electronId = 11; // electron
@@ -208,31 +319,25 @@ void NuclearDecay::betaDecay(Candidate *candidate, bool isBetaPlus) const {
 	if (not (haveElectrons or haveNeutrinos))
 		return;
 
-	// Q-value of the decay, subtract total energy of emitted photons
-	double m1 = nuclearMass(A, Z);
-	double m2 = nuclearMass(A, Z+dZ);
-	double Q = (m1 - m2 - mass_electron) * c_squared;
-
-	// generate cdf of electron energy, neglecting Coulomb correction
-	// see Basdevant, Fundamentals in Nuclear Physics, eq. (4.92)
-	std::vector<double> energies;
-	std::vector<double> densities; // cdf(E), unnormalized
-
-	energies.reserve(51);
-	densities.reserve(51);
-
+	// Q-value of the decay and cdf of the electron energy, tabulated at construction
+	int N = A - Z;
+	const BetaSpectrum *b = 0;
+	if ((Z <= 26) and (N <= 30))
+		b = isBetaPlus ? &tabBetaPlus[Z * 31 + N] : &tabBetaMinus[Z * 31 + N];
+	double Q, E;
 	double me = mass_electron * c_squared;
-	double cdf = 0;
-	for (int i = 0; i <= 50; i++) {
-		double E = me + i / 50. * Q;
-		cdf += E * sqrt(E * E - me * me) * pow(Q + me - E, 2);
-		energies.push_back(E);
-		densities.push_back(cdf);
-	}
 
 	// draw random electron energy and angle
 	Random &random = Random::instance();
-	double E = interpolate(random.rand() * cdf, densities, energies);
+	if (b and (b->n > 0)) {
+		Q = b->Q;
+		const double *cdf = &tabBetaSpectra[b->begin];
+		E = interpolate(random.rand() * cdf[b->n - 1], cdf, cdf + b->n, b->n);
+	} else {
+		std::vector<double> energy, cdf;
+		betaSpectrum(A, Z, dZ, Q, energy, cdf);
+		E = interpolate(random.rand() * cdf.back(), cdf, energy);
+	}
 	double p = sqrt(E * E - me * me);  // p*c
 	double cosTheta = 2 * random.rand() - 1;
 
@@ -249,9 +354,8 @@ void NuclearDecay::betaDecay(Candidate *candidate, bool isBetaPlus) const {
 
 void NuclearDecay::nucleonEmission(Candidate *candidate, int dA, int dZ) const {
 	Random &random = Random::instance();
-	int id = candidate->current.getId();
-	int A = massNumber(id);
-	int Z = chargeNumber(id);
+	int A = candidate->current.getMassNumber();
+	int Z = candidate->current.getChargeNumber();
 	double EpA = candidate->current.getEnergy() / double(A);
 
 	try
@@ -288,19 +392,14 @@ double NuclearDecay::meanFreePath(int id, double gamma) {
 	int N = A - Z;
 
 	// check if particle can decay
-	const std::vector<DecayMode> &decays = decayTable[Z * 31 + N];
-	if (decays.size() == 0)
+	if ((Z > 26) or (N > 30) or (tabTotalRate[Z * 31 + N] == 0))
 		return std::numeric_limits<double>::max();
 
-	double totalRate = 0;
-
-	for (size_t i = 0; i < decays.size(); i++) {
-		double rate = decays[i].rate;
-		rate /= gamma;
-		totalRate += rate;
-	}
+	return gamma / tabTotalRate[Z * 31 + N];
+}
 
-	return 1. / totalRate;
+int NuclearDecay::getParticleClasses() const {
+	return NucleiClasses;
 }
 
 } // namespace crpropa
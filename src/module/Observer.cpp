@@ -5,34 +5,230 @@
 
 #include "kiss/logger.h"
 
-#include <iostream>
+#include <algorithm>
 #include <cmath>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
 
 namespace crpropa {
 
 // Observer -------------------------------------------------------------------
+// number of the instances, for the names of their hint properties
+static size_t observerInstances = 0;
+
 Observer::Observer() :
-		makeInactive(true), clone(false) {
+		makeInactive(true), clone(false), hints(false), indexCellSize(0), indexBuilt(0) {
+	std::stringstream key;
+	key << "Observer" << __sync_add_and_fetch(&observerInstances, 1) << ".hint";
+	hintKey = PropertyKey(key.str());
 }
 
 void Observer::add(ObserverFeature *feature) {
+	(feature->isVeto() ? vetoes : detectors).push_back(features.size());
 	features.push_back(feature);
+	indexBuilt = 0;
+}
+
+void Observer::setDetectionHints(bool h) {
+	hints = h;
+}
+
+bool Observer::getDetectionHints() const {
+	return hints;
+}
+
+void Observer::setSpatialIndex(double cellSize) {
+	if (cellSize < 0)
+		throw std::runtime_error("Observer::setSpatialIndex: cell size must not be negative");
+	indexCellSize = cellSize;
+	indexBuilt = 0;
+}
+
+double Observer::getSpatialIndex() const {
+	return indexCellSize;
+}
+
+static double component(const Vector3d &v, int axis) {
+	return (axis == 0) ? v.x : ((axis == 1) ? v.y : v.z);
+}
+
+// features covering more cells are checked in each step
+static const size_t maxCellsPerFeature = 4096;
+static const size_t maxCells = 1 << 24;
+
+void Observer::buildIndex() const {
+#pragma omp critical(ObserverIndex)
+	if (!indexBuilt) {
+		SpatialIndex &g = index;
+		g = SpatialIndex();
+		double inf = std::numeric_limits<double>::infinity();
+		g.lower = Vector3d(inf);
+		g.upper = Vector3d(-inf);
+		std::vector<Vector3d> lower(features.size()), upper(features.size());
+		std::vector<bool> bounded(features.size(), false);
+		for (size_t i = 0; i < features.size(); i++) {
+			bounded[i] = features[i]->getBounds(lower[i], upper[i]);
+			if (!bounded[i]) {
+				// the vetoes are checked before the index
+				if (!features[i]->isVeto())
+					g.unbounded.push_back(i);
+				continue;
+			}
+			g.lower.setXYZ(std::min(g.lower.x, lower[i].x), std::min(g.lower.y, lower[i].y), std::min(g.lower.z, lower[i].z));
+			g.upper.setXYZ(std::max(g.upper.x, upper[i].x), std::max(g.upper.y, upper[i].y), std::max(g.upper.z, upper[i].z));
+		}
+
+		g.cellSize = indexCellSize;
+		g.n[0] = g.n[1] = g.n[2] = 0;
+		bool any = std::find(bounded.begin(), bounded.end(), true) != bounded.end();
+		while (any) {
+			Vector3d extent = g.upper - g.lower;
+			g.n[0] = std::max(1, int(ceil(extent.x / g.cellSize)));
+			g.n[1] = std::max(1, int(ceil(extent.y / g.cellSize)));
+			g.n[2] = std::max(1, int(ceil(extent.z / g.cellSize)));
+			if (double(g.n[0]) * g.n[1] * g.n[2] <= maxCells)
+				break;
+			g.cellSize *= 2;
+		}
+
+		size_t nCells = size_t(g.n[0]) * g.n[1] * g.n[2];
+		std::vector<size_t> count(nCells + 1, 0);
+		g.featureCells.assign(6 * features.size(), 0);
+		for (size_t i = 0; (i < features.size()) && any; i++) {
+			if (!bounded[i])
+				continue;
+			int *c = &g.featureCells[6 * i];
+			size_t covered = 1;
+			for (int a = 0; a < 3; a++) {
+				c[a] = std::max(0, std::min(g.n[a] - 1, int(floor((component(lower[i], a) - component(g.lower, a)) / g.cellSize))));
+				c[a + 3] = std::max(0, std::min(g.n[a] - 1, int(floor((component(upper[i], a) - component(g.lower, a)) / g.cellSize))));
+				covered *= c[a + 3] - c[a] + 1;
+			}
+			if (covered > maxCellsPerFeature) {
+				bounded[i] = false;
+				g.unbounded.push_back(i);
+				continue;
+			}
+			for (int ix = c[0]; ix <= c[3]; ix++)
+				for (int iy = c[1]; iy <= c[4]; iy++)
+					for (int iz = c[2]; iz <= c[5]; iz++)
+						count[(size_t(ix) * g.n[1] + iy) * g.n[2] + iz]++;
+		}
+		std::sort(g.unbounded.begin(), g.unbounded.end());
+
+		// features of each cell, in the order they were added
+		g.cellStart.assign(nCells + 1, 0);
+		for (size_t j = 0; j < nCells; j++)
+			g.cellStart[j + 1] = g.cellStart[j] + count[j];
+		g.cellFeatures.resize(g.cellStart[nCells]);
+		std::vector<size_t> next(g.cellStart.begin(), g.cellStart.end() - 1);
+		for (size_t i = 0; (i < features.size()) && any; i++) {
+			if (!bounded[i])
+				continue;
+			const int *c = &g.featureCells[6 * i];
+			for (int ix = c[0]; ix <= c[3]; ix++)
+				for (int iy = c[1]; iy <= c[4]; iy++)
+					for (int iz = c[2]; iz <= c[5]; iz++)
+						g.cellFeatures[next[(size_t(ix) * g.n[1] + iy) * g.n[2] + iz]++] = i;
+		}
+		__atomic_store_n(&indexBuilt, 1, __ATOMIC_RELEASE);
+	}
+}
+
+static void combineDetection(DetectionState s, DetectionState &state) {
+	if (s == VETO)
+		state = VETO;
+	else if ((s == DETECTED) && (state != VETO))
+		state = DETECTED;
+}
+
+DetectionState Observer::checkIndexed(Candidate *candidate) const {
+	if (!__atomic_load_n(&indexBuilt, __ATOMIC_ACQUIRE))
+		buildIndex();
+	const SpatialIndex &g = index;
+
+	DetectionState state = NOTHING;
+	for (size_t k = 0; k < g.unbounded.size(); k++)
+		combineDetection(features[g.unbounded[k]]->checkDetection(candidate), state);
+	if (g.cellStart.size() < 2)
+		return state;
+
+	// cells within one cell size of the box around the last step
+	Vector3d x0 = candidate->previous.getPosition();
+	Vector3d x1 = candidate->current.getPosition();
+	int q[6];
+	bool inside = true;
+	for (int a = 0; a < 3; a++) {
+		double lo = std::min(component(x0, a), component(x1, a)) - g.cellSize;
+		double hi = std::max(component(x0, a), component(x1, a)) + g.cellSize;
+		if ((hi < component(g.lower, a)) || (lo > component(g.upper, a)))
+			inside = false;
+		q[a] = std::max(0, int(floor((lo - component(g.lower, a)) / g.cellSize)));
+		q[a + 3] = std::min(g.n[a] - 1, int(floor((hi - component(g.lower, a)) / g.cellSize)));
+	}
+	for (int ix = q[0]; inside && (ix <= q[3]); ix++)
+		for (int iy = q[1]; iy <= q[4]; iy++)
+			for (int iz = q[2]; iz <= q[5]; iz++) {
+				size_t j = (size_t(ix) * g.n[1] + iy) * g.n[2] + iz;
+				for (size_t k = g.cellStart[j]; k < g.cellStart[j + 1]; k++) {
+					size_t i = g.cellFeatures[k];
+					// check a feature of several cells only in the first one
+					const int *c = &g.featureCells[6 * i];
+					if ((ix != std::max(c[0], q[0])) || (iy != std::max(c[1], q[1]))
+							|| (iz != std::max(c[2], q[2])))
+						continue;
+					combineDetection(features[i]->checkDetection(candidate), state);
+				}
+			}
+
+	// the skipped features are at least one cell size away
+	Vector3d outside = (g.lower - x1).clip(0, std::numeric_limits<double>::infinity())
+			+ (x1 - g.upper).clip(0, std::numeric_limits<double>::infinity());
+	candidate->limitNextStep(std::max(g.cellSize, outside.getR()));
+	return state;
 }
 
+// snapshot of the detected candidate for cloning actions, 0 while in use
+static __thread Candidate *detectionSnapshot = 0;
+
 void Observer::onDetection(Module *action, bool clone_) {
 	detectionAction = action;
 	clone = clone_;
 }
 
 void Observer::process(Candidate *candidate) const {
-	// loop over all features and have them check the particle
+	bool useHints = hints && (indexCellSize <= 0);
+	double length = candidate->getTrajectoryLength();
+	if (useHints && candidate->hasProperty(hintKey)) {
+		double next = candidate->getProperty(hintKey).asDouble();
+		if (length < next) {
+			// no feature can detect the candidate before
+			candidate->limitNextStep(next - length);
+			return;
+		}
+	}
+
+	// the vetoes first, a veto decides without the other features
+	for (size_t i = 0; i < vetoes.size(); i++)
+		if (features[vetoes[i]]->checkDetection(candidate) == VETO)
+			return;
+
+	// loop over all (or only the nearby) features and have them check the particle
 	DetectionState state = NOTHING;
-	for (int i = 0; i < features.size(); i++) {
-		DetectionState s = features[i]->checkDetection(candidate);
-		if (s == VETO)
-			state = VETO;
-		else if ((s == DETECTED) && (state != VETO))
-			state = DETECTED;
+	if (indexCellSize > 0) {
+		state = checkIndexed(candidate);
+	} else {
+		for (size_t i = 0; i < detectors.size(); i++)
+			combineDetection(features[detectors[i]]->checkDetection(candidate), state);
+	}
+
+	if (useHints && (state == NOTHING)) {
+		double hint = std::numeric_limits<double>::infinity();
+		for (size_t i = 0; (i < detectors.size()) && (hint > 0); i++)
+			hint = std::min(hint, features[detectors[i]]->getDetectionHint(candidate));
+		if (hint > 0)
+			candidate->setProperty(hintKey, length + hint);
 	}
 
 	if (state == DETECTED) {
@@ -41,9 +237,21 @@ void Observer::process(Candidate *candidate) const {
 		}
 
 		if (detectionAction.valid()) {
-			if (clone)
-				detectionAction->process(candidate->clone(false));
-			else
+			if (clone) {
+				Candidate *snapshot = detectionSnapshot;
+				detectionSnapshot = 0;
+				if (!snapshot) {
+					snapshot = new Candidate();
+					snapshot->addReference();
+				}
+				candidate->copyState(*snapshot);
+				detectionAction->process(snapshot);
+				// reuse the snapshot unless the action keeps it
+				if ((snapshot->getReferenceCount() == 1) && !detectionSnapshot)
+					detectionSnapshot = snapshot;
+				else
+					snapshot->removeReference();
+			} else
 				detectionAction->process(candidate);
 		}
 
@@ -73,6 +281,19 @@ std::string Observer::getDescription() const {
 	return ss.str();
 }
 
+void Observer::getConfiguration(Configuration &c) const {
+	c.setType("Observer");
+	c.setList("features", features);
+	if (detectionAction.valid())
+		c.set("detectionAction", detectionAction.get());
+	c.set("clone", clone);
+	c.set("makeInactive", makeInactive);
+	c.setString("flagKey", flagKey.getName());
+	c.setString("flagValue", flagValue);
+	c.set("spatialIndex", indexCellSize);
+	c.set("detectionHints", hints);
+}
+
 void Observer::setDeactivateOnDetection(bool deactivate) {
 	makeInactive = deactivate;
 }
@@ -89,6 +310,22 @@ std::string ObserverFeature::getDescription() const {
 	return description;
 }
 
+void ObserverFeature::getConfiguration(Configuration &configuration) const {
+	throw std::runtime_error("ObserverFeature: no configuration of " + getDescription());
+}
+
+bool ObserverFeature::getBounds(Vector3d &lower, Vector3d &upper) const {
+	return false;
+}
+
+bool ObserverFeature::isVeto() const {
+	return false;
+}
+
+double ObserverFeature::getDetectionHint(Candidate *candidate) const {
+	return 0;
+}
+
 // ObserverDetectAll ----------------------------------------------------------
 DetectionState ObserverDetectAll::checkDetection(Candidate *candidate) const {
 	return DETECTED;
@@ -98,6 +335,10 @@ std::string ObserverDetectAll::getDescription() const {
 	return description;
 }
 
+void ObserverDetectAll::getConfiguration(Configuration &c) const {
+	c.setType("ObserverDetectAll");
+}
+
 // ObserverSmallSphere --------------------------------------------------------
 ObserverSmallSphere::ObserverSmallSphere(Vector3d center, double radius) :
 		center(center), radius(radius) {
@@ -126,6 +367,17 @@ DetectionState ObserverSmallSphere::checkDetection(Candidate *candidate) const {
 	return DETECTED;
 }
 
+double ObserverSmallSphere::getDetectionHint(Candidate *candidate) const {
+	// to enter the sphere, from inside after leaving it
+	return fabs((candidate->current.getPosition() - center).getR() - radius);
+}
+
+bool ObserverSmallSphere::getBounds(Vector3d &lower, Vector3d &upper) const {
+	lower = center - Vector3d(radius);
+	upper = center + Vector3d(radius);
+	return true;
+}
+
 void ObserverSmallSphere::setCenter(const Vector3d &center) {
 	this->center = center;
 }
@@ -142,6 +394,12 @@ std::string ObserverSmallSphere::getDescription() const {
 	return ss.str();
 }
 
+void ObserverSmallSphere::getConfiguration(Configuration &c) const {
+	c.setType("ObserverSmallSphere");
+	c.set("center", center);
+	c.set("radius", radius);
+}
+
 // ObserverTracking --------------------------------------------------------
 ObserverTracking::ObserverTracking(Vector3d center, double radius, double stepSize) :
 		center(center), radius(radius), stepSize(stepSize) {
@@ -168,6 +426,16 @@ DetectionState ObserverTracking::checkDetection(Candidate *candidate) const {
 	}
 }
 
+double ObserverTracking::getDetectionHint(Candidate *candidate) const {
+	return std::max(0., (candidate->current.getPosition() - center).getR() - radius);
+}
+
+bool ObserverTracking::getBounds(Vector3d &lower, Vector3d &upper) const {
+	lower = center - Vector3d(radius);
+	upper = center + Vector3d(radius);
+	return true;
+}
+
 std::string ObserverTracking::getDescription() const {
 	std::stringstream ss;
 	ss << "ObserverTracking: ";
@@ -205,6 +473,10 @@ DetectionState ObserverLargeSphere::checkDetection(Candidate *candidate) const {
 	return DETECTED;
 }
 
+double ObserverLargeSphere::getDetectionHint(Candidate *candidate) const {
+	return fabs(radius - (candidate->current.getPosition() - center).getR());
+}
+
 std::string ObserverLargeSphere::getDescription() const {
 	std::stringstream ss;
 	ss << "ObserverLargeSphere: ";
@@ -213,6 +485,12 @@ std::string ObserverLargeSphere::getDescription() const {
 	return ss.str();
 }
 
+void ObserverLargeSphere::getConfiguration(Configuration &c) const {
+	c.setType("ObserverLargeSphere");
+	c.set("center", center);
+	c.set("radius", radius);
+}
+
 // ObserverPoint --------------------------------------------------------------
 DetectionState ObserverPoint::checkDetection(Candidate *candidate) const {
 	double x = candidate->current.getPosition().x;
@@ -223,10 +501,18 @@ DetectionState ObserverPoint::checkDetection(Candidate *candidate) const {
 	return DETECTED;
 }
 
+double ObserverPoint::getDetectionHint(Candidate *candidate) const {
+	return std::max(0., candidate->current.getPosition().x);
+}
+
 std::string ObserverPoint::getDescription() const {
 	return "ObserverPoint: observer at x = 0";
 }
 
+void ObserverPoint::getConfiguration(Configuration &c) const {
+	c.setType("ObserverPoint");
+}
+
 // ObserverRedshiftWindow -----------------------------------------------------
 ObserverRedshiftWindow::ObserverRedshiftWindow(double zmin, double zmax) :
 		zmin(zmin), zmax(zmax) {
@@ -242,12 +528,22 @@ DetectionState ObserverRedshiftWindow::checkDetection(
 	return NOTHING;
 }
 
+bool ObserverRedshiftWindow::isVeto() const {
+	return true;
+}
+
 std::string ObserverRedshiftWindow::getDescription() const {
 	std::stringstream ss;
 	ss << "ObserverRedshiftWindow: z = " << zmin << " - " << zmax;
 	return ss.str();
 }
 
+void ObserverRedshiftWindow::getConfiguration(Configuration &c) const {
+	c.setType("ObserverRedshiftWindow");
+	c.set("zmin", zmin);
+	c.set("zmax", zmax);
+}
+
 // ObserverInactiveVeto -------------------------------------------------------
 DetectionState ObserverInactiveVeto::checkDetection(Candidate *c) const {
 	if (not(c->isActive()))
@@ -255,10 +551,18 @@ DetectionState ObserverInactiveVeto::checkDetection(Candidate *c) const {
 	return NOTHING;
 }
 
+bool ObserverInactiveVeto::isVeto() const {
+	return true;
+}
+
 std::string ObserverInactiveVeto::getDescription() const {
 	return "ObserverInactiveVeto";
 }
 
+void ObserverInactiveVeto::getConfiguration(Configuration &c) const {
+	c.setType("ObserverInactiveVeto");
+}
+
 // ObserverNucleusVeto --------------------------------------------------------
 DetectionState ObserverNucleusVeto::checkDetection(Candidate *c) const {
 	if (isNucleus(c->current.getId()))
@@ -266,10 +570,18 @@ DetectionState ObserverNucleusVeto::checkDetection(Candidate *c) const {
 	return NOTHING;
 }
 
+bool ObserverNucleusVeto::isVeto() const {
+	return true;
+}
+
 std::string ObserverNucleusVeto::getDescription() const {
 	return "ObserverNucleusVeto";
 }
 
+void ObserverNucleusVeto::getConfiguration(Configuration &c) const {
+	c.setType("ObserverNucleusVeto");
+}
+
 // ObserverNeutrinoVeto -------------------------------------------------------
 DetectionState ObserverNeutrinoVeto::checkDetection(Candidate *c) const {
 	int id = abs(c->current.getId());
@@ -278,10 +590,18 @@ DetectionState ObserverNeutrinoVeto::checkDetection(Candidate *c) const {
 	return NOTHING;
 }
 
+bool ObserverNeutrinoVeto::isVeto() const {
+	return true;
+}
+
 std::string ObserverNeutrinoVeto::getDescription() const {
 	return "ObserverNeutrinoVeto";
 }
 
+void ObserverNeutrinoVeto::getConfiguration(Configuration &c) const {
+	c.setType("ObserverNeutrinoVeto");
+}
+
 // ObserverPhotonVeto ---------------------------------------------------------
 DetectionState ObserverPhotonVeto::checkDetection(Candidate *c) const {
 	if (c->current.getId() == 22)
@@ -289,10 +609,18 @@ DetectionState ObserverPhotonVeto::checkDetection(Candidate *c) const {
 	return NOTHING;
 }
 
+bool ObserverPhotonVeto::isVeto() const {
+	return true;
+}
+
 std::string ObserverPhotonVeto::getDescription() const {
 	return "ObserverPhotonVeto";
 }
 
+void ObserverPhotonVeto::getConfiguration(Configuration &c) const {
+	c.setType("ObserverPhotonVeto");
+}
+
 // ObserverElectronVeto ---------------------------------------------------------
 DetectionState ObserverElectronVeto::checkDetection(Candidate *c) const {
 	if (abs(c->current.getId()) == 11)
@@ -300,67 +628,90 @@ DetectionState ObserverElectronVeto::checkDetection(Candidate *c) const {
 	return NOTHING;
 }
 
+bool ObserverElectronVeto::isVeto() const {
+	return true;
+}
+
 std::string ObserverElectronVeto::getDescription() const {
 	return "ObserverElectronVeto";
 }
 
+void ObserverElectronVeto::getConfiguration(Configuration &c) const {
+	c.setType("ObserverElectronVeto");
+}
+
+// ObserverSourceEfficiency ---------------------------------------------------
+ObserverSourceEfficiency::ObserverSourceEfficiency(AdaptiveSourceSampling *sampling) :
+		sampling(sampling) {
+	if (!sampling)
+		throw std::runtime_error("ObserverSourceEfficiency: no adaptive source sampling");
+}
+
+DetectionState ObserverSourceEfficiency::checkDetection(Candidate *candidate) const {
+	return NOTHING;
+}
+
+void ObserverSourceEfficiency::onDetection(Candidate *candidate) const {
+	sampling->recordDetection(candidate);
+}
+
+bool ObserverSourceEfficiency::isVeto() const {
+	return true;
+}
+
+std::string ObserverSourceEfficiency::getDescription() const {
+	std::stringstream ss;
+	ss << "ObserverSourceEfficiency: " << sampling->size() << " sources";
+	return ss.str();
+}
+
 // ObserverTimeEvolution --------------------------------------------------------
 ObserverTimeEvolution::ObserverTimeEvolution() {}
 
 ObserverTimeEvolution::ObserverTimeEvolution(double min, double dist, double numb) {
+  detList.reserve(numb);
   for (size_t i = 0; i < numb; i++) {
     addTime(min + i * dist);
   }
 }
 
 
-DetectionState ObserverTimeEvolution::checkDetection(Candidate *c) const {
-
-	if (detList.size()) {
-		double length = c->getTrajectoryLength();
-		size_t index;
-		const std::string DI = "DetectionIndex";
-		std::string value;
+static const PropertyKey DI("DetectionIndex");
 
-		// Load the last detection index
-		if (c->hasProperty(DI)) {
-			index = c->getProperty(DI).asUInt64();
-		}
-		else {
-			index = 0;
-		}
-
-		// Break if the particle has been detected once for all detList entries.
-		if (index > detList.size()) {
-			return NOTHING;
-		}
-
-		// Calculate the distance to next detection
-		double distance = length - detList[index];
+DetectionState ObserverTimeEvolution::checkDetection(Candidate *c) const {
+	if (detList.empty())
+		return NOTHING;
 
-		// Limit next Step and detect candidate
-		// Increase the index by one in case of detection
-		if (distance < 0.) {
-			c->limitNextStep(-distance);
-			return NOTHING;
-		}
-		else {
+	// number of detection lengths passed at the last detection
+	size_t index = 0;
+	if (c->hasProperty(DI))
+		index = std::min<size_t>(c->getProperty(DI).asUInt64(), detList.size());
 
-			if (index < detList.size()-1) {
-				c->limitNextStep(detList[index+1]-length);
-			}
-			c->setProperty(DI, Variant::fromUInt64(index+1));
+	// and now, the list is sorted
+	double length = c->getTrajectoryLength();
+	size_t passed = std::upper_bound(detList.begin() + index, detList.end(), length)
+			- detList.begin();
 
-			return DETECTED;
-		}
+	// the next step ends at the next detection length
+	if (passed < detList.size())
+		c->limitNextStep(detList[passed] - length);
 
-	}
-	return NOTHING;
+	if (passed == index)
+		return NOTHING;
+	c->setProperty(DI, Variant::fromUInt64(passed));
+	return DETECTED;
+}
 
+double ObserverTimeEvolution::getDetectionHint(Candidate *c) const {
+	double length = c->getTrajectoryLength();
+	std::vector<double>::const_iterator next = std::upper_bound(detList.begin(), detList.end(), length);
+	if (next == detList.end())
+		return std::numeric_limits<double>::infinity();
+	return *next - length;
 }
 
 void ObserverTimeEvolution::addTime(const double& t) {
-	detList.push_back(t);
+	detList.insert(std::upper_bound(detList.begin(), detList.end(), t), t);
 }
 
 const std::vector<double>& ObserverTimeEvolution::getTimes() const {
@@ -375,14 +726,27 @@ std::string ObserverTimeEvolution::getDescription() const {
 	return s.str();
 }
 
+void ObserverTimeEvolution::getConfiguration(Configuration &c) const {
+	c.setType("ObserverTimeEvolution");
+	c.set("times", detList);
+}
+
 // ObserverSurface--------------------------------------------------------------
-ObserverSurface::ObserverSurface(Surface* _surface) : surface(_surface) { };
+ObserverSurface::ObserverSurface(Surface* _surface) : surface(_surface), rayStep(false) { };
+
+void ObserverSurface::setRayStep(bool b) {
+	rayStep = b;
+}
 
 DetectionState ObserverSurface::checkDetection(Candidate *candidate) const
 {
 		double currentDistance = surface->distance(candidate->current.getPosition());
 		double previousDistance = surface->distance(candidate->previous.getPosition());
-		candidate->limitNextStep(fabs(currentDistance));
+		double step = fabs(currentDistance);
+		if (rayStep and (candidate->current.getCharge() == 0))
+			step = std::max(step, surface->intersection(
+					candidate->current.getPosition(), candidate->current.getDirection()));
+		candidate->limitNextStep(step);
 
 		if (currentDistance * previousDistance > 0)
 			return NOTHING;
@@ -392,6 +756,14 @@ DetectionState ObserverSurface::checkDetection(Candidate *candidate) const
 			return DETECTED;
 };
 
+double ObserverSurface::getDetectionHint(Candidate *candidate) const {
+	return fabs(surface->distance(candidate->current.getPosition()));
+}
+
+bool ObserverSurface::getBounds(Vector3d &lower, Vector3d &upper) const {
+	return surface->getBounds(lower, upper);
+}
+
 std::string ObserverSurface::getDescription() const {
 	std::stringstream ss;
 	ss << "ObserverSurface: << " << surface->getDescription();
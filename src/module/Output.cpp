@@ -31,6 +31,7 @@ void Output::modify() {
 }
 
 void Output::process(Candidate *c) const {
+#pragma omp atomic
 	count++;
 }
 
@@ -123,10 +124,19 @@ size_t Output::size() const {
 	return count;
 }
 
+void Output::setFilter(const std::string &expression) {
+	filter = expression.empty() ? 0 : new OutputFilter(expression);
+}
+
+std::string Output::getFilter() const {
+	return filter ? filter->getExpression() : std::string();
+}
+
 void Output::enableProperty(const std::string &property, const Variant &defaultValue, const std::string &comment) {
 	modify();
 	Property prop;
 	prop.name = property;
+	prop.key = property;
 	prop.comment = comment;
 	prop.defaultValue = defaultValue;
 	properties.push_back(prop);
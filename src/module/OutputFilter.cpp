@@ -0,0 +1,333 @@
+#include "crpropa/module/OutputFilter.h"
+#include "crpropa/ParticleID.h"
+#include "crpropa/Units.h"
+
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+namespace crpropa {
+
+// the stack of accepts is on the stack of the thread
+static const size_t MAX_DEPTH = 64;
+
+// NaN of missing properties is false
+static inline bool isTrue(double x) {
+	return (x != 0) && !std::isnan(x);
+}
+
+namespace {
+
+struct NamedValue {
+	const char *name;
+	OutputFilter::Value value;
+};
+
+const NamedValue namedValues[] = {
+	{"D", OutputFilter::ValueD}, {"z", OutputFilter::Valuez}, {"weight", OutputFilter::Valueweight},
+	{"ID", OutputFilter::ValueID}, {"E", OutputFilter::ValueE}, {"X", OutputFilter::ValueX},
+	{"Y", OutputFilter::ValueY}, {"Z", OutputFilter::ValueZ}, {"Px", OutputFilter::ValuePx},
+	{"Py", OutputFilter::ValuePy}, {"Pz", OutputFilter::ValuePz}, {"R", OutputFilter::ValueR},
+	{"A", OutputFilter::ValueA}, {"charge", OutputFilter::ValueCharge},
+	{"ID0", OutputFilter::ValueID0}, {"E0", OutputFilter::ValueE0}, {"X0", OutputFilter::ValueX0},
+	{"Y0", OutputFilter::ValueY0}, {"Z0", OutputFilter::ValueZ0}, {"P0x", OutputFilter::ValueP0x},
+	{"P0y", OutputFilter::ValueP0y}, {"P0z", OutputFilter::ValueP0z}, {"R0", OutputFilter::ValueR0},
+	{"A0", OutputFilter::ValueA0}, {"charge0", OutputFilter::ValueCharge0},
+	{"ID1", OutputFilter::ValueID1}, {"E1", OutputFilter::ValueE1}, {"X1", OutputFilter::ValueX1},
+	{"Y1", OutputFilter::ValueY1}, {"Z1", OutputFilter::ValueZ1}, {"P1x", OutputFilter::ValueP1x},
+	{"P1y", OutputFilter::ValueP1y}, {"P1z", OutputFilter::ValueP1z}, {"R1", OutputFilter::ValueR1},
+	{"A1", OutputFilter::ValueA1}, {"charge1", OutputFilter::ValueCharge1}
+};
+
+struct Unit {
+	const char *name;
+	double value;
+};
+
+const Unit units[] = {
+	{"eV", eV}, {"keV", keV}, {"MeV", MeV}, {"GeV", GeV}, {"TeV", TeV},
+	{"PeV", PeV}, {"EeV", EeV}, {"cm", centimeter}, {"m", meter},
+	{"km", kilometer}, {"pc", pc}, {"kpc", kpc}, {"Mpc", Mpc}, {"Gpc", Gpc}
+};
+
+} // namespace
+
+// recursive descent, appends the postfix program
+class OutputFilter::Parser {
+	OutputFilter &filter;
+	const std::string &s;
+	size_t pos;
+	size_t depth;
+
+	void fail(const std::string &message) const {
+		std::stringstream ss;
+		ss << "OutputFilter: " << message << " at position " << pos << " of \"" << s << "\"";
+		throw std::runtime_error(ss.str());
+	}
+
+	void skipSpace() {
+		while ((pos < s.size()) && isspace((unsigned char) s[pos]))
+			pos++;
+	}
+
+	bool accept(const char *token) {
+		skipSpace();
+		size_t n = strlen(token);
+		if (s.compare(pos, n, token) != 0)
+			return false;
+		// keywords end at the end of a word
+		if (isalpha((unsigned char) token[0]) && (pos + n < s.size())
+				&& (isalnum((unsigned char) s[pos + n]) || (s[pos + n] == '_')))
+			return false;
+		pos += n;
+		return true;
+	}
+
+	std::string name() {
+		skipSpace();
+		size_t begin = pos;
+		while ((pos < s.size()) && (isalnum((unsigned char) s[pos]) || (s[pos] == '_') || (s[pos] == '.')))
+			pos++;
+		return s.substr(begin, pos - begin);
+	}
+
+	void emit(Code code, double number = 0, Value value = ValueD,
+			const PropertyKey &key = PropertyKey()) {
+		Instruction i;
+		i.code = code;
+		i.number = number;
+		i.value = value;
+		i.key = key;
+		filter.program.push_back(i);
+		if ((code == PushNumber) || (code == PushValue) || (code == PushProperty)) {
+			depth++;
+			if (depth > MAX_DEPTH)
+				fail("too deeply nested expression");
+		} else if ((code != Abs) && (code != Negate) && (code != Not)) {
+			depth--; // binary
+		}
+	}
+
+	void primary() {
+		skipSpace();
+		if (pos >= s.size())
+			fail("unexpected end");
+		char c = s[pos];
+		if (isdigit((unsigned char) c) || (c == '.')) {
+			char *end;
+			double number = strtod(s.c_str() + pos, &end);
+			pos = end - s.c_str();
+			size_t afterNumber = pos;
+			std::string unit = name();
+			bool found = unit.empty();
+			for (size_t i = 0; !found && (i < sizeof(units) / sizeof(units[0])); i++)
+				if (unit == units[i].name) {
+					number *= units[i].value;
+					found = true;
+				}
+			if (!found)
+				pos = afterNumber; // no unit, e.g. followed by a keyword
+			emit(PushNumber, number);
+		} else if (c == '(') {
+			pos++;
+			disjunction();
+			if (!accept(")"))
+				fail("missing )");
+		} else if (c == '"') {
+			size_t end = s.find('"', pos + 1);
+			if (end == std::string::npos)
+				fail("missing \"");
+			emit(PushProperty, 0, ValueD, PropertyKey(s.substr(pos + 1, end - pos - 1)));
+			pos = end + 1;
+		} else if (accept("abs")) {
+			if (!accept("("))
+				fail("missing ( after abs");
+			sum();
+			if (!accept(")"))
+				fail("missing )");
+			emit(Abs);
+		} else {
+			std::string n = name();
+			if (n.empty())
+				fail("unexpected character");
+			for (size_t i = 0; i < sizeof(namedValues) / sizeof(namedValues[0]); i++)
+				if (n == namedValues[i].name) {
+					emit(PushValue, 0, namedValues[i].value);
+					return;
+				}
+			emit(PushProperty, 0, ValueD, PropertyKey(n));
+		}
+	}
+
+	void unary() {
+		if (accept("-")) {
+			unary();
+			emit(Negate);
+		} else {
+			primary();
+		}
+	}
+
+	void product() {
+		unary();
+		while (true) {
+			if (accept("*")) {
+				unary();
+				emit(Multiply);
+			} else if (accept("/")) {
+				unary();
+				emit(Divide);
+			} else {
+				return;
+			}
+		}
+	}
+
+	void sum() {
+		product();
+		while (true) {
+			if (accept("+")) {
+				product();
+				emit(Add);
+			} else if (accept("-")) {
+				product();
+				emit(Subtract);
+			} else {
+				return;
+			}
+		}
+	}
+
+	void comparison() {
+		sum();
+		// the two character operators first
+		const char *tokens[6] = {"<=", ">=", "==", "!=", "<", ">"};
+		const Code codes[6] = {LessEqual, GreaterEqual, Equal, NotEqual, Less, Greater};
+		for (int i = 0; i < 6; i++)
+			if (accept(tokens[i])) {
+				sum();
+				emit(codes[i]);
+				return;
+			}
+	}
+
+	void negation() {
+		if (accept("not") || accept("!")) {
+			negation();
+			emit(Not);
+		} else {
+			comparison();
+		}
+	}
+
+	void conjunction() {
+		negation();
+		while (accept("and") || accept("&&")) {
+			negation();
+			emit(And);
+		}
+	}
+
+	void disjunction() {
+		conjunction();
+		while (accept("or") || accept("||")) {
+			conjunction();
+			emit(Or);
+		}
+	}
+
+public:
+	Parser(OutputFilter &filter, const std::string &s) :
+			filter(filter), s(s), pos(0), depth(0) {
+	}
+
+	void parse() {
+		disjunction();
+		skipSpace();
+		if (pos < s.size())
+			fail("unexpected character");
+	}
+};
+
+OutputFilter::OutputFilter(const std::string &expression) :
+		expression(expression) {
+	Parser(*this, expression).parse();
+}
+
+double OutputFilter::getValue(const Candidate *c, Value value) {
+	const ParticleState *states[3] = {&c->current, &c->source.get(), &c->created.get()};
+	if (value < ValueID)
+		switch (value) {
+		case ValueD: return c->getTrajectoryLength();
+		case Valuez: return c->getRedshift();
+		default: return c->getWeight();
+		}
+
+	// ID to charge, for each of the particles
+	int offset = value - ValueID;
+	const int perParticle = ValueID0 - ValueID;
+	const ParticleState &p = *states[offset / perParticle];
+	switch (offset % perParticle) {
+	case 0: return p.getId();
+	case 1: return p.getEnergy();
+	case 2: return p.getPosition().x;
+	case 3: return p.getPosition().y;
+	case 4: return p.getPosition().z;
+	case 5: return p.getDirection().x;
+	case 6: return p.getDirection().y;
+	case 7: return p.getDirection().z;
+	case 8: return p.getPosition().getR();
+	case 9: return isNucleus(p.getId()) ? massNumber(p.getId()) : 0;
+	default: return isNucleus(p.getId()) ? chargeNumber(p.getId()) : p.getCharge() / eplus;
+	}
+}
+
+bool OutputFilter::accepts(const Candidate *candidate) const {
+	double stack[MAX_DEPTH];
+	double *top = stack - 1; // last value
+	for (size_t i = 0; i < program.size(); i++) {
+		const Instruction &in = program[i];
+		switch (in.code) {
+		case PushNumber: *++top = in.number; break;
+		case PushValue: *++top = getValue(candidate, in.value); break;
+		case PushProperty:
+			*++top = candidate->hasProperty(in.key) ?
+					candidate->getProperty(in.key).toDouble() :
+					std::numeric_limits<double>::quiet_NaN();
+			break;
+		case Abs: *top = std::fabs(*top); break;
+		case Negate: *top = -*top; break;
+		case Not: *top = !isTrue(*top); break;
+		default: {
+			double b = *top--;
+			double &a = *top;
+			switch (in.code) {
+			case Add: a = a + b; break;
+			case Subtract: a = a - b; break;
+			case Multiply: a = a * b; break;
+			case Divide: a = a / b; break;
+			case Less: a = (a < b); break;
+			case LessEqual: a = (a <= b); break;
+			case Greater: a = (a > b); break;
+			case GreaterEqual: a = (a >= b); break;
+			case Equal: a = (a == b); break;
+			case NotEqual: a = (a != b); break;
+			case And: a = isTrue(a) && isTrue(b); break;
+			default: a = isTrue(a) || isTrue(b); break;
+			}
+		}
+		}
+	}
+	// a value without comparison is true if not zero
+	return isTrue(*top);
+}
+
+const std::string &OutputFilter::getExpression() const {
+	return expression;
+}
+
+} // namespace crpropa
@@ -1,23 +1,25 @@
 #include "crpropa/module/OutputShell.h"
+#include "crpropa/Lock.h"
 #include "crpropa/Units.h"
 
 #include <iomanip>
 
 namespace crpropa {
 
+// the shell outputs share the standard output
+static Lock coutLock("std::cout");
+
 void ShellOutput::process(Candidate* c) const {
-#pragma omp critical
-	{
-		std::cout << std::fixed << std::showpoint << std::setprecision(3)
-				<< std::setw(6);
-		std::cout << c->getTrajectoryLength() / Mpc << " Mpc,  ";
-		std::cout << c->getRedshift() << ",  ";
-		std::cout << c->current.getId() << ",  ";
-		std::cout << c->current.getEnergy() / EeV << " EeV,  ";
-		std::cout << c->current.getPosition() / Mpc << " Mpc,  ";
-		std::cout << c->current.getDirection();
-		std::cout << std::endl;
-	}
+	ScopedLock l(coutLock);
+	std::cout << std::fixed << std::showpoint << std::setprecision(3)
+			<< std::setw(6);
+	std::cout << c->getTrajectoryLength() / Mpc << " Mpc,  ";
+	std::cout << c->getRedshift() << ",  ";
+	std::cout << c->current.getId() << ",  ";
+	std::cout << c->current.getEnergy() / EeV << " EeV,  ";
+	std::cout << c->current.getPosition() / Mpc << " Mpc,  ";
+	std::cout << c->current.getDirection();
+	std::cout << std::endl;
 }
 
 std::string ShellOutput::getDescription() const {
@@ -25,16 +27,14 @@ std::string ShellOutput::getDescription() const {
 }
 
 void ShellOutput1D::process(Candidate* c) const {
-#pragma omp critical
-	{
-		std::cout << std::fixed << std::showpoint << std::setprecision(3)
-				<< std::setw(6);
-		std::cout << c->current.getPosition().x / Mpc << " Mpc,  ";
-		std::cout << c->getRedshift() << ",  ";
-		std::cout << c->current.getId() << ",  ";
-		std::cout << c->current.getEnergy() / EeV << " EeV";
-		std::cout << std::endl;
-	}
+	ScopedLock l(coutLock);
+	std::cout << std::fixed << std::showpoint << std::setprecision(3)
+			<< std::setw(6);
+	std::cout << c->current.getPosition().x / Mpc << " Mpc,  ";
+	std::cout << c->getRedshift() << ",  ";
+	std::cout << c->current.getId() << ",  ";
+	std::cout << c->current.getEnergy() / EeV << " EeV";
+	std::cout << std::endl;
 }
 
 std::string ShellOutput1D::getDescription() const {
@@ -43,11 +43,9 @@ std::string ShellOutput1D::getDescription() const {
 
 void ShellPropertyOutput::process(Candidate* c) const {
 	Candidate::PropertyMap::const_iterator i = c->properties.begin();
-#pragma omp critical
-	{
-		for ( ; i != c->properties.end(); i++) {
-			std::cout << "  " << i->first << ", " << i->second << std::endl;
-		}
+	ScopedLock l(coutLock);
+	for ( ; i != c->properties.end(); i++) {
+		std::cout << "  " << i->first << ", " << i->second << std::endl;
 	}
 }
 
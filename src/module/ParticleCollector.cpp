@@ -1,33 +1,105 @@
 #include "crpropa/module/ParticleCollector.h"
 #include "crpropa/module/TextOutput.h"
+#include "crpropa/module/BinaryOutput.h"
+#include "crpropa/module/HDF5Output.h"
 #include "crpropa/Units.h"
 
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <unistd.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 namespace crpropa {
 
-ParticleCollector::ParticleCollector() : nBuffer(10e6), clone(false), recursive(false)  {
+// further threads add to the merged container under the lock
+static const std::size_t COLLECTOR_THREADS = 256;
+
+ParticleCollector::ParticleCollector() : nBuffer(10e6), clone(false), recursive(false), spillLimit(std::numeric_limits<std::size_t>::max()), spilled(0), collected(0), lock("ParticleCollector"), memory("ParticleCollector") {
         container.reserve(nBuffer); // for 1e6 candidates ~ 500MB of RAM
+        threadContainers.resize(COLLECTOR_THREADS);
+	updateMemory(0);
 }
 
-ParticleCollector::ParticleCollector(const std::size_t nBuffer) : clone(false), recursive(false)  {
+ParticleCollector::ParticleCollector(const std::size_t nBuffer) : clone(false), recursive(false), spillLimit(std::numeric_limits<std::size_t>::max()), spilled(0), collected(0), lock("ParticleCollector"), memory("ParticleCollector") {
 	container.reserve(nBuffer);
+	threadContainers.resize(COLLECTOR_THREADS);
+	updateMemory(0);
 }
 
-ParticleCollector::ParticleCollector(const std::size_t nBuffer, const bool clone) : recursive(false) {
+ParticleCollector::ParticleCollector(const std::size_t nBuffer, const bool clone) : clone(clone), recursive(false), spillLimit(std::numeric_limits<std::size_t>::max()), spilled(0), collected(0), lock("ParticleCollector"), memory("ParticleCollector") {
 	container.reserve(nBuffer);
+	threadContainers.resize(COLLECTOR_THREADS);
+	updateMemory(0);
 }
 
-ParticleCollector::ParticleCollector(const std::size_t nBuffer, const bool clone, const bool recursive) {
+ParticleCollector::ParticleCollector(const std::size_t nBuffer, const bool clone, const bool recursive) : clone(clone), recursive(recursive), spillLimit(std::numeric_limits<std::size_t>::max()), spilled(0), collected(0), lock("ParticleCollector"), memory("ParticleCollector") {
 	container.reserve(nBuffer);
+	threadContainers.resize(COLLECTOR_THREADS);
+	updateMemory(0);
 }
 
 void ParticleCollector::process(Candidate *c) const {
-#pragma omp critical
-        {
-		if(clone)
-		       	container.push_back(c->clone(recursive));
-		else
-			container.push_back(c);
-        }
+	std::size_t n = __sync_fetch_and_add(&collected, 1);
+	// accounted in steps of 1024 candidates
+	if ((n + 1) % 1024 == 0)
+		updateMemory(std::min(n + 1, spillLimit));
+	if (n < spillLimit) {
+		ref_ptr<Candidate> candidate = clone ? c->clone(recursive) : ref_ptr<Candidate>(c);
+#ifdef _OPENMP
+		std::size_t thread = omp_get_thread_num();
+#else
+		std::size_t thread = 0;
+#endif
+		if (thread < threadContainers.size()) {
+			threadContainers[thread].candidates.push_back(candidate);
+			return;
+		}
+		ScopedLock l(lock);
+		container.push_back(candidate);
+		return;
+	}
+
+	ScopedLock l(lock);
+	if (!spill.valid()) {
+		// temporary file, removed with the collected candidates
+		const char *dir = getenv("TMPDIR");
+		std::string name = std::string(dir ? dir : "/tmp") + "/crpropa-collector-XXXXXX";
+		std::vector<char> buffer(name.begin(), name.end());
+		buffer.push_back('\0');
+		int fd = mkstemp(&buffer[0]);
+		if (fd >= 0)
+			::close(fd);
+		spillFilename = &buffer[0];
+		spill = new BinaryOutput(spillFilename);
+	}
+	spill->process(c);
+	spilled++;
+	spillInput = 0;
+}
+
+void ParticleCollector::merge() const {
+	for (std::size_t i = 0; i < threadContainers.size(); i++) {
+		tContainer &candidates = threadContainers[i].candidates;
+		if (candidates.empty())
+			continue;
+		container.insert(container.end(), candidates.begin(), candidates.end());
+		tContainer().swap(candidates);
+	}
+}
+
+void ParticleCollector::updateMemory(std::size_t kept) const {
+	std::size_t capacity;
+	{
+		ScopedLock l(lock);
+		capacity = container.capacity();
+	}
+	memory.set(capacity * sizeof(ref_ptr<Candidate>) + kept * sizeof(Candidate));
 }
 
 void ParticleCollector::process(ref_ptr<Candidate> c) const {
@@ -35,22 +107,60 @@ void ParticleCollector::process(ref_ptr<Candidate> c) const {
 }
 
 void ParticleCollector::reprocess(Module *action) const {
-	for (ParticleCollector::iterator itr = container.begin(); itr != container.end(); ++itr){
-		if (clone)
-			action->process((*(itr->get())).clone(false));
+	merge();
+	const BinaryInput *spilledInput = (spilled > 0) ? &getSpilled() : 0;
+	long n = container.size();
+	long total = n + spilled;
+	#pragma omp parallel for schedule(dynamic, 1024)
+	for (long i = 0; i < total; i++) {
+		if (i >= n)
+			action->process(spilledInput->getCandidate(i - n));
+		else if (clone)
+			action->process(container[i]->clone(false));
 		else
-        	        action->process(itr->get());
+			action->process(container[i].get());
+	}
+}
+
+const BinaryInput &ParticleCollector::getSpilled() const {
+	if (!spillInput.valid()) {
+		spill->flush();
+		spillInput = new BinaryInput(spillFilename);
 	}
+	return *spillInput;
 }
 
-void ParticleCollector::dump(const std::string &filename) const {
+void ParticleCollector::removeSpill() {
+	spillInput = 0;
+	if (spill.valid()) {
+		spill->close();
+		spill = 0;
+		std::remove(spillFilename.c_str());
+	}
+	spilled = 0;
+}
+
+void ParticleCollector::dump(const std::string &filename, bool binary) const {
+	if (binary) {
+		BinaryOutput output(filename);
+		reprocess(&output);
+		output.close();
+		return;
+	}
 	TextOutput output(filename.c_str(), Output::Everything);
 	reprocess(&output);
 	output.close();
 }
 
 void ParticleCollector::load(const std::string &filename){
-	TextOutput::load(filename.c_str(), this);
+	if (BinaryInput::isBinaryFile(filename))
+		BinaryOutput::load(filename, this);
+#ifdef CRPROPA_HAVE_HDF5
+	else if (HDF5Input::isHDF5File(filename))
+		HDF5Input(filename).load(this);
+#endif
+	else
+		TextOutput::load(filename.c_str(), this);
 }
 
 ParticleCollector::~ParticleCollector() {
@@ -58,19 +168,156 @@ ParticleCollector::~ParticleCollector() {
 }
 
 std::size_t ParticleCollector::size() const {
-        return container.size();
+        merge();
+        return container.size() + spilled;
 }
 
 ref_ptr<Candidate> ParticleCollector::operator[](const std::size_t i) const {
+	merge();
+	if (i >= container.size())
+		return getSpilled().getCandidate(i - container.size());
 	return container[i];
 }
 
 void ParticleCollector::clearContainer() {
+        merge();
         container.clear();
+        collected = 0;
+        removeSpill();
+	updateMemory(0);
 }
 
 std::vector<ref_ptr<Candidate> > ParticleCollector::getAll() const {
-        return container;
+        merge();
+        std::vector<ref_ptr<Candidate> > all = container;
+        for (std::size_t i = 0; i < spilled; i++)
+                all.push_back(getSpilled().getCandidate(i));
+        return all;
+}
+
+// a column of getColumns: a quantity of one of the states or a property
+struct CollectorColumn {
+	enum Quantity {
+		TrajectoryLength, Redshift, SerialNumber, Id, Energy, PositionX,
+		PositionY, PositionZ, DirectionX, DirectionY, DirectionZ, Weight,
+		Property
+	};
+	Quantity quantity;
+	int state; ///< 0: current, 1: at the source, 2: at the point of creation
+	PropertyKey key;
+
+	CollectorColumn(const std::string &name) :
+			quantity(Property), state(0), key(name) {
+		if (name == "D")
+			quantity = TrajectoryLength;
+		else if (name == "z")
+			quantity = Redshift;
+		else if (name == "W")
+			quantity = Weight;
+		else if ((name.size() >= 2) && (name[0] == 'P'))
+			parseDirection(name.substr(1, name.size() - 2), name[name.size() - 1]);
+		else
+			parseState(name);
+	}
+
+	bool parseStateNumber(const std::string &s) {
+		if (s.empty())
+			state = 0;
+		else if (s == "0")
+			state = 1;
+		else if (s == "1")
+			state = 2;
+		else
+			return false;
+		return true;
+	}
+
+	void parseDirection(const std::string &s, char axis) {
+		if ((axis < 'x') || (axis > 'z') || !parseStateNumber(s))
+			return;
+		quantity = Quantity(DirectionX + (axis - 'x'));
+	}
+
+	void parseState(const std::string &name) {
+		size_t n = name.size();
+		bool suffix = (n > 1) && ((name[n - 1] == '0') || (name[n - 1] == '1'));
+		std::string base = suffix ? name.substr(0, n - 1) : name;
+		if (!parseStateNumber(suffix ? name.substr(n - 1) : ""))
+			return;
+		if (base == "SN")
+			quantity = SerialNumber;
+		else if (base == "ID")
+			quantity = Id;
+		else if (base == "E")
+			quantity = Energy;
+		else if ((base.size() == 1) && (base[0] >= 'X') && (base[0] <= 'Z'))
+			quantity = Quantity(PositionX + (base[0] - 'X'));
+		else
+			state = 0;
+	}
+
+	double value(const Candidate *c) const {
+		const ParticleState &p = (state == 0) ? c->current
+				: ((state == 1) ? c->source.get() : c->created.get());
+		switch (quantity) {
+		case TrajectoryLength:
+			return c->getTrajectoryLength();
+		case Redshift:
+			return c->getRedshift();
+		case SerialNumber:
+			return (state == 0) ? c->getSerialNumber() : ((state == 1)
+					? c->getSourceSerialNumber() : c->getCreatedSerialNumber());
+		case Id:
+			return p.getId();
+		case Energy:
+			return p.getEnergy();
+		case PositionX:
+		case PositionY:
+		case PositionZ: {
+			Vector3d x = p.getPosition();
+			return (quantity == PositionX) ? x.x : ((quantity == PositionY) ? x.y : x.z);
+		}
+		case DirectionX:
+		case DirectionY:
+		case DirectionZ: {
+			Vector3d u = p.getDirection();
+			return (quantity == DirectionX) ? u.x : ((quantity == DirectionY) ? u.y : u.z);
+		}
+		case Weight:
+			return c->getWeight();
+		default:
+			if (!c->hasProperty(key))
+				return std::numeric_limits<double>::quiet_NaN();
+			return c->getProperty(key).toDouble();
+		}
+	}
+};
+
+void ParticleCollector::getColumns(const std::vector<std::string> &names,
+		double *data) const {
+	std::vector<CollectorColumn> columns;
+	for (std::size_t j = 0; j < names.size(); j++)
+		columns.push_back(CollectorColumn(names[j]));
+	const std::size_t k = columns.size();
+
+	merge();
+	for (std::size_t i = 0; i < container.size(); i++)
+		for (std::size_t j = 0; j < k; j++)
+			data[i * k + j] = columns[j].value(container[i]);
+	for (std::size_t i = 0; i < spilled; i++) {
+		ref_ptr<Candidate> c = getSpilled().getCandidate(i);
+		double *row = data + (container.size() + i) * k;
+		for (std::size_t j = 0; j < k; j++)
+			row[j] = columns[j].value(c);
+	}
+}
+
+std::vector<double> ParticleCollector::getColumns(
+		const std::vector<std::string> &columns) const {
+	std::vector<double> data(size() * columns.size());
+	if (!data.empty())
+		getColumns(columns, &data[0]);
+	return data;
 }
 
 void ParticleCollector::setClone(bool b) {
@@ -81,33 +328,54 @@ bool ParticleCollector::getClone() const {
         return clone;
 }
 
+void ParticleCollector::setSpillLimit(std::size_t n) {
+        spillLimit = n;
+}
+
+std::size_t ParticleCollector::getSpillLimit() const {
+        return spillLimit;
+}
+
 std::string ParticleCollector::getDescription() const {
         return "ParticleCollector";
 }
 
 ParticleCollector::iterator ParticleCollector::begin() {
+	merge();
 	return container.begin();
 }
 
 ParticleCollector::const_iterator ParticleCollector::begin() const {
+	merge();
 	return container.begin();
 }
 
 ParticleCollector::iterator ParticleCollector::end() {
+	merge();
 	return container.end();
 }
 
 ParticleCollector::const_iterator ParticleCollector::end() const {
+	merge();
 	return container.end();
 }
 
-void ParticleCollector::getTrajectory(ModuleList* mlist, std::size_t i, Module *output) const {
-	ref_ptr<Candidate> c_tmp = container[i]->clone();
+// re-run a collected candidate, replayed if possible
+static void rerun(ModuleList *mlist, ref_ptr<Candidate> candidate) {
+	ref_ptr<Candidate> c_tmp = candidate->clone();
+	if (mlist->getCounterBasedRandom() && ModuleList::canReplay(c_tmp)) {
+		mlist->replay(c_tmp);
+	} else {
+		c_tmp->restart();
+		mlist->run(c_tmp);
+	}
+}
 
-	c_tmp->restart();
+void ParticleCollector::getTrajectory(ModuleList* mlist, std::size_t i, Module *output) const {
+	ref_ptr<Candidate> candidate = (*this)[i];
 
 	mlist->add(output);
-	mlist->run(c_tmp);
+	rerun(mlist, candidate);
 	mlist->remove(mlist->size()-1);
 }
 
@@ -115,4 +383,30 @@ void ParticleCollector::getTrajectory(ref_ptr<ModuleList> mlist, std::size_t i,
 	ParticleCollector::getTrajectory((ModuleList*) mlist, i, (Module*) output);
 }
 
+void ParticleCollector::getTrajectories(ModuleList *mlist,
+		const std::vector<std::size_t> &indices, Module *output) const {
+	// the candidates first, spilled ones are read before the threads start
+	std::vector<ref_ptr<Candidate> > candidates(indices.size());
+	for (std::size_t j = 0; j < indices.size(); j++)
+		candidates[j] = (*this)[indices[j]];
+
+	mlist->add(output);
+	long n = candidates.size();
+	#pragma omp parallel for schedule(dynamic, 1)
+	for (long j = 0; j < n; j++) {
+		try {
+			rerun(mlist, candidates[j]);
+		} catch (std::exception &e) {
+			std::cerr << "Exception in crpropa::ParticleCollector::getTrajectories: " << std::endl;
+			std::cerr << e.what() << std::endl;
+		}
+	}
+	mlist->remove(mlist->size()-1);
+}
+
+void ParticleCollector::getTrajectories(ref_ptr<ModuleList> mlist,
+		const std::vector<std::size_t> &indices, ref_ptr<Module> output) const {
+	ParticleCollector::getTrajectories((ModuleList*) mlist, indices, (Module*) output);
+}
+
 } // namespace crpropa
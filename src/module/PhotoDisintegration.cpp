@@ -3,8 +3,11 @@
 #include "crpropa/ParticleID.h"
 #include "crpropa/ParticleMass.h"
 #include "crpropa/Random.h"
+#include "crpropa/Statistics.h"
+#include <kiss/convert.h>
 #include <kiss/logger.h>
 
+#include <algorithm>
 #include <cmath>
 #include <limits>
 #include <sstream>
@@ -21,12 +24,23 @@ PhotoDisintegration::PhotoDisintegration(PhotonField f, bool havePhotons, double
 	setPhotonField(f);
 	this->havePhotons = havePhotons;
 	this->limit = limit;
+	useOpticalDepth = false;
+
+	// own property name, several instances can process the same candidate
+	static int instances = 0;
+	std::stringstream s;
+	s << "PhotoDisintegration" << __sync_fetch_and_add(&instances, 1) << ".opticalDepth";
+	opticalDepthKey = s.str();
 }
 
 void PhotoDisintegration::setPhotonField(PhotonField photonField) {
 	this->photonField = photonField;
+	scaling = new PhotonFieldScaling(photonField);
 	std::string fname = photonFieldName(photonField);
 	setDescription("PhotoDisintegration: " + fname);
+	if (getCustomPhotonField(photonField).valid())
+		throw std::runtime_error("PhotoDisintegration: no tables of custom photon fields, "
+				"the cross sections of the channels are not available");
 	initRate(getDataPath("Photodisintegration/rate_" + fname + ".txt"));
 	initBranching(getDataPath("Photodisintegration/branching_" + fname + ".txt"));
 	initPhotonEmission(getDataPath("Photodisintegration/photon_emission_" + fname.substr(0,3) + ".txt"));
@@ -40,167 +54,243 @@ void PhotoDisintegration::setLimit(double limit) {
 	this->limit = limit;
 }
 
-void PhotoDisintegration::initRate(std::string filename) {
-	std::ifstream infile(filename.c_str());
-	if (not infile.good())
-		throw std::runtime_error("PhotoDisintegration: could not open file " + filename);
-
-	// clear previously loaded interaction rates
-	pdRate.clear();
-	pdRate.resize(27 * 31);
-
-	std::string line;
-	while (std::getline(infile, line)) {
-		if (line[0] == '#')
-			continue;
-		std::stringstream lineStream(line);
+ref_ptr<PhotoDisintegration::TableIndex> PhotoDisintegration::openTable(
+		const std::string &filename, size_t columns, TableKind kind) {
+	static std::map<std::string, ref_ptr<TableIndex> > tables;
 
-		int Z, N;
-		lineStream >> Z;
-		lineStream >> N;
+	ref_ptr<TableIndex> index;
+	std::string error;
+#pragma omp critical(PhotoDisintegrationTables)
+	{
+		// forget tables that are no longer used by any instance
+		std::map<std::string, ref_ptr<TableIndex> >::iterator i = tables.begin();
+		while (i != tables.end()) {
+			if (i->second->getReferenceCount() == 1)
+				tables.erase(i++);
+			else
+				++i;
+		}
 
-		double r;
-		for (size_t i = 0; i < nlg; i++) {
-			lineStream >> r;
-			pdRate[Z * 31 + N].push_back(r / Mpc);
+		i = tables.find(filename);
+		if (i != tables.end()) {
+			index = i->second;
+		} else {
+			try {
+				ref_ptr<DataTable> table = DataTable::open(filename);
+				if (!table.valid())
+					throw std::runtime_error("PhotoDisintegration: could not open file " + filename);
+				index = new TableIndex();
+				index->table = table;
+				std::vector<std::pair<int, size_t> > nuclei;
+				std::vector<std::pair<std::pair<int, int>, size_t> > emissions;
+				for (size_t j = 0; j < table->size(); j++) {
+					if (table->rowSize(j) < columns)
+						throw std::runtime_error("PhotoDisintegration: incomplete row in " + filename);
+					const double *row = table->row(j);
+					int Z = int(row[0]);
+					int N = int(row[1]);
+					if (kind == EmissionTable) {
+						int daughter = int(row[2]) * 31 + int(row[3]);
+						emissions.push_back(std::make_pair(std::make_pair(Z * 31 + N, daughter), j));
+					} else {
+						nuclei.push_back(std::make_pair(Z * 31 + N, j));
+					}
+				}
+
+				// flat array of the rows sorted by nucleus, in file order
+				std::sort(nuclei.begin(), nuclei.end());
+				index->rowBegin.assign(27 * 31 + 1, 0);
+				for (size_t j = 0; j < nuclei.size(); j++) {
+					index->rowBegin[nuclei[j].first + 1]++;
+					index->row.push_back(nuclei[j].second);
+				}
+				for (size_t j = 0; j < 27 * 31; j++)
+					index->rowBegin[j + 1] += index->rowBegin[j];
+
+				// flat arrays sorted by mother and daughter nucleus
+				std::sort(emissions.begin(), emissions.end());
+				index->emissionBegin.assign(27 * 31 + 1, 0);
+				for (size_t j = 0; j < emissions.size(); j++) {
+					index->emissionBegin[emissions[j].first.first + 1]++;
+					index->emissionDaughter.push_back(emissions[j].first.second);
+					index->emissionRow.push_back(emissions[j].second);
+				}
+				for (size_t j = 0; j < 27 * 31; j++)
+					index->emissionBegin[j + 1] += index->emissionBegin[j];
+
+				// cumulative branching ratios, contiguous per nucleus and tabulation point
+				if (kind == BranchingTable) {
+					index->branchBegin.assign(27 * 31 + 1, 0);
+					for (size_t j = 0; j < 27 * 31; j++)
+						index->branchBegin[j + 1] = index->branchBegin[j] + index->rowCount(j);
+					index->branchChannel.resize(index->branchBegin.back());
+					index->branchCumulative.resize(index->branchBegin.back() * nlg);
+					for (size_t j = 0; j < 27 * 31; j++) {
+						size_t n = index->rowCount(j);
+						if (n == 0)
+							continue;
+						const size_t *rows = index->rowsOf(j);
+						for (size_t c = 0; c < n; c++)
+							index->branchChannel[index->branchBegin[j] + c] = int(table->get(rows[c], 2));
+						for (size_t l = 0; l < nlg; l++) {
+							double *cumulative = &index->branchCumulative[index->branchBegin[j] * nlg + l * n];
+							double sum = 0;
+							for (size_t c = 0; c < n; c++) {
+								sum += table->get(rows[c], 3 + l);
+								cumulative[c] = sum;
+							}
+							if (sum > 0)
+								for (size_t c = 0; c < n; c++)
+									cumulative[c] /= sum;
+						}
+					}
+				}
+
+				size_t bytes = (index->rowBegin.capacity() + index->row.capacity()
+						+ index->emissionBegin.capacity() + index->emissionRow.capacity()
+						+ index->branchBegin.capacity()) * sizeof(size_t)
+						+ (index->emissionDaughter.capacity() + index->branchChannel.capacity()) * sizeof(int)
+						+ index->branchCumulative.capacity() * sizeof(double);
+				index->memory.set(bytes);
+				tables[filename] = index;
+			} catch (std::exception &e) {
+				index = 0;
+				error = e.what();
+			}
 		}
 	}
-	infile.close();
+	if (!error.empty())
+		throw std::runtime_error(error);
+	return index;
 }
 
-void PhotoDisintegration::initBranching(std::string filename) {
-	std::ifstream infile(filename.c_str());
-	if (not infile.good())
-		throw std::runtime_error("PhotoDisintegration: could not open file " + filename);
-
-	// clear previously loaded interaction rates
-	pdBranch.clear();
-	pdBranch.resize(27 * 31);
-
-	std::string line;
-	while (std::getline(infile, line)) {
-		if (line[0] == '#')
-			continue;
-
-		std::stringstream lineStream(line);
-
-		int Z, N;
-		lineStream >> Z;
-		lineStream >> N;
-
-		Branch branch;
-		lineStream >> branch.channel;
-
-		double r;
-		for (size_t i = 0; i < nlg; i++) {
-			lineStream >> r;
-			branch.branchingRatio.push_back(r);
-		}
-
-		pdBranch[Z * 31 + N].push_back(branch);
-	}
+void PhotoDisintegration::initRate(std::string filename) {
+	pdRate = openTable(filename, 2 + nlg, RateTable);
+}
 
-	infile.close();
+void PhotoDisintegration::initBranching(std::string filename) {
+	pdBranch = openTable(filename, 3 + nlg, BranchingTable);
 }
 
 void PhotoDisintegration::initPhotonEmission(std::string filename) {
-	std::ifstream infile(filename.c_str());
-	if (not infile.good())
-		throw std::runtime_error("PhotoDisintegration: could not open file " + filename);
+	pdPhoton = openTable(filename, 5 + nlg, EmissionTable);
+}
 
-	// clear previously loaded emission probabilities
-	pdPhoton.clear();
+double PhotoDisintegration::interactionRate(const Candidate *candidate) const {
+	// check if nucleus
+	if (not candidate->current.isNucleus())
+		return 0;
 
-	std::string line;
-	while (std::getline(infile, line)) {
-		if (line[0] == '#')
-			continue;
+	int A = candidate->current.getMassNumber();
+	int Z = candidate->current.getChargeNumber();
+	int N = A - Z;
 
-		std::stringstream lineStream(line);
+	// check if disintegration data available
+	if ((Z > 26) or (N > 30))
+		return 0;
+	if (pdRate->rowCount(Z * 31 + N) == 0)
+		return 0;
 
-		int Z, N, Zd, Nd;
-		lineStream >> Z;
-		lineStream >> N;
-		lineStream >> Zd;
-		lineStream >> Nd;
+	// check if in tabulated energy range
+	double z = candidate->getRedshift();
+	double lg = log10(candidate->current.getLorentzFactor() * (1 + z));
+	if ((lg <= lgmin) or (lg >= lgmax))
+		return 0;
 
-		PhotonEmission em;
-		lineStream >> em.energy;
-		em.energy *= eV;
+	const double *rates = pdRate->table->row(pdRate->rowsOf(Z * 31 + N)[0]) + 2;
+	double rate = interpolateEquidistant(lg, lgmin, lgmax, rates, nlg) / Mpc;
+	rate *= pow(1 + z, 2) * scaling->scalingFactor(z); // cosmological scaling, rate per comoving distance
+	return rate;
+}
 
-		double r;
-		for (size_t i = 0; i < nlg; i++) {
-			lineStream >> r;
-			em.emissionProbability.push_back(r);
-		}
+void PhotoDisintegration::interact(Candidate *candidate) const {
+	int A = candidate->current.getMassNumber();
+	int Z = candidate->current.getChargeNumber();
+	int N = A - Z;
+	double z = candidate->getRedshift();
+	double lg = log10(candidate->current.getLorentzFactor() * (1 + z));
 
-		int key = Z * 1000000 + N * 10000 + Zd * 100 + Nd;
-		if (pdPhoton.find(key) == pdPhoton.end()) {
-			std::vector<PhotonEmission> emissions;
-			pdPhoton[key] = emissions;
-		}
-		pdPhoton[key].push_back(em);
-	}
+	// select channel from the cumulative ratios at the closest tabulation point and interact
+	int idx = Z * 31 + N;
+	size_t n = pdBranch->rowCount(idx);
+	if (n == 0)
+		return;
+	int l = round((lg - lgmin) / (lgmax - lgmin) * (nlg - 1));
+	l = std::min(std::max(l, 0), int(nlg) - 1);
+	const double *cumulative = &pdBranch->branchCumulative[pdBranch->branchBegin[idx] * nlg + l * n];
+	size_t i = std::lower_bound(cumulative, cumulative + n, Random::instance().rand()) - cumulative;
+	performInteraction(candidate, pdBranch->branchChannel[pdBranch->branchBegin[idx] + std::min(i, n - 1)]);
+}
+
+void PhotoDisintegration::setOpticalDepth(bool b) {
+	useOpticalDepth = b;
+}
 
-	infile.close();
+int PhotoDisintegration::getParticleClasses() const {
+	// the optical depth is drawn and stored for all candidates
+	return useOpticalDepth ? AllClasses : NucleiClasses;
 }
 
 void PhotoDisintegration::process(Candidate *candidate) const {
+	if (useOpticalDepth)
+		return processOpticalDepth(candidate);
+
 	// execute the loop at least once for limiting the next step
 	double step = candidate->getCurrentStep();
 	do {
-		// check if nucleus
-		int id = candidate->current.getId();
-		if (not isNucleus(id))
-			return;
-
-		int A = massNumber(id);
-		int Z = chargeNumber(id);
-		int N = A - Z;
-		size_t idx = Z * 31 + N;
-
-		// check if disintegration data available
-		if ((Z > 26) or (N > 30))
-			return;
-		if (pdRate[idx].size() == 0)
-			return;
-
-		// check if in tabulated energy range
-		double z = candidate->getRedshift();
-		double lg = log10(candidate->current.getLorentzFactor() * (1 + z));
-		if ((lg <= lgmin) or (lg >= lgmax))
+		double rate = interactionRate(candidate) * getInteractionBias();
+		if (rate == 0)
 			return;
 
-		double rate = interpolateEquidistant(lg, lgmin, lgmax, pdRate[idx]);
-		rate *= pow(1 + z, 2) * photonFieldScaling(photonField, z); // cosmological scaling, rate per comoving distance
-
 		// check if interaction occurs in this step
 		// otherwise limit next step to a fraction of the mean free path
-		Random &random = Random::instance();
-		double randDist = -log(random.rand()) / rate;
+		double randDist = -log(Random::instance().rand()) / rate;
 		if (step < randDist) {
 			candidate->limitNextStep(limit / rate);
 			return;
 		}
 
-		// select channel and interact
-		const std::vector<Branch> &branches = pdBranch[idx];
-		double cmp = random.rand();
-		int l = round((lg - lgmin) / (lgmax - lgmin) * (nlg - 1)); // index of closest tabulation point
-		size_t i = 0;
-		while ((i < branches.size()) and (cmp > 0)) {
-			cmp -= branches[i].branchingRatio[l];
-			i++;
-		}
-		performInteraction(candidate, branches[i-1].channel);
+		interactBiased(candidate);
 
 		// repeat with remaining step
 		step -= randDist;
 	} while (step > 0);
 }
 
+void PhotoDisintegration::processOpticalDepth(Candidate *candidate) const {
+	double step = candidate->getCurrentStep();
+	double tau;
+	if (candidate->hasProperty(opticalDepthKey))
+		tau = candidate->getProperty(opticalDepthKey).toDouble();
+	else
+		tau = -log(Random::instance().rand());
+
+	// the loop is executed at least once for limiting the next step
+	do {
+		double rate = interactionRate(candidate) * getInteractionBias();
+		if (rate == 0)
+			break;
+
+		// no interaction in the remaining step
+		if (rate * step < tau) {
+			tau -= rate * step;
+			candidate->limitNextStep(std::max(tau, limit) / rate);
+			break;
+		}
+
+		// interact where the optical depth is used up and draw the next one
+		step -= tau / rate;
+		interactBiased(candidate);
+		tau = -log(Random::instance().rand());
+	} while (step > 0);
+
+	candidate->setProperty(opticalDepthKey, tau);
+}
+
 void PhotoDisintegration::performInteraction(Candidate *candidate, int channel) const {
 	KISS_LOG_DEBUG << "Photodisintegration::performInteraction. Channel " <<  channel << " on candidate " << candidate->getDescription(); 
+	if (Statistics::isEnabled())
+		Statistics::count("PhotoDisintegration: channel " + kiss::str(channel));
 	// parse disintegration channel
 	int nNeutron = digit(channel, 100000);
 	int nProton = digit(channel, 10000);
@@ -212,9 +302,8 @@ void PhotoDisintegration::performInteraction(Candidate *candidate, int channel)
 	int dA = -nNeutron - nProton - 2 * nH2 - 3 * nH3 - 3 * nHe3 - 4 * nHe4;
 	int dZ = -nProton - nH2 - nH3 - 2 * nHe3 - 2 * nHe4;
 
-	int id = candidate->current.getId();
-	int A = massNumber(id);
-	int Z = chargeNumber(id);
+	int A = candidate->current.getMassNumber();
+	int Z = candidate->current.getChargeNumber();
 	double EpA = candidate->current.getEnergy() / A;
 
 	// create secondaries
@@ -256,16 +345,27 @@ void PhotoDisintegration::performInteraction(Candidate *candidate, int channel)
 	double lf = candidate->current.getLorentzFactor();
 
 	int l = round((lg - lgmin) / (lgmax - lgmin) * (nlg - 1));  // index of closest tabulation point
-	int key = Z*1e6 + (A-Z)*1e4 + (Z+dZ)*1e2 + (A+dA) - (Z+dZ);
+	if ((Z > 26) or (A - Z > 30))
+		return;
+	int mother = Z * 31 + (A - Z);
+	int daughter = (Z + dZ) * 31 + (A + dA) - (Z + dZ);
+
+	// emissions of the mother nucleus, sorted by daughter
+	const std::vector<int> &daughters = pdPhoton->emissionDaughter;
+	std::vector<int>::const_iterator begin = daughters.begin() + pdPhoton->emissionBegin[mother];
+	std::vector<int>::const_iterator end = daughters.begin() + pdPhoton->emissionBegin[mother + 1];
+	std::pair<std::vector<int>::const_iterator, std::vector<int>::const_iterator> emissions = std::equal_range(begin, end, daughter);
+
+	for (size_t i = emissions.first - daughters.begin(); i < emissions.second - daughters.begin(); i++) {
+		const double *row = pdPhoton->table->row(pdPhoton->emissionRow[i]);
 
-	for (int i = 0; i < pdPhoton[key].size(); i++) {
 		// check for random emission
-		if (random.rand() > pdPhoton[key][i].emissionProbability[l])
+		if (random.rand() > row[5 + l])
 			continue;
 
 		// boost to lab frame
 		double cosTheta = 2 * random.rand() - 1;
-		double E = pdPhoton[key][i].energy * lf * (1 - cosTheta);
+		double E = row[4] * eV * lf * (1 - cosTheta);
 		candidate->addSecondary(22, E, pos);
 	}
 }
@@ -283,8 +383,7 @@ double PhotoDisintegration::lossLength(int id, double gamma, double z) {
 	// check if disintegration data available
 	if ((Z > 26) or (N > 30))
 		return std::numeric_limits<double>::max();
-	const std::vector<double> &rate = pdRate[idx];
-	if (rate.size() == 0)
+	if (pdRate->rowCount(idx) == 0)
 		return std::numeric_limits<double>::max();
 
 	// check if in tabulated energy range
@@ -293,16 +392,17 @@ double PhotoDisintegration::lossLength(int id, double gamma, double z) {
 		return std::numeric_limits<double>::max();
 
 	// total interaction rate
-	double lossRate = interpolateEquidistant(lg, lgmin, lgmax, rate);
+	double lossRate = interpolateEquidistant(lg, lgmin, lgmax, pdRate->table->row(pdRate->rowsOf(idx)[0]) + 2, nlg) / Mpc;
 
 	// comological scaling, rate per physical distance
-	lossRate *= pow(1 + z, 3) * photonFieldScaling(photonField, z);
+	lossRate *= pow(1 + z, 3) * scaling->scalingFactor(z);
 
 	// average number of nucleons lost for all disintegration channels
 	double avg_dA = 0;
-	const std::vector<Branch> &branches = pdBranch[idx];
-	for (size_t i = 0; i < branches.size(); i++) {
-		int channel = branches[i].channel;
+	const size_t *branches = pdBranch->rowsOf(idx);
+	for (size_t i = 0; i < pdBranch->rowCount(idx); i++) {
+		const double *row = pdBranch->table->row(branches[i]);
+		int channel = int(row[2]);
 		int dA = 0;
 		dA += 1 * digit(channel, 100000);
 		dA += 1 * digit(channel, 10000);
@@ -311,7 +411,7 @@ double PhotoDisintegration::lossLength(int id, double gamma, double z) {
 		dA += 3 * digit(channel, 10);
 		dA += 4 * digit(channel, 1);
 
-		double br = interpolateEquidistant(lg, lgmin, lgmax, branches[i].branchingRatio);
+		double br = interpolateEquidistant(lg, lgmin, lgmax, row + 3, nlg);
 		avg_dA += br * dA;
 	}
 
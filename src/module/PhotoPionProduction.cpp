@@ -1,21 +1,83 @@
 #include "crpropa/module/PhotoPionProduction.h"
+#include "crpropa/DataTable.h"
+#include "crpropa/Lock.h"
 #include "crpropa/Units.h"
 #include "crpropa/ParticleID.h"
 #include "crpropa/Random.h"
+#include "crpropa/Statistics.h"
 
 #include <kiss/convert.h>
 #include <kiss/logger.h>
 #include "sophia.h"
 
+#include <algorithm>
 #include <limits>
 #include <cmath>
 #include <sstream>
 #include <fstream>
 #include <stdexcept>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// SOPHIA draws its random numbers from the generator of the calling thread,
+// which makes concurrent events independent and reproducible with the seed
+double sophia_rand_() {
+	return crpropa::Random::instance().randDblExc();
+}
+
 namespace crpropa {
 
+// nucleon energies of the secondary table: 10 per decade up to 1e23 eV
+static const double secondaryTablePerDecade = 10;
+static const double secondaryTableMaxEnergy = 1e23 * eV;
+
+// lowest nucleon energy (at z = 0) for which SOPHIA is called
+static double sophiaThreshold(PhotonField field) {
+	return (field == CMB) ? 3.72e18 * eV : 5.83e15 * eV;
+}
+
+static size_t secondaryTableEnergies(PhotonField field) {
+	return size_t(log10(secondaryTableMaxEnergy / sophiaThreshold(field))
+			* secondaryTablePerDecade) + 1;
+}
+
+// interaction statistics, see Statistics
+static const size_t protonInteractions = Statistics::addCounter("PhotoPionProduction: interactions on protons");
+static const size_t neutronInteractions = Statistics::addCounter("PhotoPionProduction: interactions on neutrons");
+
+#ifndef CRPROPA_HAVE_SOPHIA_OPENMP
+// SOPHIA keeps its state in common blocks shared by all threads
+static Lock sophiaLock("sophia");
+#endif
+
+// SOPHIA event, serialized unless the state of SOPHIA is thread private
+static void sophiaEvent(int nature, double Ein, double momentaList[][2000],
+		int particleList[], int &nParticles, double z, int background) {
+	double maxRedshift = 100; // IR photon density is zero above this redshift
+	int dummy1; // not needed
+	double dummy2[2]; // not needed
+#ifdef CRPROPA_HAVE_SOPHIA_OPENMP
+	sophiaevent_(nature, Ein, momentaList, particleList, nParticles, z, background, maxRedshift, dummy1, dummy2, dummy2);
+#else
+	ScopedLock l(sophiaLock);
+	sophiaevent_(nature, Ein, momentaList, particleList, nParticles, z, background, maxRedshift, dummy1, dummy2, dummy2);
+#endif
+}
+
+double PhotoPionProduction::nucleonCrossSection(double eps, bool onProton) {
+	double x = eps / GeV;
+	int mode = 3, nucleon = onProton ? 13 : 14;
+#ifndef CRPROPA_HAVE_SOPHIA_OPENMP
+	ScopedLock l(sophiaLock);
+#endif
+	initial_(nucleon);
+	return crossection_(x, mode, nucleon) * 1e-6 * barn;
+}
+
 PhotoPionProduction::PhotoPionProduction(PhotonField field, bool photons, bool neutrinos, bool electrons, bool antiNucleons, double l, bool redshift) {
+	tabEventsPerEnergy = 0;
 	havePhotons = photons;
 	haveNeutrinos = neutrinos;
 	haveElectrons = electrons;
@@ -25,8 +87,21 @@ PhotoPionProduction::PhotoPionProduction(PhotonField field, bool photons, bool n
 	setPhotonField(field);
 }
 
+// maximum number of threads with a rate cache, further threads do not cache
+static const size_t rateCacheThreads = 256;
+
+void PhotoPionProduction::clearRateCache() {
+	RateCache empty;
+	empty.gamma = empty.z = empty.mfp = 0;
+	empty.i = empty.j = 0;
+	empty.valid = false;
+	rateCache.assign(2 * rateCacheThreads, empty);
+}
+
 void PhotoPionProduction::setPhotonField(PhotonField field) {
 	photonField = field;
+	scaling = new PhotonFieldScaling(field);
+	clearSecondaryTable();
 	if (haveRedshiftDependence) {
 		std::cout << "PhotoPionProduction: tabulated redshift dependence not needed for CMB, switching off" << std::endl;
 		haveRedshiftDependence = false;
@@ -36,7 +111,7 @@ void PhotoPionProduction::setPhotonField(PhotonField field) {
 	if (haveRedshiftDependence)
 		initRate(getDataPath("PhotoPionProduction/rate_" + fname.replace(0, 3, "IRBz") + ".txt"));
 	else
-		initRate(getDataPath("PhotoPionProduction/rate_" + fname + ".txt"));
+		initRate(photonFieldTable(field, "PhotoPionProduction", "rate"));
 }
 
 void PhotoPionProduction::setHavePhotons(bool b) {
@@ -66,26 +141,25 @@ void PhotoPionProduction::setLimit(double l) {
 
 void PhotoPionProduction::initRate(std::string filename) {
 	// clear previously loaded tables
+	clearRateCache();
 	tabLorentz.clear();
 	tabRedshifts.clear();
 	tabProtonRate.clear();
 	tabNeutronRate.clear();
 
-	std::ifstream infile(filename.c_str());
-	if (!infile.good())
+	ref_ptr<DataTable> table = DataTable::open(filename);
+	if (!table.valid())
 		throw std::runtime_error("PhotoPionProduction: could not open file " + filename);
 
-	if (haveRedshiftDependence) {
-		double zOld = -1, aOld = -1;
-		while (infile.good()) {
-			if (infile.peek() == '#') {
-				infile.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-				continue;
-			}
-			double z, a, b, c;
-			infile >> z >> a >> b >> c;
-			if (!infile)
-				break;
+	// rows: (redshift), log10(Lorentz factor), proton and neutron rate
+	size_t n = haveRedshiftDependence ? 4 : 3;
+	double zOld = -1, aOld = -1;
+	for (size_t i = 0; i < table->size(); i++) {
+		if (table->rowSize(i) < n)
+			throw std::runtime_error("PhotoPionProduction: incomplete row in " + filename);
+		const double *row = table->row(i);
+		if (haveRedshiftDependence) {
+			double z = row[0], a = row[1];
 			if (z > zOld) {
 				tabRedshifts.push_back(z);
 				zOld = z;
@@ -94,46 +168,169 @@ void PhotoPionProduction::initRate(std::string filename) {
 				tabLorentz.push_back(pow(10, a));
 				aOld = a;
 			}
-			tabProtonRate.push_back(b / Mpc);
-			tabNeutronRate.push_back(c / Mpc);
+		} else {
+			tabLorentz.push_back(pow(10, row[0]));
 		}
-	} else {
-		while (infile.good()) {
-			if (infile.peek() == '#') {
-				infile.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-				continue;
+		tabProtonRate.push_back(row[n - 2] / Mpc);
+		tabNeutronRate.push_back(row[n - 1] / Mpc);
+	}
+}
+
+void PhotoPionProduction::initSecondaryTable(size_t eventsPerEnergy, std::string filename) {
+	if (eventsPerEnergy == 0)
+		throw std::runtime_error("PhotoPionProduction: no events per energy for the secondary table");
+	clearSecondaryTable();
+	if ((filename != "") && loadSecondaryTable(filename, eventsPerEnergy))
+		return;
+	buildSecondaryTable(eventsPerEnergy);
+	if (filename != "")
+		saveSecondaryTable(filename);
+}
+
+void PhotoPionProduction::clearSecondaryTable() {
+	tabEventsPerEnergy = 0;
+	tabEventOffset.clear();
+	tabSecondaryType.clear();
+	tabSecondaryFraction.clear();
+}
+
+bool PhotoPionProduction::haveSecondaryTable() const {
+	return tabEventsPerEnergy > 0;
+}
+
+void PhotoPionProduction::buildSecondaryTable(size_t eventsPerEnergy) {
+	double Emin = sophiaThreshold(photonField);
+	size_t nEnergies = secondaryTableEnergies(photonField);
+	int background = (photonField == CMB) ? 1 : 2;
+
+	// events of protons (nature 0) and neutrons (nature 1) of each energy
+	int nJobs = 2 * nEnergies;
+	std::vector<std::vector<size_t> > jobCount(nJobs);
+	std::vector<std::vector<int> > jobType(nJobs);
+	std::vector<std::vector<float> > jobFraction(nJobs);
+
+#pragma omp parallel for schedule(dynamic)
+	for (int j = 0; j < nJobs; j++) {
+		int nature = j / nEnergies;
+		double Ein = Emin * pow(10, (j % nEnergies) / secondaryTablePerDecade) / GeV;
+		double momentaList[5][2000];
+		int particleList[2000];
+		int nParticles;
+		for (size_t i = 0; i < eventsPerEnergy; i++) {
+			sophiaEvent(nature, Ein, momentaList, particleList, nParticles, 0, background);
+			jobCount[j].push_back(nParticles);
+			for (int k = 0; k < nParticles; k++) {
+				jobType[j].push_back(particleList[k]);
+				jobFraction[j].push_back(momentaList[3][k] / Ein);
 			}
-			double a, b, c;
-			infile >> a >> b >> c;
-			if (!infile)
-				break;
-			tabLorentz.push_back(pow(10, a));
-			tabProtonRate.push_back(b / Mpc);
-			tabNeutronRate.push_back(c / Mpc);
 		}
 	}
 
-	infile.close();
+	tabEventOffset.push_back(0);
+	for (int j = 0; j < nJobs; j++) {
+		for (size_t i = 0; i < jobCount[j].size(); i++)
+			tabEventOffset.push_back(tabEventOffset.back() + jobCount[j][i]);
+		tabSecondaryType.insert(tabSecondaryType.end(), jobType[j].begin(), jobType[j].end());
+		tabSecondaryFraction.insert(tabSecondaryFraction.end(), jobFraction[j].begin(), jobFraction[j].end());
+	}
+	tabEventsPerEnergy = eventsPerEnergy;
+}
+
+static std::string secondaryTableHeader(PhotonField field, size_t eventsPerEnergy) {
+	std::stringstream s;
+	s << "# PhotoPionProduction secondary table: " << photonFieldName(field)
+			<< " " << eventsPerEnergy << " " << secondaryTableEnergies(field);
+	return s.str();
+}
+
+bool PhotoPionProduction::loadSecondaryTable(std::string filename, size_t eventsPerEnergy) {
+	std::ifstream infile(filename.c_str());
+	if (!infile.good())
+		return false;
+
+	// the table must have been built with the same settings
+	std::string line;
+	std::getline(infile, line);
+	if (line != secondaryTableHeader(photonField, eventsPerEnergy))
+		return false;
+	std::getline(infile, line);
+
+	size_t nEvents = 2 * secondaryTableEnergies(photonField) * eventsPerEnergy;
+	tabEventOffset.push_back(0);
+	for (size_t i = 0; i < nEvents; i++) {
+		size_t n;
+		infile >> n;
+		for (size_t k = 0; k < n; k++) {
+			int type;
+			float fraction;
+			infile >> type >> fraction;
+			tabSecondaryType.push_back(type);
+			tabSecondaryFraction.push_back(fraction);
+		}
+		if (!infile) {
+			KISS_LOG_WARNING << "PhotoPionProduction: could not read secondary table " << filename << ", building it again";
+			clearSecondaryTable();
+			return false;
+		}
+		tabEventOffset.push_back(tabSecondaryType.size());
+	}
+	tabEventsPerEnergy = eventsPerEnergy;
+	return true;
+}
+
+void PhotoPionProduction::saveSecondaryTable(std::string filename) const {
+	std::ofstream outfile(filename.c_str());
+	if (!outfile.good())
+		throw std::runtime_error("PhotoPionProduction: could not open file " + filename);
+	outfile << secondaryTableHeader(photonField, tabEventsPerEnergy) << "\n";
+	outfile << "# one event per line: number of secondaries, SOPHIA type and energy fraction of each\n";
+	outfile.precision(7);
+	for (size_t i = 0; i + 1 < tabEventOffset.size(); i++) {
+		outfile << tabEventOffset[i + 1] - tabEventOffset[i];
+		for (size_t k = tabEventOffset[i]; k < tabEventOffset[i + 1]; k++)
+			outfile << " " << tabSecondaryType[k] << " " << tabSecondaryFraction[k];
+		outfile << "\n";
+	}
 }
 
 double PhotoPionProduction::nucleonMFP(double gamma, double z, bool onProton) const {
 	const std::vector<double> &tabRate = (onProton)? tabProtonRate : tabNeutronRate;
 
+	// repeated evaluations, e.g. for the total rate and the channel selection
+#ifdef _OPENMP
+	size_t thread = omp_get_thread_num();
+#else
+	size_t thread = 0;
+#endif
+	RateCache dummy;
+	dummy.i = dummy.j = 0;
+	RateCache &cache = (thread < rateCacheThreads) ? rateCache[2 * thread + onProton] : dummy;
+	if (cache.valid and (cache.gamma == gamma) and (cache.z == z))
+		return cache.mfp;
+	cache.valid = false;
+	cache.gamma = gamma;
+	cache.z = z;
+
 	// scale nucleus energy instead of background photon energy
 	gamma *= (1 + z);
 	if (gamma < tabLorentz.front() or (gamma > tabLorentz.back()))
-		return std::numeric_limits<double>::max();
-
-	double rate;
-	if (haveRedshiftDependence)
-		rate = interpolate2d(z, gamma, tabRedshifts, tabLorentz, tabRate);
-	else
-		rate = interpolate(gamma, tabLorentz, tabRate) * photonFieldScaling(photonField, z);
-
-	// cosmological scaling
-	rate *= pow(1 + z, 2);
-
-	return 1. / rate;
+		cache.mfp = std::numeric_limits<double>::max();
+	else {
+		// the cell in gamma is computed directly, subsequent steps usually stay
+		// in the redshift cell of the last one
+		cache.i = tabLorentz.cell(gamma);
+		double rate;
+		if (haveRedshiftDependence)
+			rate = interpolate2d(z, gamma, tabRedshifts, tabLorentz.values(), tabRate, cache.j, cache.i);
+		else
+			rate = interpolate(gamma, tabLorentz.values(), tabRate, cache.i) * scaling->scalingFactor(z);
+
+		// cosmological scaling
+		rate *= pow(1 + z, 2);
+		cache.mfp = 1. / rate;
+	}
+	cache.valid = true;
+	return cache.mfp;
 }
 
 double PhotoPionProduction::nucleiModification(int A, int X) const {
@@ -144,62 +341,65 @@ double PhotoPionProduction::nucleiModification(int A, int X) const {
 	return 0.85 * X;
 }
 
+double PhotoPionProduction::nucleonRate(const Candidate *candidate, bool onProton) const {
+	int id = candidate->current.getId();
+	if (!candidate->current.isNucleus())
+		return 0;
+
+	int A = candidate->current.getMassNumber();
+	int Z = candidate->current.getChargeNumber();
+	int X = (onProton) ? Z : A - Z;
+	if (X == 0)
+		return 0;
+
+	double gamma = candidate->current.getLorentzFactor();
+	double z = candidate->getRedshift();
+	double mfp = nucleonMFP(gamma, z, onProton);
+	if (mfp == std::numeric_limits<double>::max())
+		return 0; // outside of the tabulated energy range
+	return nucleiModification(A, X) / mfp;
+}
+
+double PhotoPionProduction::interactionRate(const Candidate *candidate) const {
+	return nucleonRate(candidate, true) + nucleonRate(candidate, false);
+}
+
+void PhotoPionProduction::interact(Candidate *candidate) const {
+	// interacting particle: proton or neutron, according to the partial rates
+	double protonRate = nucleonRate(candidate, true);
+	double neutronRate = nucleonRate(candidate, false);
+	double r = Random::instance().rand() * (protonRate + neutronRate);
+	performInteraction(candidate, r < protonRate);
+}
+
 void PhotoPionProduction::process(Candidate *candidate) const {
 	double step = candidate->getCurrentStep();
-	double z = candidate->getRedshift();
 	// the loop is processed at least once for limiting the next step
 	do {
-		// check if nucleus
-		int id = candidate->current.getId();
-		if (!isNucleus(id))
+		double totalRate = interactionRate(candidate) * getInteractionBias();
+		if (totalRate == 0)
 			return;
 
-		// find interaction with minimum random distance
-		Random &random = Random::instance();
-		double randDistance = std::numeric_limits<double>::max();
-		double meanFreePath;
-		double totalRate = 0;
-		bool onProton = true; // interacting particle: proton or neutron
-
-		int A = massNumber(id);
-		int Z = chargeNumber(id);
-		int N = A - Z;
-		double gamma = candidate->current.getLorentzFactor();
-
-		// check for interaction on protons
-		if (Z > 0) {
-			meanFreePath = nucleonMFP(gamma, z, true) / nucleiModification(A, Z);
-			randDistance = -log(random.rand()) * meanFreePath;
-			totalRate += 1. / meanFreePath;
-		}
-		// check for interaction on neutrons
-		if (N > 0) {
-			meanFreePath = nucleonMFP(gamma, z, false) / nucleiModification(A, N);
-			totalRate += 1. / meanFreePath;
-			double d = -log(random.rand()) * meanFreePath;
-			if (d < randDistance) {
-				randDistance = d;
-				onProton = false;
-			}
-		}
-
 		// check if interaction does not happen
+		double randDistance = -log(Random::instance().rand()) / totalRate;
 		if (step < randDistance) {
-			if (totalRate > 0.)
-				candidate->limitNextStep(limit / totalRate);
+			candidate->limitNextStep(limit / totalRate);
 			return;
 		}
 
 		// interact and repeat with remaining step
-		performInteraction(candidate, onProton);
+		interactBiased(candidate);
 		step -= randDistance;
 	} while (step > 0);
 }
 
 void PhotoPionProduction::performInteraction(Candidate *candidate, bool onProton) const {
+	if (Statistics::isEnabled())
+		Statistics::count(onProton ? protonInteractions : neutronInteractions);
+
 	int id = candidate->current.getId();
-	int A = massNumber(id);
-	int Z = chargeNumber(id);
+	int A = candidate->current.getMassNumber();
+	int Z = candidate->current.getChargeNumber();
 	double E = candidate->current.getEnergy();
 	double EpA = E / A;
 	double z = candidate->getRedshift();
@@ -215,22 +415,33 @@ void PhotoPionProduction::performInteraction(Candidate *candidate, bool onProton
 	double momentaList[5][2000]; // momentum list, what are the five components?
 	int particleList[2000]; // particle id list
 	int nParticles; // number of outgoing particles
-	double maxRedshift = 100; // IR photon density is zero above this redshift
-	int dummy1; // not needed
-	double dummy2[2]; // not needed
 	int background = (photonField == CMB) ? 1 : 2; // photon background: 1 for CMB, 2 for Kneiske IRB
 
 	// check if below SOPHIA's energy threshold
-	double E_threshold = (photonField == CMB) ? 3.72e18 * eV : 5.83e15 * eV;
+	double E_threshold = sophiaThreshold(photonField);
 	if (EpA * (1 + z) < E_threshold)
 		return;
 
-#pragma omp critical
-	{
-		sophiaevent_(nature, Ein, momentaList, particleList, nParticles, z, background, maxRedshift, dummy1, dummy2, dummy2);
+	Random &random = Random::instance();
+	if (haveSecondaryTable()) {
+		// tabulated event of one of the neighboring energies
+		size_t nEnergies = (tabEventOffset.size() - 1) / (2 * tabEventsPerEnergy);
+		double x = log10(EpA * (1 + z) / E_threshold) * secondaryTablePerDecade;
+		size_t j = std::min(size_t(x), nEnergies - 1);
+		if ((j + 1 < nEnergies) && (random.rand() < x - j))
+			j++;
+		size_t event = (nature * nEnergies + j) * tabEventsPerEnergy
+				+ random.randInt(tabEventsPerEnergy - 1);
+		nParticles = 0;
+		for (size_t k = tabEventOffset[event]; k < tabEventOffset[event + 1]; k++) {
+			particleList[nParticles] = tabSecondaryType[k];
+			momentaList[3][nParticles] = tabSecondaryFraction[k] * Ein;
+			nParticles++;
+		}
+	} else {
+		sophiaEvent(nature, Ein, momentaList, particleList, nParticles, z, background);
 	}
 
-	Random &random = Random::instance();
 	Vector3d pos = random.randomInterpolatedPosition(candidate->previous.getPosition(), candidate->current.getPosition());
 	for (int i = 0; i < nParticles; i++) { // loop over out-going particles
 		double Eout = momentaList[3][i] * GeV; // only the energy is used; could be changed for more detail
@@ -335,4 +546,8 @@ double PhotoPionProduction::lossLength(int id, double gamma, double z) {
 	return 1. / lossRate;
 }
 
+int PhotoPionProduction::getParticleClasses() const {
+	return NucleiClasses;
+}
+
 } // namespace crpropa
@@ -5,13 +5,14 @@
 #include "EleCa/Particle.h"
 #include "EleCa/Common.h"
 
+#include <sstream>
 #include <vector>
 
 namespace crpropa {
 
 PhotonEleCa::PhotonEleCa(const std::string background,
 		const std::string &outputFilename) :
-		propagation(new eleca::Propagation), saveOnlyPhotonEnergies(false) {
+		propagation(new eleca::Propagation), saveOnlyPhotonEnergies(false), lock("PhotonEleCa") {
 	//propagation->ReadTables(getDataPath("eleca_lee.txt"));
 	propagation->ReadTables(getDataPath("EleCa/eleca.dat"));
 	propagation->InitBkgArray(background);
@@ -45,18 +46,22 @@ void PhotonEleCa::process(Candidate *candidate) const {
 		}
 	}
 
-#pragma omp critical
-	{
-		if (saveOnlyPhotonEnergies) {
-			for (int i = 0; i < ParticleAtGround.size(); ++i) {
-				eleca::Particle &p = ParticleAtGround[i];
-				if (p.GetType() != 22)
-					continue;
-				output << p.GetEnergy() << "\n";
-			}
-		} else {
-			propagation->WriteOutput(output, p0, ParticleAtGround);
+	// format outside of the lock, only the write is serialized
+	std::stringstream s;
+	if (saveOnlyPhotonEnergies) {
+		for (int i = 0; i < ParticleAtGround.size(); ++i) {
+			eleca::Particle &p = ParticleAtGround[i];
+			if (p.GetType() != 22)
+				continue;
+			s << p.GetEnergy() << "\n";
 		}
+	} else {
+		propagation->WriteOutput(s, p0, ParticleAtGround);
+	}
+	std::string str = s.str();
+	{
+		ScopedLock l(lock);
+		output.write(str.c_str(), str.size());
 	}
 
 	candidate->setActive(false);
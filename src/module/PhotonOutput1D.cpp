@@ -10,27 +10,35 @@
 #include "kiss/logger.h"
 
 #ifdef CRPROPA_HAVE_ZLIB
-#include <ozstream.hpp>
+#include "crpropa/GzipStream.h"
 #endif
 
 using namespace std;
 
 namespace crpropa {
 
-PhotonOutput1D::PhotonOutput1D() : out(&std::cout) {
+const char PhotonOutput1DMagic[8] = {'C', 'R', 'P', 'P', 'H', 'O', 'T', '1'};
+
+PhotonOutput1D::PhotonOutput1D() : out(&std::cout), binary(false), lock("PhotonOutput1D") {
 	KISS_LOG_WARNING << "PhotonOutput1D is deprecated and will be removed in the future. Replace with TextOutput or HDF5Output with features ObserverNucleusVeto + ObserverDetectAll";
 }
 
-PhotonOutput1D::PhotonOutput1D(std::ostream &out) : out(&out) {
+PhotonOutput1D::PhotonOutput1D(std::ostream &out) : out(&out), binary(false), lock("PhotonOutput1D") {
 	KISS_LOG_WARNING << "PhotonOutput1D is deprecated and will be removed in the future. Replace with TextOutput or HDF5Output with features ObserverNucleusVeto + ObserverDetectAll";
 }
 
-PhotonOutput1D::PhotonOutput1D(const std::string &filename) : outfile(
-	filename.c_str(), std::ios::binary), out(&outfile), filename(filename) {
+PhotonOutput1D::PhotonOutput1D(const std::string &filename, bool binary) :
+		outfile(filename.c_str(), std::ios::binary), out(&outfile),
+		filename(filename), binary(binary), lock("PhotonOutput1D") {
 	KISS_LOG_WARNING << "PhotonOutput1D is deprecated and will be removed in the future. Replace with TextOutput or HDF5Output with features ObserverNucleusVeto + ObserverDetectAll";
 	if (kiss::ends_with(filename, ".gz"))
 		gzip();
 
+	if (binary) {
+		out->write(PhotonOutput1DMagic, sizeof(PhotonOutput1DMagic));
+		return;
+	}
+
 	*out << "#ID\tE\tD\tpID\tpE\tiID\tiE\tiD\n";
 	*out << "#\n";
 	*out << "# ID          Id of particle (photon, electron, positron)\n";
@@ -49,6 +57,25 @@ void PhotonOutput1D::process(Candidate *candidate) const {
 	if ((pid != 22) and (abs(pid) != 11))
 		return;
 
+	if (binary) {
+		PhotonRecord1D r;
+		r.id = pid;
+		r.parentId = candidate->created.getId();
+		r.sourceId = candidate->source.getId();
+		r.reserved = 0;
+		r.energy = candidate->current.getEnergy() / EeV;
+		r.distance = candidate->current.getPosition().getR() / Mpc;
+		r.parentEnergy = candidate->created.getEnergy() / EeV;
+		r.sourceEnergy = candidate->source.getEnergy() / EeV;
+		r.sourceDistance = candidate->source.getPosition().getR() / Mpc;
+		{
+			ScopedLock l(lock);
+			out->write((const char*) &r, sizeof(r));
+		}
+		candidate->setActive(false);
+		return;
+	}
+
 	char buffer[1024];
 	size_t p = 0;
 
@@ -63,8 +90,8 @@ void PhotonOutput1D::process(Candidate *candidate) const {
 	p += std::sprintf(buffer + p, "%8.4f\t", candidate->source.getEnergy() / EeV);
 	p += std::sprintf(buffer + p, "%8.4f\n", candidate->source.getPosition().getR() / Mpc);
 
-#pragma omp critical
 	{
+		ScopedLock l(lock);
 		out->write(buffer, p);
 	}
 
@@ -73,7 +100,7 @@ void PhotonOutput1D::process(Candidate *candidate) const {
 
 void PhotonOutput1D::close() {
 	#ifdef CRPROPA_HAVE_ZLIB
-		zstream::ogzstream *zs = dynamic_cast<zstream::ogzstream *>(out);
+		GzipStream *zs = dynamic_cast<GzipStream *>(out);
 		if (zs) {
 			zs->close();
 			delete out;
@@ -95,7 +122,7 @@ PhotonOutput1D::~PhotonOutput1D() {
 
 void PhotonOutput1D::gzip() {
 	#ifdef CRPROPA_HAVE_ZLIB
-		out = new zstream::ogzstream(*out);
+		out = new GzipStream(*out);
 	#else
 		throw std::runtime_error("CRPropa was build without Zlib compression!");
 	#endif
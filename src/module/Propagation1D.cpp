@@ -0,0 +1,166 @@
+#include "crpropa/module/Propagation1D.h"
+#include "crpropa/Cosmology.h"
+#include "crpropa/ParticleID.h"
+
+#include <cmath>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+namespace crpropa {
+
+// redshift change above which a step is converted exactly with the comoving distance, as in Redshift
+static const double LONG_STEP_DZ = 1e-3;
+
+Propagation1D::Propagation1D(double minStep, double maxStep) :
+		minStep(minStep), maxStep(maxStep), lossLimit(0.3), minEnergy(0),
+		redshift(true), interactions(new InteractionCollection()) {
+	if (minStep > maxStep)
+		throw std::runtime_error("Propagation1D: minStep > maxStep");
+}
+
+void Propagation1D::setMinimumStep(double step) {
+	if (step > maxStep)
+		throw std::runtime_error("Propagation1D: minStep > maxStep");
+	minStep = step;
+}
+
+void Propagation1D::setMaximumStep(double step) {
+	if (minStep > step)
+		throw std::runtime_error("Propagation1D: minStep > maxStep");
+	maxStep = step;
+}
+
+double Propagation1D::getMinimumStep() const {
+	return minStep;
+}
+
+double Propagation1D::getMaximumStep() const {
+	return maxStep;
+}
+
+void Propagation1D::setElectronPairProduction(ElectronPairProduction *epp) {
+	pairProduction = epp;
+}
+
+void Propagation1D::setLossLimit(double limit) {
+	if (!(limit > 0))
+		throw std::runtime_error("Propagation1D: the loss limit must be positive");
+	lossLimit = limit;
+}
+
+double Propagation1D::getLossLimit() const {
+	return lossLimit;
+}
+
+void Propagation1D::add(Interaction *interaction) {
+	interactions->add(interaction);
+}
+
+void Propagation1D::setInteractionLimit(double limit) {
+	interactions->setLimit(limit);
+}
+
+void Propagation1D::setRedshift(bool r) {
+	redshift = r;
+}
+
+void Propagation1D::setMinimumEnergy(double energy) {
+	minEnergy = energy;
+}
+
+double Propagation1D::getMinimumEnergy() const {
+	return minEnergy;
+}
+
+void Propagation1D::onDetection(Module *action) {
+	detectionAction = action;
+}
+
+void Propagation1D::step(Candidate *c) const {
+	ParticleState &current = c->current;
+	c->previous = current;
+
+	// rectilinear step, as SimplePropagation
+	double step = std::max(minStep, c->getNextStep());
+	c->setCurrentStep(step);
+	current.setPosition(current.getPosition() + current.getDirection() * step);
+	c->setNextStep(maxStep);
+
+	// redshift and adiabatic loss, as Redshift
+	double z = c->getRedshift();
+	double scale = 1;
+	if (redshift && (z > std::numeric_limits<double>::min())) {
+		double dz = hubbleRate(z) / c_light * step;
+		if (dz > LONG_STEP_DZ) {
+			double D = redshift2ComovingDistance(z) - step;
+			dz = (D > 0) ? z - comovingDistance2Redshift(D) : z;
+		}
+		dz = std::min(dz, z);
+		scale = 1 - dz / (1 + z);
+		z -= dz;
+		c->setRedshift(z);
+	}
+
+	if (pairProduction.valid() && current.isNucleus()) {
+		int id = current.getId();
+		// d ln(gamma) / ds = -1 / L(gamma) over the step in the local frame
+		double lf = current.getLorentzFactor() * scale;
+		double s = step / (1 + z);
+		double L = pairProduction->lossLength(id, lf, z);
+		if (L < std::numeric_limits<double>::max()) {
+			double Lmid = pairProduction->lossLength(id, lf * exp(-0.5 * s / L), z);
+			lf *= exp(-s / Lmid);
+			c->limitNextStep(lossLimit * Lmid);
+		}
+		current.setLorentzFactor(lf);
+	} else if (scale != 1)
+		current.setEnergy(current.getEnergy() * scale);
+
+	if (interactions->size() > 0) {
+		interactions->process(c);
+		if (!c->isActive())
+			return;
+	}
+
+	// minimum energy and observer at x = 0
+	if (current.getEnergy() <= minEnergy) {
+		c->setActive(false);
+		return;
+	}
+	double x = current.getPosition().x;
+	if (x > 0) {
+		c->limitNextStep(x);
+		return;
+	}
+	if (detectionAction.valid())
+		detectionAction->process(c);
+	c->setActive(false);
+}
+
+void Propagation1D::process(Candidate *candidate) const {
+	step(candidate);
+}
+
+void Propagation1D::processBatch(Candidate *const *candidates, size_t n) const {
+	for (size_t i = 0; i < n; i++)
+		step(candidates[i]);
+}
+
+std::string Propagation1D::getDescription() const {
+	std::stringstream s;
+	s << "Propagation1D: Step size = " << minStep / kpc << " - "
+			<< maxStep / kpc << " kpc";
+	if (!redshift)
+		s << ", no redshift";
+	if (pairProduction.valid())
+		s << "\n  " << pairProduction->getDescription() << ", loss limit " << lossLimit;
+	if (interactions->size() > 0)
+		s << "\n  " << interactions->getDescription();
+	s << "\n  minimum energy " << minEnergy / EeV << " EeV, observer at x = 0";
+	if (detectionAction.valid())
+		s << ", action: " << detectionAction->getDescription();
+	return s.str();
+}
+
+} // namespace crpropa
@@ -0,0 +1,137 @@
+#include "crpropa/module/PropagationBP.h"
+#include "crpropa/Statistics.h"
+
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+
+namespace crpropa {
+
+// step statistics, see Statistics
+static const size_t steps = Statistics::addCounter("PropagationBP: steps");
+static const size_t stepSizes = Statistics::addHistogram("PropagationBP: step size [m]", 0, 26, 52);
+
+PropagationBP::PropagationBP(ref_ptr<MagneticField> field, double tolerance,
+		double minStep, double maxStep) :
+		minStep(0) {
+	setField(field);
+	setTolerance(tolerance);
+	setMaximumStep(maxStep);
+	setMinimumStep(minStep);
+}
+
+double PropagationBP::push(Vector3d &x, Vector3d &u, double h,
+		const ParticleState &p, double z) const {
+	// drift half a step
+	x += u * (h / 2);
+
+	Vector3d B(0, 0, 0);
+	try {
+		B = field->getField(x, z);
+	} catch (std::exception &e) {
+		std::cerr << "PropagationBP: Exception in getField." << std::endl;
+		std::cerr << e.what() << std::endl;
+	}
+
+	// rotate: du/ds = q*c/E * (u x B), the rotation preserves |u|
+	Vector3d t = B * (p.getCharge() * c_light / p.getEnergy() * h / 2);
+	Vector3d s = t * (2 / (1 + t.dot(t)));
+	Vector3d v = u + u.cross(t);
+	u += v.cross(s);
+
+	// drift the second half
+	x += u * (h / 2);
+
+	return B.getR();
+}
+
+void PropagationBP::process(Candidate *candidate) const {
+	// save the new previous particle state
+	ParticleState &current = candidate->current;
+	candidate->previous = current;
+
+	double step = clip(candidate->getNextStep(), minStep, maxStep);
+
+	// rectilinear propagation for neutral particles
+	if (current.getCharge() == 0) {
+		Vector3d pos = current.getPosition();
+		Vector3d dir = current.getDirection();
+		current.setPosition(pos + dir * step);
+		candidate->setCurrentStep(step);
+		candidate->setNextStep(maxStep);
+		if (Statistics::isEnabled()) {
+			Statistics::count(steps);
+			Statistics::fill(stepSizes, step);
+		}
+		return;
+	}
+
+	Vector3d x = current.getPosition();
+	Vector3d u = current.getDirection();
+	double B = push(x, u, step, current, candidate->getRedshift());
+
+	current.setPosition(x);
+	current.setDirection(u.getUnitVector());
+	candidate->setCurrentStep(step);
+
+	// the phase error of the rotation by theta = step / r_g is theta^3 / 12
+	double newStep = maxStep;
+	if ((tolerance > 0) && (B > 0)) {
+		double rg = current.getEnergy() / (std::fabs(current.getCharge()) * c_light * B);
+		newStep = pow(12 * tolerance, 1. / 3.) * rg;
+		newStep = clip(newStep, 0.1 * step, 5 * step);  // limit the step size change
+	}
+	candidate->setNextStep(clip(newStep, minStep, maxStep));
+	if (Statistics::isEnabled()) {
+		Statistics::count(steps);
+		Statistics::fill(stepSizes, step);
+	}
+}
+
+void PropagationBP::setField(ref_ptr<MagneticField> f) {
+	field = f;
+}
+
+void PropagationBP::setTolerance(double tol) {
+	if ((tol > 1) or (tol < 0))
+		throw std::runtime_error(
+				"PropagationBP: target error not in range 0-1");
+	tolerance = tol;
+}
+
+void PropagationBP::setMinimumStep(double min) {
+	if (min < 0)
+		throw std::runtime_error("PropagationBP: minStep < 0 ");
+	if (min > maxStep)
+		throw std::runtime_error("PropagationBP: minStep > maxStep");
+	minStep = min;
+}
+
+void PropagationBP::setMaximumStep(double max) {
+	if (max < minStep)
+		throw std::runtime_error("PropagationBP: maxStep < minStep");
+	maxStep = max;
+}
+
+double PropagationBP::getTolerance() const {
+	return tolerance;
+}
+
+double PropagationBP::getMinimumStep() const {
+	return minStep;
+}
+
+double PropagationBP::getMaximumStep() const {
+	return maxStep;
+}
+
+std::string PropagationBP::getDescription() const {
+	std::stringstream s;
+	s << "Propagation in magnetic fields using the Boris push.";
+	s << " Target error: " << tolerance;
+	s << ", Minimum Step: " << minStep / kpc << " kpc";
+	s << ", Maximum Step: " << maxStep / kpc << " kpc";
+	return s.str();
+}
+
+} // namespace crpropa
@@ -1,5 +1,9 @@
 #include "crpropa/module/PropagationCK.h"
+#include "crpropa/Common.h"
+#include "crpropa/Statistics.h"
 
+#include <algorithm>
+#include <cmath>
 #include <limits>
 #include <sstream>
 #include <stdexcept>
@@ -7,6 +11,19 @@
 
 namespace crpropa {
 
+// step statistics, see Statistics
+static const size_t acceptedSteps = Statistics::addCounter("PropagationCK: accepted steps");
+static const size_t rejectedSteps = Statistics::addCounter("PropagationCK: rejected steps");
+static const size_t stepSizes = Statistics::addHistogram("PropagationCK: step size [m]", 0, 26, 52);
+
+static void countSteps(const double *steps, size_t n, size_t rejected) {
+	Statistics::count(acceptedSteps, n);
+	if (rejected > 0)
+		Statistics::count(rejectedSteps, rejected);
+	for (size_t i = 0; i < n; i++)
+		Statistics::fill(stepSizes, steps[i]);
+}
+
 // Cash-Karp coefficients
 const double cash_karp_a[] = {
 	0., 0., 0., 0., 0., 0.,
@@ -25,27 +42,58 @@ const double cash_karp_bs[] = {
 	2825. / 27648., 0., 18575. / 48384., 13525. / 55296., 277. / 14336., 1. / 4.
 };
 
+// stages with nonzero weight b and their nodes c, the column density is
+// step * sum b_i n(x_i)
+const size_t cash_karp_stages[] = {0, 2, 3, 5};
+const double cash_karp_c[] = {0., 3. / 10., 3. / 5., 7. / 8.};
+
 void PropagationCK::tryStep(const Y &y, Y &out, Y &error, double h,
 		ParticleState &particle, double z) const {
-	std::vector<Y> k;
-	k.reserve(6);
+	tryStep(y, dYdt(y, particle, z), out, error, h, particle, z);
+}
 
-	out = y;
-	error = Y(0);
+void PropagationCK::tryStep(const Y &y, const Y &k1, Y &out, Y &error,
+		double h, ParticleState &particle, double z, Vector3d *stages) const {
+	// the stages k_i and the sums of b_i * k_i on 4 padded lanes
+	PaddedVector3d kx[6], ku[6];
+	kx[0] = k1.x;
+	ku[0] = k1.u;
+
+	const PaddedVector3d x(y.x), u(y.u);
+	PaddedVector3d outX(x), outU(u), errorX, errorU;
+	outX.addScaled(kx[0], cash_karp_b[0] * h);
+	outU.addScaled(ku[0], cash_karp_b[0] * h);
+	errorX.addScaled(kx[0], (cash_karp_b[0] - cash_karp_bs[0]) * h);
+	errorU.addScaled(ku[0], (cash_karp_b[0] - cash_karp_bs[0]) * h);
+	if (stages)
+		stages[0] = y.x;
 
 	// calculate the sum of b_i * k_i
-	for (size_t i = 0; i < 6; i++) {
+	for (size_t i = 1; i < 6; i++) {
+
+		PaddedVector3d x_n(x), u_n(u);
+		for (size_t j = 0; j < i; j++) {
+			double a = cash_karp_a[i * 6 + j] * h;
+			x_n.addScaled(kx[j], a);
+			u_n.addScaled(ku[j], a);
+		}
+		Y y_n(x_n, u_n);
 
-		Y y_n = y;
-		for (size_t j = 0; j < i; j++)
-			y_n += k[j] * a[i * 6 + j] * h;
+		if (stages)
+			stages[i] = y_n.x;
 
 		// update k_i
-		k[i] = dYdt(y_n, particle, z);
+		Y k = dYdt(y_n, particle, z);
+		kx[i] = k.x;
+		ku[i] = k.u;
 
-		out += k[i] * b[i] * h;
-		error += k[i] * (b[i] - bs[i]) * h;
+		outX.addScaled(kx[i], cash_karp_b[i] * h);
+		outU.addScaled(ku[i], cash_karp_b[i] * h);
+		errorX.addScaled(kx[i], (cash_karp_b[i] - cash_karp_bs[i]) * h);
+		errorU.addScaled(ku[i], (cash_karp_b[i] - cash_karp_bs[i]) * h);
 	}
+	out = Y(outX, outU);
+	error = Y(errorX, errorU);
 }
 
 PropagationCK::Y PropagationCK::dYdt(const Y &y, ParticleState &p, double z) const {
@@ -63,18 +111,33 @@ PropagationCK::Y PropagationCK::dYdt(const Y &y, ParticleState &p, double z) con
 	return Y(velocity, dudt);
 }
 
+PropagationCK::Y PropagationCK::helix(const Y &y, const Vector3d &B, double s,
+		const ParticleState &p) const {
+	Vector3d u = y.u.getUnitVector();
+	double Bmag = B.getR();
+	if (Bmag == 0)
+		return Y(y.x + u * s, u);
+
+	// du/ds = k * (b x u): rotation of u around b with wave number k
+	Vector3d b = B / Bmag;
+	double k = -p.getCharge() * c_light * Bmag / p.getEnergy();
+	Vector3d uPar = b * u.dot(b);
+	Vector3d uPerp = u - uPar;
+	Vector3d w = b.cross(uPerp);
+	double phi = k * s;
+	double cosPhi = cos(phi), sinPhi = sin(phi);
+
+	Vector3d x = y.x + uPar * s + (uPerp * sinPhi + w * (1 - cosPhi)) / k;
+	return Y(x, uPar + uPerp * cosPhi + w * sinPhi);
+}
+
 PropagationCK::PropagationCK(ref_ptr<MagneticField> field, double tolerance,
 		double minStep, double maxStep) :
-		minStep(0) {
+		minStep(0), freeStreaming(0), freeStep(100 * Gpc) {
 	setField(field);
 	setTolerance(tolerance);
 	setMaximumStep(maxStep);
 	setMinimumStep(minStep);
-
-	// load Cash-Karp coefficients
-	a.assign(cash_karp_a, cash_karp_a + 36);
-	b.assign(cash_karp_b, cash_karp_b + 6);
-	bs.assign(cash_karp_bs, cash_karp_bs + 6);
 }
 
 void PropagationCK::process(Candidate *candidate) const {
@@ -86,11 +149,22 @@ void PropagationCK::process(Candidate *candidate) const {
 
 	// rectilinear propagation for neutral particles
 	if (current.getCharge() == 0) {
+		bool free = (freeStreaming != 0) && (current.getParticleClass() & freeStreaming);
+		if (free)
+			step = clip(candidate->getNextStep(), minStep, freeStep);
 		Vector3d pos = current.getPosition();
 		Vector3d dir = current.getDirection();
 		current.setPosition(pos + dir * step);
 		candidate->setCurrentStep(step);
-		candidate->setNextStep(maxStep);
+		candidate->setNextStep(free ? freeStep : maxStep);
+		if (Statistics::isEnabled())
+			countSteps(&step, 1, 0);
+		if (density.valid()) {
+			Vector3d stages[4];
+			for (size_t i = 0; i < 4; i++)
+				stages[i] = pos + dir * (cash_karp_c[i] * step);
+			addColumnDensity(&candidate, stages, 1);
+		}
 		return;
 	}
 
@@ -98,12 +172,39 @@ void PropagationCK::process(Candidate *candidate) const {
 	Y yOut, yErr;
 	double newStep = step;
 	double r = 42;  // arbitrary value > 1
+	size_t attempts = 0;
 	double z = candidate->getRedshift();
 
+	// analytic propagation in uniform fields
+	if (field->isUniform()) {
+		Vector3d B = field->getField(yIn.x, z);
+		yOut = helix(yIn, B, step, current);
+		current.setPosition(yOut.x);
+		current.setDirection(yOut.u.getUnitVector());
+		candidate->setCurrentStep(step);
+		candidate->setNextStep(maxStep);
+		if (Statistics::isEnabled())
+			countSteps(&step, 1, 0);
+		if (density.valid()) {
+			Vector3d stages[4];
+			for (size_t i = 0; i < 4; i++)
+				stages[i] = helix(yIn, B, cash_karp_c[i] * step, current).x;
+			addColumnDensity(&candidate, stages, 1);
+		}
+		return;
+	}
+
+	// the first stage only depends on yIn: evaluate it once for all attempts
+	Y k1 = dYdt(yIn, current, z);
+
+	Vector3d stages[6];
+	Vector3d *stagesOut = density.valid() ? stages : NULL;
+
 	// try performing step until the target error (tolerance) or the minimum step size has been reached
 	while (r > 1) {
 		step = newStep;
-		tryStep(yIn, yOut, yErr, step / c_light, current, z);
+		tryStep(yIn, k1, yOut, yErr, step / c_light, current, z, stagesOut);
+		attempts++;
 
 		r = yErr.u.getR() / tolerance;  // ratio of absolute direction error and tolerance
 		newStep = step * 0.95 * pow(r, -0.2);  // update step size to keep error close to tolerance
@@ -118,12 +219,228 @@ void PropagationCK::process(Candidate *candidate) const {
 	current.setDirection(yOut.u.getUnitVector());
 	candidate->setCurrentStep(step);
 	candidate->setNextStep(newStep);
+	if (Statistics::isEnabled())
+		countSteps(&step, 1, attempts - 1);
+
+	if (stagesOut) {
+		Vector3d positions[4];
+		for (size_t i = 0; i < 4; i++)
+			positions[i] = stages[cash_karp_stages[i]];
+		addColumnDensity(&candidate, positions, 1);
+	}
+}
+
+static bool compareRedshift(const Candidate *a, const Candidate *b) {
+	return a->getRedshift() < b->getRedshift();
+}
+
+void PropagationCK::processBatch(Candidate *const *candidates, size_t n) const {
+	if (field->isUniform()) {
+		Module::processBatch(candidates, n);
+		return;
+	}
+
+	// neutral particles are propagated one by one, the others grouped by redshift
+	std::vector<Candidate *> charged;
+	charged.reserve(n);
+	for (size_t i = 0; i < n; i++) {
+		if (candidates[i]->current.getCharge() == 0)
+			process(candidates[i]);
+		else
+			charged.push_back(candidates[i]);
+	}
+	std::stable_sort(charged.begin(), charged.end(), compareRedshift);
+
+	size_t begin = 0;
+	while (begin < charged.size()) {
+		double z = charged[begin]->getRedshift();
+		size_t end = begin + 1;
+		while ((end < charged.size()) && (charged[end]->getRedshift() == z))
+			end++;
+		propagateBatch(&charged[begin], end - begin, z);
+		begin = end;
+	}
+}
+
+// field at n positions, with the error handling of dYdt
+static void getFieldsSafe(const MagneticField *field, const Vector3d *positions,
+		Vector3d *fields, size_t n, double z) {
+	try {
+		field->getFields(positions, fields, n, z);
+	} catch (std::exception &e) {
+		std::cerr << "PropagationCK: Exception in getField." << std::endl;
+		std::cerr << e.what() << std::endl;
+		for (size_t i = 0; i < n; i++) {
+			try {
+				fields[i] = field->getField(positions[i], z);
+			} catch (std::exception &e) {
+				fields[i] = Vector3d(0, 0, 0);
+			}
+		}
+	}
+}
+
+CRPROPA_MULTIVERSION
+void PropagationCK::propagateBatch(Candidate *const *candidates, size_t n,
+		double z) const {
+	// structure of arrays, component d of lane i at [d * n + i]
+	// phase points y = (x, u) and the stages k[s] = dY/dt, 6 components each
+	std::vector<double> y0(6 * n), y(6 * n), k(6 * 6 * n);
+	std::vector<double> step(n), newStep(n), qcE(n);
+	std::vector<Vector3d> positions(n), fields(n);
+	std::vector<size_t> lanes(n), retry;
+	// positions of the stages with nonzero weight for the column density
+	std::vector<Vector3d> stages(density.valid() ? 4 * n : 0);
+	std::vector<Candidate *> accepted;
+	std::vector<Vector3d> acceptedStages;
+	std::vector<double> acceptedStepSizes;
+	size_t rejected = 0;
+
+	for (size_t i = 0; i < n; i++) {
+		ParticleState &current = candidates[i]->current;
+		candidates[i]->previous = current;
+		step[i] = clip(candidates[i]->getNextStep(), minStep, maxStep);
+		qcE[i] = current.getCharge() * c_light / current.getEnergy();
+		Vector3d x = current.getPosition(), u = current.getDirection();
+		y0[i] = x.x;
+		y0[n + i] = x.y;
+		y0[2 * n + i] = x.z;
+		y0[3 * n + i] = u.x;
+		y0[4 * n + i] = u.y;
+		y0[5 * n + i] = u.z;
+		lanes[i] = i;
+	}
+
+	// stage s of the given lanes from the phase points y and the fields
+	size_t m = n;
+	for (size_t s = 0; s < 6; s++) {
+		if (s == 0)
+			y = y0;
+		for (size_t j = 0; j < m; j++) {
+			size_t i = lanes[j];
+			if (s > 0) {
+				double h = step[i] / c_light;
+				for (size_t d = 0; d < 6; d++) {
+					double yd = y0[d * n + i];
+					for (size_t t = 0; t < s; t++)
+						yd += k[(t * 6 + d) * n + i] * cash_karp_a[s * 6 + t] * h;
+					y[d * n + i] = yd;
+				}
+			}
+			positions[j] = Vector3d(y[i], y[n + i], y[2 * n + i]);
+			if (!stages.empty())
+				for (size_t t = 0; t < 4; t++)
+					if (cash_karp_stages[t] == s)
+						stages[4 * i + t] = positions[j];
+		}
+		getFieldsSafe(field, &positions[0], &fields[0], m, z);
+		for (size_t j = 0; j < m; j++) {
+			size_t i = lanes[j];
+			// normalize direction vector to prevent numerical losses
+			Vector3d u(y[3 * n + i], y[4 * n + i], y[5 * n + i]);
+			Vector3d v = u.getUnitVector() * c_light;
+			Vector3d dudt = qcE[i] * v.cross(fields[j]);
+			k[(s * 6 + 0) * n + i] = v.x;
+			k[(s * 6 + 1) * n + i] = v.y;
+			k[(s * 6 + 2) * n + i] = v.z;
+			k[(s * 6 + 3) * n + i] = dudt.x;
+			k[(s * 6 + 4) * n + i] = dudt.y;
+			k[(s * 6 + 5) * n + i] = dudt.z;
+		}
+
+		if (s < 5)
+			continue;
+
+		// combine the stages, finish the accepted lanes and retry the others
+		// with a smaller step, reusing the first stage
+		retry.clear();
+		accepted.clear();
+		acceptedStages.clear();
+		for (size_t j = 0; j < m; j++) {
+			size_t i = lanes[j];
+			double h = step[i] / c_light;
+			double out[6], error[3];
+			for (size_t d = 0; d < 6; d++) {
+				out[d] = y0[d * n + i];
+				for (size_t t = 0; t < 6; t++)
+					out[d] += k[(t * 6 + d) * n + i] * cash_karp_b[t] * h;
+			}
+			for (size_t d = 0; d < 3; d++) {
+				error[d] = 0;
+				for (size_t t = 0; t < 6; t++)
+					error[d] += k[(t * 6 + d + 3) * n + i]
+							* (cash_karp_b[t] - cash_karp_bs[t]) * h;
+			}
+
+			double r = Vector3d(error[0], error[1], error[2]).getR() / tolerance;
+			newStep[i] = step[i] * 0.95 * pow(r, -0.2);
+			newStep[i] = clip(newStep[i], 0.1 * step[i], 5 * step[i]);
+			newStep[i] = clip(newStep[i], minStep, maxStep);
+
+			if ((r > 1) && (step[i] != minStep)) {
+				step[i] = newStep[i];
+				retry.push_back(i);
+				rejected++;
+				continue;
+			}
+
+			Candidate *candidate = candidates[i];
+			candidate->current.setPosition(Vector3d(out[0], out[1], out[2]));
+			candidate->current.setDirection(Vector3d(out[3], out[4], out[5]).getUnitVector());
+			candidate->setCurrentStep(step[i]);
+			candidate->setNextStep(newStep[i]);
+			if (Statistics::isEnabled())
+				acceptedStepSizes.push_back(step[i]);
+			if (!stages.empty()) {
+				accepted.push_back(candidate);
+				acceptedStages.insert(acceptedStages.end(), &stages[4 * i],
+						&stages[4 * i] + 4);
+			}
+		}
+		if (!accepted.empty())
+			addColumnDensity(&accepted[0], &acceptedStages[0], accepted.size());
+
+		lanes.swap(retry);
+		m = lanes.size();
+		if (m > 0)
+			s = 0;  // continue with the second stage
+	}
+
+	if (Statistics::isEnabled())
+		countSteps(acceptedStepSizes.empty() ? NULL : &acceptedStepSizes[0],
+				acceptedStepSizes.size(), rejected);
+}
+
+void PropagationCK::addColumnDensity(Candidate *const *candidates,
+		const Vector3d *positions, size_t n) const {
+	std::vector<double> densities(4 * n);
+	density->getDensities(positions, &densities[0], 4 * n);
+	for (size_t i = 0; i < n; i++) {
+		double sum = 0;
+		for (size_t t = 0; t < 4; t++)
+			sum += cash_karp_b[cash_karp_stages[t]] * densities[4 * i + t];
+		Candidate *candidate = candidates[i];
+		candidate->setColumnDensity(candidate->getColumnDensity()
+				+ sum * candidate->getCurrentStep());
+	}
 }
 
 void PropagationCK::setField(ref_ptr<MagneticField> f) {
 	field = f;
 }
 
+ref_ptr<MagneticField> PropagationCK::getField() const {
+	return field;
+}
+
+void PropagationCK::setDensity(ref_ptr<Density> d) {
+	density = d;
+}
+
+ref_ptr<Density> PropagationCK::getDensity() const {
+	return density;
+}
+
 void PropagationCK::setTolerance(double tol) {
 	if ((tol > 1) or (tol < 0))
 		throw std::runtime_error(
@@ -157,13 +474,45 @@ double PropagationCK::getMaximumStep() const {
 	return maxStep;
 }
 
+void PropagationCK::setFreeStreaming(int particleClasses, double step) {
+	if (step < maxStep)
+		throw std::runtime_error("PropagationCK: free streaming step < maxStep");
+	freeStreaming = particleClasses;
+	freeStep = step;
+}
+
+int PropagationCK::getFreeStreaming() const {
+	return freeStreaming;
+}
+
+double PropagationCK::getFreeStreamingStep() const {
+	return freeStep;
+}
+
 std::string PropagationCK::getDescription() const {
 	std::stringstream s;
 	s << "Propagation in magnetic fields using the Cash-Karp method.";
 	s << " Target error: " << tolerance;
 	s << ", Minimum Step: " << minStep / kpc << " kpc";
 	s << ", Maximum Step: " << maxStep / kpc << " kpc";
+	if (freeStreaming != 0)
+		s << ", free streaming classes " << freeStreaming << " up to "
+				<< freeStep / Mpc << " Mpc";
 	return s.str();
 }
 
+void PropagationCK::getConfiguration(Configuration &c) const {
+	if (density.valid())
+		throw std::runtime_error("PropagationCK: no configuration with a density");
+	c.setType("PropagationCK");
+	c.set("field", field.get());
+	c.set("tolerance", tolerance);
+	c.set("minStep", minStep);
+	c.set("maxStep", maxStep);
+	if (freeStreaming != 0) {
+		c.set("freeStreaming", double(freeStreaming));
+		c.set("freeStreamingStep", freeStep);
+	}
+}
+
 } // namespace crpropa
@@ -0,0 +1,323 @@
+#include "crpropa/module/PropagationCKOffload.h"
+
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+
+// device offloading needs OpenMP 4.5 (target enter/exit data)
+#if defined(_OPENMP) && (_OPENMP >= 201511)
+#define CRPROPA_OMP_OFFLOAD
+#endif
+
+namespace crpropa {
+
+#ifdef CRPROPA_OMP_OFFLOAD
+#pragma omp declare target
+#endif
+
+// Cash-Karp coefficients, see PropagationCK
+static const double offload_a[36] = {
+	0., 0., 0., 0., 0., 0.,
+	1. / 5., 0., 0., 0., 0., 0.,
+	3. / 40., 9. / 40., 0., 0., 0., 0.,
+	3. / 10., -9. / 10., 6. / 5., 0., 0., 0.,
+	-11. / 54., 5. / 2., -70. / 27., 35. / 27., 0., 0.,
+	1631. / 55296., 175. / 512., 575. / 13824., 44275. / 110592., 253. / 4096., 0.
+};
+
+static const double offload_b[6] = {
+	37. / 378., 0, 250. / 621., 125. / 594., 0., 512. / 1771.
+};
+
+static const double offload_bs[6] = {
+	2825. / 27648., 0., 18575. / 48384., 13525. / 55296., 277. / 14336., 1. / 4.
+};
+
+// plain description of the grid for the device
+struct OffloadGrid {
+	const float *data;
+	int N[3];
+	bool reflective;
+	double origin[3]; // position of the first grid point
+	double spacing[3];
+};
+
+// lower and upper neighbor, as periodicClamp and reflectiveClamp
+static void offloadClamp(double x, int n, bool reflective, int &lo, int &hi) {
+	if (reflective) {
+		double y = x - 2 * n * floor(x / (2 * n));
+		y = (y < 2 * n - y) ? y : 2 * n - y;
+		lo = int(floor(y));
+		lo = (lo < n - 1) ? lo : n - 1;
+		hi = lo + (lo < n - 1);
+	} else {
+		lo = int(floor(x)) % n;
+		if (lo < 0)
+			lo += n;
+		hi = lo + 1;
+		if (hi == n)
+			hi = 0;
+	}
+}
+
+// trilinear interpolation of the grid, as Grid::interpolate
+static void offloadField(const OffloadGrid &g, const double *x, double *B) {
+	int lo[3], hi[3];
+	double f[3];
+	for (int d = 0; d < 3; d++) {
+		double r = (x[d] - g.origin[d]) / g.spacing[d];
+		offloadClamp(r, g.N[d], g.reflective, lo[d], hi[d]);
+		f[d] = r - floor(r);
+	}
+	B[0] = B[1] = B[2] = 0;
+	for (int i = 0; i < 8; i++) {
+		int ix = (i & 4) ? hi[0] : lo[0];
+		int iy = (i & 2) ? hi[1] : lo[1];
+		int iz = (i & 1) ? hi[2] : lo[2];
+		double w = ((i & 4) ? f[0] : 1 - f[0]) * ((i & 2) ? f[1] : 1 - f[1])
+				* ((i & 1) ? f[2] : 1 - f[2]);
+		const float *v = &g.data[3 * ((size_t(ix) * g.N[1] + iy) * g.N[2] + iz)];
+		B[0] += w * v[0];
+		B[1] += w * v[1];
+		B[2] += w * v[2];
+	}
+}
+
+// dY/dt = (v, q*c/E * (v x B)), as PropagationCK::dYdt
+static void offloadDerivative(const OffloadGrid &g, double c, double qcE,
+		const double *y, double *k) {
+	double B[3];
+	offloadField(g, y, B);
+	double f = c / sqrt(y[3] * y[3] + y[4] * y[4] + y[5] * y[5]);
+	k[0] = y[3] * f;
+	k[1] = y[4] * f;
+	k[2] = y[5] * f;
+	k[3] = qcE * (k[1] * B[2] - k[2] * B[1]);
+	k[4] = qcE * (k[2] * B[0] - k[0] * B[2]);
+	k[5] = qcE * (k[0] * B[1] - k[1] * B[0]);
+}
+
+static double offloadClip(double x, double lower, double upper) {
+	return (x < lower) ? lower : ((x > upper) ? upper : x);
+}
+
+// one step with step size control, as PropagationCK::process
+static void offloadStep(const OffloadGrid &g, double c, double tolerance,
+		double minStep, double maxStep, double qcE, double *y, double &step,
+		double &nextStep) {
+	double y0[6], yn[6], k[6][6], error[3];
+	for (int d = 0; d < 6; d++)
+		y0[d] = y[d];
+	offloadDerivative(g, c, qcE, y0, k[0]);
+
+	double newStep = step;
+	double r = 42;  // arbitrary value > 1
+	while (r > 1) {
+		step = newStep;
+		double h = step / c;
+		for (int s = 1; s < 6; s++) {
+			for (int d = 0; d < 6; d++) {
+				yn[d] = y0[d];
+				for (int t = 0; t < s; t++)
+					yn[d] += k[t][d] * offload_a[s * 6 + t] * h;
+			}
+			offloadDerivative(g, c, qcE, yn, k[s]);
+		}
+		for (int d = 0; d < 6; d++) {
+			y[d] = y0[d];
+			for (int s = 0; s < 6; s++)
+				y[d] += k[s][d] * offload_b[s] * h;
+		}
+		for (int d = 0; d < 3; d++) {
+			error[d] = 0;
+			for (int s = 0; s < 6; s++)
+				error[d] += k[s][d + 3] * (offload_b[s] - offload_bs[s]) * h;
+		}
+
+		r = sqrt(error[0] * error[0] + error[1] * error[1] + error[2] * error[2])
+				/ tolerance;
+		newStep = step * 0.95 * pow(r, -0.2);
+		newStep = offloadClip(newStep, 0.1 * step, 5 * step);
+		newStep = offloadClip(newStep, minStep, maxStep);
+
+		if (step == minStep)
+			break;  // performed step already at the minimum
+	}
+	nextStep = newStep;
+}
+
+#ifdef CRPROPA_OMP_OFFLOAD
+#pragma omp end declare target
+#endif
+
+PropagationCKOffload::PropagationCKOffload(ref_ptr<VectorGrid> grid,
+		double tolerance, double minStep, double maxStep) :
+		grid(grid), minStep(0) {
+	if (!grid.valid())
+		throw std::runtime_error("PropagationCKOffload: no grid given");
+	setTolerance(tolerance);
+	setMaximumStep(maxStep);
+	setMinimumStep(minStep);
+	update();
+}
+
+PropagationCKOffload::~PropagationCKOffload() {
+	release();
+}
+
+void PropagationCKOffload::release() {
+	if (data.empty())
+		return;
+#ifdef CRPROPA_OMP_OFFLOAD
+	float *p = &data[0];
+	size_t size = data.size();
+#pragma omp target exit data map(delete: p[0:size])
+#endif
+	data.clear();
+}
+
+void PropagationCKOffload::update() {
+	release();
+
+	// plain copy, independent of the layout and storage of the grid
+	size_t Nx = grid->getNx(), Ny = grid->getNy(), Nz = grid->getNz();
+	data.resize(3 * Nx * Ny * Nz);
+	size_t i = 0;
+	for (size_t ix = 0; ix < Nx; ix++)
+		for (size_t iy = 0; iy < Ny; iy++)
+			for (size_t iz = 0; iz < Nz; iz++) {
+				const Vector3f &b = grid->get(ix, iy, iz);
+				data[i++] = b.x;
+				data[i++] = b.y;
+				data[i++] = b.z;
+			}
+
+#ifdef CRPROPA_OMP_OFFLOAD
+	float *p = &data[0];
+	size_t size = data.size();
+#pragma omp target enter data map(to: p[0:size])
+#endif
+}
+
+void PropagationCKOffload::process(Candidate *candidate) const {
+	processBatch(&candidate, 1);
+}
+
+void PropagationCKOffload::processBatch(Candidate *const *candidates,
+		size_t n) const {
+	// phase points, step sizes and charge-to-energy ratios of the charged
+	// candidates, neutral particles are moved here
+	std::vector<Candidate *> lanes;
+	std::vector<double> y, step, nextStep, qcE;
+	lanes.reserve(n);
+	for (size_t i = 0; i < n; i++) {
+		Candidate *candidate = candidates[i];
+		ParticleState &current = candidate->current;
+		candidate->previous = current;
+		double s = clip(candidate->getNextStep(), minStep, maxStep);
+
+		if (current.getCharge() == 0) {
+			current.setPosition(current.getPosition() + current.getDirection() * s);
+			candidate->setCurrentStep(s);
+			candidate->setNextStep(maxStep);
+			continue;
+		}
+
+		Vector3d x = current.getPosition(), u = current.getDirection();
+		y.push_back(x.x);
+		y.push_back(x.y);
+		y.push_back(x.z);
+		y.push_back(u.x);
+		y.push_back(u.y);
+		y.push_back(u.z);
+		step.push_back(s);
+		qcE.push_back(current.getCharge() * c_light / current.getEnergy());
+		lanes.push_back(candidate);
+	}
+	if (lanes.empty())
+		return;
+	nextStep.resize(lanes.size());
+
+	OffloadGrid g;
+	g.data = 0;
+	g.N[0] = grid->getNx();
+	g.N[1] = grid->getNy();
+	g.N[2] = grid->getNz();
+	g.reflective = grid->isReflective();
+	Vector3d spacing = grid->getSpacing();
+	Vector3d origin = grid->getOrigin() + spacing / 2;
+	g.origin[0] = origin.x;
+	g.origin[1] = origin.y;
+	g.origin[2] = origin.z;
+	g.spacing[0] = spacing.x;
+	g.spacing[1] = spacing.y;
+	g.spacing[2] = spacing.z;
+
+	// the grid is already present on the device and not transferred again
+	const float *pData = &data[0];
+	size_t size = data.size();
+	double *pY = &y[0], *pStep = &step[0], *pNext = &nextStep[0];
+	const double *pQ = &qcE[0];
+	int m = lanes.size();
+	double c = c_light, tol = tolerance, lo = minStep, hi = maxStep;
+#ifdef CRPROPA_OMP_OFFLOAD
+#pragma omp target teams distribute parallel for map(to: pData[0:size], pQ[0:m]) map(tofrom: pY[0:6*m], pStep[0:m]) map(from: pNext[0:m])
+#endif
+	for (int i = 0; i < m; i++) {
+		OffloadGrid gi = g;
+		gi.data = pData;
+		offloadStep(gi, c, tol, lo, hi, pQ[i], &pY[6 * i], pStep[i], pNext[i]);
+	}
+
+	for (size_t i = 0; i < lanes.size(); i++) {
+		ParticleState &current = lanes[i]->current;
+		current.setPosition(Vector3d(y[6 * i], y[6 * i + 1], y[6 * i + 2]));
+		current.setDirection(Vector3d(y[6 * i + 3], y[6 * i + 4], y[6 * i + 5]).getUnitVector());
+		lanes[i]->setCurrentStep(step[i]);
+		lanes[i]->setNextStep(nextStep[i]);
+	}
+}
+
+void PropagationCKOffload::setTolerance(double tol) {
+	if ((tol > 1) or (tol < 0))
+		throw std::runtime_error(
+				"PropagationCKOffload: target error not in range 0-1");
+	tolerance = tol;
+}
+
+void PropagationCKOffload::setMinimumStep(double min) {
+	if (min < 0)
+		throw std::runtime_error("PropagationCKOffload: minStep < 0 ");
+	if (min > maxStep)
+		throw std::runtime_error("PropagationCKOffload: minStep > maxStep");
+	minStep = min;
+}
+
+void PropagationCKOffload::setMaximumStep(double max) {
+	if (max < minStep)
+		throw std::runtime_error("PropagationCKOffload: maxStep < minStep");
+	maxStep = max;
+}
+
+double PropagationCKOffload::getTolerance() const {
+	return tolerance;
+}
+
+double PropagationCKOffload::getMinimumStep() const {
+	return minStep;
+}
+
+double PropagationCKOffload::getMaximumStep() const {
+	return maxStep;
+}
+
+std::string PropagationCKOffload::getDescription() const {
+	std::stringstream s;
+	s << "Propagation in a magnetic field grid using the Cash-Karp method on an offload device.";
+	s << " Target error: " << tolerance;
+	s << ", Minimum Step: " << minStep / kpc << " kpc";
+	s << ", Maximum Step: " << maxStep / kpc << " kpc";
+	return s.str();
+}
+
+} // namespace crpropa
@@ -6,6 +6,9 @@
 
 namespace crpropa {
 
+// redshift change above which a step is converted exactly with the comoving distance
+static const double LONG_STEP_DZ = 1e-3;
+
 void Redshift::process(Candidate *c) const {
 	double z = c->getRedshift();
 
@@ -16,6 +19,12 @@ void Redshift::process(Candidate *c) const {
 	// use small step approximation:  dz = H(z) / c * ds
 	double dz = hubbleRate(z) / c_light * c->getCurrentStep();
 
+	// long steps, e.g. of free streaming particles: exact with the comoving distance
+	if (dz > LONG_STEP_DZ) {
+		double D = redshift2ComovingDistance(z) - c->getCurrentStep();
+		dz = (D > 0) ? z - comovingDistance2Redshift(D) : z;
+	}
+
 	// prevent dz > z
 	dz = std::min(dz, z);
 
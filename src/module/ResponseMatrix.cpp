@@ -0,0 +1,267 @@
+#include "crpropa/module/ResponseMatrix.h"
+#include "crpropa/Cosmology.h"
+#include "crpropa/ParticleID.h"
+#include "crpropa/Random.h"
+#include "crpropa/Units.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <stdint.h>
+
+namespace crpropa {
+
+static const char responseMagic[8] = {'C', 'R', 'P', 'R', 'E', 'S', 'P', '1'};
+// steps of the integration of the spectrum over an energy bin
+static const int ENERGY_STEPS = 8;
+
+ResponseMatrix::ResponseMatrix() :
+		lgEmin(0), lgEmax(1), nEnergy(1), Dmin(0), Dmax(1), nDistance(1), maxA(1) {
+}
+
+ResponseMatrix::ResponseMatrix(const std::vector<int> &species, double Emin,
+		double Emax, size_t nEnergy, double Dmin, double Dmax, size_t nDistance) :
+		species(species), lgEmin(log10(Emin)), lgEmax(log10(Emax)),
+		nEnergy(nEnergy), Dmin(Dmin), Dmax(Dmax), nDistance(nDistance), maxA(1) {
+	if (species.empty() || (nEnergy == 0) || (nDistance == 0))
+		throw std::runtime_error("ResponseMatrix: no bins");
+	if (!(Emin > 0) || !(Emax > Emin) || !(Dmin >= 0) || !(Dmax > Dmin))
+		throw std::runtime_error("ResponseMatrix: invalid energy or distance range");
+	for (size_t i = 0; i < species.size(); i++) {
+		if (!isNucleus(species[i]))
+			throw std::runtime_error("ResponseMatrix: the species must be nuclei");
+		maxA = std::max(maxA, massNumber(species[i]));
+	}
+	clear();
+}
+
+size_t ResponseMatrix::observedSize() const {
+	return maxA * nEnergy;
+}
+
+void ResponseMatrix::clear() {
+	injected.assign(getNumberOfInjectedBins(), 0);
+	yields.assign(getNumberOfInjectedBins() * observedSize(), 0);
+}
+
+size_t ResponseMatrix::getNumberOfInjectedBins() const {
+	return species.size() * nEnergy * nDistance;
+}
+
+size_t ResponseMatrix::getNumberOfObservedBins() const {
+	return observedSize();
+}
+
+size_t ResponseMatrix::getInjectedBin(size_t s, size_t energy, size_t distance) const {
+	return (s * nEnergy + energy) * nDistance + distance;
+}
+
+size_t ResponseMatrix::getObservedBin(int A, size_t energy) const {
+	return (A - 1) * nEnergy + energy;
+}
+
+const std::vector<int> &ResponseMatrix::getSpecies() const {
+	return species;
+}
+
+int ResponseMatrix::getMaximumMassNumber() const {
+	return maxA;
+}
+
+double ResponseMatrix::getEnergyBinEdge(size_t i) const {
+	return pow(10, lgEmin + i * (lgEmax - lgEmin) / nEnergy);
+}
+
+double ResponseMatrix::getDistanceBinEdge(size_t i) const {
+	return Dmin + i * (Dmax - Dmin) / nDistance;
+}
+
+size_t ResponseMatrix::getNumberOfEnergyBins() const {
+	return nEnergy;
+}
+
+size_t ResponseMatrix::getNumberOfDistanceBins() const {
+	return nDistance;
+}
+
+double ResponseMatrix::getYield(size_t injectedBin, size_t observedBin) const {
+	if ((injectedBin >= injected.size()) || (observedBin >= observedSize()))
+		throw std::runtime_error("ResponseMatrix: bin out of range");
+	if (injected[injectedBin] == 0)
+		return 0;
+	return yields[injectedBin * observedSize() + observedBin] / injected[injectedBin];
+}
+
+// the bin of the source state, -1 if outside
+long ResponseMatrix::injectedBin(const Candidate *candidate) const {
+	const ParticleState &source = candidate->source.get();
+	size_t s = std::find(species.begin(), species.end(), source.getId()) - species.begin();
+	if (s == species.size())
+		return -1;
+	double e = (log10(source.getEnergy()) - lgEmin) / (lgEmax - lgEmin) * nEnergy;
+	double d = (source.getPosition().x - Dmin) / (Dmax - Dmin) * nDistance;
+	// the edges belong to the last bin
+	if ((e < 0) || (e > nEnergy) || (d < 0) || (d > nDistance))
+		return -1;
+	return getInjectedBin(s, std::min(size_t(e), nEnergy - 1), std::min(size_t(d), nDistance - 1));
+}
+
+void ResponseMatrix::process(Candidate *candidate) const {
+	int id = candidate->current.getId();
+	if (!isNucleus(id) || (massNumber(id) > maxA))
+		return;
+	long bin = injectedBin(candidate);
+	if (bin < 0)
+		return;
+	double e = (log10(candidate->current.getEnergy()) - lgEmin) / (lgEmax - lgEmin) * nEnergy;
+	if ((e < 0) || (e >= nEnergy))
+		return;
+	double &yield = const_cast<double &>(yields[bin * observedSize()
+			+ getObservedBin(massNumber(id), size_t(e))]);
+	double weight = candidate->getWeight();
+	#pragma omp atomic
+	yield += weight;
+}
+
+void ResponseMatrix::simulate(ModuleList *modules, size_t count) {
+	long n = getNumberOfInjectedBins();
+	#pragma omp parallel for schedule(dynamic, 1)
+	for (long b = 0; b < n; b++) {
+		size_t s = b / (nEnergy * nDistance);
+		size_t e = (b / nDistance) % nEnergy;
+		size_t d = b % nDistance;
+		Random &random = Random::instance();
+		for (size_t i = 0; i < count; i++) {
+			double E = pow(10, lgEmin + (e + random.rand()) * (lgEmax - lgEmin) / nEnergy);
+			double D = Dmin + (d + random.rand()) * (Dmax - Dmin) / nDistance;
+			ref_ptr<Candidate> c = new Candidate(species[s], E, Vector3d(D, 0, 0),
+					Vector3d(-1, 0, 0), comovingDistance2Redshift(D));
+			modules->run(c.get());
+		}
+		injected[b] += count; // one thread per bin
+	}
+}
+
+std::vector<double> ResponseMatrix::fold(const std::vector<double> &sources) const {
+	if (sources.size() != injected.size())
+		throw std::runtime_error("ResponseMatrix: one source number per injected bin expected");
+	size_t m = observedSize();
+	std::vector<double> observed(m, 0);
+	for (size_t b = 0; b < sources.size(); b++) {
+		if ((sources[b] == 0) || (injected[b] == 0))
+			continue;
+		double f = sources[b] / injected[b];
+		const double *row = &yields[b * m];
+		for (size_t j = 0; j < m; j++)
+			observed[j] += f * row[j];
+	}
+	return observed;
+}
+
+std::vector<double> ResponseMatrix::getSourceNumbers(
+		const std::vector<double> &abundances, double index, double Rcut,
+		double m) const {
+	if (abundances.size() != species.size())
+		throw std::runtime_error("ResponseMatrix: one abundance per species expected");
+
+	// (1 + z)^m integrated over the redshifts of the distance bins
+	std::vector<double> distance(nDistance);
+	for (size_t d = 0; d < nDistance; d++) {
+		double z0 = comovingDistance2Redshift(getDistanceBinEdge(d));
+		double z1 = comovingDistance2Redshift(getDistanceBinEdge(d + 1));
+		if (fabs(m + 1) < 1e-12)
+			distance[d] = log1p(z1) - log1p(z0);
+		else
+			distance[d] = (pow(1 + z1, m + 1) - pow(1 + z0, m + 1)) / (m + 1);
+	}
+
+	std::vector<double> sources(injected.size(), 0);
+	double dlgE = (lgEmax - lgEmin) / nEnergy;
+	double dlnE = dlgE * log(10.) / ENERGY_STEPS;
+	for (size_t s = 0; s < species.size(); s++) {
+		double Ecut = Rcut * chargeNumber(species[s]);
+		for (size_t e = 0; e < nEnergy; e++) {
+			// dN = E^(1 - index) exp(-E / Ecut) dlnE, midpoints in log energy
+			double energy = 0;
+			for (int k = 0; k < ENERGY_STEPS; k++) {
+				double E = pow(10, lgEmin + (e + (k + 0.5) / ENERGY_STEPS) * dlgE);
+				double n = pow(E, 1 - index) * dlnE;
+				if (Ecut > 0)
+					n *= exp(-E / Ecut);
+				energy += n;
+			}
+			for (size_t d = 0; d < nDistance; d++)
+				sources[getInjectedBin(s, e, d)] = abundances[s] * energy * distance[d];
+		}
+	}
+	return sources;
+}
+
+std::vector<double> ResponseMatrix::foldSpectrum(
+		const std::vector<double> &abundances, double index, double Rcut,
+		double m) const {
+	return fold(getSourceNumbers(abundances, index, Rcut, m));
+}
+
+void ResponseMatrix::save(const std::string &filename) const {
+	std::string tmp = filename + ".tmp";
+	std::ofstream out(tmp.c_str(), std::ios::binary);
+	if (!out)
+		throw std::runtime_error("ResponseMatrix: cannot create " + tmp);
+	out.write(responseMagic, 8);
+	uint64_t sizes[3] = {species.size(), nEnergy, nDistance};
+	out.write((const char *) sizes, sizeof(sizes));
+	out.write((const char *) &species[0], species.size() * sizeof(int));
+	double ranges[4] = {lgEmin, lgEmax, Dmin, Dmax};
+	out.write((const char *) ranges, sizeof(ranges));
+	out.write((const char *) &injected[0], injected.size() * sizeof(double));
+	out.write((const char *) &yields[0], yields.size() * sizeof(double));
+	out.close();
+	if (!out || (rename(tmp.c_str(), filename.c_str()) != 0))
+		throw std::runtime_error("ResponseMatrix: cannot write " + filename);
+}
+
+ref_ptr<ResponseMatrix> ResponseMatrix::load(const std::string &filename) {
+	std::ifstream in(filename.c_str(), std::ios::binary);
+	char magic[8];
+	uint64_t sizes[3];
+	if (!in.read(magic, 8) || (memcmp(magic, responseMagic, 8) != 0)
+			|| !in.read((char *) sizes, sizeof(sizes)) || (sizes[0] == 0)
+			|| (sizes[1] == 0) || (sizes[2] == 0))
+		throw std::runtime_error("ResponseMatrix: " + filename + " is no response matrix");
+
+	ref_ptr<ResponseMatrix> matrix = new ResponseMatrix();
+	matrix->species.resize(sizes[0]);
+	matrix->nEnergy = sizes[1];
+	matrix->nDistance = sizes[2];
+	double ranges[4];
+	in.read((char *) &matrix->species[0], sizes[0] * sizeof(int));
+	in.read((char *) ranges, sizeof(ranges));
+	matrix->lgEmin = ranges[0];
+	matrix->lgEmax = ranges[1];
+	matrix->Dmin = ranges[2];
+	matrix->Dmax = ranges[3];
+	for (size_t i = 0; i < matrix->species.size(); i++)
+		matrix->maxA = std::max(matrix->maxA, massNumber(matrix->species[i]));
+	matrix->clear();
+	in.read((char *) &matrix->injected[0], matrix->injected.size() * sizeof(double));
+	in.read((char *) &matrix->yields[0], matrix->yields.size() * sizeof(double));
+	if (!in)
+		throw std::runtime_error("ResponseMatrix: " + filename + " is truncated");
+	return matrix;
+}
+
+std::string ResponseMatrix::getDescription() const {
+	std::stringstream s;
+	s << "ResponseMatrix: " << species.size() << " species, " << nEnergy
+			<< " energy bins " << getEnergyBinEdge(0) / EeV << " - "
+			<< getEnergyBinEdge(nEnergy) / EeV << " EeV, " << nDistance
+			<< " distance bins " << Dmin / Mpc << " - " << Dmax / Mpc << " Mpc";
+	return s.str();
+}
+
+} // namespace crpropa
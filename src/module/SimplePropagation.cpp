@@ -6,7 +6,7 @@
 namespace crpropa {
 
 SimplePropagation::SimplePropagation(double minStep, double maxStep) :
-		minStep(minStep), maxStep(maxStep) {
+		minStep(minStep), maxStep(maxStep), freeStreaming(0), freeStep(100 * Gpc) {
 	if (minStep > maxStep)
 		throw std::runtime_error("SimplePropagation: minStep > maxStep");
 }
@@ -21,7 +21,25 @@ void SimplePropagation::process(Candidate *c) const {
 	Vector3d dir = c->current.getDirection();
 	c->current.setPosition(pos + dir * step);
 
-	c->setNextStep(maxStep);
+	if ((freeStreaming != 0) && (c->current.getParticleClass() & freeStreaming))
+		c->setNextStep(freeStep);
+	else
+		c->setNextStep(maxStep);
+}
+
+void SimplePropagation::setFreeStreaming(int particleClasses, double step) {
+	if (step < maxStep)
+		throw std::runtime_error("SimplePropagation: free streaming step < maxStep");
+	freeStreaming = particleClasses;
+	freeStep = step;
+}
+
+int SimplePropagation::getFreeStreaming() const {
+	return freeStreaming;
+}
+
+double SimplePropagation::getFreeStreamingStep() const {
+	return freeStep;
 }
 
 void SimplePropagation::setMinimumStep(double step) {
@@ -48,7 +66,20 @@ std::string SimplePropagation::getDescription() const {
 	std::stringstream s;
 	s << "SimplePropagation: Step size = " << minStep / kpc
 			<< " - " << maxStep / kpc << " kpc";
+	if (freeStreaming != 0)
+		s << ", free streaming classes " << freeStreaming << " up to "
+				<< freeStep / Mpc << " Mpc";
 	return s.str();
 }
 
+void SimplePropagation::getConfiguration(Configuration &c) const {
+	c.setType("SimplePropagation");
+	c.set("minStep", minStep);
+	c.set("maxStep", maxStep);
+	if (freeStreaming != 0) {
+		c.set("freeStreaming", double(freeStreaming));
+		c.set("freeStreamingStep", freeStep);
+	}
+}
+
 } // namespace crpropa
@@ -1,7 +1,9 @@
 #include "crpropa/module/SynchrotronRadiation.h"
+#include "crpropa/DataTable.h"
 #include "crpropa/Units.h"
 #include "crpropa/Random.h"
 
+#include <algorithm>
 #include <fstream>
 #include <limits>
 #include <stdexcept>
@@ -15,6 +17,7 @@ SynchrotronRadiation::SynchrotronRadiation(ref_ptr<MagneticField> field, bool ha
 	this->havePhotons = havePhotons;
 	this->limit = limit;
 	secondaryThreshold = 1e7 * eV;
+	maxPhotons = 0;
 }
 
 SynchrotronRadiation::SynchrotronRadiation(double Brms, bool havePhotons, double limit) {
@@ -23,6 +26,7 @@ SynchrotronRadiation::SynchrotronRadiation(double Brms, bool havePhotons, double
 	this->havePhotons = havePhotons;
 	this->limit = limit;
 	secondaryThreshold = 1e7 * eV;
+	maxPhotons = 0;
 }
 
 void SynchrotronRadiation::setField(ref_ptr<MagneticField> f) {
@@ -65,39 +69,53 @@ double SynchrotronRadiation::getSecondaryThreshold() const {
 	return secondaryThreshold;
 }
 
+void SynchrotronRadiation::setMaximumPhotons(int n) {
+	if (n < 0)
+		throw std::runtime_error("SynchrotronRadiation: maximum number of photons < 0");
+	maxPhotons = n;
+}
+
+int SynchrotronRadiation::getMaximumPhotons() const {
+	return maxPhotons;
+}
+
 void SynchrotronRadiation::initSpectrum() {
 	std::string filename = getDataPath("Synchrotron/spectrum.txt");
-	std::ifstream infile(filename.c_str());
-
-	if (!infile.good())
-		throw std::runtime_error(
-				"SynchrotronRadiation: could not open file " + filename);
+	ref_ptr<DataTable> table = DataTable::open(filename);
+	if (!table.valid())
+		throw std::runtime_error("SynchrotronRadiation: could not open file " + filename);
 
 	// clear previously loaded interaction rates
 	tabx.clear();
-	tabCDF.clear();
-
-	while (infile.good()) {
-		if (infile.peek() != '#') {
-			double a, b;
-			infile >> a >> b;
-			if (infile) {
-				tabx.push_back(pow(10, a));
-				tabCDF.push_back(b);
-			}
-		}
-		infile.ignore(std::numeric_limits < std::streamsize > ::max(), '\n');
+	std::vector<double> cdf;
+
+	for (size_t i = 0; i < table->size(); i++) {
+		if (table->rowSize(i) < 2)
+			throw std::runtime_error("SynchrotronRadiation: incomplete row in " + filename);
+		const double *row = table->row(i);
+		tabx.push_back(pow(10, row[0]));
+		cdf.push_back(row[1]);
 	}
-	infile.close();
+	tabCDF.setCDF(cdf);
+
+	// mean of x, uniformly distributed in each bin
+	meanX = 0;
+	for (size_t i = 1; i < cdf.size(); i++)
+		meanX += (cdf[i] - cdf[i - 1]) * (tabx[i] + tabx[i - 1]) / 2;
+	meanX /= cdf.back();
 }
 
-void SynchrotronRadiation::process(Candidate *candidate) const {
-	double charge = fabs(candidate->current.getCharge());
-	if (charge == 0)
-		return; // only charged particles
+double SynchrotronRadiation::drawPhotonEnergy(double Ecrit) const {
+	// draw random value between 0 and maximum of corresponding cdf
+	// choose bin of s where cdf(x) = cdf_rand -> x_rand
+	Random &random = Random::instance();
+	size_t i = random.randBin(tabCDF); // draw random bin (upper bin boundary returned)
+	double binWidth = (tabx[i] - tabx[i-1]);
+	double x = tabx[i-1] + random.rand() * binWidth; // draw random x uniformly distributed in bin
+	return x * Ecrit;
+}
 
-	// calculate gyroradius, evaluated at the current position
-	double z = candidate->getRedshift();
+double SynchrotronRadiation::perpendicularField(const Candidate *candidate, double z) const {
 	double B;
 	if (field.valid()) {
 		Vector3d Bvec = field->getField(candidate->current.getPosition(), z);
@@ -105,7 +123,40 @@ void SynchrotronRadiation::process(Candidate *candidate) const {
 	} else {
 		B = sqrt(2. / 3) * Brms; // average perpendicular field component
 	}
-	B *= pow(1 + z, 2); // cosmological scaling
+	return B * pow(1 + z, 2); // cosmological scaling
+}
+
+double SynchrotronRadiation::energyLossRate(const Candidate *candidate, double E, double z) const {
+	double charge = fabs(candidate->current.getCharge());
+	if (charge == 0)
+		return 0;
+	double mc2 = candidate->current.getMass() * c_squared;
+	double lf = E / mc2;
+	double p = sqrt(std::max(E * E - mc2 * mc2, 0.)) / c_light;
+	double Rg = p / charge / perpendicularField(candidate, z);
+	double dEdx = 1. / 6 / M_PI / epsilon0 * pow(lf * lf - 1, 2) * pow(eplus / Rg, 2); // Jackson p. 770 (14.31)
+	return dEdx / (1 + z); // per comoving distance
+}
+
+void SynchrotronRadiation::emitSecondaries(Candidate *candidate, double E, double dE) const {
+	double charge = fabs(candidate->current.getCharge());
+	if (not(havePhotons) or (charge == 0))
+		return;
+	double mc2 = candidate->current.getMass() * c_squared;
+	double p = sqrt(std::max(E * E - mc2 * mc2, 0.)) / c_light;
+	double Rg = p / charge / perpendicularField(candidate, candidate->getRedshift());
+	double Ecrit = 3. / 4 * h_planck / M_PI * c_light * pow(E / mc2, 3) / Rg;
+	emitPhotons(candidate, Ecrit, dE);
+}
+
+void SynchrotronRadiation::process(Candidate *candidate) const {
+	double charge = fabs(candidate->current.getCharge());
+	if (charge == 0)
+		return; // only charged particles
+
+	// calculate gyroradius, evaluated at the current position
+	double z = candidate->getRedshift();
+	double B = perpendicularField(candidate, z);
 	double Rg = candidate->current.getMomentum().getR() / charge / B;
 
 	// calculate energy loss
@@ -123,20 +174,39 @@ void SynchrotronRadiation::process(Candidate *candidate) const {
 	if (not(havePhotons))
 		return;
 
-	// check if photons with energies > 14 * Ecrit are possible
 	double Ecrit = 3. / 4 * h_planck / M_PI * c_light * pow(lf, 3) / Rg;
+	emitPhotons(candidate, Ecrit, dE);
+}
+
+void SynchrotronRadiation::emitPhotons(Candidate *candidate, double Ecrit, double dE) const {
+	// check if photons with energies > 14 * Ecrit are possible
 	if (14 * Ecrit < secondaryThreshold)
 		return;
 
-	// draw photons up to the total energy loss
 	Random &random = Random::instance();
+
+	// more photons than allowed on average: draw a sample of the spectrum,
+	// weighted to carry the total energy loss
+	if ((maxPhotons > 0) and (dE > maxPhotons * meanX * Ecrit)) {
+		std::vector<double> Egamma(maxPhotons);
+		double sum = 0;
+		for (int i = 0; i < maxPhotons; i++) {
+			Egamma[i] = drawPhotonEnergy(Ecrit);
+			sum += Egamma[i];
+		}
+		double w = dE / sum;
+		for (int i = 0; i < maxPhotons; i++) {
+			if (Egamma[i] <= secondaryThreshold)
+				continue; // create only photons with energies above threshold
+			Vector3d pos = random.randomInterpolatedPosition(candidate->previous.getPosition(), candidate->current.getPosition());
+			candidate->addSecondary(22, Egamma[i], pos, w);
+		}
+		return;
+	}
+
+	// draw photons up to the total energy loss
 	while (dE > 0) {
-		// draw random value between 0 and maximum of corresponding cdf
-		// choose bin of s where cdf(x) = cdf_rand -> x_rand
-		size_t i = random.randBin(tabCDF); // draw random bin (upper bin boundary returned)
-		double binWidth = (tabx[i] - tabx[i-1]);
-		double x = tabx[i-1] + random.rand() * binWidth; // draw random x uniformly distributed in bin
-		double Egamma = x * Ecrit;
+		double Egamma = drawPhotonEnergy(Ecrit);
 
 		// if the remaining energy is not sufficient check for random accepting
 		if (Egamma > dE)
@@ -158,11 +228,18 @@ std::string SynchrotronRadiation::getDescription() const {
 		s << " for specified magnetic field";
 	else
 		s << " for Brms = " << Brms / nG << " nG";
-	if (havePhotons)
+	if (havePhotons) {
 		s << ", synchrotron photons E > " << secondaryThreshold / eV << " eV";
+		if (maxPhotons > 0)
+			s << ", at most " << maxPhotons << " weighted photons per step";
+	}
 	else
 		s << ", no synchrotron photons";
 	return s.str();
 }
 
+int SynchrotronRadiation::getParticleClasses() const {
+	return ChargedClasses;
+}
+
 } // namespace crpropa
@@ -3,37 +3,148 @@
 #include "crpropa/Units.h"
 #include "crpropa/Version.h"
 #include "crpropa/Random.h"
+#include "crpropa/Trace.h"
 
+#include <algorithm>
+#include <cmath>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
 #include <stdexcept>
 #include <iostream>
 #include <kiss/string.h>
 #include <crpropa/base64.h>
 
 #ifdef CRPROPA_HAVE_ZLIB
+#include "crpropa/GzipStream.h"
 #include <izstream.hpp>
-#include <ozstream.hpp>
+#endif
+
+#ifdef _OPENMP
+#include <omp.h>
 #endif
 
 namespace crpropa {
 
-TextOutput::TextOutput() : Output(), out(&std::cout), storeRandomSeeds(false) {
+// lines of a thread are written when this size is reached
+static const size_t LINE_BUFFER_SIZE = 64 * 1024;
+// further threads write single lines
+static const size_t LINE_BUFFER_THREADS = 256;
+// the writes of the line buffers, see Trace
+static const size_t traceWrite = Trace::addName("TextOutput write", "output");
+
+// append x as printf("%.5E\t") in the "C" locale
+static void appendExponential(std::string &s, double x) {
+	char b[32];
+	char *p = b;
+	if (std::isnan(x) || std::isinf(x)) {
+		// right aligned to the minimum width of 8
+		const char *text = std::isnan(x) ? "NAN" : "INF";
+		int n = std::signbit(x) ? 4 : 3;
+		memset(p, ' ', 8 - n);
+		p += 8 - n;
+		if (std::signbit(x))
+			*p++ = '-';
+		memcpy(p, text, 3);
+		p += 3;
+	} else {
+		if (std::signbit(x))
+			*p++ = '-';
+		x = std::fabs(x);
+		// 6 significant digits m * 10^(e - 5)
+		int e = (x > 0) ? int(std::floor(std::log10(x))) : 0;
+		double m = 0;
+		for (int i = 0; (i < 3) && (x > 0); i++) {
+			// scaled value t + err, err the rounding error of the scaling
+			int k = 5 - e;
+			double y = (k > 300) ? x * 1e300 : x;
+			k = (k > 300) ? k - 300 : k;
+			double f = std::pow(10., std::abs(k)), t, err;
+			if (k >= 0) {
+				t = y * f;
+				err = fma(y, f, -t);
+			} else {
+				t = y / f;
+				err = fma(-t, f, y) / f;
+			}
+			m = nearbyint(t);
+			double d = (t - m) + err;
+			if (std::fabs(d) == 0.5)
+				m = 2 * nearbyint((m + d) / 2); // ties to even, as printf
+			else if (d > 0.5)
+				m += 1;
+			else if (d < -0.5)
+				m -= 1;
+			if (m >= 1e6)
+				e++;
+			else if (m < 1e5)
+				e--;
+			else
+				break;
+		}
+		unsigned long digits = (unsigned long) m;
+		char d[6];
+		for (int i = 5; i >= 0; i--) {
+			d[i] = '0' + digits % 10;
+			digits /= 10;
+		}
+		*p++ = d[0];
+		*p++ = '.';
+		memcpy(p, d + 1, 5);
+		p += 5;
+		*p++ = 'E';
+		*p++ = (e < 0) ? '-' : '+';
+		int a = std::abs(e);
+		if (a >= 100)
+			*p++ = '0' + a / 100;
+		*p++ = '0' + (a / 10) % 10;
+		*p++ = '0' + a % 10;
+	}
+	*p++ = '\t';
+	s.append(b, p - b);
 }
 
-TextOutput::TextOutput(OutputType outputtype) : Output(outputtype), out(&std::cout), storeRandomSeeds(false) {
+// append x as printf("%10i\t") or printf("%10lu\t")
+static void appendInteger(std::string &s, long long x) {
+	char b[32];
+	char *p = b + sizeof(b);
+	*--p = '\t';
+	unsigned long long a = (x < 0) ? -(unsigned long long) x : x;
+	do {
+		*--p = '0' + a % 10;
+		a /= 10;
+	} while (a > 0);
+	if (x < 0)
+		*--p = '-';
+	while (p > b + sizeof(b) - 11)
+		*--p = ' ';
+	s.append(p, b + sizeof(b) - p);
 }
 
-TextOutput::TextOutput(std::ostream &out) : Output(), out(&out), storeRandomSeeds(false) {
+static void appendVector(std::string &s, const Vector3d &v) {
+	appendExponential(s, v.x);
+	appendExponential(s, v.y);
+	appendExponential(s, v.z);
+}
+
+TextOutput::TextOutput() : Output(), out(&std::cout), storeRandomSeeds(false), headerPrinted(false), lock("TextOutput"), sharded(false) {
+}
+
+TextOutput::TextOutput(OutputType outputtype) : Output(outputtype), out(&std::cout), storeRandomSeeds(false), headerPrinted(false), lock("TextOutput"), sharded(false) {
+}
+
+TextOutput::TextOutput(std::ostream &out) : Output(), out(&out), storeRandomSeeds(false), headerPrinted(false), lock("TextOutput"), sharded(false) {
 
 }
 
 TextOutput::TextOutput(std::ostream &out,
-		OutputType outputtype) : Output(outputtype), out(&out), storeRandomSeeds(false) {
+		OutputType outputtype) : Output(outputtype), out(&out), storeRandomSeeds(false), headerPrinted(false), lock("TextOutput"), sharded(false) {
 }
 
 TextOutput::TextOutput(const std::string &filename) :  Output(), outfile(filename.c_str(),
 				std::ios::binary), out(&outfile),  filename(
-				filename), storeRandomSeeds(false) {
+				filename), storeRandomSeeds(false), headerPrinted(false), lock("TextOutput"), sharded(false) {
 	if (!outfile.is_open())
 		throw std::runtime_error(std::string("Cannot create file: ") + filename);
 	if (kiss::ends_with(filename, ".gz"))
@@ -43,7 +154,7 @@ TextOutput::TextOutput(const std::string &filename) :  Output(), outfile(filenam
 TextOutput::TextOutput(const std::string &filename,
 				OutputType outputtype) : Output(outputtype), outfile(filename.c_str(),
 				std::ios::binary), out(&outfile), filename(
-				filename), storeRandomSeeds(false) {
+				filename), storeRandomSeeds(false), headerPrinted(false), lock("TextOutput"), sharded(false) {
 	if (!outfile.is_open())
 		throw std::runtime_error(std::string("Cannot create file: ") + filename);
 	if (kiss::ends_with(filename, ".gz"))
@@ -51,226 +162,331 @@ TextOutput::TextOutput(const std::string &filename,
 }
 
 void TextOutput::printHeader() const {
-	*out << "#";
+	printHeader(*out);
+}
+
+void TextOutput::printHeader(std::ostream &out) const {
+	out << "#";
 	if (fields.test(TrajectoryLengthColumn))
-		*out << "\tD";
+		out << "\tD";
 	if (fields.test(RedshiftColumn))
-		*out << "\tz";
+		out << "\tz";
 	if (fields.test(SerialNumberColumn))
-		*out << "\tSN";
+		out << "\tSN";
 	if (fields.test(CurrentIdColumn))
-		*out << "\tID";
+		out << "\tID";
 	if (fields.test(CurrentEnergyColumn))
-		*out << "\tE";
+		out << "\tE";
 	if (fields.test(CurrentPositionColumn) && oneDimensional)
-		*out << "\tX";
+		out << "\tX";
 	if (fields.test(CurrentPositionColumn) && not oneDimensional)
-		*out << "\tX\tY\tZ";
+		out << "\tX\tY\tZ";
 	if (fields.test(CurrentDirectionColumn) && not oneDimensional)
-		*out << "\tPx\tPy\tPz";
+		out << "\tPx\tPy\tPz";
 	if (fields.test(SerialNumberColumn))
-		*out << "\tSN0";
+		out << "\tSN0";
 	if (fields.test(SourceIdColumn))
-		*out << "\tID0";
+		out << "\tID0";
 	if (fields.test(SourceEnergyColumn))
-		*out << "\tE0";
+		out << "\tE0";
 	if (fields.test(SourcePositionColumn) && oneDimensional) 
-		*out << "\tX0";
+		out << "\tX0";
 	if (fields.test(SourcePositionColumn) && not oneDimensional)
-		*out << "\tX0\tY0\tZ0";
+		out << "\tX0\tY0\tZ0";
 	if (fields.test(SourceDirectionColumn) && not oneDimensional)
-		*out << "\tP0x\tP0y\tP0z";
+		out << "\tP0x\tP0y\tP0z";
 	if (fields.test(SerialNumberColumn))
-		*out << "\tSN1";
+		out << "\tSN1";
 	if (fields.test(CreatedIdColumn))
-		*out << "\tID1";
+		out << "\tID1";
 	if (fields.test(CreatedEnergyColumn))
-		*out << "\tE1";
+		out << "\tE1";
 	if (fields.test(CreatedPositionColumn) && oneDimensional)
-		*out << "\tX1";
+		out << "\tX1";
 	if (fields.test(CreatedPositionColumn) && not oneDimensional)
-		*out << "\tX1\tY1\tZ1";
+		out << "\tX1\tY1\tZ1";
 	if (fields.test(CreatedDirectionColumn) && not oneDimensional)
-		*out << "\tP1x\tP1y\tP1z";
+		out << "\tP1x\tP1y\tP1z";
 	if (fields.test(WeightColumn))
-		*out << "\tW";
+		out << "\tW";
 	for(std::vector<Property>::const_iterator iter = properties.begin();
 			iter != properties.end(); ++iter)
 	{
-		*out << "\t" << (*iter).name;
+		out << "\t" << (*iter).name;
 	}
 
-	*out << "\n#\n";
+	out << "\n#\n";
 	if (fields.test(TrajectoryLengthColumn))
-		*out << "# D             Trajectory length [" << lengthScale / Mpc
+		out << "# D             Trajectory length [" << lengthScale / Mpc
 				<< " Mpc]\n";
 	if (fields.test(RedshiftColumn))
-		*out << "# z             Redshift\n";
+		out << "# z             Redshift\n";
 	if (fields.test(SerialNumberColumn))
-		*out << "# SN/SN0/SN1    Serial number. Unique (within this run) id of the particle.\n";
+		out << "# SN/SN0/SN1    Serial number. Unique (within this run) id of the particle.\n";
 	if (fields.test(CurrentIdColumn) || fields.test(CreatedIdColumn)
 			|| fields.test(SourceIdColumn))
-		*out << "# ID/ID0/ID1    Particle type (PDG MC numbering scheme)\n";
+		out << "# ID/ID0/ID1    Particle type (PDG MC numbering scheme)\n";
 	if (fields.test(CurrentEnergyColumn) || fields.test(CreatedEnergyColumn)
 			|| fields.test(SourceEnergyColumn))
-		*out << "# E/E0/E1       Energy [" << energyScale / EeV << " EeV]\n";
+		out << "# E/E0/E1       Energy [" << energyScale / EeV << " EeV]\n";
 	if (fields.test(CurrentPositionColumn) || fields.test(CreatedPositionColumn)
 			|| fields.test(SourcePositionColumn))
-		*out << "# X/X0/X1...    Position [" << lengthScale / Mpc << " Mpc]\n";
+		out << "# X/X0/X1...    Position [" << lengthScale / Mpc << " Mpc]\n";
 	if (fields.test(CurrentDirectionColumn)
 			|| fields.test(CreatedDirectionColumn)
 			|| fields.test(SourceDirectionColumn))
-		*out << "# Px/P0x/P1x... Heading (unit vector of momentum)\n";
+		out << "# Px/P0x/P1x... Heading (unit vector of momentum)\n";
 	if (fields.test(WeightColumn))
-		*out << "# W             Weights" << " \n";
+		out << "# W             Weights" << " \n";
 	for(std::vector<Property>::const_iterator iter = properties.begin();
 			iter != properties.end(); ++iter)
 	{
-			*out << "# " << (*iter).name << " " << (*iter).comment << "\n";
+			out << "# " << (*iter).name << " " << (*iter).comment << "\n";
 	}
 
-	*out << "# no index = current, 0 = at source, 1 = at point of creation\n#\n";
-	*out << "# CRPropa version: " << g_GIT_DESC << "\n#\n";
+	out << "# no index = current, 0 = at source, 1 = at point of creation\n#\n";
+	out << "# CRPropa version: " << g_GIT_DESC << "\n#\n";
 
 	if (storeRandomSeeds)
 	{
-		*out << "# Random seeds:\n";
+		out << "# Random seeds:\n";
 		std::vector< std::vector<uint32_t> > seeds = Random::getSeedThreads();
 
 		for (size_t i =0; i < seeds.size(); i++)
 		{
 			std::string encoded_data = Base64::encode((unsigned char*) &seeds[i][0], sizeof(seeds[i][0]) * seeds[i].size() / sizeof(unsigned char));
-			*out << "#   Thread " << i << ": ";
-			*out << encoded_data;
-			*out << "\n";
+			out << "#   Thread " << i << ": ";
+			out << encoded_data;
+			out << "\n";
 		}
 	}
 }
 
 void TextOutput::process(Candidate *c) const {
-	if (fields.none() && properties.empty())
+	if ((fields.none() && properties.empty()) || !accepts(c))
 		return;
 
-	char buffer[1024];
-	size_t p = 0;
+#ifdef _OPENMP
+	size_t thread = omp_get_thread_num();
+#else
+	size_t thread = 0;
+#endif
+	// sharded output goes to the file of the thread
+	Shard *shard = 0;
+	if (sharded) {
+		if (thread >= shards.size())
+			throw std::runtime_error("TextOutput: more threads than shards");
+		if (!shards[thread])
+			shards[thread] = openShard(thread);
+		shard = shards[thread];
+	}
 
-	std::locale old_locale = std::locale::global(std::locale::classic());
+	// file output is batched in the line buffer of the thread
+	bool batched = !sharded && !filename.empty() && (thread < LINE_BUFFER_THREADS);
+	std::string single;
+	if (batched && lineBuffers.empty()) {
+		ScopedLock l(lock);
+		if (lineBuffers.empty())
+			lineBuffers.resize(LINE_BUFFER_THREADS);
+	}
+	std::string &line = shard ? shard->lines : batched ? lineBuffers[thread].lines : single;
 
 	if (fields.test(TrajectoryLengthColumn))
-		p += std::sprintf(buffer + p, "%8.5E\t",
-				c->getTrajectoryLength() / lengthScale);
+		appendExponential(line, c->getTrajectoryLength() / lengthScale);
 
 	if (fields.test(RedshiftColumn))
-		p += std::sprintf(buffer + p, "%1.5E\t", c->getRedshift());
+		appendExponential(line, c->getRedshift());
 
 	if (fields.test(SerialNumberColumn))
-		p += std::sprintf(buffer + p, "%10lu\t",
-				c->getSerialNumber());
+		appendInteger(line, c->getSerialNumber());
 	if (fields.test(CurrentIdColumn))
-		p += std::sprintf(buffer + p, "%10i\t", c->current.getId());
+		appendInteger(line, c->current.getId());
 	if (fields.test(CurrentEnergyColumn))
-		p += std::sprintf(buffer + p, "%8.5E\t",
-				c->current.getEnergy() / energyScale);
+		appendExponential(line, c->current.getEnergy() / energyScale);
 	if (fields.test(CurrentPositionColumn)) {
 		if (oneDimensional) {
-			p += std::sprintf(buffer + p, "%8.5E\t",
-					c->current.getPosition().x / lengthScale);
+			appendExponential(line, c->current.getPosition().x / lengthScale);
 		} else {
 			const Vector3d pos = c->current.getPosition() / lengthScale;
-			p += std::sprintf(buffer + p, "%8.5E\t%8.5E\t%8.5E\t", pos.x, pos.y,
-					pos.z);
+			appendVector(line, pos);
 		}
 	}
 	if (fields.test(CurrentDirectionColumn)) {
-		if (not oneDimensional) {
-			const Vector3d pos = c->current.getDirection();
-			p += std::sprintf(buffer + p, "%8.5E\t%8.5E\t%8.5E\t", pos.x, pos.y,
-					pos.z);
-		}
+		if (not oneDimensional)
+			appendVector(line, c->current.getDirection());
 	}
 
 	if (fields.test(SerialNumberColumn))
-		p += std::sprintf(buffer + p, "%10lu\t", c->getSourceSerialNumber());
+		appendInteger(line, c->getSourceSerialNumber());
 	if (fields.test(SourceIdColumn))
-		p += std::sprintf(buffer + p, "%10i\t", c->source.getId());
+		appendInteger(line, c->source.getId());
 	if (fields.test(SourceEnergyColumn))
-		p += std::sprintf(buffer + p, "%8.5E\t",
-				c->source.getEnergy() / energyScale);
+		appendExponential(line, c->source.getEnergy() / energyScale);
 	if (fields.test(SourcePositionColumn)) {
 		if (oneDimensional) {
-			p += std::sprintf(buffer + p, "%8.5E\t",
-					c->source.getPosition().x / lengthScale);
+			appendExponential(line, c->source.getPosition().x / lengthScale);
 		} else {
 			const Vector3d pos = c->source.getPosition() / lengthScale;
-			p += std::sprintf(buffer + p, "%8.5E\t%8.5E\t%8.5E\t", pos.x, pos.y,
-					pos.z);
+			appendVector(line, pos);
 		}
 	}
 	if (fields.test(SourceDirectionColumn)) {
-		if (not oneDimensional) {
-			const Vector3d pos = c->source.getDirection();
-			p += std::sprintf(buffer + p, "%8.5E\t%8.5E\t%8.5E\t", pos.x, pos.y,
-					pos.z);
-		}
-
+		if (not oneDimensional)
+			appendVector(line, c->source.getDirection());
 	}
 
 	if (fields.test(SerialNumberColumn))
-		p += std::sprintf(buffer + p, "%10lu\t",
-				c->getCreatedSerialNumber());
+		appendInteger(line, c->getCreatedSerialNumber());
 	if (fields.test(CreatedIdColumn))
-		p += std::sprintf(buffer + p, "%10i\t", c->created.getId());
+		appendInteger(line, c->created.getId());
 	if (fields.test(CreatedEnergyColumn))
-		p += std::sprintf(buffer + p, "%8.5E\t",
-				c->created.getEnergy() / energyScale);
+		appendExponential(line, c->created.getEnergy() / energyScale);
 	if (fields.test(CreatedPositionColumn)) {
 		if (oneDimensional) {
-			p += std::sprintf(buffer + p, "%8.5E\t",
-					c->created.getPosition().x / lengthScale);
+			appendExponential(line, c->created.getPosition().x / lengthScale);
 		} else {
 			const Vector3d pos = c->created.getPosition() / lengthScale;
-			p += std::sprintf(buffer + p, "%8.5E\t%8.5E\t%8.5E\t", pos.x, pos.y,
-					pos.z);
+			appendVector(line, pos);
 		}
 	}
 	if (fields.test(CreatedDirectionColumn)) {
-		if (not oneDimensional) {
-			const Vector3d pos = c->created.getDirection();
-			p += std::sprintf(buffer + p, "%8.5E\t%8.5E\t%8.5E\t", pos.x, pos.y,
-					pos.z);
-		}
+		if (not oneDimensional)
+			appendVector(line, c->created.getDirection());
 	}
 	if (fields.test(WeightColumn)) {
-		p += std::sprintf(buffer + p, "%8.5E\t", c->getWeight());
+		appendExponential(line, c->getWeight());
 	}
 
 	for(std::vector<Output::Property>::const_iterator iter = properties.begin();
 			iter != properties.end(); ++iter)
 	{
-		  Variant v;
-			if (c->hasProperty((*iter).name))
-			{
-				v = c->getProperty((*iter).name);
-			}
-			else
-			{
-				v = (*iter).defaultValue;
-			}
-			p += std::sprintf(buffer + p, "%s", v.toString().c_str());
-			p += std::sprintf(buffer + p, "\t");
+			const Variant &v = c->hasProperty((*iter).key) ?
+					c->getProperty((*iter).key) : (*iter).defaultValue;
+			v.appendTo(line);
+			line += '\t';
 	}
-	buffer[p - 1] = '\n';
+	line[line.size() - 1] = '\n';
+
+	Output::process(c);
+	if (shard) {
+		shard->count++;
+		if (line.size() >= LINE_BUFFER_SIZE) {
+			shard->out->write(line.data(), line.size());
+			line.clear();
+		}
+	} else if (!batched || (line.size() >= LINE_BUFFER_SIZE))
+		writeLines(line);
+}
 
-	std::locale::global(old_locale);
+void TextOutput::setSharded(bool b) {
+	if (b && filename.empty())
+		throw std::runtime_error("TextOutput: sharding needs a file output");
+	if (headerPrinted || !lineBuffers.empty() || (count > 0))
+		throw std::runtime_error("TextOutput: sharding has to be set before the first candidate");
+	sharded = b;
+	size_t n = LINE_BUFFER_THREADS;
+#ifdef _OPENMP
+	n = std::max(n, size_t(omp_get_max_threads()));
+#endif
+	shards.assign(sharded ? n : 0, 0);
+}
+
+bool TextOutput::isSharded() const {
+	return sharded;
+}
+
+std::string TextOutput::getShardFilename(size_t thread) const {
+	// name.<thread>.ext, the extension before a .gz suffix
+	std::string name = filename, suffix;
+	if (kiss::ends_with(name, ".gz")) {
+		name.erase(name.size() - 3);
+		suffix = ".gz";
+	}
+	size_t dot = name.rfind('.');
+	if ((dot == std::string::npos) || (dot == 0)
+			|| ((name.find('/', dot) != std::string::npos)) || (name[dot - 1] == '/'))
+		dot = name.size();
+	std::stringstream s;
+	s << name.substr(0, dot) << "." << thread << name.substr(dot) << suffix;
+	return s.str();
+}
+
+TextOutput::Shard *TextOutput::openShard(size_t thread) const {
+	Shard *shard = new Shard;
+	std::string name = getShardFilename(thread);
+	shard->file.open(name.c_str(), std::ios::binary);
+	if (!shard->file.is_open()) {
+		delete shard;
+		throw std::runtime_error(std::string("Cannot create file: ") + name);
+	}
+	shard->out = &shard->file;
+	shard->count = 0;
+	if (kiss::ends_with(name, ".gz")) {
+#ifdef CRPROPA_HAVE_ZLIB
+		shard->out = new GzipStream(shard->file);
+#endif
+	}
+	printHeader(*shard->out);
+	return shard;
+}
+
+// write the remaining lines, close the shards and write the manifest
+void TextOutput::closeShards() {
+	if (!headerPrinted) {
+		*out << "# CRPropa TextOutput shards\n# file\tlines\n";
+		headerPrinted = true;
+	}
+	for (size_t i = 0; i < shards.size(); i++) {
+		Shard *shard = shards[i];
+		if (!shard)
+			continue;
+		shard->out->write(shard->lines.data(), shard->lines.size());
+#ifdef CRPROPA_HAVE_ZLIB
+		GzipStream *zs = dynamic_cast<GzipStream *>(shard->out);
+		if (zs) {
+			zs->close();
+			delete zs;
+		}
+#endif
+		shard->file.close();
+		std::string name = getShardFilename(i);
+		size_t slash = name.rfind('/');
+		if (slash != std::string::npos)
+			name = name.substr(slash + 1); // relative to the manifest
+		*out << name << "\t" << shard->count << "\n";
+		delete shard;
+		shards[i] = 0;
+	}
+}
 
-#pragma omp critical
+void TextOutput::writeLines(std::string &lines) const {
 	{
-		if (count == 0)
+		ScopedLock l(lock);
+		if (!headerPrinted) {
 			printHeader();
-		Output::process(c);
-		out->write(buffer, p);
+			headerPrinted = true;
+		}
+		double traceStart = Trace::isEnabled() ? Trace::now() : 0;
+		out->write(lines.data(), lines.size());
+		if (Trace::isEnabled())
+			Trace::record(traceWrite, traceStart, Trace::now());
 	}
+	lines.clear();
+}
 
+void TextOutput::flush() const {
+	for (size_t i = 0; i < shards.size(); i++) {
+		if (shards[i]) {
+			shards[i]->out->write(shards[i]->lines.data(), shards[i]->lines.size());
+			shards[i]->lines.clear();
+			shards[i]->out->flush();
+		}
+	}
+	for (size_t i = 0; i < lineBuffers.size(); i++)
+		if (!lineBuffers[i].lines.empty())
+			writeLines(lineBuffers[i].lines);
+	if (out)
+		out->flush();
 }
 
 void TextOutput::load(const std::string &filename, ParticleCollector *collector){
@@ -294,10 +510,25 @@ void TextOutput::load(const std::string &filename, ParticleCollector *collector)
 #endif
 	}
 
+	// a manifest of shards: the first line, followed by the shard files
+	bool manifest = false;
 	while (std::getline(*in,line)) {
+		if (line == "# CRPropa TextOutput shards") {
+			manifest = true;
+			continue;
+		}
 		std::stringstream stream(line);
 		if (stream.peek() == '#')
 			continue;
+		if (manifest) {
+			std::string shard;
+			stream >> shard;
+			size_t slash = filename.rfind('/');
+			if (slash != std::string::npos)
+				shard = filename.substr(0, slash + 1) + shard;
+			load(shard, collector);
+			continue;
+		}
 
 		ref_ptr<Candidate> c = new Candidate(); 
 		double val_d; int val_i;
@@ -347,8 +578,11 @@ std::string TextOutput::getDescription() const {
 }
 
 void TextOutput::close() {
+	if (sharded)
+		closeShards();
+	flush();
 #ifdef CRPROPA_HAVE_ZLIB
-	zstream::ogzstream *zs = dynamic_cast<zstream::ogzstream *>(out);
+	GzipStream *zs = dynamic_cast<GzipStream *>(out);
 	if (zs) {
 		zs->close();
 		delete out;
@@ -364,7 +598,7 @@ TextOutput::~TextOutput() {
 
 void TextOutput::gzip() {
 #ifdef CRPROPA_HAVE_ZLIB
-	out = new zstream::ogzstream(*out);
+	out = new GzipStream(*out);
 #else
 	throw std::runtime_error("CRPropa was build without Zlib compression!");
 #endif
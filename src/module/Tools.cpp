@@ -8,6 +8,9 @@ using namespace std;
 
 namespace crpropa {
 
+PerformanceModule::PerformanceModule() : calls(0), lock("PerformanceModule") {
+}
+
 PerformanceModule::~PerformanceModule() {
 	double total = 0;
 	for (size_t i = 0; i < modules.size(); i++) {
@@ -40,8 +43,8 @@ void PerformanceModule::process(Candidate *candidate) const {
 		times[i] = end - start;
 	}
 
-#pragma omp critical
 	{
+		ScopedLock l(lock);
 		for (size_t i = 0; i < modules.size(); i++) {
 			_module_info &m = modules[i];
 			m.time += times[i];
@@ -99,7 +102,8 @@ string ParticleFilter::getDescription() const {
 }
 
 // ----------------------------------------------------------------------------
-EmissionMapFiller::EmissionMapFiller(EmissionMap *emissionMap) : emissionMap(emissionMap) {
+EmissionMapFiller::EmissionMapFiller(EmissionMap *emissionMap) :
+		emissionMap(emissionMap) {
 
 }
 
@@ -108,12 +112,8 @@ void EmissionMapFiller::setEmissionMap(EmissionMap *emissionMap) {
 }
 
 void EmissionMapFiller::process(Candidate* candidate) const {
-	if (emissionMap) {
-		#pragma omp critical
-		{
-			emissionMap->fillMap(candidate->source);
-		}
-	}
+	if (emissionMap)
+		emissionMap->fillMapOfThread(candidate->source);
 }
 
 string EmissionMapFiller::getDescription() const {
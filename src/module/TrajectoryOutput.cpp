@@ -0,0 +1,337 @@
+#include "crpropa/module/TrajectoryOutput.h"
+#include "crpropa/MappedFile.h"
+#include "crpropa/Trace.h"
+
+#include <cmath>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace crpropa {
+
+// number of the instances, for the names of their properties
+static size_t samplingInstances = 0;
+
+TrajectorySampling::TrajectorySampling(Module *output) :
+		output(output), everyNth(0), minDistance(0), minAngle(0), interval(0) {
+	size_t instance = __sync_add_and_fetch(&samplingInstances, 1);
+	std::stringstream prefix;
+	prefix << "TrajectorySampling" << instance << ".";
+	const char *axes[3] = {"x", "y", "z"};
+	stepsKey = PropertyKey(prefix.str() + "steps");
+	for (int i = 0; i < 3; i++) {
+		positionKeys[i] = PropertyKey(prefix.str() + axes[i]);
+		directionKeys[i] = PropertyKey(prefix.str() + "u" + axes[i]);
+	}
+}
+
+void TrajectorySampling::setEveryNthStep(size_t n) {
+	everyNth = n;
+}
+
+void TrajectorySampling::setMinDistance(double distance) {
+	minDistance = distance;
+}
+
+void TrajectorySampling::setMinAngle(double angle) {
+	minAngle = angle;
+}
+
+void TrajectorySampling::setSnapshotInterval(double length) {
+	interval = length;
+}
+
+size_t TrajectorySampling::getEveryNthStep() const {
+	return everyNth;
+}
+
+double TrajectorySampling::getMinDistance() const {
+	return minDistance;
+}
+
+double TrajectorySampling::getMinAngle() const {
+	return minAngle;
+}
+
+double TrajectorySampling::getSnapshotInterval() const {
+	return interval;
+}
+
+bool TrajectorySampling::keep(Candidate *c) const {
+	bool first = !c->hasProperty(stepsKey);
+	uint64_t steps = first ? 0 : c->getProperty(stepsKey).toUInt64() + 1;
+	bool kept = first || !c->isActive()
+			|| ((everyNth == 0) && (minDistance <= 0) && (minAngle <= 0) && (interval <= 0));
+
+	if ((everyNth > 0) && (steps >= everyNth))
+		kept = true;
+
+	const Vector3d &x = c->current.getPosition();
+	if ((minDistance > 0) && !first) {
+		Vector3d last(c->getProperty(positionKeys[0]).toDouble(),
+				c->getProperty(positionKeys[1]).toDouble(),
+				c->getProperty(positionKeys[2]).toDouble());
+		if ((x - last).getR() >= minDistance)
+			kept = true;
+	}
+
+	const Vector3d &u = c->current.getDirection();
+	if ((minAngle > 0) && !first) {
+		Vector3d last(c->getProperty(directionKeys[0]).toDouble(),
+				c->getProperty(directionKeys[1]).toDouble(),
+				c->getProperty(directionKeys[2]).toDouble());
+		if (u.getAngleTo(last) >= minAngle)
+			kept = true;
+	}
+
+	if (interval > 0) {
+		// the step passed a multiple of the interval
+		double D = c->getTrajectoryLength();
+		if (std::floor((D - c->getCurrentStep()) / interval) != std::floor(D / interval))
+			kept = true;
+	}
+
+	if (kept) {
+		steps = 0;
+		if (minDistance > 0) {
+			c->setProperty(positionKeys[0], x.x);
+			c->setProperty(positionKeys[1], x.y);
+			c->setProperty(positionKeys[2], x.z);
+		}
+		if (minAngle > 0) {
+			c->setProperty(directionKeys[0], u.x);
+			c->setProperty(directionKeys[1], u.y);
+			c->setProperty(directionKeys[2], u.z);
+		}
+	}
+	c->setProperty(stepsKey, Variant::fromUInt64(steps));
+	return kept;
+}
+
+void TrajectorySampling::process(Candidate *candidate) const {
+	if (keep(candidate))
+		output->process(candidate);
+}
+
+std::string TrajectorySampling::getDescription() const {
+	std::stringstream s;
+	s << "TrajectorySampling:";
+	if (everyNth > 0)
+		s << " every " << everyNth << " steps,";
+	if (minDistance > 0)
+		s << " distance " << minDistance / kpc << " kpc,";
+	if (minAngle > 0)
+		s << " angle " << minAngle << " rad,";
+	if (interval > 0)
+		s << " snapshots every " << interval / kpc << " kpc,";
+	s << " first and last steps\n"
+		<< "  Output: " << output->getDescription();
+	return s.str();
+}
+
+// ----------------------------------------------------------------------------
+static const char trajectoryMagic[8] = {'C', 'R', 'P', 'T', 'R', 'A', 'J', '1'};
+// segments of a thread are written when this size is reached
+static const size_t SEGMENT_BUFFER_SIZE = 256 * 1024;
+// further threads share the trajectories under the lock
+static const size_t TRAJECTORY_THREADS = 256;
+// the writes of the segments, see Trace
+static const size_t traceWrite = Trace::addName("TrajectoryOutput write", "output");
+
+// zigzag encoded, small differences of both signs take few bytes
+static void appendVarint(std::string &s, int64_t value) {
+	uint64_t v = ((uint64_t) value << 1) ^ (uint64_t) (value >> 63);
+	while (v >= 0x80) {
+		s += char((v & 0x7f) | 0x80);
+		v >>= 7;
+	}
+	s += char(v);
+}
+
+static bool readVarint(const char *&p, const char *end, int64_t &value) {
+	uint64_t v = 0;
+	for (int shift = 0; (p < end) && (shift < 64); shift += 7) {
+		unsigned char b = *p++;
+		v |= (uint64_t) (b & 0x7f) << shift;
+		if (!(b & 0x80)) {
+			value = (int64_t) (v >> 1) ^ -(int64_t) (v & 1);
+			return true;
+		}
+	}
+	return false;
+}
+
+TrajectoryOutput::TrajectoryOutput(const std::string &filename, double resolution) :
+		outfile(filename.c_str(), std::ios::binary), filename(filename),
+		resolution(resolution), lock("TrajectoryOutput") {
+	if (!outfile.is_open())
+		throw std::runtime_error(std::string("Cannot create file: ") + filename);
+	if (!(resolution > 0))
+		throw std::runtime_error("TrajectoryOutput: the resolution must be positive");
+	outfile.write(trajectoryMagic, 8);
+	outfile.write((const char *) &resolution, sizeof(resolution));
+	threads.resize(TRAJECTORY_THREADS + 1);
+}
+
+TrajectoryOutput::~TrajectoryOutput() {
+	close();
+}
+
+void TrajectoryOutput::addStep(ThreadTrajectories &t, Candidate *c) const {
+	std::pair<TrajectoryMap::iterator, bool> inserted = t.open.insert(
+			std::make_pair(c->getSerialNumber(), Trajectory()));
+	Trajectory &trajectory = inserted.first->second;
+	if (inserted.second) {
+		trajectory.count = 0;
+		memset(trajectory.last, 0, sizeof(trajectory.last));
+		trajectory.lastId = 0;
+	}
+
+	const Vector3d &x = c->current.getPosition();
+	double values[4] = {c->getTrajectoryLength(), x.x, x.y, x.z};
+	for (int k = 0; k < 4; k++) {
+		int64_t q = llround(values[k] / resolution);
+		appendVarint(trajectory.steps, q - trajectory.last[k]);
+		trajectory.last[k] = q;
+	}
+	int32_t id = c->current.getId();
+	appendVarint(trajectory.steps, (int64_t) id - trajectory.lastId);
+	trajectory.lastId = id;
+	float energy = c->current.getEnergy();
+	trajectory.steps.append((const char *) &energy, sizeof(energy));
+	trajectory.count++;
+
+	if (c->isActive())
+		return;
+	// the trajectory ends
+	appendSegment(t.segments, inserted.first->first, trajectory);
+	t.open.erase(inserted.first);
+}
+
+void TrajectoryOutput::appendSegment(std::string &segments, uint64_t serial,
+		const Trajectory &trajectory) {
+	uint32_t bytes = trajectory.steps.size();
+	segments.append((const char *) &serial, sizeof(serial));
+	segments.append((const char *) &trajectory.count, sizeof(trajectory.count));
+	segments.append((const char *) &bytes, sizeof(bytes));
+	segments.append(trajectory.steps);
+}
+
+void TrajectoryOutput::process(Candidate *c) const {
+#ifdef _OPENMP
+	size_t thread = omp_get_thread_num();
+#else
+	size_t thread = 0;
+#endif
+	if (thread < TRAJECTORY_THREADS) {
+		ThreadTrajectories &t = threads[thread];
+		addStep(t, c);
+		if (t.segments.size() >= SEGMENT_BUFFER_SIZE)
+			writeSegments(t.segments);
+		return;
+	}
+
+	std::string segments;
+	{
+		ScopedLock l(lock);
+		ThreadTrajectories &t = threads[TRAJECTORY_THREADS];
+		addStep(t, c);
+		segments.swap(t.segments);
+	}
+	if (!segments.empty())
+		writeSegments(segments);
+}
+
+void TrajectoryOutput::writeSegments(std::string &segments) const {
+	{
+		ScopedLock l(lock);
+		double traceStart = Trace::isEnabled() ? Trace::now() : 0;
+		outfile.write(segments.data(), segments.size());
+		if (Trace::isEnabled())
+			Trace::record(traceWrite, traceStart, Trace::now());
+	}
+	segments.clear();
+}
+
+void TrajectoryOutput::close() {
+	if (!outfile.is_open())
+		return;
+	for (size_t i = 0; i < threads.size(); i++) {
+		ThreadTrajectories &t = threads[i];
+		for (TrajectoryMap::iterator j = t.open.begin(); j != t.open.end(); ++j)
+			appendSegment(t.segments, j->first, j->second);
+		t.open.clear();
+		if (!t.segments.empty())
+			writeSegments(t.segments);
+	}
+	outfile.close();
+}
+
+double TrajectoryOutput::getResolution() const {
+	return resolution;
+}
+
+void TrajectoryOutput::load(const std::string &filename, ParticleCollector *collector) {
+	ref_ptr<MappedFile> file = new MappedFile(filename);
+	const char *p = (const char *) file->getData();
+	const char *end = p + file->getSize();
+	double resolution;
+	if ((end - p < 16) || (memcmp(p, trajectoryMagic, 8) != 0))
+		throw std::runtime_error("TrajectoryOutput: " + filename + " is no trajectory file");
+	memcpy(&resolution, p + 8, sizeof(resolution));
+	p += 16;
+
+	while (p < end) {
+		uint64_t serial;
+		uint32_t count, bytes;
+		if (end - p < 16)
+			throw std::runtime_error("TrajectoryOutput: " + filename + " is truncated");
+		memcpy(&serial, p, 8);
+		memcpy(&count, p + 8, 4);
+		memcpy(&bytes, p + 12, 4);
+		p += 16;
+		if ((size_t) (end - p) < bytes)
+			throw std::runtime_error("TrajectoryOutput: " + filename + " is truncated");
+		const char *q = p, *segmentEnd = p + bytes;
+		p = segmentEnd;
+
+		int64_t last[4] = {0, 0, 0, 0};
+		int64_t id = 0;
+		Vector3d position, direction(-1, 0, 0);
+		for (uint32_t i = 0; i < count; i++) {
+			int64_t delta;
+			for (int k = 0; k < 4; k++) {
+				if (!readVarint(q, segmentEnd, delta))
+					throw std::runtime_error("TrajectoryOutput: " + filename + " is corrupt");
+				last[k] += delta;
+			}
+			if (!readVarint(q, segmentEnd, delta) || (segmentEnd - q < 4))
+				throw std::runtime_error("TrajectoryOutput: " + filename + " is corrupt");
+			id += delta;
+			float energy;
+			memcpy(&energy, q, sizeof(energy));
+			q += sizeof(energy);
+
+			Vector3d x(last[1] * resolution, last[2] * resolution, last[3] * resolution);
+			if ((i > 0) && !(x == position))
+				direction = x - position;
+			position = x;
+			ref_ptr<Candidate> c = new Candidate(ParticleState(id, energy, x, direction));
+			c->setSerialNumber(serial);
+			c->setTrajectoryLength(last[0] * resolution);
+			collector->process(c);
+		}
+	}
+}
+
+std::string TrajectoryOutput::getDescription() const {
+	std::stringstream s;
+	s << "TrajectoryOutput: " << filename << ", resolution " << resolution / kpc << " kpc";
+	return s.str();
+}
+
+} // namespace crpropa
@@ -51,5 +51,25 @@ TEST (AdiabaticCooling, ConstantSphericalField) {
 
 }
 
+TEST (AdiabaticCooling, processBatch) {
+	// the batch gives the same energies and step limits as process
+	AdiabaticCooling AC(new ConstantSphericalAdvectionField(Vector3d(0,0,0), 1));
+	std::vector<ref_ptr<Candidate> > single, batch;
+	std::vector<Candidate *> pointers;
+	for (int i = 0; i < 4; i++) {
+		single.push_back(new Candidate(nucleusId(1,1), 10, Vector3d(1 + i, 0, 0)));
+		single.back()->setCurrentStep(c_light);
+		single.back()->setNextStep(c_light);
+		batch.push_back(single.back()->clone());
+		pointers.push_back(batch.back());
+		AC.process(single.back());
+	}
+	AC.processBatch(&pointers[0], pointers.size());
+	for (int i = 0; i < 4; i++) {
+		EXPECT_DOUBLE_EQ(single[i]->current.getEnergy(), batch[i]->current.getEnergy());
+		EXPECT_DOUBLE_EQ(single[i]->getNextStep(), batch[i]->getNextStep());
+	}
+}
+
 
 } // namespace crpropa
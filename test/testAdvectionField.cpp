@@ -1,4 +1,5 @@
 #include "crpropa/advectionField/AdvectionField.h"
+#include "crpropa/advectionField/AdvectionFieldGrid.h"
 #include "crpropa/Units.h"
 #include "crpropa/Common.h"
 
@@ -166,4 +167,68 @@ TEST(testSphericalAdvectionShock, SimpleTest) {
 	
 }
 
+TEST(testAdvectionFieldList, FieldAndDivergence) {
+	// the combined and batched evaluation agree with the separate calls
+	AdvectionFieldList A;
+	A.addField(new UniformAdvectionField(Vector3d(1, 2, 3)));
+	A.addField(new ConstantSphericalAdvectionField(Vector3d(1, 0, 0), 10));
+	A.addField(new SphericalAdvectionField(Vector3d(0, 1, 0), 20, 1000, 2, 1.5));
+	ref_ptr<SphericalAdvectionShock> shock = new SphericalAdvectionShock(Vector3d(0, 0, 0), 10, 1000, 0.1);
+	shock->setAzimuthalSpeed(100);
+	A.addField(shock);
+
+	std::vector<Vector3d> positions;
+	for (int i = 0; i < 40; i++)
+		positions.push_back(Vector3d(0.5 * i + 0.3, 0.2 * i - 1, 1));
+	size_t n = positions.size();
+	std::vector<Vector3d> fields(n), onlyFields(n);
+	std::vector<double> divergences(n), onlyDivergences(n);
+	A.getFieldsAndDivergences(&positions[0], &fields[0], &divergences[0], n);
+	A.getFieldsAndDivergences(&positions[0], &onlyFields[0], NULL, n);
+	A.getFieldsAndDivergences(&positions[0], NULL, &onlyDivergences[0], n);
+	for (size_t i = 0; i < n; i++) {
+		Vector3d v = A.getField(positions[i]);
+		double D = A.getDivergence(positions[i]);
+		EXPECT_NEAR(0, (v - fields[i]).getR(), 1e-12 * v.getR());
+		EXPECT_NEAR(D, divergences[i], 1e-12 * fabs(D) + 1e-12);
+		EXPECT_NEAR(0, (v - onlyFields[i]).getR(), 1e-12 * v.getR());
+		EXPECT_NEAR(D, onlyDivergences[i], 1e-12 * fabs(D) + 1e-12);
+	}
+}
+
+TEST(testAdvectionFieldGrid, divergence) {
+	// periodic wind v = (sin(kx), 0, sin(kz)), div v = k (cos(kx) + cos(kz))
+	size_t N = 64;
+	double L = 10 * kpc, k = 2 * M_PI / L;
+	ref_ptr<VectorGrid> grid = new VectorGrid(Vector3d(0.), N, L / N);
+	for (size_t ix = 0; ix < N; ix++)
+		for (size_t iy = 0; iy < N; iy++)
+			for (size_t iz = 0; iz < N; iz++) {
+				Vector3d p = Vector3d(ix + 0.5, iy + 0.5, iz + 0.5) * (L / N);
+				grid->get(ix, iy, iz) = Vector3f(sin(k * p.x), 0, sin(k * p.z));
+			}
+	AdvectionFieldGrid A(grid);
+
+	Vector3d p(0.3 * L, 0.7 * L, 0.1 * L);
+	Vector3d v;
+	double D;
+	A.getFieldAndDivergence(p, v, D);
+	EXPECT_NEAR(sin(k * p.x), v.x, 2e-3);
+	EXPECT_NEAR(sin(k * p.z), v.z, 2e-3);
+	EXPECT_NEAR(k * (cos(k * p.x) + cos(k * p.z)), D, 2e-3 * k);
+	EXPECT_DOUBLE_EQ(D, A.getDivergence(p));
+	EXPECT_FLOAT_EQ(v.x, A.getField(p).x);
+
+	// a uniform wind on a reflective grid has no divergence, also at the boundary
+	ref_ptr<VectorGrid> uniform = new VectorGrid(Vector3d(0.), 4, 1.);
+	uniform->setReflective(true);
+	for (size_t ix = 0; ix < 4; ix++)
+		for (size_t iy = 0; iy < 4; iy++)
+			for (size_t iz = 0; iz < 4; iz++)
+				uniform->get(ix, iy, iz) = Vector3f(1, 2, 3);
+	AdvectionFieldGrid B(uniform);
+	EXPECT_DOUBLE_EQ(0, B.getDivergence(Vector3d(0.1, 2, 3.9)));
+	EXPECT_DOUBLE_EQ(2, B.getField(Vector3d(0.1, 2, 3.9)).y);
+}
+
 } //namespace crpropa
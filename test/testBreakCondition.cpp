@@ -3,10 +3,15 @@
 #include "crpropa/module/BreakCondition.h"
 #include "crpropa/module/Observer.h"
 #include "crpropa/module/Boundary.h"
+#include "crpropa/module/ConditionSet.h"
+#include "crpropa/module/ImportanceSampling.h"
+#include "crpropa/module/Backtracking.h"
 #include "crpropa/module/Tools.h"
 #include "crpropa/module/RestrictToRegion.h"
 #include "crpropa/ParticleID.h"
 #include "crpropa/Geometry.h"
+#include "crpropa/Random.h"
+#include "crpropa/Units.h"
 
 #include "gtest/gtest.h"
 
@@ -111,6 +116,22 @@ TEST(ObserverFeature, SmallSphere) {
 	EXPECT_FALSE(c.isActive());
 }
 
+TEST(ObserverFeature, SurfaceRayStep) {
+	// neutral particles step to the crossing of the surface in one step
+	ref_ptr<ObserverSurface> surface = new ObserverSurface(new Plane(Vector3d(0, 0, 10), Vector3d(0, 0, 1)));
+	surface->setRayStep(true);
+	Observer obs;
+	obs.add(surface);
+	Candidate c;
+	c.setNextStep(100);
+	c.current.setPosition(Vector3d(0, 0, 0));
+	c.previous.setPosition(Vector3d(0, 0, -1));
+	c.current.setDirection(Vector3d(1, 0, 1).getUnitVector());
+	obs.process(&c);
+	EXPECT_TRUE(c.isActive());
+	EXPECT_NEAR(10 * sqrt(2.), c.getNextStep(), 1e-12);
+}
+
 TEST(ObserverFeature, LargeSphere) {
 	// detect if the current position is outside and the previous inside of the sphere
 	Observer obs;
@@ -134,6 +155,54 @@ TEST(ObserverFeature, LargeSphere) {
 	EXPECT_FALSE(c.isActive());
 }
 
+TEST(Observer, spatialIndex) {
+	// Test if the index detects the same candidates as checking all features
+	Observer all, indexed;
+	for (int i = 0; i < 10; i++)
+		for (int j = 0; j < 10; j++)
+			for (int k = 0; k < 10; k++) {
+				ref_ptr<ObserverFeature> f = new ObserverSurface(
+						new Sphere(Vector3d(i, j, k) * 10, 1));
+				all.add(f);
+				indexed.add(f);
+			}
+	all.add(new ObserverRedshiftWindow(0, 1));
+	indexed.add(new ObserverRedshiftWindow(0, 1));
+	EXPECT_EQ(0, indexed.getSpatialIndex());
+	indexed.setSpatialIndex(5);
+	EXPECT_EQ(5, indexed.getSpatialIndex());
+	EXPECT_THROW(indexed.setSpatialIndex(-1), std::runtime_error);
+
+	Random random(1);
+	int detected = 0;
+	for (int n = 0; n < 5000; n++) {
+		Vector3d x0 = Vector3d(random.rand(), random.rand(), random.rand()) * 120 - Vector3d(10);
+		Vector3d x1 = x0 + random.randVector() * 3 * random.rand();
+		Candidate c1, c2;
+		c1.previous.setPosition(x0);
+		c1.current.setPosition(x1);
+		c1.setNextStep(100);
+		c2.previous.setPosition(x0);
+		c2.current.setPosition(x1);
+		c2.setNextStep(100);
+		all.process(&c1);
+		indexed.process(&c2);
+		ASSERT_EQ(c1.isActive(), c2.isActive());
+		EXPECT_LE(c2.getNextStep(), c1.getNextStep());
+		if (!c1.isActive())
+			detected++;
+	}
+	EXPECT_LT(0, detected);
+
+	// redshift window still vetoes
+	Candidate c;
+	c.setRedshift(2);
+	c.previous.setPosition(Vector3d(11, 0, 0));
+	c.current.setPosition(Vector3d(10, 0, 0));
+	indexed.process(&c);
+	EXPECT_TRUE(c.isActive());
+}
+
 TEST(ObserverFeature, Point) {
 	Observer obs;
 	obs.add(new ObserverPoint());
@@ -163,6 +232,55 @@ TEST(ObserverFeature, DetectAll) {
 	EXPECT_FALSE(c.isActive());
 }
 
+// keeps the last detected candidate and the snapshots it was given
+class DetectionRecorder: public Module {
+public:
+	mutable std::vector<const Candidate *> seen;
+	mutable ref_ptr<Candidate> kept;
+	bool keep;
+	DetectionRecorder(bool keep) : keep(keep) {
+	}
+	void process(Candidate *c) const {
+		EXPECT_TRUE(c->isActive());
+		EXPECT_FALSE(c->hasProperty("Detected"));
+		seen.push_back(c);
+		if (keep)
+			kept = c;
+	}
+};
+
+TEST(Observer, cloneSnapshot) {
+	Observer obs;
+	obs.add(new ObserverDetectAll());
+	obs.setFlag("Detected", "yes");
+	ref_ptr<DetectionRecorder> recorder = new DetectionRecorder(false);
+	obs.onDetection(recorder, true);
+
+	// the action sees the state before the detection, in one reused snapshot
+	Candidate c1(1, 10), c2(2, 20);
+	c2.setProperty("Tag", 5);
+	obs.process(&c1);
+	obs.process(&c2);
+	EXPECT_FALSE(c2.isActive());
+	EXPECT_TRUE(c2.hasProperty("Detected"));
+	ASSERT_EQ(2, recorder->seen.size());
+	EXPECT_EQ(recorder->seen[0], recorder->seen[1]);
+	EXPECT_EQ(2, recorder->seen[1]->current.getId());
+	EXPECT_EQ(c2.getSerialNumber(), recorder->seen[1]->getSerialNumber());
+	EXPECT_TRUE(recorder->seen[1]->hasProperty("Tag"));
+
+	// a kept snapshot is not overwritten
+	ref_ptr<DetectionRecorder> keeper = new DetectionRecorder(true);
+	obs.onDetection(keeper, true);
+	Candidate c3(3, 30), c4(4, 40);
+	obs.process(&c3);
+	ref_ptr<Candidate> first = keeper->kept;
+	obs.process(&c4);
+	EXPECT_NE(first.get(), keeper->kept.get());
+	EXPECT_EQ(3, first->current.getId());
+	EXPECT_EQ(4, keeper->kept->current.getId());
+}
+
 TEST(ObserverFeature, TimeEvolution) {
   Observer obs;
   obs.setDeactivateOnDetection(false);
@@ -198,6 +316,64 @@ TEST(ObserverFeature, TimeEvolution) {
   EXPECT_TRUE(c.hasProperty("Detected"));
 }
 
+TEST(ObserverFeature, TimeEvolutionSorted) {
+  // times added in any order, a step passing several times detects once
+  ObserverTimeEvolution evolution;
+  evolution.addTime(30);
+  evolution.addTime(10);
+  evolution.addTime(20);
+  EXPECT_DOUBLE_EQ(10, evolution.getTimes()[0]);
+  EXPECT_DOUBLE_EQ(30, evolution.getTimes()[2]);
+
+  Candidate c;
+  c.setNextStep(100);
+  c.setTrajectoryLength(25);
+  EXPECT_EQ(DETECTED, evolution.checkDetection(&c));
+  EXPECT_EQ(2, c.getProperty("DetectionIndex").asUInt64());
+  EXPECT_DOUBLE_EQ(5, c.getNextStep());
+  c.setNextStep(100);
+  EXPECT_EQ(NOTHING, evolution.checkDetection(&c));
+  c.setTrajectoryLength(31);
+  EXPECT_EQ(DETECTED, evolution.checkDetection(&c));
+  c.setTrajectoryLength(40);
+  c.setNextStep(100);
+  EXPECT_EQ(NOTHING, evolution.checkDetection(&c));
+  EXPECT_DOUBLE_EQ(100, c.getNextStep());
+}
+
+TEST(Observer, vetoAndHints) {
+  // a veto returns before the surface, hints skip the steps before it
+  Observer obs;
+  obs.add(new ObserverSurface(new Sphere(Vector3d(0, 0, 0), 10)));
+  obs.add(new ObserverNucleusVeto());
+  obs.setDetectionHints(true);
+  EXPECT_TRUE(obs.getDetectionHints());
+
+  Candidate nucleus(nucleusId(4, 2), 1, Vector3d(0, 0, 0));
+  nucleus.current.setPosition(Vector3d(20, 0, 0));
+  nucleus.previous.setPosition(Vector3d(5, 0, 0));
+  obs.process(&nucleus);
+  EXPECT_TRUE(nucleus.isActive());
+
+  Candidate c;
+  c.current.setPosition(Vector3d(3, 0, 0));
+  c.previous.setPosition(Vector3d(2, 0, 0));
+  c.setTrajectoryLength(1);
+  c.setNextStep(100);
+  obs.process(&c);
+  EXPECT_TRUE(c.isActive());
+  // 7 to the surface, until the length 8
+  c.setTrajectoryLength(4);
+  obs.process(&c);
+  EXPECT_DOUBLE_EQ(4, c.getNextStep());
+
+  c.current.setPosition(Vector3d(11, 0, 0));
+  c.previous.setPosition(Vector3d(9, 0, 0));
+  c.setTrajectoryLength(9);
+  obs.process(&c);
+  EXPECT_FALSE(c.isActive());
+}
+
 //** ========================= Boundaries =================================== */
 TEST(PeriodicBox, high) {
 	// Tests if the periodical boundaries place the particle back inside the box and translate the initial position accordingly.
@@ -356,6 +532,33 @@ TEST(SphericalBoundary, limitStep) {
 	EXPECT_DOUBLE_EQ(1.5, c.getNextStep());
 }
 
+TEST(SphericalBoundary, rayStep) {
+	// neutral particles may step to the crossing of their line with the sphere
+	SphericalBoundary sphere(Vector3d(0, 0, 0), 10);
+	sphere.setMargin(1);
+	sphere.setRayStep(true);
+	Candidate c;
+	c.setNextStep(100);
+	c.current.setPosition(Vector3d(0, 0, 9.5));
+	c.current.setDirection(Vector3d(0, 0, -1));
+	sphere.process(&c);
+	EXPECT_DOUBLE_EQ(20.5, c.getNextStep());
+
+	// charged particles keep the distance
+	Candidate p(nucleusId(1, 1), 1, Vector3d(0, 0, 9.5), Vector3d(0, 0, -1));
+	p.setNextStep(100);
+	sphere.process(&p);
+	EXPECT_DOUBLE_EQ(1.5, p.getNextStep());
+
+	CubicBoundary cube(Vector3d(0, 0, 0), 10);
+	cube.setMargin(1);
+	cube.setRayStep(true);
+	c.setNextStep(100);
+	c.current.setPosition(Vector3d(5, 5, 9.5));
+	cube.process(&c);
+	EXPECT_DOUBLE_EQ(10.5, c.getNextStep());
+}
+
 TEST(EllipsoidalBoundary, inside) {
 	EllipsoidalBoundary ellipsoid(Vector3d(-5, 0, 0), Vector3d(5, 0, 0), 15);
 	Candidate c;
@@ -414,6 +617,47 @@ TEST(CylindricalBoundary, limitStep) {
 	EXPECT_DOUBLE_EQ(c.getNextStep(), 1.5);
 }
 
+TEST(ConditionSet, sameAsModules) {
+	// one pass gives the step limit and flags of the separate modules
+	ref_ptr<MaximumTrajectoryLength> length = new MaximumTrajectoryLength(10);
+	ref_ptr<SphericalBoundary> sphere = new SphericalBoundary(Vector3d(0, 0, 0), 5);
+	sphere->setMargin(0);
+	ref_ptr<MinimumEnergy> energy = new MinimumEnergy(5);
+	energy->setRejectFlag("Rejected", "energy");
+	ConditionSet set;
+	set.add(length);
+	set.add(sphere);
+	set.add(energy);
+	EXPECT_EQ(3, set.size());
+
+	Candidate c(nucleusId(1, 1), 10, Vector3d(4, 0, 0));
+	c.setTrajectoryLength(8);
+	c.setNextStep(100);
+	set.process(&c);
+	EXPECT_TRUE(c.isActive());
+	EXPECT_DOUBLE_EQ(1, c.getNextStep());
+
+	Candidate d(nucleusId(1, 1), 10, Vector3d(4, 0, 0));
+	d.setTrajectoryLength(8);
+	d.setNextStep(100);
+	length->process(&d);
+	sphere->process(&d);
+	energy->process(&d);
+	EXPECT_DOUBLE_EQ(d.getNextStep(), c.getNextStep());
+
+	// competing conditions: the first rejection wins
+	c.current.setEnergy(1);
+	c.current.setPosition(Vector3d(6, 0, 0));
+	set.process(&c);
+	EXPECT_FALSE(c.isActive());
+	EXPECT_EQ("", c.getProperty("Rejected").toString());
+
+	Candidate e(nucleusId(1, 1), 1);
+	set.process(&e);
+	EXPECT_FALSE(e.isActive());
+	EXPECT_EQ("energy", e.getProperty("Rejected").toString());
+}
+
 TEST(RestrictToRegion, RestrictToRegion) {
 
 	ref_ptr<Observer> obs = new Observer();
@@ -430,6 +674,132 @@ TEST(RestrictToRegion, RestrictToRegion) {
 	EXPECT_FALSE(c.isActive());
 }
 
+TEST(ImportanceSampling, splitting) {
+	// importance (R / d)^2: from 8 R to 2 R the level rises by 4
+	ImportanceSampling sampling(Vector3d(0.), 1 * Mpc);
+	Candidate c;
+	c.current.setPosition(Vector3d(8, 0, 0) * Mpc);
+	EXPECT_EQ(-6, sampling.getLevel(&c));
+	sampling.process(&c); // sets the level
+	EXPECT_EQ(0, c.secondaries.size());
+	c.current.setPosition(Vector3d(2, 0, 0) * Mpc);
+	sampling.process(&c);
+	ASSERT_EQ(15, c.secondaries.size());
+	EXPECT_DOUBLE_EQ(1. / 16, c.getWeight());
+	EXPECT_DOUBLE_EQ(1. / 16, c.secondaries[0]->getWeight());
+	EXPECT_EQ(&c, c.secondaries[0]->parent);
+	EXPECT_DOUBLE_EQ(2 * Mpc, c.secondaries[0]->current.getPosition().x);
+
+	// the clones keep the level and do not split again
+	sampling.process(c.secondaries[0]);
+	EXPECT_EQ(0, c.secondaries[0]->secondaries.size());
+
+	// limited splitting
+	ImportanceSampling limited(Vector3d(0.), 1 * Mpc);
+	limited.setMaxSplitting(4);
+	Candidate d;
+	d.current.setPosition(Vector3d(8, 0, 0) * Mpc);
+	limited.process(&d);
+	d.current.setPosition(Vector3d(2, 0, 0) * Mpc);
+	limited.process(&d);
+	EXPECT_EQ(3, d.secondaries.size());
+	EXPECT_DOUBLE_EQ(0.25, d.getWeight());
+}
+
+TEST(ImportanceSampling, russianRoulette) {
+	// moving away, 1 in 16 candidates survives with weight 16
+	ImportanceSampling sampling(Vector3d(0.), 1 * Mpc);
+	Random::seedThreads(7);
+	int n = 8000, survivors = 0;
+	double weight = 0;
+	for (int i = 0; i < n; i++) {
+		Candidate c;
+		c.current.setPosition(Vector3d(2, 0, 0) * Mpc);
+		sampling.process(&c);
+		c.current.setPosition(Vector3d(8, 0, 0) * Mpc);
+		sampling.process(&c);
+		if (c.isActive()) {
+			survivors++;
+			weight += c.getWeight();
+			EXPECT_DOUBLE_EQ(16, c.getWeight());
+		}
+	}
+	EXPECT_NEAR(n / 16., survivors, 4 * sqrt(n / 16.));
+	EXPECT_NEAR(1, weight / n, 0.1);
+
+	// the angle: moving away from the observer has a vanishing importance
+	ImportanceSampling angle(Vector3d(0.), 1 * Mpc, 0, 1);
+	Candidate c;
+	c.current.setPosition(Vector3d(2, 0, 0) * Mpc);
+	c.current.setDirection(Vector3d(-1, 0, 0));
+	EXPECT_EQ(0, angle.getLevel(&c));
+	c.current.setDirection(Vector3d(0, 1, 0));
+	EXPECT_EQ(-1, angle.getLevel(&c));
+	EXPECT_THROW(ImportanceSampling(Vector3d(0.), 0), std::runtime_error);
+}
+
+// sources of density 2 in a slab |x| < 1
+class SlabDensity: public Density {
+public:
+	double getDensity(const Vector3d &position) const {
+		return (fabs(position.x) < 1) ? 2 : 0;
+	}
+};
+
+TEST(BacktrackingWeight, integral) {
+	BacktrackingWeight weight(new SlabDensity());
+	Candidate c;
+	c.setWeight(3);
+	c.previous.setPosition(Vector3d(0.));
+	c.current.setPosition(Vector3d(0.5, 0, 0));
+	c.setCurrentStep(0.5);
+	weight.process(&c);
+	EXPECT_DOUBLE_EQ(3 * 2 * 0.5, c.getWeight());
+	// the density at the middle of the step times the trajectory length
+	c.previous = c.current;
+	c.current.setPosition(Vector3d(1.2, 0, 0));
+	c.setCurrentStep(1.5);
+	weight.process(&c);
+	EXPECT_DOUBLE_EQ(3 + 3 * 2 * 1.5, c.getWeight());
+	c.previous = c.current;
+	c.current.setPosition(Vector3d(4, 0, 0));
+	c.setCurrentStep(2.8);
+	weight.process(&c);
+	EXPECT_DOUBLE_EQ(12, c.getWeight());
+	EXPECT_DOUBLE_EQ(3, c.getProperty("BacktrackingWeight.weight").toDouble());
+
+	// in batches as one by one
+	Candidate d;
+	d.setWeight(3);
+	d.current.setPosition(Vector3d(0.5, 0, 0));
+	d.setCurrentStep(0.5);
+	Candidate *batch = &d;
+	weight.processBatch(&batch, 1);
+	EXPECT_DOUBLE_EQ(3, d.getWeight());
+}
+
+TEST(BacktrackingWeight, endPointOfGrid) {
+	// cells [0, 1) and [1, 2) in x, zero outside
+	ref_ptr<ScalarGrid> grid = new ScalarGrid(Vector3d(0.), 2, 1, 1, 1.);
+	grid->get(0, 0, 0) = 1;
+	grid->get(1, 0, 0) = 4;
+	BacktrackingWeight weight(grid, BacktrackingWeight::EndPoint);
+	EXPECT_DOUBLE_EQ(4, weight.getDensity(Vector3d(1.9, 0.5, 0.5)));
+	EXPECT_DOUBLE_EQ(0, weight.getDensity(Vector3d(2.1, 0.5, 0.5)));
+	EXPECT_DOUBLE_EQ(0, weight.getDensity(Vector3d(-0.1, 0.5, 0.5)));
+
+	Candidate c;
+	c.setWeight(2);
+	c.current.setPosition(Vector3d(0.5, 0.5, 0.5));
+	weight.process(&c);
+	EXPECT_DOUBLE_EQ(2, c.getWeight());
+	c.current.setPosition(Vector3d(1.5, 0.5, 0.5));
+	weight.process(&c);
+	EXPECT_DOUBLE_EQ(8, c.getWeight());
+	c.current.setPosition(Vector3d(3, 0.5, 0.5));
+	weight.process(&c);
+	EXPECT_DOUBLE_EQ(0, c.getWeight());
+}
 
 int main(int argc, char **argv) {
 	::testing::InitGoogleTest(&argc, argv);
@@ -8,18 +8,34 @@
 #include "crpropa/Candidate.h"
 #include "crpropa/base64.h"
 #include "crpropa/Common.h"
+#include "crpropa/Cosmology.h"
 #include "crpropa/Units.h"
 #include "crpropa/ParticleID.h"
 #include "crpropa/ParticleMass.h"
 #include "crpropa/Random.h"
+#include "crpropa/Module.h"
 #include "crpropa/Grid.h"
 #include "crpropa/GridTools.h"
+#include "crpropa/magneticField/MagneticFieldGrid.h"
 #include "crpropa/Geometry.h"
+#include "crpropa/Lock.h"
+#include "crpropa/MemoryAccounting.h"
 #include "crpropa/EmissionMap.h"
+#include "crpropa/DataTable.h"
+#include "crpropa/SimulationBundle.h"
+#include "crpropa/PhotonBackground.h"
 
 #include <HepPID/ParticleIDMethods.hh>
 #include "gtest/gtest.h"
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
 namespace crpropa {
 
 TEST(ParticleState, position) {
@@ -63,6 +79,25 @@ TEST(ParticleState, id) {
 	EXPECT_EQ(particle.getId(), 1000060120);
 }
 
+TEST(ParticleState, cachedNucleusProperties) {
+	ParticleState particle(nucleusId(56, 26));
+	EXPECT_TRUE(particle.isNucleus());
+	EXPECT_EQ(56, particle.getMassNumber());
+	EXPECT_EQ(26, particle.getChargeNumber());
+	EXPECT_EQ(Module::NucleusClass, particle.getParticleClass());
+
+	particle.setId(nucleusId(1, 0)); // neutron
+	EXPECT_EQ(1, particle.getMassNumber());
+	EXPECT_EQ(0, particle.getChargeNumber());
+	EXPECT_EQ(Module::NeutronClass, particle.getParticleClass());
+
+	particle.setId(22);
+	EXPECT_FALSE(particle.isNucleus());
+	EXPECT_EQ(0, particle.getMassNumber());
+	EXPECT_EQ(0, particle.getChargeNumber());
+	EXPECT_EQ(Module::PhotonClass, particle.getParticleClass());
+}
+
 TEST(ParticleState, idException) {
 	EXPECT_THROW(nucleusId(5, 6), std::runtime_error);
 }
@@ -197,6 +232,24 @@ TEST(Candidate, property) {
 	EXPECT_EQ("bar", value);
 }
 
+TEST(Candidate, propertyKey) {
+	PropertyKey key("foo");
+	EXPECT_EQ("foo", key.getName());
+	EXPECT_TRUE(key == PropertyKey(std::string("foo")));
+	EXPECT_TRUE(key != PropertyKey("bar"));
+	EXPECT_TRUE(PropertyKey().empty());
+
+	// keys and names refer to the same property
+	Candidate candidate;
+	candidate.setProperty(key, 42.);
+	EXPECT_TRUE(candidate.hasProperty("foo"));
+	EXPECT_DOUBLE_EQ(42., candidate.getProperty(key).asDouble());
+	ref_ptr<Candidate> cloned = candidate.clone();
+	EXPECT_TRUE(cloned->hasProperty(key));
+	EXPECT_TRUE(candidate.removeProperty("foo"));
+	EXPECT_FALSE(candidate.hasProperty(key));
+}
+
 TEST(Candidate, addSecondary) {
 	Candidate c;
 	c.setRedshift(5);
@@ -219,6 +272,84 @@ TEST(Candidate, addSecondary) {
 	EXPECT_TRUE(Vector3d(0,0,1) == s.created.getDirection());
 }
 
+TEST(Candidate, inlineSecondaries) {
+	// a few secondaries are stored inline, clearing keeps the heap storage
+	ref_ptr<Candidate> c = new Candidate(nucleusId(56, 26), 1000 * EeV);
+	for (int i = 0; i < 4; i++)
+		c->addSecondary(22, (i + 1) * EeV);
+	EXPECT_TRUE(c->secondaries.isInline());
+	for (int i = 4; i < 20; i++)
+		c->addSecondary(22, (i + 1) * EeV);
+	EXPECT_FALSE(c->secondaries.isInline());
+	ASSERT_EQ(20, c->secondaries.size());
+	for (int i = 0; i < 20; i++)
+		EXPECT_DOUBLE_EQ((i + 1) * EeV, c->secondaries[i]->current.getEnergy());
+	EXPECT_EQ(c.get(), c->secondaries.back()->parent);
+
+	size_t capacity = c->secondaries.capacity();
+	c->clearSecondaries();
+	EXPECT_TRUE(c->secondaries.empty());
+	EXPECT_EQ(capacity, c->secondaries.capacity());
+
+	c->addSecondary(22, 1 * EeV);
+	ref_ptr<Candidate> cloned = c->clone(true);
+	EXPECT_EQ(1, cloned->secondaries.size());
+	EXPECT_TRUE(cloned->secondaries.isInline());
+}
+
+TEST(SmallVector, copyAndMove) {
+	SmallVector<std::string, 2> v;
+	v.push_back("a");
+	v.push_back("b");
+	EXPECT_EQ(2, v.capacity());
+	v.push_back(v[0]); // an element of the vector itself
+	EXPECT_FALSE(v.isInline());
+	EXPECT_EQ("a", v.back());
+
+	SmallVector<std::string, 2> copy(v);
+	EXPECT_EQ(3, copy.size());
+	EXPECT_EQ("b", copy[1]);
+	SmallVector<std::string, 2> moved(std::move(copy));
+	EXPECT_TRUE(copy.empty());
+	EXPECT_EQ("a", moved[2]);
+
+	SmallVector<std::string, 2> small;
+	small.push_back("c");
+	moved = std::move(small);
+	EXPECT_TRUE(moved.isInline());
+	EXPECT_EQ(1, moved.size());
+	EXPECT_EQ("c", moved.front());
+	moved.pop_back();
+	EXPECT_TRUE(moved.empty());
+	EXPECT_THROW(moved.at(0), std::out_of_range);
+}
+
+TEST(Candidate, secondaryWeight) {
+	// Test if the weight of a secondary is relative to its parent
+	Candidate c;
+	c.setWeight(4);
+	c.addSecondary(22, 1 * EeV);
+	c.addSecondary(22, 1 * EeV, Vector3d(0, 0, 0), 2.5);
+	EXPECT_DOUBLE_EQ(4, c.secondaries[0]->getWeight());
+	EXPECT_DOUBLE_EQ(10, c.secondaries[1]->getWeight());
+}
+
+
+TEST(Candidate, sharedStates) {
+	ref_ptr<Candidate> c = new Candidate(nucleusId(56, 26), 1000 * EeV);
+	c->addSecondary(nucleusId(1, 1), 10 * EeV);
+	c->addSecondary(nucleusId(1, 1), 20 * EeV);
+	Candidate *s1 = c->secondaries[0], *s2 = c->secondaries[1];
+	EXPECT_TRUE(s1->source.isSharedWith(c->source));
+	EXPECT_TRUE(s1->created.isSharedWith(s2->created));
+
+	// modifying a shared state copies it
+	s1->source.setEnergy(1 * EeV);
+	EXPECT_FALSE(s1->source.isSharedWith(c->source));
+	EXPECT_DOUBLE_EQ(1000 * EeV, c->source.getEnergy());
+	EXPECT_DOUBLE_EQ(1000 * EeV, s2->source.getEnergy());
+	EXPECT_DOUBLE_EQ(1 * EeV, s1->source.getEnergy());
+}
 
 TEST(Candidate, serialNumber) {
 	Candidate::setNextSerialNumber(42);
@@ -226,6 +357,77 @@ TEST(Candidate, serialNumber) {
 	EXPECT_EQ(43, c.getSourceSerialNumber());
 }
 
+TEST(Candidate, serialNumberBlocks) {
+	Candidate::setNextSerialNumber(100);
+	std::vector<uint64_t> numbers(1000);
+#pragma omp parallel for
+	for (int i = 0; i < 1000; i++) {
+		Candidate c;
+		numbers[i] = c.getSerialNumber();
+	}
+	// unique and above the requested start
+	std::sort(numbers.begin(), numbers.end());
+	EXPECT_TRUE(std::unique(numbers.begin(), numbers.end()) == numbers.end());
+	EXPECT_LT(100, numbers[0]);
+
+	// outside of parallel regions numbers are assigned one by one
+	Candidate::setNextSerialNumber(42);
+	Candidate c;
+	EXPECT_EQ(43, c.getSerialNumber());
+	EXPECT_EQ(43, Candidate::getNextSerialNumber());
+}
+
+TEST(Candidate, threadConfined) {
+	ref_ptr<Candidate> c = new Candidate();
+	c->setThreadConfined(true);
+	EXPECT_TRUE(c->isThreadConfined());
+	EXPECT_EQ(1, c->getReferenceCount());
+	{
+		ref_ptr<Candidate> other = c;
+		EXPECT_EQ(2, c->getReferenceCount());
+	}
+	EXPECT_EQ(1, c->getReferenceCount());
+
+	// inherited by secondaries
+	c->addSecondary(22, 1 * EeV);
+	EXPECT_TRUE(c->secondaries[0]->isThreadConfined());
+	c->setThreadConfined(false);
+	EXPECT_FALSE(c->isThreadConfined());
+	EXPECT_EQ(1, c->getReferenceCount());
+}
+
+TEST(Candidate, pool) {
+	Candidate::clearPool();
+	ref_ptr<Candidate> c = new Candidate(nucleusId(1, 1), 1 * EeV);
+	for (int i = 0; i < 10; i++)
+		c->addSecondary(22, 1 * EeV);
+	EXPECT_EQ(0, Candidate::getPoolSize());
+
+	// released secondaries are kept for reuse
+	c->clearSecondaries();
+	EXPECT_EQ(10, Candidate::getPoolSize());
+	c->addSecondary(22, 1 * EeV);
+	EXPECT_EQ(9, Candidate::getPoolSize());
+	EXPECT_EQ(nucleusId(1, 1), c->secondaries[0]->source.getId());
+	c->clearSecondaries();
+	EXPECT_EQ(10, Candidate::getPoolSize());
+
+	Candidate::clearPool();
+	EXPECT_EQ(0, Candidate::getPoolSize());
+}
+
+TEST(common, instructionSet) {
+	std::string s = getInstructionSet();
+	EXPECT_TRUE((s == "avx512f") || (s == "avx2") || (s == "neon") || (s == "default"));
+
+	// the kernels give the same random numbers on every instruction set
+	Random a(7), b(7);
+	std::vector<double> bulk(1000);
+	a.fill(&bulk[0], bulk.size());
+	for (size_t i = 0; i < bulk.size(); i++)
+		EXPECT_EQ(b.rand(), bulk[i]);
+}
+
 TEST(common, digit) {
 	EXPECT_EQ(1, digit(1234, 1000));
 	EXPECT_EQ(2, digit(1234, 100));
@@ -268,6 +470,62 @@ TEST(common, interpolate) {
 
 	// value out of range, return upper bound
 	EXPECT_EQ(7, interpolate(2.001, xD, yD));
+
+	// the same from arrays
+	for (int i = 0; i < 100; i++) {
+		x = -0.1 + i * 0.022;
+		EXPECT_EQ(interpolate(x, xD, yD), interpolate(x, &xD[0], &yD[0], xD.size()));
+	}
+}
+
+TEST(common, interpolateWithHint) {
+	// the cell hint gives the same results as the search, for any hint
+	std::vector<double> X(11), Y(5), Z(55), V(11);
+	for (int i = 0; i < 11; i++) {
+		X[i] = i * i;
+		V[i] = sin(i);
+		for (int j = 0; j < 5; j++)
+			Z[i * 5 + j] = cos(i) + j * j;
+	}
+	for (int j = 0; j < 5; j++)
+		Y[j] = 0.5 * j;
+
+	size_t i = 0, j = 0;
+	Random &R = Random::instance();
+	for (int k = 0; k < 1000; k++) {
+		double x = R.rand() * 110 - 5;
+		double y = R.rand() * 2.4 - 0.2;
+		EXPECT_EQ(interpolate(x, X, V), interpolate(x, X, V, i));
+		EXPECT_EQ(interpolate2d(x, y, X, Y, Z), interpolate2d(x, y, X, Y, Z, i, j));
+	}
+}
+
+TEST(common, LogUniformTable) {
+	// the direct indexing gives the results of the search
+	std::vector<double> Y;
+	LogUniformTable X, Xnon;
+	for (int i = 0; i < 50; i++) {
+		X.push_back(pow(10, 10 + 0.1 * i));
+		Xnon.push_back(pow(10, 10 + 0.1 * i + 0.001 * i * i));
+		Y.push_back(sin(i));
+	}
+	EXPECT_TRUE(X.isUniform());
+	EXPECT_FALSE(Xnon.isUniform());
+
+	Random &R = Random::instance();
+	for (int k = 0; k < 1000; k++) {
+		double x = pow(10, 9.8 + R.rand() * 5.3);
+		EXPECT_EQ(interpolate(x, X.values(), Y), X.interpolate(x, Y));
+		EXPECT_EQ(closestIndex(x, X.values()), X.closestIndex(x));
+		EXPECT_EQ(interpolate(x, Xnon.values(), Y), Xnon.interpolate(x, Y));
+		EXPECT_EQ(closestIndex(x, Xnon.values()), Xnon.closestIndex(x));
+	}
+
+	// tabulation points themselves
+	for (int i = 0; i < 50; i++) {
+		EXPECT_EQ(interpolate(X[i], X.values(), Y), X.interpolate(X[i], Y));
+		EXPECT_EQ(i, X.closestIndex(X[i]));
+	}
 }
 
 TEST(common, interpolateEquidistant) {
@@ -391,7 +649,359 @@ TEST(Random, base64Seed) {
 	}
 }
 
+TEST(Random, randInt64) {
+	// both halves are random, the range includes n
+	Random r;
+	r.seed(42);
+	uint64_t low = 0, high = 0;
+	bool reachedN = false;
+	for (int i = 0; i < 1000; i++) {
+		uint64_t x = r.randInt64();
+		low |= x & 0xffffffffULL;
+		high |= x >> 32;
+		uint64_t y = r.randInt64(3);
+		EXPECT_LE(y, 3);
+		reachedN |= (y == 3);
+	}
+	EXPECT_EQ(0xffffffffULL, low);
+	EXPECT_EQ(0xffffffffULL, high);
+	EXPECT_TRUE(reachedN);
+}
+
+TEST(Random, copy) {
+	// the copy draws from its own state, also after the original is gone
+	Random *a = new Random(5);
+	a->rand();
+	Random b(*a);
+	Random c;
+	c = *a;
+	std::vector<double> expected;
+	for (int i = 0; i < 1000; i++)
+		expected.push_back(a->rand());
+	delete a;
+	for (int i = 0; i < 1000; i++) {
+		EXPECT_EQ(expected[i], b.rand());
+		EXPECT_EQ(expected[i], c.rand());
+	}
+}
 
+TEST(Random, saveLoadThreads) {
+	Random::seedThreads(42);
+	Random &a = Random::instance();
+	a.rand();
+	std::stringstream ss;
+	Random::saveThreads(ss);
+	double r1 = a.rand();
+	Random::loadThreads(ss);
+	double r2 = a.rand();
+	EXPECT_EQ(r1, r2);
+}
+
+#ifdef _OPENMP
+TEST(Random, nestedThreads) {
+	// Test if the threads of nested parallel regions get their own generators
+	int levels = omp_get_max_active_levels();
+	omp_set_max_active_levels(2);
+	Random::seedThreads(3);
+	std::vector<Random *> generators(8, (Random *) 0);
+	std::vector<uint32_t> first(2, 0);
+	#pragma omp parallel num_threads(2)
+	{
+		int outer = omp_get_thread_num();
+		first[outer] = Random::instance().randInt();
+		#pragma omp parallel num_threads(4)
+		generators[4 * outer + omp_get_thread_num()] = &Random::instance();
+	}
+	omp_set_max_active_levels(levels);
+
+	// the calling thread keeps stream 0
+	EXPECT_EQ(Random(3).randInt(), first[0]);
+	EXPECT_NE(first[0], first[1]);
+	std::sort(generators.begin(), generators.end());
+	EXPECT_TRUE(generators[0] != 0);
+	EXPECT_TRUE(std::unique(generators.begin(), generators.end()) == generators.end());
+}
+#endif
+
+TEST(Random, jump) {
+	// Test if a jump gives the same state as drawing the numbers
+	Random a(21), b(21);
+	a.randInt();
+	b.randInt();
+	size_t steps[3] = {100, 20000, 123457};
+	for (int i = 0; i < 3; i++) {
+		a.jump(steps[i]);
+		for (size_t j = 0; j < steps[i]; j++)
+			b.randInt();
+		EXPECT_EQ(b.randInt(), a.randInt());
+	}
+
+	a.seedCounter(5, 6);
+	b.seedCounter(5, 6);
+	a.randInt();
+	a.jump(10);
+	for (size_t j = 0; j < 11; j++)
+		b.randInt();
+	EXPECT_EQ(b.randInt(), a.randInt());
+	EXPECT_THROW(a.jumpStreams(1), std::runtime_error);
+
+	// streams of the threads
+	a.seed(8);
+	b.seed(8);
+	a.jumpStreams(2);
+	b.jumpStreams(1);
+	b.jumpStreams(1);
+	EXPECT_EQ(b.randInt(), a.randInt());
+
+	Random::seedThreadsDisjoint(8, 1);
+	Random &r = Random::instance();
+	a.seed(8);
+	a.jumpStreams(uint64_t(1) << 32);
+	for (size_t j = 0; j < 10; j++)
+		EXPECT_EQ(a.randInt(), r.randInt());
+	EXPECT_EQ(1, Random::getSeedThreads()[0].size());
+	EXPECT_EQ(8, Random::getSeedThreads()[0][0]);
+}
+
+TEST(Random, bulkGeneration) {
+	// Test if the bulk numbers continue the sequence of the single calls
+	Random a(11), b(11);
+	std::vector<double> x(1000);
+	a.fill(&x[0], 1000); // crosses a reload of the state
+	for (size_t i = 0; i < 1000; i++)
+		EXPECT_EQ(b.rand(), x[i]);
+	EXPECT_EQ(b.randInt(), a.randInt());
+
+	std::vector<uint32_t> k(10);
+	a.seedCounter(1, 2);
+	b.seedCounter(1, 2);
+	a.fillInt(&k[0], 10);
+	for (size_t i = 0; i < 10; i++)
+		EXPECT_EQ(b.randInt(), k[i]);
+
+	// moments of the distributions
+	size_t n = 100001;
+	std::vector<double> y(n);
+	a.seed(3);
+	a.fillNorm(&y[0], n, 2, 3);
+	double sum = 0, sum2 = 0;
+	for (size_t i = 0; i < n; i++) {
+		sum += y[i];
+		sum2 += (y[i] - 2) * (y[i] - 2);
+	}
+	EXPECT_NEAR(2, sum / n, 0.05);
+	EXPECT_NEAR(9, sum2 / n, 0.15);
+
+	a.fillExponential(&y[0], n);
+	sum = 0;
+	for (size_t i = 0; i < n; i++) {
+		EXPECT_GT(y[i], 0);
+		sum += y[i];
+	}
+	EXPECT_NEAR(1, sum / n, 0.02);
+}
+
+TEST(Random, aliasTable) {
+	// Test if the alias table reproduces the distribution of randBin
+	std::vector<double> cdf;
+	cdf.push_back(0); // leading bin without weight
+	cdf.push_back(1);
+	cdf.push_back(1); // zero width bin
+	cdf.push_back(4);
+	cdf.push_back(10);
+	AliasTable table(cdf);
+	EXPECT_EQ(5, table.size());
+
+	// sample at the bin borders of the uniform random number
+	std::vector<int> count(5, 0);
+	size_t n = 100000;
+	for (size_t i = 0; i < n; i++)
+		count[table.sample((i + 0.5) / n)]++;
+	EXPECT_EQ(0, count[0]);
+	EXPECT_EQ(0, count[2]);
+	EXPECT_NEAR(0.1, count[1] / double(n), 1e-4);
+	EXPECT_NEAR(0.3, count[3] / double(n), 1e-4);
+	EXPECT_NEAR(0.6, count[4] / double(n), 1e-4);
+
+	// a distribution without weight gives the first bin, as randBin
+	AliasTable empty(std::vector<double>(3, 0.));
+	EXPECT_EQ(0, empty.sample(0.7));
+	EXPECT_THROW(AliasTable(std::vector<double>()), std::runtime_error);
+
+	// rows of independent distributions in one table
+	std::vector<double> rows(cdf);
+	rows.push_back(0);
+	rows.push_back(0);
+	rows.push_back(0);
+	rows.push_back(0);
+	rows.push_back(1); // only the last bin
+	AliasTable grid;
+	grid.setCDF(rows, 2);
+	EXPECT_EQ(5, grid.size());
+	EXPECT_EQ(2, grid.rows());
+	for (size_t i = 0; i < 10; i++) {
+		EXPECT_EQ(table.sample(i / 10.), grid.sample(0, i / 10.));
+		EXPECT_EQ(4, grid.sample(1, i / 10.));
+	}
+	EXPECT_THROW(grid.setCDF(rows, 3), std::runtime_error);
+	EXPECT_EQ(10 * sizeof(AliasTable::Bin), grid.getMemory());
+}
+
+TEST(Random, lazyAliasTable) {
+	// Test if the table is rebuilt when sampled after adding bins
+	LazyAliasTable table;
+	EXPECT_TRUE(table.empty());
+	EXPECT_THROW(table.sample(0.5), std::runtime_error);
+	table.add(1);
+	EXPECT_EQ(0, table.sample(0.99));
+	table.add(0);
+	table.add(3);
+	EXPECT_EQ(3, table.getCDF().size());
+	EXPECT_DOUBLE_EQ(4, table.getCDF()[2]);
+
+	std::vector<int> count(3, 0);
+	int n = 1000;
+	#pragma omp parallel for
+	for (int i = 0; i < n; i++) {
+		size_t bin = table.sample((i + 0.5) / n);
+		#pragma omp atomic
+		count[bin]++;
+	}
+	EXPECT_EQ(250, count[0]);
+	EXPECT_EQ(0, count[1]);
+	EXPECT_EQ(750, count[2]);
+
+	// rows of equal size
+	LazyAliasTable rows;
+	rows.addRow(std::vector<double>(2, 1.)); // only the first bin
+	std::vector<double> second(2, 0.);
+	second[1] = 1;
+	rows.addRow(second);
+	EXPECT_EQ(0, rows.sample(0, 0.9));
+	EXPECT_EQ(1, rows.sample(1, 0.1));
+	EXPECT_THROW(rows.addRow(std::vector<double>(3, 1.)), std::runtime_error);
+	EXPECT_THROW(rows.add(1), std::runtime_error);
+}
+
+TEST(Random, counterBased) {
+	// Test Philox4x32-10 against the known answer for key and counter 0
+	Random r;
+	EXPECT_FALSE(r.isCounterBased());
+	r.seedCounter(0, 0);
+	EXPECT_TRUE(r.isCounterBased());
+	EXPECT_EQ(0x6627e8d5, r.randInt());
+	EXPECT_EQ(0xe169c58d, r.randInt());
+	EXPECT_EQ(0xbc57ac4c, r.randInt());
+	EXPECT_EQ(0x9b00dbd8, r.randInt());
+
+	// same key and stream give the same numbers, on any generator
+	Random a(1), b(2);
+	a.seedCounter(42, 7);
+	b.seedCounter(42, 7);
+	for (int i = 0; i < 10; i++)
+		EXPECT_EQ(a.rand(), b.rand());
+	b.seedCounter(42, 8);
+	a.seedCounter(42, 7);
+	EXPECT_NE(a.randInt(), b.randInt());
+
+	// seeding again switches back to the Mersenne Twister
+	a.seed(5);
+	b.seed(5);
+	EXPECT_FALSE(a.isCounterBased());
+	EXPECT_EQ(b.randInt(), a.randInt());
+}
+
+TEST(Lock, parallelSum) {
+	Lock lock("testLock");
+	LockProfile::reset();
+	long sum = 0;
+#pragma omp parallel for
+	for (int i = 0; i < 1000; i++) {
+		ScopedLock l(lock);
+		sum += i;
+	}
+	EXPECT_EQ(499500, sum);
+
+	std::string report = LockProfile::getReport();
+	if (LockProfile::isEnabled())
+		EXPECT_NE(std::string::npos, report.find("testLock"));
+	else
+		EXPECT_NE(std::string::npos, report.find("ENABLE_LOCK_PROFILING"));
+
+	// locks of the same name share a site
+	EXPECT_EQ(LockProfile::addSite("testLock"), LockProfile::addSite("testLock"));
+	EXPECT_NE(LockProfile::addSite("testLock"), LockProfile::addSite("otherLock"));
+}
+
+TEST(MemoryAccounting, owners) {
+	long long before = MemoryAccounting::getBytes("Grid");
+	{
+		ref_ptr<ScalarGrid> grid = new ScalarGrid(Vector3d(0.), 16, 1.);
+		EXPECT_EQ(before + 16 * 16 * 16 * sizeof(float), MemoryAccounting::getBytes("Grid"));
+		// a copy holds the same bytes
+		ScalarGrid copy(*grid);
+		EXPECT_EQ(before + 2 * 16 * 16 * 16 * sizeof(float), MemoryAccounting::getBytes("Grid"));
+		EXPECT_GE(MemoryAccounting::getPeakBytes("Grid"), MemoryAccounting::getBytes("Grid"));
+	}
+	EXPECT_EQ(before, MemoryAccounting::getBytes("Grid"));
+	EXPECT_EQ(0, MemoryAccounting::getBytes("unknown category"));
+	EXPECT_NE(std::string::npos, MemoryAccounting::getReport().find("Grid"));
+
+	MemoryAccounting::resetPeaks();
+	long live = MemoryAccounting::getLiveCandidates();
+	{
+		std::vector<ref_ptr<Candidate> > candidates;
+		for (size_t i = 0; i < 10; i++)
+			candidates.push_back(new Candidate());
+		EXPECT_EQ(live + 10, MemoryAccounting::getLiveCandidates());
+	}
+	EXPECT_EQ(live, MemoryAccounting::getLiveCandidates());
+	EXPECT_GE(MemoryAccounting::getCandidateThreads(), 1);
+	EXPECT_NE(std::string::npos, MemoryAccounting::getReport().find("Candidates"));
+}
+
+TEST(PhotonFieldScaling, analytic) {
+	// Test the photon fields that need no scaling table
+	PhotonFieldScaling cmb(CMB);
+	EXPECT_EQ(CMB, cmb.getPhotonField());
+	EXPECT_DOUBLE_EQ(1, cmb.scalingFactor(0));
+	EXPECT_DOUBLE_EQ(1, cmb.scalingFactor(10));
+
+	PhotonFieldScaling urb(URB_Protheroe96);
+	EXPECT_DOUBLE_EQ(1, urb.scalingFactor(0.5));
+	EXPECT_DOUBLE_EQ(pow(1.8 / 3, 4), urb.scalingFactor(2));
+	EXPECT_DOUBLE_EQ(0, urb.scalingFactor(7));
+	EXPECT_DOUBLE_EQ(urb.scalingFactor(2), photonFieldScaling(URB_Protheroe96, 2));
+}
+
+TEST(CustomPhotonField, registerAndScale) {
+	// Test the interpolation, the registration and the redshift scaling
+	std::vector<double> e, n;
+	e.push_back(1e-3 * eV);
+	e.push_back(1e-1 * eV);
+	n.push_back(1e6);
+	n.push_back(1e2);
+	ref_ptr<CustomPhotonField> field = new CustomPhotonField("custom test", e, n);
+	EXPECT_NEAR(1e4, field->getDensity(1e-2 * eV), 1e-6);
+	EXPECT_DOUBLE_EQ(0, field->getDensity(1 * eV));
+	std::string hash = field->getHash();
+
+	std::vector<double> z, s;
+	z.push_back(0);
+	z.push_back(1);
+	s.push_back(1);
+	s.push_back(3);
+	field->setRedshiftScaling(z, s);
+	EXPECT_NE(hash, field->getHash());
+
+	PhotonField id = registerPhotonField(field);
+	EXPECT_GT(id, URB_Protheroe96);
+	EXPECT_EQ(id, registerPhotonField(field));
+	EXPECT_EQ("custom test", photonFieldName(id));
+	EXPECT_DOUBLE_EQ(2, photonFieldScaling(id, 0.5));
+	EXPECT_FALSE(getCustomPhotonField(CMB).valid());
+	EXPECT_THROW(photonFieldTable(id, "PhotoDisintegration", "rate"), std::runtime_error);
+}
 
 TEST(Grid, PeriodicClamp) {
 	// Test correct determination of lower and upper neighbor
@@ -406,6 +1016,91 @@ TEST(Grid, PeriodicClamp) {
 	EXPECT_EQ(1, hi);
 }
 
+TEST(Grid, ReflectiveClamp) {
+	// the closed form agrees with repeated reflections, also far outside
+	int lo, hi;
+	double xs[6] = {3.4, 8.7, 23.12, -23.12, -0.5, 1e6 + 0.25};
+	for (int i = 0; i < 6; i++) {
+		double x = xs[i];
+		while ((x < 0) or (x > 8))
+			x = 2 * 8 * (x > 8) - x;
+		reflectiveClamp(xs[i], 8, lo, hi);
+		EXPECT_EQ(int(floor(x)), lo);
+		EXPECT_EQ(std::min(lo + 1, 7), hi);
+	}
+	reflectiveClamp(8, 8, lo, hi);
+	EXPECT_EQ(7, lo);
+	EXPECT_EQ(7, hi);
+
+	ScalarGrid grid(Vector3d(0.), 4, 1);
+	grid.setReflective(true);
+	grid.get(1, 2, 3) = 5;
+	// (1, 2, 3) after 1000 periods of 2 * 4 points, x mirrored
+	EXPECT_FLOAT_EQ(5, grid.closestValue(Vector3d(8000 - 1 + 0.5, -8000 + 2 + 0.5, 8000 + 3 + 0.5)));
+	EXPECT_FLOAT_EQ(grid.interpolate(Vector3d(1.7, 2.5, 3.5)),
+			grid.interpolate(Vector3d(8000 + 1.7, 2.5, 3.5)));
+}
+
+TEST(ScalarGrid, Tricubic) {
+	// grid points are reproduced, smooth fields are more accurate than trilinear
+	size_t n = 16;
+	ScalarGrid grid(Vector3d(0.), n, 1);
+	for (size_t ix = 0; ix < n; ix++)
+		for (size_t iy = 0; iy < n; iy++)
+			for (size_t iz = 0; iz < n; iz++)
+				grid.get(ix, iy, iz) = sin(2 * M_PI * (ix + 0.5) / n) * cos(2 * M_PI * (iz + 0.5) / n);
+	EXPECT_NEAR(grid.get(3, 5, 7), grid.interpolateTricubic(Vector3d(3.5, 5.5, 7.5)), 1e-6);
+
+	double linear = 0, cubic = 0;
+	for (int i = 0; i < 100; i++) {
+		Vector3d x(0.37 * i, 0.11 * i, 0.29 * i - 9);
+		double exact = sin(2 * M_PI * x.x / n) * cos(2 * M_PI * x.z / n);
+		linear = std::max(linear, fabs(grid.interpolate(x) - exact));
+		cubic = std::max(cubic, fabs(grid.interpolateTricubic(x) - exact));
+	}
+	EXPECT_LT(cubic, linear / 4);
+
+	// mirrored at the point n, as closestValue
+	grid.setReflective(true);
+	EXPECT_NEAR(grid.interpolateTricubic(Vector3d(3.2, 5.5, 7.5)),
+			grid.interpolateTricubic(Vector3d(2 * n + 1 - 3.2, 5.5, 7.5)), 1e-6);
+}
+
+TEST(SimulationBundle, tablesAndGrids) {
+	// the bundled table and grid are used instead of the deleted files
+	{
+		std::ofstream out("testBundleTable.txt");
+		out << "# x y\n1 2\n3 4 5\n";
+	}
+	ref_ptr<DataTable> table = DataTable::open("testBundleTable.txt");
+	std::vector<std::string> names = DataTable::getFilenames();
+	EXPECT_TRUE(std::find(names.begin(), names.end(), "testBundleTable.txt") != names.end());
+	ref_ptr<ScalarGrid> grid = new ScalarGrid(Vector3d(0.), 4, 1);
+	grid->get(1, 2, 3) = 7;
+	dumpGrid(grid, "testBundleGrid.raw");
+	SimulationBundle::create("testBundle.bin", std::vector<std::string>(1, "testBundleGrid.raw"));
+	table = 0;
+	std::remove("testBundleTable.txt");
+	std::remove("testBundleTable.txt.bin");
+	std::remove("testBundleGrid.raw");
+
+	SimulationBundle::open("testBundle.bin");
+	table = DataTable::open("testBundleTable.txt");
+	ASSERT_TRUE(table.valid());
+	EXPECT_EQ(2, table->size());
+	EXPECT_EQ(3, table->rowSize(1));
+	EXPECT_DOUBLE_EQ(5, table->get(1, 2));
+	ref_ptr<ScalarGrid> mapped = new ScalarGrid(Vector3d(0.), 4, 1);
+	mapGrid(mapped, "testBundleGrid.raw");
+	EXPECT_FLOAT_EQ(7, mapped->get(1, 2, 3));
+	EXPECT_FALSE(SimulationBundle::getFile("testBundleTable.txt").valid());
+
+	SimulationBundle::close();
+	EXPECT_FALSE(SimulationBundle::getTable("testBundleTable.txt").valid());
+	EXPECT_FLOAT_EQ(7, mapped->get(1, 2, 3));
+	std::remove("testBundle.bin");
+}
+
 TEST(ScalarGrid, SimpleTest) {
 	// Test construction and parameters
 	size_t Nx = 5;
@@ -499,6 +1194,126 @@ TEST(VectorGrid, Interpolation) {
 	EXPECT_FLOAT_EQ(1.7 * 0.9 * 0.15, b.x);
 }
 
+TEST(VectorGrid, InterpolationBatch) {
+	// batched interpolation gives the same values as single positions
+	VectorGrid grid(Vector3d(0.), 4, 1);
+	for (int ix = 0; ix < 4; ix++)
+		for (int iy = 0; iy < 4; iy++)
+			for (int iz = 0; iz < 4; iz++)
+				grid.get(ix, iy, iz) = Vector3f(ix, iy * iz, 1);
+
+	std::vector<Vector3d> positions;
+	for (int i = 0; i < 20; i++)
+		positions.push_back(Vector3d(0.37 * i - 2, 1.1 * i, -0.49 * i));
+	std::vector<Vector3f> values(positions.size());
+	grid.interpolate(&positions[0], &values[0], positions.size());
+	for (size_t i = 0; i < positions.size(); i++)
+		EXPECT_TRUE(grid.interpolate(positions[i]) == values[i]);
+}
+
+TEST(VectorGrid, Bricked) {
+	// the bricked layout gives the same values as the row-major layout
+	VectorGrid rowMajor(Vector3d(0.), 5, 6, 7, 1.);
+	for (int ix = 0; ix < 5; ix++)
+		for (int iy = 0; iy < 6; iy++)
+			for (int iz = 0; iz < 7; iz++)
+				rowMajor.get(ix, iy, iz) = Vector3f(ix, iy * iz, ix - iz);
+
+	VectorGrid bricked = rowMajor;
+	bricked.setBricked(true);
+	EXPECT_TRUE(bricked.isBricked());
+	EXPECT_EQ(2 * 2 * 2 * 64, bricked.getGrid().size());
+	for (int i = 0; i < 30; i++) {
+		Vector3d pos(0.37 * i - 2, 1.1 * i, -0.49 * i);
+		EXPECT_TRUE(rowMajor.interpolate(pos) == bricked.interpolate(pos));
+	}
+
+	// storage index and grid point agree
+	for (int ix = 0; ix < 5; ix++)
+		for (int iy = 0; iy < 6; iy++)
+			for (int iz = 0; iz < 7; iz++) {
+				size_t i = &bricked.get(ix, iy, iz) - &bricked.getGrid()[0];
+				EXPECT_TRUE(Vector3d(ix, iy, iz) + 0.5 == bricked.positionFromIndex(i));
+			}
+
+	// back to row-major
+	bricked.setBricked(false);
+	EXPECT_EQ(5 * 6 * 7, bricked.getGrid().size());
+	for (size_t i = 0; i < bricked.getGrid().size(); i++)
+		EXPECT_TRUE(rowMajor.getGrid()[i] == bricked.getGrid()[i]);
+}
+
+TEST(VectorGrid, Quantized) {
+	// quantized values interpolate to the original values up to the quantum
+	ref_ptr<VectorGrid> grid = new VectorGrid(Vector3d(0.), 4, 1);
+	for (int ix = 0; ix < 4; ix++)
+		for (int iy = 0; iy < 4; iy++)
+			for (int iz = 0; iz < 4; iz++)
+				grid->get(ix, iy, iz) = Vector3f(ix, -iy * iz, 0.01 * iz);
+
+	ref_ptr<QuantizedVectorGrid> q = quantizeGrid(grid);
+	EXPECT_DOUBLE_EQ(9. / 32767, q->getQuantum());
+	EXPECT_EQ(-32767, q->get(1, 3, 3).y);
+	for (int i = 0; i < 20; i++) {
+		Vector3d pos(0.37 * i - 2, 1.1 * i, -0.49 * i);
+		Vector3f b1 = grid->interpolate(pos);
+		Vector3f b2 = q->interpolate(pos);
+		EXPECT_NEAR(b1.x, b2.x, q->getQuantum());
+		EXPECT_NEAR(b1.y, b2.y, q->getQuantum());
+		EXPECT_NEAR(b1.z, b2.z, q->getQuantum());
+	}
+}
+
+TEST(VectorGrid, Sparse) {
+	// a blob in a grid of 20x12x9 points: bricks of 8^3, partial at the edges
+	ref_ptr<VectorGrid> grid = new VectorGrid(Vector3d(0.), 20, 12, 9, 1.);
+	for (int ix = 14; ix < 20; ix++)
+		for (int iy = 0; iy < 3; iy++)
+			for (int iz = 7; iz < 9; iz++)
+				grid->get(ix, iy, iz) = Vector3f(ix, -iy, iz * iz);
+
+	SparseVectorGrid sparse(*grid);
+	EXPECT_EQ(4, sparse.getNumberOfBricks()); // x: 8-15 and 16-19, y: 0-7, z: 0-7 and 8
+	EXPECT_DOUBLE_EQ(4. / 12, sparse.getFillFactor());
+	for (int ix = 0; ix < 20; ix++)
+		for (int iy = 0; iy < 12; iy++)
+			for (int iz = 0; iz < 9; iz++)
+				EXPECT_TRUE(sparse.get(ix, iy, iz) == grid->get(ix, iy, iz));
+
+	// same interpolation, periodic and reflective, including the wrap-arounds
+	for (int r = 0; r < 2; r++) {
+		grid->setReflective(r);
+		sparse.setReflective(r);
+		Vector3d pos[50];
+		Vector3f b[50];
+		for (int i = 0; i < 50; i++)
+			pos[i] = Vector3d(0.83 * i - 5, -0.41 * i, 0.37 * i - 3);
+		sparse.interpolate(pos, b, 50);
+		for (int i = 0; i < 50; i++) {
+			Vector3f b1 = grid->interpolate(pos[i]);
+			EXPECT_FLOAT_EQ(b1.x, b[i].x);
+			EXPECT_FLOAT_EQ(b1.y, b[i].y);
+			EXPECT_FLOAT_EQ(b1.z, b[i].z);
+			EXPECT_TRUE(sparse.closestValue(pos[i]) == grid->closestValue(pos[i]));
+		}
+	}
+
+	// small values are dropped with a tolerance, and back to a dense grid
+	grid->get(1, 1, 1) = Vector3f(0.1, 0, 0);
+	EXPECT_EQ(5, SparseVectorGrid(*grid).getNumberOfBricks());
+	SparseVectorGrid coarse(*grid, 0.5);
+	EXPECT_EQ(4, coarse.getNumberOfBricks());
+	ref_ptr<VectorGrid> dense = coarse.toGrid();
+	EXPECT_FLOAT_EQ(0, dense->get(1, 1, 1).x);
+	EXPECT_FLOAT_EQ(64, dense->get(15, 2, 8).z);
+
+	// as the field of a MagneticFieldGrid
+	MagneticFieldGrid field(new SparseVectorGrid(*grid));
+	EXPECT_DOUBLE_EQ(grid->interpolate(Vector3d(17.2, 1.3, 7.6)).x,
+			field.getField(Vector3d(17.2, 1.3, 7.6)).x);
+	EXPECT_THROW(field.setTricubic(true), std::runtime_error);
+}
+
 TEST(VectordGrid, Scale) {
 	// Test scaling a field
 	ref_ptr<VectorGrid> grid = new VectorGrid(Vector3d(0.), 3, 1);
@@ -514,6 +1329,43 @@ TEST(VectordGrid, Scale) {
 				EXPECT_FLOAT_EQ(5, grid->interpolate(Vector3d(0.7, 0, 0.1)).x);
 }
 
+TEST(VectorGrid, Statistics) {
+	// mean and RMS of a known grid
+	ref_ptr<VectorGrid> grid = new VectorGrid(Vector3d(0.), 4, 5, 6, 1.);
+	ref_ptr<ScalarGrid> sgrid = new ScalarGrid(Vector3d(0.), 4, 5, 6, 1.);
+	for (int ix = 0; ix < 4; ix++)
+		for (int iy = 0; iy < 5; iy++)
+			for (int iz = 0; iz < 6; iz++) {
+				grid->get(ix, iy, iz) = Vector3f(ix % 2 ? 3 : -3, 4, 0);
+				sgrid->get(ix, iy, iz) = (iz % 2) ? 1 : 3;
+			}
+	Vector3f mean = meanFieldVector(grid);
+	EXPECT_FLOAT_EQ(0, mean.x);
+	EXPECT_FLOAT_EQ(4, mean.y);
+	EXPECT_FLOAT_EQ(5, meanFieldStrength(grid));
+	EXPECT_FLOAT_EQ(5, rmsFieldStrength(grid));
+	EXPECT_FLOAT_EQ(2, meanFieldStrength(sgrid));
+	EXPECT_FLOAT_EQ(sqrt(5.), rmsFieldStrength(sgrid));
+
+	// field strength sampled from a field
+	fromMagneticFieldStrength(sgrid, new MagneticFieldGrid(grid));
+	EXPECT_FLOAT_EQ(5, sgrid->get(1, 2, 3));
+	EXPECT_FLOAT_EQ(5, meanFieldStrength(sgrid));
+}
+
+TEST(VectorGrid, Interleave) {
+	// the memory policy may be unavailable, but the values must not change
+	ref_ptr<VectorGrid> grid = new VectorGrid(Vector3d(0.), 64, 1);
+	for (int ix = 0; ix < 64; ix++)
+		for (int iy = 0; iy < 64; iy++)
+			for (int iz = 0; iz < 64; iz++)
+				grid->get(ix, iy, iz) = Vector3f(ix, iy, iz);
+
+	interleaveGrid(grid);
+	EXPECT_EQ(Vector3f(1, 2, 3), grid->get(1, 2, 3));
+	EXPECT_EQ(Vector3f(63, 0, 10), grid->get(63, 0, 10));
+}
+
 TEST(VectorGrid, Periodicity) {
 	// Test for periodic boundaries: grid(x+a*n) = grid(x)
 	size_t n = 3;
@@ -569,6 +1421,37 @@ TEST(VectorGrid, DumpLoad) {
 	}
 }
 
+TEST(VectorGrid, DumpMap) {
+	// Dump a field grid and use the file as storage
+	ref_ptr<VectorGrid> grid1 = new VectorGrid(Vector3d(0.), 3, 4, 5, 1.);
+	ref_ptr<VectorGrid> grid2 = new VectorGrid(Vector3d(0.), 3, 4, 5, 1.);
+	for (int ix = 0; ix < 3; ix++)
+		for (int iy = 0; iy < 4; iy++)
+			for (int iz = 0; iz < 5; iz++)
+				grid1->get(ix, iy, iz) = Vector3f(ix, iy, iz);
+
+	dumpGrid(grid1, "testDump.raw");
+	mapGrid(grid2, "testDump.raw");
+	EXPECT_TRUE(grid2->isMapped());
+	EXPECT_TRUE(grid2->getGrid().empty());
+	for (int i = 0; i < 20; i++) {
+		Vector3d pos(0.37 * i - 2, 1.1 * i, -0.49 * i);
+		EXPECT_TRUE(grid1->interpolate(pos) == grid2->interpolate(pos));
+	}
+
+	// modifications stay in memory
+	scaleGrid(grid2, 2);
+	EXPECT_FLOAT_EQ(4, grid2->get(1, 2, 3).y);
+	ref_ptr<VectorGrid> grid3 = new VectorGrid(Vector3d(0.), 3, 4, 5, 1.);
+	mapGrid(grid3, "testDump.raw");
+	EXPECT_FLOAT_EQ(2, grid3->get(1, 2, 3).y);
+
+	// size mismatch
+	ref_ptr<VectorGrid> grid4 = new VectorGrid(Vector3d(0.), 3, 1);
+	EXPECT_THROW(mapGrid(grid4, "testDump.raw"), std::runtime_error);
+	EXPECT_THROW(mapGrid(grid4, "nonexistent.raw"), std::runtime_error);
+}
+
 TEST(VectorGrid, DumpLoadTxt) {
 	// Dump and load a field grid
 	ref_ptr<VectorGrid> grid1 = new VectorGrid(Vector3d(0.), 3, 1);
@@ -595,6 +1478,52 @@ TEST(VectorGrid, DumpLoadTxt) {
 	}
 }
 
+TEST(VectorGrid, LoadChecksum) {
+	// Load a grid of several chunks by all threads and verify the checksum
+	ref_ptr<VectorGrid> grid1 = new VectorGrid(Vector3d(0.), 70, 50, 30, 1.);
+	for (int ix = 0; ix < 70; ix++)
+		for (int iy = 0; iy < 50; iy++)
+			for (int iz = 0; iz < 30; iz++)
+				grid1->get(ix, iy, iz) = Vector3f(ix, iy, iz * 0.5);
+	dumpGrid(grid1, "testDump.raw");
+	uint64_t checksum = gridChecksum("testDump.raw");
+
+	ref_ptr<VectorGrid> grid2 = new VectorGrid(Vector3d(0.), 70, 50, 30, 1.);
+	loadGrid(grid2, "testDump.raw", 2, checksum);
+	EXPECT_FLOAT_EQ(138, grid2->get(69, 3, 29).x);
+	EXPECT_FLOAT_EQ(6, grid2->get(69, 3, 29).y);
+	EXPECT_FLOAT_EQ(29, grid2->get(69, 3, 29).z);
+	EXPECT_THROW(loadGrid(grid2, "testDump.raw", 1, checksum + 1), std::runtime_error);
+	EXPECT_THROW(loadGrid(grid2, "nonexistent.raw"), std::runtime_error);
+}
+
+TEST(ScalarGrid, LoadTxt) {
+	// Parse header lines, signs, exponents and values for strtod
+	std::ofstream out("testLoad.txt");
+	out << "# header\n# x y z\n1.5e-3 -2\n.25\t+4E2\n\n 1e30 -0.0000125 inf 7\n";
+	out.close();
+	ref_ptr<ScalarGrid> grid = new ScalarGrid(Vector3d(0.), 2, 1);
+	loadGridFromTxt(grid, "testLoad.txt");
+	EXPECT_FLOAT_EQ(1.5e-3, grid->get(0, 0, 0));
+	EXPECT_FLOAT_EQ(-2, grid->get(0, 0, 1));
+	EXPECT_FLOAT_EQ(0.25, grid->get(0, 1, 0));
+	EXPECT_FLOAT_EQ(400, grid->get(0, 1, 1));
+	EXPECT_FLOAT_EQ(1e30, grid->get(1, 0, 0));
+	EXPECT_FLOAT_EQ(-1.25e-5, grid->get(1, 0, 1));
+	EXPECT_TRUE(std::isinf(grid->get(1, 1, 0)));
+	EXPECT_FLOAT_EQ(7, grid->get(1, 1, 1));
+
+	out.open("testLoad.txt");
+	out << "1 2 3 x 5 6 7 8\n";
+	out.close();
+	EXPECT_THROW(loadGridFromTxt(grid, "testLoad.txt"), std::runtime_error);
+	out.open("testLoad.txt");
+	out << "1 2 3\n";
+	out.close();
+	EXPECT_THROW(loadGridFromTxt(grid, "testLoad.txt"), std::runtime_error);
+	std::remove("testLoad.txt");
+}
+
 TEST(VectorGrid, Speed) {
 	// Dump and load a field grid
 	VectorGrid grid(Vector3d(0.), 3, 3);
@@ -662,6 +1591,73 @@ TEST(EmissionMap, merge) {
 	EXPECT_TRUE(cpm->getPdf()[bin] > 0);
 }
 
+TEST(EmissionMap, saveBinary) {
+	EmissionMap em(36, 18, 10, 1 * EeV, 100 * EeV);
+	em.fillMap(1, 50 * EeV, Vector3d(1, 0, 0), 2);
+	em.fillMap(2, 5 * EeV, Vector3d(0, 1, 0));
+	// a dense map
+	CylindricalProjectionMap *dense = em.getMap(3, 5 * EeV);
+	for (size_t i = 0; i < dense->getPdf().size(); i++)
+		dense->fillBin(i, i + 1);
+	em.saveBinary("testEmissionMap.bin");
+
+	// the binning is taken from the file
+	EmissionMap loaded;
+	loaded.load("testEmissionMap.bin");
+	EXPECT_EQ(3, loaded.getMaps().size());
+	EXPECT_EQ(em.binFromEnergy(50 * EeV), loaded.binFromEnergy(50 * EeV));
+	ref_ptr<CylindricalProjectionMap> cpm = loaded.getMap(1, 50 * EeV);
+	EXPECT_EQ(36 * 18, cpm->getPdf().size());
+	EXPECT_DOUBLE_EQ(2, cpm->getPdf()[cpm->binFromDirection(Vector3d(1, 0, 0))]);
+	EXPECT_DOUBLE_EQ(2, cpm->getCdf().back());
+	EXPECT_EQ(dense->getPdf(), loaded.getMap(3, 5 * EeV)->getPdf());
+
+	// merge of several files, not into maps of another binning
+	std::vector<std::string> files(4, "testEmissionMap.bin");
+	EmissionMap merged(36, 18, 10, 1 * EeV, 100 * EeV);
+	merged.merge(files);
+	cpm = merged.getMap(1, 50 * EeV);
+	EXPECT_DOUBLE_EQ(8, cpm->getPdf()[cpm->binFromDirection(Vector3d(1, 0, 0))]);
+	EXPECT_DOUBLE_EQ(4 * dense->getCdf().back(), merged.getMap(3, 5 * EeV)->getCdf().back());
+	EmissionMap other(36, 18, 20, 1 * EeV, 100 * EeV);
+	EXPECT_THROW(other.merge(files), std::runtime_error);
+	std::remove("testEmissionMap.bin");
+
+#ifdef CRPROPA_HAVE_ZLIB
+	em.saveBinary("testEmissionMap.bin.gz");
+	EmissionMap unzipped;
+	unzipped.load("testEmissionMap.bin.gz");
+	std::remove("testEmissionMap.bin.gz");
+	EXPECT_EQ(3, unzipped.getMaps().size());
+	EXPECT_EQ(dense->getPdf(), unzipped.getMap(3, 5 * EeV)->getPdf());
+#endif
+}
+
+TEST(EmissionMap, fillMapOfThread) {
+	EmissionMap em(36, 18, 10, 1 * EeV, 100 * EeV);
+	ParticleState p(1, 50 * EeV, Vector3d(0.), Vector3d(1, 0, 0));
+#pragma omp parallel for
+	for (int i = 0; i < 1000; i++)
+		em.fillMapOfThread(p);
+
+	// the maps of the threads are merged when used
+	EXPECT_EQ(1, em.getMaps().size());
+	ref_ptr<CylindricalProjectionMap> cpm = em.getMap(1, 50 * EeV);
+	size_t bin = cpm->binFromDirection(Vector3d(1, 0, 0));
+	EXPECT_DOUBLE_EQ(1000, cpm->getPdf()[bin]);
+
+	// the frozen map draws from its only bin, also concurrently
+	em.freeze();
+	EXPECT_DOUBLE_EQ(1000, cpm->getCdf().back());
+	int inBin = 0;
+#pragma omp parallel for reduction(+:inBin)
+	for (int i = 0; i < 100; i++) {
+		Vector3d d;
+		if (em.drawDirection(p, d) && (cpm->binFromDirection(d) == bin))
+			inBin++;
+	}
+	EXPECT_EQ(100, inBin);
+}
 
 TEST(Variant, copyToBuffer)
 {
@@ -694,6 +1690,45 @@ TEST(Variant, stringConversion)
 	}
 }
 
+TEST(Variant, appendTo)
+{
+	// as formatted by a stream
+	std::string s;
+	Variant(true).appendTo(s);
+	Variant('x').appendTo(s);
+	Variant(int16_t(-3)).appendTo(s);
+	Variant(uint32_t(4000000000u)).appendTo(s);
+	Variant(int64_t(-12345678901LL)).appendTo(s);
+	Variant(1.5f).appendTo(s);
+	Variant(-2.25e-300).appendTo(s);
+	Variant("text").appendTo(s);
+	EXPECT_EQ("1x-34000000000-123456789011.500000e+00-2.250000e-300text", s);
+	EXPECT_EQ("-2.250000e-300", Variant(-2.25e-300).toString());
+}
+
+TEST(Variant, strings)
+{
+	Variant v("a short string");
+	Variant w(v);
+	EXPECT_TRUE(w.isString());
+	EXPECT_EQ("a short string", w.asString());
+	v = std::string(100, 'x');
+	w = v;
+	EXPECT_EQ(100, w.asString().size());
+	w = 5.;
+	EXPECT_TRUE(w == 5.);
+	w = std::string("again");
+	EXPECT_TRUE(w == std::string("again"));
+
+	// moved from variants are empty
+	Variant m(std::move(v));
+	EXPECT_EQ(std::string(100, 'x'), m.asString());
+	EXPECT_EQ(Variant::TYPE_NONE, v.getType());
+	w = std::move(m);
+	EXPECT_EQ(100, w.asString().size());
+	EXPECT_EQ(Variant::TYPE_NONE, m.getType());
+}
+
 
 TEST(Geometry, Plane)
 {
@@ -720,6 +1755,124 @@ TEST(Geometry, ParaxialBox)
 	EXPECT_NEAR(8., b.distance(Vector3d(-8., 0., 0.)), 1E-10);
 }
 
+TEST(Geometry, intersection)
+{
+	Vector3d x(1, 0, 0);
+	EXPECT_DOUBLE_EQ(1., Plane(Vector3d(2, 0, 0), Vector3d(1, 0, 0)).intersection(x, Vector3d(1, 0, 0)));
+	EXPECT_TRUE(std::isinf(Plane(Vector3d(2, 0, 0), Vector3d(1, 0, 0)).intersection(x, Vector3d(-1, 0, 0))));
+
+	Sphere s(Vector3d(0, 0, 0), 2.);
+	EXPECT_DOUBLE_EQ(1., s.intersection(x, Vector3d(1, 0, 0)));  // leaving
+	EXPECT_DOUBLE_EQ(3., s.intersection(x, Vector3d(-1, 0, 0)));
+	EXPECT_DOUBLE_EQ(2., s.intersection(Vector3d(-4, 0, 0), Vector3d(1, 0, 0)));  // entering
+	EXPECT_TRUE(std::isinf(s.intersection(Vector3d(-4, 3, 0), Vector3d(1, 0, 0))));
+
+	ParaxialBox b(Vector3d(0, 0, 0), Vector3d(3, 4, 5));
+	EXPECT_DOUBLE_EQ(2., b.intersection(x, Vector3d(1, 0, 0)));
+	EXPECT_DOUBLE_EQ(4.5, b.intersection(Vector3d(1, 1, 0.5), Vector3d(0, 0, 1)));
+	EXPECT_DOUBLE_EQ(9., b.intersection(Vector3d(12, 1, 1), Vector3d(-1, 0, 0)));
+	EXPECT_TRUE(std::isinf(b.intersection(Vector3d(12, 1, 1), Vector3d(0, 1, 0))));
+	// the ray step is never smaller than the distance
+	EXPECT_LE(-b.distance(x), b.intersection(x, Vector3d(0, 1, 1).getUnitVector()));
+}
+
+TEST(Geometry, TriangleMesh)
+{
+	// unit cube of quads, counter-clockwise seen from outside
+	std::string filename = "testTriangleMesh.obj";
+	{
+		std::ofstream out(filename.c_str());
+		for (int i = 0; i < 8; i++)
+			out << "v " << (i & 1) << " " << ((i >> 1) & 1) << " " << ((i >> 2) & 1) << "\n";
+		out << "f 1 3 4 2\nf 5 6 8 7\nf 1 2 6 5\nf 3 7 8 4\nf 1 5 7 3\nf 2 4 8 6\n";
+	}
+	TriangleMesh mesh(filename, 2.);
+	remove(filename.c_str());
+	EXPECT_EQ(12, mesh.getNumberOfTriangles());
+
+	Vector3d lower, upper;
+	EXPECT_TRUE(mesh.getBounds(lower, upper));
+	EXPECT_EQ(Vector3d(0, 0, 0), lower);
+	EXPECT_EQ(Vector3d(2, 2, 2), upper);
+
+	ParaxialBox box(Vector3d(0, 0, 0), Vector3d(2, 2, 2));
+	Random random(42);
+	for (int i = 0; i < 1000; i++) {
+		Vector3d x(random.randUniform(-1, 3), random.randUniform(-1, 3), random.randUniform(-1, 3));
+		EXPECT_NEAR(box.distance(x), mesh.distance(x), 1E-12);
+	}
+	EXPECT_NEAR(0, (mesh.normal(Vector3d(1, 1, 2.5)) - Vector3d(0, 0, 1)).getR(), 1E-12);
+	EXPECT_NEAR(0, (mesh.normal(Vector3d(0.2, 1, 1)) - Vector3d(-1, 0, 0)).getR(), 1E-12);
+	// outside of a corner, along the pseudo normal of the vertex
+	EXPECT_NEAR(0, (mesh.normal(Vector3d(3, 3, 3)) - Vector3d(1, 1, 1).getUnitVector()).getR(), 1E-12);
+
+	EXPECT_DOUBLE_EQ(1., mesh.intersection(Vector3d(1, 1, 1), Vector3d(1, 0, 0)));
+	EXPECT_DOUBLE_EQ(3., mesh.intersection(Vector3d(-3, 1.2, 0.7), Vector3d(1, 0, 0)));
+	EXPECT_TRUE(std::isinf(mesh.intersection(Vector3d(-3, 1.2, 0.7), Vector3d(-1, 0, 0))));
+	EXPECT_TRUE(std::isinf(mesh.intersection(Vector3d(-3, 3, 0.7), Vector3d(1, 0, 0))));
+
+	std::vector<Vector3d> vertices(3, Vector3d(0.));
+	std::vector<unsigned int> triangles(3, 0);
+	triangles[2] = 3;
+	EXPECT_THROW(TriangleMesh(vertices, triangles), std::runtime_error);
+}
+
+TEST(DataTable, compileAndMap) {
+	std::remove("testDataTable.txt.bin");
+	std::ofstream out("testDataTable.txt");
+	out << "# comment\n1 2 3\n\n  4.5e2\t-6\n";
+	out.close();
+
+	// compiled to the binary file on first use
+	ref_ptr<DataTable> table = DataTable::open("testDataTable.txt");
+	ASSERT_TRUE(table.valid());
+	EXPECT_EQ(2, table->size());
+	EXPECT_EQ(3, table->rowSize(0));
+	EXPECT_EQ(2, table->rowSize(1));
+	EXPECT_DOUBLE_EQ(3, table->get(0, 2));
+	EXPECT_DOUBLE_EQ(450, table->row(1)[0]);
+	EXPECT_DOUBLE_EQ(-6, table->row(1)[1]);
+	EXPECT_TRUE(std::ifstream("testDataTable.txt.bin").good());
+
+	// shared within the process
+	EXPECT_EQ(table.get(), DataTable::open("testDataTable.txt").get());
+
+	EXPECT_FALSE(DataTable::open("testDataTable_missing.txt").valid());
+}
+
+TEST(Cosmology, conversions) {
+	// Test the tables against the Einstein-de Sitter universe
+	setCosmologyParameters(0.7, 1);
+	double dH = c_light / H0();
+	double zs[] = {0, 1e-5, 1e-4, 0.01, 0.5, 3, 100};
+	for (int i = 0; i < 7; i++) {
+		double z = zs[i];
+		double dc = 2 * dH * (1 - 1 / sqrt(1 + z));
+		double dt = 2. / 3. * dH * (1 - pow(1 + z, -1.5));
+		EXPECT_NEAR(dc, redshift2ComovingDistance(z), 1e-7 * dc + 1e-6);
+		EXPECT_NEAR((1 + z) * dc, redshift2LuminosityDistance(z), 1e-7 * (1 + z) * dc + 1e-6);
+		EXPECT_NEAR(dt, redshift2LightTravelDistance(z), 1e-7 * dt + 1e-6);
+		EXPECT_NEAR(z, comovingDistance2Redshift(dc), 1e-7 * z + 1e-15);
+		EXPECT_NEAR(z, luminosityDistance2Redshift((1 + z) * dc), 1e-7 * z + 1e-15);
+		EXPECT_NEAR(z, lightTravelDistance2Redshift(dt), 1e-7 * z + 1e-15);
+		EXPECT_NEAR(dt, comoving2LightTravelDistance(dc), 1e-7 * dt + 1e-6);
+		EXPECT_NEAR(dc, lightTravel2ComovingDistance(dt), 1e-7 * dc + 1e-6);
+	}
+	EXPECT_THROW(redshift2ComovingDistance(101), std::runtime_error);
+	EXPECT_THROW(comovingDistance2Redshift(-1), std::runtime_error);
+	EXPECT_THROW(comovingDistance2Redshift(2 * dH), std::runtime_error);
+
+	// the batched variants give the scalar results
+	double d[7], z[7];
+	redshift2ComovingDistance(zs, d, 7);
+	comovingDistance2Redshift(d, z, 7);
+	for (int i = 0; i < 7; i++) {
+		EXPECT_DOUBLE_EQ(redshift2ComovingDistance(zs[i]), d[i]);
+		EXPECT_DOUBLE_EQ(comovingDistance2Redshift(d[i]), z[i]);
+	}
+	setCosmologyParameters(0.673, 0.315);
+}
+
 int main(int argc, char **argv) {
 	::testing::InitGoogleTest(&argc, argv);
 	return RUN_ALL_TESTS();
@@ -3,6 +3,7 @@
 #include "crpropa/massDistribution/Ferriere.h"
 #include "crpropa/massDistribution/Nakanishi.h"
 #include "crpropa/massDistribution/ConstantDensity.h"
+#include "crpropa/massDistribution/CachedDensity.h"
 #include "crpropa/Units.h"
 
 #include "gtest/gtest.h"
@@ -237,4 +238,48 @@ TEST(testFerriere, checkValueAtCertainPoints) {
 	std::string captured = testing::internal::GetCapturedStderr();
 	EXPECT_NE(captured.find("WARNING"), std::string::npos);
 }
+
+TEST(testCachedDensity, SimpleTest) {
+	// constant densities are reproduced exactly, also the total and nucleon density
+	ref_ptr<DensityList> list = new DensityList();
+	list->addDensity(new ConstantDensity(1, 1, 2));
+	list->addDensity(new ConstantDensity(2, 3, 1));
+	CachedDensity cache(list, Vector3d(-1 * kpc), Vector3d(2 * kpc), 4, 4, 4);
+	Vector3d p(50 * pc, 10 * pc, -30 * pc);
+	EXPECT_NEAR(cache.getHIDensity(p), 3, 1e-6);
+	EXPECT_NEAR(cache.getHIIDensity(p), 4, 1e-6);
+	EXPECT_NEAR(cache.getH2Density(p), 3, 1e-6);
+	EXPECT_NEAR(cache.getDensity(p), 10, 1e-6);
+	EXPECT_NEAR(cache.getNucleonDensity(p), 13, 1e-6);
+	EXPECT_THROW(cache.addLevel(Vector3d(0.), Vector3d(1 * kpc), 0, 1, 1), std::runtime_error);
+}
+
+TEST(testCachedDensity, levels) {
+	// a fine level in the disc of a model, the model beyond the levels
+	ref_ptr<Nakanishi> model = new Nakanishi();
+	CachedDensity cache(model, Vector3d(-10 * kpc, -10 * kpc, -1 * kpc),
+			Vector3d(20 * kpc, 20 * kpc, 2 * kpc), 20, 20, 4);
+	cache.addLevel(Vector3d(-1 * kpc, -1 * kpc, -200 * pc),
+			Vector3d(2 * kpc, 2 * kpc, 400 * pc), 100, 100, 100);
+	EXPECT_EQ(2, cache.getNumberOfLevels());
+	EXPECT_TRUE(cache.getIsForHI());
+	EXPECT_FALSE(cache.getIsForHII());
+
+	Vector3d p(50 * pc, 100 * pc, 10 * pc);
+	EXPECT_NEAR(cache.getHIDensity(p), model->getHIDensity(p), 0.01 * model->getHIDensity(p));
+	EXPECT_NEAR(cache.getH2Density(p), model->getH2Density(p), 0.02 * model->getH2Density(p));
+	Vector3d q(0, 0, 5 * kpc);
+	EXPECT_DOUBLE_EQ(cache.getHIDensity(q), model->getHIDensity(q));
+
+	// save and load, without a model there is no density beyond the levels
+	cache.save("CachedDensity_test.bin");
+	CachedDensity loaded("CachedDensity_test.bin");
+	EXPECT_EQ(2, loaded.getNumberOfLevels());
+	EXPECT_TRUE(loaded.getIsForHI());
+	EXPECT_DOUBLE_EQ(cache.getHIDensity(p), loaded.getHIDensity(p));
+	EXPECT_DOUBLE_EQ(cache.getNucleonDensity(p), loaded.getNucleonDensity(p));
+	EXPECT_DOUBLE_EQ(0, loaded.getHIDensity(q));
+	EXPECT_THROW(CachedDensity("CachedDensity_missing.bin"), std::runtime_error);
+}
+
 } //namespace crpropa
@@ -11,8 +11,14 @@
 #include "crpropa/module/EMDoublePairProduction.h"
 #include "crpropa/module/EMTripletPairProduction.h"
 #include "crpropa/module/EMInverseComptonScattering.h"
+#include "crpropa/module/InteractionCollection.h"
+#include "crpropa/module/ContinuousLossCollection.h"
+#include "crpropa/module/EMCascade.h"
+#include "crpropa/PhotonPropagation.h"
+#include "crpropa/module/PhotonOutput1D.h"
 #include "gtest/gtest.h"
 
+#include <algorithm>
 #include <fstream>
 
 namespace crpropa {
@@ -70,6 +76,28 @@ TEST(ElectronPairProduction, thisIsNotNucleonic) {
 	EXPECT_DOUBLE_EQ(1E20 * eV, c.current.getEnergy());
 }
 
+TEST(ElectronPairProduction, secondaryInterval) {
+	// Test if the pair energy of several steps is emitted as one weighted pair.
+	ElectronPairProduction epp(CMB, true);
+	epp.setSecondaryInterval(3);
+	EXPECT_THROW(epp.setSecondaryInterval(0), std::runtime_error);
+
+	Candidate c(nucleusId(1, 1), 1E19 * eV);
+	c.setCurrentStep(10 * Mpc);
+	double E0 = c.current.getEnergy();
+	epp.process(&c);
+	epp.process(&c);
+	EXPECT_EQ(0, c.secondaries.size());
+	epp.process(&c);
+	EXPECT_EQ(2, c.secondaries.size());
+
+	// the weighted pair carries the energy loss of the three steps
+	double Epairs = 0;
+	for (size_t i = 0; i < c.secondaries.size(); i++)
+		Epairs += c.secondaries[i]->getWeight() * c.secondaries[i]->current.getEnergy();
+	EXPECT_NEAR(E0 - c.current.getEnergy(), Epairs, 1e-9 * E0);
+}
+
 TEST(ElectronPairProduction, valuesCMB) {
 	// Test if energy loss corresponds to the data table.
 	std::vector<double> x;
@@ -311,6 +339,30 @@ TEST(PhotoDisintegration, carbon) {
 	// energy conserved
 }
 
+TEST(PhotoDisintegration, opticalDepth) {
+	// Test if the accumulated optical depth gives the mean free path of the interaction.
+	// This test can stochastically fail.
+	PhotoDisintegration pd(CMB);
+	pd.setOpticalDepth(true);
+	int id = nucleusId(56, 26);
+	Candidate c(id, 100 * EeV);
+	ASSERT_GT(pd.interactionRate(&c), 0);
+	double mfp = 1 / pd.interactionRate(&c);
+
+	// distance to the first interaction in small steps
+	double sum = 0;
+	int n = 1000;
+	for (int i = 0; i < n; i++) {
+		Candidate c(id, 100 * EeV);
+		c.setCurrentStep(0.01 * mfp);
+		while (c.current.getId() == id) {
+			pd.process(&c);
+			sum += c.getCurrentStep();
+		}
+	}
+	EXPECT_NEAR(1, sum / n / mfp, 0.1);
+}
+
 TEST(PhotoDisintegration, iron) {
 	// Test if a 200 EeV Fe-56 nucleus photo-disintegrates (at least once) over a distance of 1 Gpc.
 	// This test can stochastically fail.
@@ -518,6 +570,27 @@ TEST(PhotoPionProduction, secondaries) {
 	EXPECT_GT(c.secondaries.size(), 1);
 }
 
+TEST(PhotoPionProduction, secondaryTable) {
+	// Test sampling the interaction products of a 100 EeV proton from a
+	// table of SOPHIA events, which is cached in a file.
+	PhotoPionProduction ppp(CMB, true, true, true);
+	ppp.initSecondaryTable(10, "testSecondaryTable.txt");
+	EXPECT_TRUE(ppp.haveSecondaryTable());
+
+	Candidate c(nucleusId(1, 1), 100 * EeV);
+	ppp.performInteraction(&c, true);
+	EXPECT_LT(c.current.getEnergy(), 100 * EeV);
+	EXPECT_EQ(1, massNumber(c.current.getId()));
+	EXPECT_GT(c.secondaries.size(), 1);
+
+	// the cached table is read again
+	PhotoPionProduction ppp2(CMB, true, true, true);
+	ppp2.initSecondaryTable(10, "testSecondaryTable.txt");
+	EXPECT_TRUE(ppp2.haveSecondaryTable());
+	ppp2.clearSecondaryTable();
+	EXPECT_FALSE(ppp2.haveSecondaryTable());
+}
+
 // Redshift -------------------------------------------------------------------
 TEST(Redshift, simpleTest) {
 	// Test if redshift is decreased and adiabatic energy loss is applied.
@@ -599,6 +672,27 @@ TEST(EMPairProduction, secondaries) {
 	}
 }
 
+TEST(EMPairProduction, thinning) {
+	// Test if only one weighted secondary is kept below the thinning energy.
+	EMPairProduction m;
+	m.setHaveElectrons(true);
+	m.setThinning(0.5);
+
+	for (int i = 0; i < 100; i++) {
+		Candidate c(22, 1E15 * eV);
+		c.source.setEnergy(1E16 * eV);
+		c.setCurrentStep(std::numeric_limits<double>::max());
+		m.process(&c);
+		EXPECT_FALSE(c.isActive());
+		EXPECT_EQ(1, c.secondaries.size());
+
+		// the weight compensates for the energy of the dropped particle
+		Candidate s = *c.secondaries[0];
+		EXPECT_EQ(11, abs(s.current.getId()));
+		EXPECT_NEAR(1E15 * eV, s.current.getEnergy() * s.getWeight(), 1E15 * eV * 1e-10);
+	}
+}
+
 // EMDoublePairProduction -----------------------------------------------------
 TEST(EMDoublePairProduction, limitNextStep) {
 	// Test if the interaction limits the next propagation step.
@@ -720,6 +814,26 @@ TEST(EMInverseComptonScattering, limitNextStep) {
 	EXPECT_LT(c.getNextStep(), std::numeric_limits<double>::max());
 }
 
+TEST(EMInverseComptonScattering, continuousLoss) {
+	// Test if the continuous loss conserves the energy with a macro-photon.
+	EMInverseComptonScattering m(CMB, true);
+	m.setContinuousEnergy(1E15 * eV);
+	Candidate c(11, 1E13 * eV);
+	c.setCurrentStep(1 * kpc); // a few percent of the loss length
+	c.setNextStep(std::numeric_limits<double>::max());
+	m.process(&c);
+
+	double E = c.current.getEnergy();
+	EXPECT_LT(E, 1E13 * eV);
+	EXPECT_GT(E, 0.9E13 * eV);
+	EXPECT_LT(c.getNextStep(), std::numeric_limits<double>::max());
+	ASSERT_EQ(1, c.secondaries.size());
+	const Candidate &s = *c.secondaries[0];
+	EXPECT_EQ(22, s.current.getId());
+	EXPECT_LT(s.current.getEnergy(), E);
+	EXPECT_NEAR(1E13 * eV, E + s.getWeight() * s.current.getEnergy(), 1E4 * eV);
+}
+
 TEST(EMInverseComptonScattering, secondaries) {
 	// Test if secondaries are correctly produced.
 	EMInverseComptonScattering m;
@@ -765,6 +879,397 @@ TEST(EMInverseComptonScattering, secondaries) {
 }
 
 
+// CustomPhotonField ----------------------------------------------------------
+static ref_ptr<CustomPhotonField> blackBodyField(const std::string &name) {
+	// spectral number density of the CMB
+	double kT = k_boltzmann * 2.7255 * kelvin;
+	double hbarc = h_planck / (2 * M_PI) * c_light;
+	std::vector<double> e, n;
+	for (double x = 1e-4 * kT; x < 50 * kT; x *= 1.05) {
+		e.push_back(x);
+		n.push_back(x * x / (M_PI * M_PI * pow(hbarc, 3)) / (exp(x / kT) - 1));
+	}
+	ref_ptr<CustomPhotonField> field = new CustomPhotonField(name, e, n);
+	field->setCacheDirectory(".");
+	return field;
+}
+
+TEST(CustomPhotonField, blackBodyRates) {
+	// Test if the generated tables of a black body reproduce those of the CMB
+	PhotonField field = registerPhotonField(blackBodyField("blackbody"));
+
+	EMPairProduction pp(CMB), ppCustom(field);
+	EMInverseComptonScattering ic(CMB), icCustom(field);
+	for (int i = 0; i < 5; i++) {
+		Candidate photon(22, pow(10, 15 + i) * eV);
+		double rate = pp.interactionRate(&photon);
+		EXPECT_NEAR(rate, ppCustom.interactionRate(&photon), 0.05 * rate);
+		Candidate electron(11, pow(10, 12 + 2 * i) * eV);
+		rate = ic.interactionRate(&electron);
+		EXPECT_NEAR(rate, icCustom.interactionRate(&electron), 0.05 * rate);
+	}
+
+	// the second setup reads the cached tables
+	std::string table = photonFieldTable(field, "EMPairProduction", "rate");
+	EXPECT_TRUE(std::ifstream(table.c_str()).good());
+	EXPECT_NE(std::string::npos, table.find(getCustomPhotonField(field)->getHash()));
+	EXPECT_THROW(PhotoDisintegration pd(field), std::runtime_error);
+}
+
+// InteractionCollection ------------------------------------------------------
+class CountingInteraction: public Interaction {
+public:
+	double rate;
+	mutable int count;
+	mutable int evaluations;
+	CountingInteraction(double rate) : rate(rate), count(0), evaluations(0) {
+	}
+	double interactionRate(const Candidate *candidate) const {
+		evaluations++;
+		return rate;
+	}
+	void interact(Candidate *candidate) const {
+		count++;
+	}
+	void process(Candidate *candidate) const {
+	}
+};
+
+TEST(InteractionCollection, limitNextStep) {
+	// Test if the next step is limited to a fraction of the total mean free path.
+	InteractionCollection collection(0.1);
+	collection.add(new CountingInteraction(1 / Mpc));
+	collection.add(new CountingInteraction(3 / Mpc));
+	Candidate c;
+	c.setCurrentStep(0);
+	c.setNextStep(std::numeric_limits<double>::max());
+	collection.process(&c);
+	EXPECT_DOUBLE_EQ(0.1 * Mpc / 4, c.getNextStep());
+}
+
+TEST(InteractionCollection, partialRates) {
+	// Test if the interactions are selected according to their rates.
+	CountingInteraction *a = new CountingInteraction(1 / Mpc);
+	CountingInteraction *b = new CountingInteraction(3 / Mpc);
+	CountingInteraction *none = new CountingInteraction(0);
+	InteractionCollection collection;
+	collection.add(a);
+	collection.add(none);
+	collection.add(b);
+	EXPECT_EQ(3, collection.size());
+
+	// expect on average 4 interactions per Mpc
+	Candidate c;
+	for (int i = 0; i < 1000; i++) {
+		c.setCurrentStep(1 * Mpc);
+		collection.process(&c);
+	}
+	EXPECT_NEAR(4000, a->count + b->count, 250);
+	EXPECT_NEAR(0.25, a->count / double(a->count + b->count), 0.03);
+	EXPECT_EQ(0, none->count);
+}
+
+TEST(InteractionCollection, rateTolerance) {
+	// Test if the rates are only evaluated again after a change of the state.
+	CountingInteraction *a = new CountingInteraction(1 / Gpc);
+	InteractionCollection collection;
+	collection.add(a);
+	collection.setRateTolerance(0.01);
+	EXPECT_THROW(collection.setRateTolerance(-1), std::runtime_error);
+
+	Candidate c(nucleusId(1, 1), 1E18 * eV);
+	c.setCurrentStep(1 * kpc);
+	for (int i = 0; i < 10; i++)
+		collection.process(&c);
+	EXPECT_EQ(1, a->evaluations);
+
+	c.current.setEnergy(0.995E18 * eV); // within tolerance
+	collection.process(&c);
+	EXPECT_EQ(1, a->evaluations);
+
+	c.current.setEnergy(0.9E18 * eV);
+	collection.process(&c);
+	EXPECT_EQ(2, a->evaluations);
+
+	c.current.setId(nucleusId(4, 2));
+	c.setNextStep(std::numeric_limits<double>::max());
+	collection.process(&c);
+	EXPECT_EQ(3, a->evaluations);
+	EXPECT_DOUBLE_EQ(0.1 * Gpc, c.getNextStep());
+}
+
+// absorbs the candidate into a neutrino
+class AbsorbingInteraction: public CountingInteraction {
+public:
+	AbsorbingInteraction(double rate) : CountingInteraction(rate) {
+	}
+	void interact(Candidate *candidate) const {
+		count++;
+		candidate->addSecondary(12, candidate->current.getEnergy());
+		candidate->setActive(false);
+	}
+};
+
+TEST(InteractionCollection, interactionBias) {
+	// Test if the biased interactions keep the expected weights of both branches.
+	AbsorbingInteraction *a = new AbsorbingInteraction(0.1 / Mpc);
+	EXPECT_THROW(a->setInteractionBias(0.5), std::runtime_error);
+	a->setInteractionBias(10);
+	EXPECT_DOUBLE_EQ(10, a->getInteractionBias());
+	InteractionCollection collection;
+	collection.add(a);
+
+	Random::seedThreads(42);
+	int n = 2000;
+	double surviving = 0, absorbed = 0;
+	for (int i = 0; i < n; i++) {
+		Candidate c(nucleusId(1, 1), 1 * EeV);
+		c.setCurrentStep(1 * Mpc);
+		collection.process(&c);
+		EXPECT_TRUE(c.isActive());
+		surviving += c.getWeight();
+		for (size_t j = 0; j < c.secondaries.size(); j++) {
+			EXPECT_EQ(12, c.secondaries[j]->current.getId());
+			EXPECT_EQ(&c, c.secondaries[j]->parent);
+			absorbed += c.secondaries[j]->getWeight();
+		}
+	}
+	// about 10 times more interactions than without bias
+	EXPECT_GT(a->count, n / 2);
+	EXPECT_NEAR(exp(-0.1), surviving / n, 0.01);
+	EXPECT_NEAR(1 - exp(-0.1), absorbed / n, 0.01);
+}
+
+// ContinuousLossCollection ---------------------------------------------------
+class ExponentialLoss: public ContinuousLoss {
+public:
+	double length;
+	mutable double emitted;
+	ExponentialLoss(double length) : length(length), emitted(0) {
+	}
+	double energyLossRate(const Candidate *candidate, double E, double z) const {
+		return E / length;
+	}
+	void emitSecondaries(Candidate *candidate, double E, double dE) const {
+		emitted += dE;
+	}
+	void process(Candidate *candidate) const {
+	}
+};
+
+TEST(ContinuousLossCollection, longStep) {
+	// Test if a step of several loss lengths is integrated to the tolerance
+	ref_ptr<ExponentialLoss> loss = new ExponentialLoss(1 * Mpc);
+	ContinuousLossCollection m(1, 1e-6);
+	m.setRedshiftEvolution(false);
+	m.add(loss);
+	Candidate c(nucleusId(1, 1), 1E19 * eV);
+	c.setCurrentStep(5 * Mpc);
+	c.setNextStep(std::numeric_limits<double>::max());
+	m.process(&c);
+	EXPECT_NEAR(1E19 * eV * exp(-5), c.current.getEnergy(), 1E19 * eV * 1e-5);
+	EXPECT_NEAR(1E19 * eV - c.current.getEnergy(), loss->emitted, 1E19 * eV * 1e-5);
+	EXPECT_NEAR(1 * Mpc, c.getNextStep(), 1 * kpc);
+}
+
+TEST(ContinuousLossCollection, pairProductionAndRedshift) {
+	// Test if one long step agrees with many short steps of the modules
+	ElectronPairProduction epp(CMB);
+	Redshift redshift;
+	Candidate c1(nucleusId(1, 1), 1E19 * eV);
+	c1.setRedshift(0.1);
+	for (int i = 0; i < 1000; i++) {
+		c1.setCurrentStep(0.1 * Mpc);
+		epp.process(&c1);
+		redshift.process(&c1);
+	}
+
+	ContinuousLossCollection m;
+	m.add(new ElectronPairProduction(CMB));
+	Candidate c2(nucleusId(1, 1), 1E19 * eV);
+	c2.setRedshift(0.1);
+	c2.setCurrentStep(100 * Mpc);
+	m.process(&c2);
+	EXPECT_NEAR(c1.getRedshift(), c2.getRedshift(), 1e-4);
+	EXPECT_NEAR(c1.current.getEnergy(), c2.current.getEnergy(), 1e-3 * c1.current.getEnergy());
+}
+
+// EMCascade ------------------------------------------------------------------
+TEST(EMCascade, collectInParallel) {
+	// Test if the EM particles of all threads are counted
+	EMCascade cascade;
+	cascade.setDistanceBinning(10 * Mpc, 1);
+	int n = 3000;
+	#pragma omp parallel for
+	for (int i = 0; i < n; i++) {
+		int id = (i % 3 == 0) ? 22 : ((i % 3 == 1) ? 11 : -11);
+		Candidate c(id, 1 * EeV, Vector3d(1, 0, 0) * Mpc);
+		cascade.process(&c);
+		EXPECT_FALSE(c.isActive());
+	}
+
+	std::string filename = "testEMCascade.txt";
+	cascade.save(filename);
+	std::ifstream infile(filename.c_str());
+	infile.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+	double D, logE, photons, electrons, positrons;
+	double sum[3] = {0, 0, 0};
+	while (infile >> D >> logE >> photons >> electrons >> positrons) {
+		sum[0] += photons;
+		sum[1] += electrons;
+		sum[2] += positrons;
+	}
+	infile.close();
+	std::remove(filename.c_str());
+	EXPECT_DOUBLE_EQ(n / 3, sum[0]);
+	EXPECT_DOUBLE_EQ(n / 3, sum[1]);
+	EXPECT_DOUBLE_EQ(n / 3, sum[2]);
+}
+
+TEST(DintCascade, checkInput) {
+	// Test the checks before DINT is set up
+	std::vector<double> distances, injections, spectrum(5, 1.);
+	DintCascade(distances, injections, spectrum);
+	EXPECT_EQ(3 * 170, spectrum.size());
+	EXPECT_EQ(0, *std::max_element(spectrum.begin(), spectrum.end()));
+
+	distances.push_back(10);
+	EXPECT_THROW(DintCascade(distances, injections, spectrum), std::runtime_error);
+	distances.push_back(20);
+	injections.resize(2 * 3 * 170, 1);
+	EXPECT_THROW(DintCascade(distances, injections, spectrum), std::runtime_error);
+}
+
+TEST(DintResponse, checks) {
+	// Test the checks and the cache name, the table itself needs DINT
+	EXPECT_THROW(DintResponse(100 * Mpc, 0), std::runtime_error);
+	EXPECT_THROW(DintResponse(0, 10), std::runtime_error);
+
+	DintResponse r(100 * Mpc, 10);
+	EXPECT_FALSE(r.isComputed());
+	EXPECT_EQ(10, r.getNumberOfDistances());
+	EXPECT_DOUBLE_EQ(100 * Mpc, r.getMaximumDistance());
+	std::vector<double> distances(1, 10), injections(3 * 170, 1), spectrum;
+	EXPECT_THROW(r.cascade(distances, injections, spectrum), std::runtime_error);
+	EXPECT_THROW(r.save("dint_response_test.bin"), std::runtime_error);
+	EXPECT_THROW(r.load("dint_response_missing.bin"), std::runtime_error);
+
+	// the cache is keyed by the background and the binning
+	DintResponse r2(100 * Mpc, 10, 2);
+	DintResponse r3(100 * Mpc, 20);
+	EXPECT_NE(r.getCacheFilename(), r2.getCacheFilename());
+	EXPECT_NE(r.getCacheFilename(), r3.getCacheFilename());
+	EXPECT_EQ(r.getCacheFilename(), DintResponse(100 * Mpc, 10).getCacheFilename());
+}
+
+TEST(EMCascadeResponse, injectAtNodes) {
+	// Test the module with a table of response 1/2 per node, written by hand
+	const int nE = DintResponse::getNumberOfEnergyBins();
+	const size_t m = 3 * nE;
+	{
+		std::ofstream out("cascade_response_test.bin", std::ios::binary);
+		const char magic[8] = {'C', 'R', 'P', 'D', 'I', 'N', 'T', '1'};
+		int32_t ints[5] = {2, 4, 4, nE, 0};
+		double doubles[3] = {100, 1E-13, 0};
+		out.write(magic, sizeof(magic));
+		out.write((const char*) ints, sizeof(ints));
+		out.write((const char*) doubles, sizeof(doubles));
+		std::vector<double> responses(2 * m * m, 0);
+		for (size_t k = 0; k < 2; k++)
+			for (size_t j = 0; j < m; j++)
+				responses[k * m * m + j * m + j] = 0.5;
+		out.write((const char*) &responses[0], responses.size() * sizeof(double));
+	}
+	DintResponse response(100 * Mpc, 2);
+	EXPECT_THROW(EMCascadeResponse(response, EeV), std::runtime_error);
+	response.load("cascade_response_test.bin");
+	std::remove("cascade_response_test.bin");
+	EMCascadeResponse cascade(response, EeV);
+
+	// a photon of 10^10.05 eV at the observer and an electron at node 1
+	Candidate photon(22, pow(10, 10.05) * eV, Vector3d(0.));
+	cascade.process(&photon);
+	EXPECT_FALSE(photon.isActive());
+	Candidate electron(11, pow(10, 10.05) * eV, Vector3d(50, 0, 0) * Mpc);
+	electron.setWeight(2);
+	cascade.process(&electron);
+	// too energetic, too far or no EM particle
+	Candidate high(22, 10 * EeV);
+	cascade.process(&high);
+	EXPECT_TRUE(high.isActive());
+	Candidate far(22, pow(10, 10.05) * eV, Vector3d(200, 0, 0) * Mpc);
+	cascade.process(&far);
+	EXPECT_TRUE(far.isActive());
+	Candidate proton(nucleusId(1, 1), pow(10, 10.05) * eV);
+	cascade.process(&proton);
+	EXPECT_TRUE(proton.isActive());
+
+	EXPECT_DOUBLE_EQ(3, cascade.getInjectedWeight());
+	std::vector<double> spectrum = cascade.getSpectrum();
+	ASSERT_EQ(m, spectrum.size());
+	EXPECT_DOUBLE_EQ(1, spectrum[30]);
+	// the light travel distance is a bit shorter than 50 Mpc, between the observer and node 1
+	EXPECT_GT(spectrum[nE + 30], 1);
+	EXPECT_LT(spectrum[nE + 30], 2);
+	cascade.clear();
+	EXPECT_DOUBLE_EQ(0, cascade.getInjectedWeight());
+}
+
+TEST(PhotonInputReader, textAndBinary) {
+	// Test that the text and binary PhotonOutput1D files read the same in chunks
+	{
+		PhotonOutput1D text("photons_test.txt");
+		PhotonOutput1D binary("photons_test.bin", true);
+		for (int i = 0; i < 5; i++) {
+			Candidate c;
+			c.current.setId((i % 2) ? 22 : 11);
+			c.current.setEnergy((i + 1) * EeV);
+			c.current.setPosition(Vector3d(10 * (i + 1), 0, 0) * Mpc);
+			c.created.setId(22);
+			c.created.setEnergy(10 * EeV);
+			c.source.setId(nucleusId(1, 1));
+			c.source.setEnergy(100 * EeV);
+			c.source.setPosition(Vector3d(0, 100, 0) * Mpc);
+			Candidate c2 = c;
+			text.process(&c);
+			binary.process(&c2);
+		}
+		// a nucleus is not written
+		Candidate c(nucleusId(4, 2), EeV);
+		text.process(&c);
+	}
+
+	PhotonInputReader text("photons_test.txt", 2);
+	PhotonInputReader binary("photons_test.bin", 2);
+	EXPECT_FALSE(text.isBinary());
+	EXPECT_TRUE(binary.isBinary());
+	std::vector<PhotonRecord1D> a, b;
+	int n = 0;
+	while (text.read(a)) {
+		EXPECT_TRUE(binary.read(b));
+		ASSERT_EQ(a.size(), b.size());
+		EXPECT_LE(a.size(), 2);
+		for (size_t i = 0; i < a.size(); i++, n++) {
+			EXPECT_EQ((n % 2) ? 22 : 11, a[i].id);
+			EXPECT_EQ(a[i].id, b[i].id);
+			EXPECT_EQ(22, b[i].parentId);
+			EXPECT_EQ(nucleusId(1, 1), b[i].sourceId);
+			EXPECT_DOUBLE_EQ(n + 1, b[i].energy);
+			EXPECT_DOUBLE_EQ(10 * (n + 1), b[i].distance);
+			EXPECT_DOUBLE_EQ(100, b[i].sourceDistance);
+			EXPECT_NEAR(b[i].energy, a[i].energy, 1e-4);
+			EXPECT_NEAR(b[i].distance, a[i].distance, 1e-4);
+			EXPECT_NEAR(b[i].parentEnergy, a[i].parentEnergy, 1e-4);
+			EXPECT_NEAR(b[i].sourceEnergy, a[i].sourceEnergy, 1e-4);
+			EXPECT_NEAR(b[i].sourceDistance, a[i].sourceDistance, 1e-4);
+		}
+	}
+	EXPECT_FALSE(binary.read(b));
+	EXPECT_EQ(5, n);
+
+	EXPECT_THROW(PhotonInputReader("photons_test_missing.txt"), std::runtime_error);
+}
+
 int main(int argc, char **argv) {
 	::testing::InitGoogleTest(&argc, argv);
 	return RUN_ALL_TESTS();
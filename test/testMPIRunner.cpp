@@ -0,0 +1,80 @@
+#include "crpropa/MPIRunner.h"
+#include "crpropa/GridTools.h"
+#include "crpropa/ParticleID.h"
+#include "crpropa/Units.h"
+#include "crpropa/module/SimplePropagation.h"
+#include "crpropa/module/BreakCondition.h"
+#include "crpropa/module/ParticleCollector.h"
+
+#include "gtest/gtest.h"
+
+#include <mpi.h>
+
+namespace crpropa {
+
+TEST(MPIRunner, run) {
+	ref_ptr<ModuleList> modules = new ModuleList();
+	modules->add(new SimplePropagation());
+	ref_ptr<MaximumTrajectoryLength> maxLength = new MaximumTrajectoryLength(1 * Mpc);
+	ref_ptr<ParticleCollector> collector = new ParticleCollector();
+	maxLength->onReject(collector);
+	modules->add(maxLength);
+	ref_ptr<Source> source = new Source();
+	source->add(new SourceParticleType(nucleusId(1, 1)));
+	source->add(new SourceEnergy(1 * EeV));
+
+	MPIRunner runner(modules, 7);
+	runner.seed(42);
+	runner.run(source, 100);
+	EXPECT_EQ(runner.getNumberOfProcessed(), collector->size());
+
+	unsigned long long local = collector->size(), total = 0;
+	MPI_Allreduce(&local, &total, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+	EXPECT_EQ(100, total);
+}
+
+TEST(MPIRunner, serialNumbers) {
+	ref_ptr<ModuleList> modules = new ModuleList();
+	MPIRunner runner(modules);
+	Candidate c;
+	EXPECT_EQ(uint64_t(runner.getRank()), c.getSerialNumber() >> 48);
+}
+
+TEST(MPIRunner, shardFilename) {
+	ref_ptr<ModuleList> modules = new ModuleList();
+	MPIRunner runner(modules);
+	EXPECT_EQ("out/events.3.txt", runner.getShardFilename("out/events.txt", 3));
+	EXPECT_EQ("out.d/events.3", runner.getShardFilename("out.d/events", 3));
+}
+
+#ifdef CRPROPA_HAVE_FFTW3F_MPI
+TEST(MPIRunner, dumpTurbulence) {
+	// the distributed field is identical to the one of a single process
+	size_t n = 16;
+	double spacing = 1 * Mpc;
+	dumpTurbulence("testTurbulence.raw", n, spacing, 1, 2 * spacing, 8 * spacing,
+			-11. / 3., 753);
+	MPI_Barrier(MPI_COMM_WORLD);
+
+	ref_ptr<VectorGrid> grid1 = new VectorGrid(Vector3d(0.), n, spacing);
+	initTurbulence(grid1, 1, 2 * spacing, 8 * spacing, -11. / 3., 753);
+	ref_ptr<VectorGrid> grid2 = new VectorGrid(Vector3d(0.), n, spacing);
+	mapGrid(grid2, "testTurbulence.raw");
+	for (size_t i = 0; i < n; i++) {
+		Vector3f b1 = grid1->get(i, 2, 15 - i), b2 = grid2->get(i, 2, 15 - i);
+		EXPECT_NEAR(b1.x, b2.x, 1e-5);
+		EXPECT_NEAR(b1.y, b2.y, 1e-5);
+		EXPECT_NEAR(b1.z, b2.z, 1e-5);
+	}
+}
+#endif
+
+} // namespace crpropa
+
+int main(int argc, char **argv) {
+	MPI_Init(&argc, &argv);
+	::testing::InitGoogleTest(&argc, argv);
+	int result = RUN_ALL_TESTS();
+	MPI_Finalize();
+	return result;
+}
@@ -1,13 +1,26 @@
+#include <cstdio>
 #include <stdexcept>
+#include <vector>
 
+#include "crpropa/magneticField/CachedMagneticField.h"
+#include "crpropa/magneticField/JF12Field.h"
 #include "crpropa/magneticField/MagneticFieldGrid.h"
+#include "crpropa/magneticField/MagneticFieldSnapshots.h"
+#include "crpropa/magneticField/NestedTurbulenceField.h"
+#include "crpropa/magneticField/OctreeMagneticField.h"
+#include "crpropa/magneticField/PlaneWaveTurbulence.h"
 #include "crpropa/Grid.h"
 #include "crpropa/GridTools.h"
+#include "crpropa/Random.h"
 #include "crpropa/Units.h"
 #include "crpropa/Common.h"
 
 #include "gtest/gtest.h"
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 using namespace crpropa;
 
 TEST(testUniformMagneticField, SimpleTest) {
@@ -53,6 +66,82 @@ TEST(testMagneticFieldList, SimpleTest) {
 	EXPECT_DOUBLE_EQ(b.z, 3);
 }
 
+TEST(testMagneticFieldList, isUniform) {
+	MagneticFieldList B;
+	B.addField(new UniformMagneticField(Vector3d(1, 0, 0)));
+	EXPECT_TRUE(B.isUniform());
+	B.addField(new UniformMagneticField(Vector3d(0, 2, 0)), Vector3d(0.), Vector3d(1.));
+	EXPECT_FALSE(B.isUniform());  // bounded
+	EXPECT_FALSE(MagneticDipoleField(Vector3d(0.), Vector3d(1.), 1).isUniform());
+}
+
+TEST(testMagneticFieldList, freeze) {
+	// two grids of the same geometry are fused, a bounded field is skipped outside its box
+	ref_ptr<VectorGrid> grid1 = new VectorGrid(Vector3d(0.), 4, 1);
+	ref_ptr<VectorGrid> grid2 = new VectorGrid(Vector3d(0.), 4, 1);
+	for (int ix = 0; ix < 4; ix++)
+		for (int iy = 0; iy < 4; iy++)
+			for (int iz = 0; iz < 4; iz++) {
+				grid1->get(ix, iy, iz) = Vector3f(ix, 0, 1);
+				grid2->get(ix, iy, iz) = Vector3f(0, iy * iz, 1);
+			}
+
+	MagneticFieldList B;
+	B.addField(new MagneticFieldGrid(grid1));
+	B.addField(new UniformMagneticField(Vector3d(0, 0, 3)), Vector3d(0.), Vector3d(1.));
+	B.addField(new MagneticFieldGrid(grid2));
+
+	Vector3d inside(0.3, 0.6, 0.9), outside(1.7, 2.2, 3.1);
+	Vector3d b1 = B.getField(inside), b2 = B.getField(outside);
+	EXPECT_EQ(3, B.getNumberOfFields());
+
+	B.freeze();
+	EXPECT_TRUE(B.isFrozen());
+	EXPECT_EQ(2, B.getNumberOfFields());
+	EXPECT_NEAR(b1.x, B.getField(inside).x, 1e-6);
+	EXPECT_NEAR(b1.y, B.getField(inside).y, 1e-6);
+	EXPECT_NEAR(b1.z, B.getField(inside).z, 1e-6);
+	EXPECT_NEAR(b2.y, B.getField(outside).y, 1e-6);
+	EXPECT_NEAR(2, B.getField(outside).z, 1e-6);
+
+	// the original grids are unchanged
+	EXPECT_FLOAT_EQ(1, grid1->get(1, 2, 3).z);
+
+	B.addField(new UniformMagneticField(Vector3d(1, 0, 0)));
+	EXPECT_FALSE(B.isFrozen());
+}
+
+TEST(testMagneticFieldList, getFields) {
+	// batched evaluation of a list, including redshift and bounding boxes
+	ref_ptr<VectorGrid> grid = new VectorGrid(Vector3d(0.), 4, 1);
+	for (int ix = 0; ix < 4; ix++)
+		for (int iy = 0; iy < 4; iy++)
+			for (int iz = 0; iz < 4; iz++)
+				grid->get(ix, iy, iz) = Vector3f(ix, iy * iz, 1);
+
+	MagneticFieldList B;
+	B.addField(new MagneticFieldGrid(grid));
+	B.addField(new MagneticFieldEvolution(new UniformMagneticField(Vector3d(0, 0, 1)), 2));
+	B.addField(new MagneticDipoleField(Vector3d(0.), Vector3d(1, 0, 0), 1), Vector3d(0.), Vector3d(2.));
+
+	std::vector<Vector3d> positions, fields(10);
+	for (int i = 0; i < 10; i++)
+		positions.push_back(Vector3d(0.37 * i, 1.1 * i - 3, 0.49 * i));
+	for (int frozen = 0; frozen < 2; frozen++) {
+		if (frozen)
+			B.freeze();
+		B.getFields(&positions[0], &fields[0], 10, 1.);
+		for (size_t i = 0; i < 10; i++) {
+			Vector3d b = B.getField(positions[i], 1.);
+			EXPECT_NEAR(b.x, fields[i].x, 1e-12);
+			EXPECT_NEAR(b.y, fields[i].y, 1e-12);
+			EXPECT_NEAR(b.z, fields[i].z, 1e-12);
+		}
+	}
+	// scaled uniform field: (1 + z)^2
+	EXPECT_NEAR(4 + 1, B.getField(Vector3d(3.5, 3.5, 0.7), 1.).z, 1e-6);
+}
+
 TEST(testMagneticFieldEvolution, SimpleTest) {
 	// Test if this decorator scales the underlying field as (1+z)^m
 	ref_ptr<UniformMagneticField> B = new UniformMagneticField(Vector3d(1,0,0));
@@ -69,7 +158,176 @@ TEST(testMagneticFieldEvolution, SimpleTest) {
 	EXPECT_DOUBLE_EQ(b.x, 1);
 }
 
+TEST(testPlaneWaveTurbulence, Brms) {
+	// Test for zero mean and the RMS field strength: <B> = 0, <B^2> = Brms^2
+	PlaneWaveTurbulence field(1 * nG, 1 * kpc, 100 * kpc, -11. / 3., 128, 42);
+	EXPECT_EQ(128, field.getNumberOfModes());
+
+	Random random(7);
+	Vector3d bMean(0.);
+	double b2 = 0;
+	int n = 4000;
+	for (int i = 0; i < n; i++) {
+		Vector3d b = field.getField(random.randVector() * random.rand(100 * Mpc));
+		bMean += b;
+		b2 += b.getR2();
+	}
+	bMean /= n;
+	EXPECT_NEAR(0, bMean.getR() / nG, 0.1);
+	EXPECT_NEAR(1, sqrt(b2 / n) / nG, 0.1);
+}
+
+TEST(testPlaneWaveTurbulence, divergence) {
+	// Test for a divergence free field
+	PlaneWaveTurbulence field(1 * nG, 1 * kpc, 100 * kpc, -11. / 3., 64, 42);
+	Vector3d pos(12.3 * kpc, -4.5 * kpc, 0.7 * kpc);
+	double h = 1 * pc;
+	double div = (field.getField(pos + Vector3d(h, 0, 0)).x - field.getField(pos - Vector3d(h, 0, 0)).x
+			+ field.getField(pos + Vector3d(0, h, 0)).y - field.getField(pos - Vector3d(0, h, 0)).y
+			+ field.getField(pos + Vector3d(0, 0, h)).z - field.getField(pos - Vector3d(0, 0, h)).z) / (2 * h);
+	EXPECT_NEAR(0, div * kpc / nG, 1e-4);
+}
+
+TEST(testPlaneWaveTurbulence, getFields) {
+	PlaneWaveTurbulence field(1 * nG, 1 * kpc, 100 * kpc);
+	std::vector<Vector3d> positions, fields(10);
+	for (int i = 0; i < 10; i++)
+		positions.push_back(Vector3d(0.37 * i, 1.1 * i - 3, 0.49 * i) * kpc);
+	field.getFields(&positions[0], &fields[0], 10);
+	for (size_t i = 0; i < 10; i++)
+		EXPECT_TRUE(field.getField(positions[i]) == fields[i]);
+
+	EXPECT_THROW(PlaneWaveTurbulence(1 * nG, 10 * kpc, 1 * kpc), std::runtime_error);
+}
+
+TEST(testNestedTurbulenceField, sumOfLevels) {
+	// the fine level is repeated periodically and added to the coarse one
+	ref_ptr<VectorGrid> coarse = new VectorGrid(Vector3d(0.), 4, 1.);
+	ref_ptr<VectorGrid> fine = new VectorGrid(Vector3d(0.), 4, 0.25);
+	for (size_t ix = 0; ix < 4; ix++)
+		for (size_t iy = 0; iy < 4; iy++)
+			for (size_t iz = 0; iz < 4; iz++) {
+				coarse->get(ix, iy, iz) = Vector3f(1, 0, 0);
+				fine->get(ix, iy, iz) = Vector3f(0, ix, 0);
+			}
+
+	NestedTurbulenceField field;
+	field.addLevel(coarse);
+	field.addLevel(fine);
+	EXPECT_EQ(2, field.getNumberOfLevels());
+	EXPECT_THROW(field.addLevel(new VectorGrid(Vector3d(0.), 4, 0.5)), std::runtime_error);
+
+	Vector3d b = field.getField(Vector3d(0.25 * 2 + 0.125, 0, 0));
+	Vector3d c = field.getField(Vector3d(3 + 0.25 * 2 + 0.125, 0, 0));
+	EXPECT_DOUBLE_EQ(1, b.x);
+	EXPECT_DOUBLE_EQ(2, b.y);
+	EXPECT_DOUBLE_EQ(b.y, c.y);
+
+	Vector3d positions[2] = {Vector3d(0.625, 0, 0), Vector3d(3.625, 0.3, 0.1)};
+	Vector3d fields[2];
+	field.getFields(positions, fields, 2);
+	EXPECT_DOUBLE_EQ(field.getField(positions[1]).y, fields[1].y);
+	EXPECT_DOUBLE_EQ(b.y, fields[0].y);
+}
+
+TEST(testJF12Field, sharedRealizations) {
+	// the same seed gives the same grid, in the process and from the directory
+	JF12Field a, b, c;
+	a.randomStriated(17);
+	b.randomStriated(17);
+	c.randomStriated(18);
+	EXPECT_EQ(a.getStriatedGrid().get(), b.getStriatedGrid().get());
+	EXPECT_NE(a.getStriatedGrid().get(), c.getStriatedGrid().get());
+
+	JF12Field::clearRealizations();
+	JF12Field::setRealizationDirectory(".");
+	JF12Field d;
+	d.randomStriated(17);
+	EXPECT_FALSE(d.getStriatedGrid()->isMapped());
+	JF12Field::clearRealizations();
+	JF12Field e;
+	e.randomStriated(17);
+	EXPECT_TRUE(e.getStriatedGrid()->isMapped());
+	EXPECT_FLOAT_EQ(a.getStriatedGrid()->get(3, 4, 5), e.getStriatedGrid()->get(3, 4, 5));
+	JF12Field::setRealizationDirectory("");
+	JF12Field::clearRealizations();
+	std::remove("JF12Striated-17.raw");
+}
+
+TEST(testJF12Field, cacheRegularField) {
+	JF12Field field;
+	Vector3d pos(-8.5 * kpc, 1 * kpc, 0.3 * kpc);
+	field.cacheRegularField(0.25 * kpc, 24 * kpc);
+	EXPECT_TRUE(field.isCachingRegularField());
+	Vector3d exact = field.getRegularField(pos);
+	EXPECT_NEAR(0, (field.getField(pos) - exact).getR(), 0.1 * exact.getR());
+	// outside of the cube
+	Vector3d far(15 * kpc, 0, 0);
+	EXPECT_TRUE(field.getField(far) == field.getRegularField(far));
+	field.setUseXField(false);
+	EXPECT_FALSE(field.isCachingRegularField());
+}
+
+TEST(testMagneticFieldSnapshots, interpolation) {
+	// snapshots of uniform fields B_x = 1 + z at z = 0, 1, 2
+	const char *files[3] = {"testSnapshot0.raw", "testSnapshot1.raw", "testSnapshot2.raw"};
+	ref_ptr<VectorGrid> grid = new VectorGrid(Vector3d(0.), 4, 1.);
+	MagneticFieldSnapshots field(Vector3d(0.), 4, 1.);
+	for (int i = 2; i >= 0; i--) {
+		for (size_t j = 0; j < grid->getGrid().size(); j++)
+			grid->getGrid()[j] = Vector3f(1 + i, 0, 0);
+		dumpGrid(grid, files[i]);
+		field.addSnapshot(i, files[i]);
+	}
+	EXPECT_EQ(3, field.getNumberOfSnapshots());
+	EXPECT_DOUBLE_EQ(1, field.getRedshift(1));
+	EXPECT_EQ(0, field.getNumberOfMapped());
+
+	Vector3d p(1.3, 2.1, 0.2);
+	EXPECT_DOUBLE_EQ(2.5, field.getField(p, 1.5).x);
+	EXPECT_DOUBLE_EQ(3, field.getField(p, 5).x);
+	EXPECT_DOUBLE_EQ(1.25, field.getField(p, 0.25).x);
+	EXPECT_DOUBLE_EQ(1, field.getField(p).x);
+
+	Vector3d fields[2];
+	Vector3d positions[2] = {p, Vector3d(3.5, 0, 1)};
+	field.getFields(positions, fields, 2, 0.5);
+	EXPECT_DOUBLE_EQ(1.5, fields[1].x);
+
+	// the least recently used snapshot is unmapped
+	MagneticFieldSnapshots limited(Vector3d(0.), 4, 1.);
+	for (int i = 0; i < 3; i++)
+		limited.addSnapshot(i, files[i]);
+	limited.setPrefetch(false);
+	limited.setMaxMapped(2);
+	EXPECT_THROW(limited.setMaxMapped(1), std::runtime_error);
+	limited.getField(p, 1.5);
+	limited.getField(p, 0.5);
+	EXPECT_EQ(2, limited.getNumberOfMapped());
+	EXPECT_DOUBLE_EQ(2.5, limited.getField(p, 1.5).x);
+
+	for (int i = 0; i < 3; i++)
+		std::remove(files[i]);
+}
+
 #ifdef CRPROPA_HAVE_FFTW3F
+TEST(testNestedTurbulenceField, Brms) {
+	// two levels of 32^3 points for the range of a 256^3 grid
+	NestedTurbulenceField field;
+	field.addLevel(new VectorGrid(Vector3d(0.), 32, 8 * kpc));
+	field.addLevel(new VectorGrid(Vector3d(0.), 32, 1 * kpc));
+	field.initTurbulence(1 * nG, 2 * kpc, 128 * kpc, -11. / 3., 42);
+
+	double b2 = 0;
+	for (size_t i = 0; i < 2; i++)
+		b2 += pow(rmsFieldStrength(field.getLevel(i)), 2);
+	EXPECT_NEAR(1 * nG, sqrt(b2), 1e-3 * nG);
+	EXPECT_GT(rmsFieldStrength(field.getLevel(0)), rmsFieldStrength(field.getLevel(1)));
+
+	// lMin below the finest level
+	EXPECT_THROW(field.initTurbulence(1 * nG, 1 * kpc, 128 * kpc), std::runtime_error);
+}
+
 TEST(testVectorFieldGrid, Turbulence_bmean_brms) {
 	// Test for zero mean: <B> = 0
 	size_t n = 64;
@@ -109,6 +367,27 @@ TEST(testVectorFieldGrid, Turbulence_seed) {
 	EXPECT_FLOAT_EQ(grid1->interpolate(pos).x, grid2->interpolate(pos).x);
 }
 
+#ifdef _OPENMP
+TEST(testVectorFieldGrid, Turbulence_threads) {
+	// Test if the field does not depend on the number of threads
+	size_t n = 16;
+	double spacing = 1 * Mpc;
+	int threads = omp_get_max_threads();
+
+	omp_set_num_threads(1);
+	ref_ptr<VectorGrid> grid1 = new VectorGrid(Vector3d(0, 0, 0), n, spacing);
+	initTurbulence(grid1, 1, 2 * spacing, 8 * spacing, -11. / 3., 753);
+
+	omp_set_num_threads(4);
+	ref_ptr<VectorGrid> grid2 = new VectorGrid(Vector3d(0, 0, 0), n, spacing);
+	initTurbulence(grid2, 1, 2 * spacing, 8 * spacing, -11. / 3., 753);
+	omp_set_num_threads(threads);
+
+	for (size_t i = 0; i < grid1->getGrid().size(); i++)
+		EXPECT_TRUE(grid1->getGrid()[i] == grid2->getGrid()[i]);
+}
+#endif
+
 TEST(testVectorFieldGrid, turbulence_Exceptions) {
 	// Test exceptions
 	size_t n = 64;
@@ -130,6 +409,52 @@ TEST(testVectorFieldGrid, turbulence_Exceptions) {
 }
 #endif // CRPROPA_HAVE_FFTW3F
 
+TEST(testMagneticFieldGrid, getFields) {
+	ref_ptr<VectorGrid> grid = new VectorGrid(Vector3d(0.), 4, 1);
+	ref_ptr<ScalarGrid> modGrid = new ScalarGrid(Vector3d(0.), 4, 1);
+	for (int ix = 0; ix < 4; ix++)
+		for (int iy = 0; iy < 4; iy++)
+			for (int iz = 0; iz < 4; iz++) {
+				grid->get(ix, iy, iz) = Vector3f(ix, iy * iz, 1);
+				modGrid->get(ix, iy, iz) = iz + 1;
+			}
+	MagneticFieldGrid field(grid);
+	ModulatedMagneticFieldGrid modField(grid, modGrid);
+
+	std::vector<Vector3d> positions, fields(10), modFields(10);
+	for (int i = 0; i < 10; i++)
+		positions.push_back(Vector3d(0.37 * i, 1.1 * i - 3, 0.49 * i));
+	field.getFields(&positions[0], &fields[0], 10);
+	modField.getFields(&positions[0], &modFields[0], 10);
+	for (size_t i = 0; i < 10; i++) {
+		EXPECT_TRUE(field.getField(positions[i]) == fields[i]);
+		EXPECT_TRUE(modField.getField(positions[i]) == modFields[i]);
+	}
+
+	field.setTricubic(true);
+	EXPECT_TRUE(field.isTricubic());
+	field.getFields(&positions[0], &fields[0], 10);
+	EXPECT_TRUE(Vector3d(grid->interpolateTricubic(positions[3])) == fields[3]);
+	EXPECT_NEAR(2, field.getField(Vector3d(2.5, 1.5, 2.5)).x, 1e-6);
+}
+
+TEST(testMagneticFieldGrid, quantized) {
+	ref_ptr<VectorGrid> grid = new VectorGrid(Vector3d(0.), 4, 1);
+	for (int ix = 0; ix < 4; ix++)
+		for (int iy = 0; iy < 4; iy++)
+			for (int iz = 0; iz < 4; iz++)
+				grid->get(ix, iy, iz) = Vector3f(ix, iy * iz, 1) * nG;
+	MagneticFieldGrid field(grid);
+	MagneticFieldGrid quantizedField(quantizeGrid(grid));
+	EXPECT_FALSE(quantizedField.getGrid().valid());
+
+	Vector3d pos(0.37, 1.1, 2.49);
+	Vector3d b = quantizedField.getField(pos);
+	EXPECT_NEAR(field.getField(pos).x, b.x, 1e-4 * nG);
+	EXPECT_NEAR(field.getField(pos).y, b.y, 1e-4 * nG);
+	EXPECT_NEAR(field.getField(pos).z, b.z, 1e-4 * nG);
+}
+
 class EchoMagneticField: public MagneticField {
 public:
 	Vector3d getField(const Vector3d &position) const {
@@ -162,6 +487,116 @@ TEST(testPeriodicMagneticField, Exceptions) {
 
 }
 
+// B = (x, 0, 0) nT, counts the calls
+class BatchLinearField: public BatchMagneticField {
+public:
+	mutable size_t calls;
+	BatchLinearField() : calls(0) {
+	}
+	void getFieldArray(const Vector3dArray &positions, Vector3dArray &fields,
+			double z) const {
+		calls++;
+		for (size_t i = 0; i < positions.size; i++)
+			fields.set(i, Vector3d(positions.get(i).x, 0, 0) * nG);
+	}
+};
+
+TEST(BatchMagneticField, getFields) {
+	BatchLinearField field;
+	EXPECT_DOUBLE_EQ(2 * nG, field.getField(Vector3d(2, 5, 0)).x);
+	std::vector<Vector3d> positions(10), fields(10);
+	for (size_t i = 0; i < 10; i++)
+		positions[i] = Vector3d(i, 0, 0);
+	field.getFields(&positions[0], &fields[0], 10, 0.1);
+	EXPECT_EQ(2, field.calls);
+	for (size_t i = 0; i < 10; i++)
+		EXPECT_DOUBLE_EQ(i * nG, fields[i].x);
+}
+
+TEST(testCachedMagneticField, SimpleTest) {
+	// a linear field is interpolated exactly inside the box
+	ref_ptr<EchoMagneticField> f = new EchoMagneticField();
+	CachedMagneticField cached(f, Vector3d(-10, 0, 5), Vector3d(20, 10, 7), 2);
+	EXPECT_EQ(11, cached.getGrid()->getNx());
+	EXPECT_EQ(6, cached.getGrid()->getNy());
+	EXPECT_EQ(5, cached.getGrid()->getNz());
+
+	Vector3d pos(-9.3, 9.9, 11.5);
+	Vector3d b = cached.getField(pos);
+	EXPECT_NEAR(pos.x, b.x, 1e-5);
+	EXPECT_NEAR(pos.y, b.y, 1e-5);
+	EXPECT_NEAR(pos.z, b.z, 1e-5);
+
+	// outside of the box the field is evaluated directly
+	EXPECT_TRUE(cached.getField(Vector3d(100, 0, 0)) == Vector3d(100, 0, 0));
+
+	// the saved grid can be reused
+	cached.save("testCached.raw");
+	ref_ptr<VectorGrid> grid = new VectorGrid(cached.getGrid()->getOrigin(),
+			11, 6, 5, 2.);
+	loadGrid(grid, "testCached.raw");
+	CachedMagneticField reloaded(f, grid);
+	EXPECT_TRUE(reloaded.getBoxOrigin() == Vector3d(-10, 0, 5));
+	EXPECT_TRUE(reloaded.getField(pos) == b);
+}
+
+class SineMagneticField: public MagneticField {
+public:
+	Vector3d getField(const Vector3d &position) const {
+		return Vector3d(sin(position.y), 0, 1);
+	}
+};
+
+TEST(testCachedMagneticField, refine) {
+	ref_ptr<SineMagneticField> f = new SineMagneticField();
+	CachedMagneticField cached(f, Vector3d(0.), Vector3d(10.), 2);
+	double coarse = cached.getRelativeError(1000, 1);
+	EXPECT_GT(coarse, 0.01);
+	double error = cached.refine(0.01, 0.1);
+	EXPECT_LT(error, 0.01);
+	EXPECT_LT(cached.getSpacing(), 2);
+	EXPECT_GE(cached.getSpacing(), 0.1);
+}
+
+TEST(testOctreeMagneticField, SimpleTest) {
+	// root with 8 children, the upper octant (7) refined once more
+	std::vector<OctreeNode> nodes(17);
+	nodes[0].child = 1;
+	for (int i = 0; i < 8; i++)
+		nodes[1 + i].x = i;
+	nodes[8].child = 9;
+	for (int i = 0; i < 8; i++)
+		nodes[9 + i].y = i;
+
+	OctreeMagneticField field(Vector3d(-1, -1, -1), 2);
+	field.setNodes(nodes);
+	EXPECT_EQ(1 + 4 + 1, field.getLeaf(Vector3d(0.5, -0.5, 0.5)));
+	EXPECT_DOUBLE_EQ(5, field.getField(Vector3d(0.5, -0.5, 0.5)).x);
+	EXPECT_DOUBLE_EQ(0, field.getField(Vector3d(-0.1, -0.1, -0.1)).x);
+	EXPECT_DOUBLE_EQ(6, field.getField(Vector3d(0.9, 0.9, 0.1)).y);
+	EXPECT_DOUBLE_EQ(1, field.getField(Vector3d(0.1, 0.1, 0.9)).y);
+	EXPECT_EQ(-1, field.getLeaf(Vector3d(1.1, 0, 0)));
+	EXPECT_TRUE(field.getField(Vector3d(1.1, 0, 0)) == Vector3d(0.));
+
+	// batched lookup
+	std::vector<Vector3d> positions, fields(10);
+	for (int i = 0; i < 10; i++)
+		positions.push_back(Vector3d(0.23 * i - 1, 0.7 - 0.19 * i, 0.2 * i - 0.9));
+	field.getFields(&positions[0], &fields[0], 10);
+	for (size_t i = 0; i < 10; i++)
+		EXPECT_TRUE(field.getField(positions[i]) == fields[i]);
+
+	// save and load
+	field.save("testOctree.raw");
+	OctreeMagneticField loaded(Vector3d(-1, -1, -1), 2, "testOctree.raw");
+	EXPECT_EQ(17, loaded.getNodes().size());
+	EXPECT_DOUBLE_EQ(6, loaded.getField(Vector3d(0.9, 0.9, 0.1)).y);
+
+	// not breadth-first
+	nodes[8].child = 1;
+	EXPECT_THROW(field.setNodes(nodes), std::runtime_error);
+}
+
 int main(int argc, char **argv) {
 	::testing::InitGoogleTest(&argc, argv);
 	return RUN_ALL_TESTS();
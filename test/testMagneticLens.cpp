@@ -9,14 +9,20 @@
 // Licensed under the GNU GPL v2             - 
 //--------------------------------------------
 
+#include <cstdio>
+#include <fstream>
 #include <string>
 #include "gtest/gtest.h"
 
+#include "crpropa/magneticLens/LensBuilder.h"
+#include "crpropa/magneticLens/LensOffload.h"
 #include "crpropa/magneticLens/MagneticLens.h"
 #include "crpropa/magneticLens/ModelMatrix.h"
 #include "crpropa/magneticLens/Pixelization.h"
 #include "crpropa/magneticLens/ParticleMapsContainer.h"
+#include "crpropa/Candidate.h"
 #include "crpropa/Common.h"
+#include "crpropa/Random.h"
 
 using namespace std;
 using namespace crpropa;
@@ -100,6 +106,254 @@ TEST(MagneticLens, OutOfBoundsEnergy)
 }
 
 
+TEST(MagneticLens, sampleColumn)
+{
+	// Test if the binary search draws the rows of the linear accumulation
+	ModelMatrixType M(12, 12);
+	M.insert(2, 0) = 0.25;
+	M.insert(5, 0) = 0.5;
+	M.insert(7, 0) = 0.125;
+	M.insert(3, 1) = 1;
+	LensPart part("Direct Input", 1, 10);
+	part.setMatrix(M);
+
+	uint32_t row = 0;
+	EXPECT_TRUE(part.sampleColumn(0, 0.1, row));
+	EXPECT_EQ(2, row);
+	EXPECT_TRUE(part.sampleColumn(0, 0.25, row));
+	EXPECT_EQ(5, row);
+	EXPECT_TRUE(part.sampleColumn(0, 0.8, row));
+	EXPECT_EQ(7, row);
+	EXPECT_FALSE(part.sampleColumn(0, 0.9, row)); // lost
+	EXPECT_TRUE(part.sampleColumn(1, 0.9, row));
+	EXPECT_EQ(3, row);
+	EXPECT_FALSE(part.sampleColumn(2, 0., row)); // empty column
+}
+
+TEST(MagneticLens, lensPartBins)
+{
+	// Test the lookup of lens parts in equal bins of log10(rigidity)
+	Pixelization P(1);
+	ModelMatrixType M(P.nPix(), P.nPix());
+	MagneticLens lens(1);
+	lens.setLensPart(M, pow(10, 18.5) * eV, pow(10, 18.6) * eV);
+	lens.setLensPart(M, pow(10, 18.3) * eV, pow(10, 18.4) * eV);
+	lens.setLensPart(M, pow(10, 18.4) * eV, pow(10, 18.5) * eV);
+	const std::vector<LensPart*> &parts = lens.getLensParts();
+	EXPECT_TRUE(lens.getLensPart(pow(10, 18.35) * eV) == parts[1]);
+	EXPECT_TRUE(lens.getLensPart(pow(10, 18.4) * eV) == parts[1]);
+	EXPECT_TRUE(lens.getLensPart(pow(10, 18.45) * eV) == parts[2]);
+	EXPECT_TRUE(lens.getLensPart(pow(10, 18.59) * eV) == parts[0]);
+	EXPECT_TRUE(lens.getLensPart(pow(10, 18.3) * eV) == NULL);
+	EXPECT_TRUE(lens.getLensPart(pow(10, 18.61) * eV) == NULL);
+	EXPECT_TRUE(lens.getLensPart(pow(10, 25) * eV) == NULL);
+
+	// a gap: searched
+	lens.setLensPart(M, pow(10, 19) * eV, pow(10, 19.1) * eV);
+	EXPECT_TRUE(lens.getLensPart(pow(10, 19.05) * eV) == parts[3]);
+	EXPECT_TRUE(lens.getLensPart(pow(10, 18.45) * eV) == parts[2]);
+	EXPECT_TRUE(lens.getLensPart(pow(10, 18.8) * eV) == NULL);
+}
+
+TEST(MagneticLens, mappedMatrix)
+{
+	// Compare lenses of the same matrix in memory and mapped from file
+	Pixelization P(1);
+	ModelMatrixType M(P.nPix(), P.nPix());
+	for (int i = 0; i < P.nPix(); i++)
+	{
+		M.insert(i, i) = 0.25;
+		M.insert((i + 3) % P.nPix(), i) = 0.5 + 0.01 * i;
+	}
+	M.makeCompressed();
+	serializeCSC("lens_double.csc", M);
+	serializeCSC("lens_float.csc", M, true);
+	EXPECT_TRUE(isCSCFile("lens_double.csc"));
+	EXPECT_TRUE(isCSCFile("lens_float.csc"));
+
+	std::ofstream cfg("lens_mapped.cfg");
+	cfg << "lens_double.csc 18 19\nlens_float.csc 19 20\n";
+	cfg.close();
+	MagneticLens mapped("lens_mapped.cfg");
+	MagneticLens memory(1);
+	memory.setLensPart(M, pow(10, 18) * eV, pow(10, 19) * eV);
+	ASSERT_EQ(2, mapped.getLensParts().size());
+	EXPECT_TRUE(mapped.getLensParts()[0]->isMapped());
+	EXPECT_NEAR(memory.getLensParts()[0]->getMaximumOfSumsOfColumns(),
+			mapped.getLensPart(pow(10, 18.5) * eV)->getMaximumOfSumsOfColumns(), 1e-15);
+
+	mapped.normalizeLens();
+	memory.normalizeLens();
+	EXPECT_TRUE(mapped.getLensParts()[0]->isMapped());
+	for (int i = 0; i < P.nPix(); i++)
+	{
+		for (int k = 0; k < 4; k++)
+		{
+			double rn = 0.3 * k;
+			uint32_t r1 = 0, r2 = 0;
+			bool s1 = memory.getLensParts()[0]->sampleColumn(i, rn, r1);
+			bool s2 = mapped.getLensPart(pow(10, 18.5) * eV)->sampleColumn(i, rn, r2);
+			EXPECT_EQ(s1, s2);
+			EXPECT_EQ(r1, r2);
+			s2 = mapped.getLensPart(pow(10, 19.5) * eV)->sampleColumn(i, rn, r2);
+			EXPECT_EQ(s1, s2);
+			EXPECT_EQ(r1, r2);
+		}
+	}
+
+	std::vector<double> v1(P.nPix()), v2(P.nPix()), v3(P.nPix());
+	for (int i = 0; i < P.nPix(); i++)
+		v1[i] = v2[i] = v3[i] = 1 + i;
+	memory.transformModelVector(&v1[0], pow(10, 18.5) * eV);
+	mapped.transformModelVector(&v2[0], pow(10, 18.5) * eV);
+	mapped.transformModelVector(&v3[0], pow(10, 19.5) * eV);
+	for (int i = 0; i < P.nPix(); i++)
+	{
+		EXPECT_NEAR(v1[i], v2[i], 1e-6 * v1[i]);
+		EXPECT_NEAR(v1[i], v3[i], 1e-6 * v1[i]);
+	}
+
+	// copied into memory on request
+	ModelMatrixType &m = mapped.getLensParts()[0]->getMatrix();
+	EXPECT_FALSE(mapped.getLensParts()[0]->isMapped());
+	EXPECT_EQ(M.nonZeros(), m.nonZeros());
+	EXPECT_NEAR(M.coeff(3, 0) / mapped.getNorm(), m.coeff(3, 0), 1e-15);
+
+	remove("lens_double.csc");
+	remove("lens_float.csc");
+	remove("lens_mapped.cfg");
+}
+
+TEST(MagneticLens, compactMatrix)
+{
+	// columns of a large entry and a tail of small ones
+	Pixelization P(1);
+	ModelMatrixType M(P.nPix(), P.nPix());
+	for (int i = 0; i < P.nPix(); i++)
+	{
+		M.insert(i, i) = 0.5;
+		for (int k = 1; k < 6; k++)
+			M.insert((i + k) % P.nPix(), i) = 0.1 / (1 << k);
+	}
+	M.makeCompressed();
+	double sum = M.col(0).sum();
+
+	// the two smallest elements are below 2%, removed, and the rest rescaled
+	ModelMatrixType pruned(M);
+	MatrixCompaction c = compactMatrix(pruned, 0.02);
+	EXPECT_EQ(6 * P.nPix(), c.nonZerosBefore);
+	EXPECT_EQ(4 * P.nPix(), c.nonZerosAfter);
+	EXPECT_EQ(P.nPix(), c.columns);
+	EXPECT_NEAR(sum, pruned.col(7).sum(), 1e-14);
+	EXPECT_EQ(0, pruned.coeff(12, 7));
+	double error = 2 * (0.1 / 32 + 0.1 / 16) / sum;
+	EXPECT_NEAR(error, c.maximumError, 1e-12);
+	EXPECT_NEAR(error, c.meanError, 1e-12);
+	EXPECT_THROW(compactMatrix(pruned, 1), std::runtime_error);
+
+	// uint16 steps of the column sums, stored exactly
+	ModelMatrixType steps(M);
+	c = compactMatrix(steps, 0, true);
+	EXPECT_EQ(6 * P.nPix(), c.nonZerosAfter);
+	EXPECT_LT(c.maximumError, 6. / CDF_STEPS);
+	EXPECT_GT(c.maximumError, 0);
+	serializeCSCSteps("lens_steps.csc", steps);
+	{
+		MappedModelMatrix mapped("lens_steps.csc");
+		EXPECT_TRUE(mapped.isSteps());
+		ModelMatrixType m;
+		mapped.toSparseMatrix(m);
+		for (int i = 0; i < P.nPix(); i++)
+			for (int k = 0; k < 6; k++)
+			{
+				int r = (i + k) % P.nPix();
+				EXPECT_NEAR(steps.coeff(r, i), m.coeff(r, i), 1e-15);
+			}
+		EXPECT_NEAR(sum, mapped.maximumOfSumsOfColumns(), 1e-14);
+	}
+
+	// a lens of the steps file samples as the compacted lens in memory
+	MagneticLens memory(1), mapped;
+	memory.setLensPart(M, pow(10, 18) * eV, pow(10, 19) * eV);
+	c = memory.compactLens(0, true);
+	EXPECT_EQ(6 * P.nPix(), c.nonZerosBefore);
+	std::ofstream cfg("lens_steps.cfg");
+	cfg << "lens_steps.csc 18 19\n";
+	cfg.close();
+	mapped.loadLens("lens_steps.cfg");
+	for (int i = 0; i < P.nPix(); i++)
+		for (int k = 0; k < 10; k++)
+		{
+			uint32_t r1 = 0, r2 = 0;
+			bool s1 = memory.getLensParts()[0]->sampleColumn(i, 0.08 * k, r1);
+			bool s2 = mapped.getLensParts()[0]->sampleColumn(i, 0.08 * k, r2);
+			EXPECT_EQ(s1, s2);
+			EXPECT_EQ(r1, r2);
+		}
+	remove("lens_steps.csc");
+	remove("lens_steps.cfg");
+}
+
+static Vector3d pixelDirection(const Pixelization &P, uint32_t i)
+{
+	double lon, lat;
+	P.pix2Direction(i, lon, lat);
+	return Vector3d(cos(lat) * cos(lon), cos(lat) * sin(lon), sin(lat));
+}
+
+TEST(LensBuilder, buildLens)
+{
+	// Build a lens from backtracked antiprotons in parallel, write and load it
+	LensBuilder builder(1, 2, 18, 20);
+	builder.setMaximumTransitions(7); // combine equal transitions
+	const Pixelization &P = builder.getPixelization();
+	const int nPix = P.nPix();
+	#pragma omp parallel for
+	for (int k = 0; k < 10 * nPix; k++)
+	{
+		int i = k % nPix;
+		ref_ptr<Candidate> c = new Candidate(-1000010010, pow(10, 18.5) * eV,
+				Vector3d(0.), pixelDirection(P, i));
+		c->current.setDirection(pixelDirection(P, (i + 5) % nPix));
+		builder.process(c);
+		c = new Candidate(-1000010010, pow(10, 19.5) * eV, Vector3d(0.),
+				pixelDirection(P, i), 0, 2);
+		c->current.setDirection(pixelDirection(P, (i + 1) % nPix));
+		builder.process(c);
+		// not counted: neutral or outside of the rigidities
+		c = new Candidate(22, pow(10, 18.5) * eV, Vector3d(0.), pixelDirection(P, i));
+		builder.process(c);
+		c = new Candidate(-1000010010, pow(10, 20.5) * eV, Vector3d(0.), pixelDirection(P, i));
+		builder.process(c);
+	}
+
+	for (int i = 0; i < nPix; i++)
+	{
+		EXPECT_DOUBLE_EQ(10, builder.getMatrix(0).coeff(i, (i + 5) % nPix));
+		EXPECT_DOUBLE_EQ(20, builder.getMatrix(1).coeff(i, (i + 1) % nPix));
+	}
+	EXPECT_EQ(nPix, builder.getMatrix(0).nonZeros());
+	EXPECT_EQ(nPix, builder.getMatrix(1).nonZeros());
+
+	builder.write("lens_builder.cfg");
+	MagneticLens lens("lens_builder.cfg");
+	ASSERT_EQ(2, lens.getLensParts().size());
+	LensPart *part = lens.getLensPart(pow(10, 19.5) * eV);
+	ASSERT_TRUE(part != NULL);
+	EXPECT_DOUBLE_EQ(20, part->getMatrix().coeff(3, 4));
+
+	// results of another node
+	builder.addLens("lens_builder.cfg");
+	EXPECT_DOUBLE_EQ(20, builder.getMatrix(0).coeff(0, 5));
+	EXPECT_DOUBLE_EQ(40, builder.getMatrix(1).coeff(0, 1));
+	LensBuilder other(1, 3, 18, 20);
+	EXPECT_THROW(other.addLens("lens_builder.cfg"), std::runtime_error);
+
+	remove("lens_builder.cfg");
+	remove("lens_builder_0.csc");
+	remove("lens_builder_1.csc");
+}
+
 TEST(Pixelization, angularDistance)
 {
 	// test for correct angular distance in case of same vectors 
@@ -111,6 +365,32 @@ TEST(Pixelization, angularDistance)
 	}
 }
 
+TEST(Pixelization, direction2Pix)
+{
+	// pixel centers map to their pixel, with and without the table of centers
+	for (int order = 6; order <= 9; order += 3)
+	{
+		Pixelization P(order);
+		std::vector<double> lon(3000), lat(3000);
+		std::vector<uint32_t> pix(3000);
+		for (size_t k = 0; k < lon.size(); k++)
+		{
+			uint32_t i = (k * 104729) % P.nPix();
+			P.pix2Direction(i, lon[k], lat[k]);
+			EXPECT_EQ(i, P.direction2Pix(lon[k], lat[k]));
+		}
+		P.direction2Pix(&lon[0], &lat[0], &pix[0], lon.size());
+		for (size_t k = 0; k < lon.size(); k++)
+			EXPECT_EQ(P.direction2Pix(lon[k], lat[k]), pix[k]);
+		EXPECT_NEAR(0, P.angularDistance(pix[0], pix[0]), 1e-7);
+	}
+
+	// the poles, with rounding
+	Pixelization P(6);
+	EXPECT_LT(P.direction2Pix(0.3, M_PI / 2 + 1e-15), 4);
+	EXPECT_GE(P.direction2Pix(-2, -M_PI / 2), P.nPix() - 4);
+}
+
 
 TEST(ParticleMapsContainer, addParticle)
 {
@@ -151,6 +431,153 @@ TEST(ParticleMapsContainer, getRandomParticles)
 
 }
 
+TEST(ParticleMapsContainer, weights)
+{
+  // bins added in any order, the weights of the energies and ids
+  ParticleMapsContainer maps;
+  maps.addParticle(1000010010, pow(10, 18.5) * eV, 0, 0, 1);
+  maps.addParticle(1000010010, pow(10, 18.1) * eV, 0.5, 0.2, 2);
+  maps.addParticle(1000010010, pow(10, 19.3) * eV, -0.5, 0.2, 3);
+  maps.addParticle(1000020040, pow(10, 18.1) * eV, 1, 1, 4);
+  maps.addParticle(1000010010, pow(10, 18.5) * eV, 0, 0, 1);
+
+  std::vector<double> energies = maps.getEnergies(1000010010);
+  ASSERT_EQ(energies.size(), 3);
+  EXPECT_NEAR(log10(energies[0]), 18.1, 0.02);
+  EXPECT_NEAR(log10(energies[1]), 18.5, 0.02);
+  EXPECT_NEAR(log10(energies[2]), 19.3, 0.02);
+  EXPECT_EQ(maps.getEnergies(22).size(), 0);
+  EXPECT_TRUE(maps.getMap(1000010010, pow(10, 18.7) * eV) == NULL);
+
+  EXPECT_DOUBLE_EQ(maps.getSumOfWeights(), 11);
+  EXPECT_DOUBLE_EQ(maps.getWeight(1000010010, pow(10, 18.5) * eV), 2);
+  EXPECT_DOUBLE_EQ(maps.getWeight(1000010010, pow(10, 19.3) * eV), 3);
+  EXPECT_DOUBLE_EQ(maps.getWeight(1000020040, pow(10, 18.1) * eV), 4);
+  EXPECT_DOUBLE_EQ(maps.getWeight(1000010010, pow(10, 18.7) * eV), 0);
+
+  std::vector<double> e, lons, lats;
+  std::vector<int> ids;
+  size_t N = 11000;
+  maps.getRandomParticles(N, ids, e, lons, lats);
+  int helium = 0;
+  for (size_t i = 0; i < N; i++)
+    if (ids[i] == 1000020040) {
+      helium++;
+      EXPECT_NEAR(lons[i], 1, 0.05);
+      EXPECT_NEAR(lats[i], 1, 0.05);
+    }
+  EXPECT_NEAR(helium, 4000, 200);
+
+  double lon, lat;
+  EXPECT_TRUE(maps.placeOnMap(1000010010, pow(10, 19.3) * eV, lon, lat));
+  EXPECT_NEAR(lon, -0.5, 0.05);
+  EXPECT_NEAR(lat, 0.2, 0.05);
+  EXPECT_FALSE(maps.placeOnMap(1000010010, pow(10, 18.7) * eV, lon, lat));
+  EXPECT_FALSE(maps.placeOnMap(22, pow(10, 18.1) * eV, lon, lat));
+}
+
+TEST(ParticleMapsContainer, applyLens)
+{
+  // Test the batched lensing against the product of each map
+  Pixelization P(6);
+  ModelMatrixType M(P.nPix(), P.nPix());
+  for (size_t i = 0; i < P.nPix(); i++)
+    M.insert((i * 7) % P.nPix(), i) = 0.5;
+  MagneticLens lens(6);
+  lens.setLensPart(M, 1 * EeV, 100 * EeV);
+
+  ParticleMapsContainer maps;
+  for (int i = 0; i < 36; i++)
+    maps.addParticle(1000010010, pow(10, 18.1 + 0.05 * i) * eV, 0.1 * i, 0.02 * i);
+  maps.addParticle(22, 2 * EeV, 0.5, 0.5);
+
+  std::vector<std::vector<double> > expected;
+  std::vector<double> energies = maps.getEnergies(1000010010);
+  for (size_t i = 0; i < energies.size(); i++) {
+    double *m = maps.getMap(1000010010, energies[i] * eV);
+    expected.push_back(std::vector<double>(m, m + P.nPix()));
+    prod_up(M, &expected.back()[0]);
+  }
+  double *photons = maps.getMap(22, 2 * EeV);
+  std::vector<double> expectedPhotons(photons, photons + P.nPix());
+
+  maps.applyLens(lens);
+  for (size_t i = 0; i < energies.size(); i++) {
+    double *m = maps.getMap(1000010010, energies[i] * eV);
+    for (size_t j = 0; j < P.nPix(); j++)
+      ASSERT_DOUBLE_EQ(expected[i][j], m[j]);
+  }
+  for (size_t j = 0; j < P.nPix(); j++)
+    EXPECT_EQ(expectedPhotons[j], photons[j]); // norm 1
+}
+
+TEST(LensOffload, transformAndSample)
+{
+  // Test the device products and sampling against those of the host
+  Pixelization P(4);
+  ModelMatrixType M(P.nPix(), P.nPix());
+  for (size_t i = 0; i < P.nPix(); i++) {
+    M.insert((i * 7) % P.nPix(), i) = 0.5;
+    M.insert((i * 7 + 1) % P.nPix(), i) = 0.25;
+  }
+  MagneticLens lens(4);
+  lens.setLensPart(M, 1 * EeV, 100 * EeV);
+  LensOffload offload(lens, true);
+  offload.setBatchSize(2);
+
+  std::vector<std::vector<double> > models(5), expected(5);
+  std::vector<double*> pointers;
+  for (size_t i = 0; i < models.size(); i++) {
+    for (size_t j = 0; j < P.nPix(); j++)
+      models[i].push_back(((i + 1) * j) % 13);
+    expected[i] = models[i];
+    lens.transformModelVector(&expected[i][0], 10 * EeV);
+    pointers.push_back(&models[i][0]);
+  }
+  offload.transformModelVectors(&pointers[0], pointers.size(), 10 * EeV);
+  for (size_t i = 0; i < models.size(); i++)
+    for (size_t j = 0; j < P.nPix(); j++)
+      ASSERT_DOUBLE_EQ(expected[i][j], models[i][j]);
+
+  // the maps of a container
+  ParticleMapsContainer maps, offloadMaps;
+  for (int i = 0; i < 20; i++) {
+    maps.addParticle(1000010010, pow(10, 18.1 + 0.05 * i) * eV, 0.1 * i, 0.02 * i);
+    offloadMaps.addParticle(1000010010, pow(10, 18.1 + 0.05 * i) * eV, 0.1 * i, 0.02 * i);
+  }
+  maps.applyLens(lens);
+  offloadMaps.applyLens(offload);
+  std::vector<double> energies = maps.getEnergies(1000010010);
+  for (size_t i = 0; i < energies.size(); i++) {
+    double *m = maps.getMap(1000010010, energies[i] * eV);
+    double *o = offloadMaps.getMap(1000010010, energies[i] * eV);
+    for (size_t j = 0; j < maps.getNumberOfPixels(); j++)
+      ASSERT_DOUBLE_EQ(m[j], o[j]);
+  }
+
+  // the same random numbers draw the same rows
+  std::vector<int> pixels;
+  for (int i = 0; i < 1000; i++)
+    pixels.push_back(i % P.nPix());
+  Random::instance().seed(3);
+  std::vector<int> arrival = offload.transformPixels(10 * EeV, pixels);
+  Random::instance().seed(3);
+  LensPart *part = lens.getLensPart(10 * EeV);
+  size_t lost = 0;
+  for (size_t i = 0; i < pixels.size(); i++) {
+    uint32_t row;
+    if (part->sampleColumn(pixels[i], Random::instance().rand(), row))
+      EXPECT_EQ((int) row, arrival[i]);
+    else {
+      EXPECT_EQ(-1, arrival[i]);
+      lost++;
+    }
+  }
+  EXPECT_GT(lost, 0);
+  EXPECT_EQ(-1, offload.transformPixels(0.1 * EeV, pixels)[0]);
+  EXPECT_THROW(LensOffload(lens).transformPixels(10 * EeV, pixels), std::runtime_error);
+}
+
 TEST(Pixelization, randomDirectionInPixel)
 {
   Pixelization p(6);
@@ -1,11 +1,29 @@
 #include "crpropa/ModuleList.h"
+#include "crpropa/Autotuner.h"
+#include "crpropa/Configuration.h"
+#include "crpropa/ModulePipeline.h"
+#include "crpropa/Affinity.h"
 #include "crpropa/Source.h"
 #include "crpropa/ParticleID.h"
+#include "crpropa/Random.h"
+#include "crpropa/SimulationPool.h"
 #include "crpropa/module/SimplePropagation.h"
 #include "crpropa/module/BreakCondition.h"
+#include "crpropa/module/Observer.h"
+#include "crpropa/module/PropagationCK.h"
+#include "crpropa/module/ParticleCollector.h"
+#include "crpropa/module/Output.h"
+#include "crpropa/Statistics.h"
+#include "crpropa/Trace.h"
 
 #include "gtest/gtest.h"
 
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+
 namespace crpropa {
 
 TEST(ModuleList, process) {
@@ -55,6 +73,348 @@ TEST(ModuleList, runSource) {
 	modules.run(&source, 100, false);
 }
 
+TEST(ModuleList, runSourceBatches) {
+	// Test if the number of primaries does not depend on the batch size
+	ModuleList modules;
+	modules.add(new SimplePropagation());
+	ref_ptr<MaximumTrajectoryLength> maxLength = new MaximumTrajectoryLength(1 * Mpc);
+	ref_ptr<ParticleCollector> collector = new ParticleCollector();
+	maxLength->onReject(collector);
+	modules.add(maxLength);
+	Source source;
+	source.add(new SourceParticleType(nucleusId(1, 1)));
+	source.add(new SourceEnergy(10 * EeV));
+
+	EXPECT_EQ(16, modules.getSourceBatchSize());
+	EXPECT_THROW(modules.setSourceBatchSize(0), std::runtime_error);
+	size_t sizes[3] = {1, 7, 1000};
+	for (int i = 0; i < 3; i++) {
+		collector->clearContainer();
+		modules.setSourceBatchSize(sizes[i]);
+		modules.run(&source, 100);
+		EXPECT_EQ(100, collector->size());
+	}
+}
+
+TEST(ModuleList, counterBasedRandom) {
+	// Test if each primary is reproduced from its index and the key
+	ModuleList modules;
+	modules.add(new SimplePropagation());
+	ref_ptr<MaximumTrajectoryLength> maxLength = new MaximumTrajectoryLength(1 * Mpc);
+	ref_ptr<ParticleCollector> collector = new ParticleCollector();
+	maxLength->onReject(collector);
+	modules.add(maxLength);
+	Source source;
+	source.add(new SourceParticleType(nucleusId(1, 1)));
+	source.add(new SourcePowerLawSpectrum(1 * EeV, 100 * EeV, -1));
+	source.add(new SourceIsotropicEmission());
+
+	EXPECT_FALSE(modules.getCounterBasedRandom());
+	modules.setCounterBasedRandom(true, 1234);
+	std::vector<double> energies[3];
+	size_t sizes[3] = {16, 1, 16};
+	for (int run = 0; run < 3; run++) {
+		collector->clearContainer();
+		modules.setSourceBatchSize(sizes[run]);
+		if (run == 2)
+			modules.setCounterBasedRandom(true, 4321);
+		modules.run(&source, 50);
+		ASSERT_EQ(50, collector->size());
+		for (size_t i = 0; i < collector->size(); i++)
+			energies[run].push_back((*collector)[i]->source.getEnergy());
+		std::sort(energies[run].begin(), energies[run].end());
+	}
+	EXPECT_TRUE(energies[0] == energies[1]);
+	EXPECT_FALSE(energies[0] == energies[2]);
+	modules.setCounterBasedRandom(false);
+	EXPECT_FALSE(modules.getCounterBasedRandom());
+}
+
+class RandomTurn: public Module {
+public:
+	void process(Candidate *candidate) const {
+		candidate->current.setDirection(Random::instance().randVector());
+	}
+};
+
+TEST(ModuleList, replay) {
+	// Test if getTrajectory replays a detected particle exactly
+	ref_ptr<ModuleList> modules = new ModuleList();
+	modules->add(new SimplePropagation(0.1 * Mpc, 0.1 * Mpc));
+	modules->add(new RandomTurn());
+	ref_ptr<MaximumTrajectoryLength> maxLength = new MaximumTrajectoryLength(1 * Mpc);
+	ref_ptr<ParticleCollector> collector = new ParticleCollector();
+	maxLength->onReject(collector);
+	modules->add(maxLength);
+	Source source;
+	source.add(new SourceParticleType(nucleusId(1, 1)));
+	source.add(new SourcePowerLawSpectrum(1 * EeV, 100 * EeV, -1));
+	source.add(new SourceIsotropicEmission());
+
+	modules->setCounterBasedRandom(true, 99);
+	modules->run(&source, 20);
+	ASSERT_EQ(20, collector->size());
+	ASSERT_TRUE(ModuleList::canReplay((*collector)[7]));
+
+	Random::instance().rand(); // the replay does not depend on the generator
+	ref_ptr<ParticleCollector> trajectory = new ParticleCollector();
+	collector->getTrajectory(modules, 7, trajectory);
+	EXPECT_EQ(3, modules->size());
+	ASSERT_EQ(10, trajectory->size());
+	const Candidate *detected = (*collector)[7];
+	const Candidate *replayed = (*trajectory)[9];
+	EXPECT_EQ(detected->current.getPosition(), replayed->current.getPosition());
+	EXPECT_EQ(detected->current.getDirection(), replayed->current.getDirection());
+	EXPECT_EQ(detected->source.getEnergy(), replayed->source.getEnergy());
+}
+
+TEST(ModuleList, profiling) {
+	ModuleList modules;
+	modules.add(new SimplePropagation(1 * kpc, 1 * kpc));
+	modules.add(new MaximumTrajectoryLength(5 * kpc));
+	modules.setProfiling();
+	EXPECT_TRUE(modules.getProfiling());
+	Source source;
+	source.add(new SourceParticleType(nucleusId(1, 1)));
+	source.add(new SourceEnergy(1 * EeV));
+	modules.run(&source, 10);
+
+	// 5 steps for each of the 10 candidates
+	std::string profile = modules.getProfile();
+	EXPECT_NE(std::string::npos, profile.find("50 calls, 0 secondaries"));
+	EXPECT_NE(std::string::npos, profile.find("Maximum trajectory length"));
+	EXPECT_EQ(50, modules.getProfileCalls(1));
+	EXPECT_EQ(0, modules.getProfileSecondaries(1));
+	EXPECT_GE(modules.getProfileTime(0), 0);
+
+	modules.resetProfile();
+	EXPECT_EQ(std::string::npos, modules.getProfile().find("50 calls"));
+	EXPECT_EQ(0, modules.getProfileCalls(1));
+
+	// hardware counters of every second call, where available
+	modules.setHardwareCounters(true, 2);
+	EXPECT_TRUE(modules.getHardwareCounters());
+	modules.run(&source, 10);
+	if (PerfCounters::isAvailable()) {
+		EXPECT_EQ(25, modules.getProfileCounterCalls(1));
+		EXPECT_GT(modules.getProfileCounter(1, PerfCounters::Instructions), 0);
+		EXPECT_NE(std::string::npos, modules.getProfile().find("IPC"));
+	} else {
+		EXPECT_EQ(0, modules.getProfileCounterCalls(1));
+		EXPECT_NE(std::string::npos, modules.getProfile().find("not available"));
+	}
+}
+
+TEST(ModuleList, trace) {
+	ModuleList modules;
+	modules.add(new SimplePropagation(1 * kpc, 1 * kpc));
+	modules.add(new MaximumTrajectoryLength(5 * kpc));
+	Source source;
+	source.add(new SourceParticleType(nucleusId(1, 1)));
+	source.add(new SourceEnergy(1 * EeV));
+	Trace::start(1000, 1);
+	EXPECT_TRUE(Trace::isEnabled());
+	modules.run(&source, 10);
+	Trace::stop();
+
+	// 10 primaries and 5 steps of 2 modules each
+	EXPECT_EQ(110, Trace::size());
+	std::string filename = "ModuleList_trace.json";
+	Trace::write(filename);
+	std::ifstream in(filename.c_str());
+	std::stringstream json;
+	json << in.rdbuf();
+	EXPECT_NE(std::string::npos, json.str().find("\"name\": \"primary\""));
+	EXPECT_NE(std::string::npos, json.str().find("\"args\": {\"index\": 9}"));
+	EXPECT_NE(std::string::npos, json.str().find("Maximum trajectory length"));
+	EXPECT_EQ('[', json.str()[0]);
+	remove(filename.c_str());
+
+	// the ring buffer keeps the latest events
+	Trace::start(5);
+	size_t name = Trace::addName("test", "test");
+	for (long i = 0; i < 10; i++)
+		Trace::record(name, i, i + 1, i);
+	Trace::stop();
+	EXPECT_EQ(5, Trace::size());
+	EXPECT_EQ(name, Trace::addName("test", "test"));
+}
+
+TEST(ModuleList, runSchedules) {
+	ModuleList modules;
+	modules.add(new SimplePropagation());
+	ref_ptr<MaximumTrajectoryLength> maxLength = new MaximumTrajectoryLength(1 * Mpc);
+	ref_ptr<ParticleCollector> collector = new ParticleCollector();
+	maxLength->onReject(collector);
+	modules.add(maxLength);
+	Source source;
+	source.add(new SourceParticleType(nucleusId(1, 1)));
+	source.add(new SourceEnergy(1 * EeV));
+
+	ModuleList::ScheduleType types[] = {ModuleList::StaticSchedule,
+			ModuleList::DynamicSchedule, ModuleList::GuidedSchedule,
+			ModuleList::AdaptiveSchedule};
+	for (size_t i = 0; i < 4; i++) {
+		collector->clearContainer();
+		modules.setSchedule(types[i], 3);
+		EXPECT_EQ(types[i], modules.getScheduleType());
+		modules.run(&source, 100);
+		EXPECT_EQ(100, collector->size());
+	}
+	EXPECT_GE(modules.getScheduleChunkSize(), 1);
+}
+
+TEST(ModuleList, eventLimit) {
+	ModuleList modules;
+	modules.add(new SimplePropagation());
+	ref_ptr<MaximumTrajectoryLength> maxLength = new MaximumTrajectoryLength(1 * Mpc);
+	ref_ptr<Output> output = new Output();
+	maxLength->onReject(output);
+	modules.add(maxLength);
+	Source source;
+	source.add(new SourceParticleType(nucleusId(1, 1)));
+	source.add(new SourceEnergy(1 * EeV));
+
+	modules.setEventLimit(output, 10);
+	modules.run(&source, 100);
+	EXPECT_GE(output->size(), 10);
+	EXPECT_LT(output->size(), 100);
+	EXPECT_EQ(output->size(), modules.getNumberOfCompleted());
+}
+
+TEST(ModuleList, timeLimit) {
+	ModuleList modules;
+	modules.add(new SimplePropagation());
+	modules.add(new MaximumTrajectoryLength(1 * Mpc));
+	Source source;
+	source.add(new SourceParticleType(nucleusId(1, 1)));
+	source.add(new SourceEnergy(1 * EeV));
+
+	// negative limits are always exceeded
+	modules.setTimeLimit(-1);
+	modules.run(&source, 100);
+	EXPECT_EQ(100, modules.getNumberOfCompleted());
+	modules.setTimeLimit(1e-12);
+	modules.run(&source, 100);
+	EXPECT_LT(modules.getNumberOfCompleted(), 100);
+}
+
+// splits each candidate above 1 EeV into two at its first step
+class CascadeSplitter: public Module {
+public:
+	void process(Candidate *c) const {
+		if ((c->getTrajectoryLength() > 0) or (c->current.getEnergy() <= 1 * EeV))
+			return;
+		c->addSecondary(22, c->current.getEnergy() / 2);
+		c->addSecondary(22, c->current.getEnergy() / 2);
+		c->setActive(false);
+	}
+};
+
+TEST(ModuleList, runStreamSecondaries) {
+	ModuleList modules;
+	modules.add(new CascadeSplitter());
+	modules.add(new SimplePropagation());
+	ref_ptr<MaximumTrajectoryLength> maxLength = new MaximumTrajectoryLength(1 * Mpc);
+	ref_ptr<ParticleCollector> collector = new ParticleCollector();
+	maxLength->onReject(collector);
+	modules.add(maxLength);
+	modules.setStreamSecondaries();
+	EXPECT_TRUE(modules.getStreamSecondaries());
+
+	Candidate candidate(nucleusId(1, 1), 64 * EeV);
+	modules.run(&candidate);
+
+	// 64 leaves of 1 EeV, each with a valid chain of six ancestors
+	EXPECT_EQ(64, collector->size());
+	EXPECT_EQ(0, candidate.secondaries.size());
+	for (size_t i = 0; i < collector->size(); i++) {
+		ref_ptr<Candidate> c = (*collector)[i];
+		EXPECT_DOUBLE_EQ(1 * EeV, c->current.getEnergy());
+		EXPECT_EQ(candidate.getSerialNumber(), c->getSourceSerialNumber());
+		size_t depth = 0;
+		for (Candidate *p = c->parent; p; p = p->parent)
+			depth++;
+		EXPECT_EQ(6, depth);
+	}
+}
+
+TEST(ModuleList, heartbeat) {
+	// 8 primaries of 4 EeV, each split into 2 + 4 secondaries
+	ModuleList modules;
+	modules.add(new CascadeSplitter());
+	modules.add(new SimplePropagation());
+	modules.add(new MaximumTrajectoryLength(1 * Mpc));
+	modules.setHeartbeatFile("testHeartbeat.json", 0.01);
+	ModuleList::candidate_vector_t candidates;
+	for (int i = 0; i < 8; i++)
+		candidates.push_back(new Candidate(nucleusId(1, 1), 4 * EeV));
+	modules.run(candidates);
+
+	// the last heartbeat is written when the run finishes
+	std::ifstream in("testHeartbeat.json");
+	std::string json((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	EXPECT_NE(std::string::npos, json.find("\"steps\": 8,"));
+	EXPECT_NE(std::string::npos, json.find("\"completed\": 8,"));
+	EXPECT_NE(std::string::npos, json.find("\"secondaries\": 48,"));
+	EXPECT_NE(std::string::npos, json.find("\"finished\": true"));
+	EXPECT_NE(std::string::npos, json.find("\"primariesPerSecond\": "));
+	in.close();
+	std::remove("testHeartbeat.json");
+	EXPECT_THROW(modules.setHeartbeatFile("testHeartbeat.json", 0), std::runtime_error);
+}
+
+TEST(ModuleList, runThreadConfined) {
+	ModuleList modules;
+	modules.add(new CascadeSplitter());
+	modules.add(new SimplePropagation());
+	ref_ptr<MaximumTrajectoryLength> maxLength = new MaximumTrajectoryLength(1 * Mpc);
+	ref_ptr<ParticleCollector> collector = new ParticleCollector();
+	maxLength->onReject(collector);
+	modules.add(maxLength);
+	modules.setThreadConfined();
+	EXPECT_TRUE(modules.getThreadConfined());
+
+	ModuleList::candidate_vector_t candidates;
+	for (size_t i = 0; i < 10; i++)
+		candidates.push_back(new Candidate(nucleusId(1, 1), 4 * EeV));
+	modules.run(candidates);
+
+	EXPECT_EQ(10 * 4, collector->size());
+	for (size_t i = 0; i < candidates.size(); i++) {
+		EXPECT_FALSE(candidates[i]->isThreadConfined());
+		EXPECT_EQ(1, candidates[i]->getReferenceCount());
+		EXPECT_TRUE(candidates[i]->secondaries[0]->isThreadConfined());
+	}
+}
+
+TEST(ModuleList, runCheckpoint) {
+	ModuleList modules;
+	modules.add(new SimplePropagation());
+	ref_ptr<MaximumTrajectoryLength> maxLength = new MaximumTrajectoryLength(1 * Mpc);
+	ref_ptr<ParticleCollector> collector = new ParticleCollector();
+	maxLength->onReject(collector);
+	modules.add(maxLength);
+	Source source;
+	source.add(new SourceParticleType(nucleusId(1, 1)));
+	source.add(new SourcePowerLawSpectrum(5 * EeV, 100 * EeV, -2));
+
+	std::string filename = "testModuleList_checkpoint.txt";
+	std::remove(filename.c_str());
+	modules.setCheckpoint(filename, 10);
+	modules.run(&source, 35);
+	EXPECT_EQ(35, collector->size());
+
+	// completed run, nothing left to do
+	modules.run(&source, 35);
+	EXPECT_EQ(35, collector->size());
+
+	// extended run, only the additional candidates are propagated
+	modules.run(&source, 50);
+	EXPECT_EQ(50, collector->size());
+	std::remove(filename.c_str());
+}
+
 #if _OPENMP
 #include <omp.h>
 TEST(ModuleList, runOpenMP) {
@@ -69,8 +429,456 @@ TEST(ModuleList, runOpenMP) {
 	omp_set_num_threads(2);
 	modules.run(&source, 1000, false);
 }
+
+// adds a number of secondaries to each primary on its first step
+class SecondaryGenerator: public Module {
+	int n;
+public:
+	SecondaryGenerator(int n) : n(n) {
+	}
+	void process(Candidate *c) const {
+		if ((c->parent == 0) and (c->getTrajectoryLength() == 0))
+			for (int i = 0; i < n; i++)
+				c->addSecondary(22, c->current.getEnergy() / n);
+	}
+};
+
+TEST(ModuleList, runParallelSecondaries) {
+	ModuleList modules;
+	modules.add(new SecondaryGenerator(10));
+	modules.add(new SimplePropagation());
+	ref_ptr<MaximumTrajectoryLength> maxLength = new MaximumTrajectoryLength(1 * Mpc);
+	ref_ptr<ParticleCollector> collector = new ParticleCollector();
+	maxLength->onReject(collector);
+	modules.add(maxLength);
+	modules.setParallelSecondaries();
+	EXPECT_TRUE(modules.getParallelSecondaries());
+
+	ModuleList::candidate_vector_t candidates;
+	for (size_t i = 0; i < 20; i++)
+		candidates.push_back(new Candidate(nucleusId(1, 1), 1 * EeV));
+	omp_set_num_threads(2);
+	modules.run(candidates);
+
+	// all primaries and secondaries are propagated until rejected
+	EXPECT_EQ(20 * 11, collector->size());
+	for (size_t i = 0; i < candidates.size(); i++) {
+		for (size_t j = 0; j < candidates[i]->secondaries.size(); j++)
+			EXPECT_DOUBLE_EQ(1 * Mpc, candidates[i]->secondaries[j]->getTrajectoryLength());
+	}
+}
+
+TEST(ModuleList, runThreadPinning) {
+	ModuleList modules;
+	modules.add(new SimplePropagation());
+	ref_ptr<MaximumTrajectoryLength> maxLength = new MaximumTrajectoryLength(1 * Mpc);
+	ref_ptr<ParticleCollector> collector = new ParticleCollector();
+	maxLength->onReject(collector);
+	modules.add(maxLength);
+	Source source;
+	source.add(new SourceParticleType(nucleusId(1, 1)));
+	source.add(new SourceEnergy(1 * EeV));
+
+	std::vector<int> affinity = getThreadAffinity();
+	modules.setThreadPinning();
+	EXPECT_TRUE(modules.getThreadPinning());
+	omp_set_num_threads(2);
+	modules.run(&source, 100);
+	EXPECT_EQ(100, collector->size());
+	// the calling thread is released after the run
+	EXPECT_EQ(affinity, getThreadAffinity());
+}
+
+TEST(ModuleList, runBreadthFirst) {
+	ModuleList modules;
+	modules.add(new SecondaryGenerator(10));
+	modules.add(new SimplePropagation(1 * kpc, 1 * kpc));
+	ref_ptr<MaximumTrajectoryLength> maxLength = new MaximumTrajectoryLength(5 * kpc);
+	ref_ptr<ParticleCollector> collector = new ParticleCollector();
+	maxLength->onReject(collector);
+	modules.add(maxLength);
+	modules.setBreadthFirst();
+	EXPECT_TRUE(modules.getBreadthFirst());
+	modules.setProfiling();
+
+	ref_ptr<Candidate> candidate = new Candidate(nucleusId(1, 1), 1 * EeV);
+	modules.run(candidate);
+
+	// primary and secondaries are propagated side by side until rejected
+	EXPECT_EQ(11, collector->size());
+	for (size_t j = 0; j < candidate->secondaries.size(); j++)
+		EXPECT_DOUBLE_EQ(5 * kpc, candidate->secondaries[j]->getTrajectoryLength());
+	// five steps of the primary and of each secondary
+	EXPECT_NE(std::string::npos, modules.getProfile().find("55 calls, 0 secondaries"));
+	EXPECT_NE(std::string::npos, modules.getProfile().find("10 secondaries"));
+}
+// counts the calls and candidates
+class BatchCounter: public BatchModule {
+public:
+	mutable size_t calls, candidates;
+	BatchCounter() : calls(0), candidates(0) {
+	}
+	void processCandidateVector(const std::vector<Candidate *> &batch) const {
+		calls++;
+		candidates += batch.size();
+	}
+};
+
+TEST(BatchModule, runBreadthFirst) {
+	ModuleList modules;
+	modules.add(new SecondaryGenerator(10));
+	modules.add(new SimplePropagation(1 * kpc, 1 * kpc));
+	modules.add(new MaximumTrajectoryLength(5 * kpc));
+	ref_ptr<BatchCounter> counter = new BatchCounter();
+	modules.add(counter);
+
+	// one call per step with all active candidates of the tree, the
+	// secondaries join in the second step
+	modules.setBreadthFirst();
+	ref_ptr<Candidate> candidate = new Candidate(nucleusId(1, 1), 1 * EeV);
+	modules.run(candidate);
+	EXPECT_EQ(6, counter->calls);
+	EXPECT_EQ(55, counter->candidates);
+
+	// one call per candidate and step otherwise
+	counter->calls = 0;
+	modules.setBreadthFirst(false);
+	candidate = new Candidate(nucleusId(1, 1), 1 * EeV);
+	modules.run(candidate);
+	EXPECT_EQ(55, counter->calls);
+}
+
 #endif
 
+// counts its calls, acts on photons only
+class PhotonCounter: public Module {
+public:
+	mutable size_t calls;
+	PhotonCounter() : calls(0) {
+	}
+	void process(Candidate *c) const {
+		calls++;
+	}
+	int getParticleClasses() const {
+		return PhotonClass;
+	}
+};
+
+// turns nuclei into photons
+class PhotonConverter: public Module {
+public:
+	void process(Candidate *c) const {
+		c->current.setId(22);
+	}
+	int getParticleClasses() const {
+		return NucleiClasses;
+	}
+};
+
+TEST(ModulePipeline, particleClasses) {
+	EXPECT_EQ(Module::NucleusClass, Module::particleClass(nucleusId(1, 1)));
+	EXPECT_EQ(Module::NeutronClass, Module::particleClass(nucleusId(1, 0)));
+	EXPECT_EQ(Module::PhotonClass, Module::particleClass(22));
+	EXPECT_EQ(Module::ElectronClass, Module::particleClass(-11));
+	EXPECT_EQ(Module::NeutrinoClass, Module::particleClass(14));
+	EXPECT_EQ(Module::OtherClass, Module::particleClass(13));
+}
+
+TEST(ModulePipeline, process) {
+	ModuleList list;
+	ref_ptr<PhotonCounter> counter = new PhotonCounter();
+	list.add(new SimplePropagation(1 * kpc, 1 * kpc));
+	list.add(counter);
+	list.add(new PhotonConverter());
+	list.add(counter);
+	ModulePipeline pipeline(list);
+	EXPECT_EQ(4, pipeline.size());
+
+	// the counter is skipped for the proton until it is converted
+	Candidate c(nucleusId(1, 1), 1 * EeV);
+	pipeline.process(&c);
+	EXPECT_EQ(22, c.current.getId());
+	EXPECT_EQ(1, counter->calls);
+	EXPECT_DOUBLE_EQ(1 * kpc, c.getTrajectoryLength());
+	pipeline.process(&c);
+	EXPECT_EQ(3, counter->calls);
+
+	// the same in batches
+	std::vector<ref_ptr<Candidate> > candidates;
+	std::vector<Candidate *> pointers;
+	for (int i = 0; i < 4; i++) {
+		candidates.push_back(new Candidate((i % 2) ? 22 : nucleusId(1, 1), 1 * EeV));
+		pointers.push_back(candidates.back());
+	}
+	counter->calls = 0;
+	pipeline.processBatch(&pointers[0], pointers.size());
+	// two photons, then four after the conversion
+	EXPECT_EQ(6, counter->calls);
+	for (int i = 0; i < 4; i++)
+		EXPECT_EQ(22, candidates[i]->current.getId());
+}
+
+TEST(ModuleChain, process) {
+	ref_ptr<PhotonCounter> counter = new PhotonCounter();
+	ref_ptr<MaximumTrajectoryLength> maxLength = new MaximumTrajectoryLength(5 * kpc);
+	typedef ModuleChain<SimplePropagation, PhotonCounter, MaximumTrajectoryLength> Chain;
+	ref_ptr<Chain> chain = new Chain(new SimplePropagation(1 * kpc, 1 * kpc),
+			counter, maxLength);
+
+	ModuleList modules;
+	modules.add(chain);
+	ref_ptr<Candidate> proton = new Candidate(nucleusId(1, 1), 1 * EeV);
+	modules.run(proton);
+	EXPECT_DOUBLE_EQ(5 * kpc, proton->getTrajectoryLength());
+	EXPECT_EQ(0, counter->calls);
+
+	ref_ptr<Candidate> photon = new Candidate(22, 1 * EeV);
+	modules.run(photon);
+	EXPECT_DOUBLE_EQ(5 * kpc, photon->getTrajectoryLength());
+	EXPECT_EQ(5, counter->calls);
+}
+TEST(ModuleList, particleDispatch) {
+	ModuleList modules;
+	ref_ptr<PhotonCounter> counter = new PhotonCounter();
+	modules.add(counter);
+	modules.add(new PhotonConverter());
+	modules.add(counter);
+	EXPECT_TRUE(modules.getParticleDispatch());
+
+	// the counter is skipped for the proton until it is converted
+	Candidate proton(nucleusId(1, 1), 1 * EeV);
+	modules.process(&proton);
+	EXPECT_EQ(22, proton.current.getId());
+	EXPECT_EQ(1, counter->calls);
+
+	// all modules for all candidates
+	modules.setParticleDispatch(false);
+	counter->calls = 0;
+	Candidate neutron(nucleusId(1, 0), 1 * EeV);
+	modules.process(&neutron);
+	EXPECT_EQ(2, counter->calls);
+}
+
+TEST(ModuleList, configuration) {
+	// two propagation modules share one field
+	ref_ptr<MagneticField> field = new UniformMagneticField(Vector3d(0, 0, 1 * nG));
+	ref_ptr<ModuleList> modules = new ModuleList();
+	modules->add(new PropagationCK(field, 1e-5, 1 * kpc, 10 * Mpc));
+	modules->add(new PropagationCK(field));
+	MaximumTrajectoryLength *maxLength = new MaximumTrajectoryLength(100 * Mpc);
+	maxLength->addObserverPosition(Vector3d(1, 2, 3) * Mpc);
+	maxLength->setRejectFlag("Rejected", "max");
+	modules->add(maxLength);
+	Observer *observer = new Observer();
+	observer->add(new ObserverPoint());
+	observer->add(new ObserverPhotonVeto());
+	observer->onDetection(new MinimumEnergy(5 * EeV));
+	modules->add(observer);
+	modules->setBreadthFirst(true);
+	modules->setCounterBasedRandom(true, 0xfedcba9876543210ULL);
+
+	ConfigurationDocument saved;
+	saved.add(modules);
+	EXPECT_EQ(9, saved.size()); // the field once
+	std::string text = saved.toString();
+
+	ref_ptr<ConfigurationDocument> document = ConfigurationDocument::fromString(text);
+	ref_ptr<ModuleList> loaded = dynamic_cast<ModuleList *>(document->getModule().get());
+	ASSERT_TRUE(loaded.valid());
+	ASSERT_EQ(4, loaded->size());
+	EXPECT_TRUE(loaded->getBreadthFirst());
+	EXPECT_TRUE(loaded->getCounterBasedRandom());
+
+	PropagationCK *p1 = dynamic_cast<PropagationCK *>((*loaded)[0].get());
+	PropagationCK *p2 = dynamic_cast<PropagationCK *>((*loaded)[1].get());
+	ASSERT_TRUE(p1 && p2);
+	EXPECT_DOUBLE_EQ(1e-5, p1->getTolerance());
+	EXPECT_DOUBLE_EQ(1 * kpc, p1->getMinimumStep());
+	EXPECT_DOUBLE_EQ(10 * Mpc, p1->getMaximumStep());
+	EXPECT_EQ(p1->getField().get(), p2->getField().get());
+	EXPECT_DOUBLE_EQ(1 * nG, p1->getField()->getField(Vector3d(0.)).z);
+
+	MaximumTrajectoryLength *m = dynamic_cast<MaximumTrajectoryLength *>((*loaded)[2].get());
+	ASSERT_TRUE(m);
+	EXPECT_DOUBLE_EQ(100 * Mpc, m->getMaximumTrajectoryLength());
+	ASSERT_EQ(1, m->getObserverPositions().size());
+	EXPECT_DOUBLE_EQ(3 * Mpc, m->getObserverPositions()[0].z);
+
+	// the observer detects at x = 0, the photon veto is kept
+	Candidate c(nucleusId(1, 1), 10 * EeV, Vector3d(0.));
+	(*loaded)[3]->process(&c);
+	EXPECT_FALSE(c.isActive());
+	Candidate photon(22, 10 * EeV, Vector3d(0.));
+	(*loaded)[3]->process(&photon);
+	EXPECT_TRUE(photon.isActive());
+
+	// saving again gives the same text
+	ConfigurationDocument again;
+	again.add(loaded);
+	EXPECT_EQ(text, again.toString());
+
+	// sources
+	Source source;
+	source.add(new SourcePosition(Vector3d(1, 0, 0) * Mpc));
+	source.add(new SourceParticleType(nucleusId(56, 26)));
+	source.add(new SourcePowerLawSpectrum(1 * EeV, 100 * EeV, -2));
+	ConfigurationDocument sourceDocument;
+	sourceDocument.add(&source);
+	ref_ptr<SourceInterface> loadedSource = ConfigurationDocument::fromString(
+			sourceDocument.toString())->getSource();
+	ref_ptr<Candidate> candidate = loadedSource->getCandidate();
+	EXPECT_EQ(nucleusId(56, 26), candidate->current.getId());
+	EXPECT_DOUBLE_EQ(1 * Mpc, candidate->current.getPosition().x);
+	EXPECT_LE(1 * EeV, candidate->current.getEnergy());
+
+	// modules without configuration and unknown types throw
+	ConfigurationDocument unsupported;
+	EXPECT_THROW(unsupported.add(new ParticleCollector()), std::runtime_error);
+	EXPECT_THROW(ConfigurationDocument::fromString("CRPCONF1\nobject 0 Unknown\nend\n")->getModule(),
+			std::runtime_error);
+}
+
+
+// continuous loss dE/dx = -E / length, integrated with a first order step
+class EulerLoss: public Module {
+	double length;
+public:
+	EulerLoss(double length) : length(length) {
+	}
+	void process(Candidate *candidate) const {
+		double E = candidate->current.getEnergy();
+		candidate->current.setEnergy(E * (1 - candidate->getCurrentStep() / length));
+	}
+};
+
+// straight propagation of the given step over one length
+class EulerSetup: public AutotuneSetup {
+public:
+	ref_ptr<ModuleList> create(const std::vector<double> &parameters, Module *output) const {
+		ref_ptr<ModuleList> modules = new ModuleList();
+		modules->add(new SimplePropagation(parameters[0] * Mpc, parameters[0] * Mpc));
+		modules->add(new EulerLoss(1 * Mpc));
+		MaximumTrajectoryLength *maxLength = new MaximumTrajectoryLength(1 * Mpc);
+		maxLength->onReject(output);
+		modules->add(maxLength);
+		return modules;
+	}
+};
+
+TEST(Autotuner, cheapestWithinTolerance) {
+	ref_ptr<Source> source = new Source();
+	source->add(new SourceParticleType(22));
+	source->add(new SourcePowerLawSpectrum(1 * EeV, 100 * EeV, -1));
+	Autotuner tuner(new EulerSetup(), source, 1000, 0.03);
+	std::vector<double> steps;
+	steps.push_back(1. / 3);
+	steps.push_back(0.1);
+	steps.push_back(1. / 30);
+	tuner.addParameter("step [Mpc]", steps);
+	tuner.setReference(std::vector<double>(1, 0.001));
+	tuner.run();
+
+	ASSERT_EQ(3, tuner.size());
+	EXPECT_EQ(1000, tuner.getReferenceResult().detected);
+	EXPECT_NEAR(1000 * 1000, tuner.getReferenceResult().steps, 1000);
+	// log10 E lower by about s / 2 / ln(10), each primary the same in all runs
+	EXPECT_FALSE(tuner.getResult(0).accepted);
+	EXPECT_TRUE(tuner.getResult(1).accepted);
+	EXPECT_TRUE(tuner.getResult(2).accepted);
+	EXPECT_GT(tuner.getResult(0).spectrumError, tuner.getResult(1).spectrumError);
+	EXPECT_GT(tuner.getResult(1).spectrumError, tuner.getResult(2).spectrumError);
+	EXPECT_LT(0.005, tuner.getResult(2).spectrumError);
+	EXPECT_DOUBLE_EQ(0, tuner.getResult(1).deflectionError);
+	EXPECT_DOUBLE_EQ(0, tuner.getResult(1).weightError);
+	EXPECT_DOUBLE_EQ(0.1, tuner.getBest().parameters[0]);
+	EXPECT_LT(tuner.getResult(1).steps, tuner.getResult(2).steps);
+	EXPECT_FALSE(Statistics::isEnabled());
+
+	tuner.setTolerance(0.001);
+	tuner.run();
+	EXPECT_THROW(tuner.getBest(), std::runtime_error);
+}
+
+class FailingModule: public Module {
+public:
+	void process(Candidate *candidate) const {
+		throw std::runtime_error("FailingModule");
+	}
+};
+
+TEST(SimulationPool, submitAndFeed) {
+	// Test if submits in parts reproduce one run with counter-based streams
+	ref_ptr<ModuleList> modules = new ModuleList();
+	modules->add(new SimplePropagation());
+	ref_ptr<MaximumTrajectoryLength> maxLength = new MaximumTrajectoryLength(1 * Mpc);
+	ref_ptr<ParticleCollector> collector = new ParticleCollector();
+	maxLength->onReject(collector);
+	modules->add(maxLength);
+	ref_ptr<Source> source = new Source();
+	source->add(new SourceParticleType(nucleusId(1, 1)));
+	source->add(new SourcePowerLawSpectrum(1 * EeV, 100 * EeV, -1));
+	source->add(new SourceIsotropicEmission());
+	modules->setCounterBasedRandom(true, 77);
+
+	modules->run(source.get(), 50);
+	std::vector<double> expected;
+	for (size_t i = 0; i < collector->size(); i++)
+		expected.push_back((*collector)[i]->source.getEnergy());
+	std::sort(expected.begin(), expected.end());
+	collector->clearContainer();
+
+	ref_ptr<SimulationPool> pool = new SimulationPool(modules, 2);
+	EXPECT_EQ(2, pool->getNumberOfThreads());
+	pool->setChunkSize(3);
+	ref_ptr<SimulationJob> a = pool->submit(source, 20);
+	ref_ptr<SimulationJob> b = pool->submit(source, 30);
+	b->wait();
+	a->wait();
+	EXPECT_TRUE(a->isDone());
+	EXPECT_EQ(20, a->getNumberOfCompleted());
+	EXPECT_EQ(30, b->getNumberOfCompleted());
+	std::vector<double> energies;
+	for (size_t i = 0; i < collector->size(); i++)
+		energies.push_back((*collector)[i]->source.getEnergy());
+	std::sort(energies.begin(), energies.end());
+	EXPECT_TRUE(energies == expected);
+
+	// the fed candidates are propagated in place
+	ModuleList::candidate_vector_t candidates;
+	for (int i = 0; i < 10; i++)
+		candidates.push_back(source->getCandidate());
+	ref_ptr<SimulationJob> c = pool->feed(candidates);
+	pool->wait();
+	EXPECT_EQ(0, pool->getNumberOfJobs());
+	ASSERT_EQ(10, c->getCandidates().size());
+	for (size_t i = 0; i < candidates.size(); i++) {
+		EXPECT_FALSE(candidates[i]->isActive());
+		EXPECT_TRUE(c->getCandidates()[i] == candidates[i]);
+	}
+	EXPECT_TRUE(pool->submit(source, 0)->isDone());
+}
+
+TEST(SimulationPool, failingJob) {
+	// Test if wait reports an exception of the job, the pool stays usable
+	ref_ptr<ModuleList> modules = new ModuleList();
+	modules->add(new FailingModule());
+	ref_ptr<Source> source = new Source();
+	source->add(new SourceParticleType(nucleusId(1, 1)));
+	ref_ptr<SimulationPool> pool = new SimulationPool(modules, 1);
+	ref_ptr<SimulationJob> job = pool->submit(source, 100);
+	EXPECT_THROW(job->wait(), std::runtime_error);
+	EXPECT_TRUE(job->isDone());
+	EXPECT_EQ(pool->getChunkSize(), job->getNumberOfCompleted());
+
+	modules->remove(0);
+	modules->add(new SimplePropagation());
+	modules->add(new MaximumTrajectoryLength(1 * Mpc));
+	job = pool->submit(source, 5);
+	EXPECT_NO_THROW(job->wait());
+	EXPECT_EQ(5, job->getNumberOfCompleted());
+	pool->cancel();
+}
+
 int main(int argc, char **argv) {
 	::testing::InitGoogleTest(&argc, argv);
 	return RUN_ALL_TESTS();
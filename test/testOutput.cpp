@@ -15,6 +15,15 @@
 	#include <hdf5.h>
 #endif
 
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#ifdef WITH_GALACTIC_LENSES
+	#include "crpropa/magneticLens/Pixelization.h"
+#endif
+
 // compare two arrays (intead of using Google Mock)
 // https://stackoverflow.com/a/10062016/6819103
 template<typename T, size_t size>
@@ -143,6 +152,78 @@ TEST(TextOutput, printHeader_Version) {
 	         g_GIT_DESC);
 }
 
+TEST(TextOutput, formatNumbers) {
+	// Test if the columns are formatted as printf in the "C" locale
+	Candidate c(22, 1234565 * EeV);
+	c.setRedshift(-0.1234565);
+	std::stringstream stream;
+	TextOutput output(stream, Output::Event1D);
+	output.disable(Output::SourceIdColumn);
+	output.disable(Output::SourceEnergyColumn);
+	output.enable(Output::RedshiftColumn);
+	output.process(&c);
+
+	std::string text = stream.str();
+	std::string line = text.substr(text.rfind("#\n") + 2);
+	EXPECT_EQ("0.00000E+00\t-1.23456E-01\t        22\t1.23456E+06\n", line);
+}
+
+#ifdef CRPROPA_HAVE_ZLIB
+TEST(TextOutput, gzipInParallel) {
+	// Test if the blocks compressed by the worker threads form one gzip file
+	std::string filename = "testTextOutput.txt.gz";
+	int n = 20000;
+	{
+		TextOutput output(filename, Output::Everything);
+		#pragma omp parallel for
+		for (int i = 0; i < n; i++) {
+			Candidate c(22, (i + 1) * EeV);
+			output.process(&c);
+		}
+	}
+
+	ParticleCollector collector;
+	TextOutput::load(filename, &collector);
+	std::remove(filename.c_str());
+	ASSERT_EQ(n, collector.size());
+	double sum = 0;
+	for (int i = 0; i < n; i++)
+		sum += collector[i]->current.getEnergy() / EeV;
+	EXPECT_NEAR(0.5 * n * (n + 1), sum, 1e-3 * n);
+}
+#endif
+
+TEST(TextOutput, sharded) {
+	// Test if the shards of the threads load as one dataset from the manifest
+	std::string filename = "testTextOutputShards.txt";
+	int n = 20000;
+	std::vector<std::string> shards;
+	{
+		TextOutput output(filename, Output::Everything);
+		output.setSharded(true);
+		EXPECT_EQ("testTextOutputShards.3.txt", output.getShardFilename(3));
+		#pragma omp parallel for
+		for (int i = 0; i < n; i++) {
+			Candidate c(22, (i + 1) * EeV);
+			output.process(&c);
+		}
+		for (size_t i = 0; i < 1024; i++)
+			shards.push_back(output.getShardFilename(i));
+		EXPECT_THROW(output.setSharded(false), std::runtime_error);
+	}
+
+	ParticleCollector collector;
+	collector.load(filename);
+	std::remove(filename.c_str());
+	for (size_t i = 0; i < shards.size(); i++)
+		std::remove(shards[i].c_str());
+	ASSERT_EQ(n, collector.size());
+	double sum = 0;
+	for (int i = 0; i < n; i++)
+		sum += collector[i]->current.getEnergy() / EeV;
+	EXPECT_NEAR(0.5 * n * (n + 1), sum, 1e-3 * n);
+}
+
 TEST(TextOutput, failOnIllegalOutputFile)
 {
 	EXPECT_THROW(TextOutput output("THIS_FOLDER_MUST_NOT_EXISTS_12345+/FILE.txt"), std::runtime_error);
@@ -156,6 +237,357 @@ TEST(HDF5Output, failOnIllegalOutputFile)
 	H5Eset_auto2(H5E_DEFAULT, NULL, NULL);
 	EXPECT_THROW(out.open("THIS_FOLDER_MUST_NOT_EXISTS_12345+/FILE.h5"), std::runtime_error);
 }
+
+TEST(HDF5Output, writeRowsOfAllThreads)
+{
+	// Test if the rows of all threads are written by the writer thread
+	std::string filename = "testHDF5Output.h5";
+	HDF5Output out(filename, Output::Event1D);
+	out.setFlushLimit(1000);
+	int n = 5000;
+	#pragma omp parallel for
+	for (int i = 0; i < n; i++) {
+		Candidate c(nucleusId(1, 1), 1 * EeV);
+		out.process(&c);
+	}
+	out.close();
+	EXPECT_EQ(n, out.size());
+
+	hid_t file = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+	ASSERT_GE(file, 0);
+	hid_t dset = H5Dopen2(file, "CRPROPA3", H5P_DEFAULT);
+	hid_t space = H5Dget_space(dset);
+	EXPECT_EQ(n, H5Sget_simple_extent_npoints(space));
+	H5Sclose(space);
+	H5Dclose(dset);
+	H5Fclose(file);
+	std::remove(filename.c_str());
+}
+
+TEST(HDF5Output, packedRowsWithLargeProperty)
+{
+	// Test if the rows hold only the enabled columns and properties of any size
+	std::string filename = "testHDF5OutputPacked.h5";
+	std::string text(2000, 'x');
+	HDF5Output out(filename, Output::Event1D);
+	out.enableProperty("text", Variant(text));
+	Candidate c(nucleusId(1, 1), 1 * EeV);
+	out.process(&c);
+	out.close();
+
+	hid_t file = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+	ASSERT_GE(file, 0);
+	hid_t dset = H5Dopen2(file, "CRPROPA3", H5P_DEFAULT);
+	hid_t type = H5Dget_type(dset);
+	size_t size = 0;
+	for (int i = 0; i < H5Tget_nmembers(type); i++) {
+		hid_t member = H5Tget_member_type(type, i);
+		size += H5Tget_size(member);
+		H5Tclose(member);
+	}
+	EXPECT_EQ(size, H5Tget_size(type));
+
+	std::vector<char> buffer(text.size());
+	hid_t textType = H5Tcopy(H5T_C_S1);
+	H5Tset_size(textType, text.size());
+	hid_t memType = H5Tcreate(H5T_COMPOUND, text.size());
+	H5Tinsert(memType, "text", 0, textType);
+	H5Dread(dset, memType, H5S_ALL, H5S_ALL, H5P_DEFAULT, &buffer[0]);
+	EXPECT_EQ(text, std::string(buffer.begin(), buffer.end()));
+
+	H5Tclose(memType);
+	H5Tclose(textType);
+	H5Tclose(type);
+	H5Dclose(dset);
+	H5Fclose(file);
+	std::remove(filename.c_str());
+}
+
+TEST(HDF5Output, chunkSize)
+{
+	// Test if the dataset is chunked as set and collective output is refused without MPI-IO
+	std::string filename = "testHDF5OutputChunks.h5";
+	HDF5Output out(filename, Output::Event1D);
+	out.setChunkSize(100);
+	EXPECT_EQ(100, out.getChunkSize());
+#if !defined(CRPROPA_HAVE_MPI) || !defined(H5_HAVE_PARALLEL)
+	EXPECT_THROW(out.setCollective(true), std::runtime_error);
+	EXPECT_FALSE(out.isCollective());
+#endif
+	Candidate c(nucleusId(1, 1), 1 * EeV);
+	out.process(&c);
+	EXPECT_THROW(out.setChunkSize(10), std::runtime_error);
+	out.close();
+
+	hid_t file = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+	ASSERT_GE(file, 0);
+	hid_t dset = H5Dopen2(file, "CRPROPA3", H5P_DEFAULT);
+	hid_t plist = H5Dget_create_plist(dset);
+	hsize_t chunk[1] = {0};
+	H5Pget_chunk(plist, 1, chunk);
+	EXPECT_EQ(100, chunk[0]);
+	H5Pclose(plist);
+	H5Dclose(dset);
+	H5Fclose(file);
+	std::remove(filename.c_str());
+}
+
+TEST(HDF5Input, candidatesOfNextStage)
+{
+	std::string filename = "testHDF5Input.h5";
+	int n = 1000;
+	{
+		HDF5Output out(filename, Output::Everything);
+		out.enable(Output::SerialNumberColumn);
+		out.enableProperty("tag", Variant::fromInt64(0), "");
+		for (int i = 0; i < n; i++) {
+			Candidate c(nucleusId(4, 2), (i + 1) * EeV, Vector3d(i, 0, 1) * Mpc);
+			c.source.setEnergy(2 * (i + 1) * EeV);
+			c.setSerialNumber(i + 10);
+			c.setProperty("tag", Variant::fromInt64(i));
+			out.process(&c);
+		}
+		out.close();
+	}
+
+	// prefetch in chunks smaller than the file
+	ref_ptr<HDF5Input> input = new HDF5Input(filename, 64);
+	EXPECT_EQ(n, input->size());
+	ref_ptr<Candidate> c = input->getCandidate();
+	EXPECT_EQ(nucleusId(4, 2), c->current.getId());
+	EXPECT_DOUBLE_EQ(1 * EeV, c->current.getEnergy());
+	EXPECT_DOUBLE_EQ(2 * EeV, c->source.getEnergy());
+	EXPECT_EQ(10, c->getSerialNumber());
+	EXPECT_NEAR(1 * Mpc, c->current.getPosition().z, 1e-12 * Mpc);
+	EXPECT_EQ(0, c->getProperty("tag").toInt64());
+
+	std::vector<ref_ptr<Candidate> > candidates;
+	input->getCandidates(n, candidates);
+	ASSERT_EQ(n - 1, candidates.size());
+	for (int i = 1; i < n; i++)
+		EXPECT_DOUBLE_EQ((i + 1) * EeV, candidates[i - 1]->current.getEnergy());
+	EXPECT_FALSE(input->getCandidate().valid());
+	input = 0;
+
+	ParticleCollector collector;
+	collector.load(filename);
+	EXPECT_EQ(n, collector.size());
+	std::remove(filename.c_str());
+}
+
+TEST(HDF5ColumnOutput, oneDatasetPerColumn)
+{
+	// Test if each column is written to its own dataset in the group
+	std::string filename = "testHDF5ColumnOutput.h5";
+	HDF5ColumnOutput out(filename, Output::Event1D);
+	out.setEnergyScale(EeV);
+	int n = 100;
+	for (int i = 0; i < n; i++) {
+		Candidate c(nucleusId(1, 1), i * EeV);
+		out.process(&c);
+	}
+	out.close();
+
+	hid_t file = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+	ASSERT_GE(file, 0);
+	hid_t dset = H5Dopen2(file, "CRPROPA3/E", H5P_DEFAULT);
+	ASSERT_GE(dset, 0);
+	std::vector<double> E(n);
+	H5Dread(dset, H5T_NATIVE_DOUBLE, H5S_ALL, H5S_ALL, H5P_DEFAULT, &E[0]);
+	for (int i = 0; i < n; i++)
+		EXPECT_DOUBLE_EQ(i, E[i]);
+	H5Dclose(dset);
+
+	dset = H5Dopen2(file, "CRPROPA3/ID", H5P_DEFAULT);
+	std::vector<int> ID(n);
+	H5Dread(dset, H5T_NATIVE_INT, H5S_ALL, H5S_ALL, H5P_DEFAULT, &ID[0]);
+	EXPECT_EQ(nucleusId(1, 1), ID[n - 1]);
+	H5Dclose(dset);
+	H5Fclose(file);
+	std::remove(filename.c_str());
+}
+#endif
+
+//-- HistogramOutput
+
+TEST(HistogramOutput, fillInParallel) {
+	HistogramOutput output;
+	output.addAxis(HistogramOutput::Energy, 3, 1 * EeV, 1000 * EeV, true);
+	std::vector<int> ids;
+	ids.push_back(22);
+	ids.push_back(nucleusId(1, 1));
+	output.addIdAxis(ids);
+	EXPECT_DOUBLE_EQ(10 * EeV, output.getBinEdge(0, 1));
+
+	int n = 1000;
+	#pragma omp parallel for
+	for (int i = 0; i < n; i++) {
+		// weight 2 for photons at 5 EeV, weight 1 for protons at 50 EeV
+		if (i % 2 == 0) {
+			Candidate c(22, 5 * EeV, Vector3d(0.), Vector3d(-1, 0, 0), 0, 2);
+			output.process(&c);
+		} else {
+			Candidate c(nucleusId(1, 1), 50 * EeV);
+			output.process(&c);
+		}
+	}
+	Candidate outside(nucleusId(4, 2), 5 * EeV);
+	output.process(&outside);
+
+	std::vector<size_t> index(2);
+	index[0] = 0;
+	index[1] = 0;
+	EXPECT_DOUBLE_EQ(n, output.getBin(index));
+	index[0] = 1;
+	index[1] = 1;
+	EXPECT_DOUBLE_EQ(n / 2, output.getBin(index));
+	index[1] = 0;
+	EXPECT_DOUBLE_EQ(0, output.getBin(index));
+	EXPECT_DOUBLE_EQ(1, output.getOverflow());
+	EXPECT_EQ(6, output.getHistogram().size());
+
+	output.clear();
+	EXPECT_DOUBLE_EQ(0, output.getOverflow());
+	index[1] = 1;
+	EXPECT_DOUBLE_EQ(0, output.getBin(index));
+}
+
+//-- ResponseMatrix
+
+TEST(ResponseMatrix, foldWithoutInteractions) {
+	std::vector<int> species;
+	species.push_back(nucleusId(1, 1));
+	species.push_back(nucleusId(4, 2));
+	ref_ptr<ResponseMatrix> matrix = new ResponseMatrix(species, 1 * EeV,
+			100 * EeV, 4, 1 * Mpc, 11 * Mpc, 2);
+	EXPECT_EQ(16, matrix->getNumberOfInjectedBins());
+	EXPECT_EQ(16, matrix->getNumberOfObservedBins());
+	EXPECT_DOUBLE_EQ(10 * EeV, matrix->getEnergyBinEdge(2));
+	EXPECT_DOUBLE_EQ(6 * Mpc, matrix->getDistanceBinEdge(1));
+
+	// without interactions all particles arrive with the injected energy
+	ref_ptr<Observer> observer = new Observer();
+	observer->add(new ObserverPoint());
+	observer->onDetection(matrix);
+	ModuleList modules;
+	modules.add(new SimplePropagation(0.1 * Mpc, 1 * Mpc));
+	modules.add(observer);
+	modules.setShowProgress(false);
+	matrix->simulate(&modules, 10);
+
+	size_t helium = matrix->getInjectedBin(1, 2, 1);
+	EXPECT_DOUBLE_EQ(1, matrix->getYield(helium, matrix->getObservedBin(4, 2)));
+	EXPECT_DOUBLE_EQ(0, matrix->getYield(helium, matrix->getObservedBin(1, 2)));
+	EXPECT_DOUBLE_EQ(0, matrix->getYield(helium, matrix->getObservedBin(4, 1)));
+
+	std::vector<double> sources(matrix->getNumberOfInjectedBins(), 0);
+	sources[helium] = 3;
+	sources[matrix->getInjectedBin(0, 0, 0)] = 2;
+	std::vector<double> observed = matrix->fold(sources);
+	EXPECT_DOUBLE_EQ(3, observed[matrix->getObservedBin(4, 2)]);
+	EXPECT_DOUBLE_EQ(2, observed[matrix->getObservedBin(1, 0)]);
+
+	// E^-1 gives the same number in each logarithmic energy bin
+	std::vector<double> abundances(2, 0);
+	abundances[0] = 1;
+	observed = matrix->foldSpectrum(abundances, 1);
+	EXPECT_NEAR(observed[0], observed[3], 1e-12 * observed[0]);
+	EXPECT_DOUBLE_EQ(0, observed[matrix->getObservedBin(4, 0)]);
+
+	matrix->save("response_matrix.bin");
+	ref_ptr<ResponseMatrix> loaded = ResponseMatrix::load("response_matrix.bin");
+	remove("response_matrix.bin");
+	EXPECT_EQ(4, loaded->getMaximumMassNumber());
+	EXPECT_DOUBLE_EQ(1, loaded->getYield(helium, loaded->getObservedBin(4, 2)));
+	EXPECT_THROW(ResponseMatrix::load("response_matrix.bin"), std::runtime_error);
+}
+
+TEST(BinarySource, candidatesOfNextStage) {
+	std::string filename = "BinarySource_test.bin";
+	int n = 1000;
+	{
+		BinaryOutput output(filename);
+		for (int i = 0; i < n; i++) {
+			Candidate c(nucleusId(1, 1), (i + 1) * EeV);
+			output.process(&c);
+		}
+		output.close();
+	}
+
+	ref_ptr<BinarySource> source = new BinarySource(filename);
+	EXPECT_EQ(n, source->size());
+	double sum = 0;
+	int drawn = 0;
+	#pragma omp parallel for reduction(+: sum, drawn)
+	for (int i = 0; i < n; i++) {
+		ref_ptr<Candidate> c = source->getCandidate();
+		sum += c->current.getEnergy() / EeV;
+		drawn++;
+	}
+	EXPECT_EQ(n, drawn);
+	EXPECT_DOUBLE_EQ(0.5 * n * (n + 1), sum);
+	EXPECT_FALSE(source->getCandidate().valid());
+	std::vector<ref_ptr<Candidate> > candidates;
+	source->getCandidates(10, candidates);
+	EXPECT_EQ(0, candidates.size());
+	std::remove(filename.c_str());
+}
+
+//-- EventReweighting
+
+TEST(EventReweighting, reweightBinaryFile) {
+	{
+		BinaryOutput output("EventReweighting_test.bin");
+		for (int i = 0; i < 1000; i++) {
+			// protons at 1 and 10 EeV, helium at 10 EeV, all observed at 5 EeV
+			int id = (i % 3 == 2) ? nucleusId(4, 2) : nucleusId(1, 1);
+			Candidate c(id, 5 * EeV);
+			c.source.setEnergy((i % 3 == 0) ? 1 * EeV : 10 * EeV);
+			output.process(&c);
+		}
+		Candidate outside(nucleusId(1, 1), 500 * EeV);
+		output.process(&outside);
+		output.close();
+	}
+
+	EventReweighting reweighting(1, 1 * EeV, 100 * EeV, 2);
+	EXPECT_EQ(0, reweighting.addParameterPoint(1));
+	EXPECT_EQ(1, reweighting.addParameterPoint(2));
+	EXPECT_EQ(2, reweighting.addParameterPoint(1, 10 * EeV));
+	reweighting.fill("EventReweighting_test.bin", 100);
+
+	// 334 at 1 EeV, 333 protons and 333 helium at 10 EeV
+	std::vector<double> h = reweighting.getHistogram(0);
+	EXPECT_DOUBLE_EQ(1000, h[0]);
+	EXPECT_DOUBLE_EQ(0, h[1]);
+	EXPECT_NEAR(334 + 666 * 0.1, reweighting.getHistogram(1)[0], 1e-9);
+	EXPECT_NEAR(334 * exp(-0.1) + 333 * (exp(-1) + exp(-0.5)),
+			reweighting.getHistogram(2)[0], 1e-9);
+	EXPECT_DOUBLE_EQ(0.1, reweighting.getWeight(1, nucleusId(1, 1), 10 * EeV, 0));
+
+	// only helium, abundance 2
+	reweighting.clear();
+	reweighting.setAbundance(nucleusId(4, 2), 2);
+	reweighting.fill("EventReweighting_test.bin");
+	std::remove("EventReweighting_test.bin");
+	EXPECT_DOUBLE_EQ(666, reweighting.getHistogram(0)[0]);
+}
+
+#ifdef WITH_GALACTIC_LENSES
+TEST(HistogramOutput, directionMap) {
+	HistogramOutput output;
+	output.addDirectionAxis(2);
+	EXPECT_EQ(192, output.getNumberOfBins(0));
+	// moving in -x, arriving from longitude 0 and latitude 0
+	Candidate c(nucleusId(1, 1), EeV, Vector3d(0.), Vector3d(-1, 0, 0));
+	output.process(&c);
+	output.process(&c);
+
+	Pixelization pixelization(2);
+	std::vector<size_t> index(1, pixelization.direction2Pix(0, 0));
+	EXPECT_DOUBLE_EQ(2, output.getBin(index));
+	EXPECT_DOUBLE_EQ(0, output.getOverflow());
+}
 #endif
 
 //-- ParticleCollector
@@ -169,6 +601,22 @@ TEST(ParticleCollector, size) {
 	EXPECT_EQ(output.size(), 5);
 }
 
+TEST(ParticleCollector, collectInParallel) {
+	ParticleCollector output;
+	int n = 1000;
+	#pragma omp parallel for
+	for (int i = 0; i < n; i++) {
+		ref_ptr<Candidate> c = new Candidate(22, (i + 1) * EeV);
+		output.process(c);
+	}
+
+	ASSERT_EQ(n, output.size());
+	double sum = 0;
+	for (ParticleCollector::iterator i = output.begin(); i != output.end(); ++i)
+		sum += (*i)->current.getEnergy() / EeV;
+	EXPECT_DOUBLE_EQ(0.5 * n * (n + 1), sum);
+}
+
 TEST(ParticleCollector, fetchItem) {
 	ref_ptr<Candidate> c = new Candidate(nucleusId(1,1), 1*EeV);
 	ParticleCollector output;
@@ -214,6 +662,93 @@ TEST(ParticleCollector, dumpload) {
 	EXPECT_EQ(output[3]->getRedshift(), c->getRedshift());
 }
 
+TEST(ParticleCollector, dumploadBinary) {
+	ref_ptr<Candidate> c = new Candidate(nucleusId(1,1), 1.234*EeV);
+	c->current.setPosition(Vector3d(1,2,3));
+	c->current.setDirection(Vector3d(-1,-1,-1));
+	c->source.setEnergy(5 * EeV);
+	c->setTrajectoryLength(1*Mpc);
+	c->setRedshift(2);
+	c->setProperty("name", Variant(std::string("proton")));
+	c->setProperty("count", Variant(int32_t(7)));
+
+	ParticleCollector input;
+	ParticleCollector output;
+	for(int i=0; i<=10; ++i){
+		input.process(c);
+	}
+
+	input.dump("ParticleCollector_DumpTest.bin", true);
+	output.load("ParticleCollector_DumpTest.bin");
+	std::remove("ParticleCollector_DumpTest.bin");
+
+	ASSERT_EQ(input.size(), output.size());
+	EXPECT_EQ(c->current.getEnergy(), output[0]->current.getEnergy());
+	EXPECT_EQ(c->current.getPosition(), output[1]->current.getPosition());
+	EXPECT_EQ(c->source.getEnergy(), output[2]->source.getEnergy());
+	EXPECT_EQ(c->getTrajectoryLength(), output[3]->getTrajectoryLength());
+	EXPECT_EQ(c->getRedshift(), output[4]->getRedshift());
+	EXPECT_EQ("proton", output[5]->getProperty("name").toString());
+	EXPECT_EQ(7, output[6]->getProperty("count").asInt32());
+}
+
+TEST(ParticleCollector, spillToDisk) {
+	ParticleCollector collector;
+	collector.setSpillLimit(3);
+	for (int i = 0; i < 10; i++) {
+		ref_ptr<Candidate> c = new Candidate(22, (i + 1) * EeV);
+		collector.process(c);
+	}
+
+	EXPECT_EQ(10, collector.size());
+	EXPECT_EQ(3, collector.end() - collector.begin());
+	EXPECT_DOUBLE_EQ(8 * EeV, collector[7]->current.getEnergy());
+
+	ParticleCollector output;
+	collector.reprocess(&output);
+	ASSERT_EQ(10, output.size());
+	EXPECT_DOUBLE_EQ(10 * EeV, output[9]->current.getEnergy());
+
+	collector.clearContainer();
+	EXPECT_EQ(0, collector.size());
+}
+
+TEST(ParticleCollector, getColumns) {
+	// the columns of candidates in memory and spilled to disk
+	ParticleCollector collector;
+	collector.setSpillLimit(2);
+	for (int i = 0; i < 4; i++) {
+		ref_ptr<Candidate> c = new Candidate(22, (i + 1) * EeV, Vector3d(i, 2 * i, 0));
+		c->source.setEnergy(10 * EeV);
+		c->setWeight(0.5);
+		if (i % 2)
+			c->setProperty("tag", i);
+		collector.process(c);
+	}
+
+	std::vector<std::string> columns;
+	columns.push_back("ID");
+	columns.push_back("E");
+	columns.push_back("Y");
+	columns.push_back("E0");
+	columns.push_back("W");
+	columns.push_back("tag");
+	std::vector<double> data = collector.getColumns(columns);
+	ASSERT_EQ(24, data.size());
+	for (int i = 0; i < 4; i++) {
+		const double *row = &data[i * 6];
+		EXPECT_EQ(22, row[0]);
+		EXPECT_DOUBLE_EQ((i + 1) * EeV, row[1]);
+		EXPECT_DOUBLE_EQ(2 * i, row[2]);
+		EXPECT_DOUBLE_EQ(10 * EeV, row[3]);
+		EXPECT_DOUBLE_EQ(0.5, row[4]);
+		if (i % 2)
+			EXPECT_DOUBLE_EQ(i, row[5]);
+		else
+			EXPECT_TRUE(row[5] != row[5]); // NaN
+	}
+}
+
 // Just test if the trajectory is on a line for rectilinear propagation
 TEST(ParticleCollector, getTrajectory) {
 	int pos_x[10];
@@ -252,6 +787,236 @@ TEST(ParticleCollector, getTrajectory) {
 	EXPECT_TRUE(ArraysMatch(pos_x_expected, pos_x));
 }
 
+TEST(ParticleCollector, getTrajectories) {
+	// particles from x = 10, 20, ... 50 in unit steps to the observer at x = 0
+	ref_ptr<ParticleCollector> output = new ParticleCollector();
+	ref_ptr<ModuleList> sim = new ModuleList();
+	sim->add(new SimplePropagation(1, 1));
+	ref_ptr<Observer> obs = new Observer();
+	obs->add(new ObserverPoint());
+	obs->onDetection(output);
+	sim->add(obs);
+	for (int k = 1; k <= 5; k++) {
+		ParticleState p;
+		p.setPosition(Vector3d(10 * k, 0, 0));
+		p.setDirection(Vector3d(-1, 0, 0));
+		sim->run(new Candidate(p));
+	}
+
+	ref_ptr<ParticleCollector> trajectories = new ParticleCollector();
+	trajectories->setClone(true);
+	std::vector<size_t> indices;
+	for (size_t i = 0; i < output->size(); i += 2)
+		indices.push_back(i); // 3 of the 5 particles
+	output->getTrajectories(sim, indices, trajectories);
+	EXPECT_EQ(size_t(2), sim->size());
+
+	std::vector<int> steps(6, 0);
+	for (size_t i = 0; i < trajectories->size(); i++)
+		steps[int((*trajectories)[i]->source.getPosition().x) / 10]++;
+	size_t expected = 0;
+	for (size_t j = 0; j < indices.size(); j++) {
+		int k = int((*output)[indices[j]]->source.getPosition().x) / 10;
+		EXPECT_EQ(10 * k, steps[k]);
+		expected += 10 * k;
+	}
+	EXPECT_EQ(expected, trajectories->size());
+
+	// reprocess over all threads
+	ParticleCollector copy;
+	trajectories->reprocess(&copy);
+	EXPECT_EQ(trajectories->size(), copy.size());
+}
+
+TEST(TrajectorySampling, decimation) {
+	// 1 kpc steps along x, deactivated after 100 kpc
+	ref_ptr<ParticleCollector> everyTen = new ParticleCollector(100, true);
+	ref_ptr<TrajectorySampling> sampling = new TrajectorySampling(everyTen);
+	sampling->setEveryNthStep(10);
+	ref_ptr<ParticleCollector> distance = new ParticleCollector(100, true);
+	ref_ptr<TrajectorySampling> distanceSampling = new TrajectorySampling(distance);
+	distanceSampling->setMinDistance(24.5 * kpc);
+	ref_ptr<ParticleCollector> snapshots = new ParticleCollector(100, true);
+	ref_ptr<TrajectorySampling> snapshotSampling = new TrajectorySampling(snapshots);
+	snapshotSampling->setSnapshotInterval(30 * kpc);
+
+	ModuleList sim;
+	sim.add(new SimplePropagation(1 * kpc, 1 * kpc));
+	sim.add(new MaximumTrajectoryLength(100.5 * kpc));
+	sim.add(sampling);
+	sim.add(distanceSampling);
+	sim.add(snapshotSampling);
+	ref_ptr<Candidate> c = new Candidate(ParticleState(nucleusId(1, 1), 1 * EeV,
+			Vector3d(0.), Vector3d(1, 0, 0)));
+	sim.run(c);
+
+	// first step, every tenth and the last one
+	ASSERT_EQ(11, everyTen->size());
+	EXPECT_NEAR(1 * kpc, (*everyTen)[0]->getTrajectoryLength(), 1e-6 * kpc);
+	EXPECT_NEAR(11 * kpc, (*everyTen)[1]->getTrajectoryLength(), 1e-6 * kpc);
+	EXPECT_FALSE((*everyTen)[10]->isActive());
+	ASSERT_EQ(5, distance->size());
+	EXPECT_NEAR(26 * kpc, (*distance)[1]->current.getPosition().x, 1e-6 * kpc);
+	// at 30, 60 and 90 kpc
+	ASSERT_EQ(5, snapshots->size());
+	EXPECT_NEAR(30 * kpc, (*snapshots)[1]->getTrajectoryLength(), 1e-6 * kpc);
+}
+
+TEST(TrajectoryOutput, roundTrip) {
+	std::string filename = "testTrajectoryOutput.bin";
+	{
+		TrajectoryOutput output(filename, 1 * pc);
+		Candidate a(nucleusId(1, 1), 1 * EeV, Vector3d(0.), Vector3d(1, 0, 0));
+		Candidate b(nucleusId(4, 2), 2 * EeV, Vector3d(0.), Vector3d(0, 1, 0));
+		for (int i = 0; i < 5; i++) {
+			a.current.setPosition(Vector3d(i * 1.2 * kpc, 0, -i * kpc));
+			a.setTrajectoryLength(i * 1.6 * kpc);
+			b.current.setPosition(Vector3d(0, i * kpc, 0));
+			b.setTrajectoryLength(i * kpc);
+			if (i == 4)
+				a.setActive(false);
+			output.process(&a);
+			output.process(&b);
+		}
+	}
+
+	ParticleCollector collector;
+	TrajectoryOutput::load(filename, &collector);
+	std::remove(filename.c_str());
+	// the finished trajectory first, then the open one at close()
+	ASSERT_EQ(10, collector.size());
+	const Candidate *last = collector[4];
+	EXPECT_EQ(nucleusId(1, 1), last->current.getId());
+	EXPECT_NEAR(4.8 * kpc, last->current.getPosition().x, 0.5 * pc);
+	EXPECT_NEAR(-4 * kpc, last->current.getPosition().z, 0.5 * pc);
+	EXPECT_NEAR(6.4 * kpc, last->getTrajectoryLength(), 0.5 * pc);
+	EXPECT_NEAR(1 * EeV, last->current.getEnergy(), 1e-6 * EeV);
+	EXPECT_NEAR(1.2 / sqrt(1.2 * 1.2 + 1), last->current.getDirection().x, 1e-3);
+	EXPECT_EQ(collector[0]->getSerialNumber(), last->getSerialNumber());
+	EXPECT_EQ(nucleusId(4, 2), collector[9]->current.getId());
+	EXPECT_NEAR(4 * kpc, collector[9]->current.getPosition().y, 0.5 * pc);
+	EXPECT_NE(last->getSerialNumber(), collector[9]->getSerialNumber());
+}
+
+TEST(OutputFilter, expressions) {
+	Candidate c(nucleusId(4, 2), 20 * EeV, Vector3d(3, 4, 0) * Mpc);
+	c.source.setEnergy(100 * EeV);
+	c.setProperty("n", Variant::fromInt32(3));
+	EXPECT_TRUE(OutputFilter("E > 10 EeV").accepts(&c));
+	EXPECT_FALSE(OutputFilter("E > 10 EeV and E0 < 50 EeV").accepts(&c));
+	EXPECT_TRUE(OutputFilter("ID == 22 or (A == 4 && charge == 2)").accepts(&c));
+	EXPECT_TRUE(OutputFilter("not abs(ID) == 11").accepts(&c));
+	EXPECT_TRUE(OutputFilter("R >= 5 Mpc - 1 m and R <= 5 Mpc + 1 m").accepts(&c));
+	EXPECT_TRUE(OutputFilter("n * 2 == 6 and \"n\" != 4").accepts(&c));
+	// missing properties fail the comparisons
+	EXPECT_FALSE(OutputFilter("missing > 0 or missing <= 0").accepts(&c));
+	EXPECT_TRUE(OutputFilter("missing != 1").accepts(&c));
+	EXPECT_FALSE(OutputFilter("missing").accepts(&c));
+	EXPECT_THROW(OutputFilter("E >"), std::runtime_error);
+	EXPECT_THROW(OutputFilter("(E > 1"), std::runtime_error);
+	EXPECT_THROW(OutputFilter("E > 1 EeV x"), std::runtime_error);
+}
+
+TEST(Output, filter) {
+	// Test if rejected candidates are neither written nor counted
+	std::stringstream ss;
+	TextOutput output(ss, Output::Event1D);
+	output.setFilter("E >= 5 EeV");
+	EXPECT_EQ("E >= 5 EeV", output.getFilter());
+	for (int i = 0; i < 10; i++) {
+		Candidate c(nucleusId(1, 1), i * EeV);
+		output.process(&c);
+	}
+	EXPECT_EQ(5, output.size());
+	std::string line;
+	int lines = 0;
+	while (std::getline(ss, line))
+		if (line[0] != '#')
+			lines++;
+	EXPECT_EQ(5, lines);
+	output.setFilter("");
+	EXPECT_TRUE(output.accepts(NULL));
+}
+
+TEST(NetworkOutput, streamBatches) {
+	// Test if the header, the batches of packed rows and the end are received
+	int listener = socket(AF_INET, SOCK_STREAM, 0);
+	ASSERT_GE(listener, 0);
+	struct sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	address.sin_port = 0;
+	ASSERT_EQ(0, bind(listener, (struct sockaddr *) &address, sizeof(address)));
+	ASSERT_EQ(0, listen(listener, 1));
+	socklen_t length = sizeof(address);
+	getsockname(listener, (struct sockaddr *) &address, &length);
+
+	int n = 250;
+	{
+		NetworkOutput output("127.0.0.1", ntohs(address.sin_port));
+		output.disableAll();
+		output.enable(Output::CurrentIdColumn);
+		output.enable(Output::CurrentEnergyColumn);
+		output.enableProperty("weight2", Variant::fromFloat(0));
+		output.setEnergyScale(EeV);
+		output.setBatchSize(100);
+		for (int i = 0; i < n; i++) {
+			Candidate c(nucleusId(1, 1), i * EeV);
+			c.setProperty("weight2", Variant::fromFloat(2 * i));
+			output.process(&c);
+		}
+		EXPECT_EQ(16, output.getRowSize());
+		output.close();
+	}
+
+	// the stream fits into the buffer of the connection
+	int connection = accept(listener, NULL, NULL);
+	ASSERT_GE(connection, 0);
+	std::string stream;
+	char buffer[4096];
+	ssize_t received;
+	while ((received = recv(connection, buffer, sizeof(buffer), 0)) > 0)
+		stream.append(buffer, received);
+	::close(connection);
+	::close(listener);
+
+	ASSERT_GT(stream.size(), 12);
+	EXPECT_EQ("CRPSTRM1", stream.substr(0, 8));
+	uint32_t headerSize;
+	memcpy(&headerSize, &stream[8], 4);
+	EXPECT_EQ("ID int32 4\nE float64 8\nweight2 float 4\n", stream.substr(12, headerSize));
+
+	size_t pos = 12 + headerSize;
+	int rows = 0, batches = 0;
+	while (true) {
+		uint32_t counts[2];
+		ASSERT_LE(pos + 8, stream.size());
+		memcpy(counts, &stream[pos], 8);
+		pos += 8;
+		if (counts[0] == 0)
+			break;
+		EXPECT_EQ(counts[0] * 16, counts[1]);
+		for (uint32_t i = 0; i < counts[0]; i++) {
+			int32_t id;
+			double energy;
+			float weight;
+			memcpy(&id, &stream[pos], 4);
+			memcpy(&energy, &stream[pos + 4], 8);
+			memcpy(&weight, &stream[pos + 12], 4);
+			EXPECT_EQ(nucleusId(1, 1), id);
+			EXPECT_DOUBLE_EQ(rows, energy);
+			EXPECT_FLOAT_EQ(2 * rows, weight);
+			pos += 16;
+			rows++;
+		}
+		batches++;
+	}
+	EXPECT_EQ(n, rows);
+	EXPECT_EQ(3, batches);
+	EXPECT_EQ(pos, stream.size());
+}
+
 int main(int argc, char **argv) {
 	::testing::InitGoogleTest(&argc, argv);
 	return RUN_ALL_TESTS();
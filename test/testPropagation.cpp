@@ -2,6 +2,23 @@
 #include "crpropa/ParticleID.h"
 #include "crpropa/module/SimplePropagation.h"
 #include "crpropa/module/PropagationCK.h"
+#include "crpropa/module/PropagationCKOffload.h"
+#include "crpropa/magneticField/MagneticFieldGrid.h"
+#include "crpropa/Random.h"
+#include "crpropa/Statistics.h"
+#include "crpropa/ModuleList.h"
+#include "crpropa/module/BreakCondition.h"
+#include "crpropa/module/Observer.h"
+#include "crpropa/module/ParticleCollector.h"
+#include "crpropa/module/Propagation1D.h"
+#include "crpropa/module/Redshift.h"
+#include "crpropa/Cosmology.h"
+#include "crpropa/module/PropagationBP.h"
+#include "crpropa/module/DiffusionSDE.h"
+#include "crpropa/module/AdiabaticCooling.h"
+#include "crpropa/advectionField/AdvectionField.h"
+#include "crpropa/magneticField/PlaneWaveTurbulence.h"
+#include "crpropa/massDistribution/ConstantDensity.h"
 
 #include "gtest/gtest.h"
 
@@ -31,6 +48,66 @@ TEST(testSimplePropagation, step) {
 	EXPECT_EQ(Vector3d(0,  1, 0), c.current.getDirection());
 }
 
+TEST(testSimplePropagation, freeStreaming) {
+	// a neutrino crosses 100 Mpc to the observer in two steps, a proton in 100
+	ModuleList modules;
+	SimplePropagation *propa = new SimplePropagation(0.1 * kpc, 1 * Mpc);
+	EXPECT_THROW(propa->setFreeStreaming(Module::NeutrinoClass, 0.1 * Mpc), std::runtime_error);
+	propa->setFreeStreaming(Module::NeutrinoClass);
+	EXPECT_EQ(Module::NeutrinoClass, propa->getFreeStreaming());
+	modules.add(propa);
+	Observer *obs = new Observer();
+	obs->add(new ObserverPoint());
+	modules.add(obs);
+
+	Candidate neutrino(12, 1 * EeV, Vector3d(100 * Mpc, 0, 0), Vector3d(-1, 0, 0));
+	neutrino.setNextStep(1 * Mpc);
+	modules.run(&neutrino);
+	EXPECT_FALSE(neutrino.isActive());
+	EXPECT_NEAR(0, neutrino.current.getPosition().x, 1 * kpc);
+	EXPECT_NEAR(100 * Mpc, neutrino.getTrajectoryLength(), 1 * kpc);
+
+	Candidate proton(nucleusId(1, 1), 1 * EeV, Vector3d(100 * Mpc, 0, 0), Vector3d(-1, 0, 0));
+	propa->process(&proton);
+	EXPECT_EQ(1 * Mpc, proton.getNextStep());
+	propa->process(&neutrino);
+	EXPECT_EQ(propa->getFreeStreamingStep(), neutrino.getNextStep());
+}
+
+TEST(testPropagation1D, compareModuleList) {
+	// same steps and adiabatic loss as SimplePropagation, Redshift and an observer
+	double D = 500 * Mpc;
+	double z = comovingDistance2Redshift(D);
+	ModuleList modules;
+	modules.add(new SimplePropagation(0.1 * kpc, 10 * Mpc));
+	modules.add(new Redshift());
+	Observer *obs = new Observer();
+	obs->add(new ObserverPoint());
+	modules.add(obs);
+	Candidate c1(nucleusId(1, 1), 10 * EeV, Vector3d(D, 0, 0), Vector3d(-1, 0, 0), z);
+	modules.run(&c1);
+
+	Propagation1D propa(0.1 * kpc, 10 * Mpc);
+	ParticleCollector *detected = new ParticleCollector();
+	propa.onDetection(detected);
+	Candidate c2(nucleusId(1, 1), 10 * EeV, Vector3d(D, 0, 0), Vector3d(-1, 0, 0), z);
+	while (c2.isActive())
+		propa.process(&c2);
+
+	EXPECT_EQ(1, detected->size());
+	EXPECT_NEAR(0, c2.current.getPosition().x, 1 * kpc);
+	EXPECT_NEAR(0, c2.getRedshift(), 1e-6);
+	EXPECT_NEAR(c1.current.getEnergy() / EeV, c2.current.getEnergy() / EeV, 1e-6);
+	EXPECT_NEAR(10 / (1 + z), c2.current.getEnergy() / EeV, 1e-3);
+
+	// stopped at the minimum energy, not detected
+	propa.setMinimumEnergy(9.9 * EeV);
+	Candidate c3(nucleusId(1, 1), 10 * EeV, Vector3d(D, 0, 0), Vector3d(-1, 0, 0), z);
+	while (c3.isActive())
+		propa.process(&c3);
+	EXPECT_EQ(1, detected->size());
+	EXPECT_GT(c3.current.getPosition().x, 0);
+}
 
 TEST(testPropagationCK, zeroField) {
 	PropagationCK propa(new UniformMagneticField(Vector3d(0, 0, 0)));
@@ -49,7 +126,7 @@ TEST(testPropagationCK, zeroField) {
 	propa.process(&c);
 
 	EXPECT_DOUBLE_EQ(minStep, c.getCurrentStep());  // perform minimum step
-	EXPECT_DOUBLE_EQ(5 * minStep, c.getNextStep());  // acceleration by factor 5
+	EXPECT_DOUBLE_EQ(propa.getMaximumStep(), c.getNextStep());  // analytic step in uniform field
 }
 
 TEST(testPropagationCK, proton) {
@@ -69,7 +146,7 @@ TEST(testPropagationCK, proton) {
 	propa.process(&c);
 
 	EXPECT_DOUBLE_EQ(minStep, c.getCurrentStep());  // perform minimum step
-	EXPECT_DOUBLE_EQ(5 * minStep, c.getNextStep());  // acceleration by factor 5
+	EXPECT_DOUBLE_EQ(propa.getMaximumStep(), c.getNextStep());  // analytic step in uniform field
 }
 
 TEST(testPropagationCK, neutron) {
@@ -92,6 +169,372 @@ TEST(testPropagationCK, neutron) {
 	EXPECT_EQ(Vector3d(0, 1, 0), c.current.getDirection());
 }
 
+class CountingMagneticField: public MagneticField {
+	Vector3d B;
+public:
+	mutable size_t count;
+	CountingMagneticField(const Vector3d &B) :
+			B(B), count(0) {
+	}
+	Vector3d getField(const Vector3d &pos) const {
+		count++;
+		return B;
+	}
+};
+
+TEST(testPropagationCK, reuseFirstStage) {
+	// rejected steps reuse the first stage: 1 + 5 field evaluations per attempt
+	ref_ptr<CountingMagneticField> field = new CountingMagneticField(Vector3d(0, 0, 1 * muG));
+	PropagationCK propa(field, 1e-6, 0.1 * kpc, 1 * Gpc);
+
+	ParticleState p;
+	p.setId(nucleusId(56, 26));
+	p.setEnergy(1 * EeV);
+	p.setPosition(Vector3d(0, 0, 0));
+	p.setDirection(Vector3d(0, 1, 0));
+	Candidate c(p);
+	c.setNextStep(100 * Mpc);
+
+	propa.process(&c);
+
+	EXPECT_LT(c.getCurrentStep(), 100 * Mpc);  // step has been rejected
+	EXPECT_GT(field->count, 6);
+	EXPECT_EQ(1, field->count % 5);
+}
+
+TEST(testPropagationCK, helix) {
+	// exact helix in a uniform field, compared to the numerical integration
+	double B = 1 * nG;
+	double E = 1 * EeV;
+	double rg = E / (eplus * c_light * B);
+	PropagationCK propa(new UniformMagneticField(Vector3d(0, 0, B)));
+
+	ParticleState p;
+	p.setId(nucleusId(1, 1));
+	p.setEnergy(E);
+	p.setPosition(Vector3d(0, 0, 0));
+	p.setDirection(Vector3d(0, 1, 1).getUnitVector());
+	Candidate c(p);
+	c.setNextStep(2 * M_PI * rg);  // one full turn
+	propa.process(&c);
+	EXPECT_NEAR(0, c.current.getPosition().x, 1e-9 * rg);
+	EXPECT_NEAR(0, c.current.getPosition().y, 1e-9 * rg);
+	EXPECT_NEAR(2 * M_PI * rg / sqrt(2.), c.current.getPosition().z, 1e-9 * rg);
+	EXPECT_NEAR(0, c.current.getDirection().x, 1e-9);
+
+	PropagationCK numeric(new CountingMagneticField(Vector3d(0, 0, B)), 1e-8);
+	Candidate c2(p);
+	c2.setNextStep(0);
+	while (c2.getTrajectoryLength() < rg) {
+		c2.setNextStep(std::min(c2.getNextStep(), rg - c2.getTrajectoryLength()));
+		numeric.process(&c2);
+	}
+	Candidate c3(p);
+	c3.setNextStep(rg);
+	propa.process(&c3);
+	EXPECT_NEAR(0, (c2.current.getPosition() - c3.current.getPosition()).getR(), 1e-6 * rg);
+	EXPECT_NEAR(0, (c2.current.getDirection() - c3.current.getDirection()).getR(), 1e-6);
+}
+
+TEST(testPropagationCK, processBatch) {
+	// the batched integration gives the same trajectories as process
+	PropagationCK propa(new PlaneWaveTurbulence(10 * nG, 10 * kpc, 1 * Mpc), 1e-4, 1 * kpc);
+
+	std::vector<ref_ptr<Candidate> > single, batch;
+	std::vector<Candidate *> pointers;
+	for (size_t i = 0; i < 8; i++) {
+		ParticleState p;
+		p.setId((i == 3) ? nucleusId(1, 0) : nucleusId(1 + 3 * i, 1 + i));
+		p.setEnergy((1 + i) * EeV);
+		p.setPosition(Vector3d(i * kpc, 0, 0));
+		p.setDirection(Vector3d(1, 1 + i, 0).getUnitVector());
+		single.push_back(new Candidate(p));
+		batch.push_back(new Candidate(p));
+		batch.back()->setRedshift((i < 5) ? 0 : 0.1);
+		single.back()->setRedshift((i < 5) ? 0 : 0.1);
+		pointers.push_back(batch.back());
+	}
+
+	for (size_t step = 0; step < 20; step++) {
+		for (size_t i = 0; i < single.size(); i++)
+			propa.process(single[i]);
+		propa.processBatch(&pointers[0], pointers.size());
+	}
+
+	for (size_t i = 0; i < single.size(); i++) {
+		Vector3d d = single[i]->current.getPosition() - batch[i]->current.getPosition();
+		EXPECT_NEAR(0, d.getR(), 1e-9 * single[i]->getTrajectoryLength());
+		EXPECT_NEAR(single[i]->getNextStep(), batch[i]->getNextStep(), 1e-6 * single[i]->getNextStep());
+		EXPECT_NEAR(single[i]->getTrajectoryLength(), batch[i]->getTrajectoryLength(), 1e-6 * single[i]->getTrajectoryLength());
+	}
+}
+
+// density increasing linearly along x
+class GradientDensity: public Density {
+public:
+	double getDensity(const Vector3d &position) const {
+		return 1e6 * (1 + position.x / kpc);
+	}
+};
+
+TEST(testPropagationCK, columnDensity) {
+	// the quadrature at the stages is exact for a linear density
+	PropagationCK propa(new UniformMagneticField(Vector3d(0, 0, 1 * nG)));
+	propa.setDensity(new GradientDensity());
+	Candidate neutron(nucleusId(1, 0), 1 * EeV, Vector3d(0, 0, 0), Vector3d(1, 0, 0));
+	neutron.setNextStep(10 * kpc);
+	propa.process(&neutron);
+	EXPECT_NEAR(1e6 * (10 * kpc + 50 * kpc), neutron.getColumnDensity(), 1e-9 * 60e6 * kpc);
+
+	// charged particles in uniform and structured fields: a constant density
+	// gives n * trajectory length, the batched integration the same as process
+	ref_ptr<ConstantDensity> n = new ConstantDensity(1e6, 0, 0);
+	n->setHI(true);
+	PropagationCK helix(new UniformMagneticField(Vector3d(0, 0, 1 * nG)));
+	helix.setDensity(n);
+	PropagationCK turbulent(new PlaneWaveTurbulence(10 * nG, 10 * kpc, 1 * Mpc), 1e-4, 1 * kpc);
+	turbulent.setDensity(n);
+	Candidate proton(nucleusId(1, 1), 1 * EeV, Vector3d(0, 0, 0), Vector3d(1, 1, 0).getUnitVector());
+	std::vector<ref_ptr<Candidate> > single, batch;
+	std::vector<Candidate *> pointers;
+	for (size_t i = 0; i < 4; i++) {
+		single.push_back(new Candidate(nucleusId(1, 1), (1 + i) * EeV, Vector3d(i * kpc, 0, 0), Vector3d(1, i, 0).getUnitVector()));
+		batch.push_back(single.back()->clone());
+		pointers.push_back(batch.back());
+	}
+	for (size_t step = 0; step < 10; step++) {
+		proton.setNextStep(1 * Mpc);
+		helix.process(&proton);
+		for (size_t i = 0; i < single.size(); i++)
+			turbulent.process(single[i]);
+		turbulent.processBatch(&pointers[0], pointers.size());
+	}
+	EXPECT_NEAR(1e6 * proton.getTrajectoryLength(), proton.getColumnDensity(), 1e-9 * proton.getColumnDensity());
+	for (size_t i = 0; i < single.size(); i++) {
+		EXPECT_NEAR(1e6 * single[i]->getTrajectoryLength(), single[i]->getColumnDensity(), 1e-9 * single[i]->getColumnDensity());
+		EXPECT_NEAR(single[i]->getColumnDensity(), batch[i]->getColumnDensity(), 1e-6 * single[i]->getColumnDensity());
+	}
+
+	// secondaries continue the column density of the parent
+	proton.addSecondary(nucleusId(1, 1), 0.5 * EeV);
+	EXPECT_DOUBLE_EQ(proton.getColumnDensity(), proton.secondaries[0]->getColumnDensity());
+}
+
+TEST(testPropagationCK, statistics) {
+	Statistics::setEnabled(true);
+	Statistics::reset();
+	ModuleList sim;
+	sim.add(new PropagationCK(new PlaneWaveTurbulence(10 * nG, 10 * kpc, 1 * Mpc), 1e-4, 1 * kpc, 100 * kpc));
+	sim.add(new MaximumTrajectoryLength(10 * Mpc));
+	Candidate c(nucleusId(1, 1), 1 * EeV, Vector3d(0, 0, 0), Vector3d(1, 0, 0));
+	sim.run(&c, false);
+	Statistics::setEnabled(false);
+
+	// every accepted step is in the histogram
+	size_t accepted = Statistics::getCount("PropagationCK: accepted steps");
+	EXPECT_GT(accepted, 0);
+	std::vector<double> h = Statistics::getHistogram("PropagationCK: step size [m]");
+	EXPECT_EQ(52, h.size());
+	EXPECT_EQ(53, Statistics::getHistogramEdges("PropagationCK: step size [m]").size());
+	double total = 0;
+	for (size_t i = 0; i < h.size(); i++)
+		total += h[i];
+	EXPECT_DOUBLE_EQ(accepted, total);
+
+	// each step is limited by the propagator or the trajectory length
+	std::string ck = sim[0]->getDescription();
+	std::string length = sim[1]->getDescription();
+	size_t limited = Statistics::getCount("ModuleList: next step limited by " + ck.substr(0, ck.find('\n')))
+			+ Statistics::getCount("ModuleList: next step limited by " + length.substr(0, length.find('\n')));
+	EXPECT_EQ(accepted, limited);
+
+	// disabled: nothing is counted
+	Statistics::reset();
+	Candidate d(nucleusId(1, 1), 1 * EeV, Vector3d(0, 0, 0), Vector3d(1, 0, 0));
+	sim.run(&d, false);
+	EXPECT_EQ(0, Statistics::getCount("PropagationCK: accepted steps"));
+	EXPECT_EQ(0, Statistics::getCount("unknown counter"));
+}
+
+TEST(testPropagationCKOffload, compareCK) {
+	// same trajectories as PropagationCK in a MagneticFieldGrid
+	ref_ptr<VectorGrid> grid = new VectorGrid(Vector3d(0.), 16, 10 * kpc);
+	Random random(42);
+	for (size_t ix = 0; ix < 16; ix++)
+		for (size_t iy = 0; iy < 16; iy++)
+			for (size_t iz = 0; iz < 16; iz++)
+				grid->get(ix, iy, iz) = Vector3f(random.randNorm(), random.randNorm(),
+						random.randNorm()) * float(muG);
+
+	PropagationCK propa(new MagneticFieldGrid(grid), 1e-4, 0.1 * kpc);
+	PropagationCKOffload offload(grid, 1e-4, 0.1 * kpc);
+
+	std::vector<ref_ptr<Candidate> > single, batch;
+	std::vector<Candidate *> pointers;
+	for (size_t i = 0; i < 4; i++) {
+		ParticleState p;
+		p.setId((i == 2) ? nucleusId(1, 0) : nucleusId(1, 1));
+		p.setEnergy((1 + i) * EeV);
+		p.setPosition(Vector3d(i * kpc, 0, 0));
+		p.setDirection(Vector3d(1, 1 + i, 0).getUnitVector());
+		single.push_back(new Candidate(p));
+		batch.push_back(new Candidate(p));
+		pointers.push_back(batch.back());
+	}
+
+	// the grid is interpolated in single precision by MagneticFieldGrid,
+	// the step sizes of the two diverge slowly
+	for (size_t i = 0; i < single.size(); i++) {
+		single[i]->setNextStep(50 * kpc);
+		batch[i]->setNextStep(50 * kpc);
+		propa.process(single[i]);
+	}
+	offload.processBatch(&pointers[0], pointers.size());
+
+	for (size_t i = 0; i < single.size(); i++) {
+		double step = single[i]->getCurrentStep();
+		EXPECT_NEAR(step, batch[i]->getCurrentStep(), 1e-5 * step);
+		Vector3d d = single[i]->current.getPosition() - batch[i]->current.getPosition();
+		EXPECT_NEAR(0, d.getR(), 1e-5 * step);
+		EXPECT_NEAR(single[i]->getNextStep(), batch[i]->getNextStep(), 1e-3 * step);
+	}
+}
+
+TEST(testPropagationBP, neutron) {
+	PropagationBP propa(new UniformMagneticField(Vector3d(0, 0, 1 * nG)));
+	propa.setMinimumStep(1 * kpc);
+	propa.setMaximumStep(42 * Mpc);
+
+	ParticleState p;
+	p.setId(nucleusId(1, 0));
+	p.setEnergy(100 * EeV);
+	p.setPosition(Vector3d(0, 0, 0));
+	p.setDirection(Vector3d(0, 1, 0));
+	Candidate c(p);
+
+	propa.process(&c);
+
+	EXPECT_DOUBLE_EQ(1 * kpc, c.getCurrentStep());
+	EXPECT_DOUBLE_EQ(42 * Mpc, c.getNextStep());
+	EXPECT_EQ(Vector3d(0, 1 * kpc, 0), c.current.getPosition());
+	EXPECT_EQ(Vector3d(0, 1, 0), c.current.getDirection());
+}
+
+TEST(testPropagationBP, gyration) {
+	// a proton follows its gyro-circle, the step control follows the gyro-radius
+	double B = 1 * nG;
+	double E = 1 * EeV;
+	double rg = E / (eplus * c_light * B);
+	double step = rg / 100;
+
+	PropagationBP fixed(new UniformMagneticField(Vector3d(0, 0, B)), 0, step, step);
+	ParticleState p;
+	p.setId(nucleusId(1, 1));
+	p.setEnergy(E);
+	p.setPosition(Vector3d(0, 0, 0));
+	p.setDirection(Vector3d(0, 1, 0));
+	Candidate c(p);
+
+	Vector3d center(rg, 0, 0);
+	for (size_t i = 0; i < 628; i++) {
+		fixed.process(&c);
+		EXPECT_NEAR(rg, (c.current.getPosition() - center).getR(), 1e-4 * rg);
+	}
+	EXPECT_DOUBLE_EQ(step, c.getCurrentStep());
+	EXPECT_DOUBLE_EQ(step, c.getNextStep());
+	EXPECT_DOUBLE_EQ(E, c.current.getEnergy());
+	EXPECT_NEAR(0, c.current.getPosition().getR(), 0.01 * rg);  // one full turn
+
+	PropagationBP adaptive(new UniformMagneticField(Vector3d(0, 0, B)), 1e-4, 1 * pc, 1 * Gpc);
+	c.setNextStep(0.1 * rg);
+	adaptive.process(&c);
+	EXPECT_DOUBLE_EQ(0.1 * rg, c.getCurrentStep());
+	EXPECT_NEAR(pow(12e-4, 1. / 3.) * rg, c.getNextStep(), 1e-6 * rg);
+}
+
+TEST(testDiffusionSDE, processBatch) {
+	// with the same random numbers a batch of one candidate reproduces process
+	ref_ptr<MagneticField> field = new MagneticDipoleField(Vector3d(0.), Vector3d(0, 0, 1e33), 10 * pc);
+	DiffusionSDE diffusion(field, 1e-6, 1 * pc, 1 * kpc, 0.1);
+
+	ParticleState p;
+	p.setId(nucleusId(1, 1));
+	p.setEnergy(10 * TeV);
+	p.setPosition(Vector3d(1 * kpc, 0, 0));
+	Candidate c1(p), c2(p);
+	Candidate *pointer = &c2;
+
+	Random::seedThreads(7);
+	for (size_t i = 0; i < 20; i++)
+		diffusion.process(&c1);
+	Random::seedThreads(7);
+	for (size_t i = 0; i < 20; i++)
+		diffusion.processBatch(&pointer, 1);
+	EXPECT_EQ(c1.current.getPosition(), c2.current.getPosition());
+	EXPECT_EQ(c1.getNextStep(), c2.getNextStep());
+
+	// a larger batch: along a uniform field without perpendicular diffusion
+	DiffusionSDE parallel(new UniformMagneticField(Vector3d(0, 0, 1 * nG)), 1e-4, 1 * pc, 1 * kpc, 0);
+	std::vector<ref_ptr<Candidate> > batch;
+	std::vector<Candidate *> pointers;
+	for (size_t i = 0; i < 8; i++) {
+		p.setPosition(Vector3d(i * pc, 0, 0));
+		p.setId((i == 5) ? nucleusId(1, 0) : nucleusId(1, 1));
+		batch.push_back(new Candidate(p));
+		pointers.push_back(batch.back());
+	}
+	for (size_t i = 0; i < 10; i++)
+		parallel.processBatch(&pointers[0], pointers.size());
+	for (size_t i = 0; i < batch.size(); i++) {
+		if (i == 5)
+			continue;  // neutral
+		EXPECT_DOUBLE_EQ(i * pc, batch[i]->current.getPosition().x);
+		EXPECT_EQ(0, batch[i]->current.getPosition().y);
+		EXPECT_NE(0, batch[i]->current.getPosition().z);
+	}
+}
+
+TEST(testDiffusionSDE, adiabaticCooling) {
+	// fused with the step, against a separate AdiabaticCooling module
+	ref_ptr<MagneticField> field = new UniformMagneticField(Vector3d(0, 0, 1 * muG));
+	ref_ptr<AdvectionField> wind = new ConstantSphericalAdvectionField(Vector3d(0.), 1e6);
+	DiffusionSDE fused(field, wind, 1e-4, 1 * pc, 10 * pc, 0.1);
+	EXPECT_THROW(DiffusionSDE(field).setAdiabaticCooling(), std::runtime_error);
+	fused.setAdiabaticCooling(true, 0.01);
+	EXPECT_TRUE(fused.getAdiabaticCooling());
+	DiffusionSDE diffusion(field, wind, 1e-4, 1 * pc, 10 * pc, 0.1);
+	AdiabaticCooling cooling(wind, 0.01);
+
+	ParticleState p;
+	p.setId(nucleusId(1, 1));
+	p.setEnergy(10 * TeV);
+	p.setPosition(Vector3d(1 * kpc, 0, 0));
+	Candidate c1(p), c2(p), c3(p);
+	c1.setNextStep(10 * pc);
+	c2.setNextStep(10 * pc);
+	c3.setNextStep(10 * pc);
+
+	Random::seedThreads(11);
+	fused.process(&c1);
+	Random::seedThreads(11);
+	diffusion.process(&c2);
+	cooling.process(&c2);
+	EXPECT_NEAR(0, (c1.current.getPosition() - c2.current.getPosition()).getR(), 1e-6 * pc);
+	// the divergence 2 v / R at the start of the step
+	double dt = c1.getCurrentStep() / c_light;
+	EXPECT_DOUBLE_EQ(10 * TeV * (1 - 2e6 / (3 * kpc) * dt), c1.current.getEnergy());
+	EXPECT_NEAR(1, (10 * TeV - c1.current.getEnergy()) / (10 * TeV - c2.current.getEnergy()), 0.05);
+	EXPECT_DOUBLE_EQ(c2.getNextStep(), c1.getNextStep());
+
+	// the batch evaluates the field and divergence of all candidates at once
+	Candidate *pointer = &c3;
+	Random::seedThreads(11);
+	fused.processBatch(&pointer, 1);
+	EXPECT_EQ(c1.current.getPosition(), c3.current.getPosition());
+	EXPECT_EQ(c1.current.getEnergy(), c3.current.getEnergy());
+	EXPECT_EQ(c1.getNextStep(), c3.getNextStep());
+}
+
 int main(int argc, char **argv) {
 	::testing::InitGoogleTest(&argc, argv);
 	return RUN_ALL_TESTS();
@@ -1,6 +1,8 @@
 #include "crpropa/Source.h"
+#include "crpropa/EmissionMap.h"
 #include "crpropa/Units.h"
 #include "crpropa/ParticleID.h"
+#include "crpropa/module/Observer.h"
 
 #include "gtest/gtest.h"
 #include <stdexcept>
@@ -113,6 +115,55 @@ TEST(SourceSNRDistribution, simpleTest) {
 	EXPECT_NEAR(0., Z_mean, 0.1);
 }
 
+TEST(SourcePulsarDistribution, tableSampling) {
+	// Test if the sampled heights follow the exponential profile and the
+	// radii stay within the table
+	SourcePulsarDistribution pulsar;
+	EXPECT_EQ(1024, pulsar.get_tableResolution());
+	pulsar.set_tableResolution(64);
+	pulsar.set_rBlur(0);
+	EXPECT_THROW(pulsar.set_tableResolution(0), std::runtime_error);
+
+	std::vector<ParticleState> states(100000);
+	std::vector<ParticleState *> particles(states.size());
+	for (size_t i = 0; i < states.size(); i++)
+		particles[i] = &states[i];
+	pulsar.prepareParticles(&particles[0], particles.size());
+
+	double absZ_mean = 0;
+	for (size_t i = 0; i < states.size(); i++) {
+		Vector3d pos = states[i].getPosition();
+		EXPECT_GE(22 * kpc, sqrt(pos.x * pos.x + pos.y * pos.y) * (1 - 1e-12));
+		EXPECT_GE(5 * kpc, fabs(pos.z));
+		absZ_mean += fabs(pos.z) / kpc;
+	}
+	absZ_mean /= states.size();
+	EXPECT_NEAR(0.3, absZ_mean, 0.01);
+}
+
+TEST(SourceBacktracking, antiparticlesLeavingTheSphere) {
+	SourceBacktracking backtracking(Vector3d(1, 0, 0) * kpc, 1 * pc);
+	ParticleState p;
+	double cosine = 0;
+	int n = 10000;
+	for (int i = 0; i < n; i++) {
+		p.setId(nucleusId(1, 1));
+		backtracking.prepareParticle(p);
+		Vector3d normal = (p.getPosition() - Vector3d(1, 0, 0) * kpc) / pc;
+		EXPECT_NEAR(1, normal.getR(), 1e-9);
+		EXPECT_EQ(-nucleusId(1, 1), p.getId());
+		cosine += normal.dot(p.getDirection()) / normal.getR();
+	}
+	// the mean cosine of the Lambert distribution is 2/3
+	EXPECT_NEAR(2. / 3, cosine / n, 0.01);
+
+	// neutral particles are kept
+	p.setId(22);
+	backtracking.prepareParticle(p);
+	EXPECT_EQ(22, p.getId());
+	EXPECT_THROW(SourceBacktracking(Vector3d(0.), -1), std::runtime_error);
+}
+
 TEST(SourceDensityGrid, withInRange) {
 	// Create a grid with 10^3 cells ranging from (0, 0, 0) to (10, 10, 10)
 	Vector3d origin(0, 0, 0);
@@ -179,6 +230,35 @@ TEST(SourceDensityGrid, OneAllowedCell) {
 	EXPECT_NEAR(1, mean.z, 0.2);
 }
 
+TEST(SourceDensityGrid, gridUnchangedAndProportional) {
+	// Test if the grid is kept and positions follow the density
+	ref_ptr<ScalarGrid> grid = new ScalarGrid(Vector3d(0.), 2, 1.);
+	for (int ix = 0; ix < 2; ix++)
+		for (int iy = 0; iy < 2; iy++)
+			for (int iz = 0; iz < 2; iz++)
+				grid->get(ix, iy, iz) = 0;
+	grid->get(1, 0, 1) = 1;
+	grid->get(0, 1, 0) = 3;
+
+	SourceDensityGrid source(grid);
+	EXPECT_EQ(1, grid->get(1, 0, 1));
+	EXPECT_EQ(3, grid->get(0, 1, 0));
+	EXPECT_EQ(0, grid->get(1, 1, 1));
+
+	ParticleState p;
+	int n = 10000, n101 = 0, n010 = 0;
+	for (int i = 0; i < n; i++) {
+		source.prepareParticle(p);
+		Vector3d pos = p.getPosition();
+		if ((pos.x > 1) && (pos.y < 1) && (pos.z > 1))
+			n101++;
+		if ((pos.x < 1) && (pos.y > 1) && (pos.z < 1))
+			n010++;
+	}
+	EXPECT_EQ(n, n101 + n010);
+	EXPECT_NEAR(0.25, double(n101) / n, 0.03);
+}
+
 TEST(SourceDensityGrid1D, withInRange) {
 	// Create a grid with 10 cells ranging from 0 to 10
 	Vector3d origin(0, 0, 0);
@@ -283,6 +363,19 @@ TEST(SourceGenericComposition, simpleTest) {
 	EXPECT_NEAR((float)id1Count/(float)id2Count, 0.1, 0.01);
 	EXPECT_NEAR((float)ElowCount/(float)EhighCount, 1.25, 0.1);
 }
+
+TEST(SourceGenericComposition, nucleusCDF) {
+	// Test if the expression is evaluated with the A and Z of each isotope
+	SourceGenericComposition source(1, 2, "A + 0 * E", 10);
+	source.add(nucleusId(4, 2), 1);
+	source.add(nucleusId(12, 6), 1);
+	std::vector<double> cdf = source.getNucleusCDF(nucleusId(12, 6));
+	ASSERT_EQ(11, cdf.size());
+	EXPECT_DOUBLE_EQ(0, cdf[0]);
+	EXPECT_NEAR(12, cdf[10], 1e-12);
+	EXPECT_NEAR(4, source.getNucleusCDF(nucleusId(4, 2))[10], 1e-12);
+	EXPECT_TRUE(source.getNucleusCDF(nucleusId(1, 1)).empty());
+}
 #endif
 
 TEST(SourceComposition, throwNoIsotope) {
@@ -353,6 +446,101 @@ TEST(Source, allPropertiesUsed) {
 	EXPECT_EQ(Vector3d(10, 0, 0) * Mpc, p.getPosition());
 }
 
+TEST(Source, getCandidatesAsGetCandidate) {
+	// Test if a batch of candidates equals candidates drawn one by one.
+	// The features are applied one after the other to the whole batch, so
+	// the random numbers only agree for a single random feature.
+	Source source;
+	source.add(new SourceParticleType(nucleusId(8, 4)));
+	source.add(new SourceUniformSphere(Vector3d(1, 0, 0) * Mpc, 2 * Mpc));
+	source.add(new SourceEnergy(10 * EeV));
+	source.add(new SourceRedshift1D());
+
+	Source spectrum;
+	spectrum.add(new SourcePowerLawSpectrum(5 * EeV, 100 * EeV, -2));
+
+	Random::seedThreads(42);
+	std::vector<ref_ptr<Candidate> > single, singleSpectrum;
+	for (int i = 0; i < 10; i++)
+		single.push_back(source.getCandidate());
+	for (int i = 0; i < 10; i++)
+		singleSpectrum.push_back(spectrum.getCandidate());
+	Random::seedThreads(42);
+	std::vector<ref_ptr<Candidate> > batch, batchSpectrum;
+	source.getCandidates(10, batch);
+	spectrum.getCandidates(10, batchSpectrum);
+
+	ASSERT_EQ(10, batch.size());
+	ASSERT_EQ(10, batchSpectrum.size());
+	for (int i = 0; i < 10; i++) {
+		EXPECT_EQ(nucleusId(8, 4), batch[i]->current.getId());
+		EXPECT_EQ(single[i]->source.getPosition(), batch[i]->source.getPosition());
+		EXPECT_EQ(single[i]->source.getPosition(), batch[i]->current.getPosition());
+		EXPECT_EQ(single[i]->created.getPosition(), batch[i]->previous.getPosition());
+		EXPECT_DOUBLE_EQ(10 * EeV, batch[i]->created.getEnergy());
+		EXPECT_DOUBLE_EQ(single[i]->getRedshift(), batch[i]->getRedshift());
+		EXPECT_DOUBLE_EQ(singleSpectrum[i]->current.getEnergy(),
+				batchSpectrum[i]->current.getEnergy());
+	}
+}
+
+// sets the energy of each candidate to its index in the batch
+class BatchEnergy: public BatchSourceFeature {
+public:
+	mutable size_t calls;
+	BatchEnergy() : calls(0) {
+	}
+	void prepareCandidateVector(const std::vector<Candidate *> &candidates) const {
+		calls++;
+		for (size_t i = 0; i < candidates.size(); i++) {
+			candidates[i]->source.setEnergy(i * EeV);
+			candidates[i]->current = candidates[i]->source;
+		}
+	}
+};
+
+TEST(BatchSourceFeature, getCandidates) {
+	Source source;
+	ref_ptr<BatchEnergy> energy = new BatchEnergy();
+	source.add(energy);
+	std::vector<ref_ptr<Candidate> > batch;
+	source.getCandidates(5, batch);
+	EXPECT_EQ(1, energy->calls);
+	ASSERT_EQ(5, batch.size());
+	EXPECT_DOUBLE_EQ(4 * EeV, batch[4]->current.getEnergy());
+	source.getCandidate();
+	EXPECT_EQ(2, energy->calls);
+}
+
+TEST(SourceEmissionMap, sampling) {
+	ref_ptr<EmissionMap> em = new EmissionMap(36, 18, 10, 1 * EeV, 100 * EeV);
+	ParticleState p(1, 50 * EeV, Vector3d(0.), Vector3d(1, 0, 0));
+	em->fillMap(p);
+	ref_ptr<CylindricalProjectionMap> cpm = em->getMap(1, 50 * EeV);
+	size_t bin = cpm->binFromDirection(Vector3d(1, 0, 0));
+
+	Source source;
+	source.add(new SourceParticleType(1));
+	source.add(new SourceEnergy(50 * EeV));
+	source.add(new SourceIsotropicEmission());
+	source.add(new SourceEmissionMap(em, true));
+	for (int i = 0; i < 10; i++) {
+		// the direction is drawn from the only bin, weighted with its solid angle
+		ref_ptr<Candidate> c = source.getCandidate();
+		EXPECT_TRUE(c->isActive());
+		EXPECT_EQ(bin, cpm->binFromDirection(c->current.getDirection()));
+		EXPECT_EQ(bin, cpm->binFromDirection(c->created.getDirection()));
+		EXPECT_DOUBLE_EQ(1. / (36 * 18), c->getWeight());
+	}
+
+	// no map for this energy
+	ref_ptr<Source> other = new Source;
+	other->add(new SourceParticleType(1));
+	other->add(new SourceEnergy(5 * EeV));
+	other->add(new SourceEmissionMap(em, true));
+	EXPECT_FALSE(other->getCandidate()->isActive());
+}
+
 TEST(SourceList, simpleTest) {
 	// test if source list works with one source
 	SourceList sourceList;
@@ -394,6 +582,114 @@ TEST(SourceList, luminosity) {
 	EXPECT_NEAR(80, meanE, 4); // this test can stochastically fail
 }
 
+TEST(SourceList, adaptive) {
+	// the faint source is the only one detected
+	SourceList sourceList;
+	ref_ptr<Source> bright = new Source;
+	bright->add(new SourceEnergy(100));
+	sourceList.add(bright, 80);
+	ref_ptr<Source> faint = new Source;
+	faint->add(new SourceEnergy(1));
+	sourceList.add(faint, 20);
+	sourceList.setAdaptive(1000, 0.1);
+	ref_ptr<AdaptiveSourceSampling> sampling = sourceList.getAdaptiveSampling();
+	ObserverSourceEfficiency efficiency(sampling);
+
+	// pilot, each detection also of a secondary
+	for (int i = 0; i < 1000; i++) {
+		ref_ptr<Candidate> c = sourceList.getCandidate();
+		EXPECT_DOUBLE_EQ(1, c->getWeight());
+		if (c->created.getEnergy() == 1) {
+			c->addSecondary(22, 0.5);
+			efficiency.onDetection(c->secondaries[0]);
+		}
+	}
+	EXPECT_FALSE(sampling->isAdapted());
+	EXPECT_DOUBLE_EQ(0, sampling->getEfficiency(0));
+	EXPECT_DOUBLE_EQ(1, sampling->getEfficiency(1));
+
+	// q = 0.9 + 0.1 * 0.2 for the faint source, its weight 0.2 / q
+	std::vector<ref_ptr<Candidate> > candidates;
+	sourceList.getCandidates(10000, candidates);
+	EXPECT_TRUE(sampling->isAdapted());
+	EXPECT_NEAR(0.92, sampling->getProbability(1), 1e-12);
+	double faintWeight = 0, faintCount = 0;
+	for (size_t i = 0; i < candidates.size(); i++) {
+		if (candidates[i]->created.getEnergy() != 1)
+			continue;
+		faintWeight += candidates[i]->getWeight();
+		faintCount++;
+	}
+	EXPECT_NEAR(0.92, faintCount / 10000, 0.02); // this test can stochastically fail
+	EXPECT_NEAR(0.2, faintWeight / 10000, 0.005);
+}
+
+TEST(SourceMultiplePositions, adaptive) {
+	ref_ptr<SourceMultiplePositions> positions = new SourceMultiplePositions;
+	positions->add(Vector3d(1, 0, 0), 0.25);
+	positions->add(Vector3d(2, 0, 0), 0.75);
+	positions->setAdaptive(100, 0.5);
+	Source source;
+	source.add(positions);
+	ObserverSourceEfficiency efficiency(positions->getAdaptiveSampling());
+	for (int i = 0; i < 100; i++) {
+		ref_ptr<Candidate> c = source.getCandidate();
+		if (c->current.getPosition().x == 1)
+			efficiency.onDetection(c);
+	}
+	// q = 0.5 + 0.5 * 0.25 of the first position
+	ref_ptr<Candidate> c = source.getCandidate();
+	EXPECT_NEAR(0.625, positions->getAdaptiveSampling()->getProbability(0), 1e-12);
+	double expected = (c->current.getPosition().x == 1) ? 0.25 / 0.625 : 0.75 / 0.375;
+	EXPECT_DOUBLE_EQ(expected, c->getWeight());
+	EXPECT_EQ(c->current.getPosition(), c->source.getPosition());
+}
+
+TEST(ArraySource, columns) {
+	// records of an external generator, read in place
+	struct Primary {
+		double energy;
+		double position[3];
+		int id;
+	} primaries[3];
+	double directions[9] = {0, 0, 1, 0, 2, 0, 3, 0, 0};
+	double weights[3] = {1, 2, 3};
+	for (int i = 0; i < 3; i++) {
+		primaries[i].energy = (i + 1) * EeV;
+		primaries[i].position[0] = i;
+		primaries[i].position[1] = 2 * i;
+		primaries[i].position[2] = 3 * i;
+		primaries[i].id = 22 + i;
+	}
+	ArraySource source(3);
+	source.setIds(&primaries[0].id, sizeof(Primary));
+	source.setEnergies(&primaries[0].energy, sizeof(Primary));
+	source.setPositions(primaries[0].position, sizeof(Primary));
+	source.setDirections(directions);
+	source.setWeights(weights);
+	EXPECT_EQ(3, source.size());
+
+	ref_ptr<Candidate> c = source.getCandidate();
+	EXPECT_EQ(22, c->current.getId());
+	EXPECT_DOUBLE_EQ(1 * EeV, c->source.getEnergy());
+	EXPECT_EQ(Vector3d(0, 0, 1), c->current.getDirection());
+	EXPECT_DOUBLE_EQ(0, c->getRedshift());
+
+	std::vector<ref_ptr<Candidate> > candidates;
+	source.getCandidates(5, candidates);
+	ASSERT_EQ(2, candidates.size());
+	EXPECT_EQ(24, candidates[1]->created.getId());
+	EXPECT_EQ(Vector3d(2, 4, 6), candidates[1]->current.getPosition());
+	EXPECT_EQ(Vector3d(2, 4, 6), candidates[1]->previous.getPosition());
+	EXPECT_EQ(Vector3d(1, 0, 0), candidates[1]->current.getDirection());
+	EXPECT_DOUBLE_EQ(3, candidates[1]->getWeight());
+	EXPECT_FALSE(source.getCandidate().valid()); // after the last primary
+
+	source.rewind();
+	EXPECT_EQ(22, source.getCandidate()->current.getId());
+	EXPECT_THROW(source.getCandidate(3), std::out_of_range);
+}
+
 int main(int argc, char **argv) {
 	::testing::InitGoogleTest(&argc, argv);
 	return RUN_ALL_TESTS();
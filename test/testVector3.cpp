@@ -154,6 +154,22 @@ TEST(Vector3, parallelPerpendicular) {
 	EXPECT_DOUBLE_EQ(vperp.z, 1);
 }
 
+TEST(PaddedVector3, sameAsVector3) {
+	Vector3d v(3, 2, 1), w(-1, 4, 2);
+	PaddedVector3d pv(v), pw(w);
+
+	Vector3d sum = pv + pw * 2;
+	EXPECT_EQ(v + w * 2, sum);
+	Vector3d difference = PaddedVector3d(pv).addScaled(pw, -1);
+	EXPECT_EQ(v - w, difference);
+	Vector3d cross = pv.cross(pw);
+	EXPECT_EQ(v.cross(w), cross);
+	EXPECT_DOUBLE_EQ(v.dot(w), pv.dot(pw));
+	EXPECT_DOUBLE_EQ(v.getR(), pv.getR());
+	// the padding lane stays 0
+	EXPECT_EQ(0, pv.cross(pw).v[3]);
+}
+
 int main(int argc, char **argv) {
 	::testing::InitGoogleTest(&argc, argv);
 	return RUN_ALL_TESTS();